@@ -0,0 +1,85 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <malloc.h>
+
+#include "alloc_counter.hpp"
+
+// NOTE(milo): Replacing the global operator new lets us count allocations in any library (OpenCV,
+// Eigen, GTSAM) without instrumenting it. Only the benchmark executable links this file.
+static std::atomic<uint64_t> g_num_allocations{0};
+
+// NOTE(milo): Bytes are counted with malloc_usable_size(), so that delete doesn't need to be told
+// the size. This includes malloc's rounding up, which is what the process actually pays for.
+static std::atomic<int64_t> g_live_bytes{0};
+static std::atomic<int64_t> g_peak_live_bytes{0};
+
+
+void* operator new(std::size_t size)
+{
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+
+  const int64_t bytes = static_cast<int64_t>(malloc_usable_size(ptr));
+  const int64_t live = g_live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  int64_t peak = g_peak_live_bytes.load(std::memory_order_relaxed);
+  while (live > peak && !g_peak_live_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+
+  return ptr;
+}
+
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+
+void operator delete(void* ptr) noexcept
+{
+  if (ptr != nullptr) {
+    g_live_bytes.fetch_sub(static_cast<int64_t>(malloc_usable_size(ptr)), std::memory_order_relaxed);
+  }
+  std::free(ptr);
+}
+
+
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { operator delete(ptr); }
+
+
+namespace bm {
+namespace bench {
+
+
+uint64_t NumAllocations()
+{
+  return g_num_allocations.load(std::memory_order_relaxed);
+}
+
+
+int64_t NumLiveBytes()
+{
+  return g_live_bytes.load(std::memory_order_relaxed);
+}
+
+
+int64_t PeakLiveBytes()
+{
+  return g_peak_live_bytes.load(std::memory_order_relaxed);
+}
+
+
+void ResetPeakLiveBytes()
+{
+  g_peak_live_bytes.store(NumLiveBytes(), std::memory_order_relaxed);
+}
+
+
+}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+#include <benchmark/benchmark.h>
+
+namespace bm {
+namespace bench {
+
+
+// Total number of heap allocations (operator new) made by this process so far.
+uint64_t NumAllocations();
+
+// Bytes allocated with operator new that haven't been deleted yet, and the most there have been
+// since the process started (or since ResetPeakLiveBytes()). Memory from plain malloc() isn't
+// counted (e.g cv::Mat data, which uses cv::fastMalloc()).
+int64_t NumLiveBytes();
+int64_t PeakLiveBytes();
+void ResetPeakLiveBytes();
+
+
+// Counts the allocations made between construction and Report(), and reports them as an
+// "allocs_per_op" counter averaged over all benchmark iterations.
+class AllocationCounter final {
+ public:
+  AllocationCounter() : start_(NumAllocations()) {}
+
+  void Report(benchmark::State& state)
+  {
+    const double allocs = static_cast<double>(NumAllocations() - start_);
+    state.counters["allocs_per_op"] = benchmark::Counter(allocs, benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  uint64_t start_;
+};
+
+
+// Tracks the heap used by a benchmark: "peak_mb" is the most that was live at once (above what
+// was live at construction), and "retained_mb" is what is still live at Report() (i.e the state
+// that the benchmark kept, like a graph or a triangulation).
+class MemoryCounter final {
+ public:
+  MemoryCounter() : start_(NumLiveBytes()) { ResetPeakLiveBytes(); }
+
+  void Report(benchmark::State& state)
+  {
+    const double mb = 1024.0 * 1024.0;
+    state.counters["peak_mb"] = static_cast<double>(PeakLiveBytes() - start_) / mb;
+    state.counters["retained_mb"] = static_cast<double>(NumLiveBytes() - start_) / mb;
+  }
+
+ private:
+  int64_t start_;
+};
+
+
+}
+}
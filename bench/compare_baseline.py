@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""
+Compare two Google Benchmark JSON outputs (e.g a saved baseline and the current commit).
+
+Usage:
+  python3 compare_baseline.py baseline.json current.json [--threshold 0.10]
+
+Prints the change in real time, and allocations per op for every benchmark that appears in both
+files. Exits with code 1 if any benchmark got slower by more than the threshold (fractional), or
+if any "error_*" counter (e.g the model fit errors from imaging_bench.cpp) grew by more than the
+error threshold, so that a speedup can't hide a worse fit.
+"""
+import argparse
+import json
+import sys
+
+
+def load(path):
+  with open(path) as f:
+    data = json.load(f)
+
+  out = {}
+  for b in data["benchmarks"]:
+    # With --benchmark_repetitions, only compare the median.
+    if b.get("run_type") == "aggregate" and b.get("aggregate_name") != "median":
+      continue
+    name = b.get("run_name", b["name"])
+    out[name] = b
+  return out
+
+
+def main():
+  parser = argparse.ArgumentParser()
+  parser.add_argument("baseline")
+  parser.add_argument("current")
+  parser.add_argument("--threshold", type=float, default=0.10)
+  parser.add_argument("--error-threshold", type=float, default=0.05)
+  args = parser.parse_args()
+
+  baseline = load(args.baseline)
+  current = load(args.current)
+
+  print("{:<50} {:>14} {:>14} {:>9} {:>12}".format("benchmark", "baseline", "current", "change", "allocs/op"))
+
+  regressions = []
+  error_regressions = []
+  for name in sorted(set(baseline) & set(current)):
+    b, c = baseline[name], current[name]
+    change = (c["real_time"] - b["real_time"]) / max(b["real_time"], 1e-12)
+    allocs = "{:.1f} -> {:.1f}".format(b.get("allocs_per_op", 0), c.get("allocs_per_op", 0))
+    print("{:<50} {:>11.3f} {:>2} {:>11.3f} {:>2} {:>+8.1%} {:>12}".format(
+        name, b["real_time"], b["time_unit"], c["real_time"], c["time_unit"], change, allocs))
+    if change > args.threshold:
+      regressions.append(name)
+
+    for counter in sorted(k for k in b if k.startswith("error_") and k in c):
+      error_change = (c[counter] - b[counter]) / max(abs(b[counter]), 1e-12)
+      print("  {:<48} {:>14.6f} {:>14.6f} {:>+8.1%}".format(counter, b[counter], c[counter], error_change))
+      if error_change > args.error_threshold:
+        error_regressions.append("{} ({})".format(name, counter))
+
+  for name in sorted(set(baseline) - set(current)):
+    print("{:<50} (missing from current)".format(name))
+
+  if regressions:
+    print("\nREGRESSIONS (> {:.0%} slower): {}".format(args.threshold, ", ".join(regressions)))
+  if error_regressions:
+    print("\nERROR REGRESSIONS (> {:.0%} higher): {}".format(
+        args.error_threshold, ", ".join(error_regressions)))
+  return 1 if (regressions or error_regressions) else 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
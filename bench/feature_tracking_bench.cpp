@@ -0,0 +1,139 @@
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "vision_core/cv_types.hpp"
+#include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/feature_tracker.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+
+#include "alloc_counter.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+using namespace bench;
+
+
+static Image1b LoadGray(const std::string& filepath)
+{
+  const Image1b im = cv::imread(filepath, cv::IMREAD_GRAYSCALE);
+  CHECK(!im.empty()) << "Could not load benchmark image: " << filepath << std::endl;
+  return im;
+}
+
+
+static void BM_FeatureDetectorDetect(benchmark::State& state)
+{
+  const Image1b iml = LoadGray("./resources/caddy_32_left.jpg");
+
+  FeatureDetector::Params params;
+  FeatureDetector detector(params);
+
+  const VecPoint2f tracked_kp;
+  VecPoint2f new_kp;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    new_kp.clear();
+    detector.Detect(iml, tracked_kp, new_kp);
+    benchmark::DoNotOptimize(new_kp.data());
+  }
+  allocs.Report(state);
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  state.counters["keypoints"] = new_kp.size();
+}
+BENCHMARK(BM_FeatureDetectorDetect)->Unit(benchmark::kMillisecond);
+
+
+static void BM_FeatureTrackerTrack(benchmark::State& state)
+{
+  const Image1b iml = LoadGray("./resources/caddy_32_left.jpg");
+  const Image1b imr = LoadGray("./resources/caddy_32_right.jpg");
+  const bool bidirectional = state.range(0) != 0;
+
+  FeatureDetector::Params dparams;
+  FeatureDetector detector(dparams);
+  FeatureTracker::Params tparams;
+  FeatureTracker tracker(tparams);
+
+  VecPoint2f empty_kp, left_kp;
+  detector.Detect(iml, empty_kp, left_kp);
+
+  VecPoint2f right_kp;
+  std::vector<uchar> status;
+  std::vector<float> error;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    right_kp.clear();
+    tracker.Track(iml, imr, left_kp, right_kp, status, error, bidirectional);
+    benchmark::DoNotOptimize(right_kp.data());
+  }
+  allocs.Report(state);
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  state.counters["keypoints"] = left_kp.size();
+}
+BENCHMARK(BM_FeatureTrackerTrack)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+
+// Same as above, but with pyramids built ahead of time (what StereoTracker does when retracking).
+static void BM_FeatureTrackerTrackPyramid(benchmark::State& state)
+{
+  const Image1b iml = LoadGray("./resources/caddy_32_left.jpg");
+  const Image1b imr = LoadGray("./resources/caddy_32_right.jpg");
+  const bool bidirectional = state.range(0) != 0;
+
+  FeatureDetector::Params dparams;
+  FeatureDetector detector(dparams);
+  FeatureTracker::Params tparams;
+  FeatureTracker tracker(tparams);
+
+  VecPoint2f empty_kp, left_kp;
+  detector.Detect(iml, empty_kp, left_kp);
+
+  const ImagePyramid pyr_l = tracker.BuildPyramid(iml);
+  const ImagePyramid pyr_r = tracker.BuildPyramid(imr);
+
+  VecPoint2f right_kp;
+  std::vector<uchar> status;
+  std::vector<float> error;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    right_kp.clear();
+    tracker.Track(pyr_l, pyr_r, left_kp, right_kp, status, error, bidirectional);
+    benchmark::DoNotOptimize(right_kp.data());
+  }
+  allocs.Report(state);
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  state.counters["keypoints"] = left_kp.size();
+}
+BENCHMARK(BM_FeatureTrackerTrackPyramid)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+
+static void BM_StereoMatcherMatchRectified(benchmark::State& state)
+{
+  const Image1b iml = LoadGray("./resources/farmsim_01_left.png");
+  const Image1b imr = LoadGray("./resources/farmsim_01_right.png");
+
+  FeatureDetector::Params dparams;
+  FeatureDetector detector(dparams);
+  StereoMatcher::Params mparams;
+  mparams.parallel = state.range(0) != 0;
+  StereoMatcher matcher(mparams);
+
+  VecPoint2f empty_kp, left_kp;
+  detector.Detect(iml, empty_kp, left_kp);
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    const std::vector<double> disp = matcher.MatchRectified(iml, imr, left_kp);
+    benchmark::DoNotOptimize(disp.data());
+  }
+  allocs.Report(state);
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  state.counters["keypoints"] = left_kp.size();
+}
+BENCHMARK(BM_StereoMatcherMatchRectified)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
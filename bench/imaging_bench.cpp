@@ -0,0 +1,235 @@
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/math_util.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/image_util.hpp"
+#include "imaging/attenuation.hpp"
+#include "imaging/backscatter.hpp"
+#include "imaging/enhance.hpp"
+#include "imaging/illuminant.hpp"
+
+#include "alloc_counter.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+using namespace bench;
+
+
+// Same args as in test/imaging/enhance_test.cpp.
+static const int kBackNumPx = 256;
+static const int kBackOptIters = 10;
+static const int kBetaNumPx = 256;
+static const int kBetaOptIters = 20;
+
+
+// Image and range map pairs in resources/test_images_enhance (the first is used for the per-stage
+// benchmarks).
+static const std::vector<std::pair<std::string, std::string>> kEnhanceFrames = {
+  { "images/3374_bluegreen.png", "depth/depth_3374.exr" },
+  { "images/3047.png", "depth/depth_3047.exr" },
+  { "images/3390.png", "depth/depth_3390.exr" },
+  { "images/4856_neutral.png", "depth/depth_4856.exr" }
+};
+
+
+// Loads one frame of test_images_enhance, resized to scale_pct percent. The range maps were saved
+// at a lower resolution, so they're resized to match the image.
+static void LoadEnhanceFrame(size_t i, int scale_pct, Image3f& bgr, Image1f& range)
+{
+  const std::string folder = "./resources/test_images_enhance/";
+  const Image3b raw = cv::imread(folder + kEnhanceFrames.at(i).first, cv::IMREAD_COLOR);
+  range = cv::imread(folder + kEnhanceFrames.at(i).second, cv::IMREAD_ANYDEPTH);
+  CHECK(!raw.empty() && !range.empty()) << "Could not load benchmark images" << std::endl;
+
+  bgr = CastImage3bTo3f(raw);
+
+  const cv::Size size(raw.cols * scale_pct / 100, raw.rows * scale_pct / 100);
+  cv::resize(bgr, bgr, size, 0, 0, cv::INTER_AREA);
+
+  // NOTE(milo): Averaging would mix missing range (zero) into its neighbors.
+  cv::resize(range, range, size, 0, 0, cv::INTER_NEAREST);
+}
+
+
+// Everything EnhanceUnderwater() computes on the way to the output, so that each benchmark can
+// start from the inputs of its stage.
+struct EnhanceStages final {
+  Image3f bgr;
+  Image1f range;
+  Image1b is_dark;
+  EUInfo info;
+  Image3f D;
+  Image3f il;
+};
+
+
+static EnhanceStages RunEnhanceStages(int scale_pct)
+{
+  EnhanceStages s;
+  LoadEnhanceFrame(0, scale_pct, s.bgr, s.range);
+
+  // NOTE(milo): The estimators sample pixels with std::random_shuffle, so reseed before each one
+  // to keep the errors repeatable.
+  FindDarkFast(ComputeIntensity(s.bgr), s.range, 0.01, s.is_dark);
+  InitialBackscatterGuess(s.info);
+  std::srand(0);
+  s.info.error_backscatter = EstimateBackscatter(
+      s.bgr, s.range, s.is_dark, kBackNumPx, kBackOptIters,
+      s.info.B, s.info.beta_B, s.info.Jp, s.info.beta_Dp);
+
+  s.D = RemoveBackscatter(s.bgr, s.range, s.info.B, s.info.beta_B);
+  s.il = EstimateIlluminantRangeGuided(s.D, s.range, core::NextEvenInt(s.D.cols / 3), 0.01, 8);
+
+  s.info.beta_D = BetaInitialGuess1();
+  ClampBetaD(s.info.beta_D);
+  std::srand(0);
+  s.info.error_attenuation = EstimateBeta(s.range, s.il, kBetaNumPx, kBetaOptIters, s.info.beta_D);
+
+  return s;
+}
+
+
+static void ReportImageRate(benchmark::State& state, const EnhanceStages& s)
+{
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  state.counters["pixels"] = static_cast<double>(s.bgr.rows * s.bgr.cols);
+}
+
+
+// Each stage of EnhanceUnderwater() on the first frame. The arg is the image scale in percent.
+static void BM_EnhanceFindDark(benchmark::State& state)
+{
+  const EnhanceStages s = RunEnhanceStages(static_cast<int>(state.range(0)));
+  const Image1f intensity = ComputeIntensity(s.bgr);
+  Image1b is_dark;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(FindDarkFast(intensity, s.range, 0.01, is_dark));
+  }
+  allocs.Report(state);
+  ReportImageRate(state, s);
+}
+BENCHMARK(BM_EnhanceFindDark)->Arg(100)->Arg(50)->Arg(25)->Unit(benchmark::kMillisecond);
+
+
+static void BM_EnhanceEstimateBackscatter(benchmark::State& state)
+{
+  const EnhanceStages s = RunEnhanceStages(static_cast<int>(state.range(0)));
+
+  AllocationCounter allocs;
+  float error = 0;
+  for (auto _ : state) {
+    EUInfo info;
+    InitialBackscatterGuess(info);
+    std::srand(0);
+    error = EstimateBackscatter(
+        s.bgr, s.range, s.is_dark, kBackNumPx, kBackOptIters,
+        info.B, info.beta_B, info.Jp, info.beta_Dp);
+    benchmark::DoNotOptimize(error);
+  }
+  allocs.Report(state);
+  ReportImageRate(state, s);
+  state.counters["error_backscatter"] = error;
+}
+BENCHMARK(BM_EnhanceEstimateBackscatter)->Arg(100)->Arg(50)->Arg(25)->Unit(benchmark::kMillisecond);
+
+
+static void BM_EnhanceIlluminant(benchmark::State& state)
+{
+  const EnhanceStages s = RunEnhanceStages(static_cast<int>(state.range(0)));
+  const int r = core::NextEvenInt(s.D.cols / 3);
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    const Image3f il = EstimateIlluminantRangeGuided(s.D, s.range, r, 0.01, 8);
+    benchmark::DoNotOptimize(il.data);
+  }
+  allocs.Report(state);
+  ReportImageRate(state, s);
+}
+BENCHMARK(BM_EnhanceIlluminant)->Arg(100)->Arg(50)->Arg(25)->Unit(benchmark::kMillisecond);
+
+
+static void BM_EnhanceEstimateBeta(benchmark::State& state)
+{
+  const EnhanceStages s = RunEnhanceStages(static_cast<int>(state.range(0)));
+
+  AllocationCounter allocs;
+  float error = 0;
+  for (auto _ : state) {
+    Vector12f beta_D = BetaInitialGuess1();
+    ClampBetaD(beta_D);
+    std::srand(0);
+    error = EstimateBeta(s.range, s.il, kBetaNumPx, kBetaOptIters, beta_D);
+    benchmark::DoNotOptimize(error);
+  }
+  allocs.Report(state);
+  ReportImageRate(state, s);
+  state.counters["error_attenuation"] = error;
+}
+BENCHMARK(BM_EnhanceEstimateBeta)->Arg(100)->Arg(50)->Arg(25)->Unit(benchmark::kMillisecond);
+
+
+static void BM_EnhanceCorrectAttenuation(benchmark::State& state)
+{
+  const EnhanceStages s = RunEnhanceStages(static_cast<int>(state.range(0)));
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    const Image3f J = CorrectAttenuation(s.D, s.range, s.info.beta_D);
+    benchmark::DoNotOptimize(J.data);
+  }
+  allocs.Report(state);
+  ReportImageRate(state, s);
+}
+BENCHMARK(BM_EnhanceCorrectAttenuation)->Arg(100)->Arg(50)->Arg(25)->Unit(benchmark::kMillisecond);
+
+
+// The whole EnhanceUnderwater() over every frame, with the model estimated at estimate_scale (the
+// arg, in percent) and applied at full resolution. The errors are averaged over the frames, and
+// compare_baseline.py flags them if the fit gets worse.
+static void BM_EnhanceUnderwater(benchmark::State& state)
+{
+  const float estimate_scale = static_cast<float>(state.range(0)) / 100.0f;
+
+  std::vector<Image3f> bgrs(kEnhanceFrames.size());
+  std::vector<Image1f> ranges(kEnhanceFrames.size());
+  for (size_t i = 0; i < kEnhanceFrames.size(); ++i) {
+    LoadEnhanceFrame(i, 100, bgrs.at(i), ranges.at(i));
+  }
+
+  AllocationCounter allocs;
+  double error_backscatter = 0;
+  double error_attenuation = 0;
+  for (auto _ : state) {
+    error_backscatter = 0;
+    error_attenuation = 0;
+    for (size_t i = 0; i < bgrs.size(); ++i) {
+      std::srand(0);
+      Image3f J;
+      const EUInfo info = EnhanceUnderwater(
+          bgrs.at(i), ranges.at(i), kBackNumPx, kBackOptIters, kBetaNumPx, kBetaOptIters,
+          BetaInitialGuess1(), J, estimate_scale);
+      benchmark::DoNotOptimize(J.data);
+      error_backscatter += info.error_backscatter;
+      error_attenuation += info.error_attenuation;
+    }
+  }
+  allocs.Report(state);
+  state.counters["images_per_sec"] = benchmark::Counter(
+      state.iterations() * bgrs.size(), benchmark::Counter::kIsRate);
+  state.counters["error_backscatter"] = error_backscatter / bgrs.size();
+  state.counters["error_attenuation"] = error_attenuation / bgrs.size();
+}
+BENCHMARK(BM_EnhanceUnderwater)->Arg(100)->Arg(50)->Arg(25)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <opencv2/core.hpp>
+
+#include "core/uid.hpp"
+#include "feature_tracking/feature_tracks.hpp"
+#include "mesher/delaunay.hpp"
+#include "mesher/landmark_graph.hpp"
+#include "mesher/object_mesher.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_image.hpp"
+
+#include "alloc_counter.hpp"
+
+using namespace bm;
+using namespace mesher;
+using namespace bench;
+
+
+// One frame of ObjectMesher::ProcessStereo() updates: N landmarks (the arg) on a line, each one
+// voting on the edges to its next 8 neighbors, with 5% of the landmarks replaced every frame.
+static void BM_LandmarkGraphFrame(benchmark::State& state)
+{
+  const int num_lmks = static_cast<int>(state.range(0));
+
+  LandmarkGraph graph(2.0f);
+  core::uid_t next_id = num_lmks;
+  std::vector<core::uid_t> ids(num_lmks);
+  for (int i = 0; i < num_lmks; ++i) {
+    ids.at(i) = i;
+  }
+
+  std::srand(0);
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    for (int i = 0; i < num_lmks; ++i) {
+      for (int j = i + 1; j < std::min(num_lmks, i + 9); ++j) {
+        const float increment = (std::rand() % 4 == 0) ? -1.0f : 1.0f;
+        graph.UpdateEdge(ids.at(i), ids.at(j), increment, 0.0f, 4.0f);
+      }
+    }
+
+    for (int k = 0; k < num_lmks / 20; ++k) {
+      const int i = std::rand() % num_lmks;
+      graph.RemoveLandmark(ids.at(i));
+      ids.at(i) = next_id++;
+      graph.AddLandmark(ids.at(i));
+    }
+
+    benchmark::DoNotOptimize(graph.GetClusters(2.0f));
+  }
+  allocs.Report(state);
+}
+BENCHMARK(BM_LandmarkGraphFrame)->Arg(100)->Arg(200)->Arg(400)->Unit(benchmark::kMicrosecond);
+
+
+// Landmarks that move by up to half a pixel per frame, with 5% of them replaced every frame.
+static void JitterLandmarks(std::vector<cv::Point2f>& pts, std::vector<core::uid_t>& ids,
+                            core::uid_t& next_id, std::vector<core::uid_t>& removed)
+{
+  removed.clear();
+  for (cv::Point2f& pt : pts) {
+    pt.x = std::min(639.0f, std::max(0.0f, pt.x + static_cast<float>(std::rand() % 101 - 50) / 100.0f));
+    pt.y = std::min(479.0f, std::max(0.0f, pt.y + static_cast<float>(std::rand() % 101 - 50) / 100.0f));
+  }
+  for (size_t k = 0; k < pts.size() / 20; ++k) {
+    const size_t i = std::rand() % pts.size();
+    removed.emplace_back(ids.at(i));
+    ids.at(i) = next_id++;
+    pts.at(i) = cv::Point2f(std::rand() % 640, std::rand() % 480);
+  }
+}
+
+
+static void InitLandmarks(int num_lmks, std::vector<cv::Point2f>& pts, std::vector<core::uid_t>& ids)
+{
+  std::srand(0);
+  pts.resize(num_lmks);
+  ids.resize(num_lmks);
+  for (int i = 0; i < num_lmks; ++i) {
+    ids.at(i) = i;
+    pts.at(i) = cv::Point2f(std::rand() % 640, std::rand() % 480);
+  }
+}
+
+
+// Updating one Delaunay2D per frame, vs. building a new one (like a new cv::Subdiv2D) per frame.
+static void BM_Delaunay2DUpdate(benchmark::State& state)
+{
+  std::vector<cv::Point2f> pts;
+  std::vector<core::uid_t> ids;
+  InitLandmarks(static_cast<int>(state.range(0)), pts, ids);
+  core::uid_t next_id = ids.size();
+
+  Delaunay2D tri(cv::Rect(0, 0, 640, 480));
+  std::vector<core::uid_t> removed;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    JitterLandmarks(pts, ids, next_id, removed);
+
+    for (const core::uid_t lmk_id : removed) {
+      tri.Remove(lmk_id);
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+      if (!tri.Move(ids.at(i), pts.at(i))) { tri.Insert(ids.at(i), pts.at(i)); }
+    }
+    benchmark::DoNotOptimize(tri.GetTriangles());
+  }
+  allocs.Report(state);
+}
+BENCHMARK(BM_Delaunay2DUpdate)->Arg(100)->Arg(200)->Arg(400)->Unit(benchmark::kMicrosecond);
+
+
+static void BM_Delaunay2DRebuild(benchmark::State& state)
+{
+  std::vector<cv::Point2f> pts;
+  std::vector<core::uid_t> ids;
+  InitLandmarks(static_cast<int>(state.range(0)), pts, ids);
+  core::uid_t next_id = ids.size();
+  std::vector<core::uid_t> removed;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    JitterLandmarks(pts, ids, next_id, removed);
+
+    Delaunay2D tri(cv::Rect(0, 0, 640, 480));
+    for (size_t i = 0; i < ids.size(); ++i) {
+      tri.Insert(ids.at(i), pts.at(i));
+    }
+    benchmark::DoNotOptimize(tri.GetTriangles());
+  }
+  allocs.Report(state);
+}
+BENCHMARK(BM_Delaunay2DRebuild)->Arg(100)->Arg(200)->Arg(400)->Unit(benchmark::kMicrosecond);
+
+
+// A synthetic scene for ObjectMesher::ProcessTracks(): num_lmks landmarks in num_clusters vertical
+// strips of the image, with each strip at a different depth. Edges within a strip are kept, and
+// edges across strips fail edge_max_depth_change, so the graph has about num_clusters clusters.
+// Every frame, the landmarks move by up to half a pixel and churn_percent of them are replaced.
+class SyntheticTracks final {
+ public:
+  SyntheticTracks(int num_lmks, int num_clusters, int churn_percent, const StereoCamera& stereo_rig)
+      : num_clusters_(num_clusters),
+        churn_percent_(churn_percent),
+        ids_(num_lmks),
+        pts_(num_lmks)
+  {
+    std::srand(0);
+    for (int i = 0; i < num_clusters; ++i) {
+      // Strips are 1.5m apart (edge_max_depth_change is 1m by default).
+      disps_.emplace_back(stereo_rig.DepthToDisp(2.0 + 1.5 * i));
+    }
+    for (int i = 0; i < num_lmks; ++i) {
+      ids_.at(i) = next_id_++;
+      pts_.at(i) = RandomPoint(i);
+    }
+  }
+
+  // Moves the landmarks to the next frame, and updates the tracks to match.
+  void NextFrame(core::uid_t camera_id, FeatureTracks& tracks)
+  {
+    expired_.clear();
+    for (size_t i = 0; i < pts_.size(); ++i) {
+      if ((std::rand() % 100) < churn_percent_) {
+        expired_.emplace_back(ids_.at(i));
+        tracks.Remove(ids_.at(i));
+        ids_.at(i) = next_id_++;
+        pts_.at(i) = RandomPoint(i);
+      } else {
+        cv::Point2f& pt = pts_.at(i);
+        const cv::Rect strip = Strip(i);
+        pt.x = std::min<float>(strip.x + strip.width - 1, std::max<float>(strip.x, pt.x + Jitter()));
+        pt.y = std::min(479.0f, std::max(0.0f, pt.y + Jitter()));
+      }
+      tracks.AddObservation(ids_.at(i), camera_id, pts_.at(i), disps_.at(i % num_clusters_));
+    }
+  }
+
+  const std::vector<core::uid_t>& Expired() const { return expired_; }
+
+ private:
+  // Landmark i is always in strip (i % num_clusters).
+  cv::Rect Strip(size_t i) const
+  {
+    const int width = 640 / num_clusters_;
+    return cv::Rect(static_cast<int>(i % num_clusters_) * width, 0, width, 480);
+  }
+
+  cv::Point2f RandomPoint(size_t i) const
+  {
+    const cv::Rect strip = Strip(i);
+    return cv::Point2f(strip.x + std::rand() % strip.width, std::rand() % strip.height);
+  }
+
+  static float Jitter() { return static_cast<float>(std::rand() % 101 - 50) / 100.0f; }
+
+  int num_clusters_;
+  int churn_percent_;
+  core::uid_t next_id_ = 0;
+  std::vector<core::uid_t> ids_;
+  std::vector<cv::Point2f> pts_;
+  std::vector<double> disps_;
+  std::vector<core::uid_t> expired_;
+};
+
+
+// One frame of ObjectMesher::ProcessTracks() for (num_lmks, num_clusters, churn_percent), with
+// the time in each stage of the mesher, and the memory that it uses.
+static void BM_ObjectMesherTracks(benchmark::State& state)
+{
+  const int num_lmks = static_cast<int>(state.range(0));
+  const int num_clusters = static_cast<int>(state.range(1));
+  const int churn_percent = static_cast<int>(state.range(2));
+
+  ObjectMesher::Params params;
+  params.use_own_tracker = false;
+  params.stereo_rig = StereoCamera(PinholeCamera(400.0, 400.0, 320.0, 240.0, 480, 640), 0.2);
+
+  // Random texture, so that the whole image is foreground and only depth splits the clusters.
+  Image1b texture(480, 640);
+  cv::randu(texture, 0, 256);
+
+  SyntheticTracks synthetic(num_lmks, num_clusters, churn_percent, params.stereo_rig);
+  FeatureTracks tracks;
+  core::uid_t camera_id = 0;
+
+  MemoryCounter memory;
+  ObjectMesher mesher(params);
+
+  // Edges need min_obs_connect_edge frames in a row before they're in a cluster.
+  for (int k = 0; k < 5; ++k, ++camera_id) {
+    synthetic.NextFrame(camera_id, tracks);
+    mesher.ProcessTracks(StereoImage1b(camera_id, camera_id, texture, texture), tracks, 0, &synthetic.Expired());
+  }
+
+  MesherStageTimes total;
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    state.PauseTiming();
+    synthetic.NextFrame(camera_id, tracks);
+    const StereoImage1b stereo_pair(camera_id, camera_id, texture, texture);
+    ++camera_id;
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(mesher.ProcessTracks(stereo_pair, tracks, 0, &synthetic.Expired()));
+
+    const MesherStageTimes& times = mesher.LastStageTimes();
+    total.ms_foreground += times.ms_foreground;
+    total.ms_graph += times.ms_graph;
+    total.ms_clusters += times.ms_clusters;
+    total.ms_triangulate += times.ms_triangulate;
+    total.ms_build_mesh += times.ms_build_mesh;
+    total.ms_merge += times.ms_merge;
+    total.num_clusters += times.num_clusters;
+    total.num_triangles += times.num_triangles;
+  }
+  allocs.Report(state);
+  memory.Report(state);
+
+  const auto avg = benchmark::Counter::kAvgIterations;
+  state.counters["ms_foreground"] = benchmark::Counter(total.ms_foreground, avg);
+  state.counters["ms_graph"] = benchmark::Counter(total.ms_graph, avg);
+  state.counters["ms_clusters"] = benchmark::Counter(total.ms_clusters, avg);
+  state.counters["ms_triangulate"] = benchmark::Counter(total.ms_triangulate, avg);
+  state.counters["ms_build_mesh"] = benchmark::Counter(total.ms_build_mesh, avg);
+  state.counters["ms_merge"] = benchmark::Counter(total.ms_merge, avg);
+  state.counters["clusters"] = benchmark::Counter(total.num_clusters, avg);
+  state.counters["triangles"] = benchmark::Counter(total.num_triangles, avg);
+}
+
+
+static void ObjectMesherArgs(benchmark::internal::Benchmark* b)
+{
+  for (const int num_lmks : { 100, 500, 1000, 2000, 5000 }) {
+    for (const int num_clusters : { 1, 8, 32 }) {
+      for (const int churn_percent : { 0, 5, 20 }) {
+        b->Args({ num_lmks, num_clusters, churn_percent });
+      }
+    }
+  }
+}
+BENCHMARK(BM_ObjectMesherTracks)->Apply(ObjectMesherArgs)->Unit(benchmark::kMillisecond);
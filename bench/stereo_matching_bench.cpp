@@ -0,0 +1,200 @@
+#include <cmath>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/cv_types.hpp"
+#include "stereo_matching/patchmatch.hpp"
+#include "stereo_matching/patchmatch_cpu.hpp"
+#include "stereo_matching/stereo_matching.hpp"
+
+#include "alloc_counter.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace stereo;
+using namespace bench;
+
+
+template <typename ImageT>
+static float L1CostFunction(const ImageT& pl, const ImageT& pr)
+{
+  cv::Mat diff;
+  cv::absdiff(pl, pr, diff);
+  return (float)cv::mean(diff)[0];
+}
+
+
+// Same cost as in test/stereo_matching/patchmatch_test.cpp.
+static float L1GradientCostFunction(const Image1b& pl,
+                                    const Image1b& pr,
+                                    const Image1f& gl,
+                                    const Image1f& gr)
+{
+  const float alpha = 0.7;
+  const float tau_color = 50.0;
+  const float tau_grad = 20.0;
+
+  const float error_color = std::fmin(L1CostFunction<Image1b>(pl, pr), tau_color);
+  const float error_grad = std::fmin(L1CostFunction<Image1f>(gl, gr), tau_grad);
+
+  return alpha * error_color + (1 - alpha) * error_grad;
+}
+
+
+static void ComputeGradient(const Image1b& im, Image1f& gmag)
+{
+  cv::Mat Dx, Dy;
+  cv::Sobel(im, Dx, CV_32F, 1, 0, 3);
+  cv::Sobel(im, Dy, CV_32F, 0, 1, 3);
+  cv::pow(Dx, 2, Dx);
+  cv::pow(Dy, 2, Dy);
+  cv::sqrt(Dx + Dy, gmag);
+}
+
+
+// One Patchmatch propagation pass over a half-resolution farmsim image pair. The patch size is
+// the benchmark arg.
+static void BM_PatchmatchPropagate(benchmark::State& state)
+{
+  Image1b iml = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  Image1b imr = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  CHECK(!iml.empty() && !imr.empty()) << "Could not load benchmark images" << std::endl;
+  cv::resize(iml, iml, iml.size() / 2);
+  cv::resize(imr, imr, imr.size() / 2);
+
+  const int patch_size = static_cast<int>(state.range(0));
+
+  Patchmatch::Params params;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.bidirectional = true;
+  Patchmatch pm(params);
+
+  Image1f Gl, Gr;
+  ComputeGradient(iml, Gl);
+  ComputeGradient(imr, Gr);
+
+  const Image1f disp0 = pm.Initialize(iml, imr, 1);
+  Image1f disp;
+
+  // Fixed seed so that every run propagates from the same noisy initialization.
+  // NOTE(milo): allocs_per_op also counts any allocations made by AddNoise().
+  cv::theRNG().state = 123;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    state.PauseTiming();
+    disp0.copyTo(disp);
+    pm.AddNoise(disp, 8.0, disp > 0);
+    state.ResumeTiming();
+
+    pm.Propagate(iml, imr, Gl, Gr, disp, L1GradientCostFunction, patch_size, patch_size);
+    benchmark::DoNotOptimize(disp.data);
+  }
+  allocs.Report(state);
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_PatchmatchPropagate)->Arg(3)->Arg(5)->Unit(benchmark::kMillisecond);
+
+
+// Same as BM_PatchmatchPropagate, but with the PatchmatchCpu engine (gives the same output).
+static void BM_PatchmatchCpuPropagate(benchmark::State& state)
+{
+  Image1b iml = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  Image1b imr = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  CHECK(!iml.empty() && !imr.empty()) << "Could not load benchmark images" << std::endl;
+  cv::resize(iml, iml, iml.size() / 2);
+  cv::resize(imr, imr, imr.size() / 2);
+
+  const int patch_size = static_cast<int>(state.range(0));
+
+  Patchmatch::Params params;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.bidirectional = true;
+  Patchmatch pm(params);
+  PatchmatchCpu<L1GradientCost> pm_cpu;
+
+  Image1f Gl, Gr;
+  ComputeGradient(iml, Gl);
+  ComputeGradient(imr, Gr);
+
+  const Image1f disp0 = pm.Initialize(iml, imr, 1);
+  Image1f disp;
+
+  cv::theRNG().state = 123;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    state.PauseTiming();
+    disp0.copyTo(disp);
+    pm.AddNoise(disp, 8.0, disp > 0);
+    state.ResumeTiming();
+
+    pm_cpu.Propagate(iml, imr, Gl, Gr, disp, patch_size, patch_size);
+    benchmark::DoNotOptimize(disp.data);
+  }
+  allocs.Report(state);
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_PatchmatchCpuPropagate)->Arg(3)->Arg(5)->Unit(benchmark::kMillisecond);
+
+
+// Dense disparity for the whole (half resolution) image with each DenseStereo backend:
+// 0 = SgmCensus (8 paths), 1 = OpenCV StereoSGBM. Both search disparities 0 to 64.
+static void BM_DenseStereo(benchmark::State& state)
+{
+  Image1b iml = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  Image1b imr = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  CHECK(!iml.empty() && !imr.empty()) << "Could not load benchmark images" << std::endl;
+  cv::resize(iml, iml, iml.size() / 2);
+  cv::resize(imr, imr, imr.size() / 2);
+
+  DenseStereoParams params;
+  params.method = (state.range(0) == 0) ? "sgm_census" : "opencv_sgbm";
+  params.sgm_params.matcher_params.max_disp = 64;
+  std::unique_ptr<DenseStereo> stereo = CreateDenseStereo(params);
+
+  // Warm up (SgmCensus allocates its buffers on the first image).
+  stereo->ComputeDisparity(iml, imr);
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    const Image1f disp = stereo->ComputeDisparity(iml, imr);
+    benchmark::DoNotOptimize(disp.data);
+  }
+  allocs.Report(state);
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_DenseStereo)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+
+// SgmCensus inside of the dilated ForegroundTextureMask ROI only. Reports the fraction of the image
+// in the ROI, since the speedup over BM_DenseStereo/0 depends on it.
+static void BM_DenseStereoForegroundRoi(benchmark::State& state)
+{
+  Image1b iml = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  Image1b imr = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  CHECK(!iml.empty() && !imr.empty()) << "Could not load benchmark images" << std::endl;
+  cv::resize(iml, iml, iml.size() / 2);
+  cv::resize(imr, imr, imr.size() / 2);
+
+  SgmCensus::Params params;
+  params.matcher_params.max_disp = 64;
+  SgmCensus sgm(params);
+
+  const ForegroundRoi roi = EstimateForegroundRoi(iml, 8, 12, 25.0, 4);
+  sgm.ComputeDisparity(iml, imr, roi);
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    const Image1f disp = sgm.ComputeDisparity(iml, imr, roi);
+    benchmark::DoNotOptimize(disp.data);
+  }
+  allocs.Report(state);
+  state.counters["roi_fraction"] = static_cast<double>(roi.Area()) / static_cast<double>(iml.total());
+  state.counters["images_per_sec"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_DenseStereoForegroundRoi)->Unit(benchmark::kMillisecond);
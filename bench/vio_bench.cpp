@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "core/eigen_types.hpp"
+#include "core/imu_measurement.hpp"
+#include "core/timestamp.hpp"
+#include "vio/ekf_kernels.hpp"
+#include "vio/imu_manager.hpp"
+#include "vio/state_ekf.hpp"
+
+#include "alloc_counter.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+using namespace bench;
+
+
+// A deterministic 200Hz IMU stream for a body that is slowly rotating and accelerating. Gravity is
+// +y in the RDF frame, so a stationary IMU would read (0, -9.81, 0).
+static std::vector<ImuMeasurement> SyntheticImuStream(size_t N, seconds_t t0 = 1.0, seconds_t dt = 0.005)
+{
+  std::vector<ImuMeasurement> out;
+  out.reserve(N);
+  for (size_t i = 0; i < N; ++i) {
+    const double t = t0 + i * dt;
+    const Vector3d w(0.1 * std::sin(t), 0.2 * std::cos(0.5 * t), 0.05);
+    const Vector3d a(0.3 * std::cos(t), -9.81 + 0.1 * std::sin(2 * t), 0.2);
+    out.emplace_back(ConvertToNanoseconds(t), w, a);
+  }
+  return out;
+}
+
+
+static void BM_StateEkfPredictAndUpdateImu(benchmark::State& state)
+{
+  const std::vector<ImuMeasurement> imu = SyntheticImuStream(2000);
+
+  StateEkf::Params params;
+  params.reapply_measurements_after_init = false;
+  StateEkf filter(params);
+
+  const State s0(Vector3d::Zero(), Vector3d::Zero(), Vector3d::Zero(),
+                 Quaterniond::Identity(), Vector3d::Zero(),
+                 0.1 * StateCovariance::Identity());
+
+  // The filter only predicts forward in time, so re-initialize whenever the stream runs out.
+  size_t i = imu.size();
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    if (i == imu.size()) {
+      state.PauseTiming();
+      filter.Initialize(StateStamped(ConvertToSeconds(imu.front().timestamp) - 0.005, s0), kZeroImuBias);
+      i = 0;
+      state.ResumeTiming();
+    }
+    benchmark::DoNotOptimize(filter.PredictAndUpdate(imu.at(i++), false));
+  }
+  allocs.Report(state);
+}
+BENCHMARK(BM_StateEkfPredictAndUpdateImu);
+
+
+// Rewind the filter by N IMU measurements (the benchmark arg) and re-apply them, which is what
+// happens whenever a smoother result arrives. N=40 is 0.2 sec of smoother latency at 200Hz.
+static void BM_StateEkfRewindAndReapply(benchmark::State& state)
+{
+  const size_t N = static_cast<size_t>(state.range(0));
+  const std::vector<ImuMeasurement> imu = SyntheticImuStream(1000);
+
+  StateEkf::Params params;
+  StateEkf filter(params);
+
+  const State s0(Vector3d::Zero(), Vector3d::Zero(), Vector3d::Zero(),
+                 Quaterniond::Identity(), Vector3d::Zero(),
+                 0.1 * StateCovariance::Identity());
+  filter.Initialize(StateStamped(ConvertToSeconds(imu.front().timestamp) - 0.005, s0), kZeroImuBias);
+  for (const ImuMeasurement& m : imu) {
+    filter.PredictAndUpdate(m, true);
+  }
+
+  const seconds_t rewind_time = ConvertToSeconds(imu.at(imu.size() - N).timestamp);
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    filter.Rewind(rewind_time);
+    filter.ReapplyImu();
+    benchmark::DoNotOptimize(filter.GetTimestamp());
+  }
+  allocs.Report(state);
+}
+BENCHMARK(BM_StateEkfRewindAndReapply)->Arg(40)->Arg(200);
+
+
+template <typename Scalar>
+static EkfCovariance<Scalar> BenchCovariance()
+{
+  const EkfCovariance<Scalar> A = EkfCovariance<Scalar>::Random();
+  return A * A.transpose() + Scalar(0.1) * EkfCovariance<Scalar>::Identity();
+}
+
+
+// One covariance propagation step (F * P * F' + dt * Q) at IMU rate.
+template <typename Scalar>
+static void BM_EkfPropagateCovariance(benchmark::State& state)
+{
+  const EkfCovariance<Scalar> P0 = BenchCovariance<Scalar>();
+  const EkfCovariance<Scalar> Q = Scalar(1e-3) * EkfCovariance<Scalar>::Identity();
+  const Eigen::Matrix<Scalar, 3, 3> R_dq = Eigen::AngleAxis<Scalar>(Scalar(0.01), Eigen::Matrix<Scalar, 3, 1>::UnitZ()).toRotationMatrix();
+  const Eigen::Matrix<Scalar, 3, 3> G = Eigen::Matrix<Scalar, 3, 3>::Identity();
+  EkfCovariance<Scalar> P1;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    PropagateCovariance<Scalar>(P0, Scalar(0.005), R_dq, G, Q, P1);
+    benchmark::DoNotOptimize(P1.data());
+    benchmark::ClobberMemory();
+  }
+  allocs.Report(state);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_EkfPropagateCovariance, double);
+BENCHMARK_TEMPLATE(BM_EkfPropagateCovariance, float);
+
+
+// One Joseph-form update with a D-dimensional measurement, e.g 6 for IMU or pose, 1 for depth.
+template <typename Scalar, int D>
+static void BM_EkfJosephUpdate(benchmark::State& state)
+{
+  const EkfCovariance<Scalar> P0 = BenchCovariance<Scalar>();
+  EkfJacobian<Scalar, D> H = EkfJacobian<Scalar, D>::Zero();
+  H.template leftCols<D>().setIdentity();
+  const Eigen::Matrix<Scalar, D, D> R = Scalar(0.01) * Eigen::Matrix<Scalar, D, D>::Identity();
+
+  EkfGain<Scalar, D> K;
+  EkfCovariance<Scalar> P1;
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    JosephUpdate<Scalar, D>(P0, H, R, K, P1);
+    benchmark::DoNotOptimize(P1.data());
+    benchmark::ClobberMemory();
+  }
+  allocs.Report(state);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_EkfJosephUpdate, double, 1);
+BENCHMARK_TEMPLATE(BM_EkfJosephUpdate, double, 6);
+BENCHMARK_TEMPLATE(BM_EkfJosephUpdate, float, 1);
+BENCHMARK_TEMPLATE(BM_EkfJosephUpdate, float, 6);
+
+
+// Baseline for BM_EkfJosephUpdate: the same 6-dim update with dynamic-size matrices and explicit
+// inverses, which is how StateEkf used to do it.
+static void BM_EkfDynamicUpdate(benchmark::State& state)
+{
+  const Eigen::MatrixXd P0 = BenchCovariance<double>();
+  Eigen::MatrixXd H = Eigen::MatrixXd::Zero(6, 15);
+  H.leftCols(6).setIdentity();
+  const Eigen::MatrixXd R = 0.01 * Eigen::MatrixXd::Identity(6, 6);
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    const Eigen::MatrixXd S = H*P0*H.transpose() + R;
+    const Eigen::MatrixXd K = P0*H.transpose() * S.inverse();
+    const Eigen::MatrixXd A = Eigen::MatrixXd::Identity(15, 15) - K*H;
+    const Eigen::MatrixXd P1 = A*P0*A.transpose() + K*R*K.transpose();
+    benchmark::DoNotOptimize(P1.data());
+  }
+  allocs.Report(state);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EkfDynamicUpdate);
+
+
+// Preintegrate a window of N measurements (the benchmark arg), e.g 40 for 0.2 sec between
+// keyframes at 200Hz.
+static void BM_ImuManagerPreintegrate(benchmark::State& state)
+{
+  const size_t N = static_cast<size_t>(state.range(0));
+  const std::vector<ImuMeasurement> imu = SyntheticImuStream(N);
+
+  ImuManager::Params params;
+  params.max_queue_size = std::max(1000, static_cast<int>(N));
+  ImuManager manager(params);
+
+  const seconds_t from_time = ConvertToSeconds(imu.front().timestamp);
+  const seconds_t to_time = ConvertToSeconds(imu.back().timestamp);
+
+  AllocationCounter allocs;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (const ImuMeasurement& m : imu) {
+      manager.Push(m);
+    }
+    state.ResumeTiming();
+
+    const PimResult result = manager.Preintegrate(from_time, to_time);
+    benchmark::DoNotOptimize(result.timestamps_aligned);
+  }
+  allocs.Report(state);
+  state.SetItemsProcessed(state.iterations() * N);
+}
+BENCHMARK(BM_ImuManagerPreintegrate)->Arg(40)->Arg(200)->Arg(1000);
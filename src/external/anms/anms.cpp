@@ -25,6 +25,7 @@ SOFTWARE.
 #include "anms/anms.h"
 
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
 
 #include <opencv2/opencv.hpp>
@@ -361,7 +362,8 @@ std::vector<cv::KeyPoint> Ssc(const std::vector<cv::KeyPoint>& keyPoints,
       (sol1 > sol2)
           ? sol1
           : sol2;  // binary search range initialization with positive solution
-  int low = floor(sqrt((double)keyPoints.size() / numRetPoints));
+  // NOTE: The grid cells are width/2 (integer division), so the width must be at least 2.
+  int low = std::max(2, (int)floor(sqrt((double)keyPoints.size() / numRetPoints)));
 
   int width;
   int prevWidth = -1;
@@ -39,6 +39,10 @@ public:
   int getNumFloatImagePixels() const { return width*height; }
   const std::vector<float>& getFloatImagePixels() const { return pixels; }
 
+  //! Raw row-major pixels (e.g to wrap in a cv::Mat without copying).
+  float* data() { return pixels.data(); }
+  const float* data() const { return pixels.data(); }
+
   //! TODO: Fix decimateAvg function. DO NOT USE!
   void decimateAvg();
 
@@ -1,6 +1,7 @@
 #ifndef TAGDETECTOR_H
 #define TAGDETECTOR_H
 
+#include <utility>
 #include <vector>
 
 #include "opencv2/opencv.hpp"
@@ -8,20 +9,57 @@
 #include "AprilTags/TagDetection.h"
 #include "AprilTags/TagFamily.h"
 #include "AprilTags/FloatImage.h"
+#include "AprilTags/Quad.h"
 
 namespace AprilTags {
 
 class TagDetector {
 public:
-	
-	const TagFamily thisTagFamily;
 
-	//! Constructor
+  //! Options for the fast path. The defaults give the original (full resolution, serial) detector.
+  struct Options {
+    //! Find quads on an image that's decimated by this factor (1 = full resolution). Segmentation
+    //! is the slow part, and gets roughly decimate^2 faster. The quads are scaled back up, refined
+    //! against the full resolution image, and decoded there. Tags must be about 2*decimate times
+    //! larger (in pixels) than the minimum to be found.
+    int decimate;
+
+    //! Threads for the row-parallel stages (gradients, edges) and the per-cluster/per-quad stages
+    //! (line fitting, quad search, decoding). 1 = serial. Uses OpenCV's thread pool.
+    int numThreads;
+
+    //! After decimation, fit each edge of a quad again on the full resolution gradient.
+    bool refineEdges;
+
+    //! Gaussian blur for segmentation (0 = none). See extractTags().
+    float segSigma;
+
+    Options() : decimate(1), numThreads(1), refineEdges(true), segSigma(0.8f) {}
+  };
+
+  const TagFamily thisTagFamily;
+  Options options;
+
+  //! Constructor
   // note: TagFamily is instantiated here from TagCodes
-	TagDetector(const TagCodes& tagCodes) : thisTagFamily(tagCodes) {}
-	
-	std::vector<TagDetection> extractTags(const cv::Mat& image);
-	
+  TagDetector(const TagCodes& tagCodes) : thisTagFamily(tagCodes) {}
+  TagDetector(const TagCodes& tagCodes, const Options& opts) : thisTagFamily(tagCodes), options(opts) {}
+
+  //! Detect tags in an 8-bit grayscale image.
+  std::vector<TagDetection> extractTags(const cv::Mat& image);
+
+private:
+  //! Steps two through seven: segment the (blurred) image, fit lines and chain them into quads.
+  std::vector<Quad> findQuads(const FloatImage& fimSeg, const FloatImage& fimOrig,
+                              const std::pair<float,float>& opticalCenter) const;
+
+  //! Moves each edge of a quad (scaled up from the decimated image) to the strongest gradient in the
+  //! full resolution image, and intersects the refined edges to get new corners. Returns false (and
+  //! leaves the corners alone) if an edge can't be refined.
+  bool refineQuadEdges(const FloatImage& fim, std::vector< std::pair<float,float> >& p) const;
+
+  //! Step eight: read off the bits of a quad. Returns false if it isn't a valid tag.
+  bool decodeQuad(const FloatImage& fim, Quad& quad, TagDetection& detection) const;
 };
 
 } // namespace
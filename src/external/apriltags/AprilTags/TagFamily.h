@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 #include "AprilTags/TagDetection.h"
 using namespace std;
@@ -54,9 +55,17 @@ public:
   static int popCount(unsigned long long w);
 
   //! Given an observed tag with code 'rCode', try to recover the id.
-  /*  The corresponding fields of TagDetection will be filled in. */
+  /*  The corresponding fields of TagDetection will be filled in. Codes
+   *  within maxHashedErrorBits of a valid code (for any rotation) are
+   *  looked up in a hash table. Anything else is only searched for (by
+   *  comparing against every code) if errorRecoveryBits is larger than
+   *  that. Otherwise det.good is false, and det.id is -1.
+   */
   void decode(TagDetection& det, unsigned long long rCode) const;
 
+  //! Same as decode(), but always compares against every code.
+  void decodeExhaustive(TagDetection& det, unsigned long long rCode) const;
+
   //! Prints the hamming distances of the tag codes.
   void printHammingDistances() const;
 
@@ -87,6 +96,15 @@ public:
   //! The array of the codes. The id for a code is its index.
   std::vector<unsigned long long> codes;
 
+  //! Only codes with up to this many bit errors go in the hash table.
+  /*  The table has codes.size() * 4 * (bits choose <= e) entries, so
+   *  e.g. 36h11 with 2 bits is ~1.5M entries, but 3 bits would be ~18M.
+   */
+  static const int maxHashedErrorBits = 2;
+
+  //! Number of observed codes in the hash table.
+  size_t numHashedCodes() const { return codeTable.size(); }
+
   static const int  popCountTableShift = 12;
   static const unsigned int popCountTableSize = 1 << popCountTableShift;
   static unsigned char popCountTable[popCountTableSize];
@@ -99,6 +117,25 @@ public:
         TagFamily::popCountTable[i] = TagFamily::popCountReal(i);
     }
   } initializer;
+
+private:
+  struct CodeMatch {
+    int id;
+    int rotation;
+    int hammingDistance;
+  };
+
+  //! Rebuilds codeTable for the current errorRecoveryBits.
+  void buildCodeTable();
+
+  //! Adds every code within 'remaining' more bit flips of 'w' (flipping
+  //! only bits >= 'firstBit'), so that each one is visited once.
+  void addCodesNear(unsigned long long w, int firstBit, int remaining,
+                    int flipped, int id, int rotation);
+
+  //! Maps an observed code to the best (id, rotation, distance).
+  std::unordered_map<unsigned long long, CodeMatch> codeTable;
+  int hashedErrorBits;
 };
 
 } // namespace
@@ -1,7 +1,9 @@
 #include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <climits>
-#include <map>
+#include <numeric>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 
@@ -24,81 +26,82 @@
 
 #include "AprilTags/TagDetector.h"
 
-//#define DEBUG_APRIL
-
-#ifdef DEBUG_APRIL
-#include <opencv/cv.h>
-#include <opencv/highgui.h>
-#endif
-
 using namespace std;
 
 namespace AprilTags {
 
-  std::vector<TagDetection> TagDetector::extractTags(const cv::Mat& image) {
-
-    // convert to internal AprilTags image (todo: slow, change internally to OpenCV)
-    int width = image.cols;
-    int height = image.rows;
-    AprilTags::FloatImage fimOrig(width, height);
-    int i = 0;
-    for (int y=0; y<height; y++) {
-      for (int x=0; x<width; x++) {
-        fimOrig.set(x, y, image.data[i]/255.);
-        i++;
-      }
-    }
-    std::pair<int,int> opticalCenter(width/2, height/2);
-
-#ifdef DEBUG_APRIL
-#if 0
-  { // debug - write
-    int height_ = fimOrig.getHeight();
-    int width_  = fimOrig.getWidth();
-    cv::Mat image(height_, width_, CV_8UC3);
-    {
-      for (int y=0; y<height_; y++) {
-        for (int x=0; x<width_; x++) {
-          cv::Vec3b v;
-          //        float vf = fimMag.get(x,y);
-          float vf = fimOrig.get(x,y);
-          int val = (int)(vf * 255.);
-          if ((val & 0xffff00) != 0) {printf("problem... %i\n", val);}
-          for (int k=0; k<3; k++) {
-            v(k) = val;
-          }
-          image.at<cv::Vec3b>(y, x) = v;
-        }
-      }
-    }
-    imwrite("out.bmp", image);
-  }
-#endif
-#if 0
-  FloatImage fimOrig = fimOrig_;
-  { // debug - read
-
-    cv::Mat image = cv::imread("test.bmp");
-    int height_ = fimOrig.getHeight();
-    int width_  = fimOrig.getWidth();
-    {
-      for (int y=0; y<height_; y++) {
-        for (int x=0; x<width_; x++) {
-          cv::Vec3b v = image.at<cv::Vec3b>(y,x);
-          float val = (float)v(0)/255.;
-          fimOrig.set(x,y,val);
-        }
-      }
-    }
+namespace {
+
+//! Runs f(i) for every i in [0, n). Splits the range into numThreads stripes on OpenCV's thread
+//! pool, or runs it in order on this thread if numThreads <= 1.
+template <typename F>
+void parallelFor(int n, int numThreads, const F& f) {
+  if (numThreads <= 1 || n < 2) {
+    for (int i = 0; i < n; i++)
+      f(i);
+    return;
   }
-#endif
-#endif
+  cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& r) {
+      for (int i = r.start; i < r.end; i++)
+        f(i);
+    }, numThreads);
+}
+
+//! Wraps a FloatImage (row major, no padding) so that OpenCV can read or write it in place.
+cv::Mat asMat(FloatImage& fim) {
+  return cv::Mat(fim.getHeight(), fim.getWidth(), CV_32FC1, fim.data());
+}
+
+//! Separable Gaussian blur with the same kernel as FloatImage::filterFactoredCentered, but using
+//! OpenCV's vectorized filters (the borders are replicated, so they differ very slightly).
+void gaussianBlur(const FloatImage& src, float sigma, FloatImage& dst) {
+  const int filtsz = ((int) max(3.0f, 3*sigma)) | 1;
+  const std::vector<float> filt = Gaussian::makeGaussianFilter(sigma, filtsz);
+  const cv::Mat kernel(filt, true);
+
+  dst = FloatImage(src.getWidth(), src.getHeight());
+  const cv::Mat srcMat(src.getHeight(), src.getWidth(), CV_32FC1, const_cast<float*>(src.data()));
+  cv::Mat dstMat = asMat(dst);
+  cv::sepFilter2D(srcMat, dstMat, CV_32F, kernel, kernel, cv::Point(-1, -1), 0, cv::BORDER_REPLICATE);
+}
+
+//! Bilinear interpolation. The caller makes sure that 0 <= x < width-1 and 0 <= y < height-1.
+inline float sampleBilinear(const FloatImage& fim, float x, float y) {
+  const int ix = (int) x;
+  const int iy = (int) y;
+  const float fx = x - ix;
+  const float fy = y - iy;
+  const float* r0 = fim.data() + iy*fim.getWidth() + ix;
+  const float* r1 = r0 + fim.getWidth();
+  return (1-fy)*((1-fx)*r0[0] + fx*r0[1]) + fy*((1-fx)*r1[0] + fx*r1[1]);
+}
+
+//! The line fit to one cluster. Segments are only constructed on one thread afterwards, since
+//! their ids come from a (non-atomic) static counter.
+struct SegmentFit {
+  bool good;
+  float x0, y0, x1, y1;
+  float theta, length;
+};
+
+} // namespace
+
+std::vector<TagDetection> TagDetector::extractTags(const cv::Mat& image) {
+  CV_Assert(image.type() == CV_8UC1);
 
   //================================================================
-  // Step one: preprocess image (convert to grayscale) and low pass if necessary
+  // Step one: preprocess image (convert to the internal image) and low pass if necessary
+
+  const int width = image.cols;
+  const int height = image.rows;
+  const int decimate = std::max(1, options.decimate);
+  const int numThreads = options.numThreads;
+
+  FloatImage fimOrig(width, height);
+  cv::Mat origMat = asMat(fimOrig);
+  image.convertTo(origMat, CV_32F, 1.0/255.0);
+  std::pair<int,int> opticalCenter(width/2, height/2);
 
-  FloatImage fim = fimOrig;
-  
   //! Gaussian smoothing kernel applied to image (0 == no filter).
   /*! Used when sampling bits. Filtering is a good idea in cases
    * where A) a cheap camera is introducing artifical sharpening, B)
@@ -107,7 +110,23 @@ namespace AprilTags {
    * harder to decode very small tags. Reasonable values are 0, or
    * [0.8, 1.5].
    */
-  float sigma = 0;
+  const float sigma = 0;
+
+  FloatImage fimBlur;
+  if (sigma > 0) {
+    gaussianBlur(fimOrig, sigma, fimBlur);
+  }
+  const FloatImage& fim = (sigma > 0) ? fimBlur : fimOrig;
+
+  // Quads are found on the decimated image. cv::resize with INTER_AREA averages each block of
+  // pixels, which also low passes the image.
+  FloatImage fimSmall;
+  if (decimate > 1) {
+    fimSmall = FloatImage(width / decimate, height / decimate);
+    cv::Mat smallMat = asMat(fimSmall);
+    cv::resize(origMat, smallMat, smallMat.size(), 0, 0, cv::INTER_AREA);
+  }
+  const FloatImage& fimQuad = (decimate > 1) ? fimSmall : fimOrig;
 
   //! Gaussian smoothing kernel applied to image (0 == no filter).
   /*! Used when detecting the outline of the box. It is almost always
@@ -116,86 +135,162 @@ namespace AprilTags {
    * segsigma has been optimized to avoid a redundant filter
    * operation.
    */
-  float segSigma = 0.8f;
+  const float segSigma = options.segSigma;
 
-  if (sigma > 0) {
-    int filtsz = ((int) max(3.0f, 3*sigma)) | 1;
-    std::vector<float> filt = Gaussian::makeGaussianFilter(sigma, filtsz);
-    fim.filterFactoredCentered(filt, filt);
+  FloatImage fimSegBlur;
+  const FloatImage* fimSeg = &fimQuad;
+  if (segSigma > 0) {
+    if (segSigma == sigma && decimate == 1) {
+      fimSeg = &fim;
+    } else {
+      gaussianBlur(fimQuad, segSigma, fimSegBlur);
+      fimSeg = &fimSegBlur;
+    }
   }
 
   //================================================================
-  // Step two: Compute the local gradient. We store the direction and magnitude.
-  // This step is quite sensitve to noise, since a few bad theta estimates will
-  // break up segments, causing us to miss Quads. It is useful to do a Gaussian
-  // low pass on this step even if we don't want it for encoding.
+  // Steps two through seven: find the quads.
+
+  const std::pair<float,float> quadCenter(fimQuad.getWidth()/2, fimQuad.getHeight()/2);
+  std::vector<Quad> quads = findQuads(*fimSeg, fimQuad, quadCenter);
+
+  // Scale quads from the decimated image back up to full resolution (pixel centers line up the
+  // way cv::resize lines them up), and refine them there.
+  if (decimate > 1) {
+    std::vector< std::vector< std::pair<float,float> > > corners(quads.size());
+    parallelFor((int) quads.size(), numThreads, [&](int qi) {
+        std::vector< std::pair<float,float> >& p = corners[qi];
+        p = quads[qi].quadPoints;
+        for (int k = 0; k < 4; k++) {
+          p[k].first = (p[k].first + 0.5f) * decimate - 0.5f;
+          p[k].second = (p[k].second + 0.5f) * decimate - 0.5f;
+        }
+        if (options.refineEdges) {
+          refineQuadEdges(fimOrig, p);
+        }
+      });
 
-  FloatImage fimSeg;
-  if (segSigma > 0) {
-    if (segSigma == sigma) {
-      fimSeg = fim;
-    } else {
-      // blur anew
-      int filtsz = ((int) max(3.0f, 3*segSigma)) | 1;
-      std::vector<float> filt = Gaussian::makeGaussianFilter(segSigma, filtsz);
-      fimSeg = fimOrig;
-      fimSeg.filterFactoredCentered(filt, filt);
+    std::vector<Quad> fullQuads;
+    fullQuads.reserve(quads.size());
+    for (unsigned int qi = 0; qi < quads.size(); qi++) {
+      fullQuads.push_back(Quad(corners[qi], opticalCenter));
+      fullQuads.back().observedPerimeter = quads[qi].observedPerimeter * decimate;
     }
-  } else {
-    fimSeg = fimOrig;
+    quads.swap(fullQuads);
   }
 
-  FloatImage fimTheta(fimSeg.getWidth(), fimSeg.getHeight());
-  FloatImage fimMag(fimSeg.getWidth(), fimSeg.getHeight());
-  
-
-  #pragma omp parallel for
-  for (int y = 1; y < fimSeg.getHeight()-1; y++) {
-    for (int x = 1; x < fimSeg.getWidth()-1; x++) {
-      float Ix = fimSeg.get(x+1, y) - fimSeg.get(x-1, y);
-      float Iy = fimSeg.get(x, y+1) - fimSeg.get(x, y-1);
-
-      float mag = Ix*Ix + Iy*Iy;
-#if 0 // kaess: fast version, but maybe less accurate?
-      float theta = MathUtil::fast_atan2(Iy, Ix);
-#else
-      float theta = atan2(Iy, Ix);
-#endif
-      
-      fimTheta.set(x, y, theta);
-      fimMag.set(x, y, mag);
-    }
+  //================================================================
+  // Step eight. Decode the quads. For each quad, we first estimate a
+  // threshold color to decide between 0 and 1. Then, we read off the
+  // bits and see if they make sense. Each quad is independent, and
+  // keeps its slot so that the detections come out in the same order.
+
+  std::vector<TagDetection> decoded(quads.size());
+  std::vector<char> isGood(quads.size(), 0);
+  parallelFor((int) quads.size(), numThreads, [&](int qi) {
+      isGood[qi] = decodeQuad(fim, quads[qi], decoded[qi]);
+    });
+
+  std::vector<TagDetection> detections;
+  for (unsigned int qi = 0; qi < quads.size(); qi++) {
+    if (isGood[qi])
+      detections.push_back(decoded[qi]);
   }
 
-#ifdef DEBUG_APRIL
-  int height_ = fimSeg.getHeight();
-  int width_  = fimSeg.getWidth();
-  cv::Mat image(height_, width_, CV_8UC3);
-  {
-    for (int y=0; y<height_; y++) {
-      for (int x=0; x<width_; x++) {
-        cv::Vec3b v;
-        //        float vf = fimMag.get(x,y);
-        float vf = fimOrig.get(x,y);
-        int val = (int)(vf * 255.);
-        if ((val & 0xffff00) != 0) {printf("problem... %i\n", val);}
-        for (int k=0; k<3; k++) {
-          v(k) = val;
-        }
-        image.at<cv::Vec3b>(y, x) = v;
-      }
+  //================================================================
+  //Step nine: Some quads may be detected more than once, due to
+  //partial occlusion and our aggressive attempts to recover from
+  //broken lines. When two quads (with the same id) overlap, we will
+  //keep the one with the lowest error, and if the error is the same,
+  //the one with the greatest observed perimeter.
+
+  std::vector<TagDetection> goodDetections;
+
+  // NOTE: allow multiple non-overlapping detections of the same target.
+
+  for ( vector<TagDetection>::const_iterator it = detections.begin();
+	it != detections.end(); it++ ) {
+    const TagDetection &thisTagDetection = *it;
+
+    bool newFeature = true;
+
+    for ( unsigned int odidx = 0; odidx < goodDetections.size(); odidx++) {
+      TagDetection &otherTagDetection = goodDetections[odidx];
+
+      if ( thisTagDetection.id != otherTagDetection.id ||
+	   ! thisTagDetection.overlapsTooMuch(otherTagDetection) )
+	continue;
+
+      // There's a conflict.  We must pick one to keep.
+      newFeature = false;
+
+      // This detection is worse than the previous one... just don't use it.
+      if ( thisTagDetection.hammingDistance > otherTagDetection.hammingDistance )
+	continue;
+
+      // Otherwise, keep the new one if it either has strictly *lower* error, or greater perimeter.
+      if ( thisTagDetection.hammingDistance < otherTagDetection.hammingDistance ||
+	   thisTagDetection.observedPerimeter > otherTagDetection.observedPerimeter )
+	goodDetections[odidx] = thisTagDetection;
     }
+
+     if ( newFeature )
+       goodDetections.push_back(thisTagDetection);
+
   }
-#endif
+
+  return goodDetections;
+}
+
+std::vector<Quad> TagDetector::findQuads(const FloatImage& fimSeg, const FloatImage& fimOrig,
+                                         const std::pair<float,float>& opticalCenter) const {
+  const int width = fimSeg.getWidth();
+  const int height = fimSeg.getHeight();
+  const int numThreads = options.numThreads;
+
+  std::vector<Quad> quads;
+  if (width < 3 || height < 3)
+    return quads;
+
+  //================================================================
+  // Step two: Compute the local gradient. We store the direction and magnitude.
+  // This step is quite sensitve to noise, since a few bad theta estimates will
+  // break up segments, causing us to miss Quads. It is useful to do a Gaussian
+  // low pass on this step even if we don't want it for encoding.
+
+  FloatImage fimTheta(width, height);
+  FloatImage fimMag(width, height);
+
+  parallelFor(height-2, numThreads, [&](int row) {
+      const int y = row + 1;
+      const float* up = fimSeg.data() + (y-1)*width;
+      const float* mid = up + width;
+      const float* down = mid + width;
+      float* mag = fimMag.data() + y*width;
+      float* theta = fimTheta.data() + y*width;
+
+      // No branches, so this vectorizes.
+      for (int x = 1; x < width-1; x++) {
+        const float Ix = mid[x+1] - mid[x-1];
+        const float Iy = down[x] - up[x];
+        mag[x] = Ix*Ix + Iy*Iy;
+      }
+
+      // Theta is only ever read where mag >= Edge::minMag (see Edge::edgeCost), so the atan2 can
+      // be skipped everywhere else. This leaves the result unchanged.
+      for (int x = 1; x < width-1; x++) {
+        if (mag[x] >= Edge::minMag)
+          theta[x] = atan2(down[x] - up[x], mid[x+1] - mid[x-1]);
+      }
+    });
 
   //================================================================
   // Step three. Extract edges by grouping pixels with similar
   // thetas together. This is a greedy algorithm: we start with
   // the most similar pixels.  We use 4-connectivity.
-  UnionFindSimple uf(fimSeg.getWidth()*fimSeg.getHeight());
-  
-  vector<Edge> edges(width*height*4);
-  size_t nEdges = 0;
+  UnionFindSimple uf(width*height);
+
+  vector<Edge> edges;
 
   // Bounds on the thetas assigned to this group. Note that because
   // theta is periodic, these are defined such that the average
@@ -209,149 +304,180 @@ namespace AprilTags {
     float * tmax = &storage[width*height*1];
     float * mmin = &storage[width*height*2];
     float * mmax = &storage[width*height*3];
-                  
-    for (int y = 0; y+1 < height; y++) {
-      for (int x = 0; x+1 < width; x++) {
-                                  
-        float mag0 = fimMag.get(x,y);
-        if (mag0 < Edge::minMag)
-          continue;
-        mmax[y*width+x] = mag0;
-        mmin[y*width+x] = mag0;
-                                  
-        float theta0 = fimTheta.get(x,y);
-        tmin[y*width+x] = theta0;
-        tmax[y*width+x] = theta0;
-                                  
-        // Calculates then adds edges to 'vector<Edge> edges'
-        Edge::calcEdges(theta0, x, y, fimTheta, fimMag, edges, nEdges);
-                                  
-        // XXX Would 8 connectivity help for rotated tags?
-        // Probably not much, so long as input filtering hasn't been disabled.
-      }
+
+    // Every edge starts at a pixel in one band of rows, and only the bounds at that pixel are
+    // written, so the bands are independent. They're concatenated in row order, which gives the
+    // same edges (in the same order) as one pass over the image.
+    const int numBands = (numThreads <= 1) ? 1 : std::min(height-1, 4*numThreads);
+    vector< vector<Edge> > bandEdges(numBands);
+
+    parallelFor(numBands, numThreads, [&](int b) {
+        const int y0 = (height-1) * b / numBands;
+        const int y1 = (height-1) * (b+1) / numBands;
+        vector<Edge>& out = bandEdges[b];
+        out.resize((y1-y0) * width * 4);
+        size_t nOut = 0;
+
+        for (int y = y0; y < y1; y++) {
+          for (int x = 0; x+1 < width; x++) {
+
+            float mag0 = fimMag.get(x,y);
+            if (mag0 < Edge::minMag)
+              continue;
+            mmax[y*width+x] = mag0;
+            mmin[y*width+x] = mag0;
+
+            float theta0 = fimTheta.get(x,y);
+            tmin[y*width+x] = theta0;
+            tmax[y*width+x] = theta0;
+
+            // Calculates then adds edges to 'vector<Edge> out'
+            Edge::calcEdges(theta0, x, y, fimTheta, fimMag, out, nOut);
+
+            // XXX Would 8 connectivity help for rotated tags?
+            // Probably not much, so long as input filtering hasn't been disabled.
+          }
+        }
+        out.resize(nOut);
+      });
+
+    size_t nEdges = 0;
+    for (int b = 0; b < numBands; b++)
+      nEdges += bandEdges[b].size();
+    edges.reserve(nEdges);
+    for (int b = 0; b < numBands; b++) {
+      edges.insert(edges.end(), bandEdges[b].begin(), bandEdges[b].end());
+      vector<Edge>().swap(bandEdges[b]);
     }
-                  
-    edges.resize(nEdges);
+
+    // NOTE: Merging stays serial. It's greedy (cheapest edge first), so the result depends on
+    // the order the edges are merged in.
     std::stable_sort(edges.begin(), edges.end());
     Edge::mergeEdges(edges,uf,tmin,tmax,mmin,mmax);
   }
-          
+
   //================================================================
   // Step four: Loop over the pixels again, collecting statistics for each cluster.
-  // We will soon fit lines (segments) to these points.
-
-  map<int, vector<XYWeight> > clusters;
-  for (int y = 0; y+1 < fimSeg.getHeight(); y++) {
-    for (int x = 0; x+1 < fimSeg.getWidth(); x++) {
-      if (uf.getSetSize(y*fimSeg.getWidth()+x) < Segment::minimumSegmentSize)
+  // We will soon fit lines (segments) to these points. Clusters are visited in
+  // the order of their representative pixel afterwards.
+
+  std::unordered_map<int, int> clusterIndex;
+  vector< vector<XYWeight> > clusters;
+  vector<int> clusterReps;
+  for (int y = 0; y+1 < height; y++) {
+    for (int x = 0; x+1 < width; x++) {
+      if (uf.getSetSize(y*width+x) < Segment::minimumSegmentSize)
 	continue;
 
-      int rep = (int) uf.getRepresentative(y*fimSeg.getWidth()+x);
-     
-      map<int, vector<XYWeight> >::iterator it = clusters.find(rep);
-      if ( it == clusters.end() ) {
-	clusters[rep] = vector<XYWeight>();
-	it = clusters.find(rep);
+      int rep = (int) uf.getRepresentative(y*width+x);
+
+      std::unordered_map<int, int>::iterator it = clusterIndex.find(rep);
+      if ( it == clusterIndex.end() ) {
+        it = clusterIndex.insert(std::make_pair(rep, (int) clusters.size())).first;
+        clusters.push_back(vector<XYWeight>());
+        clusterReps.push_back(rep);
       }
-      vector<XYWeight> &points = it->second;
-      points.push_back(XYWeight(x,y,fimMag.get(x,y)));
+      clusters[it->second].push_back(XYWeight(x,y,fimMag.get(x,y)));
     }
   }
 
+  vector<int> clusterOrder(clusters.size());
+  std::iota(clusterOrder.begin(), clusterOrder.end(), 0);
+  std::sort(clusterOrder.begin(), clusterOrder.end(),
+            [&](int a, int b) { return clusterReps[a] < clusterReps[b]; });
+
   //================================================================
   // Step five: Loop over the clusters, fitting lines (which we call Segments).
-  std::vector<Segment> segments; //used in Step six
-  std::map<int, std::vector<XYWeight> >::const_iterator clustersItr;
-  for (clustersItr = clusters.begin(); clustersItr != clusters.end(); clustersItr++) {
-    std::vector<XYWeight> points = clustersItr->second;
-    GLineSegment2D gseg = GLineSegment2D::lsqFitXYW(points);
-
-    // filter short lines
-    float length = MathUtil::distance2D(gseg.getP0(), gseg.getP1());
-    if (length < Segment::minimumLineLength)
-      continue;
-
-    Segment seg;
-    float dy = gseg.getP1().second - gseg.getP0().second;
-    float dx = gseg.getP1().first - gseg.getP0().first;
-
-    float tmpTheta = std::atan2(dy,dx);
-
-    seg.setTheta(tmpTheta);
-    seg.setLength(length);
-
-    // We add an extra semantic to segments: the vector
-    // p1->p2 will have dark on the left, white on the right.
-    // To do this, we'll look at every gradient and each one
-    // will vote for which way they think the gradient should
-    // go. This is way more retentive than necessary: we
-    // could probably sample just one point!
-
-    float flip = 0, noflip = 0;
-    for (unsigned int i = 0; i < points.size(); i++) {
-      XYWeight xyw = points[i];
-      
-      float theta = fimTheta.get((int) xyw.x, (int) xyw.y);
-      float mag = fimMag.get((int) xyw.x, (int) xyw.y);
-
-      // err *should* be +M_PI/2 for the correct winding, but if we
-      // got the wrong winding, it'll be around -M_PI/2.
-      float err = MathUtil::mod2pi(theta - seg.getTheta());
-
-      if (err < 0)
-	noflip += mag;
-      else
-	flip += mag;
-    }
+  vector<SegmentFit> fits(clusters.size());
+  parallelFor((int) clusters.size(), numThreads, [&](int ci) {
+      const std::vector<XYWeight>& points = clusters[clusterOrder[ci]];
+      SegmentFit& fit = fits[ci];
+      fit.good = false;
+
+      GLineSegment2D gseg = GLineSegment2D::lsqFitXYW(points);
+
+      // filter short lines
+      float length = MathUtil::distance2D(gseg.getP0(), gseg.getP1());
+      if (length < Segment::minimumLineLength)
+        return;
+
+      float dy = gseg.getP1().second - gseg.getP0().second;
+      float dx = gseg.getP1().first - gseg.getP0().first;
+
+      float segTheta = std::atan2(dy,dx);
+
+      // We add an extra semantic to segments: the vector
+      // p1->p2 will have dark on the left, white on the right.
+      // To do this, we'll look at every gradient and each one
+      // will vote for which way they think the gradient should
+      // go. This is way more retentive than necessary: we
+      // could probably sample just one point!
+
+      float flip = 0, noflip = 0;
+      for (unsigned int i = 0; i < points.size(); i++) {
+        const XYWeight& xyw = points[i];
+
+        float theta = fimTheta.get((int) xyw.x, (int) xyw.y);
+        float mag = fimMag.get((int) xyw.x, (int) xyw.y);
+
+        // err *should* be +M_PI/2 for the correct winding, but if we
+        // got the wrong winding, it'll be around -M_PI/2.
+        float err = MathUtil::mod2pi(theta - segTheta);
+
+        if (err < 0)
+          noflip += mag;
+        else
+          flip += mag;
+      }
 
-    if (flip > noflip) {
-      float temp = seg.getTheta() + (float)M_PI;
-      seg.setTheta(temp);
-    }
+      if (flip > noflip) {
+        segTheta += (float)M_PI;
+      }
 
-    float dot = dx*std::cos(seg.getTheta()) + dy*std::sin(seg.getTheta());
-    if (dot > 0) {
-      seg.setX0(gseg.getP1().first); seg.setY0(gseg.getP1().second);
-      seg.setX1(gseg.getP0().first); seg.setY1(gseg.getP0().second);
-    }
-    else {
-      seg.setX0(gseg.getP0().first); seg.setY0(gseg.getP0().second);
-      seg.setX1(gseg.getP1().first); seg.setY1(gseg.getP1().second);
-    }
+      float dot = dx*std::cos(segTheta) + dy*std::sin(segTheta);
+      if (dot > 0) {
+        fit.x0 = gseg.getP1().first; fit.y0 = gseg.getP1().second;
+        fit.x1 = gseg.getP0().first; fit.y1 = gseg.getP0().second;
+      }
+      else {
+        fit.x0 = gseg.getP0().first; fit.y0 = gseg.getP0().second;
+        fit.x1 = gseg.getP1().first; fit.y1 = gseg.getP1().second;
+      }
+      fit.theta = segTheta;
+      fit.length = length;
+      fit.good = true;
+    });
 
+  std::vector<Segment> segments; //used in Step six
+  segments.reserve(fits.size());
+  for (unsigned int ci = 0; ci < fits.size(); ci++) {
+    const SegmentFit& fit = fits[ci];
+    if (!fit.good)
+      continue;
+    Segment seg;
+    seg.setTheta(fit.theta);
+    seg.setLength(fit.length);
+    seg.setX0(fit.x0); seg.setY0(fit.y0);
+    seg.setX1(fit.x1); seg.setY1(fit.y1);
     segments.push_back(seg);
   }
 
-#ifdef DEBUG_APRIL
-#if 0
-  {
-    for (vector<Segment>::iterator it = segments.begin(); it!=segments.end(); it++) {
-      long int r = random();
-      cv::line(image,
-               cv::Point2f(it->getX0(), it->getY0()),
-               cv::Point2f(it->getX1(), it->getY1()),
-               cv::Scalar(r%0xff,(r%0xff00)>>8,(r%0xff0000)>>16,0) );
-    }
-  }
-#endif
-#endif
-
   // Step six: For each segment, find segments that begin where this segment ends.
   // (We will chain segments together next...) The gridder accelerates the search by
   // building (essentially) a 2D hash table.
   Gridder<Segment> gridder(0,0,width,height,10);
-  
+
   // add every segment to the hash table according to the position of the segment's
   // first point. Remember that the first point has a specific meaning due to our
   // left-hand rule above.
   for (unsigned int i = 0; i < segments.size(); i++) {
     gridder.add(segments[i].getX0(), segments[i].getY0(), &segments[i]);
   }
-  
+
   // Now, find child segments that begin where each parent segment ends.
   for (unsigned i = 0; i < segments.size(); i++) {
     Segment &parentseg = segments[i];
-      
+
     //compute length of the line segment
     GLine2D parentLine(std::pair<float,float>(parentseg.getX0(), parentseg.getY0()),
 		       std::pair<float,float>(parentseg.getX1(), parentseg.getY1()));
@@ -387,200 +513,198 @@ namespace AprilTags {
 
   //================================================================
   // Step seven: Search all connected segments to see if any form a loop of length 4.
-  // Add those to the quads list.
-  vector<Quad> quads;
-  
-  vector<Segment*> tmp(5);
-  for (unsigned int i = 0; i < segments.size(); i++) {
-    tmp[0] = &segments[i];
-    Quad::search(fimOrig, tmp, segments[i], 0, quads, opticalCenter);
-  }
-
-#ifdef DEBUG_APRIL
-  {
-    for (unsigned int qi = 0; qi < quads.size(); qi++ ) {
-      Quad &quad = quads[qi];
-      std::pair<float, float> p1 = quad.quadPoints[0];
-      std::pair<float, float> p2 = quad.quadPoints[1];
-      std::pair<float, float> p3 = quad.quadPoints[2];
-      std::pair<float, float> p4 = quad.quadPoints[3];
-      cv::line(image, cv::Point2f(p1.first, p1.second), cv::Point2f(p2.first, p2.second), cv::Scalar(0,0,255,0) );
-      cv::line(image, cv::Point2f(p2.first, p2.second), cv::Point2f(p3.first, p3.second), cv::Scalar(0,0,255,0) );
-      cv::line(image, cv::Point2f(p3.first, p3.second), cv::Point2f(p4.first, p4.second), cv::Scalar(0,0,255,0) );
-      cv::line(image, cv::Point2f(p4.first, p4.second), cv::Point2f(p1.first, p1.second), cv::Scalar(0,0,255,0) );
-
-      p1 = quad.interpolate(-1,-1);
-      p2 = quad.interpolate(-1,1);
-      p3 = quad.interpolate(1,1);
-      p4 = quad.interpolate(1,-1);
-      cv::circle(image, cv::Point2f(p1.first, p1.second), 3, cv::Scalar(0,255,0,0), 1);
-      cv::circle(image, cv::Point2f(p2.first, p2.second), 3, cv::Scalar(0,255,0,0), 1);
-      cv::circle(image, cv::Point2f(p3.first, p3.second), 3, cv::Scalar(0,255,0,0), 1);
-      cv::circle(image, cv::Point2f(p4.first, p4.second), 3, cv::Scalar(0,255,0,0), 1);
+  // Add those to the quads list. The search from each segment only reads the others,
+  // so each one gets its own list, and they're concatenated in order.
+  vector< vector<Quad> > segmentQuads(segments.size());
+  parallelFor((int) segments.size(), numThreads, [&](int i) {
+      vector<Segment*> tmp(5);
+      tmp[0] = &segments[i];
+      Quad::search(fimOrig, tmp, segments[i], 0, segmentQuads[i], opticalCenter);
+    });
+
+  for (unsigned int i = 0; i < segmentQuads.size(); i++) {
+    for (unsigned int qi = 0; qi < segmentQuads[i].size(); qi++) {
+      quads.push_back(segmentQuads[i][qi]);
+      // NOTE: The segments are about to go out of scope.
+      quads.back().segments.clear();
     }
-    cv::imshow("debug_april", image);
   }
-#endif
-
-  //================================================================
-  // Step eight. Decode the quads. For each quad, we first estimate a
-  // threshold color to decide between 0 and 1. Then, we read off the
-  // bits and see if they make sense.
-
-  std::vector<TagDetection> detections;
 
-  for (unsigned int qi = 0; qi < quads.size(); qi++ ) {
-    Quad &quad = quads[qi];
-
-    // Find a threshold
-    GrayModel blackModel, whiteModel;
-    const int dd = 2 * thisTagFamily.blackBorder + thisTagFamily.dimension;
-
-    for (int iy = -1; iy <= dd; iy++) {
-      float y = (iy + 0.5f) / dd;
-      for (int ix = -1; ix <= dd; ix++) {
-	float x = (ix + 0.5f) / dd;
-	std::pair<float,float> pxy = quad.interpolate01(x, y);
-	int irx = (int) (pxy.first + 0.5);
-	int iry = (int) (pxy.second + 0.5);
-	if (irx < 0 || irx >= width || iry < 0 || iry >= height)
-	  continue;
-	float v = fim.get(irx, iry);
-	if (iy == -1 || iy == dd || ix == -1 || ix == dd)
-	  whiteModel.addObservation(x, y, v);
-	else if (iy == 0 || iy == (dd-1) || ix == 0 || ix == (dd-1))
-	  blackModel.addObservation(x, y, v);
-      }
-    }
+  return quads;
+}
 
-    bool bad = false;
-    unsigned long long tagCode = 0;
-    for ( int iy = thisTagFamily.dimension-1; iy >= 0; iy-- ) {
-      float y = (thisTagFamily.blackBorder + iy + 0.5f) / dd;
-      for (int ix = 0; ix < thisTagFamily.dimension; ix++ ) {
-	float x = (thisTagFamily.blackBorder + ix + 0.5f) / dd;
-	std::pair<float,float> pxy = quad.interpolate01(x, y);
-	int irx = (int) (pxy.first + 0.5);
-	int iry = (int) (pxy.second + 0.5);
-	if (irx < 0 || irx >= width || iry < 0 || iry >= height) {
-	  // cout << "*** bad:  irx=" << irx << "  iry=" << iry << endl;
-	  bad = true;
-	  continue;
-	}
-	float threshold = (blackModel.interpolate(x,y) + whiteModel.interpolate(x,y)) * 0.5f;
-	float v = fim.get(irx, iry);
-	tagCode = tagCode << 1;
-	if ( v > threshold)
-	  tagCode |= 1;
-#ifdef DEBUG_APRIL
-        {
-          if (v>threshold)
-            cv::circle(image, cv::Point2f(irx, iry), 1, cv::Scalar(0,0,255,0), 2);
-          else
-            cv::circle(image, cv::Point2f(irx, iry), 1, cv::Scalar(0,255,0,0), 2);
+bool TagDetector::refineQuadEdges(const FloatImage& fim, std::vector< std::pair<float,float> >& p) const {
+  const int width = fim.getWidth();
+  const int height = fim.getHeight();
+
+  // Search this far (in full resolution pixels) on either side of each edge.
+  const float range = (float) (options.decimate + 1);
+  const float step = 0.5f;
+  const int nsteps = (int) (2*range / step) + 1;
+
+  std::vector<GLine2D> lines;
+  std::vector<float> mags(nsteps);
+
+  for (int i = 0; i < 4; i++) {
+    const std::pair<float,float>& a = p[i];
+    const std::pair<float,float>& b = p[(i+1) % 4];
+    const float dx = b.first - a.first;
+    const float dy = b.second - a.second;
+    const float len = std::sqrt(dx*dx + dy*dy);
+    if (len < 4)
+      return false;
+
+    // Unit normal to the edge.
+    const float nx = -dy / len;
+    const float ny = dx / len;
+
+    // Sample about every other pixel along the edge, staying away from the corners (where the
+    // neighbouring edges would pull the gradient around).
+    const int nsamples = std::max(4, (int) (len / 2));
+    std::vector<XYWeight> points;
+    points.reserve(nsamples);
+
+    for (int s = 0; s < nsamples; s++) {
+      const float t = 0.1f + 0.8f * (s + 0.5f) / nsamples;
+      const float ex = a.first + t*dx;
+      const float ey = a.second + t*dy;
+
+      // The strongest gradient along the normal (a central difference of the intensity).
+      int best = -1;
+      for (int k = 0; k < nsteps; k++) {
+        const float off = -range + k*step;
+        const float xm = ex + (off - 0.5f)*nx, ym = ey + (off - 0.5f)*ny;
+        const float xp = ex + (off + 0.5f)*nx, yp = ey + (off + 0.5f)*ny;
+        if (std::min(xm, xp) < 0 || std::max(xm, xp) >= width-1 ||
+            std::min(ym, yp) < 0 || std::max(ym, yp) >= height-1) {
+          mags[k] = 0;
+          continue;
         }
-#endif
+        mags[k] = std::fabs(sampleBilinear(fim, xp, yp) - sampleBilinear(fim, xm, ym));
+        if (best < 0 || mags[k] > mags[best])
+          best = k;
       }
-    }
-
-    if ( !bad ) {
-      TagDetection thisTagDetection;
-      thisTagFamily.decode(thisTagDetection, tagCode);
-
-      // compute the homography (and rotate it appropriately)
-      thisTagDetection.homography = quad.homography.getH();
-      thisTagDetection.hxy = quad.homography.getCXY();
-
-      float c = std::cos(thisTagDetection.rotation*(float)M_PI/2);
-      float s = std::sin(thisTagDetection.rotation*(float)M_PI/2);
-      Eigen::Matrix3d R;
-      R.setZero();
-      R(0,0) = R(1,1) = c;
-      R(0,1) = -s;
-      R(1,0) = s;
-      R(2,2) = 1;
-      Eigen::Matrix3d tmp;
-      tmp = thisTagDetection.homography * R;
-      thisTagDetection.homography = tmp;
-
-      // Rotate points in detection according to decoded
-      // orientation.  Thus the order of the points in the
-      // detection object can be used to determine the
-      // orientation of the target.
-      std::pair<float,float> bottomLeft = thisTagDetection.interpolate(-1,-1);
-      int bestRot = -1;
-      float bestDist = FLT_MAX;
-      for ( int i=0; i<4; i++ ) {
-	float const dist = AprilTags::MathUtil::distance2D(bottomLeft, quad.quadPoints[i]);
-	if ( dist < bestDist ) {
-	  bestDist = dist;
-	  bestRot = i;
-	}
+      if (best < 0 || mags[best] <= 0)
+        continue;
+
+      // Parabolic interpolation around the peak.
+      float off = -range + best*step;
+      if (best > 0 && best < nsteps-1) {
+        const float denom = mags[best-1] - 2*mags[best] + mags[best+1];
+        if (denom < 0)
+          off += step * 0.5f * (mags[best-1] - mags[best+1]) / denom;
       }
+      points.push_back(XYWeight(ex + off*nx, ey + off*ny, mags[best]));
+    }
 
-      for (int i=0; i< 4; i++)
-	thisTagDetection.p[i] = quad.quadPoints[(i+bestRot) % 4];
+    if (points.size() < 3)
+      return false;
 
-      if (thisTagDetection.good) {
-	thisTagDetection.cxy = quad.interpolate01(0.5f, 0.5f);
-	thisTagDetection.observedPerimeter = quad.observedPerimeter;
-	detections.push_back(thisTagDetection);
-      }
-    }
+    GLineSegment2D seg = GLineSegment2D::lsqFitXYW(points);
+    lines.push_back(GLine2D(seg.getP0(), seg.getP1()));
   }
 
-#ifdef DEBUG_APRIL
-  {
-    cv::imshow("debug_april", image);
+  // Corner i is where edge i-1 (into it) meets edge i (out of it).
+  std::vector< std::pair<float,float> > refined(4);
+  for (int i = 0; i < 4; i++) {
+    refined[i] = lines[(i+3) % 4].intersectionWith(lines[i]);
+    if (refined[i].first == -1)
+      return false;
+    if (MathUtil::distance2D(refined[i], p[i]) > 2*range)
+      return false;
   }
-#endif
-
-  //================================================================
-  //Step nine: Some quads may be detected more than once, due to
-  //partial occlusion and our aggressive attempts to recover from
-  //broken lines. When two quads (with the same id) overlap, we will
-  //keep the one with the lowest error, and if the error is the same,
-  //the one with the greatest observed perimeter.
 
-  std::vector<TagDetection> goodDetections;
-
-  // NOTE: allow multiple non-overlapping detections of the same target.
-
-  for ( vector<TagDetection>::const_iterator it = detections.begin();
-	it != detections.end(); it++ ) {
-    const TagDetection &thisTagDetection = *it;
-
-    bool newFeature = true;
-
-    for ( unsigned int odidx = 0; odidx < goodDetections.size(); odidx++) {
-      TagDetection &otherTagDetection = goodDetections[odidx];
-
-      if ( thisTagDetection.id != otherTagDetection.id ||
-	   ! thisTagDetection.overlapsTooMuch(otherTagDetection) )
-	continue;
-
-      // There's a conflict.  We must pick one to keep.
-      newFeature = false;
-
-      // This detection is worse than the previous one... just don't use it.
-      if ( thisTagDetection.hammingDistance > otherTagDetection.hammingDistance )
-	continue;
+  p = refined;
+  return true;
+}
 
-      // Otherwise, keep the new one if it either has strictly *lower* error, or greater perimeter.
-      if ( thisTagDetection.hammingDistance < otherTagDetection.hammingDistance ||
-	   thisTagDetection.observedPerimeter > otherTagDetection.observedPerimeter )
-	goodDetections[odidx] = thisTagDetection;
+bool TagDetector::decodeQuad(const FloatImage& fim, Quad& quad, TagDetection& detection) const {
+  const int width = fim.getWidth();
+  const int height = fim.getHeight();
+
+  // Find a threshold
+  GrayModel blackModel, whiteModel;
+  const int dd = 2 * thisTagFamily.blackBorder + thisTagFamily.dimension;
+
+  for (int iy = -1; iy <= dd; iy++) {
+    float y = (iy + 0.5f) / dd;
+    for (int ix = -1; ix <= dd; ix++) {
+      float x = (ix + 0.5f) / dd;
+      std::pair<float,float> pxy = quad.interpolate01(x, y);
+      int irx = (int) (pxy.first + 0.5);
+      int iry = (int) (pxy.second + 0.5);
+      if (irx < 0 || irx >= width || iry < 0 || iry >= height)
+        continue;
+      float v = fim.get(irx, iry);
+      if (iy == -1 || iy == dd || ix == -1 || ix == dd)
+        whiteModel.addObservation(x, y, v);
+      else if (iy == 0 || iy == (dd-1) || ix == 0 || ix == (dd-1))
+        blackModel.addObservation(x, y, v);
     }
+  }
 
-     if ( newFeature )
-       goodDetections.push_back(thisTagDetection);
+  unsigned long long tagCode = 0;
+  for ( int iy = thisTagFamily.dimension-1; iy >= 0; iy-- ) {
+    float y = (thisTagFamily.blackBorder + iy + 0.5f) / dd;
+    for (int ix = 0; ix < thisTagFamily.dimension; ix++ ) {
+      float x = (thisTagFamily.blackBorder + ix + 0.5f) / dd;
+      std::pair<float,float> pxy = quad.interpolate01(x, y);
+      int irx = (int) (pxy.first + 0.5);
+      int iry = (int) (pxy.second + 0.5);
+      if (irx < 0 || irx >= width || iry < 0 || iry >= height) {
+        // cout << "*** bad:  irx=" << irx << "  iry=" << iry << endl;
+        return false;
+      }
+      float threshold = (blackModel.interpolate(x,y) + whiteModel.interpolate(x,y)) * 0.5f;
+      float v = fim.get(irx, iry);
+      tagCode = tagCode << 1;
+      if ( v > threshold)
+        tagCode |= 1;
+    }
+  }
 
+  TagDetection& thisTagDetection = detection;
+  thisTagFamily.decode(thisTagDetection, tagCode);
+  if (!thisTagDetection.good)
+    return false;
+
+  // compute the homography (and rotate it appropriately)
+  thisTagDetection.homography = quad.homography.getH();
+  thisTagDetection.hxy = quad.homography.getCXY();
+
+  float c = std::cos(thisTagDetection.rotation*(float)M_PI/2);
+  float s = std::sin(thisTagDetection.rotation*(float)M_PI/2);
+  Eigen::Matrix3d R;
+  R.setZero();
+  R(0,0) = R(1,1) = c;
+  R(0,1) = -s;
+  R(1,0) = s;
+  R(2,2) = 1;
+  Eigen::Matrix3d tmp;
+  tmp = thisTagDetection.homography * R;
+  thisTagDetection.homography = tmp;
+
+  // Rotate points in detection according to decoded
+  // orientation.  Thus the order of the points in the
+  // detection object can be used to determine the
+  // orientation of the target.
+  std::pair<float,float> bottomLeft = thisTagDetection.interpolate(-1,-1);
+  int bestRot = -1;
+  float bestDist = FLT_MAX;
+  for ( int i=0; i<4; i++ ) {
+    float const dist = AprilTags::MathUtil::distance2D(bottomLeft, quad.quadPoints[i]);
+    if ( dist < bestDist ) {
+      bestDist = dist;
+      bestRot = i;
+    }
   }
 
-  //cout << "AprilTags: edges=" << nEdges << " clusters=" << clusters.size() << " segments=" << segments.size()
-  //     << " quads=" << quads.size() << " detections=" << detections.size() << " unique tags=" << goodDetections.size() << endl;
+  for (int i=0; i< 4; i++)
+    thisTagDetection.p[i] = quad.quadPoints[(i+bestRot) % 4];
 
-  return goodDetections;
+  thisTagDetection.cxy = quad.interpolate01(0.5f, 0.5f);
+  thisTagDetection.observedPerimeter = quad.observedPerimeter;
+  return true;
 }
 
 } // namespace
@@ -28,18 +28,69 @@ namespace AprilTags {
 TagFamily::TagFamily(const TagCodes& tagCodes)
   : blackBorder(1), bits(tagCodes.bits), dimension((int)std::sqrt((float)bits)),
     minimumHammingDistance(tagCodes.minHammingDistance),
-    errorRecoveryBits(1), codes() {
+    errorRecoveryBits(1), codes(), codeTable(), hashedErrorBits(-1) {
   if ( bits != dimension*dimension )
     cerr << "Error: TagFamily constructor called with bits=" << bits << "; must be a square number!" << endl;
   codes = tagCodes.codes;
+  buildCodeTable();
 }
 
 void TagFamily::setErrorRecoveryBits(int b) {
   errorRecoveryBits = b;
+  buildCodeTable();
 }
 
 void TagFamily::setErrorRecoveryFraction(float v) {
   errorRecoveryBits = (int) (((int) (minimumHammingDistance-1)/2)*v);
+  buildCodeTable();
+}
+
+void TagFamily::buildCodeTable() {
+  const int e = max(0, min(errorRecoveryBits, maxHashedErrorBits));
+  if (e == hashedErrorBits)
+    return;
+
+  codeTable.clear();
+  hashedErrorBits = e;
+
+  // (bits choose <= e) codes per rotation of each code.
+  size_t perCode = 0;
+  size_t choose = 1;
+  for (int k = 0; k <= e; k++) {
+    perCode += choose;
+    choose = choose * (bits - k) / (k + 1);
+  }
+  codeTable.reserve(codes.size() * 4 * perCode);
+
+  // An observed code w matches codes[id] at rotation rot if rotating w by rot
+  // is within e bits of codes[id], so rotate the code the other way
+  // (rotations just permute the bits, so the errors can be added after).
+  for (unsigned int id = 0; id < codes.size(); id++) {
+    unsigned long long rotated[4];
+    rotated[0] = codes[id];
+    rotated[1] = rotate90(rotated[0], dimension);
+    rotated[2] = rotate90(rotated[1], dimension);
+    rotated[3] = rotate90(rotated[2], dimension);
+    for (int rot = 0; rot < 4; rot++)
+      addCodesNear(rotated[(4 - rot) % 4], 0, e, 0, id, rot);
+  }
+}
+
+void TagFamily::addCodesNear(unsigned long long w, int firstBit, int remaining,
+                             int flipped, int id, int rotation) {
+  // Same tie-breaking as the exhaustive search: closest, then lowest id, and
+  // then lowest rotation (codes are added in that order).
+  std::pair<std::unordered_map<unsigned long long, CodeMatch>::iterator, bool> it =
+    codeTable.insert(std::make_pair(w, CodeMatch{id, rotation, flipped}));
+  if (!it.second && flipped < it.first->second.hammingDistance)
+    it.first->second = CodeMatch{id, rotation, flipped};
+
+  if (remaining == 0)
+    return;
+
+  const unsigned long long oneLongLong = 1;
+  for (int b = firstBit; b < bits; b++)
+    addCodesNear(w ^ (oneLongLong << b), b + 1, remaining - 1, flipped + 1, id, rotation);
 }
 
 unsigned long long TagFamily::rotate90(unsigned long long w, int d) {
@@ -81,6 +132,33 @@ int TagFamily::popCount(unsigned long long w) {
 }
 
 void TagFamily::decode(TagDetection& det, unsigned long long rCode) const {
+  std::unordered_map<unsigned long long, CodeMatch>::const_iterator it = codeTable.find(rCode);
+  if (it != codeTable.end()) {
+    det.id = it->second.id;
+    det.hammingDistance = it->second.hammingDistance;
+    det.rotation = it->second.rotation;
+    det.good = (det.hammingDistance <= errorRecoveryBits);
+    det.obsCode = rCode;
+    det.code = codes[it->second.id];
+    return;
+  }
+
+  // Everything within hashedErrorBits is in the table, so only search if a
+  // code with more errors than that could still be good.
+  if (errorRecoveryBits > hashedErrorBits) {
+    decodeExhaustive(det, rCode);
+    return;
+  }
+
+  det.id = -1;
+  det.hammingDistance = INT_MAX;
+  det.rotation = 0;
+  det.good = false;
+  det.obsCode = rCode;
+  det.code = 0;
+}
+
+void TagFamily::decodeExhaustive(TagDetection& det, unsigned long long rCode) const {
   int  bestId = -1;
   int  bestHamming = INT_MAX;
   int  bestRotation = 0;
@@ -0,0 +1,65 @@
+#include <future>
+
+#include <glog/logging.h>
+
+#include "core/path_util.hpp"
+#include "core/inproc_bus.hpp"
+#include "core/timer.hpp"
+#include "params/params_snapshot.hpp"
+#include "state_estimator_lcm.hpp"
+#include "object_mesher_lcm.hpp"
+
+
+// Runs the StateEstimatorLcm and ObjectMesherLcm in one process. Stereo pairs and smoother results
+// are passed to the mesher over an InprocBus (by pointer), instead of being encoded to LCM and
+// decoded again. Everything else (including all outputs) still goes over LCM.
+int main(int argc, char const *argv[])
+{
+  // Set up glog.
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  CHECK_EQ(4ul, argc)
+      << "Requires (3) args: state_estimator_params_path, object_mesher_params_path and shared_params_path."
+      << "They should be relative to vehicle/config" << std::endl;
+
+  const std::string state_estimator_params_path = std::string(argv[1]);
+  const std::string object_mesher_params_path = std::string(argv[2]);
+  const std::string shared_params_path = std::string(argv[3]);
+
+  // The two nodes' params don't depend on each other, so parse them at the same time.
+  Timer load_timer(true);
+  std::future<ParamsSnapshot<StateEstimatorLcm::Params>::Ptr> state_estimator_future = std::async(std::launch::async, [&]()
+  {
+    return std::make_shared<ParamsSnapshot<StateEstimatorLcm::Params>>(
+      config_path(state_estimator_params_path),
+      config_path(shared_params_path));
+  });
+  ObjectMesherLcm::Params object_mesher_params(
+    config_path(object_mesher_params_path),
+    config_path(shared_params_path));
+  const ParamsSnapshot<StateEstimatorLcm::Params>::Ptr state_estimator_snapshot = state_estimator_future.get();
+  LOG(INFO) << "Loaded all params in " << load_timer.Elapsed().milliseconds() << " ms" << std::endl;
+
+  StateEstimatorLcm::Params state_estimator_params = *state_estimator_snapshot->Get();
+
+  // The bus topics are the StateEstimatorLcm's channels, whatever the mesher would use over LCM.
+  object_mesher_params.channel_input_stereo = state_estimator_params.channel_input_stereo;
+  object_mesher_params.channel_input_smoother_pose = state_estimator_params.channel_output_smoother_pose;
+
+  InprocBus::Ptr bus = std::make_shared<InprocBus>();
+
+  // NOTE(milo): The mesher has to subscribe first, since the StateEstimatorLcm starts publishing
+  // as soon as it gets an initial pose (in its constructor).
+  ObjectMesherLcm object_mesher(object_mesher_params, bus);
+  StateEstimatorLcm state_estimator(state_estimator_params, bus);
+  state_estimator.WatchParams(state_estimator_snapshot);
+  state_estimator.Spin();
+
+  // Stop delivering to the mesher before either node is destroyed.
+  bus->Close();
+
+  LOG(INFO) << "DONE" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,436 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/image_util.hpp"
+#include "params/params_base.hpp"
+#include "core/path_util.hpp"
+#include "core/inproc_bus.hpp"
+#include "core/data_subsampler.hpp"
+#include "lcm_util/decode_image.hpp"
+#include "lcm_util/util_mesh_t.hpp"
+#include "lcm_util/util_surfel_map_t.hpp"
+#include "lcm_util/util_node_status_t.hpp"
+#include "lcm_util/image_subscriber.hpp"
+#include "lcm_util/perf_profile.hpp"
+#include "mesher/object_mesher.hpp"
+#include "mesher/local_costmap.hpp"
+#include "mesher/surfel_map.hpp"
+#include "vision_core/viz_tap.hpp"
+#include "vio/smoother_result.hpp"
+
+#include "vehicle/stereo_image_t.hpp"
+#include "vehicle/mesh_stamped_t.hpp"
+#include "vehicle/mesh_delta_t.hpp"
+#include "vehicle/pose3_stamped_t.hpp"
+#include "vehicle/surfel_map_update_t.hpp"
+#include "vehicle/node_status_t.hpp"
+#include "vehicle/perf_profile_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// Interpolates between two poses (slerp for the rotation, linear for the translation).
+static Matrix4d InterpolatePose(timestamp_t t0, const Matrix4d& T0,
+                                timestamp_t t1, const Matrix4d& T1,
+                                timestamp_t t)
+{
+  if (t1 <= t0) {
+    return T1;
+  }
+
+  const double alpha = static_cast<double>(t - t0) / static_cast<double>(t1 - t0);
+  const Quaterniond q0(Matrix3d(T0.block<3, 3>(0, 0)));
+  const Quaterniond q1(Matrix3d(T1.block<3, 3>(0, 0)));
+
+  Matrix4d T = Matrix4d::Identity();
+  T.block<3, 3>(0, 0) = q0.slerp(alpha, q1).toRotationMatrix();
+  T.block<3, 1>(0, 3) = (1.0 - alpha) * T0.block<3, 1>(0, 3) + alpha * T1.block<3, 1>(0, 3);
+  return T;
+}
+
+
+class ObjectMesherLcm final {
+ public:
+  struct Params : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    std::string channel_input_stereo;
+    std::string channel_output_mesh;
+    std::string channel_output_mesh_delta;  // Compact version of the mesh, for low bandwidth links.
+    int mesh_delta_keyframe_period = 30;
+    double mesh_delta_min_move = 0.01;      // m
+    bool visualize = true;
+    bool expect_shm_images = true;
+    bool shm_ring_images = false;     // Raw images from a ShmStereoPublisher (overrides expect_shm_images).
+    int mesher_input_height = 480;    // Downsample images to have this height.
+
+    // In dense mode, run this many noise frames (at the mesher input size) through the GPU before
+    // subscribing to images. Readiness (and the warm-up times) go out on channel_output_status.
+    int warm_up_frames = 3;
+    std::string channel_output_status;
+
+    // Meshes are fused into a world-frame SurfelMap once the smoother has a pose for them.
+    bool accumulate_meshes = true;
+    std::string channel_input_smoother_pose;
+    std::string channel_output_surfels;
+    int max_pending_meshes = 30;      // Meshes waiting for a pose (the oldest are dropped).
+    int max_buffered_poses = 100;
+
+    // Named performance profiles (see PerfProfiles), relative to vehicle/config. A perf_profile_t on
+    // channel_input_perf_profile switches between them at runtime. Empty = no profiles.
+    std::string perf_profiles_path;
+    std::string channel_input_perf_profile;
+    PerfProfiles perf_profiles;
+
+    ObjectMesher::Params mesher_params;
+    SurfelMap::Params surfel_map_params;
+    LocalCostmap::Params local_costmap_params;   // Follows the vehicle, for planner queries.
+
+   private:
+    void LoadParams(const YamlParser& parser) override
+    {
+      channel_input_stereo = YamlToString(parser.GetNode("channel_input_stereo"));
+      channel_output_mesh = YamlToString(parser.GetNode("channel_output_mesh"));
+      channel_output_mesh_delta = YamlToString(parser.GetNode("channel_output_mesh_delta"));
+      parser.GetParam("mesh_delta_keyframe_period", &mesh_delta_keyframe_period);
+      parser.GetParam("mesh_delta_min_move", &mesh_delta_min_move);
+      parser.GetParam("visualize", &visualize);
+      parser.GetParam("expect_shm_images", &expect_shm_images);
+      parser.GetParam("shm_ring_images", &shm_ring_images);
+      parser.GetParam("mesher_input_height", &mesher_input_height);
+      parser.GetParam("warm_up_frames", &warm_up_frames);
+      channel_output_status = YamlToString(parser.GetNode("channel_output_status"));
+      parser.GetParam("accumulate_meshes", &accumulate_meshes);
+      channel_input_smoother_pose = YamlToString(parser.GetNode("channel_input_smoother_pose"));
+      channel_output_surfels = YamlToString(parser.GetNode("channel_output_surfels"));
+      parser.GetParam("max_pending_meshes", &max_pending_meshes);
+      parser.GetParam("max_buffered_poses", &max_buffered_poses);
+      perf_profiles_path = YamlToString(parser.GetNode("perf_profiles_path"));
+      channel_input_perf_profile = YamlToString(parser.GetNode("channel_input_perf_profile"));
+      if (!perf_profiles_path.empty()) {
+        perf_profiles = PerfProfiles(config_path(perf_profiles_path));
+      }
+      mesher_params = ObjectMesher::Params(parser.Subtree("ObjectMesher"));
+      surfel_map_params = SurfelMap::Params(parser.Subtree("SurfelMap"));
+      local_costmap_params = LocalCostmap::Params(parser.Subtree("LocalCostmap"));
+    }
+  };
+
+  // If a bus is given, stereo pairs and smoother results come from it (published by a
+  // StateEstimatorLcm in the same process) instead of LCM. Meshes and surfels still go out on LCM.
+  ObjectMesherLcm(const Params& params, const InprocBus::Ptr& bus = nullptr)
+      : params_(params),
+        bus_(bus),
+        mesher_(params.mesher_params),
+        surfel_map_(params.surfel_map_params),
+        costmap_(params.local_costmap_params),
+        mesh_delta_encoder_(params.mesh_delta_keyframe_period, params.mesh_delta_min_move),
+        viz_tap_(std::make_shared<VizTap>()),
+        viewer_(viz_tap_)
+  {
+    if (!lcm_.good()) {
+      LOG(WARNING) << "Failed to initialize LCM" << std::endl;
+      return;
+    }
+
+    // NOTE(milo): Images aren't subscribed to until the warm-up is done, so the first real frames
+    // never queue up behind it.
+    PublishStatus(false, "warming up");
+    warm_up_report_ = mesher_.WarmUp(InputSize(), params_.warm_up_frames);
+
+    // NOTE(milo): Visualization is rendered on the viewer's own thread, so it never blocks meshing.
+    if (params_.visualize) {
+      mesher_.SetVizTap(viz_tap_);
+      viewer_.Start();
+    }
+
+    // NOTE(milo): Meshing is slow, so images from the bus are handled on their own thread, and only
+    // the newest couple are kept.
+    if (bus_) {
+      bus_->Subscribe<StereoImage1b>(params_.channel_input_stereo,
+          [this](const std::shared_ptr<const StereoImage1b>& stereo_pair) { HandleStereo(*stereo_pair); }, 2);
+    } else {
+      const ImageTransport transport = params_.shm_ring_images ? ImageTransport::SHM_RING :
+          (params_.expect_shm_images ? ImageTransport::MMF : ImageTransport::LCM_MESSAGE);
+      sub_.reset(new ImageSubscriber(lcm_, params_.channel_input_stereo, transport));
+      sub_->RegisterCallback(std::bind(&ObjectMesherLcm::HandleStereo, this, std::placeholders::_1));
+
+      // Dense meshing runs Patchmatch on the GPU, which can read the images in place if they're
+      // decoded into mapped memory (see PatchmatchGpu::Params::zero_copy).
+      sub_->DecodeIntoMappedMemory(params_.mesher_params.dense);
+    }
+
+    LOG(INFO) << "Listening for images on: " << params_.channel_input_stereo << (bus_ ? " (in process)" : "") << std::endl;
+    LOG(INFO) << "Will publish mesh on: " << params_.channel_output_mesh << std::endl;
+    LOG(INFO) << "Will publish mesh deltas on: " << params_.channel_output_mesh_delta << std::endl;
+
+    if (params_.accumulate_meshes && bus_) {
+      bus_->Subscribe<vio::SmootherResult>(params_.channel_input_smoother_pose,
+          [this](const std::shared_ptr<const vio::SmootherResult>& result)
+      {
+        AddSmootherPose(ConvertToNanoseconds(result->timestamp), result->world_P_body.matrix());
+      }, 10);
+    } else if (params_.accumulate_meshes) {
+      lcm_.subscribe(params_.channel_input_smoother_pose.c_str(), &ObjectMesherLcm::HandleSmootherPose, this);
+    }
+
+    if (params_.accumulate_meshes) {
+      LOG(INFO) << "Listening for poses on: " << params_.channel_input_smoother_pose << std::endl;
+      LOG(INFO) << "Will publish surfels on: " << params_.channel_output_surfels << std::endl;
+    }
+
+    // NOTE(milo): Switches always come over LCM (even with a bus), so every node gets the same one.
+    if (!params_.perf_profiles_path.empty()) {
+      if (!params_.perf_profiles.initial_profile.empty()) {
+        ApplyProfile(*params_.perf_profiles.Find(params_.perf_profiles.initial_profile));
+      }
+      lcm_.subscribe(params_.channel_input_perf_profile.c_str(), &ObjectMesherLcm::HandlePerfProfile, this);
+      LOG(INFO) << "Listening for perf profiles on: " << params_.channel_input_perf_profile << std::endl;
+    }
+  }
+
+  void Spin()
+  {
+    PublishStatus(true, "running");
+    while (0 == lcm_.handle() && !is_shutdown_);
+  }
+
+  void HandleStereo(const StereoImage1b& stereo_pair)
+  {
+    std::lock_guard<std::mutex> lock(handler_lock_);
+
+    if (!run_mesher_) {
+      return;
+    }
+    if (mesh_subsampler_ && !mesh_subsampler_->ShouldSample(ConvertToSeconds(stereo_pair.timestamp))) {
+      return;
+    }
+
+    TriangleMesh mesh;
+
+    if (stereo_pair.left_image.rows > params_.mesher_input_height) {
+      StereoImage1b pair_downsized = StereoImage1b(stereo_pair.timestamp, stereo_pair.camera_id, Image1b(), Image1b());
+      const double height = static_cast<double>(stereo_pair.left_image.rows);
+      const double scale_factor = static_cast<double>(params_.mesher_input_height) / height;
+      const cv::Size input_size(static_cast<int>(scale_factor * stereo_pair.left_image.cols), params_.mesher_input_height);
+      cv::resize(stereo_pair.left_image, pair_downsized.left_image, input_size, 0, 0, cv::INTER_LINEAR);
+      cv::resize(stereo_pair.right_image, pair_downsized.right_image, input_size, 0, 0, cv::INTER_LINEAR);
+      mesh = mesher_.ProcessStereo(std::move(pair_downsized));
+    } else {
+      mesh = mesher_.ProcessStereo(std::move(stereo_pair));
+    }
+
+    // NOTE(milo): If the scene didn't change enough to trigger meshing, subscribers (and the surfel
+    // map) already have this mesh.
+    if (!mesher_.LastMeshUpdated()) {
+      return;
+    }
+
+    vehicle::mesh_stamped_t out;
+    out.header.timestamp = stereo_pair.timestamp;
+    out.header.seq = stereo_pair.camera_id;
+    pack_mesh_t(mesh.vertices, mesh.triangles, out.mesh);
+    lcm_.publish(params_.channel_output_mesh.c_str(), &out);
+
+    vehicle::mesh_delta_t delta;
+    mesh_delta_encoder_.Encode(mesh, delta);
+    delta.header.timestamp = stereo_pair.timestamp;
+    delta.header.frame_id = "cam_left";
+    lcm_.publish(params_.channel_output_mesh_delta.c_str(), &delta);
+
+    if (params_.accumulate_meshes) {
+      pending_meshes_.emplace_back(stereo_pair.timestamp, std::move(mesh));
+      while (pending_meshes_.size() > static_cast<size_t>(params_.max_pending_meshes)) {
+        pending_meshes_.pop_front();
+      }
+      FusePendingMeshes();
+    }
+  }
+
+  // Switch to a performance profile (see PerfProfiles). Frames are handled under the same lock, so
+  // this takes effect between two frames, and no frame is meshed with half of a profile.
+  void ApplyProfile(const PerfProfile& profile)
+  {
+    std::lock_guard<std::mutex> lock(handler_lock_);
+
+    run_mesher_ = profile.run_mesher;
+    mesher_.SetPatchmatchIters(profile.patchmatch_iters);
+    if (profile.mesh_max_hz > 0) {
+      mesh_subsampler_.reset(new DataSubsampler(profile.mesh_max_hz));
+    } else {
+      mesh_subsampler_.reset();
+    }
+    profile_name_ = profile.name;
+
+    LOG(INFO) << "Switched to perf profile " << profile.name
+              << ": run_mesher=" << profile.run_mesher
+              << " mesh_max_hz=" << profile.mesh_max_hz
+              << " patchmatch_iters=" << profile.patchmatch_iters << std::endl;
+  }
+
+  void HandlePerfProfile(const lcm::ReceiveBuffer*,
+                         const std::string&,
+                         const vehicle::perf_profile_t* msg)
+  {
+    const PerfProfile* profile = params_.perf_profiles.Find(msg->name);
+    if (profile == nullptr) {
+      LOG(WARNING) << "Ignoring unknown perf profile: " << msg->name << std::endl;
+      return;
+    }
+    if (profile->name == profile_name_) {
+      return;
+    }
+    ApplyProfile(*profile);
+    PublishStatus(true, "running (" + profile->name + ")");
+  }
+
+  // The size that images are meshed at (see mesher_input_height), assuming they match the rig.
+  cv::Size InputSize() const
+  {
+    const StereoCamera& rig = params_.mesher_params.stereo_rig;
+    if (rig.Height() <= params_.mesher_input_height) {
+      return cv::Size(rig.Width(), rig.Height());
+    }
+    const double scale_factor = static_cast<double>(params_.mesher_input_height) / rig.Height();
+    return cv::Size(static_cast<int>(scale_factor * rig.Width()), params_.mesher_input_height);
+  }
+
+  // Whether the node is ready for images, stamped with the wall time.
+  void PublishStatus(bool ready, const std::string& status)
+  {
+    vehicle::node_status_t msg;
+    msg.header.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    msg.header.seq = -1;
+    pack_node_status_t("object_mesher", ready, status, warm_up_report_, msg);
+    lcm_.publish(params_.channel_output_status.c_str(), &msg);
+  }
+
+  void HandleSmootherPose(const lcm::ReceiveBuffer*,
+                          const std::string&,
+                          const vehicle::pose3_stamped_t* msg)
+  {
+    const vehicle::pose3_t& p = msg->pose;
+    const Quaterniond q(p.orientation.w, p.orientation.x, p.orientation.y, p.orientation.z);
+
+    Matrix4d world_T_body = Matrix4d::Identity();
+    world_T_body.block<3, 3>(0, 0) = q.normalized().toRotationMatrix();
+    world_T_body.block<3, 1>(0, 3) = Vector3d(p.position.x, p.position.y, p.position.z);
+
+    AddSmootherPose(static_cast<timestamp_t>(msg->header.timestamp), world_T_body);
+  }
+
+  void AddSmootherPose(timestamp_t timestamp, const Matrix4d& world_T_body)
+  {
+    std::lock_guard<std::mutex> lock(handler_lock_);
+
+    poses_[timestamp] = world_T_body;
+    while (poses_.size() > static_cast<size_t>(params_.max_buffered_poses)) {
+      poses_.erase(poses_.begin());
+    }
+
+    FusePendingMeshes();
+  }
+
+  // Fuses every pending mesh that's bracketed by two smoother poses, and publishes the blocks of
+  // the SurfelMap that changed.
+  void FusePendingMeshes()
+  {
+    bool did_fuse = false;
+
+    while (!pending_meshes_.empty() && !poses_.empty()) {
+      const timestamp_t t = pending_meshes_.front().first;
+
+      // NOTE(milo): Meshes from before the first buffered pose will never get one.
+      if (t < poses_.begin()->first) {
+        pending_meshes_.pop_front();
+        continue;
+      }
+
+      const auto hi = poses_.lower_bound(t);
+      if (hi == poses_.end()) {
+        break;  // Wait for the smoother to catch up.
+      }
+
+      Matrix4d world_T_body = hi->second;
+      if (hi->first != t) {
+        const auto lo = std::prev(hi);
+        world_T_body = InterpolatePose(lo->first, lo->second, hi->first, hi->second, t);
+      }
+
+      const Matrix4d world_T_cam = world_T_body * params_.mesher_params.body_T_cam_left;
+      surfel_map_.Integrate(t, pending_meshes_.front().second, world_T_cam);
+      costmap_.Recenter(world_T_body.block<3, 1>(0, 3));
+      costmap_.IntegrateMesh(pending_meshes_.front().second, world_T_cam);
+      pending_meshes_.pop_front();
+      did_fuse = true;
+    }
+
+    if (!did_fuse) {
+      return;
+    }
+
+    BlockSet updated, evicted;
+    surfel_map_.PopChanges(updated, evicted);
+
+    vehicle::surfel_map_update_t out;
+    out.header.timestamp = poses_.rbegin()->first;
+    out.header.seq = -1;
+    out.header.frame_id = "world";
+    pack_surfel_map_update_t(surfel_map_, updated, evicted, out);
+    lcm_.publish(params_.channel_output_surfels.c_str(), &out);
+  }
+
+  // Collision queries against the LocalCostmap around the vehicle (world frame). These can be called
+  // from any thread (e.g a planner's).
+  double CostmapDistance(const Vector3d& world_p)
+  {
+    std::lock_guard<std::mutex> lock(handler_lock_);
+    return costmap_.Distance(world_p);
+  }
+
+  bool CostmapSegmentFree(const Vector3d& world_a, const Vector3d& world_b, double clearance)
+  {
+    std::lock_guard<std::mutex> lock(handler_lock_);
+    return costmap_.IsSegmentFree(world_a, world_b, clearance);
+  }
+
+ private:
+  std::atomic_bool is_shutdown_{false};
+  Params params_;
+  InprocBus::Ptr bus_;
+
+  // NOTE(milo): With LCM, everything is handled on the LCM thread. With a bus, images and poses
+  // arrive on different threads, so this serializes them.
+  std::mutex handler_lock_;
+
+  ObjectMesher mesher_;
+  SurfelMap surfel_map_;
+  LocalCostmap costmap_;
+  MeshDeltaEncoder mesh_delta_encoder_;
+  VizTap::Ptr viz_tap_;
+  VizTapViewer viewer_;
+  std::deque<std::pair<timestamp_t, TriangleMesh>> pending_meshes_;
+  std::map<timestamp_t, Matrix4d> poses_;    // world_T_body from the smoother.
+  lcm::LCM lcm_;
+  WarmUpReport warm_up_report_;
+  std::unique_ptr<ImageSubscriber> sub_;    // Only without a bus.
+
+  // NOTE(milo): These are only touched under handler_lock_ (see ApplyProfile).
+  bool run_mesher_ = true;
+  std::unique_ptr<DataSubsampler> mesh_subsampler_;   // Only if the profile limits the mesh rate.
+  std::string profile_name_;
+};
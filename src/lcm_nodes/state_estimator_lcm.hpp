@@ -0,0 +1,732 @@
+#pragma once
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <unordered_map>
+
+#include <opencv2/highgui.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/params_snapshot.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "core/timer.hpp"
+#include "core/uid.hpp"
+#include "core/file_utils.hpp"
+#include "core/path_util.hpp"
+#include "vision_core/image_util.hpp"
+#include "core/data_subsampler.hpp"
+#include "core/stats_tracker.hpp"
+#include "core/inproc_bus.hpp"
+#include "core/publish_scheduler.hpp"
+#include "core/latency_trace.hpp"
+
+#include "dataset/dataset_util.hpp"
+
+#include "vio/state_estimator.hpp"
+#include "vio/visualizer_3d.hpp"
+#include "vio/smoother_result.hpp"
+#include "mesher/object_mesher.hpp"
+
+#include "lcm_util/util_pose3_t.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+#include "lcm_util/util_depth_measurement_t.hpp"
+#include "lcm_util/util_range_measurement_t.hpp"
+#include "lcm_util/util_mag_measurement_t.hpp"
+#include "lcm_util/util_mesh_t.hpp"
+#include "lcm_util/util_latency_trace_t.hpp"
+#include "lcm_util/util_node_status_t.hpp"
+#include "lcm_util/image_subscriber.hpp"
+#include "lcm_util/image_preview.hpp"
+#include "lcm_util/lcm_stats_exporter.hpp"
+#include "lcm_util/lcm_publisher.hpp"
+#include "lcm_util/scheduled_lcm_publisher.hpp"
+#include "lcm_util/receive_latency.hpp"
+#include "lcm_util/perf_profile.hpp"
+
+#include "feature_tracking/visualization_2d.hpp"
+
+#include "vehicle/pose3_stamped_t.hpp"
+#include "vehicle/propagated_pose_t.hpp"
+#include "vehicle/stereo_image_t.hpp"
+#include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/imu_batch_t.hpp"
+#include "vehicle/range_measurement_t.hpp"
+#include "vehicle/depth_measurement_t.hpp"
+#include "vehicle/mag_measurement_t.hpp"
+#include "vehicle/mesh_stamped_t.hpp"
+#include "vehicle/image_preview_t.hpp"
+#include "vehicle/latency_trace_t.hpp"
+#include "vehicle/node_status_t.hpp"
+#include "vehicle/perf_profile_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+class StateEstimatorLcm final {
+ public:
+  struct Params : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    bool use_stereo = true;
+    bool use_imu = true;
+    bool use_depth = true;
+    bool use_range = true;
+    bool use_mag = true;
+
+    // Images get their own LCM instance (and thread), so that a burst of image traffic doesn't
+    // delay IMU and other sensor messages queued behind it. The provider URLs can also differ
+    // (e.g a separate multicast port for images, so the sensor socket never sees image packets).
+    std::string lcm_url_sensors;
+    std::string lcm_url_images;
+    bool separate_image_lcm = true;
+    int lcm_handle_timeout_ms = 100;      // Each LCM thread checks for shutdown this often.
+
+    // Time between LCM receiving each message and its handler running, per channel.
+    std::string channel_output_lcm_stats;
+    float lcm_stats_interval_sec = 5.0;
+
+    // Follow each keyframe from LCM receive through decode, frontend and smoother to publish, and
+    // send the stage times out as a latency_trace_t (see the latency_monitor tool).
+    bool trace_latency = false;
+    std::string channel_output_latency_trace;
+
+    // Before listening for the initial pose, run this many dummy frames through the frontend (and
+    // one smoother update), so that the first real keyframes aren't slowed down by startup costs.
+    // Readiness (and the warm-up times) go out on channel_output_status.
+    int warm_up_frames = 5;
+    std::string channel_output_status;
+
+    std::string channel_input_stereo;
+    std::vector<std::string> channel_input_rig_stereo;  // The other stereo rigs (1, 2, ...), see /shared/stereo_rigs.
+    bool expect_shm_images = true;
+    bool async_decode_images = false;   // Decode images off of the LCM thread (see ImageSubscriber).
+    bool shm_ring_images = false;       // Raw images from a ShmStereoPublisher (overrides expect_shm_images).
+
+    std::string channel_input_imu;
+    std::string channel_input_imu_batch;  // Several IMU measurements per message (imu_batch_t).
+    std::string channel_input_range;
+    std::string channel_input_depth;
+    std::string channel_input_mag;
+    std::string channel_initial_pose;
+
+    // Run the ObjectMesher on the StereoFrontend's tracks, instead of in object_mesher_lcm (which
+    // tracks the same images again).
+    bool run_object_mesher = false;
+    std::string channel_output_mesh;
+
+    std::string channel_output_filter_pose;
+    std::string channel_output_smoother_pose;
+    std::string channel_output_propagated_pose;
+
+    bool visualize = true;
+    float filter_publish_hz = 50.0;
+
+    // With WatchParams(), check the yaml files for changes this often, and apply the tunables that
+    // can change at runtime (filter_publish_hz, max_features_per_frame). 0 = never.
+    float params_reload_sec = 0;
+
+    // Named performance profiles (see PerfProfiles), relative to vehicle/config. A perf_profile_t on
+    // channel_input_perf_profile switches between them at runtime. Empty = no profiles.
+    std::string perf_profiles_path;
+    std::string channel_input_perf_profile;
+    PerfProfiles perf_profiles;
+
+    // Filter and smoother poses go out ahead of meshes. If the link saturates (or its capacity is
+    // configured), meshes slow down to as low as mesh_min_hz, instead of delaying poses.
+    float link_max_bytes_per_sec = 0;       // 0 = unknown (publish failures set the budget).
+    float link_min_bytes_per_sec = 10e3;
+    float mesh_max_hz = 5.0;
+    float mesh_min_hz = 0.5;
+
+    // A downscaled, low quality JPEG of each left image (for lcm_image_viewer), at most
+    // image_preview_hz. It's the first traffic to slow down if the link saturates.
+    bool publish_image_preview = true;
+    std::string channel_output_image_preview;
+    float image_preview_hz = 2.0;
+    float image_preview_scale = 0.25;
+    int image_preview_jpeg_quality = 50;
+
+    mesher::ObjectMesher::Params mesher_params;
+    StateEstimator::Params state_estimator_params;
+    Visualizer3D::Params visualizer3d_params;
+
+   private:
+    void LoadParams(const YamlParser& parser) override
+    {
+      parser.GetParam("use_stereo", &use_stereo);
+      parser.GetParam("use_imu", &use_imu);
+      parser.GetParam("use_depth", &use_depth);
+      parser.GetParam("use_range", &use_range);
+      parser.GetParam("use_mag", &use_mag);
+
+      lcm_url_sensors = YamlToString(parser.GetNode("lcm_url_sensors"));
+      lcm_url_images = YamlToString(parser.GetNode("lcm_url_images"));
+      parser.GetParam("separate_image_lcm", &separate_image_lcm);
+      parser.GetParam("lcm_handle_timeout_ms", &lcm_handle_timeout_ms);
+      channel_output_lcm_stats = YamlToString(parser.GetNode("channel_output_lcm_stats"));
+      parser.GetParam("lcm_stats_interval_sec", &lcm_stats_interval_sec);
+      parser.GetParam("trace_latency", &trace_latency);
+      channel_output_latency_trace = YamlToString(parser.GetNode("channel_output_latency_trace"));
+      parser.GetParam("warm_up_frames", &warm_up_frames);
+      channel_output_status = YamlToString(parser.GetNode("channel_output_status"));
+
+      channel_input_stereo = YamlToString(parser.GetNode("channel_input_stereo"));
+      channel_input_rig_stereo = YamlToStringList(parser.GetNode("channel_input_rig_stereo"));
+      parser.GetParam("expect_shm_images", &expect_shm_images);
+      parser.GetParam("async_decode_images", &async_decode_images);
+      parser.GetParam("shm_ring_images", &shm_ring_images);
+
+      channel_input_imu = YamlToString(parser.GetNode("channel_input_imu"));
+      channel_input_imu_batch = YamlToString(parser.GetNode("channel_input_imu_batch"));
+      channel_input_depth = YamlToString(parser.GetNode("channel_input_depth"));
+      channel_input_range = YamlToString(parser.GetNode("channel_input_range"));
+      channel_input_mag = YamlToString(parser.GetNode("channel_input_mag"));
+      channel_initial_pose = YamlToString(parser.GetNode("channel_initial_pose"));
+
+      channel_output_filter_pose = YamlToString(parser.GetNode("channel_output_filter_pose"));
+      channel_output_smoother_pose = YamlToString(parser.GetNode("channel_output_smoother_pose"));
+      channel_output_propagated_pose = YamlToString(parser.GetNode("channel_output_propagated_pose"));
+
+      parser.GetParam("visualize", &visualize);
+      parser.GetParam("filter_publish_hz", &filter_publish_hz);
+      parser.GetParam("params_reload_sec", &params_reload_sec);
+      perf_profiles_path = YamlToString(parser.GetNode("perf_profiles_path"));
+      channel_input_perf_profile = YamlToString(parser.GetNode("channel_input_perf_profile"));
+      if (!perf_profiles_path.empty()) {
+        perf_profiles = PerfProfiles(config_path(perf_profiles_path));
+      }
+      parser.GetParam("link_max_bytes_per_sec", &link_max_bytes_per_sec);
+      parser.GetParam("link_min_bytes_per_sec", &link_min_bytes_per_sec);
+      parser.GetParam("mesh_max_hz", &mesh_max_hz);
+      parser.GetParam("mesh_min_hz", &mesh_min_hz);
+      parser.GetParam("publish_image_preview", &publish_image_preview);
+      channel_output_image_preview = YamlToString(parser.GetNode("channel_output_image_preview"));
+      parser.GetParam("image_preview_hz", &image_preview_hz);
+      parser.GetParam("image_preview_scale", &image_preview_scale);
+      parser.GetParam("image_preview_jpeg_quality", &image_preview_jpeg_quality);
+
+      parser.GetParam("run_object_mesher", &run_object_mesher);
+      if (run_object_mesher) {
+        channel_output_mesh = YamlToString(parser.GetNode("channel_output_mesh"));
+        mesher_params = mesher::ObjectMesher::Params(parser.Subtree("ObjectMesher"));
+        CHECK(!mesher_params.use_own_tracker) << "ObjectMesher should use the StereoFrontend's tracks" << std::endl;
+        CHECK(!mesher_params.dense) << "Dense meshing needs the stereo pairs, run it in object_mesher_lcm" << std::endl;
+      }
+
+      state_estimator_params = StateEstimator::Params(parser.Subtree("StateEstimator"));
+      visualizer3d_params = Visualizer3D::Params(parser.Subtree("Visualizer3D"));
+    }
+  };
+
+  static PublishScheduler::Params SchedulerParamsFor(const Params& params)
+  {
+    PublishScheduler::Params out;
+    out.link_max_bytes_per_sec = params.link_max_bytes_per_sec;
+    out.link_min_bytes_per_sec = params.link_min_bytes_per_sec;
+    return out;
+  }
+
+  static ImageTransport ImageTransportFor(const Params& params)
+  {
+    if (params.shm_ring_images) {
+      return ImageTransport::SHM_RING;
+    }
+    return params.expect_shm_images ? ImageTransport::MMF : ImageTransport::LCM_MESSAGE;
+  }
+
+  // If a bus is given, each stereo pair and smoother result also goes out on it (on the
+  // channel_input_stereo and channel_output_smoother_pose topics), for other nodes in this process.
+  StateEstimatorLcm(const Params& params, const InprocBus::Ptr& bus = nullptr)
+      : params_(params),
+        bus_(bus),
+        lcm_(params.lcm_url_sensors),
+        image_lcm_(params.separate_image_lcm ? new lcm::LCM(params.lcm_url_images) : nullptr),
+        scheduler_(SchedulerParamsFor(params)),
+        filter_pose_pub_(lcm_, params.channel_output_filter_pose, scheduler_, PublishPriority::CRITICAL, params.filter_publish_hz),
+        smoother_pose_pub_(lcm_, params.channel_output_smoother_pose, scheduler_, PublishPriority::CRITICAL, 0),
+        propagated_pose_pub_(lcm_, params.channel_output_propagated_pose),
+        latency_trace_pub_(lcm_, params.channel_output_latency_trace),
+        status_pub_(lcm_, params.channel_output_status),
+        mesh_pub_(lcm_, params.channel_output_mesh, scheduler_, PublishPriority::NORMAL, params.mesh_max_hz, params.mesh_min_hz),
+        preview_pub_(lcm_, params.channel_output_image_preview, scheduler_, PublishPriority::VISUALIZATION,
+                     params.image_preview_hz, 0.1 * params.image_preview_hz),
+        state_estimator_(params.state_estimator_params),
+        viz_(params.visualizer3d_params),
+        filter_subsampler_(params.filter_publish_hz),
+        preview_subsampler_(params.image_preview_hz),
+        image_sub_(ImageLcm(), params_.channel_input_stereo, ImageTransportFor(params_), params_.async_decode_images)
+  {
+    if (!lcm_.good()) {
+      LOG(WARNING) << "Failed to initialize LCM" << std::endl;
+      return;
+    }
+    if (!ImageLcm().good()) {
+      LOG(WARNING) << "Failed to initialize LCM for images" << std::endl;
+      return;
+    }
+
+    lcm_stats_.RegisterExporter(std::make_shared<LcmStatsExporter>(lcm_, params_.channel_output_lcm_stats));
+    imu_latency_ = &lcm_stats_.Histogram("ReceiveLatency/" + params_.channel_input_imu);
+    imu_batch_latency_ = &lcm_stats_.Histogram("ReceiveLatency/" + params_.channel_input_imu_batch);
+    depth_latency_ = &lcm_stats_.Histogram("ReceiveLatency/" + params_.channel_input_depth);
+    range_latency_ = &lcm_stats_.Histogram("ReceiveLatency/" + params_.channel_input_range);
+    mag_latency_ = &lcm_stats_.Histogram("ReceiveLatency/" + params_.channel_input_mag);
+    image_sub_.RecordReceiveLatency(&lcm_stats_.Histogram("ReceiveLatency/" + params_.channel_input_stereo));
+    for (const std::string& channel : params_.channel_input_rig_stereo) {
+      rig_image_subs_.emplace_back(new ImageSubscriber(ImageLcm(), channel, ImageTransportFor(params_), params_.async_decode_images));
+      rig_image_subs_.back()->RecordReceiveLatency(&lcm_stats_.Histogram("ReceiveLatency/" + channel));
+    }
+
+    if (params_.trace_latency) {
+      tracer_ = std::make_shared<LatencyTracer>();
+      image_sub_.TraceLatency(tracer_);
+      state_estimator_.TraceLatency(tracer_);
+      LOG(INFO) << "Will publish latency traces on: " << params_.channel_output_latency_trace << std::endl;
+    }
+
+    state_estimator_.RegisterSmootherResultCallback(std::bind(&StateEstimatorLcm::SmootherCallback, this, std::placeholders::_1));
+    state_estimator_.RegisterFilterResultCallback(std::bind(&StateEstimatorLcm::FilterCallback, this, std::placeholders::_1));
+    state_estimator_.RegisterPropagatedStateCallback(std::bind(&StateEstimatorLcm::PropagatedCallback, this, std::placeholders::_1));
+
+    lcm_.subscribe(params_.channel_initial_pose.c_str(), &StateEstimatorLcm::InitializeLcm, this);
+    LOG(INFO) << "Listening for initial pose on channel: " << params_.channel_initial_pose << std::endl;
+
+    if (params_.run_object_mesher) {
+      mesher_.reset(new mesher::ObjectMesher(params_.mesher_params));
+      state_estimator_.RegisterFeatureTracksCallback(std::bind(&StateEstimatorLcm::FeatureTracksCallback, this, std::placeholders::_1, std::placeholders::_2));
+      LOG(INFO) << "Will publish mesh on: " << params_.channel_output_mesh << std::endl;
+    }
+
+    // Bind the image subscriber callback directly to the internal state estimator.
+    // NOTE(milo): The copy on the bus shares its pixels with this one, so nobody can modify them.
+    image_sub_.RegisterCallback([this](const StereoImage1b& stereo_pair)
+    {
+      state_estimator_.ReceiveStereo(stereo_pair);
+      MaybePublishPreview(stereo_pair);
+      if (bus_) {
+        bus_->Publish<StereoImage1b>(params_.channel_input_stereo, std::make_shared<const StereoImage1b>(stereo_pair));
+      }
+    });
+    for (size_t i = 0; i < rig_image_subs_.size(); ++i) {
+      rig_image_subs_.at(i)->RegisterCallback([this, i](const StereoImage1b& stereo_pair)
+      {
+        state_estimator_.ReceiveStereo(stereo_pair, i + 1);
+      });
+    }
+
+    scheduler_.Start();
+
+    if (!params_.perf_profiles_path.empty()) {
+      lcm_.subscribe(params_.channel_input_perf_profile.c_str(), &StateEstimatorLcm::HandlePerfProfile, this);
+      LOG(INFO) << "Listening for perf profiles on: " << params_.channel_input_perf_profile << std::endl;
+      if (!params_.perf_profiles.initial_profile.empty()) {
+        ApplyProfile(*params_.perf_profiles.Find(params_.perf_profiles.initial_profile));
+      }
+    }
+
+    // NOTE(milo): The initial pose is only handled after warming up, so nothing starts until then.
+    PublishStatus(false, "warming up");
+    warm_up_report_ = state_estimator_.WarmUp(params_.warm_up_frames);
+    PublishStatus(true, "waiting for initial pose");
+    LOG(INFO) << "Ready, will publish status on: " << params_.channel_output_status << std::endl;
+
+    while (!initialized_ && 0 == lcm_.handle());
+  }
+
+  ~StateEstimatorLcm() { scheduler_.Stop(); }
+
+  // Hot-reload params from this snapshot while the node spins (see Params::params_reload_sec). Only
+  // the tunables are applied (see ApplyTunables), everything else needs a restart.
+  void WatchParams(const ParamsSnapshot<Params>::Ptr& snapshot) { params_snapshot_ = snapshot; }
+
+  // Apply the params that can change at runtime. None of these take a lock on the hot path.
+  void ApplyTunables(const Params& params)
+  {
+    filter_pose_pub_.SetMaxHz(params.filter_publish_hz);
+    state_estimator_.SetMaxFeaturesPerFrame(
+        params.state_estimator_params.stereo_frontend_params.tracker_params.detector_params.max_features_per_frame);
+    LOG(INFO) << "Applied tunables: filter_publish_hz=" << params.filter_publish_hz << std::endl;
+  }
+
+  // Switch to a performance profile (see PerfProfiles). None of these take a lock, and the frontend
+  // and mesher pick them up at their next frame, so the estimator keeps running (and its state) the
+  // whole time. A hot reload applies the yaml tunables again (see ApplyTunables), until the next switch.
+  void ApplyProfile(const PerfProfile& profile)
+  {
+    state_estimator_.SetTrackerEffort(profile.max_features_per_frame, profile.klt_max_level);
+    filter_pose_pub_.SetMaxHz(profile.filter_publish_hz);
+    mesh_pub_.SetMaxHz(profile.mesh_max_hz);
+    run_mesher_.store(profile.run_mesher);
+    profile_name_ = profile.name;
+
+    LOG(INFO) << "Switched to perf profile " << profile.name
+              << ": max_features_per_frame=" << profile.max_features_per_frame
+              << " klt_max_level=" << profile.klt_max_level
+              << " run_mesher=" << profile.run_mesher
+              << " mesh_max_hz=" << profile.mesh_max_hz
+              << " filter_publish_hz=" << profile.filter_publish_hz << std::endl;
+  }
+
+  void HandlePerfProfile(const lcm::ReceiveBuffer*,
+                         const std::string&,
+                         const vehicle::perf_profile_t* msg)
+  {
+    const PerfProfile* profile = params_.perf_profiles.Find(msg->name);
+    if (profile == nullptr) {
+      LOG(WARNING) << "Ignoring unknown perf profile: " << msg->name << std::endl;
+      return;
+    }
+    if (profile->name == profile_name_) {
+      return;
+    }
+    ApplyProfile(*profile);
+    if (initialized_) {
+      PublishStatus(true, "running (" + profile_name_ + ")");
+    }
+  }
+
+  void InitializeLcm(const lcm::ReceiveBuffer*,
+                     const std::string&,
+                     const vehicle::pose3_stamped_t* msg)
+  {
+    if (initialized_) {
+      return;
+    }
+
+    const timestamp_t t0 = msg->header.timestamp;
+    const std::string frame_id = msg->header.frame_id;
+
+    if (frame_id != "imu" && frame_id != "body") {
+      LOG(WARNING) << "Received initial pose in wrong frame: " << frame_id << std::endl;
+      return;
+    }
+
+    initialized_.store(true);
+
+    gtsam::Pose3 world_P_body = gtsam::Pose3::identity();
+    decode_pose3_t(msg->pose, world_P_body);
+
+    LOG(INFO) << "Received initial pose at t=" << t0 << "\n" << world_P_body << std::endl;
+
+    // After a restart, resume from the last checkpoint if there is one (the initial pose is only
+    // used if it can't be read).
+    const std::string& checkpoint_path = params_.state_estimator_params.checkpoint_path;
+    if (checkpoint_path.empty() || !state_estimator_.Initialize(checkpoint_path)) {
+      state_estimator_.Initialize(ConvertToSeconds(t0), world_P_body);
+    }
+
+    if (params_.visualize) {
+      LOG(INFO) << "Visualization is ON, setting viewer pose" << std::endl;
+      viz_.Start();
+      viz_.UpdateBodyPose("T0_world_body", world_P_body.matrix());
+      viz_.SetViewerPose(world_P_body.matrix());
+    }
+
+    PublishStatus(true, "running");
+
+    LOG(INFO) << "Setting up sensor data subscriptions" << std::endl;
+    lcm_.subscribe(params_.channel_input_imu.c_str(), &StateEstimatorLcm::HandleImu, this);
+    lcm_.subscribe(params_.channel_input_imu_batch.c_str(), &StateEstimatorLcm::HandleImuBatch, this);
+    lcm_.subscribe(params_.channel_input_range.c_str(), &StateEstimatorLcm::HandleRange, this);
+    lcm_.subscribe(params_.channel_input_depth.c_str(), &StateEstimatorLcm::HandleDepth, this);
+    lcm_.subscribe(params_.channel_input_mag.c_str(), &StateEstimatorLcm::HandleMag, this);
+    LOG(INFO) << "Subscribed to " << params_.channel_input_stereo << std::endl;
+    for (const std::string& channel : params_.channel_input_rig_stereo) {
+      LOG(INFO) << "Subscribed to " << channel << std::endl;
+    }
+    LOG(INFO) << "Subscribed to " << params_.channel_input_imu << std::endl;
+    LOG(INFO) << "Subscribed to " << params_.channel_input_imu_batch << std::endl;
+    LOG(INFO) << "Subscribed to " << params_.channel_input_range << std::endl;
+    LOG(INFO) << "Subscribed to " << params_.channel_input_depth << std::endl;
+    LOG(INFO) << "Subscribed to " << params_.channel_input_mag << std::endl;
+  }
+
+  // Blocks to keep this node alive. Sensor messages are handled on this thread, and images on
+  // their own thread (if Params::separate_image_lcm).
+  // NOTE(milo): Need to call lcm_.handle() in order to receive LCM messages. Not sure why.
+  void Spin()
+  {
+    CHECK(initialized_) << "StateEstimatorLcm should be initialized before Spin()" << std::endl;
+
+    std::thread image_thread;
+    if (image_lcm_) {
+      image_thread = std::thread(&StateEstimatorLcm::HandleUntilShutdown, this, std::ref(*image_lcm_), false);
+    }
+
+    // NOTE(milo): Reloading parses yaml, so it gets a thread of its own instead of the LCM threads.
+    std::thread reload_thread;
+    if (params_snapshot_ && params_.params_reload_sec > 0) {
+      reload_thread = std::thread(&StateEstimatorLcm::ReloadUntilShutdown, this);
+    }
+
+    HandleUntilShutdown(lcm_, true);
+
+    if (image_thread.joinable()) {
+      image_thread.join();
+    }
+    if (reload_thread.joinable()) {
+      reload_thread.join();
+    }
+  }
+
+  void HandleImu(const lcm::ReceiveBuffer* rbuf,
+                 const std::string&,
+                 const vehicle::imu_measurement_t* msg)
+  {
+    imu_latency_->Record(ReceiveLatencyMs(rbuf));
+    if (!params_.use_imu) { return; }
+    ImuMeasurement data;
+    decode_imu_measurement_t(*msg, data);
+    state_estimator_.ReceiveImu(std::move(data));
+  }
+
+  void HandleImuBatch(const lcm::ReceiveBuffer* rbuf,
+                      const std::string&,
+                      const vehicle::imu_batch_t* msg)
+  {
+    imu_batch_latency_->Record(ReceiveLatencyMs(rbuf));
+    if (!params_.use_imu) { return; }
+    decode_imu_batch_t(*msg, imu_batch_);
+    state_estimator_.ReceiveImuBatch(imu_batch_.data(), imu_batch_.size());
+  }
+
+  void HandleDepth(const lcm::ReceiveBuffer* rbuf,
+                   const std::string&,
+                   const vehicle::depth_measurement_t* msg)
+  {
+    depth_latency_->Record(ReceiveLatencyMs(rbuf));
+    if (!params_.use_depth) { return; }
+    DepthMeasurement data(0, 123);
+    decode_depth_measurement_t(*msg, data);
+    state_estimator_.ReceiveDepth(std::move(data));
+  }
+
+  void HandleRange(const lcm::ReceiveBuffer* rbuf,
+                   const std::string&,
+                   const vehicle::range_measurement_t* msg)
+  {
+    range_latency_->Record(ReceiveLatencyMs(rbuf));
+    if (!params_.use_range) { return; }
+    RangeMeasurement data(0, 0, Vector3d::Zero());
+    decode_range_measurement_t(*msg, data);
+    state_estimator_.ReceiveRange(std::move(data));
+  }
+
+  void HandleMag(const lcm::ReceiveBuffer* rbuf,
+                 const std::string&,
+                 const vehicle::mag_measurement_t* msg)
+  {
+    mag_latency_->Record(ReceiveLatencyMs(rbuf));
+    if (!params_.use_mag) { return; }
+    MagMeasurement data(0, Vector3d::Zero());
+    decode_mag_measurement_t(*msg, data);
+    state_estimator_.ReceiveMag(std::move(data));
+  }
+
+  // Runs on the StereoFrontend thread.
+  void FeatureTracksCallback(const StereoImage1b& stereo_pair, const FeatureTracks& live_tracks)
+  {
+    if (!run_mesher_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    const int retrack_frames_k = params_.state_estimator_params.stereo_frontend_params.tracker_params.retrack_frames_k;
+    const mesher::TriangleMesh mesh = mesher_->ProcessTracks(stereo_pair, live_tracks, retrack_frames_k);
+    if (!mesher_->LastMeshUpdated()) {
+      return;
+    }
+
+    mesh_pub_.Update([&](vehicle::mesh_stamped_t& out)
+    {
+      out.header.timestamp = stereo_pair.timestamp;
+      out.header.seq = stereo_pair.camera_id;
+      pack_mesh_t(mesh.vertices, mesh.triangles, out.mesh);
+    });
+  }
+
+  void SmootherCallback(const SmootherResult& result)
+  {
+    const core::uid_t cam_id = static_cast<core::uid_t>(result.keypose_id);
+    const Matrix3d body_cov_pose = result.cov_pose.block<3, 3>(3, 3);
+    const Matrix3d world_R_body = result.world_P_body.rotation().matrix();
+    const Matrix3d world_cov_pose = world_R_body * body_cov_pose * world_R_body.transpose();
+
+    if (params_.visualize) {
+      viz_.AddCameraPose(cam_id, Image1b(), result.world_P_body.matrix(), true, std::make_shared<Matrix3d>(world_cov_pose));
+    }
+
+    // Publish pose estimate to LCM.
+    smoother_pose_pub_.Update([&](vehicle::pose3_stamped_t& msg)
+    {
+      msg.header.timestamp = ConvertToNanoseconds(result.timestamp);
+      msg.header.seq = -1;
+      msg.header.frame_id = "body";
+      pack_pose3_t(result.world_P_body, msg.pose);
+    });
+
+    // NOTE(milo): "publish" is when the pose was handed to the scheduler. CRITICAL channels wake it
+    // up right away, so the pose goes out on the link very soon after.
+    if (tracer_ && tracer_->Finish(ConvertToNanoseconds(result.timestamp), "publish", latency_trace_)) {
+      pack_latency_trace_t(latency_trace_, latency_trace_pub_.Msg());
+      latency_trace_pub_.Publish();
+    }
+
+    if (bus_) {
+      bus_->Publish<SmootherResult>(params_.channel_output_smoother_pose,
+          std::allocate_shared<SmootherResult>(Eigen::aligned_allocator<SmootherResult>(), result));
+    }
+  }
+
+  void FilterCallback(const StateStamped& ss)
+  {
+    // The scheduler limits the publishing rate (to filter_publish_hz), but always sends the newest.
+    filter_pose_pub_.Update([&](vehicle::pose3_stamped_t& msg)
+    {
+      msg.header.timestamp = ConvertToNanoseconds(ss.timestamp);
+      msg.header.seq = -1;
+      msg.header.frame_id = "body";
+      pack_pose3_t(ss.state.q, ss.state.t, msg.pose);
+    });
+
+    if (params_.visualize && filter_subsampler_.ShouldSample(ss.timestamp)) {
+      Matrix4d world_T_body = Matrix4d::Identity();
+      world_T_body.block<3, 3>(0, 0) = ss.state.q.toRotationMatrix();
+      world_T_body.block<3, 1>(0, 3) = ss.state.t;
+      viz_.UpdateBodyPose("body", world_T_body);
+    }
+  }
+
+  // NOTE(milo): Called from HandleImu(), so this isn't subsampled. It goes out at the IMU rate, and
+  // isn't scheduled, since controllers want it with as little delay as possible.
+  void PropagatedCallback(const PropagatedState& ps)
+  {
+    vehicle::propagated_pose_t& msg = propagated_pose_pub_.Msg();
+    msg.header.timestamp = ConvertToNanoseconds(ps.timestamp);
+    msg.header.seq = -1;
+    msg.header.frame_id = "body";
+    pack_pose3_t(ps.q, ps.t, msg.pose);
+    msg.velocity.x = ps.v.x();
+    msg.velocity.y = ps.v.y();
+    msg.velocity.z = ps.v.z();
+    msg.age = ConvertToNanoseconds(ps.age);
+
+    propagated_pose_pub_.Publish();
+  }
+
+ private:
+  lcm::LCM& ImageLcm() { return image_lcm_ ? *image_lcm_ : lcm_; }
+
+  // Whether the node is ready for data, stamped with the wall time (there's no sensor time yet).
+  void PublishStatus(bool ready, const std::string& status)
+  {
+    vehicle::node_status_t& msg = status_pub_.Msg();
+    msg.header.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    msg.header.seq = -1;
+    msg.header.frame_id = "";
+    pack_node_status_t("state_estimator", ready, status, warm_up_report_, msg);
+    status_pub_.Publish();
+  }
+
+  // Only encodes a preview when one could be published, rather than for every image.
+  void MaybePublishPreview(const StereoImage1b& stereo_pair)
+  {
+    if (!params_.publish_image_preview || !preview_subsampler_.ShouldSample(ConvertToSeconds(stereo_pair.timestamp))) {
+      return;
+    }
+    preview_pub_.Update([&](vehicle::image_preview_t& msg)
+    {
+      PackImagePreview(stereo_pair.left_image, stereo_pair.timestamp, stereo_pair.camera_id,
+                       params_.image_preview_scale, params_.image_preview_jpeg_quality, msg);
+    });
+  }
+
+  void ReloadUntilShutdown()
+  {
+    Timer timer(true);
+    while (!is_shutdown_) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      if (timer.Elapsed().seconds() < params_.params_reload_sec) {
+        continue;
+      }
+      timer.Reset();
+      if (params_snapshot_->ReloadIfModified()) {
+        ApplyTunables(*params_snapshot_->Get());
+      }
+    }
+  }
+
+  // Handles messages until shutdown (or an LCM error, which shuts down the other thread too).
+  void HandleUntilShutdown(lcm::LCM& lcm, bool export_stats)
+  {
+    while (!is_shutdown_) {
+      if (lcm.handleTimeout(params_.lcm_handle_timeout_ms) < 0) {
+        LOG(WARNING) << "LCM handle failed, shutting down" << std::endl;
+        is_shutdown_.store(true);
+        break;
+      }
+      if (export_stats) {
+        lcm_stats_.Export(params_.lcm_stats_interval_sec);
+      }
+    }
+  }
+
+ private:
+  std::atomic_bool is_shutdown_{false};
+  std::atomic_bool initialized_{false};
+  std::atomic_bool run_mesher_{true};     // Only if Params::run_object_mesher (see ApplyProfile).
+  std::string profile_name_;              // The current perf profile (sensor LCM thread only).
+
+  Params params_;
+  ParamsSnapshot<Params>::Ptr params_snapshot_;   // Optional, for hot-reloading (see WatchParams).
+  InprocBus::Ptr bus_;                    // Optional, for nodes in the same process.
+  lcm::LCM lcm_;                          // Sensors, and everything that this node publishes.
+  std::unique_ptr<lcm::LCM> image_lcm_;   // Only if Params::separate_image_lcm.
+
+  // NOTE(milo): Each of these reuses its message and buffer so that publishing doesn't allocate. The
+  // scheduled ones are published from the scheduler's thread, and the propagated pose from the LCM
+  // sensor thread.
+  PublishScheduler scheduler_;
+  ScheduledLcmPublisher<vehicle::pose3_stamped_t> filter_pose_pub_;
+  ScheduledLcmPublisher<vehicle::pose3_stamped_t> smoother_pose_pub_;
+  LcmPublisher<vehicle::propagated_pose_t> propagated_pose_pub_;
+  LcmPublisher<vehicle::latency_trace_t> latency_trace_pub_;     // Smoother thread.
+  LcmPublisher<vehicle::node_status_t> status_pub_;               // Sensor LCM thread.
+  WarmUpReport warm_up_report_;
+  ScheduledLcmPublisher<vehicle::mesh_stamped_t> mesh_pub_;
+  ScheduledLcmPublisher<vehicle::image_preview_t> preview_pub_;
+
+  StatsTracker lcm_stats_{"StateEstimatorLcm", 100};
+  LatencyHistogram* imu_latency_ = nullptr;
+  LatencyHistogram* imu_batch_latency_ = nullptr;
+  LatencyHistogram* depth_latency_ = nullptr;
+  LatencyHistogram* range_latency_ = nullptr;
+  LatencyHistogram* mag_latency_ = nullptr;
+
+  std::vector<ImuMeasurement> imu_batch_;   // Reused by HandleImuBatch().
+
+  LatencyTracer::Ptr tracer_;                // Only if Params::trace_latency.
+  LatencyTrace latency_trace_;               // Reused by SmootherCallback().
+
+  StateEstimator state_estimator_;
+  Visualizer3D viz_;
+  std::unique_ptr<mesher::ObjectMesher> mesher_;   // Only if Params::run_object_mesher.
+
+  DataSubsampler filter_subsampler_;     // Only for the visualizer.
+  DataSubsampler preview_subsampler_;
+
+  ImageSubscriber image_sub_;
+  std::vector<std::unique_ptr<ImageSubscriber>> rig_image_subs_;  // One for each of the other rigs.
+};
@@ -0,0 +1,154 @@
+#include <cuda_runtime.h>
+#include <cuda_profiler_api.h>
+
+#include <cstdio>
+#include <functional>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/cuda.hpp>
+
+#include "core/timer.hpp"
+#include "patchmatch_gpu/patchmatch_gpu.h"
+
+namespace cu = cv::cuda;
+namespace pm = bm::pm;
+
+// Times the Patchmatch iterations (pm::PatchmatchGpu::Match on GpuMats) with the global memory
+// kernels, the tiled/texture kernels and their half precision versions, and reports ms per megapixel. Then times the full
+// Match() and MatchAsync() (sparse init, upload, left and right disparity, download) per frame.
+// Only the timed loops are inside cudaProfilerStart/Stop, so they can be captured on their own, e.g:
+//   nsys profile --capture-range=cudaProfilerApi ./patchmatch_bench
+//   ncu --profile-from-start off ./patchmatch_bench
+
+
+typedef std::function<void(cu::GpuMat& disp)> MatchFunction;
+
+
+static float TimeGpuMatch(const char* name,
+                          const cu::GpuMat& disp0,
+                          int iters,
+                          const MatchFunction& f)
+{
+  cu::GpuMat disp;
+  disp0.copyTo(disp);
+  f(disp);  // Warmup.
+
+  cudaEvent_t start, stop;
+  cudaEventCreate(&start);
+  cudaEventCreate(&stop);
+
+  float total_ms = 0;
+  for (int i = 0; i < iters; ++i) {
+    disp0.copyTo(disp);
+    cudaEventRecord(start);
+    f(disp);
+    cudaEventRecord(stop);
+    cudaEventSynchronize(stop);
+
+    float ms = 0;
+    cudaEventElapsedTime(&ms, start, stop);
+    total_ms += ms;
+  }
+
+  cudaEventDestroy(start);
+  cudaEventDestroy(stop);
+
+  const float megapixels = static_cast<float>(disp0.rows * disp0.cols) / 1e6f;
+  const float avg_ms = total_ms / static_cast<float>(iters);
+  printf("%-10s %8.3f ms  %8.3f ms/MP\n", name, avg_ms, avg_ms / megapixels);
+  return avg_ms;
+}
+
+
+static pm::PatchmatchGpu::Params MakeParams(bool tiled_kernels)
+{
+  pm::PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+  params.tiled_kernels = tiled_kernels;
+  return params;
+}
+
+
+int main(int argc, char* argv[])
+{
+  const int iters = (argc > 1) ? std::atoi(argv[1]) : 100;
+
+  cv::Mat1b il = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  cv::Mat1b ir = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  CV_Assert(!il.empty() && !ir.empty());
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+  printf("Image dimensions: %d %d (tiles fit: %d, half tiles fit: %d)\n", il.cols, il.rows,
+      pm::PatchmatchGpu::TilesFit(il.rows, il.cols), pm::PatchmatchGpu::TilesFit(il.rows, il.cols, true));
+
+  cu::GpuMat iml, imr, tmp;
+  tmp.upload(il);
+  tmp.convertTo(iml, CV_32FC1);
+  tmp.upload(ir);
+  tmp.convertTo(imr, CV_32FC1);
+
+  cu::GpuMat _Gx, _Gy, Gl, Gr;
+  pm::GradientMagnitude(iml, _Gx, _Gy, Gl);
+  pm::GradientMagnitude(imr, _Gx, _Gy, Gr);
+
+  cu::GpuMat ilg, irg;
+  tmp.upload(il);
+  pm::PackIntensityGradient(tmp, ilg);
+  tmp.upload(ir);
+  pm::PackIntensityGradient(tmp, irg);
+
+  pm::PatchmatchGpu pm_global(MakeParams(false));
+  pm::PatchmatchGpu pm_tiled(MakeParams(true));
+
+  // The noise image is allocated by the first full Match(), so run one on each.
+  cv::Mat1f disp, dispr;
+  pm_global.Match(il, ir, disp, dispr);
+  pm_tiled.Match(il, ir, disp, dispr);
+
+  cu::GpuMat disp0;
+  disp0.upload(pm_tiled.SparseInit(il, ir, 4));
+
+  cudaProfilerStart();
+
+  const float ms_global = TimeGpuMatch("global", disp0, iters, [&](cu::GpuMat& d) {
+    pm_global.Match(iml, imr, Gl, Gr, d);
+  });
+
+  const float ms_tiled = TimeGpuMatch("tiled", disp0, iters, [&](cu::GpuMat& d) {
+    pm_tiled.Match(iml, imr, Gl, Gr, d);
+  });
+
+  const bool half_fits = pm::PatchmatchGpu::TilesFit(il.rows, il.cols, true);
+  const float ms_half = !half_fits ? 0 : TimeGpuMatch("half", disp0, iters, [&](cu::GpuMat& d) {
+    pm_tiled.MatchHalf(ilg, irg, d);
+  });
+
+  const int frames = std::max(1, iters / 10);
+
+  bm::core::Timer timer(true);
+  for (int i = 0; i < frames; ++i) {
+    pm_tiled.Match(il, ir, disp, dispr);
+  }
+  const double ms_sync = timer.Elapsed().milliseconds() / frames;
+
+  timer.Reset();
+  for (int i = 0; i < frames; ++i) {
+    pm_tiled.MatchAsync(il, ir, pm::PatchmatchGpu::Callback());
+  }
+  pm_tiled.Flush();
+  const double ms_async = timer.Elapsed().milliseconds() / frames;
+
+  cudaProfilerStop();
+
+  printf("Speedup (tiled): %.2fx\n", ms_global / ms_tiled);
+  if (half_fits) {
+    printf("Speedup (half): %.2fx over tiled\n", ms_tiled / ms_half);
+  }
+  printf("Match(): %.3f ms/frame, MatchAsync(): %.3f ms/frame\n", ms_sync, ms_async);
+
+  return 0;
+}
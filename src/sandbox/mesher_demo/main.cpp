@@ -23,6 +23,7 @@
 #include "dataset/acfr_dataset.hpp"
 #include "dataset/dataset_util.hpp"
 #include "mesher/object_mesher.hpp"
+#include "vision_core/viz_tap.hpp"
 
 
 using namespace bm;
@@ -72,6 +73,12 @@ int main(int argc, char const *argv[])
       shared_params_path);
   ObjectMesher mesher(mesher_params);
 
+  // Render the mesher's visualization on another thread.
+  const VizTap::Ptr viz_tap = std::make_shared<VizTap>();
+  VizTapViewer viewer(viz_tap);
+  mesher.SetVizTap(viz_tap);
+  viewer.Start();
+
   dataset::StereoCallback1b stereo_cb = [&](const StereoImage1b& stereo_pair)
   {
     if (stereo_pair.left_image.rows > params.input_height) {
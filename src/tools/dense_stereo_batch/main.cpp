@@ -0,0 +1,379 @@
+#include <glog/logging.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/file_utils.hpp"
+#include "core/macros.hpp"
+#include "core/path_util.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/timer.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "dataset/dataset_util.hpp"
+#include "stereo_matching/sgm_census.hpp"
+#include "patchmatch_gpu/patchmatch_gpu.h"
+
+using namespace bm;
+using namespace core;
+
+namespace cu = cv::cuda;
+
+
+// Runs dense stereo over every stereo pair in a dataset, and writes one file per frame (see
+// WriteFrame()). Frames are decoded by a pool of prefetch threads, and matched by one worker per
+// GPU (each with its own PatchmatchGpu) plus optional CPU workers (SgmCensus). Frames that already
+// have an output file are skipped, so an interrupted run can be resumed by running it again.
+struct DenseStereoBatchParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(DenseStereoBatchParams);
+  dataset::Dataset dataset = dataset::Dataset::FARMSIM;
+  std::string folder;
+  std::string subfolder;
+  std::string output_folder;
+
+  bool output_range = false;    // Write range (m) instead of disparity (px).
+  int downsample = 2;           // Match at 1/downsample of the image resolution.
+  int num_gpus = -1;            // Negative to use every GPU.
+  int cpu_workers = 0;          // Extra workers that match on the CPU.
+  int decode_threads = 4;
+  int prefetch_frames = 16;     // Max decoded frames waiting for a worker.
+
+  pm::PatchmatchGpu::Params patchmatch_params;
+  stereo::SgmCensus::Params sgm_params;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    dataset = YamlToEnum<dataset::Dataset>(parser.GetNode("dataset"));
+    folder = YamlToString(parser.GetNode("folder"));
+    subfolder = YamlToString(parser.GetNode("subfolder"));
+    output_folder = YamlToString(parser.GetNode("output_folder"));
+    parser.GetParam("output_range", &output_range);
+    parser.GetParam("downsample", &downsample);
+    parser.GetParam("num_gpus", &num_gpus);
+    parser.GetParam("cpu_workers", &cpu_workers);
+    parser.GetParam("decode_threads", &decode_threads);
+    parser.GetParam("prefetch_frames", &prefetch_frames);
+    patchmatch_params = pm::PatchmatchGpu::Params(parser.Subtree("PatchmatchGpu"));
+    sgm_params = stereo::SgmCensus::Params(parser.Subtree("SgmCensus"));
+
+    CHECK_GE(downsample, 1);
+    CHECK_GE(decode_threads, 1);
+    CHECK_GE(prefetch_frames, 1);
+  }
+};
+
+
+// A decoded (and downsampled) stereo pair.
+struct Frame final
+{
+  size_t index = 0;
+  timestamp_t timestamp = 0;
+  Image1b left;
+  Image1b right;
+};
+
+
+//================================== OUTPUT FORMAT =================================================
+// Each frame is a FrameHeader followed by rows * cols uint16 values (row-major), where
+// value = round(scale * x) and 0 means invalid. With the default scales that's 1/16 px disparities
+// (up to 4096 px) or mm ranges (up to 65 m), at 2 bytes per pixel.
+static const char kFrameMagic[4] = { 'B', 'M', 'D', 'S' };
+static const uint32_t kFrameVersion = 1;
+static const float kDisparityScale = 16.0f;
+static const float kRangeScale = 1000.0f;
+
+enum FrameKind : uint32_t { DISPARITY = 0, RANGE = 1 };
+
+struct FrameHeader final
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t timestamp;
+  int32_t rows;
+  int32_t cols;
+  uint32_t kind;
+  float scale;
+};
+
+
+static std::string FramePath(const std::string& output_folder, timestamp_t timestamp)
+{
+  return Join(output_folder, std::to_string(timestamp) + ".bin");
+}
+
+
+// Whether the frame at path was completely written (by a previous run).
+static bool FrameIsComplete(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in.good()) {
+    return false;
+  }
+  const std::streamoff size = in.tellg();
+  if (size < static_cast<std::streamoff>(sizeof(FrameHeader))) {
+    return false;
+  }
+
+  FrameHeader header;
+  in.seekg(0);
+  in.read(reinterpret_cast<char*>(&header), sizeof(FrameHeader));
+  const std::streamoff expected = sizeof(FrameHeader) + 2LL * header.rows * header.cols;
+  return in.good() && std::memcmp(header.magic, kFrameMagic, 4) == 0 && size == expected;
+}
+
+
+// NOTE(milo): Writes to a temporary file and then renames it, so that a crash never leaves behind a
+// partial frame that looks complete.
+static void WriteFrame(const std::string& path, timestamp_t timestamp, FrameKind kind, const Image1f& im)
+{
+  const float scale = (kind == FrameKind::RANGE) ? kRangeScale : kDisparityScale;
+
+  FrameHeader header;
+  std::memcpy(header.magic, kFrameMagic, 4);
+  header.version = kFrameVersion;
+  header.timestamp = timestamp;
+  header.rows = im.rows;
+  header.cols = im.cols;
+  header.kind = kind;
+  header.scale = scale;
+
+  cv::Mat1w values(im.size(), 0);
+  for (int y = 0; y < im.rows; ++y) {
+    for (int x = 0; x < im.cols; ++x) {
+      const float v = im(y, x);
+      if (v > 0) {
+        values(y, x) = static_cast<uint16_t>(std::min(65535.0f, std::round(scale * v)));
+      }
+    }
+  }
+
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(FrameHeader));
+  for (int y = 0; y < values.rows; ++y) {
+    out.write(reinterpret_cast<const char*>(values.ptr<uint16_t>(y)), 2 * values.cols);
+  }
+  out.close();
+  CHECK(out.good()) << "Failed to write " << tmp_path << std::endl;
+  CHECK_EQ(0, std::rename(tmp_path.c_str(), path.c_str())) << "Failed to rename " << tmp_path << std::endl;
+}
+
+
+// Range along the ray through each pixel (0 where the disparity is invalid).
+static Image1f DisparityToRange(const Image1f& disp, const StereoCamera& stereo_rig)
+{
+  Image1f range(disp.size(), 0.0f);
+  const double fx = stereo_rig.fx(), fy = stereo_rig.fy();
+  const double cx = stereo_rig.cx(), cy = stereo_rig.cy();
+
+  for (int y = 0; y < disp.rows; ++y) {
+    for (int x = 0; x < disp.cols; ++x) {
+      const float d = disp(y, x);
+      if (d <= 0) {
+        continue;
+      }
+      const double z = stereo_rig.DispToDepth(d);
+      const double px = (x - cx) * z / fx;
+      const double py = (y - cy) * z / fy;
+      range(y, x) = static_cast<float>(std::sqrt(px*px + py*py + z*z));
+    }
+  }
+
+  return range;
+}
+
+
+//====================================== PIPELINE ==================================================
+class BatchRunner final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(BatchRunner);
+
+  BatchRunner(const DenseStereoBatchParams& params,
+              const std::vector<dataset::StereoDatasetItem>& items,
+              const StereoCamera& stereo_rig)
+      : params_(params),
+        items_(items),
+        stereo_rig_(stereo_rig),
+        frames_(0, false, "frames") {}
+
+  void Run()
+  {
+    CHECK(mkdir(params_.output_folder, true)) << "Couldn't create " << params_.output_folder << std::endl;
+
+    for (size_t i = 0; i < items_.size(); ++i) {
+      if (!FrameIsComplete(FramePath(params_.output_folder, items_.at(i).timestamp))) {
+        pending_.emplace_back(i);
+      }
+    }
+    LOG(INFO) << "Resuming with " << pending_.size() << "/" << items_.size() << " frames left" << std::endl;
+
+    const int num_devices = cu::getCudaEnabledDeviceCount();
+    const int num_gpus = (params_.num_gpus < 0) ? num_devices : std::min(params_.num_gpus, num_devices);
+    CHECK(num_gpus > 0 || params_.cpu_workers > 0) << "No GPUs found, and cpu_workers is 0" << std::endl;
+    LOG(INFO) << "Using " << num_gpus << " GPUs, " << params_.cpu_workers << " CPU workers and "
+              << params_.decode_threads << " decode threads" << std::endl;
+
+    Timer timer(true);
+
+    std::vector<std::thread> decoders;
+    for (int i = 0; i < params_.decode_threads; ++i) {
+      decoders.emplace_back(&BatchRunner::DecodeWorker, this);
+    }
+
+    std::vector<std::thread> workers;
+    for (int device = 0; device < num_gpus; ++device) {
+      workers.emplace_back(&BatchRunner::GpuWorker, this, device);
+    }
+    for (int i = 0; i < params_.cpu_workers; ++i) {
+      workers.emplace_back(&BatchRunner::CpuWorker, this);
+    }
+
+    for (std::thread& t : decoders) {
+      t.join();
+    }
+    // Wakes up the workers once the last decoded frames are taken.
+    frames_.Close();
+
+    for (std::thread& t : workers) {
+      t.join();
+    }
+
+    const double sec = timer.Elapsed().seconds();
+    LOG(INFO) << "Wrote " << num_written_ << " frames in " << sec << " sec ("
+              << num_written_ / std::max(1e-3, sec) << " fps)" << std::endl;
+  }
+
+ private:
+  void DecodeWorker()
+  {
+    while (true) {
+      const size_t i = next_pending_++;
+      if (i >= pending_.size()) {
+        return;
+      }
+
+      // Don't let the decoders run too far ahead of the workers.
+      while (frames_.Size() >= (size_t)params_.prefetch_frames) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+
+      const dataset::StereoDatasetItem& item = items_.at(pending_.at(i));
+      Frame frame;
+      frame.index = pending_.at(i);
+      frame.timestamp = item.timestamp;
+      frame.left = cv::imread(item.path_left, cv::IMREAD_GRAYSCALE);
+      frame.right = cv::imread(item.path_right, cv::IMREAD_GRAYSCALE);
+      CHECK(!frame.left.empty() && !frame.right.empty()) << "Couldn't read " << item.path_left << std::endl;
+
+      if (params_.downsample > 1) {
+        const cv::Size size = frame.left.size() / params_.downsample;
+        cv::resize(frame.left, frame.left, size, 0, 0, cv::INTER_AREA);
+        cv::resize(frame.right, frame.right, size, 0, 0, cv::INTER_AREA);
+      }
+
+      frames_.Push(std::move(frame));
+    }
+  }
+
+  // NOTE(milo): Frames are handed out in whatever order the workers finish, so the temporal mode
+  // of PatchmatchGpu is turned off.
+  void GpuWorker(int device)
+  {
+    cu::setDevice(device);
+    pm::PatchmatchGpu::Params params = params_.patchmatch_params;
+    params.temporal = false;
+    pm::PatchmatchGpu pm(params);
+
+    Frame frame;
+    while (frames_.PopBlocking(frame)) {
+      const timestamp_t timestamp = frame.timestamp;
+      pm.MatchAsync(frame.left, frame.right, [this, timestamp](const DisparityMap& left, const Image1f&)
+      {
+        Write(timestamp, left.disp);
+      });
+    }
+    pm.Flush();
+  }
+
+  void CpuWorker()
+  {
+    stereo::SgmCensus sgm(params_.sgm_params);
+
+    Frame frame;
+    while (frames_.PopBlocking(frame)) {
+      Write(frame.timestamp, sgm.ComputeDisparity(frame.left, frame.right));
+    }
+  }
+
+  void Write(timestamp_t timestamp, const Image1f& disp)
+  {
+    const std::string path = FramePath(params_.output_folder, timestamp);
+    if (params_.output_range) {
+      WriteFrame(path, timestamp, FrameKind::RANGE, DisparityToRange(disp, stereo_rig_));
+    } else {
+      WriteFrame(path, timestamp, FrameKind::DISPARITY, disp);
+    }
+
+    const int n = ++num_written_;
+    if (n % 100 == 0) {
+      LOG(INFO) << "Wrote " << n << "/" << pending_.size() << " frames" << std::endl;
+    }
+  }
+
+ private:
+  const DenseStereoBatchParams& params_;
+  const std::vector<dataset::StereoDatasetItem>& items_;
+  StereoCamera stereo_rig_;     // At the matching resolution.
+
+  std::vector<size_t> pending_;
+  std::atomic<size_t> next_pending_{0};
+  ThreadsafeQueue<Frame> frames_;
+  std::atomic<int> num_written_{0};
+};
+
+
+void Run(const std::string& config_path)
+{
+  DenseStereoBatchParams params(config_path);
+
+  std::string shared_params_path;
+  dataset::DataProvider dataset = dataset::GetDatasetByName(
+      params.dataset, params.folder, params.subfolder, shared_params_path);
+
+  StereoCamera stereo_rig;
+  Matrix4d body_T_left, body_T_right;
+  YamlParser shared_parser(shared_params_path);
+  YamlToStereoRig(shared_parser.GetNode("stereo_forward"), stereo_rig, body_T_left, body_T_right);
+
+  // The disparity is at the downsampled resolution, so range needs the rescaled intrinsics.
+  const PinholeCamera cam = stereo_rig.LeftCamera().Rescale(
+      stereo_rig.Height() / params.downsample, stereo_rig.Width() / params.downsample);
+  const StereoCamera stereo_rig_ds(cam, stereo_rig.Baseline());
+
+  BatchRunner runner(params, dataset.StereoItems(), stereo_rig_ds);
+  runner.Run();
+
+  LOG(INFO) << "DONE" << std::endl;
+}
+
+
+int main(int argc, char const *argv[])
+{
+  Run(argc > 1 ? std::string(argv[1]) : tools_path("dense_stereo_batch/config/DenseStereoBatch.yaml"));
+  return 0;
+}
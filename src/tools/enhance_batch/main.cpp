@@ -0,0 +1,405 @@
+#include <glog/logging.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/file_utils.hpp"
+#include "core/macros.hpp"
+#include "core/path_util.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/timer.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "dataset/dataset_util.hpp"
+#include "vision_core/image_util.hpp"
+#include "imaging/attenuation.hpp"
+#include "imaging/enhance.hpp"
+#include "imaging/io.hpp"
+#include "imaging/normalization.hpp"
+
+using namespace bm;
+using namespace core;
+
+namespace fs = boost::filesystem;
+
+
+// Runs EnhanceUnderwater() over every image in a folder or dataset, and writes one .png per image.
+// Images are decoded (with their range maps) by a pool of prefetch threads, enhanced by a pool of
+// workers, and encoded by another pool, so that decoding and encoding overlap with enhancement.
+// Images that already have an output file are skipped, so an interrupted run can be resumed by
+// running it again.
+struct EnhanceBatchParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(EnhanceBatchParams);
+
+  enum Input { FOLDER = 0, DATASET = 1 };
+
+  Input input = Input::FOLDER;
+  std::string image_folder;
+  std::string range_prefix = "depth";
+  dataset::Dataset dataset = dataset::Dataset::FARMSIM;
+  std::string folder;
+  std::string subfolder;
+  std::string range_folder;
+  std::string output_folder;
+
+  int back_num_px = 256;
+  int back_opt_iters = 10;
+  int beta_num_px = 256;
+  int beta_opt_iters = 20;
+  float estimate_scale = 0.5f;
+  float gamma_power = 0.4545f;
+
+  int enhance_workers = 4;
+  int decode_threads = 2;
+  int encode_threads = 2;
+  int prefetch_frames = 8;      // Max decoded (or enhanced) frames waiting in each queue.
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    input = YamlToEnum<Input>(parser.GetNode("input"));
+    image_folder = YamlToString(parser.GetNode("image_folder"));
+    range_prefix = YamlToString(parser.GetNode("range_prefix"));
+    dataset = YamlToEnum<dataset::Dataset>(parser.GetNode("dataset"));
+    folder = YamlToString(parser.GetNode("folder"));
+    subfolder = YamlToString(parser.GetNode("subfolder"));
+    range_folder = YamlToString(parser.GetNode("range_folder"));
+    output_folder = YamlToString(parser.GetNode("output_folder"));
+    parser.GetParam("back_num_px", &back_num_px);
+    parser.GetParam("back_opt_iters", &back_opt_iters);
+    parser.GetParam("beta_num_px", &beta_num_px);
+    parser.GetParam("beta_opt_iters", &beta_opt_iters);
+    parser.GetParam("estimate_scale", &estimate_scale);
+    parser.GetParam("gamma_power", &gamma_power);
+    parser.GetParam("enhance_workers", &enhance_workers);
+    parser.GetParam("decode_threads", &decode_threads);
+    parser.GetParam("encode_threads", &encode_threads);
+    parser.GetParam("prefetch_frames", &prefetch_frames);
+
+    CHECK(estimate_scale > 0 && estimate_scale <= 1.0f);
+    CHECK_GE(enhance_workers, 1);
+    CHECK_GE(decode_threads, 1);
+    CHECK_GE(encode_threads, 1);
+    CHECK_GE(prefetch_frames, 1);
+  }
+};
+
+
+// One image to enhance.
+struct Job final
+{
+  std::string image_path;
+  std::string range_path;
+  std::string output_path;
+  bool range_is_frame = false;    // A dense_stereo_batch .bin file, rather than an image.
+};
+
+
+// A decoded image (and range), or the enhanced output.
+struct Frame final
+{
+  size_t index = 0;
+  Image3f bgr;
+  Image1f range;
+  Image3b out;
+};
+
+
+//================================== RANGE FRAMES ==================================================
+// Same format as the output of dense_stereo_batch: a FrameHeader followed by rows * cols uint16
+// values (row-major), where value = round(scale * range) and 0 means invalid.
+static const char kFrameMagic[4] = { 'B', 'M', 'D', 'S' };
+static const uint32_t kFrameKindRange = 1;
+
+struct FrameHeader final
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t timestamp;
+  int32_t rows;
+  int32_t cols;
+  uint32_t kind;
+  float scale;
+};
+
+
+static Image1f ReadRangeFrame(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  CHECK(in.good()) << "Couldn't read " << path << std::endl;
+
+  FrameHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(FrameHeader));
+  CHECK(in.good() && std::memcmp(header.magic, kFrameMagic, 4) == 0) << "Not a frame: " << path << std::endl;
+  CHECK_EQ(kFrameKindRange, header.kind) << "Expected range (output_range: 1) in " << path << std::endl;
+
+  cv::Mat1w values(header.rows, header.cols);
+  for (int y = 0; y < values.rows; ++y) {
+    in.read(reinterpret_cast<char*>(values.ptr<uint16_t>(y)), 2 * values.cols);
+  }
+  CHECK(in.good()) << "Truncated frame: " << path << std::endl;
+
+  Image1f range;
+  values.convertTo(range, CV_32F, 1.0 / header.scale);
+  return range;
+}
+
+
+//===================================== INPUTS =====================================================
+// Every image in image_folder that has a range map named <range_prefix><image name> (any
+// extension) in range_folder.
+static std::vector<Job> FolderJobs(const EnhanceBatchParams& params)
+{
+  std::vector<std::string> range_paths;
+  FilenamesInDirectory(params.range_folder, range_paths, true);
+
+  std::map<std::string, std::string> range_by_stem;
+  for (const std::string& path : range_paths) {
+    range_by_stem[fs::path(path).stem().string()] = path;
+  }
+
+  std::vector<std::string> image_paths;
+  FilenamesInDirectory(params.image_folder, image_paths, true);
+
+  std::vector<Job> jobs;
+  for (const std::string& path : image_paths) {
+    const std::string stem = fs::path(path).stem().string();
+    const auto it = range_by_stem.find(params.range_prefix + stem);
+    if (it == range_by_stem.end()) {
+      LOG(WARNING) << "No range map for " << path << ", skipping" << std::endl;
+      continue;
+    }
+
+    Job job;
+    job.image_path = path;
+    job.range_path = it->second;
+    job.output_path = Join(params.output_folder, stem + ".png");
+    jobs.emplace_back(job);
+  }
+
+  return jobs;
+}
+
+
+// The left image of every stereo pair in the dataset that has a range frame in range_folder.
+static std::vector<Job> DatasetJobs(const EnhanceBatchParams& params)
+{
+  std::string shared_params_path;
+  const dataset::DataProvider dataset = dataset::GetDatasetByName(
+      params.dataset, params.folder, params.subfolder, shared_params_path);
+
+  std::vector<Job> jobs;
+  for (const dataset::StereoDatasetItem& item : dataset.StereoItems()) {
+    const std::string name = std::to_string(item.timestamp);
+    const std::string range_path = Join(params.range_folder, name + ".bin");
+    if (!Exists(range_path)) {
+      LOG(WARNING) << "No range frame for " << item.path_left << ", skipping" << std::endl;
+      continue;
+    }
+
+    Job job;
+    job.image_path = item.path_left;
+    job.range_path = range_path;
+    job.range_is_frame = true;
+    job.output_path = Join(params.output_folder, name + ".png");
+    jobs.emplace_back(job);
+  }
+
+  return jobs;
+}
+
+
+//====================================== PIPELINE ==================================================
+class BatchRunner final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(BatchRunner);
+
+  BatchRunner(const EnhanceBatchParams& params, const std::vector<Job>& jobs)
+      : params_(params),
+        jobs_(jobs),
+        decoded_(0, false, "decoded"),
+        enhanced_(0, false, "enhanced") {}
+
+  void Run()
+  {
+    CHECK(mkdir(params_.output_folder, true)) << "Couldn't create " << params_.output_folder << std::endl;
+
+    // NOTE(milo): Outputs are renamed into place once they're complete (see EncodeWorker()), so an
+    // existing file is never partial.
+    for (size_t i = 0; i < jobs_.size(); ++i) {
+      if (!Exists(jobs_.at(i).output_path)) {
+        pending_.emplace_back(i);
+      }
+    }
+    LOG(INFO) << "Resuming with " << pending_.size() << "/" << jobs_.size() << " images left" << std::endl;
+    LOG(INFO) << "Using " << params_.enhance_workers << " enhance workers, " << params_.decode_threads
+              << " decode threads and " << params_.encode_threads << " encode threads" << std::endl;
+
+    Timer timer(true);
+
+    std::vector<std::thread> decoders, workers, encoders;
+    for (int i = 0; i < params_.decode_threads; ++i) {
+      decoders.emplace_back(&BatchRunner::DecodeWorker, this);
+    }
+    for (int i = 0; i < params_.enhance_workers; ++i) {
+      workers.emplace_back(&BatchRunner::EnhanceWorker, this);
+    }
+    for (int i = 0; i < params_.encode_threads; ++i) {
+      encoders.emplace_back(&BatchRunner::EncodeWorker, this);
+    }
+
+    // Each stage is closed once the stage before it is done, which wakes up its consumers after
+    // the last frames are taken.
+    for (std::thread& t : decoders) {
+      t.join();
+    }
+    decoded_.Close();
+
+    for (std::thread& t : workers) {
+      t.join();
+    }
+    enhanced_.Close();
+
+    for (std::thread& t : encoders) {
+      t.join();
+    }
+
+    const double sec = timer.Elapsed().seconds();
+    LOG(INFO) << "Wrote " << num_written_ << " images in " << sec << " sec ("
+              << num_written_ / std::max(1e-3, sec) << " images/sec)" << std::endl;
+    LOG(INFO) << "Backscatter fit failed on " << num_failed_backscatter_ << " images, attenuation fit "
+              << "failed on " << num_failed_attenuation_ << " images" << std::endl;
+  }
+
+ private:
+  // Don't let a stage run too far ahead of the next one.
+  static void WaitForRoom(ThreadsafeQueue<Frame>& queue, int max_size)
+  {
+    while (queue.Size() >= (size_t)max_size) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  void DecodeWorker()
+  {
+    while (true) {
+      const size_t i = next_pending_++;
+      if (i >= pending_.size()) {
+        return;
+      }
+
+      WaitForRoom(decoded_, params_.prefetch_frames);
+
+      const Job& job = jobs_.at(pending_.at(i));
+      Frame frame;
+      frame.index = pending_.at(i);
+
+      const Image3b raw = cv::imread(job.image_path, cv::IMREAD_COLOR);
+      CHECK(!raw.empty()) << "Couldn't read " << job.image_path << std::endl;
+      frame.bgr = CastImage3bTo3f(raw);
+
+      // NOTE(milo): TIFF decoding is slow, so range maps go through the LoadDepthTif() cache.
+      frame.range = job.range_is_frame ?
+          ReadRangeFrame(job.range_path) : imaging::LoadDepthTif(job.range_path);
+      CHECK(!frame.range.empty()) << "Couldn't read " << job.range_path << std::endl;
+
+      // Range maps are often saved at a lower resolution than the images. Averaging would mix
+      // missing range (zero) into its neighbors.
+      if (frame.range.size() != frame.bgr.size()) {
+        cv::resize(frame.range, frame.range, frame.bgr.size(), 0, 0, cv::INTER_NEAREST);
+      }
+
+      decoded_.Push(std::move(frame));
+    }
+  }
+
+  void EnhanceWorker()
+  {
+    Frame frame;
+    while (decoded_.PopBlocking(frame)) {
+      Image3f J;
+      const imaging::EUInfo info = imaging::EnhanceUnderwater(
+          frame.bgr, frame.range,
+          params_.back_num_px, params_.back_opt_iters,
+          params_.beta_num_px, params_.beta_opt_iters,
+          imaging::BetaInitialGuess1(), J, params_.estimate_scale);
+
+      if (!info.success_backscatter) {
+        ++num_failed_backscatter_;
+      }
+      if (!info.success_attenuation) {
+        ++num_failed_attenuation_;
+      }
+
+      frame.out = CastImage3fTo3b(imaging::LinearToGamma(J, params_.gamma_power));
+      frame.bgr.release();
+      frame.range.release();
+
+      WaitForRoom(enhanced_, params_.prefetch_frames);
+      enhanced_.Push(std::move(frame));
+    }
+  }
+
+  // NOTE(milo): Writes to a temporary file and then renames it, so that a crash never leaves behind
+  // a partial image that looks complete.
+  void EncodeWorker()
+  {
+    Frame frame;
+    while (enhanced_.PopBlocking(frame)) {
+      const std::string& path = jobs_.at(frame.index).output_path;
+      const std::string tmp_path = path + ".tmp.png";
+      CHECK(cv::imwrite(tmp_path, frame.out)) << "Failed to write " << tmp_path << std::endl;
+      CHECK_EQ(0, std::rename(tmp_path.c_str(), path.c_str())) << "Failed to rename " << tmp_path << std::endl;
+
+      const int n = ++num_written_;
+      if (n % 100 == 0) {
+        LOG(INFO) << "Wrote " << n << "/" << pending_.size() << " images" << std::endl;
+      }
+    }
+  }
+
+ private:
+  const EnhanceBatchParams& params_;
+  const std::vector<Job>& jobs_;
+
+  std::vector<size_t> pending_;
+  std::atomic<size_t> next_pending_{0};
+  ThreadsafeQueue<Frame> decoded_;
+  ThreadsafeQueue<Frame> enhanced_;
+  std::atomic<int> num_written_{0};
+  std::atomic<int> num_failed_backscatter_{0};
+  std::atomic<int> num_failed_attenuation_{0};
+};
+
+
+void Run(const std::string& config_path)
+{
+  EnhanceBatchParams params(config_path);
+
+  const std::vector<Job> jobs = (params.input == EnhanceBatchParams::Input::DATASET) ?
+      DatasetJobs(params) : FolderJobs(params);
+
+  BatchRunner runner(params, jobs);
+  runner.Run();
+
+  LOG(INFO) << "DONE" << std::endl;
+}
+
+
+int main(int argc, char const *argv[])
+{
+  Run(argc > 1 ? std::string(argv[1]) : tools_path("enhance_batch/config/EnhanceBatch.yaml"));
+  return 0;
+}
@@ -0,0 +1,366 @@
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/latency_histogram.hpp"
+#include "core/macros.hpp"
+#include "core/path_util.hpp"
+#include "core/timer.hpp"
+#include "core/timestamp.hpp"
+#include "params/params_base.hpp"
+#include "dataset/dataset_util.hpp"
+#include "lcm_util/shm_stereo_publisher.hpp"
+#include "lcm_util/util_depth_measurement_t.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+#include "lcm_util/util_pose3_t.hpp"
+#include "lcm_util/util_range_measurement_t.hpp"
+
+#include "vehicle/depth_measurement_t.hpp"
+#include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/pose3_stamped_t.hpp"
+#include "vehicle/range_measurement_t.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Allows re-running without recompiling.
+struct HilReplayParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(HilReplayParams);
+  dataset::Dataset dataset = dataset::Dataset::FARMSIM;
+  std::string folder;
+  std::string subfolder;
+  bool use_stereo = true;
+  bool use_imu = true;
+  bool use_depth = true;
+  bool use_range = true;
+  float playback_speed = 1.0;     // Multiple of real time, or <= 0 to publish as fast as possible.
+  double start_delay_sec = 2.0;   // Wait this long after the initial pose, so the nodes can initialize.
+  int prefetch_lookahead = 16;
+  int prefetch_threads = 2;
+
+  // Sleep until a measurement is (almost) due, and busy-wait the rest, since sleeping alone wakes up
+  // tens of microseconds late.
+  int spin_us = 200;
+
+  // If publishing falls this far behind (e.g a slow disk), start the schedule over from the current
+  // measurement, instead of publishing everything that's overdue in a burst.
+  double resync_late_ms = 200.0;
+  double print_interval_sec = 5.0;
+
+  std::vector<std::string> channels_stereo;   // Each one gets its own ring (shm_name_<i>).
+  std::string shm_name;
+  int shm_slots = 8;
+  std::string channel_imu;
+  std::string channel_depth;
+  std::string channel_range;
+  std::string channel_initial_pose;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    dataset = YamlToEnum<dataset::Dataset>(parser.GetNode("dataset"));
+    folder = YamlToString(parser.GetNode("folder"));
+    subfolder = YamlToString(parser.GetNode("subfolder"));
+    parser.GetParam("use_stereo", &use_stereo);
+    parser.GetParam("use_imu", &use_imu);
+    parser.GetParam("use_depth", &use_depth);
+    parser.GetParam("use_range", &use_range);
+    parser.GetParam("playback_speed", &playback_speed);
+    parser.GetParam("start_delay_sec", &start_delay_sec);
+    parser.GetParam("prefetch_lookahead", &prefetch_lookahead);
+    parser.GetParam("prefetch_threads", &prefetch_threads);
+    parser.GetParam("spin_us", &spin_us);
+    parser.GetParam("resync_late_ms", &resync_late_ms);
+    parser.GetParam("print_interval_sec", &print_interval_sec);
+    channels_stereo = YamlToStringList(parser.GetNode("channels_stereo"));
+    shm_name = YamlToString(parser.GetNode("shm_name"));
+    parser.GetParam("shm_slots", &shm_slots);
+    channel_imu = YamlToString(parser.GetNode("channel_imu"));
+    channel_depth = YamlToString(parser.GetNode("channel_depth"));
+    channel_range = YamlToString(parser.GetNode("channel_range"));
+    channel_initial_pose = YamlToString(parser.GetNode("channel_initial_pose"));
+  }
+};
+
+
+// Maps dataset time onto the wall clock: a measurement at time t is due at wall_t0 + (t - t0) / speed.
+// Deadlines are absolute, so sleeping late for one measurement doesn't delay all of the ones after it.
+class ReplayClock final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ReplayClock)
+
+  ReplayClock(float speed, int spin_us, double resync_late_ms)
+      : speed_(speed), spin_(std::chrono::microseconds(spin_us)), resync_late_ms_(resync_late_ms) {}
+
+  // Start the schedule, with t0 due now.
+  void Start(timestamp_t t0)
+  {
+    t0_ = t0;
+    wall_t0_ = std::chrono::steady_clock::now();
+  }
+
+  // Wait until the measurement at time t is due. Returns how late it is (ms) once this returns.
+  double WaitUntil(timestamp_t t)
+  {
+    if (speed_ <= 0) {
+      return 0;
+    }
+
+    const auto deadline = Deadline(t);
+    if (std::chrono::steady_clock::now() < deadline - spin_) {
+      std::this_thread::sleep_until(deadline - spin_);
+    }
+    while (std::chrono::steady_clock::now() < deadline) {}
+
+    const double late_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - deadline).count();
+    if (late_ms > resync_late_ms_) {
+      Start(t);
+      ++num_resyncs_;
+    }
+    return late_ms;
+  }
+
+  size_t NumResyncs() const { return num_resyncs_; }
+
+ private:
+  Clocktime Deadline(timestamp_t t) const
+  {
+    const double wall_sec = ConvertToSeconds(t - t0_) / static_cast<double>(speed_);
+    return wall_t0_ + std::chrono::duration_cast<Clocktime::duration>(Seconds(wall_sec));
+  }
+
+  float speed_;
+  std::chrono::microseconds spin_;
+  double resync_late_ms_;
+
+  timestamp_t t0_ = 0;
+  Clocktime wall_t0_;
+  size_t num_resyncs_ = 0;
+};
+
+
+// Counts and pacing error for one stream.
+struct StreamStats final
+{
+  explicit StreamStats(const std::string& name) : name(name) {}
+
+  void Record(timestamp_t t, double late_ms)
+  {
+    if (count == 0) {
+      first = t;
+    }
+    last = t;
+    ++count;
+    late_hist.Record(late_ms);
+  }
+
+  std::string name;
+  uint64_t count = 0;
+  uint64_t failed = 0;    // Messages that couldn't be published (e.g a stereo pair too big for the ring).
+  timestamp_t first = 0;
+  timestamp_t last = 0;
+  LatencyHistogram late_hist{1e-3};
+};
+
+
+// Publishes a dataset onto LCM (and stereo pairs into shared memory rings), paced to a multiple of
+// real time, so that the deployed nodes (state_estimator_lcm, object_mesher_lcm) can be load tested
+// with the same data as the vio_dataset_player. Prints the rate that each stream actually went out
+// at, and how late each message was compared to its schedule.
+class HilReplay final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(HilReplay)
+
+  HilReplay(const HilReplayParams& params, lcm::LCM& lcm)
+      : params_(params),
+        lcm_(lcm),
+        clock_(params.playback_speed, params.spin_us, params.resync_late_ms),
+        stereo_stats_("stereo"),
+        imu_stats_("imu"),
+        depth_stats_("depth"),
+        range_stats_("range")
+  {
+    stereo_pubs_.resize(params_.channels_stereo.size());
+  }
+
+  void Run(dataset::DataProvider& dataset)
+  {
+    if (params_.use_stereo) {
+      dataset.SetStereoPrefetch(params_.prefetch_lookahead, params_.prefetch_threads);
+      dataset.RegisterStereoCallback([this](const StereoImage1b& stereo_pair) { PublishStereo(stereo_pair); });
+    }
+    if (params_.use_imu)
+      dataset.RegisterImuCallback(std::bind(&HilReplay::PublishImu, this, std::placeholders::_1));
+    if (params_.use_depth)
+      dataset.RegisterDepthCallback(std::bind(&HilReplay::PublishDepth, this, std::placeholders::_1));
+    if (params_.use_range)
+      dataset.RegisterRangeCallback(std::bind(&HilReplay::PublishRange, this, std::placeholders::_1));
+
+    const timestamp_t t0 = dataset.FirstTimestamp();
+    PublishInitialPose(t0, dataset.InitialPose());
+    std::this_thread::sleep_for(Seconds(params_.start_delay_sec));
+
+    LOG(INFO) << "Replaying " << ConvertToSeconds(dataset.LastTimestamp() - t0) << " sec of data at "
+              << params_.playback_speed << "x" << std::endl;
+
+    clock_.Start(t0);
+    wall_timer_.Reset();
+
+    Timer print_timer(true);
+    while (dataset.Step()) {
+      if (print_timer.Elapsed().seconds() >= params_.print_interval_sec) {
+        Print();
+        print_timer.Reset();
+      }
+    }
+
+    LOG(INFO) << "Finished replay" << std::endl;
+    Print();
+  }
+
+  void Print()
+  {
+    const double wall_sec = wall_timer_.Elapsed().seconds();
+
+    std::stringstream ss;
+    ss << "Replay at " << params_.playback_speed << "x after " << std::fixed << std::setprecision(1)
+       << wall_sec << " sec (" << clock_.NumResyncs() << " resyncs):\n";
+    ss << std::setprecision(2);
+
+    for (const StreamStats* s : { &stereo_stats_, &imu_stats_, &depth_stats_, &range_stats_ }) {
+      if (s->count == 0) {
+        continue;
+      }
+
+      // The rate that the stream would go out at if the pacing were perfect.
+      const double span_sec = ConvertToSeconds(s->last - s->first);
+      const double nominal_hz = (span_sec > 0 && params_.playback_speed > 0) ?
+          params_.playback_speed * (s->count - 1) / span_sec : 0;
+      const double achieved_hz = (wall_sec > 0) ? s->count / wall_sec : 0;
+
+      ss << "  " << std::left << std::setw(8) << s->name << std::right
+         << " n=" << std::setw(8) << s->count
+         << " failed=" << std::setw(4) << s->failed
+         << " hz=" << std::setw(8) << achieved_hz << " (nominal " << std::setw(8) << nominal_hz << ")"
+         << "  late ms: p50=" << std::setw(7) << s->late_hist.Percentile(0.5)
+         << " p99=" << std::setw(7) << s->late_hist.Percentile(0.99)
+         << " max=" << std::setw(7) << s->late_hist.Max() << "\n";
+    }
+    LOG(INFO) << ss.str() << std::endl;
+  }
+
+ private:
+  void PublishInitialPose(timestamp_t t0, const Matrix4d& world_T_body)
+  {
+    vehicle::pose3_stamped_t msg;
+    msg.header.timestamp = t0;
+    msg.header.seq = -1;
+    msg.header.frame_id = "body";
+    pack_pose3_t(gtsam::Pose3(world_T_body), msg.pose);
+    lcm_.publish(params_.channel_initial_pose, &msg);
+    LOG(INFO) << "Published initial pose on: " << params_.channel_initial_pose << std::endl;
+  }
+
+  void PublishStereo(const StereoImage1b& stereo_pair)
+  {
+    const double late_ms = clock_.WaitUntil(stereo_pair.timestamp);
+
+    for (size_t i = 0; i < params_.channels_stereo.size(); ++i) {
+      // NOTE(milo): Rings are created on the first pair, so that their slots fit the dataset's images.
+      if (!stereo_pubs_.at(i)) {
+        stereo_pubs_.at(i).reset(new ShmStereoPublisher(
+            lcm_, params_.channels_stereo.at(i), params_.shm_name + "_" + std::to_string(i),
+            params_.shm_slots, stereo_pair.left_image.cols, stereo_pair.left_image.rows, 1));
+      }
+      if (!stereo_pubs_.at(i)->Publish(stereo_pair)) {
+        ++stereo_stats_.failed;
+      }
+    }
+    stereo_stats_.Record(stereo_pair.timestamp, late_ms);
+  }
+
+  void PublishImu(const ImuMeasurement& data)
+  {
+    const double late_ms = clock_.WaitUntil(data.timestamp);
+    vehicle::imu_measurement_t msg;
+    pack_imu_measurement_t(data, msg);
+    msg.header.seq = static_cast<int64_t>(imu_stats_.count);
+    msg.header.frame_id = "imu0";
+    lcm_.publish(params_.channel_imu, &msg);
+    imu_stats_.Record(data.timestamp, late_ms);
+  }
+
+  void PublishDepth(const DepthMeasurement& data)
+  {
+    const double late_ms = clock_.WaitUntil(data.timestamp);
+    vehicle::depth_measurement_t msg;
+    pack_depth_measurement_t(data, msg);
+    msg.header.seq = static_cast<int64_t>(depth_stats_.count);
+    msg.header.frame_id = "body";
+    lcm_.publish(params_.channel_depth, &msg);
+    depth_stats_.Record(data.timestamp, late_ms);
+  }
+
+  void PublishRange(const RangeMeasurement& data)
+  {
+    const double late_ms = clock_.WaitUntil(data.timestamp);
+    vehicle::range_measurement_t msg;
+    pack_range_measurement_t(data, msg);
+    msg.header.seq = static_cast<int64_t>(range_stats_.count);
+    msg.header.frame_id = "body";
+    lcm_.publish(params_.channel_range, &msg);
+    range_stats_.Record(data.timestamp, late_ms);
+  }
+
+  HilReplayParams params_;
+  lcm::LCM& lcm_;
+  ReplayClock clock_;
+  Timer wall_timer_;
+
+  std::vector<std::unique_ptr<ShmStereoPublisher>> stereo_pubs_;
+
+  StreamStats stereo_stats_;
+  StreamStats imu_stats_;
+  StreamStats depth_stats_;
+  StreamStats range_stats_;
+};
+
+
+int main(int argc, char const *argv[])
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  HilReplayParams params(tools_path("hil_replay/config/HilReplay.yaml"));
+
+  // Sweeping the speed (e.g 1, 2, 5) to find where the nodes saturate doesn't need a config edit.
+  if (argc == 2) {
+    params.playback_speed = std::stof(argv[1]);
+  }
+
+  lcm::LCM lcm;
+  if (!lcm.good()) {
+    LOG(WARNING) << "Failed to initialize LCM" << std::endl;
+    return 1;
+  }
+
+  std::string shared_params_path;
+  dataset::DataProvider dataset = dataset::GetDatasetByName(
+      params.dataset, params.folder, params.subfolder, shared_params_path);
+
+  HilReplay replay(params, lcm);
+  replay.Run(dataset);
+
+  return 0;
+}
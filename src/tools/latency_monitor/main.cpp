@@ -0,0 +1,105 @@
+#include <iomanip>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/stats_tracker.hpp"
+#include "core/timer.hpp"
+#include "lcm_util/util_latency_trace_t.hpp"
+#include "vehicle/latency_trace_t.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Aggregates latency_trace_t messages into a histogram per stage (the time since the stage before
+// it), and one for the whole pipeline (first stage to last). Prints them every few seconds.
+class LatencyMonitor final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(LatencyMonitor)
+
+  LatencyMonitor() = default;
+
+  void HandleTrace(const lcm::ReceiveBuffer*,
+                   const std::string&,
+                   const vehicle::latency_trace_t* msg)
+  {
+    decode_latency_trace_t(*msg, trace_);
+    if (trace_.stages.size() < 2) {
+      return;
+    }
+
+    for (size_t i = 1; i < trace_.stages.size(); ++i) {
+      const std::string name = trace_.stages.at(i - 1).first + " -> " + trace_.stages.at(i).first;
+      RecordMs(name, trace_.stages.at(i).second - trace_.stages.at(i - 1).second);
+    }
+
+    const std::string total = trace_.stages.front().first + " -> " + trace_.stages.back().first + " (total)";
+    RecordMs(total, trace_.stages.back().second - trace_.stages.front().second);
+    stats_.Increment("NumTraces");
+  }
+
+  void Print()
+  {
+    const StatsSnapshot snapshot = stats_.Snapshot();
+
+    std::stringstream ss;
+    ss << "Latency (ms) over " << stats_.Counter("NumTraces").load() << " frames:\n";
+    ss << std::fixed << std::setprecision(2);
+    for (const HistogramSummary& h : snapshot.histograms) {
+      ss << "  " << std::left << std::setw(40) << h.name << std::right
+         << " p50=" << std::setw(8) << h.p50
+         << " p90=" << std::setw(8) << h.p90
+         << " p99=" << std::setw(8) << h.p99
+         << " max=" << std::setw(8) << h.max << "\n";
+    }
+    LOG(INFO) << ss.str() << std::endl;
+  }
+
+ private:
+  void RecordMs(const std::string& name, int64_t dt_utime)
+  {
+    stats_.Histogram(name).Record(static_cast<double>(dt_utime) * 1e-3);
+  }
+
+  StatsTracker stats_{"LatencyMonitor", 100};
+  LatencyTrace trace_;   // Reused by HandleTrace().
+};
+
+
+int main(int argc, char const *argv[])
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  if (argc != 2 && argc != 3) {
+    LOG(WARNING) << "Expected 1 or 2 arguments: the latency_trace_t channel name, and optionally "
+                 << "how often to print (seconds, default 5). Exiting." << std::endl;
+    return 0;
+  }
+
+  const std::string lcm_channel(argv[1]);
+  const double print_interval_sec = (argc == 3) ? std::stod(argv[2]) : 5.0;
+  LOG(INFO) << "Listening for latency traces on channel " << lcm_channel << std::endl;
+
+  lcm::LCM lcm;
+  if (!lcm.good()) {
+    LOG(WARNING) << "LCM could not be initialized. Exiting." << std::endl;
+    return 1;
+  }
+
+  LatencyMonitor monitor;
+  lcm.subscribe(lcm_channel, &LatencyMonitor::HandleTrace, &monitor);
+
+  Timer print_timer(true);
+  while (lcm.handleTimeout(100) >= 0) {
+    if (print_timer.Elapsed().seconds() >= print_interval_sec) {
+      monitor.Print();
+      print_timer.Reset();
+    }
+  }
+
+  return 0;
+}
@@ -1,4 +1,4 @@
-#include <fstream>
+#include <algorithm>
 #include <iostream>
 
 #include <glog/logging.h>
@@ -14,6 +14,7 @@
 #include "vehicle/image_t.hpp"
 #include "vehicle/stereo_image_t.hpp"
 #include "vehicle/mmf_stereo_image_t.hpp"
+#include "vehicle/image_preview_t.hpp"
 
 #include "lcm_util/decode_image.hpp"
 
@@ -42,41 +43,34 @@ class LcmImageViewer final {
       LOG(INFO) << "Opening memory-mapped file for the first time: " << mm_filename << std::endl;
       mapped_file_ = ipc::file_mapping(mm_filename.c_str(), ipc::read_only);
       mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
-      fbuf_.open(mm_filename, std::ios_base::in | std::ios_base::binary);
     }
 
     CHECK_EQ(mm_filename, mapped_file_.get_name());
-    CHECK(fbuf_.is_open()) << "File buffer was not open" << std::endl;
 
-    // Read raw char buffers for both images.
     const int offl = msg->img_left.offset;
     const int szl = msg->img_left.size;
-
-    if (offl < 0 || szl <= 0) {
-      LOG(WARNING) << "Got a data buffer for the left image with negative offset or zero size" << std::endl;
-      return;
-    }
-
-    lbuf_.resize(szl);
-    fbuf_.pubseekpos(offl);
-    fbuf_.sgetn(&lbuf_[0], std::streamsize(szl));
-
     const int offr = msg->img_right.offset;
     const int szr = msg->img_right.size;
 
-    if (offr < 0 || szr <= 0) {
-      LOG(WARNING) << "Got a data buffer for the right image with negative offset or zero size" << std::endl;
+    if (offl < 0 || szl <= 0 || offr < 0 || szr <= 0) {
+      LOG(WARNING) << "Got a data buffer with negative offset or zero size" << std::endl;
       return;
     }
 
-    rbuf_.resize(szr);
-    fbuf_.pubseekpos(offr);
-    fbuf_.sgetn(&rbuf_[0], std::streamsize(szr));
+    // The publisher might have grown the file since it was mapped.
+    const size_t end = static_cast<size_t>(std::max(offl + szl, offr + szr));
+    if (end > mapped_region_.get_size()) {
+      mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
+    }
+    if (end > mapped_region_.get_size()) {
+      LOG(WARNING) << "Image data is past the end of the memory-mapped file" << std::endl;
+      return;
+    }
 
-    // Decode the data into images.
-    // https://stackoverflow.com/questions/4254615/how-to-cast-vectorunsigned-char-to-char
-    bm::DecodeJPG(msg->img_left, reinterpret_cast<uint8_t*>(lbuf_.data()), left_);
-    bm::DecodeJPG(msg->img_right, reinterpret_cast<uint8_t*>(rbuf_.data()), right_);
+    // Decode straight from the mapping.
+    const uint8_t* data = static_cast<const uint8_t*>(mapped_region_.get_address());
+    bm::DecodeJPG(msg->img_left, data + offl, left_);
+    bm::DecodeJPG(msg->img_right, data + offr, right_);
 
     ShowImagePair(msg->header.timestamp);
   }
@@ -116,6 +110,37 @@ class LcmImageViewer final {
     }
   }
 
+  // Previews are small (see PackImagePreview), so this is cheap to run on a topside computer.
+  void HandlePreview(const lcm::ReceiveBuffer*,
+                     const std::string&,
+                     const vehicle::image_preview_t* msg)
+  {
+    if (msg->img.encoding != "jpg") {
+      LOG(WARNING) << "Unsupported encoding: " << msg->img.encoding << std::endl;
+      return;
+    }
+
+    bm::DecodeJPG(msg->img, left_);
+    if (left_.rows == 0 || left_.cols == 0) {
+      LOG(WARNING) << "Problem decoding preview image" << std::endl;
+      return;
+    }
+
+    const std::string time_str = "timestamp: " + std::to_string(msg->header.timestamp);
+    const std::string dim_str = "w=" + std::to_string(msg->full_width) + " h=" + std::to_string(msg->full_height)
+                              + " (preview w=" + std::to_string(left_.cols) + " h=" + std::to_string(left_.rows) + ")";
+
+    if (left_.channels() == 1) {
+      cv::cvtColor(left_, left_, cv::COLOR_GRAY2BGR);
+    }
+
+    cv::putText(left_, time_str, cv::Point(10, 15), cv::FONT_HERSHEY_PLAIN, kTextScale, kColorRed);
+    cv::putText(left_, dim_str, cv::Point(10, left_.rows - 10), cv::FONT_HERSHEY_PLAIN, kTextScale, kColorRed);
+
+    cv::imshow("PREVIEW", left_);
+    cv::waitKey(5);
+  }
+
   void ShowImagePair(core::timestamp_t timestamp)
   {
     const std::string time_str = "timestamp: " + std::to_string(timestamp);
@@ -142,10 +167,6 @@ class LcmImageViewer final {
 
   ipc::file_mapping mapped_file_;
   ipc::mapped_region mapped_region_;
-
-  // https://stackoverflow.com/questions/604431/c-reading-unsigned-char-from-file-stream
-  std::basic_filebuf<char> fbuf_;
-  std::vector<char> lbuf_, rbuf_;
 };
 
 
@@ -157,13 +178,15 @@ int main(int argc, char const *argv[])
 
   LOG(INFO) << "Starting lcm_image_viewer" << std::endl;
 
-  if (argc != 2) {
-    LOG(WARNING) << "Expected 1 argument, make sure to pass in the LCM channel name. Exiting." << std::endl;
+  if (argc != 2 && argc != 3) {
+    LOG(WARNING) << "Expected 1 or 2 arguments: the LCM channel name, and optionally the message type "
+                 << "(preview, mmf or stereo, default preview). Exiting." << std::endl;
     return 0;
   }
 
   const std::string lcm_channel(argv[1]);
-  LOG(INFO) << "Listening on channel " << lcm_channel << std::endl;
+  const std::string message_type((argc == 3) ? argv[2] : "preview");
+  LOG(INFO) << "Listening on channel " << lcm_channel << " (" << message_type << ")" << std::endl;
 
   lcm::LCM lcm;
 
@@ -174,8 +197,18 @@ int main(int argc, char const *argv[])
 
   LcmImageViewer viewer;
 
-  // lcm.subscribe(lcm_channel, &LcmImageViewer::HandleStereo, &viewer);
-  lcm.subscribe(lcm_channel, &LcmImageViewer::HandleMmfStereo, &viewer);
+  // NOTE(milo): Full frames (mmf or stereo) are only worth viewing on the vehicle itself. Over the
+  // network, use the preview channel that StateEstimatorLcm publishes.
+  if (message_type == "preview") {
+    lcm.subscribe(lcm_channel, &LcmImageViewer::HandlePreview, &viewer);
+  } else if (message_type == "mmf") {
+    lcm.subscribe(lcm_channel, &LcmImageViewer::HandleMmfStereo, &viewer);
+  } else if (message_type == "stereo") {
+    lcm.subscribe(lcm_channel, &LcmImageViewer::HandleStereo, &viewer);
+  } else {
+    LOG(WARNING) << "Unknown message type: " << message_type << ". Exiting." << std::endl;
+    return 1;
+  }
 
   // Keep running until we exit.
   while (0 == lcm.handle());
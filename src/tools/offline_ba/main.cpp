@@ -0,0 +1,125 @@
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/path_util.hpp"
+#include "core/timestamp.hpp"
+#include "params/params_base.hpp"
+#include "vio/mission_log.hpp"
+#include "vio/offline_bundle_adjuster.hpp"
+#include "vio/state_estimator.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Bundle adjusts a mission that StateEstimator recorded (see StateEstimator::Params::mission_log_path),
+// and writes out the refined trajectory.
+struct OfflineBaParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(OfflineBaParams);
+  std::string mission_log;
+  std::string estimator_config;         // Relative to src/tools.
+  std::string shared_config;            // Relative to config.
+  std::string trajectory_path;
+  std::string online_trajectory_path;   // Optional, the online estimate in the same format.
+
+  OfflineBundleAdjuster::Params ba_params;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    mission_log = YamlToString(parser.GetNode("mission_log"));
+    estimator_config = YamlToString(parser.GetNode("estimator_config"));
+    shared_config = YamlToString(parser.GetNode("shared_config"));
+    trajectory_path = YamlToString(parser.GetNode("trajectory_path"));
+    online_trajectory_path = YamlToString(parser.GetNode("online_trajectory_path"));
+    ba_params = OfflineBundleAdjuster::Params(parser.Subtree("OfflineBundleAdjuster"));
+  }
+};
+
+
+// One line per keypose, like EuRoC groundtruth (ns,qw,qx,qy,qz,tx,ty,tz), so that it can be
+// compared with the same tools.
+static void WriteTrajectory(const std::string& path,
+                            const std::vector<SmootherResult, Eigen::aligned_allocator<SmootherResult>>& keyposes)
+{
+  std::ofstream out(path);
+  CHECK(out.good()) << "Couldn't open " << path << std::endl;
+  out.precision(9);
+  for (const SmootherResult& kp : keyposes) {
+    const Quaterniond q = kp.world_P_body.rotation().toQuaternion();
+    const Vector3d t = kp.world_P_body.translation();
+    out << ConvertToNanoseconds(kp.timestamp) << ","
+        << q.w() << "," << q.x() << "," << q.y() << "," << q.z() << ","
+        << t.x() << "," << t.y() << "," << t.z() << "\n";
+  }
+}
+
+
+void Run(const std::string& config_file)
+{
+  const OfflineBaParams app_params(config_file);
+
+  // NOTE(milo): The factors have to be built the same way as when the mission was recorded.
+  const StateEstimator::Params estimator_params(
+      tools_path(app_params.estimator_config),
+      config_path(app_params.shared_config));
+
+  MissionLog log;
+  CHECK(ReadMissionLog(app_params.mission_log, log)) << "Couldn't read " << app_params.mission_log << std::endl;
+  LOG(INFO) << "Read " << log.keyposes.size() << " keyposes and " << log.imu.size() << " IMU measurements" << std::endl;
+
+  OfflineBundleAdjuster adjuster(app_params.ba_params, estimator_params.smoother_params, estimator_params.imu_manager_params);
+  const OfflineBaResult result = adjuster.Solve(log);
+
+  // How far the refined trajectory moved from the online one.
+  size_t num_refined = 0;
+  double sum_sq_correction = 0;
+  double max_correction = 0;
+  for (size_t i = 0; i < result.keyposes.size(); ++i) {
+    if (!result.refined.at(i)) {
+      continue;
+    }
+    const double correction = (result.keyposes.at(i).world_P_body.translation() -
+                               log.keyposes.at(i).online.world_P_body.translation()).norm();
+    sum_sq_correction += correction * correction;
+    max_correction = std::max(max_correction, correction);
+    ++num_refined;
+  }
+
+  printf("\n============================== OFFLINE BA ==============================\n");
+  printf("Keyposes:   %zu (%zu refined)\n", result.keyposes.size(), num_refined);
+  printf("Windows:    %d (%d failed)\n", result.num_windows, result.num_failed_windows);
+  printf("Mission:    %.1f sec\n", result.mission_sec);
+  printf("Solve:      %.1f sec (%.3fx mission time)\n", result.solve_sec,
+      result.mission_sec > 0 ? result.solve_sec / result.mission_sec : 0.0);
+  printf("Correction: RMS=%.3f m MAX=%.3f m\n",
+      num_refined > 0 ? std::sqrt(sum_sq_correction / num_refined) : 0.0, max_correction);
+
+  WriteTrajectory(app_params.trajectory_path, result.keyposes);
+  LOG(INFO) << "Wrote refined trajectory to " << app_params.trajectory_path << std::endl;
+
+  if (!app_params.online_trajectory_path.empty()) {
+    std::vector<SmootherResult, Eigen::aligned_allocator<SmootherResult>> online;
+    for (const MissionKeypose& kp : log.keyposes) {
+      online.emplace_back(kp.online);
+    }
+    WriteTrajectory(app_params.online_trajectory_path, online);
+  }
+}
+
+
+int main(int argc, char const *argv[])
+{
+  Run(argc > 1 ? std::string(argv[1]) : tools_path("offline_ba/config/OfflineBa.yaml"));
+  return 0;
+}
@@ -0,0 +1,516 @@
+#include <glog/logging.h>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/path_util.hpp"
+#include "core/random.hpp"
+#include "core/stats_exporter.hpp"
+#include "core/stats_tracker.hpp"
+#include "core/timer.hpp"
+#include "params/params_base.hpp"
+#include "mesher/triangle_mesh.hpp"
+#include "rrt/informed_sampler.hpp"
+#include "rrt/mesh_collision_checker.hpp"
+#include "rrt/rrt.hpp"
+#include "vehicle/mesh_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+enum class Scene { RANDOM_SPHERES = 0, MESH = 1 };
+
+// How neighbors are found. KDTREE rebuilds a kd-tree every iteration (like BuildTree used to).
+enum class Planner { VOXEL_INDEX = 0, KDTREE = 1, PARALLEL = 2 };
+
+// ANALYTIC checks segments against the spheres exactly (only for RANDOM_SPHERES).
+enum class Collision { ANALYTIC = 0, MESH_VOXELS = 1 };
+
+
+// Allows re-running without recompiling.
+struct RrtBenchmarkParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(RrtBenchmarkParams);
+
+  Scene scene = Scene::RANDOM_SPHERES;
+  int num_spheres = 200;
+  double sphere_radius_min = 1.0;
+  double sphere_radius_max = 4.0;
+
+  // An OBJ file, or an LCM log with mesh_t messages on mesh_channel (the last one is used).
+  std::string mesh_path;
+  std::string mesh_channel;
+
+  Vector3d pmin = Vector3d(-50, -50, -20);
+  Vector3d pmax = Vector3d(50, 50, 20);
+  Vector3d start = Vector3d(-45, 0, 0);
+  Vector3d goal = Vector3d(45, 0, 0);
+  double goal_radius = 2.0;
+  double goal_bias = 0.05;
+  bool informed = true;         // Sample the informed set once there's a solution.
+  double clearance = 0.5;
+  double voxel_size = 0.25;
+
+  int num_trials = 3;
+  int num_threads = 4;
+  std::vector<int> sweep_maxiters;
+  std::vector<double> sweep_search_radius;
+  std::vector<int> sweep_planner;
+  std::vector<int> sweep_collision;
+
+  std::string report_path;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    scene = YamlToEnum<Scene>(parser.GetNode("scene"));
+    parser.GetParam("num_spheres", &num_spheres);
+    parser.GetParam("sphere_radius_min", &sphere_radius_min);
+    parser.GetParam("sphere_radius_max", &sphere_radius_max);
+    mesh_path = YamlToString(parser.GetNode("mesh_path"));
+    mesh_channel = YamlToString(parser.GetNode("mesh_channel"));
+    YamlToVector<Vector3d>(parser.GetNode("pmin"), pmin);
+    YamlToVector<Vector3d>(parser.GetNode("pmax"), pmax);
+    YamlToVector<Vector3d>(parser.GetNode("start"), start);
+    YamlToVector<Vector3d>(parser.GetNode("goal"), goal);
+    parser.GetParam("goal_radius", &goal_radius);
+    parser.GetParam("goal_bias", &goal_bias);
+    parser.GetParam("informed", &informed);
+    parser.GetParam("clearance", &clearance);
+    parser.GetParam("voxel_size", &voxel_size);
+    parser.GetParam("num_trials", &num_trials);
+    parser.GetParam("num_threads", &num_threads);
+    YamlToList(parser.GetNode("sweep_maxiters"), sweep_maxiters);
+    YamlToList(parser.GetNode("sweep_search_radius"), sweep_search_radius);
+    YamlToList(parser.GetNode("sweep_planner"), sweep_planner);
+    YamlToList(parser.GetNode("sweep_collision"), sweep_collision);
+    report_path = YamlToString(parser.GetNode("report_path"));
+  }
+
+  template <typename T>
+  static void YamlToList(const cv::FileNode& node, std::vector<T>& out)
+  {
+    CHECK(node.isSeq()) << "Expected a YAML list" << std::endl;
+    out.clear();
+    for (size_t i = 0; i < node.size(); ++i) {
+      out.emplace_back(static_cast<T>(node[i]));
+    }
+  }
+};
+
+
+struct Sphere final
+{
+  Vector3d center;
+  double radius;
+};
+
+
+struct ObstacleScene final
+{
+  std::vector<Sphere> spheres;    // Empty for a MESH scene.
+  mesher::TriangleMesh mesh;
+};
+
+
+// A UV sphere, so that the spheres can go into a MeshCollisionChecker too.
+static void AddSphereMesh(const Sphere& s, mesher::TriangleMesh& mesh, int lat_lines = 8, int lng_lines = 16)
+{
+  const int first = static_cast<int>(mesh.vertices.size());
+  mesh.vertices.emplace_back(s.center + Vector3d(0, 0, -s.radius));
+
+  for (int i = 1; i < lat_lines; ++i) {
+    const double lat = -M_PI / 2 + M_PI * i / lat_lines;
+    for (int j = 0; j < lng_lines; ++j) {
+      const double lng = 2 * M_PI * j / lng_lines;
+      mesh.vertices.emplace_back(s.center + s.radius * Vector3d(std::cos(lat) * std::cos(lng),
+                                                                std::cos(lat) * std::sin(lng),
+                                                                std::sin(lat)));
+    }
+  }
+  const int north = static_cast<int>(mesh.vertices.size());
+  mesh.vertices.emplace_back(s.center + Vector3d(0, 0, s.radius));
+
+  const auto ring = [&](int i, int j) { return first + 1 + (i - 1) * lng_lines + (j % lng_lines); };
+  for (int j = 0; j < lng_lines; ++j) {
+    mesh.triangles.emplace_back(first, ring(1, j + 1), ring(1, j));
+    mesh.triangles.emplace_back(north, ring(lat_lines - 1, j), ring(lat_lines - 1, j + 1));
+    for (int i = 1; i < lat_lines - 1; ++i) {
+      mesh.triangles.emplace_back(ring(i, j), ring(i, j + 1), ring(i + 1, j + 1));
+      mesh.triangles.emplace_back(ring(i, j), ring(i + 1, j + 1), ring(i + 1, j));
+    }
+  }
+}
+
+
+// Random spheres in the box, leaving room around the start and goal.
+static ObstacleScene MakeSphereScene(const RrtBenchmarkParams& p)
+{
+  ObstacleScene scene;
+  while (static_cast<int>(scene.spheres.size()) < p.num_spheres) {
+    Sphere s;
+    s.center = SampleBoxPoint(p.pmin, p.pmax);
+    s.radius = RandomUniformd(p.sphere_radius_min, p.sphere_radius_max);
+    const double keepout = s.radius + p.clearance + p.goal_radius;
+    if ((s.center - p.start).norm() > keepout && (s.center - p.goal).norm() > keepout) {
+      scene.spheres.emplace_back(s);
+      AddSphereMesh(s, scene.mesh);
+    }
+  }
+  return scene;
+}
+
+
+// Only the "v x y z" and "f a b c" lines (faces with more vertices are fanned into triangles).
+static bool LoadObjMesh(const std::string& path, mesher::TriangleMesh& mesh)
+{
+  std::ifstream in(path);
+  if (!in.good()) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ss(line);
+    std::string type;
+    ss >> type;
+    if (type == "v") {
+      Vector3d v;
+      ss >> v.x() >> v.y() >> v.z();
+      mesh.vertices.emplace_back(v);
+    } else if (type == "f") {
+      // Vertices can look like "3", "3/1" or "3/1/2", and are 1-indexed.
+      std::vector<int> face;
+      std::string token;
+      while (ss >> token) {
+        face.emplace_back(std::stoi(token.substr(0, token.find('/'))) - 1);
+      }
+      for (size_t i = 2; i < face.size(); ++i) {
+        mesh.triangles.emplace_back(face.at(0), face.at(i - 1), face.at(i));
+      }
+    }
+  }
+
+  return !mesh.triangles.empty();
+}
+
+
+// The last mesh_t on "channel" in an LCM log (e.g recorded from ObjectMesherLcm).
+static bool LoadLcmLogMesh(const std::string& path, const std::string& channel, mesher::TriangleMesh& mesh)
+{
+  lcm::LogFile log(path, "r");
+  if (!log.good()) {
+    return false;
+  }
+
+  vehicle::mesh_t msg;
+  bool found = false;
+  for (const lcm::LogEvent* event = log.readNextEvent(); event != nullptr; event = log.readNextEvent()) {
+    if (event->channel == channel && msg.decode(event->data, 0, event->datalen) >= 0) {
+      found = true;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  mesh = mesher::TriangleMesh();
+  for (const vehicle::vector3_t& v : msg.vertices) {
+    mesh.vertices.emplace_back(v.x, v.y, v.z);
+  }
+  for (const vehicle::mesh_triangle_t& t : msg.triangles) {
+    mesh.triangles.emplace_back(t.vertex_indices[0], t.vertex_indices[1], t.vertex_indices[2]);
+  }
+  return true;
+}
+
+
+static ObstacleScene LoadMeshScene(const RrtBenchmarkParams& p)
+{
+  ObstacleScene scene;
+  const bool is_obj = p.mesh_path.size() > 4 && p.mesh_path.substr(p.mesh_path.size() - 4) == ".obj";
+  const bool ok = is_obj ? LoadObjMesh(p.mesh_path, scene.mesh) : LoadLcmLogMesh(p.mesh_path, p.mesh_channel, scene.mesh);
+  CHECK(ok) << "Could not load a mesh from: " << p.mesh_path << std::endl;
+  LOG(INFO) << "Loaded mesh with " << scene.mesh.vertices.size() << " vertices and "
+            << scene.mesh.triangles.size() << " triangles" << std::endl;
+  return scene;
+}
+
+
+static double SegmentPointDistance(const Vector3d& a, const Vector3d& b, const Vector3d& p)
+{
+  const Vector3d ab = b - a;
+  const double len2 = ab.squaredNorm();
+  const double t = (len2 > 0) ? std::min(1.0, std::max(0.0, (p - a).dot(ab) / len2)) : 0.0;
+  return (a + t * ab - p).norm();
+}
+
+
+// Rough size of a Tree: the node arrays, a child index and a VoxelIndex entry per node.
+static double TreeBytes(const Tree& tree)
+{
+  const double per_node = 3 * sizeof(double) + sizeof(int) + sizeof(double) +
+                          sizeof(std::vector<Tree::index_t>) + 2 * sizeof(Tree::index_t);
+  return per_node * tree.Size();
+}
+
+
+static double MaxRssMb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;   // Linux reports kilobytes.
+}
+
+
+struct TrialResult final
+{
+  bool solved = false;
+  double total_ms = 0;
+  double first_solution_ms = 0;
+  int iters_to_first_solution = 0;
+  double path_cost = 0;
+  double tree_bytes = 0;
+};
+
+
+// The cheapest node within goal_radius, or -1.
+static int BestGoalNode(const Tree& tree, const Vector3d& goal, double goal_radius)
+{
+  std::vector<Tree::index_t> near_goal;
+  tree.Nearby(goal, goal_radius, near_goal);
+  int best = -1;
+  for (const Tree::index_t i : near_goal) {
+    if (best < 0 || tree.Cost(i) < tree.Cost(best)) {
+      best = static_cast<int>(i);
+    }
+  }
+  return best;
+}
+
+
+static TrialResult RunTrial(const RrtBenchmarkParams& p,
+                            Planner planner,
+                            const CollisionChecker& checker,
+                            const BatchCollisionChecker& batch_checker,
+                            int maxiters,
+                            double search_radius)
+{
+  TrialResult r;
+  Tree tree(search_radius);
+
+  InformedSampler::Params sampler_params;
+  sampler_params.goal_bias = p.goal_bias;
+  InformedSampler informed_sampler(sampler_params, p.pmin, p.pmax, p.start, p.goal);
+
+  Timer timer(true);
+
+  if (planner == Planner::PARALLEL) {
+    ParallelBuildParams params;
+    params.num_threads = p.num_threads;
+    // NOTE(milo): The tree is only seen after it's built, so the sampler is never informed.
+    BuildTreeParallel(tree, p.start, p.goal, informed_sampler.AsBatchPointSampler(),
+                      checker, search_radius, maxiters, params);
+    r.total_ms = timer.Elapsed().milliseconds();
+
+    // NOTE(milo): Nodes are added in order, so the first one near the goal is about when the first
+    // solution was found (assuming a constant rate).
+    for (Tree::index_t i = 0; i < tree.Size(); ++i) {
+      if ((tree.GetPoint(i) - p.goal).norm() <= p.goal_radius) {
+        r.solved = true;
+        r.iters_to_first_solution = static_cast<int>(i);
+        r.first_solution_ms = r.total_ms * i / tree.Size();
+        break;
+      }
+    }
+  } else {
+    tree.AddNode(Node(p.start, -1, 0));
+    Tree::index_t z_new;
+    for (int iter = 0; iter < maxiters; ++iter) {
+      const Vector3d x_sample = informed_sampler.Sample();
+      bool added = false;
+      if (planner == Planner::KDTREE) {
+        const kdtree_t kdtree = tree.BuildKdTree();
+        added = ExtendTree(tree, kdtree, x_sample, batch_checker, search_radius, z_new);
+      } else {
+        added = ExtendTree(tree, x_sample, batch_checker, search_radius, z_new);
+      }
+
+      if (!added || (tree.GetPoint(z_new) - p.goal).norm() > p.goal_radius) {
+        continue;
+      }
+
+      if (!r.solved) {
+        r.solved = true;
+        r.iters_to_first_solution = iter + 1;
+        r.first_solution_ms = timer.Elapsed().milliseconds();
+      }
+
+      // A better path could end anywhere within goal_radius (see AnytimePlanner).
+      if (p.informed) {
+        informed_sampler.SetBestCost(tree.Cost(BestGoalNode(tree, p.goal, p.goal_radius)) + p.goal_radius);
+      }
+    }
+    r.total_ms = timer.Elapsed().milliseconds();
+  }
+
+  const int best = BestGoalNode(tree, p.goal, p.goal_radius);
+  r.path_cost = (best >= 0) ? tree.Cost(best) : 0;
+  r.tree_bytes = TreeBytes(tree);
+  return r;
+}
+
+
+static void PrintSnapshot(const StatsSnapshot& s)
+{
+  printf("\n========================== %s ==========================\n", s.tracker_name.c_str());
+  for (const HistogramSummary& h : s.histograms) {
+    printf("%-36s N=%-8lu MEAN=%-10.3f P50=%-10.3f P90=%-10.3f MAX=%-10.3f\n",
+        h.name.c_str(), h.count, h.mean, h.p50, h.p90, h.max);
+  }
+  for (const auto& c : s.counters) {
+    printf("%-36s %ld\n", c.first.c_str(), c.second);
+  }
+  for (const auto& g : s.gauges) {
+    printf("%-36s %f\n", g.first.c_str(), g.second);
+  }
+}
+
+
+static const char* PlannerName(Planner planner)
+{
+  switch (planner) {
+    case Planner::VOXEL_INDEX: return "voxel";
+    case Planner::KDTREE: return "kdtree";
+    default: return "parallel";
+  }
+}
+
+
+void Run()
+{
+  const RrtBenchmarkParams p(tools_path("rrt_benchmark/config/RrtBenchmark.yaml"));
+  CHECK(!p.sweep_maxiters.empty() && !p.sweep_search_radius.empty() &&
+        !p.sweep_planner.empty() && !p.sweep_collision.empty()) << "Sweep lists can't be empty" << std::endl;
+
+  const ObstacleScene scene = (p.scene == Scene::MESH) ? LoadMeshScene(p) : MakeSphereScene(p);
+
+  Timer mesh_timer(true);
+  MeshCollisionChecker::Params mesh_params;
+  mesh_params.voxel_size = p.voxel_size;
+  mesh_params.clearance = p.clearance;
+  MeshCollisionChecker mesh_checker(mesh_params);
+  mesh_checker.AddMesh(scene.mesh);
+  LOG(INFO) << "Voxelized " << scene.mesh.triangles.size() << " triangles into " << mesh_checker.NumOccupied()
+            << " voxels in " << mesh_timer.Elapsed().milliseconds() << " ms" << std::endl;
+
+  const CollisionChecker analytic = [&scene, &p](const Vector3d& a, const Vector3d& b)
+  {
+    for (const Sphere& s : scene.spheres) {
+      if (SegmentPointDistance(a, b, s.center) <= s.radius + p.clearance) {
+        return false;
+      }
+    }
+    return true;
+  };
+  const BatchCollisionChecker analytic_batch = [&analytic](const Vector3d& from, const VecVector3d& to, std::vector<uint8_t>& is_free)
+  {
+    is_free.resize(to.size());
+    for (size_t i = 0; i < to.size(); ++i) {
+      is_free.at(i) = analytic(from, to.at(i)) ? 1 : 0;
+    }
+  };
+
+  std::vector<StatsSnapshot> snapshots;
+  printf("\n%-64s %-7s %-12s %-12s %-10s %-10s\n", "config", "solved", "first_ms", "iters/sec", "cost", "tree_kb");
+
+  for (const int maxiters : p.sweep_maxiters) {
+    for (const double radius : p.sweep_search_radius) {
+      for (const int planner_id : p.sweep_planner) {
+        for (const int collision_id : p.sweep_collision) {
+          const Planner planner = static_cast<Planner>(planner_id);
+          const Collision collision = static_cast<Collision>(collision_id);
+          if (collision == Collision::ANALYTIC && scene.spheres.empty()) {
+            LOG(WARNING) << "Skipping the analytic collision checker, since the scene has no spheres" << std::endl;
+            continue;
+          }
+
+          char label[128];
+          snprintf(label, sizeof(label), "maxiters=%d radius=%.1f planner=%s collision=%s",
+              maxiters, radius, PlannerName(planner), collision == Collision::ANALYTIC ? "analytic" : "mesh");
+
+          StatsTracker stats(std::string("rrt_benchmark [") + label + "]", 100);
+          for (int trial = 0; trial < p.num_trials; ++trial) {
+            const TrialResult r = (collision == Collision::ANALYTIC) ?
+                RunTrial(p, planner, analytic, analytic_batch, maxiters, radius) :
+                RunTrial(p, planner, mesh_checker.AsCollisionChecker(), mesh_checker.AsBatchCollisionChecker(), maxiters, radius);
+
+            stats.Histogram("Time/total_ms").Record(r.total_ms);
+            stats.Histogram("Throughput/iters_per_sec").Record(maxiters / std::max(1e-6, r.total_ms * 1e-3));
+            stats.Histogram("Memory/tree_kb").Record(r.tree_bytes / 1024.0);
+            stats.Increment("Trials/total");
+            if (r.solved) {
+              stats.Increment("Trials/solved");
+              stats.Histogram("Time/first_solution_ms").Record(r.first_solution_ms);
+              stats.Histogram("Iters/first_solution").Record(r.iters_to_first_solution);
+              stats.Histogram("Path/cost").Record(r.path_cost);
+            }
+          }
+          stats.SetGauge("Memory/max_rss_mb", MaxRssMb());
+
+          const StatsSnapshot s = stats.Snapshot();
+          snapshots.emplace_back(s);
+
+          const auto p50 = [&s](const std::string& name)
+          {
+            for (const HistogramSummary& h : s.histograms) {
+              if (h.name == name) { return h.p50; }
+            }
+            return std::nan("");
+          };
+          printf("%-64s %3ld/%-3d %-12.2f %-12.0f %-10.3f %-10.1f\n", label,
+              stats.Counter("Trials/solved").load(), p.num_trials, p50("Time/first_solution_ms"),
+              p50("Throughput/iters_per_sec"), p50("Path/cost"), p50("Memory/tree_kb"));
+        }
+      }
+    }
+  }
+
+  for (const StatsSnapshot& s : snapshots) {
+    PrintSnapshot(s);
+  }
+
+  if (!p.report_path.empty()) {
+    JsonStatsExporter exporter(p.report_path);
+    for (const StatsSnapshot& s : snapshots) {
+      exporter.Export(s);
+    }
+    LOG(INFO) << "Wrote benchmark report to: " << p.report_path << std::endl;
+  }
+
+  LOG(INFO) << "DONE" << std::endl;
+}
+
+
+int main(int argc, char const *argv[])
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  Run();
+
+  return 0;
+}
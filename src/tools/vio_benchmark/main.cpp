@@ -0,0 +1,661 @@
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "core/timer.hpp"
+#include "core/timestamp.hpp"
+#include "core/path_util.hpp"
+#include "core/stats_tracker.hpp"
+#include "core/stats_exporter.hpp"
+#include "dataset/dataset_util.hpp"
+#include "dataset/in_memory_dataset.hpp"
+#include "dataset/trajectory_evaluator.hpp"
+#include "vio/state_estimator.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Allows re-running without recompiling.
+struct VioBenchmarkParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(VioBenchmarkParams);
+  dataset::Dataset dataset = dataset::Dataset::FARMSIM;
+  std::string folder;
+  std::string subfolder;
+  bool use_stereo = true;
+  bool use_imu = true;
+  bool use_depth = true;
+  bool use_range = true;
+  float playback_speed = -1.0;
+  bool lockstep = false;              // Deterministic playback (see StateEstimator::Params::lockstep).
+  int prefetch_lookahead = 8;
+  int prefetch_threads = 2;
+  double groundtruth_max_dt = 0.05;
+  double rpe_delta_sec = 1.0;         // Length of the segments that relative pose error is over.
+  std::string report_path;
+
+  // The StateEstimator config to run (relative to the tools folder). Defaults to the one that
+  // vio_dataset_player uses, so that the numbers here reflect what we actually run.
+  std::string estimator_params_path = "vio_dataset_player/config/StateEstimator.yaml";
+
+  // Decode every stereo pair once before playback (see dataset::InMemoryDataset), and share them
+  // between all of the estimators, instead of each one reading the images again.
+  bool in_memory = false;
+  int decode_threads = 4;
+
+  // Only play back [window_start_sec, window_start_sec + window_duration_sec) of the dataset (from
+  // its first timestamp). A duration <= 0 goes to the end.
+  double window_start_sec = 0;
+  double window_duration_sec = 0;
+
+  // Split the window into this many equal slices, and run a separate StateEstimator on each one in
+  // parallel. Every slice is initialized at its first groundtruth pose.
+  int num_shards = 1;
+
+  // If isam2_sweep, the dataset is played back once for every combination of these smoother params.
+  bool isam2_sweep = false;
+  std::vector<double> sweep_relinearize_threshold;
+  std::vector<int> sweep_relinearize_skip;
+  std::vector<int> sweep_constrain_newest_keypose_last;
+
+  // If param_sweep, every config in sweep_configs (StateEstimator yamls, relative to the tools
+  // folder) is played back at the same time, from one copy of the dataset in memory. At most
+  // sweep_max_parallel configs run at once (0 runs all of them).
+  bool param_sweep = false;
+  std::vector<std::string> sweep_configs;
+  int sweep_max_parallel = 0;
+
+  // If float_comparison, the dataset is played back with the frontend odometry in double and then
+  // in float (see StereoFrontend::Params::float_odometry), and the difference is printed.
+  bool float_comparison = false;
+
+  // If parallel_comparison, the dataset is played back with a serial smoother, and then with parallel
+  // triangulation and parallel_tbb_threads for iSAM2 (see FixedLagSmoother::Params).
+  bool parallel_comparison = false;
+  int parallel_tbb_threads = 0;
+
+  // If incremental_comparison, the dataset is played back with smart factors that triangulate from
+  // scratch, and then incrementally (see FixedLagSmoother::Params::incremental_triangulation).
+  bool incremental_comparison = false;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    dataset = YamlToEnum<dataset::Dataset>(parser.GetNode("dataset"));
+    folder = YamlToString(parser.GetNode("folder"));
+    subfolder = YamlToString(parser.GetNode("subfolder"));
+    parser.GetParam("use_stereo", &use_stereo);
+    parser.GetParam("use_imu", &use_imu);
+    parser.GetParam("use_depth", &use_depth);
+    parser.GetParam("use_range", &use_range);
+    parser.GetParam("playback_speed", &playback_speed);
+    parser.GetParam("lockstep", &lockstep);
+    parser.GetParam("prefetch_lookahead", &prefetch_lookahead);
+    parser.GetParam("prefetch_threads", &prefetch_threads);
+    parser.GetParam("groundtruth_max_dt", &groundtruth_max_dt);
+    parser.GetParam("rpe_delta_sec", &rpe_delta_sec);
+    report_path = YamlToString(parser.GetNode("report_path"));
+    estimator_params_path = YamlToString(parser.GetNode("estimator_params_path"));
+    parser.GetParam("in_memory", &in_memory);
+    parser.GetParam("decode_threads", &decode_threads);
+    parser.GetParam("window_start_sec", &window_start_sec);
+    parser.GetParam("window_duration_sec", &window_duration_sec);
+    parser.GetParam("num_shards", &num_shards);
+    parser.GetParam("isam2_sweep", &isam2_sweep);
+    YamlToList(parser.GetNode("sweep_relinearize_threshold"), sweep_relinearize_threshold);
+    YamlToList(parser.GetNode("sweep_relinearize_skip"), sweep_relinearize_skip);
+    YamlToList(parser.GetNode("sweep_constrain_newest_keypose_last"), sweep_constrain_newest_keypose_last);
+    parser.GetParam("param_sweep", &param_sweep);
+    sweep_configs = YamlToStringList(parser.GetNode("sweep_configs"));
+    parser.GetParam("sweep_max_parallel", &sweep_max_parallel);
+    parser.GetParam("float_comparison", &float_comparison);
+    parser.GetParam("parallel_comparison", &parallel_comparison);
+    parser.GetParam("parallel_tbb_threads", &parallel_tbb_threads);
+    parser.GetParam("incremental_comparison", &incremental_comparison);
+  }
+
+  template <typename T>
+  static void YamlToList(const cv::FileNode& node, std::vector<T>& out)
+  {
+    CHECK(node.isSeq()) << "Expected a YAML list" << std::endl;
+    out.clear();
+    for (size_t i = 0; i < node.size(); ++i) {
+      out.emplace_back(static_cast<T>(node[i]));
+    }
+  }
+};
+
+
+// Measures the wall time between a measurement going into the estimator and an estimate with the
+// same timestamp coming out. Measurements that never get an estimate (e.g non-keyframes, dropped
+// frames) are forgotten once a newer estimate arrives.
+class LatencyTracker final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(LatencyTracker)
+
+  // NOTE(milo): Timestamps go through seconds_t inside the estimator, so they only match to within
+  // a few hundred ns. Anything within "tolerance_sec" is considered the same measurement.
+  LatencyTracker(LatencyHistogram& histogram_ms, seconds_t tolerance_sec = 1e-4)
+      : histogram_ms_(histogram_ms), tolerance_ns_(ConvertToNanoseconds(tolerance_sec)) {}
+
+  void Start(timestamp_t timestamp)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.emplace(timestamp, Timer(true));
+  }
+
+  void Stop(seconds_t timestamp)
+  {
+    const timestamp_t t = ConvertToNanoseconds(timestamp);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_.lower_bound(t > tolerance_ns_ ? t - tolerance_ns_ : 0);
+    if (it != pending_.end() && it->first <= (t + tolerance_ns_)) {
+      histogram_ms_.Record(it->second.Elapsed().milliseconds());
+      ++it;
+    }
+    pending_.erase(pending_.begin(), it);
+  }
+
+ private:
+  LatencyHistogram& histogram_ms_;
+  timestamp_t tolerance_ns_;
+  std::mutex mutex_;
+  std::map<timestamp_t, Timer> pending_;
+};
+
+
+static void PrintSnapshot(const StatsSnapshot& s)
+{
+  printf("\n========================== %s ==========================\n", s.tracker_name.c_str());
+  for (const HistogramSummary& h : s.histograms) {
+    printf("%-36s N=%-8lu MEAN=%-10.3f P50=%-10.3f P90=%-10.3f P99=%-10.3f MAX=%-10.3f\n",
+        h.name.c_str(), h.count, h.mean, h.p50, h.p90, h.p99, h.max);
+  }
+  for (const auto& c : s.counters) {
+    printf("%-36s %ld\n", c.first.c_str(), c.second);
+  }
+  for (const auto& g : s.gauges) {
+    printf("%-36s %f\n", g.first.c_str(), g.second);
+  }
+}
+
+
+typedef std::function<void(StateEstimator::Params&)> ConfigureFunction;
+
+
+static void SetTrajectoryGauges(StatsTracker& stats, const std::string& prefix, const dataset::TrajectoryError& e)
+{
+  stats.Counter(prefix + "/num_matched") = e.num_matched;
+  stats.Counter(prefix + "/num_unmatched") = e.num_unmatched;
+  stats.SetGauge(prefix + "/ate_rmse_m", e.ate_rmse_m);
+  stats.SetGauge(prefix + "/ate_p50_m", e.ate_p50_m);
+  stats.SetGauge(prefix + "/ate_p99_m", e.ate_p99_m);
+  stats.SetGauge(prefix + "/ate_max_m", e.ate_max_m);
+  stats.SetGauge(prefix + "/final_m", e.ate_final_m);
+  stats.SetGauge(prefix + "/ate_rot_rmse_deg", e.ate_rot_rmse_deg);
+  stats.Counter(prefix + "/num_rpe") = e.num_rpe;
+  stats.SetGauge(prefix + "/rpe_trans_rmse_m", e.rpe_trans_rmse_m);
+  stats.SetGauge(prefix + "/rpe_rot_rmse_deg", e.rpe_rot_rmse_deg);
+}
+
+
+// Loads the dataset once, and slices the benchmark window into app_params.num_shards pieces. If
+// app_params.in_memory, the window is decoded up front, and every shard shares the same images.
+static std::vector<dataset::DataProvider> LoadShards(const VioBenchmarkParams& app_params,
+                                                     std::string& shared_params_path)
+{
+  CHECK_GT(app_params.num_shards, 0) << "Need at least one shard" << std::endl;
+
+  dataset::DataProvider dataset = dataset::GetDatasetByName(
+      app_params.dataset, app_params.folder, app_params.subfolder, shared_params_path);
+  dataset.SetStereoPrefetch(app_params.prefetch_lookahead, app_params.prefetch_threads);
+
+  const timestamp_t t_first = dataset.FirstTimestamp();
+  const timestamp_t t_end = dataset.LastTimestamp() + 1;
+  const timestamp_t t0 = std::min(t_end, t_first + ConvertToNanoseconds(app_params.window_start_sec));
+  const timestamp_t t1 = (app_params.window_duration_sec > 0) ?
+      std::min(t_end, t0 + ConvertToNanoseconds(app_params.window_duration_sec)) : t_end;
+
+  // NOTE(milo): Only decode the window, since everything in it stays in memory.
+  if (app_params.in_memory) {
+    dataset = dataset::InMemoryDataset(dataset.Slice(t0, t1), false, app_params.decode_threads);
+  }
+
+  std::vector<dataset::DataProvider> shards;
+  const timestamp_t shard_ns = (t1 - t0) / app_params.num_shards;
+  for (int i = 0; i < app_params.num_shards; ++i) {
+    const timestamp_t shard_t0 = t0 + i * shard_ns;
+    const timestamp_t shard_t1 = (i + 1 == app_params.num_shards) ? t1 : (shard_t0 + shard_ns);
+    shards.emplace_back(dataset.Slice(shard_t0, shard_t1));
+    CHECK(!shards.back().GroundtruthPoses().empty()) << "No groundtruth poses in shard " << i << std::endl;
+  }
+
+  return shards;
+}
+
+
+// Plays a dataset (or a slice of one) through a StateEstimator once, and returns the estimator and
+// benchmark stats. "configure" can override any of the estimator params before it's constructed.
+static void RunOnce(const VioBenchmarkParams& app_params,
+                    const dataset::DataProvider& source,
+                    const std::string& shared_params_path,
+                    const ConfigureFunction& configure,
+                    StatsSnapshot& estimator_snapshot,
+                    StatsSnapshot& bench_snapshot)
+{
+  // NOTE(milo): Copy, so that several estimators can play back the same slice at once.
+  dataset::DataProvider dataset = source;
+
+  const std::vector<dataset::GroundtruthItem>& groundtruth_poses = dataset.GroundtruthPoses();
+  CHECK(!groundtruth_poses.empty()) << "No groundtruth poses found" << std::endl;
+
+  StateEstimator::Params params(tools_path(app_params.estimator_params_path), shared_params_path);
+  params.show_feature_tracks = false;
+  params.lockstep = app_params.lockstep;
+  if (configure) {
+    configure(params);
+  }
+  StateEstimator state_estimator(params);
+
+  StatsTracker bench_stats("vio_benchmark", 100);
+  LatencyTracker stereo_latency(bench_stats.Histogram("Latency/stereo_to_smoother_ms"));
+  LatencyTracker imu_latency(bench_stats.Histogram("Latency/imu_to_filter_ms"));
+  std::atomic<int64_t>& num_stereo = bench_stats.Counter("Received/stereo");
+  std::atomic<int64_t>& num_imu = bench_stats.Counter("Received/imu");
+  std::atomic<int64_t>& num_smoother_results = bench_stats.Counter("Results/smoother");
+  std::atomic<int64_t>& num_filter_results = bench_stats.Counter("Results/filter");
+
+  // Score the smoother and the filter as their results come in, so the trajectory isn't stored.
+  dataset::TrajectoryEvaluator smoother_error(groundtruth_poses, app_params.groundtruth_max_dt, app_params.rpe_delta_sec);
+  dataset::TrajectoryEvaluator filter_error(groundtruth_poses, app_params.groundtruth_max_dt, app_params.rpe_delta_sec);
+
+  state_estimator.RegisterSmootherResultCallback([&](const SmootherResult& result)
+  {
+    stereo_latency.Stop(result.timestamp);
+    ++num_smoother_results;
+    smoother_error.AddPose(result.timestamp, result.world_P_body.matrix());
+  });
+
+  state_estimator.RegisterFilterResultCallback([&](const StateStamped& ss)
+  {
+    imu_latency.Stop(ss.timestamp);
+    ++num_filter_results;
+    Matrix4d world_T_body = Matrix4d::Identity();
+    world_T_body.block<3, 3>(0, 0) = ss.state.q.normalized().toRotationMatrix();
+    world_T_body.block<3, 1>(0, 3) = ss.state.t;
+    filter_error.AddPose(ss.timestamp, world_T_body);
+  });
+
+  dataset::StereoCallback1b stereo_cb = [&](const StereoImage1b& stereo_pair)
+  {
+    ++num_stereo;
+    stereo_latency.Start(stereo_pair.timestamp);
+    state_estimator.ReceiveStereo(stereo_pair);
+  };
+
+  dataset::ImuCallback imu_cb = [&](const ImuMeasurement& imu_data)
+  {
+    ++num_imu;
+    imu_latency.Start(imu_data.timestamp);
+    state_estimator.ReceiveImu(imu_data);
+  };
+
+  if (app_params.use_stereo)
+    dataset.RegisterStereoCallback(stereo_cb);
+  if (app_params.use_imu)
+    dataset.RegisterImuCallback(imu_cb);
+  if (app_params.use_depth)
+    dataset.RegisterDepthCallback(std::bind(&StateEstimator::ReceiveDepth, &state_estimator, std::placeholders::_1));
+  if (app_params.use_range)
+    dataset.RegisterRangeCallback(std::bind(&StateEstimator::ReceiveRange, &state_estimator, std::placeholders::_1));
+
+  gtsam::Pose3 P0_world_body(dataset.InitialPose());
+  state_estimator.Initialize(ConvertToSeconds(dataset.FirstTimestamp()), P0_world_body);
+
+  Timer wall_timer(true);
+  // NOTE(milo): In lockstep, every measurement already waits for the estimator, so there's no point
+  // in sleeping between them too.
+  dataset.Playback(app_params.lockstep ? -1.0f : app_params.playback_speed, false);
+  state_estimator.BlockUntilFinished();
+  const double wall_sec = wall_timer.Elapsed().seconds();
+  state_estimator.Shutdown();
+
+  //================================== TRAJECTORY ERROR ============================================
+  // The estimator is initialized at the first groundtruth pose, so no alignment is needed.
+  SetTrajectoryGauges(bench_stats, "TrajectoryError", smoother_error.Error());
+  SetTrajectoryGauges(bench_stats, "FilterError", filter_error.Error());
+
+  const double dataset_sec = ConvertToSeconds(groundtruth_poses.back().timestamp) -
+                             ConvertToSeconds(groundtruth_poses.front().timestamp);
+  bench_stats.SetGauge("Throughput/wall_sec", wall_sec);
+  bench_stats.SetGauge("Throughput/dataset_sec", dataset_sec);
+  bench_stats.SetGauge("Throughput/realtime_factor", dataset_sec / std::max(1e-3, wall_sec));
+  bench_stats.SetGauge("Throughput/stereo_per_sec", num_stereo / std::max(1e-3, wall_sec));
+
+  estimator_snapshot = state_estimator.GetStats();
+  bench_snapshot = bench_stats.Snapshot();
+}
+
+
+// Runs every shard in parallel (each with its own StateEstimator), and appends their stats in shard
+// order. With more than one shard, the shard is added to each tracker_name.
+static void RunShards(const VioBenchmarkParams& app_params,
+                      const std::vector<dataset::DataProvider>& shards,
+                      const std::string& shared_params_path,
+                      const ConfigureFunction& configure,
+                      std::vector<StatsSnapshot>& estimator_snapshots,
+                      std::vector<StatsSnapshot>& bench_snapshots)
+{
+  std::vector<StatsSnapshot> shard_estimator(shards.size());
+  std::vector<StatsSnapshot> shard_bench(shards.size());
+
+  std::vector<std::future<void>> futures;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    futures.emplace_back(std::async(std::launch::async, RunOnce,
+        std::cref(app_params), std::cref(shards.at(i)), std::cref(shared_params_path), std::cref(configure),
+        std::ref(shard_estimator.at(i)), std::ref(shard_bench.at(i))));
+  }
+
+  for (size_t i = 0; i < shards.size(); ++i) {
+    futures.at(i).get();
+    if (shards.size() > 1) {
+      const std::string label = " [shard " + std::to_string(i + 1) + "/" + std::to_string(shards.size()) + "]";
+      shard_estimator.at(i).tracker_name += label;
+      shard_bench.at(i).tracker_name += label;
+    }
+    estimator_snapshots.emplace_back(shard_estimator.at(i));
+    bench_snapshots.emplace_back(shard_bench.at(i));
+  }
+}
+
+
+static void ExportReport(const std::string& report_path, const std::vector<StatsSnapshot>& snapshots)
+{
+  if (report_path.empty()) {
+    return;
+  }
+  JsonStatsExporter exporter(report_path);
+  for (const StatsSnapshot& s : snapshots) {
+    exporter.Export(s);
+  }
+  LOG(INFO) << "Wrote benchmark report to: " << report_path << std::endl;
+}
+
+
+static const HistogramSummary* FindHistogram(const StatsSnapshot& s, const std::string& name)
+{
+  for (const HistogramSummary& h : s.histograms) {
+    if (h.name == name) { return &h; }
+  }
+  return nullptr;
+}
+
+
+static double FindGauge(const StatsSnapshot& s, const std::string& name)
+{
+  for (const auto& g : s.gauges) {
+    if (g.first == name) { return g.second; }
+  }
+  return 0;
+}
+
+
+// Runs the dataset for every combination of iSAM2 params, and prints the smoother update time for
+// each one (and each shard). Every run is also exported, with the params in tracker_name.
+static void RunIsam2Sweep(const VioBenchmarkParams& app_params)
+{
+  CHECK(!app_params.sweep_relinearize_threshold.empty() &&
+        !app_params.sweep_relinearize_skip.empty() &&
+        !app_params.sweep_constrain_newest_keypose_last.empty()) << "Sweep lists can't be empty" << std::endl;
+
+  std::string shared_params_path;
+  const std::vector<dataset::DataProvider> shards = LoadShards(app_params, shared_params_path);
+
+  std::vector<std::string> labels;
+  std::vector<StatsSnapshot> estimator_snapshots;
+  std::vector<StatsSnapshot> bench_snapshots;
+
+  for (const double threshold : app_params.sweep_relinearize_threshold) {
+    for (const int skip : app_params.sweep_relinearize_skip) {
+      for (const int newest_last : app_params.sweep_constrain_newest_keypose_last) {
+        char label[128];
+        snprintf(label, sizeof(label), "thresh=%.3f skip=%d newest_last=%d", threshold, skip, newest_last);
+        LOG(INFO) << "iSAM2 sweep: " << label << std::endl;
+
+        const size_t first = estimator_snapshots.size();
+        RunShards(app_params, shards, shared_params_path, [=](StateEstimator::Params& params)
+        {
+          params.smoother_params.relinearize_threshold = threshold;
+          params.smoother_params.relinearize_skip = skip;
+          params.smoother_params.constrain_newest_keypose_last = newest_last;
+        }, estimator_snapshots, bench_snapshots);
+
+        for (size_t i = first; i < estimator_snapshots.size(); ++i) {
+          const std::string shard = (shards.size() > 1) ? (" shard=" + std::to_string(i - first + 1)) : "";
+          estimator_snapshots.at(i).tracker_name += std::string(" [") + label + "]";
+          bench_snapshots.at(i).tracker_name += std::string(" [") + label + "]";
+          labels.emplace_back(label + shard);
+        }
+      }
+    }
+  }
+
+  printf("\n=============================== iSAM2 SWEEP (SmootherUpdateWithVision ms) ===============================\n");
+  for (size_t i = 0; i < labels.size(); ++i) {
+    const HistogramSummary* h = FindHistogram(estimator_snapshots.at(i), "SmootherUpdateWithVision");
+    const double ate = FindGauge(bench_snapshots.at(i), "TrajectoryError/ate_rmse_m");
+    const double rpe = FindGauge(bench_snapshots.at(i), "TrajectoryError/rpe_trans_rmse_m");
+    if (h == nullptr) {
+      printf("%-54s (no smoother updates with vision)\n", labels.at(i).c_str());
+      continue;
+    }
+    printf("%-54s N=%-6lu P50=%-9.3f P99=%-9.3f MAX=%-9.3f ATE=%.3f m RPE=%.3f m\n",
+        labels.at(i).c_str(), h->count, h->p50, h->p99, h->max, ate, rpe);
+  }
+
+  std::vector<StatsSnapshot> snapshots = estimator_snapshots;
+  snapshots.insert(snapshots.end(), bench_snapshots.begin(), bench_snapshots.end());
+  ExportReport(app_params.report_path, snapshots);
+}
+
+
+// Runs the dataset once with "configure_a" and once with "configure_b", and prints the accuracy
+// and the "timing" histogram (p50/p99) of each one, with the difference and speedup of b over a.
+// Both runs are exported, with the label in tracker_name.
+static void RunComparison(const VioBenchmarkParams& app_params,
+                          const std::string& title,
+                          const std::string& timing,
+                          const std::string& label_a,
+                          const ConfigureFunction& configure_a,
+                          const std::string& label_b,
+                          const ConfigureFunction& configure_b)
+{
+  std::string shared_params_path;
+  const std::vector<dataset::DataProvider> shards = LoadShards(app_params, shared_params_path);
+
+  std::vector<StatsSnapshot> estimator_snapshots[2];
+  std::vector<StatsSnapshot> bench_snapshots[2];
+  const std::string labels[2] = { label_a, label_b };
+  const ConfigureFunction configure[2] = { configure_a, configure_b };
+
+  for (int i = 0; i < 2; ++i) {
+    LOG(INFO) << title << ": " << labels[i] << std::endl;
+    RunShards(app_params, shards, shared_params_path, configure[i], estimator_snapshots[i], bench_snapshots[i]);
+
+    for (size_t s = 0; s < estimator_snapshots[i].size(); ++s) {
+      estimator_snapshots[i].at(s).tracker_name += " [" + labels[i] + "]";
+      bench_snapshots[i].at(s).tracker_name += " [" + labels[i] + "]";
+    }
+  }
+
+  printf("\n=============================== %s (%s ms) ===============================\n", title.c_str(), timing.c_str());
+  for (size_t s = 0; s < shards.size(); ++s) {
+    double ate[2], rpe[2], p50[2], p99[2];
+    for (int i = 0; i < 2; ++i) {
+      const HistogramSummary* h = FindHistogram(estimator_snapshots[i].at(s), timing);
+      ate[i] = FindGauge(bench_snapshots[i].at(s), "TrajectoryError/ate_rmse_m");
+      rpe[i] = FindGauge(bench_snapshots[i].at(s), "TrajectoryError/rpe_trans_rmse_m");
+      p50[i] = (h != nullptr) ? h->p50 : 0;
+      p99[i] = (h != nullptr) ? h->p99 : 0;
+      printf("shard=%-3lu %-10s ATE=%-9.4f m RPE=%-9.4f m P50=%-9.3f P99=%-9.3f\n",
+          s + 1, labels[i].c_str(), ate[i], rpe[i], p50[i], p99[i]);
+    }
+    printf("shard=%-3lu %-10s ATE=%+-9.4f m RPE=%+-9.4f m P50=%+-9.3f P99=%+-9.3f SPEEDUP=%.2fx\n",
+        s + 1, "delta", ate[1] - ate[0], rpe[1] - rpe[0], p50[1] - p50[0], p99[1] - p99[0],
+        p50[0] / std::max(1e-6, p50[1]));
+  }
+
+  std::vector<StatsSnapshot> snapshots;
+  for (int i = 0; i < 2; ++i) {
+    snapshots.insert(snapshots.end(), estimator_snapshots[i].begin(), estimator_snapshots[i].end());
+    snapshots.insert(snapshots.end(), bench_snapshots[i].begin(), bench_snapshots[i].end());
+  }
+  ExportReport(app_params.report_path, snapshots);
+}
+
+
+// Plays back every config in app_params.sweep_configs at the same time (sweep_max_parallel at once),
+// with its own StateEstimator on every shard, from one decoded copy of the dataset. Prints the
+// accuracy and the frontend/smoother time of each config, and exports all of them with the config
+// in tracker_name.
+static void RunParamSweep(const VioBenchmarkParams& app_params)
+{
+  CHECK(!app_params.sweep_configs.empty()) << "No configs to sweep" << std::endl;
+
+  // NOTE(milo): The runs compete for cores, so only lockstep playback (nothing is dropped when an
+  // estimator falls behind) gives each config the same trajectory that it would get on its own.
+  // Timings are measured under the shared load though, so only compare them within a sweep.
+  VioBenchmarkParams sweep_params = app_params;
+  sweep_params.lockstep = true;
+  sweep_params.in_memory = true;
+
+  std::string shared_params_path;
+  const std::vector<dataset::DataProvider> shards = LoadShards(sweep_params, shared_params_path);
+
+  const size_t num_configs = app_params.sweep_configs.size();
+  const size_t max_parallel = (app_params.sweep_max_parallel > 0) ?
+      std::min(num_configs, static_cast<size_t>(app_params.sweep_max_parallel)) : num_configs;
+
+  std::vector<VioBenchmarkParams> config_params(num_configs, sweep_params);
+  for (size_t k = 0; k < num_configs; ++k) {
+    config_params.at(k).estimator_params_path = app_params.sweep_configs.at(k);
+  }
+
+  std::vector<std::vector<StatsSnapshot>> estimator_snapshots(num_configs);
+  std::vector<std::vector<StatsSnapshot>> bench_snapshots(num_configs);
+  const ConfigureFunction no_configure;
+
+  Timer wall_timer(true);
+  for (size_t first = 0; first < num_configs; first += max_parallel) {
+    const size_t last = std::min(num_configs, first + max_parallel);
+    std::vector<std::future<void>> futures;
+    for (size_t k = first; k < last; ++k) {
+      LOG(INFO) << "Param sweep: " << config_params.at(k).estimator_params_path << std::endl;
+      futures.emplace_back(std::async(std::launch::async, RunShards,
+          std::cref(config_params.at(k)), std::cref(shards), std::cref(shared_params_path), std::cref(no_configure),
+          std::ref(estimator_snapshots.at(k)), std::ref(bench_snapshots.at(k))));
+    }
+    for (std::future<void>& f : futures) {
+      f.get();
+    }
+  }
+  LOG(INFO) << "Param sweep took " << wall_timer.Elapsed().seconds() << " sec" << std::endl;
+
+  printf("\n=============================== PARAM SWEEP (ms) ===============================\n");
+  std::vector<StatsSnapshot> snapshots;
+  for (size_t k = 0; k < num_configs; ++k) {
+    const std::string& config = app_params.sweep_configs.at(k);
+    for (size_t s = 0; s < estimator_snapshots.at(k).size(); ++s) {
+      StatsSnapshot& estimator = estimator_snapshots.at(k).at(s);
+      StatsSnapshot& bench = bench_snapshots.at(k).at(s);
+
+      const HistogramSummary* frontend = FindHistogram(estimator, "StereoFrontendTrack");
+      const HistogramSummary* smoother = FindHistogram(estimator, "SmootherUpdateWithVision");
+      const std::string shard = (shards.size() > 1) ? (" shard=" + std::to_string(s + 1)) : "";
+      printf("%-54s ATE=%-8.4f m RPE=%-8.4f m FRONTEND P50=%-8.3f P99=%-8.3f SMOOTHER P50=%-8.3f P99=%-8.3f RTF=%.2f\n",
+          (config + shard).c_str(),
+          FindGauge(bench, "TrajectoryError/ate_rmse_m"),
+          FindGauge(bench, "TrajectoryError/rpe_trans_rmse_m"),
+          (frontend != nullptr) ? frontend->p50 : 0, (frontend != nullptr) ? frontend->p99 : 0,
+          (smoother != nullptr) ? smoother->p50 : 0, (smoother != nullptr) ? smoother->p99 : 0,
+          FindGauge(bench, "Throughput/realtime_factor"));
+
+      estimator.tracker_name += " [" + config + "]";
+      bench.tracker_name += " [" + config + "]";
+      snapshots.emplace_back(estimator);
+      snapshots.emplace_back(bench);
+    }
+  }
+
+  ExportReport(app_params.report_path, snapshots);
+}
+
+
+void Run()
+{
+  VioBenchmarkParams app_params(tools_path("vio_benchmark/config/VioBenchmark.yaml"));
+
+  if (app_params.param_sweep) {
+    RunParamSweep(app_params);
+  } else if (app_params.isam2_sweep) {
+    RunIsam2Sweep(app_params);
+  } else if (app_params.float_comparison) {
+    RunComparison(app_params, "FLOAT vs DOUBLE ODOMETRY", "StereoFrontendTrack",
+        "double", [](StateEstimator::Params& params) { params.stereo_frontend_params.float_odometry = false; },
+        "float", [](StateEstimator::Params& params) { params.stereo_frontend_params.float_odometry = true; });
+  } else if (app_params.parallel_comparison) {
+    // NOTE(milo): The serial run uses a single TBB thread, so this also measures GTSAM's own
+    // parallelism if the build has BM_ENABLE_TBB (otherwise only the triangulation differs).
+    const int tbb_threads = app_params.parallel_tbb_threads;
+    RunComparison(app_params, "SERIAL vs PARALLEL SMOOTHER", "SmootherUpdateWithVision",
+        "serial", [](StateEstimator::Params& params)
+        {
+          params.smoother_params.parallel_triangulation = false;
+          params.smoother_params.tbb_threads = 1;
+        },
+        "parallel", [tbb_threads](StateEstimator::Params& params)
+        {
+          params.smoother_params.parallel_triangulation = true;
+          params.smoother_params.tbb_threads = tbb_threads;
+        });
+  } else if (app_params.incremental_comparison) {
+    RunComparison(app_params, "FULL vs INCREMENTAL TRIANGULATION", "SmootherUpdateWithVision",
+        "full", [](StateEstimator::Params& params) { params.smoother_params.incremental_triangulation = false; },
+        "incremental", [](StateEstimator::Params& params) { params.smoother_params.incremental_triangulation = true; });
+  } else {
+    std::string shared_params_path;
+    const std::vector<dataset::DataProvider> shards = LoadShards(app_params, shared_params_path);
+
+    std::vector<StatsSnapshot> snapshots;
+    std::vector<StatsSnapshot> bench_snapshots;
+    RunShards(app_params, shards, shared_params_path, nullptr, snapshots, bench_snapshots);
+
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+      PrintSnapshot(snapshots.at(i));
+      PrintSnapshot(bench_snapshots.at(i));
+    }
+    snapshots.insert(snapshots.end(), bench_snapshots.begin(), bench_snapshots.end());
+    ExportReport(app_params.report_path, snapshots);
+  }
+
+  LOG(INFO) << "DONE" << std::endl;
+}
+
+
+int main(int argc, char const *argv[])
+{
+  Run();
+  return 0;
+}
@@ -16,10 +16,12 @@
 #include "core/uid.hpp"
 #include "core/file_utils.hpp"
 #include "core/path_util.hpp"
+#include "core/publish_scheduler.hpp"
 #include "dataset/dataset_util.hpp"
 #include "vio/state_estimator.hpp"
 #include "vio/visualizer_3d.hpp"
 #include "lcm_util/util_pose3_t.hpp"
+#include "lcm_util/scheduled_lcm_publisher.hpp"
 #include "feature_tracking/visualization_2d.hpp"
 
 #include "vehicle/pose3_stamped_t.hpp"
@@ -43,6 +45,8 @@ struct VioDatasetPlayerParams : public ParamsBase
   bool pause = false;
   bool visualize = true;
   float playback_speed = 4.0;
+  int prefetch_lookahead = 8;
+  int prefetch_threads = 2;
   float filter_publish_hz = 50.0;
 
  private:
@@ -58,6 +62,9 @@ struct VioDatasetPlayerParams : public ParamsBase
     parser.GetParam("pause", &pause);
     parser.GetParam("visualize", &visualize);
     parser.GetParam("playback_speed", &playback_speed);
+    parser.GetParam("prefetch_lookahead", &prefetch_lookahead);
+    parser.GetParam("prefetch_threads", &prefetch_threads);
+    parser.GetParam("filter_publish_hz", &filter_publish_hz);
   }
 };
 
@@ -76,6 +83,7 @@ void Run()
   std::string shared_params_path;
   dataset::DataProvider dataset = dataset::GetDatasetByName(
       app_params.dataset, app_params.folder, app_params.subfolder, shared_params_path);
+  dataset.SetStereoPrefetch(app_params.prefetch_lookahead, app_params.prefetch_threads);
 
   const std::vector<dataset::GroundtruthItem>& groundtruth_poses = dataset.GroundtruthPoses();
   CHECK(!groundtruth_poses.empty()) << "No groundtruth poses found" << std::endl;
@@ -90,6 +98,14 @@ void Run()
       shared_params_path);
   Visualizer3D viz(viz_params);
 
+  // Poses are published off of the estimator's threads, and only the newest one goes out.
+  PublishScheduler scheduler(PublishScheduler::Params{});
+  ScheduledLcmPublisher<vehicle::pose3_stamped_t> smoother_pose_pub(
+      lcm, "vio/smoother/world_P_body", scheduler, PublishPriority::CRITICAL, 0);
+  ScheduledLcmPublisher<vehicle::pose3_stamped_t> filter_pose_pub(
+      lcm, "vio/filter/world_P_body", scheduler, PublishPriority::CRITICAL, app_params.filter_publish_hz);
+  scheduler.Start();
+
   SmootherResult::Callback smoother_callback = [&](const SmootherResult& result)
   {
     const core::uid_t cam_id = static_cast<core::uid_t>(result.keypose_id);
@@ -99,20 +115,29 @@ void Run()
     viz.AddCameraPose(cam_id, Image1b(), result.world_P_body.matrix(), true, std::make_shared<Matrix3d>(world_cov_pose));
 
     // Publish pose estimate to LCM.
-    vehicle::pose3_stamped_t msg;
-    msg.header.timestamp = ConvertToNanoseconds(result.timestamp);
-    msg.header.seq = -1;
-    msg.header.frame_id = "imu0";
-    pack_pose3_t(result.world_P_body, msg.pose);
-
-    lcm.publish("vio/smoother/world_P_body", &msg);
+    smoother_pose_pub.Update([&](vehicle::pose3_stamped_t& msg)
+    {
+      msg.header.timestamp = ConvertToNanoseconds(result.timestamp);
+      msg.header.seq = -1;
+      msg.header.frame_id = "imu0";
+      pack_pose3_t(result.world_P_body, msg.pose);
+    });
   };
 
-  Timer filter_publish_timer(true);
+  Timer viz_update_timer(true);
   StateStamped::Callback filter_callback = [&](const StateStamped& ss)
   {
-    // Limit the publishing rate to avoid overwhelming consumers.
-    if (filter_publish_timer.Elapsed().seconds() < (1.0 / app_params.filter_publish_hz)) {
+    // Publish pose estimate to LCM (the scheduler limits the rate to filter_publish_hz).
+    filter_pose_pub.Update([&](vehicle::pose3_stamped_t& msg)
+    {
+      msg.header.timestamp = ConvertToNanoseconds(ss.timestamp);
+      msg.header.seq = -1;
+      msg.header.frame_id = "imu0";
+      pack_pose3_t(ss.state.q, ss.state.t, msg.pose);
+    });
+
+    // Limit the visualizer's update rate too.
+    if (viz_update_timer.Elapsed().seconds() < (1.0 / app_params.filter_publish_hz)) {
       return;
     }
 
@@ -120,16 +145,15 @@ void Run()
     world_T_body.block<3, 3>(0, 0) = ss.state.q.toRotationMatrix();
     world_T_body.block<3, 1>(0, 3) = ss.state.t;
     viz.UpdateBodyPose("imu0", world_T_body);
+    viz_update_timer.Reset();
+  };
 
-    // Publish pose estimate to LCM.
-    vehicle::pose3_stamped_t msg;
-    msg.header.timestamp = ConvertToNanoseconds(ss.timestamp);
-    msg.header.seq = -1;
-    msg.header.frame_id = "imu0";
-    pack_pose3_t(ss.state.q, ss.state.t, msg.pose);
-
-    lcm.publish("vio/filter/world_P_body", &msg);
-    filter_publish_timer.Reset();
+  // Batch re-optimization corrects keyposes that already left the smoother's window.
+  BatchResult::Callback batch_callback = [&](const BatchResult& result)
+  {
+    for (const auto& it : result.world_P_body) {
+      viz.UpdateCameraPose(it.first, it.second.matrix());
+    }
   };
 
   for (size_t i = 0; i < groundtruth_poses.size(); ++i) {
@@ -138,9 +162,10 @@ void Run()
 
   state_estimator.RegisterSmootherResultCallback(smoother_callback);
   state_estimator.RegisterFilterResultCallback(filter_callback);
+  state_estimator.RegisterBatchResultCallback(batch_callback);
 
   if (app_params.use_stereo)
-    dataset.RegisterStereoCallback(std::bind(&StateEstimator::ReceiveStereo, &state_estimator, std::placeholders::_1));
+    dataset.RegisterStereoCallback([&](const StereoImage1b& stereo_pair) { state_estimator.ReceiveStereo(stereo_pair); });
   if (app_params.use_imu)
     dataset.RegisterImuCallback(std::bind(&StateEstimator::ReceiveImu, &state_estimator, std::placeholders::_1));
   if (app_params.use_depth)
@@ -162,6 +187,7 @@ void Run()
 
   state_estimator.BlockUntilFinished();
   state_estimator.Shutdown();
+  scheduler.Stop();
 
   LOG(INFO) << "DONE" << std::endl;
 }
@@ -16,8 +16,30 @@ int main(int argc, char const *argv[])
   const char* path = std::getenv("BM_DATASETS_DIR");
   CHECK(path != nullptr) << "No environment variable $BM_DATASETS_DIR. Did you source setup.bash?" << std::endl;
 
+  // Pass --binary to record a binary log instead of a EuRoC folder, or --video <h264|h265|ffv1> to
+  // record a video log. Pass --hd720 to record 720p at 60 Hz instead of VGA at 30 Hz.
+  RecordFormat format = RecordFormat::EUROC;
+  dataset::video_log::VideoCodec video_codec = dataset::video_log::VideoCodec::H264;
+  bool hd720 = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg == "--binary") {
+      format = RecordFormat::BINARY_LOG;
+    } else if (arg == "--video") {
+      CHECK(i + 1 < argc) << "--video needs a codec (h264, h265 or ffv1)" << std::endl;
+      format = RecordFormat::VIDEO_LOG;
+      video_codec = dataset::video_log::CodecFromString(argv[++i]);
+    } else if (arg == "--hd720") {
+      hd720 = true;
+    } else {
+      LOG(FATAL) << "Unknown argument: " << arg << std::endl;
+    }
+  }
+
   const std::string datasets_path(core::Join(path, "zed_dataset"));
-  ZedRecorder zr(datasets_path);
+  ZedRecorder zr(datasets_path, core::ThreadConfig(), format,
+                 hd720 ? sl::RESOLUTION::HD720 : sl::RESOLUTION::VGA,
+                 hd720 ? 60 : 30, video_codec);
   zr.Run(true);
   return 0;
 }
@@ -5,7 +5,10 @@
 #include "core/depth_measurement.hpp"
 #include "vision_core/stereo_image.hpp"
 #include "core/math_util.hpp"
-#include "dataset/euroc_data_writer.hpp"
+#include "core/timer.hpp"
+#include "dataset/async_euroc_data_writer.hpp"
+#include "dataset/binary_log.hpp"
+#include "dataset/video_log.hpp"
 
 namespace bm {
 namespace zed {
@@ -61,11 +64,36 @@ void printSensorConfiguration(sl::SensorParameters& sp)
 }
 
 
-ZedRecorder::ZedRecorder(const std::string& output_folder)
-  : output_folder_(output_folder), shutdown_(false)
+ZedRecorder::ZedRecorder(const std::string& output_folder,
+                         const core::ThreadConfig& thread_config,
+                         RecordFormat format,
+                         sl::RESOLUTION resolution,
+                         int camera_fps,
+                         dataset::video_log::VideoCodec video_codec)
+  : thread_config_(thread_config),
+    output_folder_(output_folder),
+    format_(format),
+    resolution_(resolution),
+    camera_fps_(camera_fps),
+    video_codec_(video_codec),
+    shutdown_(false),
+    cam_sampler_(camera_fps)
 {
   LOG(INFO) << "Constructed ZedRecorder" << std::endl;
-  LOG(INFO) << "Will save data in EuRoC format to: " << output_folder_ << std::endl;
+  if (format_ == RecordFormat::BINARY_LOG) {
+    LOG(INFO) << "Will save data as a binary log to: " << output_folder_ << ".bmlog" << std::endl;
+  } else if (format_ == RecordFormat::VIDEO_LOG) {
+    LOG(INFO) << "Will save data as a " << dataset::video_log::to_string(video_codec_)
+              << " video log to: " << output_folder_ << std::endl;
+  } else {
+    LOG(INFO) << "Will save data in EuRoC format to: " << output_folder_ << std::endl;
+  }
+}
+
+
+ZedRecorder::~ZedRecorder()
+{
+  Shutdown();
 }
 
 
@@ -73,10 +101,9 @@ void ZedRecorder::Run(bool blocking)
 {
   thread_ = std::thread(&ZedRecorder::CaptureLoop, this);
 
+  // NOTE(milo): CaptureLoop() returns once recording is done (and everything is written).
   if (blocking) {
-    while (!shutdown_) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(500));
-    }
+    thread_.join();
   }
 }
 
@@ -93,6 +120,8 @@ void ZedRecorder::Shutdown()
 
 void ZedRecorder::CaptureLoop()
 {
+  ConfigureCurrentThread(thread_config_, "bm_zed_capture");
+
   sl::Camera zed;
 
   // Set configuration parameters for the ZED.
@@ -101,7 +130,8 @@ void ZedRecorder::CaptureLoop()
   initp.coordinate_system = sl::COORDINATE_SYSTEM::IMAGE; // RDF
   initp.sdk_verbose = true;
   initp.depth_mode = sl::DEPTH_MODE::NONE;
-  initp.camera_resolution = sl::RESOLUTION::VGA;
+  initp.camera_resolution = resolution_;
+  initp.camera_fps = camera_fps_;
 
   sl::ERROR_CODE returned_state = zed.open(initp);
   if (returned_state != sl::ERROR_CODE::SUCCESS) {
@@ -158,68 +188,71 @@ void ZedRecorder::CaptureLoop()
   printSensorConfiguration(info.sensors_configuration.magnetometer_parameters);
   printSensorConfiguration(info.sensors_configuration.barometer_parameters);
 
-  sl::TimestampHandler ts;
-
-  // Retrieve sensors data during 5 seconds.
-  auto start_time = std::chrono::high_resolution_clock::now();
-  double elapsed_sec = 0;
+  // NOTE(milo): EuRoC images are encoded on a few threads, so that capture doesn't stall on disk
+  // I/O. Fast PNG compression keeps up with the camera on most disks. A video log leaves the
+  // compression to the hardware encoder instead.
+  dataset::DataWriter::Ptr writer;
+  std::shared_ptr<dataset::AsyncEurocDataWriter> euroc_writer;
+  if (format_ == RecordFormat::BINARY_LOG) {
+    writer = std::make_shared<dataset::BinaryLogWriter>(output_folder_ + ".bmlog");
+  } else if (format_ == RecordFormat::VIDEO_LOG) {
+    writer = std::make_shared<dataset::VideoLogWriter>(output_folder_, video_codec_, camera_fps_);
+  } else {
+    euroc_writer = std::make_shared<dataset::AsyncEurocDataWriter>(output_folder_, ".png", 1, 4, 32);
+    writer = euroc_writer;
+  }
 
-  sl::SensorsData sensors_data;
+  grab_done_ = false;
+  sensors_done_ = false;
+  convert_done_ = false;
 
-  dataset::EurocDataWriter writer(output_folder_);
+  std::thread sensor_thread(&ZedRecorder::SensorLoop, this, std::ref(zed));
+  std::thread convert_thread(&ZedRecorder::ConvertLoop, this);
+  std::thread write_thread(&ZedRecorder::WriteLoop, this, std::ref(*writer));
 
   LOG(INFO) << "Recording in progress" << std::endl;
 
-  while (elapsed_sec < max_duration_sec_ && !shutdown_) {
-    // Depending on your camera model, different sensors are available.
-    // They do not run at the same rate: therefore, to not miss any new samples we iterate as fast as possible
-    // and compare timestamps to determine when a given sensor's data has been updated.
-    // NOTE: There is no need to acquire images with grab(). getSensorsData runs in a separate internal capture thread.
-    if (zed.getSensorsData(sensors_data, sl::TIME_REFERENCE::CURRENT) == sl::ERROR_CODE::SUCCESS) {
-      // Check if a new IMU sample is available. IMU is the sensor with the highest update frequency.
-      if (ts.isNew(sensors_data.imu)) {
-        // std::cout << "Sample " << count++ << "\n";
-        // std::cout << " - IMU:\n";
-        // std::cout << " \t Orientation: {" << sensors_data.imu.pose.getOrientation() << "}\n";
-        // std::cout << " \t Acceleration: {" << sensors_data.imu.linear_acceleration << "} [m/sec^2]\n";
-        // std::cout << " \t Angular Velocity: {" << sensors_data.imu.angular_velocity << "} [deg/sec]\n";
-
-        const timestamp_t timestamp = sensors_data.imu.timestamp.getNanoseconds();
-
-        if (imu_sampler_.ShouldSample(ConvertToSeconds(timestamp))) {
-          const Vector3d angular_vel(DegToRad(sensors_data.imu.angular_velocity.x),
-                                     DegToRad(sensors_data.imu.angular_velocity.y),
-                                     DegToRad(sensors_data.imu.angular_velocity.y));
-          const Vector3d linear_accel(sensors_data.imu.linear_acceleration.x,
-                                      sensors_data.imu.linear_acceleration.y,
-                                      sensors_data.imu.linear_acceleration.z);
-          writer.WriteImu(ImuMeasurement(timestamp, angular_vel, linear_accel));
-        }
+  LatencyHistogram& grab_latency_ms = stats_.Histogram("Grab/latency_ms");
+  LatencyHistogram& grab_interval_ms = stats_.Histogram("Grab/interval_ms");
+  LatencyHistogram& convert_depth = stats_.Histogram("Queue/convert_depth");
+  std::atomic<int64_t>& num_grabbed = stats_.Counter("Frames/grabbed");
+  std::atomic<int64_t>& num_dropped = stats_.Counter("Frames/dropped_convert");
 
-        // Check if Magnetometer data has been updated.
-        if (ts.isNew(sensors_data.magnetometer))
-          std::cout << " - Magnetometer\n \t Magnetic Field: {" << sensors_data.magnetometer.magnetic_field_calibrated << "} [uT]\n";
+  auto start_time = std::chrono::high_resolution_clock::now();
+  double elapsed_sec = 0;
+  Timer interval_timer(true);
 
-        // Check if Barometer data has been updated.
-        if (ts.isNew(sensors_data.barometer))
-          std::cout << " - Barometer\n \t Atmospheric pressure:" << sensors_data.barometer.pressure << " [hPa]\n";
-      }
+  sl::Mat iml, imr;
 
-      // NOTE(milo): ZED returns a BGRA image, so we need to get the first 3 channels only.
-      if (zed.grab() == sl::ERROR_CODE::SUCCESS) {
-        const timestamp_t timestamp = zed.getTimestamp(sl::TIME_REFERENCE::IMAGE);
-        if (cam_sampler_.ShouldSample(ConvertToSeconds(timestamp))) {
-          sl::Mat iml, imr;
-          zed.retrieveImage(iml, sl::VIEW::LEFT, sl::MEM::CPU);
-          zed.retrieveImage(imr, sl::VIEW::RIGHT, sl::MEM::CPU);
-          const cv::Mat iml_cv = slMat2cvMat(iml);
-          const cv::Mat imr_cv = slMat2cvMat(imr);
-          Image3b iml_cv_bgr, imr_cv_bgr;
-          cv::cvtColor(iml_cv, iml_cv_bgr, cv::COLOR_BGRA2BGR);
-          cv::cvtColor(imr_cv, imr_cv_bgr, cv::COLOR_BGRA2BGR);
-          const StereoImage3b stereo_pair(timestamp, camera_id_, iml_cv_bgr, imr_cv_bgr);
-          writer.WriteStereo(stereo_pair);
-          ++camera_id_;
+  while (elapsed_sec < max_duration_sec_ && !shutdown_) {
+    Timer grab_timer(true);
+
+    // NOTE(milo): ZED returns a BGRA image, so we need to get the first 3 channels only (see
+    // ConvertLoop()). grab() blocks until the next frame is ready.
+    if (zed.grab() == sl::ERROR_CODE::SUCCESS) {
+      const timestamp_t timestamp = zed.getTimestamp(sl::TIME_REFERENCE::IMAGE);
+      if (cam_sampler_.ShouldSample(ConvertToSeconds(timestamp))) {
+        zed.retrieveImage(iml, sl::VIEW::LEFT, sl::MEM::CPU);
+        zed.retrieveImage(imr, sl::VIEW::RIGHT, sl::MEM::CPU);
+
+        // The SDK reuses its buffers on the next retrieveImage(), so copy the pixels out.
+        RecorderFrame frame;
+        frame.timestamp = timestamp;
+        frame.camera_id = camera_id_++;
+        frame.left = slMat2cvMat(iml).clone();
+        frame.right = slMat2cvMat(imr).clone();
+        grab_latency_ms.Record(grab_timer.Elapsed().milliseconds());
+
+        if (num_grabbed > 0) {
+          grab_interval_ms.Record(interval_timer.Elapsed().milliseconds());
+        }
+        interval_timer.Reset();
+
+        ++num_grabbed;
+        convert_depth.Record(static_cast<double>(convert_queue_.Size()));
+        if (!convert_queue_.Push(std::move(frame))) {
+          ++num_dropped;
+          LOG_EVERY_N(WARNING, 30) << "Dropped a frame, color conversion can't keep up" << std::endl;
         }
       }
     }
@@ -228,10 +261,168 @@ void ZedRecorder::CaptureLoop()
         std::chrono::high_resolution_clock::now() - start_time).count();
   }
 
-  LOG(INFO) << "Finished collecting data" << std::endl;
+  LOG(INFO) << "Finished collecting data, waiting for the writer to catch up" << std::endl;
+
+  // Stop each stage once everything upstream of it is done, so that no frames are lost.
+  grab_done_ = true;
+  sensor_thread.join();
+  convert_thread.join();
+  write_thread.join();
+
   zed.close();
+
+  if (euroc_writer) {
+    euroc_writer->Close();
+    const StatsSnapshot writer_stats = euroc_writer->GetStats();
+    for (const auto& c : writer_stats.counters) {
+      LOG(INFO) << c.first << ": " << c.second << std::endl;
+    }
+  }
+  writer.reset();
+
+  PrintStats();
 }
 
 
+void ZedRecorder::SensorLoop(sl::Camera& zed)
+{
+  ConfigureCurrentThread(thread_config_, "bm_zed_sensors");
+
+  std::atomic<int64_t>& num_dropped = stats_.Counter("Imu/dropped");
+  std::atomic<int64_t>& num_imu = stats_.Counter("Imu/samples");
+
+  sl::TimestampHandler ts;
+  sl::SensorsData sensors_data;
+
+  // NOTE(milo): getSensorsData() runs off of the SDK's own sensor thread, so it doesn't have to wait
+  // for grab(). Poll a few times faster than the IMU rate (400 Hz on the ZED 2) so that no samples
+  // are missed.
+  while (!grab_done_) {
+    if (zed.getSensorsData(sensors_data, sl::TIME_REFERENCE::CURRENT) != sl::ERROR_CODE::SUCCESS) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    bool is_new = false;
+
+    if (ts.isNew(sensors_data.imu)) {
+      is_new = true;
+      const timestamp_t timestamp = sensors_data.imu.timestamp.getNanoseconds();
+
+      if (imu_sampler_.ShouldSample(ConvertToSeconds(timestamp))) {
+        RecorderSample sample;
+        sample.timestamp = timestamp;
+        sample.w = Vector3d(DegToRad(sensors_data.imu.angular_velocity.x),
+                            DegToRad(sensors_data.imu.angular_velocity.y),
+                            DegToRad(sensors_data.imu.angular_velocity.y));
+        sample.a = Vector3d(sensors_data.imu.linear_acceleration.x,
+                            sensors_data.imu.linear_acceleration.y,
+                            sensors_data.imu.linear_acceleration.z);
+        ++num_imu;
+        if (!sensor_queue_.Push(std::move(sample))) {
+          ++num_dropped;
+        }
+      }
+    }
+
+    if (ts.isNew(sensors_data.magnetometer)) {
+      is_new = true;
+      const sl::float3& field = sensors_data.magnetometer.magnetic_field_calibrated;
+      RecorderSample sample;
+      sample.is_mag = true;
+      sample.timestamp = sensors_data.magnetometer.timestamp.getNanoseconds();
+      sample.field = Vector3d(field.x, field.y, field.z);
+      if (!sensor_queue_.Push(std::move(sample))) {
+        ++num_dropped;
+      }
+    }
+
+    if (!is_new) {
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+  }
+
+  sensors_done_ = true;
+}
+
+
+void ZedRecorder::ConvertLoop()
+{
+  LatencyHistogram& convert_ms = stats_.Histogram("Convert/ms");
+  LatencyHistogram& write_depth = stats_.Histogram("Queue/write_depth");
+  std::atomic<int64_t>& num_dropped = stats_.Counter("Frames/dropped_write");
+
+  RecorderFrame frame;
+  while (true) {
+    if (!convert_queue_.PopBlocking(frame, 0.05)) {
+      if (grab_done_ && convert_queue_.Empty()) {
+        break;
+      }
+      continue;
+    }
+
+    Timer timer(true);
+    RecorderFrame bgr;
+    bgr.timestamp = frame.timestamp;
+    bgr.camera_id = frame.camera_id;
+    cv::cvtColor(frame.left, bgr.left, cv::COLOR_BGRA2BGR);
+    cv::cvtColor(frame.right, bgr.right, cv::COLOR_BGRA2BGR);
+    convert_ms.Record(timer.Elapsed().milliseconds());
+
+    write_depth.Record(static_cast<double>(write_queue_.Size()));
+    if (!write_queue_.Push(std::move(bgr))) {
+      ++num_dropped;
+      LOG_EVERY_N(WARNING, 30) << "Dropped a frame, the writer can't keep up" << std::endl;
+    }
+  }
+
+  convert_done_ = true;
+}
+
+
+void ZedRecorder::WriteLoop(dataset::DataWriter& writer)
+{
+  LatencyHistogram& write_ms = stats_.Histogram("Write/stereo_ms");
+  std::atomic<int64_t>& num_written = stats_.Counter("Frames/written");
+
+  RecorderSample sample;
+  RecorderFrame frame;
+
+  while (true) {
+    // Sensor samples are small, so write all of them before each frame.
+    while (sensor_queue_.PopIfNonEmpty(sample)) {
+      if (sample.is_mag) {
+        writer.WriteMag(MagMeasurement(sample.timestamp, sample.field));
+      } else {
+        writer.WriteImu(ImuMeasurement(sample.timestamp, sample.w, sample.a));
+      }
+    }
+
+    if (write_queue_.PopBlocking(frame, 0.005)) {
+      Timer timer(true);
+      writer.WriteStereo(StereoImage3b(frame.timestamp, frame.camera_id, Image3b(frame.left), Image3b(frame.right)));
+      write_ms.Record(timer.Elapsed().milliseconds());
+      ++num_written;
+      continue;
+    }
+
+    if (convert_done_ && sensors_done_ && write_queue_.Empty() && sensor_queue_.Empty()) {
+      break;
+    }
+  }
+}
+
+
+void ZedRecorder::PrintStats()
+{
+  const StatsSnapshot stats = stats_.Snapshot();
+  for (const auto& c : stats.counters) {
+    LOG(INFO) << c.first << ": " << c.second << std::endl;
+  }
+  for (const HistogramSummary& h : stats.histograms) {
+    LOG(INFO) << h.name << ": N=" << h.count << " P50=" << h.p50 << " P99=" << h.p99 << " MAX=" << h.max << std::endl;
+  }
+}
+
 }
 }
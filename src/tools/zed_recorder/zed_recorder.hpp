@@ -7,9 +7,17 @@
 #include <thread>
 
 #include <sl/Camera.hpp>
+#include <opencv2/core.hpp>
 
+#include "core/eigen_types.hpp"
 #include "core/timestamp.hpp"
+#include "core/uid.hpp"
 #include "core/data_subsampler.hpp"
+#include "core/stats_tracker.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/thread_util.hpp"
+#include "dataset/data_writer.hpp"
+#include "dataset/video_log.hpp"
 
 namespace sl {
 
@@ -45,33 +53,111 @@ namespace bm {
 namespace zed {
 
 
+// How the recording is stored on disk.
+enum class RecordFormat { EUROC = 0, BINARY_LOG = 1, VIDEO_LOG = 2 };
+
+
+// A stereo pair on its way through the recording pipeline. The images are BGRA (as they come out of
+// the camera) until the convert stage turns them into BGR.
+struct RecorderFrame final {
+  core::timestamp_t timestamp = 0;
+  uid_t camera_id = 0;
+  cv::Mat left;
+  cv::Mat right;
+};
+
+
+// An IMU or magnetometer sample on its way to the writer.
+struct RecorderSample final {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  bool is_mag = false;
+  core::timestamp_t timestamp = 0;
+  core::Vector3d w = core::Vector3d::Zero();        // IMU only.
+  core::Vector3d a = core::Vector3d::Zero();        // IMU only.
+  core::Vector3d field = core::Vector3d::Zero();    // Magnetometer only.
+};
+
+
+// Records the ZED's stereo images, IMU and magnetometer to disk. Recording is split into pipelined
+// stages, each on its own thread, with bounded queues in between:
+//
+//   grab:     zed.grab() and copy the images out of the SDK's buffers
+//   sensors:  poll the IMU/magnetometer at their native rate (independently of grab)
+//   convert:  BGRA -> BGR
+//   write:    hand everything to the DataWriter
+//
+// If a stage can't keep up, frames are dropped at its input queue instead of stalling grab (so the
+// camera keeps its timing). Everything is counted in GetStats():
+//   Grab/latency_ms, Grab/interval_ms        grab() (including the wait for a frame) + copying the
+//                                            images out, and the time between recorded frames
+//   Convert/ms, Write/stereo_ms              Time per frame in the later stages
+//   Queue/convert_depth, Queue/write_depth   Frames waiting at each stage (when a frame arrives)
+//   Frames/grabbed, Frames/written           Frames in and out of the pipeline
+//   Frames/dropped_convert, Frames/dropped_write, Imu/dropped
 class ZedRecorder final {
  public:
-  ZedRecorder(const std::string& output_folder);
-
-  // Run the data acquisition and save to disk.
+  // The grab and sensor threads are pinned/prioritized according to thread_config (default: left
+  // alone). Images are recorded at camera_fps and resolution, and stored depending on format:
+  //   EUROC:       a folder in EuRoC format, with a PNG per image
+  //   BINARY_LOG:  everything goes into "<output_folder>.bmlog" (see BinaryLogWriter)
+  //   VIDEO_LOG:   the images are encoded with video_codec, on the Jetson's hardware encoder for
+  //                H264/H265 (see VideoLogWriter)
+  ZedRecorder(const std::string& output_folder,
+              const core::ThreadConfig& thread_config = core::ThreadConfig(),
+              RecordFormat format = RecordFormat::EUROC,
+              sl::RESOLUTION resolution = sl::RESOLUTION::VGA,
+              int camera_fps = 30,
+              dataset::video_log::VideoCodec video_codec = dataset::video_log::VideoCodec::H264);
+
+  ~ZedRecorder();
+
+  // Run the data acquisition and save to disk. If blocking, returns once recording is finished.
   void Run(bool blocking = true);
 
-  // Signal a graceful shutdown.
+  // Signal a graceful shutdown, and wait for everything that was captured to be written.
   void Shutdown();
 
+  core::StatsSnapshot GetStats() { return stats_.Snapshot(); }
+
  private:
-  // Main worker.
+  // Opens the camera, starts the other stages, and then runs the grab stage.
   void CaptureLoop();
 
+  void SensorLoop(sl::Camera& zed);
+  void ConvertLoop();
+  void WriteLoop(dataset::DataWriter& writer);
+
+  void PrintStats();
+
  private:
   std::thread thread_;
+  core::ThreadConfig thread_config_;
   std::string output_folder_;
+  RecordFormat format_;
+  sl::RESOLUTION resolution_;
+  int camera_fps_;
+  dataset::video_log::VideoCodec video_codec_;
   std::atomic_bool shutdown_;
 
   uid_t camera_id_ = 0;
 
-  core::DataSubsampler cam_sampler_{30.0};
+  core::DataSubsampler cam_sampler_;
   core::DataSubsampler imu_sampler_{100.0};
 
   double max_duration_sec_ = 120;
-};
 
+  // NOTE(milo): A second or so of frames at 60 Hz. Frames are big, so don't go much higher.
+  core::ThreadsafeQueue<RecorderFrame> convert_queue_{60, false, "zed_convert"};
+  core::ThreadsafeQueue<RecorderFrame> write_queue_{60, false, "zed_write"};
+  core::ThreadsafeQueue<RecorderSample> sensor_queue_{4000, false, "zed_sensors"};
+
+  std::atomic_bool grab_done_{false};
+  std::atomic_bool sensors_done_{false};
+  std::atomic_bool convert_done_{false};
+
+  core::StatsTracker stats_{"ZedRecorder", 100};
+};
 
 }
 }
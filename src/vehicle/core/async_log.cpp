@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "core/async_log.hpp"
+
+namespace bm {
+namespace core {
+
+
+static int64_t SteadyNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+bool LogSite::ShouldLog(double period_sec, uint64_t& suppressed)
+{
+  num_calls_.fetch_add(1, std::memory_order_relaxed);
+
+  const int64_t now = SteadyNowNs();
+  int64_t next = next_ns_.load(std::memory_order_relaxed);
+
+  // NOTE(milo): If two threads get here at once, only the one that moves next_ns_ logs.
+  if (now < next || !next_ns_.compare_exchange_strong(next, now + static_cast<int64_t>(period_sec * 1e9),
+                                                      std::memory_order_relaxed)) {
+    num_suppressed_.fetch_add(1, std::memory_order_relaxed);
+    pending_suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  suppressed = pending_suppressed_.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
+
+// NOTE(milo): Destroyed at exit, which writes out whatever is left in the ring.
+AsyncLogSink& AsyncLogSink::Instance()
+{
+  static AsyncLogSink sink;
+  return sink;
+}
+
+
+AsyncLogSink::AsyncLogSink()
+    : ring_(new Record[kCapacity])
+{
+  static_assert((kCapacity & (kCapacity - 1)) == 0, "AsyncLogSink::kCapacity must be a power of 2");
+  for (size_t i = 0; i < kCapacity; ++i) {
+    ring_[i].seq.store(i, std::memory_order_relaxed);
+  }
+  thread_ = std::thread(&AsyncLogSink::SinkLoop, this);
+}
+
+
+AsyncLogSink::~AsyncLogSink()
+{
+  is_shutdown_.store(true);
+  notifier_.Notify();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+
+// A slot is free for position pos when its sequence is pos, and holds the message for pos when its
+// sequence is pos + 1 (Vyukov's bounded queue, with a single consumer).
+bool AsyncLogSink::Push(google::LogSeverity severity, const char* file, int line, const char* text, size_t length)
+{
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Record* r = nullptr;
+
+  while (true) {
+    r = &ring_[pos & (kCapacity - 1)];
+    const size_t seq = r->seq.load(std::memory_order_acquire);
+    const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  r->severity = severity;
+  r->file = file;
+  r->line = line;
+  r->length = std::min(length, kMaxMessageBytes);
+  std::memcpy(r->text, text, r->length);
+  r->seq.store(pos + 1, std::memory_order_release);
+
+  notifier_.Notify();
+  return true;
+}
+
+
+void AsyncLogSink::Flush()
+{
+  const size_t target = enqueue_pos_.load(std::memory_order_acquire);
+  notifier_.Notify();
+  flushed_.Wait([&]() { return dequeue_pos_.load(std::memory_order_acquire) >= target; });
+}
+
+
+void AsyncLogSink::SinkLoop()
+{
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+  const auto ready = [&]() {
+    return ring_[pos & (kCapacity - 1)].seq.load(std::memory_order_acquire) == pos + 1;
+  };
+
+  while (true) {
+    notifier_.Wait([&]() { return ready() || is_shutdown_.load(); });
+
+    while (ready()) {
+      Record& r = ring_[pos & (kCapacity - 1)];
+      google::LogMessage(r.file, r.line, r.severity).stream().write(r.text, r.length);
+      r.seq.store(pos + kCapacity, std::memory_order_release);
+      ++pos;
+      num_written_.fetch_add(1, std::memory_order_relaxed);
+      dequeue_pos_.store(pos, std::memory_order_release);
+      flushed_.Notify();
+    }
+
+    if (is_shutdown_.load()) {
+      break;
+    }
+  }
+}
+
+
+// Each thread formats into its own buffer, so that a message never allocates or takes a lock.
+static thread_local char tl_line_buffer[AsyncLogSink::kMaxMessageBytes];
+
+
+AsyncLogLine::AsyncLogLine(const LogSite& site, google::LogSeverity severity, uint64_t suppressed)
+    : site_(site),
+      severity_(severity),
+      suppressed_(suppressed),
+      stream_(&buf_)
+{
+  buf_.Reset(tl_line_buffer, sizeof(tl_line_buffer));
+}
+
+
+AsyncLogLine::~AsyncLogLine()
+{
+  if (suppressed_ > 0) {
+    stream_ << " [" << suppressed_ << " more suppressed]";
+  }
+  AsyncLogSink::Instance().Push(severity_, site_.File(), site_.Line(), tl_line_buffer, buf_.Length());
+}
+
+
+}
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "core/notifier.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Rate limits one logging call site (see BM_LOG_EVERY_SEC), and counts how often it fired. A call
+// is logged if at least period_sec have passed since the last one that was, and the next logged
+// message reports how many were suppressed in between. Sites are never locked, so they're safe to
+// hit from any thread (including while holding a lock).
+class LogSite final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(LogSite)
+
+  LogSite(const char* file, int line) : file_(file), line_(line) {}
+
+  // Counts the call, and returns true if it should be logged. In that case, suppressed is the
+  // number of calls that weren't logged since the last one that was.
+  bool ShouldLog(double period_sec, uint64_t& suppressed);
+
+  const char* File() const { return file_; }
+  int Line() const { return line_; }
+
+  // Total calls, and how many of them weren't logged.
+  uint64_t NumCalls() const { return num_calls_.load(std::memory_order_relaxed); }
+  uint64_t NumSuppressed() const { return num_suppressed_.load(std::memory_order_relaxed); }
+
+ private:
+  const char* file_;
+  int line_;
+  std::atomic<int64_t> next_ns_{0};
+  std::atomic<uint64_t> num_calls_{0};
+  std::atomic<uint64_t> num_suppressed_{0};
+  std::atomic<uint64_t> pending_suppressed_{0};
+};
+
+
+// Writes log messages from any number of threads to glog on ONE background thread, so that a
+// thread that logs never waits on stderr (or the log file). Messages go into a bounded lock-free
+// ring (one sequence number per slot, so producers only contend on one atomic increment). If the
+// ring is full, the message is dropped and counted instead of blocking.
+//
+// NOTE(milo): Messages are formatted into a fixed size buffer per thread and copied into the ring,
+// so a message doesn't allocate on the thread that logs it. Long messages are truncated.
+class AsyncLogSink final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(AsyncLogSink)
+
+  static constexpr size_t kMaxMessageBytes = 256;
+  static constexpr size_t kCapacity = 1024;     // Must be a power of 2.
+
+  // The sink that BM_LOG_EVERY_SEC writes to. Its thread starts on first use.
+  static AsyncLogSink& Instance();
+
+  AsyncLogSink();
+
+  // Writes out everything that's still in the ring, then stops the thread.
+  ~AsyncLogSink();
+
+  // Copies a message into the ring. Returns false (and counts it) if the ring is full.
+  bool Push(google::LogSeverity severity, const char* file, int line, const char* text, size_t length);
+
+  // Blocks until every message pushed so far is written.
+  void Flush();
+
+  uint64_t NumDropped() const { return num_dropped_.load(std::memory_order_relaxed); }
+  uint64_t NumWritten() const { return num_written_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Record final
+  {
+    std::atomic<size_t> seq;
+    google::LogSeverity severity;
+    const char* file;
+    int line;
+    size_t length;
+    char text[kMaxMessageBytes];
+  };
+
+  void SinkLoop();
+
+  std::unique_ptr<Record[]> ring_;
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+  std::atomic<uint64_t> num_dropped_{0};
+  std::atomic<uint64_t> num_written_{0};
+  std::atomic_bool is_shutdown_{false};
+  Notifier notifier_;
+  Notifier flushed_;
+  std::thread thread_;
+};
+
+
+// One message, formatted into a thread local buffer and pushed into the sink when it goes out of
+// scope (when the log statement ends).
+class AsyncLogLine final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(AsyncLogLine)
+
+  AsyncLogLine(const LogSite& site, google::LogSeverity severity, uint64_t suppressed);
+  ~AsyncLogLine();
+
+  std::ostream& stream() { return stream_; }
+
+ private:
+  // Writes into a fixed buffer, and drops whatever doesn't fit.
+  class FixedBuf final : public std::streambuf {
+   public:
+    void Reset(char* begin, size_t size) { setp(begin, begin + size); }
+    size_t Length() const { return pptr() - pbase(); }
+   protected:
+    int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+  };
+
+  const LogSite& site_;
+  google::LogSeverity severity_;
+  uint64_t suppressed_;
+  FixedBuf buf_;
+  std::ostream stream_;
+};
+
+
+// Used by the macro below: checks the rate limit once, so that the loop body runs at most once.
+struct LogGuard final
+{
+  LogGuard(LogSite& site, double period_sec) : site(site) { active = site.ShouldLog(period_sec, suppressed); }
+  bool Once() { const bool was = active; active = false; return was; }
+
+  LogSite& site;
+  uint64_t suppressed = 0;
+  bool active = false;
+};
+
+
+}
+}
+
+
+// Logs like LOG(severity), but at most once every period_sec per call site, and asynchronously
+// (see AsyncLogSink). Use this in hot loops and under locks, where a burst of messages (e.g a
+// queue dropping every item under overload) shouldn't block the thread on I/O. The next message
+// that gets through says how many were suppressed. Only INFO, WARNING and ERROR are supported,
+// since a FATAL message has to be written before the process exits.
+//
+//  BM_LOG_EVERY_SEC(WARNING, 1.0) << "Dropping item from queue " << name;
+#define BM_LOG_EVERY_SEC(severity, period_sec)                                                    \
+  for (::bm::core::LogGuard bm_log_guard_([]() -> ::bm::core::LogSite& {                          \
+         static ::bm::core::LogSite site(__FILE__, __LINE__); return site; }(), (period_sec));    \
+       bm_log_guard_.Once(); )                                                                    \
+    ::bm::core::AsyncLogLine(bm_log_guard_.site, google::GLOG_##severity, bm_log_guard_.suppressed).stream()
@@ -0,0 +1,484 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#include <eigen3/Eigen/Core>
+
+#include <glog/logging.h>
+
+#include "core/async_log.hpp"
+#include "core/macros.hpp"
+#include "core/queue_telemetry.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Single-writer, multi-reader storage for a stream of items. Each item is stored once no matter how
+// many readers there are. The buffer holds the last "capacity" items; readers that fall further
+// behind than that miss the overwritten ones.
+//
+// Items are constructed in a pool of nodes that is allocated up front, and readers get shared_ptrs
+// that alias a node, so Publish() and Fetch() don't allocate. A node is reused once the pool holds
+// the only reference to it. The pool has room for the ring, plus the most that each reader that
+// called AddReader() can hold on to. If other readers keep items around, it grows (see
+// NumPoolGrowths()).
+// NOTE(milo): An item is only destroyed when its node is reused, so don't use this for items that
+// own big resources.
+template <typename Item>
+class BroadcastBuffer final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(BroadcastBuffer)
+  MACRO_DELETE_COPY_CONSTRUCTORS(BroadcastBuffer)
+  typedef std::shared_ptr<const Item> ItemPtr;
+
+  BroadcastBuffer(size_t capacity, const std::string& name = "")
+      : name_(name), ring_(capacity), push_ns_(capacity)
+  {
+    CHECK_GT(capacity, 0) << "BroadcastBuffer must have capacity > 0" << std::endl;
+
+    // One node per ring slot, and one for the item that's being published.
+    AddNodes(capacity + 1);
+  }
+
+  // Reserve nodes for a reader that holds on to at most max_pending items that could already be
+  // overwritten in the ring (e.g the unread items of a BroadcastQueue). This allocates, so call it
+  // before data starts flowing.
+  void AddReader(size_t max_pending)
+  {
+    std::lock_guard<std::mutex> lock(publish_lock_);
+    AddNodes(max_pending);
+  }
+
+  // Store an item and make it visible to all readers.
+  void Publish(Item item)
+  {
+    std::lock_guard<std::mutex> publish_lock(publish_lock_);
+
+    // Construct outside of the ring lock.
+    ItemPtr ptr = Emplace(std::move(item));
+    const int64_t now_ns = QueueTelemetry::Now();
+    lock_.lock();
+    ring_.at(sequence_ % ring_.size()) = std::move(ptr);
+    push_ns_.at(sequence_ % ring_.size()) = now_ns;
+    ++sequence_;
+    lock_.unlock();
+    cv_.notify_all();
+  }
+
+  // Store several items (oldest first) with one lock and one notification.
+  void PublishBatch(std::vector<Item>&& items)
+  {
+    std::lock_guard<std::mutex> publish_lock(publish_lock_);
+    for (Item& item : items) {
+      batch_.emplace_back(Emplace(std::move(item)));
+    }
+    const int64_t now_ns = QueueTelemetry::Now();
+    lock_.lock();
+    for (ItemPtr& ptr : batch_) {
+      ring_.at(sequence_ % ring_.size()) = std::move(ptr);
+      push_ns_.at(sequence_ % ring_.size()) = now_ns;
+      ++sequence_;
+    }
+    lock_.unlock();
+    batch_.clear();
+    cv_.notify_all();
+  }
+
+  // Call visitor(const ItemPtr& item, int64_t push_ns) on all items published since "cursor", oldest
+  // first, and advance the cursor. push_ns is the time that the item was published (see
+  // QueueTelemetry::Now()). The visitor runs under the buffer's lock, so keep it short. Returns the
+  // number of items that were overwritten before this reader could fetch them.
+  template <typename Visitor>
+  size_t Fetch(uint64_t& cursor, Visitor&& visitor)
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const uint64_t oldest_available = (sequence_ > ring_.size()) ? (sequence_ - ring_.size()) : 0;
+    const size_t num_missed = (cursor < oldest_available) ? (oldest_available - cursor) : 0;
+    for (uint64_t i = std::max(cursor, oldest_available); i < sequence_; ++i) {
+      visitor(ring_.at(i % ring_.size()), push_ns_.at(i % ring_.size()));
+    }
+    cursor = sequence_;
+    return num_missed;
+  }
+
+  // Total number of items published so far (also the cursor for "no unread items").
+  uint64_t Sequence()
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    return sequence_;
+  }
+
+  // Block until an item past "cursor" is published, "closed" is set, or timeout_sec elapses. A
+  // negative timeout waits forever.
+  void Wait(uint64_t cursor, const std::atomic_bool& closed, double timeout_sec)
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    const auto pred = [this, cursor, &closed]() { return closed || sequence_ > cursor; };
+    if (timeout_sec < 0) {
+      cv_.wait(lock, pred);
+    } else {
+      cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec), pred);
+    }
+  }
+
+  // Wake up all waiting readers (e.g on shutdown).
+  void Notify() { cv_.notify_all(); }
+
+  const std::string& Name() const { return name_; }
+
+  // Number of nodes in the pool, and how many times Publish() had to add one because they were all
+  // in use (i.e allocated in steady state).
+  size_t PoolSize()
+  {
+    std::lock_guard<std::mutex> lock(publish_lock_);
+    return pool_.size();
+  }
+  size_t NumPoolGrowths() const { return num_pool_growths_.load(); }
+
+ private:
+  // Storage for one item. Not constructed until the first time that the node is used.
+  struct Node final
+  {
+    MACRO_DELETE_COPY_CONSTRUCTORS(Node)
+
+    Node() = default;
+    ~Node() { if (has_item) { Get()->~Item(); } }
+
+    Item* Get() { return reinterpret_cast<Item*>(&storage); }
+
+    void Set(Item&& item)
+    {
+      if (has_item) { Get()->~Item(); }
+      has_item = false;
+      new (&storage) Item(std::move(item));
+      has_item = true;
+    }
+
+    typename std::aligned_storage<sizeof(Item), alignof(Item)>::type storage;
+    bool has_item = false;
+  };
+
+  typedef std::shared_ptr<Node> NodePtr;
+
+  void AddNodes(size_t n)
+  {
+    pool_.reserve(pool_.size() + n);
+    for (size_t i = 0; i < n; ++i) {
+      pool_.emplace_back(std::allocate_shared<Node>(Eigen::aligned_allocator<Node>()));
+    }
+    batch_.reserve(pool_.size());
+  }
+
+  // Move an item into a free node, and return a pointer to it that shares ownership of the node.
+  // Must hold publish_lock_.
+  ItemPtr Emplace(Item&& item)
+  {
+    // NOTE(milo): Readers only copy pointers that they already hold (or that the ring holds), so a
+    // node that only the pool refers to can't be picked up again until we hand it out. Start from
+    // where the last search stopped, since nodes tend to be freed in publish order.
+    NodePtr* node = nullptr;
+    for (size_t n = 0; n < pool_.size() && node == nullptr; ++n) {
+      NodePtr& candidate = pool_.at(next_node_);
+      next_node_ = (next_node_ + 1) % pool_.size();
+      if (candidate.use_count() == 1) {
+        node = &candidate;
+      }
+    }
+
+    if (node == nullptr) {
+      ++num_pool_growths_;
+      BM_LOG_EVERY_SEC(WARNING, 1.0) << "BroadcastBuffer pool is exhausted, adding a node!"
+          << " Buffer=" << name_ << " Item=" << typeid(Item).name() << " PoolSize=" << pool_.size();
+      pool_.emplace_back(std::allocate_shared<Node>(Eigen::aligned_allocator<Node>()));
+      node = &pool_.back();
+    }
+
+    // Pairs with the release of the reader that dropped the last other reference.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    (*node)->Set(std::move(item));
+    return ItemPtr(*node, (*node)->Get());
+  }
+
+ private:
+  std::string name_;
+  std::mutex lock_;
+  std::condition_variable cv_;
+  uint64_t sequence_ = 0;
+  std::vector<ItemPtr> ring_;
+  std::vector<int64_t> push_ns_;    // When each item in ring_ was published.
+
+  // Only touched by Publish*() and AddReader(), under publish_lock_.
+  std::mutex publish_lock_;
+  std::vector<NodePtr> pool_;
+  size_t next_node_ = 0;
+  std::vector<ItemPtr> batch_;      // Scratch space for PublishBatch().
+  std::atomic<size_t> num_pool_growths_{0};
+};
+
+
+// A queue that reads from a (possibly shared) BroadcastBuffer, with the same API as ThreadsafeQueue.
+// Every BroadcastQueue has its own read cursor, so several consumers can each see every item, but
+// the items themselves are only stored once. Pushing to ANY queue that shares a buffer makes the
+// item visible to ALL of them.
+//
+// By default a BroadcastQueue has a private buffer, and behaves just like a normal queue. Call
+// ShareWith() to attach it to another queue's buffer. The unread items of each consumer are kept in
+// a ring of max_queue_size, so nothing is allocated after construction.
+// NOTE(milo): The consumer-side state isn't locked. Push() is safe from any thread; everything else
+// should be called from the consumer (or under a lock, like DataManager does).
+template <typename Item>
+class BroadcastQueue {
+ public:
+  typedef BroadcastBuffer<Item> Buffer;
+  typedef typename Buffer::ItemPtr ItemPtr;
+
+  // Used by DataManager to decide whether it needs to take its own lock.
+  static constexpr bool kLockFree = false;
+
+  // Construct the queue with a max size and drop policy. Since the storage is shared, this queue
+  // must be bounded. The max size applies to the unread items of this consumer.
+  BroadcastQueue(size_t max_queue_size,
+                 bool drop_oldest_if_full = true,
+                 const std::string& queue_name = "")
+      : max_queue_size_(max_queue_size),
+        drop_oldest_if_full_(drop_oldest_if_full),
+        queue_name_(queue_name),
+        buffer_(std::make_shared<Buffer>(max_queue_size, queue_name)),
+        pending_(max_queue_size),
+        pending_push_ns_(max_queue_size)
+  {
+    CHECK_GT(max_queue_size, 0) << "BroadcastQueue must have a max_queue_size > 0"
+        << "\n  Queue=" << queue_name_ << std::endl;
+    buffer_->AddReader(max_queue_size_);
+  }
+
+  BroadcastQueue(const BroadcastQueue&) = delete;
+  void operator=(const BroadcastQueue&) = delete;
+
+  // Read from the same buffer as "other", starting with the next item that's pushed. Any unread
+  // items in this queue are dropped. Call this before data starts flowing.
+  void ShareWith(BroadcastQueue& other)
+  {
+    other.buffer_->AddReader(max_queue_size_);
+    buffer_ = other.buffer_;
+    cursor_ = buffer_->Sequence();
+    while (pending_size_ > 0) {
+      PopFrontPending();
+    }
+  }
+
+  // Publish an item to every queue that shares this buffer.
+  bool Push(Item item)
+  {
+    buffer_->Publish(std::move(item));
+    return true;
+  }
+
+  // Publish several items at once (oldest first). Returns the number pushed (always all of them).
+  size_t PushBatch(std::vector<Item>&& items)
+  {
+    const size_t n = items.size();
+    buffer_->PublishBatch(std::move(items));
+    return n;
+  }
+
+  Item Pop()
+  {
+    Fetch();
+    CHECK(pending_size_ > 0) << "Tried to pop from empty BroadcastQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    Item item = PendingAt(0);
+    RecordPopFront(QueueTelemetry::Now());
+    return item;
+  }
+
+  bool PopIfNonEmpty(Item& item)
+  {
+    Fetch();
+    const bool nonempty = pending_size_ > 0;
+    if (nonempty) {
+      item = PendingAt(0);
+      RecordPopFront(QueueTelemetry::Now());
+    }
+    return nonempty;
+  }
+
+  // Wait up to timeout_sec for an item, and pop it if one arrives. A negative timeout waits forever.
+  bool PopBlocking(Item& item, double timeout_sec = -1)
+  {
+    return WaitNotEmpty(timeout_sec) && PopIfNonEmpty(item);
+  }
+
+  // Block until there is an unread item, the queue is closed, or timeout_sec elapses. Returns
+  // whether there is an unread item.
+  bool WaitNotEmpty(double timeout_sec = -1)
+  {
+    if (pending_size_ == 0) {
+      buffer_->Wait(cursor_, closed_, timeout_sec);
+    }
+    return !Empty();
+  }
+
+  // NOTE(milo): There is no WaitEmpty(), since the unread items are private to the consumer.
+
+  void Close()
+  {
+    closed_ = true;
+    buffer_->Notify();
+  }
+
+  bool IsClosed() const { return closed_; }
+
+  // Number of unread items for this consumer.
+  size_t Size()
+  {
+    const uint64_t unfetched = buffer_->Sequence() - cursor_;
+    return std::min(pending_size_ + static_cast<size_t>(unfetched), max_queue_size_);
+  }
+
+  bool Empty() { return Size() == 0; }
+
+  // Total number of items this consumer has missed or dropped since construction.
+  size_t NumDropped() const { return num_dropped_.load(); }
+
+  // Push/pop counts, high-water depth and dwell times of this consumer (see QueueTelemetry). Items
+  // count as pushed once this consumer fetches them from the buffer, so the depth and high water
+  // don't include items that were published since the last Fetch().
+  const QueueTelemetry& Telemetry() const { return telemetry_; }
+
+  // The buffer that this queue reads from (e.g to check its pool).
+  Buffer& GetBuffer() { return *buffer_; }
+
+  size_t ConsumerSize()
+  {
+    Fetch();
+    return pending_size_;
+  }
+
+  const Item& At(size_t i) const
+  {
+    CHECK_LT(i, pending_size_) << "Tried to At() past the end of BroadcastQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return PendingAt(i);
+  }
+
+  void PopFront(size_t n)
+  {
+    n = std::min(n, pending_size_);
+    const int64_t now_ns = QueueTelemetry::Now();
+    for (size_t i = 0; i < n; ++i) {
+      RecordPopFront(now_ns);
+    }
+  }
+
+  const Item& PeekFront()
+  {
+    Fetch();
+    CHECK(pending_size_ > 0) << "Tried to PeekFront() from empty BroadcastQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return PendingAt(0);
+  }
+
+  const Item& PeekBack()
+  {
+    Fetch();
+    CHECK(pending_size_ > 0) << "Tried to PeekBack() from empty BroadcastQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return PendingAt(pending_size_ - 1);
+  }
+
+ private:
+  // Grab pointers to newly published items, and apply this consumer's drop policy to the ones that
+  // don't fit.
+  void Fetch()
+  {
+    size_t num_fetched = 0;
+    size_t num_full = 0;
+    const size_t num_missed = buffer_->Fetch(cursor_, [this, &num_fetched, &num_full](const ItemPtr& item, int64_t push_ns) {
+      ++num_fetched;
+      if (pending_size_ == max_queue_size_) {
+        ++num_full;
+        if (!drop_oldest_if_full_) {
+          return;
+        }
+        PopFrontPending();
+      }
+      const size_t back = (pending_head_ + pending_size_) % max_queue_size_;
+      pending_.at(back) = item;
+      pending_push_ns_.at(back) = push_ns;
+      ++pending_size_;
+    });
+    const size_t num_dropped = num_missed + num_full;
+
+    if (num_fetched > 0) {
+      telemetry_.RecordPush(num_fetched, pending_size_);
+    }
+
+    if (num_dropped > 0) {
+      num_dropped_ += num_dropped;
+      BM_LOG_EVERY_SEC(WARNING, 1.0) << "Dropping " << num_dropped << " items from BroadcastQueue!"
+          << " Queue=" << queue_name_ << " Item=" << typeid(Item).name();
+    }
+  }
+
+  const Item& PendingAt(size_t i) const
+  {
+    return *pending_.at((pending_head_ + i) % max_queue_size_);
+  }
+
+  // Release the oldest unread item (so that its node can go back to the pool).
+  void PopFrontPending()
+  {
+    pending_.at(pending_head_).reset();
+    pending_head_ = (pending_head_ + 1) % max_queue_size_;
+    --pending_size_;
+  }
+
+  void RecordPopFront(int64_t now_ns)
+  {
+    const int64_t push_ns = pending_push_ns_.at(pending_head_);
+    PopFrontPending();
+    telemetry_.RecordPop(push_ns, now_ns, pending_size_);
+  }
+
+ private:
+  size_t max_queue_size_;
+  bool drop_oldest_if_full_;
+  std::string queue_name_;
+  std::atomic_bool closed_{false};
+  std::atomic<size_t> num_dropped_{0};
+
+  typename Buffer::Ptr buffer_;
+  uint64_t cursor_ = 0;               // Sequence number of the next item to fetch from the buffer.
+
+  // Fetched but not yet popped, in a ring of max_queue_size_ that starts at pending_head_.
+  std::vector<ItemPtr> pending_;
+  std::vector<int64_t> pending_push_ns_;
+  size_t pending_head_ = 0;
+  size_t pending_size_ = 0;
+  QueueTelemetry telemetry_;
+};
+
+
+template <typename Item>
+constexpr bool BroadcastQueue<Item>::kLockFree;
+
+
+}
+}
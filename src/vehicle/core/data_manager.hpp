@@ -1,18 +1,61 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <typeinfo>
+#include <vector>
 
+#include "core/async_log.hpp"
 #include "core/macros.hpp"
 #include "core/timestamp.hpp"
 #include "core/thread_safe_queue.hpp"
+#include "core/spsc_queue.hpp"
+#include "core/broadcast_queue.hpp"
 
 namespace bm {
 namespace core {
 
 
-template <typename DataType>
+// Stores timestamped sensor data in order. The QueueType can be ThreadsafeQueue (any number of
+// producers/consumers), SpscQueue (lock-free, but only one producer and one consumer thread), or
+// BroadcastQueue (several DataManagers read one shared copy of the data; see ShareWith()).
+//
+// Measurements are kept sorted by timestamp, so lookups (DiscardBefore, PopUntil, Nearest,
+// GetRange, Interpolate) are binary searches over the queue, rather than linear scans.
+//
+// Measurements that arrive out of order (e.g UDP packets) can be sorted by a small reorder buffer;
+// see SetReorderWindow(). Anything that arrives after a newer measurement was already released to
+// the queue is dropped, and counted by NumLate().
+template <typename DataType, typename QueueType = ThreadsafeQueue<DataType>>
 class DataManager {
  public:
+  // A read-only window onto a contiguous range of measurements, without copying them. For a locked
+  // DataManager, the View holds the lock until it goes out of scope, so don't keep it around!
+  // NOTE(milo): Only the consumer thread should create views of an SpscQueue-backed DataManager.
+  class View final {
+   public:
+    size_t Size() const { return count_; }
+    bool Empty() const { return count_ == 0; }
+    const DataType& at(size_t i) const
+    {
+      CHECK_LT(i, count_) << "Tried to access past the end of a DataManager::View" << std::endl;
+      return queue_->At(first_ + i);
+    }
+    const DataType& front() const { return at(0); }
+    const DataType& back() const { return at(count_ - 1); }
+
+   private:
+    friend class DataManager;
+    View(QueueType* queue, size_t first, size_t count, std::unique_lock<std::mutex>&& lock)
+        : queue_(queue), first_(first), count_(count), lock_(std::move(lock)) {}
+
+    QueueType* queue_;
+    size_t first_;
+    size_t count_;
+    std::unique_lock<std::mutex> lock_;
+  };
+
   MACRO_DELETE_DEFAULT_CONSTRUCTOR(DataManager);
   MACRO_DELETE_COPY_CONSTRUCTORS(DataManager);
 
@@ -24,25 +67,109 @@ class DataManager {
   void Push(const DataType& item)
   {
     // NOTE(milo): Cannot use the lock here! It will enter a race with Newest().
-    lock_.lock();
+    Lock();
     const seconds_t timestamp = MaybeConvertToSeconds(item.timestamp);
 
-    // Always push if queue is empty.
-    if (queue_.Empty()) {
-      queue_.Push(std::move(item));
+    if (reorder_window_sec_ <= 0) {
+      PushInOrder(item, timestamp);
     } else {
-      const timestamp_t newest = Newest(false); // Grab timestamp once to make sure it's consistent.
-      CHECK(newest == kMaxSeconds || timestamp >= newest)
-          << "Tried to add measurement out of order."
-          << "\n  timestamp=" << timestamp
-          << "\n  newest=" << newest << std::endl;
-      queue_.Push(std::move(item));
+      // Sort on insert. Items with equal timestamps stay in arrival order.
+      const auto it = std::upper_bound(reorder_buffer_.begin(), reorder_buffer_.end(), timestamp,
+          [this](seconds_t t, const DataType& other) { return t < MaybeConvertToSeconds(other.timestamp); });
+      reorder_buffer_.insert(it, item);
+
+      // Release everything that's more than the window older than the newest arrival.
+      const seconds_t release_before = MaybeConvertToSeconds(reorder_buffer_.back().timestamp) - reorder_window_sec_;
+      size_t n = 0;
+      while (n < reorder_buffer_.size() && MaybeConvertToSeconds(reorder_buffer_[n].timestamp) <= release_before) {
+        PushInOrder(reorder_buffer_[n], MaybeConvertToSeconds(reorder_buffer_[n].timestamp));
+        ++n;
+      }
+      reorder_buffer_.erase(reorder_buffer_.begin(), reorder_buffer_.begin() + n);
+    }
+    Unlock();
+  }
+
+  // Push n measurements (e.g everything in one LCM message) with a single lock, and a single push
+  // onto the underlying queue. Same ordering and late/reorder behavior as calling Push() on each.
+  void PushBatch(const DataType* items, size_t n)
+  {
+    Lock();
+    std::vector<DataType> in_order;
+    in_order.reserve(n);
+    seconds_t newest = newest_pushed_;
+
+    for (size_t i = 0; i < n; ++i) {
+      if (reorder_window_sec_ <= 0) {
+        AcceptInOrder(items[i], MaybeConvertToSeconds(items[i].timestamp), newest, in_order);
+        continue;
+      }
+      const seconds_t timestamp = MaybeConvertToSeconds(items[i].timestamp);
+      const auto it = std::upper_bound(reorder_buffer_.begin(), reorder_buffer_.end(), timestamp,
+          [this](seconds_t t, const DataType& other) { return t < MaybeConvertToSeconds(other.timestamp); });
+      reorder_buffer_.insert(it, items[i]);
+    }
+
+    // Everything in the batch is sorted into the reorder buffer first, and then released together.
+    if (reorder_window_sec_ > 0 && !reorder_buffer_.empty()) {
+      const seconds_t release_before = MaybeConvertToSeconds(reorder_buffer_.back().timestamp) - reorder_window_sec_;
+      size_t r = 0;
+      while (r < reorder_buffer_.size() && MaybeConvertToSeconds(reorder_buffer_[r].timestamp) <= release_before) {
+        AcceptInOrder(reorder_buffer_[r], MaybeConvertToSeconds(reorder_buffer_[r].timestamp), newest, in_order);
+        ++r;
+      }
+      reorder_buffer_.erase(reorder_buffer_.begin(), reorder_buffer_.begin() + r);
+    }
+
+    // The queue only ever drops from the end of the batch, so the newest pushed is easy to find.
+    if (!in_order.empty()) {
+      std::vector<seconds_t> timestamps(in_order.size());
+      for (size_t i = 0; i < in_order.size(); ++i) {
+        timestamps[i] = MaybeConvertToSeconds(in_order[i].timestamp);
+      }
+      const size_t num_pushed = queue_.PushBatch(std::move(in_order));
+      if (num_pushed > 0) { newest_pushed_ = timestamps[num_pushed - 1]; }
+    }
+    Unlock();
+  }
+
+  // Hold each pushed measurement for up to window_sec (of measurement time), so that any older ones
+  // that arrive late can be sorted in front of it. This adds window_sec of latency to the queue.
+  // Zero (the default) pushes straight through. Call from the producer, before pushing any data.
+  void SetReorderWindow(seconds_t window_sec)
+  {
+    CHECK_GE(window_sec, 0) << "Reorder window must be >= 0" << std::endl;
+    reorder_window_sec_ = window_sec;
+  }
+
+  // Release all measurements held by the reorder buffer (e.g once no more data is coming).
+  void FlushReorderBuffer()
+  {
+    Lock();
+    for (const DataType& item : reorder_buffer_) {
+      PushInOrder(item, MaybeConvertToSeconds(item.timestamp));
     }
-    lock_.unlock();
+    reorder_buffer_.clear();
+    Unlock();
+  }
+
+  // Number of measurements that arrived too late (after a newer one was already queued) and were
+  // dropped.
+  size_t NumLate() const { return num_late_.load(std::memory_order_relaxed); }
+
+  // Read the same underlying data as "other", so that a measurement pushed to either one is seen by
+  // both without being copied. Only available with a BroadcastQueue. Call before pushing any data.
+  void ShareWith(DataManager& other)
+  {
+    Lock();
+    queue_.ShareWith(other.queue_);
+    Unlock();
   }
 
   bool Empty() { return queue_.Empty(); }
   size_t Size() { return queue_.Size(); }
+  size_t NumDropped() const { return queue_.NumDropped(); }
+  const QueueTelemetry& Telemetry() const { return queue_.Telemetry(); }
 
   // Get the oldest measurement (first in) from the queue.
   DataType Pop() { return queue_.Pop(); }
@@ -51,62 +178,185 @@ class DataManager {
   // the newest one.
   DataType PopNewest()
   {
-    lock_.lock();
+    Lock();
     CHECK(queue_.Size() >= 1);
     while (queue_.Size() > 1) {
       queue_.Pop();
     }
     DataType item = queue_.Pop();
-    lock_.unlock();
+    Unlock();
     return item;
   }
 
   // Pop measurements and put them in "out" until the next item exceeds the timestamp.
   void PopUntil(seconds_t timestamp, std::vector<DataType>& out)
   {
-    lock_.lock();
-    while (!queue_.Empty() && (MaybeConvertToSeconds(queue_.PeekFront().timestamp) <= timestamp)) {
-      out.emplace_back(std::move(queue_.Pop()));
+    Lock();
+    const size_t n = UpperBound(timestamp, queue_.ConsumerSize());
+    out.reserve(out.size() + n);
+    for (size_t i = 0; i < n; ++i) {
+      out.emplace_back(queue_.At(i));
     }
-    lock_.unlock();
+    queue_.PopFront(n);
+    Unlock();
   }
 
   // Throw away measurements before (but NOT equal to) timestamp. If save_at_least_one is true,
   // we don't pop the only remaining item, no matter what timestamp it has.
   void DiscardBefore(seconds_t timestamp, bool save_at_least_one = false)
   {
-    lock_.lock();
-    while (!queue_.Empty() &&
-           !(queue_.Size() == 1 && save_at_least_one) &&
-           (MaybeConvertToSeconds(queue_.PeekFront().timestamp) < timestamp)) {
-      queue_.Pop();
+    Lock();
+    const size_t size = queue_.ConsumerSize();
+    size_t n = LowerBound(timestamp, size);
+    if (save_at_least_one && n == size && size > 0) {
+      --n;
     }
-    lock_.unlock();
+    queue_.PopFront(n);
+    Unlock();
+  }
+
+  // Throw away measurements before AND equal to timestamp.
+  void DiscardUpTo(seconds_t timestamp)
+  {
+    Lock();
+    queue_.PopFront(UpperBound(timestamp, queue_.ConsumerSize()));
+    Unlock();
+  }
+
+  // Copy the measurement closest in time to timestamp into "out". Returns false if empty.
+  bool Nearest(seconds_t timestamp, DataType& out)
+  {
+    Lock();
+    const size_t size = queue_.ConsumerSize();
+    const size_t i = LowerBound(timestamp, size);
+    const bool nonempty = size > 0;
+    if (nonempty) {
+      const bool use_prev = (i == size) ||
+          (i > 0 && (timestamp - TimestampAt(i - 1)) < (TimestampAt(i) - timestamp));
+      out = queue_.At(use_prev ? i - 1 : i);
+    }
+    Unlock();
+    return nonempty;
+  }
+
+  // Get a view of all measurements with timestamps in [t0, t1], without copying them.
+  View GetRange(seconds_t t0, seconds_t t1)
+  {
+    std::unique_lock<std::mutex> lock = QueueType::kLockFree ?
+        std::unique_lock<std::mutex>() : std::unique_lock<std::mutex>(lock_);
+    const size_t size = queue_.ConsumerSize();
+    const size_t first = LowerBound(t0, size);
+    const size_t last = std::max(first, UpperBound(t1, size));
+    return View(&queue_, first, last - first, std::move(lock));
+  }
+
+  // Interpolate a measurement at timestamp from the two measurements that bracket it. DataType must
+  // have an InterpolateMeasurement(before, after, timestamp) overload. Returns false if timestamp is
+  // outside of the range of buffered measurements.
+  bool Interpolate(seconds_t timestamp, DataType& out)
+  {
+    Lock();
+    const size_t size = queue_.ConsumerSize();
+    const size_t i = LowerBound(timestamp, size);
+    bool success = false;
+    if (i < size && TimestampAt(i) == timestamp) {
+      out = queue_.At(i);
+      success = true;
+    } else if (i > 0 && i < size) {
+      out = InterpolateMeasurement(queue_.At(i - 1), queue_.At(i), timestamp);
+      success = true;
+    }
+    Unlock();
+    return success;
   }
 
   // Timestamp of the newest measurement in the queue. If empty, returns kMaxSeconds.
   seconds_t Newest(bool lock = true)
   {
-    if (lock) lock_.lock();
+    if (lock) Lock();
     const seconds_t t = queue_.Empty() ? kMaxSeconds : MaybeConvertToSeconds(queue_.PeekBack().timestamp);
-    if (lock) lock_.unlock();
+    if (lock) Unlock();
     return t;
   }
 
   // Timestamp of the oldest measurement in the queue. If empty, returns kMinSeconds.
   seconds_t Oldest(bool lock = false)
   {
-    if (lock) lock_.lock();
+    if (lock) Lock();
     const seconds_t t = queue_.Empty() ? kMinSeconds : MaybeConvertToSeconds(queue_.PeekFront().timestamp);
-    if (lock) lock_.unlock();
+    if (lock) Unlock();
     return t;
   }
 
  private:
   std::mutex lock_;
-  ThreadsafeQueue<DataType> queue_;
+  QueueType queue_;
+  seconds_t newest_pushed_ = kMaxSeconds;  // Only accessed from Push().
+
+  // Only accessed by the producer (Push).
+  seconds_t reorder_window_sec_ = 0;
+  std::vector<DataType> reorder_buffer_;
+  std::atomic<size_t> num_late_{0};
 
  private:
+  // Push a measurement that is known to be in order, or drop it (and count it) if it's late.
+  void PushInOrder(const DataType& item, seconds_t timestamp)
+  {
+    // NOTE(milo): The back item is always the last one we pushed. We remember its timestamp instead
+    // of peeking, since the producer can't safely PeekBack() an SpscQueue while the consumer is
+    // popping.
+    if (newest_pushed_ != kMaxSeconds && timestamp < newest_pushed_) {
+      num_late_.fetch_add(1, std::memory_order_relaxed);
+      BM_LOG_EVERY_SEC(WARNING, 1.0) << "Dropping late measurement: timestamp=" << timestamp
+          << " newest=" << newest_pushed_;
+      return;
+    }
+    if (queue_.Push(item)) { newest_pushed_ = timestamp; }
+  }
+
+  // Like PushInOrder(), but collects the ones that aren't late in "out" (for PushBatch). "newest" is
+  // the newest timestamp accepted so far.
+  void AcceptInOrder(const DataType& item, seconds_t timestamp, seconds_t& newest, std::vector<DataType>& out)
+  {
+    if (newest != kMaxSeconds && timestamp < newest) {
+      num_late_.fetch_add(1, std::memory_order_relaxed);
+      BM_LOG_EVERY_SEC(WARNING, 1.0) << "Dropping late measurement: timestamp=" << timestamp
+          << " newest=" << newest;
+      return;
+    }
+    out.emplace_back(item);
+    newest = timestamp;
+  }
+
+  // An SpscQueue already guarantees consistency between its producer and consumer, so the extra
+  // lock is only needed when the underlying queue can be shared by several threads.
+  void Lock() { if (!QueueType::kLockFree) { lock_.lock(); } }
+  void Unlock() { if (!QueueType::kLockFree) { lock_.unlock(); } }
+
+  seconds_t TimestampAt(size_t i) { return MaybeConvertToSeconds(queue_.At(i).timestamp); }
+
+  // Index of the first of the n oldest measurements with a timestamp >= t (or n if there isn't one).
+  size_t LowerBound(seconds_t t, size_t n)
+  {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (TimestampAt(mid) < t) { lo = mid + 1; } else { hi = mid; }
+    }
+    return lo;
+  }
+
+  // Index of the first of the n oldest measurements with a timestamp > t (or n if there isn't one).
+  size_t UpperBound(seconds_t t, size_t n)
+  {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (TimestampAt(mid) <= t) { lo = mid + 1; } else { hi = mid; }
+    }
+    return lo;
+  }
+
   seconds_t MaybeConvertToSeconds(timestamp_t t) const
   {
     return ConvertToSeconds(t);
@@ -20,5 +20,18 @@ struct DepthMeasurement final
 };
 
 
+// Linearly interpolate between two depth measurements (see DataManager::Interpolate).
+inline DepthMeasurement InterpolateMeasurement(const DepthMeasurement& before,
+                                               const DepthMeasurement& after,
+                                               seconds_t timestamp)
+{
+  const seconds_t t0 = ConvertToSeconds(before.timestamp);
+  const seconds_t t1 = ConvertToSeconds(after.timestamp);
+  const double alpha = (t1 > t0) ? (timestamp - t0) / (t1 - t0) : 0.0;
+  return DepthMeasurement(ConvertToNanoseconds(timestamp),
+                          (1.0 - alpha) * before.depth + alpha * after.depth);
+}
+
+
 }
 }
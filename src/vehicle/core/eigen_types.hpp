@@ -43,6 +43,10 @@ typedef Eigen::Matrix<double, 1, 1> Matrix1d;
 typedef Eigen::Matrix3d Matrix3d;
 typedef Eigen::Matrix4d Matrix4d;
 
+// Dynamic size arrays, for batches of points stored as structure-of-arrays (one per coordinate).
+typedef Eigen::ArrayXf ArrayXf;
+typedef Eigen::ArrayXd ArrayXd;
+
 // 3D transformations.
 typedef Eigen::AffineCompact3f Transform3f;
 typedef Eigen::AffineCompact3d Transform3d;
@@ -56,5 +60,13 @@ typedef Eigen::AlignedBox2f Box2f;
 typedef Eigen::AlignedBox2d Box2d;
 typedef Eigen::AlignedBox2i Box2i;
 
+// For code that is templated on the scalar type (float or double).
+template <typename Scalar> using Vector2T = Eigen::Matrix<Scalar, 2, 1>;
+template <typename Scalar> using Vector3T = Eigen::Matrix<Scalar, 3, 1>;
+template <typename Scalar> using Vector6T = Eigen::Matrix<Scalar, 6, 1>;
+template <typename Scalar> using Matrix3T = Eigen::Matrix<Scalar, 3, 3>;
+template <typename Scalar> using Matrix4T = Eigen::Matrix<Scalar, 4, 4>;
+template <typename Scalar> using Matrix6T = Eigen::Matrix<Scalar, 6, 6>;
+
 }
 }
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace bm {
+namespace core {
+
+
+// Expires keys that haven't been touched in more than "lifespan" ticks (a timing wheel). Each key
+// lives in the bucket of the tick that it was last touched at, and there are lifespan + 1 buckets,
+// so moving to a new tick only has to look at the one bucket that just went stale. Touching and
+// removing a key are O(1), and expiring is O(number of keys that expire), no matter how many keys
+// are alive.
+//
+// Usage:
+//  ExpirationWheel<uid_t> wheel(3);
+//  wheel.Advance(tick, expired);   // Start of each tick (expired gets the keys from tick - 4).
+//  wheel.Touch(lmk_id);            // Whenever a key is seen during the tick.
+template <typename Key>
+class ExpirationWheel final {
+ public:
+  explicit ExpirationWheel(size_t lifespan) : buckets_(lifespan + 1) {}
+
+  // Number of keys that haven't expired (or been removed).
+  size_t Size() const { return location_.size(); }
+  bool Empty() const { return location_.empty(); }
+  bool Contains(const Key& key) const { return location_.count(key) != 0; }
+
+  uint64_t Now() const { return now_; }
+  size_t Lifespan() const { return buckets_.size() - 1; }
+
+  // Mark a key as seen at the current tick (adding it if it's new).
+  void Touch(const Key& key)
+  {
+    const size_t b = now_ % buckets_.size();
+    const auto it = location_.find(key);
+    if (it != location_.end()) {
+      if (it->second.bucket == b) {
+        return;
+      }
+      Erase(it->second);
+      it->second = Push(b, key);
+    } else {
+      location_.emplace(key, Push(b, key));
+    }
+  }
+
+  // Forget about a key without expiring it (does nothing if it isn't in the wheel).
+  void Remove(const Key& key)
+  {
+    const auto it = location_.find(key);
+    if (it != location_.end()) {
+      Erase(it->second);
+      location_.erase(it);
+    }
+  }
+
+  // Move forward to "tick", and append every key that was last touched before tick - lifespan to
+  // "expired" (they're removed from the wheel). Ticks can skip, but must never go backwards.
+  void Advance(uint64_t tick, std::vector<Key>& expired)
+  {
+    CHECK_GE(tick, now_) << "ExpirationWheel can't go back in time" << std::endl;
+
+    // The bucket for tick u holds the keys from u - (lifespan + 1), which expire at u. After a full
+    // turn of the wheel, every bucket has expired.
+    const uint64_t steps = std::min<uint64_t>(tick - now_, buckets_.size());
+    for (uint64_t u = tick - steps + 1; u <= tick; ++u) {
+      std::vector<Key>& bucket = buckets_.at(u % buckets_.size());
+      for (const Key& key : bucket) {
+        location_.erase(key);
+        expired.emplace_back(key);
+      }
+      bucket.clear();
+    }
+    now_ = tick;
+  }
+
+  void Clear()
+  {
+    for (std::vector<Key>& bucket : buckets_) {
+      bucket.clear();
+    }
+    location_.clear();
+    now_ = 0;
+  }
+
+ private:
+  struct Location final
+  {
+    size_t bucket;
+    size_t index;
+  };
+
+  Location Push(size_t b, const Key& key)
+  {
+    buckets_.at(b).emplace_back(key);
+    return Location{b, buckets_.at(b).size() - 1};
+  }
+
+  // Swap-and-pop the key out of its bucket, and fix the location of the one that moved.
+  void Erase(const Location& loc)
+  {
+    std::vector<Key>& bucket = buckets_.at(loc.bucket);
+    if (loc.index + 1 != bucket.size()) {
+      bucket.at(loc.index) = bucket.back();
+      location_.at(bucket.at(loc.index)).index = loc.index;
+    }
+    bucket.pop_back();
+  }
+
+ private:
+  std::vector<std::vector<Key>> buckets_;
+  std::unordered_map<Key, Location> location_;
+  uint64_t now_ = 0;
+};
+
+
+}
+}
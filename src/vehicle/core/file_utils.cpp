@@ -39,6 +39,14 @@ bool Exists(const std::string& fname)
 }
 
 
+std::time_t LastWriteTime(const std::string& fname)
+{
+  boost::system::error_code ec;
+  const std::time_t t = fs::last_write_time(fs::path(fname), ec);
+  return ec ? 0 : t;
+}
+
+
 bool mkdir(const std::string& folder, bool exist_ok)
 {
   if (!exist_ok && Exists(folder)) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <ctime>
 #include <string>
 #include <vector>
 
@@ -17,6 +18,10 @@ std::string Join(const std::string& a, const std::string& b);
 bool Exists(const std::string& fname);
 
 
+// Returns when a file was last modified (or 0 if it doesn't exist).
+std::time_t LastWriteTime(const std::string& fname);
+
+
 bool mkdir(const std::string& folder, bool exist_ok = true);
 
 
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cstdint>
+
+#include <glog/logging.h>
+
+#include "core/frame_arena.hpp"
+
+namespace bm {
+namespace core {
+
+
+FrameArena::FrameArena(size_t initial_bytes)
+{
+  CHECK_GT(initial_bytes, 0ul);
+  AddBlock(initial_bytes);
+}
+
+
+FrameArena::~FrameArena()
+{
+  for (const Block& block : blocks_) {
+    ::operator delete(block.data);
+  }
+}
+
+
+void FrameArena::AddBlock(size_t size)
+{
+  blocks_.emplace_back(Block{ static_cast<char*>(::operator new(size)), size });
+  ++num_heap_allocations_;
+}
+
+
+void* FrameArena::Allocate(size_t bytes, size_t alignment)
+{
+  CHECK(alignment > 0 && (alignment & (alignment - 1)) == 0) << "Alignment must be a power of two" << std::endl;
+  ++num_allocations_;
+
+  // Align the address (not just the offset), so that any alignment works.
+  const Block* block = &blocks_.back();
+  uintptr_t ptr = reinterpret_cast<uintptr_t>(block->data) + offset_;
+  size_t padding = (alignment - (ptr & (alignment - 1))) & (alignment - 1);
+
+  if (offset_ + padding + bytes > block->size) {
+    used_before_ += offset_;
+    AddBlock(std::max(2 * block->size, bytes + alignment));
+    offset_ = 0;
+    block = &blocks_.back();
+    ptr = reinterpret_cast<uintptr_t>(block->data);
+    padding = (alignment - (ptr & (alignment - 1))) & (alignment - 1);
+  }
+
+  offset_ += padding + bytes;
+  return reinterpret_cast<void*>(ptr + padding);
+}
+
+
+void FrameArena::Reset()
+{
+  // NOTE(milo): Merge the blocks, so that a frame this size fits in one block next time.
+  if (blocks_.size() > 1) {
+    const size_t total = Capacity();
+    for (const Block& block : blocks_) {
+      ::operator delete(block.data);
+    }
+    blocks_.clear();
+    AddBlock(total);
+  }
+
+  offset_ = 0;
+  used_before_ = 0;
+  num_allocations_ = 0;
+}
+
+
+size_t FrameArena::BytesUsed() const
+{
+  return used_before_ + offset_;
+}
+
+
+size_t FrameArena::Capacity() const
+{
+  size_t total = 0;
+  for (const Block& block : blocks_) {
+    total += block.size;
+  }
+  return total;
+}
+
+
+}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A monotonic (bump pointer) allocator for temporaries that only live for one frame. Allocate()
+// never frees, and Reset() throws away everything at once. If a frame needed more than one block,
+// Reset() merges them into a single block that's big enough for the whole frame, so once the arena
+// has seen the largest frame, it stops allocating from the heap.
+//
+// NOTE(milo): Not thread-safe. Anything allocated from the arena is invalid after Reset().
+class FrameArena final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(FrameArena)
+
+  explicit FrameArena(size_t initial_bytes = 64 * 1024);
+  ~FrameArena();
+
+  // Returns memory for "bytes" with the given alignment (a power of two).
+  void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+  // Frees everything that was allocated since the last Reset().
+  void Reset();
+
+  size_t NumAllocations() const { return num_allocations_; }        // Since the last Reset().
+  size_t NumHeapAllocations() const { return num_heap_allocations_; } // Blocks, since construction.
+  size_t BytesUsed() const;                                         // Since the last Reset().
+  size_t Capacity() const;
+
+ private:
+  struct Block final
+  {
+    char* data;
+    size_t size;
+  };
+
+  void AddBlock(size_t size);
+
+ private:
+  std::vector<Block> blocks_;
+  size_t offset_ = 0;         // Into the last block.
+  size_t used_before_ = 0;    // Bytes used in all blocks before the last one.
+
+  size_t num_allocations_ = 0;
+  size_t num_heap_allocations_ = 0;
+};
+
+
+// STL allocator that draws from a FrameArena. deallocate() is a no-op, so containers can grow (the
+// old storage is reclaimed at Reset()). A default-constructed allocator uses the heap instead, so
+// that arena containers can also be used outside of a frame.
+// NOTE(milo): Not final, since the STL containers derive from their allocator.
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  ArenaAllocator() = default;
+  ArenaAllocator(FrameArena& arena) : arena_(&arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(size_t n)
+  {
+    if (arena_ == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* p, size_t)
+  {
+    if (arena_ == nullptr) {
+      ::operator delete(p);
+    }
+  }
+
+  FrameArena* arena() const { return arena_; }
+
+ private:
+  FrameArena* arena_ = nullptr;
+};
+
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+  return a.arena() == b.arena();
+}
+
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+  return !(a == b);
+}
+
+
+// A vector that lives in a FrameArena, e.g ArenaVector<int> indices(arena);
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+}
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <list>
 #include <vector>
 
@@ -74,5 +75,141 @@ class GridLookup final {
   std::vector<std::vector<std::list<Scalar>>> grid_;
 };
 
+
+// A contiguous range of items in a PackedGridLookup.
+template <typename Scalar>
+class GridSpan final {
+ public:
+  GridSpan(const Scalar* begin, const Scalar* end) : begin_(begin), end_(end) {}
+
+  const Scalar* begin() const { return begin_; }
+  const Scalar* end() const { return end_; }
+  size_t size() const { return static_cast<size_t>(end_ - begin_); }
+  bool empty() const { return begin_ == end_; }
+
+ private:
+  const Scalar* begin_;
+  const Scalar* end_;
+};
+
+
+// Same lookup as GridLookup, but all of the items are stored in one array, sorted by cell (in
+// row-major order), with the offset of each cell's first item. Build() buckets every item at once
+// with a counting sort, and reuses the arrays from the previous Build(), so that filling and
+// querying the grid doesn't allocate once the arrays are big enough.
+template <typename Scalar>
+class PackedGridLookup final {
+ public:
+  PackedGridLookup(int rows, int cols)
+      : rows_(rows), cols_(cols), offsets_(rows * cols + 1, 0), cursor_(rows * cols, 0) {
+    assert(rows >= 1 && cols >= 1);
+  }
+
+  // Put items.at(i) in grid cell cells.at(i), replacing whatever was in the grid. For grid cells,
+  // 'y' is the row direction and 'x' is the column direction (like image).
+  void Build(const std::vector<Vector2i>& cells, const std::vector<Scalar>& items)
+  {
+    assert(cells.size() == items.size());
+    BuildImpl(cells, [&items](size_t i) { return items[i]; });
+  }
+
+  // Same as above, where the item in cell cells.at(i) is i.
+  void BuildIndices(const std::vector<Vector2i>& cells)
+  {
+    BuildImpl(cells, [](size_t i) { return static_cast<Scalar>(i); });
+  }
+
+  GridSpan<Scalar> GetCell(int row, int col) const
+  {
+    assert(row >= 0 && row < rows_ && col >= 0 && col < cols_);
+    const int c = row * cols_ + col;
+    return GridSpan<Scalar>(items_.data() + offsets_[c], items_.data() + offsets_[c + 1]);
+  }
+
+  // Calls visit(span) for each row of the roi. The cells in a row are next to each other in the
+  // array, so this is one span per row.
+  template <typename Visitor>
+  void ForEachRoiSpan(const core::Box2i& roi, const Visitor& visit) const
+  {
+    const Vector2i& cmin = roi.min();
+    const Vector2i& cmax = roi.max();
+    const int min_x = std::max(0, cmin.x());
+    const int max_x = std::min(cols_, cmax.x() + 1);
+    const int min_y = std::max(0, cmin.y());
+    const int max_y = std::min(rows_, cmax.y() + 1);
+
+    if (min_x >= max_x) {
+      return;
+    }
+
+    for (int row = min_y; row < max_y; ++row) {
+      const int start = offsets_[row * cols_ + min_x];
+      const int end = offsets_[row * cols_ + max_x];
+      if (start < end) {
+        visit(GridSpan<Scalar>(items_.data() + start, items_.data() + end));
+      }
+    }
+  }
+
+  // Calls visit(item) for every item within the roi.
+  template <typename Visitor>
+  void ForEachInRoi(const core::Box2i& roi, const Visitor& visit) const
+  {
+    ForEachRoiSpan(roi, [&visit](const GridSpan<Scalar>& span)
+    {
+      for (const Scalar& item : span) {
+        visit(item);
+      }
+    });
+  }
+
+  // Copies every item within the roi into out (which is cleared first, but keeps its capacity).
+  void GetRoi(const core::Box2i& roi, std::vector<Scalar>& out) const
+  {
+    out.clear();
+    ForEachRoiSpan(roi, [&out](const GridSpan<Scalar>& span)
+    {
+      out.insert(out.end(), span.begin(), span.end());
+    });
+  }
+
+  void Clear()
+  {
+    std::fill(offsets_.begin(), offsets_.end(), 0);
+    items_.clear();
+  }
+
+  size_t Size() const { return items_.size(); }
+  int Rows() const { return rows_; }
+  int Cols() const { return cols_; }
+
+ private:
+  template <typename ItemFunc>
+  void BuildImpl(const std::vector<Vector2i>& cells, const ItemFunc& item)
+  {
+    // Count the items in each cell, then offsets_[c] is the sum of the counts before c.
+    std::fill(offsets_.begin(), offsets_.end(), 0);
+    for (const Vector2i& cell : cells) {
+      assert(cell.y() >= 0 && cell.y() < rows_ && cell.x() >= 0 && cell.x() < cols_);
+      ++offsets_[cell.y() * cols_ + cell.x() + 1];
+    }
+    for (size_t c = 1; c < offsets_.size(); ++c) {
+      offsets_[c] += offsets_[c - 1];
+    }
+
+    // NOTE(milo): Items keep their input order within a cell.
+    std::copy(offsets_.begin(), offsets_.end() - 1, cursor_.begin());
+    items_.resize(cells.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+      items_[cursor_[cells[i].y() * cols_ + cells[i].x()]++] = item(i);
+    }
+  }
+
+  int rows_, cols_;
+  std::vector<int> offsets_;
+  std::vector<int> cursor_;
+  std::vector<Scalar> items_;
+};
+
 }
 }
@@ -25,5 +25,19 @@ struct ImuMeasurement final
 };
 
 
+// Linearly interpolate between two IMU measurements (see DataManager::Interpolate).
+inline ImuMeasurement InterpolateMeasurement(const ImuMeasurement& before,
+                                             const ImuMeasurement& after,
+                                             seconds_t timestamp)
+{
+  const seconds_t t0 = ConvertToSeconds(before.timestamp);
+  const seconds_t t1 = ConvertToSeconds(after.timestamp);
+  const double alpha = (t1 > t0) ? (timestamp - t0) / (t1 - t0) : 0.0;
+  return ImuMeasurement(ConvertToNanoseconds(timestamp),
+                        (1.0 - alpha) * before.w + alpha * after.w,
+                        (1.0 - alpha) * before.a + alpha * after.a);
+}
+
+
 }
 }
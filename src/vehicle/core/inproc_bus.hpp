@@ -0,0 +1,174 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "core/thread_safe_queue.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Passes messages between modules that run in the same process, so that they don't have to be
+// serialized (e.g to LCM) and deserialized again. Like LCM, messages are published on named topics,
+// and every subscriber to a topic gets every message. Messages are passed as shared pointers to
+// const, so all subscribers share one copy, and nothing is copied.
+//
+// By default, a subscriber's callback runs on the thread that publishes (so keep it fast!). A
+// subscriber can instead ask for its own queue and delivery thread, so that a slow callback never
+// holds up the publisher. If that queue fills up, the oldest message is dropped.
+//
+// NOTE(milo): Subscriptions last for the lifetime of the bus. All subscribers to a topic must use
+// the same message type as the publisher (this is checked on every publish).
+class InprocBus final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(InprocBus)
+  MACRO_DELETE_COPY_CONSTRUCTORS(InprocBus)
+
+  template <typename MessageType>
+  using Callback = std::function<void(const std::shared_ptr<const MessageType>&)>;
+
+  InprocBus() = default;
+
+  ~InprocBus() { Close(); }
+
+  // Stops all of the delivery threads (anything still queued is dropped). Call this before any
+  // subscriber that uses a queue is destroyed.
+  void Close()
+  {
+    // NOTE(milo): Not under the lock, since a callback that's running might be publishing.
+    std::vector<Subscription*> subs;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      for (auto& it : topics_) {
+        for (const std::unique_ptr<Subscription>& sub : it.second) {
+          subs.emplace_back(sub.get());
+        }
+      }
+    }
+    for (Subscription* sub : subs) {
+      sub->Stop();
+    }
+  }
+
+  // Call "callback" with every message published on "topic". If queue_size is zero, the callback
+  // runs on the publisher's thread. Otherwise, messages are delivered on a thread that belongs to
+  // this subscription, with up to queue_size of them waiting.
+  template <typename MessageType>
+  void Subscribe(const std::string& topic, const Callback<MessageType>& callback, size_t queue_size = 0)
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    topics_[topic].emplace_back(new TypedSubscription<MessageType>(topic, callback, queue_size));
+  }
+
+  template <typename MessageType>
+  void Publish(const std::string& topic, const std::shared_ptr<const MessageType>& msg)
+  {
+    // NOTE(milo): Copy the subscriber list, so that callbacks can publish or subscribe too without
+    // deadlocking. Subscriptions are never removed, so the pointers stay valid.
+    std::vector<Subscription*> subs;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      const auto it = topics_.find(topic);
+      if (it == topics_.end()) {
+        return;
+      }
+      for (const std::unique_ptr<Subscription>& sub : it->second) {
+        subs.emplace_back(sub.get());
+      }
+    }
+
+    for (Subscription* sub : subs) {
+      CHECK(sub->Type() == std::type_index(typeid(MessageType)))
+          << "Published " << typeid(MessageType).name() << " on topic " << topic
+          << ", but it was subscribed to with another type" << std::endl;
+      static_cast<TypedSubscription<MessageType>*>(sub)->Deliver(msg);
+    }
+  }
+
+  // Number of subscribers on a topic (e.g so that a publisher can skip building unwanted messages).
+  size_t NumSubscribers(const std::string& topic)
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const auto it = topics_.find(topic);
+    return (it == topics_.end()) ? 0 : it->second.size();
+  }
+
+ private:
+  class Subscription {
+   public:
+    virtual ~Subscription() = default;
+    virtual std::type_index Type() const = 0;
+    virtual void Stop() = 0;
+  };
+
+  template <typename MessageType>
+  class TypedSubscription final : public Subscription {
+   public:
+    typedef std::shared_ptr<const MessageType> MessagePtr;
+
+    TypedSubscription(const std::string& topic, const Callback<MessageType>& callback, size_t queue_size)
+        : callback_(callback),
+          queued_(queue_size > 0),
+          queue_(queued_ ? queue_size : 1, true, "inproc/" + topic)
+    {
+      if (queued_) {
+        thread_ = std::thread(&TypedSubscription::DeliveryWorker, this);
+      }
+    }
+
+    ~TypedSubscription() { Stop(); }
+
+    std::type_index Type() const override { return std::type_index(typeid(MessageType)); }
+
+    void Stop() override
+    {
+      queue_.Close();
+      if (thread_.joinable()) {
+        thread_.join();
+      }
+    }
+
+    void Deliver(const MessagePtr& msg)
+    {
+      if (queued_) {
+        queue_.Push(msg);
+      } else {
+        callback_(msg);
+      }
+    }
+
+   private:
+    void DeliveryWorker()
+    {
+      MessagePtr msg;
+      while (!queue_.IsClosed()) {
+        if (queue_.PopBlocking(msg)) {
+          callback_(msg);
+        }
+      }
+    }
+
+    Callback<MessageType> callback_;
+    bool queued_;
+    ThreadsafeQueue<MessagePtr> queue_;
+    std::thread thread_;
+  };
+
+  std::mutex lock_;
+  std::unordered_map<std::string, std::vector<std::unique_ptr<Subscription>>> topics_;
+};
+
+
+}
+}
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include <glog/logging.h>
+
+#include "core/landmark_map.hpp"
+
+namespace bm {
+namespace core {
+
+
+// NOTE(milo): Same packing as rrt::VoxelIndex (21 bits per axis), which covers +/- 1 million
+// voxels on each axis.
+static const int kVoxelCoordBits = 21;
+static const int kVoxelCoordOffset = 1 << (kVoxelCoordBits - 1);
+static const uint64_t kVoxelCoordMask = (1ul << kVoxelCoordBits) - 1;
+
+// The id lookup can hold this many ids per landmark (including aliases).
+static const size_t kMaxIdsPerLandmark = 4;
+
+
+static int VoxelCoord(double x, double voxel_size)
+{
+  return static_cast<int>(std::floor(x / voxel_size));
+}
+
+
+static uint64_t PackVoxelKey(int ix, int iy, int iz)
+{
+  const uint64_t x = static_cast<uint64_t>(ix + kVoxelCoordOffset) & kVoxelCoordMask;
+  const uint64_t y = static_cast<uint64_t>(iy + kVoxelCoordOffset) & kVoxelCoordMask;
+  const uint64_t z = static_cast<uint64_t>(iz + kVoxelCoordOffset) & kVoxelCoordMask;
+  return (x << (2 * kVoxelCoordBits)) | (y << kVoxelCoordBits) | z;
+}
+
+
+LandmarkMap::LandmarkMap(const Params& params)
+    : params_(params),
+      slots_(params.max_landmarks)
+{
+  CHECK_GT(params_.max_landmarks, 0ul) << "LandmarkMap needs max_landmarks > 0" << std::endl;
+  CHECK_GT(params_.voxel_size, 0) << "LandmarkMap needs voxel_size > 0" << std::endl;
+  CHECK_GT(params_.max_average_obs, 0);
+  CHECK(params_.evict_distance > 0 && params_.evict_age_sec > 0);
+
+  free_.reserve(params_.max_landmarks);
+  for (size_t i = params_.max_landmarks; i > 0; --i) {
+    free_.emplace_back(static_cast<SlotIndex>(i - 1));
+  }
+  ids_.reserve(kMaxIdsPerLandmark * params_.max_landmarks);
+  evict_scores_.reserve(params_.max_landmarks);
+}
+
+
+LandmarkMap::VoxelKey LandmarkMap::KeyOf(const Vector3d& t) const
+{
+  return PackVoxelKey(VoxelCoord(t.x(), params_.voxel_size),
+                      VoxelCoord(t.y(), params_.voxel_size),
+                      VoxelCoord(t.z(), params_.voxel_size));
+}
+
+
+bool LandmarkMap::FindSlot(uid_t lmk_id, SlotIndex& slot) const
+{
+  const auto it = ids_.find(lmk_id);
+  if (it == ids_.end() || slots_.at(it->second.slot).generation != it->second.generation) {
+    return false;
+  }
+  slot = it->second.slot;
+  return true;
+}
+
+
+bool LandmarkMap::FindNearest(const Vector3d& t_world_lmk, double radius, SlotIndex& slot) const
+{
+  const double vs = params_.voxel_size;
+  double best_sq = radius * radius;
+  bool found = false;
+
+  for (int ix = VoxelCoord(t_world_lmk.x() - radius, vs); ix <= VoxelCoord(t_world_lmk.x() + radius, vs); ++ix) {
+    for (int iy = VoxelCoord(t_world_lmk.y() - radius, vs); iy <= VoxelCoord(t_world_lmk.y() + radius, vs); ++iy) {
+      for (int iz = VoxelCoord(t_world_lmk.z() - radius, vs); iz <= VoxelCoord(t_world_lmk.z() + radius, vs); ++iz) {
+        const auto it = voxels_.find(PackVoxelKey(ix, iy, iz));
+        if (it == voxels_.end()) {
+          continue;
+        }
+        for (const SlotIndex s : it->second) {
+          const double d_sq = (slots_[s].t_world_lmk - t_world_lmk).squaredNorm();
+          if (d_sq <= best_sq) {
+            best_sq = d_sq;
+            slot = s;
+            found = true;
+          }
+        }
+      }
+    }
+  }
+
+  return found;
+}
+
+
+void LandmarkMap::AddToVoxel(VoxelKey key, SlotIndex slot)
+{
+  voxels_[key].emplace_back(slot);
+  slots_[slot].voxel = key;
+}
+
+
+void LandmarkMap::RemoveFromVoxel(VoxelKey key, SlotIndex slot)
+{
+  const auto it = voxels_.find(key);
+  CHECK(it != voxels_.end());
+
+  std::vector<SlotIndex>& v = it->second;
+  const auto s = std::find(v.begin(), v.end(), slot);
+  CHECK(s != v.end());
+  *s = v.back();
+  v.pop_back();
+
+  if (v.empty()) {
+    voxels_.erase(it);
+  }
+}
+
+
+void LandmarkMap::UpdateSlot(SlotIndex slot, const Vector3d& t_world_lmk, seconds_t timestamp)
+{
+  Slot& s = slots_[slot];
+
+  // Running average, but with the weight of the old position capped so that it keeps moving.
+  const double w = static_cast<double>(std::min(s.num_obs, static_cast<uint32_t>(params_.max_average_obs)));
+  s.t_world_lmk = (w * s.t_world_lmk + t_world_lmk) / (w + 1.0);
+  s.last_seen = std::max(s.last_seen, timestamp);
+  ++s.num_obs;
+
+  const VoxelKey key = KeyOf(s.t_world_lmk);
+  if (key != s.voxel) {
+    RemoveFromVoxel(s.voxel, slot);
+    AddToVoxel(key, slot);
+  }
+}
+
+
+LandmarkMap::SlotIndex LandmarkMap::NewSlot(uid_t lmk_id, const Vector3d& t_world_lmk, seconds_t timestamp)
+{
+  if (free_.empty()) {
+    Evict();
+  }
+  CHECK(!free_.empty());
+
+  const SlotIndex slot = free_.back();
+  free_.pop_back();
+
+  Slot& s = slots_[slot];
+  s.id = lmk_id;
+  s.t_world_lmk = t_world_lmk;
+  s.last_seen = timestamp;
+  s.num_obs = 1;
+  s.used = true;
+  AddToVoxel(KeyOf(t_world_lmk), slot);
+
+  return slot;
+}
+
+
+uid_t LandmarkMap::Update(uid_t lmk_id, const Vector3d& t_world_lmk, seconds_t timestamp)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  newest_ = std::max(newest_, timestamp);
+
+  SlotIndex slot;
+  if (FindSlot(lmk_id, slot)) {
+    UpdateSlot(slot, t_world_lmk, timestamp);
+    return slots_[slot].id;
+  }
+
+  if (params_.merge_radius > 0 && FindNearest(t_world_lmk, params_.merge_radius, slot)) {
+    UpdateSlot(slot, t_world_lmk, timestamp);
+    ++num_merged_;
+  } else {
+    slot = NewSlot(lmk_id, t_world_lmk, timestamp);
+  }
+
+  if (ids_.size() >= kMaxIdsPerLandmark * params_.max_landmarks) {
+    PruneIds();
+  }
+  ids_[lmk_id] = IdRef{slot, slots_[slot].generation};
+
+  return slots_[slot].id;
+}
+
+
+void LandmarkMap::Evict()
+{
+  const size_t num_evict = std::max(1ul, static_cast<size_t>(params_.evict_fraction * params_.max_landmarks));
+
+  evict_scores_.clear();
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    const Slot& s = slots_[i];
+    if (!s.used) {
+      continue;
+    }
+    const double score = (s.t_world_lmk - t_world_body_).norm() / params_.evict_distance +
+                         (newest_ - s.last_seen) / params_.evict_age_sec;
+    evict_scores_.emplace_back(score, static_cast<SlotIndex>(i));
+  }
+
+  const size_t n = std::min(num_evict, evict_scores_.size());
+  std::nth_element(evict_scores_.begin(), evict_scores_.begin() + n, evict_scores_.end(),
+      [](const std::pair<double, SlotIndex>& a, const std::pair<double, SlotIndex>& b)
+  {
+    return a.first > b.first;
+  });
+
+  for (size_t i = 0; i < n; ++i) {
+    const SlotIndex slot = evict_scores_[i].second;
+    Slot& s = slots_[slot];
+    RemoveFromVoxel(s.voxel, slot);
+    s.used = false;
+    ++s.generation;
+    free_.emplace_back(slot);
+  }
+
+  num_evicted_ += n;
+  PruneIds();
+}
+
+
+void LandmarkMap::PruneIds()
+{
+  // Forget ids of evicted landmarks, and if that isn't enough, aliases.
+  for (auto it = ids_.begin(); it != ids_.end();) {
+    const Slot& s = slots_[it->second.slot];
+    it = (s.generation != it->second.generation) ? ids_.erase(it) : std::next(it);
+  }
+
+  if (ids_.size() >= kMaxIdsPerLandmark * params_.max_landmarks) {
+    for (auto it = ids_.begin(); it != ids_.end();) {
+      it = (slots_[it->second.slot].id != it->first) ? ids_.erase(it) : std::next(it);
+    }
+  }
+}
+
+
+void LandmarkMap::SetVehiclePosition(const Vector3d& t_world_body)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  t_world_body_ = t_world_body;
+}
+
+
+bool LandmarkMap::Get(uid_t lmk_id, Vector3d& t_world_lmk) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  SlotIndex slot;
+  if (!FindSlot(lmk_id, slot)) {
+    return false;
+  }
+  t_world_lmk = slots_[slot].t_world_lmk;
+  return true;
+}
+
+
+size_t LandmarkMap::RadiusQuery(const Vector3d& center,
+                                double radius,
+                                std::vector<uid_t>* lmk_ids,
+                                std::vector<Vector3d>* t_world_lmks) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const double r_sq = radius * radius;
+  size_t num_found = 0;
+
+  const auto check_voxel = [&](const std::vector<SlotIndex>& voxel)
+  {
+    for (const SlotIndex slot : voxel) {
+      const Slot& s = slots_[slot];
+      if ((s.t_world_lmk - center).squaredNorm() <= r_sq) {
+        if (lmk_ids) { lmk_ids->emplace_back(s.id); }
+        if (t_world_lmks) { t_world_lmks->emplace_back(s.t_world_lmk); }
+        ++num_found;
+      }
+    }
+  };
+
+  const double vs = params_.voxel_size;
+  const int x0 = VoxelCoord(center.x() - radius, vs), x1 = VoxelCoord(center.x() + radius, vs);
+  const int y0 = VoxelCoord(center.y() - radius, vs), y1 = VoxelCoord(center.y() + radius, vs);
+  const int z0 = VoxelCoord(center.z() - radius, vs), z1 = VoxelCoord(center.z() + radius, vs);
+  const double num_voxels = (x1 - x0 + 1.0) * (y1 - y0 + 1.0) * (z1 - z0 + 1.0);
+
+  // NOTE(milo): For big queries (e.g the visualizer getting everything), it's faster to just look
+  // at every voxel that has something in it.
+  if (num_voxels > static_cast<double>(voxels_.size())) {
+    for (const auto& it : voxels_) {
+      check_voxel(it.second);
+    }
+    return num_found;
+  }
+
+  for (int ix = x0; ix <= x1; ++ix) {
+    for (int iy = y0; iy <= y1; ++iy) {
+      for (int iz = z0; iz <= z1; ++iz) {
+        const auto it = voxels_.find(PackVoxelKey(ix, iy, iz));
+        if (it != voxels_.end()) {
+          check_voxel(it->second);
+        }
+      }
+    }
+  }
+
+  return num_found;
+}
+
+
+void LandmarkMap::Clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.clear();
+  for (size_t i = slots_.size(); i > 0; --i) {
+    Slot& s = slots_[i - 1];
+    if (s.used) {
+      s.used = false;
+      ++s.generation;
+    }
+    free_.emplace_back(static_cast<SlotIndex>(i - 1));
+  }
+  ids_.clear();
+  voxels_.clear();
+  newest_ = 0;
+}
+
+
+size_t LandmarkMap::Size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return slots_.size() - free_.size();
+}
+
+
+size_t LandmarkMap::MemoryBytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // NOTE(milo): Roughly one pointer per bucket, and a node (with a next pointer) per entry.
+  size_t bytes = slots_.capacity() * sizeof(Slot) +
+                 free_.capacity() * sizeof(SlotIndex) +
+                 evict_scores_.capacity() * sizeof(std::pair<double, SlotIndex>);
+  bytes += ids_.bucket_count() * sizeof(void*) + ids_.size() * (sizeof(void*) + sizeof(uid_t) + sizeof(IdRef));
+  bytes += voxels_.bucket_count() * sizeof(void*);
+  for (const auto& it : voxels_) {
+    bytes += sizeof(void*) + sizeof(VoxelKey) + sizeof(std::vector<SlotIndex>) +
+             it.second.capacity() * sizeof(SlotIndex);
+  }
+  return bytes;
+}
+
+
+size_t LandmarkMap::NumMerged() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_merged_;
+}
+
+
+size_t LandmarkMap::NumEvicted() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_evicted_;
+}
+
+
+}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A world-frame map of landmark positions for long missions, with a hard limit on its size. The
+// visualizer, relocalization and the local planner can all share one of these, instead of each
+// keeping an unbounded map of every landmark ever seen.
+//
+// Landmarks are hashed into voxels, so radius queries only look at the voxels around the center.
+// A landmark that shows up within merge_radius of one that's already in the map (e.g the same
+// structure, re-triangulated with a new id after the tracker lost it) is merged into it, and its id
+// becomes an alias for the existing one. Positions are a running average over the last few updates
+// (max_average_obs), so they still follow the smoother as it refines them.
+//
+// When the map is full, the landmarks that are far away from the vehicle and haven't been seen in
+// a while are evicted (a batch at a time, so that evicting is amortized O(1) per Update()).
+//
+// NOTE(milo): All of the memory for landmarks is allocated up front. The id lookup holds at most
+// 4 * max_landmarks ids (aliases are forgotten first, since they're just a shortcut for merging),
+// so the map never grows past about MemoryBytes() at capacity. Thread-safe.
+class LandmarkMap final {
+ public:
+  struct Params final
+  {
+    size_t max_landmarks = 100000;
+    double voxel_size = 1.0;            // Make this about the size of a typical radius query.
+    double merge_radius = 0.05;         // Landmarks closer than this are the same one.
+    int max_average_obs = 10;           // Average the position over (about) this many updates.
+
+    // Eviction score = distance from the vehicle / evict_distance + age / evict_age_sec.
+    double evict_distance = 20.0;
+    double evict_age_sec = 60.0;
+    double evict_fraction = 0.05;       // Evict this fraction of max_landmarks when full.
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(LandmarkMap)
+
+  explicit LandmarkMap(const Params& params);
+
+  // Add a landmark (or update its position). Returns the id that it's stored under: lmk_id, or the
+  // id of the landmark that it was merged into.
+  uid_t Update(uid_t lmk_id, const Vector3d& t_world_lmk, seconds_t timestamp);
+
+  // Tell the map where the vehicle is (for eviction).
+  void SetVehiclePosition(const Vector3d& t_world_body);
+
+  // Get the position of a landmark (or the one it was merged into). Returns false if it isn't in
+  // the map (never added, or evicted).
+  bool Get(uid_t lmk_id, Vector3d& t_world_lmk) const;
+
+  // Get all of the landmarks within radius of center. Either output can be null. Returns the number
+  // of landmarks that were found.
+  size_t RadiusQuery(const Vector3d& center,
+                     double radius,
+                     std::vector<uid_t>* lmk_ids,
+                     std::vector<Vector3d>* t_world_lmks) const;
+
+  void Clear();
+
+  size_t Size() const;
+  size_t Capacity() const { return params_.max_landmarks; }
+  size_t MemoryBytes() const;
+
+  size_t NumMerged() const;       // Total number of landmarks that were merged into another one.
+  size_t NumEvicted() const;
+
+ private:
+  typedef uint64_t VoxelKey;
+  typedef uint32_t SlotIndex;
+
+  struct Slot final
+  {
+    uid_t id = 0;                   // The id of the landmark that was added first.
+    Vector3d t_world_lmk = Vector3d::Zero();
+    seconds_t last_seen = 0;
+    uint32_t num_obs = 0;
+    uint32_t generation = 0;        // Incremented when evicted, so that stale ids can be detected.
+    VoxelKey voxel = 0;
+    bool used = false;
+  };
+
+  struct IdRef final
+  {
+    SlotIndex slot;
+    uint32_t generation;
+  };
+
+  VoxelKey KeyOf(const Vector3d& t) const;
+
+  // All of these assume that the lock is held.
+  bool FindSlot(uid_t lmk_id, SlotIndex& slot) const;
+  bool FindNearest(const Vector3d& t_world_lmk, double radius, SlotIndex& slot) const;
+  void UpdateSlot(SlotIndex slot, const Vector3d& t_world_lmk, seconds_t timestamp);
+  SlotIndex NewSlot(uid_t lmk_id, const Vector3d& t_world_lmk, seconds_t timestamp);
+  void AddToVoxel(VoxelKey key, SlotIndex slot);
+  void RemoveFromVoxel(VoxelKey key, SlotIndex slot);
+  void Evict();
+  void PruneIds();
+
+  Params params_;
+
+  mutable std::mutex mutex_;
+  std::vector<Slot> slots_;
+  std::vector<SlotIndex> free_;
+  std::unordered_map<uid_t, IdRef> ids_;
+  std::unordered_map<VoxelKey, std::vector<SlotIndex>> voxels_;
+
+  std::vector<std::pair<double, SlotIndex>> evict_scores_;   // Reused by Evict().
+
+  Vector3d t_world_body_ = Vector3d::Zero();
+  seconds_t newest_ = 0;
+  size_t num_merged_ = 0;
+  size_t num_evicted_ = 0;
+};
+
+
+}
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "core/latency_histogram.hpp"
+
+namespace bm {
+namespace core {
+
+
+constexpr int LatencyHistogram::kSubBucketBits;
+constexpr int LatencyHistogram::kSubBucketCount;
+constexpr int LatencyHistogram::kSubBucketHalf;
+constexpr int LatencyHistogram::kNumBuckets;
+
+
+LatencyHistogram::LatencyHistogram(double resolution)
+    : resolution_(resolution)
+{
+  Reset();
+}
+
+
+void LatencyHistogram::Reset()
+{
+  for (std::atomic<uint64_t>& b : buckets_) {
+    b.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+
+int LatencyHistogram::BucketIndex(uint64_t v)
+{
+  if (v < static_cast<uint64_t>(kSubBucketCount)) {
+    return static_cast<int>(v);
+  }
+
+  // Shift the value so that its top kSubBucketBits bits are kept.
+  const int msb = 63 - __builtin_clzll(v);
+  const int shift = msb - kSubBucketBits + 1;
+  const int mantissa = static_cast<int>(v >> shift);  // In [kSubBucketHalf, kSubBucketCount).
+  return kSubBucketCount + (shift - 1) * kSubBucketHalf + (mantissa - kSubBucketHalf);
+}
+
+
+uint64_t LatencyHistogram::BucketMidpoint(int index)
+{
+  if (index < kSubBucketCount) {
+    return static_cast<uint64_t>(index);
+  }
+  const int shift = (index - kSubBucketCount) / kSubBucketHalf + 1;
+  const uint64_t mantissa = static_cast<uint64_t>((index - kSubBucketCount) % kSubBucketHalf + kSubBucketHalf);
+  const uint64_t lower = mantissa << shift;
+  return lower + ((1ull << shift) >> 1);
+}
+
+
+void LatencyHistogram::Record(double value)
+{
+  const double scaled = std::max(0.0, value / resolution_);
+  const uint64_t v = (scaled >= 1.8e19) ? std::numeric_limits<uint64_t>::max() :
+                                          static_cast<uint64_t>(std::llround(scaled));
+
+  buckets_.at(BucketIndex(v)).fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(v, std::memory_order_relaxed);
+
+  uint64_t prev_min = min_.load(std::memory_order_relaxed);
+  while (v < prev_min && !min_.compare_exchange_weak(prev_min, v, std::memory_order_relaxed)) {}
+  uint64_t prev_max = max_.load(std::memory_order_relaxed);
+  while (v > prev_max && !max_.compare_exchange_weak(prev_max, v, std::memory_order_relaxed)) {}
+}
+
+
+double LatencyHistogram::Percentile(double q) const
+{
+  const uint64_t count = Count();
+  if (count == 0) {
+    return 0;
+  }
+
+  // The sample with this (1-based) rank has the requested quantile.
+  const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::min(1.0, std::max(0.0, q)) * count)));
+
+  uint64_t cumulative = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    cumulative += buckets_.at(i).load(std::memory_order_relaxed);
+    if (cumulative >= rank) {
+      // Don't report anything outside of the observed range.
+      const uint64_t v = std::min(std::max(BucketMidpoint(i), min_.load()), max_.load());
+      return resolution_ * static_cast<double>(v);
+    }
+  }
+
+  return Max();
+}
+
+
+double LatencyHistogram::Min() const
+{
+  return (Count() == 0) ? 0 : resolution_ * static_cast<double>(min_.load(std::memory_order_relaxed));
+}
+
+
+double LatencyHistogram::Max() const
+{
+  return resolution_ * static_cast<double>(max_.load(std::memory_order_relaxed));
+}
+
+
+double LatencyHistogram::Mean() const
+{
+  const uint64_t count = Count();
+  return (count == 0) ? 0 : resolution_ * static_cast<double>(sum_.load()) / static_cast<double>(count);
+}
+
+
+}
+}
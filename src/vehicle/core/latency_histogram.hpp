@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A fixed-memory, HDR-style histogram for latencies (or any other nonnegative value). Values are
+// bucketed with about 3% relative error over the full uint64 range, so percentiles are accurate
+// without storing samples. Record() is lock-free and can be called from any number of threads.
+class LatencyHistogram final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(LatencyHistogram)
+
+  // Values are quantized to multiples of "resolution" (e.g 1e-3 for microseconds when recording ms).
+  explicit LatencyHistogram(double resolution = 1e-3);
+
+  // Add a sample. Negative values are clamped to zero.
+  void Record(double value);
+
+  // Value at quantile q (in [0, 1]), e.g 0.99 for p99. Returns 0 if there are no samples.
+  double Percentile(double q) const;
+
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+  double Min() const;
+  double Max() const;
+  double Mean() const;
+
+  // Forget all samples.
+  void Reset();
+
+ private:
+  // Values below 2^kSubBucketBits get their own bucket. Above that, each power of two is split
+  // into 2^(kSubBucketBits-1) equally sized buckets.
+  static constexpr int kSubBucketBits = 5;
+  static constexpr int kSubBucketCount = 1 << kSubBucketBits;
+  static constexpr int kSubBucketHalf = kSubBucketCount / 2;
+  static constexpr int kNumBuckets = kSubBucketCount + (64 - kSubBucketBits) * kSubBucketHalf;
+
+  static int BucketIndex(uint64_t v);
+  static uint64_t BucketMidpoint(int index);
+
+ private:
+  double resolution_;
+  std::array<std::atomic<uint64_t>, kNumBuckets> buckets_;
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> min_;
+  std::atomic<uint64_t> max_{0};
+};
+
+
+}
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+
+#include <glog/logging.h>
+
+#include "core/latency_trace.hpp"
+
+namespace bm {
+namespace core {
+
+
+int64_t WallTimeUtime()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+LatencyTracer::LatencyTracer(size_t max_open, timestamp_t match_tolerance_ns)
+    : max_open_(max_open), match_tolerance_ns_(match_tolerance_ns)
+{
+  CHECK_GT(max_open, 0ul) << "Need to keep at least one trace open" << std::endl;
+}
+
+
+void LatencyTracer::Begin(timestamp_t timestamp, uid_t seq, const std::string& stage, int64_t utime)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+
+  LatencyTrace& trace = open_[timestamp];
+  trace.timestamp = timestamp;
+  trace.seq = seq;
+  trace.stages.clear();
+  trace.stages.emplace_back(stage, utime);
+
+  while (open_.size() > max_open_) {
+    open_.erase(open_.begin());
+  }
+}
+
+
+bool LatencyTracer::Stamp(timestamp_t timestamp, const std::string& stage, int64_t utime)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  const auto it = Find(timestamp);
+  if (it == open_.end()) {
+    return false;
+  }
+  it->second.stages.emplace_back(stage, utime);
+  return true;
+}
+
+
+bool LatencyTracer::Finish(timestamp_t timestamp, const std::string& stage, LatencyTrace& trace, int64_t utime)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  const auto it = Find(timestamp);
+  if (it == open_.end()) {
+    return false;
+  }
+  trace = std::move(it->second);
+  trace.stages.emplace_back(stage, utime);
+  open_.erase(it);
+  return true;
+}
+
+
+size_t LatencyTracer::NumOpen() const
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  return open_.size();
+}
+
+
+std::map<timestamp_t, LatencyTrace>::iterator LatencyTracer::Find(timestamp_t timestamp)
+{
+  // The closest open timestamp at or after (timestamp - tolerance).
+  const timestamp_t lower = (timestamp > match_tolerance_ns_) ? (timestamp - match_tolerance_ns_) : 0;
+  const auto it = open_.lower_bound(lower);
+  if (it == open_.end() || it->first > timestamp + match_tolerance_ns_) {
+    return open_.end();
+  }
+  return it;
+}
+
+
+}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Wall time in microseconds since the epoch (the same clock as lcm::ReceiveBuffer::recv_utime).
+int64_t WallTimeUtime();
+
+
+// The wall times at which one frame reached each stage of the pipeline, in order.
+struct LatencyTrace final
+{
+  timestamp_t timestamp = 0;    // Of the frame (e.g the camera timestamp).
+  uid_t seq = 0;
+  std::vector<std::pair<std::string, int64_t>> stages;   // (stage, utime)
+};
+
+
+// Follows frames through a pipeline that runs on several threads (e.g LCM receive -> decode ->
+// frontend -> smoother -> publish), so that per-stage latency can be measured end to end. The first
+// stage opens a trace for a frame, later stages stamp it, and the last one takes it out.
+//
+// Frames are looked up by timestamp, allowing for the rounding of a timestamp that went through
+// seconds_t. Not every frame reaches the last stage (e.g only keyframes go to the smoother), so only
+// the newest max_open traces are kept, and older ones are dropped.
+//
+// NOTE(milo): Threadsafe. Every call takes a lock, so only stamp a few stages per frame.
+class LatencyTracer final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(LatencyTracer)
+  MACRO_DELETE_COPY_CONSTRUCTORS(LatencyTracer)
+
+  explicit LatencyTracer(size_t max_open = 64, timestamp_t match_tolerance_ns = 1000);
+
+  // Open a trace for a frame, starting at "stage" (at wall time utime).
+  void Begin(timestamp_t timestamp, uid_t seq, const std::string& stage, int64_t utime);
+
+  // Stamp a frame that's already open (otherwise nothing happens). Returns whether it was open.
+  bool Stamp(timestamp_t timestamp, const std::string& stage, int64_t utime = WallTimeUtime());
+
+  // Stamp the last stage of a frame and take its trace out. Returns false if it wasn't open.
+  bool Finish(timestamp_t timestamp, const std::string& stage, LatencyTrace& trace, int64_t utime = WallTimeUtime());
+
+  size_t NumOpen() const;
+
+ private:
+  // Must hold lock_. Returns open_.end() if there's no trace for the timestamp.
+  std::map<timestamp_t, LatencyTrace>::iterator Find(timestamp_t timestamp);
+
+  size_t max_open_;
+  timestamp_t match_tolerance_ns_;
+
+  mutable std::mutex lock_;
+  std::map<timestamp_t, LatencyTrace> open_;
+};
+
+
+}
+}
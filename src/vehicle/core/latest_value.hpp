@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "core/macros.hpp"
+#include "core/notifier.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A lock-free "mailbox" that holds the newest value from exactly ONE producer thread for exactly
+// ONE consumer thread (a triple buffer). Writing never blocks or waits for the consumer, so a slow
+// consumer only ever misses intermediate values, and always gets the latest one.
+//
+// The producer owns one slot, the consumer owns another, and the third is swapped between them
+// through an atomic index. The "dirty" bit tells the consumer that the middle slot has a value that
+// it hasn't read yet.
+//
+// NOTE(milo): Write() must only be called from the producer thread, and Read()/WaitAndRead() must
+// only be called from the consumer thread! HasNew() can be called from anywhere.
+template <typename T>
+class LatestValue final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(LatestValue)
+
+  LatestValue() = default;
+
+  // Publish a new value, overwriting any value that hasn't been read yet.
+  void Write(const T& value)
+  {
+    slots_[write_idx_] = value;
+    const uint8_t prev = middle_.exchange(write_idx_ | kDirty, std::memory_order_acq_rel);
+    write_idx_ = prev & kIndexMask;
+    notifier_.Notify();
+  }
+
+  // Returns true if a value was written since the last Read().
+  bool HasNew() const { return middle_.load(std::memory_order_acquire) & kDirty; }
+
+  // If there is a new value, copies it into "value" and returns true. Otherwise returns false.
+  bool Read(T& value)
+  {
+    if (!HasNew()) {
+      return false;
+    }
+    const uint8_t prev = middle_.exchange(read_idx_, std::memory_order_acq_rel);
+    read_idx_ = prev & kIndexMask;
+    value = slots_[read_idx_];
+    return true;
+  }
+
+  // Blocks until there is a new value (or timeout_sec elapses), then reads it. A negative timeout
+  // waits forever. Returns false if no new value arrived.
+  bool WaitAndRead(T& value, double timeout_sec = -1)
+  {
+    notifier_.Wait([this]() { return HasNew(); }, timeout_sec);
+    return Read(value);
+  }
+
+ private:
+  static constexpr uint8_t kDirty = 0x4;
+  static constexpr uint8_t kIndexMask = 0x3;
+
+  T slots_[3];
+  uint8_t write_idx_ = 0;               // Only touched by the producer.
+  uint8_t read_idx_ = 1;                // Only touched by the consumer.
+  std::atomic<uint8_t> middle_{2};      // Index of the shared slot, plus the dirty bit.
+
+  Notifier notifier_;
+};
+
+
+}
+}
@@ -0,0 +1,72 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core/mapped_file.hpp"
+
+namespace bm {
+namespace core {
+
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+
+bool MappedFile::Open(const std::string& path)
+{
+  Close();
+
+  fd_ = ::open(path.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (::fstat(fd_, &st) != 0) {
+    Close();
+    return false;
+  }
+
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ == 0) {
+    return true;
+  }
+
+  void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (mapped == MAP_FAILED) {
+    Close();
+    return false;
+  }
+  data_ = static_cast<const uint8_t*>(mapped);
+
+  return true;
+}
+
+
+void MappedFile::Close()
+{
+  if (data_ != nullptr) {
+    ::munmap(const_cast<uint8_t*>(data_), size_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+  fd_ = -1;
+  data_ = nullptr;
+  size_ = 0;
+}
+
+
+void MappedFile::AdviseSequential() const
+{
+  if (data_ != nullptr) {
+    ::madvise(const_cast<uint8_t*>(data_), size_, MADV_SEQUENTIAL);
+  }
+}
+
+
+}
+}
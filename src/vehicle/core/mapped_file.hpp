@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A read-only memory mapping of a whole file, which is unmapped on destruction.
+class MappedFile final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(MappedFile);
+  MACRO_DELETE_COPY_CONSTRUCTORS(MappedFile);
+
+  MappedFile() = default;
+  ~MappedFile();
+
+  // Returns false if the file can't be opened or mapped. An empty file maps to (nullptr, 0).
+  bool Open(const std::string& path);
+
+  void Close();
+
+  // Hint that the whole file will be read front to back (see madvise).
+  void AdviseSequential() const;
+
+  const uint8_t* Data() const { return data_; }
+  size_t Size() const { return size_; }
+  bool IsOpen() const { return fd_ >= 0; }
+
+ private:
+  int fd_ = -1;
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+
+}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Lets threads sleep until some condition (e.g "queue is nonempty") becomes true, without polling.
+// Whoever changes the condition calls Notify(). If no one is waiting, Notify() doesn't take a lock,
+// so it's cheap enough to call on every push/pop of a lock-free queue.
+class Notifier final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(Notifier)
+
+  Notifier() = default;
+
+  // Wake up all threads blocked in Wait() so that they re-check their condition.
+  void Notify()
+  {
+    // Pairs with the fence in Wait(): either we see the waiter, or the waiter sees our change.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_waiters_.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cv_.notify_all();
+    }
+  }
+
+  // Block until pred() returns true, or timeout_sec elapses. A negative timeout waits forever.
+  // Returns the final value of pred().
+  template <typename Predicate>
+  bool Wait(Predicate pred, double timeout_sec = -1)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_waiters_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    bool result = true;
+    if (timeout_sec < 0) {
+      cv_.wait(lock, pred);
+    } else {
+      result = cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec), pred);
+    }
+
+    num_waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return result;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<int> num_waiters_{0};
+};
+
+
+}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+// NOTE(milo): Header-only, so that CUDA kernels draw from the same generator as the host code.
+#ifdef __CUDACC__
+#define BM_HOST_DEVICE __host__ __device__ __forceinline__
+#else
+#define BM_HOST_DEVICE inline
+#endif
+
+namespace bm {
+namespace core {
+
+
+// Philox4x32-10 from "Parallel Random Numbers: As Easy as 1, 2, 3" (Salmon et al, 2011).
+// https://www.thesalmons.org/john/random123/papers/random123sc11.pdf
+//
+// A counter-based generator: the 4 outputs are a pure function of a 128-bit counter and a 64-bit
+// key, so there is no state to share (or race on). Every thread, pixel or sample can compute its
+// own numbers from (seed, index), and gets the same ones no matter how the work is split up.
+struct Philox4x32 final
+{
+  uint32_t v[4];
+
+  BM_HOST_DEVICE Philox4x32(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1)
+  {
+    v[0] = c0; v[1] = c1; v[2] = c2; v[3] = c3;
+    for (int r = 0; r < 10; ++r) {
+      uint32_t hi0, lo0, hi1, lo1;
+      MulHiLo(0xD2511F53u, v[0], hi0, lo0);
+      MulHiLo(0xCD9E8D57u, v[2], hi1, lo1);
+      const uint32_t x0 = hi1 ^ v[1] ^ k0;
+      const uint32_t x2 = hi0 ^ v[3] ^ k1;
+      v[0] = x0; v[1] = lo1; v[2] = x2; v[3] = lo0;
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+  }
+
+  BM_HOST_DEVICE static void MulHiLo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo)
+  {
+#ifdef __CUDA_ARCH__
+    hi = __umulhi(a, b);
+    lo = a * b;
+#else
+    const uint64_t p = static_cast<uint64_t>(a) * b;
+    hi = static_cast<uint32_t>(p >> 32);
+    lo = static_cast<uint32_t>(p);
+#endif
+  }
+};
+
+
+// Maps 32 random bits to a float in [0, 1). Only the top 24 bits are used, so every output is
+// exactly representable (and 1 can't come out from rounding).
+BM_HOST_DEVICE float UintToUnitFloat(uint32_t x)
+{
+  return static_cast<float>(x >> 8) * (1.0f / 16777216.0f);
+}
+
+
+// Maps 64 random bits to a double in [0, 1), using the top 53 bits.
+BM_HOST_DEVICE double UintsToUnitDouble(uint32_t hi, uint32_t lo)
+{
+  const uint64_t x = (static_cast<uint64_t>(hi) << 32) | lo;
+  return static_cast<double>(x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+}
+}
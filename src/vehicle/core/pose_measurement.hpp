@@ -0,0 +1,26 @@
+#pragma once
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace core {
+
+
+// An absolute measurement of the body pose in the world (e.g from seeing a fiducial tag with a
+// known pose). The sigmas are for rotation (rad) then translation (m), the same order as Pose3.
+struct PoseMeasurement final {
+  MACRO_SHARED_POINTER_TYPEDEFS(PoseMeasurement)
+
+  PoseMeasurement(timestamp_t timestamp, const Matrix4d& world_T_body, const Vector6d& sigmas)
+      : timestamp(timestamp), world_T_body(world_T_body), sigmas(sigmas) {}
+
+  timestamp_t timestamp;
+  Matrix4d world_T_body;
+  Vector6d sigmas;
+};
+
+
+}
+}
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <chrono>
+
+#include <glog/logging.h>
+
+#include "core/publish_scheduler.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Throughput is measured over windows this long.
+static const double kMeasureWindowSec = 1.0;
+
+// After a failed publish, wait this long before probing for more capacity.
+static const double kProbeHoldoffSec = 1.0;
+
+
+static seconds_t WallTime()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+PublishScheduler::PublishScheduler(const Params& params)
+    : params_(params)
+{
+  CHECK_GE(params_.link_max_bytes_per_sec, 0) << "Link capacity can't be negative" << std::endl;
+  CHECK_GT(params_.poll_hz, 0) << "Must poll at poll_hz > 0" << std::endl;
+  capacity_ = params_.link_max_bytes_per_sec;
+  tokens_ = capacity_ * params_.burst_sec;
+}
+
+
+PublishScheduler::~PublishScheduler()
+{
+  Stop();
+}
+
+
+PublishScheduler::ChannelId PublishScheduler::AddChannel(const std::string& name,
+                                                         PublishPriority priority,
+                                                         double max_hz,
+                                                         double min_hz,
+                                                         const PublishFunction& publish)
+{
+  CHECK(!thread_.joinable()) << "Add channels before calling Start()" << std::endl;
+  CHECK_GE(max_hz, 0) << "Channel " << name << " needs max_hz >= 0" << std::endl;
+  CHECK_LE(min_hz, max_hz) << "Channel " << name << " needs min_hz <= max_hz" << std::endl;
+
+  std::unique_ptr<Channel> ch(new Channel());
+  ch->name = name;
+  ch->priority = priority;
+  ch->max_hz = max_hz;
+  ch->min_hz = (min_hz > 0) ? min_hz : max_hz;
+  ch->fixed_rate = (min_hz <= 0);
+  ch->publish = publish;
+  ch->current_hz = max_hz;
+
+  // Keep the order that channels were added in, within each priority.
+  const auto it = std::upper_bound(by_priority_.begin(), by_priority_.end(), priority,
+      [](PublishPriority p, const Channel* other) { return p < other->priority; });
+  by_priority_.insert(it, ch.get());
+
+  channels_.emplace_back(std::move(ch));
+  return static_cast<ChannelId>(channels_.size() - 1);
+}
+
+
+void PublishScheduler::MarkPending(ChannelId id)
+{
+  Channel& ch = *channels_.at(id);
+  ch.pending.store(true, std::memory_order_release);
+  if (ch.priority == PublishPriority::CRITICAL) {
+    urgent_ = true;
+    notifier_.Notify();
+  }
+}
+
+
+void PublishScheduler::SetMaxHz(ChannelId id, double max_hz)
+{
+  Channel& ch = *channels_.at(id);
+  CHECK_GE(max_hz, 0) << "Channel " << ch.name << " needs max_hz >= 0" << std::endl;
+
+  if (ch.fixed_rate || ch.min_hz.load() > max_hz) {
+    ch.min_hz = max_hz;
+  }
+  ch.max_hz = max_hz;
+  ch.current_hz = max_hz;
+}
+
+
+double PublishScheduler::ChannelHz(ChannelId id) const
+{
+  return channels_.at(id)->current_hz.load();
+}
+
+
+bool PublishScheduler::IsDue(const Channel& ch, seconds_t now) const
+{
+  const double hz = ch.current_hz.load(std::memory_order_relaxed);
+  return !ch.sent_once || hz <= 0 || (now - ch.last_sent) >= (1.0 / hz);
+}
+
+
+void PublishScheduler::UpdateBudget(seconds_t now)
+{
+  const double dt = polled_once_ ? std::max(0.0, now - last_poll_) : 0.0;
+  polled_once_ = true;
+  last_poll_ = now;
+
+  if (now - window_start_ >= kMeasureWindowSec) {
+    measured_ = window_bytes_ / (now - window_start_);
+    window_start_ = now;
+    window_bytes_ = 0;
+  }
+
+  double capacity = capacity_.load();
+  if (capacity <= 0) {
+    return;   // Unlimited.
+  }
+
+  // Probe for more capacity while publishing succeeds, up to the configured limit (if any).
+  if (now - last_failure_ >= kProbeHoldoffSec) {
+    capacity *= (1.0 + params_.probe_rate * dt);
+    if (params_.link_max_bytes_per_sec > 0) {
+      capacity = std::min(capacity, params_.link_max_bytes_per_sec);
+    }
+    capacity_ = capacity;
+  }
+
+  tokens_ = std::min(tokens_ + capacity * dt, capacity * params_.burst_sec);
+}
+
+
+void PublishScheduler::OnPublishFailed(seconds_t now)
+{
+  // Assume the link can carry about half of what got through recently.
+  const double measured = measured_.load();
+  const double current = capacity_.load();
+  const double base = (current > 0 && (measured <= 0 || current < measured)) ? current : measured;
+  const double estimate = std::max(params_.link_min_bytes_per_sec, 0.5 * base);
+
+  LOG_EVERY_N(WARNING, 20) << "Publishing failed, link capacity estimate is now " << estimate << " bytes/sec" << std::endl;
+
+  capacity_ = estimate;
+  tokens_ = std::min(tokens_, 0.0);
+  last_failure_ = now;
+}
+
+
+int PublishScheduler::Poll(seconds_t now)
+{
+  UpdateBudget(now);
+
+  int num_published = 0;
+
+  for (Channel* ch : by_priority_) {
+    if (!ch->pending.load(std::memory_order_acquire) || !IsDue(*ch, now)) {
+      continue;
+    }
+
+    const bool limited = capacity_.load() > 0;
+    const bool critical = ch->priority == PublishPriority::CRITICAL;
+
+    // Lower priority channels wait (and keep coalescing) until there's budget for them.
+    if (limited && !critical && tokens_ < static_cast<double>(ch->last_bytes)) {
+      ch->current_hz = std::max(ch->min_hz.load(), 0.5 * ch->current_hz.load());
+      continue;
+    }
+
+    // NOTE(milo): Clear before publishing, so that a value that arrives during the publish isn't lost.
+    ch->pending.store(false, std::memory_order_release);
+    const int bytes = ch->publish();
+
+    if (bytes < 0) {
+      ch->pending.store(true, std::memory_order_release);   // Try the newest value again later.
+      OnPublishFailed(now);
+      continue;
+    }
+
+    ++num_published;
+    ch->sent_once = true;
+    ch->last_sent = now;
+    ch->last_bytes = bytes;
+    window_bytes_ += bytes;
+
+    if (limited) {
+      tokens_ -= bytes;
+
+      // Speed back up while there's budget left over for this channel's next message.
+      const double max_hz = ch->max_hz.load();
+      if (!critical && max_hz > 0 && tokens_ >= static_cast<double>(bytes)) {
+        ch->current_hz = std::min(max_hz, ch->current_hz.load() + std::max(0.1 * max_hz, ch->min_hz.load()));
+      }
+    }
+  }
+
+  return num_published;
+}
+
+
+void PublishScheduler::Start()
+{
+  CHECK(!thread_.joinable()) << "PublishScheduler already started" << std::endl;
+  stop_ = false;
+  thread_ = std::thread(&PublishScheduler::Run, this);
+}
+
+
+void PublishScheduler::Stop()
+{
+  stop_ = true;
+  notifier_.Notify();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+
+void PublishScheduler::Run()
+{
+  const double poll_sec = 1.0 / params_.poll_hz;
+
+  while (!stop_) {
+    urgent_ = false;
+    Poll(WallTime());
+    notifier_.Wait([this]() { return stop_ || urgent_; }, poll_sec);
+  }
+}
+
+
+}
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/notifier.hpp"
+#include "core/timestamp.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Lower values go first, and are throttled last.
+enum class PublishPriority
+{
+  CRITICAL = 0,       // Pose outputs, control inputs. Never throttled by the link budget.
+  NORMAL = 1,         // Meshes, maps, etc.
+  VISUALIZATION = 2   // The first thing to be slowed down when the link is saturated.
+};
+
+
+// Decides when to publish each of several outgoing channels, so that a saturated link (e.g the
+// tether) degrades visualization first, instead of control inputs.
+//
+// Each channel keeps its own latest value, and calls MarkPending() when it has a new one. The
+// scheduler publishes it (by calling the channel's PublishFunction) once the channel's rate allows,
+// so intermediate values are coalesced, and the newest one always goes out. Unlike DataSubsampler,
+// a value isn't dropped just because it arrived too soon after the last one.
+//
+// If the link is limited (or publishing starts failing), bytes are budgeted with a token bucket.
+// CRITICAL channels always go out when they're due (and use up the budget first), and lower
+// priority channels wait for budget. A channel that has to wait is slowed down (halving its rate,
+// down to min_hz), and sped back up again (towards max_hz) while there's budget to spare. The link
+// capacity is estimated from the measured throughput: it's cut when a publish fails, and probed
+// upwards again while publishing succeeds.
+//
+// NOTE(milo): Add all of the channels before Start(). MarkPending() is lock-free and can be called
+// from any thread, but PublishFunctions are only ever called from one thread (the scheduler's).
+class PublishScheduler final {
+ public:
+  struct Params final
+  {
+    double link_max_bytes_per_sec = 0;      // Configured link capacity (0 = unlimited).
+    double link_min_bytes_per_sec = 10e3;   // Never estimate the link capacity lower than this.
+    double burst_sec = 0.1;                 // Allow bursts of this many seconds of capacity.
+    double probe_rate = 0.1;                // Grow the capacity estimate this much per second.
+    double poll_hz = 200.0;                 // How often the scheduler thread checks the channels.
+  };
+
+  // Publishes the channel's latest value, and returns the number of bytes sent (or < 0 if it failed,
+  // e.g because the link is saturated).
+  typedef std::function<int()> PublishFunction;
+  typedef int ChannelId;
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PublishScheduler)
+
+  explicit PublishScheduler(const Params& params);
+  ~PublishScheduler();
+
+  // Add a channel that's published at most max_hz (0 = as soon as there's a new value). If the link
+  // is saturated, non-CRITICAL channels slow down to as low as min_hz (0 = never slow down).
+  ChannelId AddChannel(const std::string& name,
+                       PublishPriority priority,
+                       double max_hz,
+                       double min_hz,
+                       const PublishFunction& publish);
+
+  // Tell the scheduler that a channel has a new value to publish.
+  void MarkPending(ChannelId id);
+
+  // Change a channel's max_hz while the scheduler is running (e.g when params are reloaded). It
+  // restarts at the new rate, and slows down again if the link is still saturated. A channel that
+  // never slows down (min_hz = 0) keeps doing that at the new rate.
+  void SetMaxHz(ChannelId id, double max_hz);
+
+  // Publish every pending channel that's due, in priority order. Returns the number published.
+  // Called by the scheduler thread, or call it directly (without Start()) at wall time "now".
+  int Poll(seconds_t now);
+
+  // Poll on a thread of our own, at poll_hz (and right away when a CRITICAL channel is pending).
+  void Start();
+  void Stop();
+
+  double ChannelHz(ChannelId id) const;
+  double LinkCapacity() const { return capacity_.load(); }       // bytes/sec, 0 if unlimited.
+  double MeasuredBytesPerSec() const { return measured_.load(); }
+
+ private:
+  struct Channel final
+  {
+    std::string name;
+    PublishPriority priority;
+    PublishFunction publish;
+
+    // NOTE(milo): The rates are atomic because SetMaxHz() can be called from any thread.
+    std::atomic<double> max_hz{0};
+    std::atomic<double> min_hz{0};
+    bool fixed_rate = false;            // min_hz was 0 (never slow down).
+
+    std::atomic<bool> pending{false};
+    std::atomic<double> current_hz{0};
+    bool sent_once = false;
+    seconds_t last_sent = 0;
+    int last_bytes = 0;                 // Size of the last message (the guess for the next one).
+  };
+
+  bool IsDue(const Channel& ch, seconds_t now) const;
+  void UpdateBudget(seconds_t now);
+  void OnPublishFailed(seconds_t now);
+  void Run();
+
+  Params params_;
+  std::vector<std::unique_ptr<Channel>> channels_;
+  std::vector<Channel*> by_priority_;
+
+  // Only accessed by Poll().
+  bool polled_once_ = false;
+  seconds_t last_poll_ = 0;
+  seconds_t last_failure_ = 0;
+  double tokens_ = 0;
+  seconds_t window_start_ = 0;
+  double window_bytes_ = 0;
+
+  std::atomic<double> capacity_{0};
+  std::atomic<double> measured_{0};
+
+  std::atomic_bool stop_{false};
+  std::atomic_bool urgent_{false};
+  Notifier notifier_;
+  std::thread thread_;
+};
+
+
+}
+}
@@ -0,0 +1,28 @@
+#include "core/queue_telemetry.hpp"
+#include "core/stats_tracker.hpp"
+
+namespace bm {
+namespace core {
+
+
+void ExportQueueTelemetry(StatsTracker& stats,
+                          const std::string& name,
+                          const QueueTelemetry& telemetry,
+                          size_t num_dropped)
+{
+  const std::string prefix = "Queue/" + name + "/";
+  stats.SetGauge(prefix + "depth", static_cast<double>(telemetry.Depth()));
+  stats.SetGauge(prefix + "high_water", static_cast<double>(telemetry.HighWater()));
+  stats.Counter(prefix + "pushed") = static_cast<int64_t>(telemetry.NumPushed());
+  stats.Counter(prefix + "popped") = static_cast<int64_t>(telemetry.NumPopped());
+  stats.Counter(prefix + "dropped") = static_cast<int64_t>(num_dropped);
+
+  const LatencyHistogram& dwell_ms = telemetry.DwellMs();
+  stats.SetGauge(prefix + "dwell_p50_ms", dwell_ms.Percentile(0.5));
+  stats.SetGauge(prefix + "dwell_p99_ms", dwell_ms.Percentile(0.99));
+  stats.SetGauge(prefix + "dwell_max_ms", dwell_ms.Max());
+}
+
+
+}
+}
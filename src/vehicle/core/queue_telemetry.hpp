@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "core/latency_histogram.hpp"
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+class StatsTracker;
+
+
+// Counters for one queue (ThreadsafeQueue, SpscQueue or BroadcastQueue), which every queue keeps
+// for itself: how many items went in and out, the most that were ever waiting at once, and how
+// long each item waited between its Push() and the consumer popping it (the "dwell" time). Items
+// are stamped on push, so the dwell time is everything between the producer and the consumer.
+//
+// NOTE(milo): Everything is an atomic, and recording never takes a lock, so the producer and the
+// consumer can both record without contending (the stamp is one steady_clock read per push).
+class QueueTelemetry final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(QueueTelemetry)
+
+  // Dwell times are in ms, with a resolution of 1 us.
+  QueueTelemetry() : dwell_ms_(1e-3) {}
+
+  // The time that pushed items are stamped with (steady clock nanoseconds).
+  static int64_t Now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Called by the queue after n items were pushed, leaving "depth" items in it.
+  void RecordPush(size_t n, size_t depth)
+  {
+    num_pushed_.fetch_add(n, std::memory_order_relaxed);
+    depth_.store(depth, std::memory_order_relaxed);
+    size_t high_water = high_water_.load(std::memory_order_relaxed);
+    while (depth > high_water &&
+           !high_water_.compare_exchange_weak(high_water, depth, std::memory_order_relaxed)) {}
+  }
+
+  // Called by the queue when the consumer pops an item that was pushed at push_ns, leaving "depth"
+  // items in it.
+  void RecordPop(int64_t push_ns, int64_t now_ns, size_t depth)
+  {
+    num_popped_.fetch_add(1, std::memory_order_relaxed);
+    depth_.store(depth, std::memory_order_relaxed);
+    dwell_ms_.Record(1e-6 * static_cast<double>(now_ns - push_ns));
+  }
+
+  uint64_t NumPushed() const { return num_pushed_.load(std::memory_order_relaxed); }
+  uint64_t NumPopped() const { return num_popped_.load(std::memory_order_relaxed); }
+
+  // The number of items in the queue after the last push or pop (which, unlike the queue's Size(),
+  // is safe to read from any thread), and the most that were ever in it at once.
+  size_t Depth() const { return depth_.load(std::memory_order_relaxed); }
+  size_t HighWater() const { return high_water_.load(std::memory_order_relaxed); }
+
+  const LatencyHistogram& DwellMs() const { return dwell_ms_; }
+
+ private:
+  std::atomic<uint64_t> num_pushed_{0};
+  std::atomic<uint64_t> num_popped_{0};
+  std::atomic<size_t> depth_{0};
+  std::atomic<size_t> high_water_{0};
+  LatencyHistogram dwell_ms_;
+};
+
+
+// Copies the telemetry of a queue into a StatsTracker, under "Queue/<name>/...": the depth and
+// high_water gauges, the pushed, popped and dropped counters, and the dwell_p50_ms, dwell_p99_ms
+// and dwell_max_ms gauges. Call this whenever the stats are exported (from any thread).
+void ExportQueueTelemetry(StatsTracker& stats,
+                          const std::string& name,
+                          const QueueTelemetry& telemetry,
+                          size_t num_dropped);
+
+
+// Same as above, for any queue (or DataManager) with Telemetry() and NumDropped().
+template <typename QueueT>
+void ExportQueueTelemetry(StatsTracker& stats, const std::string& name, const QueueT& queue)
+{
+  ExportQueueTelemetry(stats, name, queue.Telemetry(), queue.NumDropped());
+}
+
+
+}
+}
@@ -1,41 +1,249 @@
-#include <random>
+#include <atomic>
+#include <cmath>
 
+#include "core/philox.hpp"
 #include "core/random.hpp"
 
 namespace bm {
 namespace core {
 
 
-// NOTE(milo): All of the random functions rely on this generator to create noise.
-static std::default_random_engine _G;
+static const double kTwoPi = 6.283185307179586;
+
+
+RandomStream::RandomStream(uint64_t seed, uint64_t stream)
+{
+  key_[0] = static_cast<uint32_t>(seed);
+  key_[1] = static_cast<uint32_t>(seed >> 32);
+  stream_[0] = static_cast<uint32_t>(stream);
+  stream_[1] = static_cast<uint32_t>(stream >> 32);
+}
+
+
+void RandomStream::NextBlock(uint32_t out[4])
+{
+  const Philox4x32 block(static_cast<uint32_t>(counter_), static_cast<uint32_t>(counter_ >> 32),
+                         stream_[0], stream_[1], key_[0], key_[1]);
+  ++counter_;
+  out[0] = block.v[0]; out[1] = block.v[1]; out[2] = block.v[2]; out[3] = block.v[3];
+}
+
+
+uint32_t RandomStream::NextUint()
+{
+  if (num_buffered_ == 0) {
+    NextBlock(buffer_);
+    num_buffered_ = 4;
+  }
+  return buffer_[4 - (num_buffered_--)];
+}
+
+
+float RandomStream::Uniformf(float a, float b)
+{
+  return a + (b - a) * UintToUnitFloat(NextUint());
+}
+
+
+double RandomStream::Uniformd(double a, double b)
+{
+  const uint32_t hi = NextUint();
+  return a + (b - a) * UintsToUnitDouble(hi, NextUint());
+}
+
+
+float RandomStream::Normalf(float mu, float sigma)
+{
+  return static_cast<float>(Normald(mu, sigma));
+}
+
+
+double RandomStream::Normald(double mu, double sigma)
+{
+  if (has_spare_normal_) {
+    has_spare_normal_ = false;
+    return mu + sigma * spare_normal_;
+  }
+
+  // Box-Muller: u1 is in (0, 1] so that the log is finite.
+  const double u1 = 1.0 - Uniformd(0, 1);
+  const double u2 = Uniformd(0, 1);
+  const double r = std::sqrt(-2.0 * std::log(u1));
+  spare_normal_ = r * std::sin(kTwoPi * u2);
+  has_spare_normal_ = true;
+  return mu + sigma * r * std::cos(kTwoPi * u2);
+}
+
+
+void RandomStream::FillUniform(float* out, size_t n, float a, float b)
+{
+  const float scale = b - a;
+  const size_t num_blocks = n / 4;
+
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const uint64_t c = counter_ + i;
+    const Philox4x32 block(static_cast<uint32_t>(c), static_cast<uint32_t>(c >> 32),
+                           stream_[0], stream_[1], key_[0], key_[1]);
+    for (int j = 0; j < 4; ++j) {
+      out[4*i + j] = a + scale * UintToUnitFloat(block.v[j]);
+    }
+  }
+  counter_ += num_blocks;
+
+  if (n % 4 != 0) {
+    uint32_t words[4];
+    NextBlock(words);
+    for (size_t j = 0; j < n % 4; ++j) {
+      out[4*num_blocks + j] = a + scale * UintToUnitFloat(words[j]);
+    }
+  }
+}
+
+
+void RandomStream::FillUniform(double* out, size_t n, double a, double b)
+{
+  const double scale = b - a;
+  const size_t num_blocks = n / 2;
+
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const uint64_t c = counter_ + i;
+    const Philox4x32 block(static_cast<uint32_t>(c), static_cast<uint32_t>(c >> 32),
+                           stream_[0], stream_[1], key_[0], key_[1]);
+    out[2*i] = a + scale * UintsToUnitDouble(block.v[0], block.v[1]);
+    out[2*i + 1] = a + scale * UintsToUnitDouble(block.v[2], block.v[3]);
+  }
+  counter_ += num_blocks;
+
+  if (n % 2 != 0) {
+    uint32_t words[4];
+    NextBlock(words);
+    out[n - 1] = a + scale * UintsToUnitDouble(words[0], words[1]);
+  }
+}
+
+
+void RandomStream::FillNormal(float* out, size_t n, float mu, float sigma)
+{
+  const size_t num_blocks = n / 4;
+
+  // Two Box-Muller pairs per block (u1 is in (0, 1] so that the log is finite).
+  const auto box_muller = [mu, sigma](const uint32_t* words, float* pair, int count)
+  {
+    for (int k = 0; k < count; k += 2) {
+      const float u1 = 1.0f - UintToUnitFloat(words[k]);
+      const float u2 = UintToUnitFloat(words[k + 1]);
+      const float r = sigma * std::sqrt(-2.0f * std::log(u1));
+      pair[k] = mu + r * std::cos(static_cast<float>(kTwoPi) * u2);
+      if (k + 1 < count) {
+        pair[k + 1] = mu + r * std::sin(static_cast<float>(kTwoPi) * u2);
+      }
+    }
+  };
+
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const uint64_t c = counter_ + i;
+    const Philox4x32 block(static_cast<uint32_t>(c), static_cast<uint32_t>(c >> 32),
+                           stream_[0], stream_[1], key_[0], key_[1]);
+    box_muller(block.v, out + 4*i, 4);
+  }
+  counter_ += num_blocks;
+
+  if (n % 4 != 0) {
+    uint32_t words[4];
+    NextBlock(words);
+    box_muller(words, out + 4*num_blocks, static_cast<int>(n % 4));
+  }
+}
+
+
+void RandomStream::FillNormal(double* out, size_t n, double mu, double sigma)
+{
+  const auto box_muller = [mu, sigma](const uint32_t* words, double* pair, bool both)
+  {
+    const double u1 = 1.0 - UintsToUnitDouble(words[0], words[1]);
+    const double u2 = UintsToUnitDouble(words[2], words[3]);
+    const double r = sigma * std::sqrt(-2.0 * std::log(u1));
+    pair[0] = mu + r * std::cos(kTwoPi * u2);
+    if (both) {
+      pair[1] = mu + r * std::sin(kTwoPi * u2);
+    }
+  };
+
+  // One Box-Muller pair per block.
+  const size_t num_blocks = n / 2;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const uint64_t c = counter_ + i;
+    const Philox4x32 block(static_cast<uint32_t>(c), static_cast<uint32_t>(c >> 32),
+                           stream_[0], stream_[1], key_[0], key_[1]);
+    box_muller(block.v, out + 2*i, true);
+  }
+  counter_ += num_blocks;
+
+  if (n % 2 != 0) {
+    uint32_t words[4];
+    NextBlock(words);
+    box_muller(words, out + n - 1, false);
+  }
+}
+
+
+// NOTE(milo): All of the Random*() functions draw from a RandomStream that belongs to the calling
+// thread, so they're safe to call from parallel kernels (e.g RRT sampling). Each thread gets the
+// next stream of the global seed when it first draws (or after SetRandomSeed).
+static std::atomic<uint64_t> g_seed{0};
+static std::atomic<uint64_t> g_seed_generation{0};
+static std::atomic<uint64_t> g_next_stream{0};
+
+
+static RandomStream& ThreadRandomStream()
+{
+  struct ThreadStream final
+  {
+    uint64_t generation = ~0ull;
+    RandomStream stream;
+  };
+  thread_local ThreadStream ts;
+
+  const uint64_t generation = g_seed_generation.load(std::memory_order_acquire);
+  if (ts.generation != generation) {
+    ts.stream = RandomStream(g_seed.load(), g_next_stream.fetch_add(1));
+    ts.generation = generation;
+  }
+  return ts.stream;
+}
+
+
+void SetRandomSeed(uint64_t seed)
+{
+  g_seed.store(seed);
+  g_next_stream.store(0);
+  g_seed_generation.fetch_add(1, std::memory_order_release);
+}
+
 
 // Return a random float in the range [a, b).
 float RandomUniformf(float a, float b)
 {
-  std::uniform_real_distribution<float> d(a, b);
-  return d(_G);
+  return ThreadRandomStream().Uniformf(a, b);
 }
 
 
 float RandomNormalf(float mu, float sigma)
 {
-  std::normal_distribution<float> d(mu, sigma);
-  return d(_G);
+  return ThreadRandomStream().Normalf(mu, sigma);
 }
 
 
 // Return a random double in the range [a, b).
 double RandomUniformd(double a, double b)
 {
-  std::uniform_real_distribution<double> d(a, b);
-  return d(_G);
+  return ThreadRandomStream().Uniformd(a, b);
 }
 
 
 double RandomNormald(double mu, double sigma)
 {
-  std::normal_distribution<double> d(mu, sigma);
-  return d(_G);
+  return ThreadRandomStream().Normald(mu, sigma);
 }
 
 
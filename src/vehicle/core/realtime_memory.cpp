@@ -0,0 +1,98 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "core/realtime_memory.hpp"
+
+namespace bm {
+namespace core {
+
+
+bool LockProcessMemory()
+{
+  bool ok = true;
+
+  // NOTE(milo): Without these, free() trims the top of the heap and munmaps big blocks, and the
+  // next allocation faults them in again.
+  if (mallopt(M_MMAP_MAX, 0) == 0 || mallopt(M_TRIM_THRESHOLD, -1) == 0) {
+    LOG(WARNING) << "Failed to turn off malloc trimming" << std::endl;
+    ok = false;
+  }
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    LOG(WARNING) << "Failed to mlockall(): " << std::strerror(errno)
+                 << " (needs CAP_IPC_LOCK or a bigger RLIMIT_MEMLOCK)" << std::endl;
+    ok = false;
+  }
+
+  return ok;
+}
+
+
+void PrefaultHeap(size_t bytes)
+{
+  if (bytes == 0) {
+    return;
+  }
+
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  volatile char* buf = static_cast<volatile char*>(std::malloc(bytes));
+  CHECK(buf != nullptr) << "Failed to prefault " << bytes << " bytes of heap" << std::endl;
+  for (size_t i = 0; i < bytes; i += page) {
+    buf[i] = 0;
+  }
+  std::free(const_cast<char*>(buf));
+}
+
+
+void PrefaultStack(size_t bytes)
+{
+  // NOTE(milo): alloca() memory is freed on return, but the pages stay mapped (and locked).
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  volatile char* buf = static_cast<volatile char*>(alloca(bytes));
+  for (size_t i = 0; i < bytes; i += page) {
+    buf[i] = 0;
+  }
+}
+
+
+#ifdef BM_COUNT_ALLOCATIONS
+static thread_local uint64_t g_thread_allocations = 0;
+
+bool AllocationCountingEnabled() { return true; }
+uint64_t ThreadAllocationCount() { return g_thread_allocations; }
+#else
+bool AllocationCountingEnabled() { return false; }
+uint64_t ThreadAllocationCount() { return 0; }
+#endif
+
+
+}
+}
+
+
+#ifdef BM_COUNT_ALLOCATIONS
+// NOTE(milo): Replacing the plain versions is enough, since the array and nothrow ones call them.
+// Eigen (and anything else that calls malloc directly) isn't counted.
+void* operator new(size_t size)
+{
+  ++bm::core::g_thread_allocations;
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+#endif
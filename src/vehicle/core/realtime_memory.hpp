@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bm {
+namespace core {
+
+
+// Locks every current and future page of the process into RAM (mlockall), and stops glibc malloc
+// from handing memory back to the OS or using mmap for big blocks. Memory that gets freed is then
+// reused without new page faults. Needs CAP_IPC_LOCK (or a big enough RLIMIT_MEMLOCK). Failures
+// are logged but not fatal. Returns whether everything was applied.
+bool LockProcessMemory();
+
+
+// Mallocs "bytes", writes to every page and frees it again, so that the malloc arena of the CALLING
+// thread already has that much resident memory (only sticks after LockProcessMemory()).
+void PrefaultHeap(size_t bytes);
+
+
+// Writes to "bytes" of the calling thread's stack, so that deep calls later don't fault in pages.
+void PrefaultStack(size_t bytes);
+
+
+// Debug hook for finding allocations in steady state: counts the calls to operator new on each
+// thread. Only counts if built with BM_COUNT_ALLOCATIONS (it replaces the global operator new),
+// and otherwise always returns zero.
+bool AllocationCountingEnabled();
+uint64_t ThreadAllocationCount();
+
+
+}
+}
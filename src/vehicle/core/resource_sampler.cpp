@@ -0,0 +1,172 @@
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "core/resource_sampler.hpp"
+
+namespace bm {
+namespace core {
+
+
+static const double kBytesPerMb = 1024.0 * 1024.0;
+
+
+static double TimevalSec(const timeval& tv)
+{
+  return static_cast<double>(tv.tv_sec) + 1e-6 * static_cast<double>(tv.tv_usec);
+}
+
+
+// Parses /proc/self/task/<tid>/stat. The name is in parentheses, and can have spaces (or more
+// parentheses) in it, so the fields after it are found from the last ')'.
+static bool ReadThreadStat(int tid, ThreadCpuTime& out)
+{
+  std::ifstream in("/proc/self/task/" + std::to_string(tid) + "/stat");
+  std::string line;
+  if (!in.good() || !std::getline(in, line)) {
+    return false;
+  }
+
+  const size_t open = line.find('(');
+  const size_t close = line.rfind(')');
+  if (open == std::string::npos || close == std::string::npos || close < open) {
+    return false;
+  }
+
+  // Fields 3 onwards (state, ppid, ...). utime and stime are fields 14 and 15, in clock ticks.
+  std::istringstream fields(line.substr(close + 1));
+  std::string field;
+  unsigned long long utime = 0, stime = 0;
+  for (int i = 3; i <= 15 && (fields >> field); ++i) {
+    if (i == 14) { utime = std::strtoull(field.c_str(), nullptr, 10); }
+    if (i == 15) { stime = std::strtoull(field.c_str(), nullptr, 10); }
+  }
+
+  static const double kTicksPerSec = static_cast<double>(sysconf(_SC_CLK_TCK));
+  out.tid = tid;
+  out.name = line.substr(open + 1, close - open - 1);
+  out.cpu_sec = static_cast<double>(utime + stime) / kTicksPerSec;
+  return true;
+}
+
+
+ResourceSampler::ResourceSampler(float interval_sec)
+    : interval_sec_(interval_sec), timer_(true) {}
+
+
+void ResourceSampler::AddMemorySource(const std::string& name, const MemoryFunc& bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  memory_sources_.emplace_back(name, bytes);
+}
+
+
+bool ResourceSampler::Sample(StatsTracker& stats)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (interval_sec_ < 0 || (has_sample_ && timer_.Elapsed().seconds() < interval_sec_)) {
+    return false;
+  }
+
+  const double elapsed_sec = timer_.Tock().seconds();
+  const bool has_rates = has_sample_ && elapsed_sec > 0;
+
+  std::vector<ThreadCpuTime> threads;
+  ReadThreadCpuTimes(threads);
+
+  // Sum up the threads that share a name. Threads that exited since the last sample are dropped.
+  std::map<std::string, double> cpu_sec_by_name;
+  std::unordered_map<int, double> thread_cpu_sec;
+  for (const ThreadCpuTime& thread : threads) {
+    const auto it = last_thread_cpu_sec_.find(thread.tid);
+    const double last_cpu_sec = (it == last_thread_cpu_sec_.end()) ? 0 : it->second;
+    cpu_sec_by_name[thread.name] += thread.cpu_sec - last_cpu_sec;
+    thread_cpu_sec.emplace(thread.tid, thread.cpu_sec);
+  }
+  last_thread_cpu_sec_ = std::move(thread_cpu_sec);
+
+  const double process_cpu_sec = ReadProcessCpuSec();
+
+  if (has_rates) {
+    for (const auto& item : cpu_sec_by_name) {
+      stats.SetGauge("Cpu/" + item.first, 100.0 * item.second / elapsed_sec);
+    }
+    stats.SetGauge("Cpu/process", 100.0 * (process_cpu_sec - last_process_cpu_sec_) / elapsed_sec);
+  }
+  last_process_cpu_sec_ = process_cpu_sec;
+
+  stats.SetGauge("Memory/rss_mb", ReadRssBytes() / kBytesPerMb);
+  stats.SetGauge("Memory/peak_rss_mb", ReadPeakRssBytes() / kBytesPerMb);
+  for (const auto& source : memory_sources_) {
+    stats.SetGauge("Memory/" + source.first + "_mb", source.second() / kBytesPerMb);
+  }
+
+  has_sample_ = true;
+  return true;
+}
+
+
+bool ResourceSampler::ReadThreadCpuTimes(std::vector<ThreadCpuTime>& out)
+{
+  out.clear();
+
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    LOG_FIRST_N(WARNING, 1) << "Can't read /proc/self/task, no per-thread CPU usage" << std::endl;
+    return false;
+  }
+
+  for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+    const int tid = std::atoi(entry->d_name);
+    ThreadCpuTime thread;
+    if (tid > 0 && ReadThreadStat(tid, thread)) {
+      out.emplace_back(thread);
+    }
+  }
+
+  closedir(dir);
+  return true;
+}
+
+
+double ResourceSampler::ReadRssBytes()
+{
+  // The second field of statm is the number of resident pages.
+  std::ifstream in("/proc/self/statm");
+  unsigned long long size_pages = 0, resident_pages = 0;
+  if (!(in >> size_pages >> resident_pages)) {
+    return 0;
+  }
+  return static_cast<double>(resident_pages) * static_cast<double>(sysconf(_SC_PAGESIZE));
+}
+
+
+double ResourceSampler::ReadPeakRssBytes()
+{
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return 1024.0 * static_cast<double>(usage.ru_maxrss);  // In kB on Linux.
+}
+
+
+double ResourceSampler::ReadProcessCpuSec()
+{
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return TimevalSec(usage.ru_utime) + TimevalSec(usage.ru_stime);
+}
+
+
+}
+}
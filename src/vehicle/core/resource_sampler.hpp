@@ -0,0 +1,82 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/timer.hpp"
+#include "core/stats_tracker.hpp"
+
+namespace bm {
+namespace core {
+
+
+// CPU time that one thread of this process has used so far.
+struct ThreadCpuTime final
+{
+  int tid = 0;
+  std::string name;         // Set with pthread_setname_np (see ConfigureCurrentThread()).
+  double cpu_sec = 0;       // User + system time.
+};
+
+
+// Samples how much CPU each thread of this process uses, the process RSS, and any other memory
+// that a module reports (e.g the GpuContext pools), and writes them as gauges into a StatsTracker,
+// so that they get exported along with the latency metrics:
+//  Cpu/<thread name>     % of one core since the last sample (threads with the same name add up)
+//  Cpu/process           % of one core, for the whole process
+//  Memory/rss_mb         resident set size
+//  Memory/peak_rss_mb    peak resident set size
+//  Memory/<source>_mb    for each AddMemorySource()
+//
+// Threads are read from /proc/self/task, so every thread shows up without registering it, and the
+// names are whatever the thread was given (unnamed threads have the name of the process).
+//
+// NOTE(milo): A sample reads one small /proc file per thread, so keep interval_sec around a second
+// or more. Thread-safe.
+class ResourceSampler final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ResourceSampler)
+
+  // Returns a number of bytes.
+  typedef std::function<double()> MemoryFunc;
+
+  // If interval_sec is zero, every call to Sample() takes a sample. If negative, none do.
+  explicit ResourceSampler(float interval_sec = 1.0f);
+
+  // Report the memory from "bytes" as Memory/<name>_mb.
+  void AddMemorySource(const std::string& name, const MemoryFunc& bytes);
+
+  // Take a sample, if interval_sec has elapsed since the last one, and write the gauges into stats.
+  // Returns whether a sample was taken. CPU percentages need two samples, so they're written
+  // starting from the second one.
+  bool Sample(StatsTracker& stats);
+
+  // CPU time used by each thread of this process. Returns false if /proc can't be read.
+  static bool ReadThreadCpuTimes(std::vector<ThreadCpuTime>& out);
+
+  // Resident set size of this process (and its peak), in bytes.
+  static double ReadRssBytes();
+  static double ReadPeakRssBytes();
+
+  // User + system CPU time used by the whole process so far.
+  static double ReadProcessCpuSec();
+
+ private:
+  float interval_sec_;
+
+  std::mutex mutex_;
+  bool has_sample_ = false;
+  Timer timer_;
+  std::unordered_map<int, double> last_thread_cpu_sec_;
+  double last_process_cpu_sec_ = 0;
+  std::vector<std::pair<std::string, MemoryFunc>> memory_sources_;
+};
+
+
+}
+}
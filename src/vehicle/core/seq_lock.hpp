@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Holds the latest value from ONE writer for ANY number of readers (a sequence lock). Unlike a
+// mutex, a reader never holds up the writer: Store() never waits. A reader that overlaps a Store()
+// just copies the value again, so readers only ever spin for as long as one copy of T takes.
+//
+// The sequence number is odd while a Store() is in progress, and goes up by two with each one, so
+// a reader knows that its copy is consistent if the sequence was even and didn't change.
+//
+// NOTE(milo): Readers copy the bytes of T while they might be getting overwritten, and throw away
+// the copy if they were. So T must be a plain value (e.g fixed-size Eigen types, gtsam geometry,
+// structs of these) with nothing on the heap! Store() can be called from different threads, but
+// never from two at once.
+template <typename T>
+class SeqLock final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(SeqLock)
+
+  SeqLock() : SeqLock(T()) {}
+
+  explicit SeqLock(const T& value) { std::memcpy(&storage_, &value, sizeof(T)); }
+
+  // Publish a new value. Never waits for readers.
+  void Store(const T& value)
+  {
+    const uint64_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&storage_, &value, sizeof(T));
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  // Copies the latest value into "value", and returns its version (see Version()).
+  uint64_t Load(T& value) const
+  {
+    Storage copy;
+    uint64_t before, after;
+    do {
+      before = seq_.load(std::memory_order_acquire);
+      while (before & 1) {
+        before = seq_.load(std::memory_order_acquire);
+      }
+      std::memcpy(&copy, &storage_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq_.load(std::memory_order_relaxed);
+    } while (before != after);
+
+    std::memcpy(static_cast<void*>(&value), &copy, sizeof(T));
+    return before / 2;
+  }
+
+  T Load() const
+  {
+    T value;
+    Load(value);
+    return value;
+  }
+
+  // The number of values stored so far (zero means that Load() returns the initial value).
+  uint64_t Version() const { return seq_.load(std::memory_order_acquire) / 2; }
+
+ private:
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+  std::atomic<uint64_t> seq_{0};
+  Storage storage_;
+};
+
+
+}
+}
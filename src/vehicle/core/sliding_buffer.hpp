@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <utility>
 #include <vector>
 #include <glog/logging.h>
 
@@ -9,9 +11,84 @@ namespace bm {
 namespace core {
 
 
+// Smallest power of two that is >= n (n > 0).
+constexpr size_t NextPowerOfTwo(size_t n, size_t p = 1)
+{
+  return (p >= n) ? p : NextPowerOfTwo(n, 2 * p);
+}
+
+
 // A fixed-length sliding buffer of items, implemented as a circular buffer.
-template <typename Item>
+// If N > 0, the capacity is fixed at compile time: items live in a std::array (no heap allocation),
+// indexing uses a power-of-two mask instead of a modulo, and Get() is only bounds-checked in debug
+// builds. If N == 0 (the default), the capacity is chosen at runtime (see the specialization below).
+template <typename Item, size_t N = 0>
 class SlidingBuffer {
+ public:
+  static_assert(N > 0, "SlidingBuffer with N == 0 uses the runtime-sized specialization");
+
+  SlidingBuffer() = default;
+
+  // Get an item k_ago from the head.
+  const Item& Get(int k_ago) const
+  {
+    DCHECK(k_ago >= 0 && k_ago < (int)N) << "Trying to access an item at k > max storable age" << std::endl;
+    DCHECK(k_ago < (int)num_added_)
+        << "Tried to access the item " << k_ago << " ago, but have only added "
+        << num_added_ << " items. Probably a bug." << std::endl;
+    return cbuffer_[(num_added_ - k_ago - 1) & kMask];
+  }
+
+  // Get the "head" (most recent) item.
+  const Item& Head() const { return Get(0); }
+
+  // Adds an item at the head of the buffer, pushing out the oldest item.
+  void Add(const Item& item)
+  {
+    cbuffer_[num_added_ & kMask] = item;
+    ++num_added_;
+  }
+
+  void Add(Item&& item)
+  {
+    cbuffer_[num_added_ & kMask] = std::move(item);
+    ++num_added_;
+  }
+
+  // Release the item k_ago (e.g to free an image that will never be accessed again). The slot holds
+  // a default-constructed Item until it gets overwritten.
+  void Release(int k_ago)
+  {
+    DCHECK(k_ago >= 0 && k_ago < (int)N && k_ago < (int)num_added_);
+    cbuffer_[(num_added_ - k_ago - 1) & kMask] = Item();
+  }
+
+  // Construct an item at the head of the buffer from args.
+  template <typename... Args>
+  void Emplace(Args&&... args)
+  {
+    cbuffer_[num_added_ & kMask] = Item(std::forward<Args>(args)...);
+    ++num_added_;
+  }
+
+  // Size of the circular buffer.
+  size_t Size() const { return N; }
+
+  // How many items have been added so far?
+  size_t Added() const { return num_added_; }
+
+ private:
+  static constexpr size_t kCapacity = NextPowerOfTwo(N);
+  static constexpr size_t kMask = kCapacity - 1;
+
+  size_t num_added_ = 0;
+  std::array<Item, kCapacity> cbuffer_; // Circular buffer.
+};
+
+
+// Runtime-sized version.
+template <typename Item>
+class SlidingBuffer<Item, 0> {
  public:
   SlidingBuffer(size_t N) : cbuffer_(N) {}
 
@@ -39,6 +116,13 @@ class SlidingBuffer {
     ++num_added_;
   }
 
+  void Add(Item&& item)
+  {
+    cbuffer_.at(head_index_) = std::move(item);
+    head_index_ = (head_index_ + 1) % (int)cbuffer_.size();
+    ++num_added_;
+  }
+
   // Size of the circular buffer.
   size_t Size() const { return cbuffer_.size(); }
 
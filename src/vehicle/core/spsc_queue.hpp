@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/async_log.hpp"
+#include "core/notifier.hpp"
+#include "core/queue_telemetry.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Assume 64-byte cache lines (x86 and the ARM cores on the Jetson).
+static const size_t kCacheLineBytes = 64;
+
+
+// A bounded, lock-free ring buffer for exactly ONE producer thread and ONE consumer thread. It has
+// the same API and drop policy as ThreadsafeQueue, so the two can be swapped via a template param.
+//
+// Only the producer writes the tail index and only the consumer writes the head index, so neither
+// side ever takes a lock. This means that the producer can't drop the oldest item itself. Instead,
+// when drop_oldest_if_full is set, the ring has 2x max_queue_size slots of physical storage, and
+// the consumer discards any excess items (oldest first) before it reads from the front. From the
+// consumer's point of view, the queue never holds more than max_queue_size items.
+//
+// NOTE(milo): Push() and PeekBack() (and Size(), Empty()) may be called from the producer thread.
+// Everything else must only be called from the consumer thread!
+template <typename Item>
+class SpscQueue {
+ public:
+  // Used by DataManager to decide whether it needs to take its own lock.
+  static constexpr bool kLockFree = true;
+
+  // Construct the queue with a max size and drop policy. Unlike ThreadsafeQueue, the queue must be
+  // bounded, since all of its storage is allocated up front.
+  SpscQueue(size_t max_queue_size,
+            bool drop_oldest_if_full = true,
+            const std::string& queue_name = "")
+      : max_queue_size_(max_queue_size),
+        drop_oldest_if_full_(drop_oldest_if_full),
+        queue_name_(queue_name),
+        num_slots_(drop_oldest_if_full ? 2 * max_queue_size : max_queue_size),
+        slots_(new Slot[num_slots_]),
+        push_ns_(new int64_t[num_slots_])
+  {
+    CHECK_GT(max_queue_size, 0) << "SpscQueue must have a max_queue_size > 0"
+        << "\n  Queue=" << queue_name_ << std::endl;
+  }
+
+  ~SpscQueue()
+  {
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    for (size_t i = head_.load(std::memory_order_relaxed); i != tail; ++i) {
+      SlotAt(i)->~Item();
+    }
+  }
+
+  SpscQueue(const SpscQueue&) = delete;
+  void operator=(const SpscQueue&) = delete;
+
+  // Push an item onto the queue (PRODUCER ONLY).
+  // NOTE(milo): If Item has a move constructor, this avoids a copy.
+  bool Push(Item item)
+  {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t head = head_.load(std::memory_order_acquire);
+    const size_t limit = drop_oldest_if_full_ ? num_slots_ : max_queue_size_;
+
+    // If drop_oldest_if_full is set, this only happens if the consumer has fallen behind by an
+    // entire extra max_queue_size items. The oldest item can't be reached from here, so we have to
+    // drop the newest one.
+    if ((tail - head) >= limit) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      if (drop_oldest_if_full_) {
+        BM_LOG_EVERY_SEC(WARNING, 1.0) << "SpscQueue consumer fell behind, dropping newest item!"
+            << " Queue=" << queue_name_ << " Item=" << typeid(Item).name();
+      }
+      return false;
+    }
+
+    new (SlotAt(tail)) Item(std::move(item));
+    push_ns_[tail % num_slots_] = QueueTelemetry::Now();
+    tail_.store(tail + 1, std::memory_order_release);
+    telemetry_.RecordPush(1, std::min(tail + 1 - head, max_queue_size_));
+    notifier_.Notify();
+    return true;
+  }
+
+  // Push several items, oldest first (PRODUCER ONLY). Stops at the first one that doesn't fit, so
+  // the items pushed are always the first ones. Returns how many were pushed.
+  size_t PushBatch(std::vector<Item>&& items)
+  {
+    for (size_t i = 0; i < items.size(); ++i) {
+      if (!Push(std::move(items[i]))) {
+        num_dropped_.fetch_add(items.size() - i - 1, std::memory_order_relaxed);
+        return i;
+      }
+    }
+    return items.size();
+  }
+
+  // Pop the item at the front of the queue (oldest) (CONSUMER ONLY).
+  Item Pop()
+  {
+    DropExcess();
+    const size_t head = head_.load(std::memory_order_relaxed);
+    CHECK(head != tail_.load(std::memory_order_acquire)) << "Tried to pop from empty SpscQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    Item* slot = SlotAt(head);
+    Item item = std::move(*slot);
+    slot->~Item();
+    telemetry_.RecordPop(push_ns_[head % num_slots_], QueueTelemetry::Now(),
+                         tail_.load(std::memory_order_relaxed) - head - 1);
+    head_.store(head + 1, std::memory_order_release);
+    notifier_.Notify();
+    return item;
+  }
+
+  // Pop the front item if there is one (CONSUMER ONLY).
+  bool PopIfNonEmpty(Item& item)
+  {
+    DropExcess();
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    Item* slot = SlotAt(head);
+    item = std::move(*slot);
+    slot->~Item();
+    telemetry_.RecordPop(push_ns_[head % num_slots_], QueueTelemetry::Now(),
+                         tail_.load(std::memory_order_relaxed) - head - 1);
+    head_.store(head + 1, std::memory_order_release);
+    notifier_.Notify();
+    return true;
+  }
+
+  // Wait up to timeout_sec for an item, and pop it if one arrives (CONSUMER ONLY). A negative
+  // timeout waits forever. Returns false if the timeout elapsed or the queue was closed while empty.
+  bool PopBlocking(Item& item, double timeout_sec = -1)
+  {
+    return WaitNotEmpty(timeout_sec) && PopIfNonEmpty(item);
+  }
+
+  // Block until the queue is nonempty, it's closed, or timeout_sec elapses. A negative timeout
+  // waits forever. Returns whether the queue is nonempty.
+  bool WaitNotEmpty(double timeout_sec = -1)
+  {
+    notifier_.Wait([this]() { return !Empty() || IsClosed(); }, timeout_sec);
+    return !Empty();
+  }
+
+  // Block until the consumer has emptied the queue, it's closed, or timeout_sec elapses. Returns
+  // whether the queue is empty.
+  bool WaitEmpty(double timeout_sec = -1)
+  {
+    notifier_.Wait([this]() { return Empty() || IsClosed(); }, timeout_sec);
+    return Empty();
+  }
+
+  // Wake up all waiting threads and make future waits return immediately. Items can still be
+  // pushed and popped after closing; this is just a signal that everyone should stop blocking.
+  void Close()
+  {
+    closed_.store(true);
+    notifier_.Notify();
+  }
+
+  bool IsClosed() const { return closed_.load(); }
+
+  // Return the current size of the queue. Excess items that the consumer hasn't discarded yet are
+  // not counted.
+  size_t Size()
+  {
+    const size_t head = head_.load(std::memory_order_acquire);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    return std::min(tail - head, max_queue_size_);
+  }
+
+  bool Empty() { return Size() == 0; }
+
+  // Total number of items dropped (either policy) since construction. Excess items are only counted
+  // once the consumer discards them.
+  size_t NumDropped() const { return num_dropped_.load(std::memory_order_relaxed); }
+
+  // Push/pop counts, high-water depth and dwell times (see QueueTelemetry). Items that are popped
+  // with PopFront() count as popped too, and excess items that are discarded count as dropped.
+  const QueueTelemetry& Telemetry() const { return telemetry_; }
+
+  // (CONSUMER ONLY).
+  const Item& PeekFront()
+  {
+    DropExcess();
+    const size_t head = head_.load(std::memory_order_relaxed);
+    CHECK(head != tail_.load(std::memory_order_acquire)) << "Tried to PeekFront() from empty SpscQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return *SlotAt(head);
+  }
+
+  // Discard any excess items, and return the number of items that the consumer can access with At()
+  // (CONSUMER ONLY). Those items stay in place until the consumer pops them, even if the producer
+  // keeps pushing.
+  size_t ConsumerSize()
+  {
+    DropExcess();
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed);
+  }
+
+  // Access the i-th item from the front (oldest) without popping it (CONSUMER ONLY). Only valid for
+  // i < ConsumerSize().
+  const Item& At(size_t i) const
+  {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    CHECK_LT(i, tail_.load(std::memory_order_acquire) - head) << "Tried to At() past the end of SpscQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return *SlotAt(head + i);
+  }
+
+  // Discard the n oldest items in one shot (or all of them if there are fewer than n). Items are
+  // destroyed in place, with no moves (CONSUMER ONLY).
+  void PopFront(size_t n)
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    n = std::min(n, tail - head);
+    const int64_t now_ns = QueueTelemetry::Now();
+    for (size_t i = 0; i < n; ++i, ++head) {
+      SlotAt(head)->~Item();
+      telemetry_.RecordPop(push_ns_[head % num_slots_], now_ns, tail - head - 1);
+    }
+    head_.store(head, std::memory_order_release);
+    if (n > 0) { notifier_.Notify(); }
+  }
+
+  // NOTE(milo): If called from the producer, the consumer could pop this item while the reference
+  // is still in use. Only the consumer should hold onto the returned reference.
+  const Item& PeekBack()
+  {
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    CHECK(head_.load(std::memory_order_acquire) != tail) << "Tried to PeekBack() from empty SpscQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return *SlotAt(tail - 1);
+  }
+
+ private:
+  typedef typename std::aligned_storage<sizeof(Item), alignof(Item)>::type Slot;
+
+  Item* SlotAt(size_t i) const { return reinterpret_cast<Item*>(&slots_[i % num_slots_]); }
+
+  // Discard the oldest items until at most max_queue_size are left (CONSUMER ONLY).
+  void DropExcess()
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    if ((tail - head) <= max_queue_size_) {
+      return;
+    }
+
+    const size_t num_drop = (tail - head) - max_queue_size_;
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "Dropping " << num_drop << " items from SpscQueue!"
+        << " Queue=" << queue_name_ << " Item=" << typeid(Item).name();
+
+    for (size_t i = 0; i < num_drop; ++i, ++head) {
+      SlotAt(head)->~Item();
+    }
+    head_.store(head, std::memory_order_release);
+    num_dropped_.fetch_add(num_drop, std::memory_order_relaxed);
+    notifier_.Notify();
+  }
+
+ private:
+  size_t max_queue_size_;
+  bool drop_oldest_if_full_;
+  std::string queue_name_;
+  size_t num_slots_;
+  std::unique_ptr<Slot[]> slots_;
+  std::unique_ptr<int64_t[]> push_ns_;    // When the item in each slot was pushed.
+  std::atomic_bool closed_{false};
+  std::atomic<size_t> num_dropped_{0};
+  Notifier notifier_;
+  QueueTelemetry telemetry_;
+
+  // Monotonically increasing indices (they are wrapped when accessing a slot). Each one gets its
+  // own cache line so that the producer and consumer don't false-share.
+  alignas(kCacheLineBytes) std::atomic<size_t> head_{0};
+  alignas(kCacheLineBytes) std::atomic<size_t> tail_{0};
+  char pad_[kCacheLineBytes - sizeof(std::atomic<size_t>)];
+};
+
+
+template <typename Item>
+constexpr bool SpscQueue<Item>::kLockFree;
+
+
+}
+}
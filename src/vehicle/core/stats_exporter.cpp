@@ -0,0 +1,75 @@
+#include <iomanip>
+
+#include <glog/logging.h>
+
+#include "core/stats_exporter.hpp"
+
+namespace bm {
+namespace core {
+
+
+CsvStatsExporter::CsvStatsExporter(const std::string& filepath)
+    : out_(filepath, std::ios::out | std::ios::trunc)
+{
+  CHECK(out_.is_open()) << "Could not open CSV stats file: " << filepath << std::endl;
+  out_ << "wall_time_sec,tracker,type,name,count,min,max,mean,p50,p90,p99,p999,value\n";
+}
+
+
+void CsvStatsExporter::Export(const StatsSnapshot& s)
+{
+  out_ << std::fixed << std::setprecision(6);
+  for (const HistogramSummary& h : s.histograms) {
+    out_ << s.wall_time_sec << "," << s.tracker_name << ",histogram," << h.name << ","
+         << h.count << "," << h.min << "," << h.max << "," << h.mean << ","
+         << h.p50 << "," << h.p90 << "," << h.p99 << "," << h.p999 << ",\n";
+  }
+  for (const auto& c : s.counters) {
+    out_ << s.wall_time_sec << "," << s.tracker_name << ",counter," << c.first << ",,,,,,,,," << c.second << "\n";
+  }
+  for (const auto& g : s.gauges) {
+    out_ << s.wall_time_sec << "," << s.tracker_name << ",gauge," << g.first << ",,,,,,,,," << g.second << "\n";
+  }
+  out_.flush();
+}
+
+
+JsonStatsExporter::JsonStatsExporter(const std::string& filepath)
+    : out_(filepath, std::ios::out | std::ios::trunc)
+{
+  CHECK(out_.is_open()) << "Could not open JSON stats file: " << filepath << std::endl;
+}
+
+
+// NOTE(milo): Metric names are code identifiers (no quotes or backslashes), so they aren't escaped.
+void JsonStatsExporter::Export(const StatsSnapshot& s)
+{
+  out_ << std::fixed << std::setprecision(6);
+  out_ << "{\"wall_time_sec\":" << s.wall_time_sec << ",\"tracker\":\"" << s.tracker_name << "\"";
+
+  out_ << ",\"histograms\":{";
+  for (size_t i = 0; i < s.histograms.size(); ++i) {
+    const HistogramSummary& h = s.histograms.at(i);
+    out_ << (i > 0 ? "," : "") << "\"" << h.name << "\":{"
+         << "\"count\":" << h.count << ",\"min\":" << h.min << ",\"max\":" << h.max
+         << ",\"mean\":" << h.mean << ",\"p50\":" << h.p50 << ",\"p90\":" << h.p90
+         << ",\"p99\":" << h.p99 << ",\"p999\":" << h.p999 << "}";
+  }
+
+  out_ << "},\"counters\":{";
+  for (size_t i = 0; i < s.counters.size(); ++i) {
+    out_ << (i > 0 ? "," : "") << "\"" << s.counters.at(i).first << "\":" << s.counters.at(i).second;
+  }
+
+  out_ << "},\"gauges\":{";
+  for (size_t i = 0; i < s.gauges.size(); ++i) {
+    out_ << (i > 0 ? "," : "") << "\"" << s.gauges.at(i).first << "\":" << s.gauges.at(i).second;
+  }
+
+  out_ << "}}\n";
+  out_.flush();
+}
+
+
+}
+}
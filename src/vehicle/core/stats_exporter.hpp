@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Percentiles and basic stats for one histogram in a StatsTracker.
+struct HistogramSummary final
+{
+  std::string name;
+  uint64_t count = 0;
+  double min = 0;
+  double max = 0;
+  double mean = 0;
+  double p50 = 0;
+  double p90 = 0;
+  double p99 = 0;
+  double p999 = 0;
+};
+
+
+// A copy of all of the metrics in a StatsTracker at some point in time.
+struct StatsSnapshot final
+{
+  std::string tracker_name;
+  double wall_time_sec = 0;   // Seconds since the Unix epoch.
+  std::vector<HistogramSummary> histograms;
+  std::vector<std::pair<std::string, int64_t>> counters;
+  std::vector<std::pair<std::string, double>> gauges;
+};
+
+
+// Interface for sending StatsTracker metrics somewhere (a file, an LCM channel, etc).
+class StatsExporter {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(StatsExporter)
+
+  virtual ~StatsExporter() = default;
+  virtual void Export(const StatsSnapshot& snapshot) = 0;
+};
+
+
+// Appends one CSV row per metric to a file. Histogram rows fill in the stats columns, and counter
+// and gauge rows fill in the "value" column.
+class CsvStatsExporter final : public StatsExporter {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(CsvStatsExporter)
+
+  explicit CsvStatsExporter(const std::string& filepath);
+  void Export(const StatsSnapshot& snapshot) override;
+
+ private:
+  std::ofstream out_;
+};
+
+
+// Appends one JSON object per snapshot to a file (i.e the JSON lines format).
+class JsonStatsExporter final : public StatsExporter {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(JsonStatsExporter)
+
+  explicit JsonStatsExporter(const std::string& filepath);
+  void Export(const StatsSnapshot& snapshot) override;
+
+ private:
+  std::ofstream out_;
+};
+
+
+}
+}
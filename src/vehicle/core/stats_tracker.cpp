@@ -1,3 +1,5 @@
+#include <chrono>
+
 #include "core/stats_tracker.hpp"
 
 namespace bm {
@@ -13,6 +15,9 @@ StatsTracker::StatsTracker(const std::string& tracker_name, size_t k)
 
 void StatsTracker::Add(const std::string& name, float value)
 {
+  Histogram(name).Record(value);
+
+  std::lock_guard<std::mutex> lock(mutex_);
   if (stats_.count(name) == 0) {
     stats_.emplace(name, StatsBuffer<float>(k_));
   }
@@ -24,6 +29,8 @@ void StatsTracker::Print(const std::string& name,
                          const std::string& units,
                          float print_interval_sec)
 {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   // Can't print stats for nonexistent scalar.
   if (stats_.count(name) == 0) {
     return;
@@ -40,10 +47,107 @@ void StatsTracker::Print(const std::string& name,
     stats_.at(name).MinMaxMean(N, min, max, mean);
     printf("[ %s/%s ] MIN=%f %s MAX=%f %s MEAN=%f %s (N=%d)\n",
         tracker_name_.c_str(), name.c_str(), min, units.c_str(), max, units.c_str(), mean, units.c_str(), N);
+
+    const LatencyHistogram& h = *histograms_.at(name);
+    printf("[ %s/%s ] P50=%f %s P90=%f %s P99=%f %s P999=%f %s (ALL=%lu)\n",
+        tracker_name_.c_str(), name.c_str(), h.Percentile(0.5), units.c_str(), h.Percentile(0.9), units.c_str(),
+        h.Percentile(0.99), units.c_str(), h.Percentile(0.999), units.c_str(), h.Count());
     timers_.at(name).Reset();
   }
 }
 
 
+LatencyHistogram& StatsTracker::Histogram(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<LatencyHistogram>& h = histograms_[name];
+  if (!h) {
+    h.reset(new LatencyHistogram());
+  }
+  return *h;
+}
+
+
+std::atomic<int64_t>& StatsTracker::Counter(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<std::atomic<int64_t>>& c = counters_[name];
+  if (!c) {
+    c.reset(new std::atomic<int64_t>(0));
+  }
+  return *c;
+}
+
+
+void StatsTracker::SetGauge(const std::string& name, double value)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<std::atomic<double>>& g = gauges_[name];
+  if (!g) {
+    g.reset(new std::atomic<double>(0));
+  }
+  g->store(value);
+}
+
+
+StatsSnapshot StatsTracker::Snapshot()
+{
+  StatsSnapshot s;
+  s.tracker_name = tracker_name_;
+  s.wall_time_sec = std::chrono::duration<double>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& it : histograms_) {
+    const LatencyHistogram& h = *it.second;
+    HistogramSummary summary;
+    summary.name = it.first;
+    summary.count = h.Count();
+    summary.min = h.Min();
+    summary.max = h.Max();
+    summary.mean = h.Mean();
+    summary.p50 = h.Percentile(0.5);
+    summary.p90 = h.Percentile(0.9);
+    summary.p99 = h.Percentile(0.99);
+    summary.p999 = h.Percentile(0.999);
+    s.histograms.emplace_back(summary);
+  }
+  for (const auto& it : counters_) {
+    s.counters.emplace_back(it.first, it.second->load());
+  }
+  for (const auto& it : gauges_) {
+    s.gauges.emplace_back(it.first, it.second->load());
+  }
+
+  return s;
+}
+
+
+void StatsTracker::RegisterExporter(const StatsExporter::Ptr& exporter)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  exporters_.emplace_back(exporter);
+}
+
+
+void StatsTracker::Export(float export_interval_sec)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (exporters_.empty() || export_timer_.Elapsed().seconds() < export_interval_sec) {
+      return;
+    }
+    export_timer_.Reset();
+  }
+
+  const StatsSnapshot snapshot = Snapshot();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const StatsExporter::Ptr& exporter : exporters_) {
+    exporter->Export(snapshot);
+  }
+}
+
+
 }
 }
@@ -1,43 +1,98 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "core/macros.hpp"
 #include "core/timer.hpp"
 #include "core/sliding_buffer.hpp"
+#include "core/latency_histogram.hpp"
+#include "core/stats_exporter.hpp"
 
 namespace bm {
 namespace core {
 
 
+// A SlidingBuffer that keeps its min/max/sum up to date as items are added, so that MinMaxMean()
+// doesn't have to scan the buffer. The min/max are only rescanned when the item that's pushed out
+// was the current min/max, and the sum is recomputed once per buffer cycle to avoid drift.
 template <typename Item>
 class StatsBuffer : public SlidingBuffer<Item> {
  public:
   StatsBuffer(size_t k) : SlidingBuffer<Item>(k) {}
 
+  void Add(const Item& item)
+  {
+    const size_t N_before = std::min(this->Size(), this->Added());
+    const bool is_full = (N_before == this->Size());
+    const Item evicted = is_full ? this->Get(static_cast<int>(this->Size()) - 1) : item;
+
+    SlidingBuffer<Item>::Add(item);
+
+    if (is_full && (this->Added() % this->Size()) == 0) {
+      Rescan();
+      return;
+    }
+
+    sum_ += item;
+    if (is_full) {
+      sum_ -= evicted;
+      if (evicted == min_ || evicted == max_) {
+        Rescan();
+        return;
+      }
+    }
+    min_ = std::min(min_, item);
+    max_ = std::max(max_, item);
+  }
+
   // Returns the number of items, and the min/max/mean of item values in the buffer.
   void MinMaxMean(int& N, Item& min, Item& max, Item& mean) const
   {
-    min = std::numeric_limits<Item>::max();
-    max = std::numeric_limits<Item>::min();
-    mean = 0;
     N = static_cast<int>(std::min(this->Size(), this->Added()));
+    min = min_;
+    max = max_;
+    mean = sum_ / static_cast<Item>(N);
+  }
 
+ private:
+  void Rescan()
+  {
+    const int N = static_cast<int>(std::min(this->Size(), this->Added()));
+    min_ = std::numeric_limits<Item>::max();
+    max_ = std::numeric_limits<Item>::lowest();
+    sum_ = 0;
     for (int ago = 0; ago < N; ++ago) {
       const Item val = this->Get(ago);
-      min = std::min(min, val);
-      max = std::max(max, val);
-      mean += val;
+      min_ = std::min(min_, val);
+      max_ = std::max(max_, val);
+      sum_ += val;
     }
-
-    mean /= static_cast<Item>(N);
   }
+
+ private:
+  Item min_ = std::numeric_limits<Item>::max();
+  Item max_ = std::numeric_limits<Item>::lowest();
+  Item sum_ = 0;
 };
 
 
 // Stores the k latest scalar measurements for various named parameters so that we can print out
 // basic stats about them. For example, this is useful for profiling various functions and
 // tracking how their runtime changes online.
+//
+// Every scalar that's Add()ed also goes into a histogram, so that we can look at tail latency
+// (p99, p999) over the whole run. There are also counters (e.g dropped frames) and gauges (e.g
+// queue depth). All metrics can be periodically sent to one or more StatsExporters.
+//
+// NOTE(milo): Looking up a metric by name takes a short lock. On the hot path, grab a reference
+// with Histogram() / Counter() once, and then record into it without any locking.
 class StatsTracker final {
  public:
   MACRO_DELETE_COPY_CONSTRUCTORS(StatsTracker)
@@ -51,11 +106,35 @@ class StatsTracker final {
              const std::string& units = "",
              float print_interval_sec = 0);
 
+  // Get (or create) a named histogram/counter. The reference stays valid for the tracker's lifetime.
+  LatencyHistogram& Histogram(const std::string& name);
+  std::atomic<int64_t>& Counter(const std::string& name);
+
+  void Increment(const std::string& name, int64_t n = 1) { Counter(name).fetch_add(n); }
+  void SetGauge(const std::string& name, double value);
+
+  // Copy out the current value of every histogram, counter and gauge.
+  StatsSnapshot Snapshot();
+
+  // Send a snapshot to all registered exporters, if export_interval_sec has elapsed since the last
+  // export (or always, if it's zero).
+  void RegisterExporter(const StatsExporter::Ptr& exporter);
+  void Export(float export_interval_sec = 0);
+
  private:
   std::string tracker_name_;
   size_t k_;
+
+  std::mutex mutex_;
   std::unordered_map<std::string, Timer> timers_;
   std::unordered_map<std::string, StatsBuffer<float>> stats_;
+
+  std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms_;
+  std::map<std::string, std::unique_ptr<std::atomic<int64_t>>> counters_;
+  std::map<std::string, std::unique_ptr<std::atomic<double>>> gauges_;
+
+  std::vector<StatsExporter::Ptr> exporters_;
+  Timer export_timer_;
 };
 
 
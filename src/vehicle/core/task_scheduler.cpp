@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <string>
+
+#include <glog/logging.h>
+
+#include "core/task_scheduler.hpp"
+
+namespace bm {
+namespace core {
+
+
+// The scheduler and worker index of the current thread (if it's a worker).
+static thread_local TaskScheduler* tls_scheduler = nullptr;
+static thread_local int tls_worker = -1;
+
+// Bound with ScopedTaskScheduler (for threads that aren't workers).
+static thread_local TaskScheduler* tls_bound = nullptr;
+
+static std::mutex g_global_mutex;
+static std::unique_ptr<TaskScheduler> g_global;
+
+
+TaskScheduler::TaskScheduler(int num_workers, const ThreadConfig& worker_config)
+{
+  CHECK_GE(num_workers, 0) << "Can't have a negative number of workers" << std::endl;
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.emplace_back(new Worker());
+  }
+
+  // NOTE(milo): Start the threads after all of the workers exist, since they steal from each other.
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.at(i)->thread = std::thread(&TaskScheduler::WorkerLoop, this, i, worker_config);
+  }
+}
+
+
+TaskScheduler::~TaskScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::unique_ptr<Worker>& w : workers_) {
+    w->thread.join();
+  }
+}
+
+
+TaskScheduler& TaskScheduler::Global()
+{
+  std::lock_guard<std::mutex> lock(g_global_mutex);
+  if (!g_global) {
+    const int num_cores = static_cast<int>(std::thread::hardware_concurrency());
+    g_global.reset(new TaskScheduler(std::max(0, num_cores - 1)));
+  }
+  return *g_global;
+}
+
+
+bool TaskScheduler::ConfigureGlobal(int num_workers, const ThreadConfig& worker_config)
+{
+  std::lock_guard<std::mutex> lock(g_global_mutex);
+  if (g_global) {
+    LOG(WARNING) << "The global TaskScheduler already exists, can't configure it" << std::endl;
+    return false;
+  }
+  g_global.reset(new TaskScheduler(num_workers, worker_config));
+  return true;
+}
+
+
+TaskScheduler& TaskScheduler::Current()
+{
+  if (tls_scheduler) {
+    return *tls_scheduler;
+  }
+  return tls_bound ? *tls_bound : Global();
+}
+
+
+ScopedTaskScheduler::ScopedTaskScheduler(TaskScheduler* scheduler)
+    : previous_(tls_bound)
+{
+  if (scheduler) {
+    tls_bound = scheduler;
+  }
+}
+
+
+ScopedTaskScheduler::~ScopedTaskScheduler()
+{
+  tls_bound = previous_;
+}
+
+
+int TaskScheduler::CurrentWorker() const
+{
+  return (tls_scheduler == this) ? tls_worker : -1;
+}
+
+
+void TaskScheduler::Submit(Task task, TaskGroup* group, TaskPriority priority, int worker)
+{
+  CHECK(task) << "Can't submit an empty task" << std::endl;
+  CHECK_LT(worker, NumWorkers()) << "Can't pin a task to a worker that doesn't exist" << std::endl;
+
+  if (group) {
+    ++group->pending_;
+  }
+
+  // Nobody else could run it.
+  if (workers_.empty()) {
+    Item item{ std::move(task), group };
+    Run(item);
+    return;
+  }
+
+  const int p = static_cast<int>(priority);
+  const bool pinned = worker >= 0;
+  const int self = CurrentWorker();
+
+  // Tasks from a worker go onto its own deque, since they're likely to use the same data.
+  if (!pinned) {
+    worker = (self >= 0) ? self : static_cast<int>(next_worker_.fetch_add(1) % workers_.size());
+  }
+
+  Worker& w = *workers_.at(worker);
+  {
+    std::lock_guard<std::mutex> lock(w.mutex);
+    (pinned ? w.pinned[p] : w.queues[p]).emplace_back(Item{ std::move(task), group });
+  }
+
+  // NOTE(milo): Counted under mutex_ so that a worker can't miss the wakeup.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pinned) {
+      ++w.num_pinned;
+    } else {
+      ++num_stealable_;
+    }
+  }
+
+  // Threads in Wait() can run tasks too.
+  if (pinned) {
+    work_cv_.notify_all();
+  } else {
+    work_cv_.notify_one();
+  }
+  done_cv_.notify_all();
+}
+
+
+void TaskScheduler::Wait(TaskGroup& group)
+{
+  const int self = CurrentWorker();
+
+  Item item{ nullptr, nullptr };
+  while (group.pending_.load() > 0) {
+    if (TryPop(self, item)) {
+      Run(item);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&]()
+    {
+      return group.pending_.load() == 0 ||
+             num_stealable_.load() > 0 ||
+             (self >= 0 && workers_.at(self)->num_pinned.load() > 0);
+    });
+  }
+}
+
+
+void TaskScheduler::ParallelFor(size_t n, const RangeFunction& f, size_t grain, TaskPriority priority)
+{
+  if (n == 0) {
+    return;
+  }
+
+  grain = std::max(grain, static_cast<size_t>(1));
+
+  // Not worth waking anyone up.
+  if (workers_.empty() || n <= grain) {
+    f(0, n);
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  const auto run_chunks = [&]()
+  {
+    while (true) {
+      const size_t begin = next.fetch_add(grain);
+      if (begin >= n) {
+        return;
+      }
+      f(begin, std::min(begin + grain, n));
+    }
+  };
+
+  // Helpers that start after all of the chunks are taken just return.
+  const size_t num_chunks = (n + grain - 1) / grain;
+  const size_t num_helpers = std::min(workers_.size(), num_chunks - 1);
+
+  TaskGroup group;
+  for (size_t i = 0; i < num_helpers; ++i) {
+    Submit(run_chunks, &group, priority);
+  }
+  run_chunks();
+  Wait(group);
+}
+
+
+bool TaskScheduler::TryPop(int self, Item& item)
+{
+  for (int p = 0; p < kNumPriorities; ++p) {
+    if (self >= 0) {
+      Worker& w = *workers_.at(self);
+      std::lock_guard<std::mutex> lock(w.mutex);
+      if (!w.pinned[p].empty()) {
+        item = std::move(w.pinned[p].front());
+        w.pinned[p].pop_front();
+        --w.num_pinned;
+        return true;
+      }
+      if (!w.queues[p].empty()) {
+        item = std::move(w.queues[p].back());
+        w.queues[p].pop_back();
+        --num_stealable_;
+        return true;
+      }
+    }
+    if (TrySteal(self, p, item)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool TaskScheduler::TrySteal(int self, int priority, Item& item)
+{
+  // NOTE(milo): Start at a different victim each time, so that thieves don't all pile onto one.
+  static thread_local unsigned seed = 0;
+  const size_t N = workers_.size();
+  const size_t start = (seed++) % N;
+
+  for (size_t i = 0; i < N; ++i) {
+    const size_t victim = (start + i) % N;
+    if (static_cast<int>(victim) == self) {
+      continue;
+    }
+    Worker& w = *workers_.at(victim);
+    std::lock_guard<std::mutex> lock(w.mutex);
+    std::deque<Item>& q = w.queues[priority];
+    if (!q.empty()) {
+      item = std::move(q.front());
+      q.pop_front();
+      --num_stealable_;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void TaskScheduler::Run(Item& item)
+{
+  item.task();
+  item.task = nullptr;
+
+  // NOTE(milo): The group can be destroyed as soon as pending_ hits zero, so don't touch it after.
+  if (item.group && item.group->pending_.fetch_sub(1) == 1) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_cv_.notify_all();
+  }
+  item.group = nullptr;
+}
+
+
+void TaskScheduler::WorkerLoop(int index, ThreadConfig config)
+{
+  tls_scheduler = this;
+  tls_worker = index;
+  ConfigureCurrentThread(config, "bm_task_" + std::to_string(index));
+
+  Worker& w = *workers_.at(index);
+
+  Item item{ nullptr, nullptr };
+  while (true) {
+    if (TryPop(index, item)) {
+      Run(item);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_cv_.wait(lock, [&]()
+    {
+      return stop_ || num_stealable_.load() > 0 || w.num_pinned.load() > 0;
+    });
+
+    // Drain the queues before stopping.
+    if (stop_ && num_stealable_.load() == 0 && w.num_pinned.load() == 0) {
+      return;
+    }
+  }
+}
+
+
+}
+}
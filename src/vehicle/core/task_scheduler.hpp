@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/thread_util.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Workers take HIGH tasks before NORMAL ones, and NORMAL before LOW. Use HIGH for work that
+// something on the critical path is blocked on (e.g the tracker), and LOW for background work.
+enum class TaskPriority { HIGH = 0, NORMAL = 1, LOW = 2 };
+
+
+// Counts the tasks that were submitted with it, so that a caller can wait for all of them.
+// NOTE(milo): Must outlive its tasks, so Wait() before it goes out of scope.
+class TaskGroup final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(TaskGroup)
+
+  TaskGroup() = default;
+
+  int NumPending() const { return pending_.load(); }
+
+ private:
+  friend class TaskScheduler;
+  std::atomic<int> pending_{0};
+};
+
+
+// A fixed set of workers that short tasks from the whole process share, so that the pipeline
+// doesn't oversubscribe the cores. Each worker has its own deques. It runs its newest task first
+// (which is still in cache), and steals the oldest task from a random worker when it runs out.
+// Tasks can be pinned to one worker, and are never stolen then.
+//
+// Waiting on a TaskGroup runs tasks on the calling thread in the meantime, so tasks can submit and
+// wait on other tasks (e.g nested ParallelFor) without deadlocking the workers.
+//
+// NOTE(milo): Tasks must not block on anything other than a TaskGroup. Long-running loops (like the
+// StateEstimator threads) should keep their own std::thread.
+class TaskScheduler final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(TaskScheduler)
+
+  typedef std::function<void()> Task;
+
+  // Calls f(begin, end) on chunks of the range [begin, end).
+  typedef std::function<void(size_t, size_t)> RangeFunction;
+
+  // All workers are configured with worker_config (e.g to keep them off of the cores that the
+  // realtime threads use).
+  explicit TaskScheduler(int num_workers, const ThreadConfig& worker_config = ThreadConfig());
+  ~TaskScheduler();
+
+  // The process-wide scheduler. Created on first use, with one worker less than the number of cores
+  // (since the calling thread works too), unless ConfigureGlobal() was called before that.
+  static TaskScheduler& Global();
+
+  // Returns false (and changes nothing) if the global scheduler already exists.
+  static bool ConfigureGlobal(int num_workers, const ThreadConfig& worker_config = ThreadConfig());
+
+  // The scheduler that work on this thread should go to: the worker's own scheduler (so that nested
+  // work stays on it), then the one bound with ScopedTaskScheduler, and Global() otherwise. Library
+  // code should use this instead of Global(), so that a host can give each part of the process its
+  // own pool (e.g several StateEstimators sharing one).
+  static TaskScheduler& Current();
+
+  // Queue a task. If group is given, it's counted there. A worker >= 0 pins the task to that worker.
+  void Submit(Task task,
+              TaskGroup* group = nullptr,
+              TaskPriority priority = TaskPriority::NORMAL,
+              int worker = -1);
+
+  // Block until all of the tasks in the group are done. Runs other tasks while waiting.
+  void Wait(TaskGroup& group);
+
+  // Run f over [0, n) in chunks of about "grain" items, and block until all of them are done.
+  // Unlike ThreadPool::ParallelFor(), can be nested and called from several threads at once.
+  void ParallelFor(size_t n,
+                   const RangeFunction& f,
+                   size_t grain = 1,
+                   TaskPriority priority = TaskPriority::HIGH);
+
+  int NumWorkers() const { return static_cast<int>(workers_.size()); }
+  int NumThreads() const { return NumWorkers() + 1; }
+
+  // Index of the worker this is called from, or -1 for other threads.
+  int CurrentWorker() const;
+
+ private:
+  static constexpr int kNumPriorities = 3;
+
+  struct Item final
+  {
+    Task task;
+    TaskGroup* group;
+  };
+
+  struct Worker final
+  {
+    std::mutex mutex;
+    std::deque<Item> queues[kNumPriorities];    // Can be stolen by other workers.
+    std::deque<Item> pinned[kNumPriorities];    // Only this worker runs these.
+    std::atomic<int> num_pinned{0};
+    std::thread thread;
+  };
+
+  void WorkerLoop(int index, ThreadConfig config);
+
+  // Try to find a task, first in worker "self" (if >= 0), then by stealing from the others.
+  bool TryPop(int self, Item& item);
+  bool TrySteal(int self, int priority, Item& item);
+
+  void Run(Item& item);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  bool stop_ = false;
+  std::atomic<int> num_stealable_{0};
+  std::atomic<unsigned> next_worker_{0};   // Round robin for tasks from other threads.
+};
+
+
+// Binds a scheduler to the calling thread (see TaskScheduler::Current()) until it goes out of scope.
+// A nullptr changes nothing. Nests, and restores whatever was bound before.
+class ScopedTaskScheduler final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ScopedTaskScheduler)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ScopedTaskScheduler)
+
+  explicit ScopedTaskScheduler(TaskScheduler* scheduler);
+  ~ScopedTaskScheduler();
+
+ private:
+  TaskScheduler* previous_;
+};
+
+
+}
+}
@@ -0,0 +1,102 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "core/thread_pool.hpp"
+
+namespace bm {
+namespace core {
+
+
+ThreadPool::ThreadPool(int num_workers)
+{
+  CHECK_GE(num_workers, 0) << "Can't have a negative number of workers" << std::endl;
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& t : workers_) {
+    t.join();
+  }
+}
+
+
+void ThreadPool::ParallelFor(size_t n, const RangeFunction& f, size_t grain)
+{
+  if (n == 0) {
+    return;
+  }
+
+  // Not worth waking anyone up.
+  if (workers_.empty() || n <= grain) {
+    f(0, n);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    f_ = &f;
+    n_ = n;
+    grain_ = std::max(grain, static_cast<size_t>(1));
+    next_.store(0);
+    num_busy_ = static_cast<int>(workers_.size());
+    ++generation_;
+  }
+  work_cv_.notify_all();
+
+  RunChunks();
+
+  // Wait for the workers to finish their last chunks (so that f can go out of scope).
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return num_busy_ == 0; });
+  f_ = nullptr;
+}
+
+
+void ThreadPool::RunChunks()
+{
+  while (true) {
+    const size_t begin = next_.fetch_add(grain_);
+    if (begin >= n_) {
+      return;
+    }
+    (*f_)(begin, std::min(begin + grain_, n_));
+  }
+}
+
+
+void ThreadPool::WorkerLoop()
+{
+  uint64_t seen_generation = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [&]() { return stop_ || generation_ != seen_generation; });
+      if (stop_) {
+        return;
+      }
+      seen_generation = generation_;
+    }
+
+    RunChunks();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--num_busy_ == 0) {
+      done_cv_.notify_all();
+    }
+  }
+}
+
+
+}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A fixed set of worker threads for data-parallel loops, for libraries that don't link OpenCV (and
+// so can't use cv::parallel_for_). The calling thread works too, so ThreadPool(0) runs serially.
+//
+// NOTE(milo): ParallelFor() calls can't be nested or made from several threads at once.
+class ThreadPool final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ThreadPool)
+
+  // Calls f(begin, end) on chunks of the range [begin, end).
+  typedef std::function<void(size_t, size_t)> RangeFunction;
+
+  explicit ThreadPool(int num_workers);
+  ~ThreadPool();
+
+  // Run f over [0, n) in chunks of about "grain" items, and block until all of them are done.
+  void ParallelFor(size_t n, const RangeFunction& f, size_t grain = 1);
+
+  int NumThreads() const { return static_cast<int>(workers_.size()) + 1; }
+
+ private:
+  void WorkerLoop();
+  void RunChunks();
+
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  bool stop_ = false;
+  uint64_t generation_ = 0;     // Bumped for each ParallelFor().
+  int num_busy_ = 0;            // Workers still working on this generation.
+
+  // The current loop.
+  const RangeFunction* f_ = nullptr;
+  size_t n_ = 0;
+  size_t grain_ = 1;
+  std::atomic<size_t> next_{0};
+};
+
+
+}
+}
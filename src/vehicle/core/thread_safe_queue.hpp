@@ -1,13 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
-#include <queue>
+#include <deque>
 #include <utility>
+#include <vector>
 
 #include <eigen3/Eigen/StdDeque>
 
 #include <glog/logging.h>
 
+#include "core/async_log.hpp"
+#include "core/queue_telemetry.hpp"
+
 namespace bm {
 namespace core {
 
@@ -15,6 +22,9 @@ namespace core {
 template<typename Item>
 class ThreadsafeQueue {
  public:
+  // Used by DataManager to decide whether it needs to take its own lock.
+  static constexpr bool kLockFree = false;
+
   // Construct the queue with a max size and drop policy.
   // If max_queue_size is zero, no items are dropped (size unbounded).
   ThreadsafeQueue(size_t max_queue_size,
@@ -29,24 +39,59 @@ class ThreadsafeQueue {
   bool Push(Item item)
   {
     bool did_push = false;
+    const int64_t now_ns = QueueTelemetry::Now();
     lock_.lock();
     if (q_.size() >= max_queue_size_ && max_queue_size_ != 0) {
+      ++num_dropped_;
       if (drop_oldest_if_full_) {
-        LOG(WARNING) << "Dropping item from ThreadSafeQueue!"
-            << "\n  Queue=" << queue_name_
-            << "\n  Item=" << typeid(Item).name() << std::endl;
-        q_.pop();
-        q_.push(std::move(item));
+        BM_LOG_EVERY_SEC(WARNING, 1.0) << "Dropping item from ThreadSafeQueue!"
+            << " Queue=" << queue_name_ << " Item=" << typeid(Item).name();
+        q_.pop_front();
+        push_ns_.pop_front();
+        q_.push_back(std::move(item));
+        push_ns_.push_back(now_ns);
         did_push = true;
       }
     } else {
-      q_.push(std::move(item));
+      q_.push_back(std::move(item));
+      push_ns_.push_back(now_ns);
       did_push = true;
     }
+    if (did_push) { telemetry_.RecordPush(1, q_.size()); }
     lock_.unlock();
+    cv_.notify_all();
     return did_push;
   }
 
+  // Push several items (oldest first) with one lock and one notification. Returns the number of
+  // items pushed, which are always the first ones (the rest are dropped if the queue fills up).
+  size_t PushBatch(std::vector<Item>&& items)
+  {
+    size_t num_pushed = 0;
+    const int64_t now_ns = QueueTelemetry::Now();
+    lock_.lock();
+    for (Item& item : items) {
+      if (q_.size() >= max_queue_size_ && max_queue_size_ != 0) {
+        if (!drop_oldest_if_full_) {
+          num_dropped_ += items.size() - num_pushed;
+          break;
+        }
+        ++num_dropped_;
+        BM_LOG_EVERY_SEC(WARNING, 1.0) << "Dropping item from ThreadSafeQueue!"
+            << " Queue=" << queue_name_ << " Item=" << typeid(Item).name();
+        q_.pop_front();
+        push_ns_.pop_front();
+      }
+      q_.push_back(std::move(item));
+      push_ns_.push_back(now_ns);
+      ++num_pushed;
+    }
+    telemetry_.RecordPush(num_pushed, q_.size());
+    lock_.unlock();
+    cv_.notify_all();
+    return num_pushed;
+  }
+
   // Pop the item at the front of the queue (oldest).
   // NOTE(milo): This could cause problems if there are MULTIPLE things popping from the queue! Only
   // use with a single consumer!
@@ -58,8 +103,9 @@ class ThreadsafeQueue {
         << "\n  Queue=" << queue_name_
         << "\n  Item=" << typeid(Item).name() << std::endl;
     Item item = std::move(q_.front());
-    q_.pop();
+    PopFrontLocked(QueueTelemetry::Now());
     lock_.unlock();
+    cv_.notify_all();
     return std::move(item);
   }
 
@@ -71,12 +117,63 @@ class ThreadsafeQueue {
     const bool nonempty = !q_.empty();
     if (nonempty) {
       item = std::move(q_.front());
-      q_.pop();
+      PopFrontLocked(QueueTelemetry::Now());
     }
     lock_.unlock();
+    if (nonempty) { cv_.notify_all(); }
+    return nonempty;
+  }
+
+  // Wait up to timeout_sec for an item, and pop it if one arrives. A negative timeout waits forever.
+  // Returns false if the timeout elapsed or the queue was closed while empty.
+  bool PopBlocking(Item& item, double timeout_sec = -1)
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    Wait(lock, [this]() { return !q_.empty() || closed_; }, timeout_sec);
+    const bool nonempty = !q_.empty();
+    if (nonempty) {
+      item = std::move(q_.front());
+      PopFrontLocked(QueueTelemetry::Now());
+    }
+    lock.unlock();
+    if (nonempty) { cv_.notify_all(); }
     return nonempty;
   }
 
+  // Block until the queue is nonempty, it's closed, or timeout_sec elapses. A negative timeout
+  // waits forever. Returns whether the queue is nonempty.
+  bool WaitNotEmpty(double timeout_sec = -1)
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    Wait(lock, [this]() { return !q_.empty() || closed_; }, timeout_sec);
+    return !q_.empty();
+  }
+
+  // Block until consumers have emptied the queue, it's closed, or timeout_sec elapses. Returns
+  // whether the queue is empty.
+  bool WaitEmpty(double timeout_sec = -1)
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    Wait(lock, [this]() { return q_.empty() || closed_; }, timeout_sec);
+    return q_.empty();
+  }
+
+  // Wake up all waiting threads and make future waits return immediately. Items can still be
+  // pushed and popped after closing; this is just a signal that everyone should stop blocking.
+  void Close()
+  {
+    lock_.lock();
+    closed_ = true;
+    lock_.unlock();
+    cv_.notify_all();
+  }
+
+  bool IsClosed()
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    return closed_;
+  }
+
   // Return the current size of the queue.
   size_t Size()
   {
@@ -99,6 +196,40 @@ class ThreadsafeQueue {
     return item;
   }
 
+  // Size of the queue. With a single consumer, items [0, ConsumerSize()) can be accessed with At()
+  // until the consumer pops them.
+  size_t ConsumerSize() { return Size(); }
+
+  // Access the i-th item from the front (oldest) without popping it.
+  const Item& At(size_t i)
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    CHECK_LT(i, q_.size()) << "Tried to At() past the end of ThreadsafeQueue!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return q_.at(i);
+  }
+
+  // Discard the n oldest items in one shot (or all of them if there are fewer than n).
+  void PopFront(size_t n)
+  {
+    lock_.lock();
+    n = std::min(n, q_.size());
+    const int64_t now_ns = QueueTelemetry::Now();
+    for (size_t i = 0; i < n; ++i) {
+      PopFrontLocked(now_ns);
+    }
+    lock_.unlock();
+    if (n > 0) { cv_.notify_all(); }
+  }
+
+  // Total number of items dropped (either policy) since construction.
+  size_t NumDropped() const { return num_dropped_.load(); }
+
+  // Push/pop counts, high-water depth and dwell times (see QueueTelemetry). Items that are popped
+  // with PopFront() count as popped too.
+  const QueueTelemetry& Telemetry() const { return telemetry_; }
+
   const Item& PeekBack()
   {
     lock_.lock();
@@ -110,15 +241,44 @@ class ThreadsafeQueue {
     return item;
   }
 
+ private:
+  // Pop the front item (which the caller has already moved out) and record how long it waited.
+  // NOTE(milo): Must hold the lock.
+  void PopFrontLocked(int64_t now_ns)
+  {
+    q_.pop_front();
+    telemetry_.RecordPop(push_ns_.front(), now_ns, q_.size());
+    push_ns_.pop_front();
+  }
+
+  template <typename Predicate>
+  void Wait(std::unique_lock<std::mutex>& lock, Predicate pred, double timeout_sec)
+  {
+    if (timeout_sec < 0) {
+      cv_.wait(lock, pred);
+    } else {
+      cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec), pred);
+    }
+  }
+
  private:
   size_t max_queue_size_ = 0;
   bool drop_oldest_if_full_ = true;
   std::string queue_name_;
 
   // http://eigen.tuxfamily.org/dox-devel/group__TopicStlContainers.html
-  std::queue<Item, std::deque<Item, Eigen::aligned_allocator<Item>>> q_;
+  std::deque<Item, Eigen::aligned_allocator<Item>> q_;
+  std::deque<int64_t> push_ns_;         // When each item in q_ was pushed.
   std::mutex lock_;
+  std::condition_variable cv_;
+  bool closed_ = false;
+  std::atomic<size_t> num_dropped_{0};
+  QueueTelemetry telemetry_;
 };
 
+
+template <typename Item>
+constexpr bool ThreadsafeQueue<Item>::kLockFree;
+
 }
 }
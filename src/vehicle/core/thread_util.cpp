@@ -0,0 +1,65 @@
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "core/thread_util.hpp"
+
+namespace bm {
+namespace core {
+
+
+bool ConfigureCurrentThread(const ThreadConfig& config, const std::string& name)
+{
+  bool ok = true;
+  const pthread_t self = pthread_self();
+
+  // NOTE(milo): Linux limits thread names to 15 characters.
+  if (!name.empty()) {
+    pthread_setname_np(self, name.substr(0, 15).c_str());
+  }
+
+  if (!config.cpus.empty()) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (const int cpu : config.cpus) {
+      CHECK(cpu >= 0 && cpu < CPU_SETSIZE) << "Invalid cpu index: " << cpu << std::endl;
+      CPU_SET(cpu, &cpuset);
+    }
+    const int err = pthread_setaffinity_np(self, sizeof(cpu_set_t), &cpuset);
+    if (err != 0) {
+      LOG(WARNING) << "Failed to set CPU affinity for thread " << name << ": " << std::strerror(err) << std::endl;
+      ok = false;
+    }
+  }
+
+  if (config.realtime_priority > 0) {
+    sched_param param;
+    param.sched_priority = config.realtime_priority;
+    const int err = pthread_setschedparam(self, SCHED_FIFO, &param);
+    if (err != 0) {
+      LOG(WARNING) << "Failed to set SCHED_FIFO priority " << config.realtime_priority
+                   << " for thread " << name << ": " << std::strerror(err) << std::endl;
+      ok = false;
+    }
+  } else if (config.nice != 0) {
+    // On Linux, the nice value is per-thread when set via the thread id.
+    const pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, tid, config.nice) != 0) {
+      LOG(WARNING) << "Failed to set nice " << config.nice << " for thread " << name
+                   << ": " << std::strerror(errno) << std::endl;
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+
+}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace bm {
+namespace core {
+
+
+// Scheduling options for a worker thread. The defaults leave the thread alone.
+struct ThreadConfig final
+{
+  std::vector<int> cpus;        // Pin to these cores (empty = any core).
+  int realtime_priority = 0;    // 1-99 uses SCHED_FIFO (needs CAP_SYS_NICE), 0 uses SCHED_OTHER.
+  int nice = 0;                 // Only used with SCHED_OTHER. Negative values need CAP_SYS_NICE.
+};
+
+
+// Apply a ThreadConfig to the CALLING thread, and give it a name (shows up in top, gdb, etc).
+// Failures (e.g missing permissions, nonexistent cores) are logged, but not fatal, since the
+// thread can still do its job. Returns whether every setting was applied.
+bool ConfigureCurrentThread(const ThreadConfig& config, const std::string& name = "");
+
+
+}
+}
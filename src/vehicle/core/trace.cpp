@@ -0,0 +1,129 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "core/trace.hpp"
+
+namespace bm {
+namespace core {
+
+
+static uint64_t SteadyClockNs()
+{
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+// Escape the few characters that would break a JSON string.
+static std::string JsonEscape(const std::string& s)
+{
+  std::string out;
+  out.reserve(s.size());
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+    }
+    out.push_back(c);
+  }
+  return out;
+}
+
+
+TraceBuffer::TraceBuffer(size_t capacity, uint32_t thread_id)
+    : capacity_(capacity),
+      thread_id_(thread_id),
+      events_(new TraceEvent[capacity]) {}
+
+
+constexpr size_t Tracer::kEventsPerThread;
+
+
+Tracer& Tracer::Instance()
+{
+  static Tracer tracer;
+  return tracer;
+}
+
+
+Tracer::Tracer() : t0_ns_(SteadyClockNs()) {}
+
+
+uint64_t Tracer::NowNs() const
+{
+  // Add 1 so that a valid start time is never zero.
+  return SteadyClockNs() - t0_ns_ + 1;
+}
+
+
+TraceBuffer& Tracer::ThreadBuffer()
+{
+  static thread_local TraceBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace_back(new TraceBuffer(kEventsPerThread, static_cast<uint32_t>(buffers_.size())));
+    buffer = buffers_.back().get();
+  }
+  return *buffer;
+}
+
+
+bool Tracer::WriteChromeTrace(const std::string& filepath)
+{
+  std::ofstream out(filepath, std::ios::out | std::ios::trunc);
+  if (!out.is_open()) {
+    LOG(WARNING) << "Could not open trace file: " << filepath << std::endl;
+    return false;
+  }
+
+  const int pid = static_cast<int>(getpid());
+  bool first = true;
+
+  out << std::fixed << std::setprecision(3);
+  out << "{\"traceEvents\":[\n";
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::unique_ptr<TraceBuffer>& buffer : buffers_) {
+    const uint32_t tid = buffer->ThreadId();
+
+    if (!buffer->ThreadName().empty()) {
+      out << (first ? "" : ",\n")
+          << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+          << ",\"args\":{\"name\":\"" << JsonEscape(buffer->ThreadName()) << "\"}}";
+      first = false;
+    }
+
+    // Chrome trace timestamps are in microseconds.
+    const size_t N = buffer->Size();
+    for (size_t i = 0; i < N; ++i) {
+      const TraceEvent& e = buffer->At(i);
+      out << (first ? "" : ",\n")
+          << "{\"name\":\"" << JsonEscape(e.name) << "\",\"ph\":\"X\",\"pid\":" << pid
+          << ",\"tid\":" << tid
+          << ",\"ts\":" << static_cast<double>(e.start_ns) * 1e-3
+          << ",\"dur\":" << static_cast<double>(e.duration_ns) * 1e-3 << "}";
+      first = false;
+    }
+  }
+
+  out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return true;
+}
+
+
+size_t Tracer::NumDropped()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t total = 0;
+  for (const std::unique_ptr<TraceBuffer>& buffer : buffers_) {
+    total += buffer->NumDropped();
+  }
+  return total;
+}
+
+
+}
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+
+// Scoped tracing for the hot path. Each thread appends events to its own buffer without any
+// locking, and the whole trace can be written out as Chrome trace JSON. That file can be opened
+// in chrome://tracing or https://ui.perfetto.dev to see how stages overlap across threads.
+//
+// Tracing is compiled out entirely unless BM_ENABLE_TRACING is defined (see the CMake option). To
+// record, call Tracer::Instance().Start(), and call WriteChromeTrace() when done.
+//
+// Usage:
+//  BM_TRACE_THREAD_NAME("smoother");
+//  {
+//    BM_TRACE_SCOPE("SmootherUpdate");
+//    ...
+//  }
+#ifdef BM_ENABLE_TRACING
+  #define BM_TRACE_CONCAT_INNER(a, b) a##b
+  #define BM_TRACE_CONCAT(a, b) BM_TRACE_CONCAT_INNER(a, b)
+  #define BM_TRACE_SCOPE(name) ::bm::core::ScopedTrace BM_TRACE_CONCAT(bm_scoped_trace_, __LINE__)(name)
+  #define BM_TRACE_FUNCTION() BM_TRACE_SCOPE(__FUNCTION__)
+  #define BM_TRACE_THREAD_NAME(name) ::bm::core::Tracer::Instance().SetThreadName(name)
+#else
+  #define BM_TRACE_SCOPE(name)
+  #define BM_TRACE_FUNCTION()
+  #define BM_TRACE_THREAD_NAME(name)
+#endif
+
+namespace bm {
+namespace core {
+
+
+// A completed scope. The name must be a string literal (or otherwise outlive the Tracer).
+struct TraceEvent final
+{
+  const char* name = nullptr;
+  uint64_t start_ns = 0;    // Since the Tracer was created.
+  uint64_t duration_ns = 0;
+};
+
+
+// Fixed-capacity event storage for ONE writer thread. The writer never blocks; once the buffer is
+// full, new events are counted and dropped. Other threads can safely read the first Size() events.
+class TraceBuffer final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(TraceBuffer)
+
+  TraceBuffer(size_t capacity, uint32_t thread_id);
+
+  void Add(const TraceEvent& event)
+  {
+    const size_t i = size_.load(std::memory_order_relaxed);
+    if (i >= capacity_) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events_[i] = event;
+    size_.store(i + 1, std::memory_order_release);
+  }
+
+  size_t Size() const { return size_.load(std::memory_order_acquire); }
+  const TraceEvent& At(size_t i) const { return events_[i]; }
+  size_t NumDropped() const { return num_dropped_.load(std::memory_order_relaxed); }
+  uint32_t ThreadId() const { return thread_id_; }
+
+  // NOTE(milo): Only the writer thread should set the name, before it records anything.
+  void SetThreadName(const std::string& name) { thread_name_ = name; }
+  const std::string& ThreadName() const { return thread_name_; }
+
+ private:
+  size_t capacity_;
+  uint32_t thread_id_;
+  std::string thread_name_;
+  std::unique_ptr<TraceEvent[]> events_;
+  std::atomic<size_t> size_{0};
+  std::atomic<size_t> num_dropped_{0};
+};
+
+
+// Process-wide owner of all thread buffers. Buffers are never freed while the process is running,
+// so events from threads that already exited still show up in the trace.
+class Tracer final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(Tracer)
+
+  // Max number of events stored for each thread.
+  static constexpr size_t kEventsPerThread = 1 << 16;
+
+  static Tracer& Instance();
+
+  // Events are only recorded between Start() and Stop().
+  void Start() { enabled_.store(true, std::memory_order_relaxed); }
+  void Stop() { enabled_.store(false, std::memory_order_relaxed); }
+  bool Enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // Nanoseconds since the Tracer was created.
+  uint64_t NowNs() const;
+
+  // Get the calling thread's buffer, creating it on first use (this takes a lock ONCE per thread).
+  TraceBuffer& ThreadBuffer();
+
+  void SetThreadName(const std::string& name) { ThreadBuffer().SetThreadName(name); }
+
+  // Write all events recorded so far in the Chrome trace event format. Returns false if the file
+  // couldn't be opened.
+  bool WriteChromeTrace(const std::string& filepath);
+
+  // Total number of events dropped because a thread buffer was full.
+  size_t NumDropped();
+
+ private:
+  Tracer();
+
+ private:
+  std::atomic_bool enabled_{false};
+  uint64_t t0_ns_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers_;
+};
+
+
+// Records a TraceEvent for the lifetime of this object.
+class ScopedTrace final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ScopedTrace)
+
+  explicit ScopedTrace(const char* name)
+      : name_(name), start_ns_(Tracer::Instance().Enabled() ? Tracer::Instance().NowNs() : 0) {}
+
+  ~ScopedTrace()
+  {
+    Tracer& tracer = Tracer::Instance();
+    if (start_ns_ == 0 || !tracer.Enabled()) {
+      return;
+    }
+    TraceEvent event;
+    event.name = name_;
+    event.start_ns = start_ns_;
+    event.duration_ns = tracer.NowNs() - start_ns_;
+    tracer.ThreadBuffer().Add(event);
+  }
+
+ private:
+  const char* name_;
+  uint64_t start_ns_;
+};
+
+
+}
+}
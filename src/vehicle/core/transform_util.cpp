@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cmath>
+
 #include <glog/logging.h>
+
 #include "core/transform_util.hpp"
 
 namespace bm {
@@ -46,7 +50,7 @@ Vector3d skewcoords(Matrix3d M)
 }
 
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
-Matrix4d inverse_se3(Matrix4d T)
+Matrix4d inverse_se3(const Matrix4d& T)
 {
   Matrix4d Tinv = Matrix4d::Identity();
   Matrix3d R;
@@ -59,7 +63,7 @@ Matrix4d inverse_se3(Matrix4d T)
 }
 
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
-Matrix4d expmap_se3(Vector6d x)
+Matrix4d expmap_se3(const Vector6d& x)
 {
   Matrix3d R, V, s, I = Matrix3d::Identity();
   Vector3d t, w;
@@ -80,7 +84,7 @@ Matrix4d expmap_se3(Vector6d x)
 }
 
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
-Vector6d logmap_se3(Matrix4d T)
+Vector6d logmap_se3(const Matrix4d& T)
 {
   Matrix3d R, Id3 = Matrix3d::Identity();
   Vector3d Vt, t, w;
@@ -114,6 +118,128 @@ Vector6d logmap_se3(Matrix4d T)
 }
 
 
+// Below this angle, ExpSE3() and LogSE3() use Taylor expansions of their coefficients.
+static const double kSmallAngle = 1e-4;
+
+
+template <typename Scalar>
+static Matrix3T<Scalar> SkewT(const Vector3T<Scalar>& v)
+{
+  Matrix3T<Scalar> S;
+  S <<     0, -v(2),  v(1),
+        v(2),     0, -v(0),
+       -v(1),  v(0),     0;
+  return S;
+}
+
+
+template <typename Scalar>
+RigidT<Scalar> ExpSE3(const Vector6T<Scalar>& xi)
+{
+  const Vector3T<Scalar> u = xi.template head<3>();
+  const Vector3T<Scalar> w = xi.template tail<3>();
+  const Scalar theta2 = w.squaredNorm();
+  const Matrix3T<Scalar> W = SkewT<Scalar>(w);
+  const Matrix3T<Scalar> W2 = W * W;
+
+  // R = I + a*W + b*W^2 and V = I + b*W + c*W^2 (Rodrigues).
+  Scalar a, b, c;
+  if (theta2 < kSmallAngle * kSmallAngle) {
+    a = 1 - theta2 / 6;
+    b = Scalar(0.5) - theta2 / 24;
+    c = Scalar(1) / 6 - theta2 / 120;
+  } else {
+    const Scalar theta = std::sqrt(theta2);
+    const Scalar s = std::sin(theta);
+    const Scalar co = std::cos(theta);
+    a = s / theta;
+    b = (1 - co) / theta2;
+    c = (theta - s) / (theta2 * theta);
+  }
+
+  const Matrix3T<Scalar> I = Matrix3T<Scalar>::Identity();
+  return RigidT<Scalar>(I + a*W + b*W2, (I + b*W + c*W2) * u);
+}
+
+
+template <typename Scalar>
+Vector6T<Scalar> LogSE3(const RigidT<Scalar>& T)
+{
+  const Matrix3T<Scalar>& R = T.R;
+  const Scalar cosine = std::max(Scalar(-1), std::min(Scalar(1), (R.trace() - 1) / 2));
+  const Vector3T<Scalar> v(R(2, 1) - R(1, 2), R(0, 2) - R(2, 0), R(1, 0) - R(0, 1));
+
+  // NOTE(milo): Near pi, sin(theta) is tiny, so the axis comes from the symmetric part of R.
+  Vector3T<Scalar> w;
+  Scalar theta2;
+  if (cosine > 1 - Scalar(0.5) * kSmallAngle * kSmallAngle) {
+    w = Scalar(0.5) * v;
+    theta2 = w.squaredNorm();
+  } else if (cosine < Scalar(-0.99)) {
+    const Scalar theta = std::acos(cosine);
+    const Matrix3T<Scalar> B = (R + R.transpose()) / 2 - cosine * Matrix3T<Scalar>::Identity();
+    int k;
+    B.diagonal().maxCoeff(&k);
+    Vector3T<Scalar> axis = B.col(k) / std::sqrt(std::max(B(k, k), Scalar(1e-12)) * (1 - cosine));
+    axis.normalize();
+    if (axis.dot(v) < 0) {
+      axis = -axis;
+    }
+    w = theta * axis;
+    theta2 = theta * theta;
+  } else {
+    const Scalar theta = std::acos(cosine);
+    w = (theta / (2 * std::sin(theta))) * v;
+    theta2 = theta * theta;
+  }
+
+  // V^-1 = I - W/2 + d*W^2, with d -> 1/12 for small angles.
+  const Matrix3T<Scalar> W = SkewT<Scalar>(w);
+  Scalar d;
+  if (theta2 < kSmallAngle * kSmallAngle) {
+    d = Scalar(1) / 12 + theta2 / 720;
+  } else {
+    const Scalar theta = std::sqrt(theta2);
+    d = (1 - theta * std::sin(theta) / (2 * (1 - std::cos(theta)))) / theta2;
+  }
+
+  Vector6T<Scalar> xi;
+  xi.template head<3>() = (Matrix3T<Scalar>::Identity() - Scalar(0.5)*W + d*W*W) * T.t;
+  xi.template tail<3>() = w;
+  return xi;
+}
+
+
+template <typename Scalar>
+void ExpSE3(const Vector6T<Scalar>* xi, RigidT<Scalar>* T, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) {
+    T[i] = ExpSE3<Scalar>(xi[i]);
+  }
+}
+
+
+template <typename Scalar>
+void LogSE3(const RigidT<Scalar>* T, Vector6T<Scalar>* xi, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) {
+    xi[i] = LogSE3<Scalar>(T[i]);
+  }
+}
+
+
+#define INSTANTIATE_SE3(Scalar) \
+  template RigidT<Scalar> ExpSE3<Scalar>(const Vector6T<Scalar>&); \
+  template Vector6T<Scalar> LogSE3<Scalar>(const RigidT<Scalar>&); \
+  template void ExpSE3<Scalar>(const Vector6T<Scalar>*, RigidT<Scalar>*, size_t); \
+  template void LogSE3<Scalar>(const RigidT<Scalar>*, Vector6T<Scalar>*, size_t);
+
+INSTANTIATE_SE3(double)
+INSTANTIATE_SE3(float)
+
+#undef INSTANTIATE_SE3
+
+
 Axis3 GetGravityAxis(const Vector3d& n_gravity, Vector3d& n_gravity_unit)
 {
   const double max_value = n_gravity.cwiseAbs().maxCoeff();
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 #include "core/axis3.hpp"
 #include "core/eigen_types.hpp"
 #include "vision_core/pinhole_camera.hpp"
@@ -17,13 +19,78 @@ Matrix3d fast_skewexp(Vector3d v);
 Vector3d skewcoords(Matrix3d M);
 
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
-Matrix4d inverse_se3(Matrix4d T);
+Matrix4d inverse_se3(const Matrix4d& T);
 
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
-Matrix4d expmap_se3(Vector6d x);
+Matrix4d expmap_se3(const Vector6d& x);
 
 // From: https://github.com/rubengooj/stvo-pl/blob/master/src/auxiliar.cpp
-Vector6d logmap_se3(Matrix4d T);
+Vector6d logmap_se3(const Matrix4d& T);
+
+
+// A rigid transform stored as a rotation and a translation, so that inner loops don't have to carry
+// around (and multiply through) the bottom row of a 4x4. Composing, inverting and transforming
+// points are fused into the 3x3 and 3x1 math.
+template <typename Scalar>
+struct RigidT final
+{
+  typedef Eigen::Matrix<Scalar, 3, Eigen::Dynamic> Points;
+
+  RigidT() : R(Matrix3T<Scalar>::Identity()), t(Vector3T<Scalar>::Zero()) {}
+  RigidT(const Matrix3T<Scalar>& R, const Vector3T<Scalar>& t) : R(R), t(t) {}
+  explicit RigidT(const Matrix4T<Scalar>& T) : R(T.template block<3, 3>(0, 0)), t(T.template block<3, 1>(0, 3)) {}
+
+  Matrix4T<Scalar> Matrix() const
+  {
+    Matrix4T<Scalar> T = Matrix4T<Scalar>::Identity();
+    T.template block<3, 3>(0, 0) = R;
+    T.template block<3, 1>(0, 3) = t;
+    return T;
+  }
+
+  RigidT Inverse() const
+  {
+    const Matrix3T<Scalar> Rt = R.transpose();
+    return RigidT(Rt, -(Rt * t));
+  }
+
+  RigidT operator*(const RigidT& other) const { return RigidT(R * other.R, R * other.t + t); }
+  Vector3T<Scalar> operator*(const Vector3T<Scalar>& p) const { return R * p + t; }
+
+  // Transform a 3xN block of points in one go (out can't alias P).
+  void TransformPoints(const Points& P, Points& out) const
+  {
+    out.noalias() = R * P;
+    out.colwise() += t;
+  }
+
+  template <typename Other>
+  RigidT<Other> Cast() const { return RigidT<Other>(R.template cast<Other>(), t.template cast<Other>()); }
+
+  Matrix3T<Scalar> R;
+  Vector3T<Scalar> t;
+};
+
+typedef RigidT<double> Rigid3d;
+typedef RigidT<float> Rigid3f;
+
+
+// Exponential map from se(3), with the same convention as expmap_se3 (translation first, then
+// rotation). Small rotations use a Taylor expansion instead of dividing by a tiny angle.
+template <typename Scalar>
+RigidT<Scalar> ExpSE3(const Vector6T<Scalar>& xi);
+
+// Logarithm map to se(3), inverse of ExpSE3().
+template <typename Scalar>
+Vector6T<Scalar> LogSE3(const RigidT<Scalar>& T);
+
+// Batched versions over arrays of n elements. The loops have no dependencies between elements (and
+// no 4x4s), so each one is straight-line 3x3 math that the compiler can vectorize and pipeline.
+template <typename Scalar>
+void ExpSE3(const Vector6T<Scalar>* xi, RigidT<Scalar>* T, size_t n);
+
+template <typename Scalar>
+void LogSE3(const RigidT<Scalar>* T, Vector6T<Scalar>* xi, size_t n);
 
 
 inline Vector4d MakeHomogeneous(const Vector3d& vec)
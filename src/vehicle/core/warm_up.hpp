@@ -0,0 +1,40 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bm {
+namespace core {
+
+
+// How long each stage of warming up a module took (e.g StateEstimator::WarmUp()). The first frames
+// through CUDA, OpenCV and GTSAM are much slower than the rest (context creation, kernel loading,
+// first touch allocations), so nodes run a few dummy frames through before reporting that they're
+// ready for real data.
+struct WarmUpReport final
+{
+  void Add(const std::string& stage, double ms) { stages_ms.emplace_back(stage, ms); }
+
+  double TotalMs() const
+  {
+    double total = 0;
+    for (const auto& stage : stages_ms) { total += stage.second; }
+    return total;
+  }
+
+  std::string ToString() const
+  {
+    std::stringstream ss;
+    for (const auto& stage : stages_ms) { ss << stage.first << "=" << stage.second << "ms "; }
+    ss << "total=" << TotalMs() << "ms";
+    return ss.str();
+  }
+
+  std::vector<std::pair<std::string, double>> stages_ms;
+};
+
+
+}
+}
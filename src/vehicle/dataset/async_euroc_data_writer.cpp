@@ -0,0 +1,214 @@
+#include <glog/logging.h>
+
+#include "core/timer.hpp"
+#include "dataset/async_euroc_data_writer.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+AsyncEurocDataWriter::AsyncEurocDataWriter(const std::string& folder,
+                                           const std::string& image_ext,
+                                           int compression,
+                                           int num_encoders,
+                                           size_t max_queued_stereo,
+                                           bool drop_if_full,
+                                           double flush_period_sec)
+    : writer_(folder, image_ext, compression),
+      max_queued_stereo_(max_queued_stereo),
+      drop_if_full_(drop_if_full),
+      flush_period_sec_(flush_period_sec),
+      stats_("AsyncEurocDataWriter", 100),
+      stereo_wait_ms_(stats_.Histogram("Backpressure/stereo_wait_ms")),
+      stereo_depth_(stats_.Histogram("Queue/stereo_depth")),
+      encode_ms_(stats_.Histogram("Encode/stereo_ms")),
+      csv_batch_ms_(stats_.Histogram("Write/csv_batch_ms")),
+      num_blocked_(stats_.Counter("Backpressure/stereo_blocked")),
+      num_dropped_(stats_.Counter("Backpressure/stereo_dropped")),
+      num_failed_(stats_.Counter("Encode/stereo_failed"))
+{
+  CHECK_GT(num_encoders, 0) << "Need at least one encoder thread" << std::endl;
+  CHECK_GT(max_queued_stereo, 0ul) << "Stereo queue can't be empty" << std::endl;
+  CHECK_GT(flush_period_sec, 0) << "Flush period has to be positive" << std::endl;
+
+  for (int i = 0; i < num_encoders; ++i) {
+    encoders_.emplace_back(&AsyncEurocDataWriter::EncoderLoop, this);
+  }
+  io_thread_ = std::thread(&AsyncEurocDataWriter::IoLoop, this);
+}
+
+
+AsyncEurocDataWriter::~AsyncEurocDataWriter()
+{
+  Close();
+}
+
+
+void AsyncEurocDataWriter::WriteImu(const ImuMeasurement& data)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(!closed_) << "Can't write after Close()" << std::endl;
+  pending_imu_.emplace_back(data);
+}
+
+
+void AsyncEurocDataWriter::WriteDepth(const DepthMeasurement& data)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(!closed_) << "Can't write after Close()" << std::endl;
+  pending_depth_.emplace_back(data);
+}
+
+
+void AsyncEurocDataWriter::WriteRange(const RangeMeasurement& data)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(!closed_) << "Can't write after Close()" << std::endl;
+  pending_range_.emplace_back(data);
+}
+
+
+void AsyncEurocDataWriter::WriteMag(const MagMeasurement& data)
+{
+  // NOTE(milo): EurocDataWriter only warns about these, so there's nothing to queue up.
+  writer_.WriteMag(data);
+}
+
+
+void AsyncEurocDataWriter::WriteStereo(const StereoImage3b& data)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK(!closed_) << "Can't write after Close()" << std::endl;
+
+  stereo_depth_.Record(static_cast<double>(stereo_queue_.size()));
+
+  if (stereo_queue_.size() >= max_queued_stereo_) {
+    if (drop_if_full_) {
+      ++num_dropped_;
+      LOG_EVERY_N(WARNING, 30) << "Stereo queue is full, dropping pairs (disk can't keep up)" << std::endl;
+      return;
+    }
+
+    ++num_blocked_;
+    Timer timer(true);
+    space_cv_.wait(lock, [this]() { return stereo_queue_.size() < max_queued_stereo_; });
+    stereo_wait_ms_.Record(timer.Elapsed().milliseconds());
+  }
+
+  // NOTE(milo): The images are shallow copies, so the caller shouldn't write into them afterwards.
+  stereo_queue_.emplace_back(next_seq_++, data);
+  lock.unlock();
+  encode_cv_.notify_one();
+}
+
+
+void AsyncEurocDataWriter::EncoderLoop()
+{
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    encode_cv_.wait(lock, [this]() { return closed_ || !stereo_queue_.empty(); });
+
+    // Finish everything that was queued before exiting.
+    if (stereo_queue_.empty()) {
+      return;
+    }
+
+    std::pair<uint64_t, StereoImage3b> item = std::move(stereo_queue_.front());
+    stereo_queue_.pop_front();
+    lock.unlock();
+    space_cv_.notify_one();
+
+    Timer timer(true);
+    const bool ok = writer_.WriteStereoImages(item.second);
+    encode_ms_.Record(timer.Elapsed().milliseconds());
+    if (!ok) {
+      ++num_failed_;
+    }
+
+    lock.lock();
+    encoded_.emplace(item.first, std::make_pair(item.second.timestamp, ok));
+    lock.unlock();
+    io_cv_.notify_one();
+  }
+}
+
+
+void AsyncEurocDataWriter::IoLoop()
+{
+  std::vector<ImuMeasurement> imu;
+  std::vector<DepthMeasurement> depth;
+  std::vector<RangeMeasurement> range;
+  std::vector<timestamp_t> stereo;
+
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    io_cv_.wait_for(lock, std::chrono::duration<double>(flush_period_sec_),
+        [this]() { return encoders_done_; });
+
+    const bool done = encoders_done_;
+
+    imu.clear();
+    depth.clear();
+    range.clear();
+    stereo.clear();
+    std::swap(imu, pending_imu_);
+    std::swap(depth, pending_depth_);
+    std::swap(range, pending_range_);
+
+    // Stereo rows have to wait until every pair before them is saved, so that the CSVs stay in order.
+    for (auto it = encoded_.begin(); it != encoded_.end() && it->first == next_csv_seq_;) {
+      if (it->second.second) {
+        stereo.emplace_back(it->second.first);
+      }
+      ++next_csv_seq_;
+      it = encoded_.erase(it);
+    }
+    lock.unlock();
+
+    Timer timer(true);
+    for (const ImuMeasurement& data : imu) { writer_.WriteImu(data); }
+    for (const DepthMeasurement& data : depth) { writer_.WriteDepth(data); }
+    for (const RangeMeasurement& data : range) { writer_.WriteRange(data); }
+    for (const timestamp_t timestamp : stereo) { writer_.WriteStereoCsv(timestamp); }
+    writer_.Flush();
+
+    if (!(imu.empty() && depth.empty() && range.empty() && stereo.empty())) {
+      csv_batch_ms_.Record(timer.Elapsed().milliseconds());
+    }
+
+    // NOTE(milo): Nothing can be added after the encoders are done, so this batch was the last one.
+    if (done) {
+      return;
+    }
+  }
+}
+
+
+void AsyncEurocDataWriter::Close()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+      return;
+    }
+    closed_ = true;
+  }
+  encode_cv_.notify_all();
+
+  for (std::thread& t : encoders_) {
+    t.join();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    encoders_done_ = true;
+  }
+  io_cv_.notify_all();
+  io_thread_.join();
+
+  CHECK(encoded_.empty()) << "Some stereo pairs were saved but never added to the CSVs" << std::endl;
+}
+
+
+}
+}
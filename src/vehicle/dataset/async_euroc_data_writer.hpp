@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/stats_tracker.hpp"
+#include "dataset/euroc_data_writer.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// Saves a EuRoC dataset (see EurocDataWriter) without blocking the caller on disk I/O. Stereo pairs
+// go into a bounded queue, and are encoded on a pool of threads. CSV rows are buffered in memory
+// and written out in batches by a single I/O thread, which also adds each stereo pair to the CSVs
+// (in the order they arrived) once both of its images are saved.
+//
+// If encoding can't keep up, WriteStereo() either blocks until there's room in the queue, or drops
+// the pair (drop_if_full). Either way, it shows up in GetStats():
+//   Backpressure/stereo_blocked    Pairs that had to wait for room in the queue
+//   Backpressure/stereo_wait_ms    How long they waited
+//   Backpressure/stereo_dropped    Pairs that were dropped because the queue was full
+//   Queue/stereo_depth             Pairs waiting to be encoded when each pair arrives
+//   Encode/stereo_ms               Time to encode and save both images of a pair
+//   Encode/stereo_failed           Pairs that couldn't be saved (and were left out of the CSVs)
+//   Write/csv_batch_ms             Time to write (and flush) one batch of CSV rows
+class AsyncEurocDataWriter final : public DataWriter {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(AsyncEurocDataWriter);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(AsyncEurocDataWriter);
+
+  // See EurocDataWriter for image_ext and compression. At most max_queued_stereo pairs are waiting
+  // to be encoded at any time. CSV rows are written every flush_period_sec.
+  explicit AsyncEurocDataWriter(const std::string& folder,
+                                const std::string& image_ext = ".png",
+                                int compression = 3,
+                                int num_encoders = 2,
+                                size_t max_queued_stereo = 16,
+                                bool drop_if_full = false,
+                                double flush_period_sec = 0.2);
+
+  // Calls Close().
+  ~AsyncEurocDataWriter();
+
+  void WriteImu(const ImuMeasurement& data) override;
+  void WriteDepth(const DepthMeasurement& data) override;
+  void WriteRange(const RangeMeasurement& data) override;
+  void WriteMag(const MagMeasurement& data) override;
+  void WriteStereo(const StereoImage3b& data) override;
+
+  // Blocks until everything that was written is on disk, and stops the threads. Nothing can be
+  // written after this.
+  void Close();
+
+  StatsSnapshot GetStats() { return stats_.Snapshot(); }
+
+ private:
+  void EncoderLoop();
+  void IoLoop();
+
+  EurocDataWriter writer_;
+  const size_t max_queued_stereo_;
+  const bool drop_if_full_;
+  const double flush_period_sec_;
+
+  StatsTracker stats_;
+  LatencyHistogram& stereo_wait_ms_;
+  LatencyHistogram& stereo_depth_;
+  LatencyHistogram& encode_ms_;
+  LatencyHistogram& csv_batch_ms_;
+  std::atomic<int64_t>& num_blocked_;
+  std::atomic<int64_t>& num_dropped_;
+  std::atomic<int64_t>& num_failed_;
+
+  std::mutex mutex_;
+  std::condition_variable encode_cv_;   // Pairs to encode (or closing).
+  std::condition_variable space_cv_;    // Room in the stereo queue.
+  std::condition_variable io_cv_;       // Encoded pairs (or closing).
+
+  // Sequence numbers keep the stereo CSV rows in the order that the pairs arrived. Pairs that
+  // couldn't be saved are still in encoded_ (so that later rows aren't held up), but with false.
+  std::deque<std::pair<uint64_t, StereoImage3b>> stereo_queue_;
+  std::map<uint64_t, std::pair<timestamp_t, bool>> encoded_;
+  uint64_t next_seq_ = 0;
+  uint64_t next_csv_seq_ = 0;
+
+  std::vector<ImuMeasurement> pending_imu_;
+  std::vector<DepthMeasurement> pending_depth_;
+  std::vector<RangeMeasurement> pending_range_;
+
+  bool closed_ = false;
+  bool encoders_done_ = false;   // Set once every encoder has drained the queue and exited.
+  std::vector<std::thread> encoders_;
+  std::thread io_thread_;
+};
+
+
+}
+}
@@ -0,0 +1,433 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <glog/logging.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "dataset/binary_log.hpp"
+#include "dataset/stereo_prefetcher.hpp"
+#include "vision_core/image_util.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace binary_log;
+
+
+// Payloads of the fixed-size records.
+struct ImuPayload final { double w[3]; double a[3]; };
+struct DepthPayload final { double depth; };
+struct RangePayload final { double range; double point[3]; };
+struct MagPayload final { double field[3]; };
+struct GroundtruthPayload final { double world_T_body[16]; };  // Column-major (like Eigen).
+
+
+template <typename PayloadT>
+static PayloadT ReadPayload(const RecordView& r, RecordType type)
+{
+  CHECK(r.type == type) << "Wrong record type: " << static_cast<int>(r.type) << std::endl;
+  CHECK_EQ(sizeof(PayloadT), r.size) << "Wrong payload size for record type " << static_cast<int>(type);
+
+  // NOTE(milo): Payloads are 8-byte aligned in the file, but memcpy doesn't care either way.
+  PayloadT p;
+  std::memcpy(&p, r.data, sizeof(PayloadT));
+  return p;
+}
+
+
+// Appends the pixels of an image row by row, so that non-continuous images work too.
+static void AppendRaw(const cv::Mat& im, std::vector<uint8_t>& out)
+{
+  const size_t row_bytes = im.cols * im.elemSize();
+  for (int r = 0; r < im.rows; ++r) {
+    const uint8_t* row = im.ptr<uint8_t>(r);
+    out.insert(out.end(), row, row + row_bytes);
+  }
+}
+
+
+BinaryLogWriter::BinaryLogWriter(const std::string& path,
+                                 ImageEncoding encoding,
+                                 int jpeg_quality,
+                                 size_t chunk_bytes)
+    : encoding_(encoding),
+      jpeg_quality_(jpeg_quality),
+      chunk_bytes_(chunk_bytes),
+      out_(path, std::ios::binary | std::ios::trunc)
+{
+  CHECK(out_.is_open()) << "Could not open binary log for writing: " << path << std::endl;
+
+  FileHeader header;
+  std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = kVersion;
+  header.reserved = 0;
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+  offset_ = sizeof(FileHeader);
+
+  chunk_.reserve(chunk_bytes_);
+  chunk_header_ = ChunkHeader{ kChunkMagic, 0, 0, kMaxTimestamp, kMinTimestamp };
+}
+
+
+BinaryLogWriter::~BinaryLogWriter()
+{
+  Close();
+}
+
+
+void BinaryLogWriter::WriteRecord(RecordType type, timestamp_t timestamp, const void* data, size_t size)
+{
+  CHECK(!closed_) << "Can't write to a closed binary log" << std::endl;
+  CHECK_LE(size, std::numeric_limits<uint32_t>::max()) << "Record is too large" << std::endl;
+
+  RecordHeader header;
+  header.type = type;
+  std::memset(header.reserved, 0, sizeof(header.reserved));
+  header.size = static_cast<uint32_t>(size);
+  header.timestamp = timestamp;
+
+  const uint8_t* h = reinterpret_cast<const uint8_t*>(&header);
+  const uint8_t* d = reinterpret_cast<const uint8_t*>(data);
+  chunk_.insert(chunk_.end(), h, h + sizeof(RecordHeader));
+  chunk_.insert(chunk_.end(), d, d + size);
+  chunk_.resize(Padded(chunk_.size()), 0);
+
+  ++chunk_header_.num_records;
+  chunk_header_.t_first = std::min(chunk_header_.t_first, timestamp);
+  chunk_header_.t_last = std::max(chunk_header_.t_last, timestamp);
+
+  if (chunk_.size() >= chunk_bytes_) {
+    FlushChunk();
+  }
+}
+
+
+void BinaryLogWriter::FlushChunk()
+{
+  if (chunk_header_.num_records == 0) {
+    return;
+  }
+
+  chunk_header_.size = chunk_.size();
+  index_.emplace_back(ChunkIndexEntry{ offset_, chunk_header_.num_records, 0,
+                                       chunk_header_.t_first, chunk_header_.t_last });
+
+  out_.write(reinterpret_cast<const char*>(&chunk_header_), sizeof(ChunkHeader));
+  out_.write(reinterpret_cast<const char*>(chunk_.data()), chunk_.size());
+  out_.flush();
+  offset_ += sizeof(ChunkHeader) + chunk_.size();
+
+  chunk_.clear();
+  chunk_header_ = ChunkHeader{ kChunkMagic, 0, 0, kMaxTimestamp, kMinTimestamp };
+}
+
+
+void BinaryLogWriter::Close()
+{
+  if (closed_) {
+    return;
+  }
+
+  FlushChunk();
+
+  Footer footer;
+  footer.index_offset = offset_;
+  footer.num_chunks = index_.size();
+  std::memcpy(footer.magic, kFooterMagic, sizeof(kFooterMagic));
+
+  out_.write(reinterpret_cast<const char*>(index_.data()), index_.size() * sizeof(ChunkIndexEntry));
+  out_.write(reinterpret_cast<const char*>(&footer), sizeof(Footer));
+  out_.close();
+  closed_ = true;
+}
+
+
+void BinaryLogWriter::WriteImu(const ImuMeasurement& data)
+{
+  const ImuPayload p = { { data.w.x(), data.w.y(), data.w.z() },
+                         { data.a.x(), data.a.y(), data.a.z() } };
+  WriteRecord(RecordType::IMU, data.timestamp, &p, sizeof(p));
+}
+
+
+void BinaryLogWriter::WriteDepth(const DepthMeasurement& data)
+{
+  const DepthPayload p = { data.depth };
+  WriteRecord(RecordType::DEPTH, data.timestamp, &p, sizeof(p));
+}
+
+
+void BinaryLogWriter::WriteRange(const RangeMeasurement& data)
+{
+  const RangePayload p = { data.range, { data.point.x(), data.point.y(), data.point.z() } };
+  WriteRecord(RecordType::RANGE, data.timestamp, &p, sizeof(p));
+}
+
+
+void BinaryLogWriter::WriteMag(const MagMeasurement& data)
+{
+  const MagPayload p = { { data.field.x(), data.field.y(), data.field.z() } };
+  WriteRecord(RecordType::MAG, data.timestamp, &p, sizeof(p));
+}
+
+
+void BinaryLogWriter::WriteGroundtruth(const GroundtruthItem& data)
+{
+  GroundtruthPayload p;
+  std::memcpy(p.world_T_body, data.world_T_body.data(), sizeof(p.world_T_body));
+  WriteRecord(RecordType::GROUNDTRUTH, data.timestamp, &p, sizeof(p));
+}
+
+
+void BinaryLogWriter::WriteStereo(const StereoImage3b& data)
+{
+  WriteStereoImages(data.timestamp, data.left_image, data.right_image);
+}
+
+
+void BinaryLogWriter::WriteStereo(const StereoImage1b& data)
+{
+  WriteStereoImages(data.timestamp, data.left_image, data.right_image);
+}
+
+
+void BinaryLogWriter::WriteStereoImages(timestamp_t timestamp, const cv::Mat& left, const cv::Mat& right)
+{
+  CHECK(left.size() == right.size() && left.type() == right.type())
+      << "Left and right images should have the same size and type" << std::endl;
+
+  StereoHeader header;
+  header.encoding = encoding_;
+  header.rows = left.rows;
+  header.cols = left.cols;
+  header.cv_type = left.type();
+
+  scratch_.resize(sizeof(StereoHeader));
+
+  if (encoding_ == ImageEncoding::JPEG) {
+    const std::vector<int> options = { cv::IMWRITE_JPEG_QUALITY, jpeg_quality_ };
+    std::vector<uint8_t> buf;
+
+    cv::imencode(".jpg", left, buf, options);
+    header.left_size = static_cast<uint32_t>(buf.size());
+    scratch_.insert(scratch_.end(), buf.begin(), buf.end());
+    scratch_.resize(Padded(scratch_.size()), 0);
+
+    cv::imencode(".jpg", right, buf, options);
+    header.right_size = static_cast<uint32_t>(buf.size());
+    scratch_.insert(scratch_.end(), buf.begin(), buf.end());
+  } else {
+    AppendRaw(left, scratch_);
+    header.left_size = static_cast<uint32_t>(scratch_.size() - sizeof(StereoHeader));
+    scratch_.resize(Padded(scratch_.size()), 0);
+
+    const size_t right_begin = scratch_.size();
+    AppendRaw(right, scratch_);
+    header.right_size = static_cast<uint32_t>(scratch_.size() - right_begin);
+  }
+
+  std::memcpy(scratch_.data(), &header, sizeof(StereoHeader));
+  WriteRecord(RecordType::STEREO, timestamp, scratch_.data(), scratch_.size());
+}
+
+
+BinaryLogReader::BinaryLogReader(const std::string& path)
+{
+  if (!file_.Open(path)) {
+    throw std::runtime_error("ERROR: Could not open binary log:\n  " + path);
+  }
+  data_ = file_.Data();
+  size_ = file_.Size();
+
+  FileHeader header;
+  if (size_ < sizeof(FileHeader)) {
+    throw std::runtime_error("ERROR: Binary log is empty or truncated:\n  " + path);
+  }
+  std::memcpy(&header, data_, sizeof(FileHeader));
+  if (std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 || header.version != kVersion) {
+    throw std::runtime_error("ERROR: Not a binary log (or an unsupported version):\n  " + path);
+  }
+
+  ReadIndex();
+  if (!has_index_) {
+    LOG(WARNING) << "Binary log wasn't closed, walking the chunks instead: " << path << std::endl;
+    RebuildIndex();
+  }
+
+  // NOTE(milo): Playback reads the file front to back.
+  file_.AdviseSequential();
+}
+
+
+void BinaryLogReader::ReadIndex()
+{
+  if (size_ < sizeof(FileHeader) + sizeof(Footer)) {
+    return;
+  }
+
+  Footer footer;
+  std::memcpy(&footer, data_ + size_ - sizeof(Footer), sizeof(Footer));
+  if (std::memcmp(footer.magic, kFooterMagic, sizeof(kFooterMagic)) != 0) {
+    return;
+  }
+
+  const uint64_t index_bytes = footer.num_chunks * sizeof(ChunkIndexEntry);
+  if (footer.index_offset + index_bytes + sizeof(Footer) != size_) {
+    return;
+  }
+
+  chunks_.resize(footer.num_chunks);
+  std::memcpy(chunks_.data(), data_ + footer.index_offset, index_bytes);
+  has_index_ = true;
+}
+
+
+void BinaryLogReader::RebuildIndex()
+{
+  chunks_.clear();
+
+  uint64_t offset = sizeof(FileHeader);
+  while (offset + sizeof(ChunkHeader) <= size_) {
+    ChunkHeader header;
+    std::memcpy(&header, data_ + offset, sizeof(ChunkHeader));
+    if (header.magic != kChunkMagic || (offset + sizeof(ChunkHeader) + header.size) > size_) {
+      break;
+    }
+    chunks_.emplace_back(ChunkIndexEntry{ offset, header.num_records, 0, header.t_first, header.t_last });
+    offset += sizeof(ChunkHeader) + header.size;
+  }
+}
+
+
+size_t BinaryLogReader::FindChunk(timestamp_t t) const
+{
+  // NOTE(milo): The sensors are interleaved, so chunks can overlap a little in time.
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    if (chunks_.at(i).t_last >= t) {
+      return i;
+    }
+  }
+  return chunks_.size();
+}
+
+
+void BinaryLogReader::ForEachRecord(const std::function<void(const RecordView&)>& f,
+                                    size_t first_chunk) const
+{
+  for (size_t i = first_chunk; i < chunks_.size(); ++i) {
+    const ChunkIndexEntry& chunk = chunks_.at(i);
+    uint64_t offset = chunk.offset + sizeof(ChunkHeader);
+
+    for (uint32_t k = 0; k < chunk.num_records; ++k) {
+      RecordHeader header;
+      std::memcpy(&header, data_ + offset, sizeof(RecordHeader));
+      offset += sizeof(RecordHeader);
+      CHECK_LE(offset + header.size, size_) << "Binary log record runs past the end of the file";
+
+      f(RecordView{ header.type, header.timestamp, data_ + offset, header.size });
+      offset += Padded(header.size);
+    }
+  }
+}
+
+
+ImuMeasurement ParseImuRecord(const RecordView& r)
+{
+  const ImuPayload p = ReadPayload<ImuPayload>(r, RecordType::IMU);
+  return ImuMeasurement(r.timestamp, Vector3d(p.w[0], p.w[1], p.w[2]), Vector3d(p.a[0], p.a[1], p.a[2]));
+}
+
+
+DepthMeasurement ParseDepthRecord(const RecordView& r)
+{
+  const DepthPayload p = ReadPayload<DepthPayload>(r, RecordType::DEPTH);
+  return DepthMeasurement(r.timestamp, p.depth);
+}
+
+
+RangeMeasurement ParseRangeRecord(const RecordView& r)
+{
+  const RangePayload p = ReadPayload<RangePayload>(r, RecordType::RANGE);
+  return RangeMeasurement(r.timestamp, p.range, Vector3d(p.point[0], p.point[1], p.point[2]));
+}
+
+
+MagMeasurement ParseMagRecord(const RecordView& r)
+{
+  const MagPayload p = ReadPayload<MagPayload>(r, RecordType::MAG);
+  return MagMeasurement(r.timestamp, Vector3d(p.field[0], p.field[1], p.field[2]));
+}
+
+
+GroundtruthItem ParseGroundtruthRecord(const RecordView& r)
+{
+  const GroundtruthPayload p = ReadPayload<GroundtruthPayload>(r, RecordType::GROUNDTRUTH);
+  return GroundtruthItem(r.timestamp, Eigen::Map<const Matrix4d>(p.world_T_body));
+}
+
+
+ImageEncoding ParseStereoRecord(const RecordView& r, cv::Mat& left, cv::Mat& right)
+{
+  CHECK(r.type == RecordType::STEREO) << "Wrong record type: " << static_cast<int>(r.type) << std::endl;
+  CHECK_GE(r.size, sizeof(StereoHeader));
+
+  StereoHeader header;
+  std::memcpy(&header, r.data, sizeof(StereoHeader));
+
+  const size_t left_begin = sizeof(StereoHeader);
+  const size_t right_begin = Padded(left_begin + header.left_size);
+  CHECK_EQ(right_begin + header.right_size, r.size) << "Corrupt stereo record" << std::endl;
+
+  // NOTE(milo): cv::Mat won't take a const pointer, but nothing writes through these views (and
+  // the mapping is read-only, so anything that tried would fault).
+  uint8_t* left_data = const_cast<uint8_t*>(r.data + left_begin);
+  uint8_t* right_data = const_cast<uint8_t*>(r.data + right_begin);
+
+  if (header.encoding == ImageEncoding::JPEG) {
+    left = cv::Mat(1, static_cast<int>(header.left_size), CV_8UC1, left_data);
+    right = cv::Mat(1, static_cast<int>(header.right_size), CV_8UC1, right_data);
+  } else {
+    left = cv::Mat(header.rows, header.cols, header.cv_type, left_data);
+    right = cv::Mat(header.rows, header.cols, header.cv_type, right_data);
+    CHECK_EQ(left.total() * left.elemSize(), header.left_size) << "Corrupt stereo record" << std::endl;
+  }
+
+  return header.encoding;
+}
+
+
+void DecodeStereoRecord(const RecordView& r, bool decode_color, DecodedStereo& out)
+{
+  out = DecodedStereo();
+
+  cv::Mat left, right;
+  if (ParseStereoRecord(r, left, right) == ImageEncoding::JPEG) {
+    left = cv::imdecode(left, cv::IMREAD_ANYCOLOR);
+    right = cv::imdecode(right, cv::IMREAD_ANYCOLOR);
+  } else if (decode_color || left.channels() == 1) {
+    // The callbacks might hold onto the images for longer than the mapping is around.
+    left = left.clone();
+    right = right.clone();
+  }
+
+  if (left.empty() || right.empty()) {
+    out.error = "ERROR: Could not decode the stereo pair at t=" + std::to_string(r.timestamp);
+    return;
+  }
+
+  if (decode_color) {
+    out.has_color = left.channels() > 1 && right.channels() > 1;
+    out.left = std::make_shared<ImageFrame>(left);
+    out.right = std::make_shared<ImageFrame>(right);
+  } else {
+    // NOTE(milo): RAW color images that aren't kept are only read once here, by cvtColor().
+    out.left = std::make_shared<ImageFrame>(MaybeConvertToGray(left));
+    out.right = std::make_shared<ImageFrame>(MaybeConvertToGray(right));
+  }
+}
+
+
+}
+}
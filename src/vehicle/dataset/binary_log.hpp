@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "core/macros.hpp"
+#include "core/mapped_file.hpp"
+#include "core/timestamp.hpp"
+#include "dataset/data_provider.hpp"
+#include "dataset/data_writer.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// A chunked, indexed binary log of timestamped sensor records, so that a recording loads without
+// parsing CSVs and plays back without opening a file per image. Layout (in host byte order):
+//
+//   FileHeader
+//   Chunk: ChunkHeader, then num_records x (RecordHeader, payload padded to 8 bytes)
+//   ...
+//   ChunkIndexEntry x num_chunks
+//   Footer
+//
+// Records are written in the order they arrive, so different sensors are interleaved. The index
+// and footer are only written by Close(). If a recording gets cut off before that, the reader walks
+// the chunks from the start instead (losing the chunk that was being buffered).
+namespace binary_log {
+
+static const char kFileMagic[8] = { 'B', 'M', 'L', 'O', 'G', 0, 0, 0 };
+static const char kFooterMagic[8] = { 'B', 'M', 'L', 'O', 'G', 'I', 'D', 'X' };
+static const uint32_t kChunkMagic = 0x4b4e4843;   // "CHNK"
+static const uint32_t kVersion = 1;
+
+enum class RecordType : uint8_t { IMU = 1, DEPTH = 2, RANGE = 3, MAG = 4, STEREO = 5, GROUNDTRUTH = 6 };
+
+enum class ImageEncoding : uint32_t { RAW = 0, JPEG = 1 };
+
+struct FileHeader final {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct ChunkHeader final {
+  uint32_t magic;
+  uint32_t num_records;
+  uint64_t size;            // Bytes of records after this header.
+  timestamp_t t_first;      // Earliest and latest record in the chunk.
+  timestamp_t t_last;
+};
+
+struct RecordHeader final {
+  RecordType type;
+  uint8_t reserved[3];
+  uint32_t size;            // Bytes of payload (not counting the padding).
+  timestamp_t timestamp;
+};
+
+// Followed by the left image bytes, padding to 8 bytes, and then the right image bytes. RAW images
+// are stored row after row (rows x cols x elemSize bytes), and JPEG images are the encoded files.
+struct StereoHeader final {
+  ImageEncoding encoding;
+  int32_t rows;
+  int32_t cols;
+  int32_t cv_type;
+  uint32_t left_size;
+  uint32_t right_size;
+};
+
+struct ChunkIndexEntry final {
+  uint64_t offset;          // Of the ChunkHeader, from the start of the file.
+  uint32_t num_records;
+  uint32_t reserved;
+  timestamp_t t_first;
+  timestamp_t t_last;
+};
+
+struct Footer final {
+  uint64_t index_offset;
+  uint64_t num_chunks;
+  char magic[8];
+};
+
+static_assert(sizeof(FileHeader) == 16, "Unexpected FileHeader padding");
+static_assert(sizeof(ChunkHeader) == 32, "Unexpected ChunkHeader padding");
+static_assert(sizeof(RecordHeader) == 16, "Unexpected RecordHeader padding");
+static_assert(sizeof(StereoHeader) == 24, "Unexpected StereoHeader padding");
+static_assert(sizeof(ChunkIndexEntry) == 32, "Unexpected ChunkIndexEntry padding");
+static_assert(sizeof(Footer) == 24, "Unexpected Footer padding");
+
+inline size_t Padded(size_t size) { return (size + 7) & ~static_cast<size_t>(7); }
+
+}
+
+
+// A record inside of a mapped log. The payload points into the mapping, so it's only valid for as
+// long as the BinaryLogReader is around.
+struct RecordView final {
+  binary_log::RecordType type;
+  timestamp_t timestamp;
+  const uint8_t* data;
+  uint32_t size;
+};
+
+
+// Writes sensor data to a binary log (see binary_log above). Records are buffered in memory and
+// written out a chunk at a time. Stereo pairs can be stored RAW (fastest to read back) or as JPEG
+// (about 10x smaller).
+class BinaryLogWriter final : public DataWriter {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(BinaryLogWriter);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(BinaryLogWriter);
+
+  explicit BinaryLogWriter(const std::string& path,
+                           binary_log::ImageEncoding encoding = binary_log::ImageEncoding::RAW,
+                           int jpeg_quality = 95,
+                           size_t chunk_bytes = 4 * 1024 * 1024);
+
+  // Calls Close().
+  ~BinaryLogWriter();
+
+  void WriteImu(const ImuMeasurement& data) override;
+  void WriteDepth(const DepthMeasurement& data) override;
+  void WriteRange(const RangeMeasurement& data) override;
+  void WriteMag(const MagMeasurement& data) override;
+  void WriteStereo(const StereoImage3b& data) override;
+
+  // Grayscale pairs, which don't need to be converted to color first.
+  void WriteStereo(const StereoImage1b& data);
+
+  void WriteGroundtruth(const GroundtruthItem& data);
+
+  // Writes the buffered chunk, the index and the footer. Nothing can be written after this.
+  void Close();
+
+ private:
+  void WriteRecord(binary_log::RecordType type, timestamp_t timestamp, const void* data, size_t size);
+  void WriteStereoImages(timestamp_t timestamp, const cv::Mat& left, const cv::Mat& right);
+  void FlushChunk();
+
+  binary_log::ImageEncoding encoding_;
+  int jpeg_quality_;
+  size_t chunk_bytes_;
+
+  std::ofstream out_;
+  uint64_t offset_ = 0;
+  bool closed_ = false;
+
+  std::vector<uint8_t> chunk_;
+  std::vector<uint8_t> scratch_;
+  binary_log::ChunkHeader chunk_header_;
+  std::vector<binary_log::ChunkIndexEntry> index_;
+};
+
+
+// Memory-maps a binary log, and gives access to its records without copying them.
+class BinaryLogReader final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(BinaryLogReader);
+  MACRO_DELETE_COPY_CONSTRUCTORS(BinaryLogReader);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(BinaryLogReader);
+
+  // Throws std::runtime_error if the file can't be mapped, or isn't a binary log.
+  explicit BinaryLogReader(const std::string& path);
+
+  // False if the log wasn't closed (and the index was rebuilt by walking the chunks).
+  bool HasIndex() const { return has_index_; }
+
+  const std::vector<binary_log::ChunkIndexEntry>& Chunks() const { return chunks_; }
+
+  // Returns the first chunk that has a record at or after t (or Chunks().size() if there isn't one).
+  size_t FindChunk(timestamp_t t) const;
+
+  // Calls f for every record, in the order that they were written, starting at chunk first_chunk.
+  void ForEachRecord(const std::function<void(const RecordView&)>& f, size_t first_chunk = 0) const;
+
+ private:
+  void ReadIndex();
+  void RebuildIndex();
+
+  MappedFile file_;
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  bool has_index_ = false;
+  std::vector<binary_log::ChunkIndexEntry> chunks_;
+};
+
+
+// Decode the payload of a record (which should be of the matching type).
+ImuMeasurement ParseImuRecord(const RecordView& r);
+DepthMeasurement ParseDepthRecord(const RecordView& r);
+RangeMeasurement ParseRangeRecord(const RecordView& r);
+MagMeasurement ParseMagRecord(const RecordView& r);
+GroundtruthItem ParseGroundtruthRecord(const RecordView& r);
+
+// Wraps the images of a stereo record without copying them. RAW images are read-only views into the
+// mapping, with the stored size and type. JPEG images are 1xN CV_8UC1 views of the encoded bytes,
+// which can be passed straight to cv::imdecode().
+binary_log::ImageEncoding ParseStereoRecord(const RecordView& r, cv::Mat& left, cv::Mat& right);
+
+// Reads a stereo record into images that own their pixels (see DecodedStereo).
+void DecodeStereoRecord(const RecordView& r, bool decode_color, DecodedStereo& out);
+
+
+}
+}
@@ -0,0 +1,76 @@
+#include <glog/logging.h>
+
+#include "dataset/binary_log_dataset.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace binary_log;
+
+
+BinaryLogDataset::BinaryLogDataset(const std::string& path) : DataProvider()
+{
+  const BinaryLogReader::Ptr reader = std::make_shared<BinaryLogReader>(path);
+
+  // NOTE(milo): Stereo records are looked up by index during playback, so they're kept in the same
+  // order as stereo_data.
+  std::vector<RecordView> stereo_views;
+
+  reader->ForEachRecord([&](const RecordView& r)
+  {
+    switch (r.type) {
+      case RecordType::IMU:
+        imu_data.emplace_back(ParseImuRecord(r));
+        break;
+      case RecordType::DEPTH:
+        depth_data.emplace_back(ParseDepthRecord(r));
+        break;
+      case RecordType::RANGE:
+        range_data.emplace_back(ParseRangeRecord(r));
+        break;
+      case RecordType::MAG:
+        mag_data_.emplace_back(ParseMagRecord(r));
+        break;
+      case RecordType::GROUNDTRUTH:
+        pose_data.emplace_back(ParseGroundtruthRecord(r));
+        break;
+      case RecordType::STEREO:
+        stereo_views.emplace_back(r);
+        break;
+      default:
+        LOG(WARNING) << "Skipping unknown record type " << static_cast<int>(r.type) << std::endl;
+        break;
+    }
+  });
+
+  // Records are in the order they arrived, which is almost (but not always) chronological.
+  SortByTimestamp(imu_data);
+  SortByTimestamp(depth_data);
+  SortByTimestamp(range_data);
+  SortByTimestamp(mag_data_);
+  SortByTimestamp(pose_data);
+  SortByTimestamp(stereo_views);
+
+  for (const RecordView& r : stereo_views) {
+    stereo_data.emplace_back(r.timestamp, "", "");
+  }
+
+  // NOTE(milo): The decoder holds onto the reader, which keeps the mapping (that the views point
+  // into) alive for as long as any copy of this dataset is around.
+  stereo_decoder = [reader, stereo_views](size_t idx, bool decode_color, DecodedStereo& out)
+  {
+    (void)reader;
+    DecodeStereoRecord(stereo_views.at(idx), decode_color, out);
+  };
+
+  LOG(INFO) << "Read binary log " << path << " (" << reader->Chunks().size() << " chunks):\n"
+            << "  stereo=" << stereo_data.size() << " imu=" << imu_data.size()
+            << " depth=" << depth_data.size() << " range=" << range_data.size()
+            << " mag=" << mag_data_.size() << " groundtruth=" << pose_data.size() << std::endl;
+
+  SanityCheck(path + ".report.csv");
+}
+
+
+}
+}
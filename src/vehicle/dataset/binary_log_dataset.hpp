@@ -0,0 +1,26 @@
+#pragma once
+
+#include "dataset/data_provider.hpp"
+#include "dataset/binary_log.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Plays back a binary log (see BinaryLogWriter). The measurements are copied out of the mapping
+// once on construction, and the stereo pairs are decoded straight from the mapping during playback.
+class BinaryLogDataset : public DataProvider {
+ public:
+  // Throws std::runtime_error if path isn't a readable binary log.
+  explicit BinaryLogDataset(const std::string& path);
+
+  // DataProvider has no magnetometer source yet, so these are only kept around for tools.
+  const std::vector<MagMeasurement>& MagData() const { return mag_data_; }
+
+ private:
+  std::vector<MagMeasurement> mag_data_;
+};
+
+
+}
+}
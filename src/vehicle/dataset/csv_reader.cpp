@@ -0,0 +1,188 @@
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include "dataset/csv_reader.hpp"
+
+namespace bm {
+namespace dataset {
+
+// Files smaller than this aren't worth splitting across threads.
+static const size_t kMinBytesPerThread = 4 * 1024 * 1024;
+
+
+static bool IsSpace(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+
+void CsvLine::Advance(const char* p)
+{
+  while (p < end_ && IsSpace(*p)) {
+    ++p;
+  }
+  if (p < end_ && *p == ',') {
+    ++p;
+  }
+  p_ = p;
+}
+
+
+bool CsvLine::Next(double& value)
+{
+  const char* p = p_;
+  while (p < end_ && IsSpace(*p)) {
+    ++p;
+  }
+
+  // NOTE(milo): strtod would skip over a newline (and read the next line) if the field was empty.
+  if (p >= end_ || *p == ',') {
+    return false;
+  }
+
+  char* e = nullptr;
+  value = std::strtod(p, &e);
+  if (e == p || e > end_) {
+    return false;
+  }
+
+  Advance(e);
+  return true;
+}
+
+
+bool CsvLine::Next(timestamp_t& value)
+{
+  const char* p = p_;
+  while (p < end_ && IsSpace(*p)) {
+    ++p;
+  }
+
+  // strtoull would quietly wrap a negative number around.
+  if (p >= end_ || !std::isdigit(static_cast<unsigned char>(*p))) {
+    return false;
+  }
+
+  char* e = nullptr;
+  value = static_cast<timestamp_t>(std::strtoull(p, &e, 10));
+  if (e == p || e > end_) {
+    return false;
+  }
+
+  Advance(e);
+  return true;
+}
+
+
+bool CsvLine::Next(const char*& begin, size_t& length)
+{
+  if (p_ > end_) {
+    return false;
+  }
+
+  const char* comma = std::find(p_, end_, ',');
+  begin = p_;
+  length = comma - p_;
+
+  p_ = (comma < end_) ? (comma + 1) : (end_ + 1);
+  return true;
+}
+
+
+CsvReader::CsvReader(const std::string& path) : path_(path)
+{
+  CHECK(file_.Open(path)) << "Could not open file: " << path << std::endl;
+  file_.AdviseSequential();
+
+  const char* begin = reinterpret_cast<const char*>(file_.Data());
+  const char* end = begin + file_.Size();
+
+  // Find the end of the last full line.
+  end_ = end;
+  while (end_ > begin && *(end_ - 1) != '\n') {
+    --end_;
+  }
+  if (end_ < end) {
+    last_line_.assign(end_, end);
+  }
+}
+
+
+size_t CsvReader::NumLines() const
+{
+  const char* begin = reinterpret_cast<const char*>(file_.Data());
+  return std::count(begin, end_, '\n') + (last_line_.empty() ? 0 : 1);
+}
+
+
+std::vector<CsvReader::Span> CsvReader::Split(size_t skip_lines, int max_threads) const
+{
+  const char* begin = reinterpret_cast<const char*>(file_.Data());
+  for (size_t i = 0; i < skip_lines && begin < end_; ++i) {
+    begin = std::find(begin, end_, '\n') + 1;
+  }
+
+  const size_t bytes = end_ - begin;
+  const size_t num_threads = (max_threads > 0) ? max_threads : std::max(1u, std::thread::hardware_concurrency());
+  const size_t num_spans = std::max(1ul, std::min(num_threads, bytes / kMinBytesPerThread));
+
+  // Cut at (about) equal byte offsets, and then move each cut to the start of the next line.
+  std::vector<Span> spans;
+  const char* span_begin = begin;
+  for (size_t i = 1; i <= num_spans && span_begin < end_; ++i) {
+    const char* span_end = (i == num_spans) ? end_ : std::find(begin + (i * bytes) / num_spans, end_, '\n') + 1;
+    span_end = std::min(std::max(span_end, span_begin), end_);
+    spans.emplace_back(Span{ span_begin, span_end });
+    span_begin = span_end;
+  }
+
+  if (spans.empty()) {
+    spans.emplace_back(Span{ end_, end_ });
+  }
+
+  return spans;
+}
+
+
+std::vector<size_t> CsvReader::ChunkOffsets(size_t lines_per_chunk, size_t skip_lines) const
+{
+  CHECK_GT(lines_per_chunk, 0ul) << "Chunks need at least one line" << std::endl;
+
+  const char* data = reinterpret_cast<const char*>(file_.Data());
+  const char* line = data;
+  size_t skipped = 0;
+  for (; skipped < skip_lines && line < end_; ++skipped) {
+    line = std::find(line, end_, '\n') + 1;
+  }
+
+  std::vector<size_t> offsets;
+  size_t num_lines = 0;
+  for (; line < end_; ++num_lines) {
+    if (num_lines % lines_per_chunk == 0) {
+      offsets.emplace_back(line - data);
+    }
+    line = std::find(line, end_, '\n') + 1;
+  }
+
+  // The last line (if it doesn't end with a newline) starts at end_.
+  if (!last_line_.empty() && skipped == skip_lines && num_lines % lines_per_chunk == 0) {
+    offsets.emplace_back(end_ - data);
+  }
+
+  offsets.emplace_back(file_.Size());
+  return offsets;
+}
+
+
+void CsvReader::CheckBadLines(size_t num_bad) const
+{
+  CHECK_EQ(0ul, num_bad) << "Could not parse " << num_bad << " lines of " << path_ << std::endl;
+}
+
+
+}
+}
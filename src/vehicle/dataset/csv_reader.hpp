@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/mapped_file.hpp"
+#include "core/timestamp.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// A cursor over the comma-separated fields of one line, which parses numbers in place (with
+// strtod/strtoull) instead of copying each field into a std::string first.
+class CsvLine final {
+ public:
+  // [begin, end) shouldn't include the newline. The byte at end has to be readable, and can't be
+  // part of a number (e.g '\n', '\r' or '\0'), since strtod doesn't take a length.
+  CsvLine(const char* begin, const char* end) : p_(begin), end_(end) {}
+
+  // Parse the next field. Return false (and don't move) if the field is empty, or isn't a number.
+  bool Next(double& value);
+  bool Next(timestamp_t& value);
+
+  // The raw text of the next field (not null-terminated).
+  bool Next(const char*& begin, size_t& length);
+
+  bool AtEnd() const { return p_ >= end_; }
+
+ private:
+  // Moves past the field that ends at p (and the comma after it).
+  void Advance(const char* p);
+
+  const char* p_;
+  const char* end_;
+};
+
+
+// Memory-maps a CSV file, and parses its lines without allocating (see CsvLine). Big files are
+// split into chunks of whole lines, which are parsed on several threads and then concatenated, so
+// the output order is the same as in the file.
+class CsvReader final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(CsvReader);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(CsvReader);
+
+  // CHECK-fails if the file can't be opened.
+  explicit CsvReader(const std::string& path);
+
+  // Number of newline-terminated lines (plus a last line without one).
+  size_t NumLines() const;
+
+  // Calls parse_line(line, out) for every non-empty line after the first skip_lines lines, which
+  // should append whatever it parsed to out. Lines that parse_line returns false for are counted,
+  // and CHECK-fail at the end (with the path). Uses up to max_threads threads (0 for one thread
+  // per core), but only for files that are larger than a few MB.
+  template <typename T, typename ParseFn>
+  void ParseLines(std::vector<T>& out, ParseFn parse_line, size_t skip_lines = 1, int max_threads = 0) const;
+
+  // Byte offsets that split the lines after the first skip_lines into chunks of lines_per_chunk
+  // lines, followed by the size of the file, so that chunk i is [offsets[i], offsets[i+1]). There
+  // are no chunks (only the size) if there are no lines.
+  std::vector<size_t> ChunkOffsets(size_t lines_per_chunk, size_t skip_lines = 1) const;
+
+  // Like ParseLines(), but only for the lines in bytes [begin, end) of the file (e.g a chunk from
+  // ChunkOffsets()), on the calling thread.
+  template <typename T, typename ParseFn>
+  void ParseChunk(std::vector<T>& out, ParseFn parse_line, size_t begin, size_t end) const;
+
+  const std::string& Path() const { return path_; }
+
+ private:
+  struct Span final {
+    const char* begin;
+    const char* end;
+  };
+
+  // Parses every line in the span (see ParseLines()), and counts the ones that didn't parse.
+  template <typename T, typename ParseFn>
+  static void ParseSpan(const Span& span, ParseFn& parse_line, std::vector<T>& out, std::atomic<size_t>& num_bad);
+
+  // Splits the lines after the first skip_lines into (at most) num_chunks spans of whole lines.
+  std::vector<Span> Split(size_t skip_lines, int max_threads) const;
+
+  void CheckBadLines(size_t num_bad) const;
+
+  std::string path_;
+  MappedFile file_;
+
+  // NOTE(milo): If the file doesn't end with a newline, the last line is copied here so that there
+  // is always a byte after it for strtod to stop at.
+  std::string last_line_;
+  const char* end_ = nullptr;   // End of the mapped lines (not counting last_line_).
+};
+
+
+template <typename T, typename ParseFn>
+void CsvReader::ParseSpan(const Span& span, ParseFn& parse_line, std::vector<T>& out, std::atomic<size_t>& num_bad)
+{
+  out.reserve(out.size() + std::count(span.begin, span.end, '\n') + 1);
+
+  const char* line = span.begin;
+  while (line < span.end) {
+    const char* eol = std::find(line, span.end, '\n');
+    CsvLine csv(line, (eol > line && *(eol - 1) == '\r') ? (eol - 1) : eol);
+    if (!csv.AtEnd() && !parse_line(csv, out)) {
+      ++num_bad;
+    }
+    line = eol + 1;
+  }
+}
+
+
+template <typename T, typename ParseFn>
+void CsvReader::ParseLines(std::vector<T>& out, ParseFn parse_line, size_t skip_lines, int max_threads) const
+{
+  std::atomic<size_t> num_bad{0};
+
+  const auto parse_span = [&](const Span& span, std::vector<T>& span_out)
+  {
+    ParseSpan(span, parse_line, span_out, num_bad);
+  };
+
+  const std::vector<Span> spans = Split(skip_lines, max_threads);
+
+  if (spans.size() == 1) {
+    parse_span(spans.front(), out);
+  } else {
+    std::vector<std::vector<T>> span_outs(spans.size());
+    std::vector<std::future<void>> futures;
+    for (size_t i = 1; i < spans.size(); ++i) {
+      futures.emplace_back(std::async(std::launch::async, parse_span, std::cref(spans.at(i)), std::ref(span_outs.at(i))));
+    }
+    parse_span(spans.front(), out);
+    for (size_t i = 1; i < spans.size(); ++i) {
+      futures.at(i - 1).get();
+      out.insert(out.end(), std::make_move_iterator(span_outs.at(i).begin()),
+                            std::make_move_iterator(span_outs.at(i).end()));
+    }
+  }
+
+  // The last line of a file without a trailing newline.
+  if (!last_line_.empty() && NumLines() > skip_lines) {
+    const Span last = { last_line_.data(), last_line_.data() + last_line_.size() };
+    parse_span(last, out);
+  }
+
+  CheckBadLines(num_bad);
+}
+
+
+template <typename T, typename ParseFn>
+void CsvReader::ParseChunk(std::vector<T>& out, ParseFn parse_line, size_t begin, size_t end) const
+{
+  std::atomic<size_t> num_bad{0};
+
+  const char* data = reinterpret_cast<const char*>(file_.Data());
+  const size_t mapped_end = end_ - data;
+  const Span span = { data + std::min(begin, mapped_end), data + std::min(end, mapped_end) };
+  ParseSpan(span, parse_line, out, num_bad);
+
+  // The chunk might end with the last line of a file without a trailing newline.
+  if (!last_line_.empty() && end > mapped_end) {
+    const Span last = { last_line_.data(), last_line_.data() + last_line_.size() };
+    ParseSpan(last, parse_line, out, num_bad);
+  }
+
+  CheckBadLines(num_bad);
+}
+
+
+}
+}
@@ -1,19 +1,104 @@
+#include <algorithm>
 #include <thread>
 #include <glog/logging.h>
-#include <opencv2/highgui.hpp>
 
 #include "dataset/data_provider.hpp"
-
-#include "core/file_utils.hpp"
-#include "vision_core/image_util.hpp"
+#include "dataset/dataset_analyzer.hpp"
+#include "dataset/stereo_prefetcher.hpp"
 
 namespace bm {
 namespace dataset {
 
-static const double kMaxAcceleration = 98.1;    // m/s^2
-static const double kMaxAngularVelocity = 20.0; // [rad / sec]
-static const double kMaxRange = 100.0;          // m
-static const double kMaxDepth = 20.0;           // m
+// Index of the first item at or after t.
+template <typename T>
+static size_t LowerBoundTimestamp(const std::vector<T>& data, timestamp_t t)
+{
+  const auto it = std::lower_bound(data.begin(), data.end(), t,
+      [](const T& item, timestamp_t value) { return item.timestamp < value; });
+  return static_cast<size_t>(it - data.begin());
+}
+
+
+// Items in [t0, t1), assuming that data is sorted by timestamp.
+template <typename T>
+static std::vector<T> SliceTimestamps(const std::vector<T>& data, timestamp_t t0, timestamp_t t1)
+{
+  const size_t i0 = LowerBoundTimestamp(data, t0);
+  const size_t i1 = std::max(i0, LowerBoundTimestamp(data, t1));
+  return std::vector<T>(data.begin() + i0, data.begin() + i1);
+}
+
+
+// Call a loader (at most once), and then clear it.
+template <typename T>
+static void LoadOnce(std::function<void(std::vector<T>&)>& loader, std::vector<T>& data)
+{
+  if (loader) {
+    const std::function<void(std::vector<T>&)> f = std::move(loader);
+    loader = nullptr;
+    f(data);
+  }
+}
+
+
+void DataProvider::LoadStereo() const { LoadOnce(stereo_loader, stereo_data); }
+void DataProvider::LoadPoses() const { LoadOnce(pose_loader, pose_data); }
+void DataProvider::LoadDepth() const { LoadOnce(depth_loader, depth_data); }
+void DataProvider::LoadRange() const { LoadOnce(range_loader, range_data); }
+
+
+void DataProvider::LoadImu() const
+{
+  LoadOnce(imu_loader, imu_data);
+
+  if (imu_chunk_loader && !imu_chunk_loaded_) {
+    imu_chunk_first_ = 0;
+    LoadImuChunk(0);
+  }
+}
+
+
+void DataProvider::LoadAll() const
+{
+  LoadStereo();
+  LoadImu();
+  LoadPoses();
+  LoadDepth();
+  LoadRange();
+}
+
+
+bool DataProvider::AllLoaded() const
+{
+  return !stereo_loader && !imu_loader && !pose_loader && !depth_loader && !range_loader &&
+         (!imu_chunk_loader || imu_chunk_loaded_);
+}
+
+
+bool DataProvider::LoadImuChunk(size_t i) const
+{
+  imu_data.clear();
+  imu_chunk_ = i;
+  imu_chunk_loaded_ = true;
+  return imu_chunk_loader(i, imu_data);
+}
+
+
+const std::vector<ImuMeasurement>& DataProvider::AllImu(std::vector<ImuMeasurement>& storage) const
+{
+  LoadImu();
+  if (!imu_chunk_loader) {
+    return imu_data;
+  }
+
+  storage.clear();
+  std::vector<ImuMeasurement> chunk;
+  for (size_t i = 0; imu_chunk_loader(i, chunk); ++i) {
+    storage.insert(storage.end(), chunk.begin(), chunk.end());
+    chunk.clear();
+  }
+  return storage;
+}
 
 
 timestamp_t DataProvider::NextTimestamp(timestamp_t& next_imu_time,
@@ -92,6 +177,13 @@ bool DataProvider::Step(bool verbose)
     }
     ++next_imu_idx_;
 
+    // Move on to the next chunk of a streamed IMU.
+    while (imu_chunk_loader && next_imu_idx_ >= imu_data.size() && !imu_data.empty()) {
+      imu_chunk_first_ += imu_data.size();
+      next_imu_idx_ = 0;
+      LoadImuChunk(imu_chunk_ + 1);
+    }
+
   } else if (next_source == DataSource::DEPTH) {
     for (const DepthCallback& function : depth_callbacks_) {
       function(depth_data.at(next_depth_idx_));
@@ -105,36 +197,45 @@ bool DataProvider::Step(bool verbose)
     ++next_range_idx_;
 
   } else {
-    // Load the images and convert to grayscale if needed.
-    timestamp_t timestamp = stereo_data.at(next_stereo_idx_).timestamp;
-
-    const std::string& path_left = stereo_data.at(next_stereo_idx_).path_left;
-    const std::string& path_right = stereo_data.at(next_stereo_idx_).path_right;
-
-    if (!Exists(path_left)) {
-      throw std::runtime_error("ERROR: Left image filepath is invalid:\n  " + path_left);
+    // Load the images. Each view of them is only computed if a callback needs it.
+    const timestamp_t timestamp = stereo_data.at(next_stereo_idx_).timestamp;
+    const bool decode_color = !stereo_callbacks_3b_.empty() || !stereo_frame_callbacks_.empty();
+    const bool decode_gray = !stereo_callbacks_1b_.empty();
+
+    DecodedStereo decoded;
+    if (prefetch_lookahead_ > 0) {
+      if (!prefetcher_) {
+        prefetcher_ = std::make_shared<StereoPrefetcher>(
+            stereo_data.size(), GetStereoDecoder(), prefetch_lookahead_, prefetch_threads_, decode_color, decode_gray);
+      }
+      prefetcher_->Get(next_stereo_idx_, decoded);
+    } else {
+      DecodeStereo(next_stereo_idx_, decode_color, decoded);
     }
-    if (!Exists(path_right)) {
-      throw std::runtime_error("ERROR: Right image filepath is invalid:\n  " + path_right);
+
+    if (!decoded.error.empty()) {
+      throw std::runtime_error(decoded.error);
     }
 
-    // NOTE(milo): Using non-const left/right images so that we can avoid copy them into the
-    // stereo image (use std::move instead to steal the underlying data).
-    const cv::Mat iml = cv::imread(path_left, cv::IMREAD_ANYCOLOR);
-    const cv::Mat imr = cv::imread(path_right, cv::IMREAD_ANYCOLOR);
+    // NOTE(milo): The stereo images are views of the decoded frames (no copies).
+    const bool has_color = decoded.has_color;
+    const StereoFrame frame(timestamp, next_stereo_idx_, std::move(decoded.left), std::move(decoded.right));
+    for (const StereoFrameCallback& f : stereo_frame_callbacks_) {
+      f(frame);
+    }
 
-    if (iml.channels() > 1 && imr.channels() > 1) {
-      const StereoImage3b stereo3b(timestamp, next_stereo_idx_, Image3b(iml), Image3b(imr));
+    if (has_color && !stereo_callbacks_3b_.empty()) {
+      const StereoImage3b stereo3b = ColorView(frame);
       for (const StereoCallback3b& f : stereo_callbacks_3b_) {
         f(stereo3b);
       }
     }
 
-    Image1b iml_gray = MaybeConvertToGray(iml);
-    Image1b imr_gray = MaybeConvertToGray(imr);
-    const StereoImage1b stereo1b(timestamp, next_stereo_idx_, std::move(iml_gray), std::move(imr_gray));
-    for (const StereoCallback1b& f : stereo_callbacks_1b_) {
-      f(stereo1b);
+    if (!stereo_callbacks_1b_.empty()) {
+      const StereoImage1b stereo1b = GrayView(frame);
+      for (const StereoCallback1b& f : stereo_callbacks_1b_) {
+        f(stereo1b);
+      }
     }
     ++next_stereo_idx_;
   }
@@ -145,27 +246,59 @@ bool DataProvider::Step(bool verbose)
 }
 
 
-void DataProvider::StepUntil(DataSource source)
+StereoDecoder DataProvider::GetStereoDecoder() const
+{
+  if (stereo_decoder) {
+    return stereo_decoder;
+  }
+
+  // NOTE(milo): Copy the items, since the decoder might outlive this DataProvider (or this copy
+  // of it).
+  const std::vector<StereoDatasetItem> items = stereo_data;
+  const std::shared_ptr<ImagePool> pool = image_pool_;
+  return [items, pool](size_t idx, bool decode_color, DecodedStereo& out)
+  {
+    DecodeStereoItem(items.at(idx), decode_color, out, pool.get());
+  };
+}
+
+
+void DataProvider::DecodeStereo(size_t idx, bool decode_color, DecodedStereo& out) const
 {
-  size_t* idx_ptr;
-  if (source == DataSource::IMU) {
-    idx_ptr = &next_imu_idx_;
-  } else if (source == DataSource::RANGE) {
-    idx_ptr = &next_range_idx_;
-  } else if (source == DataSource::DEPTH) {
-    idx_ptr = &next_depth_idx_;
+  if (stereo_decoder) {
+    stereo_decoder(idx, decode_color, out);
   } else {
-    idx_ptr = &next_stereo_idx_;
+    DecodeStereoItem(stereo_data.at(idx), decode_color, out, image_pool_.get());
   }
+}
+
 
-  const size_t idx0 = *idx_ptr;
+void DataProvider::StepUntil(DataSource source)
+{
+  // NOTE(milo): A streamed IMU index starts over at each chunk, so compare the absolute position.
+  const auto position = [this, source]() -> size_t
+  {
+    if (source == DataSource::IMU) {
+      return imu_chunk_first_ + next_imu_idx_;
+    } else if (source == DataSource::RANGE) {
+      return next_range_idx_;
+    } else if (source == DataSource::DEPTH) {
+      return next_depth_idx_;
+    } else {
+      return next_stereo_idx_;
+    }
+  };
 
-  while ((*idx_ptr) == idx0 && Step()) {}
+  const size_t idx0 = position();
+
+  while (position() == idx0 && Step()) {}
 }
 
 
 void DataProvider::PlaybackWorker(float speed, bool verbose)
 {
+  ConfigureCurrentThread(playback_thread_config_, "bm_playback");
+
   while (Step(verbose)) {
     const timestamp_t next_time = NextTimestamp().first;
 
@@ -173,6 +306,11 @@ void DataProvider::PlaybackWorker(float speed, bool verbose)
       break;
     }
 
+    // Negative speed means "as fast as possible", so don't sleep at all.
+    if (speed < 0) {
+      continue;
+    }
+
     const float ns_until_next = static_cast<float>(next_time - last_data_timestamp_) / speed;
 
     if (verbose) {
@@ -186,24 +324,110 @@ void DataProvider::PlaybackWorker(float speed, bool verbose)
 
 void DataProvider::Playback(float speed, bool verbose)
 {
-  CHECK_GT(speed, 0.01f) << "Cannot go slower than 1% speed" << std::endl;
+  CHECK(speed < 0 || speed > 0.01f) << "Cannot go slower than 1% speed" << std::endl;
 
   std::thread worker(&DataProvider::PlaybackWorker, this, speed, verbose);
   worker.join();
 }
 
 
+void DataProvider::SetStereoPrefetch(size_t lookahead, int num_threads)
+{
+  CHECK_GT(num_threads, 0) << "Need at least one thread to prefetch with" << std::endl;
+  prefetch_lookahead_ = lookahead;
+  prefetch_threads_ = num_threads;
+  prefetcher_.reset();
+}
+
+
 void DataProvider::Reset()
 {
+  // Drop the prefetched pairs, since playback starts over.
+  prefetcher_.reset();
   last_data_timestamp_ = 0;
   next_stereo_idx_ = 0;
   next_imu_idx_ = 0;
   next_depth_idx_ = 0;
+  next_range_idx_ = 0;
+
+  if (imu_chunk_loaded_ && (imu_chunk_ != 0 || imu_chunk_first_ != 0)) {
+    imu_chunk_first_ = 0;
+    LoadImuChunk(0);
+  }
+}
+
+
+void DataProvider::SeekTo(timestamp_t t)
+{
+  next_stereo_idx_ = LowerBoundTimestamp(stereo_data, t);
+
+  // A streamed IMU only has one chunk in memory, so read forward to the chunk with t in it (from
+  // the start, unless t is at or after the current chunk).
+  if (imu_chunk_loaded_ && (imu_data.empty() || imu_data.front().timestamp > t)) {
+    imu_chunk_first_ = 0;
+    LoadImuChunk(0);
+  }
+  while (imu_chunk_loaded_ && !imu_data.empty() && imu_data.back().timestamp < t) {
+    imu_chunk_first_ += imu_data.size();
+    LoadImuChunk(imu_chunk_ + 1);
+  }
+  next_imu_idx_ = LowerBoundTimestamp(imu_data, t);
+  next_depth_idx_ = LowerBoundTimestamp(depth_data, t);
+  next_range_idx_ = LowerBoundTimestamp(range_data, t);
+
+  // NOTE(milo): The prefetcher starts over by itself when asked for a pair outside of its window.
+  last_data_timestamp_ = t;
+}
+
+
+DataProvider DataProvider::Slice(timestamp_t t0, timestamp_t t1) const
+{
+  CHECK_LE(t0, t1) << "Slice ends before it starts" << std::endl;
+  LoadAll();
+
+  DataProvider slice;
+  slice.prefetch_lookahead_ = prefetch_lookahead_;
+  slice.prefetch_threads_ = prefetch_threads_;
+  slice.playback_thread_config_ = playback_thread_config_;
+
+  slice.stereo_data = SliceTimestamps(stereo_data, t0, t1);
+  std::vector<ImuMeasurement> all_imu;
+  slice.imu_data = SliceTimestamps(AllImu(all_imu), t0, t1);
+  slice.pose_data = SliceTimestamps(pose_data, t0, t1);
+  slice.depth_data = SliceTimestamps(depth_data, t0, t1);
+  slice.range_data = SliceTimestamps(range_data, t0, t1);
+
+  // Stereo pair idx of the slice is pair (offset + idx) of this dataset.
+  if (stereo_decoder) {
+    const StereoDecoder decoder = stereo_decoder;
+    const size_t offset = LowerBoundTimestamp(stereo_data, t0);
+    slice.stereo_decoder = [decoder, offset](size_t idx, bool decode_color, DecodedStereo& out)
+    {
+      decoder(offset + idx, decode_color, out);
+    };
+  }
+
+  return slice;
+}
+
+
+const std::vector<GroundtruthItem>& DataProvider::GroundtruthPoses() const
+{
+  LoadPoses();
+  return pose_data;
+}
+
+
+const std::vector<StereoDatasetItem>& DataProvider::StereoItems() const
+{
+  LoadStereo();
+  return stereo_data;
 }
 
 
 Matrix4d DataProvider::InitialPose() const
 {
+  LoadPoses();
   Matrix4d world_T_body = Matrix4d::Identity();
 
   if (pose_data.size() > 0) {
@@ -214,11 +438,16 @@ Matrix4d DataProvider::InitialPose() const
 }
 
 
+// NOTE(milo): A stream that's still waiting on its loader won't be played back, so it doesn't
+// count as part of the dataset here.
 timestamp_t DataProvider::FirstTimestamp() const
 {
+  if (stereo_data.empty() && imu_data.empty() && depth_data.empty() && range_data.empty()) {
+    LoadAll();
+  }
   CHECK(!(imu_data.empty() && stereo_data.empty() && depth_data.empty()));
 
-  const timestamp_t first_imu = imu_data.empty() ?
+  timestamp_t first_imu = imu_data.empty() ?
       kMaxTimestamp : imu_data.front().timestamp;
   const timestamp_t first_stereo = stereo_data.empty() ?
       kMaxTimestamp : stereo_data.front().timestamp;
@@ -227,37 +456,93 @@ timestamp_t DataProvider::FirstTimestamp() const
   const timestamp_t first_range = range_data.empty() ?
       kMaxTimestamp : range_data.front().timestamp;
 
+  // Playback might be past the first chunk of a streamed IMU.
+  std::vector<ImuMeasurement> chunk;
+  if (imu_chunk_loaded_ && imu_chunk_ != 0 && imu_chunk_loader(0, chunk) && !chunk.empty()) {
+    first_imu = chunk.front().timestamp;
+  }
+
   return std::min({first_imu, first_stereo, first_depth, first_range});
 }
 
 
-void DataProvider::SanityCheck()
+timestamp_t DataProvider::LastTimestamp() const
 {
-  for (size_t i = 0; i < imu_data.size(); ++i) {
-    const ImuMeasurement imu = imu_data.at(i);
-    CHECK_LT(imu.a.norm(), kMaxAcceleration)
-        << "Bad acceleration: #" << i << "\n" << imu.a.transpose() << std::endl;
-    CHECK_LT(imu.w.norm(), kMaxAngularVelocity)
-        << "Bad angular velocity: #" << i << "\n" << imu.w.transpose() << std::endl;
+  if (stereo_data.empty() && imu_data.empty() && depth_data.empty() && range_data.empty()) {
+    LoadAll();
   }
+  CHECK(!(imu_data.empty() && stereo_data.empty() && depth_data.empty()));
 
-  for (size_t i = 0; i < depth_data.size(); ++i) {
-    const DepthMeasurement data = depth_data.at(i);
-    CHECK(data.depth <= kMaxDepth && data.depth >= 0)
-      << "Bad depth: #" << i << "\n" << "Value: " << data.depth << std::endl;
+  timestamp_t last_imu = imu_data.empty() ? 0 : imu_data.back().timestamp;
+  const timestamp_t last_stereo = stereo_data.empty() ? 0 : stereo_data.back().timestamp;
+  const timestamp_t last_depth = depth_data.empty() ? 0 : depth_data.back().timestamp;
+  const timestamp_t last_range = range_data.empty() ? 0 : range_data.back().timestamp;
+
+  // The last chunk of a streamed IMU could be anywhere, so this has to read through all of them.
+  if (imu_chunk_loaded_) {
+    std::vector<ImuMeasurement> chunk;
+    for (size_t i = imu_chunk_ + 1; imu_chunk_loader(i, chunk); ++i) {
+      if (!chunk.empty()) { last_imu = chunk.back().timestamp; }
+      chunk.clear();
+    }
   }
 
-  for (size_t i = 0; i < range_data.size(); ++i) {
-    const RangeMeasurement data = range_data.at(i);
-    CHECK(data.range <= kMaxRange && data.range >= 0)
-      << "Bad range: #" << i << "\n" << "Value: " << data.range << std::endl;
-  }
+  return std::max({last_imu, last_stereo, last_depth, last_range});
+}
 
-  CHECK(TimestampsInOrder<ImuMeasurement>(imu_data, true));
-  CHECK(TimestampsInOrder<DepthMeasurement>(depth_data, true));
-  CHECK(TimestampsInOrder<RangeMeasurement>(range_data, false));
+
+DatasetReport DataProvider::Analyze(int max_threads) const
+{
+  LoadAll();
+  std::vector<ImuMeasurement> all_imu;
+  return AnalyzeDataset(stereo_data, AllImu(all_imu), depth_data, range_data, pose_data, max_threads);
 }
 
 
+void DataProvider::SanityCheck(const std::string& report_path)
+{
+  LoadAll();
+  std::vector<ImuMeasurement> all_imu;
+  const std::vector<ImuMeasurement>& imu_stream = AllImu(all_imu);
+
+  DatasetReport report;
+  const bool cached = !report_path.empty() && LoadReport(report_path, report) &&
+      ReportMatchesData(report, stereo_data, imu_stream, depth_data, range_data, pose_data);
+
+  if (cached) {
+    LOG(INFO) << "Using cached dataset report: " << report_path << std::endl;
+  } else {
+    report = AnalyzeDataset(stereo_data, imu_stream, depth_data, range_data, pose_data);
+  }
+
+  LOG(INFO) << "Dataset report:\n" << report.ToString();
+
+  for (const StreamReport& s : report.streams) {
+    if (s.num_gaps > 0) {
+      LOG(WARNING) << s.name << " has " << s.num_gaps << " gaps (longest is " << s.dt_max_ms << " ms)" << std::endl;
+    }
+    if (s.num_saturated > 0) {
+      LOG(WARNING) << s.name << " has " << s.num_saturated << " saturated samples" << std::endl;
+    }
+  }
+
+  const StreamReport* imu = report.Find("IMU");
+  const StreamReport* depth = report.Find("DEPTH");
+  const StreamReport* range = report.Find("RANGE");
+  CHECK(imu != nullptr && depth != nullptr && range != nullptr) << "Incomplete dataset report" << std::endl;
+
+  CHECK_EQ(0ul, imu->num_invalid) << "Bad IMU measurement: #" << imu->first_invalid << std::endl;
+  CHECK_EQ(0ul, depth->num_invalid) << "Bad depth: #" << depth->first_invalid << std::endl;
+  CHECK_EQ(0ul, range->num_invalid) << "Bad range: #" << range->first_invalid << std::endl;
+
+  CHECK(imu->num_out_of_order == 0 && imu->num_duplicates == 0) << "IMU timestamps aren't strictly increasing" << std::endl;
+  CHECK(depth->num_out_of_order == 0 && depth->num_duplicates == 0) << "Depth timestamps aren't strictly increasing" << std::endl;
+  CHECK_EQ(0ul, range->num_out_of_order) << "Range timestamps aren't in order" << std::endl;
+
+  if (!cached && !report_path.empty() && !SaveReport(report_path, report)) {
+    LOG(WARNING) << "Could not cache the dataset report at: " << report_path << std::endl;
+  }
+}
+
 }
 }
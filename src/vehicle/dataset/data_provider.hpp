@@ -2,17 +2,22 @@
 
 #include "core/eigen_types.hpp"
 
+#include <algorithm>
 #include <string>
 #include <functional>
+#include <memory>
 #include <vector>
 
 #include "vision_core/cv_types.hpp"
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "vision_core/stereo_image.hpp"
+#include "vision_core/image_frame.hpp"
+#include "vision_core/image_pool.hpp"
 #include "core/imu_measurement.hpp"
 #include "core/depth_measurement.hpp"
 #include "core/range_measurement.hpp"
+#include "core/thread_util.hpp"
 
 namespace bm {
 namespace dataset {
@@ -40,6 +45,7 @@ inline std::string to_string(const DataSource& d)
 // Callback function signatures.
 typedef std::function<void(const StereoImage1b&)> StereoCallback1b;
 typedef std::function<void(const StereoImage3b&)> StereoCallback3b;
+typedef std::function<void(const StereoFrame&)> StereoFrameCallback;
 typedef std::function<void(const ImuMeasurement&)> ImuCallback;
 typedef std::function<void(const DepthMeasurement&)> DepthCallback;
 typedef std::function<void(const RangeMeasurement&)> RangeCallback;
@@ -61,6 +67,15 @@ struct StereoDatasetItem
 };
 
 
+class StereoPrefetcher;
+struct DecodedStereo;
+struct DatasetReport;
+
+// Decodes stereo pair idx of a dataset (see DecodedStereo). The color images are only needed if
+// decode_color is set.
+typedef std::function<void(size_t idx, bool decode_color, DecodedStereo& out)> StereoDecoder;
+
+
 // Represents a groundruth state at a timestamp (just pose for now).
 struct GroundtruthItem
 {
@@ -89,16 +104,35 @@ bool TimestampsInOrder(const std::vector<T>& data, bool strictly_increasing = fa
 }
 
 
+// Stable, so that measurements with the same timestamp stay in the order they were recorded.
+template <typename T>
+void SortByTimestamp(std::vector<T>& data)
+{
+  std::stable_sort(data.begin(), data.end(), [](const T& lhs, const T& rhs)
+  {
+    return lhs.timestamp < rhs.timestamp;
+  });
+}
+
+
 // Generic interface for something that provides sensor data.
 class DataProvider {
  public:
   DataProvider() = default;
 
-  void RegisterStereoCallback(StereoCallback1b cb) { stereo_callbacks_1b_.emplace_back(cb); }
-  void RegisterStereoCallback(StereoCallback3b cb) { stereo_callbacks_3b_.emplace_back(cb); }
-  void RegisterImuCallback(ImuCallback cb) { imu_callbacks_.emplace_back(cb); }
-  void RegisterDepthCallback(DepthCallback cb) { depth_callbacks_.emplace_back(cb); }
-  void RegisterRangeCallback(RangeCallback cb) { range_callbacks_.emplace_back(cb); }
+  // Registering a callback loads its stream, if the dataset hasn't yet (see the loaders below).
+  void RegisterStereoCallback(StereoCallback1b cb) { LoadStereo(); stereo_callbacks_1b_.emplace_back(cb); }
+  void RegisterStereoCallback(StereoCallback3b cb) { LoadStereo(); stereo_callbacks_3b_.emplace_back(cb); }
+  // The frames compute gray, color and float views on demand (see ImageFrame), for consumers that
+  // need more than one of them, or don't know which one until they see the frame.
+  void RegisterStereoFrameCallback(StereoFrameCallback cb) { LoadStereo(); stereo_frame_callbacks_.emplace_back(cb); }
+  void RegisterImuCallback(ImuCallback cb) { LoadImu(); imu_callbacks_.emplace_back(cb); }
+  void RegisterDepthCallback(DepthCallback cb) { LoadDepth(); depth_callbacks_.emplace_back(cb); }
+  void RegisterRangeCallback(RangeCallback cb) { LoadRange(); range_callbacks_.emplace_back(cb); }
+
+  // Read every stream that hasn't been read yet. Only lazy datasets need this, and whatever needs
+  // the whole dataset (Slice(), Analyze(), SanityCheck()) calls it anyway.
+  void LoadAll() const;
 
   // Retrieve ONE piece of data from whichever data source occurs next chronologically.
   // If there is a tie between different sources, prioritizes (1) IMU, (2) APS, (3) STEREO.
@@ -111,16 +145,51 @@ class DataProvider {
   // playback based on the factor "speed". If speed is < 0, returns data as fast as possible.
   void Playback(float speed = 1.0f, bool verbose = false);
 
+  // CPU pinning and priority for the thread that Playback() runs callbacks on.
+  void SetPlaybackThreadConfig(const ThreadConfig& config) { playback_thread_config_ = config; }
+
+  // Decode up to lookahead stereo pairs ahead of playback on num_threads worker threads (see
+  // StereoPrefetcher), instead of reading each pair inside of Step(). A lookahead of zero turns
+  // prefetching off. Stereo callbacks should be registered before the first Step().
+  void SetStereoPrefetch(size_t lookahead, int num_threads = 2);
+
   // Start the dataset back over at the beginning.
   void Reset();
 
+  // Move playback to the first measurement (of every source) at or after timestamp t, with a binary
+  // search into each source. Can seek backward or forward. A streamed IMU is read from the start
+  // until t.
+  void SeekTo(timestamp_t t);
+
+  // A new DataProvider with only the data in [t0, t1), which can be played back on its own (e.g on
+  // another thread). Callbacks aren't copied, but the prefetch settings are. The data is copied, but
+  // image files and logs aren't, so this is cheap compared to loading the dataset again.
+  DataProvider Slice(timestamp_t t0, timestamp_t t1) const;
+
+  // The first groundtruth pose (or identity if there isn't one).
   Matrix4d InitialPose() const;
+
+  // First/last timestamp of the streams that are loaded, i.e the ones that will be played back. If
+  // none of them are loaded yet, loads everything.
   timestamp_t FirstTimestamp() const;
+  timestamp_t LastTimestamp() const;
+
+  const std::vector<GroundtruthItem>& GroundtruthPoses() const;
 
-  const std::vector<GroundtruthItem>& GroundtruthPoses() const { return pose_data; }
+  // Paths to every stereo pair, for tools that load the images themselves (e.g in parallel). If the
+  // dataset isn't stored as image files, the paths are empty (use DecodeStereo() instead).
+  const std::vector<StereoDatasetItem>& StereoItems() const;
 
-  // Make sure numerical data is reasonable.
-  void SanityCheck();
+  // Reads stereo pair idx, wherever the dataset keeps it.
+  void DecodeStereo(size_t idx, bool decode_color, DecodedStereo& out) const;
+
+  // Rates, gaps, jitter, ordering and bad values for every stream (see AnalyzeDataset()).
+  DatasetReport Analyze(int max_threads = 0) const;
+
+  // Make sure numerical data is reasonable and in order (CHECK-fails if not), and warn about gaps and
+  // IMU saturation. If report_path is given, the report is cached there, and reused as long as it
+  // still matches the data (see ReportMatchesData()).
+  void SanityCheck(const std::string& report_path = "");
 
  private:
   timestamp_t NextTimestamp(timestamp_t& imu_time,
@@ -130,18 +199,44 @@ class DataProvider {
 
   std::pair<timestamp_t, DataSource> NextTimestamp() const;
 
-  // Does sanity-checking on input data. Should be called before playback.
-  void Validate() const;
+  // A decoder for the stereo pairs that doesn't refer back to this DataProvider.
+  StereoDecoder GetStereoDecoder() const;
 
   // Playback() runs this member function in its own thread.
   void PlaybackWorker(float speed, bool verbose);
 
+  // Call the loader for a stream (if it hasn't been already). For a streamed IMU, this reads the
+  // first chunk.
+  void LoadStereo() const;
+  void LoadImu() const;
+  void LoadPoses() const;
+  void LoadDepth() const;
+  void LoadRange() const;
+  bool AllLoaded() const;
+
+  // Streamed IMU only: replace imu_data with chunk i (returns false if there isn't one).
+  bool LoadImuChunk(size_t i) const;
+
+  // The whole IMU stream. If it's streamed, this reads every chunk into "storage" (and is slow).
+  const std::vector<ImuMeasurement>& AllImu(std::vector<ImuMeasurement>& storage) const;
+
   std::vector<StereoCallback1b> stereo_callbacks_1b_;
   std::vector<StereoCallback3b> stereo_callbacks_3b_;
+  std::vector<StereoFrameCallback> stereo_frame_callbacks_;
   std::vector<ImuCallback> imu_callbacks_;
   std::vector<DepthCallback> depth_callbacks_;
   std::vector<RangeCallback> range_callbacks_;
 
+  ThreadConfig playback_thread_config_;
+
+  size_t prefetch_lookahead_ = 0;
+  int prefetch_threads_ = 2;
+  std::shared_ptr<StereoPrefetcher> prefetcher_;  // Created on the first stereo Step().
+
+  // Gray images are converted into buffers from here. Copies of this DataProvider (and decoders from
+  // GetStereoDecoder()) share it.
+  std::shared_ptr<ImagePool> image_pool_ = std::make_shared<ImagePool>(16);
+
   // Timestamp of the last data item that was passed to a callback.
   timestamp_t last_data_timestamp_ = 0;
 
@@ -151,12 +246,41 @@ class DataProvider {
   size_t next_depth_idx_ = 0;
   size_t next_range_idx_ = 0;
 
+  // Streamed IMU only: which chunk is in imu_data, and how many measurements came before it.
+  mutable bool imu_chunk_loaded_ = false;
+  mutable size_t imu_chunk_ = 0;
+  mutable size_t imu_chunk_first_ = 0;
+
  protected:
-  std::vector<StereoDatasetItem> stereo_data;
-  std::vector<ImuMeasurement> imu_data;
-  std::vector<GroundtruthItem> pose_data;
-  std::vector<DepthMeasurement> depth_data;
-  std::vector<RangeMeasurement> range_data;
+  // NOTE(milo): Mutable, since lazy streams are read the first time anything (even a const method)
+  // needs them.
+  mutable std::vector<StereoDatasetItem> stereo_data;
+  mutable std::vector<ImuMeasurement> imu_data;
+  mutable std::vector<GroundtruthItem> pose_data;
+  mutable std::vector<DepthMeasurement> depth_data;
+  mutable std::vector<RangeMeasurement> range_data;
+
+  // Datasets can leave a stream empty in their constructor, and set its loader to fill it in on
+  // first use instead (when a callback is registered for it, or something reads it). Each loader
+  // is called at most once, and then cleared. Like stereo_decoder, they survive a copy, so they
+  // shouldn't refer back to the subclass. Loading isn't threadsafe, so call LoadAll() before
+  // sharing a lazy dataset between threads.
+  mutable std::function<void(std::vector<StereoDatasetItem>&)> stereo_loader;
+  mutable std::function<void(std::vector<ImuMeasurement>&)> imu_loader;
+  mutable std::function<void(std::vector<GroundtruthItem>&)> pose_loader;
+  mutable std::function<void(std::vector<DepthMeasurement>&)> depth_loader;
+  mutable std::function<void(std::vector<RangeMeasurement>&)> range_loader;
+
+  // Or, the IMU can be streamed from disk: imu_chunk_loader(i, out) fills out with chunk i of the
+  // stream (in order), and returns false if there is no chunk i. Only the chunk being played back
+  // is kept in imu_data.
+  typedef std::function<bool(size_t chunk, std::vector<ImuMeasurement>& out)> ImuChunkLoader;
+  ImuChunkLoader imu_chunk_loader;
+
+  // Datasets that don't store their stereo pairs as image files (at the paths in stereo_data) can
+  // set this to read them instead. It's a std::function rather than a virtual so that it survives
+  // a DataProvider being copied out of a subclass (see GetDatasetByName()).
+  StereoDecoder stereo_decoder;
 };
 
 }
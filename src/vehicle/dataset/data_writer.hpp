@@ -0,0 +1,37 @@
+#pragma once
+
+#include "core/macros.hpp"
+#include "core/imu_measurement.hpp"
+#include "core/depth_measurement.hpp"
+#include "core/range_measurement.hpp"
+#include "core/mag_measurement.hpp"
+#include "vision_core/stereo_image.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// Generic interface for something that records sensor data to disk (the opposite of a
+// DataProvider), so that recorders don't care about the dataset format.
+class DataWriter {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(DataWriter);
+
+  virtual ~DataWriter() = default;
+
+  virtual void WriteImu(const ImuMeasurement& data) = 0;
+
+  virtual void WriteDepth(const DepthMeasurement& data) = 0;
+
+  virtual void WriteRange(const RangeMeasurement& data) = 0;
+
+  virtual void WriteMag(const MagMeasurement& data) = 0;
+
+  virtual void WriteStereo(const StereoImage3b& data) = 0;
+};
+
+
+}
+}
@@ -0,0 +1,389 @@
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include "core/latency_histogram.hpp"
+#include "dataset/csv_reader.hpp"
+#include "dataset/dataset_analyzer.hpp"
+
+namespace bm {
+namespace dataset {
+
+// Streams shorter than this aren't worth splitting across threads.
+static const size_t kMinItemsPerThread = 100000;
+
+// An IMU axis is only considered saturated if it's pinned at its largest value this many times (a
+// single sample at the max is just the max), but for less than half of the samples (otherwise the
+// axis is just constant, e.g gravity in a simulator).
+static const size_t kMinPinnedSamples = 3;
+
+
+namespace {
+
+// Running totals for a contiguous chunk of a stream.
+struct ChunkStats final
+{
+  timestamp_t t_min = kMaxTimestamp;
+  timestamp_t t_max = 0;
+
+  size_t num_dt = 0;
+  double sum_dt = 0;
+  double sum_sq_dt = 0;
+
+  size_t num_out_of_order = 0;
+  size_t num_duplicates = 0;
+  size_t num_gaps = 0;
+  size_t num_invalid = 0;
+  size_t first_invalid = std::numeric_limits<size_t>::max();
+
+  // Largest absolute value on each IMU axis (w, then a), and how many samples are at it.
+  std::array<double, 6> max_abs = {{ 0, 0, 0, 0, 0, 0 }};
+  std::array<size_t, 6> num_pinned = {{ 0, 0, 0, 0, 0, 0 }};
+};
+
+}
+
+
+static bool IsValid(const StereoDatasetItem&) { return true; }
+
+static bool IsValid(const ImuMeasurement& data)
+{
+  return data.a.norm() < kMaxAcceleration && data.w.norm() < kMaxAngularVelocity;
+}
+
+static bool IsValid(const DepthMeasurement& data)
+{
+  return data.depth <= kMaxDepth && data.depth >= 0;
+}
+
+static bool IsValid(const RangeMeasurement& data)
+{
+  return data.range <= kMaxRange && data.range >= 0;
+}
+
+static bool IsValid(const GroundtruthItem& data)
+{
+  return data.world_T_body.allFinite();
+}
+
+
+template <typename T>
+static void TrackSaturation(const T&, ChunkStats&) {}
+
+static void TrackSaturation(const ImuMeasurement& data, ChunkStats& stats)
+{
+  const double values[6] = { data.w.x(), data.w.y(), data.w.z(), data.a.x(), data.a.y(), data.a.z() };
+  for (int k = 0; k < 6; ++k) {
+    const double v = std::fabs(values[k]);
+    if (v > stats.max_abs[k]) {
+      stats.max_abs[k] = v;
+      stats.num_pinned[k] = 1;
+    } else if (v == stats.max_abs[k] && v > 0) {
+      ++stats.num_pinned[k];
+    }
+  }
+}
+
+
+template <typename T>
+static void AnalyzeChunk(const std::vector<T>& data,
+                         size_t begin,
+                         size_t end,
+                         double gap_sec,
+                         LatencyHistogram& dt_ms,
+                         ChunkStats& stats)
+{
+  for (size_t i = begin; i < end; ++i) {
+    const T& item = data[i];
+    stats.t_min = std::min(stats.t_min, item.timestamp);
+    stats.t_max = std::max(stats.t_max, item.timestamp);
+
+    if (!IsValid(item)) {
+      ++stats.num_invalid;
+      stats.first_invalid = std::min(stats.first_invalid, i);
+    }
+    TrackSaturation(item, stats);
+
+    if (i == 0) {
+      continue;
+    }
+
+    const timestamp_t prev = data[i - 1].timestamp;
+    if (item.timestamp < prev) {
+      ++stats.num_out_of_order;
+      continue;
+    }
+    if (item.timestamp == prev) {
+      ++stats.num_duplicates;
+    }
+
+    const double dt = ConvertToSeconds(item.timestamp - prev);
+    dt_ms.Record(1e3 * dt);
+    ++stats.num_dt;
+    stats.sum_dt += dt;
+    stats.sum_sq_dt += dt * dt;
+    if (gap_sec > 0 && dt > gap_sec) {
+      ++stats.num_gaps;
+    }
+  }
+}
+
+
+template <typename T>
+static StreamReport AnalyzeStream(const std::string& name,
+                                  const std::vector<T>& data,
+                                  int max_threads,
+                                  double gap_factor)
+{
+  StreamReport report;
+  report.name = name;
+  report.count = data.size();
+  if (data.empty()) {
+    return report;
+  }
+
+  // NOTE(milo): The average is taken from the ends of the stream, so that gaps can be counted in the
+  // same pass (it's only off if the stream is out of order, which is reported anyway).
+  const double duration = (data.back().timestamp > data.front().timestamp) ?
+      ConvertToSeconds(data.back().timestamp - data.front().timestamp) : 0;
+  const double gap_sec = (data.size() > 1) ? gap_factor * duration / static_cast<double>(data.size() - 1) : 0;
+
+  const size_t num_threads = (max_threads > 0) ? max_threads : std::max(1u, std::thread::hardware_concurrency());
+  const size_t num_chunks = std::max(1ul, std::min(num_threads, data.size() / kMinItemsPerThread));
+
+  LatencyHistogram dt_ms(1e-3);
+  std::vector<ChunkStats> chunks(num_chunks);
+  std::vector<std::future<void>> futures;
+  for (size_t c = 0; c < num_chunks; ++c) {
+    const size_t begin = (c * data.size()) / num_chunks;
+    const size_t end = ((c + 1) * data.size()) / num_chunks;
+    if (c + 1 == num_chunks) {
+      AnalyzeChunk(data, begin, end, gap_sec, dt_ms, chunks.at(c));
+    } else {
+      futures.emplace_back(std::async(std::launch::async, AnalyzeChunk<T>, std::cref(data), begin, end,
+                                      gap_sec, std::ref(dt_ms), std::ref(chunks.at(c))));
+    }
+  }
+  for (std::future<void>& f : futures) {
+    f.get();
+  }
+
+  // Merge the chunks.
+  ChunkStats total;
+  for (const ChunkStats& c : chunks) {
+    total.t_min = std::min(total.t_min, c.t_min);
+    total.t_max = std::max(total.t_max, c.t_max);
+    total.num_dt += c.num_dt;
+    total.sum_dt += c.sum_dt;
+    total.sum_sq_dt += c.sum_sq_dt;
+    total.num_out_of_order += c.num_out_of_order;
+    total.num_duplicates += c.num_duplicates;
+    total.num_gaps += c.num_gaps;
+    total.num_invalid += c.num_invalid;
+    total.first_invalid = std::min(total.first_invalid, c.first_invalid);
+    for (int k = 0; k < 6; ++k) {
+      total.max_abs[k] = std::max(total.max_abs[k], c.max_abs[k]);
+    }
+  }
+  for (const ChunkStats& c : chunks) {
+    for (int k = 0; k < 6; ++k) {
+      if (c.max_abs[k] == total.max_abs[k]) {
+        total.num_pinned[k] += c.num_pinned[k];
+      }
+    }
+  }
+
+  report.t_first = total.t_min;
+  report.t_last = total.t_max;
+  report.rate_hz = (total.t_max > total.t_min) ?
+      static_cast<double>(data.size() - 1) / ConvertToSeconds(total.t_max - total.t_min) : 0;
+  report.dt_p50_ms = dt_ms.Percentile(0.5);
+  report.dt_p99_ms = dt_ms.Percentile(0.99);
+  report.dt_max_ms = dt_ms.Max();
+  if (total.num_dt > 0) {
+    const double mean = total.sum_dt / static_cast<double>(total.num_dt);
+    const double var = total.sum_sq_dt / static_cast<double>(total.num_dt) - mean * mean;
+    report.jitter_ms = 1e3 * std::sqrt(std::max(0.0, var));
+  }
+  report.num_out_of_order = total.num_out_of_order;
+  report.num_duplicates = total.num_duplicates;
+  report.num_gaps = total.num_gaps;
+  report.num_invalid = total.num_invalid;
+  report.first_invalid = (total.num_invalid > 0) ? total.first_invalid : 0;
+  for (int k = 0; k < 6; ++k) {
+    if (total.num_pinned[k] >= kMinPinnedSamples && 2 * total.num_pinned[k] < data.size()) {
+      report.num_saturated += total.num_pinned[k];
+    }
+  }
+
+  return report;
+}
+
+
+DatasetReport AnalyzeDataset(const std::vector<StereoDatasetItem>& stereo_data,
+                             const std::vector<ImuMeasurement>& imu_data,
+                             const std::vector<DepthMeasurement>& depth_data,
+                             const std::vector<RangeMeasurement>& range_data,
+                             const std::vector<GroundtruthItem>& pose_data,
+                             int max_threads,
+                             double gap_factor)
+{
+  std::future<StreamReport> stereo = std::async(std::launch::async, AnalyzeStream<StereoDatasetItem>,
+      "STEREO", std::cref(stereo_data), max_threads, gap_factor);
+  std::future<StreamReport> imu = std::async(std::launch::async, AnalyzeStream<ImuMeasurement>,
+      "IMU", std::cref(imu_data), max_threads, gap_factor);
+  std::future<StreamReport> depth = std::async(std::launch::async, AnalyzeStream<DepthMeasurement>,
+      "DEPTH", std::cref(depth_data), max_threads, gap_factor);
+  std::future<StreamReport> range = std::async(std::launch::async, AnalyzeStream<RangeMeasurement>,
+      "RANGE", std::cref(range_data), max_threads, gap_factor);
+  const StreamReport groundtruth = AnalyzeStream<GroundtruthItem>("GROUNDTRUTH", pose_data, max_threads, gap_factor);
+
+  DatasetReport report;
+  report.streams = { stereo.get(), imu.get(), depth.get(), range.get(), groundtruth };
+  return report;
+}
+
+
+const StreamReport* DatasetReport::Find(const std::string& name) const
+{
+  for (const StreamReport& s : streams) {
+    if (s.name == name) { return &s; }
+  }
+  return nullptr;
+}
+
+
+std::string DatasetReport::ToString() const
+{
+  std::string out;
+  char line[256];
+  for (const StreamReport& s : streams) {
+    if (s.count == 0) {
+      continue;
+    }
+    snprintf(line, sizeof(line),
+        "%-12s N=%-9zu RATE=%-8.2f DT_P50=%-8.3f DT_P99=%-8.3f DT_MAX=%-9.3f JITTER=%-7.3f "
+        "GAPS=%zu OUT_OF_ORDER=%zu DUPLICATES=%zu INVALID=%zu SATURATED=%zu\n",
+        s.name.c_str(), s.count, s.rate_hz, s.dt_p50_ms, s.dt_p99_ms, s.dt_max_ms, s.jitter_ms,
+        s.num_gaps, s.num_out_of_order, s.num_duplicates, s.num_invalid, s.num_saturated);
+    out += line;
+  }
+  return out;
+}
+
+
+bool SaveReport(const std::string& path, const DatasetReport& report)
+{
+  std::ofstream out(path, std::ios_base::out | std::ios_base::trunc);
+  if (!out.is_open()) {
+    return false;
+  }
+
+  out << "#name,count,t_first,t_last,rate_hz,dt_p50_ms,dt_p99_ms,dt_max_ms,jitter_ms,"
+         "num_out_of_order,num_duplicates,num_gaps,num_invalid,num_saturated\n";
+
+  char line[512];
+  for (const StreamReport& s : report.streams) {
+    snprintf(line, sizeof(line), "%s,%zu,%zu,%zu,%.9g,%.9g,%.9g,%.9g,%.9g,%zu,%zu,%zu,%zu,%zu\n",
+        s.name.c_str(), s.count, s.t_first, s.t_last, s.rate_hz, s.dt_p50_ms, s.dt_p99_ms, s.dt_max_ms,
+        s.jitter_ms, s.num_out_of_order, s.num_duplicates, s.num_gaps, s.num_invalid, s.num_saturated);
+    out << line;
+  }
+
+  return out.good();
+}
+
+
+static bool NextCount(CsvLine& line, size_t& value)
+{
+  timestamp_t v = 0;
+  if (!line.Next(v)) {
+    return false;
+  }
+  value = static_cast<size_t>(v);
+  return true;
+}
+
+
+bool LoadReport(const std::string& path, DatasetReport& report)
+{
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    return false;
+  }
+
+  DatasetReport loaded;
+  std::string text;
+  std::getline(in, text);   // Header.
+
+  while (std::getline(in, text)) {
+    if (text.empty()) {
+      continue;
+    }
+
+    // NOTE(milo): std::string is null-terminated, so CsvLine can parse the last field in place.
+    CsvLine line(text.data(), text.data() + text.size());
+    const char* name = nullptr;
+    size_t name_length = 0;
+
+    StreamReport s;
+    const bool ok = line.Next(name, name_length) &&
+                    NextCount(line, s.count) &&
+                    line.Next(s.t_first) &&
+                    line.Next(s.t_last) &&
+                    line.Next(s.rate_hz) &&
+                    line.Next(s.dt_p50_ms) &&
+                    line.Next(s.dt_p99_ms) &&
+                    line.Next(s.dt_max_ms) &&
+                    line.Next(s.jitter_ms) &&
+                    NextCount(line, s.num_out_of_order) &&
+                    NextCount(line, s.num_duplicates) &&
+                    NextCount(line, s.num_gaps) &&
+                    NextCount(line, s.num_invalid) &&
+                    NextCount(line, s.num_saturated);
+    if (!ok) {
+      LOG(WARNING) << "Could not parse dataset report: " << path << std::endl;
+      return false;
+    }
+    s.name.assign(name, name_length);
+    loaded.streams.emplace_back(s);
+  }
+
+  report = loaded;
+  return true;
+}
+
+
+template <typename T>
+static bool EndsMatch(const StreamReport* report, const std::vector<T>& data)
+{
+  if (report == nullptr || report->count != data.size()) {
+    return false;
+  }
+  return data.empty() || (report->t_first == data.front().timestamp && report->t_last == data.back().timestamp);
+}
+
+
+bool ReportMatchesData(const DatasetReport& report,
+                       const std::vector<StereoDatasetItem>& stereo_data,
+                       const std::vector<ImuMeasurement>& imu_data,
+                       const std::vector<DepthMeasurement>& depth_data,
+                       const std::vector<RangeMeasurement>& range_data,
+                       const std::vector<GroundtruthItem>& pose_data)
+{
+  return EndsMatch(report.Find("STEREO"), stereo_data) &&
+         EndsMatch(report.Find("IMU"), imu_data) &&
+         EndsMatch(report.Find("DEPTH"), depth_data) &&
+         EndsMatch(report.Find("RANGE"), range_data) &&
+         EndsMatch(report.Find("GROUNDTRUTH"), pose_data);
+}
+
+
+}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "core/timestamp.hpp"
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+// Limits on measurement values, beyond which a measurement is considered invalid.
+static const double kMaxAcceleration = 98.1;    // m/s^2
+static const double kMaxAngularVelocity = 20.0; // [rad / sec]
+static const double kMaxRange = 100.0;          // m
+static const double kMaxDepth = 20.0;           // m
+
+
+// Timing and value statistics for one stream of a dataset (e.g the IMU).
+struct StreamReport final
+{
+  std::string name;
+  size_t count = 0;
+  timestamp_t t_first = 0;        // Earliest and latest timestamps.
+  timestamp_t t_last = 0;
+
+  double rate_hz = 0;             // Average rate over the whole stream.
+  double dt_p50_ms = 0;           // Time between consecutive measurements.
+  double dt_p99_ms = 0;
+  double dt_max_ms = 0;
+  double jitter_ms = 0;           // Standard deviation of the time between measurements.
+
+  size_t num_out_of_order = 0;    // Timestamps that went backwards...
+  size_t num_duplicates = 0;      // ... or repeated the one before.
+  size_t num_gaps = 0;            // Times between measurements over gap_factor x the average.
+
+  size_t num_invalid = 0;         // Values outside of the limits above.
+  size_t first_invalid = 0;       // Index of the first one (only if num_invalid > 0, not cached).
+  size_t num_saturated = 0;       // IMU only: samples pinned at the largest value seen on an axis.
+};
+
+
+// The result of analyzing a whole dataset, with one StreamReport for each of STEREO, IMU, DEPTH,
+// RANGE and GROUNDTRUTH (in that order).
+struct DatasetReport final
+{
+  std::vector<StreamReport> streams;
+
+  // Returns nullptr if there's no stream called name.
+  const StreamReport* Find(const std::string& name) const;
+
+  // A table with one line per (nonempty) stream.
+  std::string ToString() const;
+};
+
+
+// Analyzes every stream in a single pass. Each stream is analyzed on its own thread, and long streams
+// are also split across up to max_threads threads (0 for one per core). A gap is any time between
+// measurements over gap_factor times the stream's average.
+DatasetReport AnalyzeDataset(const std::vector<StereoDatasetItem>& stereo_data,
+                             const std::vector<ImuMeasurement>& imu_data,
+                             const std::vector<DepthMeasurement>& depth_data,
+                             const std::vector<RangeMeasurement>& range_data,
+                             const std::vector<GroundtruthItem>& pose_data,
+                             int max_threads = 0,
+                             double gap_factor = 5.0);
+
+// Reports are cached as a small CSV (one row per stream). LoadReport() returns false if the file
+// doesn't exist or can't be parsed.
+bool SaveReport(const std::string& path, const DatasetReport& report);
+bool LoadReport(const std::string& path, DatasetReport& report);
+
+// Whether every stream has the same count and first/last timestamps as in the report, i.e a cached
+// report is (very likely) for this data. This doesn't look at anything but the ends of each stream.
+bool ReportMatchesData(const DatasetReport& report,
+                       const std::vector<StereoDatasetItem>& stereo_data,
+                       const std::vector<ImuMeasurement>& imu_data,
+                       const std::vector<DepthMeasurement>& depth_data,
+                       const std::vector<RangeMeasurement>& range_data,
+                       const std::vector<GroundtruthItem>& pose_data);
+
+
+}
+}
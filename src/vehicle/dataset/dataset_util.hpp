@@ -7,6 +7,7 @@
 #include "dataset/himb_dataset.hpp"
 #include "dataset/caddy_dataset.hpp"
 #include "dataset/acfr_dataset.hpp"
+#include "dataset/synthetic_dataset.hpp"
 
 #include "core/path_util.hpp"
 
@@ -22,12 +23,14 @@ enum Dataset
   CADDY = 1,
   HIMB = 2,
   ACFR = 3,
-  ZEDM = 4
+  ZEDM = 4,
+  SYNTHETIC = 5
 };
 
 
 // Convenience function for returning a dataset based on the enum type specified.
 // Pass in the top level dataset folder, and optionally a subfolder if required (e.g HIMB "train").
+// For SYNTHETIC, the folder is the path to a SyntheticDataset params file (or empty for defaults).
 // Returns the dataset and sets shared_params_path to the relevant dataset params in
 // vehicle/config/shared/*.
 inline DataProvider GetDatasetByName(Dataset code,
@@ -58,6 +61,12 @@ inline DataProvider GetDatasetByName(Dataset code,
       dataset = dataset::EurocDataset(folder);
       shared_params_path = config_path("shared/ZEDMini.yaml");
       break;
+    case Dataset::SYNTHETIC:
+      // NOTE(milo): Generated in Farmsim's frames, with its rig by default.
+      dataset = dataset::SyntheticDataset(folder.empty() ? SyntheticDataset::Params() :
+                                                           SyntheticDataset::Params(folder));
+      shared_params_path = config_path("shared/Farmsim.yaml");
+      break;
     default:
       LOG(FATAL) << "Unknown dataset type: " << code << std::endl;
       break;
@@ -10,9 +10,44 @@ namespace bm {
 namespace dataset {
 
 
-EurocDataWriter::EurocDataWriter(const std::string& folder)
-    : folder_(Join(folder, "mav0"))
+static const char* kImuHeader = "#timestamp [ns],w_RS_S_x [rad s^-1],w_RS_S_y [rad s^-1],w_RS_S_z [rad s^-1],"
+                                "a_RS_S_x [m s^-2],a_RS_S_y [m s^-2],a_RS_S_z [m s^-2]";
+static const char* kDepthHeader = "#timestamp [ns],depth [m]";
+static const char* kRangeHeader = "#timestamp [ns],range [m],x [m],y [m],z [m]";
+static const char* kCameraHeader = "#timestamp [ns],filename";
+
+
+// Open a CSV the first time something is written to it, and start it with a header row (EurocDataset
+// skips the first line). NOTE(milo): Sensors that never write anything don't get a CSV, since
+// EurocDataset expects every CSV that exists to have data in it.
+static std::ofstream& OpenCsv(std::ofstream& out, const std::string& folder, const char* header)
+{
+  if (!out.is_open()) {
+    const std::string path = Join(folder, "data.csv");
+    out.open(path, std::ios_base::out | std::ios_base::trunc);
+    CHECK(out.is_open()) << "Could not open file: " << path << std::endl;
+    out << header << "\n";
+  }
+  return out;
+}
+
+
+EurocDataWriter::EurocDataWriter(const std::string& folder,
+                                 const std::string& image_ext,
+                                 int compression)
+    : folder_(Join(folder, "mav0")),
+      image_ext_(image_ext)
 {
+  if (image_ext_ == ".png") {
+    CHECK(compression >= 0 && compression <= 9) << "PNG compression must be in [0, 9]" << std::endl;
+    image_params_ = { cv::IMWRITE_PNG_COMPRESSION, compression };
+  } else if (image_ext_ == ".jpg") {
+    CHECK(compression >= 0 && compression <= 100) << "JPEG quality must be in [0, 100]" << std::endl;
+    image_params_ = { cv::IMWRITE_JPEG_QUALITY, compression };
+  } else {
+    LOG(FATAL) << "Unsupported image extension: " << image_ext_ << std::endl;
+  }
+
   if (Exists(folder)) {
     LOG(WARNING) << "Dataset folder already exists, overwriting" << std::endl;
     rmdir(folder);
@@ -20,6 +55,7 @@ EurocDataWriter::EurocDataWriter(const std::string& folder)
 
   imu_folder_ = Join(folder_, "imu0");
   depth_folder_ = Join(folder_, "depth0");
+  range_folder_ = Join(folder_, "aps0");
   left_folder_ = Join(folder_, "cam0");
   right_folder_ = Join(folder_, "cam1");
 
@@ -27,6 +63,7 @@ EurocDataWriter::EurocDataWriter(const std::string& folder)
   mkdir(folder_);
   mkdir(imu_folder_);
   mkdir(depth_folder_);
+  mkdir(range_folder_);
   mkdir(left_folder_);
   mkdir(right_folder_);
   mkdir(Join(left_folder_, "data"));
@@ -36,37 +73,94 @@ EurocDataWriter::EurocDataWriter(const std::string& folder)
 
 void EurocDataWriter::WriteImu(const ImuMeasurement& data)
 {
-  std::ofstream out;
-  out.open(Join(imu_folder_, "data.csv"), std::ios_base::app);
-
   char buf[100];
   const int sz = std::snprintf(buf, 100, "%zu,%lf,%lf,%lf,%lf,%lf,%lf\n",
       data.timestamp, data.w.x(), data.w.y(), data.w.z(), data.a.x(), data.a.y(), data.a.z());
   CHECK(sz < 100) << "Buffer overflow! Need to allocate larger char[]" << std::endl;
 
-  out << std::string(buf);
-  out.close();
+  OpenCsv(imu_csv_, imu_folder_, kImuHeader).write(buf, sz);
+}
+
+
+void EurocDataWriter::WriteDepth(const DepthMeasurement& data)
+{
+  char buf[100];
+  const int sz = std::snprintf(buf, 100, "%zu,%lf\n", data.timestamp, data.depth);
+  CHECK(sz < 100) << "Buffer overflow! Need to allocate larger char[]" << std::endl;
+
+  OpenCsv(depth_csv_, depth_folder_, kDepthHeader).write(buf, sz);
+}
+
+
+void EurocDataWriter::WriteRange(const RangeMeasurement& data)
+{
+  char buf[150];
+  const int sz = std::snprintf(buf, 150, "%zu,%lf,%lf,%lf,%lf\n",
+      data.timestamp, data.range, data.point.x(), data.point.y(), data.point.z());
+  CHECK(sz < 150) << "Buffer overflow! Need to allocate larger char[]" << std::endl;
+
+  OpenCsv(range_csv_, range_folder_, kRangeHeader).write(buf, sz);
+}
+
+
+void EurocDataWriter::WriteMag(const MagMeasurement&)
+{
+  LOG_FIRST_N(WARNING, 1) << "EuRoC format doesn't store magnetometer data, dropping it" << std::endl;
 }
 
 
 void EurocDataWriter::WriteStereo(const StereoImage3b& data)
 {
-  std::ofstream ofl, ofr;
-  ofl.open(Join(left_folder_, "data.csv"), std::ios_base::app);
-  ofr.open(Join(right_folder_, "data.csv"), std::ios_base::app);
-
-  const std::string img_name = std::to_string(data.timestamp) + ".png";
-  const std::string data_img_name = Join("data", img_name);
-
-  cv::imwrite(Join(left_folder_, data_img_name), data.left_image);
-  cv::imwrite(Join(right_folder_, data_img_name), data.right_image);
-
-  // NOTE(milo): Write metadata after image! That way we don't end up with data.csv pointing
-  // to an image that doesn't exist on disk.
-  ofl << std::to_string(data.timestamp) << "," << img_name << std::endl;
-  ofr << std::to_string(data.timestamp) << "," << img_name << std::endl;
-  ofl.close();
-  ofr.close();
+  if (WriteStereoImages(data)) {
+    WriteStereoCsv(data.timestamp);
+  }
+}
+
+
+std::string EurocDataWriter::ImageName(timestamp_t timestamp) const
+{
+  return std::to_string(timestamp) + image_ext_;
+}
+
+
+bool EurocDataWriter::WriteStereoImages(const StereoImage3b& data) const
+{
+  const std::string data_img_name = Join("data", ImageName(data.timestamp));
+
+  const std::string left_path = Join(left_folder_, data_img_name);
+  const std::string right_path = Join(right_folder_, data_img_name);
+
+  // NOTE(milo): Don't crash the recorder if an image can't be written (e.g the disk is full).
+  if (!cv::imwrite(left_path, data.left_image, image_params_)) {
+    LOG(ERROR) << "Could not write image, skipping this stereo pair: " << left_path << std::endl;
+    return false;
+  }
+  if (!cv::imwrite(right_path, data.right_image, image_params_)) {
+    LOG(ERROR) << "Could not write image, skipping this stereo pair: " << right_path << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+void EurocDataWriter::WriteStereoCsv(timestamp_t timestamp)
+{
+  // NOTE(milo): Only call this after the images are saved! That way we don't end up with data.csv
+  // pointing to an image that doesn't exist on disk.
+  const std::string row = std::to_string(timestamp) + "," + ImageName(timestamp) + "\n";
+  OpenCsv(left_csv_, left_folder_, kCameraHeader) << row;
+  OpenCsv(right_csv_, right_folder_, kCameraHeader) << row;
+}
+
+
+void EurocDataWriter::Flush()
+{
+  imu_csv_.flush();
+  depth_csv_.flush();
+  range_csv_.flush();
+  left_csv_.flush();
+  right_csv_.flush();
 }
 
 
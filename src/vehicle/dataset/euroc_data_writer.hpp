@@ -1,32 +1,69 @@
 #pragma once
 
+#include <fstream>
 #include <string>
+#include <vector>
 
-#include "core/imu_measurement.hpp"
-#include "core/depth_measurement.hpp"
-#include "vision_core/stereo_image.hpp"
+#include "core/macros.hpp"
+#include "dataset/data_writer.hpp"
 
 namespace bm {
 namespace dataset {
 
 using namespace core;
 
-class EurocDataWriter {
+
+// Writes a dataset folder in EuRoC format (see EurocDataset). The CSVs are kept open and buffered,
+// so rows only reach the disk when the buffer fills up, on Flush(), or when the writer is destroyed.
+class EurocDataWriter final : public DataWriter {
  public:
-  EurocDataWriter(const std::string& folder);
+  MACRO_DELETE_COPY_CONSTRUCTORS(EurocDataWriter);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(EurocDataWriter);
+
+  // Images are saved with image_ext (".png" or ".jpg"). The compression is the PNG compression
+  // level (0-9, higher is smaller but slower) or the JPEG quality (0-100).
+  explicit EurocDataWriter(const std::string& folder,
+                           const std::string& image_ext = ".png",
+                           int compression = 3);
+
+  void WriteImu(const ImuMeasurement& data) override;
+
+  void WriteDepth(const DepthMeasurement& data) override;
+
+  void WriteRange(const RangeMeasurement& data) override;
 
-  void WriteImu(const ImuMeasurement& data);
+  // EuRoC has no magnetometer data, so this is dropped (with a warning).
+  void WriteMag(const MagMeasurement& data) override;
 
-  void WriteDepth(const DepthMeasurement& data);
+  void WriteStereo(const StereoImage3b& data) override;
 
-  void WriteStereo(const StereoImage3b& data);
+  // The two halves of WriteStereo(). WriteStereoImages() only encodes and saves the images (and
+  // returns false if either one couldn't be written), and is safe to call from several threads at
+  // once. WriteStereoCsv() adds an (already saved) pair to the cam0/cam1 CSVs.
+  bool WriteStereoImages(const StereoImage3b& data) const;
+  void WriteStereoCsv(timestamp_t timestamp);
+
+  // Push all buffered CSV rows to disk.
+  void Flush();
 
  private:
+  std::string ImageName(timestamp_t timestamp) const;
+
   std::string folder_;
   std::string imu_folder_;
   std::string depth_folder_;
+  std::string range_folder_;
   std::string left_folder_;
   std::string right_folder_;
+
+  std::string image_ext_;
+  std::vector<int> image_params_;
+
+  std::ofstream imu_csv_;
+  std::ofstream depth_csv_;
+  std::ofstream range_csv_;
+  std::ofstream left_csv_;
+  std::ofstream right_csv_;
 };
 
 }
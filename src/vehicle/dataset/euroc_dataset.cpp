@@ -1,39 +1,51 @@
-#include <fstream>
+#include <cctype>
+#include <algorithm>
+#include <limits>
+#include <memory>
 
 #include <glog/logging.h>
 
 #include "dataset/euroc_dataset.hpp"
+#include "dataset/csv_reader.hpp"
 #include "core/file_utils.hpp"
 
 namespace bm {
 namespace dataset {
 
 
-EurocDataset::EurocDataset(const std::string& toplevel_path) : DataProvider()
+EurocDataset::EurocDataset(const std::string& toplevel_path, bool lazy, size_t imu_chunk_lines)
+    : DataProvider()
 {
   const std::string mav0_path = Join(toplevel_path, "mav0");
 
+  // NOTE(milo): The loaders only capture paths, so they still work after this dataset is copied
+  // into a DataProvider.
   const std::string cam0_path = Join(mav0_path, "cam0");
   const std::string cam1_path = Join(mav0_path, "cam1");
-  ParseStereo(cam0_path, cam1_path);
+  stereo_loader = [cam0_path, cam1_path](std::vector<StereoDatasetItem>& out)
+  {
+    ParseStereo(cam0_path, cam1_path, out);
+  };
 
   const std::string& imu_csv = Join(mav0_path, "imu0/data.csv");
-  if (Exists(imu_csv)) {
-    ParseImu(imu_csv);
+  if (Exists(imu_csv) && imu_chunk_lines > 0) {
+    imu_chunk_loader = ImuChunks(imu_csv, imu_chunk_lines);
+  } else if (Exists(imu_csv)) {
+    imu_loader = [imu_csv](std::vector<ImuMeasurement>& out) { ParseImu(imu_csv, out); };
   } else {
     LOG(WARNING) << "[MISSING DATA] No IMU measurements found!" << std::endl;
   }
 
   const std::string& pose_txt = Join(mav0_path, "imu0_poses.txt");
   if (Exists(pose_txt)) {
-    ParseGroundtruth(pose_txt);
+    pose_loader = [pose_txt](std::vector<GroundtruthItem>& out) { ParseGroundtruth(pose_txt, out); };
   } else {
     LOG(WARNING) << "[MISSING DATA] No groundtruth poses found!" << std::endl;
   }
 
   const std::string& depth_csv = Join(mav0_path, "depth0/data.csv");
   if (Exists(depth_csv)) {
-    ParseDepth(depth_csv);
+    depth_loader = [depth_csv](std::vector<DepthMeasurement>& out) { ParseDepth(depth_csv, out); };
   } else {
     LOG(WARNING) << "[MISSING DATA] No depth measurements found!" << std::endl;
   }
@@ -46,74 +58,89 @@ EurocDataset::EurocDataset(const std::string& toplevel_path) : DataProvider()
     range_csv_paths.emplace_back(Join(mav0_path, "aps1/data.csv"));
   }
   if (!range_csv_paths.empty()) {
-    ParseRange(range_csv_paths);
+    range_loader = [range_csv_paths](std::vector<RangeMeasurement>& out) { ParseRange(range_csv_paths, out); };
   } else {
     LOG(WARNING) << "[MISSING DATA] No range measurements found!" << std::endl;
   }
 
-  SanityCheck();
+  // NOTE(milo): A lazy dataset is sanity checked by whoever needs it to be, since checking reads
+  // every stream.
+  if (!lazy) {
+    SanityCheck(Join(toplevel_path, "dataset_report.csv"));
+  }
+}
+
+
+// NOTE(milo): EuRoC IMU lines follow this format:
+// timestamp [ns],w_RS_S_x [rad s^-1],w_RS_S_y [rad s^-1],w_RS_S_z [rad s^-1],
+// a_RS_S_x [m s^-2],a_RS_S_y [m s^-2],a_RS_S_z [m s^-2]
+static bool ParseImuLine(CsvLine& line, std::vector<ImuMeasurement>& out)
+{
+  timestamp_t timestamp = 0;
+  Vector3d w, a;
+  if (!(line.Next(timestamp) && line.Next(w.x()) && line.Next(w.y()) && line.Next(w.z()) &&
+        line.Next(a.x()) && line.Next(a.y()) && line.Next(a.z()))) {
+    return false;
+  }
+  out.emplace_back(timestamp, w, a);
+  return true;
+}
+
+
+EurocDataset::ImuChunkLoader EurocDataset::ImuChunks(const std::string& imu_csv_path, size_t lines_per_chunk)
+{
+  // NOTE(milo): Shared, so that copies of the loader read from the same mapping of the file.
+  const std::shared_ptr<const CsvReader> csv = std::make_shared<const CsvReader>(imu_csv_path);
+  const std::shared_ptr<const std::vector<size_t>> offsets =
+      std::make_shared<const std::vector<size_t>>(csv->ChunkOffsets(lines_per_chunk));
+
+  LOG(INFO) << "Streaming IMU measurements from " << imu_csv_path << " in "
+            << (offsets->size() - 1) << " chunks" << std::endl;
+
+  return [csv, offsets](size_t chunk, std::vector<ImuMeasurement>& out)
+  {
+    if ((chunk + 1) >= offsets->size()) {
+      return false;
+    }
+    csv->ParseChunk(out, ParseImuLine, offsets->at(chunk), offsets->at(chunk + 1));
+    return true;
+  };
 }
 
 
 // NOTE(milo): Adapted from KIMERA-VIO
-void EurocDataset::ParseImu(const std::string& data_csv_path)
+void EurocDataset::ParseImu(const std::string& data_csv_path, std::vector<ImuMeasurement>& imu_data)
 {
-  // NOTE(milo): EuRoC IMU lines follow this format:
-  // timestamp [ns],w_RS_S_x [rad s^-1],w_RS_S_y [rad s^-1],w_RS_S_z [rad s^-1],
-  // a_RS_S_x [m s^-2],a_RS_S_y [m s^-2],a_RS_S_z [m s^-2]
-  std::ifstream fin(data_csv_path.c_str());
-  CHECK(fin.is_open()) << "Could not open file: " << data_csv_path << std::endl;
+  const CsvReader csv(data_csv_path);
 
   // Skip the first line, containing the header.
-  std::string line;
-  std::getline(fin, line);
+  csv.ParseLines(imu_data, ParseImuLine);
 
-  size_t count = 0;
   double max_norm_acc = 0;
   double max_norm_rot_rate = 0;
-  timestamp_t prev_timestamp = 0;
 
-  // Read/store imu measurements, line by line.
-  while (std::getline(fin, line)) {
-    timestamp_t timestamp = 0;
-    Vector6d gyr_acc_data;
-    for (size_t i = 0; i < (gyr_acc_data.size() + 1ul); ++i) {
-      size_t idx = line.find_first_of(',');
-      if (i == 0) {
-        timestamp = std::stoll(line.substr(0, idx));
-      } else {
-        gyr_acc_data(i - 1) = std::stod(line.substr(0, idx));
-      }
-      line = line.substr(idx + 1);
-    }
-    if (prev_timestamp != 0) {
-      CHECK_GT(timestamp, prev_timestamp) << "Euroc IMU data is not in chronological order!";
+  for (size_t i = 0; i < imu_data.size(); ++i) {
+    if (i > 0) {
+      CHECK_GT(imu_data.at(i).timestamp, imu_data.at(i - 1).timestamp)
+          << "Euroc IMU data is not in chronological order!";
     }
-
-    const double norm_acc = gyr_acc_data.tail(3).norm();
-    max_norm_acc = std::max(max_norm_acc, norm_acc);
-
-    const double norm_rot_rate = gyr_acc_data.head(3).norm();
-    max_norm_rot_rate = std::max(max_norm_rot_rate, norm_rot_rate);
-
-    imu_data.emplace_back(ImuMeasurement(timestamp, gyr_acc_data.head(3), gyr_acc_data.tail(3)));
-
-    prev_timestamp = timestamp;
-    ++count;
+    max_norm_acc = std::max(max_norm_acc, imu_data.at(i).a.norm());
+    max_norm_rot_rate = std::max(max_norm_rot_rate, imu_data.at(i).w.norm());
   }
 
-  fin.close();
-
+  CHECK(!imu_data.empty()) << "No IMU measurements in " << data_csv_path << std::endl;
   const timestamp_t total_time = imu_data.back().timestamp - imu_data.front().timestamp;
 
   LOG(INFO) << "IMU average (hz): "
-           << (1e9 * static_cast<double>(count) / static_cast<double>(total_time)) << '\n'
+           << (1e9 * static_cast<double>(imu_data.size()) / static_cast<double>(total_time)) << '\n'
            << "Maximum measured rotation rate (rad/s): " << max_norm_rot_rate << '\n'
            << "Maximum measured acceleration (m/s^2): " << max_norm_acc;
 }
 
 
-void EurocDataset::ParseStereo(const std::string& cam0_path, const std::string& cam1_path)
+void EurocDataset::ParseStereo(const std::string& cam0_path,
+                               const std::string& cam1_path,
+                               std::vector<StereoDatasetItem>& stereo_data)
 {
   std::vector<timestamp_t> left_stamps, right_stamps;
   std::vector<std::string> lf, rf;
@@ -142,99 +169,108 @@ void EurocDataset::ParseImageFolder(const std::string& cam_folder,
 {
   CHECK(!cam_folder.empty());
 
-  const std::string data_csv_path = Join(cam_folder, "data.csv");
-  std::ifstream fin(data_csv_path.c_str());
-  CHECK(fin.is_open()) << "Cannot open file: " << data_csv_path;
+  const CsvReader csv(Join(cam_folder, "data.csv"));
 
   // Skip the first line, containing the header.
-  std::string item;
-  std::getline(fin, item);
-
-  // Read/store list of image names.
-  while (std::getline(fin, item)) {
-    // TODO(milo): We use the timestamp to get the image file here, not the image file...
-    size_t idx = item.find_first_of(',');
-    const timestamp_t timestamp = std::stoll(item.substr(0, idx));
-    const std::string image_filename = Join(cam_folder, "data/" + item.substr(0, idx) + ".png");
-
-    // NOTE(KIMERA): Strangely, on mac, it does not work if we use: item.substr(idx + 1).
-    output_timestamps.emplace_back(timestamp);
-    output_filenames.emplace_back(image_filename);
-  }
+  typedef std::pair<timestamp_t, std::string> StampAndFilename;
+  std::vector<StampAndFilename> items;
+  csv.ParseLines(items, [&](CsvLine& line, std::vector<StampAndFilename>& out)
+  {
+    const char* stamp_text = nullptr;
+    size_t stamp_length = 0;
+    if (!line.Next(stamp_text, stamp_length) || stamp_length == 0) {
+      return false;
+    }
+    const std::string stamp(stamp_text, stamp_length);
+
+    // Use the filename column if there is one (images might not be PNGs), or else <stamp>.png.
+    const char* name_text = nullptr;
+    size_t name_length = 0;
+    std::string name = stamp + ".png";
+    if (line.Next(name_text, name_length)) {
+      while (name_length > 0 && std::isspace(static_cast<unsigned char>(name_text[0]))) {
+        ++name_text;
+        --name_length;
+      }
+      while (name_length > 0 && std::isspace(static_cast<unsigned char>(name_text[name_length - 1]))) {
+        --name_length;
+      }
+      if (name_length > 0) {
+        name.assign(name_text, name_length);
+      }
+    }
+
+    out.emplace_back(std::stoull(stamp), Join(cam_folder, "data/" + name));
+    return true;
+  });
 
-  fin.close();
+  output_timestamps.reserve(output_timestamps.size() + items.size());
+  output_filenames.reserve(output_filenames.size() + items.size());
+  for (StampAndFilename& item : items) {
+    output_timestamps.emplace_back(item.first);
+    output_filenames.emplace_back(std::move(item.second));
+  }
 }
 
 
-void EurocDataset::ParseGroundtruth(const std::string& gt_path)
+void EurocDataset::ParseGroundtruth(const std::string& gt_path, std::vector<GroundtruthItem>& pose_data)
 {
-  // Read in groundtruth poses.
+  // Read in groundtruth poses (ns,qw,qx,qy,qz,tx,ty,tz), which don't have a header line.
   CHECK(Exists(gt_path)) << "Groundtruth pose file does not exist: " << gt_path << std::endl;
 
-  std::ifstream stream(gt_path.c_str());
-  std::string line;
+  const CsvReader csv(gt_path);
 
-  while (std::getline(stream, line)) {
-    std::stringstream iss(line);
-
-    std::string ns, qw, qx, qy, qz, tx, ty, tz;
-    std::getline(iss, ns, ',');
-    std::getline(iss, qw, ',');
-    std::getline(iss, qx, ',');
-    std::getline(iss, qy, ',');
-    std::getline(iss, qz, ',');
-    std::getline(iss, tx, ',');
-    std::getline(iss, ty, ',');
-    std::getline(iss, tz, ',');
-
-    const Quaterniond q(std::stod(qw), std::stod(qx), std::stod(qy), std::stod(qz));
-    const Vector3d t(std::stod(tx), std::stod(ty), std::stod(tz));
+  csv.ParseLines(pose_data, [](CsvLine& line, std::vector<GroundtruthItem>& out)
+  {
+    timestamp_t timestamp = 0;
+    double qw, qx, qy, qz;
+    Vector3d t;
+    if (!(line.Next(timestamp) && line.Next(qw) && line.Next(qx) && line.Next(qy) && line.Next(qz) &&
+          line.Next(t.x()) && line.Next(t.y()) && line.Next(t.z()))) {
+      return false;
+    }
 
     Matrix4d world_T_body = Matrix4d::Identity();
-    world_T_body.block<3, 3>(0, 0) = q.normalized().toRotationMatrix();
+    world_T_body.block<3, 3>(0, 0) = Quaterniond(qw, qx, qy, qz).normalized().toRotationMatrix();
     world_T_body.block<3, 1>(0, 3) = t;
 
-    const timestamp_t timestamp = std::stoull(ns);
-    pose_data.emplace_back(GroundtruthItem(timestamp, world_T_body));
-  }
+    out.emplace_back(timestamp, world_T_body);
+    return true;
+  }, 0);
 
-  stream.close();
   LOG(INFO) << "Read in " << pose_data.size() << " groundtruth poses" << std::endl;
 }
 
 
-void EurocDataset::ParseDepth(const std::string& depth_csv_path)
+void EurocDataset::ParseDepth(const std::string& depth_csv_path, std::vector<DepthMeasurement>& depth_data)
 {
-  std::ifstream fin(depth_csv_path.c_str());
-  CHECK(fin.is_open()) << "Could not open file: " << depth_csv_path << std::endl;
+  const CsvReader csv(depth_csv_path);
 
   // Skip the first line, containing the header.
-  std::string line;
-  std::getline(fin, line);
+  csv.ParseLines(depth_data, [](CsvLine& line, std::vector<DepthMeasurement>& out)
+  {
+    timestamp_t timestamp = 0;
+    double depth = 0;
+    if (!(line.Next(timestamp) && line.Next(depth))) {
+      return false;
+    }
+    out.emplace_back(timestamp, depth);
+    return true;
+  });
 
   double min_depth = std::numeric_limits<double>::max();
   double max_depth = std::numeric_limits<double>::min();
-  timestamp_t prev_timestamp = 0;
-
-  // Read/store imu measurements, line by line.
-  while (std::getline(fin, line)) {
-    int comma_idx = line.find_first_of(',');
-    const timestamp_t timestamp = std::stoll(line.substr(0, comma_idx));
-
-    line = line.substr(comma_idx + 1);
-    comma_idx = line.find_first_of(',');
-    const double depth = std::stod(line.substr(0, comma_idx));
 
-    CHECK_GT(timestamp, prev_timestamp) << "EuRoC depth data is not in chronological order!";
-
-    min_depth = std::min(min_depth, depth);
-    max_depth = std::max(max_depth, depth);
-
-    depth_data.emplace_back(DepthMeasurement(timestamp, depth));
-    prev_timestamp = timestamp;
+  for (size_t i = 0; i < depth_data.size(); ++i) {
+    if (i > 0) {
+      CHECK_GT(depth_data.at(i).timestamp, depth_data.at(i - 1).timestamp)
+          << "EuRoC depth data is not in chronological order!";
+    }
+    min_depth = std::min(min_depth, depth_data.at(i).depth);
+    max_depth = std::max(max_depth, depth_data.at(i).depth);
   }
 
-  fin.close();
+  CHECK(!depth_data.empty()) << "No depth measurements in " << depth_csv_path << std::endl;
 
   LOG(INFO) << "Read in " << depth_data.size() << " DEPTH measurements.\n"
             << "  earliest=" << depth_data.front().timestamp
@@ -247,47 +283,32 @@ static std::vector<RangeMeasurement> ParseRangeHelper(const std::string& range_c
 {
   std::vector<RangeMeasurement> range_data;
 
-  std::ifstream fin(range_csv_path.c_str());
-  CHECK(fin.is_open()) << "Could not open file: " << range_csv_path << std::endl;
+  const CsvReader csv(range_csv_path);
 
   // Skip the first line, containing the header.
-  std::string line;
-  std::getline(fin, line);
-
-  double min_range = std::numeric_limits<double>::max();
-  double max_range = std::numeric_limits<double>::min();
-  timestamp_t prev_timestamp = 0;
-
-  // Read/store imu measurements, line by line.
-  while (std::getline(fin, line)) {
-    std::stringstream iss(line);
-
-    std::string ns, r, tx, ty, tz;
-    std::getline(iss, ns, ',');
-    std::getline(iss, r, ',');
-    std::getline(iss, tx, ',');
-    std::getline(iss, ty, ',');
-    std::getline(iss, tz, ',');
-
-    const timestamp_t timestamp = std::stoll(ns);
-    const double range = std::stod(r);
-    const Vector3d t(std::stod(tx), std::stod(ty), std::stod(tz));
-
-    CHECK_GT(timestamp, prev_timestamp) << "EuRoC range data is not in chronological order!";
-
-    min_range = std::min(min_range, range);
-    max_range = std::max(max_range, range);
+  csv.ParseLines(range_data, [](CsvLine& line, std::vector<RangeMeasurement>& out)
+  {
+    timestamp_t timestamp = 0;
+    double range = 0;
+    Vector3d t;
+    if (!(line.Next(timestamp) && line.Next(range) && line.Next(t.x()) && line.Next(t.y()) && line.Next(t.z()))) {
+      return false;
+    }
+    out.emplace_back(timestamp, range, t);
+    return true;
+  });
 
-    range_data.emplace_back(RangeMeasurement(timestamp, range, t));
-    prev_timestamp = timestamp;
+  for (size_t i = 1; i < range_data.size(); ++i) {
+    CHECK_GT(range_data.at(i).timestamp, range_data.at(i - 1).timestamp)
+        << "EuRoC range data is not in chronological order!";
   }
 
-  fin.close();
   return range_data;
 }
 
 
-void EurocDataset::ParseRange(const std::vector<std::string>& range_csv_paths)
+void EurocDataset::ParseRange(const std::vector<std::string>& range_csv_paths,
+                              std::vector<RangeMeasurement>& range_data)
 {
   // Get range measurements from all sources.
   for (const std::string& csv_path : range_csv_paths) {
@@ -297,8 +318,8 @@ void EurocDataset::ParseRange(const std::vector<std::string>& range_csv_paths)
   }
 
   // Now sort by timestamp so that they're in order.
-  std::sort(range_data.begin(), range_data.end(),
-      [](const RangeMeasurement& a, const RangeMeasurement& b) { return (a.timestamp <= b.timestamp); });
+  std::stable_sort(range_data.begin(), range_data.end(),
+      [](const RangeMeasurement& a, const RangeMeasurement& b) { return a.timestamp < b.timestamp; });
 
   LOG(INFO) << "Read in " << range_data.size() << " RANGE measurements.\n"
             << "  earliest=" << range_data.front().timestamp
@@ -11,25 +11,36 @@ class EurocDataset : public DataProvider {
   // EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   // Construct with a toplevel_path, which should contain the "mav0" folder inside of it.
-  EurocDataset(const std::string& toplevel_path);
+  //
+  // By default, every stream is read (and sanity checked) up front. If lazy, each stream is only
+  // read when it's needed (see DataProvider::LoadAll()), so that e.g a tool that only wants the
+  // groundtruth doesn't parse the IMU. If imu_chunk_lines > 0, the IMU is streamed from disk in
+  // chunks of that many lines instead of being kept in memory.
+  EurocDataset(const std::string& toplevel_path, bool lazy = false, size_t imu_chunk_lines = 0);
 
  private:
-  void ParseStereo(const std::string& cam0_path, const std::string& cam1_path);
+  static void ParseStereo(const std::string& cam0_path,
+                          const std::string& cam1_path,
+                          std::vector<StereoDatasetItem>& stereo_data);
 
-  void ParseImageFolder(const std::string& cam_folder,
-                        std::vector<timestamp_t>& output_timestamps,
-                        std::vector<std::string>& output_filenames);
+  static void ParseImageFolder(const std::string& cam_folder,
+                               std::vector<timestamp_t>& output_timestamps,
+                               std::vector<std::string>& output_filenames);
 
-  void ParseImu(const std::string& imu_csv_path);
+  static void ParseImu(const std::string& imu_csv_path, std::vector<ImuMeasurement>& imu_data);
 
-  void ParseGroundtruth(const std::string& gt_path);
+  static void ParseGroundtruth(const std::string& gt_path, std::vector<GroundtruthItem>& pose_data);
 
-  void ParseDepth(const std::string& depth_csv_path);
+  static void ParseDepth(const std::string& depth_csv_path, std::vector<DepthMeasurement>& depth_data);
 
   // Load in range measurements from a list of paths. This supports range measurements from
   // multiple receivers or beacons (e.g aps0 and aps1), which will all get put into the same
   // vector and sorted by timestamp.
-  void ParseRange(const std::vector<std::string>& range_csv_paths);
+  static void ParseRange(const std::vector<std::string>& range_csv_paths,
+                         std::vector<RangeMeasurement>& range_data);
+
+  // Reads the IMU one chunk at a time (see DataProvider::imu_chunk_loader).
+  static ImuChunkLoader ImuChunks(const std::string& imu_csv_path, size_t lines_per_chunk);
 };
 
 
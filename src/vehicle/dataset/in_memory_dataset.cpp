@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <stdexcept>
+#include <glog/logging.h>
+
+#include "core/thread_pool.hpp"
+#include "dataset/in_memory_dataset.hpp"
+#include "dataset/stereo_prefetcher.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+static size_t FrameBytes(const ImageFrame& frame)
+{
+  return frame.Decoded().total() * frame.Decoded().elemSize() +
+         (frame.IsColor() ? frame.Gray().total() * frame.Gray().elemSize() : 0);
+}
+
+
+// NOTE(milo): Slice() reads every stream, flattens a streamed IMU, and doesn't copy callbacks, so
+// it's the cheapest way to get a complete, standalone copy of the source.
+InMemoryDataset::InMemoryDataset(const DataProvider& source, bool decode_color, int num_threads)
+    : DataProvider(source.Slice(source.FirstTimestamp(), source.LastTimestamp() + 1))
+{
+  CHECK_GT(num_threads, 0) << "Need at least one thread to decode with" << std::endl;
+
+  // Nothing to read ahead of playback anymore.
+  SetStereoPrefetch(0, 1);
+
+  typedef std::vector<DecodedStereo> DecodedPairs;
+  DecodedPairs decoded(stereo_data.size());
+
+  // NOTE(milo): ThreadPool(n) has n workers, plus the calling thread.
+  ThreadPool pool(num_threads - 1);
+  pool.ParallelFor(decoded.size(), [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i) {
+      DecodedStereo& pair = decoded.at(i);
+      DecodeStereo(i, decode_color, pair);
+
+      // Compute the gray views up front, so that the first consumer of each pair doesn't pay for
+      // the conversion (and look slower than the others).
+      if (pair.error.empty() && pair.has_color) {
+        pair.left->Gray();
+        pair.right->Gray();
+      }
+    }
+  });
+
+  for (size_t i = 0; i < decoded.size(); ++i) {
+    if (!decoded.at(i).error.empty()) {
+      throw std::runtime_error(decoded.at(i).error);
+    }
+    num_bytes_ += FrameBytes(*decoded.at(i).left) + FrameBytes(*decoded.at(i).right);
+  }
+
+  LOG(INFO) << "Decoded " << decoded.size() << " stereo pairs into memory ("
+            << static_cast<double>(num_bytes_) / (1024.0 * 1024.0) << " MB)" << std::endl;
+
+  // Every copy of the decoder (and so every copy or slice of this dataset) shares the same pairs.
+  const std::shared_ptr<const DecodedPairs> pairs = std::make_shared<const DecodedPairs>(std::move(decoded));
+  stereo_decoder = [pairs](size_t idx, bool decode_color, DecodedStereo& out)
+  {
+    const DecodedStereo& pair = pairs->at(idx);
+    out.has_color = decode_color && pair.has_color;
+    out.left = pair.left;
+    out.right = pair.right;
+    out.error.clear();
+  };
+}
+
+
+}
+}
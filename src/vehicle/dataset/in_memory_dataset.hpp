@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// A copy of another dataset with every stereo pair already decoded, so that several consumers can
+// play it back at once (e.g one StateEstimator per config in a parameter sweep) without each one
+// reading and converting every image again. The decoded frames are shared and read-only: copies
+// and Slice()s of this dataset hand out the same ImageFrames, which only cost a reference count.
+//
+// NOTE(milo): Everything is held in memory, which is about 2 * width * height bytes per stereo
+// pair in gray (3x that in color). Use a window (see DataProvider::Slice()) for long datasets.
+class InMemoryDataset : public DataProvider {
+ public:
+  // Reads every stream of "source" and decodes all of its stereo pairs on num_threads threads.
+  // Callbacks aren't copied. If decode_color isn't set, only the gray images are kept. Throws a
+  // std::runtime_error if a pair can't be decoded.
+  InMemoryDataset(const DataProvider& source, bool decode_color = false, int num_threads = 4);
+
+  // Size of the decoded images.
+  size_t NumBytes() const { return num_bytes_; }
+
+ private:
+  size_t num_bytes_ = 0;
+};
+
+
+}
+}
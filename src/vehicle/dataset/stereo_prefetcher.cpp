@@ -0,0 +1,149 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <opencv2/highgui.hpp>
+
+#include "dataset/stereo_prefetcher.hpp"
+
+#include "core/file_utils.hpp"
+#include "vision_core/image_util.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+void DecodeStereoItem(const StereoDatasetItem& item,
+                      bool decode_color,
+                      DecodedStereo& out,
+                      ImagePool* pool)
+{
+  out = DecodedStereo();
+
+  if (!Exists(item.path_left)) {
+    out.error = "ERROR: Left image filepath is invalid:\n  " + item.path_left;
+    return;
+  }
+  if (!Exists(item.path_right)) {
+    out.error = "ERROR: Right image filepath is invalid:\n  " + item.path_right;
+    return;
+  }
+
+  const cv::Mat iml = cv::imread(item.path_left, cv::IMREAD_ANYCOLOR);
+  const cv::Mat imr = cv::imread(item.path_right, cv::IMREAD_ANYCOLOR);
+
+  if (decode_color) {
+    out.has_color = iml.channels() > 1 && imr.channels() > 1;
+    out.left = std::make_shared<ImageFrame>(iml);
+    out.right = std::make_shared<ImageFrame>(imr);
+  } else if (pool) {
+    out.left = std::make_shared<ImageFrame>(MaybeConvertToGray(iml, *pool));
+    out.right = std::make_shared<ImageFrame>(MaybeConvertToGray(imr, *pool));
+  } else {
+    out.left = std::make_shared<ImageFrame>(MaybeConvertToGray(iml));
+    out.right = std::make_shared<ImageFrame>(MaybeConvertToGray(imr));
+  }
+}
+
+
+StereoPrefetcher::StereoPrefetcher(size_t num_items,
+                                   const StereoDecoder& decoder,
+                                   size_t lookahead,
+                                   int num_threads,
+                                   bool decode_color,
+                                   bool decode_gray)
+    : num_items_(num_items),
+      decoder_(decoder),
+      lookahead_(lookahead),
+      decode_color_(decode_color),
+      decode_gray_(decode_gray)
+{
+  CHECK_GT(lookahead_, 0ul) << "StereoPrefetcher needs lookahead > 0" << std::endl;
+  CHECK_GT(num_threads, 0) << "StereoPrefetcher needs num_threads > 0" << std::endl;
+
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&StereoPrefetcher::Worker, this);
+  }
+}
+
+
+StereoPrefetcher::~StereoPrefetcher()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_shutdown_ = true;
+  }
+  work_cv_.notify_all();
+
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+
+void StereoPrefetcher::Get(size_t idx, DecodedStereo& out)
+{
+  CHECK_LT(idx, num_items_);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  if (idx < window_begin_ || idx >= (window_begin_ + lookahead_)) {
+    // Seek: anything that was prefetched (or is being decoded right now) is for the wrong pairs.
+    ++generation_;
+    ready_.clear();
+    next_decode_ = idx;
+  } else {
+    ready_.erase(ready_.begin(), ready_.lower_bound(idx));
+    next_decode_ = std::max(next_decode_, idx);
+  }
+  window_begin_ = idx;
+  work_cv_.notify_all();
+
+  ready_cv_.wait(lock, [&]{ return ready_.count(idx) > 0; });
+
+  auto it = ready_.find(idx);
+  out = std::move(it->second);
+  ready_.erase(it);
+
+  // Free up a slot for the workers.
+  window_begin_ = idx + 1;
+  work_cv_.notify_all();
+}
+
+
+void StereoPrefetcher::Worker()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    work_cv_.wait(lock, [&]{
+      return is_shutdown_ ||
+             (next_decode_ < num_items_ && next_decode_ < (window_begin_ + lookahead_));
+    });
+
+    if (is_shutdown_) {
+      return;
+    }
+
+    const size_t idx = next_decode_++;
+    const uint64_t generation = generation_;
+
+    // NOTE(milo): Don't hold the lock while decoding, which is the slow part.
+    lock.unlock();
+    DecodedStereo decoded;
+    decoder_(idx, decode_color_, decoded);
+    if (decode_gray_ && decoded.error.empty()) {
+      decoded.left->Gray();
+      decoded.right->Gray();
+    }
+    lock.lock();
+
+    if (generation == generation_ && idx >= window_begin_) {
+      ready_.emplace(idx, std::move(decoded));
+      ready_cv_.notify_all();
+    }
+  }
+}
+
+
+}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/image_frame.hpp"
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// A stereo pair after it has been read from disk. If decode_color wasn't set, the frames are
+// already gray (and the color buffers have been freed).
+struct DecodedStereo final {
+  bool has_color = false;   // Only if both images are color, and decode_color was set.
+  ImageFrame::Ptr left;
+  ImageFrame::Ptr right;
+
+  // Set instead of throwing (e.g if a file is missing), so that errors can cross threads.
+  std::string error;
+};
+
+
+// Reads and converts one stereo pair. If a pool is given, gray images are converted into buffers from
+// it (imread() always allocates the images that it reads, since it only knows their size after).
+void DecodeStereoItem(const StereoDatasetItem& item,
+                      bool decode_color,
+                      DecodedStereo& out,
+                      ImagePool* pool = nullptr);
+
+
+// Decodes the next few stereo pairs of a dataset on a pool of worker threads, so that playback
+// doesn't have to wait on imread() and cvtColor(). At most lookahead pairs past the last one that
+// was taken are kept in memory. Reading out of order (e.g after DataProvider::Reset()) throws away
+// whatever was prefetched and starts over at the requested pair.
+class StereoPrefetcher final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(StereoPrefetcher);
+  MACRO_DELETE_COPY_CONSTRUCTORS(StereoPrefetcher);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(StereoPrefetcher);
+
+  StereoPrefetcher(size_t num_items,
+                   const StereoDecoder& decoder,
+                   size_t lookahead,
+                   int num_threads,
+                   bool decode_color,
+                   bool decode_gray = true);
+
+  ~StereoPrefetcher();
+
+  // Blocks until pair idx is decoded, and moves it into out.
+  void Get(size_t idx, DecodedStereo& out);
+
+ private:
+  void Worker();
+
+  const size_t num_items_;
+  const StereoDecoder decoder_;
+  const size_t lookahead_;
+  const bool decode_color_;
+  const bool decode_gray_;     // Compute the gray views on the workers too.
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable ready_cv_;
+
+  size_t window_begin_ = 0;   // The next pair that Get() should be called for.
+  size_t next_decode_ = 0;    // The next pair that a worker will pick up.
+  uint64_t generation_ = 0;   // Incremented on every seek, so that stale results are dropped.
+  std::map<size_t, DecodedStereo> ready_;
+  bool is_shutdown_ = false;
+
+  std::vector<std::thread> workers_;
+};
+
+
+}
+}
@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <glog/logging.h>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/random.hpp"
+#include "vision_core/image_util.hpp"
+#include "dataset/stereo_prefetcher.hpp"
+#include "dataset/synthetic_dataset.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+static const Vector3d kGravity = Vector3d(0.0, 9.81, 0.0);
+
+// Each kind of random draw gets its own stream, so that changing one rate doesn't change the noise
+// on every other stream. Stereo pairs use kImageStream + 2*idx (+1 for the right image), so that a
+// pair's noise doesn't depend on which thread decodes it, or in what order.
+static const uint64_t kTextureStream = 0;
+static const uint64_t kImuStream = 1;
+static const uint64_t kDepthStream = 2;
+static const uint64_t kRangeStream = 3;
+static const uint64_t kImageStream = 1ull << 32;
+
+
+void SyntheticDataset::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("seed", &seed);
+  parser.GetParam("start_sec", &start_sec);
+  parser.GetParam("duration_sec", &duration_sec);
+
+  parser.GetParam("stereo_hz", &stereo_hz);
+  parser.GetParam("imu_hz", &imu_hz);
+  parser.GetParam("depth_hz", &depth_hz);
+  parser.GetParam("range_hz", &range_hz);
+  parser.GetParam("groundtruth_hz", &groundtruth_hz);
+
+  parser.GetParam("image_width", &image_width);
+  parser.GetParam("image_height", &image_height);
+  parser.GetParam("fx", &fx);
+  parser.GetParam("baseline", &baseline);
+  YamlToVector<Vector3d>(parser.GetNode("body_t_cam_left"), body_t_cam_left);
+  int color_int = 0;
+  parser.GetParam("color", &color_int);
+  color = color_int > 0;
+  parser.GetParam("image_noise_sigma", &image_noise_sigma);
+
+  texture_path = YamlToString(parser.GetNode("texture_path"));
+  parser.GetParam("texture_pixels_per_meter", &texture_pixels_per_meter);
+
+  parser.GetParam("wall_z", &wall_z);
+  parser.GetParam("floor_y", &floor_y);
+
+  YamlToVector<Vector3d>(parser.GetNode("center"), center);
+  YamlToVector<Vector3d>(parser.GetNode("amplitude"), amplitude);
+  YamlToVector<Vector3d>(parser.GetNode("period_sec"), period_sec);
+  YamlToVector<Vector3d>(parser.GetNode("ypr_amplitude"), ypr_amplitude);
+  YamlToVector<Vector3d>(parser.GetNode("ypr_period_sec"), ypr_period_sec);
+
+  parser.GetParam("accel_noise_sigma", &accel_noise_sigma);
+  parser.GetParam("gyro_noise_sigma", &gyro_noise_sigma);
+  YamlToVector<Vector3d>(parser.GetNode("accel_bias"), accel_bias);
+  YamlToVector<Vector3d>(parser.GetNode("gyro_bias"), gyro_bias);
+
+  parser.GetParam("depth_noise_sigma", &depth_noise_sigma);
+
+  parser.GetParam("num_beacons", &num_beacons);
+  parser.GetParam("beacon_circle_radius", &beacon_circle_radius);
+  parser.GetParam("range_noise_sigma", &range_noise_sigma);
+
+  CHECK_GT(duration_sec, 0);
+  CHECK(image_width > 0 && image_height > 0);
+  CHECK_GT(fx, 0);
+  CHECK_GT(texture_pixels_per_meter, 0);
+  CHECK_GE(num_beacons, 0);
+}
+
+
+// amplitude * sin(2 pi t / period), and its first and second derivatives. A period of zero (or
+// less) holds the axis still.
+static void Sinusoid(double amplitude, double period, double t, double& x, double& dx, double& ddx)
+{
+  if (period <= 0) {
+    x = dx = ddx = 0;
+    return;
+  }
+  const double w = 2.0 * M_PI / period;
+  x = amplitude * std::sin(w * t);
+  dx = amplitude * w * std::cos(w * t);
+  ddx = -amplitude * w * w * std::sin(w * t);
+}
+
+
+static Matrix3d WorldRBody(const SyntheticDataset::Params& params, double t)
+{
+  double ypr[3], unused_d, unused_dd;
+  for (int i = 0; i < 3; ++i) {
+    Sinusoid(params.ypr_amplitude(i), params.ypr_period_sec(i), t, ypr[i], unused_d, unused_dd);
+  }
+
+  // Yaw is about the down axis (y), pitch about the right axis (x) and roll about forward (z).
+  return (Eigen::AngleAxisd(ypr[0], Vector3d::UnitY()) *
+          Eigen::AngleAxisd(ypr[1], Vector3d::UnitX()) *
+          Eigen::AngleAxisd(ypr[2], Vector3d::UnitZ())).toRotationMatrix();
+}
+
+
+Matrix4d SyntheticDataset::WorldTBody(const Params& params, double t)
+{
+  Matrix4d world_T_body = Matrix4d::Identity();
+  world_T_body.block<3, 3>(0, 0) = WorldRBody(params, t);
+
+  for (int i = 0; i < 3; ++i) {
+    double x, dx, ddx;
+    Sinusoid(params.amplitude(i), params.period_sec(i), t, x, dx, ddx);
+    world_T_body(i, 3) = params.center(i) + x;
+  }
+
+  return world_T_body;
+}
+
+
+ImuMeasurement SyntheticDataset::ExactImu(const Params& params, double t)
+{
+  Vector3d world_a;
+  for (int i = 0; i < 3; ++i) {
+    double x, dx, ddx;
+    Sinusoid(params.amplitude(i), params.period_sec(i), t, x, dx, ddx);
+    world_a(i) = ddx;
+  }
+
+  // NOTE(milo): The body rate is a central difference of the orientation, which is accurate to
+  // O(h^2) (far below any IMU noise). Composing the three rotations analytically isn't worth it.
+  const double h = 1e-4;
+  const Matrix3d world_R_body = WorldRBody(params, t);
+  const Eigen::AngleAxisd delta(WorldRBody(params, t - h).transpose() * WorldRBody(params, t + h));
+  const Vector3d w = delta.axis() * delta.angle() / (2.0 * h);
+
+  // The accelerometer measures specific force (i.e -gravity at rest), in the body frame.
+  const Vector3d a = world_R_body.transpose() * (world_a - kGravity);
+
+  return ImuMeasurement(ConvertToNanoseconds(params.start_sec + t), w, a);
+}
+
+
+Vector3d SyntheticDataset::BeaconPosition(const Params& params, int i)
+{
+  const double theta = 2.0 * M_PI * i / std::max(1, params.num_beacons);
+  return Vector3d(params.center.x() + params.beacon_circle_radius * std::cos(theta),
+                  params.floor_y,
+                  params.center.z() + params.beacon_circle_radius * std::sin(theta));
+}
+
+
+// Times (since start_sec) of a stream at rate hz, over the whole duration.
+static std::vector<double> SampleTimes(double hz, double duration_sec)
+{
+  std::vector<double> times;
+  if (hz <= 0) {
+    return times;
+  }
+  for (size_t k = 0; k / hz <= duration_sec; ++k) {
+    times.emplace_back(k / hz);
+  }
+  return times;
+}
+
+
+// A few octaves of smoothed noise, stretched to [0, 255]. Blobs at every scale give the frontend
+// corners to detect and the stereo matcher texture to match, at any image resolution.
+static cv::Mat MakeRandomTexture(int seed, int size, bool color)
+{
+  RandomStream rng(seed, kTextureStream);
+
+  std::vector<cv::Mat> channels;
+  for (int c = 0; c < (color ? 3 : 1); ++c) {
+    cv::Mat sum = cv::Mat::zeros(size, size, CV_32FC1);
+    for (int cell = 64; cell >= 2; cell /= 4) {
+      cv::Mat coarse(size / cell, size / cell, CV_32FC1);
+      rng.FillUniform(coarse.ptr<float>(), coarse.total(), 0.0f, 1.0f);
+      cv::Mat upsampled;
+      cv::resize(coarse, upsampled, sum.size(), 0, 0, cv::INTER_CUBIC);
+      sum += upsampled;
+    }
+    cv::Mat channel;
+    cv::normalize(sum, sum, 0, 255, cv::NORM_MINMAX);
+    sum.convertTo(channel, CV_8UC1);
+    channels.emplace_back(channel);
+  }
+
+  cv::Mat texture;
+  cv::merge(channels, texture);
+  return texture;
+}
+
+
+// Reflects x into [0, n - 1], so that the texture tiles without any seams (mirrored every tile).
+static float MirrorWrap(double x, int n)
+{
+  const double period = 2.0 * (n - 1);
+  double m = std::fmod(std::fabs(x), period);
+  if (m > n - 1) {
+    m = period - m;
+  }
+  return static_cast<float>(m);
+}
+
+
+// Everything that rendering needs, shared by every copy of the dataset (and its decoder).
+struct SyntheticScene final
+{
+  SyntheticDataset::Params params;
+  cv::Mat texture;
+  std::vector<double> stereo_times;
+
+  // Ray casts the wall and floor from a camera at world_T_cam. Rays that miss both (i.e looking up
+  // at the surface) are black.
+  cv::Mat Render(const Matrix4d& world_T_cam, uint64_t noise_stream) const
+  {
+    const int w = params.image_width;
+    const int h = params.image_height;
+    const double cx = 0.5 * (w - 1);
+    const double cy = 0.5 * (h - 1);
+    const Matrix3d R = world_T_cam.block<3, 3>(0, 0);
+    const Vector3d o = world_T_cam.block<3, 1>(0, 3);
+    const double ppm = params.texture_pixels_per_meter;
+
+    cv::Mat map_x(h, w, CV_32FC1), map_y(h, w, CV_32FC1);
+    for (int v = 0; v < h; ++v) {
+      float* mx = map_x.ptr<float>(v);
+      float* my = map_y.ptr<float>(v);
+      for (int u = 0; u < w; ++u) {
+        const Vector3d ray = R * Vector3d((u - cx) / params.fx, (v - cy) / params.fx, 1.0);
+        const double s_wall = (ray.z() > 1e-9) ? (params.wall_z - o.z()) / ray.z() : -1.0;
+        const double s_floor = (ray.y() > 1e-9) ? (params.floor_y - o.y()) / ray.y() : -1.0;
+
+        mx[u] = my[u] = -1.0f;
+        if (s_wall > 0 && (s_floor <= 0 || s_wall < s_floor)) {
+          const Vector3d p = o + s_wall * ray;
+          mx[u] = MirrorWrap(ppm * p.x(), texture.cols);
+          my[u] = MirrorWrap(ppm * p.y(), texture.rows);
+        } else if (s_floor > 0) {
+          // Offset by half a tile, so that the floor doesn't look like the wall.
+          const Vector3d p = o + s_floor * ray;
+          mx[u] = MirrorWrap(ppm * p.x() + 0.5 * texture.cols, texture.cols);
+          my[u] = MirrorWrap(ppm * p.z() + 0.5 * texture.rows, texture.rows);
+        }
+      }
+    }
+
+    cv::Mat image;
+    cv::remap(texture, image, map_x, map_y, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+
+    if (params.image_noise_sigma > 0) {
+      cv::Mat noise(image.size(), CV_32FC(image.channels()));
+      RandomStream rng(params.seed, noise_stream);
+      rng.FillNormal(noise.ptr<float>(), noise.total() * noise.channels(), 0.0f,
+                     static_cast<float>(params.image_noise_sigma));
+      cv::Mat noisy;
+      image.convertTo(noisy, noise.type());
+      noisy += noise;
+      noisy.convertTo(image, image.type());
+    }
+
+    return image;
+  }
+
+  void Decode(size_t idx, bool decode_color, DecodedStereo& out) const
+  {
+    out = DecodedStereo();
+
+    const Matrix4d world_T_body = SyntheticDataset::WorldTBody(params, stereo_times.at(idx));
+    Matrix4d body_T_left = Matrix4d::Identity();
+    body_T_left.block<3, 1>(0, 3) = params.body_t_cam_left;
+    Matrix4d left_T_right = Matrix4d::Identity();
+    left_T_right(0, 3) = params.baseline;
+
+    const cv::Mat left = Render(world_T_body * body_T_left, kImageStream + 2 * idx);
+    const cv::Mat right = Render(world_T_body * body_T_left * left_T_right, kImageStream + 2 * idx + 1);
+
+    if (decode_color) {
+      out.has_color = params.color;
+      out.left = std::make_shared<ImageFrame>(left);
+      out.right = std::make_shared<ImageFrame>(right);
+    } else {
+      out.left = std::make_shared<ImageFrame>(MaybeConvertToGray(left));
+      out.right = std::make_shared<ImageFrame>(MaybeConvertToGray(right));
+    }
+  }
+};
+
+
+SyntheticDataset::SyntheticDataset(const Params& params) : DataProvider()
+{
+  const std::shared_ptr<SyntheticScene> scene = std::make_shared<SyntheticScene>();
+  scene->params = params;
+
+  if (params.texture_path.empty()) {
+    scene->texture = MakeRandomTexture(params.seed, 1024, params.color);
+  } else {
+    scene->texture = cv::imread(params.texture_path, params.color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE);
+    if (scene->texture.empty()) {
+      throw std::runtime_error("Could not read texture " + params.texture_path);
+    }
+  }
+
+  scene->stereo_times = SampleTimes(params.stereo_hz, params.duration_sec);
+  for (const double t : scene->stereo_times) {
+    stereo_data.emplace_back(ConvertToNanoseconds(params.start_sec + t), "", "");
+  }
+
+  // NOTE(milo): The noise densities are continuous time (like the shared params), so the noise on
+  // each sample grows with the rate.
+  RandomStream imu_rng(params.seed, kImuStream);
+  const double imu_sqrt_hz = std::sqrt(std::max(0.0, params.imu_hz));
+  for (const double t : SampleTimes(params.imu_hz, params.duration_sec)) {
+    ImuMeasurement imu = ExactImu(params, t);
+    imu.w += params.gyro_bias;
+    imu.a += params.accel_bias;
+    for (int i = 0; i < 3; ++i) {
+      imu.w(i) += imu_rng.Normald(0, params.gyro_noise_sigma * imu_sqrt_hz);
+      imu.a(i) += imu_rng.Normald(0, params.accel_noise_sigma * imu_sqrt_hz);
+    }
+    imu_data.emplace_back(imu);
+  }
+
+  // Depth is along the gravity axis (world y).
+  RandomStream depth_rng(params.seed, kDepthStream);
+  for (const double t : SampleTimes(params.depth_hz, params.duration_sec)) {
+    const double depth = WorldTBody(params, t)(1, 3) + depth_rng.Normald(0, params.depth_noise_sigma);
+    depth_data.emplace_back(ConvertToNanoseconds(params.start_sec + t), depth);
+  }
+
+  RandomStream range_rng(params.seed, kRangeStream);
+  for (const double t : SampleTimes(params.range_hz, params.duration_sec)) {
+    const Vector3d world_t_body = WorldTBody(params, t).block<3, 1>(0, 3);
+    for (int i = 0; i < params.num_beacons; ++i) {
+      const Vector3d beacon = BeaconPosition(params, i);
+      const double range = (world_t_body - beacon).norm() + range_rng.Normald(0, params.range_noise_sigma);
+      range_data.emplace_back(ConvertToNanoseconds(params.start_sec + t), range, beacon);
+    }
+  }
+
+  for (const double t : SampleTimes(params.groundtruth_hz, params.duration_sec)) {
+    pose_data.emplace_back(ConvertToNanoseconds(params.start_sec + t), WorldTBody(params, t));
+  }
+
+  stereo_decoder = [scene](size_t idx, bool decode_color, DecodedStereo& out)
+  {
+    scene->Decode(idx, decode_color, out);
+  };
+
+  LOG(INFO) << "Generated synthetic dataset (" << params.duration_sec << " sec, "
+            << params.image_width << "x" << params.image_height << "):\n"
+            << "  stereo=" << stereo_data.size() << " imu=" << imu_data.size()
+            << " depth=" << depth_data.size() << " range=" << range_data.size()
+            << " groundtruth=" << pose_data.size() << std::endl;
+}
+
+
+}
+}
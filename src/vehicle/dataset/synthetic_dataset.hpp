@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+
+#include "core/eigen_types.hpp"
+#include "params/params_base.hpp"
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Generates a dataset instead of reading one, so that the pipeline can be load tested at rates,
+// resolutions and beacon counts that none of the recordings have (e.g 2x the IMU rate, 4K images).
+// Everything is a deterministic function of the params (and seed), so two runs see exactly the same
+// data, no matter how the stereo pairs are prefetched.
+//
+// The scene is a textured wall in front of the vehicle and a textured floor below it, in the same
+// frames as Farmsim (see config/shared/Farmsim.yaml): the world is RDF with gravity along +y, the
+// IMU and body frames are the same, and the cameras are RDF too, looking down the body +z axis. The
+// vehicle follows a Lissajous curve (each axis of position and yaw/pitch/roll is a sinusoid), and
+// the IMU is sampled from that curve exactly, so the groundtruth and the IMU always agree.
+//
+// Only the timestamps of the stereo pairs are generated up front. Each pair is ray cast when it's
+// decoded (e.g on the StereoPrefetcher threads), so long, high resolution datasets don't need any
+// memory for images.
+class SyntheticDataset : public DataProvider {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int seed = 0;
+    double start_sec = 1.0;       // Timestamp of the first measurement.
+    double duration_sec = 60.0;
+
+    // Rates of each stream. A rate of zero leaves the stream out.
+    double stereo_hz = 10.0;
+    double imu_hz = 100.0;
+    double depth_hz = 50.0;
+    double range_hz = 1.0;
+    double groundtruth_hz = 100.0;
+
+    // The cameras (Farmsim's rig by default). The focal length is for image_width, so a larger
+    // image sees the same field of view at a higher resolution.
+    int image_width = 672;
+    int image_height = 376;
+    double fx = 336.135986;
+    double baseline = 0.2;
+    Vector3d body_t_cam_left = Vector3d(-0.1, 0.0, 0.1);
+    bool color = false;
+    double image_noise_sigma = 2.0;   // Pixel noise (in [0, 255] intensity units).
+
+    // If empty, a random texture is generated from the seed.
+    std::string texture_path = "";
+    double texture_pixels_per_meter = 100.0;
+
+    // The scene: the wall is at world z = wall_z, the floor is at world depth y = floor_y.
+    double wall_z = 8.0;
+    double floor_y = 4.0;
+
+    // The trajectory: world_t_body(t) = center + amplitude * sin(2 pi t / period), per axis, and the
+    // same for yaw (about y), pitch (about x) and roll (about z) in radians.
+    Vector3d center = Vector3d(0.0, 1.0, 0.0);
+    Vector3d amplitude = Vector3d(3.0, 0.5, 1.0);
+    Vector3d period_sec = Vector3d(40.0, 17.0, 23.0);
+    Vector3d ypr_amplitude = Vector3d(0.3, 0.1, 0.05);
+    Vector3d ypr_period_sec = Vector3d(29.0, 13.0, 11.0);
+
+    // IMU noise (continuous time densities, as in the shared params) and constant biases.
+    double accel_noise_sigma = 0.001;
+    double gyro_noise_sigma = 0.0004;
+    Vector3d accel_bias = Vector3d::Zero();
+    Vector3d gyro_bias = Vector3d::Zero();
+
+    double depth_noise_sigma = 0.02;
+
+    // Beacons are spread out evenly on a circle on the floor. Each range epoch has one measurement
+    // per beacon.
+    int num_beacons = 2;
+    double beacon_circle_radius = 10.0;
+    double range_noise_sigma = 0.1;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  explicit SyntheticDataset(const Params& params);
+
+  // The world position of beacon i.
+  static Vector3d BeaconPosition(const Params& params, int i);
+
+  // The exact pose, and the IMU measurement (without noise or bias) at time t (seconds since
+  // start_sec).
+  static Matrix4d WorldTBody(const Params& params, double t);
+  static ImuMeasurement ExactImu(const Params& params, double t);
+};
+
+
+}
+}
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include "dataset/trajectory_evaluator.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+static const double kRadToDeg = 180.0 / M_PI;
+
+
+static Matrix4d RigidInverse(const Matrix4d& T)
+{
+  Matrix4d inv = Matrix4d::Identity();
+  inv.block<3, 3>(0, 0) = T.block<3, 3>(0, 0).transpose();
+  inv.block<3, 1>(0, 3) = -inv.block<3, 3>(0, 0) * T.block<3, 1>(0, 3);
+  return inv;
+}
+
+
+// Angle (rad) of the rotation between R0 and R1.
+static double RotationAngle(const Matrix3d& R0, const Matrix3d& R1)
+{
+  const double c = 0.5 * ((R0.transpose() * R1).trace() - 1.0);
+  return std::acos(std::max(-1.0, std::min(1.0, c)));
+}
+
+
+TrajectoryEvaluator::TrajectoryEvaluator(const std::vector<GroundtruthItem>& groundtruth,
+                                         seconds_t max_dt,
+                                         seconds_t rpe_delta_sec)
+    : groundtruth_(groundtruth),
+      max_dt_(max_dt),
+      rpe_delta_sec_(rpe_delta_sec) {}
+
+
+const GroundtruthItem* TrajectoryEvaluator::NearestGroundtruth(const std::vector<GroundtruthItem>& poses,
+                                                               seconds_t timestamp,
+                                                               seconds_t max_dt)
+{
+  // NOTE(milo): timestamp_t is unsigned, so anything before zero has to be clamped.
+  const timestamp_t t = (timestamp > 0) ? ConvertToNanoseconds(timestamp) : 0;
+  auto it = std::lower_bound(poses.begin(), poses.end(), t,
+      [](const GroundtruthItem& item, timestamp_t t) { return item.timestamp < t; });
+
+  const GroundtruthItem* best = nullptr;
+  double best_dt = max_dt;
+  if (it != poses.end()) {
+    const double dt = ConvertToSeconds(it->timestamp) - timestamp;
+    if (dt <= best_dt) { best = &(*it); best_dt = dt; }
+  }
+  if (it != poses.begin()) {
+    const double dt = timestamp - ConvertToSeconds(std::prev(it)->timestamp);
+    if (dt <= best_dt) { best = &(*std::prev(it)); }
+  }
+  return best;
+}
+
+
+bool TrajectoryEvaluator::AddPose(seconds_t timestamp, const Matrix4d& world_T_body)
+{
+  const GroundtruthItem* gt = NearestGroundtruth(groundtruth_, timestamp, max_dt_);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (gt == nullptr) {
+    ++num_unmatched_;
+    return false;
+  }
+
+  const double err = (world_T_body.block<3, 1>(0, 3) - gt->world_T_body.block<3, 1>(0, 3)).norm();
+  const double rot_err = RotationAngle(world_T_body.block<3, 3>(0, 0), gt->world_T_body.block<3, 3>(0, 0));
+  ate_m_.Record(err);
+  sum_sq_ate_ += err * err;
+  sum_sq_rot_ += rot_err * rot_err;
+  max_ate_ = std::max(max_ate_, err);
+  final_ate_ = err;
+  ++num_matched_;
+
+  if (has_anchor_ && timestamp < anchor_time_) {
+    has_anchor_ = false;
+  }
+
+  if (!has_anchor_) {
+    has_anchor_ = true;
+    anchor_time_ = timestamp;
+    anchor_est_ = world_T_body;
+    anchor_gt_ = gt->world_T_body;
+    return true;
+  }
+
+  if ((timestamp - anchor_time_) >= rpe_delta_sec_) {
+    // How the estimate moved over the segment vs. how the groundtruth moved.
+    const Matrix4d est_delta = RigidInverse(anchor_est_) * world_T_body;
+    const Matrix4d gt_delta = RigidInverse(anchor_gt_) * gt->world_T_body;
+    const Matrix4d E = RigidInverse(gt_delta) * est_delta;
+
+    const double trans = E.block<3, 1>(0, 3).norm();
+    const double rot = RotationAngle(Matrix3d::Identity(), E.block<3, 3>(0, 0));
+    sum_sq_rpe_trans_ += trans * trans;
+    sum_sq_rpe_rot_ += rot * rot;
+    ++num_rpe_;
+
+    anchor_time_ = timestamp;
+    anchor_est_ = world_T_body;
+    anchor_gt_ = gt->world_T_body;
+  }
+
+  return true;
+}
+
+
+TrajectoryError TrajectoryEvaluator::Error() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  TrajectoryError out;
+  out.num_matched = num_matched_;
+  out.num_unmatched = num_unmatched_;
+
+  if (num_matched_ > 0) {
+    const double N = static_cast<double>(num_matched_);
+    out.ate_rmse_m = std::sqrt(sum_sq_ate_ / N);
+    out.ate_p50_m = ate_m_.Percentile(0.5);
+    out.ate_p99_m = ate_m_.Percentile(0.99);
+    out.ate_max_m = max_ate_;
+    out.ate_final_m = final_ate_;
+    out.ate_rot_rmse_deg = kRadToDeg * std::sqrt(sum_sq_rot_ / N);
+  }
+
+  out.num_rpe = num_rpe_;
+  if (num_rpe_ > 0) {
+    const double N = static_cast<double>(num_rpe_);
+    out.rpe_trans_rmse_m = std::sqrt(sum_sq_rpe_trans_ / N);
+    out.rpe_rot_rmse_deg = kRadToDeg * std::sqrt(sum_sq_rpe_rot_ / N);
+  }
+
+  return out;
+}
+
+
+}
+}
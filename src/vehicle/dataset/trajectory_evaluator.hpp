@@ -0,0 +1,98 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/latency_histogram.hpp"
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// Accuracy of an estimated trajectory against groundtruth.
+struct TrajectoryError final
+{
+  size_t num_matched = 0;         // Estimates with a groundtruth pose within max_dt...
+  size_t num_unmatched = 0;       // ... and without one (these are ignored).
+
+  // Absolute trajectory error (no alignment, since estimators start at the groundtruth pose).
+  double ate_rmse_m = 0;
+  double ate_p50_m = 0;
+  double ate_p99_m = 0;
+  double ate_max_m = 0;
+  double ate_final_m = 0;         // Error of the latest estimate.
+  double ate_rot_rmse_deg = 0;
+
+  // Relative pose error over segments of (at least) rpe_delta_sec.
+  size_t num_rpe = 0;
+  double rpe_trans_rmse_m = 0;
+  double rpe_rot_rmse_deg = 0;
+};
+
+
+// Scores estimates against groundtruth as they arrive (e.g from a SmootherResult or filter
+// StateStamped callback), so that a benchmark can report accuracy without storing the trajectory.
+// Each estimate is matched to the nearest groundtruth pose with a binary search. ATE is a running
+// sum, and RPE is computed over consecutive, non-overlapping segments, so memory use doesn't grow
+// with the length of the run.
+//
+// AddPose() can be called from any thread, but estimates should arrive in time order (a segment is
+// restarted if one goes backwards).
+class TrajectoryEvaluator final {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  MACRO_DELETE_COPY_CONSTRUCTORS(TrajectoryEvaluator)
+
+  // NOTE(milo): Keeps a reference to the groundtruth poses (sorted by timestamp), so they have to
+  // outlive the evaluator.
+  TrajectoryEvaluator(const std::vector<GroundtruthItem>& groundtruth,
+                      seconds_t max_dt = 0.05,
+                      seconds_t rpe_delta_sec = 1.0);
+
+  // Score one estimate of world_T_body. Returns false if there's no groundtruth pose near it.
+  bool AddPose(seconds_t timestamp, const Matrix4d& world_T_body);
+
+  TrajectoryError Error() const;
+
+  // Returns the groundtruth pose closest in time to "timestamp", or nullptr if there is none within
+  // max_dt.
+  static const GroundtruthItem* NearestGroundtruth(const std::vector<GroundtruthItem>& poses,
+                                                   seconds_t timestamp,
+                                                   seconds_t max_dt);
+
+ private:
+  const std::vector<GroundtruthItem>& groundtruth_;
+  seconds_t max_dt_;
+  seconds_t rpe_delta_sec_;
+
+  mutable std::mutex mutex_;
+
+  // NOTE(milo): Fixed-size, so the percentiles don't need the individual errors (0.1 mm resolution).
+  LatencyHistogram ate_m_{1e-4};
+  size_t num_matched_ = 0;
+  size_t num_unmatched_ = 0;
+  double sum_sq_ate_ = 0;
+  double sum_sq_rot_ = 0;
+  double max_ate_ = 0;
+  double final_ate_ = 0;
+
+  // The start of the current RPE segment.
+  bool has_anchor_ = false;
+  seconds_t anchor_time_ = 0;
+  Matrix4d anchor_est_ = Matrix4d::Identity();
+  Matrix4d anchor_gt_ = Matrix4d::Identity();
+
+  size_t num_rpe_ = 0;
+  double sum_sq_rpe_trans_ = 0;
+  double sum_sq_rpe_rot_ = 0;
+};
+
+
+}
+}
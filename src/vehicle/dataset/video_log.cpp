@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+#include "core/file_utils.hpp"
+#include "dataset/csv_reader.hpp"
+#include "dataset/video_log.hpp"
+#include "vision_core/image_util.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace video_log;
+
+
+namespace video_log {
+
+
+std::string to_string(VideoCodec codec)
+{
+  switch (codec) {
+    case VideoCodec::H264:
+      return "h264";
+    case VideoCodec::H265:
+      return "h265";
+    case VideoCodec::FFV1:
+      return "ffv1";
+    default:
+      return "unknown";
+  }
+}
+
+
+VideoCodec CodecFromString(const std::string& name)
+{
+  if (name == "h264") {
+    return VideoCodec::H264;
+  } else if (name == "h265") {
+    return VideoCodec::H265;
+  } else if (name == "ffv1") {
+    return VideoCodec::FFV1;
+  }
+  throw std::runtime_error("Unknown video codec: " + name);
+}
+
+
+std::string EncoderPipeline(VideoCodec codec,
+                            const std::string& path,
+                            int bitrate_kbps,
+                            int keyframe_interval,
+                            bool hardware)
+{
+  CHECK(codec != VideoCodec::FFV1) << "FFV1 is written with FFmpeg, not GStreamer" << std::endl;
+  const std::string name = to_string(codec);
+
+  std::stringstream ss;
+  ss << "appsrc ! videoconvert ! ";
+
+  // NOTE(milo): Every keyframe is an IDR frame, so that decoding can start at any of them.
+  if (hardware) {
+    ss << "video/x-raw,format=BGRx ! nvvidconv ! video/x-raw(memory:NVMM),format=NV12 ! "
+       << "nvv4l2" << name << "enc bitrate=" << 1000 * bitrate_kbps
+       << " iframeinterval=" << keyframe_interval << " idrinterval=" << keyframe_interval
+       << " insert-sps-pps=true ! ";
+  } else {
+    ss << "video/x-raw,format=I420 ! "
+       << (codec == VideoCodec::H264 ? "x264enc" : "x265enc") << " bitrate=" << bitrate_kbps
+       << " key-int-max=" << keyframe_interval << " speed-preset=ultrafast tune=zerolatency ! ";
+  }
+
+  ss << name << "parse ! matroskamux ! filesink location=" << path;
+  return ss.str();
+}
+
+
+std::string DecoderPipeline(VideoCodec codec, const std::string& path)
+{
+  CHECK(codec != VideoCodec::FFV1) << "FFV1 is read with FFmpeg, not GStreamer" << std::endl;
+  const std::string name = to_string(codec);
+
+  std::stringstream ss;
+  ss << "filesrc location=" << path << " ! matroskademux ! " << name << "parse ! nvv4l2decoder ! "
+     << "nvvidconv ! video/x-raw,format=BGRx ! videoconvert ! video/x-raw,format=BGR ! appsink";
+  return ss.str();
+}
+
+
+}
+
+
+VideoLogIndex VideoLogIndex::Read(const std::string& path)
+{
+  std::ifstream in(path);
+  std::string first_line;
+  if (!in.is_open() || !std::getline(in, first_line)) {
+    throw std::runtime_error("Could not read video log index: " + path);
+  }
+
+  const std::string prefix = "# codec: ";
+  if (first_line.compare(0, prefix.size(), prefix) != 0) {
+    throw std::runtime_error("Video log index has no codec line: " + path);
+  }
+
+  VideoLogIndex index;
+  index.codec = CodecFromString(first_line.substr(prefix.size()));
+
+  CsvReader csv(path);
+  csv.ParseLines(index.frames, [](CsvLine& line, std::vector<VideoLogFrame>& out)
+  {
+    timestamp_t frame = 0, timestamp = 0, keyframe = 0;
+    if (!(line.Next(frame) && line.Next(timestamp) && line.Next(keyframe))) {
+      return false;
+    }
+    out.emplace_back(VideoLogFrame{ static_cast<size_t>(frame), timestamp, keyframe != 0 });
+    return true;
+  }, 2);
+
+  // Frames are written in order, so the index is only ever out of order if the file was edited.
+  for (size_t i = 0; i < index.frames.size(); ++i) {
+    if (index.frames.at(i).frame != i) {
+      throw std::runtime_error("Video log index skips frame " + std::to_string(i) + ": " + path);
+    }
+  }
+  if (!index.frames.empty() && !index.frames.front().keyframe) {
+    throw std::runtime_error("Video log doesn't start with a keyframe: " + path);
+  }
+
+  return index;
+}
+
+
+size_t VideoLogIndex::KeyframeBefore(size_t idx) const
+{
+  CHECK_LT(idx, frames.size());
+  while (idx > 0 && !frames.at(idx).keyframe) {
+    --idx;
+  }
+  return idx;
+}
+
+
+VideoLogWriter::VideoLogWriter(const std::string& folder,
+                               VideoCodec codec,
+                               double fps,
+                               int bitrate_kbps,
+                               int keyframe_interval,
+                               bool hardware)
+    : folder_(folder),
+      codec_(codec),
+      fps_(fps),
+      bitrate_kbps_(bitrate_kbps),
+      keyframe_interval_(codec == VideoCodec::FFV1 ? kFfv1KeyframeInterval : keyframe_interval),
+      hardware_(hardware)
+{
+  CHECK_GT(keyframe_interval_, 0);
+  mkdir(folder_);
+
+  const std::string index_path = Join(folder_, kIndexFile);
+  index_.open(index_path, std::ios::trunc);
+  CHECK(index_.is_open()) << "Could not open video log index for writing: " << index_path << std::endl;
+  index_ << "# codec: " << to_string(codec_) << "\n";
+  index_ << "#frame,timestamp [ns],keyframe\n";
+
+  sensors_.reset(new BinaryLogWriter(Join(folder_, kSensorLog)));
+}
+
+
+VideoLogWriter::~VideoLogWriter()
+{
+  Close();
+}
+
+
+void VideoLogWriter::WriteImu(const ImuMeasurement& data)
+{
+  CHECK(!closed_) << "VideoLogWriter is closed" << std::endl;
+  sensors_->WriteImu(data);
+}
+
+
+void VideoLogWriter::WriteDepth(const DepthMeasurement& data)
+{
+  CHECK(!closed_) << "VideoLogWriter is closed" << std::endl;
+  sensors_->WriteDepth(data);
+}
+
+
+void VideoLogWriter::WriteRange(const RangeMeasurement& data)
+{
+  CHECK(!closed_) << "VideoLogWriter is closed" << std::endl;
+  sensors_->WriteRange(data);
+}
+
+
+void VideoLogWriter::WriteMag(const MagMeasurement& data)
+{
+  CHECK(!closed_) << "VideoLogWriter is closed" << std::endl;
+  sensors_->WriteMag(data);
+}
+
+
+void VideoLogWriter::OpenVideo(cv::VideoWriter& writer, const std::string& path, const cv::Size& size)
+{
+  if (codec_ == VideoCodec::FFV1) {
+    writer.open(path, cv::CAP_FFMPEG, cv::VideoWriter::fourcc('F', 'F', 'V', '1'), fps_, size, true);
+  } else {
+    if (hardware_) {
+      writer.open(EncoderPipeline(codec_, path, bitrate_kbps_, keyframe_interval_, true),
+                  cv::CAP_GSTREAMER, 0, fps_, size, true);
+      LOG_IF(WARNING, !writer.isOpened()) << "No hardware " << to_string(codec_)
+          << " encoder, falling back to software for " << path << std::endl;
+    }
+    if (!writer.isOpened()) {
+      writer.open(EncoderPipeline(codec_, path, bitrate_kbps_, keyframe_interval_, false),
+                  cv::CAP_GSTREAMER, 0, fps_, size, true);
+    }
+  }
+
+  CHECK(writer.isOpened()) << "Could not open a " << to_string(codec_) << " video writer for " << path << std::endl;
+}
+
+
+void VideoLogWriter::WriteStereo(const StereoImage3b& data)
+{
+  CHECK(!closed_) << "VideoLogWriter is closed" << std::endl;
+
+  const cv::Size size = data.left_image.size();
+  CHECK(data.right_image.size() == size) << "Left and right images should have the same size" << std::endl;
+
+  if (num_frames_ == 0) {
+    size_ = size;
+    OpenVideo(left_, Join(folder_, kLeftVideo), size_);
+    OpenVideo(right_, Join(folder_, kRightVideo), size_);
+  }
+  CHECK(size == size_) << "The image size can't change during a video log" << std::endl;
+
+  left_.write(data.left_image);
+  right_.write(data.right_image);
+
+  // NOTE(milo): The encoders don't report which frames became keyframes, so this assumes that they
+  // start one exactly every keyframe_interval frames (which is what they were asked to do).
+  const bool keyframe = (num_frames_ % static_cast<size_t>(keyframe_interval_)) == 0;
+  index_ << num_frames_ << "," << data.timestamp << "," << (keyframe ? 1 : 0) << "\n";
+  ++num_frames_;
+}
+
+
+void VideoLogWriter::Close()
+{
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+
+  left_.release();
+  right_.release();
+  index_.close();
+  sensors_->Close();
+
+  LOG(INFO) << "Closed video log " << folder_ << " (" << to_string(codec_) << ", " << num_frames_
+            << " stereo pairs)" << std::endl;
+}
+
+
+VideoLogReader::VideoLogReader(const std::string& folder, bool hardware)
+    : folder_(folder),
+      hardware_(hardware),
+      index_(VideoLogIndex::Read(Join(folder, kIndexFile)))
+{
+  left_.path = Join(folder_, kLeftVideo);
+  right_.path = Join(folder_, kRightVideo);
+  Open(left_);
+  Open(right_);
+}
+
+
+void VideoLogReader::Open(Stream& s)
+{
+  s.cap.release();
+  s.next = 0;
+
+  if (hardware_ && index_.codec != VideoCodec::FFV1) {
+    s.cap.open(DecoderPipeline(index_.codec, s.path), cv::CAP_GSTREAMER);
+    LOG_IF(WARNING, !s.cap.isOpened()) << "No hardware " << to_string(index_.codec)
+        << " decoder, falling back to FFmpeg for " << s.path << std::endl;
+  }
+  if (!s.cap.isOpened()) {
+    s.cap.open(s.path, cv::CAP_FFMPEG);
+  }
+
+  if (!s.cap.isOpened()) {
+    throw std::runtime_error("Could not open video: " + s.path);
+  }
+}
+
+
+bool VideoLogReader::ReadFrame(Stream& s, size_t idx, cv::Mat& out)
+{
+  // Decoding forward from where the stream is beats seeking, as long as it doesn't have to go past a
+  // keyframe to get there.
+  const size_t keyframe = index_.KeyframeBefore(idx);
+  if (s.next > idx || s.next < keyframe) {
+    ++num_seeks_;
+    if (s.cap.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(keyframe))) {
+      s.next = keyframe;
+    } else {
+      // NOTE(milo): Not every backend can seek, but starting over always works.
+      Open(s);
+    }
+  }
+
+  for (; s.next < idx; ++s.next) {
+    if (!s.cap.grab()) {
+      return false;
+    }
+  }
+
+  ++s.next;
+  return s.cap.read(out) && !out.empty();
+}
+
+
+void VideoLogReader::Decode(size_t idx, bool decode_color, DecodedStereo& out)
+{
+  out = DecodedStereo();
+
+  if (idx >= index_.frames.size()) {
+    out.error = "ERROR: No stereo pair " + std::to_string(idx) + " in video log " + folder_;
+    return;
+  }
+
+  cv::Mat left, right;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (idx != cached_idx_) {
+      cached_idx_ = static_cast<size_t>(-1);
+      cached_left_ = cv::Mat();
+      cached_right_ = cv::Mat();
+
+      // Each read allocates its own image, so the cached pair isn't written over later.
+      if (!ReadFrame(left_, idx, cached_left_) || !ReadFrame(right_, idx, cached_right_)) {
+        left_.next = right_.next = static_cast<size_t>(-1);   // Force a seek next time.
+        out.error = "ERROR: Could not decode the stereo pair at t=" + std::to_string(index_.frames.at(idx).timestamp);
+        return;
+      }
+      cached_idx_ = idx;
+    }
+
+    // The callbacks might hold onto (and modify) the images.
+    left = cached_left_.clone();
+    right = cached_right_.clone();
+  }
+
+  if (decode_color) {
+    out.has_color = left.channels() > 1 && right.channels() > 1;
+    out.left = std::make_shared<ImageFrame>(left);
+    out.right = std::make_shared<ImageFrame>(right);
+  } else {
+    out.left = std::make_shared<ImageFrame>(MaybeConvertToGray(left));
+    out.right = std::make_shared<ImageFrame>(MaybeConvertToGray(right));
+  }
+}
+
+
+}
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "dataset/binary_log.hpp"
+#include "dataset/data_writer.hpp"
+#include "dataset/stereo_prefetcher.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace core;
+
+
+// A recording where the left and right images are video streams instead of image files, so that the
+// (hardware) encoder does the compression instead of the CPU. It's a folder with:
+//
+//   left.mkv, right.mkv    One frame per stereo pair, in the same order
+//   index.csv              Frame number, timestamp and whether the frame is a keyframe
+//   sensors.bmlog          Everything else, as a binary log (see BinaryLogWriter)
+//
+// The first line of index.csv is "# codec: <name>", and the second is the column header. Seeking
+// decodes forward from the keyframe at or before a frame, so the keyframe interval trades file size
+// for random access.
+namespace video_log {
+
+static const char* const kLeftVideo = "left.mkv";
+static const char* const kRightVideo = "right.mkv";
+static const char* const kIndexFile = "index.csv";
+static const char* const kSensorLog = "sensors.bmlog";
+
+// H264/H265 are lossy, and hardware accelerated on the Jetson. FFV1 is lossless (for calibration
+// data), and always done in software by FFmpeg.
+enum class VideoCodec { H264 = 0, H265 = 1, FFV1 = 2 };
+
+std::string to_string(VideoCodec codec);
+
+// Throws std::runtime_error for anything but "h264", "h265" or "ffv1".
+VideoCodec CodecFromString(const std::string& name);
+
+// NOTE(milo): OpenCV's FFmpeg writer doesn't let us choose the GOP size, and always uses 12.
+static const int kFfv1KeyframeInterval = 12;
+
+// GStreamer pipelines for cv::VideoWriter/cv::VideoCapture (H264/H265 only). With hardware, encoding
+// goes through the Jetson's nvv4l2 encoder. The software encoders are a fallback for machines without
+// it (e.g a laptop). The decoder is Jetson-only, since FFmpeg can read the files directly elsewhere.
+std::string EncoderPipeline(VideoCodec codec,
+                            const std::string& path,
+                            int bitrate_kbps,
+                            int keyframe_interval,
+                            bool hardware);
+
+std::string DecoderPipeline(VideoCodec codec, const std::string& path);
+
+}
+
+
+// One line of index.csv.
+struct VideoLogFrame final {
+  size_t frame;
+  timestamp_t timestamp;
+  bool keyframe;
+};
+
+
+// The parsed index.csv of a video log.
+struct VideoLogIndex final {
+  video_log::VideoCodec codec = video_log::VideoCodec::H264;
+  std::vector<VideoLogFrame> frames;
+
+  // Throws std::runtime_error if the index is missing or malformed.
+  static VideoLogIndex Read(const std::string& path);
+
+  // The last keyframe at or before frame idx (every stream starts with one).
+  size_t KeyframeBefore(size_t idx) const;
+};
+
+
+// Writes a video log (see video_log above). The video writers are opened on the first stereo pair,
+// once the image size is known. Fails with a CHECK if neither the hardware nor software encoders can
+// be opened, like BinaryLogWriter does when it can't open its file.
+class VideoLogWriter final : public DataWriter {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(VideoLogWriter);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(VideoLogWriter);
+
+  // The streams are tagged to play back at fps, but each frame keeps its own timestamp in the index.
+  // The bitrate and keyframe interval only apply to H264/H265.
+  explicit VideoLogWriter(const std::string& folder,
+                          video_log::VideoCodec codec = video_log::VideoCodec::H264,
+                          double fps = 30.0,
+                          int bitrate_kbps = 8000,
+                          int keyframe_interval = 30,
+                          bool hardware = true);
+
+  // Calls Close().
+  ~VideoLogWriter();
+
+  void WriteImu(const ImuMeasurement& data) override;
+  void WriteDepth(const DepthMeasurement& data) override;
+  void WriteRange(const RangeMeasurement& data) override;
+  void WriteMag(const MagMeasurement& data) override;
+  void WriteStereo(const StereoImage3b& data) override;
+
+  // Finishes the streams (the containers need their trailers), and closes the index and sensor log.
+  // Nothing can be written after this.
+  void Close();
+
+ private:
+  void OpenVideo(cv::VideoWriter& writer, const std::string& path, const cv::Size& size);
+
+  std::string folder_;
+  video_log::VideoCodec codec_;
+  double fps_;
+  int bitrate_kbps_;
+  int keyframe_interval_;
+  bool hardware_;
+
+  cv::VideoWriter left_;
+  cv::VideoWriter right_;
+  cv::Size size_;
+  size_t num_frames_ = 0;
+  bool closed_ = false;
+
+  std::ofstream index_;
+  std::unique_ptr<BinaryLogWriter> sensors_;
+};
+
+
+// Decodes stereo pairs out of a video log by index. Reading the next frame is the fast path. Anything
+// else seeks to the keyframe before the frame (from the index) and decodes forward, unless the frame
+// is close enough ahead that decoding forward from where the streams are is cheaper. Threadsafe, but
+// decoding is sequential, so prefetching with more than one thread doesn't help.
+class VideoLogReader final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(VideoLogReader);
+  MACRO_DELETE_COPY_CONSTRUCTORS(VideoLogReader);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(VideoLogReader);
+
+  // If hardware, H264/H265 are decoded by the Jetson (falling back to FFmpeg if the pipeline doesn't
+  // open). Throws std::runtime_error if the index or the videos can't be read.
+  explicit VideoLogReader(const std::string& folder, bool hardware = true);
+
+  const VideoLogIndex& Index() const { return index_; }
+
+  // Sets out.error (like DecodeStereoRecord()) if the frame can't be decoded.
+  void Decode(size_t idx, bool decode_color, DecodedStereo& out);
+
+  // How many times a stream had to seek to a keyframe (for tests and profiling).
+  size_t NumSeeks() const { return num_seeks_; }
+
+ private:
+  struct Stream final {
+    std::string path;
+    cv::VideoCapture cap;
+    size_t next = 0;          // The frame that cap.read() will return.
+  };
+
+  void Open(Stream& s);
+  bool ReadFrame(Stream& s, size_t idx, cv::Mat& out);
+
+  std::string folder_;
+  bool hardware_;
+  VideoLogIndex index_;
+
+  std::mutex mutex_;
+  Stream left_;
+  Stream right_;
+  size_t num_seeks_ = 0;
+
+  // NOTE(milo): Playback and a prefetcher can both ask for the same pair, so keep the last one.
+  size_t cached_idx_ = static_cast<size_t>(-1);
+  cv::Mat cached_left_;
+  cv::Mat cached_right_;
+};
+
+
+}
+}
@@ -0,0 +1,65 @@
+#include <glog/logging.h>
+
+#include "core/file_utils.hpp"
+#include "dataset/video_log_dataset.hpp"
+
+namespace bm {
+namespace dataset {
+
+using namespace binary_log;
+
+
+VideoLogDataset::VideoLogDataset(const std::string& folder, bool hardware_decode) : DataProvider()
+{
+  const VideoLogReader::Ptr video = std::make_shared<VideoLogReader>(folder, hardware_decode);
+
+  for (const VideoLogFrame& f : video->Index().frames) {
+    stereo_data.emplace_back(f.timestamp, "", "");
+  }
+
+  // NOTE(milo): Like BinaryLogDataset, the decoder owns the reader, so that it survives this dataset
+  // being copied into a DataProvider (see GetDatasetByName()).
+  stereo_decoder = [video](size_t idx, bool decode_color, DecodedStereo& out)
+  {
+    video->Decode(idx, decode_color, out);
+  };
+
+  BinaryLogReader sensors(Join(folder, video_log::kSensorLog));
+  sensors.ForEachRecord([&](const RecordView& r)
+  {
+    switch (r.type) {
+      case RecordType::IMU:
+        imu_data.emplace_back(ParseImuRecord(r));
+        break;
+      case RecordType::DEPTH:
+        depth_data.emplace_back(ParseDepthRecord(r));
+        break;
+      case RecordType::RANGE:
+        range_data.emplace_back(ParseRangeRecord(r));
+        break;
+      case RecordType::MAG:
+        mag_data_.emplace_back(ParseMagRecord(r));
+        break;
+      default:
+        LOG(WARNING) << "Skipping unexpected record type " << static_cast<int>(r.type) << std::endl;
+        break;
+    }
+  });
+
+  // The sensor records are in the order they arrived (see BinaryLogDataset).
+  SortByTimestamp(imu_data);
+  SortByTimestamp(depth_data);
+  SortByTimestamp(range_data);
+  SortByTimestamp(mag_data_);
+
+  LOG(INFO) << "Read video log " << folder << " (" << video_log::to_string(video->Index().codec) << "):\n"
+            << "  stereo=" << stereo_data.size() << " imu=" << imu_data.size()
+            << " depth=" << depth_data.size() << " range=" << range_data.size()
+            << " mag=" << mag_data_.size() << std::endl;
+
+  SanityCheck(Join(folder, "report.csv"));
+}
+
+
+}
+}
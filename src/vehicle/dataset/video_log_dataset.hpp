@@ -0,0 +1,27 @@
+#pragma once
+
+#include "dataset/data_provider.hpp"
+#include "dataset/video_log.hpp"
+
+namespace bm {
+namespace dataset {
+
+
+// Plays back a video log (see VideoLogWriter). The measurements are read from its binary log on
+// construction, and the stereo pairs are decoded from the videos during playback (on the Jetson's
+// hardware decoder if hardware_decode). Seeking and Slice() start decoding at the nearest keyframe.
+class VideoLogDataset : public DataProvider {
+ public:
+  // Throws std::runtime_error if folder isn't a readable video log.
+  explicit VideoLogDataset(const std::string& folder, bool hardware_decode = true);
+
+  // DataProvider has no magnetometer source yet, so these are only kept around for tools.
+  const std::vector<MagMeasurement>& MagData() const { return mag_data_; }
+
+ private:
+  std::vector<MagMeasurement> mag_data_;
+};
+
+
+}
+}
@@ -1,5 +1,7 @@
-#include <numeric>
+#include <algorithm>
+#include <cmath>
 
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc.hpp>
 #include <glog/logging.h>
 
@@ -33,11 +35,28 @@ static VecPoint2f CvKeyPointToPoint(const std::vector<cv::KeyPoint>& input)
 
 void FeatureDetector::Params::LoadParams(const YamlParser& parser)
 {
+  algorithm = YamlToEnum<FeatureAlgorithm>(parser.GetNode("algorithm"));
   parser.GetParam("max_features_per_frame", &max_features_per_frame);
+  parser.GetParam("tile_rows", &tile_rows);
+  parser.GetParam("tile_cols", &tile_cols);
+  parser.GetParam("incremental", &incremental);
+  parser.GetParam("incremental_fill_ratio", &incremental_fill_ratio);
+  parser.GetParam("incremental_max_tiles", &incremental_max_tiles);
+  parser.GetParam("incremental_skip_coverage", &incremental_skip_coverage);
+  anms_algorithm = YamlToEnum<AnmsAlgorithm>(parser.GetNode("anms_algorithm"));
+  parser.GetParam("anms_candidates_per_feature", &anms_candidates_per_feature);
+  parser.GetParam("anms_tolerance", &anms_tolerance);
+  parser.GetParam("fast_threshold", &fast_threshold);
   parser.GetParam("min_distance_btw_tracked_and_detected_features", &min_distance_btw_tracked_and_detected_features);
   parser.GetParam("gftt_quality_level", &gftt_quality_level);
   parser.GetParam("gftt_block_size", &gftt_block_size);
   parser.GetParam("gftt_use_harris_corner_detector", &gftt_use_harris_corner_detector);
+
+  CHECK_GE(anms_candidates_per_feature, 1);
+  CHECK(anms_tolerance >= 0 && anms_tolerance < 1);
+  CHECK(!incremental || (tile_rows > 0 && tile_cols > 0)) << "Incremental detection needs tiles" << std::endl;
+  CHECK(incremental_fill_ratio > 0 && incremental_fill_ratio <= 1);
+  CHECK_GE(incremental_max_tiles, 0);
 }
 
 
@@ -45,44 +64,211 @@ FeatureDetector::FeatureDetector(const Params& params) : params_(params)
 {
   if (params_.algorithm == FeatureAlgorithm::GFTT) {
     feature_detector_ = cv::GFTTDetector::create(
-      params_.max_features_per_frame,
+      NumCandidates(),
       params_.gftt_quality_level,
       params_.min_distance_btw_tracked_and_detected_features,
       params_.gftt_block_size,
       params_.gftt_use_harris_corner_detector,
       params_.gftt_k);
+  } else if (params_.algorithm == FeatureAlgorithm::FAST) {
+    feature_detector_ = cv::FastFeatureDetector::create(params_.fast_threshold, true);
   } else {
     throw std::runtime_error("Unsupported feature detection algorithm!");
   }
 }
 
 
-// Adapted from Kimera-VIO
-static std::vector<cv::KeyPoint> ANMSRangeTree(std::vector<cv::KeyPoint>& keypoints,
-                                              int num_to_keep,
-                                              float tolerance,
-                                              int cols,
-                                              int rows)
+void FeatureDetector::SetMaxFeaturesPerFrame(int max_features_per_frame)
+{
+  CHECK_GT(max_features_per_frame, 0);
+  params_.max_features_per_frame = max_features_per_frame;
+
+  const cv::Ptr<cv::GFTTDetector> gftt = feature_detector_.dynamicCast<cv::GFTTDetector>();
+  if (gftt) {
+    gftt->setMaxFeatures(NumCandidates());
+  }
+}
+
+
+int FeatureDetector::NumCandidates() const
 {
+  if (params_.anms_algorithm == AnmsAlgorithm::NONE) {
+    return params_.max_features_per_frame;
+  }
+  return params_.max_features_per_frame * params_.anms_candidates_per_feature;
+}
+
+
+void FeatureDetector::SelectKeypoints(int num_to_keep,
+                                      int cols,
+                                      int rows,
+                                      std::vector<cv::KeyPoint>& keypoints) const
+{
+  if (num_to_keep <= 0) {
+    keypoints.clear();
+    return;
+  }
   if ((int)keypoints.size() <= num_to_keep) {
-    return keypoints;
+    return;
   }
 
-  // Sorting keypoints by deacreasing order of strength.
-  std::vector<int> responses;
-  for (size_t i = 0; i < keypoints.size(); i++) {
-    responses.emplace_back(keypoints[i].response);
+  const auto stronger = [](const cv::KeyPoint& a, const cv::KeyPoint& b) { return a.response > b.response; };
+
+  // NOTE(milo): ANMS needs at least two points to solve for its initial search range.
+  if (params_.anms_algorithm == AnmsAlgorithm::NONE || num_to_keep < 2) {
+    std::nth_element(keypoints.begin(), keypoints.begin() + num_to_keep, keypoints.end(), stronger);
+    keypoints.resize(num_to_keep);
+    return;
   }
-  std::vector<int> idx(responses.size());
-  std::iota(std::begin(idx), std::end(idx), 0);
-  cv::sortIdx(responses, idx, cv::SortFlags::SORT_DESCENDING);
-  std::vector<cv::KeyPoint> keypoints_sorted;
 
-  for (unsigned int i = 0; i < keypoints.size(); i++) {
-    keypoints_sorted.push_back(keypoints[idx[i]]);
+  // Bound the candidate set (FAST can find thousands of corners), then sort it strongest first,
+  // which is the order that ANMS expects.
+  const int max_candidates = num_to_keep * params_.anms_candidates_per_feature;
+  if ((int)keypoints.size() > max_candidates) {
+    std::nth_element(keypoints.begin(), keypoints.begin() + max_candidates, keypoints.end(), stronger);
+    keypoints.resize(max_candidates);
   }
+  std::sort(keypoints.begin(), keypoints.end(), stronger);
 
-  return anms::RangeTree(keypoints_sorted, num_to_keep, tolerance, cols, rows);
+  if (params_.anms_algorithm == AnmsAlgorithm::SSC) {
+    keypoints = anms::Ssc(keypoints, num_to_keep, params_.anms_tolerance, cols, rows);
+  } else {
+    keypoints = anms::RangeTree(keypoints, num_to_keep, params_.anms_tolerance, cols, rows);
+  }
+
+  // ANMS can overshoot by up to the tolerance. Its output is strongest first, so drop the end.
+  if ((int)keypoints.size() > num_to_keep) {
+    keypoints.resize(num_to_keep);
+  }
+}
+
+
+std::vector<int> FeatureDetector::TileBudgets(const cv::Size& image_size, const VecPoint2f& tracked_kp) const
+{
+  const int tile_rows = params_.tile_rows;
+  const int tile_cols = params_.tile_cols;
+  CHECK(tile_rows > 0 && tile_cols > 0);
+  const int num_tiles = tile_rows * tile_cols;
+  const int tile_h = (image_size.height + tile_rows - 1) / tile_rows;
+  const int tile_w = (image_size.width + tile_cols - 1) / tile_cols;
+
+  // Each cell gets an equal share of the total, minus the features it's already tracking.
+  const int per_cell = (params_.max_features_per_frame + num_tiles - 1) / num_tiles;
+  std::vector<int> occupancy(num_tiles, 0);
+  for (const cv::Point2f& pt : tracked_kp) {
+    const int r = std::min(tile_rows - 1, std::max(0, (int)pt.y / tile_h));
+    const int c = std::min(tile_cols - 1, std::max(0, (int)pt.x / tile_w));
+    ++occupancy.at(r*tile_cols + c);
+  }
+
+  std::vector<int> budget(num_tiles, 0);
+  for (int i = 0; i < num_tiles; ++i) {
+    budget.at(i) = std::max(0, per_cell - occupancy.at(i));
+  }
+
+  if (!params_.incremental) {
+    return budget;
+  }
+
+  // Only under-filled tiles are worth running the detector on.
+  const int min_occupancy = std::max(1, (int)std::ceil(params_.incremental_fill_ratio * per_cell));
+  std::vector<int> underfilled;
+  for (int i = 0; i < num_tiles; ++i) {
+    if (occupancy.at(i) < min_occupancy) {
+      underfilled.emplace_back(i);
+    } else {
+      budget.at(i) = 0;
+    }
+  }
+
+  const int num_filled = num_tiles - (int)underfilled.size();
+  if (num_filled >= params_.incremental_skip_coverage * num_tiles) {
+    std::fill(budget.begin(), budget.end(), 0);
+    return budget;
+  }
+
+  // Spend the per-frame budget on the emptiest tiles first.
+  if (params_.incremental_max_tiles > 0 && (int)underfilled.size() > params_.incremental_max_tiles) {
+    std::stable_sort(underfilled.begin(), underfilled.end(),
+        [&occupancy](int a, int b) { return occupancy.at(a) < occupancy.at(b); });
+    for (size_t j = params_.incremental_max_tiles; j < underfilled.size(); ++j) {
+      budget.at(underfilled.at(j)) = 0;
+    }
+  }
+
+  return budget;
+}
+
+
+void FeatureDetector::DetectTiled(const Image1b& img,
+                                  const cv::Mat& mask,
+                                  const std::vector<int>& budget,
+                                  int num_to_keep,
+                                  std::vector<cv::KeyPoint>& new_kp_cv) const
+{
+  new_kp_cv.clear();
+  if (num_to_keep <= 0) {
+    return;
+  }
+
+  const int tile_rows = params_.tile_rows;
+  const int tile_cols = params_.tile_cols;
+  const int num_tiles = tile_rows * tile_cols;
+  const int tile_h = (img.rows + tile_rows - 1) / tile_rows;
+  const int tile_w = (img.cols + tile_cols - 1) / tile_cols;
+  CHECK_EQ(num_tiles, (int)budget.size());
+
+  std::vector<std::vector<cv::KeyPoint>> tile_kp(num_tiles);
+
+  cv::parallel_for_(cv::Range(0, num_tiles), [&](const cv::Range& range)
+  {
+    for (int i = range.start; i < range.end; ++i) {
+      if (budget.at(i) <= 0) {
+        continue;
+      }
+      const int r = i / tile_cols;
+      const int c = i % tile_cols;
+      const cv::Rect roi = cv::Rect(c*tile_w, r*tile_h, tile_w, tile_h) & cv::Rect(0, 0, img.cols, img.rows);
+      if (roi.area() == 0) {
+        continue;
+      }
+
+      // NOTE(milo): GFTT keeps the strongest "maxCorners" points, so this does the top-k for the
+      // cell. FAST returns every corner, so they're selected afterwards (with ANMS inside of the
+      // cell). A detector per tile avoids sharing one across threads.
+      cv::Ptr<cv::Feature2D> detector;
+      if (params_.algorithm == FeatureAlgorithm::FAST) {
+        detector = cv::FastFeatureDetector::create(params_.fast_threshold, true);
+      } else {
+        detector = cv::GFTTDetector::create(
+            budget.at(i),
+            params_.gftt_quality_level,
+            params_.min_distance_btw_tracked_and_detected_features,
+            params_.gftt_block_size,
+            params_.gftt_use_harris_corner_detector,
+            params_.gftt_k);
+      }
+
+      std::vector<cv::KeyPoint>& kp = tile_kp.at(i);
+      detector->detect(img(roi), kp, mask(roi));
+      SelectKeypoints(budget.at(i), roi.width, roi.height, kp);
+      for (cv::KeyPoint& k : kp) {
+        k.pt.x += roi.x;
+        k.pt.y += roi.y;
+      }
+    }
+  });
+
+  for (const std::vector<cv::KeyPoint>& kp : tile_kp) {
+    new_kp_cv.insert(new_kp_cv.end(), kp.begin(), kp.end());
+  }
+
+  // Rounding up the per-cell budget can overshoot the total, so drop the weakest extras.
+  if ((int)new_kp_cv.size() > num_to_keep) {
+    std::nth_element(new_kp_cv.begin(), new_kp_cv.begin() + num_to_keep, new_kp_cv.end(),
+        [](const cv::KeyPoint& a, const cv::KeyPoint& b) { return a.response > b.response; });
+    new_kp_cv.resize(num_to_keep);
+  }
 }
 
 
@@ -92,6 +278,19 @@ void FeatureDetector::Detect(const Image1b& img,
 {
   new_kp.clear();
 
+  const bool tiled = params_.tile_rows > 0 && params_.tile_cols > 0;
+  const int num_to_keep = std::max(0, params_.max_features_per_frame - (int)tracked_kp.size());
+
+  // Figure out which tiles need features first, so that detection can be skipped altogether when
+  // the tracked points already cover the image (incremental mode).
+  std::vector<int> budget;
+  if (tiled) {
+    budget = TileBudgets(img.size(), tracked_kp);
+    if (num_to_keep <= 0 || std::all_of(budget.begin(), budget.end(), [](int b) { return b <= 0; })) {
+      return;
+    }
+  }
+
   // Only detect keypoints that a minimum distance from existing tracked keypoints.
   cv::Mat mask(img.size(), CV_8U, cv::Scalar(255));
   for (size_t i = 0; i < tracked_kp.size(); ++i) {
@@ -99,13 +298,17 @@ void FeatureDetector::Detect(const Image1b& img,
   }
 
   std::vector<cv::KeyPoint> new_kp_cv;
-  feature_detector_->detect(img, new_kp_cv, mask);
 
-  // Apply non-maximal suppression to limit the number of new points that are detected.
-  // Supposedly, this function will achieve a more "even distribution" of features across the image.
-  const int num_to_keep = std::max(0, params_.max_features_per_frame - (int)tracked_kp.size());
+  if (tiled) {
+    DetectTiled(img, mask, budget, num_to_keep, new_kp_cv);
+  } else {
+    feature_detector_->detect(img, new_kp_cv, mask);
+
+    // Apply non-maximal suppression to limit the number of new points that are detected, with a
+    // more even distribution of features across the image.
+    SelectKeypoints(num_to_keep, img.cols, img.rows, new_kp_cv);
+  }
 
-  new_kp_cv = ANMSRangeTree(new_kp_cv, num_to_keep, 0.1f, img.cols, img.rows);
   new_kp = CvKeyPointToPoint(new_kp_cv);
 
   // Optionally do sub-pixel refinement on keypoint locations.
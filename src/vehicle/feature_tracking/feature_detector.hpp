@@ -15,6 +15,11 @@ using namespace core;
 // Different options for the point detection algorithm.
 enum FeatureAlgorithm { FAST, ORB, GFTT, };
 
+// Adaptive non-maximal suppression (see external/anms), which picks the strongest features that
+// are spread out over the image. Both binary search over a suppression width, and each pass is
+// O(n log n) or better.
+enum AnmsAlgorithm { NONE, RANGE_TREE, SSC, };
+
 
 class FeatureDetector final {
  public:
@@ -27,6 +32,34 @@ class FeatureDetector final {
 
     int max_features_per_frame = 200;
 
+    //============================ TILING =================================
+    // If both are > 0, split the image into a tile_rows x tile_cols grid and detect in each tile
+    // (in parallel), keeping the strongest features in each cell. This gives a more uniform spread
+    // of features than the full-image ANMS, and bounds the cost of the selection step.
+    int tile_rows = 0;
+    int tile_cols = 0;
+
+    // Incremental detection (tiled only): a tile is only detected in if it tracks fewer than
+    // incremental_fill_ratio of its share of max_features_per_frame, and at most
+    // incremental_max_tiles (the emptiest ones, 0 = no limit) are detected in per call. If at least
+    // incremental_skip_coverage of the tiles are filled, detection is skipped altogether.
+    bool incremental = false;
+    float incremental_fill_ratio = 0.5;
+    int incremental_max_tiles = 0;
+    float incremental_skip_coverage = 0.9;
+
+    //============================ ANMS ===================================
+    // The detector finds up to anms_candidates_per_feature times more candidates than are needed,
+    // and ANMS keeps the requested number. SSC (suppression via square covering) is the fastest. With
+    // NONE, the detector's strongest candidates are kept as-is.
+    AnmsAlgorithm anms_algorithm = AnmsAlgorithm::SSC;
+    int anms_candidates_per_feature = 10;
+    float anms_tolerance = 0.1;           // ANMS stops within this fraction of the requested number.
+
+    //============================ FAST ===================================
+    // FAST finds a large candidate set much faster than GFTT, and is meant to be used with ANMS.
+    int fast_threshold = 20;
+
     //============================ GFTT ===================================
     int min_distance_btw_tracked_and_detected_features = 20;
     double gftt_quality_level = 0.01;
@@ -54,6 +87,30 @@ class FeatureDetector final {
 
   void Detect(const Image1b& img, const VecPoint2f& tracked_kp, VecPoint2f& new_kp);
 
+  // Change the feature budget at runtime (e.g to shed load).
+  void SetMaxFeaturesPerFrame(int max_features_per_frame);
+  int MaxFeaturesPerFrame() const { return params_.max_features_per_frame; }
+
+  // Keep (at most) num_to_keep of the keypoints, using the ANMS algorithm in params. Candidates
+  // beyond the strongest num_to_keep * anms_candidates_per_feature are dropped first (in O(n)).
+  void SelectKeypoints(int num_to_keep, int cols, int rows, std::vector<cv::KeyPoint>& keypoints) const;
+
+  // How many new features to detect in each tile (row-major), given the tracked keypoints in each.
+  // A zero means that the tile isn't detected in at all. Only valid with tiling enabled.
+  std::vector<int> TileBudgets(const cv::Size& image_size, const VecPoint2f& tracked_kp) const;
+
+ private:
+  // Detect (at most) num_to_keep keypoints using the tile grid in params, with a tile budget from
+  // TileBudgets().
+  void DetectTiled(const Image1b& img,
+                   const cv::Mat& mask,
+                   const std::vector<int>& budget,
+                   int num_to_keep,
+                   std::vector<cv::KeyPoint>& new_kp_cv) const;
+
+  // How many candidates the full-image detector should return.
+  int NumCandidates() const;
+
  private:
   Params params_;
 
@@ -1,18 +1,47 @@
+#include <algorithm>
+
 #include <glog/logging.h>
 #include <opencv2/video/tracking.hpp>
 
+#include "core/async_log.hpp"
 #include "feature_tracking/feature_tracker.hpp"
 
 namespace bm {
 namespace ft {
 
 
+void WarpByRotation(const PinholeCamera& cam,
+                    const Matrix3d& cur_R_ref,
+                    const VecPoint2f& px_ref,
+                    VecPoint2f& px_cur)
+{
+  px_cur.resize(px_ref.size());
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    const Vector3d ray_cur = cur_R_ref * cam.Backproject(Vector2d(px_ref[i].x, px_ref[i].y), 1.0);
+    if (ray_cur.z() <= 1e-3) {
+      px_cur[i] = px_ref[i];
+      continue;
+    }
+    const Vector2d p = cam.Project(ray_cur);
+    px_cur[i] = cv::Point2f(p.x(), p.y());
+  }
+}
+
+
 void FeatureTracker::Params::LoadParams(const YamlParser& parser)
 {
   parser.GetParam("klt_maxiters", &klt_maxiters);
   parser.GetParam("klt_epsilon", &klt_epsilon);
   parser.GetParam("klt_winsize", &klt_winsize);
   parser.GetParam("klt_max_level", &klt_max_level);
+  parser.GetParam("klt_seeded_maxiters", &klt_seeded_maxiters);
+  parser.GetParam("klt_seeded_max_level", &klt_seeded_max_level);
+}
+
+
+ImagePyramid FeatureTracker::BuildPyramid(const Image1b& img) const
+{
+  return ImagePyramid(img, cv::Size2i(params_.klt_winsize, params_.klt_winsize), params_.klt_max_level);
 }
 
 
@@ -24,52 +53,94 @@ void FeatureTracker::Track(const Image1b& ref_img,
                            std::vector<float>& error,
                            bool bidirectional,
                            float fwd_bkw_thresh_px)
+{
+  if (px_ref.empty()) {
+    status.clear();
+    error.clear();
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "No keypoints in reference frame!";
+    return;
+  }
+
+  Track(BuildPyramid(ref_img), BuildPyramid(cur_img), px_ref, px_cur, status, error,
+        bidirectional, fwd_bkw_thresh_px);
+}
+
+
+void FeatureTracker::Track(const ImagePyramid& ref_pyr,
+                           const ImagePyramid& cur_pyr,
+                           const VecPoint2f& px_ref,
+                           VecPoint2f& px_cur,
+                           std::vector<uchar>& status,
+                           std::vector<float>& error,
+                           bool bidirectional,
+                           float fwd_bkw_thresh_px)
 {
   status.clear();
   error.clear();
 
   if (px_ref.empty()) {
-    LOG(WARNING) << "No keypoints in reference frame!" << std::endl;
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "No keypoints in reference frame!";
     return;
   }
 
+  // A seeded initial guess only has to correct a small residual flow.
+  const bool seeded = !px_cur.empty();
+  CHECK(!seeded || px_cur.size() == px_ref.size()) << "Initial guess px_cur must match px_ref" << std::endl;
+
   // Setup termination criteria for optical flow.
   const cv::TermCriteria kTerminationCriteria(
       cv::TermCriteria::COUNT + cv::TermCriteria::EPS,
-      params_.klt_maxiters,
+      seeded ? std::min(params_.klt_seeded_maxiters, params_.klt_maxiters) : params_.klt_maxiters,
       params_.klt_epsilon);
 
+  const int klt_max_level = seeded ? std::min(params_.klt_seeded_max_level, params_.klt_max_level) : params_.klt_max_level;
+
   const cv::Size2i klt_window_size(params_.klt_winsize, params_.klt_winsize);
+  const int max_level = std::min(klt_max_level, std::min(ref_pyr.MaxLevel(), cur_pyr.MaxLevel()));
+  CHECK(ref_pyr.WinSize() == klt_window_size && cur_pyr.WinSize() == klt_window_size)
+      << "Pyramids must be built with the KLT window size" << std::endl;
 
   // If no initial guesses are provided for the optical flow, nitialize px_cur to previous locations.
-  if (px_cur.empty()) {
+  // NOTE(milo): If seeded, start the backward flow from the inverse of the seeded motion. Only the
+  // seeded offset is kept here (px_ref - px_seed), so that px_cur doesn't have to be copied.
+  VecPoint2f px_ref_bkw;
+  if (seeded && bidirectional) {
+    px_ref_bkw.resize(px_cur.size());
+    for (size_t i = 0; i < px_cur.size(); ++i) {
+      px_ref_bkw[i] = px_ref[i] - px_cur[i];
+    }
+  } else if (!seeded) {
     px_cur = px_ref;
   }
 
-  cv::calcOpticalFlowPyrLK(ref_img,
-                           cur_img,
+  cv::calcOpticalFlowPyrLK(ref_pyr.Levels(),
+                           cur_pyr.Levels(),
                            px_ref,
                            px_cur,
                            status,
                            error,
                            klt_window_size,
-                           params_.klt_max_level,
+                           max_level,
                            kTerminationCriteria,
-                           cv::OPTFLOW_USE_INITIAL_FLOW & cv::OPTFLOW_LK_GET_MIN_EIGENVALS,
+                           cv::OPTFLOW_USE_INITIAL_FLOW,
                            0.0001);
 
   if (bidirectional) {
-    VecPoint2f px_ref_bkw;
-    cv::calcOpticalFlowPyrLK(cur_img,
-                            ref_img,
+    if (seeded) {
+      for (size_t i = 0; i < px_cur.size(); ++i) {
+        px_ref_bkw[i] += px_cur[i];
+      }
+    }
+    cv::calcOpticalFlowPyrLK(cur_pyr.Levels(),
+                            ref_pyr.Levels(),
                             px_cur,
                             px_ref_bkw,
                             status,
                             error,
                             klt_window_size,
-                            params_.klt_max_level,
+                            max_level,
                             kTerminationCriteria,
-                            cv::OPTFLOW_USE_INITIAL_FLOW & cv::OPTFLOW_LK_GET_MIN_EIGENVALS,
+                            seeded ? cv::OPTFLOW_USE_INITIAL_FLOW : 0,
                             0.0001);
 
     // Invalidate any points that could be tracked in reverse.
@@ -85,6 +156,7 @@ void FeatureTracker::Track(const Image1b& ref_img,
   }
 
   // Invalidate any points that have tracked out of the image.
+  const Image1b& cur_img = cur_pyr.Image();
   for (size_t i = 0; i < px_cur.size(); ++i) {
     const cv::Point2f& pt = px_cur.at(i);
     if (pt.x <= 0 || pt.x >= cur_img.cols || pt.y <= 0 || pt.y >= cur_img.rows) {
@@ -4,7 +4,10 @@
 
 #include "core/macros.hpp"
 #include "params/params_base.hpp"
+#include "core/eigen_types.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "feature_tracking/image_pyramid.hpp"
 
 namespace bm {
 namespace ft {
@@ -12,6 +15,16 @@ namespace ft {
 using namespace core;
 
 
+// Warp pixels through the infinite homography (pure rotation): p_cur ~ K * cur_R_ref * K^-1 * p_ref.
+// This is a good initial guess for FeatureTracker::Track() when the rotation since the reference
+// image is known (e.g from the gyro). Points that would end up behind the camera keep their
+// reference location.
+void WarpByRotation(const PinholeCamera& cam,
+                    const Matrix3d& cur_R_ref,
+                    const VecPoint2f& px_ref,
+                    VecPoint2f& px_cur);
+
+
 class FeatureTracker final {
  public:
   struct Params final : public ParamsBase
@@ -23,6 +36,11 @@ class FeatureTracker final {
     int klt_winsize = 21;
     int klt_max_level = 4;
 
+    // Used instead of the above when px_cur is seeded with a good initial guess (e.g by warping
+    // through a rotation prior), since the remaining flow is small.
+    int klt_seeded_maxiters = 10;
+    int klt_seeded_max_level = 2;
+
    private:
     void LoadParams(const YamlParser& parser) override;
   };
@@ -34,9 +52,14 @@ class FeatureTracker final {
   // Construct with options.
   explicit FeatureTracker(const Params& params) : params_(params) {}
 
+  // Build the optical flow pyramid for an image, using the window size and levels in params. Build
+  // it once per frame and pass it to Track() to avoid rebuilding it for every call.
+  ImagePyramid BuildPyramid(const Image1b& img) const;
+
   // Track points from ref_img to cur_img using Lucas-Kanade optical flow.
-  // If px_cur is provided, these locations are used as an initial guess for the flow.
-  // Otherwise, points are tracked from their reference locations.
+  // If px_cur is provided, these locations are used as an initial guess for the flow (and only
+  // klt_seeded_max_level and klt_seeded_maxiters are used). Otherwise, points are tracked from
+  // their reference locations.
   void Track(const Image1b& ref_img,
              const Image1b& cur_img,
              const VecPoint2f& px_ref,
@@ -46,6 +69,21 @@ class FeatureTracker final {
              bool bidirectional = false,
              float fwd_bkw_thresh_px = 5.0);
 
+  // Same as above, but with prebuilt pyramids (see BuildPyramid()).
+  void Track(const ImagePyramid& ref_pyr,
+             const ImagePyramid& cur_pyr,
+             const VecPoint2f& px_ref,
+             VecPoint2f& px_cur,
+             std::vector<uchar>& status,
+             std::vector<float>& error,
+             bool bidirectional = false,
+             float fwd_bkw_thresh_px = 5.0);
+
+  // Change the number of pyramid levels at runtime (e.g to shed load). Pyramids that were built
+  // with more levels can still be tracked from.
+  void SetMaxLevel(int klt_max_level) { params_.klt_max_level = klt_max_level; }
+  int MaxLevel() const { return params_.klt_max_level; }
+
  private:
   Params params_;
 };
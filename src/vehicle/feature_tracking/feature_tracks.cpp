@@ -0,0 +1,120 @@
+#include "feature_tracking/feature_tracks.hpp"
+
+namespace bm {
+namespace ft {
+
+
+constexpr size_t FeatureTracks::kMaxObsPerTrack;
+
+
+FeatureTracks::Slot FeatureTracks::AllocateSlot()
+{
+  if (!free_slots_.empty()) {
+    const Slot s = free_slots_.back();
+    free_slots_.pop_back();
+    return s;
+  }
+
+  const Slot s = static_cast<Slot>(lmk_ids_.size());
+  lmk_ids_.emplace_back(0);
+  num_obs_.emplace_back(0);
+  disp_vars_.emplace_back(-1.0);
+  live_index_.emplace_back(0);
+  obs_camera_ids_.resize(obs_camera_ids_.size() + kMaxObsPerTrack);
+  obs_pixels_.resize(obs_pixels_.size() + kMaxObsPerTrack);
+  obs_disps_.resize(obs_disps_.size() + kMaxObsPerTrack);
+  return s;
+}
+
+
+void FeatureTracks::AddObservation(uid_t lmk_id,
+                                   uid_t camera_id,
+                                   const cv::Point2f& pixel,
+                                   double disparity,
+                                   double disparity_var)
+{
+  auto it = slot_map_.find(lmk_id);
+
+  // New track.
+  if (it == slot_map_.end()) {
+    const Slot s = AllocateSlot();
+    lmk_ids_[s] = lmk_id;
+    num_obs_[s] = 0;
+    live_index_[s] = live_slots_.size();
+    live_slots_.emplace_back(s);
+    it = slot_map_.emplace(lmk_id, s).first;
+  }
+
+  const Slot s = it->second;
+  DCHECK(num_obs_[s] == 0 || CameraId(s, 0) < camera_id)
+      << "Observations must be added in order of increasing camera_id" << std::endl;
+
+  const size_t i = s * kMaxObsPerTrack + (num_obs_[s] & kMask);
+  obs_camera_ids_[i] = camera_id;
+  obs_pixels_[i] = pixel;
+  obs_disps_[i] = disparity;
+  disp_vars_[s] = disparity_var;
+  ++num_obs_[s];
+}
+
+
+void FeatureTracks::Remove(uid_t lmk_id)
+{
+  const auto it = slot_map_.find(lmk_id);
+  if (it == slot_map_.end()) {
+    return;
+  }
+
+  const Slot s = it->second;
+  slot_map_.erase(it);
+
+  // Swap-remove from the live list, so that it stays packed.
+  const size_t idx = live_index_[s];
+  const Slot moved = live_slots_.back();
+  live_slots_[idx] = moved;
+  live_index_[moved] = idx;
+  live_slots_.pop_back();
+
+  num_obs_[s] = 0;
+  free_slots_.emplace_back(s);
+}
+
+
+void FeatureTracks::Clear()
+{
+  while (!live_slots_.empty()) {
+    Remove(lmk_ids_[live_slots_.back()]);
+  }
+}
+
+
+bool FeatureTracks::FindObservation(uid_t lmk_id,
+                                    uid_t camera_id,
+                                    cv::Point2f& pixel,
+                                    double& disparity) const
+{
+  const auto it = slot_map_.find(lmk_id);
+  if (it == slot_map_.end()) {
+    return false;
+  }
+
+  const Slot s = it->second;
+  for (size_t k = 0; k < NumStored(s); ++k) {
+    const uid_t cid = CameraId(s, k);
+    if (cid == camera_id) {
+      pixel = Pixel(s, k);
+      disparity = Disparity(s, k);
+      return true;
+    }
+    // Observations are sorted by camera_id, so we can stop early.
+    if (cid < camera_id) {
+      break;
+    }
+  }
+
+  return false;
+}
+
+
+}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/uid.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/landmark_observation.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// Storage for all of the live feature tracks, laid out as a structure-of-arrays. Each track gets a
+// "slot", and stores its last kMaxObsPerTrack observations in a fixed ring inside contiguous
+// camera_id/pixel/disparity arrays. Slots of removed tracks are reused, so once the store has grown
+// to the max number of live tracks, adding observations doesn't allocate.
+//
+// Landmark ids are stable: a track keeps its id (and slot) until it's removed.
+//
+// Usage:
+//  for (const FeatureTracks::Slot s : tracks.LiveSlots()) {
+//    const uid_t lmk_id = tracks.LandmarkId(s);
+//    const cv::Point2f& latest_px = tracks.Pixel(s, 0);
+//  }
+class FeatureTracks final {
+ public:
+  typedef uint32_t Slot;
+
+  // Only this many of the most recent observations are stored for each track.
+  // NOTE(milo): Must be a power of two.
+  static constexpr size_t kMaxObsPerTrack = 16;
+
+  FeatureTracks() = default;
+
+  // Number of live tracks.
+  size_t Size() const { return live_slots_.size(); }
+  bool Empty() const { return live_slots_.empty(); }
+
+  bool Contains(uid_t lmk_id) const { return slot_map_.count(lmk_id) != 0; }
+
+  // Append an observation to a track, creating the track if it doesn't exist yet. Observations of a
+  // track must be added in order of increasing camera_id. If the disparity was fused over several
+  // frames (see InverseDepthFilter), pass its variance too.
+  void AddObservation(uid_t lmk_id,
+                      uid_t camera_id,
+                      const cv::Point2f& pixel,
+                      double disparity,
+                      double disparity_var = -1.0);
+
+  // Remove a track (does nothing if it doesn't exist).
+  void Remove(uid_t lmk_id);
+
+  void Clear();
+
+  // Slots of all live tracks, packed densely for iteration. Removing a track may reorder them.
+  const std::vector<Slot>& LiveSlots() const { return live_slots_; }
+
+  // Get the slot for a landmark. The landmark must exist.
+  Slot GetSlot(uid_t lmk_id) const
+  {
+    CHECK(Contains(lmk_id)) << "Landmark " << lmk_id << " is not in FeatureTracks" << std::endl;
+    return slot_map_.at(lmk_id);
+  }
+
+  uid_t LandmarkId(Slot s) const { return lmk_ids_[s]; }
+
+  // Total number of observations ever added to the track (can be more than are stored).
+  size_t NumObservations(Slot s) const { return num_obs_[s]; }
+
+  // Number of observations that are actually stored (at most kMaxObsPerTrack).
+  size_t NumStored(Slot s) const { return std::min(num_obs_[s], kMaxObsPerTrack); }
+
+  // Access the observation k_ago (k_ago = 0 is the most recent one).
+  uid_t CameraId(Slot s, size_t k_ago) const { return obs_camera_ids_[Index(s, k_ago)]; }
+  const cv::Point2f& Pixel(Slot s, size_t k_ago) const { return obs_pixels_[Index(s, k_ago)]; }
+  double Disparity(Slot s, size_t k_ago) const { return obs_disps_[Index(s, k_ago)]; }
+
+  // Variance (px^2) of the most recent disparity, or negative if it wasn't filtered.
+  double DisparityVariance(Slot s) const { return disp_vars_[s]; }
+
+  LandmarkObservation Observation(Slot s, size_t k_ago) const
+  {
+    return LandmarkObservation(lmk_ids_[s], CameraId(s, k_ago), Pixel(s, k_ago), Disparity(s, k_ago), 0.0, 0.0);
+  }
+
+  // Find the observation of a landmark from camera_id. Returns false if the landmark doesn't exist,
+  // or if that observation isn't stored.
+  bool FindObservation(uid_t lmk_id, uid_t camera_id, cv::Point2f& pixel, double& disparity) const;
+
+ private:
+  static constexpr size_t kMask = kMaxObsPerTrack - 1;
+  static_assert((kMaxObsPerTrack & kMask) == 0, "kMaxObsPerTrack must be a power of two");
+
+  size_t Index(Slot s, size_t k_ago) const
+  {
+    DCHECK_LT(k_ago, NumStored(s)) << "Observation is not stored" << std::endl;
+    return s * kMaxObsPerTrack + ((num_obs_[s] - 1 - k_ago) & kMask);
+  }
+
+  // Get a free slot, growing the arrays if there aren't any.
+  Slot AllocateSlot();
+
+ private:
+  std::unordered_map<uid_t, Slot> slot_map_;
+  std::vector<Slot> free_slots_;
+  std::vector<Slot> live_slots_;
+  std::vector<size_t> live_index_;        // Position of each slot in live_slots_.
+
+  // Per-slot data.
+  std::vector<uid_t> lmk_ids_;
+  std::vector<size_t> num_obs_;
+  std::vector<double> disp_vars_;
+
+  // Per-observation data (kMaxObsPerTrack per slot).
+  std::vector<uid_t> obs_camera_ids_;
+  std::vector<cv::Point2f> obs_pixels_;
+  std::vector<double> obs_disps_;
+};
+
+
+}
+}
@@ -0,0 +1,237 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "feature_tracking/gpu_frontend.hpp"
+#include "feature_tracking/stripe_matcher_gpu.h"
+
+namespace bm {
+namespace ft {
+
+
+constexpr size_t GpuFrontend::kHistory;
+
+
+GpuFrontend::GpuFrontend(const FeatureDetector::Params& detector_params,
+                         const FeatureTracker::Params& tracker_params,
+                         const StereoMatcher::Params& matcher_params)
+    : detector_params_(detector_params),
+      tracker_params_(tracker_params),
+      matcher_params_(matcher_params),
+      stream_(GpuContext::Global().Stream(GpuPriority::VIO_FRONTEND))
+{
+  CHECK_GT(cu::getCudaEnabledDeviceCount(), 0) << "GpuFrontend needs a CUDA device" << std::endl;
+
+  klt_ = cu::SparsePyrLKOpticalFlow::create(
+      cv::Size(tracker_params_.klt_winsize, tracker_params_.klt_winsize),
+      tracker_params_.klt_max_level,
+      tracker_params_.klt_maxiters,
+      true);
+
+  gftt_ = cu::createGoodFeaturesToTrackDetector(
+      CV_8UC1,
+      detector_params_.max_features_per_frame,
+      detector_params_.gftt_quality_level,
+      detector_params_.min_distance_btw_tracked_and_detected_features,
+      detector_params_.gftt_block_size,
+      detector_params_.gftt_use_harris_corner_detector,
+      detector_params_.gftt_k);
+}
+
+
+void GpuFrontend::Upload(uid_t camera_id, const Image1b& left, const Image1b& right)
+{
+  left_ = left;
+  right_ = right;
+
+  // NOTE(milo): The frame comes from the context's pool, so it's never the memory of an image in
+  // d_history_. Another module might have uploaded it on its own stream, so wait for that.
+  GpuContext& context = GpuContext::Global();
+  const GpuStereoFrame::ConstPtr frame = context.UploadStereo(camera_id, left, right, GpuPriority::VIO_FRONTEND);
+  context.WaitFor(stream_, frame->ready);
+  d_left_ = frame->left;
+  d_right_ = frame->right;
+}
+
+
+void GpuFrontend::Push()
+{
+  d_history_.Add(d_left_);
+}
+
+
+void GpuFrontend::UploadPoints(const VecPoint2f& pts, cu::GpuMat& d_pts)
+{
+  const cv::Mat header(1, static_cast<int>(pts.size()), CV_32FC2, const_cast<cv::Point2f*>(pts.data()));
+  d_pts.upload(header, stream_);
+}
+
+
+void GpuFrontend::DownloadPoints(const cu::GpuMat& d_pts, VecPoint2f& pts)
+{
+  pts.resize(d_pts.cols);
+  cv::Mat header(1, d_pts.cols, CV_32FC2, pts.data());
+  d_pts.download(header, stream_);
+}
+
+
+void GpuFrontend::Track(int k_ago,
+                        const VecPoint2f& px_ref,
+                        VecPoint2f& px_cur,
+                        std::vector<uchar>& status,
+                        bool bidirectional,
+                        float fwd_bkw_thresh_px)
+{
+  status.clear();
+  px_cur.clear();
+  if (px_ref.empty()) {
+    return;
+  }
+
+  const cu::GpuMat& d_ref = d_history_.Get(k_ago - 1);
+
+  UploadPoints(px_ref, d_pts_ref_);
+  d_pts_ref_.copyTo(d_pts_cur_, stream_);   // Initial guess is the reference location.
+  klt_->calc(d_ref, d_left_, d_pts_ref_, d_pts_cur_, d_status_, cv::noArray(), stream_);
+
+  VecPoint2f px_ref_bkw;
+  std::vector<uchar> status_bkw;
+  if (bidirectional) {
+    d_pts_cur_.copyTo(d_pts_bkw_, stream_);
+    klt_->calc(d_left_, d_ref, d_pts_cur_, d_pts_bkw_, d_status_bkw_, cv::noArray(), stream_);
+  }
+
+  DownloadPoints(d_pts_cur_, px_cur);
+  status.resize(px_ref.size());
+  cv::Mat status_header(1, static_cast<int>(status.size()), CV_8UC1, status.data());
+  d_status_.download(status_header, stream_);
+
+  if (bidirectional) {
+    DownloadPoints(d_pts_bkw_, px_ref_bkw);
+  }
+
+  stream_.waitForCompletion();
+
+  // Invalidate any points that couldn't be tracked back to where they started.
+  if (bidirectional) {
+    for (size_t i = 0; i < px_ref.size(); ++i) {
+      const float dx = px_ref[i].x - px_ref_bkw[i].x;
+      const float dy = px_ref[i].y - px_ref_bkw[i].y;
+      if ((dx*dx + dy*dy) > fwd_bkw_thresh_px*fwd_bkw_thresh_px) {
+        status[i] = 0;
+      }
+    }
+  }
+
+  // Invalidate any points that have tracked out of the image.
+  for (size_t i = 0; i < px_cur.size(); ++i) {
+    const cv::Point2f& pt = px_cur[i];
+    if (pt.x <= 0 || pt.x >= left_.cols || pt.y <= 0 || pt.y >= left_.rows) {
+      status[i] = 0;
+    }
+  }
+}
+
+
+void GpuFrontend::Detect(const VecPoint2f& tracked_kp, VecPoint2f& new_kp)
+{
+  new_kp.clear();
+
+  const int num_to_keep = std::max(0, detector_params_.max_features_per_frame - (int)tracked_kp.size());
+  if (num_to_keep == 0) {
+    return;
+  }
+
+  // Only detect keypoints that a minimum distance from existing tracked keypoints.
+  cv::Mat mask(left_.size(), CV_8U, cv::Scalar(255));
+  for (const cv::Point2f& pt : tracked_kp) {
+    cv::circle(mask, pt, detector_params_.min_distance_btw_tracked_and_detected_features, cv::Scalar(0), CV_FILLED);
+  }
+  d_mask_.upload(mask, stream_);
+
+  gftt_->detect(d_left_, d_corners_, d_mask_, stream_);
+
+  if (d_corners_.empty()) {
+    stream_.waitForCompletion();
+    return;
+  }
+  DownloadPoints(d_corners_, new_kp);
+  stream_.waitForCompletion();
+
+  // NOTE(milo): Corners come back sorted by decreasing response, so keep the strongest ones.
+  if ((int)new_kp.size() > num_to_keep) {
+    new_kp.resize(num_to_keep);
+  }
+
+  if (detector_params_.subpixel_corners) {
+    cv::TermCriteria term_criteria;
+    term_criteria.type = cv::TermCriteria::EPS + cv::TermCriteria::COUNT;
+    term_criteria.epsilon = detector_params_.subpix_epsilon;
+    term_criteria.maxCount = detector_params_.subpix_maxiters;
+    const cv::Size winsize(detector_params_.subpix_winsize, detector_params_.subpix_winsize);
+    const cv::Size zerozone(detector_params_.subpix_zerozone, detector_params_.subpix_zerozone);
+    cv::cornerSubPix(left_, new_kp, winsize, zerozone, term_criteria);
+  }
+}
+
+
+std::vector<double> GpuFrontend::MatchRectified(const VecPoint2f& left_keypoints)
+{
+  std::vector<double> out(left_keypoints.size(), -1.0);
+
+  const int stripe_rows = matcher_params_.templ_rows + 2;
+  if (left_keypoints.empty() || matcher_params_.max_disp < matcher_params_.templ_cols) {
+    return out;
+  }
+
+  // Window geometry is cheap, so do it on the CPU (the same way as StereoMatcher).
+  std::vector<MatchWindow> windows;
+  std::vector<size_t> indices;
+  std::vector<cv::Vec4i> h_windows;
+  windows.reserve(left_keypoints.size());
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    MatchWindow w;
+    if (ComputeMatchWindow(matcher_params_, left_.size(), right_.size(), left_keypoints[i], w)) {
+      windows.emplace_back(w);
+      indices.emplace_back(i);
+      h_windows.emplace_back(w.templ_rect.x, w.templ_rect.y, w.stripe_rect.x, w.stripe_rect.y);
+    }
+  }
+  if (windows.empty()) {
+    return out;
+  }
+
+  d_windows_.upload(cv::Mat(1, static_cast<int>(h_windows.size()), CV_32SC4, h_windows.data()), stream_);
+  MatchStripesGpu(d_left_, d_right_, d_windows_,
+                  matcher_params_.templ_cols, matcher_params_.templ_rows,
+                  matcher_params_.max_disp, stripe_rows,
+                  d_match_result_, stream_);
+
+  std::vector<cv::Vec4f> h_result(windows.size());
+  cv::Mat result_header(1, static_cast<int>(h_result.size()), CV_32FC4, h_result.data());
+  d_match_result_.download(result_header, stream_);
+  stream_.waitForCompletion();
+
+  const int cost_cols = matcher_params_.max_disp - matcher_params_.templ_cols + 1;
+  for (size_t j = 0; j < windows.size(); ++j) {
+    const cv::Vec4f& r = h_result[j];
+    const int best = static_cast<int>(r[1]);
+    const cv::Point min_loc(best % cost_cols, best / cost_cols);
+
+    float subpixel_dx = 0;
+    if (matcher_params_.parabola_refinement && r[2] >= 0 && r[3] >= 0) {
+      subpixel_dx = ParabolaOffset(r[2], r[0], r[3]);
+    }
+
+    const size_t i = indices[j];
+    out[i] = DisparityFromMatch(matcher_params_, right_, left_keypoints[i], windows[j], r[0], min_loc, subpixel_dx);
+  }
+
+  return out;
+}
+
+
+}
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+
+#ifdef BM_ENABLE_CUDA_FRONTEND
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/cudaoptflow.hpp>
+#endif
+
+#include "core/macros.hpp"
+#include "core/sliding_buffer.hpp"
+#include "core/uid.hpp"
+#include "vision_core/cv_types.hpp"
+#ifdef BM_ENABLE_CUDA_FRONTEND
+#include "vision_core/gpu_context.hpp"
+#endif
+#include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/feature_tracker.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+#ifdef BM_ENABLE_CUDA_FRONTEND
+
+namespace cu = cv::cuda;
+
+
+// CUDA versions of the FeatureDetector (GFTT), FeatureTracker (pyramidal KLT) and StereoMatcher
+// used by StereoTracker. Each stereo pair is uploaded ONCE through the GpuContext (so other GPU
+// modules can share it), and all of the stages for that frame run on the GPU copies, on the
+// highest priority stream. The last few left images are kept on the GPU so that retracking from k
+// frames ago doesn't upload them again.
+//
+// Only built if BM_ENABLE_CUDA_FRONTEND is ON (needs OpenCV with the CUDA modules).
+class GpuFrontend final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(GpuFrontend)
+
+  // Max number of previous left images kept on the GPU.
+  static constexpr size_t kHistory = 8;
+
+  GpuFrontend(const FeatureDetector::Params& detector_params,
+              const FeatureTracker::Params& tracker_params,
+              const StereoMatcher::Params& matcher_params);
+
+  // Upload the current stereo pair. Call this once per frame, before anything else.
+  void Upload(uid_t camera_id, const Image1b& left, const Image1b& right);
+
+  // Track points from the left image k_ago frames ago (k_ago >= 1) into the current left image.
+  void Track(int k_ago,
+             const VecPoint2f& px_ref,
+             VecPoint2f& px_cur,
+             std::vector<uchar>& status,
+             bool bidirectional,
+             float fwd_bkw_thresh_px);
+
+  // Detect new keypoints in the current left image, away from the tracked ones.
+  void Detect(const VecPoint2f& tracked_kp, VecPoint2f& new_kp);
+
+  // Stereo match keypoints from the current left image into the current right image.
+  std::vector<double> MatchRectified(const VecPoint2f& left_keypoints);
+
+  // Save the current left image for tracking in future frames. Call this at the end of each frame.
+  void Push();
+
+ private:
+  void UploadPoints(const VecPoint2f& pts, cu::GpuMat& d_pts);
+  void DownloadPoints(const cu::GpuMat& d_pts, VecPoint2f& pts);
+
+ private:
+  FeatureDetector::Params detector_params_;
+  FeatureTracker::Params tracker_params_;
+  StereoMatcher::Params matcher_params_;
+
+  cu::Stream& stream_;    // Shared VIO_FRONTEND stream from the GpuContext.
+
+  Image1b left_, right_;    // Host copies (the stereo matcher needs them for subpixel refinement).
+  cu::GpuMat d_left_, d_right_, d_mask_;
+  cu::GpuMat d_pts_ref_, d_pts_cur_, d_pts_bkw_, d_status_, d_status_bkw_;
+  cu::GpuMat d_corners_, d_windows_, d_match_result_;
+
+  SlidingBuffer<cu::GpuMat, kHistory> d_history_;
+
+  cv::Ptr<cu::SparsePyrLKOpticalFlow> klt_;
+  cv::Ptr<cu::CornersDetector> gftt_;
+};
+
+#else
+
+// CPU-only build: StereoTracker never constructs a GpuFrontend, so none of these are called.
+class GpuFrontend final {
+ public:
+  void Upload(uid_t, const Image1b&, const Image1b&) {}
+  void Track(int, const VecPoint2f&, VecPoint2f&, std::vector<uchar>&, bool, float) {}
+  void Detect(const VecPoint2f&, VecPoint2f&) {}
+  std::vector<double> MatchRectified(const VecPoint2f&) { return std::vector<double>(); }
+  void Push() {}
+};
+
+#endif
+
+
+}
+}
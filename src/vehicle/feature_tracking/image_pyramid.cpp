@@ -0,0 +1,30 @@
+#include <opencv2/video/tracking.hpp>
+
+#include "feature_tracking/image_pyramid.hpp"
+
+namespace bm {
+namespace ft {
+
+
+ImagePyramid::ImagePyramid(const Image1b& img, const cv::Size& winsize, int max_level)
+    : image_(img), winsize_(winsize)
+{
+  // NOTE(milo): The number of levels can be fewer than requested for small images.
+  max_level_ = cv::buildOpticalFlowPyramid(img, levels_, winsize, max_level, true);
+}
+
+
+cv::Mat ImagePyramid::LevelImage(int level) const
+{
+  if (level == 0) {
+    return image_;
+  }
+
+  // NOTE(milo): The pyramid is built with derivatives, so levels_ holds (image, derivative) pairs.
+  const size_t i = 2 * static_cast<size_t>(level);
+  return (level > 0 && level <= max_level_ && i < levels_.size()) ? levels_.at(i) : cv::Mat();
+}
+
+
+}
+}
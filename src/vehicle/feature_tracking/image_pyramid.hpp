@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// An image along with its optical flow pyramid (and derivatives), built once per frame so that
+// every KLT call that involves the frame can reuse it instead of rebuilding it.
+// NOTE(milo): The pyramid is only valid for calcOpticalFlowPyrLK calls with the same window size
+// that it was built with, and a max level <= MaxLevel().
+class ImagePyramid final {
+ public:
+  ImagePyramid() = default;
+
+  ImagePyramid(const Image1b& img, const cv::Size& winsize, int max_level);
+
+  // Just hold the image, without building any pyramid levels (e.g when tracking on the GPU).
+  explicit ImagePyramid(const Image1b& img) : image_(img) {}
+
+  // The original (full resolution) image.
+  const Image1b& Image() const { return image_; }
+
+  // Pyramid levels in the format expected by calcOpticalFlowPyrLK.
+  const std::vector<cv::Mat>& Levels() const { return levels_; }
+
+  // The image at a pyramid level (level 0 is the original image), or an empty image if that level
+  // wasn't built. Lets other modules (e.g Patchmatch) reuse the pyramid.
+  cv::Mat LevelImage(int level) const;
+
+  const cv::Size& WinSize() const { return winsize_; }
+  int MaxLevel() const { return max_level_; }
+
+  bool Empty() const { return levels_.empty(); }
+
+ private:
+  Image1b image_;
+  std::vector<cv::Mat> levels_;
+  cv::Size winsize_;
+  int max_level_ = 0;
+};
+
+
+}
+}
@@ -0,0 +1,61 @@
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "feature_tracking/inverse_depth_filter.hpp"
+
+namespace bm {
+namespace ft {
+
+
+void InverseDepthFilter::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("enabled", &enabled);
+  parser.GetParam("meas_sigma", &meas_sigma);
+  parser.GetParam("process_sigma", &process_sigma);
+  parser.GetParam("max_sigma", &max_sigma);
+  parser.GetParam("outlier_sigmas", &outlier_sigmas);
+
+  CHECK_GT(meas_sigma, 0);
+  CHECK_GE(process_sigma, 0);
+  CHECK_GE(max_sigma, 0);
+  CHECK_GT(outlier_sigmas, 0);
+}
+
+
+InverseDepthFilter::Estimate InverseDepthFilter::Initialize(double disp) const
+{
+  return Estimate{ disp, params_.meas_sigma * params_.meas_sigma };
+}
+
+
+InverseDepthFilter::Estimate InverseDepthFilter::Predict(const Estimate& e, int frames_ago) const
+{
+  CHECK_GE(frames_ago, 0);
+  return Estimate{ e.disp, e.var + frames_ago * params_.process_sigma * params_.process_sigma };
+}
+
+
+bool InverseDepthFilter::NeedsMatch(const Estimate& predicted) const
+{
+  return predicted.var > params_.max_sigma * params_.max_sigma;
+}
+
+
+InverseDepthFilter::Estimate InverseDepthFilter::Update(const Estimate& predicted, double disp) const
+{
+  const double r = params_.meas_sigma * params_.meas_sigma;
+  const double innovation = disp - predicted.disp;
+  const double S = predicted.var + r;
+
+  if (innovation * innovation > params_.outlier_sigmas * params_.outlier_sigmas * S) {
+    return Initialize(disp);
+  }
+
+  const double K = predicted.var / S;
+  return Estimate{ predicted.disp + K * innovation, (1.0 - K) * predicted.var };
+}
+
+
+}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "params/params_base.hpp"
+#include "core/macros.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// A recursive (1D Kalman) filter on the inverse depth of each tracked landmark, so that the depth
+// from many stereo matches is fused instead of starting over every frame. Stereo disparity is
+// d = fx * B / depth, i.e just the inverse depth scaled by fx * B, and matching noise is constant in
+// pixels, so the filter runs on disparity directly.
+//
+// The tracker doesn't know how the camera translated between frames, so the disparity is predicted
+// to stay the same, with process_sigma of noise per frame. Once enough matches have been fused, the
+// predicted sigma stays under max_sigma for a few frames, and the tracker can skip stereo matching
+// for the landmark until it grows past that again.
+class InverseDepthFilter final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    bool enabled = false;
+    double meas_sigma = 0.5;        // px, noise of a single stereo match.
+    double process_sigma = 0.2;     // px, random walk of the disparity per frame.
+
+    // Skip stereo matching while the predicted sigma of a landmark is at most this (px). Zero always
+    // matches (the disparities are still fused).
+    double max_sigma = 0.4;
+
+    // A match this many (predicted) sigmas away from the prediction restarts the filter from it
+    // (e.g the track jumped to another surface, or the camera moved quickly).
+    double outlier_sigmas = 3.0;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  // Disparity (px) and its variance (px^2).
+  struct Estimate final
+  {
+    double disp;
+    double var;
+  };
+
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(InverseDepthFilter);
+
+  explicit InverseDepthFilter(const Params& params) : params_(params) {}
+
+  bool Enabled() const { return params_.enabled; }
+
+  // Start a landmark from its first stereo match.
+  Estimate Initialize(double disp) const;
+
+  // Predict frames_ago frames ahead of the last estimate.
+  Estimate Predict(const Estimate& e, int frames_ago = 1) const;
+
+  // Whether the predicted estimate is too uncertain to use without a new stereo match.
+  bool NeedsMatch(const Estimate& predicted) const;
+
+  // Fuse a stereo match into the predicted estimate, or restart from it if it's an outlier.
+  Estimate Update(const Estimate& predicted, double disp) const;
+
+ private:
+  Params params_;
+};
+
+
+}
+}
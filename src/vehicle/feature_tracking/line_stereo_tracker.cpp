@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "core/math_util.hpp"
+#include "core/task_scheduler.hpp"
+#include "core/trace.hpp"
+#include "vision_core/line_util.hpp"
+#include "feature_tracking/line_stereo_tracker.hpp"
+
+namespace bm {
+namespace ft {
+
+
+void LineStereoTracker::Params::LoadParams(const YamlParser& parser)
+{
+  algorithm = YamlToEnum<LineAlgorithm>(parser.GetNode("algorithm"));
+  parser.GetParam("detect_level", &detect_level);
+  parser.GetParam("max_lines_per_frame", &max_lines_per_frame);
+  parser.GetParam("min_line_length", &min_line_length);
+  parser.GetParam("max_descriptor_distance", &max_descriptor_distance);
+  parser.GetParam("stereo_max_depth", &stereo_max_depth);
+  parser.GetParam("stereo_min_depth", &stereo_min_depth);
+  parser.GetParam("stereo_max_angle_diff_deg", &stereo_max_angle_diff_deg);
+  parser.GetParam("stereo_min_y_overlap", &stereo_min_y_overlap);
+  parser.GetParam("min_angle_from_horizontal_deg", &min_angle_from_horizontal_deg);
+  parser.GetParam("track_max_angle_diff_deg", &track_max_angle_diff_deg);
+  parser.GetParam("track_max_midpoint_dist", &track_max_midpoint_dist);
+  parser.GetParam("track_min_overlap", &track_min_overlap);
+  parser.GetParam("lost_line_frames", &lost_line_frames);
+
+  CHECK_GE(detect_level, 0);
+  CHECK_GT(max_lines_per_frame, 0);
+  CHECK(stereo_min_depth > 0 && stereo_min_depth < stereo_max_depth);
+  CHECK_GE(lost_line_frames, 0);
+}
+
+
+LineStereoTracker::LineStereoTracker(const Params& params, const StereoCamera& stereo_rig)
+    : params_(params),
+      stereo_rig_(stereo_rig),
+      matcher_(cv::NORM_HAMMING, true)
+{
+  // NOTE(milo): Lines are detected on a single pyramid level, so the descriptor only needs one
+  // octave too.
+  ld::BinaryDescriptor::Params bd_params;
+  bd_params.numOfOctave_ = 1;
+  bd_left_ = ld::BinaryDescriptor::createBinaryDescriptor(bd_params);
+  bd_right_ = ld::BinaryDescriptor::createBinaryDescriptor(bd_params);
+
+  if (params_.algorithm == LineAlgorithm::LSD) {
+    lsd_left_ = ld::LSDDetector::createLSDDetector();
+    lsd_right_ = ld::LSDDetector::createLSDDetector();
+  } else if (params_.algorithm != LineAlgorithm::EDLINES) {
+    throw std::runtime_error("Unsupported line detection algorithm!");
+  }
+}
+
+
+// Angle of the (undirected) line in degrees, in [0, 180).
+static double LineAngleDeg(const ld::KeyLine& kl)
+{
+  double a = RadToDeg(std::atan2(kl.endPointY - kl.startPointY, kl.endPointX - kl.startPointX));
+  a = std::fmod(a + 360.0, 180.0);
+  return a;
+}
+
+
+// Difference between two undirected line angles in degrees, in [0, 90].
+static double AngleDiffDeg(double a, double b)
+{
+  const double d = std::fabs(a - b);
+  return std::min(d, 180.0 - d);
+}
+
+
+static Vector2d StartPoint(const ld::KeyLine& kl) { return Vector2d(kl.startPointX, kl.startPointY); }
+static Vector2d EndPoint(const ld::KeyLine& kl) { return Vector2d(kl.endPointX, kl.endPointY); }
+
+
+// The image at a pyramid level, from the prebuilt pyramid if it has that level.
+static Image1b PyramidLevel(const Image1b& img, const ImagePyramid* pyramid, int level)
+{
+  if (pyramid != nullptr) {
+    const cv::Mat cached = pyramid->LevelImage(level);
+    if (!cached.empty()) {
+      return cached;
+    }
+  }
+
+  Image1b out = img;
+  for (int i = 0; i < level; ++i) {
+    Image1b down;
+    cv::pyrDown(out, down);
+    out = down;
+  }
+  return out;
+}
+
+
+void LineStereoTracker::DetectAndDescribe(const Image1b& level_img,
+                                          const cv::Ptr<ld::LSDDetector>& lsd,
+                                          const cv::Ptr<ld::BinaryDescriptor>& bd,
+                                          std::vector<ld::KeyLine>& keylines,
+                                          cv::Mat& descriptors) const
+{
+  keylines.clear();
+  descriptors.release();
+
+  if (params_.algorithm == LineAlgorithm::LSD) {
+    lsd->detect(level_img, keylines, 1, 1);
+  } else {
+    bd->detect(level_img, keylines);
+  }
+
+  // Keep the longest lines (the others are less repeatable, and can't be triangulated as well).
+  const double scale = static_cast<double>(1 << params_.detect_level);
+  const float min_length = static_cast<float>(params_.min_line_length / scale);
+  keylines.erase(std::remove_if(keylines.begin(), keylines.end(),
+      [min_length](const ld::KeyLine& kl) { return kl.lineLength < min_length; }), keylines.end());
+
+  if ((int)keylines.size() > params_.max_lines_per_frame) {
+    std::nth_element(keylines.begin(), keylines.begin() + params_.max_lines_per_frame, keylines.end(),
+        [](const ld::KeyLine& a, const ld::KeyLine& b) { return a.lineLength > b.lineLength; });
+    keylines.resize(params_.max_lines_per_frame);
+  }
+
+  if (keylines.empty()) {
+    return;
+  }
+
+  // NOTE(milo): The descriptor looks up lines by (class_id, octave), so the ids must be unique.
+  for (size_t i = 0; i < keylines.size(); ++i) {
+    keylines.at(i).class_id = static_cast<int>(i);
+  }
+  bd->compute(level_img, keylines, descriptors);
+
+  for (ld::KeyLine& kl : keylines) {
+    kl.startPointX *= scale;
+    kl.startPointY *= scale;
+    kl.endPointX *= scale;
+    kl.endPointY *= scale;
+    kl.pt *= scale;
+    kl.lineLength *= scale;
+  }
+}
+
+
+bool LineStereoTracker::StereoDisparity(const ld::KeyLine& left,
+                                        const ld::KeyLine& right,
+                                        double& disp_start,
+                                        double& disp_end) const
+{
+  const double angle_left = LineAngleDeg(left);
+  if (AngleDiffDeg(angle_left, 0.0) < params_.min_angle_from_horizontal_deg) {
+    return false;
+  }
+  if (AngleDiffDeg(angle_left, LineAngleDeg(right)) > params_.stereo_max_angle_diff_deg) {
+    return false;
+  }
+
+  // The lines should cover mostly the same rows (epipolar lines).
+  const double yl0 = std::min(left.startPointY, left.endPointY);
+  const double yl1 = std::max(left.startPointY, left.endPointY);
+  const double yr0 = std::min(right.startPointY, right.endPointY);
+  const double yr1 = std::max(right.startPointY, right.endPointY);
+  const double overlap = std::min(yl1, yr1) - std::max(yl0, yr0);
+  if (overlap < params_.stereo_min_y_overlap * std::max(yl1 - yl0, yr1 - yr0)) {
+    return false;
+  }
+
+  // Extend the right line to the rows of the left endpoints, so that the disparity is along the
+  // epipolar lines through them.
+  const LineSegment2d ls_left(left);
+  const LineSegment2d ls_right_ext = ExtrapolateLineSegment(left, right);
+  ComputeEndpointDisparity(ls_left, ls_right_ext, disp_start, disp_end);
+
+  // NOTE(milo): ComputeEndpointDisparity() gives absolute values, so make sure that the right line
+  // is actually to the left (positive disparity).
+  if ((ls_left.p0.x() + ls_left.p1.x()) <= (ls_right_ext.p0.x() + ls_right_ext.p1.x())) {
+    return false;
+  }
+
+  const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
+  const double max_disp = stereo_rig_.DepthToDisp(params_.stereo_min_depth);
+  return disp_start >= min_disp && disp_start <= max_disp &&
+         disp_end >= min_disp && disp_end <= max_disp;
+}
+
+
+std::vector<uid_t> LineStereoTracker::AssignTracks(const std::vector<ld::KeyLine>& keylines,
+                                                   const cv::Mat& descriptors)
+{
+  std::vector<uid_t> line_ids(keylines.size());
+  std::vector<bool> assigned(keylines.size(), false);
+  std::vector<bool> track_seen(tracks_.size(), false);
+
+  if (!tracks_.empty() && !keylines.empty()) {
+    cv::Mat track_descriptors;
+    for (const LineTrack& t : tracks_) {
+      track_descriptors.push_back(t.descriptor);
+    }
+
+    std::vector<cv::DMatch> matches;
+    matcher_.match(descriptors, track_descriptors, matches);
+
+    for (const cv::DMatch& m : matches) {
+      if (m.distance > params_.max_descriptor_distance) {
+        continue;
+      }
+      const ld::KeyLine& cur = keylines.at(m.queryIdx);
+      LineTrack& track = tracks_.at(m.trainIdx);
+
+      if (AngleDiffDeg(LineAngleDeg(cur), LineAngleDeg(track.keyline)) > params_.track_max_angle_diff_deg) {
+        continue;
+      }
+      const Vector2d mid_cur = 0.5 * (StartPoint(cur) + EndPoint(cur));
+      const Vector2d mid_track = 0.5 * (StartPoint(track.keyline) + EndPoint(track.keyline));
+      if ((mid_cur - mid_track).norm() > params_.track_max_midpoint_dist) {
+        continue;
+      }
+      const double overlap = LineSegmentOverlap(StartPoint(cur), EndPoint(cur),
+                                                StartPoint(track.keyline), EndPoint(track.keyline));
+      if (overlap < params_.track_min_overlap) {
+        continue;
+      }
+
+      line_ids.at(m.queryIdx) = track.line_id;
+      assigned.at(m.queryIdx) = true;
+      track_seen.at(m.trainIdx) = true;
+      track.keyline = cur;
+      track.descriptor = descriptors.row(m.queryIdx).clone();
+      track.frames_since_seen = 0;
+    }
+  }
+
+  // Age the tracks that weren't observed, and kill off the ones that have been lost for too long.
+  std::vector<LineTrack> live;
+  live.reserve(tracks_.size() + keylines.size());
+  for (size_t i = 0; i < tracks_.size(); ++i) {
+    LineTrack& t = tracks_.at(i);
+    if (!track_seen.at(i)) {
+      ++t.frames_since_seen;
+    }
+    if (t.frames_since_seen <= params_.lost_line_frames) {
+      live.emplace_back(std::move(t));
+    }
+  }
+
+  // Everything else starts a new track.
+  for (size_t i = 0; i < keylines.size(); ++i) {
+    if (assigned.at(i)) {
+      continue;
+    }
+    line_ids.at(i) = AllocateLineId();
+    live.emplace_back(LineTrack{ line_ids.at(i), keylines.at(i), descriptors.row(i).clone(), 0 });
+  }
+
+  tracks_ = std::move(live);
+  return line_ids;
+}
+
+
+void LineStereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair,
+                                            VecLineObservation& observations,
+                                            const ImagePyramid* left_pyramid)
+{
+  BM_TRACE_SCOPE("LineStereoTracker::TrackAndTriangulate");
+  observations.clear();
+
+  //=========================== DETECTION ======================================
+  // The right image is detected in the background while the left one is done here.
+  std::vector<ld::KeyLine> kl_left, kl_right;
+  cv::Mat desc_left, desc_right;
+
+  TaskScheduler& scheduler = TaskScheduler::Current();
+  TaskGroup right;
+  scheduler.Submit([&]() {
+    const Image1b img = PyramidLevel(stereo_pair.right_image, nullptr, params_.detect_level);
+    DetectAndDescribe(img, lsd_right_, bd_right_, kl_right, desc_right);
+  }, &right, TaskPriority::HIGH);
+
+  const Image1b img_left = PyramidLevel(stereo_pair.left_image, left_pyramid, params_.detect_level);
+  DetectAndDescribe(img_left, lsd_left_, bd_left_, kl_left, desc_left);
+  scheduler.Wait(right);
+
+  //=========================== TRACKING =======================================
+  const std::vector<uid_t> line_ids = AssignTracks(kl_left, desc_left);
+
+  if (kl_left.empty() || kl_right.empty()) {
+    return;
+  }
+
+  //=========================== STEREO MATCHING ================================
+  std::vector<cv::DMatch> matches;
+  matcher_.match(desc_left, desc_right, matches);
+
+  const PinholeCamera& cam = stereo_rig_.LeftCamera();
+
+  for (const cv::DMatch& m : matches) {
+    if (m.distance > params_.max_descriptor_distance) {
+      continue;
+    }
+
+    const ld::KeyLine& left = kl_left.at(m.queryIdx);
+    const ld::KeyLine& right = kl_right.at(m.trainIdx);
+
+    double disp_start, disp_end;
+    if (!StereoDisparity(left, right, disp_start, disp_end)) {
+      continue;
+    }
+
+    const Vector2d ps = StartPoint(left);
+    const Vector2d pe = EndPoint(left);
+    const LineFeature3D camera_line(cam.Backproject(ps, stereo_rig_.DispToDepth(disp_start)),
+                                    cam.Backproject(pe, stereo_rig_.DispToDepth(disp_end)));
+
+    observations.emplace_back(line_ids.at(m.queryIdx),
+                              stereo_pair.camera_id,
+                              LineFeature2D(ps, pe),
+                              disp_start,
+                              disp_end,
+                              camera_line,
+                              m.distance);
+  }
+}
+
+
+}
+}
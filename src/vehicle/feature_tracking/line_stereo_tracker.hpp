@@ -0,0 +1,135 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+#include <opencv2/line_descriptor/descriptor.hpp>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/line_observation.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_image.hpp"
+#include "feature_tracking/image_pyramid.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+// Different options for the line segment detector.
+enum LineAlgorithm { LSD, EDLINES, };
+
+
+// Tracks line segments through a sequence of stereo pairs, alongside the StereoTracker (points).
+// Texture-poor scenes (pilings, hulls) are often edge-rich, so lines can still constrain the pose
+// when there aren't enough good corners. Each frame:
+//  1. Detect lines (LSD or EDLines) in the left and right images, at a pyramid level (reusing the
+//     StereoTracker's KLT pyramid if it's passed in). Left and right run concurrently.
+//  2. Compute LBD descriptors, and match them left-to-right in one batch (mutual best matches).
+//     Matches are checked against the epipolar geometry, and the right line is extrapolated onto
+//     the epipolar lines through the left endpoints to get the endpoint disparities.
+//  3. Match the left lines to the live tracks in one batch, and check that they overlap.
+//
+// NOTE(milo): The stereo pair must be rectified. Lines that are near-horizontal can't be
+// triangulated (their disparity is ambiguous), so they're skipped.
+class LineStereoTracker final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    LineAlgorithm algorithm = LineAlgorithm::LSD;
+
+    // Detect on this level of the image pyramid (0 = full resolution). Each level is about 4x
+    // cheaper, and the endpoints are scaled back up to full resolution afterwards.
+    int detect_level = 1;
+
+    // Keep the longest lines (after the min_line_length filter) from each image.
+    int max_lines_per_frame = 60;
+    double min_line_length = 30.0;          // px, at full resolution.
+
+    // LBD descriptors are 256 bits. Matches with a larger Hamming distance are rejected.
+    int max_descriptor_distance = 60;
+
+    //============================ STEREO ===================================
+    double stereo_max_depth = 30.0;
+    double stereo_min_depth = 0.5;
+    double stereo_max_angle_diff_deg = 5.0;  // Between the left and right lines.
+    double stereo_min_y_overlap = 0.5;       // Fraction of the longer line's vertical extent.
+    double min_angle_from_horizontal_deg = 10.0;
+
+    //============================ TRACKING =================================
+    double track_max_angle_diff_deg = 10.0;
+    double track_max_midpoint_dist = 40.0;   // px, between consecutive observations.
+    double track_min_overlap = 0.3;          // See LineSegmentOverlap().
+
+    // Kill off a track if it hasn't been observed in this many (processed) frames.
+    int lost_line_frames = 3;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(LineStereoTracker);
+
+  LineStereoTracker(const Params& params, const StereoCamera& stereo_rig);
+
+  // Detects, stereo matches and tracks lines, and returns the lines that were triangulated in this
+  // stereo pair. If left_pyramid is the left image's pyramid (e.g StereoTracker::CurrentPyramid()),
+  // its detect_level is reused. Otherwise (or if that level wasn't built) it's built here.
+  void TrackAndTriangulate(const StereoImage1b& stereo_pair,
+                           VecLineObservation& observations,
+                           const ImagePyramid* left_pyramid = nullptr);
+
+  // Check a left-right line match against the epipolar geometry, and if it's valid, get the
+  // disparity at each endpoint of the left line.
+  bool StereoDisparity(const ld::KeyLine& left,
+                       const ld::KeyLine& right,
+                       double& disp_start,
+                       double& disp_end) const;
+
+  size_t NumLiveTracks() const { return tracks_.size(); }
+
+ private:
+  struct LineTrack final
+  {
+    uid_t line_id;
+    ld::KeyLine keyline;      // At full resolution.
+    cv::Mat descriptor;       // One row.
+    int frames_since_seen;
+  };
+
+  // Detect lines (and compute their descriptors) in a pyramid level image. The keylines are scaled
+  // up to full resolution.
+  void DetectAndDescribe(const Image1b& level_img,
+                         const cv::Ptr<ld::LSDDetector>& lsd,
+                         const cv::Ptr<ld::BinaryDescriptor>& bd,
+                         std::vector<ld::KeyLine>& keylines,
+                         cv::Mat& descriptors) const;
+
+  // Match the current left lines to the live tracks, and assign each one a line id.
+  std::vector<uid_t> AssignTracks(const std::vector<ld::KeyLine>& keylines, const cv::Mat& descriptors);
+
+  uid_t AllocateLineId() { return next_line_id_++; }
+
+ private:
+  Params params_;
+  StereoCamera stereo_rig_;
+
+  uid_t next_line_id_ = 0;
+
+  // NOTE(milo): The detectors and descriptors aren't thread-safe, so the left and right images each
+  // get their own.
+  cv::Ptr<ld::LSDDetector> lsd_left_, lsd_right_;
+  cv::Ptr<ld::BinaryDescriptor> bd_left_, bd_right_;
+  cv::BFMatcher matcher_;
+
+  std::vector<LineTrack> tracks_;
+};
+
+
+}
+}
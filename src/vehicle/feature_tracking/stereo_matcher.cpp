@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
 #include <glog/logging.h>
 
+#include <opencv2/core/utility.hpp>
 #include "opencv2/imgproc/imgproc.hpp"
 
 #include "feature_tracking/stereo_matcher.hpp"
@@ -16,28 +21,55 @@ void StereoMatcher::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("max_matching_cost", &max_matching_cost);
   parser.GetParam("bidirectional", &bidirectional);
   parser.GetParam("subpixel_refinement", &subpixel_refinement);
+  parser.GetParam("parabola_refinement", &parabola_refinement);
+  parser.GetParam("parallel", &parallel);
+  parser.GetParam("predicted_disp_window", &predicted_disp_window);
+
+  CHECK_GE(predicted_disp_window, 0);
 }
 
 
-double StereoMatcher::MatchRectified(const Image1b& left_rectified,
-                                     const Image1b& right_rectified,
-                                     const cv::Point2f& left_keypoint)
+// Scales an odd window size, and keeps it odd (and at least 3).
+static int RescaleOddWindow(int size, double scale)
+{
+  return std::max(3, 2 * static_cast<int>(std::lround(0.5 * (size - 1) * scale)) + 1);
+}
+
+
+StereoMatcher::Params StereoMatcher::Params::Rescaled(double scale) const
+{
+  CHECK_GT(scale, 0);
+
+  Params params = *this;
+  params.templ_cols = RescaleOddWindow(templ_cols, scale);
+  params.templ_rows = RescaleOddWindow(templ_rows, scale);
+  params.max_disp = static_cast<int>(std::ceil(max_disp * scale));
+  params.predicted_disp_window = static_cast<int>(std::lround(predicted_disp_window * scale));
+  return params;
+}
+
+
+bool ComputeMatchWindow(const StereoMatcher::Params& params,
+                        const cv::Size& left_size,
+                        const cv::Size& right_size,
+                        const cv::Point2f& left_keypoint,
+                        MatchWindow& window)
 {
   // Add +/- 1 extra pixel to the stripe to account for rectification error.
-  const int stripe_rows = params_.templ_rows + 2;
+  const int stripe_rows = params.templ_rows + 2;
 
   const int rounded_lkp_x = round(left_keypoint.x);
   const int rounded_lkp_y = round(left_keypoint.y);
 
-  int templ_topleft_y = rounded_lkp_y - (params_.templ_rows - 1) / 2;  // y-component of upper left corner of template
+  int templ_topleft_y = rounded_lkp_y - (params.templ_rows - 1) / 2;  // y-component of upper left corner of template
 
   // Template exceeds top or bottom of the image, return no match.
-  if (templ_topleft_y < 0 || (templ_topleft_y + params_.templ_rows) >= left_rectified.rows) {
-    return -1.0;
+  if (templ_topleft_y < 0 || (templ_topleft_y + params.templ_rows) >= left_size.height) {
+    return false;
   }
 
   int offset_x = 0;
-  int templ_topleft_x = rounded_lkp_x - (params_.templ_cols - 1) / 2;
+  int templ_topleft_x = rounded_lkp_x - (params.templ_cols - 1) / 2;
 
   // If the template goes off the left side of hte image, move it to the right until it's inside.
   if (templ_topleft_x < 0) {
@@ -46,55 +78,135 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
   }
 
   // If the template goes off the right side of the image, move it to the left until it's inside.
-  if ((templ_topleft_x + params_.templ_cols) >= left_rectified.cols) {
+  if ((templ_topleft_x + params.templ_cols) >= left_size.width) {
     if (offset_x != 0) {
       LOG(FATAL) << "offset_x exceeds left AND right bounds! This is probably a bug." << std::endl;
     }
-    offset_x = (templ_topleft_x + params_.templ_cols) - (left_rectified.cols - 1);
+    offset_x = (templ_topleft_x + params.templ_cols) - (left_size.width - 1);
     templ_topleft_x -= offset_x;
   }
 
-  // Grab the local image patch around the keypoint.
-  cv::Rect template_rect = cv::Rect(templ_topleft_x, templ_topleft_y, params_.templ_cols, params_.templ_rows);
-  cv::Mat patch(left_rectified, template_rect);
-
   // Get a horizontal "stripe" from the right image to match against.
   const int stripe_corner_y = rounded_lkp_y - (stripe_rows - 1) / 2;
 
   // Stripe goes off the top/bottom of the image, return no match.
-  if (stripe_corner_y < 0 || (stripe_corner_y + stripe_rows) >= right_rectified.rows) {
-    return -1.0;
+  if (stripe_corner_y < 0 || (stripe_corner_y + stripe_rows) >= right_size.height) {
+    return false;
   }
   int offset_stripe = 0;
-  int stripe_corner_x = rounded_lkp_x + (params_.templ_cols - 1) / 2 - params_.max_disp;
-  if (stripe_corner_x + params_.max_disp > right_rectified.cols - 1) {
-    offset_stripe = (stripe_corner_x + params_.max_disp) - (right_rectified.cols - 1);
+  int stripe_corner_x = rounded_lkp_x + (params.templ_cols - 1) / 2 - params.max_disp;
+  if (stripe_corner_x + params.max_disp > right_size.width - 1) {
+    offset_stripe = (stripe_corner_x + params.max_disp) - (right_size.width - 1);
     stripe_corner_x -= offset_stripe;
   }
   if (stripe_corner_x < 0) {
     stripe_corner_x = 0;
   }
 
-  cv::Rect stripe_rect = cv::Rect(stripe_corner_x, stripe_corner_y, params_.max_disp, stripe_rows);
-  cv::Mat stripe(right_rectified, stripe_rect);
+  window.templ_rect = cv::Rect(templ_topleft_x, templ_topleft_y, params.templ_cols, params.templ_rows);
+  window.stripe_rect = cv::Rect(stripe_corner_x, stripe_corner_y, params.max_disp, stripe_rows);
+  window.offset_x = offset_x;
+  return true;
+}
 
-  cv::Mat result;
-  cv::matchTemplate(stripe, patch, result, CV_TM_SQDIFF_NORMED);
 
-  // Find the location of best match.
-  double minVal;
-  double maxVal;
-  cv::Point minLoc;
-  cv::Point maxLoc;
-  cv::minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc, cv::Mat());
+bool NarrowMatchWindow(const StereoMatcher::Params& params,
+                       double predicted_disp,
+                       MatchWindow& window)
+{
+  const int half_cols = (params.templ_cols - 1) / 2;
+  const int d = static_cast<int>(std::round(predicted_disp));
+  const int d_lo = std::max(0, d - params.predicted_disp_window);
+  const int d_hi = d + params.predicted_disp_window;
 
-  cv::Point matchLoc = minLoc;
-  matchLoc.x += stripe_corner_x + (params_.templ_cols - 1) / 2 + offset_x;
-  matchLoc.y += stripe_corner_y + (params_.templ_rows - 1) / 2;
-  cv::Point2f match_px(matchLoc.x, matchLoc.y);
+  // The template is centered at templ_center in the left image, so a disparity of d puts its
+  // center at templ_center - d in the right image.
+  const int templ_center = window.templ_rect.x + half_cols;
+  const cv::Rect narrow(templ_center - d_hi - half_cols, window.stripe_rect.y,
+                        (d_hi - d_lo) + params.templ_cols, window.stripe_rect.height);
+
+  const cv::Rect stripe = narrow & window.stripe_rect;
+  if (stripe.width < params.templ_cols) {
+    return false;
+  }
+
+  window.stripe_rect = stripe;
+  return true;
+}
+
+
+float ParabolaOffset(float c_left, float c_center, float c_right)
+{
+  const float denom = c_left - 2.0f*c_center + c_right;
+  if (denom <= 0) {
+    return 0.0f;
+  }
+  return std::max(-0.5f, std::min(0.5f, 0.5f * (c_left - c_right) / denom));
+}
+
+
+// Computes the same cost as cv::matchTemplate(stripe, patch, cost, CV_TM_SQDIFF_NORMED), but with
+// exact integer sums, and without allocating once "cost" has grown large enough. The cost is
+// stored row-major with "cost_cols" columns.
+static void SqdiffNormed(const cv::Mat& stripe,
+                         const cv::Mat& patch,
+                         std::vector<float>& cost,
+                         int& cost_cols)
+{
+  const int tc = patch.cols;
+  const int tr = patch.rows;
+  cost_cols = stripe.cols - tc + 1;
+  const int cost_rows = stripe.rows - tr + 1;
+  cost.resize(cost_cols * cost_rows);
+
+  int64_t sum_t2 = 0;
+  for (int r = 0; r < tr; ++r) {
+    const uchar* t = patch.ptr<uchar>(r);
+    for (int c = 0; c < tc; ++c) {
+      sum_t2 += int(t[c]) * int(t[c]);
+    }
+  }
+
+  for (int y = 0; y < cost_rows; ++y) {
+    for (int x = 0; x < cost_cols; ++x) {
+      // NOTE(milo): These inner loops are contiguous uchar math, which the compiler vectorizes with
+      // -O3 -march=native. 255^2 * templ_cols * templ_rows fits in an int for any sane template.
+      int ssd = 0;
+      int sum_i2 = 0;
+      for (int r = 0; r < tr; ++r) {
+        const uchar* s = stripe.ptr<uchar>(y + r) + x;
+        const uchar* t = patch.ptr<uchar>(r);
+        for (int c = 0; c < tc; ++c) {
+          const int d = int(s[c]) - int(t[c]);
+          ssd += d*d;
+          sum_i2 += int(s[c]) * int(s[c]);
+        }
+      }
+
+      // Normalize the same way that OpenCV does (costs are clamped to 1).
+      const double denom = std::sqrt(static_cast<double>(sum_i2) * static_cast<double>(sum_t2));
+      const double num = static_cast<double>(ssd);
+      cost[y*cost_cols + x] = static_cast<float>((num < denom) ? (num / denom) : 1.0);
+    }
+  }
+}
+
+
+double DisparityFromMatch(const StereoMatcher::Params& params,
+                          const Image1b& right_rectified,
+                          const cv::Point2f& left_keypoint,
+                          const MatchWindow& window,
+                          double min_val,
+                          const cv::Point& min_loc,
+                          float subpixel_dx)
+{
+  cv::Point matchLoc = min_loc;
+  matchLoc.x += window.stripe_rect.x + (params.templ_cols - 1) / 2 + window.offset_x;
+  matchLoc.y += window.stripe_rect.y + (params.templ_rows - 1) / 2;
+  cv::Point2f match_px(matchLoc.x + subpixel_dx, matchLoc.y);
 
   // Refine keypoint with subpixel accuracy.
-  if (params_.subpixel_refinement) {
+  if (params.subpixel_refinement) {
     static const cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 40, 0.001);
     static const cv::Size winSize(10, 10);
     static const cv::Size zeroZone(-1, -1);
@@ -104,7 +216,7 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
     match_px = corner.at(0);
   }
 
-  const bool has_good_matching_score = minVal < params_.max_matching_cost;
+  const bool has_good_matching_score = min_val < params.max_matching_cost;
   const bool match_is_to_the_left = left_keypoint.x >= match_px.x;
 
   if (has_good_matching_score && match_is_to_the_left) {
@@ -116,14 +228,139 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
 }
 
 
+double StereoMatcher::MatchRectified(const Image1b& left_rectified,
+                                     const Image1b& right_rectified,
+                                     const cv::Point2f& left_keypoint)
+{
+  MatchWindow window;
+  if (!ComputeMatchWindow(params_, left_rectified.size(), right_rectified.size(), left_keypoint, window)) {
+    return -1.0;
+  }
+
+  // Grab the local image patch around the keypoint, and the stripe from the right image.
+  cv::Mat patch(left_rectified, window.templ_rect);
+  cv::Mat stripe(right_rectified, window.stripe_rect);
+
+  cv::Mat result;
+  cv::matchTemplate(stripe, patch, result, CV_TM_SQDIFF_NORMED);
+
+  // Find the location of best match.
+  double minVal;
+  double maxVal;
+  cv::Point minLoc;
+  cv::Point maxLoc;
+  cv::minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc, cv::Mat());
+
+  float subpixel_dx = 0;
+  if (params_.parabola_refinement && minLoc.x > 0 && minLoc.x < (result.cols - 1)) {
+    const float* row = result.ptr<float>(minLoc.y);
+    subpixel_dx = ParabolaOffset(row[minLoc.x - 1], row[minLoc.x], row[minLoc.x + 1]);
+  }
+
+  return DisparityFromMatch(params_, right_rectified, left_keypoint, window, minVal, minLoc, subpixel_dx);
+}
+
+
+// Best match of the template within window.stripe_rect. Sets "on_edge" if the minimum is at either
+// end of the stripe (so the true minimum might be outside of it).
+static double MatchInWindow(const StereoMatcher::Params& params,
+                            const Image1b& left_rectified,
+                            const Image1b& right_rectified,
+                            const cv::Point2f& left_keypoint,
+                            const MatchWindow& window,
+                            std::vector<float>& cost,
+                            bool& on_edge)
+{
+  on_edge = false;
+  const cv::Mat patch(left_rectified, window.templ_rect);
+  const cv::Mat stripe(right_rectified, window.stripe_rect);
+
+  if (stripe.cols < patch.cols || stripe.rows < patch.rows) {
+    return -1.0;
+  }
+
+  int cost_cols = 0;
+  SqdiffNormed(stripe, patch, cost, cost_cols);
+
+  // Find the FIRST minimum in row-major order (same as cv::minMaxLoc).
+  size_t min_idx = 0;
+  for (size_t i = 1; i < cost.size(); ++i) {
+    if (cost[i] < cost[min_idx]) {
+      min_idx = i;
+    }
+  }
+  const cv::Point min_loc(static_cast<int>(min_idx) % cost_cols, static_cast<int>(min_idx) / cost_cols);
+  on_edge = (min_loc.x == 0 || min_loc.x == (cost_cols - 1));
+
+  float subpixel_dx = 0;
+  if (params.parabola_refinement && min_loc.x > 0 && min_loc.x < (cost_cols - 1)) {
+    subpixel_dx = ParabolaOffset(cost[min_idx - 1], cost[min_idx], cost[min_idx + 1]);
+  }
+
+  return DisparityFromMatch(params, right_rectified, left_keypoint, window, cost[min_idx], min_loc, subpixel_dx);
+}
+
+
+// Same as StereoMatcher::MatchRectified() for a single keypoint, but without cv::matchTemplate.
+// If predicted_disp >= 0, tries a narrow window around it first. The "cost" vector is scratch
+// space that gets reused across keypoints.
+static double MatchRectifiedSqdiff(const StereoMatcher::Params& params,
+                                   const Image1b& left_rectified,
+                                   const Image1b& right_rectified,
+                                   const cv::Point2f& left_keypoint,
+                                   double predicted_disp,
+                                   std::vector<float>& cost)
+{
+  MatchWindow window;
+  if (!ComputeMatchWindow(params, left_rectified.size(), right_rectified.size(), left_keypoint, window)) {
+    return -1.0;
+  }
+
+  bool on_edge = false;
+  MatchWindow narrow = window;
+  if (predicted_disp >= 0 && params.predicted_disp_window > 0 && NarrowMatchWindow(params, predicted_disp, narrow)) {
+    const double disp = MatchInWindow(params, left_rectified, right_rectified, left_keypoint, narrow, cost, on_edge);
+    if (disp >= 0 && !on_edge) {
+      return disp;
+    }
+  }
+
+  return MatchInWindow(params, left_rectified, right_rectified, left_keypoint, window, cost, on_edge);
+}
+
+
 std::vector<double> StereoMatcher::MatchRectified(const Image1b& left_rectified,
                                                   const Image1b& right_rectified,
                                                   const VecPoint2f& left_keypoints)
 {
+  return MatchRectified(left_rectified, right_rectified, left_keypoints,
+                        std::vector<double>(left_keypoints.size(), -1.0));
+}
+
+
+std::vector<double> StereoMatcher::MatchRectified(const Image1b& left_rectified,
+                                                  const Image1b& right_rectified,
+                                                  const VecPoint2f& left_keypoints,
+                                                  const std::vector<double>& predicted_disps)
+{
+  CHECK_EQ(left_keypoints.size(), predicted_disps.size());
   std::vector<double> out(left_keypoints.size(), -1.0);
 
-  for (size_t i = 0; i < left_keypoints.size(); ++i) {
-    out.at(i) = MatchRectified(left_rectified, right_rectified, left_keypoints.at(i));
+  const Params& params = params_;
+  const auto match_range = [&](const cv::Range& range)
+  {
+    std::vector<float> cost;
+    for (int i = range.start; i < range.end; ++i) {
+      out[i] = MatchRectifiedSqdiff(params, left_rectified, right_rectified, left_keypoints[i],
+                                    predicted_disps[i], cost);
+    }
+  };
+
+  const cv::Range all(0, static_cast<int>(left_keypoints.size()));
+  if (params_.parallel) {
+    cv::parallel_for_(all, match_range);
+  } else {
+    match_range(all);
   }
 
   return out;
@@ -24,6 +24,17 @@ class StereoMatcher final {
     double max_matching_cost = 0.15;    // Maximum matching cost considered valid
     bool bidirectional = false;
     bool subpixel_refinement = false;
+    bool parabola_refinement = false;   // Fit a parabola to the costs around the best match
+    bool parallel = false;              // Match keypoints in parallel (batched version only)
+
+    // When a keypoint comes with a predicted disparity (e.g from the previous frame of its track),
+    // only search +/- this many pixels around it. If the best match is bad, or lands on the edge of
+    // the narrow window, the keypoint falls back to the full [0, max_disp] search.
+    int predicted_disp_window = 8;
+
+    // The same params for images that are scale times the size (e.g 0.5 for half resolution). The
+    // disparity range and windows are in pixels, so they're scaled too (templates stay odd).
+    Params Rescaled(double scale) const;
 
    private:
     void LoadParams(const YamlParser& parser) override;
@@ -39,14 +50,62 @@ class StereoMatcher final {
                         const Image1b& right_rectified,
                         const cv::Point2f& left_keypoint);
 
-  // Match a set of keypoints in the left image (calls member function above).
+  // Match a set of keypoints in the left image. This gives the same result as calling the function
+  // above for each keypoint, but computes the matching cost directly with integer SSD (no
+  // cv::matchTemplate, no allocation per keypoint), and can optionally run in parallel.
   std::vector<double> MatchRectified(const Image1b& left_rectified,
                                      const Image1b& right_rectified,
                                      const VecPoint2f& left_keypoints);
 
+  // Same as above, but keypoints with a predicted_disps >= 0 are first matched in a narrow window
+  // around it (see predicted_disp_window). Negative predictions get the full search.
+  std::vector<double> MatchRectified(const Image1b& left_rectified,
+                                     const Image1b& right_rectified,
+                                     const VecPoint2f& left_keypoints,
+                                     const std::vector<double>& predicted_disps);
+
  private:
   Params params_;
 };
 
+
+// Where to take the template (left image) and the search stripe (right image) from.
+struct MatchWindow final
+{
+  cv::Rect templ_rect;
+  cv::Rect stripe_rect;
+  int offset_x = 0;
+};
+
+
+// Returns false if the template or stripe goes off the top/bottom of the image (no match).
+bool ComputeMatchWindow(const StereoMatcher::Params& params,
+                        const cv::Size& left_size,
+                        const cv::Size& right_size,
+                        const cv::Point2f& left_keypoint,
+                        MatchWindow& window);
+
+
+// Shrinks the stripe of a window from ComputeMatchWindow() so that it only covers disparities in
+// [predicted_disp - predicted_disp_window, predicted_disp + predicted_disp_window]. Returns false if
+// that range doesn't overlap the full stripe (use the full window instead).
+bool NarrowMatchWindow(const StereoMatcher::Params& params,
+                       double predicted_disp,
+                       MatchWindow& window);
+
+
+// Sub-pixel offset of the minimum of a parabola through three neighboring costs, in [-0.5, 0.5].
+float ParabolaOffset(float c_left, float c_center, float c_right);
+
+
+// Turn the best match location in the stripe into a disparity (or -1 if the match is bad).
+double DisparityFromMatch(const StereoMatcher::Params& params,
+                          const Image1b& right_rectified,
+                          const cv::Point2f& left_keypoint,
+                          const MatchWindow& window,
+                          double min_val,
+                          const cv::Point& min_loc,
+                          float subpixel_dx);
+
 }
 }
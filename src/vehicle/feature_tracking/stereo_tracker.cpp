@@ -1,11 +1,17 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <glog/logging.h>
 
 #include <opencv2/imgproc.hpp>
 
 #include "vision_core/image_util.hpp"
 #include "core/math_util.hpp"
-#include "feature_tracking/visualization_2d.hpp"
+#include "core/task_scheduler.hpp"
+#include "core/trace.hpp"
 #include "feature_tracking/stereo_tracker.hpp"
+#include "feature_tracking/gpu_frontend.hpp"
 
 namespace bm {
 namespace ft {
@@ -17,98 +23,295 @@ void StereoTracker::Params::LoadParams(const YamlParser& parser)
   detector_params = FeatureDetector::Params(parser.GetNode("FeatureDetector"));
   tracker_params = FeatureTracker::Params(parser.GetNode("FeatureTracker"));
   matcher_params = StereoMatcher::Params(parser.GetNode("StereoMatcher"));
+  depth_filter_params = InverseDepthFilter::Params(parser.GetNode("InverseDepthFilter"));
 
   parser.GetParam("stereo_max_depth", &stereo_max_depth);
   parser.GetParam("stereo_min_depth", &stereo_min_depth);
   parser.GetParam("retrack_frames_k", &retrack_frames_k);
   parser.GetParam("trigger_keyframe_min_lmks", &trigger_keyframe_min_lmks);
   parser.GetParam("trigger_keyframe_k", &trigger_keyframe_k);
+  parser.GetParam("trigger_keyframe_min_parallax", &trigger_keyframe_min_parallax);
+  parser.GetParam("trigger_keyframe_max_k", &trigger_keyframe_max_k);
+  parser.GetParam("pipelined", &pipelined);
+  parser.GetParam("use_gpu", &use_gpu);
+  parser.GetParam("klt_rotation_prior", &klt_rotation_prior);
+  parser.GetParam("dense_max_cost", &dense_max_cost);
+
+  CHECK(retrack_frames_k >= 1 && retrack_frames_k < StereoTracker::kMaxRetrackFrames);
+
+  // NOTE(milo): StereoFrontend looks up each track's observation from the last keyframe, so it must
+  // still be stored.
+  CHECK(trigger_keyframe_k >= 1 && trigger_keyframe_k < (int)FeatureTracks::kMaxObsPerTrack);
+  CHECK(trigger_keyframe_max_k >= trigger_keyframe_k && trigger_keyframe_max_k < (int)FeatureTracks::kMaxObsPerTrack);
+}
+
 
-  CHECK(retrack_frames_k >= 1 && retrack_frames_k < 8);
+StereoTracker::StereoTracker(const Params& params, const StereoCamera& stereo_rig)
+    : params_(params),
+      stereo_rig_(stereo_rig),
+      detector_(params.detector_params),
+      matcher_(params.matcher_params),
+      tracker_(params.tracker_params),
+      depth_filter_(params.depth_filter_params),
+      lmk_wheel_(params.retrack_frames_k)
+{
+  if (params_.use_gpu) {
+#ifdef BM_ENABLE_CUDA_FRONTEND
+    gpu_.reset(new GpuFrontend(params_.detector_params, params_.tracker_params, params_.matcher_params));
+#else
+    LOG(WARNING) << "StereoTracker: use_gpu is set, but BM_ENABLE_CUDA_FRONTEND is OFF. Using the CPU." << std::endl;
+#endif
+  }
 }
 
 
-bool StereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair, bool force_keyframe)
+// NOTE(milo): Defined here so that GpuFrontend is a complete type.
+StereoTracker::~StereoTracker() {}
+
+
+std::vector<double> StereoTracker::MatchRectified(const StereoImage1b& stereo_pair,
+                                                  const VecPoint2f& left_pts,
+                                                  const DisparityMap* dense,
+                                                  const std::vector<double>* predicted_disps)
 {
-  std::unordered_map<int, std::vector<uid_t>> live_lmk_ids_k_ago;
-  std::unordered_map<int, VecPoint2f> live_lmk_pts_k_ago;
-  for (int k = 0; k <= params_.retrack_frames_k; ++k) {
-    live_lmk_ids_k_ago.emplace(k, std::vector<uid_t>());
-    live_lmk_pts_k_ago.emplace(k, VecPoint2f());
+  // NOTE(milo): The GPU matcher always does the full search, since one thread block per keypoint
+  // already covers the stripe in a single pass.
+  const auto match = [&](const VecPoint2f& pts, const std::vector<double>* predicted)
+  {
+    if (gpu_) {
+      return gpu_->MatchRectified(pts);
+    }
+    return predicted ? matcher_.MatchRectified(stereo_pair.left_image, stereo_pair.right_image, pts, *predicted) :
+                       matcher_.MatchRectified(stereo_pair.left_image, stereo_pair.right_image, pts);
+  };
+
+  if (dense == nullptr) {
+    return match(left_pts, predicted_disps);
+  }
+
+  std::vector<double> disps = QueryDisparity(*dense, left_pts, params_.dense_max_cost);
+
+  // Only fall back to the matcher for the points that the dense map couldn't answer.
+  std::vector<size_t> missing;
+  VecPoint2f missing_pts;
+  std::vector<double> missing_predicted;
+  for (size_t i = 0; i < disps.size(); ++i) {
+    if (disps.at(i) < 0) {
+      missing.emplace_back(i);
+      missing_pts.emplace_back(left_pts.at(i));
+      missing_predicted.emplace_back(predicted_disps ? predicted_disps->at(i) : -1.0);
+    }
+  }
+
+  if (!missing_pts.empty()) {
+    const std::vector<double> missing_disps = match(missing_pts, predicted_disps ? &missing_predicted : nullptr);
+    for (size_t j = 0; j < missing.size(); ++j) {
+      disps.at(missing.at(j)) = missing_disps.at(j);
+    }
   }
 
-  for (const auto& item : live_tracks_) {
-    const uid_t lmk_id = item.first;
+  return disps;
+}
+
 
-    // NOTE(milo): Observations are sorted in order of INCREASING camera_id, so the last
-    // observation is the most recent.
-    const VecLmkObs& observations = item.second;
-    CHECK(!observations.empty());
+bool StereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair,
+                                        bool force_keyframe,
+                                        const Matrix3d& prev_R_cur,
+                                        const DisparityMap* dense)
+{
+  BM_TRACE_SCOPE("StereoTracker::TrackAndTriangulate");
+
+  arena_.Reset();
+
+  //========================== GARBAGE COLLECTION ==============================
+  // Kill off any tracks that haven't been seen in retrack_frames_k frames. They couldn't be
+  // retracked in this frame anyway.
+  KillOffLostLandmarks();
+
+  const size_t num_k = params_.retrack_frames_k + 1;
+  ArenaVector<ArenaVector<uid_t>> live_lmk_ids_k_ago(num_k, ArenaVector<uid_t>(arena_), arena_);
+  ArenaVector<ArenaVector<double>> live_lmk_disps_k_ago(num_k, ArenaVector<double>(arena_), arena_);
+  ArenaVector<ArenaVector<double>> live_lmk_vars_k_ago(num_k, ArenaVector<double>(arena_), arena_);
+  live_lmk_pts_k_ago_.resize(num_k);
+  live_lmk_pts_cur_k_ago_.resize(num_k);
+  status_k_ago_.resize(num_k);
+  error_k_ago_.resize(num_k);
+  for (size_t k = 0; k < num_k; ++k) {
+    live_lmk_pts_k_ago_.at(k).clear();
+    live_lmk_pts_cur_k_ago_.at(k).clear();
+  }
 
+  for (const FeatureTracks::Slot s : live_tracks_.LiveSlots()) {
     // This landmark was last seen "k" frames ago.
-    const int k = stereo_pair.camera_id - observations.back().camera_id;
-    if (k > params_.retrack_frames_k) {
+    const int k = FramesAgo(live_tracks_.CameraId(s, 0), stereo_pair.camera_id);
+    if (k < 0 || k > params_.retrack_frames_k) {
       continue;
     }
 
-    live_lmk_ids_k_ago.at(k).emplace_back(lmk_id);
-    live_lmk_pts_k_ago.at(k).emplace_back(observations.back().pixel_location);
+    live_lmk_ids_k_ago.at(k).emplace_back(live_tracks_.LandmarkId(s));
+    live_lmk_disps_k_ago.at(k).emplace_back(live_tracks_.Disparity(s, 0));
+    live_lmk_vars_k_ago.at(k).emplace_back(live_tracks_.DisparityVariance(s));
+    live_lmk_pts_k_ago_.at(k).emplace_back(live_tracks_.Pixel(s, 0));
   }
 
   //======================== KANADE-LUCAS OPTICAL FLOW =========================
-  std::vector<uid_t> good_lmk_ids;
-  VecPoint2f good_lmk_pts;
+  // Build the current pyramid once, and reuse it for every retracking call (and next frames). The
+  // GPU builds its own pyramids, so just upload the images once for all the stages.
+  ImagePyramid cur_pyramid = gpu_ ? ImagePyramid(stereo_pair.left_image) :
+                                    tracker_.BuildPyramid(stereo_pair.left_image);
+  if (gpu_) {
+    gpu_->Upload(stereo_pair.camera_id, stereo_pair.left_image, stereo_pair.right_image);
+  }
 
-  for (int k = 1; k <= params_.retrack_frames_k; ++k) {
-    if (live_lmk_pts_k_ago.at(k).empty()) {
-      continue;
+  ArenaVector<uid_t> good_lmk_ids(arena_);
+  good_lmk_ids.reserve(live_tracks_.Size());
+  ArenaVector<InverseDepthFilter::Estimate> good_lmk_predicted(arena_);   // Negative var if unfiltered.
+  good_lmk_predicted.reserve(live_tracks_.Size());
+  good_lmk_pts_.clear();
+  good_lmk_prev_disps_.clear();
+
+  // Orientation of the current camera (only relative rotations between frames matter).
+  const bool use_rotation_prior = params_.klt_rotation_prior && !gpu_;
+  // NOTE(milo): Renormalize through a quaternion so that the accumulated rotation doesn't drift.
+  o_R_cam_ = Quaterniond(o_R_cam_ * prev_R_cur).normalized().toRotationMatrix();
+
+  // Track from each of the previous k frames. These are independent, so they can run in parallel.
+  const auto track_k_ago = [&](int k)
+  {
+    if (gpu_) {
+      gpu_->Track(k, live_lmk_pts_k_ago_.at(k), live_lmk_pts_cur_k_ago_.at(k), status_k_ago_.at(k),
+                  true, params_.klt_fwd_bwd_tol);
+      return;
+    }
+    // Seed the flow with the rotation between the k-ago camera and the current one.
+    if (use_rotation_prior) {
+      const Matrix3d cur_R_ref = o_R_cam_.transpose() * o_R_cam_buffer_.Get(k-1);
+      WarpByRotation(stereo_rig_.LeftCamera(), cur_R_ref, live_lmk_pts_k_ago_.at(k), live_lmk_pts_cur_k_ago_.at(k));
     }
-
-    VecPoint2f live_lmk_pts_cur;
-    std::vector<uchar> status;
-    std::vector<float> error;
 
     tracker_.Track(img_buffer_.Get(k-1),
-                   stereo_pair.left_image,
-                   live_lmk_pts_k_ago.at(k),
-                   live_lmk_pts_cur,
-                   status,
-                   error,
+                   cur_pyramid,
+                   live_lmk_pts_k_ago_.at(k),
+                   live_lmk_pts_cur_k_ago_.at(k),
+                   status_k_ago_.at(k),
+                   error_k_ago_.at(k),
                    true,
                    params_.klt_fwd_bwd_tol);
+  };
+
+  TaskScheduler& scheduler = TaskScheduler::Current();
+  TaskGroup track_group;
+  for (int k = 1; k <= params_.retrack_frames_k; ++k) {
+    if (live_lmk_pts_k_ago_.at(k).empty()) {
+      continue;
+    }
+    if (params_.pipelined && !gpu_) {
+      scheduler.Submit([&track_k_ago, k]() { track_k_ago(k); }, &track_group, TaskPriority::HIGH);
+    } else {
+      track_k_ago(k);
+    }
+  }
+  scheduler.Wait(track_group);
+
+  for (int k = 1; k <= params_.retrack_frames_k; ++k) {
+    if (live_lmk_pts_k_ago_.at(k).empty()) {
+      continue;
+    }
 
-    // Filter out unsuccessful KLT tracks.
-    std::vector<uid_t> good_lmk_ids_k = SubsetFromMaskCv<uid_t>(live_lmk_ids_k_ago.at(k), status);
-    VecPoint2f good_lmk_pts_k = SubsetFromMaskCv<cv::Point2f>(live_lmk_pts_cur, status);
-    good_lmk_ids.insert(good_lmk_ids.end(), good_lmk_ids_k.begin(), good_lmk_ids_k.end());
-    good_lmk_pts.insert(good_lmk_pts.end(), good_lmk_pts_k.begin(), good_lmk_pts_k.end());
+    // Keep the successful KLT tracks.
+    const std::vector<uchar>& status = status_k_ago_.at(k);
+    const ArenaVector<uid_t>& ids = live_lmk_ids_k_ago.at(k);
+    const VecPoint2f& pts = live_lmk_pts_cur_k_ago_.at(k);
+    CHECK_EQ(ids.size(), status.size());
+    for (size_t i = 0; i < status.size(); ++i) {
+      if (status[i]) {
+        good_lmk_ids.emplace_back(ids[i]);
+        good_lmk_pts_.emplace_back(pts[i]);
+        good_lmk_prev_disps_.emplace_back(live_lmk_disps_k_ago.at(k)[i]);
+
+        const InverseDepthFilter::Estimate last{ live_lmk_disps_k_ago.at(k)[i], live_lmk_vars_k_ago.at(k)[i] };
+        good_lmk_predicted.emplace_back(last.var < 0 ? last : depth_filter_.Predict(last, k));
+      }
+    }
   }
 
   // Decide if a new keyframe should be initialized.
   // NOTE(milo): If this is the first image, we will have no tracks, triggering a keyframe,
   // causing new keypoints to be detected as desired.
-  const bool is_keyframe = force_keyframe ||
-                           ((int)good_lmk_ids.size() < params_.trigger_keyframe_min_lmks) ||
-                           (int)(stereo_pair.camera_id - prev_kf_id_) >= params_.trigger_keyframe_k;
+  const int frames_since_kf = frames_since_kf_ + 1;
+  bool k_triggered = frames_since_kf >= params_.trigger_keyframe_k;
+  if (k_triggered && params_.trigger_keyframe_min_parallax > 0 && frames_since_kf < params_.trigger_keyframe_max_k) {
+    last_parallax_ = MedianParallax(good_lmk_ids, good_lmk_pts_);
+    k_triggered = last_parallax_ >= params_.trigger_keyframe_min_parallax;
+  }
+
+  const bool few_lmks = (int)good_lmk_ids.size() < params_.trigger_keyframe_min_lmks;
+  const bool is_keyframe = force_keyframe || few_lmks || k_triggered;
+
+  if (!is_keyframe && frames_since_kf >= params_.trigger_keyframe_k) {
+    ++num_suppressed_keyframes_;
+  }
+
+  // With the depth filter, tracked points whose fused disparity is still certain enough don't need
+  // to be matched again. The rest are matched, and fused below.
+  const bool use_depth_filter = depth_filter_.Enabled();
+  ArenaVector<size_t> match_idx(arena_);
+  if (use_depth_filter) {
+    match_lmk_pts_.clear();
+    match_lmk_prev_disps_.clear();
+    for (size_t i = 0; i < good_lmk_predicted.size(); ++i) {
+      const InverseDepthFilter::Estimate& predicted = good_lmk_predicted.at(i);
+      if (predicted.var < 0 || depth_filter_.NeedsMatch(predicted)) {
+        match_idx.emplace_back(i);
+        match_lmk_pts_.emplace_back(good_lmk_pts_.at(i));
+        match_lmk_prev_disps_.emplace_back(good_lmk_prev_disps_.at(i));
+      }
+    }
+  }
+  last_num_matches_skipped_ = use_depth_filter ? (good_lmk_ids.size() - match_idx.size()) : 0;
+
+  const VecPoint2f& match_pts = use_depth_filter ? match_lmk_pts_ : good_lmk_pts_;
+  const std::vector<double>& match_prev_disps = use_depth_filter ? match_lmk_prev_disps_ : good_lmk_prev_disps_;
+
+  // Stereo matching of the tracked points only needs the right image, so it can run while
+  // keyframe detection happens on the left image.
+  // Tracked points only search around the disparity they had when last observed (see
+  // StereoMatcher::Params::predicted_disp_window), and new keypoints do the full search.
+  // NOTE(milo): good_lmk_pts_ must not be modified until match_group is done below.
+  std::vector<double> matched_disps;
+  const auto match_tracked = [&]()
+  {
+    matched_disps = MatchRectified(stereo_pair, match_pts, dense, &match_prev_disps);
+  };
+
+  // NOTE(milo): The GPU stages share one CUDA stream, so they always run one after the other.
+  const bool run_async = params_.pipelined && !gpu_;
+  TaskGroup match_group;
+  if (run_async) {
+    scheduler.Submit(match_tracked, &match_group, TaskPriority::HIGH);
+  }
 
   //===================== KEYFRAME FEATURE DETECTION ===========================
   // If this is a new keyframe, (maybe) detect new keypoints in the left image.
   if (is_keyframe) {
-    VecPoint2f new_left_kps;
-    detector_.Detect(stereo_pair.left_image, good_lmk_pts, new_left_kps);
+    new_left_kps_.clear();
+    if (gpu_) {
+      gpu_->Detect(good_lmk_pts_, new_left_kps_);
+    } else {
+      detector_.Detect(stereo_pair.left_image, good_lmk_pts_, new_left_kps_);
+    }
 
     // Assign new landmark IDs to the initialized keypoints.
-    std::vector<uid_t> new_lmk_ids(new_left_kps.size());
-    for (size_t i = 0; i < new_left_kps.size(); ++i) {
+    ArenaVector<uid_t> new_lmk_ids(new_left_kps_.size(), 0, arena_);
+    for (size_t i = 0; i < new_left_kps_.size(); ++i) {
       new_lmk_ids.at(i) = AllocateLandmarkId();
     }
 
-    const std::vector<double> new_lmk_disps = matcher_.MatchRectified(
-        stereo_pair.left_image, stereo_pair.right_image, new_left_kps);
+    const std::vector<double> new_lmk_disps = MatchRectified(stereo_pair, new_left_kps_, dense);
 
     for (size_t i = 0; i < new_lmk_ids.size(); ++i) {
       const uid_t lmk_id = new_lmk_ids.at(i);
-      const cv::Point2f& pt = new_left_kps.at(i);
+      const cv::Point2f& pt = new_left_kps_.at(i);
       const double disp = new_lmk_disps.at(i);
 
       // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
@@ -117,29 +320,54 @@ bool StereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair, bool f
         continue;
       }
 
-      CHECK_EQ(live_tracks_.count(lmk_id), 0) << "Newly initialized landmark should not exist in live_tracks_" << std::endl;
-
-      // If this is a new landmark, add an empty vector of observations.
-      live_tracks_.emplace(lmk_id, VecLmkObs());
+      CHECK(!live_tracks_.Contains(lmk_id)) << "Newly initialized landmark should not exist in live_tracks_" << std::endl;
 
-      // Now insert the latest observation.
-      const LandmarkObservation lmk_obs(lmk_id, stereo_pair.camera_id, pt, disp, 0.0, 0.0);
-      live_tracks_.at(lmk_id).emplace_back(lmk_obs);
+      // Start a new track with this observation.
+      AddObservation(lmk_id, stereo_pair.camera_id, pt, disp,
+                     use_depth_filter ? depth_filter_.Initialize(disp).var : -1.0);
     }
 
     prev_kf_id_ = stereo_pair.camera_id;
+    frames_since_kf_ = 0;
+  } else {
+    ++frames_since_kf_;
   }
 
   //============================ STEREO MATCHING ===============================
-  const std::vector<double> good_lmk_disps = matcher_.MatchRectified(
-      stereo_pair.left_image, stereo_pair.right_image, good_lmk_pts);
+  if (run_async) {
+    scheduler.Wait(match_group);
+  } else {
+    match_tracked();
+  }
 
-  CHECK_EQ(good_lmk_disps.size(), good_lmk_ids.size());
+  CHECK_EQ(matched_disps.size(), use_depth_filter ? match_idx.size() : good_lmk_ids.size());
+
+  // Steps through match_idx alongside i (both are in increasing order).
+  size_t next_match = 0;
 
   for (size_t i = 0; i < good_lmk_ids.size(); ++i) {
     const uid_t lmk_id = good_lmk_ids.at(i);
-    const cv::Point2f& pt = good_lmk_pts.at(i);
-    const double disp = good_lmk_disps.at(i);
+    const cv::Point2f& pt = good_lmk_pts_.at(i);
+
+    double disp = -1.0;
+    double disp_var = -1.0;
+    if (!use_depth_filter) {
+      disp = matched_disps.at(i);
+    } else if (next_match < match_idx.size() && match_idx.at(next_match) == i) {
+      disp = matched_disps.at(next_match++);
+      const InverseDepthFilter::Estimate& predicted = good_lmk_predicted.at(i);
+
+      // NOTE(milo): A failed match still kills the track, even if its fused disparity is good.
+      if (disp > 0) {
+        const InverseDepthFilter::Estimate fused = (predicted.var < 0) ? depth_filter_.Initialize(disp) :
+                                                                         depth_filter_.Update(predicted, disp);
+        disp = fused.disp;
+        disp_var = fused.var;
+      }
+    } else {
+      disp = good_lmk_predicted.at(i).disp;
+      disp_var = good_lmk_predicted.at(i).var;
+    }
 
     // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
     const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
@@ -147,100 +375,156 @@ bool StereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair, bool f
       continue;
     }
 
-    // If this is a new landmark, add an empty vector of observations.
-    CHECK_GT(live_tracks_.count(lmk_id), 0) << "Tracked point should already exist in live_tracks_!" << std::endl;
+    CHECK(live_tracks_.Contains(lmk_id)) << "Tracked point should already exist in live_tracks_!" << std::endl;
 
     // Now insert the latest observation.
-    const LandmarkObservation lmk_obs(lmk_id, stereo_pair.camera_id, pt, disp, 0.0, 0.0);
-    live_tracks_.at(lmk_id).emplace_back(lmk_obs);
+    AddObservation(lmk_id, stereo_pair.camera_id, pt, disp, disp_var);
   }
 
-  //========================== GARBAGE COLLECTION ==============================
-  // Check for any tracks that have haven't been seen in k images and kill them off.
-  // Also kill off any landmarks that have way too many observations so that the memory needed to
-  // store them doesn't blow up.
-  KillOffLostLandmarks(stereo_pair.camera_id);
-
   // Housekeeping.
-  img_buffer_.Add(stereo_pair.left_image);
+  img_buffer_.Add(std::move(cur_pyramid));
+  camera_id_buffer_.Add(stereo_pair.camera_id);
+  o_R_cam_buffer_.Add(o_R_cam_);
+
+  // Only the last retrack_frames_k pyramids are tracked from, so release the older one right away.
+  if (img_buffer_.Added() > (size_t)params_.retrack_frames_k) {
+    img_buffer_.Release(params_.retrack_frames_k);
+  }
+  if (gpu_) {
+    gpu_->Push();
+  }
   prev_camera_id_ = stereo_pair.camera_id;
+  ++num_frames_;
 
   return is_keyframe;
 }
 
 
-void StereoTracker::KillOffLostLandmarks(uid_t cur_camera_id)
+void StereoTracker::KillOffLostLandmarks()
 {
-  std::vector<uid_t> lmk_ids_to_kill;
+  // NOTE(milo): The wheel ticks once per processed frame, so skipped camera ids don't count (same
+  // as FramesAgo()). Landmarks last seen more than retrack_frames_k frames ago pop out of it.
+  expired_lmk_ids_.clear();
+  lmk_wheel_.Advance(num_frames_, expired_lmk_ids_);
+
+  for (const uid_t lmk_id : expired_lmk_ids_) {
+    live_tracks_.Remove(lmk_id);
+  }
+}
+
 
-  for (const auto& item : live_tracks_) {
-    const uid_t lmk_id = item.first;
+void StereoTracker::AddObservation(uid_t lmk_id, uid_t camera_id, const cv::Point2f& pt, double disp, double disp_var)
+{
+  live_tracks_.AddObservation(lmk_id, camera_id, pt, disp, disp_var);
+  lmk_wheel_.Touch(lmk_id);
+}
 
-    // NOTE(milo): Observations should be sorted in order of INCREASING camera_id.
-    const VecLmkObs& observations = item.second;
 
-    // Should never have an landmark with no observations, this is a bug.
-    CHECK(!observations.empty());
+void StereoTracker::KillLandmark(uid_t lmk_id)
+{
+  if (live_tracks_.Contains(lmk_id)) {
+    expired_lmk_ids_.emplace_back(lmk_id);
+  }
+  live_tracks_.Remove(lmk_id);
+  lmk_wheel_.Remove(lmk_id);
+}
 
-    const int frames_since_last_seen = (int)cur_camera_id - observations.back().camera_id;
 
-    // If this landmark hasn't been observed in retrack_frames_k, it won't be retracked, so kill.
-    if (frames_since_last_seen > params_.retrack_frames_k) {
-      lmk_ids_to_kill.emplace_back(lmk_id);
+double StereoTracker::MedianParallax(const ArenaVector<uid_t>& lmk_ids, const VecPoint2f& lmk_pts)
+{
+  ArenaVector<float> displacements(arena_);
+  displacements.reserve(lmk_ids.size());
+
+  for (size_t i = 0; i < lmk_ids.size(); ++i) {
+    cv::Point2f pt_kf;
+    double disp_kf;
+    if (live_tracks_.FindObservation(lmk_ids.at(i), prev_kf_id_, pt_kf, disp_kf)) {
+      const cv::Point2f delta = lmk_pts.at(i) - pt_kf;
+      displacements.emplace_back(std::sqrt(delta.x*delta.x + delta.y*delta.y));
     }
   }
 
-  for (const uid_t lmk_id : lmk_ids_to_kill) {
-    live_tracks_.erase(lmk_id);
+  // Nothing to compare against, so there's no reason to hold off on a keyframe.
+  if (displacements.empty()) {
+    return std::numeric_limits<double>::max();
   }
+
+  const auto median = displacements.begin() + displacements.size() / 2;
+  std::nth_element(displacements.begin(), median, displacements.end());
+  return *median;
 }
 
 
-void StereoTracker::KillLandmark(uid_t lmk_id)
+int StereoTracker::FramesAgo(uid_t camera_id, uid_t cur_camera_id) const
 {
-  if (live_tracks_.count(lmk_id) != 0) {
-    live_tracks_.erase(lmk_id);
+  if (camera_id == cur_camera_id) {
+    return 0;
+  }
+
+  // NOTE(milo): Only called before the current frame is added, so camera_id_buffer_.Get(0) is the
+  // previous frame.
+  const int N = std::min((int)camera_id_buffer_.Added(), (int)camera_id_buffer_.Size());
+  for (int k = 0; k < N; ++k) {
+    if (camera_id_buffer_.Get(k) == camera_id) {
+      return k + 1;
+    }
   }
+
+  return -1;
+}
+
+
+void StereoTracker::SetEffort(int max_features_per_frame, int klt_max_level)
+{
+  detector_.SetMaxFeaturesPerFrame(max_features_per_frame);
+  tracker_.SetMaxLevel(klt_max_level);
 }
 
 
 Image3b StereoTracker::VisualizeFeatureTracks() const
 {
-  VecPoint2f ref_keypoints, cur_keypoints, untracked_ref, untracked_cur;
+  DrawList list;
+  GetFeatureTracksDrawList(list);
+
+  Image3b out;
+  RenderDrawList(list, out);
+  return out;
+}
 
-  for (const auto& item : live_tracks_) {
-    const VecLmkObs& lmk_obs = item.second;
 
-    CHECK(!lmk_obs.empty()) << "Landmark should have one or more observations stored" << std::endl;
+void StereoTracker::GetFeatureTracksDrawList(DrawList& list) const
+{
+  const cv::Vec3b red(0, 0, 255), green(0, 255, 0), blue(255, 0, 0);
 
-    const LandmarkObservation& lmk_last_obs = lmk_obs.back();
+  list.background = img_buffer_.Head().Image();
+  list.points.clear();
+  list.lines.clear();
 
-    CHECK_LE(lmk_last_obs.camera_id, prev_camera_id_)
+  for (const FeatureTracks::Slot s : live_tracks_.LiveSlots()) {
+    const uid_t last_camera_id = live_tracks_.CameraId(s, 0);
+
+    CHECK_LE(last_camera_id, prev_camera_id_)
         << "Found landmark observation for future camera_id" << std::endl;
 
     // CASE 1: This landmark was seen in the current frame.
-    if (lmk_last_obs.camera_id == prev_camera_id_) {
-      const bool is_new_keypoint = (lmk_obs.size() == 1);
+    if (last_camera_id == prev_camera_id_) {
+      const bool is_new_keypoint = (live_tracks_.NumObservations(s) == 1);
 
       // CASE 1a: Newly initialized keypoint.
       if (is_new_keypoint) {
-        untracked_cur.emplace_back(lmk_last_obs.pixel_location);
+        list.points.push_back({ live_tracks_.Pixel(s, 0), blue, 4 });
 
       // CASE 1b: Tracked from previous location.
       } else {
-        CHECK_GE(lmk_obs.size(), 2);
-        cur_keypoints.emplace_back(lmk_last_obs.pixel_location);
-        const LandmarkObservation& lmk_lastlast_obs = lmk_obs.at(lmk_obs.size() - 2);
-        ref_keypoints.emplace_back(lmk_lastlast_obs.pixel_location);
+        list.points.push_back({ live_tracks_.Pixel(s, 0), green, 6 });
+        list.lines.push_back({ live_tracks_.Pixel(s, 1), live_tracks_.Pixel(s, 0), green, true });
       }
 
     // CASE 2: Landmark not tracked into current frame.
     } else {
-      untracked_ref.emplace_back(lmk_last_obs.pixel_location);
+      list.points.push_back({ live_tracks_.Pixel(s, 0), red, 4 });
     }
   }
-
-  return DrawFeatureTracks(img_buffer_.Head(), ref_keypoints, cur_keypoints, untracked_ref, untracked_cur);
 }
 
 
@@ -1,16 +1,25 @@
 #pragma once
 
+#include <algorithm>
+#include <memory>
 #include <unordered_map>
 
+#include "core/expiration_wheel.hpp"
+#include "core/frame_arena.hpp"
 #include "core/macros.hpp"
 #include "params/params_base.hpp"
 #include "core/uid.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/disparity_map.hpp"
 #include "vision_core/stereo_image.hpp"
 #include "vision_core/stereo_camera.hpp"
 #include "core/sliding_buffer.hpp"
 #include "vision_core/landmark_observation.hpp"
+#include "vision_core/viz_tap.hpp"
 #include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/feature_tracks.hpp"
+#include "feature_tracking/image_pyramid.hpp"
+#include "feature_tracking/inverse_depth_filter.hpp"
 #include "feature_tracking/feature_tracker.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
 
@@ -20,7 +29,8 @@ namespace ft {
 using namespace core;
 
 typedef std::vector<LandmarkObservation> VecLmkObs;
-typedef std::unordered_map<uid_t, VecLmkObs> FeatureTracks;
+
+class GpuFrontend;
 
 
 class StereoTracker final {
@@ -34,37 +44,72 @@ class StereoTracker final {
     FeatureTracker::Params tracker_params;
     StereoMatcher::Params matcher_params;
 
+    // Fuse the disparity of each tracked landmark over frames, and only stereo match the ones whose
+    // fused disparity has become too uncertain. The observations carry the fused disparity.
+    InverseDepthFilter::Params depth_filter_params;
+
     double stereo_max_depth = 30.0;
     double stereo_min_depth = 0.5;
 
     double klt_fwd_bwd_tol = 2.0;
 
+    // Seed KLT by warping keypoints through the infinite homography K * cur_R_ref * K^-1, using the
+    // camera rotation passed into TrackAndTriangulate() (e.g integrated from the gyro). The seeded
+    // flow is small, so it runs with klt_seeded_max_level and klt_seeded_maxiters.
+    bool klt_rotation_prior = false;
+
     // Kill off a tracked landmark if it hasn't been observed in this many frames.
+    // NOTE(milo): Counts frames that were actually processed, so skipping frames is fine.
     // If set to zero, this means that a track dies as soon as it isn't observed in the current frame.
     int retrack_frames_k = 3; // Retrack points from the previous k frames.
 
     // Trigger a keyframe if we only have 0% of maximum keypoints.
     int trigger_keyframe_min_lmks = 10;
 
-    // Trigger a keyframe at least every k frames.
+    // Trigger a keyframe at least every k (processed) frames.
     int trigger_keyframe_k = 10;
 
+    // If > 0, trigger_keyframe_k only triggers a keyframe if the median displacement (pixels) of the
+    // tracked points since the last keyframe is at least this. When the camera is hovering, new
+    // keyframes would be redundant (and each one costs a smoother update downstream). A keyframe is
+    // still triggered every trigger_keyframe_max_k frames, no matter the parallax.
+    double trigger_keyframe_min_parallax = 0;
+    int trigger_keyframe_max_k = 15;
+
+    // Run the independent stages of each frame concurrently: KLT from each of the previous k
+    // frames, and stereo matching of tracked points alongside keyframe detection. The results are
+    // the same as the sequential version.
+    bool pipelined = false;
+
+    // Run KLT, detection and stereo matching on the GPU (see GpuFrontend). Only available if built
+    // with BM_ENABLE_CUDA_FRONTEND, otherwise this falls back to the CPU with a warning.
+    bool use_gpu = false;
+
+    // When a DisparityMap is passed to TrackAndTriangulate(), keypoints take their disparity from it
+    // if the pixel is valid and has at most this (per tap) matching cost. The rest are still matched
+    // with the StereoMatcher.
+    double dense_max_cost = 20.0;
+
    private:
     void LoadParams(const YamlParser& parser) override;
   };
 
   MACRO_DELETE_COPY_CONSTRUCTORS(StereoTracker);
 
-  StereoTracker(const Params& params, const StereoCamera& stereo_rig)
-      : params_(params),
-        stereo_rig_(stereo_rig),
-        detector_(params.detector_params),
-        matcher_(params.matcher_params),
-        tracker_(params.tracker_params),
-        img_buffer_(params_.retrack_frames_k) {}
+  // Upper bound (exclusive) on Params::retrack_frames_k.
+  static constexpr int kMaxRetrackFrames = 8;
+
+  StereoTracker(const Params& params, const StereoCamera& stereo_rig);
+  ~StereoTracker();
 
-  // Returns whether a new keyframe was initialized.
-  bool TrackAndTriangulate(const StereoImage1b& stereo_pair, bool force_keyframe);
+  // Returns whether a new keyframe was initialized. prev_R_cur is the rotation of the current
+  // camera in the previously processed camera, and is only used if klt_rotation_prior is set. If
+  // dense stereo already ran on this stereo pair, pass its left disparity as "dense" to skip most
+  // of the sparse stereo matching (see dense_max_cost).
+  bool TrackAndTriangulate(const StereoImage1b& stereo_pair,
+                           bool force_keyframe,
+                           const Matrix3d& prev_R_cur = Matrix3d::Identity(),
+                           const DisparityMap* dense = nullptr);
 
   // Draws current feature tracks:
   // BLUE = Newly detected feature
@@ -72,17 +117,69 @@ class StereoTracker final {
   // RED = Lost tracking (could be revived in a future image)
   Image3b VisualizeFeatureTracks() const;
 
+  // Same as VisualizeFeatureTracks(), but only fills in the draw primitives (for a VizTap), which
+  // is a lot cheaper than actually drawing them.
+  void GetFeatureTracksDrawList(DrawList& list) const;
+
   const FeatureTracks& GetLiveTracks() const { return live_tracks_; }
+
+  // The left image (and KLT pyramid) of the most recent frame, so that other frontends (e.g the
+  // LineStereoTracker) can reuse it. Only valid after the first call to TrackAndTriangulate().
+  const ImagePyramid& CurrentPyramid() const { return img_buffer_.Head(); }
   void KillLandmark(uid_t lmk_id);
 
+  // Landmarks that were removed from the live tracks by the last TrackAndTriangulate() (because
+  // they weren't seen in retrack_frames_k frames), and by KillLandmark() calls since. Consumers
+  // that see every frame (e.g the ObjectMesher) can remove these instead of diffing their own
+  // landmarks against GetLiveTracks().
+  const std::vector<uid_t>& ExpiredLandmarks() const { return expired_lmk_ids_; }
+
+  // Frames where trigger_keyframe_k was reached, but a keyframe was held off because there wasn't
+  // enough parallax (see trigger_keyframe_min_parallax), and the median parallax last computed.
+  size_t NumSuppressedKeyframes() const { return num_suppressed_keyframes_; }
+  double LastParallax() const { return last_parallax_; }
+
+  // Tracked points in the last frame that took their (fused) disparity from the InverseDepthFilter
+  // instead of being stereo matched.
+  size_t LastNumMatchesSkipped() const { return last_num_matches_skipped_; }
+
+  // Per-frame temporaries come from this arena (reset at the start of each TrackAndTriangulate()).
+  const FrameArena& Arena() const { return arena_; }
+
+  // Shed (or restore) load at runtime: change the keyframe feature budget and the number of KLT
+  // pyramid levels. Takes effect on the next frame.
+  void SetEffort(int max_features_per_frame, int klt_max_level);
+
+  // New landmarks get ids >= next_lmk_id (e.g when resuming from a checkpoint, so that their ids
+  // don't collide with landmarks from before the restart).
+  void ReserveLandmarkIds(uid_t next_lmk_id) { next_lmk_id_ = std::max(next_lmk_id_, next_lmk_id); }
+
  private:
   // Get the next available landmark uid_t.
   uid_t AllocateLandmarkId() { return next_lmk_id_++; }
 
-  // Kill off any landmarks that haven't been seen in lost_point_lifespan frames.
-  // This should be called AFTER tracking points in to the current image so that the most recent
-  // observations are available.
-  void KillOffLostLandmarks(uid_t cur_camera_id);
+  // Kill off any landmarks that haven't been seen in retrack_frames_k frames (see lmk_wheel_). This
+  // should be called at the start of a frame, BEFORE the wheel is touched with its observations.
+  void KillOffLostLandmarks();
+
+  // Add an observation to live_tracks_, and mark the landmark as seen in this frame.
+  void AddObservation(uid_t lmk_id, uid_t camera_id, const cv::Point2f& pt, double disp, double disp_var = -1.0);
+
+  // Number of processed frames between camera_id and the current frame (with id cur_camera_id),
+  // or -1 if camera_id is older than the history that's kept. Camera ids can skip (e.g dropped
+  // frames), so they can't be subtracted directly.
+  int FramesAgo(uid_t camera_id, uid_t cur_camera_id) const;
+
+  // Median pixel displacement of tracked points (current pixels) since the last keyframe.
+  double MedianParallax(const ArenaVector<uid_t>& lmk_ids, const VecPoint2f& lmk_pts);
+
+  // Disparity of each left image point, from dense where it's valid (if given), and from the
+  // StereoMatcher otherwise. If predicted_disps is given (e.g the last disparity of each tracked
+  // point), the CPU matcher searches a narrow window around each prediction first.
+  std::vector<double> MatchRectified(const StereoImage1b& stereo_pair,
+                                     const VecPoint2f& left_pts,
+                                     const DisparityMap* dense,
+                                     const std::vector<double>* predicted_disps = nullptr);
 
  private:
   Params params_;
@@ -91,14 +188,51 @@ class StereoTracker final {
   uid_t next_lmk_id_ = 0;
   uid_t prev_kf_id_ = 0;
   uid_t prev_camera_id_ = 0;
+  int frames_since_kf_ = 0;
+  size_t num_suppressed_keyframes_ = 0;
+  double last_parallax_ = 0;
+  size_t last_num_matches_skipped_ = 0;
 
   FeatureDetector detector_;
   StereoMatcher matcher_;
   FeatureTracker tracker_;
+  InverseDepthFilter depth_filter_;
+
+  // Only set if params_.use_gpu (and the CUDA frontend was built).
+  std::unique_ptr<GpuFrontend> gpu_;
 
-  SlidingBuffer<Image1b> img_buffer_;
+  // Left images (with their KLT pyramids) from previous frames, so that retracking from k frames
+  // ago doesn't rebuild the pyramid. Sized for the largest allowed retrack_frames_k.
+  SlidingBuffer<ImagePyramid, kMaxRetrackFrames> img_buffer_;
+  SlidingBuffer<uid_t, kMaxRetrackFrames> camera_id_buffer_;  // Camera ids of img_buffer_.
+
+  // Orientation of each previous camera relative to an arbitrary (drifting) frame, for warping
+  // keypoints when klt_rotation_prior is set. Only relative rotations between frames are used.
+  SlidingBuffer<Matrix3d, kMaxRetrackFrames> o_R_cam_buffer_;
+  Matrix3d o_R_cam_ = Matrix3d::Identity();
 
   FeatureTracks live_tracks_;
+
+  // Every live landmark, in the bucket of the (processed) frame that it was last seen in, so that
+  // only the landmarks that actually expire are touched each frame.
+  ExpirationWheel<uid_t> lmk_wheel_;
+  uint64_t num_frames_ = 0;
+  std::vector<uid_t> expired_lmk_ids_;
+
+  // NOTE(milo): OpenCV only takes std::vectors (with the default allocator), so the point lists
+  // that go through calcOpticalFlowPyrLK() and the matcher are members, and reuse their capacity
+  // from frame to frame. Everything else that's per-frame comes from the arena (only on the calling
+  // thread, since matching runs concurrently with detection when pipelined).
+  FrameArena arena_;
+  std::vector<VecPoint2f> live_lmk_pts_k_ago_;
+  std::vector<VecPoint2f> live_lmk_pts_cur_k_ago_;
+  std::vector<std::vector<uchar>> status_k_ago_;
+  std::vector<std::vector<float>> error_k_ago_;
+  VecPoint2f good_lmk_pts_;
+  std::vector<double> good_lmk_prev_disps_;  // Last disparity of each good_lmk_pts_ track.
+  VecPoint2f match_lmk_pts_;                // The good_lmk_pts_ that need stereo matching ...
+  std::vector<double> match_lmk_prev_disps_;  // ... and their last disparities.
+  VecPoint2f new_left_kps_;
 };
 
 }
@@ -0,0 +1,107 @@
+#include <opencv2/core/cuda/common.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#include "feature_tracking/stripe_matcher_gpu.h"
+
+namespace bm {
+namespace ft {
+
+
+// One block per keypoint. Every thread computes the cost for some of the stripe positions into
+// shared memory, and then thread 0 finds the FIRST minimum (same as cv::minMaxLoc).
+__global__
+void MatchStripesKernel(const cu::PtrStepSz<uchar> left,
+                        const cu::PtrStepSz<uchar> right,
+                        const int4* windows,
+                        int num_windows,
+                        int templ_cols,
+                        int templ_rows,
+                        int stripe_cols,
+                        int stripe_rows,
+                        float4* result)
+{
+  extern __shared__ float cost[];
+
+  const int k = blockIdx.x;
+  if (k >= num_windows) {
+    return;
+  }
+
+  const int4 w = windows[k];
+  const int cost_cols = stripe_cols - templ_cols + 1;
+  const int cost_rows = stripe_rows - templ_rows + 1;
+  const int num_cost = cost_cols * cost_rows;
+
+  for (int i = threadIdx.x; i < num_cost; i += blockDim.x) {
+    const int x = i % cost_cols;
+    const int y = i / cost_cols;
+
+    int ssd = 0;
+    int sum_i2 = 0;
+    int sum_t2 = 0;
+    for (int r = 0; r < templ_rows; ++r) {
+      const uchar* t = left.ptr(w.y + r) + w.x;
+      const uchar* s = right.ptr(w.w + y + r) + w.z + x;
+      for (int c = 0; c < templ_cols; ++c) {
+        const int tv = t[c];
+        const int sv = s[c];
+        const int d = sv - tv;
+        ssd += d*d;
+        sum_i2 += sv*sv;
+        sum_t2 += tv*tv;
+      }
+    }
+
+    // Normalize the same way that OpenCV does (costs are clamped to 1).
+    const float denom = sqrtf(static_cast<float>(sum_i2) * static_cast<float>(sum_t2));
+    const float num = static_cast<float>(ssd);
+    cost[i] = (num < denom) ? (num / denom) : 1.0f;
+  }
+
+  __syncthreads();
+
+  if (threadIdx.x == 0) {
+    int best = 0;
+    for (int i = 1; i < num_cost; ++i) {
+      if (cost[i] < cost[best]) {
+        best = i;
+      }
+    }
+    const int bx = best % cost_cols;
+    const float c_left = (bx > 0) ? cost[best - 1] : -1.0f;
+    const float c_right = (bx < cost_cols - 1) ? cost[best + 1] : -1.0f;
+    result[k] = make_float4(cost[best], static_cast<float>(best), c_left, c_right);
+  }
+}
+
+
+void MatchStripesGpu(const cu::GpuMat& left,
+                     const cu::GpuMat& right,
+                     const cu::GpuMat& windows,
+                     int templ_cols,
+                     int templ_rows,
+                     int stripe_cols,
+                     int stripe_rows,
+                     cu::GpuMat& result,
+                     cu::Stream& stream)
+{
+  const int N = windows.cols;
+  result.create(1, N, CV_32FC4);
+  if (N == 0) {
+    return;
+  }
+
+  const int num_cost = (stripe_cols - templ_cols + 1) * (stripe_rows - templ_rows + 1);
+  const size_t shared_bytes = num_cost * sizeof(float);
+
+  cudaStream_t s = cu::StreamAccessor::getStream(stream);
+  MatchStripesKernel<<<N, 128, shared_bytes, s>>>(
+      left, right, windows.ptr<int4>(), N,
+      templ_cols, templ_rows, stripe_cols, stripe_rows,
+      result.ptr<float4>());
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/core/cuda_types.hpp>
+
+namespace bm {
+namespace ft {
+
+namespace cu = cv::cuda;
+
+
+// Computes the CV_TM_SQDIFF_NORMED cost of a template (left image) against every position in a
+// search stripe (right image), for a batch of keypoints, and finds the best match for each one.
+//
+// windows: 1xN CV_32SC4 with (templ_x, templ_y, stripe_x, stripe_y) for each keypoint.
+// result:  1xN CV_32FC4 with (best_cost, best_index, cost_left_of_best, cost_right_of_best), where
+//          best_index is row-major in a cost image that is (stripe_cols - templ_cols + 1) wide.
+//          The neighboring costs are -1 if the best match is on the edge of the stripe.
+void MatchStripesGpu(const cu::GpuMat& left,
+                     const cu::GpuMat& right,
+                     const cu::GpuMat& windows,
+                     int templ_cols,
+                     int templ_rows,
+                     int stripe_cols,
+                     int stripe_rows,
+                     cu::GpuMat& result,
+                     cu::Stream& stream);
+
+
+}
+}
@@ -3,10 +3,11 @@
 
 #include <glog/logging.h>
 
-#include <opencv2/highgui.hpp>
+#include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
-#include <opencv2/viz/types.hpp>
 
+#include "vision_core/color_mapping.hpp"
+#include "vision_core/viz_tap.hpp"
 #include "feature_tracking/visualization_2d.hpp"
 
 namespace bm {
@@ -28,27 +29,29 @@ Image3b DrawFeatureTracks(const Image1b& cur_img,
                           const VecPoint2f& untracked_ref,
                           const VecPoint2f& untracked_cur)
 {
-  Image3b img_bgr(cur_img.size(), CV_8U);
+  const cv::Vec3b red(0, 0, 255), green(0, 255, 0), blue(255, 0, 0);
 
-  cv::cvtColor(cur_img, img_bgr, cv::COLOR_GRAY2BGR);
+  DrawList list;
+  list.background = cur_img;
+  list.points.reserve(untracked_ref.size() + untracked_cur.size() + ref_keypoints.size());
+  list.lines.reserve(ref_keypoints.size());
 
   // Optionally show corners that were only detected in ref/cur.
   for (const auto& kp : untracked_ref) {
-    cv::circle(img_bgr, kp, 4, cv::viz::Color::red(), 1);
+    list.points.push_back({ kp, red, 4 });
   }
   for (const auto& kp : untracked_cur) {
-    cv::circle(img_bgr, kp, 4, cv::viz::Color::blue(), 1);
+    list.points.push_back({ kp, blue, 4 });
   }
 
   // Show tracks from ref_img to cur_img.
   for (size_t i = 0; i < ref_keypoints.size(); ++i) {
-    const cv::Point& px_cur = cur_keypoints.at(i);
-    const cv::Point& px_ref = ref_keypoints.at(i);
-
-    cv::circle(img_bgr, px_cur, 6, cv::viz::Color::green(), 1);
-    cv::arrowedLine(img_bgr, px_ref, px_cur, cv::viz::Color::green(), 1);
+    list.points.push_back({ cur_keypoints.at(i), green, 6 });
+    list.lines.push_back({ ref_keypoints.at(i), cur_keypoints.at(i), green, true });
   }
 
+  Image3b img_bgr;
+  RenderDrawList(list, img_bgr);
   return img_bgr;
 }
 
@@ -62,48 +65,42 @@ Image3b DrawStereoMatches(const Image1b& left,
       << "Size of keypoints_left and disp_left should match!" << std::endl;
 
   // Horizontally concat images to make 2*width x height shaped image.
-  Image3b pair_bgr;
-  Image3b left_bgr, right_bgr;
-  cv::cvtColor(left, left_bgr, cv::COLOR_GRAY2BGR);
-  cv::cvtColor(right, right_bgr, cv::COLOR_GRAY2BGR);
-  cv::hconcat(left_bgr, right_bgr, pair_bgr);
+  DrawList list;
+  cv::hconcat(left, right, list.background);
 
   if (disp_left.empty()) {
     LOG(WARNING) << "No disparities passed to DrawStereoMatches!" << std::endl;
-    return pair_bgr;
-  }
-
-  const auto result = std::minmax_element(disp_left.begin(), disp_left.end());
-  const double disp_value_min = 0.0;
-  const double disp_value_max = *result.second;
-  const double disp_value_range = disp_value_max - disp_value_min;
-
-  // Color-map based on disparity.
-  cv::Mat1d disp1d = cv::Mat1d(disp_left).reshape(0, disp_left.size());
-  cv::Mat1b disp1b;
-  disp1d.convertTo(disp1b, CV_8UC1, 255.0 / disp_value_range, disp_value_min);
-
-  cv::Mat3b disp3b;
-  cv::applyColorMap(disp1b, disp3b, cv::COLORMAP_PARULA);
-
-  for (size_t i = 0; i < keypoints_left.size(); ++i) {
-    const double disp = disp_left.at(i);
-    const cv::Point2f& kpl = keypoints_left.at(i);
-
-    const bool has_valid_disp = (disp >= 0);
-    if (has_valid_disp) {
-      const cv::Vec3b bgr = disp3b(0, i);
-
-      // Keypoint is offset to the LEFT in the right image.
-      cv::Point2f kpr = cv::Point2f(left.cols + kpl.x - disp, kpl.y);
-      cv::circle(pair_bgr, kpr, 4, bgr, 1);
-      cv::circle(pair_bgr, kpl, 4, bgr, 1);
-      cv::line(pair_bgr, kpl, kpr, bgr, 1);
-    } else {
-      cv::circle(pair_bgr, kpl, 4, cv::viz::Color::gray(), 1);
+  } else {
+    // Color-map based on disparity.
+    const double disp_value_min = 0.0;
+    const double disp_value_max = std::max(1.0, *std::max_element(disp_left.begin(), disp_left.end()));
+    std::vector<cv::Vec3b> colors(disp_left.size());
+    GetColormapLut(cv::COLORMAP_PARULA).Map(
+        disp_left.data(), disp_left.size(), disp_value_min, disp_value_max, colors.data());
+
+    const cv::Vec3b gray(128, 128, 128);
+    list.points.reserve(2 * keypoints_left.size());
+    list.lines.reserve(keypoints_left.size());
+
+    for (size_t i = 0; i < keypoints_left.size(); ++i) {
+      const double disp = disp_left.at(i);
+      const cv::Point2f& kpl = keypoints_left.at(i);
+
+      const bool has_valid_disp = (disp >= 0);
+      if (has_valid_disp) {
+        // Keypoint is offset to the LEFT in the right image.
+        const cv::Point2f kpr(left.cols + kpl.x - disp, kpl.y);
+        list.points.push_back({ kpr, colors.at(i), 4 });
+        list.points.push_back({ kpl, colors.at(i), 4 });
+        list.lines.push_back({ kpl, kpr, colors.at(i), false });
+      } else {
+        list.points.push_back({ kpl, gray, 4 });
+      }
     }
   }
 
+  Image3b pair_bgr;
+  RenderDrawList(list, pair_bgr);
   return pair_bgr;
 }
 
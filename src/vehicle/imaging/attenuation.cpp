@@ -5,6 +5,8 @@
 
 #include "imaging/attenuation.hpp"
 #include "imaging/illuminant.hpp"
+#include "imaging/normal_equations.hpp"
+#include "imaging/op_graph.hpp"
 
 namespace bm {
 namespace imaging {
@@ -129,173 +131,97 @@ float EstimateBeta(const Image1f& range,
 }
 
 
-float ComputeError(const std::vector<float>& ranges,
-                   const std::vector<Vector3f>& illuminants,
-                   const Vector12f& X)
+// Error of one sample (SSD of the observed range vs. the range predicted from the illuminant in
+// each channel). If Ji isn't null, also sets the weighted row of the Jacobian and the weighted
+// residual.
+static float LinearizeSample(float z,
+                             const Vector3f& illuminant,
+                             const Vector12f& X,
+                             Vector12f* Ji,
+                             float* Ri)
 {
-  assert(ranges.size() == illuminants.size());
-
-  float error = 0.0f;
-  const int M = ranges.size();
-
-  for (int i = 0; i < ranges.size(); ++i) {
-    const float z = ranges.at(i);
-
-    const Vector3f E = illuminants.at(i).cwiseMax(1e-3);
-    const Vector3f log_E = E.array().log();
+  const Vector3f E = illuminant.cwiseMax(1e-3);
+  const Vector3f log_E = E.array().log();
 
-    const Vector3f a = X.block<3, 1>(0, 0);
-    const Vector3f b = X.block<3, 1>(3, 0);
-    const Vector3f c = X.block<3, 1>(6, 0);
-    const Vector3f d = X.block<3, 1>(9, 0);
+  const Vector3f a = X.block<3, 1>(0, 0);
+  const Vector3f b = X.block<3, 1>(3, 0);
+  const Vector3f c = X.block<3, 1>(6, 0);
+  const Vector3f d = X.block<3, 1>(9, 0);
 
-    const Vector3f exp_bz = (b * z).array().exp();
-    const Vector3f exp_dz = (d * z).array().exp();
+  const Vector3f exp_bz = (b * z).array().exp();
+  const Vector3f exp_dz = (d * z).array().exp();
 
-    const Vector3f beta_c = a.cwiseProduct(exp_bz) + c.cwiseProduct(exp_dz);
-    const Vector3f beta_c_inv = beta_c.cwiseMax(1e-3).cwiseInverse();
+  const Vector3f beta_c = a.cwiseProduct(exp_bz) + c.cwiseProduct(exp_dz);
+  const Vector3f beta_c_inv = beta_c.cwiseMax(1e-3).cwiseInverse();
 
-    const Vector3f z_c = -log_E.array() * beta_c_inv.array();
+  const Vector3f z_c = -log_E.array() * beta_c_inv.array();
 
-    // Difference between observed z and model-predicted z.
-    const Vector3f r_c = Vector3f::Constant(z) - z_c;
+  // Difference between observed z and model-predicted z.
+  const Vector3f r_c = Vector3f::Constant(z) - z_c;
 
-    // Residual is the SSD of z errors.
-    const float r = r_c(0)*r_c(0) + r_c(1)*r_c(1) + r_c(2)*r_c(2);
+  // Residual is the SSD of z errors.
+  const float r = r_c(0)*r_c(0) + r_c(1)*r_c(1) + r_c(2)*r_c(2);
 
-    // NOTE(milo): Weighting the error is misleading, and leads to wrong changes to lambda in LM.
-    error += r;
+  if (Ji == nullptr) {
+    return r;
   }
 
-  return error / static_cast<float>(M);
-}
-
-
-void LinearizeBeta(const std::vector<float>& ranges,
-                   const std::vector<Vector3f> illuminants,
-                   const Vector12f& X,
-                   Matrix12f& H,
-                   Vector12f& g,
-                   float& error)
-{
-  assert(ranges.size() == illuminants.size());
-
-  error = 0.0f;
-  const int M = ranges.size();
-
-  // Initialize Jacobian w/ zeros.
-  Eigen::MatrixXf J = Eigen::MatrixXf::Zero(M, 12);
-
-  // Initialize residual error vector R.
-  Eigen::VectorXf R = Eigen::VectorXf::Zero(M);
-
-  for (int i = 0; i < ranges.size(); ++i) {
-    const float z = ranges.at(i);
-
-    const Vector3f E = illuminants.at(i).cwiseMax(1e-3);
-    const Vector3f log_E = E.array().log();
-
-    const Vector3f a = X.block<3, 1>(0, 0);
-    const Vector3f b = X.block<3, 1>(3, 0);
-    const Vector3f c = X.block<3, 1>(6, 0);
-    const Vector3f d = X.block<3, 1>(9, 0);
-
-    const Vector3f exp_bz = (b * z).array().exp();
-    const Vector3f exp_dz = (d * z).array().exp();
-
-    const Vector3f beta_c = a.cwiseProduct(exp_bz) + c.cwiseProduct(exp_dz);
-    const Vector3f beta_c_inv = beta_c.cwiseMax(1e-3).cwiseInverse();
-    const Vector3f beta_c2 = beta_c.array() * beta_c.array();
-    const Vector3f beta_c2_inv = beta_c2.cwiseMax(1e-3).cwiseInverse();
-
-    const Vector3f z_c = -log_E.array() * beta_c_inv.array();
+  const float weight = RobustWeightCauchy(r);
+  *Ri = weight * r;
 
-    // Difference between observed z and model-predicted z.
-    const Vector3f r_c = Vector3f::Constant(z) - z_c;
+  const Vector3f beta_c2 = beta_c.array() * beta_c.array();
+  const Vector3f beta_c2_inv = beta_c2.cwiseMax(1e-3).cwiseInverse();
 
-    // Residual is the SSD of z errors.
-    const float r = r_c(0)*r_c(0) + r_c(1)*r_c(1) + r_c(2)*r_c(2);
-    const float weight = RobustWeightCauchy(r);
-    R(i) = weight * r;
+  // Outer chain-rule stuff that multiplies everything.
+  const Vector3f outer = -2.0f * r_c.array() * log_E.array() * beta_c2_inv.array();
 
-    // NOTE(milo): Weighting the error is misleading, and leads to wrong changes to lambda in LM.
-    error += r;
+  Ji->block<3, 1>(0, 0) = outer.array() * exp_bz.array();
+  Ji->block<3, 1>(3, 0) = outer.array() * z * a.array() * exp_bz.array();
+  Ji->block<3, 1>(6, 0) = outer.array() * exp_dz.array();
+  Ji->block<3, 1>(9, 0) = outer.array() * z * c.array() * exp_dz.array();
 
-    // Outer chain-rule stuff that multiplies everything.
-    const Vector3f outer = -2.0f * r_c.array() * log_E.array() * beta_c2_inv.array();
+  *Ji *= weight;
 
-    const Vector3f J_ac = outer.array() * exp_bz.array();
-    const Vector3f J_bc = outer.array() * z * a.array() * exp_bz.array();
-    const Vector3f J_cc = outer.array() * exp_dz.array();
-    const Vector3f J_dc = outer.array() * z * c.array() * exp_dz.array();
-
-    Vector12f Ji;
-    Ji.block<3, 1>(0, 0) = J_ac;
-    Ji.block<3, 1>(3, 0) = J_bc;
-    Ji.block<3, 1>(6, 0) = J_cc;
-    Ji.block<3, 1>(9, 0) = J_dc;
-
-    J.row(i) = weight * Ji;
-  }
-
-  H = J.transpose() * J;
-  g = -J.transpose() * R;
-
-  // Normalize error by # of samples.
-  error /= static_cast<float>(M);
+  // NOTE(milo): Weighting the error is misleading, and leads to wrong changes to lambda in LM.
+  return r;
 }
 
 
-static Image1f MatExp(const Image1f& m)
+float ComputeError(const std::vector<float>& ranges,
+                   const std::vector<Vector3f>& illuminants,
+                   const Vector12f& X)
 {
-  Image1f out;
-  cv::exp(m, out);
-  return out;
+  assert(ranges.size() == illuminants.size());
+
+  return MeanErrorParallel(static_cast<int>(ranges.size()), [&](int i)
+  {
+    return LinearizeSample(ranges.at(i), illuminants.at(i), X, nullptr, nullptr);
+  });
 }
 
 
-static Image1f SetMaxRangeWhereZero(const Image1f& range)
+void LinearizeBeta(const std::vector<float>& ranges,
+                   const std::vector<Vector3f>& illuminants,
+                   const Vector12f& X,
+                   Matrix12f& H,
+                   Vector12f& g,
+                   float& error)
 {
-  double rmin, rmax;
-  cv::Point pmin, pmax;
-  cv::minMaxLoc(range, &rmin, &rmax, &pmin, &pmax);
+  assert(ranges.size() == illuminants.size());
 
-  Image1f add_where_zero;
-  cv::threshold(range, add_where_zero, 0.0f, rmax, CV_THRESH_BINARY_INV);
-  return range + add_where_zero;
+  error = AccumulateNormalEquations(static_cast<int>(ranges.size()),
+      [&](int i, Vector12f& Ji, float& Ri)
+  {
+    return LinearizeSample(ranges.at(i), illuminants.at(i), X, &Ji, &Ri);
+  }, H, g);
 }
 
 
 Image3f CorrectAttenuation(const Image3f& bgr, const Image1f& range, const Vector12f& X)
 {
-  const Image1f& z = SetMaxRangeWhereZero(range);
-
-  const float a_b = X(0);
-  const float a_g = X(1);
-  const float a_r = X(2);
-
-  const float b_b = X(3);
-  const float b_g = X(4);
-  const float b_r = X(5);
-
-  const float c_b = X(6);
-  const float c_g = X(7);
-  const float c_r = X(8);
-
-  const float d_b = X(9);
-  const float d_g = X(10);
-  const float d_r = X(11);
-
-  Image1f beta_cz[3];
-  beta_cz[0] = z.mul(a_b * MatExp(z * b_b) + c_b * MatExp(z * d_b));
-  beta_cz[1] = z.mul(a_g * MatExp(z * b_g) + c_g * MatExp(z * d_g));
-  beta_cz[2] = z.mul(a_r * MatExp(z * b_r) + c_r * MatExp(z * d_r));
-
-  Image3f E;
-  cv::merge(beta_cz, 3, E);
-  cv::exp(E, E);
-
-  return bgr.mul(E);
+  Image3f out;
+  OpGraph().CorrectAttenuation(X).Run(bgr, range, out);
+  return out;
 }
 
 }
@@ -47,9 +47,10 @@ float ComputeError(const std::vector<float>& ranges,
                    const Vector12f& X);
 
 
-// Compute the Jacobian of the underwater image formation model wrt model parameters.
+// Compute the Gauss-Newton normal equations (H = J^T * J and g = -J^T * R) of the attenuation model
+// wrt model parameters. The samples are accumulated in parallel, without building J.
 void LinearizeBeta(const std::vector<float>& ranges,
-                   const std::vector<Vector3f> illuminants,
+                   const std::vector<Vector3f>& illuminants,
                    const Vector12f& X,
                    Matrix12f& H,
                    Vector12f& g,
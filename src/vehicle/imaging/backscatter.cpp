@@ -1,23 +1,24 @@
 #include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <numeric>
 
 #include <eigen3/Eigen/QR>
+#include <glog/logging.h>
 
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
 #include "core/math_util.hpp"
 #include "imaging/backscatter.hpp"
+#include "imaging/normal_equations.hpp"
+#include "imaging/op_graph.hpp"
 
 
 namespace bm {
 namespace imaging {
 
 
-// Range of background pixels (in meters).
-static const float kBackgroundRange = 20.0f;
-
-
 // Returns the max diagonal entry from a 12x12 matrix.
 static float MaxDiagonal(const Matrix12f& H)
 {
@@ -40,87 +41,208 @@ static float RobustWeightCauchy(float residual)
 
 float FindDarkFast(const Image1f& intensity, const Image1f& range, float percentile, Image1b& mask)
 {
-  const float N = static_cast<float>(intensity.rows * intensity.cols);
-  const int N_desired = static_cast<int>(percentile * N);
-
-  float low = 0;
-  float high = 0.5;
-
-  const Image1b& range_valid_mask = (range > 0.1);
-
-  // Start by assuming a uniform distribution over intensity (i.e 10th percentile <= 0.1 intensity).
-  mask = (intensity <= 1.5*percentile & range_valid_mask);
-  int N_dark = cv::countNonZero(mask);
-  if (N_dark < N_desired) {
-    low = 1.5*percentile;
-  } else if (N_dark > N_desired) {
-    high = 1.5*percentile;
-  } else {
-    return 1.5*percentile;
+  std::vector<cv::Point> unused;
+  return FindDarkFast(intensity, range, percentile, 1, 0, mask, unused);
+}
+
+
+float FindDarkFast(const Image1f& intensity,
+                   const Image1f& range,
+                   float percentile,
+                   int num_range_bins,
+                   int max_px,
+                   Image1b& mask,
+                   std::vector<cv::Point>& dark_px)
+{
+  CHECK(intensity.size() == range.size());
+  CHECK_GT(num_range_bins, 0);
+  CHECK_GE(max_px, 0);
+
+  // Pixels closer than this don't have a valid range.
+  const float min_range = 0.1f;
+
+  float range_bin_size = 1.0f;
+  if (num_range_bins > 1) {
+    double rmin, rmax;
+    cv::Point pmin, pmax;
+    cv::minMaxLoc(range, &rmin, &rmax, &pmin, &pmax);
+    range_bin_size = std::max(1e-3f, (static_cast<float>(rmax) - min_range) / num_range_bins);
   }
 
-  // Switch to binary search to refine threshold.
-  // 8-iters gives +/- 0.4% accuracy.
-  // 10-iters gives +/-0.1% accuracy.
-  for (int iter = 0; iter < 8; ++iter) {
-    float threshold = (high + low) / 2.0f;
-    mask = (intensity <= threshold & range_valid_mask);
-    N_dark = cv::countNonZero(mask);
-
-    if (N_dark < N_desired) {
-      low = threshold;
-    } else if (N_dark > N_desired) {
-      high = threshold;
-    } else {
-      return threshold;
+  // Histogram bin of a pixel (-1 if the range is invalid), in range-major order.
+  const auto bin = [&](int y, int x)
+  {
+    const float z = range(y, x);
+    if (!(z > min_range)) {
+      return -1;
+    }
+    const int rb = std::min(static_cast<int>((z - min_range) / range_bin_size), num_range_bins - 1);
+    const int ib = std::min(std::max(static_cast<int>(intensity(y, x) * kDarkHistogramBins), 0),
+                            kDarkHistogramBins - 1);
+    return rb * kDarkHistogramBins + ib;
+  };
+
+  // Single pass to build the histogram. Each block of rows counts into its own histogram.
+  std::vector<int> hist(num_range_bins * kDarkHistogramBins, 0);
+  std::mutex hist_mutex;
+
+  cv::parallel_for_(cv::Range(0, intensity.rows), [&](const cv::Range& rows)
+  {
+    std::vector<int> local(hist.size(), 0);
+    for (int y = rows.start; y < rows.end; ++y) {
+      for (int x = 0; x < intensity.cols; ++x) {
+        const int b = bin(y, x);
+        if (b >= 0) {
+          ++local[b];
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(hist_mutex);
+    for (size_t b = 0; b < hist.size(); ++b) {
+      hist[b] += local[b];
+    }
+  });
+
+  // Within each range bin, the darkest intensity bin at which the cumulative count reaches the
+  // percentile (-1 if there are no pixels in the range bin).
+  std::vector<int> max_dark_bin(num_range_bins, -1);
+  std::vector<int> total_hist(kDarkHistogramBins, 0);
+
+  for (int rb = 0; rb < num_range_bins; ++rb) {
+    const int* h = hist.data() + rb * kDarkHistogramBins;
+    const int N_range_bin = std::accumulate(h, h + kDarkHistogramBins, 0);
+    const int N_desired = static_cast<int>(std::ceil(percentile * N_range_bin));
+
+    int N_dark = 0;
+    for (int ib = 0; ib < kDarkHistogramBins && N_desired > 0; ++ib) {
+      N_dark += h[ib];
+      if (N_dark >= N_desired) {
+        max_dark_bin.at(rb) = ib;
+        break;
+      }
+    }
+
+    for (int ib = 0; ib < kDarkHistogramBins; ++ib) {
+      total_hist.at(ib) += h[ib];
     }
   }
 
-  return (high + low) / 2.0f;
+  // Second pass writes the mask, and keeps the dark pixel coordinates of each block of rows so
+  // that they can be concatenated in scan order.
+  mask.create(intensity.rows, intensity.cols);
+
+  std::vector<std::vector<cv::Point>> dark_rows(intensity.rows);
+
+  cv::parallel_for_(cv::Range(0, intensity.rows), [&](const cv::Range& rows)
+  {
+    for (int y = rows.start; y < rows.end; ++y) {
+      uint8_t* mask_row = mask.ptr<uint8_t>(y);
+      for (int x = 0; x < intensity.cols; ++x) {
+        const int b = bin(y, x);
+        const bool is_dark = b >= 0 &&
+            (b % kDarkHistogramBins) <= max_dark_bin.at(b / kDarkHistogramBins);
+        mask_row[x] = is_dark ? 255 : 0;
+        if (is_dark && max_px > 0) {
+          dark_rows.at(y).emplace_back(x, y);
+        }
+      }
+    }
+  });
+
+  // Evenly spaced in scan order, so that the samples cover the whole image.
+  dark_px.clear();
+  if (max_px > 0) {
+    size_t N_dark = 0;
+    for (const std::vector<cv::Point>& row : dark_rows) {
+      N_dark += row.size();
+    }
+
+    const double step = std::max(1.0, static_cast<double>(N_dark) / static_cast<double>(max_px));
+    double next = 0;
+    size_t i = 0;
+
+    for (const std::vector<cv::Point>& row : dark_rows) {
+      for (const cv::Point& pt : row) {
+        if (static_cast<double>(i) >= next && static_cast<int>(dark_px.size()) < max_px) {
+          dark_px.emplace_back(pt);
+          next += step;
+        }
+        ++i;
+      }
+    }
+  }
+
+  // The threshold over all range bins.
+  const int N_valid = std::accumulate(total_hist.begin(), total_hist.end(), 0);
+  const int N_desired = static_cast<int>(std::ceil(percentile * N_valid));
+  int N_dark = 0;
+  for (int ib = 0; ib < kDarkHistogramBins && N_desired > 0; ++ib) {
+    N_dark += total_hist.at(ib);
+    if (N_dark >= N_desired) {
+      return static_cast<float>(ib + 1) / static_cast<float>(kDarkHistogramBins);
+    }
+  }
+
+  return 0.0f;
 }
 
 
-float EstimateBackscatter(const Image3f& bgr,
-                         const Image1f& range,
-                         const Image1b& dark_mask,
-                         int num_px, int iters,
-                         Vector3f& B, Vector3f& beta_B,
-                         Vector3f& Jp, Vector3f& beta_D)
+// Error of one dark pixel (red, green and blue SSD against the image formation model). If Ji isn't
+// null, also sets the weighted row of the Jacobian and the weighted residual.
+static float LinearizeSample(const Vector3f& bgr_actual,
+                             float z,
+                             const Vector12f& X,
+                             Vector12f* Ji,
+                             float* Ri)
 {
-  std::vector<cv::Point> dark_px;
-  cv::findNonZero(dark_mask, dark_px);
+  const Vector3f B = X.block<3, 1>(0, 0);
+  const Vector3f beta_B = X.block<3, 1>(3, 0);
+  const Vector3f Jp = X.block<3, 1>(6, 0);
+  const Vector3f beta_D = X.block<3, 1>(9, 0);
 
-  // Limit to a small number of pixel locations (randomly sampled).
-  std::random_shuffle(dark_px.begin(), dark_px.end());
-  dark_px.resize(std::min(num_px, static_cast<int>(dark_px.size())));
+  const Vector3f exp_beta_B = (-beta_B * z).array().exp();
+  const Vector3f atten_back = Vector3f::Ones() - exp_beta_B;
 
-  std::vector<Vector3f> bgrs(dark_px.size());
-  std::vector<float> ranges(dark_px.size());
+  const Vector3f exp_beta_D = (-beta_D * z).array().exp();
+  const Vector3f bgr_model = B.cwiseProduct(atten_back) + Jp.cwiseProduct(exp_beta_D);
 
-  for (int i = 0; i < dark_px.size(); ++i) {
-    const cv::Point& pt = dark_px.at(i);
-    bgrs.at(i) = Vector3f(bgr(pt)(0), bgr(pt)(1), bgr(pt)(2));
-    ranges.at(i) = range(pt);
+  // Residual is the SSD of BGR error.
+  const Vector3f r_c = bgr_actual - bgr_model;
+  const float r = r_c.squaredNorm();
+
+  if (Ji == nullptr) {
+    return r;
   }
 
-  // Initialize Jacobian w/ zeros.
-  Eigen::MatrixXf J = Eigen::MatrixXf::Zero(static_cast<int>(bgrs.size()), 12);
+  const float weight = RobustWeightCauchy(r);
+  *Ri = weight * r;
 
-  // Initialize residual error vector R.
-  Eigen::VectorXf R = Eigen::VectorXf::Zero(bgrs.size());
+  Ji->block<3, 1>(0, 0) = -2.0f * r_c.cwiseProduct(atten_back);
+  Ji->block<3, 1>(3, 0) = -2.0f * z * r_c.cwiseProduct(B).cwiseProduct(exp_beta_B);
+  Ji->block<3, 1>(6, 0) = -2.0f * r_c.cwiseProduct(exp_beta_D);
+  Ji->block<3, 1>(9, 0) = 2.0f * z * r_c.cwiseProduct(Jp).cwiseProduct(exp_beta_D);
+
+  // NOTE(milo): All entries in the Jacobian have this outermost chain rule component.
+  *Ji *= weight;
+
+  return r;
+}
 
-  // Optimization variables.
-  Vector12f X;
+
+// Levenberg-Marquardt, starting from X. Returns the error at the final X.
+static float OptimizeBackscatter(const std::vector<Vector3f>& bgrs,
+                                 const std::vector<float>& ranges,
+                                 int iters,
+                                 Vector12f& X)
+{
+  Matrix12f H;
+  Vector12f g;
 
   // Calculate the error if using current variable guess.
   float err;
   float err_prev = std::numeric_limits<float>::max();
-  X.block<3, 1>(0, 0) = B;
-  X.block<3, 1>(3, 0) = beta_B;
-  X.block<3, 1>(6, 0) = Jp;
-  X.block<3, 1>(9, 0) = beta_D;
-  LinearizeImageFormation(bgrs, ranges, B, beta_B, Jp, beta_D, J, R, err_prev);
-  Matrix12f H = J.transpose() * J;
+  LinearizeImageFormation(bgrs, ranges, X, H, g, err_prev);
   float lambda = 1e-3 * MaxDiagonal(H);
 
   const float lambda_k_increase = 2.0;
@@ -129,17 +251,14 @@ float EstimateBackscatter(const Image3f& bgr,
 
   for (int iter = 0; iter < iters; ++iter) {
     // http://ceres-solver.org/nnls_solving.html
-    Matrix12f H = J.transpose() * J;
-    const Vector12f g = -J.transpose() * R;
-
     // Levenberg-Marquardt diagonal thing.
-    H.diagonal() += Vector12f::Constant(lambda);
+    Matrix12f H_damped = H;
+    H_damped.diagonal() += Vector12f::Constant(lambda);
 
-    Eigen::ColPivHouseholderQR<Matrix12f> solver(H);
+    Eigen::ColPivHouseholderQR<Matrix12f> solver(H_damped);
     const Vector12f dX = step_size * solver.solve(g);
 
     // Compute the error if we were to take the step dX.
-    // LinearizeImageFormation(bgrs, ranges, B, beta_B, Jp, beta_D, J, R, err);
     const Vector12f X_test = (X + dX).cwiseMax(0);
     err = ComputeImageFormationError(bgrs, ranges, X_test);
 
@@ -147,25 +266,17 @@ float EstimateBackscatter(const Image3f& bgr,
     // See: https://en.wikipedia.org/wiki/Levenberg%E2%80%93Marquardt_algorithm
     if (err > err_prev) {
       lambda *= lambda_k_increase;
-      // printf("Error increased, lambda = %f\n", lambda);
 
     // If error improves, decrease the damping factor (more like Gauss-Newton).
     // See: https://en.wikipedia.org/wiki/Levenberg%E2%80%93Marquardt_algorithm
     } else {
       lambda /= lambda_k_decrease;
-      // printf("Error decreased, err = %f lambda = %f\n", err, lambda);
 
       // Gauss-Newton update: https://en.wikipedia.org/wiki/Gauss%E2%80%93Newton_algorithm.
       X = X_test;
 
-      // Pull individual vars out for next linearization.
-      B = X.block<3, 1>(0, 0);
-      beta_B = X.block<3, 1>(3, 0);
-      Jp = X.block<3, 1>(6, 0);
-      beta_D = X.block<3, 1>(9, 0);
-
       // Because we changed X, need to re-linearize the image formation model.
-      LinearizeImageFormation(bgrs, ranges, B, beta_B, Jp, beta_D, J, R, err_prev);
+      LinearizeImageFormation(bgrs, ranges, X, H, g, err_prev);
     }
   }
 
@@ -173,104 +284,108 @@ float EstimateBackscatter(const Image3f& bgr,
 }
 
 
-float ComputeImageFormationError(const std::vector<Vector3f>& bgr,
-                                const std::vector<float>& ranges,
-                                const Vector12f& X)
+float EstimateBackscatter(const Image3f& bgr,
+                         const Image1f& range,
+                         const Image1b& dark_mask,
+                         int num_px, int iters,
+                         Vector3f& B, Vector3f& beta_B,
+                         Vector3f& Jp, Vector3f& beta_D,
+                         int num_restarts)
 {
-  assert(bgr.size() == ranges.size());
-
-  float error = 0.0f;
-
-  const Vector3f& B = X.block<3, 1>(0, 0);
-  const Vector3f& beta_B = X.block<3, 1>(3, 0);
-  const Vector3f& Jp = X.block<3, 1>(6, 0);
-  const Vector3f& beta_D = X.block<3, 1>(9, 0);
-
-  for (int i = 0; i < bgr.size(); ++i) {
-    // Compute the residual BGR error.
-    const float z = ranges.at(i);
-    const Vector3f bgr_actual = bgr.at(i);
-    const Vector3f atten_back = Vector3f::Ones() - Vector3f((-beta_B * z).array().exp());
-
-    const Vector3f exp_beta_D = (-beta_D * z).array().exp();
-    const Vector3f bgr_model = B.cwiseProduct(atten_back) + Jp.cwiseProduct(exp_beta_D);
-
-    const float r_b = (bgr_actual(0) - bgr_model(0));
-    const float r_g = (bgr_actual(1) - bgr_model(1));
-    const float r_r = (bgr_actual(2) - bgr_model(2));
+  std::vector<cv::Point> dark_px;
+  cv::findNonZero(dark_mask, dark_px);
 
-    // Residual is the SSD of BGR error.
-    const float r = r_b*r_b + r_g*r_g + r_r*r_r;
-    error += r;
-  }
+  // Limit to a small number of pixel locations (randomly sampled).
+  std::random_shuffle(dark_px.begin(), dark_px.end());
+  dark_px.resize(std::min(num_px, static_cast<int>(dark_px.size())));
 
-  return error / static_cast<float>(bgr.size());
+  return EstimateBackscatter(bgr, range, dark_px, iters, B, beta_B, Jp, beta_D, num_restarts);
 }
 
 
-void LinearizeImageFormation(const std::vector<Vector3f>& bgr,
-                             const std::vector<float>& ranges,
-                             Vector3f& B,
-                             Vector3f& beta_B,
-                             Vector3f& Jp,
-                             Vector3f& beta_D,
-                             Eigen::MatrixXf& J,
-                             Eigen::VectorXf& R,
-                             float& error)
+float EstimateBackscatter(const Image3f& bgr,
+                         const Image1f& range,
+                         const std::vector<cv::Point>& dark_px,
+                         int iters,
+                         Vector3f& B, Vector3f& beta_B,
+                         Vector3f& Jp, Vector3f& beta_D,
+                         int num_restarts)
 {
-  // Jacobian should be m x 12, where m is the number of data points used.
-  assert(J.cols() == 12 && J.rows() == bgr.size());
-  assert(bgr.size() == ranges.size());
-  assert(R.rows() == bgr.size());
+  std::vector<Vector3f> bgrs(dark_px.size());
+  std::vector<float> ranges(dark_px.size());
 
-  error = 0.0f;
+  for (int i = 0; i < dark_px.size(); ++i) {
+    const cv::Point& pt = dark_px.at(i);
+    bgrs.at(i) = Vector3f(bgr(pt)(0), bgr(pt)(1), bgr(pt)(2));
+    ranges.at(i) = range(pt);
+  }
 
-  for (int i = 0; i < bgr.size(); ++i) {
-    // Compute the residual BGR error.
-    const float z = ranges.at(i);
-    const Vector3f bgr_actual = bgr.at(i);
-    const Vector3f atten_back = Vector3f::Ones() - Vector3f((-beta_B * z).array().exp());
+  // Optimization variables.
+  Vector12f X0;
+  X0.block<3, 1>(0, 0) = B;
+  X0.block<3, 1>(3, 0) = beta_B;
+  X0.block<3, 1>(6, 0) = Jp;
+  X0.block<3, 1>(9, 0) = beta_D;
+
+  // The first start is the guess itself, the others scale each param by a random factor in
+  // [0.5, 2]. Seeded, so that the estimate is repeatable for a given set of pixels.
+  std::vector<Vector12f, Eigen::aligned_allocator<Vector12f>> X(1 + std::max(0, num_restarts), X0);
+  cv::RNG rng(0);
+  for (size_t k = 1; k < X.size(); ++k) {
+    for (int i = 0; i < 12; ++i) {
+      X.at(k)(i) *= std::pow(2.0f, rng.uniform(-1.0f, 1.0f));
+    }
+  }
 
-    const Vector3f exp_beta_D = (-beta_D * z).array().exp();
-    const Vector3f bgr_model = B.cwiseProduct(atten_back) + Jp.cwiseProduct(exp_beta_D);
+  // NOTE(milo): The linearization inside of each restart is also parallel, and OpenCV runs nested
+  // parallel_for_ calls serially, so a single start still uses all of the threads.
+  std::vector<float> err(X.size());
+  cv::parallel_for_(cv::Range(0, static_cast<int>(X.size())), [&](const cv::Range& starts)
+  {
+    for (int k = starts.start; k < starts.end; ++k) {
+      err.at(k) = OptimizeBackscatter(bgrs, ranges, iters, X.at(k));
+    }
+  });
 
-    const float r_b = (bgr_actual(0) - bgr_model(0));
-    const float r_g = (bgr_actual(1) - bgr_model(1));
-    const float r_r = (bgr_actual(2) - bgr_model(2));
+  const size_t best = std::min_element(err.begin(), err.end()) - err.begin();
 
-    // Residual is the SSD of BGR error.
-    const float r = r_b*r_b + r_g*r_g + r_r*r_r;
-    const float weight = RobustWeightCauchy(r);
-    R(i) = weight*r;
-    error += r;
+  // Pull individual vars out of the best solution.
+  B = X.at(best).block<3, 1>(0, 0);
+  beta_B = X.at(best).block<3, 1>(3, 0);
+  Jp = X.at(best).block<3, 1>(6, 0);
+  beta_D = X.at(best).block<3, 1>(9, 0);
 
-    const float J_Bb = -2.0f * r_b * atten_back(0);
-    const float J_Bg = -2.0f * r_g * atten_back(1);
-    const float J_Br = -2.0f * r_r * atten_back(2);
+  return err.at(best);
+}
 
-    const Vector3f exp_beta_B = (-beta_B * z).array().exp();
-    const float J_beta_Bb = -2.0f * r_b * B(0) * z * exp_beta_B(0);
-    const float J_beta_Bg = -2.0f * r_g * B(1) * z * exp_beta_B(1);
-    const float J_beta_Br = -2.0f * r_r * B(2) * z * exp_beta_B(2);
 
-    const float J_Jp_b = -2.0f * r_b * exp_beta_D(0);
-    const float J_Jp_g = -2.0f * r_g * exp_beta_D(1);
-    const float J_Jp_r = -2.0f * r_r * exp_beta_D(2);
+float ComputeImageFormationError(const std::vector<Vector3f>& bgr,
+                                const std::vector<float>& ranges,
+                                const Vector12f& X)
+{
+  assert(bgr.size() == ranges.size());
 
-    const float J_beta_Db = 2.0f * r_b * Jp(0) * z * exp_beta_D(0);
-    const float J_beta_Dg = 2.0f * r_g * Jp(1) * z * exp_beta_D(1);
-    const float J_beta_Dr = 2.0f * r_r * Jp(2) * z * exp_beta_D(2);
+  return MeanErrorParallel(static_cast<int>(bgr.size()), [&](int i)
+  {
+    return LinearizeSample(bgr.at(i), ranges.at(i), X, nullptr, nullptr);
+  });
+}
 
-    J.row(i) << J_Bb, J_Bg, J_Br,
-                J_beta_Bb, J_beta_Bg, J_beta_Br,
-                J_Jp_b, J_Jp_g, J_Jp_r,
-                J_beta_Db, J_beta_Dg, J_beta_Dr;
 
-    // NOTE(milo): All entries in the Jacobian have this outermost chain rule component.
-    J.row(i) *= weight;
-  }
+void LinearizeImageFormation(const std::vector<Vector3f>& bgr,
+                             const std::vector<float>& ranges,
+                             const Vector12f& X,
+                             Matrix12f& H,
+                             Vector12f& g,
+                             float& error)
+{
+  assert(bgr.size() == ranges.size());
 
-  error /= static_cast<float>(bgr.size());
+  error = AccumulateNormalEquations(static_cast<int>(bgr.size()),
+      [&](int i, Vector12f& Ji, float& Ri)
+  {
+    return LinearizeSample(bgr.at(i), ranges.at(i), X, &Ji, &Ri);
+  }, H, g);
 }
 
 
@@ -279,31 +394,8 @@ Image3f RemoveBackscatter(const Image3f& bgr,
                           const Vector3f& B,
                           const Vector3f& beta_B)
 {
-  Image1f Ic[3];
-  cv::split(bgr, Ic);
-
-  // Set the range to max wherever it's zero.
-  Image1f range_default;
-  cv::threshold(range, range_default, 1e-3, kBackgroundRange, CV_THRESH_BINARY_INV);
-  Image1f range_nonzero = range + range_default;
-
-  Image1f exp_b, exp_g, exp_r;
-  cv::exp(-beta_B(0)*range_nonzero, exp_b);
-  cv::exp(-beta_B(1)*range_nonzero, exp_g);
-  cv::exp(-beta_B(2)*range_nonzero, exp_r);
-
-  exp_b = B(0) * (1.0f - exp_b);
-  exp_g = B(1) * (1.0f - exp_g);
-  exp_r = B(2) * (1.0f - exp_r);
-
-  Ic[0] = Ic[0] - exp_b;
-  Ic[1] = Ic[1] - exp_g;
-  Ic[2] = Ic[2] - exp_r;
-
-  Image3f out = Image3f(bgr.size(), 0);
-  cv::merge(Ic, 3, out);
-  out = cv::max(out, 0.0f);  // Clamp nonnegative.
-
+  Image3f out;
+  OpGraph().RemoveBackscatter(B, beta_B).Run(bgr, range, out);
   return out;
 }
 
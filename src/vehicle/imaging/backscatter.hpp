@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "vision_core/cv_types.hpp"
 #include "core/eigen_types.hpp"
 
@@ -8,18 +10,50 @@ namespace imaging {
 
 using namespace core;
 
-// Find the percentile-darkest pixels in an image. Returns the intensity threshold at which this
-// percentile occurrs (approximately).
+// Intensity bins of the histograms in FindDarkFast(), evenly spaced over [0, 1].
+static const int kDarkHistogramBins = 1024;
+
+
+// Find the percentile-darkest pixels in an image (out of the pixels with a valid range). Returns
+// the intensity threshold at which this percentile occurrs (to within 1 / kDarkHistogramBins).
 float FindDarkFast(const Image1f& intensity, const Image1f& range, float percentile, Image1b& mask);
 
 
+// Same as above, but the percentile is taken separately within num_range_bins evenly spaced range
+// bins (so that far-away pixels, which are brighter due to backscatter, are also sampled). Builds
+// an intensity histogram per range bin in a single (parallel) pass, instead of searching for the
+// threshold. Also returns up to max_px of the dark pixel locations, evenly spaced in scan order,
+// for the EstimateBackscatter() below. The return value is the threshold over all range bins.
+float FindDarkFast(const Image1f& intensity,
+                   const Image1f& range,
+                   float percentile,
+                   int num_range_bins,
+                   int max_px,
+                   Image1b& mask,
+                   std::vector<cv::Point>& dark_px);
+
+
 // Estimate the formation model parameters of an underwater scene using a set of dark pixels.
+// With num_restarts > 0, the optimization also runs from that many random perturbations of the
+// initial guess (concurrently), and the params with the lowest error are returned.
 float EstimateBackscatter(const Image3f& bgr,
                          const Image1f& range,
                          const Image1b& dark_mask,
                          int num_px, int iters,
                          Vector3f& B, Vector3f& beta_B,
-                         Vector3f& Jp, Vector3f& beta_D);
+                         Vector3f& Jp, Vector3f& beta_D,
+                         int num_restarts = 0);
+
+
+// Same as above, using all of the dark_px (e.g from FindDarkFast()) instead of a random sample
+// from a mask.
+float EstimateBackscatter(const Image3f& bgr,
+                         const Image1f& range,
+                         const std::vector<cv::Point>& dark_px,
+                         int iters,
+                         Vector3f& B, Vector3f& beta_B,
+                         Vector3f& Jp, Vector3f& beta_D,
+                         int num_restarts = 0);
 
 
 // Compute the residual error of an image given a set of formation model parameters.
@@ -28,15 +62,14 @@ float ComputeImageFormationError(const std::vector<Vector3f>& bgr,
                                  const Vector12f& X);
 
 
-// Compute the Jacobian of the underwater image formation model wrt model parameters.
+// Compute the Gauss-Newton normal equations (H = J^T * J and g = -J^T * R) of the underwater image
+// formation model wrt model parameters X = (B, beta_B, Jp, beta_D). The samples are accumulated in
+// parallel, without building J.
 void LinearizeImageFormation(const std::vector<Vector3f>& bgr,
                              const std::vector<float>& ranges,
-                             Vector3f& B,
-                             Vector3f& beta_B,
-                             Vector3f& Jp,
-                             Vector3f& beta_D,
-                             Eigen::MatrixXf& J,
-                             Eigen::VectorXf& R,
+                             const Vector12f& X,
+                             Matrix12f& H,
+                             Vector12f& g,
                              float& error);
 
 
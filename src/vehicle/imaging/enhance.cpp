@@ -1,4 +1,8 @@
-#include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
 #include <opencv2/imgproc.hpp>
 
 #include "core/math_util.hpp"
@@ -8,78 +12,243 @@
 #include "imaging/attenuation.hpp"
 #include "imaging/normalization.hpp"
 #include "imaging/illuminant.hpp"
+#include "imaging/op_graph.hpp"
+#include "imaging/io.hpp"
+#include "imaging/fused_correction.hpp"
 
 namespace bm {
 namespace imaging {
 
 
-// TODO(milo): Optimize the OpenCV-heavy function calls here. Or maybe recompile OpenCV?
-// With OpenCV compiled properly on the Jetson, image operations should be faster.
-// EnhanceContrast() --> 3 ms
-// RemoveBackscatter() --> 3.5 ms
-// Estimateil() --> 1.7ms
-// EstimateBackscatter is really fast with -O3 compile option!
-EUInfo EnhanceUnderwater(const Image3f& I,
-                          const Image1f& range,
+void InitialBackscatterGuess(EUInfo& info)
+{
+  // NOTE(milo): I set this initial guess based on the D5 3374 image from Sea-thru.
+  info.B << 0.132, 0.115, 0.0559;
+  info.beta_B << 0.358, 0.695, 1.11;
+  info.Jp << 0.05, 0.05, 0.05;
+  info.beta_Dp << 1.17, 1.23, 0.891;
+}
+
+
+void ClampBetaD(Vector12f& beta_D)
+{
+  // a and c are nonnegative.
+  beta_D.block<3, 1>(0, 0) = beta_D.block<3, 1>(0, 0).cwiseMax(0);
+  beta_D.block<3, 1>(6, 0) = beta_D.block<3, 1>(6, 0).cwiseMax(0);
+
+  // b and d are nonpositive.
+  beta_D.block<3, 1>(3, 0) = beta_D.block<3, 1>(3, 0).cwiseMin(0);
+  beta_D.block<3, 1>(9, 0) = beta_D.block<3, 1>(9, 0).cwiseMin(0);
+}
+
+
+// Everything in EnhanceUnderwater() up to the correction, on an image at the estimation scale. D_est
+// is I_est with the backscatter removed.
+static void EstimateModel(const Image3f& I_est,
+                          const Image1f& range_est,
                           int back_num_px,
                           int back_opt_iters,
                           int beta_num_px,
                           int beta_opt_iters,
-                          Vector12f beta_D_guess,
-                          Image3f& out)
+                          const Vector12f& beta_D_guess,
+                          Timer& timer,
+                          EUInfo& info,
+                          Image3f& D_est)
 {
-  EUInfo info;
-
   // Find dark pixels.
   Image1b is_dark;
-  const Image1f intensity = ComputeIntensity(I);
-  FindDarkFast(intensity, range, 0.01, is_dark);
-  cv::imshow("dark_mask", is_dark);
+  const Image1f intensity = ComputeIntensity(I_est);
+  FindDarkFast(intensity, range_est, 0.01, is_dark);
 
   info.success_finddark = true;
+  info.ms_finddark = timer.Tock().milliseconds();
 
   // Optimize image formation parameters to best match observed dark pixels.
-  Vector3f B, beta_B, Jp, beta_D;
-
-  // NOTE(milo): I set this initial guess based on the D5 3374 image from Sea-thru.
-  info.B << 0.132, 0.115, 0.0559;
-  info.beta_B << 0.358, 0.695, 1.11;
-  info.Jp << 0.05, 0.05, 0.05;
-  info.beta_Dp << 1.17, 1.23, 0.891;
+  InitialBackscatterGuess(info);
 
   info.error_backscatter = EstimateBackscatter(
-      I, range, is_dark, back_num_px, back_opt_iters,
+      I_est, range_est, is_dark, back_num_px, back_opt_iters,
       info.B, info.beta_B, info.Jp, info.beta_Dp);
 
   info.success_backscatter = (info.error_backscatter < 0.1f);
+  info.ms_backscatter = timer.Tock().milliseconds();
 
-  const Image3f D = RemoveBackscatter(I, range, info.B, info.beta_B);
-  cv::imshow("remove_scatter", D);
+  D_est = RemoveBackscatter(I_est, range_est, info.B, info.beta_B);
 
-  // Tuned the guided filter params offline.
+  // Tuned the guided filter params offline. The radius is relative to the image width, and the
+  // illuminant is only used to fit beta_D, so it stays at the estimation scale.
   const double eps = 0.01;
   const int s = 8;
-  const int r = core::NextEvenInt(D.cols / 3);
-  const Image3f il = EstimateIlluminantRangeGuided(D, range, r, eps, s);
+  const int r = core::NextEvenInt(D_est.cols / 3);
+  const Image3f il = EstimateIlluminantRangeGuided(D_est, range_est, r, eps, s);
   info.success_illuminant = true;
+  info.ms_illuminant = timer.Tock().milliseconds();
 
-  cv::imshow("il", il);
   info.beta_D = beta_D_guess;
+  ClampBetaD(info.beta_D);
 
-  // a and c are nonnegative.
-  info.beta_D.block<3, 1>(0, 0) = info.beta_D.block<3, 1>(0, 0).cwiseMax(0);
-  info.beta_D.block<3, 1>(6, 0) = info.beta_D.block<3, 1>(6, 0).cwiseMax(0);
+  info.error_attenuation = EstimateBeta(range_est, il, beta_num_px, beta_opt_iters, info.beta_D);
+  info.success_attenuation = (info.error_attenuation < 0.1f);
+  info.ms_attenuation = timer.Tock().milliseconds();
+}
 
-  // b and d are nonpositive.
-  info.beta_D.block<3, 1>(3, 0) = info.beta_D.block<3, 1>(3, 0).cwiseMin(0);
-  info.beta_D.block<3, 1>(9, 0) = info.beta_D.block<3, 1>(9, 0).cwiseMin(0);
 
-  info.error_attenuation = EstimateBeta(range, il, beta_num_px, beta_opt_iters, info.beta_D);
-  info.success_attenuation = (info.error_attenuation < 0.1f);
+// TODO(milo): Optimize the OpenCV-heavy function calls here. Or maybe recompile OpenCV?
+// With OpenCV compiled properly on the Jetson, image operations should be faster.
+// EnhanceContrast() --> 3 ms
+// RemoveBackscatter() --> 3.5 ms
+// Estimateil() --> 1.7ms
+// EstimateBackscatter is really fast with -O3 compile option!
+EUInfo EnhanceUnderwater(const Image3f& I,
+                          const Image1f& range,
+                          int back_num_px,
+                          int back_opt_iters,
+                          int beta_num_px,
+                          int beta_opt_iters,
+                          Vector12f beta_D_guess,
+                          Image3f& out,
+                          float estimate_scale)
+{
+  CHECK(estimate_scale > 0 && estimate_scale <= 1.0f);
 
+  EUInfo info;
+  Timer timer(true);
+
+  // Everything up to the correction runs on I_est and range_est.
+  Image3f I_est = I;
+  Image1f range_est = range;
+
+  if (estimate_scale < 1.0f) {
+    const cv::Size size_est(std::max(1, static_cast<int>(estimate_scale * I.cols)),
+                            std::max(1, static_cast<int>(estimate_scale * I.rows)));
+    cv::resize(I, I_est, size_est, 0, 0, cv::INTER_AREA);
+
+    // NOTE(milo): Averaging would mix missing range (zero) into its neighbors.
+    cv::resize(range, range_est, size_est, 0, 0, cv::INTER_NEAREST);
+  }
+
+  Image3f D_est;
+  EstimateModel(I_est, range_est, back_num_px, back_opt_iters, beta_num_px, beta_opt_iters,
+                beta_D_guess, timer, info, D_est);
+
+  // Apply the model once at full resolution, in a single pass. At full scale, D_est already has the
+  // backscatter removed.
   // Image3f J = D / il;
-  out = CorrectAttenuation(D, range, info.beta_D);
+  Image3f J;
+  OpGraph correction;
+  if (estimate_scale < 1.0f) {
+    correction.RemoveBackscatter(info.B, info.beta_B).CorrectAttenuation(info.beta_D).Run(I, range, J);
+  } else {
+    correction.CorrectAttenuation(info.beta_D).Run(D_est, range, J);
+  }
+  out = J;
   // out = CorrectColorApprox(out);
+  info.ms_correction = timer.Tock().milliseconds();
+
+  return info;
+}
+
+
+EUInfo EnhanceUnderwaterTiled(const std::string& bgr_path,
+                              const std::string& range_path,
+                              int back_num_px,
+                              int back_opt_iters,
+                              int beta_num_px,
+                              int beta_opt_iters,
+                              Vector12f beta_D_guess,
+                              const std::string& out_path,
+                              float estimate_scale,
+                              int tile_rows,
+                              float gamma_power)
+{
+  CHECK(estimate_scale > 0 && estimate_scale <= 1.0f);
+  CHECK_GT(tile_rows, 0);
+
+  const MappedImage::Ptr bgr = MappedImage::Open(bgr_path);
+  const MappedImage::Ptr range = MappedImage::Open(range_path);
+  CHECK(bgr) << "Could not map the image: " << bgr_path << std::endl;
+  CHECK(range) << "Could not map the range: " << range_path << std::endl;
+
+  // NOTE(milo): Check the types before wrapping them, since an Image1f of another type would copy.
+  const cv::Mat& I = bgr->Image();
+  CHECK(I.type() == CV_32FC3 || I.type() == CV_8UC3) << "Expected a CV_32FC3 or CV_8UC3 image" << std::endl;
+  CHECK(range->Image().type() == CV_32FC1 && range->Image().size() == I.size())
+      << "Expected a CV_32FC1 range the size of the image" << std::endl;
+  const Image1f R = range->Image();
+
+  EUInfo info;
+  Timer timer(true);
+
+  // NOTE(milo): An integer factor, so that each band of the overview only comes from its own band
+  // of the image (INTER_AREA is then a box average), and the overview can be built one band at a
+  // time. Leftover rows and cols (less than one factor) are left out of the overview.
+  const int factor = std::max(1, std::min(static_cast<int>(std::round(1.0f / estimate_scale)), std::min(I.rows, I.cols)));
+  const int est_rows = I.rows / factor;
+  const int est_cols = I.cols / factor;
+  const int band_rows = factor * std::max(1, tile_rows / factor);
+  const float input_scale = (I.type() == CV_8UC3) ? (1.0f / 255.0f) : 1.0f;
+
+  Image3f I_est(est_rows, est_cols);
+  Image1f range_est(est_rows, est_cols);
+  float max_range = 0;
+
+  for (int y0 = 0; y0 < I.rows; y0 += band_rows) {
+    const int y1 = std::min(I.rows, y0 + band_rows);
+
+    // CorrectAttenuation() fills in missing range with the max over the whole image.
+    double rmin, rmax;
+    cv::minMaxLoc(R.rowRange(y0, y1), &rmin, &rmax);
+    max_range = std::max(max_range, static_cast<float>(rmax));
+
+    const int e0 = y0 / factor;
+    const int e1 = std::min(est_rows, y1 / factor);
+    if (e1 > e0) {
+      const cv::Rect src(0, y0, est_cols * factor, (e1 - e0) * factor);
+      const cv::Size dst_size(est_cols, e1 - e0);
+
+      cv::Mat band;
+      cv::resize(I(src), band, dst_size, 0, 0, cv::INTER_AREA);
+      Image3f est_band = I_est.rowRange(e0, e1);
+      band.convertTo(est_band, CV_32FC3, input_scale);
+
+      // NOTE(milo): Averaging would mix missing range (zero) into its neighbors.
+      Image1f range_band = range_est.rowRange(e0, e1);
+      cv::resize(R(src), range_band, dst_size, 0, 0, cv::INTER_NEAREST);
+    }
+
+    bgr->Release(y0, y1);
+    range->Release(y0, y1);
+  }
+
+  Image3f D_est;
+  EstimateModel(I_est, range_est, back_num_px, back_opt_iters, beta_num_px, beta_opt_iters,
+                beta_D_guess, timer, info, D_est);
+
+  CorrectionModel model = MakeCorrectionModel(info, range_est, gamma_power);
+  model.max_range = max_range;
+
+  // The correction is per-pixel, so the tiles are bands of whole rows that don't need to overlap.
+  // Only one band of each file is resident at a time.
+  const MappedImage::Ptr out = MappedImage::Create(out_path, I.rows, I.cols, CV_8UC3);
+  CHECK(out) << "Could not create the output image: " << out_path << std::endl;
+
+  for (int y0 = 0; y0 < I.rows; y0 += tile_rows) {
+    const int y1 = std::min(I.rows, y0 + tile_rows);
+    Image3b out_band = out->Image().rowRange(y0, y1);
+
+    if (I.type() == CV_8UC3) {
+      CorrectImageFused(Image3b(I.rowRange(y0, y1)), R.rowRange(y0, y1), model, out_band);
+    } else {
+      CorrectImageFused(Image3f(I.rowRange(y0, y1)), R.rowRange(y0, y1), model, out_band);
+    }
+
+    bgr->Release(y0, y1);
+    range->Release(y0, y1);
+    out->Release(y0, y1);
+  }
+
+  CHECK(out->Flush()) << "Could not write the output image: " << out_path << std::endl;
+  info.ms_correction = timer.Tock().milliseconds();
 
   return info;
 }
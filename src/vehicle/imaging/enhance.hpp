@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #include "vision_core/cv_types.hpp"
 #include "vision_core/image_util.hpp"
 #include "core/eigen_types.hpp"
@@ -24,9 +26,29 @@ struct EUInfo {
 
   // Attenuation model params.
   Vector12f beta_D;
+
+  // Time spent in each stage of EnhanceUnderwater() (ms). The first four run at the estimation
+  // scale, and correction is RemoveBackscatter() + CorrectAttenuation() at full resolution.
+  double ms_finddark = 0;
+  double ms_backscatter = 0;
+  double ms_illuminant = 0;
+  double ms_attenuation = 0;
+  double ms_correction = 0;
 };
 
 
+// Initial guess for the backscatter model params (B, beta_B, Jp, beta_Dp).
+void InitialBackscatterGuess(EUInfo& info);
+
+
+// Clamps the attenuation params to the allowed signs (a and c are nonnegative, b and d are
+// nonpositive).
+void ClampBetaD(Vector12f& beta_D);
+
+
+// Estimates the image formation model of an underwater image, and corrects it. With an
+// estimate_scale < 1, the model is estimated on a downsampled copy of bgr and range (the params
+// don't depend on resolution), and only the correction runs at full resolution.
 EUInfo EnhanceUnderwater(const Image3f& bgr,
                           const Image1f& range,
                           int back_num_px,
@@ -34,7 +56,29 @@ EUInfo EnhanceUnderwater(const Image3f& bgr,
                           int beta_num_px,
                           int beta_opt_iters,
                           Vector12f beta_D_guess,
-                          Image3f& out);
+                          Image3f& out,
+                          float estimate_scale = 1.0f);
+
+
+// Out-of-core version of EnhanceUnderwater(), for images that don't fit in memory (e.g survey
+// mosaics). The inputs are MappedImage files: bgr is CV_32FC3 in [0, 1] or CV_8UC3, and range is
+// CV_32FC1. The model is estimated on an overview (downsampled by about 1 / estimate_scale) that is
+// built tile_rows rows at a time. Then tiles of tile_rows rows are streamed through
+// CorrectImageFused() into a new CV_8UC3 MappedImage at out_path (gamma encoded, not contrast
+// stretched), so memory use depends on the width and tile_rows, but not on the height.
+//
+// NOTE(milo): The overview is still held in memory, so keep estimate_scale small for big mosaics.
+EUInfo EnhanceUnderwaterTiled(const std::string& bgr_path,
+                              const std::string& range_path,
+                              int back_num_px,
+                              int back_opt_iters,
+                              int beta_num_px,
+                              int beta_opt_iters,
+                              Vector12f beta_D_guess,
+                              const std::string& out_path,
+                              float estimate_scale = 0.125f,
+                              int tile_rows = 256,
+                              float gamma_power = 0.4545f);
 
 }
 }
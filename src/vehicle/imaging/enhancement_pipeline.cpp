@@ -0,0 +1,178 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "core/math_util.hpp"
+#include "vision_core/image_util.hpp"
+#include "imaging/enhancement_pipeline.hpp"
+#include "imaging/backscatter.hpp"
+#include "imaging/illuminant.hpp"
+#include "imaging/op_graph.hpp"
+
+namespace bm {
+namespace imaging {
+
+
+void EnhancementPipeline::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("back_num_px", &back_num_px);
+  parser.GetParam("back_opt_iters", &back_opt_iters);
+  parser.GetParam("beta_num_px", &beta_num_px);
+  parser.GetParam("beta_opt_iters", &beta_opt_iters);
+  parser.GetParam("dark_range_bins", &dark_range_bins);
+  parser.GetParam("warm_back_opt_iters", &warm_back_opt_iters);
+  parser.GetParam("warm_beta_opt_iters", &warm_beta_opt_iters);
+  parser.GetParam("reestimate_every", &reestimate_every);
+  parser.GetParam("check_drift_every", &check_drift_every);
+  parser.GetParam("drift_num_px", &drift_num_px);
+  parser.GetParam("drift_factor", &drift_factor);
+}
+
+
+EnhancementPipeline::EnhancementPipeline(const Params& params, const Vector12f& beta_D_guess)
+    : params_(params),
+      beta_D_guess_(beta_D_guess)
+{
+  CHECK_GE(params_.reestimate_every, 0);
+  CHECK_GE(params_.check_drift_every, 0);
+  CHECK_GT(params_.drift_factor, 1.0f);
+  Reset();
+}
+
+
+void EnhancementPipeline::Reset()
+{
+  model_.success_finddark = false;
+  model_.success_backscatter = false;
+  model_.success_illuminant = false;
+  model_.success_attenuation = false;
+  model_.error_backscatter = 0;
+  model_.error_attenuation = 0;
+
+  InitialBackscatterGuess(model_);
+  model_.beta_D = beta_D_guess_;
+  ClampBetaD(model_.beta_D);
+  has_model_ = false;
+  frames_since_estimate_ = 0;
+}
+
+
+bool EnhancementPipeline::Process(const Image3f& bgr, const Image1f& range, Image3f& out)
+{
+  ++frames_since_estimate_;
+
+  bool reestimate = !has_model_ ||
+      (params_.reestimate_every > 0 && frames_since_estimate_ >= params_.reestimate_every);
+
+  if (!reestimate && params_.check_drift_every > 0 &&
+      (frames_since_estimate_ % params_.check_drift_every) == 0) {
+    reestimate = CheckDrift(bgr, range);
+  }
+
+  // NOTE(milo): Between estimates, the backscatter and attenuation are corrected in one pass.
+  Image3f J;
+  if (reestimate) {
+    const Image3f D = Estimate(bgr, range);
+    OpGraph().CorrectAttenuation(model_.beta_D).Run(D, range, J);
+  } else {
+    OpGraph().RemoveBackscatter(model_.B, model_.beta_B).CorrectAttenuation(model_.beta_D).Run(bgr, range, J);
+  }
+  out = J;
+
+  return reestimate;
+}
+
+
+Image3f EnhancementPipeline::Estimate(const Image3f& bgr, const Image1f& range)
+{
+  const bool warm = has_model_;
+  EUInfo info = model_;
+
+  Image1b is_dark;
+  std::vector<cv::Point> dark_px;
+  FindDarkFast(ComputeIntensity(bgr), range, 0.01, params_.dark_range_bins,
+               params_.back_num_px, is_dark, dark_px);
+  info.success_finddark = true;
+
+  info.error_backscatter = EstimateBackscatter(
+      bgr, range, dark_px,
+      warm ? params_.warm_back_opt_iters : params_.back_opt_iters,
+      info.B, info.beta_B, info.Jp, info.beta_Dp);
+  info.success_backscatter = (info.error_backscatter < 0.1f);
+
+  // NOTE(milo): A bad fit (e.g a frame without any dark pixels) would be applied to every frame
+  // until the next estimate, so keep the previous params instead.
+  if (!info.success_backscatter && warm) {
+    info.B = model_.B;
+    info.beta_B = model_.beta_B;
+    info.Jp = model_.Jp;
+    info.beta_Dp = model_.beta_Dp;
+    info.error_backscatter = model_.error_backscatter;
+  }
+
+  const Image3f D = RemoveBackscatter(bgr, range, info.B, info.beta_B);
+
+  // Same guided filter params as EnhanceUnderwater(). The filter keeps the range terms, which
+  // saves the box filters of the guide whenever the range image repeats.
+  const int r = core::NextEvenInt(D.cols / 3);
+  if (!illuminant_filter_ || illuminant_filter_r_ != r) {
+    illuminant_filter_.reset(new CachedGuidedFilter(r, 0.01, 8));
+    illuminant_filter_r_ = r;
+  }
+  const Image3f il = EstimateIlluminantRangeGuided(D, range, *illuminant_filter_);
+  info.success_illuminant = true;
+
+  ClampBetaD(info.beta_D);
+  info.error_attenuation = EstimateBeta(
+      range, il, params_.beta_num_px,
+      warm ? params_.warm_beta_opt_iters : params_.beta_opt_iters,
+      info.beta_D);
+  info.success_attenuation = (info.error_attenuation < 0.1f);
+
+  if (!info.success_attenuation && warm) {
+    info.beta_D = model_.beta_D;
+    info.error_attenuation = model_.error_attenuation;
+  }
+
+  model_ = info;
+  has_model_ = true;
+  frames_since_estimate_ = 0;
+
+  return D;
+}
+
+
+bool EnhancementPipeline::CheckDrift(const Image3f& bgr, const Image1f& range) const
+{
+  // The dark pixels come back evenly spaced (rather than random), so the check is repeatable.
+  Image1b is_dark;
+  std::vector<cv::Point> dark_px;
+  FindDarkFast(ComputeIntensity(bgr), range, 0.01, params_.dark_range_bins,
+               params_.drift_num_px, is_dark, dark_px);
+  if (dark_px.empty()) {
+    return false;
+  }
+
+  std::vector<Vector3f> bgrs;
+  std::vector<float> ranges;
+  for (const cv::Point& pt : dark_px) {
+    bgrs.emplace_back(bgr(pt)(0), bgr(pt)(1), bgr(pt)(2));
+    ranges.emplace_back(range(pt));
+  }
+
+  Vector12f X;
+  X.block<3, 1>(0, 0) = model_.B;
+  X.block<3, 1>(3, 0) = model_.beta_B;
+  X.block<3, 1>(6, 0) = model_.Jp;
+  X.block<3, 1>(9, 0) = model_.beta_Dp;
+
+  // NOTE(milo): The error at the last estimate can be ~0 on a clean frame, so don't let the check
+  // fire on noise.
+  const float error = ComputeImageFormationError(bgrs, ranges, X);
+  const float error_ref = std::max(model_.error_backscatter, 1e-4f);
+  return error > params_.drift_factor * error_ref;
+}
+
+
+}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <memory>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "vision_core/cv_types.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "imaging/enhance.hpp"
+#include "imaging/attenuation.hpp"
+#include "imaging/fast_guided_filter.hpp"
+
+namespace bm {
+namespace imaging {
+
+using namespace core;
+
+
+// Streaming version of EnhanceUnderwater(). Water properties change slowly, so the backscatter and
+// attenuation params are only re-estimated every few frames (warm-started from the last estimate),
+// or when they stop fitting the dark pixels of the current frame. Every other frame only needs
+// RemoveBackscatter() and CorrectAttenuation().
+class EnhancementPipeline final {
+ public:
+  struct Params final : public ParamsBase {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    // Same as the EnhanceUnderwater() args. The first estimate runs the full number of iterations.
+    int back_num_px = 256;
+    int back_opt_iters = 10;
+    int beta_num_px = 256;
+    int beta_opt_iters = 20;
+
+    // Dark pixels are the darkest 1% within each of this many range bins (see FindDarkFast()).
+    int dark_range_bins = 1;
+
+    // Iterations when re-estimating from the previous params.
+    int warm_back_opt_iters = 3;
+    int warm_beta_opt_iters = 5;
+
+    // Re-estimate every this many frames (0 = only on drift).
+    int reestimate_every = 30;
+
+    // Every check_drift_every frames (0 = never), the backscatter model is evaluated on
+    // drift_num_px dark pixels of the frame. If the error grew by more than drift_factor since the
+    // last estimate, the params are re-estimated.
+    int check_drift_every = 5;
+    int drift_num_px = 64;
+    float drift_factor = 2.0;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(EnhancementPipeline);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(EnhancementPipeline);
+
+  EnhancementPipeline(const Params& params, const Vector12f& beta_D_guess = BetaInitialGuess1());
+
+  // Enhances one frame (bgr in [0, 1], range in meters). Returns whether the params were
+  // re-estimated on this frame.
+  bool Process(const Image3f& bgr, const Image1f& range, Image3f& out);
+
+  // Forget the current params, so that the next frame is estimated from scratch (the initial
+  // guesses).
+  void Reset();
+
+  // The params that are being applied, and the errors from when they were estimated.
+  const EUInfo& Model() const { return model_; }
+
+ private:
+  // Re-estimates model_ on this frame, and returns the image with backscatter removed.
+  Image3f Estimate(const Image3f& bgr, const Image1f& range);
+
+  // Whether the backscatter params no longer fit this frame's dark pixels.
+  bool CheckDrift(const Image3f& bgr, const Image1f& range) const;
+
+ private:
+  Params params_;
+  Vector12f beta_D_guess_;
+
+  EUInfo model_;
+  bool has_model_ = false;
+  int frames_since_estimate_ = 0;
+
+  // Created on the first estimate, since r depends on the image width.
+  std::unique_ptr<CachedGuidedFilter> illuminant_filter_;
+  int illuminant_filter_r_ = 0;
+};
+
+
+}
+}
@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "imaging/fast_guided_filter.hpp"
 
 namespace bm {
@@ -233,5 +235,39 @@ cv::Mat fastGuidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps,
 }
 
 
+static bool SameImage(const cv::Mat& a, const cv::Mat& b)
+{
+  if (a.size() != b.size() || a.type() != b.type()) {
+    return false;
+  }
+
+  const size_t row_bytes = a.cols * a.elemSize();
+  for (int y = 0; y < a.rows; ++y) {
+    if (std::memcmp(a.ptr(y), b.ptr(y), row_bytes) != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+CachedGuidedFilter::CachedGuidedFilter(int r, double eps, int s)
+    : r_(r), eps_(eps), s_(s) {}
+
+
+cv::Mat CachedGuidedFilter::filter(const cv::Mat& I, const cv::Mat& p, int depth)
+{
+  reused_ = (filter_ != nullptr) && SameImage(I, I_);
+
+  if (!reused_) {
+    I_ = I.clone();
+    filter_.reset(new FastGuidedFilter(I_, r_, eps_, s_));
+  }
+
+  return filter_->filter(p, depth);
+}
+
+
 }
 }
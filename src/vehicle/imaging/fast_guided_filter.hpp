@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+
 #include <opencv2/opencv.hpp>
 
 namespace bm {
@@ -16,6 +18,9 @@ class FastGuidedFilter {
   FastGuidedFilter(const cv::Mat &I, int r, double eps,int s);
   ~FastGuidedFilter();
 
+  FastGuidedFilter(const FastGuidedFilter&) = delete;
+  void operator=(const FastGuidedFilter&) = delete;
+
   cv::Mat filter(const cv::Mat &p, int depth = -1) const;
 
  private:
@@ -26,5 +31,30 @@ class FastGuidedFilter {
 cv::Mat fastGuidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int s = 1, int depth = -1);
 
 
+// Keeps the FastGuidedFilter (i.e the box filters of the guide and its variance) for the last guide
+// that it saw, and only rebuilds it when filter() gets a different guide. Checking the guide is a
+// single read of it, which is much cheaper than the box filters, so this is worth using whenever
+// the guide can repeat (e.g a fixed range image, or several inputs with the same guide).
+class CachedGuidedFilter final {
+ public:
+  CachedGuidedFilter(int r, double eps, int s);
+
+  // Same as fastGuidedFilter(I, p, r, eps, s, depth).
+  cv::Mat filter(const cv::Mat& I, const cv::Mat& p, int depth = -1);
+
+  // Whether the last call to filter() reused the guide terms.
+  bool Reused() const { return reused_; }
+
+ private:
+  int r_;
+  double eps_;
+  int s_;
+
+  cv::Mat I_;
+  std::unique_ptr<FastGuidedFilter> filter_;
+  bool reused_ = false;
+};
+
+
 }
 }
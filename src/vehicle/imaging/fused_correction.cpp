@@ -0,0 +1,106 @@
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "imaging/fused_correction.hpp"
+
+namespace bm {
+namespace imaging {
+
+
+CorrectionModel MakeCorrectionModel(const EUInfo& info, const Image1f& range, float gamma_power)
+{
+  CorrectionModel m;
+
+  for (int i = 0; i < 3; ++i) {
+    m.B[i] = info.B(i);
+    m.beta_B[i] = info.beta_B(i);
+  }
+  for (int i = 0; i < 12; ++i) {
+    m.beta_D[i] = info.beta_D(i);
+  }
+
+  double rmin, rmax;
+  cv::Point pmin, pmax;
+  cv::minMaxLoc(range, &rmin, &rmax, &pmin, &pmax);
+  m.max_range = static_cast<float>(rmax);
+
+  m.gamma_power = gamma_power;
+
+  return m;
+}
+
+
+// NOTE(milo): Kept to plain loops over one row (no early outs or library calls), so that -O3
+// vectorizes them with whatever the target has (e.g NEON on the Jetson, AVX on a laptop).
+template <typename T>
+static void CorrectRows(const cv::Mat_<T>& bgr,
+                        const Image1f& range,
+                        const CorrectionModel& model,
+                        float input_scale,
+                        int y0, int y1,
+                        Image3b& out)
+{
+  const int cols = bgr.cols;
+
+  for (int y = y0; y < y1; ++y) {
+    const typename T::value_type* bgr_row = bgr.template ptr<typename T::value_type>(y);
+    const float* range_row = range.ptr<float>(y);
+    uint8_t* out_row = out.ptr<uint8_t>(y);
+
+    for (int x = 0; x < cols; ++x) {
+      float b = input_scale * static_cast<float>(bgr_row[3*x]);
+      float g = input_scale * static_cast<float>(bgr_row[3*x + 1]);
+      float r = input_scale * static_cast<float>(bgr_row[3*x + 2]);
+
+      CorrectPixel(model, range_row[x], b, g, r);
+
+      out_row[3*x] = GammaEncode8(b, model.gamma_power);
+      out_row[3*x + 1] = GammaEncode8(g, model.gamma_power);
+      out_row[3*x + 2] = GammaEncode8(r, model.gamma_power);
+    }
+  }
+}
+
+
+template <typename T>
+static void CorrectImage(const cv::Mat_<T>& bgr,
+                         const Image1f& range,
+                         const CorrectionModel& model,
+                         float input_scale,
+                         Image3b& out)
+{
+  CHECK(bgr.size() == range.size());
+  CHECK_GT(model.vmax, model.vmin);
+
+  if (out.size() != bgr.size()) {
+    out = Image3b(bgr.rows, bgr.cols);
+  }
+
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range& rows)
+  {
+    CorrectRows(bgr, range, model, input_scale, rows.start, rows.end, out);
+  });
+}
+
+
+void CorrectImageFused(const Image3f& bgr,
+                       const Image1f& range,
+                       const CorrectionModel& model,
+                       Image3b& out)
+{
+  CorrectImage(bgr, range, model, 1.0f, out);
+}
+
+
+void CorrectImageFused(const Image3b& bgr,
+                       const Image1f& range,
+                       const CorrectionModel& model,
+                       Image3b& out)
+{
+  CorrectImage(bgr, range, model, 1.0f / 255.0f, out);
+}
+
+
+}
+}
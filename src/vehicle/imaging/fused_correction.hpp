@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "vision_core/cv_types.hpp"
+#include "imaging/enhance.hpp"
+
+// The per-pixel math below is shared with the CUDA version (patchmatch_gpu/correction_gpu.h).
+#ifdef __CUDACC__
+#define BM_HOST_DEVICE __host__ __device__
+#else
+#define BM_HOST_DEVICE
+#endif
+
+namespace bm {
+namespace imaging {
+
+using namespace core;
+
+
+// Range of background pixels (in meters), wherever the range is missing in RemoveBackscatter().
+static constexpr float kBackscatterBackgroundRange = 20.0f;
+
+
+// Everything that CorrectImageFused() applies to a pixel. Passed to the kernels by value.
+struct CorrectionModel final {
+  float B[3];             // bgr
+  float beta_B[3];        // bgr
+  float beta_D[12];       // Same layout as the Vector12f in CorrectAttenuation().
+  float max_range;        // Range used for attenuation where the range is zero.
+
+  // The value (HSV) of the corrected image is stretched with (v - vmin) / (vmax - vmin), like in
+  // EnhanceContrast(). The defaults leave the image as-is.
+  float vmin = 0.0f;
+  float vmax = 1.0f;
+
+  float gamma_power = 0.4545f;
+};
+
+
+// The model from EnhanceUnderwater() or EnhancementPipeline, for an image with this range.
+CorrectionModel MakeCorrectionModel(const EUInfo& info,
+                                    const Image1f& range,
+                                    float gamma_power = 0.4545f);
+
+
+// Corrects and gamma encodes an image in one pass, i.e the same as:
+//   LinearToGamma(Stretch(CorrectAttenuation(RemoveBackscatter(bgr, ...), ...)), gamma_power)
+// and converting to 8-bit, where Stretch() is the EnhanceContrast() value stretch with the model's
+// vmin/vmax (EnhanceContrast() finds these on the image itself, which would take another pass, so a
+// streaming caller would pass in the range from a previous frame).
+//
+// Each row is read and written once, and the exp() and pow() use the approximations below, so that
+// the inner loop has no branches or library calls and gets vectorized. bgr is in [0, 1] for the
+// Image3f version and [0, 255] for the Image3b version.
+void CorrectImageFused(const Image3f& bgr,
+                       const Image1f& range,
+                       const CorrectionModel& model,
+                       Image3b& out);
+
+void CorrectImageFused(const Image3b& bgr,
+                       const Image1f& range,
+                       const CorrectionModel& model,
+                       Image3b& out);
+
+
+// NOTE(milo): fminf(), fmaxf() and floorf() only get vectorized with -ffast-math (they have to
+// handle NaN, signed zeros and FP exceptions), so the functions below stick to comparisons.
+BM_HOST_DEVICE inline float MinF(float a, float b) { return (a < b) ? a : b; }
+BM_HOST_DEVICE inline float MaxF(float a, float b) { return (a > b) ? a : b; }
+
+
+BM_HOST_DEVICE inline float BitsToFloat(int32_t i)
+{
+  float f;
+  memcpy(&f, &i, sizeof(float));
+  return f;
+}
+
+
+BM_HOST_DEVICE inline int32_t FloatToBits(float f)
+{
+  int32_t i;
+  memcpy(&i, &f, sizeof(float));
+  return i;
+}
+
+
+// 2^x, with a relative error below 1e-5. Inputs are clamped to [-126, 126].
+BM_HOST_DEVICE inline float FastExp2(float x)
+{
+  x = MinF(MaxF(x, -126.0f), 126.0f);
+
+  // Adding and subtracting 1.5 * 2^23 rounds to the nearest integer.
+  const float xi = (x + 12582912.0f) - 12582912.0f;
+  const float f = x - xi;
+
+  // Taylor series of 2^f on [-0.5, 0.5).
+  const float p = 1.0f + f*(0.69314718f + f*(0.24022651f + f*(0.05550411f +
+                  f*(0.00961813f + f*0.00133336f))));
+  return p * BitsToFloat((static_cast<int32_t>(xi) + 127) << 23);
+}
+
+
+BM_HOST_DEVICE inline float FastExp(float x)
+{
+  return FastExp2(1.44269504f * x);
+}
+
+
+// log2(x), with an absolute error below 1e-4. Inputs below the smallest normal float (including
+// zero and negative numbers) are clamped to it.
+BM_HOST_DEVICE inline float FastLog2(float x)
+{
+  // Nonnegative floats are ordered the same as their bits, and negative floats are negative ints.
+  int32_t bits = FloatToBits(x);
+  bits = (bits < 0x00800000) ? 0x00800000 : bits;
+
+  const float e = static_cast<float>(((bits >> 23) & 0xFF) - 127);
+  const float m = BitsToFloat((bits & 0x007FFFFF) | 0x3F800000);  // Mantissa in [1, 2).
+
+  // log(m) = 2 * atanh(t), with t in [0, 1/3).
+  const float t = (m - 1.0f) / (m + 1.0f);
+  const float t2 = t * t;
+  const float log_m = 2.0f * t * (1.0f + t2*(0.33333333f + t2*(0.2f + t2*0.14285714f)));
+  return e + 1.44269504f * log_m;
+}
+
+
+// x^p for x >= 0 and p > 0 (0 gives ~0).
+BM_HOST_DEVICE inline float FastPow(float x, float p)
+{
+  return FastExp2(p * FastLog2(x));
+}
+
+
+// Removes the backscatter from channel i of a pixel (in [0, 1]) and corrects its attenuation.
+BM_HOST_DEVICE inline float CorrectChannel(const CorrectionModel& m,
+                                           int i,
+                                           float z_B,
+                                           float z_D,
+                                           float c)
+{
+  const float backscatter = m.B[i] * (1.0f - FastExp(-m.beta_B[i] * z_B));
+  const float D = MaxF(c - backscatter, 0.0f);
+
+  const float beta_D = m.beta_D[i] * FastExp(m.beta_D[3 + i] * z_D) +
+                       m.beta_D[6 + i] * FastExp(m.beta_D[9 + i] * z_D);
+  return D * FastExp(beta_D * z_D);
+}
+
+
+// The corrected (linear, not clipped) bgr of one pixel with color bgr in [0, 1].
+BM_HOST_DEVICE inline void CorrectPixel(const CorrectionModel& m,
+                                        float range,
+                                        float& b, float& g, float& r)
+{
+  // NOTE(milo): RemoveBackscatter() and CorrectAttenuation() fill in missing range differently.
+  const float z_B = (range > 1e-3f) ? range : (range + kBackscatterBackgroundRange);
+  const float z_D = (range > 0.0f) ? range : (range + m.max_range);
+
+  b = CorrectChannel(m, 0, z_B, z_D, b);
+  g = CorrectChannel(m, 1, z_B, z_D, g);
+  r = CorrectChannel(m, 2, z_B, z_D, r);
+
+  // Scaling all channels by V' / V keeps the hue and saturation (see EnhanceContrast()).
+  const float v = MaxF(b, MaxF(g, r));
+  const float v_stretched = (v - m.vmin) / (m.vmax - m.vmin);
+  const float scale = MaxF(v_stretched, 0.0f) / MaxF(v, 1e-20f);
+
+  b *= scale;
+  g *= scale;
+  r *= scale;
+}
+
+
+// Gamma encodes, clips to [0, 1], and rounds to 8-bit.
+BM_HOST_DEVICE inline uint8_t GammaEncode8(float v, float gamma_power)
+{
+  // Negative values come out of FastPow() as ~0, so only the top needs to be clipped.
+  const float v_gamma = MinF(FastPow(v, gamma_power), 1.0f);
+  return static_cast<uint8_t>(static_cast<int32_t>(255.0f * v_gamma + 0.5f));
+}
+
+
+}
+}
@@ -34,5 +34,14 @@ Image3f EstimateIlluminantRangeGuided(const Image3f& bgr,
 }
 
 
+Image3f EstimateIlluminantRangeGuided(const Image3f& bgr,
+                                      const Image1f& range,
+                                      CachedGuidedFilter& filter)
+{
+  const Image3f& lsac = filter.filter(range, bgr);
+  return 2.0f * lsac;
+}
+
+
 }
 }
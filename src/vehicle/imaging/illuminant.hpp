@@ -1,6 +1,7 @@
 #pragma once
 
 #include "vision_core/cv_types.hpp"
+#include "imaging/fast_guided_filter.hpp"
 
 namespace bm {
 namespace imaging {
@@ -20,5 +21,12 @@ Image3f EstimateIlluminantRangeGuided(const Image3f& bgr,
                                       double eps,
                                       int s);
 
+
+// Same as above, with the r, eps and s of the filter. The range terms are reused for as long as
+// the range image doesn't change.
+Image3f EstimateIlluminantRangeGuided(const Image3f& bgr,
+                                      const Image1f& range,
+                                      CachedGuidedFilter& filter);
+
 }
 }
@@ -1,15 +1,415 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <glog/logging.h>
+
 #include <opencv2/highgui.hpp>
 #include "imaging/io.hpp"
 
 namespace bm {
 namespace imaging {
 
+namespace fs = boost::filesystem;
+
+
+// Layout of a cache file: this header, then the source path (not null terminated), then the rows
+// of the depth map (float32, no padding) starting at data_offset.
+struct DepthCacheHeader final {
+  char magic[8];
+  uint32_t version;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t data_offset;
+  int64_t source_size;
+  int64_t source_mtime_ns;
+  uint32_t path_length;
+  uint32_t reserved;
+};
+
+static const char kDepthCacheMagic[8] = { 'B', 'M', 'D', 'E', 'P', 'T', 'H', '\0' };
+static const uint32_t kDepthCacheVersion = 1;
+
+// Keeps each row of the mapped image aligned for vectorized loads.
+static const uint32_t kDepthCacheAlignment = 64;
+
+
+// Layout of a MappedImage file: this header, then the rows (no padding) starting at data_offset.
+struct MappedImageHeader final {
+  char magic[8];
+  uint32_t version;
+  int32_t type;
+  uint32_t rows;
+  uint32_t cols;
+  uint64_t data_offset;
+};
+
+static const char kMappedImageMagic[8] = { 'B', 'M', 'I', 'M', 'A', 'G', 'E', '\0' };
+static const uint32_t kMappedImageVersion = 1;
+
+// NOTE(milo): The rows start on a page, so that Release() can drop whole pages.
+static const uint64_t kMappedImageDataOffset = 4096;
+
+
+// Size and mtime of a file, or false if it doesn't exist.
+static bool StatSource(const std::string& path, int64_t& size, int64_t& mtime_ns)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  size = static_cast<int64_t>(st.st_size);
+  mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+
+// NOTE(milo): std::hash isn't guaranteed to be the same across builds, and the cache outlives the
+// binary, so use FNV-1a.
+static uint64_t HashPath(const std::string& path)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (const char c : path) {
+    h ^= static_cast<uint8_t>(c);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+
+std::string DepthCacheDir()
+{
+  const char* dir = std::getenv("BM_DEPTH_CACHE_DIR");
+  return (dir != nullptr) ? std::string(dir) : std::string(kDefaultDepthCacheDir);
+}
+
+
+std::string DepthCachePath(const std::string& filepath, const std::string& cache_dir)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.depth",
+           static_cast<unsigned long long>(HashPath(fs::absolute(filepath).string())));
+  return (fs::path(cache_dir) / name).string();
+}
+
+
+MappedDepth::MappedDepth(void* addr, size_t length, const Image1f& image)
+    : addr_(addr), length_(length), image_(image) {}
+
+
+MappedDepth::~MappedDepth()
+{
+  image_.release();
+  ::munmap(addr_, length_);
+}
+
+
+MappedDepth::Ptr MappedDepth::Open(const std::string& cache_path, const std::string& source_path)
+{
+  const int fd = ::open(cache_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(DepthCacheHeader))) {
+    ::close(fd);
+    return nullptr;
+  }
+
+  const size_t length = static_cast<size_t>(st.st_size);
+  void* addr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+
+  DepthCacheHeader header;
+  memcpy(&header, addr, sizeof(header));
+
+  const std::string abs_path = fs::absolute(source_path).string();
+  const size_t data_size = static_cast<size_t>(header.rows) * header.cols * sizeof(float);
+
+  int64_t source_size, source_mtime_ns;
+  const bool valid =
+      memcmp(header.magic, kDepthCacheMagic, sizeof(kDepthCacheMagic)) == 0 &&
+      header.version == kDepthCacheVersion &&
+      header.path_length == abs_path.size() &&
+      sizeof(header) + header.path_length <= header.data_offset &&
+      header.data_offset % kDepthCacheAlignment == 0 &&
+      header.data_offset + data_size <= length &&
+      memcmp(static_cast<char*>(addr) + sizeof(header), abs_path.data(), abs_path.size()) == 0 &&
+      StatSource(source_path, source_size, source_mtime_ns) &&
+      source_size == header.source_size &&
+      source_mtime_ns == header.source_mtime_ns;
+
+  if (!valid) {
+    ::munmap(addr, length);
+    return nullptr;
+  }
+
+  float* data = reinterpret_cast<float*>(static_cast<char*>(addr) + header.data_offset);
+  const Image1f image(static_cast<int>(header.rows), static_cast<int>(header.cols), data);
+
+  return Ptr(new MappedDepth(addr, length, image));
+}
+
+
+bool WriteDepthCache(const std::string& cache_path,
+                     const std::string& source_path,
+                     const Image1f& depth)
+{
+  DepthCacheHeader header;
+  memset(&header, 0, sizeof(header));
+
+  if (!StatSource(source_path, header.source_size, header.source_mtime_ns)) {
+    return false;
+  }
+
+  const std::string abs_path = fs::absolute(source_path).string();
+  memcpy(header.magic, kDepthCacheMagic, sizeof(kDepthCacheMagic));
+  header.version = kDepthCacheVersion;
+  header.rows = static_cast<uint32_t>(depth.rows);
+  header.cols = static_cast<uint32_t>(depth.cols);
+  header.path_length = static_cast<uint32_t>(abs_path.size());
+
+  const size_t offset = sizeof(header) + abs_path.size();
+  header.data_offset = static_cast<uint32_t>(
+      (offset + kDepthCacheAlignment - 1) / kDepthCacheAlignment * kDepthCacheAlignment);
+
+  // Unique per process and thread, so that concurrent writers of the same entry don't collide.
+  const std::string tmp_path = cache_path + ".tmp." + std::to_string(::getpid()) + "." +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      return false;
+    }
+
+    const std::vector<char> padding(header.data_offset - offset, 0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(abs_path.data(), abs_path.size());
+    out.write(padding.data(), padding.size());
+
+    for (int y = 0; y < depth.rows; ++y) {
+      out.write(reinterpret_cast<const char*>(depth.ptr<float>(y)), depth.cols * sizeof(float));
+    }
+
+    if (!out) {
+      out.close();
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+
+  if (std::rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
 
-Image1f LoadDepthTif(const std::string& filepath)
+  return true;
+}
+
+
+MappedImage::MappedImage(void* addr, size_t length, size_t data_offset, bool writable, const cv::Mat& image)
+    : addr_(addr), length_(length), data_offset_(data_offset), writable_(writable), image_(image) {}
+
+
+MappedImage::~MappedImage()
 {
-  return cv::imread(filepath, CV_LOAD_IMAGE_ANYDEPTH);
+  image_.release();
+  ::munmap(addr_, length_);
 }
 
 
+MappedImage::Ptr MappedImage::Create(const std::string& path, int rows, int cols, int type)
+{
+  CHECK(rows > 0 && cols > 0) << "Can't create an empty MappedImage" << std::endl;
+
+  MappedImageHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMappedImageMagic, sizeof(kMappedImageMagic));
+  header.version = kMappedImageVersion;
+  header.type = type;
+  header.rows = static_cast<uint32_t>(rows);
+  header.cols = static_cast<uint32_t>(cols);
+  header.data_offset = kMappedImageDataOffset;
+
+  const size_t length = header.data_offset + static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+
+  const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  // The file is sparse until the pixels are written.
+  const bool ok = ::ftruncate(fd, static_cast<off_t>(length)) == 0 &&
+                  ::pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+  ::close(fd);
+
+  return ok ? Open(path, true) : nullptr;
+}
+
+
+MappedImage::Ptr MappedImage::Open(const std::string& path, bool writable)
+{
+  const int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  MappedImageHeader header;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || ::pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+    ::close(fd);
+    return nullptr;
+  }
+
+  const size_t length = static_cast<size_t>(st.st_size);
+  const size_t data_size = static_cast<size_t>(header.rows) * header.cols * CV_ELEM_SIZE(header.type);
+  const bool valid =
+      memcmp(header.magic, kMappedImageMagic, sizeof(kMappedImageMagic)) == 0 &&
+      header.version == kMappedImageVersion &&
+      header.rows > 0 && header.cols > 0 &&
+      header.data_offset % kMappedImageDataOffset == 0 &&
+      header.data_offset + data_size <= length;
+
+  if (!valid) {
+    ::close(fd);
+    return nullptr;
+  }
+
+  const int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  void* addr = ::mmap(nullptr, length, prot, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+
+  // Reads go through the image in order (see EnhanceUnderwaterTiled()).
+  ::madvise(addr, length, MADV_SEQUENTIAL);
+
+  const cv::Mat image(static_cast<int>(header.rows), static_cast<int>(header.cols), header.type,
+                      static_cast<char*>(addr) + header.data_offset);
+
+  return Ptr(new MappedImage(addr, length, static_cast<size_t>(header.data_offset), writable, image));
+}
+
+
+void MappedImage::Release(int row_begin, int row_end) const
+{
+  row_begin = std::max(0, row_begin);
+  row_end = std::min(image_.rows, row_end);
+  if (row_begin >= row_end) {
+    return;
+  }
+
+  // Only whole pages can be dropped, so the pages at either end stay (they're shared with the rows
+  // next to this range).
+  const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  const size_t begin = data_offset_ + static_cast<size_t>(row_begin) * image_.step[0];
+  const size_t end = data_offset_ + static_cast<size_t>(row_end) * image_.step[0];
+  const size_t page_begin = (begin + page - 1) / page * page;
+  const size_t page_end = (row_end == image_.rows) ? (end + page - 1) / page * page : end / page * page;
+  if (page_begin >= page_end) {
+    return;
+  }
+
+  char* addr = static_cast<char*>(addr_) + page_begin;
+  const size_t length = std::min(page_end, length_) - page_begin;
+
+  // NOTE(milo): Dropping a shared mapping doesn't lose writes (they're in the page cache), but start
+  // writing them out so that the page cache doesn't fill up with dirty pages either.
+  if (writable_) {
+    ::msync(addr, length, MS_ASYNC);
+  }
+  ::madvise(addr, length, MADV_DONTNEED);
+}
+
+
+bool MappedImage::Flush() const
+{
+  return !writable_ || ::msync(addr_, length_, MS_SYNC) == 0;
+}
+
+
+bool WriteMappedImage(const std::string& path, const cv::Mat& image)
+{
+  const MappedImage::Ptr mapped = MappedImage::Create(path, image.rows, image.cols, image.type());
+  if (!mapped) {
+    return false;
+  }
+  image.copyTo(mapped->Image());
+  return mapped->Flush();
+}
+
+
+MappedDepth::Ptr MapDepthTif(const std::string& filepath, const std::string& cache_dir)
+{
+  CHECK(!cache_dir.empty()) << "MapDepthTif() needs a cache directory" << std::endl;
+
+  const std::string cache_path = DepthCachePath(filepath, cache_dir);
+  MappedDepth::Ptr mapped = MappedDepth::Open(cache_path, filepath);
+
+  if (mapped) {
+    return mapped;
+  }
+
+  const Image1f depth = cv::imread(filepath, CV_LOAD_IMAGE_ANYDEPTH);
+  if (depth.empty()) {
+    return nullptr;
+  }
+
+  boost::system::error_code ec;
+  fs::create_directories(cache_dir, ec);
+
+  if (!WriteDepthCache(cache_path, filepath, depth)) {
+    LOG(WARNING) << "Could not write depth cache file: " << cache_path << std::endl;
+    return nullptr;
+  }
+
+  return MappedDepth::Open(cache_path, filepath);
+}
+
+
+Image1f LoadDepthTif(const std::string& filepath, const std::string& cache_dir)
+{
+  if (cache_dir.empty()) {
+    return cv::imread(filepath, CV_LOAD_IMAGE_ANYDEPTH);
+  }
+
+  const std::string cache_path = DepthCachePath(filepath, cache_dir);
+  const MappedDepth::Ptr mapped = MappedDepth::Open(cache_path, filepath);
+  if (mapped) {
+    return mapped->Image().clone();
+  }
+
+  const Image1f depth = cv::imread(filepath, CV_LOAD_IMAGE_ANYDEPTH);
+
+  // NOTE(milo): A cache that can't be written (e.g a read-only disk) only costs the speedup.
+  if (!depth.empty()) {
+    boost::system::error_code ec;
+    fs::create_directories(cache_dir, ec);
+    if (!WriteDepthCache(cache_path, filepath, depth)) {
+      LOG(WARNING) << "Could not write depth cache file: " << cache_path << std::endl;
+    }
+  }
+
+  return depth;
+}
+
 }
 }
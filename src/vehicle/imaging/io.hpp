@@ -1,5 +1,8 @@
 #pragma once
 
+#include <string>
+
+#include "core/macros.hpp"
 #include "vision_core/cv_types.hpp"
 
 namespace bm {
@@ -7,8 +10,112 @@ namespace imaging {
 
 using namespace core;
 
-// Load the depth maps from Sea-thru paper.
-Image1f LoadDepthTif(const std::string& filepath);
+
+// Where LoadDepthTif() and MapDepthTif() keep decoded depth maps, unless the BM_DEPTH_CACHE_DIR
+// environment variable is set.
+static const char* const kDefaultDepthCacheDir = "/tmp/bm_depth_cache";
+
+
+// The cache directory that LoadDepthTif() uses by default (see above).
+std::string DepthCacheDir();
+
+
+// A decoded depth map in the cache, memory mapped. Image() points into the mapping (no copy), so
+// it's only valid while this object is alive. The mapping is private, so writing to Image() is
+// allowed, but doesn't change the cache file.
+class MappedDepth final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(MappedDepth);
+  MACRO_DELETE_COPY_CONSTRUCTORS(MappedDepth);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MappedDepth);
+
+  // Maps a cache file written by WriteDepthCache(). Returns nullptr if it can't be read, or if it
+  // wasn't made from the source file at source_path as it is now (path, size and mtime).
+  static Ptr Open(const std::string& cache_path, const std::string& source_path);
+
+  ~MappedDepth();
+
+  const Image1f& Image() const { return image_; }
+  Image1f& Image() { return image_; }
+
+ private:
+  MappedDepth(void* addr, size_t length, const Image1f& image);
+
+  void* addr_;
+  size_t length_;
+  Image1f image_;
+};
+
+
+// An image in a raw file (a small header, then the rows with no padding), memory mapped and shared
+// with the file, so that writes to Image() go to the file. For images that are too big for RAM
+// (e.g survey mosaics): only the pages that were touched recently are resident, and Release() hands
+// a range of rows back to the kernel once it's done with them.
+class MappedImage final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(MappedImage);
+  MACRO_DELETE_COPY_CONSTRUCTORS(MappedImage);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MappedImage);
+
+  // Creates (or overwrites) a writable file for a rows x cols image of an OpenCV type (e.g CV_32FC3).
+  // The pixels start out zero, without writing them. Returns nullptr on failure.
+  static Ptr Create(const std::string& path, int rows, int cols, int type);
+
+  // Maps an existing file. Returns nullptr if it can't be read, or isn't a MappedImage.
+  static Ptr Open(const std::string& path, bool writable = false);
+
+  ~MappedImage();
+
+  const cv::Mat& Image() const { return image_; }
+  cv::Mat& Image() { return image_; }
+  bool Writable() const { return writable_; }
+
+  // Drops the pages of rows [row_begin, row_end) from this process (written back first if
+  // Writable()). The data stays valid, and is read back from the file if it's used again.
+  void Release(int row_begin, int row_end) const;
+
+  // Writes all changes back to the file, and returns whether that worked.
+  bool Flush() const;
+
+ private:
+  MappedImage(void* addr, size_t length, size_t data_offset, bool writable, const cv::Mat& image);
+
+  void* addr_;
+  size_t length_;
+  size_t data_offset_;
+  bool writable_;
+  cv::Mat image_;
+};
+
+
+// Copies an image into a new MappedImage file. Returns false on failure.
+bool WriteMappedImage(const std::string& path, const cv::Mat& image);
+
+
+// The cache file for a depth map (named by a hash of its absolute path) in cache_dir.
+std::string DepthCachePath(const std::string& filepath, const std::string& cache_dir);
+
+
+// Writes depth to a cache file for the source file at source_path (the header records its path,
+// size and mtime). The file is written to a temporary name and then renamed, so that readers in
+// other processes never see a partial cache file. Returns false on failure.
+bool WriteDepthCache(const std::string& cache_path,
+                     const std::string& source_path,
+                     const Image1f& depth);
+
+
+// Load the depth maps from Sea-thru paper. Decoding a float TIFF is slow, so the decoded map is
+// kept in cache_dir (see DepthCachePath()). Later calls use it as long as the TIFF hasn't changed,
+// and only copy the mapped data. An empty cache_dir turns the cache off.
+Image1f LoadDepthTif(const std::string& filepath, const std::string& cache_dir = DepthCacheDir());
+
+
+// Same as above, but returns the mapped cache file itself (zero-copy). Decodes and writes the
+// cache file first if needed. Returns nullptr if the TIFF can't be read, or if the cache can't be
+// written.
+MappedDepth::Ptr MapDepthTif(const std::string& filepath,
+                             const std::string& cache_dir = DepthCacheDir());
+
 
 }
 }
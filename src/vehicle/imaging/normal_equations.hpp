@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+
+#include <eigen3/Eigen/StdVector>
+#include <opencv2/core.hpp>
+
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace imaging {
+
+using namespace core;
+
+
+// Samples per parallel chunk in the functions below. The chunks are fixed (rather than one per
+// thread), and their sums are added up in order, so the results don't depend on the thread count.
+static const int kSamplesPerChunk = 64;
+
+
+// Forms the Gauss-Newton normal equations directly, i.e H = J^T * J and g = -J^T * R, without
+// building the m x 12 J. linearize(i, Ji, Ri) returns the (unweighted) error of sample i and sets
+// its row of the Jacobian Ji and its residual Ri. Returns the mean error over the m samples.
+template <typename LinearizeFunc>
+float AccumulateNormalEquations(int m, const LinearizeFunc& linearize, Matrix12f& H, Vector12f& g)
+{
+  const int num_chunks = (m + kSamplesPerChunk - 1) / kSamplesPerChunk;
+
+  std::vector<Matrix12f, Eigen::aligned_allocator<Matrix12f>> H_chunk(num_chunks);
+  std::vector<Vector12f, Eigen::aligned_allocator<Vector12f>> g_chunk(num_chunks);
+  std::vector<float> err_chunk(num_chunks);
+
+  cv::parallel_for_(cv::Range(0, num_chunks), [&](const cv::Range& chunks)
+  {
+    for (int c = chunks.start; c < chunks.end; ++c) {
+      Matrix12f Hc = Matrix12f::Zero();
+      Vector12f gc = Vector12f::Zero();
+      float ec = 0;
+
+      Vector12f Ji = Vector12f::Zero();
+      float Ri = 0;
+
+      for (int i = c * kSamplesPerChunk; i < std::min(m, (c + 1) * kSamplesPerChunk); ++i) {
+        ec += linearize(i, Ji, Ri);
+
+        // NOTE(milo): Only the upper triangle is updated, it's copied over at the end.
+        Hc.selfadjointView<Eigen::Upper>().rankUpdate(Ji);
+        gc -= Ri * Ji;
+      }
+
+      H_chunk.at(c) = Hc;
+      g_chunk.at(c) = gc;
+      err_chunk.at(c) = ec;
+    }
+  });
+
+  H.setZero();
+  g.setZero();
+  float error = 0;
+
+  for (int c = 0; c < num_chunks; ++c) {
+    H += H_chunk.at(c);
+    g += g_chunk.at(c);
+    error += err_chunk.at(c);
+  }
+
+  for (int row = 1; row < 12; ++row) {
+    for (int col = 0; col < row; ++col) {
+      H(row, col) = H(col, row);
+    }
+  }
+
+  return (m > 0) ? error / static_cast<float>(m) : 0.0f;
+}
+
+
+// Mean of error(i) over m samples, with the same chunking as above.
+template <typename ErrorFunc>
+float MeanErrorParallel(int m, const ErrorFunc& error)
+{
+  const int num_chunks = (m + kSamplesPerChunk - 1) / kSamplesPerChunk;
+  std::vector<float> err_chunk(num_chunks);
+
+  cv::parallel_for_(cv::Range(0, num_chunks), [&](const cv::Range& chunks)
+  {
+    for (int c = chunks.start; c < chunks.end; ++c) {
+      float ec = 0;
+      for (int i = c * kSamplesPerChunk; i < std::min(m, (c + 1) * kSamplesPerChunk); ++i) {
+        ec += error(i);
+      }
+      err_chunk.at(c) = ec;
+    }
+  });
+
+  float total = 0;
+  for (const float ec : err_chunk) {
+    total += ec;
+  }
+
+  return (m > 0) ? total / static_cast<float>(m) : 0.0f;
+}
+
+
+}
+}
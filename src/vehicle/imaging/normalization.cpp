@@ -1,4 +1,8 @@
 #include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 
@@ -6,65 +10,24 @@
 #include "core/math_util.hpp"
 #include "imaging/illuminant.hpp"
 #include "imaging/normalization.hpp"
+#include "imaging/op_graph.hpp"
 
 namespace bm {
 namespace imaging {
 
 
+// NOTE(milo): These are single-op OpGraphs. Chains of them should use an OpGraph directly, which
+// fuses the per-pixel work into fewer passes over the image.
 Image3f EnhanceContrast(const Image3f& bgr)
 {
-  cv::Point pmin, pmax;
-
-  Image1f channels[3];
-
-  Image3f hsv;
-  cv::cvtColor(bgr, hsv, CV_BGR2HSV);
-
-  cv::split(hsv, channels);
-
-  // NOTE(milo): Smooth out high intensity noise to get a better estimate of the min/max values.
-  // The contras-boosted image will look slightly brighter as a result.
-  Image1f smoothed_value;
-  cv::resize(channels[2], smoothed_value, hsv.size() / 8);
-
-  double vmin, vmax;
-  cv::minMaxLoc(smoothed_value, &vmin, &vmax, &pmin, &pmax);
-
-  channels[2] = (channels[2] - vmin) / (vmax - vmin);
-  cv::merge(channels, 3, hsv);
-
-  Image3f out;
-  cv::cvtColor(hsv, out, CV_HSV2BGR);
-
-  return out;
+  return Normalize(bgr);
 }
 
 
 Image3f Normalize(const Image3f& bgr)
 {
-  cv::Point pmin, pmax;
-
-  Image1f channels[3];
-
-  Image3f hsv;
-  cv::cvtColor(bgr, hsv, CV_BGR2HSV);
-
-  cv::split(hsv, channels);
-
-  // NOTE(milo): Smooth out high intensity noise to get a better estimate of the min/max values.
-  // The contrast-boosted image will look slightly brighter as a result.
-  Image1f smoothed_value;
-  cv::resize(channels[2], smoothed_value, hsv.size() / 8);
-
-  double vmin, vmax;
-  cv::minMaxLoc(smoothed_value, &vmin, &vmax, &pmin, &pmax);
-
-  channels[2] = (channels[2] - vmin) / (vmax - vmin);
-  cv::merge(channels, 3, hsv);
-
   Image3f out;
-  cv::cvtColor(hsv, out, CV_HSV2BGR);
-
+  OpGraph().Normalize().Run(bgr, out);
   return out;
 }
 
@@ -78,34 +41,8 @@ Image3f EnhanceContrastFactor(const Image3f& bgr)
 
 Image3f WhiteBalanceSimple(const Image3f& bgr)
 {
-  double bmin, bmax, gmin, gmax, rmin, rmax;
-  cv::Point pmin, pmax;
-
-  // Smooth out high intensity noise to get a better min/max estimate.
-  Image3f bgr_smoothed;
-  cv::resize(bgr, bgr_smoothed, bgr.size() / 8);
-
-  Image1f channels[3];
-  cv::split(bgr_smoothed, channels);
-  cv::minMaxLoc(channels[0], &bmin, &bmax, &pmin, &pmax);
-  cv::minMaxLoc(channels[1], &gmin, &gmax, &pmin, &pmax);
-  cv::minMaxLoc(channels[2], &rmin, &rmax, &pmin, &pmax);
-
-  // NOTE(milo): Make sure that we don't divide by zero (e.g monochrome image case).
-  const double db = (bmax - bmin) > 0 ? (bmax - bmin) : 1;
-  const double dg = (gmax - gmin) > 0 ? (gmax - gmin) : 1;
-  const double dr = (rmax - rmin) > 0 ? (rmax - rmin) : 1;
-
-  Image1f Ic[3];
-  cv::split(bgr, Ic);
-
-  Image3f out = Image3f(bgr.size(), 0);
-  Ic[0] = (Ic[0] - bmin) / db;
-  Ic[1] = (Ic[1] - gmin) / dg;
-  Ic[2] = (Ic[2] - rmin) / dr;
-
-  cv::merge(Ic, 3, out);
-
+  Image3f out;
+  OpGraph().WhiteBalanceSimple().Run(bgr, out);
   return out;
 }
 
@@ -113,7 +50,7 @@ Image3f WhiteBalanceSimple(const Image3f& bgr)
 Image3f LinearToGamma(const Image3f& bgr_linear, float gamma_power)
 {
   Image3f out;
-  cv::pow(bgr_linear, gamma_power, out);
+  OpGraph().LinearToGamma(gamma_power).Run(bgr_linear, out);
   return out;
 }
 
@@ -121,7 +58,7 @@ Image3f LinearToGamma(const Image3f& bgr_linear, float gamma_power)
 Image3f GammaToLinear(const Image3f& bgr_gamma, float gamma_power)
 {
   Image3f out;
-  cv::pow(bgr_gamma, gamma_power, out);
+  OpGraph().GammaToLinear(gamma_power).Run(bgr_gamma, out);
   return out;
 }
 
@@ -129,7 +66,7 @@ Image3f GammaToLinear(const Image3f& bgr_gamma, float gamma_power)
 Image1f LinearToGamma(const Image1f& bgr_linear, float gamma_power)
 {
   Image1f out;
-  cv::pow(bgr_linear, gamma_power, out);
+  OpGraph().LinearToGamma(gamma_power).Run(bgr_linear, out);
   return out;
 }
 
@@ -137,7 +74,7 @@ Image1f LinearToGamma(const Image1f& bgr_linear, float gamma_power)
 Image1f GammaToLinear(const Image1f& bgr_gamma, float gamma_power)
 {
   Image1f out;
-  cv::pow(bgr_gamma, gamma_power, out);
+  OpGraph().GammaToLinear(gamma_power).Run(bgr_gamma, out);
   return out;
 }
 
@@ -155,22 +92,8 @@ Image3f EnhanceContrastDerya(const Image3f& bgr, float vmin, float vmax)
 
 Image3f CorrectColorRatio(const Image3f& bgr)
 {
-  Image1f channels[3];
-  cv::split(bgr, channels);
-
-  const cv::Scalar bgr_mean = cv::mean(bgr);
-  std::cout << bgr_mean << std::endl;
-
-  const float blue_ratio = bgr_mean(1) / bgr_mean(0);
-  const float red_ratio = bgr_mean(1) / bgr_mean(2);
-  printf("Blue ratio = %f // Red ratio = %f\n", blue_ratio, red_ratio);
-
-  channels[0] *= (bgr_mean(1) / bgr_mean(0));
-  channels[2] *= (bgr_mean(1) / bgr_mean(2));
-
   Image3f out;
-  cv::merge(channels, 3, out);
-
+  OpGraph().CorrectColorRatio().Run(bgr, out);
   return out;
 }
 
@@ -187,19 +110,176 @@ Image3f NormalizeColorIlluminant(const Image3f bgr)
 
 Image1f Sharpen(const Image1f& gray)
 {
-  Image1f blurred;
-  double sigma = 1.0;
-  double threshold = 0.01;
-  double amount = 0.5;
+  Image1f out;
+  OpGraph().Sharpen().Run(gray, out);
+  return out;
+}
+
+
+// 1 x 256 table of round(f(x)), saturated to [0, 255].
+template <typename Func>
+static cv::Mat MakeLut8(const Func& f)
+{
+  cv::Mat lut(1, 256, CV_8UC1);
+  for (int x = 0; x < 256; ++x) {
+    lut.at<uint8_t>(x) = cv::saturate_cast<uint8_t>(f(static_cast<float>(x)));
+  }
+  return lut;
+}
+
+
+// Per-channel version of the above (cv::LUT applies each channel of the table to that channel).
+template <typename Func>
+static cv::Mat MakeLut8PerChannel(const Func& f)
+{
+  cv::Mat lut(1, 256, CV_8UC3);
+  for (int x = 0; x < 256; ++x) {
+    for (int c = 0; c < 3; ++c) {
+      lut.at<cv::Vec3b>(x)[c] = cv::saturate_cast<uint8_t>(f(c, static_cast<float>(x)));
+    }
+  }
+  return lut;
+}
+
+
+void Normalize(const Image3b& bgr, Image3b& out)
+{
+  // NOTE(milo): Same smoothing as the Image3f version, but the value (max over bgr) is taken after
+  // downsampling, which only changes vmin/vmax by a little.
+  Image3b smoothed;
+  cv::resize(bgr, smoothed, bgr.size() / 8);
+
+  int vmin = 255, vmax = 0;
+  for (int y = 0; y < smoothed.rows; ++y) {
+    for (int x = 0; x < smoothed.cols; ++x) {
+      const cv::Vec3b& p = smoothed(y, x);
+      const int v = std::max(p[0], std::max(p[1], p[2]));
+      vmin = std::min(vmin, v);
+      vmax = std::max(vmax, v);
+    }
+  }
+  const float dv = (vmax > vmin) ? static_cast<float>(vmax - vmin) : 1.0f;
+
+  // Stretching the value and keeping hue and saturation is the same as scaling all channels by
+  // V' / V (see EnhanceContrast()). The gain is in 16.16 fixed point, and since each channel is
+  // <= V, the product can't overflow.
+  int32_t gain[256];
+  gain[0] = 0;
+  for (int v = 1; v < 256; ++v) {
+    const float v_stretched = std::min(std::max(255.0f * (v - vmin) / dv, 0.0f), 255.0f);
+    gain[v] = static_cast<int32_t>(65536.0f * v_stretched / static_cast<float>(v) + 0.5f);
+  }
+
+  out.create(bgr.rows, bgr.cols);
+
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range& rows)
+  {
+    for (int y = rows.start; y < rows.end; ++y) {
+      const uint8_t* in_row = bgr.ptr<uint8_t>(y);
+      uint8_t* out_row = out.ptr<uint8_t>(y);
+
+      for (int x = 0; x < 3 * bgr.cols; x += 3) {
+        const uint8_t b = in_row[x], g = in_row[x + 1], r = in_row[x + 2];
+        const int32_t k = gain[std::max(b, std::max(g, r))];
+        out_row[x] = static_cast<uint8_t>((b * k + 32768) >> 16);
+        out_row[x + 1] = static_cast<uint8_t>((g * k + 32768) >> 16);
+        out_row[x + 2] = static_cast<uint8_t>((r * k + 32768) >> 16);
+      }
+    }
+  });
+}
+
+
+void WhiteBalanceSimple(const Image3b& bgr, Image3b& out)
+{
+  // Smooth out high intensity noise to get a better min/max estimate.
+  Image3b bgr_smoothed;
+  cv::resize(bgr, bgr_smoothed, bgr.size() / 8);
 
-  cv::GaussianBlur(gray, blurred, cv::Size(3, 3), sigma, sigma);
+  float cmin[3] = { 255, 255, 255 };
+  float cmax[3] = { 0, 0, 0 };
+  for (int y = 0; y < bgr_smoothed.rows; ++y) {
+    for (int x = 0; x < bgr_smoothed.cols; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        cmin[c] = std::min(cmin[c], static_cast<float>(bgr_smoothed(y, x)[c]));
+        cmax[c] = std::max(cmax[c], static_cast<float>(bgr_smoothed(y, x)[c]));
+      }
+    }
+  }
 
-  Image1b low_contrast_mask = cv::abs(gray - blurred) < threshold;
-  Image1f sharpened = gray*(1 + amount) - blurred*amount;
+  // NOTE(milo): Make sure that we don't divide by zero (e.g monochrome image case).
+  const cv::Mat lut = MakeLut8PerChannel([&](int c, float x)
+  {
+    const float dc = (cmax[c] - cmin[c]) > 0 ? (cmax[c] - cmin[c]) : 255.0f;
+    return 255.0f * (x - cmin[c]) / dc;
+  });
+
+  cv::LUT(bgr, lut, out);
+}
 
-  gray.copyTo(sharpened, low_contrast_mask);
 
-  return sharpened;
+void CorrectColorRatio(const Image3b& bgr, Image3b& out)
+{
+  const cv::Scalar bgr_mean = cv::mean(bgr);
+
+  // Blue and red are scaled to match the mean of green.
+  const float ratio[3] = {
+    static_cast<float>(bgr_mean(1) / std::max(bgr_mean(0), 1.0)),
+    1.0f,
+    static_cast<float>(bgr_mean(1) / std::max(bgr_mean(2), 1.0))
+  };
+
+  const cv::Mat lut = MakeLut8PerChannel([&](int c, float x) { return ratio[c] * x; });
+  cv::LUT(bgr, lut, out);
+}
+
+
+void LinearToGamma(const Image3b& bgr_linear, Image3b& out, float gamma_power)
+{
+  GammaLut(gamma_power).Apply(bgr_linear, out);
+}
+
+
+void GammaToLinear(const Image3b& bgr_gamma, Image3b& out, float gamma_power)
+{
+  GammaLut(gamma_power).Apply(bgr_gamma, out);
+}
+
+
+GammaLut::GammaLut(float gamma_power)
+    : gamma_power_(gamma_power),
+      lut16_(65536)
+{
+  CHECK_GT(gamma_power, 0);
+
+  lut8_ = MakeLut8([&](float x) { return 255.0f * std::pow(x / 255.0f, gamma_power); });
+
+  for (int x = 0; x < 65536; ++x) {
+    lut16_.at(x) = cv::saturate_cast<uint8_t>(255.0f * std::pow(x / 65535.0f, gamma_power));
+  }
+}
+
+
+void GammaLut::Apply(const Image3b& in, Image3b& out) const
+{
+  cv::LUT(in, lut8_, out);
+}
+
+
+void GammaLut::Apply(const Image3w& in, Image3b& out) const
+{
+  out.create(in.rows, in.cols);
+
+  cv::parallel_for_(cv::Range(0, in.rows), [&](const cv::Range& rows)
+  {
+    for (int y = rows.start; y < rows.end; ++y) {
+      const uint16_t* in_row = in.ptr<uint16_t>(y);
+      uint8_t* out_row = out.ptr<uint8_t>(y);
+      for (int x = 0; x < 3 * in.cols; ++x) {
+        out_row[x] = lut16_[in_row[x]];
+      }
+    }
+  });
 }
 
 }
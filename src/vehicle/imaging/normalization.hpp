@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
+#include "core/macros.hpp"
 #include "vision_core/cv_types.hpp"
 #include "core/eigen_types.hpp"
 
@@ -44,5 +48,38 @@ Image3f NormalizeColorIlluminant(const Image3f bgr);
 Image1f Sharpen(const Image1f& gray);
 
 
+// 8-bit versions of the functions above, for running on every live frame without converting to
+// Image3f. The per-pixel math is done with lookup tables (and a fixed-point gain in Normalize()),
+// and the results saturate to [0, 255]. out is only allocated if its size changes, and can be the
+// same image as bgr.
+void Normalize(const Image3b& bgr, Image3b& out);
+void WhiteBalanceSimple(const Image3b& bgr, Image3b& out);
+void CorrectColorRatio(const Image3b& bgr, Image3b& out);
+void LinearToGamma(const Image3b& bgr_linear, Image3b& out, float gamma_power = 0.4545f);
+void GammaToLinear(const Image3b& bgr_gamma, Image3b& out, float gamma_power = 2.2f);
+
+
+// Lookup tables for x^gamma_power, with 8-bit output. The 16-bit table takes linear frames (e.g
+// from a raw camera) straight to an 8-bit gamma encoded image, without losing the dark tones to
+// 8-bit quantization first. Build once and reuse, since the 16-bit table has 65536 entries.
+class GammaLut final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(GammaLut);
+
+  explicit GammaLut(float gamma_power = 0.4545f);
+
+  // out can be the same image as in.
+  void Apply(const Image3b& in, Image3b& out) const;
+  void Apply(const Image3w& in, Image3b& out) const;
+
+  float GammaPower() const { return gamma_power_; }
+
+ private:
+  float gamma_power_;
+  cv::Mat lut8_;                  // 1 x 256, CV_8UC1
+  std::vector<uint8_t> lut16_;    // 65536 entries
+};
+
+
 }
 }
@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "imaging/fused_correction.hpp"
+#include "imaging/op_graph.hpp"
+
+namespace bm {
+namespace imaging {
+
+
+// Scales every channel by V' / V, where V = max(b, g, r) and V' = (V - vmin) / (vmax - vmin), which
+// is the same as stretching the value in HSV and converting back.
+class NormalizeOp final : public ImagingOp {
+ public:
+  std::string Name() const override { return "Normalize"; }
+  bool IsBarrier() const override { return true; }
+
+  void Prepare(const cv::Mat& input, const Image1f&) override
+  {
+    Image1f value(input.rows, input.cols);
+    cv::parallel_for_(cv::Range(0, input.rows), [&](const cv::Range& rows)
+    {
+      for (int y = rows.start; y < rows.end; ++y) {
+        const float* in_row = input.ptr<float>(y);
+        float* value_row = value.ptr<float>(y);
+        for (int x = 0; x < input.cols; ++x) {
+          value_row[x] = MaxF(in_row[3*x], MaxF(in_row[3*x + 1], in_row[3*x + 2]));
+        }
+      }
+    });
+
+    // NOTE(milo): Smooth out high intensity noise to get a better estimate of the min/max values.
+    // The contrast-boosted image will look slightly brighter as a result.
+    Image1f smoothed_value;
+    cv::resize(value, smoothed_value, value.size() / 8);
+
+    double vmin, vmax;
+    cv::Point pmin, pmax;
+    cv::minMaxLoc(smoothed_value, &vmin, &vmax, &pmin, &pmax);
+    vmin_ = static_cast<float>(vmin);
+    vmax_ = static_cast<float>(vmax);
+  }
+
+  void ApplyRow(int, const float*, int cols, int, float* row) const override
+  {
+    const float dv = vmax_ - vmin_;
+    for (int x = 0; x < cols; ++x) {
+      float* px = row + 3*x;
+      const float v = MaxF(px[0], MaxF(px[1], px[2]));
+      const float v_stretched = (v - vmin_) / dv;
+
+      // A black pixel has no hue, so it comes back out gray.
+      const bool black = (v <= 0.0f);
+      const float scale = black ? 0.0f : (v_stretched / v);
+      const float offset = black ? v_stretched : 0.0f;
+      px[0] = px[0] * scale + offset;
+      px[1] = px[1] * scale + offset;
+      px[2] = px[2] * scale + offset;
+    }
+  }
+
+ private:
+  float vmin_ = 0;
+  float vmax_ = 1;
+};
+
+
+class WhiteBalanceSimpleOp final : public ImagingOp {
+ public:
+  std::string Name() const override { return "WhiteBalanceSimple"; }
+  bool IsBarrier() const override { return true; }
+
+  void Prepare(const cv::Mat& input, const Image1f&) override
+  {
+    // Smooth out high intensity noise to get a better min/max estimate.
+    Image3f smoothed;
+    cv::resize(input, smoothed, input.size() / 8);
+
+    Image1f channels[3];
+    cv::split(smoothed, channels);
+
+    for (int c = 0; c < 3; ++c) {
+      double cmin, cmax;
+      cv::Point pmin, pmax;
+      cv::minMaxLoc(channels[c], &cmin, &cmax, &pmin, &pmax);
+
+      // NOTE(milo): Make sure that we don't divide by zero (e.g monochrome image case).
+      cmin_[c] = static_cast<float>(cmin);
+      inv_range_[c] = static_cast<float>(1.0 / ((cmax - cmin) > 0 ? (cmax - cmin) : 1));
+    }
+  }
+
+  void ApplyRow(int, const float*, int cols, int, float* row) const override
+  {
+    for (int x = 0; x < cols; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        row[3*x + c] = (row[3*x + c] - cmin_[c]) * inv_range_[c];
+      }
+    }
+  }
+
+ private:
+  float cmin_[3] = { 0, 0, 0 };
+  float inv_range_[3] = { 1, 1, 1 };
+};
+
+
+// Scales blue and red so that their means match the mean of green.
+class CorrectColorRatioOp final : public ImagingOp {
+ public:
+  std::string Name() const override { return "CorrectColorRatio"; }
+  bool IsBarrier() const override { return true; }
+
+  void Prepare(const cv::Mat& input, const Image1f&) override
+  {
+    const cv::Scalar bgr_mean = cv::mean(input);
+    ratio_[0] = static_cast<float>(bgr_mean(1) / bgr_mean(0));
+    ratio_[1] = 1.0f;
+    ratio_[2] = static_cast<float>(bgr_mean(1) / bgr_mean(2));
+  }
+
+  void ApplyRow(int, const float*, int cols, int, float* row) const override
+  {
+    for (int x = 0; x < cols; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        row[3*x + c] *= ratio_[c];
+      }
+    }
+  }
+
+ private:
+  float ratio_[3] = { 1, 1, 1 };
+};
+
+
+// NOTE(milo): Same as cv::pow() with a non-integer power, which uses the absolute value.
+class PowOp final : public ImagingOp {
+ public:
+  PowOp(const std::string& name, float power) : name_(name), power_(power) {}
+
+  std::string Name() const override { return name_; }
+  bool SupportsChannels(int channels) const override { return channels == 1 || channels == 3; }
+
+  void ApplyRow(int, const float*, int cols, int channels, float* row) const override
+  {
+    for (int i = 0; i < cols * channels; ++i) {
+      row[i] = std::pow(std::fabs(row[i]), power_);
+    }
+  }
+
+ private:
+  std::string name_;
+  float power_;
+};
+
+
+class RemoveBackscatterOp final : public ImagingOp {
+ public:
+  RemoveBackscatterOp(const Vector3f& B, const Vector3f& beta_B)
+  {
+    for (int c = 0; c < 3; ++c) {
+      B_[c] = B(c);
+      beta_B_[c] = beta_B(c);
+    }
+  }
+
+  std::string Name() const override { return "RemoveBackscatter"; }
+
+  void Prepare(const cv::Mat& input, const Image1f& range) override
+  {
+    CHECK(range.size() == input.size()) << "RemoveBackscatter needs a range image" << std::endl;
+  }
+
+  void ApplyRow(int, const float* range_row, int cols, int, float* row) const override
+  {
+    for (int x = 0; x < cols; ++x) {
+      // Pixels without a range are treated as background.
+      const float r = range_row[x];
+      const float z = (r > 1e-3f) ? r : (r + kBackscatterBackgroundRange);
+      for (int c = 0; c < 3; ++c) {
+        const float backscatter = B_[c] * (1.0f - std::exp(-beta_B_[c] * z));
+        row[3*x + c] = MaxF(row[3*x + c] - backscatter, 0.0f);
+      }
+    }
+  }
+
+ private:
+  float B_[3];
+  float beta_B_[3];
+};
+
+
+class CorrectAttenuationOp final : public ImagingOp {
+ public:
+  explicit CorrectAttenuationOp(const Vector12f& beta_D)
+  {
+    for (int i = 0; i < 12; ++i) {
+      beta_D_[i] = beta_D(i);
+    }
+  }
+
+  std::string Name() const override { return "CorrectAttenuation"; }
+
+  void Prepare(const cv::Mat& input, const Image1f& range) override
+  {
+    CHECK(range.size() == input.size()) << "CorrectAttenuation needs a range image" << std::endl;
+
+    double rmin, rmax;
+    cv::Point pmin, pmax;
+    cv::minMaxLoc(range, &rmin, &rmax, &pmin, &pmax);
+    max_range_ = static_cast<float>(rmax);
+  }
+
+  void ApplyRow(int, const float* range_row, int cols, int, float* row) const override
+  {
+    const float* X = beta_D_;
+    for (int x = 0; x < cols; ++x) {
+      // Pixels without a range are treated as the farthest range in the image.
+      const float r = range_row[x];
+      const float z = (r > 0.0f) ? r : (r + max_range_);
+      for (int c = 0; c < 3; ++c) {
+        const float beta = X[c] * std::exp(X[3 + c] * z) + X[6 + c] * std::exp(X[9 + c] * z);
+        row[3*x + c] *= std::exp(z * beta);
+      }
+    }
+  }
+
+ private:
+  float beta_D_[12];
+  float max_range_ = 0;
+};
+
+
+// Unsharp mask, except where the image is already within kThreshold of its blur.
+class SharpenOp final : public ImagingOp {
+ public:
+  std::string Name() const override { return "Sharpen"; }
+  bool IsBarrier() const override { return true; }
+  bool SupportsChannels(int channels) const override { return channels == 1 || channels == 3; }
+
+  void Prepare(const cv::Mat& input, const Image1f&) override
+  {
+    cv::GaussianBlur(input, blurred_, cv::Size(3, 3), kSigma, kSigma);
+  }
+
+  void ApplyRow(int y, const float*, int cols, int channels, float* row) const override
+  {
+    const float* blurred_row = blurred_.ptr<float>(y);
+    for (int i = 0; i < cols * channels; ++i) {
+      const float v = row[i];
+      const float sharpened = v * (1.0f + kAmount) - blurred_row[i] * kAmount;
+      row[i] = (std::fabs(v - blurred_row[i]) < kThreshold) ? v : sharpened;
+    }
+  }
+
+ private:
+  static constexpr double kSigma = 1.0;
+  static constexpr float kThreshold = 0.01f;
+  static constexpr float kAmount = 0.5f;
+
+  cv::Mat blurred_;   // Kept across runs, so it's only allocated when the size changes.
+};
+
+
+OpGraph::OpGraph(int tile_rows)
+    : tile_rows_(tile_rows)
+{
+  CHECK_GT(tile_rows, 0);
+}
+
+
+OpGraph& OpGraph::Normalize() { return Add(std::unique_ptr<ImagingOp>(new NormalizeOp())); }
+OpGraph& OpGraph::WhiteBalanceSimple() { return Add(std::unique_ptr<ImagingOp>(new WhiteBalanceSimpleOp())); }
+OpGraph& OpGraph::CorrectColorRatio() { return Add(std::unique_ptr<ImagingOp>(new CorrectColorRatioOp())); }
+OpGraph& OpGraph::Sharpen() { return Add(std::unique_ptr<ImagingOp>(new SharpenOp())); }
+
+
+OpGraph& OpGraph::LinearToGamma(float gamma_power)
+{
+  return Add(std::unique_ptr<ImagingOp>(new PowOp("LinearToGamma", gamma_power)));
+}
+
+
+OpGraph& OpGraph::GammaToLinear(float gamma_power)
+{
+  return Add(std::unique_ptr<ImagingOp>(new PowOp("GammaToLinear", gamma_power)));
+}
+
+
+OpGraph& OpGraph::RemoveBackscatter(const Vector3f& B, const Vector3f& beta_B)
+{
+  return Add(std::unique_ptr<ImagingOp>(new RemoveBackscatterOp(B, beta_B)));
+}
+
+
+OpGraph& OpGraph::CorrectAttenuation(const Vector12f& beta_D)
+{
+  return Add(std::unique_ptr<ImagingOp>(new CorrectAttenuationOp(beta_D)));
+}
+
+
+OpGraph& OpGraph::Add(std::unique_ptr<ImagingOp> op)
+{
+  CHECK(op != nullptr);
+
+  // The first op can always look at its input (the input to Run()), so only later barriers need
+  // the previous pass to be stored.
+  if (passes_.empty() || op->IsBarrier()) {
+    passes_.emplace_back(Pass{ ops_.size(), ops_.size() + 1 });
+  } else {
+    passes_.back().end = ops_.size() + 1;
+  }
+
+  ops_.emplace_back(std::move(op));
+  return *this;
+}
+
+
+std::string OpGraph::Plan() const
+{
+  std::string plan;
+  for (const Pass& pass : passes_) {
+    plan += plan.empty() ? "[" : " [";
+    for (size_t i = pass.begin; i < pass.end; ++i) {
+      plan += ((i == pass.begin) ? "" : " ") + ops_.at(i)->Name();
+    }
+    plan += "]";
+  }
+  return plan;
+}
+
+
+void OpGraph::Run(const Image3f& bgr, const Image1f& range, Image3f& out)
+{
+  RunPasses(bgr, range, out);
+}
+
+
+void OpGraph::Run(const Image3f& bgr, Image3f& out)
+{
+  RunPasses(bgr, Image1f(), out);
+}
+
+
+void OpGraph::Run(const Image1f& gray, Image1f& out)
+{
+  RunPasses(gray, Image1f(), out);
+}
+
+
+void OpGraph::RunPasses(const cv::Mat& in, const Image1f& range, cv::Mat& out)
+{
+  const int channels = in.channels();
+  for (const std::unique_ptr<ImagingOp>& op : ops_) {
+    CHECK(op->SupportsChannels(channels)) << op->Name() << " can't run on " << channels << " channels" << std::endl;
+  }
+
+  if (passes_.empty()) {
+    in.copyTo(out);
+    return;
+  }
+
+  const size_t row_bytes = in.cols * in.elemSize();
+  const int num_tiles = (in.rows + tile_rows_ - 1) / tile_rows_;
+
+  for (size_t p = 0; p < passes_.size(); ++p) {
+    const Pass& pass = passes_.at(p);
+    const cv::Mat& src = (p == 0) ? in : buffers_[(p - 1) % 2];
+    cv::Mat& dst = (p + 1 == passes_.size()) ? out : buffers_[p % 2];
+
+    for (size_t i = pass.begin; i < pass.end; ++i) {
+      ops_.at(i)->Prepare(src, range);
+    }
+
+    // NOTE(milo): Doesn't reallocate if dst is already the right size (e.g the buffers after the
+    // first run, or out when it's the same image as in).
+    dst.create(src.rows, src.cols, src.type());
+
+    cv::parallel_for_(cv::Range(0, num_tiles), [&](const cv::Range& tiles)
+    {
+      const int y0 = tiles.start * tile_rows_;
+      const int y1 = std::min(src.rows, tiles.end * tile_rows_);
+      for (int y = y0; y < y1; ++y) {
+        float* row = dst.ptr<float>(y);
+        if (src.data != dst.data) {
+          memcpy(row, src.ptr<float>(y), row_bytes);
+        }
+
+        const float* range_row = range.empty() ? nullptr : range.ptr<float>(y);
+        for (size_t i = pass.begin; i < pass.end; ++i) {
+          ops_.at(i)->ApplyRow(y, range_row, src.cols, channels, row);
+        }
+      }
+    });
+  }
+}
+
+
+}
+}
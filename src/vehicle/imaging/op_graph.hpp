@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace imaging {
+
+using namespace core;
+
+
+// One step of an OpGraph. Every op has a per-pixel part that transforms a row in place, so that a
+// run of ops can be applied to each row while it's still in cache. Ops that need to look at their
+// whole input first (e.g for its min/max, or to blur it) are "barriers", and start a new pass over
+// the image.
+//
+// NOTE(milo): ApplyRow() is called from several threads at once, so it can't change the op.
+class ImagingOp {
+ public:
+  virtual ~ImagingOp() = default;
+
+  virtual std::string Name() const = 0;
+
+  virtual bool IsBarrier() const { return false; }
+
+  virtual bool SupportsChannels(int channels) const { return channels == 3; }
+
+  // Called once per OpGraph::Run(), before any of the rows. "input" is the whole input of the pass
+  // that this op is in (i.e the op's own input if it's a barrier, which only barriers can look
+  // at). range is the range image given to Run(), and is empty if there wasn't one.
+  virtual void Prepare(const cv::Mat& input, const Image1f& range) { (void)input; (void)range; }
+
+  // Transforms row y (cols pixels, with interleaved channels) in place. range_row is row y of the
+  // range image (nullptr if there isn't one).
+  virtual void ApplyRow(int y, const float* range_row, int cols, int channels, float* row) const = 0;
+};
+
+
+// A pipeline of imaging steps that is planned once and then run on every frame, e.g:
+//
+//   OpGraph graph;
+//   graph.RemoveBackscatter(B, beta_B).CorrectAttenuation(beta_D).Normalize().LinearToGamma();
+//   graph.Run(bgr, range, out);
+//
+// Chaining the free functions (RemoveBackscatter(), Normalize(), etc) allocates and writes a new
+// image for every step. Here, consecutive per-pixel ops are fused into one pass over the image,
+// which reads each input row once and writes each output row once (the graph above makes two
+// passes instead of four). The passes run on tiles of tile_rows rows in parallel. Intermediate
+// images go into two buffers (each pass reads one and writes the other), which are kept across
+// calls to Run(), and the last pass writes straight into out.
+class OpGraph final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(OpGraph);
+
+  explicit OpGraph(int tile_rows = 16);
+
+  // Steps are run in the order that they're added. Each one here does the same thing as the free
+  // function with the same name.
+  OpGraph& Normalize();                 // Also EnhanceContrast().
+  OpGraph& WhiteBalanceSimple();
+  OpGraph& CorrectColorRatio();
+  OpGraph& LinearToGamma(float gamma_power = 0.4545f);
+  OpGraph& GammaToLinear(float gamma_power = 2.2f);
+  OpGraph& RemoveBackscatter(const Vector3f& B, const Vector3f& beta_B);
+  OpGraph& CorrectAttenuation(const Vector12f& beta_D);
+  OpGraph& Sharpen();
+
+  // Any other step.
+  OpGraph& Add(std::unique_ptr<ImagingOp> op);
+
+  // Runs the graph on a float image (bgr or gray). The range is only needed by RemoveBackscatter()
+  // and CorrectAttenuation(). out can be the same image as the input.
+  void Run(const Image3f& bgr, const Image1f& range, Image3f& out);
+  void Run(const Image3f& bgr, Image3f& out);
+  void Run(const Image1f& gray, Image1f& out);
+
+  int NumOps() const { return static_cast<int>(ops_.size()); }
+  int NumPasses() const { return static_cast<int>(passes_.size()); }
+
+  // The ops in each pass, e.g "[RemoveBackscatter CorrectAttenuation] [Normalize LinearToGamma]".
+  std::string Plan() const;
+
+ private:
+  void RunPasses(const cv::Mat& in, const Image1f& range, cv::Mat& out);
+
+  // Ops [begin, end) run together in one pass.
+  struct Pass final
+  {
+    size_t begin;
+    size_t end;
+  };
+
+  int tile_rows_;
+  std::vector<std::unique_ptr<ImagingOp>> ops_;
+  std::vector<Pass> passes_;
+  cv::Mat buffers_[2];
+};
+
+
+}
+}
@@ -45,7 +45,6 @@ void DecodeJPG(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat
     LOG(WARNING) << "Tried to decode an image_t with size <= 0. Probably a mistake in the publisher." << std::endl;
   }
 
-  // const uchar* buf_data = msg.data.data();
   cv::Mat raw_data(1, buf_size, is_color ? CV_8UC3 : CV_8UC1, (void*)buf_data);
   cv::imdecode(raw_data, is_color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE, &out);
 
@@ -56,4 +55,36 @@ void DecodeJPG(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat
 }
 
 
+void DecodeJPGGray(const uint8_t* buf_data, int buf_size, cv::Mat& out)
+{
+  if (buf_size <= 0) {
+    LOG(WARNING) << "Tried to decode an image with size <= 0. Probably a mistake in the publisher." << std::endl;
+  }
+
+  const cv::Mat raw_data(1, buf_size, CV_8UC1, const_cast<uint8_t*>(buf_data));
+  cv::imdecode(raw_data, cv::IMREAD_GRAYSCALE, &out);
+}
+
+
+bool WrapRaw(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat& out)
+{
+  CHECK_EQ("raw", msg.encoding) << "Expected raw image" << std::endl;
+
+  const bool is_color = msg.format == "rgb8" || msg.format == "bgr8";
+  const bool is_gray = msg.format == "mono8";
+  CHECK(is_color || is_gray) << "Unrecognized image format specifier: " << msg.format << std::endl;
+
+  const int channels = is_color ? 3 : 1;
+  if (msg.width <= 0 || msg.height <= 0 || msg.size != (msg.width * msg.height * channels)) {
+    LOG(WARNING) << "Raw image size doesn't match its dimensions: size=" << msg.size
+                 << " w=" << msg.width << " h=" << msg.height << " format=" << msg.format << std::endl;
+    return false;
+  }
+
+  // NOTE(milo): cv::Mat doesn't take a const pointer, but nothing writes through this header.
+  out = cv::Mat(msg.height, msg.width, is_color ? CV_8UC3 : CV_8UC1, const_cast<uint8_t*>(buf_data));
+  return true;
+}
+
+
 }
@@ -13,4 +13,13 @@ void DecodeJPG(const vehicle::image_t& msg, cv::Mat& out);
 // Decodes a JPG image from a buffer of uint8_t data.
 void DecodeJPG(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat& out);
 
+// Decodes a JPG buffer straight to a grayscale image. libjpeg only has to decode the luma channel
+// for this, so it's faster than decoding in color and then converting.
+void DecodeJPGGray(const uint8_t* buf_data, int buf_size, cv::Mat& out);
+
+// Wraps a "raw" (unencoded, row-major) image in a cv::Mat header over buf_data, without copying
+// it. The header is only valid for as long as buf_data is. Returns false if msg.size doesn't match
+// the image dimensions.
+bool WrapRaw(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat& out);
+
 }
@@ -0,0 +1,46 @@
+#include <glog/logging.h>
+
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "lcm_util/image_preview.hpp"
+
+namespace bm {
+
+
+void PackImagePreview(const cv::Mat& image,
+                      core::timestamp_t timestamp,
+                      core::uid_t seq,
+                      double scale,
+                      int jpeg_quality,
+                      vehicle::image_preview_t& msg)
+{
+  CHECK(scale > 0 && scale <= 1.0) << "Preview scale should be in (0, 1]" << std::endl;
+  CHECK(image.type() == CV_8UC1 || image.type() == CV_8UC3) << "Expected an 8-bit image" << std::endl;
+
+  msg.header.timestamp = timestamp;
+  msg.header.seq = static_cast<int64_t>(seq);
+  msg.full_width = image.cols;
+  msg.full_height = image.rows;
+
+  // NOTE(milo): INTER_AREA averages the pixels that get dropped, so the preview doesn't alias.
+  cv::Mat small;
+  if (scale < 1.0) {
+    cv::resize(image, small, cv::Size(), scale, scale, cv::INTER_AREA);
+  } else {
+    small = image;
+  }
+
+  const std::vector<int> options = { cv::IMWRITE_JPEG_QUALITY, jpeg_quality };
+  cv::imencode(".jpg", small, msg.img.data, options);
+
+  msg.img.width = small.cols;
+  msg.img.height = small.rows;
+  msg.img.channels = small.channels();
+  msg.img.format = (small.channels() == 1) ? "mono8" : "bgr8";
+  msg.img.encoding = "jpg";
+  msg.img.size = static_cast<int32_t>(msg.img.data.size());
+}
+
+
+}
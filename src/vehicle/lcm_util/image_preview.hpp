@@ -0,0 +1,22 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+#include "vehicle/image_preview_t.hpp"
+
+namespace bm {
+
+
+// Downscales an image (by "scale", in (0, 1]) and JPEG encodes it into msg. The encode buffer in
+// msg is reused, so publishing previews of the same size doesn't allocate after the first one.
+void PackImagePreview(const cv::Mat& image,
+                      core::timestamp_t timestamp,
+                      core::uid_t seq,
+                      double scale,
+                      int jpeg_quality,
+                      vehicle::image_preview_t& msg);
+
+
+}
@@ -1,110 +1,325 @@
+#include <future>
+
 #include <glog/logging.h>
 
+#include <opencv2/imgproc.hpp>
+
 #include "lcm_util/image_subscriber.hpp"
 #include "lcm_util/decode_image.hpp"
+#include "lcm_util/receive_latency.hpp"
 
+#include "vision_core/gpu_context.hpp"
 #include "vision_core/image_util.hpp"
+#include "core/trace.hpp"
 
 namespace bm {
 
 
-ImageSubscriber::ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool expect_shm)
-    : channel_(channel)
+// Decodes (or converts) an image into a grayscale image that owns its pixels. If out is already
+// allocated with the right size, it's written in place. Temporary color images come from the pool.
+static bool DecodeToGray(const vehicle::mmf_image_t& msg,
+                         const uint8_t* data,
+                         core::ImagePool& pool,
+                         core::Image1b& out)
+{
+  // NOTE(milo): Decoding an RGB JPG to gray directly would swap the red and blue weights, so those
+  // are decoded in color and converted.
+  if (msg.encoding == "jpg" && msg.format == "rgb8") {
+    cv::Mat decoded = pool.Get(msg.height, msg.width, CV_8UC3);
+    bm::DecodeJPG(msg, data, decoded);
+    if (decoded.empty()) {
+      return false;
+    }
+    cv::cvtColor(decoded, out, cv::COLOR_BGR2GRAY);
+    return true;
+  } else if (msg.encoding == "jpg") {
+    cv::Mat decoded = out;
+    bm::DecodeJPGGray(data, msg.size, decoded);
+    out = decoded;
+    return !out.empty();
+  }
+
+  // NOTE(milo): A raw image is only wrapped, so it has to be copied out (or converted) before the
+  // callbacks get it. Callbacks can hold onto images, and the publisher will reuse this part of
+  // the file for a later frame.
+  cv::Mat wrapped;
+  if (!bm::WrapRaw(msg, data, wrapped)) {
+    return false;
+  }
+  if (msg.format == "mono8") {
+    wrapped.copyTo(out);
+  } else {
+    cv::cvtColor(wrapped, out, (msg.format == "rgb8") ? cv::COLOR_RGB2GRAY : cv::COLOR_BGR2GRAY);
+  }
+  return true;
+}
+
+
+// The metadata of an image_t, so that it can be decoded like an mmf_image_t.
+static vehicle::mmf_image_t ImageMetadata(const vehicle::image_t& msg)
+{
+  vehicle::mmf_image_t meta;
+  meta.width = msg.width;
+  meta.height = msg.height;
+  meta.channels = msg.channels;
+  meta.format = msg.format;
+  meta.encoding = msg.encoding;
+  meta.offset = 0;
+  meta.size = msg.size;
+  return meta;
+}
+
+
+ImageSubscriber::ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool expect_shm, bool async_decode)
+    : ImageSubscriber(lcm, channel, expect_shm ? ImageTransport::MMF : ImageTransport::LCM_MESSAGE, async_decode) {}
+
+
+ImageSubscriber::ImageSubscriber(lcm::LCM& lcm,
+                                 const std::string& channel,
+                                 ImageTransport transport,
+                                 bool async_decode)
+    : channel_(channel),
+      async_decode_(async_decode && transport != ImageTransport::SHM_RING)
 {
   if (!lcm.good()) {
     LOG(WARNING) << "Failed to initialize LCM" << std::endl;
     return;
   }
 
-  if (expect_shm) {
+  if (transport == ImageTransport::MMF) {
     lcm.subscribe(channel, &ImageSubscriber::HandleMmf, this);
+  } else if (transport == ImageTransport::SHM_RING) {
+    lcm.subscribe(channel, &ImageSubscriber::HandleShmRing, this);
   } else {
     lcm.subscribe(channel, &ImageSubscriber::Handle, this);
   }
 
+  if (async_decode_) {
+    decode_thread_ = std::thread(&ImageSubscriber::DecodeWorker, this);
+  }
+
   LOG(INFO) << "ImageSubscriber listening on: " << channel << std::endl;
 }
 
 
-void ImageSubscriber::HandleMmf(const lcm::ReceiveBuffer*,
+ImageSubscriber::~ImageSubscriber()
+{
+  decode_queue_.Close();
+  if (decode_thread_.joinable()) {
+    decode_thread_.join();
+  }
+}
+
+
+void ImageSubscriber::HandleMmf(const lcm::ReceiveBuffer* rbuf,
                                 const std::string&,
                                 const vehicle::mmf_stereo_image_t* msg)
 {
-  const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width)
-               && IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width);
+  BM_TRACE_SCOPE("ImageSubscriber::HandleMmf");
+  MaybeRecordLatency(rbuf, msg->header);
+
+  const vehicle::mmf_image_t& il = msg->img_left;
+  const vehicle::mmf_image_t& ir = msg->img_right;
+  const bool ok = IsSupported(il.encoding, il.format, il.height, il.width, true)
+               && IsSupported(ir.encoding, ir.format, ir.height, ir.width, true);
   if (!ok) { return; }
 
-  const std::string mm_filename = msg->img_left.mm_filename;
+  const std::string mm_filename = il.mm_filename;
+  CHECK_EQ(mm_filename, ir.mm_filename)
+      << "Expected same memory-mapped file names for left and right images" << std::endl;
 
   // Open the memory-mapped file if not already open.
   if (mapped_file_.get_name() != mm_filename) {
     LOG(INFO) << "First message, opening MMF: " << mm_filename << std::endl;
     mapped_file_ = ipc::file_mapping(mm_filename.c_str(), ipc::read_only);
     mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
-    fbuf_.open(mm_filename, std::ios_base::in | std::ios_base::binary);
   }
 
   CHECK_EQ(mm_filename, mapped_file_.get_name())
       << "Message mm_filename doesn't match previous. Did the publisher switch?" << std::endl;
-  CHECK(fbuf_.is_open()) << "File buffer not open, cannot read" << std::endl;
 
-  // Read raw char buffers for both images.
-  const int offl = msg->img_left.offset;
-  const int szl = msg->img_left.size;
-
-  if (offl < 0 || szl <= 0) {
-    LOG(WARNING) << "Got a data buffer for the left image with negative offset or zero size" << std::endl;
+  const uint8_t* left_data = MappedData(il);
+  const uint8_t* right_data = MappedData(ir);
+  if (left_data == nullptr || right_data == nullptr) {
     return;
   }
 
-  lbuf_.resize(szl);
-  fbuf_.pubseekpos(offl);
-  fbuf_.sgetn(&lbuf_[0], std::streamsize(szl));
-
-  const int offr = msg->img_right.offset;
-  const int szr = msg->img_right.size;
+  // NOTE(milo): Copy the encoded bytes out now, since the publisher will reuse the mapping.
+  if (async_decode_) {
+    PushEncoded(msg->header, il, left_data, ir, right_data);
+    return;
+  }
 
-  if (offr < 0 || szr <= 0) {
-    LOG(WARNING) << "Got a data buffer for the right image with negative offset or zero size" << std::endl;
+  core::Image1b left, right;
+  AllocateOutput(il, left);
+  AllocateOutput(ir, right);
+  if (!DecodeToGray(il, left_data, pool_, left) || !DecodeToGray(ir, right_data, pool_, right)) {
+    LOG(WARNING) << "Could not decode stereo pair: seq=" << msg->header.seq << std::endl;
     return;
   }
 
-  rbuf_.resize(szr);
-  fbuf_.pubseekpos(offr);
-  fbuf_.sgetn(&rbuf_[0], std::streamsize(szr));
+  PublishStereo(msg->header.timestamp, msg->header.seq, std::move(left), std::move(right));
+}
 
-  // https://stackoverflow.com/questions/4254615/how-to-cast-vectorunsigned-char-to-char
-  bm::DecodeJPG(msg->img_left, reinterpret_cast<uint8_t*>(lbuf_.data()), left_);
-  bm::DecodeJPG(msg->img_right, reinterpret_cast<uint8_t*>(rbuf_.data()), right_);
 
-  core::StereoImage1b out(
-      msg->header.timestamp,
-      msg->header.seq,
-      core::MaybeConvertToGray(std::move(left_)),
-      core::MaybeConvertToGray(std::move(right_)));
+const uint8_t* ImageSubscriber::MappedData(const vehicle::mmf_image_t& msg)
+{
+  if (msg.offset < 0 || msg.size <= 0) {
+    LOG(WARNING) << "Got a data buffer with negative offset or zero size" << std::endl;
+    return nullptr;
+  }
 
-  for (const StereoImage1bCallback& f : callbacks_1b_) {
-    f(out);
+  // The publisher might have grown the file since it was mapped.
+  const size_t end = static_cast<size_t>(msg.offset) + static_cast<size_t>(msg.size);
+  if (end > mapped_region_.get_size()) {
+    mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
   }
+  if (end > mapped_region_.get_size()) {
+    LOG(WARNING) << "Image data [" << msg.offset << ", " << end << ") is past the end of "
+                 << msg.mm_filename << " (" << mapped_region_.get_size() << " bytes)" << std::endl;
+    return nullptr;
+  }
+
+  return static_cast<const uint8_t*>(mapped_region_.get_address()) + msg.offset;
 }
 
 
-void ImageSubscriber::Handle(const lcm::ReceiveBuffer*,
+void ImageSubscriber::Handle(const lcm::ReceiveBuffer* rbuf,
                              const std::string&,
                              const vehicle::stereo_image_t* msg)
 {
+  MaybeRecordLatency(rbuf, msg->header);
+
   const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width)
-               && IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width);
+               && IsSupported(msg->img_right.encoding, msg->img_right.format, msg->img_right.height, msg->img_right.width);
   if (!ok) { return; }
 
-  bm::DecodeJPG(msg->img_left, left_);
-  bm::DecodeJPG(msg->img_right, right_);
+  const vehicle::mmf_image_t il = ImageMetadata(msg->img_left);
+  const vehicle::mmf_image_t ir = ImageMetadata(msg->img_right);
+
+  if (async_decode_) {
+    PushEncoded(msg->header, il, msg->img_left.data.data(), ir, msg->img_right.data.data());
+    return;
+  }
+
+  core::Image1b left, right;
+  AllocateOutput(il, left);
+  AllocateOutput(ir, right);
+  if (!DecodeToGray(il, msg->img_left.data.data(), pool_, left) || !DecodeToGray(ir, msg->img_right.data.data(), pool_, right)) {
+    LOG(WARNING) << "Could not decode stereo pair: seq=" << msg->header.seq << std::endl;
+    return;
+  }
+
+  PublishStereo(msg->header.timestamp, msg->header.seq, std::move(left), std::move(right));
+}
+
+
+void ImageSubscriber::HandleShmRing(const lcm::ReceiveBuffer* rbuf,
+                                    const std::string&,
+                                    const vehicle::shm_stereo_image_t* msg)
+{
+  BM_TRACE_SCOPE("ImageSubscriber::HandleShmRing");
+  MaybeRecordLatency(rbuf, msg->header);
+
+  // Open the ring if not already open (or if the publisher switched to another one).
+  if (!ring_ || ring_->Name() != msg->shm_name) {
+    LOG(INFO) << "First message, opening shared memory ring: " << msg->shm_name << std::endl;
+    ring_.reset(new ShmImageRing(msg->shm_name));
+  }
+
+  core::timestamp_t timestamp = 0;
+  cv::Mat left, right;
+  if (!ring_->Read(msg->slot, msg->slot_seq, timestamp, left, right, &pool_)) {
+    ++num_overwritten_;
+    LOG_EVERY_N(WARNING, 30) << "Stereo pair seq=" << msg->header.seq << " was overwritten before it could be read ("
+                             << num_overwritten_ << " so far). The ring needs more slots, or this subscriber is too slow."
+                             << std::endl;
+    return;
+  }
+
+  PublishStereo(timestamp, msg->header.seq, core::MaybeConvertToGray(left, pool_), core::MaybeConvertToGray(right, pool_));
+}
+
+
+void ImageSubscriber::MaybeRecordLatency(const lcm::ReceiveBuffer* rbuf, const vehicle::header_t& header)
+{
+  if (receive_latency_ != nullptr) {
+    receive_latency_->Record(ReceiveLatencyMs(rbuf));
+  }
+  if (tracer_) {
+    tracer_->Begin(header.timestamp, header.seq, "lcm_receive", rbuf->recv_utime);
+  }
+}
+
+
+void ImageSubscriber::PushEncoded(const vehicle::header_t& header,
+                                  const vehicle::mmf_image_t& left, const uint8_t* left_data,
+                                  const vehicle::mmf_image_t& right, const uint8_t* right_data)
+{
+  BM_TRACE_SCOPE("ImageSubscriber::PushEncoded");
+
+  EncodedStereo item;
+  item.timestamp = header.timestamp;
+  item.seq = header.seq;
+  item.left = left;
+  item.right = right;
+  item.left_data.assign(left_data, left_data + left.size);
+  item.right_data.assign(right_data, right_data + right.size);
+
+  decode_queue_.Push(std::move(item));
+}
+
+
+void ImageSubscriber::DecodeWorker()
+{
+  EncodedStereo item;
+  while (!decode_queue_.IsClosed()) {
+    if (!decode_queue_.PopBlocking(item)) {
+      continue;
+    }
+
+    BM_TRACE_SCOPE("ImageSubscriber::DecodeWorker");
+
+    // Decode the right image on another thread while this one decodes the left.
+    core::Image1b left, right;
+    AllocateOutput(item.left, left);
+    AllocateOutput(item.right, right);
+    std::future<bool> right_ok = std::async(std::launch::async, [this, &item, &right]()
+    {
+      return DecodeToGray(item.right, item.right_data.data(), pool_, right);
+    });
+    const bool left_ok = DecodeToGray(item.left, item.left_data.data(), pool_, left);
+
+    if (!right_ok.get() || !left_ok) {
+      LOG(WARNING) << "Could not decode stereo pair: seq=" << item.seq << std::endl;
+      continue;
+    }
+
+    PublishStereo(item.timestamp, item.seq, std::move(left), std::move(right));
+  }
+}
+
+
+void ImageSubscriber::AllocateOutput(const vehicle::mmf_image_t& msg, core::Image1b& out)
+{
+  if (msg.width <= 0 || msg.height <= 0) {
+    return;
+  }
+  out = decode_mapped_ ? core::GpuContext::Global().GetMapped(msg.height, msg.width, CV_8UC1)
+                       : pool_.Get(msg.height, msg.width, CV_8UC1);
+}
+
+
+void ImageSubscriber::PublishStereo(core::timestamp_t timestamp,
+                                    core::uid_t seq,
+                                    core::Image1b&& left,
+                                    core::Image1b&& right)
+{
+  if (tracer_) {
+    tracer_->Stamp(timestamp, "decode");
+  }
 
-  core::StereoImage1b out(
-      msg->header.timestamp,
-      msg->header.seq,
-      core::MaybeConvertToGray(std::move(left_)),
-      core::MaybeConvertToGray(std::move(right_)));
+  const core::StereoImage1b out(timestamp, seq, std::move(left), std::move(right));
 
   for (const StereoImage1bCallback& f : callbacks_1b_) {
     f(out);
@@ -114,9 +329,10 @@ void ImageSubscriber::Handle(const lcm::ReceiveBuffer*,
 
 bool ImageSubscriber::IsSupported(const std::string& encoding,
                                   const std::string& format,
-                                  int height, int width)
+                                  int height, int width,
+                                  bool allow_raw)
 {
-  if (encoding != "jpg") {
+  if (encoding != "jpg" && !(allow_raw && encoding == "raw")) {
     LOG(WARNING)
         << "Unsupported encoding:\n  " << encoding
         << "\nchannel:\n  " << channel_ << std::endl;
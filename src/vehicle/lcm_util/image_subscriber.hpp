@@ -1,8 +1,9 @@
 #pragma once
 
 #include <vector>
-#include <fstream>
 #include <iostream>
+#include <memory>
+#include <thread>
 
 #include <opencv2/core/mat.hpp>
 
@@ -11,11 +12,18 @@
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 
+#include "core/macros.hpp"
+#include "core/thread_safe_queue.hpp"
 #include "core/timestamp.hpp"
+#include "core/latency_histogram.hpp"
+#include "core/latency_trace.hpp"
+#include "vision_core/image_pool.hpp"
 #include "vision_core/stereo_image.hpp"
+#include "lcm_util/shm_image_ring.hpp"
 
 #include "vehicle/stereo_image_t.hpp"
 #include "vehicle/mmf_stereo_image_t.hpp"
+#include "vehicle/shm_stereo_image_t.hpp"
 
 namespace bm {
 
@@ -26,17 +34,58 @@ typedef std::function<void(const core::StereoImage1b&)> StereoImage1bCallback;
 typedef std::function<void(const core::StereoImage3b&)> StereoImage3bCallback;
 
 
+// How stereo images get to an ImageSubscriber.
+enum class ImageTransport
+{
+  LCM_MESSAGE,    // Encoded images inside of the LCM message (stereo_image_t).
+  MMF,            // Encoded images in a memory-mapped file (mmf_stereo_image_t).
+  SHM_RING        // Raw images in a ShmImageRing (shm_stereo_image_t), see ShmStereoPublisher.
+};
+
+
 class ImageSubscriber final {
  public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ImageSubscriber);
+
   // Create an image subscriber that listens on "channel". If expect_shm is true, this subscriber
   // will expect to receive a memory-mapped image (mmf_stereo_image_t).
+  //
+  // If async_decode is true, the LCM handler only copies out the encoded images, and they're
+  // decoded (left and right at the same time) and passed to the callbacks on a decode thread, so
+  // that decoding doesn't hold up the other handlers on the same LCM loop. If decoding falls
+  // behind, the oldest pair that hasn't been decoded yet is dropped.
   // NOTE(milo): An LCM handle must be passed in! Messages are only received if lcm.Spin() is
   // constantly called, which should happen in whatever process owns this ImageSubscriber.
-  ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool expect_shm = true);
+  ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool expect_shm = true, bool async_decode = false);
+
+  // Same as above, for any transport. Images from a SHM_RING are raw, so they're always copied out
+  // of the ring on the LCM thread (there's nothing to decode).
+  ImageSubscriber(lcm::LCM& lcm, const std::string& channel, ImageTransport transport, bool async_decode = false);
+
+  ~ImageSubscriber();
 
-  // Register a callback function that will be called for each decoded image.
+  // Register a callback function that will be called for each decoded image. With async_decode,
+  // callbacks are called on the decode thread, so register them before LCM starts handling messages.
   void RegisterCallback(StereoImage1bCallback f) { callbacks_1b_.emplace_back(f); }
 
+  // Record how long each image message waited for its handler (see ReceiveLatencyMs). The
+  // histogram must outlive this subscriber.
+  void RecordReceiveLatency(core::LatencyHistogram* h) { receive_latency_ = h; }
+
+  // Open a trace for each stereo pair when LCM receives it ("lcm_receive"), and stamp it once it's
+  // decoded ("decode"). Set this before LCM starts handling messages.
+  void TraceLatency(const core::LatencyTracer::Ptr& tracer) { tracer_ = tracer; }
+
+  // Decode JPG and raw images into GpuContext::GetMapped() buffers, so that GPU modules can read
+  // them in place on a GPU that shares memory with the CPU (e.g PatchmatchGpu with zero_copy), or
+  // upload them without a staging copy on one that doesn't. Set this before LCM starts handling
+  // messages. Images from a SHM_RING are always copied into regular memory.
+  void DecodeIntoMappedMemory(bool on) { decode_mapped_ = on; }
+
+  // Images are decoded into buffers from this pool (unless they're decoded into mapped memory), and
+  // go back to it once every callback has released them.
+  const core::ImagePool& Pool() const { return pool_; }
+
  private:
   void HandleMmf(const lcm::ReceiveBuffer*,
                 const std::string&,
@@ -46,26 +95,68 @@ class ImageSubscriber final {
               const std::string&,
               const vehicle::stereo_image_t* msg);
 
-  // Validates the image metadata to make sure it can be decoded.
+  void HandleShmRing(const lcm::ReceiveBuffer*,
+                     const std::string&,
+                     const vehicle::shm_stereo_image_t* msg);
+
+  void MaybeRecordLatency(const lcm::ReceiveBuffer* rbuf, const vehicle::header_t& header);
+
+  // Validates the image metadata to make sure it can be decoded. Only memory-mapped images can
+  // be "raw".
   bool IsSupported(const std::string& encoding,
                    const std::string& format,
                    int height,
-                   int width);
+                   int width,
+                   bool allow_raw = false);
+
+  // Finds one image in the memory-mapped file (its pixels are read straight from the mapping).
+  // Returns nullptr if it doesn't fit in the file.
+  const uint8_t* MappedData(const vehicle::mmf_image_t& msg);
+
+  // Encoded images that are waiting for the decode thread. The metadata is kept as an mmf_image_t
+  // (whether or not it came from one), but the bytes are copied out of the message or mapping.
+  struct EncodedStereo final
+  {
+    core::timestamp_t timestamp = 0;
+    core::uid_t seq = 0;
+    vehicle::mmf_image_t left, right;
+    std::vector<uint8_t> left_data, right_data;
+  };
+
+  void PushEncoded(const vehicle::header_t& header,
+                   const vehicle::mmf_image_t& left, const uint8_t* left_data,
+                   const vehicle::mmf_image_t& right, const uint8_t* right_data);
+
+  void DecodeWorker();
+
+  // Points out at a mapped image (if decode_mapped_) or a pooled one that fits msg (DecodeToGray()
+  // writes into it).
+  void AllocateOutput(const vehicle::mmf_image_t& msg, core::Image1b& out);
+
+  void PublishStereo(core::timestamp_t timestamp, core::uid_t seq, core::Image1b&& left, core::Image1b&& right);
 
  private:
   std::string channel_;
 
-  cv::Mat left_;
-  cv::Mat right_;
-
+  // NOTE(milo): Images are read through the mapping (no copies or reads into a buffer first).
   ipc::file_mapping mapped_file_;
   ipc::mapped_region mapped_region_;
 
-  // https://stackoverflow.com/questions/604431/c-reading-unsigned-char-from-file-stream
-  std::basic_filebuf<char> fbuf_;
-  std::vector<char> lbuf_, rbuf_;
+  std::unique_ptr<ShmImageRing> ring_;   // Opened on the first SHM_RING message.
+  int num_overwritten_ = 0;
 
   std::vector<StereoImage1bCallback> callbacks_1b_;
+  core::LatencyHistogram* receive_latency_ = nullptr;
+  core::LatencyTracer::Ptr tracer_;
+
+  bool async_decode_ = false;
+  bool decode_mapped_ = false;
+  core::ThreadsafeQueue<EncodedStereo> decode_queue_{2, true, "image_decode"};
+
+  // NOTE(milo): Consumers (e.g the StateEstimator's queues and the frontend's keyframe) hold onto a
+  // few frames, so this needs a handful of buffers per image (and a color one for rgb8 JPGs).
+  core::ImagePool pool_{16};
+  std::thread decode_thread_;
 };
 
 
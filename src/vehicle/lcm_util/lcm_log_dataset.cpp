@@ -0,0 +1,427 @@
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+#include "core/mapped_file.hpp"
+#include "dataset/stereo_prefetcher.hpp"
+#include "vision_core/image_util.hpp"
+#include "lcm_util/decode_image.hpp"
+#include "lcm_util/lcm_log_dataset.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+#include "lcm_util/util_depth_measurement_t.hpp"
+#include "lcm_util/util_range_measurement_t.hpp"
+
+#include "vehicle/header_t.hpp"
+#include "vehicle/stereo_image_t.hpp"
+#include "vehicle/mmf_stereo_image_t.hpp"
+
+namespace bm {
+
+using namespace core;
+using namespace dataset;
+
+
+// Every event in an LCM log is (big endian): sync word, event number, log time in usec, channel
+// length, data length, and then the channel name and the message data.
+// https://lcm-proj.github.io/log_file_format.html
+static const uint32_t kLcmSyncWord = 0xEDA1DA01;
+static const size_t kLcmEventHeaderBytes = 28;
+
+static const char kIndexMagic[8] = { 'B', 'M', 'L', 'C', 'M', 'I', 'D', 'X' };
+static const uint32_t kIndexVersion = 1;
+
+enum class LogStream : uint8_t { STEREO = 0, IMU = 1, IMU_BATCH = 2, DEPTH = 3, RANGE = 4 };
+
+// Where one message is in the log. The index file is these, in log order and in host byte order,
+// after an IndexHeader and the channel names it was built for.
+struct IndexEntry final {
+  LogStream stream;
+  uint8_t reserved[3];
+  uint32_t size;
+  uint64_t offset;          // Of the message data, from the start of the log.
+  timestamp_t timestamp;    // From the message header (not the time it was logged).
+};
+
+struct IndexHeader final {
+  char magic[8];
+  uint32_t version;
+  uint32_t channels_size;
+  uint64_t log_size;
+  int64_t log_mtime_ns;
+  uint64_t num_entries;
+};
+
+
+static uint32_t ReadBE32(const uint8_t* p)
+{
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+
+static uint64_t ReadBE64(const uint8_t* p)
+{
+  return (static_cast<uint64_t>(ReadBE32(p)) << 32) | ReadBE32(p + 4);
+}
+
+
+static bool StatFile(const std::string& path, uint64_t& size, int64_t& mtime_ns)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  size = static_cast<uint64_t>(st.st_size);
+  mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000ll + st.st_mtim.tv_nsec;
+  return true;
+}
+
+
+// The index is only valid for the channels it was built with.
+static std::string ChannelKey(const LcmLogChannels& channels)
+{
+  return channels.stereo + "\n" + channels.imu + "\n" + channels.imu_batch + "\n" +
+         channels.depth + "\n" + channels.range;
+}
+
+
+// One pass over the whole log. Events on other channels are skipped over without being read. If
+// the log is corrupted somewhere, this searches ahead for the next sync word (like lcm-logplayer).
+static void BuildIndex(const MappedFile& log, const LcmLogChannels& channels, std::vector<IndexEntry>& entries)
+{
+  const std::vector<std::pair<LogStream, const std::string*>> streams = {
+    { LogStream::STEREO, &channels.stereo },
+    { LogStream::IMU, &channels.imu },
+    { LogStream::IMU_BATCH, &channels.imu_batch },
+    { LogStream::DEPTH, &channels.depth },
+    { LogStream::RANGE, &channels.range },
+  };
+
+  const uint8_t* data = log.Data();
+  const size_t size = log.Size();
+  size_t pos = 0;
+  size_t num_skipped_bytes = 0;
+  size_t num_bad_headers = 0;
+
+  while (pos + kLcmEventHeaderBytes <= size) {
+    if (ReadBE32(data + pos) != kLcmSyncWord) {
+      ++pos;
+      ++num_skipped_bytes;
+      continue;
+    }
+
+    const uint64_t channel_begin = pos + kLcmEventHeaderBytes;
+    const uint64_t data_begin = channel_begin + ReadBE32(data + pos + 20);
+    const uint32_t data_size = ReadBE32(data + pos + 24);
+    if (data_begin + data_size > size) {
+      LOG(WARNING) << "LCM log ends partway through an event at byte " << pos << ", stopping there" << std::endl;
+      break;
+    }
+
+    const char* channel = reinterpret_cast<const char*>(data + channel_begin);
+    const size_t channel_size = data_begin - channel_begin;
+
+    for (const auto& s : streams) {
+      const std::string& name = *s.second;
+      if (name.empty() || name.size() != channel_size || std::memcmp(name.data(), channel, channel_size) != 0) {
+        continue;
+      }
+
+      // NOTE(milo): Every message type that we play back starts with a header_t (after the 8 byte
+      // hash), so the timestamp can be read without decoding the rest (e.g the images).
+      vehicle::header_t header;
+      if (data_size < 8 || header._decodeNoHash(data + data_begin, 8, data_size - 8) < 0) {
+        ++num_bad_headers;
+      } else {
+        entries.emplace_back(IndexEntry{ s.first, {0, 0, 0}, data_size, data_begin,
+                                        static_cast<timestamp_t>(header.timestamp) });
+      }
+      break;
+    }
+
+    pos = data_begin + data_size;
+  }
+
+  if (num_skipped_bytes > 0 || num_bad_headers > 0) {
+    LOG(WARNING) << "LCM log is corrupted: skipped " << num_skipped_bytes << " bytes and "
+                 << num_bad_headers << " messages without a header" << std::endl;
+  }
+}
+
+
+static bool ReadIndex(const std::string& index_path,
+                      uint64_t log_size,
+                      int64_t log_mtime_ns,
+                      const std::string& channel_key,
+                      std::vector<IndexEntry>& entries)
+{
+  std::ifstream in(index_path, std::ios::binary);
+  if (!in.good()) {
+    return false;
+  }
+
+  IndexHeader h;
+  in.read(reinterpret_cast<char*>(&h), sizeof(IndexHeader));
+  if (!in.good() || std::memcmp(h.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+      h.version != kIndexVersion || h.log_size != log_size || h.log_mtime_ns != log_mtime_ns ||
+      h.channels_size != channel_key.size()) {
+    return false;
+  }
+
+  std::string key(h.channels_size, '\0');
+  in.read(&key[0], key.size());
+  if (!in.good() || key != channel_key) {
+    return false;
+  }
+
+  entries.resize(h.num_entries);
+  in.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(IndexEntry));
+  if (!in.good()) {
+    entries.clear();
+    return false;
+  }
+
+  for (const IndexEntry& e : entries) {
+    if (e.offset + e.size > log_size || e.size < 8) {
+      entries.clear();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+// Writes to a temporary file and renames it, so that a crash can't leave a partial index behind.
+static bool WriteIndex(const std::string& index_path,
+                       uint64_t log_size,
+                       int64_t log_mtime_ns,
+                       const std::string& channel_key,
+                       const std::vector<IndexEntry>& entries)
+{
+  const std::string tmp_path = index_path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.good()) {
+      return false;
+    }
+
+    IndexHeader h;
+    std::memcpy(h.magic, kIndexMagic, sizeof(kIndexMagic));
+    h.version = kIndexVersion;
+    h.channels_size = static_cast<uint32_t>(channel_key.size());
+    h.log_size = log_size;
+    h.log_mtime_ns = log_mtime_ns;
+    h.num_entries = entries.size();
+
+    out.write(reinterpret_cast<const char*>(&h), sizeof(IndexHeader));
+    out.write(channel_key.data(), channel_key.size());
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(IndexEntry));
+    if (!out.good()) {
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+
+  return std::rename(tmp_path.c_str(), index_path.c_str()) == 0;
+}
+
+
+template <typename Msg>
+static bool DecodeMessage(const MappedFile& log, const IndexEntry& e, Msg& msg)
+{
+  return msg.decode(log.Data() + e.offset, 0, static_cast<int>(e.size)) >= 0;
+}
+
+
+static vehicle::mmf_image_t ImageInfo(const vehicle::image_t& msg)
+{
+  vehicle::mmf_image_t info;
+  info.width = msg.width;
+  info.height = msg.height;
+  info.channels = msg.channels;
+  info.format = msg.format;
+  info.encoding = msg.encoding;
+  info.offset = 0;
+  info.size = msg.size;
+  return info;
+}
+
+
+// Decodes (or copies) one image from buf. JPEGs are decoded straight to gray if color isn't needed.
+static bool DecodeImage(const vehicle::mmf_image_t& info, const uint8_t* buf, bool decode_color, cv::Mat& out)
+{
+  out = cv::Mat();
+  if (info.encoding == "jpg") {
+    if (decode_color) {
+      DecodeJPG(info, buf, out);
+    } else {
+      DecodeJPGGray(buf, info.size, out);
+    }
+  } else if (info.encoding == "raw" && WrapRaw(info, buf, out)) {
+    // buf only lives as long as the message (or mapping) does.
+    out = out.clone();
+  }
+  return !out.empty();
+}
+
+
+static bool DecodeMmfImage(const vehicle::mmf_image_t& msg, bool decode_color, cv::Mat& out)
+{
+  MappedFile mmf;
+  if (!mmf.Open(msg.mm_filename) || msg.offset < 0 || msg.size < 0 ||
+      static_cast<size_t>(msg.offset) + static_cast<size_t>(msg.size) > mmf.Size()) {
+    return false;
+  }
+  return DecodeImage(msg, mmf.Data() + msg.offset, decode_color, out);
+}
+
+
+static void DecodeStereoMessage(const MappedFile& log, const IndexEntry& e, bool decode_color, DecodedStereo& out)
+{
+  out = DecodedStereo();
+
+  // The hash at the start of the message says which type it is.
+  const int64_t hash = static_cast<int64_t>(ReadBE64(log.Data() + e.offset));
+  cv::Mat left, right;
+  bool ok = false;
+
+  if (hash == vehicle::stereo_image_t::getHash()) {
+    vehicle::stereo_image_t msg;
+    ok = DecodeMessage(log, e, msg) &&
+         DecodeImage(ImageInfo(msg.img_left), msg.img_left.data.data(), decode_color, left) &&
+         DecodeImage(ImageInfo(msg.img_right), msg.img_right.data.data(), decode_color, right);
+  } else if (hash == vehicle::mmf_stereo_image_t::getHash()) {
+    vehicle::mmf_stereo_image_t msg;
+    ok = DecodeMessage(log, e, msg) &&
+         DecodeMmfImage(msg.img_left, decode_color, left) &&
+         DecodeMmfImage(msg.img_right, decode_color, right);
+  }
+
+  if (!ok) {
+    out.error = "ERROR: Could not decode the LCM stereo pair at t=" + std::to_string(e.timestamp);
+    return;
+  }
+
+  if (decode_color) {
+    out.has_color = left.channels() > 1 && right.channels() > 1;
+    out.left = std::make_shared<ImageFrame>(left);
+    out.right = std::make_shared<ImageFrame>(right);
+  } else {
+    out.left = std::make_shared<ImageFrame>(MaybeConvertToGray(left));
+    out.right = std::make_shared<ImageFrame>(MaybeConvertToGray(right));
+  }
+}
+
+
+LcmLogDataset::LcmLogDataset(const std::string& path,
+                             const LcmLogChannels& channels,
+                             bool use_cached_index,
+                             size_t prefetch_lookahead,
+                             int prefetch_threads)
+    : DataProvider()
+{
+  const MappedFile::Ptr log = std::make_shared<MappedFile>();
+  uint64_t log_size = 0;
+  int64_t log_mtime_ns = 0;
+  if (!StatFile(path, log_size, log_mtime_ns) || !log->Open(path)) {
+    throw std::runtime_error("Couldn't open LCM log: " + path);
+  }
+
+  const std::string channel_key = ChannelKey(channels);
+  const std::string index_path = IndexPath(path);
+
+  std::vector<IndexEntry> entries;
+  used_cached_index_ = use_cached_index && ReadIndex(index_path, log->Size(), log_mtime_ns, channel_key, entries);
+
+  if (!used_cached_index_) {
+    log->AdviseSequential();
+    BuildIndex(*log, channels, entries);
+    if (use_cached_index && !WriteIndex(index_path, log->Size(), log_mtime_ns, channel_key, entries)) {
+      LOG(WARNING) << "Couldn't write LCM log index: " << index_path << std::endl;
+    }
+  }
+
+  // NOTE(milo): Stereo messages are looked up by index during playback, so they're kept in the same
+  // order as stereo_data.
+  std::vector<IndexEntry> stereo_entries;
+  std::vector<ImuMeasurement> imu_batch;
+  size_t num_bad = 0;
+
+  for (const IndexEntry& e : entries) {
+    switch (e.stream) {
+      case LogStream::STEREO:
+        stereo_entries.emplace_back(e);
+        break;
+      case LogStream::IMU: {
+        vehicle::imu_measurement_t msg;
+        if (!DecodeMessage(*log, e, msg)) { ++num_bad; break; }
+        imu_data.emplace_back();
+        decode_imu_measurement_t(msg, imu_data.back());
+        break;
+      }
+      case LogStream::IMU_BATCH: {
+        vehicle::imu_batch_t msg;
+        if (!DecodeMessage(*log, e, msg)) { ++num_bad; break; }
+        decode_imu_batch_t(msg, imu_batch);
+        imu_data.insert(imu_data.end(), imu_batch.begin(), imu_batch.end());
+        break;
+      }
+      case LogStream::DEPTH: {
+        vehicle::depth_measurement_t msg;
+        if (!DecodeMessage(*log, e, msg)) { ++num_bad; break; }
+        depth_data.emplace_back(0, 0);
+        decode_depth_measurement_t(msg, depth_data.back());
+        break;
+      }
+      case LogStream::RANGE: {
+        vehicle::range_measurement_t msg;
+        if (!DecodeMessage(*log, e, msg)) { ++num_bad; break; }
+        range_data.emplace_back(0, 0, Vector3d::Zero());
+        decode_range_measurement_t(msg, range_data.back());
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  if (num_bad > 0) {
+    LOG(WARNING) << "Skipped " << num_bad << " LCM messages that didn't decode (wrong type on a channel?)" << std::endl;
+  }
+
+  // Like binary logs, messages are in the order they arrived, which isn't always chronological.
+  SortByTimestamp(imu_data);
+  SortByTimestamp(depth_data);
+  SortByTimestamp(range_data);
+  SortByTimestamp(stereo_entries);
+
+  for (const IndexEntry& e : stereo_entries) {
+    stereo_data.emplace_back(e.timestamp, "", "");
+  }
+
+  // NOTE(milo): The decoder holds onto the mapping, so it stays around for as long as any copy of
+  // this dataset does.
+  stereo_decoder = [log, stereo_entries](size_t idx, bool decode_color, DecodedStereo& out)
+  {
+    DecodeStereoMessage(*log, stereo_entries.at(idx), decode_color, out);
+  };
+
+  LOG(INFO) << "Read LCM log " << path << (used_cached_index_ ? " (cached index)" : "") << ":\n"
+            << "  stereo=" << stereo_data.size() << " imu=" << imu_data.size()
+            << " depth=" << depth_data.size() << " range=" << range_data.size() << std::endl;
+
+  SanityCheck(path + ".report.csv");
+
+  // JPEG decoding is most of the cost of playing back a log, so it's spread across threads.
+  SetStereoPrefetch(prefetch_lookahead, prefetch_threads);
+}
+
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+
+#include "dataset/data_provider.hpp"
+
+namespace bm {
+
+
+// The channels to play back from an LCM log. A stream whose channel is empty is skipped.
+struct LcmLogChannels final
+{
+  std::string stereo = "sim/auv/stereo";        // stereo_image_t or mmf_stereo_image_t
+  std::string imu = "sim/auv/imu";              // imu_measurement_t
+  std::string imu_batch = "sim/auv/imu_batch";  // imu_batch_t
+  std::string depth = "sim/auv/depth";          // depth_measurement_t
+  std::string range = "sim/auv/range";          // range_measurement_t
+};
+
+
+// Plays back a recorded LCM log (e.g from lcm-logger) directly, instead of converting it into a
+// dataset folder first. The log is memory mapped, and one pass over it builds an index of where
+// each message on the channels above is (and its header timestamp). The index is cached next to
+// the log (see IndexPath()), so opening the same log again doesn't read it through.
+//
+// IMU, depth and range messages are small, so they're decoded up front. Stereo messages are only
+// decoded (straight out of the mapping) when they're played back, on the StereoPrefetcher threads,
+// so that JPEG decoding runs in parallel with the callbacks.
+//
+// NOTE(milo): The images of an mmf_stereo_image_t aren't in the log, only the name of the file
+// they were in. Those are read from mm_filename, which only works if that file is still around
+// (e.g a ring in /dev/shm that was copied out next to the log, and hasn't been overwritten).
+class LcmLogDataset : public dataset::DataProvider {
+ public:
+  // Throws std::runtime_error if path can't be read. If use_cached_index, an index that matches
+  // the log (and channels) is read instead of scanning the log, and a new one is written if not.
+  explicit LcmLogDataset(const std::string& path,
+                         const LcmLogChannels& channels = LcmLogChannels(),
+                         bool use_cached_index = true,
+                         size_t prefetch_lookahead = 8,
+                         int prefetch_threads = 2);
+
+  // Where the index for the log at log_path is cached.
+  static std::string IndexPath(const std::string& log_path) { return log_path + ".index"; }
+
+  // True if the index was read from IndexPath() rather than built by scanning the log.
+  bool UsedCachedIndex() const { return used_cached_index_; }
+
+ private:
+  bool used_cached_index_ = false;
+};
+
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/macros.hpp"
+
+namespace bm {
+
+
+// Publishes LCM messages of one type on one channel, reusing the same message and encode buffer
+// every time (lcm::LCM::publish() allocates a new buffer for each message). Fill in Msg() and call
+// Publish(). Once the message and buffer have grown to their steady state size, nothing allocates.
+//
+// NOTE(milo): Not threadsafe! Each thread that publishes should have its own LcmPublisher.
+template <typename MessageType>
+class LcmPublisher final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(LcmPublisher);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(LcmPublisher);
+
+  // NOTE(milo): The LCM handle must outlive this publisher.
+  LcmPublisher(lcm::LCM& lcm, const std::string& channel)
+      : lcm_(lcm), channel_(channel) {}
+
+  // The message that the next Publish() sends. It keeps its contents (and string/array capacity)
+  // from the last one, so only fields that change need to be set.
+  MessageType& Msg() { return msg_; }
+
+  // Encode Msg() into the reused buffer and publish it. Returns 0 on success (same as lcm::LCM).
+  int Publish()
+  {
+    const int size = msg_.getEncodedSize();
+    if (buf_.size() < static_cast<size_t>(size)) {
+      buf_.resize(size);
+    }
+    if (msg_.encode(buf_.data(), 0, size) != size) {
+      return -1;
+    }
+    return lcm_.publish(channel_, buf_.data(), static_cast<unsigned int>(size));
+  }
+
+  const std::string& Channel() const { return channel_; }
+
+ private:
+  lcm::LCM& lcm_;
+  std::string channel_;
+  MessageType msg_;
+  std::vector<uint8_t> buf_;
+};
+
+
+}
@@ -0,0 +1,53 @@
+#include "lcm_util/lcm_stats_exporter.hpp"
+
+namespace bm {
+
+
+LcmStatsExporter::LcmStatsExporter(lcm::LCM& lcm, const std::string& channel)
+    : lcm_(lcm), channel_(channel) {}
+
+
+void LcmStatsExporter::Export(const core::StatsSnapshot& snapshot)
+{
+  vehicle::stats_t msg;
+  msg.header.timestamp = static_cast<int64_t>(snapshot.wall_time_sec * 1e9);
+  msg.header.seq = seq_++;
+  msg.header.frame_id = "";
+  msg.tracker_name = snapshot.tracker_name;
+
+  for (const core::HistogramSummary& h : snapshot.histograms) {
+    vehicle::histogram_summary_t hmsg;
+    hmsg.name = h.name;
+    hmsg.count = static_cast<int64_t>(h.count);
+    hmsg.min = h.min;
+    hmsg.max = h.max;
+    hmsg.mean = h.mean;
+    hmsg.p50 = h.p50;
+    hmsg.p90 = h.p90;
+    hmsg.p99 = h.p99;
+    hmsg.p999 = h.p999;
+    msg.histograms.emplace_back(hmsg);
+  }
+  msg.num_histograms = static_cast<int32_t>(msg.histograms.size());
+
+  for (const auto& it : snapshot.counters) {
+    vehicle::named_value_t v;
+    v.name = it.first;
+    v.value = static_cast<double>(it.second);
+    msg.counters.emplace_back(v);
+  }
+  msg.num_counters = static_cast<int32_t>(msg.counters.size());
+
+  for (const auto& it : snapshot.gauges) {
+    vehicle::named_value_t v;
+    v.name = it.first;
+    v.value = it.second;
+    msg.gauges.emplace_back(v);
+  }
+  msg.num_gauges = static_cast<int32_t>(msg.gauges.size());
+
+  lcm_.publish(channel_, &msg);
+}
+
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/stats_exporter.hpp"
+#include "vehicle/stats_t.hpp"
+
+namespace bm {
+
+
+// Publishes StatsTracker snapshots as stats_t messages on an LCM channel.
+class LcmStatsExporter final : public core::StatsExporter {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(LcmStatsExporter)
+
+  // NOTE(milo): The LCM handle must outlive this exporter.
+  LcmStatsExporter(lcm::LCM& lcm, const std::string& channel);
+
+  void Export(const core::StatsSnapshot& snapshot) override;
+
+ private:
+  lcm::LCM& lcm_;
+  std::string channel_;
+  int64_t seq_ = 0;
+};
+
+
+}
@@ -0,0 +1,52 @@
+#include <glog/logging.h>
+
+#include "lcm_util/perf_profile.hpp"
+
+namespace bm {
+
+
+void PerfProfile::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("max_features_per_frame", &max_features_per_frame);
+  parser.GetParam("klt_max_level", &klt_max_level);
+  parser.GetParam("run_mesher", &run_mesher);
+  parser.GetParam("mesh_max_hz", &mesh_max_hz);
+  parser.GetParam("patchmatch_iters", &patchmatch_iters);
+  parser.GetParam("filter_publish_hz", &filter_publish_hz);
+
+  CHECK_GT(max_features_per_frame, 0);
+  CHECK_GE(klt_max_level, 0);
+  CHECK_GE(mesh_max_hz, 0);
+  CHECK_GT(patchmatch_iters, 0);
+  CHECK_GT(filter_publish_hz, 0);
+}
+
+
+void PerfProfiles::LoadParams(const YamlParser& parser)
+{
+  initial_profile = YamlToString(parser.GetNode("initial_profile"));
+
+  profiles.clear();
+  for (const std::string& name : YamlToStringList(parser.GetNode("profiles"))) {
+    CHECK(Find(name) == nullptr) << "Duplicate perf profile: " << name << std::endl;
+    profiles.emplace_back(parser.Subtree(name));
+    profiles.back().name = name;
+  }
+
+  CHECK(initial_profile.empty() || Find(initial_profile) != nullptr)
+      << "Unknown initial_profile: " << initial_profile << std::endl;
+}
+
+
+const PerfProfile* PerfProfiles::Find(const std::string& name) const
+{
+  for (const PerfProfile& profile : profiles) {
+    if (profile.name == name) {
+      return &profile;
+    }
+  }
+  return nullptr;
+}
+
+
+}
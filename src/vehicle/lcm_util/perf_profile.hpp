@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "params/params_base.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+// The settings that change together when the vehicle switches between kinds of work (e.g transit,
+// inspection, docking), across every node. Each node applies the ones that it owns (see
+// StateEstimatorLcm::ApplyProfile and ObjectMesherLcm::ApplyProfile), and ignores the rest.
+struct PerfProfile final : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(PerfProfile);
+
+  std::string name;
+
+  // StereoFrontend effort (see StateEstimator::SetTrackerEffort).
+  int max_features_per_frame = 200;
+  int klt_max_level = 4;
+
+  // Meshing, in whichever node runs the mesher. In dense mode, Patchmatch runs this many iterations.
+  bool run_mesher = true;
+  float mesh_max_hz = 5.0;          // 0 = every frame.
+  int patchmatch_iters = 3;
+
+  float filter_publish_hz = 50.0;
+
+ private:
+  void LoadParams(const YamlParser& parser) override;
+};
+
+
+// Every profile that a switch can name, shared by all of the nodes (see config/auv/PerfProfiles.yaml).
+struct PerfProfiles final : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(PerfProfiles);
+
+  // Applied right after startup. Empty keeps each node's own params until the first switch.
+  std::string initial_profile;
+  std::vector<PerfProfile> profiles;
+
+  // Returns nullptr if there's no profile with this name.
+  const PerfProfile* Find(const std::string& name) const;
+
+ private:
+  void LoadParams(const YamlParser& parser) override;
+};
+
+
+}
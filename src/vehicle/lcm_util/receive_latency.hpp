@@ -0,0 +1,22 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+#include <lcm/lcm-cpp.hpp>
+
+namespace bm {
+
+
+// How long a message waited between LCM receiving it and its handler running (ms). This is the
+// time it spent queued behind other messages on the same LCM instance.
+// NOTE(milo): recv_utime is wall clock time (microseconds since the epoch) on this machine.
+inline double ReceiveLatencyMs(const lcm::ReceiveBuffer* rbuf)
+{
+  const int64_t now_utime = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  return 1e-3 * static_cast<double>(std::max<int64_t>(0, now_utime - rbuf->recv_utime));
+}
+
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/macros.hpp"
+#include "core/publish_scheduler.hpp"
+#include "lcm_util/lcm_publisher.hpp"
+
+namespace bm {
+
+
+// An LcmPublisher whose messages go out when a PublishScheduler decides, instead of right away.
+// Update() overwrites the one pending message, so a slow link only ever sends the newest value.
+//
+// NOTE(milo): Update() can be called from any thread. The message is only published from the
+// scheduler's thread.
+template <typename MessageType>
+class ScheduledLcmPublisher final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ScheduledLcmPublisher);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ScheduledLcmPublisher);
+
+  typedef std::function<void(MessageType&)> UpdateFunction;
+
+  // NOTE(milo): The LCM handle and scheduler must outlive this publisher (and the scheduler should
+  // be stopped before it's destroyed).
+  ScheduledLcmPublisher(lcm::LCM& lcm,
+                        const std::string& channel,
+                        core::PublishScheduler& scheduler,
+                        core::PublishPriority priority,
+                        double max_hz,
+                        double min_hz = 0)
+      : pub_(lcm, channel), scheduler_(scheduler)
+  {
+    id_ = scheduler_.AddChannel(channel, priority, max_hz, min_hz, [this]() { return PublishLatest(); });
+  }
+
+  // Fill in the pending message (under a lock) and mark it for publishing.
+  void Update(const UpdateFunction& f)
+  {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      f(pub_.Msg());
+    }
+    scheduler_.MarkPending(id_);
+  }
+
+  // See PublishScheduler::SetMaxHz().
+  void SetMaxHz(double max_hz) { scheduler_.SetMaxHz(id_, max_hz); }
+
+  const std::string& Channel() const { return pub_.Channel(); }
+
+ private:
+  int PublishLatest()
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (pub_.Publish() != 0) {
+      return -1;
+    }
+    return pub_.Msg().getEncodedSize();
+  }
+
+  std::mutex lock_;
+  LcmPublisher<MessageType> pub_;
+  core::PublishScheduler& scheduler_;
+  core::PublishScheduler::ChannelId id_;
+};
+
+
+}
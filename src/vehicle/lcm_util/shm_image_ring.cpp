@@ -0,0 +1,239 @@
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#include <glog/logging.h>
+
+#include "lcm_util/shm_image_ring.hpp"
+
+namespace bm {
+
+
+static const uint64_t kRingMagic = 0x474e495245474d49ul;   // "IMGERING"
+static const uint32_t kRingVersion = 1;
+
+// NOTE(milo): Each slot starts on its own cache line, so that the publisher writing one slot
+// doesn't invalidate the line a subscriber is reading from another.
+static const size_t kAlignment = 64;
+
+
+static size_t AlignUp(size_t n)
+{
+  return ((n + kAlignment - 1) / kAlignment) * kAlignment;
+}
+
+
+struct ShmImageRing::RingHeader final
+{
+  uint64_t magic;
+  uint32_t version;
+  int32_t num_slots;
+  uint64_t slot_bytes;        // Including the SlotHeader.
+  uint64_t max_image_bytes;
+};
+
+
+struct ShmImageRing::SlotHeader final
+{
+  // Odd while the publisher is writing the slot.
+  std::atomic<uint64_t> seq;
+  uint64_t timestamp;
+  int32_t rows;
+  int32_t cols;
+  int32_t type;
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The seqlock needs lock-free 64-bit atomics in shared memory");
+
+
+static bool IsSupportedType(int type)
+{
+  return type == CV_8UC1 || type == CV_8UC3;
+}
+
+
+static size_t ImageBytes(int rows, int cols, int type)
+{
+  return static_cast<size_t>(rows) * static_cast<size_t>(cols) * ((type == CV_8UC3) ? 3 : 1);
+}
+
+
+ShmImageRing::ShmImageRing(const std::string& name, int num_slots, size_t max_image_bytes)
+    : name_(name), owner_(true)
+{
+  CHECK_GT(num_slots, 0) << "Need at least one slot" << std::endl;
+  CHECK_GT(max_image_bytes, 0ul) << "Slots can't be empty" << std::endl;
+
+  const size_t slot_bytes = AlignUp(sizeof(SlotHeader)) + 2 * AlignUp(max_image_bytes);
+  const size_t total_bytes = AlignUp(sizeof(RingHeader)) + num_slots * slot_bytes;
+
+  // Start from a new ring, in case an old publisher didn't clean its up.
+  ipc::shared_memory_object::remove(name_.c_str());
+  shm_ = ipc::shared_memory_object(ipc::create_only, name_.c_str(), ipc::read_write);
+  shm_.truncate(static_cast<ipc::offset_t>(total_bytes));
+  region_ = ipc::mapped_region(shm_, ipc::read_write);
+
+  header_ = new (region_.get_address()) RingHeader();
+  header_->version = kRingVersion;
+  header_->num_slots = num_slots;
+  header_->slot_bytes = slot_bytes;
+  header_->max_image_bytes = max_image_bytes;
+
+  for (int i = 0; i < num_slots; ++i) {
+    SlotHeader* slot = new (Slot(i)) SlotHeader();
+    slot->seq.store(0, std::memory_order_relaxed);
+  }
+
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = kRingMagic;
+
+  LOG(INFO) << "Created shared memory ring: " << name_ << " (" << num_slots << " slots of "
+            << slot_bytes << " bytes)" << std::endl;
+}
+
+
+ShmImageRing::ShmImageRing(const std::string& name)
+    : name_(name), owner_(false)
+{
+  shm_ = ipc::shared_memory_object(ipc::open_only, name_.c_str(), ipc::read_only);
+  region_ = ipc::mapped_region(shm_, ipc::read_only);
+
+  CHECK_GE(region_.get_size(), sizeof(RingHeader)) << "Shared memory is too small: " << name_ << std::endl;
+  header_ = static_cast<RingHeader*>(region_.get_address());
+
+  CHECK_EQ(kRingMagic, header_->magic) << "Not a ShmImageRing: " << name_ << std::endl;
+  CHECK_EQ(kRingVersion, header_->version) << "Unsupported ShmImageRing version: " << name_ << std::endl;
+
+  const size_t total_bytes = AlignUp(sizeof(RingHeader)) + header_->num_slots * header_->slot_bytes;
+  CHECK_GE(region_.get_size(), total_bytes) << "Shared memory is smaller than its slots: " << name_ << std::endl;
+
+  LOG(INFO) << "Opened shared memory ring: " << name_ << " (" << header_->num_slots << " slots)" << std::endl;
+}
+
+
+ShmImageRing::~ShmImageRing()
+{
+  if (owner_) {
+    ipc::shared_memory_object::remove(name_.c_str());
+  }
+}
+
+
+int ShmImageRing::NumSlots() const
+{
+  return header_->num_slots;
+}
+
+
+size_t ShmImageRing::MaxImageBytes() const
+{
+  return header_->max_image_bytes;
+}
+
+
+ShmImageRing::SlotHeader* ShmImageRing::Slot(int i) const
+{
+  uint8_t* base = static_cast<uint8_t*>(region_.get_address()) + AlignUp(sizeof(RingHeader));
+  return reinterpret_cast<SlotHeader*>(base + i * header_->slot_bytes);
+}
+
+
+bool ShmImageRing::Write(core::timestamp_t timestamp,
+                         const cv::Mat& left,
+                         const cv::Mat& right,
+                         int& slot,
+                         int64_t& seq)
+{
+  CHECK(owner_) << "Only the publisher can write to a ShmImageRing" << std::endl;
+
+  if (left.rows != right.rows || left.cols != right.cols || left.type() != right.type()) {
+    LOG(WARNING) << "Left and right images have different sizes or types" << std::endl;
+    return false;
+  }
+  if (!IsSupportedType(left.type())) {
+    LOG(WARNING) << "ShmImageRing only supports CV_8UC1 and CV_8UC3 images" << std::endl;
+    return false;
+  }
+
+  const size_t image_bytes = ImageBytes(left.rows, left.cols, left.type());
+  if (image_bytes > header_->max_image_bytes) {
+    LOG(WARNING) << "Image (" << image_bytes << " bytes) doesn't fit in a slot ("
+                 << header_->max_image_bytes << " bytes)" << std::endl;
+    return false;
+  }
+
+  SlotHeader* s = Slot(next_slot_);
+  uint8_t* left_data = reinterpret_cast<uint8_t*>(s) + AlignUp(sizeof(SlotHeader));
+  uint8_t* right_data = left_data + AlignUp(header_->max_image_bytes);
+
+  // Make the sequence number odd, so that readers know the slot is changing.
+  const uint64_t seq0 = s->seq.load(std::memory_order_relaxed);
+  s->seq.store(seq0 + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  s->timestamp = timestamp;
+  s->rows = left.rows;
+  s->cols = left.cols;
+  s->type = left.type();
+
+  // NOTE(milo): Row by row, since the images might be ROIs of something larger.
+  const size_t row_bytes = image_bytes / left.rows;
+  for (int r = 0; r < left.rows; ++r) {
+    std::memcpy(left_data + r * row_bytes, left.ptr(r), row_bytes);
+    std::memcpy(right_data + r * row_bytes, right.ptr(r), row_bytes);
+  }
+
+  s->seq.store(seq0 + 2, std::memory_order_release);
+
+  slot = next_slot_;
+  seq = static_cast<int64_t>(seq0 + 2);
+  next_slot_ = (next_slot_ + 1) % header_->num_slots;
+
+  return true;
+}
+
+
+bool ShmImageRing::Read(int slot,
+                        int64_t seq,
+                        core::timestamp_t& timestamp,
+                        cv::Mat& left,
+                        cv::Mat& right,
+                        core::ImagePool* pool) const
+{
+  if (slot < 0 || slot >= header_->num_slots) {
+    LOG(WARNING) << "Slot " << slot << " isn't in ring " << name_ << std::endl;
+    return false;
+  }
+
+  const SlotHeader* s = Slot(slot);
+  const uint8_t* left_data = reinterpret_cast<const uint8_t*>(s) + AlignUp(sizeof(SlotHeader));
+  const uint8_t* right_data = left_data + AlignUp(header_->max_image_bytes);
+
+  const uint64_t seq0 = s->seq.load(std::memory_order_acquire);
+  if (seq0 != static_cast<uint64_t>(seq)) {
+    return false;
+  }
+
+  // The header might be torn too, so check it before trusting it.
+  const int rows = s->rows;
+  const int cols = s->cols;
+  const int type = s->type;
+  if (rows <= 0 || cols <= 0 || !IsSupportedType(type) ||
+      ImageBytes(rows, cols, type) > header_->max_image_bytes) {
+    return false;
+  }
+
+  timestamp = s->timestamp;
+  left = pool ? pool->Get(rows, cols, type) : cv::Mat(rows, cols, type);
+  right = pool ? pool->Get(rows, cols, type) : cv::Mat(rows, cols, type);
+  const size_t image_bytes = ImageBytes(rows, cols, type);
+  std::memcpy(left.data, left_data, image_bytes);
+  std::memcpy(right.data, right_data, image_bytes);
+
+  // If the publisher started writing the slot during the copy, the images could be torn.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return s->seq.load(std::memory_order_relaxed) == seq0;
+}
+
+
+}
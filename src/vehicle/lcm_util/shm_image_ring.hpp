@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+
+#include <opencv2/core/mat.hpp>
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "vision_core/image_pool.hpp"
+
+namespace bm {
+
+namespace ipc = boost::interprocess;
+
+
+// A ring of fixed-size slots in shared memory (/dev/shm on Linux), which holds raw (unencoded)
+// stereo pairs. One publisher writes pairs into the slots round-robin, and tells subscribers which
+// slot (and sequence number) to read with a small LCM message (see shm_stereo_image_t), so images
+// are never encoded or copied through LCM.
+//
+// Each slot is guarded by a seqlock: the publisher makes the slot's sequence number odd while it
+// writes, and even again once it's done. A reader copies the pair out, and then checks that the
+// sequence number hasn't changed. That way the publisher never waits for subscribers, and a
+// subscriber that falls so far behind that its slot was reused finds out (Read() returns false)
+// instead of getting a torn image.
+//
+// NOTE(milo): Subscribers only ever copy out of the ring, since anything they hold onto would be
+// overwritten after num_slots more pairs.
+class ShmImageRing final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ShmImageRing);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ShmImageRing);
+
+  // Create a ring for a publisher, with num_slots slots that each fit a stereo pair of up to
+  // max_image_bytes per image. Replaces any existing ring with the same name, and removes it on
+  // destruction.
+  ShmImageRing(const std::string& name, int num_slots, size_t max_image_bytes);
+
+  // Open an existing ring (read-only) for a subscriber. CHECK-fails if it doesn't exist, or wasn't
+  // created by a ShmImageRing.
+  explicit ShmImageRing(const std::string& name);
+
+  ~ShmImageRing();
+
+  // Copy a stereo pair (CV_8UC1 or CV_8UC3, with the same size and type) into the next slot.
+  // Outputs the slot and its sequence number, which subscribers need to read it back. Returns false
+  // (and writes nothing) if the images don't fit in a slot.
+  bool Write(core::timestamp_t timestamp,
+             const cv::Mat& left,
+             const cv::Mat& right,
+             int& slot,
+             int64_t& seq);
+
+  // Copy the stereo pair in a slot into newly allocated images (or buffers from the pool, if one is
+  // given). Returns false if the slot doesn't hold the pair with sequence number "seq" anymore, or
+  // was overwritten during the copy.
+  bool Read(int slot,
+            int64_t seq,
+            core::timestamp_t& timestamp,
+            cv::Mat& left,
+            cv::Mat& right,
+            core::ImagePool* pool = nullptr) const;
+
+  const std::string& Name() const { return name_; }
+  int NumSlots() const;
+  size_t MaxImageBytes() const;
+
+ private:
+  struct RingHeader;
+  struct SlotHeader;
+
+  SlotHeader* Slot(int i) const;
+
+  std::string name_;
+  bool owner_ = false;
+  ipc::shared_memory_object shm_;
+  ipc::mapped_region region_;
+
+  RingHeader* header_ = nullptr;
+  int next_slot_ = 0;   // Only used by the publisher.
+};
+
+
+}
@@ -0,0 +1,61 @@
+#include <glog/logging.h>
+
+#include "lcm_util/shm_stereo_publisher.hpp"
+#include "core/trace.hpp"
+
+#include "vehicle/shm_stereo_image_t.hpp"
+
+namespace bm {
+
+
+ShmStereoPublisher::ShmStereoPublisher(lcm::LCM& lcm,
+                                       const std::string& channel,
+                                       const std::string& shm_name,
+                                       int num_slots,
+                                       int max_width,
+                                       int max_height,
+                                       int max_channels)
+    : lcm_(lcm),
+      channel_(channel),
+      ring_(shm_name, num_slots, static_cast<size_t>(max_width) * max_height * max_channels)
+{
+  LOG(INFO) << "ShmStereoPublisher publishing on: " << channel_ << " (ring " << shm_name << ")" << std::endl;
+}
+
+
+bool ShmStereoPublisher::Publish(const core::StereoImage1b& stereo_pair)
+{
+  return Publish(stereo_pair.timestamp, stereo_pair.camera_id, stereo_pair.left_image, stereo_pair.right_image);
+}
+
+
+bool ShmStereoPublisher::Publish(const core::StereoImage3b& stereo_pair)
+{
+  return Publish(stereo_pair.timestamp, stereo_pair.camera_id, stereo_pair.left_image, stereo_pair.right_image);
+}
+
+
+bool ShmStereoPublisher::Publish(core::timestamp_t timestamp,
+                                 core::uid_t camera_id,
+                                 const cv::Mat& left,
+                                 const cv::Mat& right)
+{
+  BM_TRACE_SCOPE("ShmStereoPublisher::Publish");
+
+  vehicle::shm_stereo_image_t msg;
+  if (!ring_.Write(timestamp, left, right, msg.slot, msg.slot_seq)) {
+    return false;
+  }
+
+  // NOTE(milo): ImageSubscriber passes header.seq through as the camera id.
+  msg.header.timestamp = timestamp;
+  msg.header.seq = camera_id;
+  msg.header.frame_id = "";
+  msg.shm_name = ring_.Name();
+
+  lcm_.publish(channel_, &msg);
+  return true;
+}
+
+
+}
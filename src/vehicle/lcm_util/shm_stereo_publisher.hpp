@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/macros.hpp"
+#include "lcm_util/shm_image_ring.hpp"
+#include "vision_core/stereo_image.hpp"
+
+namespace bm {
+
+
+// Publishes raw stereo pairs through a ShmImageRing: each pair is copied into the next slot of the
+// ring, and only a shm_stereo_image_t (the slot and its sequence number) goes over LCM. Subscribe
+// with an ImageSubscriber that uses ImageTransport::SHM_RING.
+class ShmStereoPublisher final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ShmStereoPublisher);
+
+  // Creates a ring called shm_name, with num_slots slots that each hold a pair of up to width x
+  // height x channels. More slots give slow subscribers longer to read each pair before it's
+  // overwritten.
+  // NOTE(milo): The LCM handle must outlive this publisher.
+  ShmStereoPublisher(lcm::LCM& lcm,
+                     const std::string& channel,
+                     const std::string& shm_name,
+                     int num_slots,
+                     int max_width,
+                     int max_height,
+                     int max_channels = 1);
+
+  // Returns false if the pair couldn't be written to the ring (e.g it's too big).
+  bool Publish(const core::StereoImage1b& stereo_pair);
+  bool Publish(const core::StereoImage3b& stereo_pair);
+
+ private:
+  bool Publish(core::timestamp_t timestamp, core::uid_t camera_id, const cv::Mat& left, const cv::Mat& right);
+
+  lcm::LCM& lcm_;
+  std::string channel_;
+  ShmImageRing ring_;
+};
+
+
+}
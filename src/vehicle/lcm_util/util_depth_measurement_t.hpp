@@ -8,6 +8,13 @@ namespace bm {
 using namespace core;
 
 
+inline void pack_depth_measurement_t(const DepthMeasurement& data, vehicle::depth_measurement_t& msg)
+{
+  msg.header.timestamp = data.timestamp;
+  msg.depth = data.depth;
+}
+
+
 inline void decode_depth_measurement_t(const vehicle::depth_measurement_t& msg, DepthMeasurement& out)
 {
   out.timestamp = msg.header.timestamp;
@@ -1,14 +1,25 @@
 #pragma once
 
+#include <vector>
+
 #include "core/imu_measurement.hpp"
 #include "lcm_util/util_vector3_t.hpp"
 #include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/imu_batch_t.hpp"
 
 namespace bm {
 
 using namespace core;
 
 
+inline void pack_imu_measurement_t(const ImuMeasurement& data, vehicle::imu_measurement_t& msg)
+{
+  msg.header.timestamp = data.timestamp;
+  pack_vector3_t(data.a, msg.linear_acc);
+  pack_vector3_t(data.w, msg.angular_vel);
+}
+
+
 inline void decode_imu_measurement_t(const vehicle::imu_measurement_t& msg, ImuMeasurement& out)
 {
   out.timestamp = msg.header.timestamp;
@@ -17,4 +28,33 @@ inline void decode_imu_measurement_t(const vehicle::imu_measurement_t& msg, ImuM
 }
 
 
+inline void pack_imu_batch_t(const ImuMeasurement* data, size_t n, vehicle::imu_batch_t& msg)
+{
+  msg.header.timestamp = (n > 0) ? data[n - 1].timestamp : 0;
+  msg.num_measurements = (int32_t)n;
+
+  msg.timestamps.resize(n);
+  msg.linear_acc.resize(n);
+  msg.angular_vel.resize(n);
+
+  for (size_t i = 0; i < n; ++i) {
+    msg.timestamps[i] = data[i].timestamp;
+    pack_vector3_t(data[i].a, msg.linear_acc[i]);
+    pack_vector3_t(data[i].w, msg.angular_vel[i]);
+  }
+}
+
+
+inline void decode_imu_batch_t(const vehicle::imu_batch_t& msg, std::vector<ImuMeasurement>& out)
+{
+  out.resize(msg.num_measurements);
+
+  for (int32_t i = 0; i < msg.num_measurements; ++i) {
+    out[i].timestamp = msg.timestamps[i];
+    decode_vector3_t(msg.linear_acc[i], out[i].a);
+    decode_vector3_t(msg.angular_vel[i], out[i].w);
+  }
+}
+
+
 }
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "core/latency_trace.hpp"
+#include "vehicle/latency_trace_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+inline void pack_latency_trace_t(const LatencyTrace& trace, vehicle::latency_trace_t& msg)
+{
+  msg.header.timestamp = trace.timestamp;
+  msg.header.seq = static_cast<int64_t>(trace.seq);
+  msg.num_stages = static_cast<int32_t>(trace.stages.size());
+  msg.stages.resize(trace.stages.size());
+  msg.utime.resize(trace.stages.size());
+  for (size_t i = 0; i < trace.stages.size(); ++i) {
+    msg.stages.at(i) = trace.stages.at(i).first;
+    msg.utime.at(i) = trace.stages.at(i).second;
+  }
+}
+
+
+inline void decode_latency_trace_t(const vehicle::latency_trace_t& msg, LatencyTrace& out)
+{
+  out.timestamp = msg.header.timestamp;
+  out.seq = static_cast<uid_t>(msg.header.seq);
+  out.stages.resize(msg.num_stages);
+  for (int i = 0; i < msg.num_stages; ++i) {
+    out.stages.at(i) = std::make_pair(msg.stages.at(i), msg.utime.at(i));
+  }
+}
+
+
+}
@@ -1,8 +1,19 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <set>
+#include <unordered_map>
+
+#include <glog/logging.h>
+
 #include "core/eigen_types.hpp"
+#include "core/uid.hpp"
+#include "mesher/triangle_mesh.hpp"
 
 #include "vehicle/mesh_t.hpp"
+#include "vehicle/mesh_delta_t.hpp"
 #include "vehicle/vector3_t.hpp"
 
 namespace bm {
@@ -10,7 +21,7 @@ namespace bm {
 using namespace core;
 
 
-void pack_mesh_t(const std::vector<Vector3d>& vertices,
+inline void pack_mesh_t(const std::vector<Vector3d>& vertices,
                  const std::vector<Vector3i>& triangles,
                  vehicle::mesh_t& msg)
 {
@@ -38,4 +49,245 @@ void pack_mesh_t(const std::vector<Vector3d>& vertices,
 }
 
 
+// A triangle by the ids of its vertices, rotated so that the smallest id is first (which keeps
+// the orientation).
+typedef std::array<uid_t, 3> MeshTriangleIds;
+
+inline MeshTriangleIds CanonicalTriangleIds(uid_t a, uid_t b, uid_t c)
+{
+  if (a < b && a < c) { return {{ a, b, c }}; }
+  if (b < c) { return {{ b, c, a }}; }
+  return {{ c, a, b }};
+}
+
+
+// Encodes a TriangleMesh (with vertex_ids) as mesh_delta_t messages, which only have the vertices
+// and triangles that changed since the last message. Every keyframe_period messages (and the first
+// one) is a keyframe with the whole mesh, so that receivers can join or recover from a dropped
+// message. Positions are quantized to 16 bits over the bounding box of the vertices that are sent,
+// and a vertex is only sent again once it moves by more than min_move (m).
+class MeshDeltaEncoder final {
+ public:
+  explicit MeshDeltaEncoder(int keyframe_period = 30, double min_move = 0.01)
+      : keyframe_period_(keyframe_period), min_move_(min_move) {}
+
+  void Encode(const mesher::TriangleMesh& mesh, vehicle::mesh_delta_t& msg)
+  {
+    CHECK_EQ(mesh.vertices.size(), mesh.vertex_ids.size())
+        << "MeshDeltaEncoder needs a vertex id for each vertex" << std::endl;
+
+    msg.keyframe = (seq_ % std::max(1, keyframe_period_)) == 0;
+    msg.header.seq = seq_++;
+    msg.added.clear();
+    msg.moved.clear();
+    msg.removed.clear();
+    msg.added_triangles.clear();
+    msg.removed_triangles.clear();
+
+    if (msg.keyframe) {
+      sent_vertices_.clear();
+      sent_triangles_.clear();
+    }
+
+    // Find the vertices to send first, since the origin and scale depend on them.
+    std::vector<size_t> added, moved;
+    std::unordered_map<uid_t, size_t> current;
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+      const uid_t id = mesh.vertex_ids[i];
+      current.emplace(id, i);
+
+      const auto it = sent_vertices_.find(id);
+      if (it == sent_vertices_.end()) {
+        added.emplace_back(i);
+      } else if ((it->second - mesh.vertices[i]).norm() > min_move_) {
+        moved.emplace_back(i);
+      }
+    }
+
+    Vector3d vmin = Vector3d::Zero();
+    Vector3d vmax = Vector3d::Zero();
+    for (size_t k = 0; k < added.size() + moved.size(); ++k) {
+      const Vector3d& v = mesh.vertices[k < added.size() ? added[k] : moved[k - added.size()]];
+      vmin = (k == 0) ? v : Vector3d(vmin.cwiseMin(v));
+      vmax = (k == 0) ? v : Vector3d(vmax.cwiseMax(v));
+    }
+
+    const Vector3d origin = 0.5 * (vmin + vmax);
+    const double scale = std::max(1e-6, 0.5 * (vmax - vmin).maxCoeff() / 32767.0);
+    msg.origin.x = origin.x();
+    msg.origin.y = origin.y();
+    msg.origin.z = origin.z();
+    msg.scale = scale;
+
+    for (const size_t i : added) {
+      msg.added.emplace_back(Quantize(mesh.vertex_ids[i], mesh.vertices[i], origin, scale));
+    }
+    for (const size_t i : moved) {
+      msg.moved.emplace_back(Quantize(mesh.vertex_ids[i], mesh.vertices[i], origin, scale));
+    }
+
+    for (auto it = sent_vertices_.begin(); it != sent_vertices_.end();) {
+      if (current.count(it->first) == 0) {
+        msg.removed.emplace_back(static_cast<int64_t>(it->first));
+        it = sent_vertices_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    std::set<MeshTriangleIds> triangles;
+    for (const Vector3i& t : mesh.triangles) {
+      triangles.insert(CanonicalTriangleIds(
+          mesh.vertex_ids.at(t.x()), mesh.vertex_ids.at(t.y()), mesh.vertex_ids.at(t.z())));
+    }
+
+    for (const MeshTriangleIds& t : triangles) {
+      if (sent_triangles_.count(t) == 0) {
+        msg.added_triangles.emplace_back(PackTriangle(t));
+      }
+    }
+
+    // NOTE(milo): Triangles that use a removed vertex are removed by the decoder anyways.
+    for (const MeshTriangleIds& t : sent_triangles_) {
+      if (triangles.count(t) == 0 &&
+          current.count(t[0]) > 0 && current.count(t[1]) > 0 && current.count(t[2]) > 0) {
+        msg.removed_triangles.emplace_back(PackTriangle(t));
+      }
+    }
+
+    sent_triangles_ = std::move(triangles);
+
+    msg.num_added = (int32_t)msg.added.size();
+    msg.num_moved = (int32_t)msg.moved.size();
+    msg.num_removed = (int32_t)msg.removed.size();
+    msg.num_added_triangles = (int32_t)msg.added_triangles.size();
+    msg.num_removed_triangles = (int32_t)msg.removed_triangles.size();
+  }
+
+ private:
+  // Also remembers where the decoder will think the vertex is, so that errors don't accumulate.
+  vehicle::mesh_delta_vertex_t Quantize(uid_t id, const Vector3d& v, const Vector3d& origin, double scale)
+  {
+    vehicle::mesh_delta_vertex_t out;
+    out.id = static_cast<int64_t>(id);
+
+    Vector3d decoded;
+    for (int j = 0; j < 3; ++j) {
+      const double q = std::round((v(j) - origin(j)) / scale);
+      out.position[j] = static_cast<int16_t>(std::max(-32767.0, std::min(32767.0, q)));
+      decoded(j) = origin(j) + scale * out.position[j];
+    }
+
+    sent_vertices_[id] = decoded;
+    return out;
+  }
+
+  static vehicle::mesh_delta_triangle_t PackTriangle(const MeshTriangleIds& t)
+  {
+    vehicle::mesh_delta_triangle_t out;
+    for (int j = 0; j < 3; ++j) {
+      out.vertex_ids[j] = static_cast<int64_t>(t[j]);
+    }
+    return out;
+  }
+
+  int keyframe_period_;
+  double min_move_;
+  int64_t seq_ = 0;
+
+  std::unordered_map<uid_t, Vector3d> sent_vertices_;
+  std::set<MeshTriangleIds> sent_triangles_;
+};
+
+
+// Rebuilds the mesh from mesh_delta_t messages (see MeshDeltaEncoder).
+class MeshDeltaDecoder final {
+ public:
+  // Applies a message. Returns false (and ignores it) if it's a delta, and a message was missed
+  // since the last one. Deltas are ignored until the next keyframe after that.
+  bool Decode(const vehicle::mesh_delta_t& msg)
+  {
+    const bool in_sequence = synced_ && msg.header.seq == last_seq_ + 1;
+    last_seq_ = msg.header.seq;
+
+    if (!msg.keyframe && !in_sequence) {
+      synced_ = false;
+      return false;
+    }
+
+    if (msg.keyframe) {
+      vertices_.clear();
+      triangles_.clear();
+    }
+    synced_ = true;
+
+    const Vector3d origin(msg.origin.x, msg.origin.y, msg.origin.z);
+    for (const vehicle::mesh_delta_vertex_t& v : msg.added) {
+      vertices_[static_cast<uid_t>(v.id)] = Dequantize(v, origin, msg.scale);
+    }
+    for (const vehicle::mesh_delta_vertex_t& v : msg.moved) {
+      vertices_[static_cast<uid_t>(v.id)] = Dequantize(v, origin, msg.scale);
+    }
+
+    for (const int64_t id : msg.removed) {
+      vertices_.erase(static_cast<uid_t>(id));
+    }
+    if (!msg.removed.empty()) {
+      for (auto it = triangles_.begin(); it != triangles_.end();) {
+        const MeshTriangleIds& t = *it;
+        const bool alive = vertices_.count(t[0]) > 0 && vertices_.count(t[1]) > 0 && vertices_.count(t[2]) > 0;
+        it = alive ? std::next(it) : triangles_.erase(it);
+      }
+    }
+
+    for (const vehicle::mesh_delta_triangle_t& t : msg.removed_triangles) {
+      triangles_.erase(UnpackTriangle(t));
+    }
+    for (const vehicle::mesh_delta_triangle_t& t : msg.added_triangles) {
+      triangles_.insert(UnpackTriangle(t));
+    }
+
+    return true;
+  }
+
+  // Returns the current mesh, with vertex_ids.
+  void GetMesh(mesher::TriangleMesh& mesh) const
+  {
+    mesh.vertices.clear();
+    mesh.triangles.clear();
+    mesh.vertex_ids.clear();
+
+    std::unordered_map<uid_t, int> id_to_index;
+    for (auto it = vertices_.begin(); it != vertices_.end(); ++it) {
+      id_to_index.emplace(it->first, static_cast<int>(mesh.vertices.size()));
+      mesh.vertices.emplace_back(it->second);
+      mesh.vertex_ids.emplace_back(it->first);
+    }
+
+    for (const MeshTriangleIds& t : triangles_) {
+      mesh.triangles.emplace_back(id_to_index.at(t[0]), id_to_index.at(t[1]), id_to_index.at(t[2]));
+    }
+  }
+
+ private:
+  static Vector3d Dequantize(const vehicle::mesh_delta_vertex_t& v, const Vector3d& origin, double scale)
+  {
+    return origin + scale * Vector3d(v.position[0], v.position[1], v.position[2]);
+  }
+
+  static MeshTriangleIds UnpackTriangle(const vehicle::mesh_delta_triangle_t& t)
+  {
+    return CanonicalTriangleIds(static_cast<uid_t>(t.vertex_ids[0]),
+                                static_cast<uid_t>(t.vertex_ids[1]),
+                                static_cast<uid_t>(t.vertex_ids[2]));
+  }
+
+  bool synced_ = false;
+  int64_t last_seq_ = -1;
+
+  std::unordered_map<uid_t, Vector3d> vertices_;
+  std::set<MeshTriangleIds> triangles_;
+};
+
+
 }
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "core/warm_up.hpp"
+#include "vehicle/node_status_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+inline void pack_node_status_t(const std::string& node_name,
+                               bool ready,
+                               const std::string& status,
+                               const WarmUpReport& report,
+                               vehicle::node_status_t& msg)
+{
+  msg.node_name = node_name;
+  msg.ready = ready;
+  msg.status = status;
+  msg.num_warm_up_ms = static_cast<int32_t>(report.stages_ms.size());
+  msg.warm_up_ms.resize(report.stages_ms.size());
+  for (size_t i = 0; i < report.stages_ms.size(); ++i) {
+    msg.warm_up_ms.at(i).name = report.stages_ms.at(i).first;
+    msg.warm_up_ms.at(i).value = report.stages_ms.at(i).second;
+  }
+}
+
+
+}
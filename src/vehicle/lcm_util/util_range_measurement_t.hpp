@@ -9,6 +9,14 @@ namespace bm {
 using namespace core;
 
 
+inline void pack_range_measurement_t(const RangeMeasurement& data, vehicle::range_measurement_t& msg)
+{
+  msg.header.timestamp = data.timestamp;
+  msg.range = data.range;
+  pack_vector3_t(data.point, msg.point);
+}
+
+
 inline void decode_range_measurement_t(const vehicle::range_measurement_t& msg, RangeMeasurement& out)
 {
   out.timestamp = msg.header.timestamp;
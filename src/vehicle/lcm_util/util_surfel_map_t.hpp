@@ -0,0 +1,73 @@
+#pragma once
+
+#include "mesher/surfel_map.hpp"
+
+#include "vehicle/surfel_block_t.hpp"
+#include "vehicle/surfel_map_update_t.hpp"
+#include "vehicle/vector3_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+inline void pack_surfel_block_t(const mesher::BlockIndex& index,
+                                const std::vector<mesher::Surfel>& surfels,
+                                vehicle::surfel_block_t& msg)
+{
+  msg.index[0] = index.x();
+  msg.index[1] = index.y();
+  msg.index[2] = index.z();
+
+  msg.num_surfels = (int32_t)surfels.size();
+  msg.positions.resize(surfels.size());
+  msg.normals.resize(surfels.size());
+  msg.weights.resize(surfels.size());
+
+  for (size_t i = 0; i < surfels.size(); ++i) {
+    const mesher::Surfel& s = surfels[i];
+    msg.positions[i].x = s.position.x();
+    msg.positions[i].y = s.position.y();
+    msg.positions[i].z = s.position.z();
+    msg.normals[i].x = s.normal.x();
+    msg.normals[i].y = s.normal.y();
+    msg.normals[i].z = s.normal.z();
+    msg.weights[i] = s.weight;
+  }
+}
+
+
+// Packs the blocks that changed since the last call to PopChanges() (see SurfelMap).
+inline void pack_surfel_map_update_t(const mesher::SurfelMap& map,
+                                     const mesher::BlockSet& updated,
+                                     const mesher::BlockSet& evicted,
+                                     vehicle::surfel_map_update_t& msg)
+{
+  msg.voxel_size = map.GetParams().voxel_size;
+  msg.block_voxels = map.GetParams().block_voxels;
+
+  msg.blocks.clear();
+  msg.blocks.reserve(updated.size());
+
+  std::vector<mesher::Surfel> surfels;
+  for (const mesher::BlockIndex& index : updated) {
+    surfels.clear();
+    map.GetSurfels(index, surfels);
+    msg.blocks.emplace_back();
+    pack_surfel_block_t(index, surfels, msg.blocks.back());
+  }
+  msg.num_blocks = (int32_t)msg.blocks.size();
+
+  msg.removed.clear();
+  msg.removed.reserve(evicted.size());
+
+  surfels.clear();
+  for (const mesher::BlockIndex& index : evicted) {
+    msg.removed.emplace_back();
+    pack_surfel_block_t(index, surfels, msg.removed.back());
+  }
+  msg.num_removed = (int32_t)msg.removed.size();
+}
+
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Eigen/Geometry>
+
+#include "core/eigen_types.hpp"
+#include "vision_core/packed_observation.hpp"
+#include "vio/vo_result.hpp"
+
+#include "vehicle/vo_result_t.hpp"
+
+namespace bm {
+
+using namespace core;
+
+
+// Packs a VoResult for sharing with another process. The observations are delta-encoded with
+// PackObservations(), so each one is 16 bytes on the wire (instead of 48 in memory).
+inline void pack_vo_result_t(const vio::VoResult& result, vehicle::vo_result_t& msg)
+{
+  msg.header.timestamp = result.timestamp;
+  msg.timestamp_lkf = result.timestamp_lkf;
+  msg.camera_id = static_cast<int64_t>(result.camera_id);
+  msg.camera_id_lkf = static_cast<int64_t>(result.camera_id_lkf);
+  msg.rig = static_cast<int32_t>(result.rig);
+  msg.is_keyframe = result.is_keyframe;
+  msg.status = result.status;
+  msg.avg_reprojection_err = static_cast<float>(result.avg_reprojection_err);
+
+  const Eigen::Quaterniond q(Matrix3d(result.lkf_T_cam.block<3, 3>(0, 0)));
+  msg.lkf_T_cam.position.x = result.lkf_T_cam(0, 3);
+  msg.lkf_T_cam.position.y = result.lkf_T_cam(1, 3);
+  msg.lkf_T_cam.position.z = result.lkf_T_cam(2, 3);
+  msg.lkf_T_cam.orientation.w = q.w();
+  msg.lkf_T_cam.orientation.x = q.x();
+  msg.lkf_T_cam.orientation.y = q.y();
+  msg.lkf_T_cam.orientation.z = q.z();
+
+  PackedObservations packed;
+  PackObservations(result.lmk_obs, result.camera_id, packed);
+  msg.base_landmark_id = static_cast<int64_t>(packed.base_landmark_id);
+  msg.num_obs = static_cast<int32_t>(packed.obs.size());
+  msg.obs.resize(packed.obs.size());
+
+  for (size_t i = 0; i < packed.obs.size(); ++i) {
+    const PackedObservation& p = packed.obs[i];
+    vehicle::landmark_observation_t& o = msg.obs[i];
+    o.pixel[0] = p.u;
+    o.pixel[1] = p.v;
+    o.landmark_offset = static_cast<int32_t>(p.landmark_offset);
+    o.disparity = p.disparity;
+    o.camera_delta = static_cast<int16_t>(p.camera_delta);
+  }
+}
+
+
+// NOTE(milo): VoResult is move-only, so this returns it (it's moved out, not copied).
+inline vio::VoResult decode_vo_result_t(const vehicle::vo_result_t& msg)
+{
+  vio::VoResult result(msg.header.timestamp,
+                       msg.timestamp_lkf,
+                       static_cast<uid_t>(msg.camera_id),
+                       static_cast<uid_t>(msg.camera_id_lkf));
+  result.rig = static_cast<size_t>(msg.rig);
+  result.is_keyframe = msg.is_keyframe;
+  result.status = msg.status;
+  result.avg_reprojection_err = msg.avg_reprojection_err;
+
+  const Eigen::Quaterniond q(msg.lkf_T_cam.orientation.w, msg.lkf_T_cam.orientation.x,
+                             msg.lkf_T_cam.orientation.y, msg.lkf_T_cam.orientation.z);
+  result.lkf_T_cam = Matrix4d::Identity();
+  result.lkf_T_cam.block<3, 3>(0, 0) = q.normalized().toRotationMatrix();
+  result.lkf_T_cam.block<3, 1>(0, 3) = Vector3d(msg.lkf_T_cam.position.x,
+                                                msg.lkf_T_cam.position.y,
+                                                msg.lkf_T_cam.position.z);
+
+  PackedObservations packed;
+  packed.camera_id = result.camera_id;
+  packed.base_landmark_id = static_cast<uid_t>(msg.base_landmark_id);
+  packed.obs.resize(msg.obs.size());
+
+  for (size_t i = 0; i < msg.obs.size(); ++i) {
+    const vehicle::landmark_observation_t& o = msg.obs[i];
+    PackedObservation& p = packed.obs[i];
+    p.u = o.pixel[0];
+    p.v = o.pixel[1];
+    p.landmark_offset = static_cast<uint32_t>(o.landmark_offset);
+    p.disparity = o.disparity;
+    p.camera_delta = static_cast<uint16_t>(o.camera_delta);
+  }
+
+  UnpackObservations(packed, result.lmk_obs);
+  return result;
+}
+
+
+}
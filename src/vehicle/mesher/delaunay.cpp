@@ -0,0 +1,517 @@
+#include <algorithm>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "mesher/delaunay.hpp"
+
+namespace bm {
+namespace mesher {
+
+// Vertices closer than this (squared, in pixels) are counted as the same location.
+static const double kMinVertexDistSq = 1e-6;
+
+// Locate() gives up walking after this many steps (only possible with degenerate triangles), and
+// checks every triangle instead.
+static const int kMaxWalkSteps = 100000;
+
+
+// Twice the signed area of abc, > 0 if abc are counter-clockwise.
+static double Orient(const Vector2d& a, const Vector2d& b, const Vector2d& c)
+{
+  return (b.x() - a.x()) * (c.y() - a.y()) - (b.y() - a.y()) * (c.x() - a.x());
+}
+
+
+// > 0 if d is inside of the circumcircle of the counter-clockwise triangle abc.
+static double InCircle(const Vector2d& a, const Vector2d& b, const Vector2d& c, const Vector2d& d)
+{
+  const Vector2d ad = a - d;
+  const Vector2d bd = b - d;
+  const Vector2d cd = c - d;
+  return ad.squaredNorm() * (bd.x() * cd.y() - cd.x() * bd.y()) -
+         bd.squaredNorm() * (ad.x() * cd.y() - cd.x() * ad.y()) +
+         cd.squaredNorm() * (ad.x() * bd.y() - bd.x() * ad.y());
+}
+
+
+// The index i in t such that edge i (opposite v[i]) goes from a to b, or -1.
+template <typename TriangleT>
+static int EdgeIndex(const TriangleT& t, int a, int b)
+{
+  for (int i = 0; i < 3; ++i) {
+    if (t.v[(i + 1) % 3] == a && t.v[(i + 2) % 3] == b) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+Delaunay2D::Delaunay2D(const cv::Rect& rect) : rect_(rect)
+{
+  CHECK(rect.width > 0 && rect.height > 0) << "Delaunay2D needs a non-empty rect" << std::endl;
+
+  // NOTE(milo): Same super triangle as cv::Subdiv2D.
+  const double big = 3.0 * std::max(rect.width, rect.height);
+  const double x0 = rect.x, y0 = rect.y;
+
+  vertices_.resize(3);
+  vertices_.at(0).pt = Vector2d(x0 + big, y0);
+  vertices_.at(1).pt = Vector2d(x0, y0 + big);
+  vertices_.at(2).pt = Vector2d(x0 - big, y0 - big);
+  for (Vertex& v : vertices_) {
+    v.alive = true;
+    v.tri = 0;
+  }
+
+  // Orient the super triangle counter-clockwise.
+  if (Orient(vertices_.at(0).pt, vertices_.at(1).pt, vertices_.at(2).pt) > 0) {
+    NewTriangle(0, 1, 2);
+  } else {
+    NewTriangle(0, 2, 1);
+  }
+}
+
+
+bool Delaunay2D::Insert(uid_t lmk_id, const cv::Point2f& pt)
+{
+  if (Contains(lmk_id)) {
+    return false;
+  }
+
+  if (pt.x < rect_.x || pt.y < rect_.y ||
+      pt.x >= rect_.x + rect_.width || pt.y >= rect_.y + rect_.height) {
+    return false;
+  }
+
+  int vtx;
+  if (!free_vertices_.empty()) {
+    vtx = free_vertices_.back();
+    free_vertices_.pop_back();
+  } else {
+    vtx = static_cast<int>(vertices_.size());
+    vertices_.emplace_back();
+  }
+
+  Vertex& v = vertices_.at(vtx);
+  v.pt = Vector2d(pt.x, pt.y);
+  v.lmk_id = lmk_id;
+
+  if (!InsertVertex(vtx, Locate(v.pt))) {
+    free_vertices_.emplace_back(vtx);
+    return false;
+  }
+
+  v.alive = true;
+  lmk_to_vtx_.emplace(lmk_id, vtx);
+  return true;
+}
+
+
+bool Delaunay2D::Remove(uid_t lmk_id)
+{
+  const auto it = lmk_to_vtx_.find(lmk_id);
+  if (it == lmk_to_vtx_.end()) {
+    return false;
+  }
+
+  const int vtx = it->second;
+  RemoveVertex(vtx);
+
+  vertices_.at(vtx).alive = false;
+  vertices_.at(vtx).tri = -1;
+  free_vertices_.emplace_back(vtx);
+  lmk_to_vtx_.erase(it);
+  return true;
+}
+
+
+bool Delaunay2D::Move(uid_t lmk_id, const cv::Point2f& pt)
+{
+  const auto it = lmk_to_vtx_.find(lmk_id);
+  if (it == lmk_to_vtx_.end()) {
+    return false;
+  }
+
+  const int vtx = it->second;
+  const Vector2d q(pt.x, pt.y);
+  Vertex& v = vertices_.at(vtx);
+
+  if (q == v.pt) {
+    return true;
+  }
+
+  const bool in_rect = pt.x >= rect_.x && pt.y >= rect_.y &&
+                       pt.x < rect_.x + rect_.width && pt.y < rect_.y + rect_.height;
+
+  // If every triangle around the vertex keeps its orientation, the triangulation is still valid
+  // and only its edges need to be flipped. Otherwise, remove and insert the vertex again.
+  std::vector<int>& star = star_;
+  GetStar(vtx, star);
+
+  bool valid = in_rect;
+  for (size_t k = 0; valid && k < star.size(); ++k) {
+    const Triangle& t = triangles_.at(star.at(k));
+    const int i = std::find(t.v.begin(), t.v.end(), vtx) - t.v.begin();
+    const Vector2d& a = vertices_.at(t.v[(i + 1) % 3]).pt;
+    const Vector2d& b = vertices_.at(t.v[(i + 2) % 3]).pt;
+    valid = Orient(q, a, b) > 0 && (q - a).squaredNorm() >= kMinVertexDistSq;
+  }
+
+  if (valid) {
+    v.pt = q;
+
+    // Only the triangles around the vertex changed, so check their edges: the edge opposite of the
+    // vertex, and one of the edges to it (the other one is checked from the next triangle).
+    std::vector<std::array<int, 3>>& queue = flip_queue_;
+    queue.clear();
+    for (const int s : star) {
+      const Triangle& t = triangles_.at(s);
+      const int i = std::find(t.v.begin(), t.v.end(), vtx) - t.v.begin();
+      const int a = t.v[(i + 1) % 3];
+      const int b = t.v[(i + 2) % 3];
+      queue.push_back({ s, a, b });
+      queue.push_back({ s, vtx, a });
+    }
+    FlipEdges(queue);
+    return true;
+  }
+
+  Remove(lmk_id);
+  return Insert(lmk_id, pt);
+}
+
+
+void Delaunay2D::GetLandmarkIds(std::vector<uid_t>& lmk_ids) const
+{
+  for (auto it = lmk_to_vtx_.begin(); it != lmk_to_vtx_.end(); ++it) {
+    lmk_ids.emplace_back(it->first);
+  }
+}
+
+
+std::vector<LmkTriangle> Delaunay2D::GetTriangles() const
+{
+  std::vector<LmkTriangle> out;
+
+  for (const Triangle& t : triangles_) {
+    if (!t.alive || IsSuper(t.v[0]) || IsSuper(t.v[1]) || IsSuper(t.v[2])) {
+      continue;
+    }
+    out.push_back({ vertices_.at(t.v[0]).lmk_id, vertices_.at(t.v[1]).lmk_id, vertices_.at(t.v[2]).lmk_id });
+  }
+
+  return out;
+}
+
+
+int Delaunay2D::Locate(const Vector2d& pt) const
+{
+  int t = triangles_.at(hint_).alive ? hint_ : -1;
+  for (size_t i = 0; t < 0 && i < triangles_.size(); ++i) {
+    t = triangles_.at(i).alive ? static_cast<int>(i) : -1;
+  }
+
+  // Walk toward pt, crossing any edge that pt is on the other side of.
+  for (int step = 0; step < kMaxWalkSteps; ++step) {
+    const Triangle& tri = triangles_.at(t);
+
+    int next = -1;
+    for (int i = 0; i < 3 && next < 0; ++i) {
+      const Vector2d& a = vertices_.at(tri.v[(i + 1) % 3]).pt;
+      const Vector2d& b = vertices_.at(tri.v[(i + 2) % 3]).pt;
+      if (Orient(a, b, pt) < 0 && tri.n[i] >= 0) {
+        next = tri.n[i];
+      }
+    }
+
+    if (next < 0) {
+      return t;
+    }
+    t = next;
+  }
+
+  for (size_t i = 0; i < triangles_.size(); ++i) {
+    const Triangle& tri = triangles_.at(i);
+    if (tri.alive &&
+        Orient(vertices_.at(tri.v[0]).pt, vertices_.at(tri.v[1]).pt, pt) >= 0 &&
+        Orient(vertices_.at(tri.v[1]).pt, vertices_.at(tri.v[2]).pt, pt) >= 0 &&
+        Orient(vertices_.at(tri.v[2]).pt, vertices_.at(tri.v[0]).pt, pt) >= 0) {
+      return static_cast<int>(i);
+    }
+  }
+
+  LOG(FATAL) << "Delaunay2D::Locate() could not find a triangle" << std::endl;
+  return -1;
+}
+
+
+bool Delaunay2D::InsertVertex(int vtx, int t)
+{
+  const Vector2d& p = vertices_.at(vtx).pt;
+
+  for (const int u : triangles_.at(t).v) {
+    if ((vertices_.at(u).pt - p).squaredNorm() < kMinVertexDistSq) {
+      return false;
+    }
+  }
+
+  // The cavity is every triangle (connected to t) whose circumcircle contains p.
+  marks_.resize(triangles_.size(), 0);
+  ++mark_;
+
+  std::vector<int>& cavity = cavity_;
+  cavity.assign(1, t);
+  marks_.at(t) = mark_;
+
+  for (size_t k = 0; k < cavity.size(); ++k) {
+    for (const int o : triangles_.at(cavity.at(k)).n) {
+      if (o < 0 || marks_.at(o) == mark_) {
+        continue;
+      }
+      const Triangle& tri = triangles_.at(o);
+      if (InCircle(vertices_.at(tri.v[0]).pt, vertices_.at(tri.v[1]).pt,
+                   vertices_.at(tri.v[2]).pt, p) > 0) {
+        marks_.at(o) = mark_;
+        cavity.emplace_back(o);
+      }
+    }
+  }
+
+  // Edges on the boundary of the cavity (a, b, and the triangle on the other side).
+  std::vector<std::array<int, 3>>& boundary = boundary_;
+  boundary.clear();
+  for (const int c : cavity) {
+    const Triangle& tri = triangles_.at(c);
+    for (int i = 0; i < 3; ++i) {
+      const int o = tri.n[i];
+      if (o < 0 || marks_.at(o) != mark_) {
+        boundary.push_back({ tri.v[(i + 1) % 3], tri.v[(i + 2) % 3], o });
+      }
+    }
+  }
+
+  for (const int c : cavity) {
+    FreeTriangle(c);
+  }
+
+  // Connect p to each boundary edge. Then the triangle for edge (a, b) is next to the triangles
+  // for the edges that end at a and start at b.
+  std::vector<int>& fan = fan_;
+  fan.resize(boundary.size());
+  for (size_t k = 0; k < boundary.size(); ++k) {
+    fan.at(k) = NewTriangle(boundary.at(k)[0], boundary.at(k)[1], vtx);
+    Link(fan.at(k), 2, boundary.at(k)[2]);
+  }
+
+  for (size_t k = 0; k < boundary.size(); ++k) {
+    for (size_t j = 0; j < boundary.size(); ++j) {
+      if (boundary.at(j)[0] == boundary.at(k)[1]) {
+        Link(fan.at(k), 0, fan.at(j));
+      }
+    }
+  }
+
+  vertices_.at(vtx).tri = fan.front();
+  return true;
+}
+
+
+void Delaunay2D::RemoveVertex(int vtx)
+{
+  std::vector<int>& star = star_;
+  GetStar(vtx, star);
+
+  // The polygon around the vertex (counter-clockwise), and the triangle outside of each edge.
+  std::vector<int>& poly = poly_;
+  std::vector<int>& outer = outer_;
+  poly.resize(star.size());
+  outer.resize(star.size());
+  for (size_t k = 0; k < star.size(); ++k) {
+    const Triangle& t = triangles_.at(star.at(k));
+    const int i = std::find(t.v.begin(), t.v.end(), vtx) - t.v.begin();
+    poly.at(k) = t.v[(i + 1) % 3];
+    outer.at(k) = t.n[i];
+  }
+
+  for (const int s : star) {
+    FreeTriangle(s);
+  }
+
+  // Cut off ears whose circumcircle doesn't contain any other vertex of the polygon. There is
+  // always one, since the polygon is star-shaped (from the removed vertex).
+  while (poly.size() > 3) {
+    const size_t n = poly.size();
+    size_t ear = n;
+
+    // NOTE(milo): With roundoff, no ear might be exactly empty, so keep the least bad one too.
+    size_t least_bad = n;
+    double least_bad_incircle = std::numeric_limits<double>::max();
+
+    for (size_t k = 0; k < n && ear == n; ++k) {
+      const Vector2d& a = vertices_.at(poly.at((k + n - 1) % n)).pt;
+      const Vector2d& b = vertices_.at(poly.at(k)).pt;
+      const Vector2d& c = vertices_.at(poly.at((k + 1) % n)).pt;
+      if (Orient(a, b, c) <= 0) {
+        continue;
+      }
+
+      double worst = 0;
+      for (size_t j = 2; j < n - 1; ++j) {
+        worst = std::max(worst, InCircle(a, b, c, vertices_.at(poly.at((k + j) % n)).pt));
+      }
+      if (worst <= 0) {
+        ear = k;
+      } else if (worst < least_bad_incircle) {
+        least_bad_incircle = worst;
+        least_bad = k;
+      }
+    }
+
+    if (ear == n) {
+      ear = least_bad;
+    }
+    CHECK_LT(ear, n) << "Delaunay2D::RemoveVertex() found no ear to cut off" << std::endl;
+
+    const size_t prev = (ear + n - 1) % n;
+    const int t = NewTriangle(poly.at(prev), poly.at(ear), poly.at((ear + 1) % n));
+    Link(t, 0, outer.at(ear));
+    Link(t, 2, outer.at(prev));
+
+    // The new edge from prev to next replaces the two edges of the ear.
+    outer.at(prev) = t;
+    poly.erase(poly.begin() + ear);
+    outer.erase(outer.begin() + ear);
+  }
+
+  const int t = NewTriangle(poly.at(0), poly.at(1), poly.at(2));
+  Link(t, 0, outer.at(1));
+  Link(t, 1, outer.at(2));
+  Link(t, 2, outer.at(0));
+}
+
+
+void Delaunay2D::FlipEdges(std::vector<std::array<int, 3>>& queue)
+{
+  while (!queue.empty()) {
+    const std::array<int, 3> e = queue.back();
+    queue.pop_back();
+
+    // Skip edges that were flipped (or moved to another triangle) since they were queued.
+    const int t = e[0];
+    const int i = triangles_.at(t).alive ? EdgeIndex(triangles_.at(t), e[1], e[2]) : -1;
+    if (i < 0 || triangles_.at(t).n[i] < 0) {
+      continue;
+    }
+
+    const int u = triangles_.at(t).n[i];
+    const int a = triangles_.at(t).v[i];
+    const int b = e[1];
+    const int c = e[2];
+    const int j = EdgeIndex(triangles_.at(u), c, b);
+    const int d = triangles_.at(u).v[j];
+
+    const Vector2d& pa = vertices_.at(a).pt;
+    const Vector2d& pb = vertices_.at(b).pt;
+    const Vector2d& pc = vertices_.at(c).pt;
+    const Vector2d& pd = vertices_.at(d).pt;
+
+    if (InCircle(pa, pb, pc, pd) <= 0 || Orient(pa, pb, pd) <= 0 || Orient(pa, pd, pc) <= 0) {
+      continue;
+    }
+
+    // Replace (a, b, c) and (d, c, b) with (a, b, d) and (a, d, c).
+    const int t_ca = triangles_.at(t).n[(i + 1) % 3];
+    const int t_ab = triangles_.at(t).n[(i + 2) % 3];
+    const int t_bd = triangles_.at(u).n[(j + 1) % 3];
+    const int t_dc = triangles_.at(u).n[(j + 2) % 3];
+
+    Triangle& tt = triangles_.at(t);
+    Triangle& tu = triangles_.at(u);
+    tt.v = {{ a, b, d }};
+    tu.v = {{ a, d, c }};
+    tt.n = {{ -1, u, -1 }};
+    tu.n = {{ -1, -1, t }};
+    Link(t, 0, t_bd);
+    Link(t, 2, t_ab);
+    Link(u, 0, t_dc);
+    Link(u, 1, t_ca);
+
+    vertices_.at(a).tri = t;
+    vertices_.at(b).tri = t;
+    vertices_.at(c).tri = u;
+    vertices_.at(d).tri = t;
+
+    queue.push_back({ t, b, d });
+    queue.push_back({ t, a, b });
+    queue.push_back({ u, d, c });
+    queue.push_back({ u, c, a });
+  }
+}
+
+
+void Delaunay2D::GetStar(int vtx, std::vector<int>& star) const
+{
+  star.clear();
+
+  // NOTE(milo): The vertex is never on the outer boundary, so the triangles around it are a loop.
+  const int first = vertices_.at(vtx).tri;
+  int t = first;
+  do {
+    star.emplace_back(t);
+    const Triangle& tri = triangles_.at(t);
+    const int i = std::find(tri.v.begin(), tri.v.end(), vtx) - tri.v.begin();
+    t = tri.n[(i + 1) % 3];
+  } while (t != first);
+}
+
+
+int Delaunay2D::NewTriangle(int a, int b, int c)
+{
+  int t;
+  if (!free_triangles_.empty()) {
+    t = free_triangles_.back();
+    free_triangles_.pop_back();
+  } else {
+    t = static_cast<int>(triangles_.size());
+    triangles_.emplace_back();
+  }
+
+  Triangle& tri = triangles_.at(t);
+  tri.v = {{ a, b, c }};
+  tri.n = {{ -1, -1, -1 }};
+  tri.alive = true;
+
+  vertices_.at(a).tri = t;
+  vertices_.at(b).tri = t;
+  vertices_.at(c).tri = t;
+
+  hint_ = t;
+  return t;
+}
+
+
+void Delaunay2D::FreeTriangle(int t)
+{
+  triangles_.at(t).alive = false;
+  free_triangles_.emplace_back(t);
+}
+
+
+void Delaunay2D::Link(int t, int i, int o)
+{
+  Triangle& tri = triangles_.at(t);
+  tri.n[i] = o;
+
+  if (o >= 0) {
+    Triangle& other = triangles_.at(o);
+    const int j = EdgeIndex(other, tri.v[(i + 2) % 3], tri.v[(i + 1) % 3]);
+    CHECK_GE(j, 0) << "Delaunay2D::Link() triangles don't share an edge" << std::endl;
+    other.n[j] = t;
+  }
+}
+
+
+}
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+typedef std::array<uid_t, 3> LmkTriangle;
+
+
+// A 2D Delaunay triangulation of landmarks that can be updated in place, so that a mesh can be
+// kept across frames instead of rebuilt. Inserting and removing a vertex only retriangulates the
+// triangles around it, and moving a vertex only flips edges around it (unless it moves past one
+// of its neighbors, and then it's removed and inserted again). Like cv::Subdiv2D, all of the
+// vertices are inside of a large triangle around rect, whose corners aren't part of the output.
+class Delaunay2D final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(Delaunay2D);
+  MACRO_DELETE_COPY_CONSTRUCTORS(Delaunay2D);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(Delaunay2D);
+
+  explicit Delaunay2D(const cv::Rect& rect);
+
+  // Adds a vertex for lmk_id at pt. Returns false (and doesn't add it) if lmk_id is already in the
+  // triangulation, pt is outside of rect, or pt is at the same location as another vertex.
+  bool Insert(uid_t lmk_id, const cv::Point2f& pt);
+
+  // Removes the vertex for lmk_id. Returns false if it isn't in the triangulation.
+  bool Remove(uid_t lmk_id);
+
+  // Moves the vertex for lmk_id to pt. Returns false if it isn't in the triangulation, or if it was
+  // removed because pt couldn't be inserted (see Insert()).
+  bool Move(uid_t lmk_id, const cv::Point2f& pt);
+
+  bool Contains(uid_t lmk_id) const { return lmk_to_vtx_.count(lmk_id) > 0; }
+
+  // Number of (landmark) vertices.
+  size_t Size() const { return lmk_to_vtx_.size(); }
+
+  const cv::Rect& Rect() const { return rect_; }
+
+  // Appends the id of every landmark in the triangulation to lmk_ids.
+  void GetLandmarkIds(std::vector<uid_t>& lmk_ids) const;
+
+  // Returns every triangle between landmarks (counter-clockwise in image coordinates, which is
+  // clockwise on screen).
+  std::vector<LmkTriangle> GetTriangles() const;
+
+ private:
+  // Vertices of a triangle in counter-clockwise order, and the neighbor across the edge opposite
+  // of each one (-1 for the outer edges of the first triangle).
+  struct Triangle final {
+    std::array<int, 3> v;
+    std::array<int, 3> n;
+    bool alive = false;
+  };
+
+  // Slots in vertices_, and the landmark at each one.
+  struct Vertex final {
+    Vector2d pt;
+    uid_t lmk_id = 0;
+    int tri = -1;       // Any triangle that has this vertex.
+    bool alive = false;
+  };
+
+  // Returns the triangle that contains pt.
+  int Locate(const Vector2d& pt) const;
+
+  // Adds a vertex at pt to the triangulation with Bowyer-Watson. Returns false if pt is at the
+  // same location as the vertex in triangle t (which contains pt).
+  bool InsertVertex(int vtx, int t);
+
+  // Removes a vertex by filling in the polygon around it with Delaunay ears.
+  void RemoveVertex(int vtx);
+
+  // Flips edges until every edge in (and after) the queue is locally Delaunay.
+  void FlipEdges(std::vector<std::array<int, 3>>& queue);
+
+  // Returns the counter-clockwise triangles around a vertex.
+  void GetStar(int vtx, std::vector<int>& star) const;
+
+  int NewTriangle(int a, int b, int c);
+  void FreeTriangle(int t);
+
+  // Sets the neighbor of t across edge i to o, and the neighbor of o across the same edge to t.
+  void Link(int t, int i, int o);
+
+  bool IsSuper(int vtx) const { return vtx < 3; }
+
+  cv::Rect rect_;
+
+  std::vector<Vertex> vertices_;
+  std::vector<int> free_vertices_;
+  std::unordered_map<uid_t, int> lmk_to_vtx_;
+
+  std::vector<Triangle> triangles_;
+  std::vector<int> free_triangles_;
+  // Scratch space, so that updates don't allocate. marks_ flags the triangles in cavity_ (the ones
+  // equal to mark_) in InsertVertex().
+  std::vector<int> marks_;
+  int mark_ = 0;
+  std::vector<int> cavity_, fan_, star_, poly_, outer_;
+  std::vector<std::array<int, 3>> boundary_, flip_queue_;
+
+  // The last triangle created, where Locate() starts walking from.
+  int hint_ = 0;
+};
+
+}
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace bm {
+namespace mesher {
+
+// Marks an empty bucket in EdgeMap. Both slots would have to be UINT32_MAX, which Key() never
+// returns.
+static const uint64_t kEmptyEdgeKey = ~0ull;
+
+
+// Maps an undirected edge between two vertex slots to its weight. Uses open addressing with
+// linear probing over flat arrays, so that lookups and inserts don't allocate (except to grow),
+// and erasing shifts the following entries back instead of leaving tombstones.
+class EdgeMap final {
+ public:
+  explicit EdgeMap(size_t capacity = 64) { Reset(capacity); }
+
+  // The key for the edge between slots a and b (in either order).
+  static uint64_t Key(uint32_t a, uint32_t b)
+  {
+    if (a > b) { std::swap(a, b); }
+    return (static_cast<uint64_t>(a) << 32) | b;
+  }
+
+  // Returns the weight of the edge, or nullptr if it isn't in the map.
+  float* Find(uint64_t key)
+  {
+    for (size_t i = Bucket(key); ; i = (i + 1) & mask_) {
+      if (keys_[i] == key) { return &values_[i]; }
+      if (keys_[i] == kEmptyEdgeKey) { return nullptr; }
+    }
+  }
+
+  // Returns the weight of the edge, adding it with weight init if it isn't in the map yet.
+  // NOTE(milo): The pointer is only valid until the next Insert() or Erase().
+  float* Insert(uint64_t key, float init, bool& inserted)
+  {
+    if (2 * (size_ + 1) > keys_.size()) {
+      Grow();
+    }
+
+    size_t i = Bucket(key);
+    for (; keys_[i] != kEmptyEdgeKey; i = (i + 1) & mask_) {
+      if (keys_[i] == key) {
+        inserted = false;
+        return &values_[i];
+      }
+    }
+
+    keys_[i] = key;
+    values_[i] = init;
+    ++size_;
+    inserted = true;
+    return &values_[i];
+  }
+
+  // Removes the edge. Returns false if it wasn't in the map.
+  bool Erase(uint64_t key)
+  {
+    size_t i = Bucket(key);
+    for (; keys_[i] != key; i = (i + 1) & mask_) {
+      if (keys_[i] == kEmptyEdgeKey) { return false; }
+    }
+
+    // Shift back any entries after i that can't be found anymore with i empty.
+    for (size_t j = (i + 1) & mask_; keys_[j] != kEmptyEdgeKey; j = (j + 1) & mask_) {
+      const size_t home = Bucket(keys_[j]);
+      if (((j - home) & mask_) >= ((j - i) & mask_)) {
+        keys_[i] = keys_[j];
+        values_[i] = values_[j];
+        i = j;
+      }
+    }
+
+    keys_[i] = kEmptyEdgeKey;
+    --size_;
+    return true;
+  }
+
+  size_t Size() const { return size_; }
+
+  void Clear()
+  {
+    std::fill(keys_.begin(), keys_.end(), kEmptyEdgeKey);
+    size_ = 0;
+  }
+
+ private:
+  void Reset(size_t capacity)
+  {
+    size_t n = 16;
+    while (n < capacity) { n <<= 1; }
+    keys_.assign(n, kEmptyEdgeKey);
+    values_.assign(n, 0.0f);
+    mask_ = n - 1;
+    size_ = 0;
+  }
+
+  size_t Bucket(uint64_t key) const
+  {
+    // NOTE(milo): The 64-bit finalizer from MurmurHash3, since slot keys are mostly sequential.
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return static_cast<size_t>(key) & mask_;
+  }
+
+  void Grow()
+  {
+    std::vector<uint64_t> keys;
+    std::vector<float> values;
+    keys.swap(keys_);
+    values.swap(values_);
+    Reset(2 * keys.size());
+
+    bool inserted;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (keys[i] != kEmptyEdgeKey) {
+        Insert(keys[i], values[i], inserted);
+      }
+    }
+  }
+
+  std::vector<uint64_t> keys_;
+  std::vector<float> values_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+};
+
+}
+}
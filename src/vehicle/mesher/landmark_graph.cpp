@@ -1,40 +1,76 @@
+#include <algorithm>
+#include <limits>
+
 #include <glog/logging.h>
-#include <boost/graph/connected_components.hpp>
 
 #include "mesher/landmark_graph.hpp"
 
 namespace bm {
 namespace mesher {
 
+// Vertex::comp of a free slot, and of a slot that SplitComponent() hasn't reached yet.
+static const size_t kNoComp = std::numeric_limits<size_t>::max();
+static const size_t kSplitComp = kNoComp - 1;
+
 
-LandmarkGraph::LandmarkGraph() {}
+LandmarkGraph::LandmarkGraph(float subgraph_min_weight)
+    : subgraph_min_weight_(subgraph_min_weight) {}
 
 
 void LandmarkGraph::AddLandmark(uid_t lmk_id)
 {
-  if (lmk_to_vtx_.count(lmk_id) == 0) {
-    const Graph::vertex_descriptor v = boost::add_vertex(VertexIndex(lmk_id), g_);
-    lmk_to_vtx_.emplace(lmk_id, v);
+  if (lmk_to_slot_.count(lmk_id) > 0) {
+    return;
   }
+
+  uint32_t slot;
+  if (!free_slots_.empty()) {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  } else {
+    slot = static_cast<uint32_t>(vertices_.size());
+    vertices_.emplace_back();
+  }
+
+  Vertex& v = vertices_.at(slot);
+  v.lmk_id = lmk_id;
+  v.nbrs.clear();   // NOTE(milo): Keeps its capacity from the last landmark in this slot.
+
+  lmk_to_slot_.emplace(lmk_id, slot);
+  AddComponent(slot);
 }
 
 
 size_t LandmarkGraph::GraphSize() const
 {
-  return boost::num_vertices(g_);
+  return lmk_to_slot_.size();
 }
 
 
-// https://stackoverflow.com/questions/29931231/boost-how-to-remove-all-the-out-edges-for-a-vertex
 void LandmarkGraph::RemoveLandmark(uid_t lmk_id)
 {
-  CHECK_GT(lmk_to_vtx_.count(lmk_id), 0)
-      << "Trying to RemoveLandmark() for lmk_id not in g_" << std::endl;
+  CHECK_GT(lmk_to_slot_.count(lmk_id), 0)
+      << "Trying to RemoveLandmark() for lmk_id not in graph" << std::endl;
+
+  const uint32_t slot = lmk_to_slot_.at(lmk_id);
+  Vertex& v = vertices_.at(slot);
 
-  const Graph::vertex_descriptor v = lmk_to_vtx_.at(lmk_id);
-  boost::clear_vertex(v, g_);   // Clears all edges, but not the vertex.
-  boost::remove_vertex(v, g_);  // Then remove the vertex.
-  lmk_to_vtx_.erase(lmk_id);
+  for (const uint32_t nbr : v.nbrs) {
+    edges_.Erase(EdgeMap::Key(slot, nbr));
+
+    std::vector<uint32_t>& nbr_nbrs = vertices_.at(nbr).nbrs;
+    const auto it = std::find(nbr_nbrs.begin(), nbr_nbrs.end(), slot);
+    *it = nbr_nbrs.back();
+    nbr_nbrs.pop_back();
+  }
+
+  // The rest of its component might not be connected without it.
+  dirty_comps_.insert(v.comp);
+
+  v.nbrs.clear();
+  v.comp = kNoComp;
+  free_slots_.emplace_back(slot);
+  lmk_to_slot_.erase(lmk_id);
 }
 
 
@@ -44,97 +80,185 @@ void LandmarkGraph::UpdateEdge(uid_t lmk1,
                                float clamp_min,
                                float clamp_max)
 {
-  if (lmk_to_vtx_.count(lmk1) == 0) {
-    AddLandmark(lmk1);
+  AddLandmark(lmk1);
+  AddLandmark(lmk2);
+
+  const uint32_t slot1 = lmk_to_slot_.at(lmk1);
+  const uint32_t slot2 = lmk_to_slot_.at(lmk2);
+
+  bool inserted;
+  float* weight = edges_.Insert(EdgeMap::Key(slot1, slot2), 0.0f, inserted);
+
+  const float old_weight = *weight;
+  const float new_weight = std::min(clamp_max, std::max(clamp_min, old_weight + increment));
+  *weight = new_weight;
+
+  if (inserted) {
+    vertices_.at(slot1).nbrs.emplace_back(slot2);
+    vertices_.at(slot2).nbrs.emplace_back(slot1);
   }
-  if (lmk_to_vtx_.count(lmk2) == 0) {
-    AddLandmark(lmk2);
+
+  // Only edges that cross the min weight change the components.
+  const bool was_in_subgraph = !inserted && (old_weight >= subgraph_min_weight_);
+  const bool is_in_subgraph = (new_weight >= subgraph_min_weight_);
+
+  if (is_in_subgraph && !was_in_subgraph) {
+    AddSubgraphEdge(slot1, slot2);
+  } else if (was_in_subgraph && !is_in_subgraph) {
+    // The endpoints might still be connected through another path, which is checked later.
+    dirty_comps_.insert(vertices_.at(slot1).comp);
+  }
+}
+
+
+LmkClusters LandmarkGraph::GetClusters(float subgraph_min_weight)
+{
+  if (subgraph_min_weight != subgraph_min_weight_) {
+    Rebuild(subgraph_min_weight);
   }
 
-  const Graph::vertex_descriptor v1 = lmk_to_vtx_.at(lmk1);
-  const Graph::vertex_descriptor v2 = lmk_to_vtx_.at(lmk2);
+  const std::vector<size_t> dirty(dirty_comps_.begin(), dirty_comps_.end());
+  for (const size_t comp : dirty) {
+    SplitComponent(comp);
+  }
+  dirty_comps_.clear();
 
-  std::pair<Graph::edge_descriptor, bool> edge = boost::edge(v1, v2, g_);
-  const bool edge_exists = edge.second;
+  LmkClusters out;
+  out.reserve(comp_members_.size());
 
-  if (!edge_exists) {
-    edge = boost::add_edge(v1, v2, EdgeWeight(0), g_);
+  for (auto it = comp_members_.begin(); it != comp_members_.end(); ++it) {
+    LmkSet cluster;
+    for (const uint32_t slot : it->second) {
+      const Vertex& v = vertices_.at(slot);
+      if (v.comp == it->first) {
+        cluster.insert(v.lmk_id);
+      }
+    }
+    out.emplace_back(std::move(cluster));
   }
 
-  // Otherwise add the increment to the edge weight.
-  // https://stackoverflow.com/questions/24366642/how-do-i-change-the-edge-weight-in-a-graph-using-the-boost-graph-library/24372985
-  const float weight = boost::get(edge_weight_t(), g_, edge.first);
-  const float new_weight = std::min(clamp_max, std::max(clamp_min, weight + increment));
-  boost::put(edge_weight_t(), g_, edge.first, new_weight);
+  return out;
 }
 
-// https://stackoverflow.com/questions/47909707/find-connected-components-using-boost-graph-library-with-the-vertex-and-edge-ty/47911251#47911251
-LmkClusters LandmarkGraph::GetClusters(float subgraph_min_weight)
+
+LmkSet LandmarkGraph::GetLandmarkIds() const
 {
-  Subgraph subgraph;
-  std::unordered_map<uid_t, Subgraph::vertex_descriptor> lmk_id_to_vtx;
-  std::unordered_map<Subgraph::vertex_descriptor, uid_t> vtx_to_lmk_id;
+  LmkSet out;
+  for (auto it = lmk_to_slot_.begin(); it != lmk_to_slot_.end(); ++it) {
+    out.insert(it->first);
+  }
 
-  const auto edge_bounds = boost::edges(g_);
+  return out;
+}
 
-  VertexIndexMap lmk_id_map;
 
-  for (auto it = edge_bounds.first; it != edge_bounds.second; ++it) {
-    Graph::vertex_descriptor v1 = boost::source(*it, g_);
-    Graph::vertex_descriptor v2 = boost::target(*it, g_);
-    const uid_t lmk1 = boost::get(vertex_index_t(), g_, v1);
-    const uid_t lmk2 = boost::get(vertex_index_t(), g_, v2);
+bool LandmarkGraph::InSubgraph(uint32_t slot1, uint32_t slot2)
+{
+  const float* weight = edges_.Find(EdgeMap::Key(slot1, slot2));
+  return weight != nullptr && *weight >= subgraph_min_weight_;
+}
 
-    std::pair<Graph::edge_descriptor, bool> edge = boost::edge(v1, v2, g_);
-    const float weight = boost::get(edge_weight_t(), g_, edge.first);
 
-    if (weight >= subgraph_min_weight) {
-      if (lmk_id_to_vtx.count(lmk1) == 0) {
-        const Subgraph::vertex_descriptor v = boost::add_vertex(subgraph);
-        lmk_id_to_vtx.emplace(lmk1, v);
-        vtx_to_lmk_id.emplace(v, lmk1);
-      }
-      if (lmk_id_to_vtx.count(lmk2) == 0) {
-        const Subgraph::vertex_descriptor v = boost::add_vertex(subgraph);
-        lmk_id_to_vtx.emplace(lmk2, v);
-        vtx_to_lmk_id.emplace(v, lmk2);
-      }
+void LandmarkGraph::AddSubgraphEdge(uint32_t slot1, uint32_t slot2)
+{
+  size_t comp1 = vertices_.at(slot1).comp;
+  size_t comp2 = vertices_.at(slot2).comp;
+  if (comp1 == comp2) {
+    return;
+  }
 
-      const Subgraph::vertex_descriptor sv1 = lmk_id_to_vtx.at(lmk1);
-      const Subgraph::vertex_descriptor sv2 = lmk_id_to_vtx.at(lmk2);
-      boost::add_edge(sv1, sv2, subgraph);
+  // Merge the smaller component into the larger one, so that each landmark is moved at most
+  // O(log(n)) times.
+  if (comp_members_.at(comp1).size() < comp_members_.at(comp2).size()) {
+    std::swap(comp1, comp2);
+  }
+
+  std::vector<uint32_t>& into = comp_members_.at(comp1);
+  for (const uint32_t slot : comp_members_.at(comp2)) {
+    // NOTE(milo): Stale members of a dirty component are dropped here.
+    Vertex& v = vertices_.at(slot);
+    if (v.comp == comp2) {
+      v.comp = comp1;
+      into.emplace_back(slot);
     }
   }
+  comp_members_.erase(comp2);
+
+  if (dirty_comps_.erase(comp2) > 0) {
+    dirty_comps_.insert(comp1);
+  }
+}
 
-  std::vector<int> cluster_ids(boost::num_vertices(subgraph));
 
-  // TODO(milo): incremental_components() is faster.
-  // NOTE(milo): The compiler errors from Boost Graph are just about impossible to understand!
-  // For some reason, boost::connected_components() will only work if the graph has a vertex index
-  // property. If not, the compiler complains about a reference to void.
-  // Next I realized that running boost::connected_components with a void* vertex_descriptor causes
-  // some weird hidden memory corrupting. Easier to just build a graph here from scratch.
-  const int num_comp = boost::connected_components(subgraph, &cluster_ids[0]);
+void LandmarkGraph::AddComponent(uint32_t slot)
+{
+  const size_t comp = next_comp_++;
+  vertices_.at(slot).comp = comp;
+  comp_members_[comp] = { slot };
+}
 
-  LmkClusters out(num_comp);
 
-  for (uid_t v = 0; v < cluster_ids.size(); ++v) {
-    const uid_t lmk_id = vtx_to_lmk_id.at(v);
-    out.at(cluster_ids.at(v)).insert(lmk_id);
+void LandmarkGraph::SplitComponent(size_t comp)
+{
+  if (comp_members_.count(comp) == 0) {
+    return;
   }
 
-  return out;
+  const std::vector<uint32_t> members = std::move(comp_members_.at(comp));
+  comp_members_.erase(comp);
+
+  // Every slot that's still in comp is marked until a search reaches it.
+  for (const uint32_t slot : members) {
+    Vertex& v = vertices_.at(slot);
+    if (v.comp == comp) {
+      v.comp = kSplitComp;
+    }
+  }
+
+  std::vector<uint32_t> stack;
+  for (const uint32_t seed : members) {
+    if (vertices_.at(seed).comp != kSplitComp) {
+      continue;
+    }
+
+    const size_t new_comp = next_comp_++;
+    std::vector<uint32_t>& new_members = comp_members_[new_comp];
+
+    vertices_.at(seed).comp = new_comp;
+    stack.emplace_back(seed);
+
+    while (!stack.empty()) {
+      const uint32_t slot = stack.back();
+      stack.pop_back();
+      new_members.emplace_back(slot);
+
+      for (const uint32_t nbr : vertices_.at(slot).nbrs) {
+        Vertex& n = vertices_.at(nbr);
+        if (n.comp == kSplitComp && InSubgraph(slot, nbr)) {
+          n.comp = new_comp;
+          stack.emplace_back(nbr);
+        }
+      }
+    }
+  }
 }
 
 
-LmkSet LandmarkGraph::GetLandmarkIds() const
+void LandmarkGraph::Rebuild(float subgraph_min_weight)
 {
-  LmkSet out;
-  for (auto it = lmk_to_vtx_.begin(); it != lmk_to_vtx_.end(); ++it) {
-    out.insert(it->first);
+  subgraph_min_weight_ = subgraph_min_weight;
+  comp_members_.clear();
+  dirty_comps_.clear();
+
+  // Start with every landmark in one component, and then split it up.
+  const size_t comp = next_comp_++;
+  std::vector<uint32_t>& members = comp_members_[comp];
+  for (auto it = lmk_to_slot_.begin(); it != lmk_to_slot_.end(); ++it) {
+    vertices_.at(it->second).comp = comp;
+    members.emplace_back(it->second);
   }
 
-  return out;
+  SplitComponent(comp);
 }
 
 
@@ -1,47 +1,34 @@
 #pragma once
 
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-#include <boost/graph/adjacency_list.hpp>
-
 #include "core/uid.hpp"
+#include "mesher/edge_map.hpp"
 
 namespace bm {
 namespace mesher {
 
 using namespace core;
 
-typedef boost::edge_weight_t edge_weight_t;
-typedef boost::vertex_index_t vertex_index_t;
-typedef boost::vertex_name_t vertex_name_t;
-typedef boost::property<vertex_index_t, uid_t> VertexIndex;
-typedef boost::property<vertex_name_t, uid_t> VertexName;
-typedef boost::property<edge_weight_t, float> EdgeWeight;
-
-// https://cs.brown.edu/~jwicks/boost/libs/graph/doc/adjacency_list.html
-// Calling boost::remove_vertex() invalidates vertex ids! Have to use setS or listS to keep them stable.
-typedef boost::adjacency_list<boost::setS,
-                              boost::setS,
-                              boost::undirectedS,
-                              VertexIndex,
-                              EdgeWeight> Graph;
-
-typedef boost::adjacency_list<boost::vecS,
-                              boost::vecS,
-                              boost::undirectedS,
-                              VertexIndex> Subgraph;
-
-typedef boost::property_map<Graph, vertex_index_t>::type VertexIndexMap;
-typedef boost::property_map<Graph, edge_weight_t>::type EdgeWeightMap;
-
 typedef std::unordered_set<uid_t> LmkSet;
 typedef std::vector<LmkSet> LmkClusters;
 
 
+// Keeps a graph of landmarks with weighted edges, and the connected components of its "subgraph"
+// (the edges with weight >= a min weight). Each landmark lives in a vertex slot, and slots are
+// reused after a landmark is removed (along with their neighbor lists). The edge weights are kept
+// in a flat EdgeMap keyed by the two slots, so updating an edge doesn't allocate.
+//
+// The components are maintained incrementally: an edge that reaches the min weight merges its two
+// components (the smaller one into the larger one), and an edge that drops below it (or a removed
+// landmark) marks its component as dirty. Dirty components are split up again (by a search over
+// only their own landmarks) the next time that GetClusters() is called.
 class LandmarkGraph final {
  public:
-  LandmarkGraph();
+  // The subgraph min weight can be set here, or by the first GetClusters() call.
+  explicit LandmarkGraph(float subgraph_min_weight = 0.0f);
 
   // Add a new landmark to the graph.
   void AddLandmark(uid_t lmk_id);
@@ -57,24 +44,55 @@ class LandmarkGraph final {
                   float clamp_min,
                   float clamp_max);
 
-  // Finds connected components in the landmark graph and returns them.
+  // Returns the connected components of the subgraph (every landmark is in exactly one cluster,
+  // so a landmark without any subgraph edges is its own cluster). If subgraph_min_weight differs
+  // from the current min weight, the components are rebuilt from scratch for the new one.
   LmkClusters GetClusters(float subgraph_min_weight);
 
+  bool HasLandmark(uid_t lmk_id) const { return lmk_to_slot_.count(lmk_id) != 0; }
+
   // Returns a set of ids for all the landmarks current in the graph.
   LmkSet GetLandmarkIds() const;
 
   size_t GraphSize() const;
 
  private:
-  void MaybeAddSubgraphEdge(uid_t lmk1, uid_t lmk2);
-  void MaybeRemoveSubgraphEdge(uid_t lmk1, uid_t lmk2);
+  struct Vertex final {
+    uid_t lmk_id = 0;
+    size_t comp = 0;
+    std::vector<uint32_t> nbrs;   // Slots of all the neighbors in the graph (any edge weight).
+  };
+
+  // Called when the edge between two slots reaches the min weight. Merges their components.
+  void AddSubgraphEdge(uint32_t slot1, uint32_t slot2);
+
+  // Puts a landmark in a new component of its own.
+  void AddComponent(uint32_t slot);
+
+  // Splits a dirty component into its actual connected components.
+  void SplitComponent(size_t comp);
+
+  // Recomputes all of the components for a new min weight.
+  void Rebuild(float subgraph_min_weight);
+
+  // Does the edge between these two neighbors have weight >= the min weight?
+  bool InSubgraph(uint32_t slot1, uint32_t slot2);
 
  private:
-  std::unordered_map<uid_t, Graph::vertex_descriptor> lmk_to_vtx_;
+  std::unordered_map<uid_t, uint32_t> lmk_to_slot_;
+  std::vector<Vertex> vertices_;
+  std::vector<uint32_t> free_slots_;
 
-  Graph g_;
-};
+  EdgeMap edges_;
 
+  float subgraph_min_weight_;
+
+  // The slots in each component. A dirty component can also list slots that were freed (or moved
+  // to another component), which are skipped using Vertex::comp.
+  std::unordered_map<size_t, std::vector<uint32_t>> comp_members_;
+  std::unordered_set<size_t> dirty_comps_;
+  size_t next_comp_ = 0;
+};
 
 }
 }
@@ -0,0 +1,450 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "mesher/local_costmap.hpp"
+
+namespace bm {
+namespace mesher {
+
+
+static const Vector3i kNoObstacle = Vector3i::Constant(INT_MIN);
+
+
+void LocalCostmap::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("voxel_size", &voxel_size);
+  parser.GetParam("size_voxels", &size_voxels);
+  parser.GetParam("max_distance", &max_distance);
+  parser.GetParam("max_ray_length", &max_ray_length);
+  parser.GetParam("hit_evidence", &hit_evidence);
+  parser.GetParam("miss_evidence", &miss_evidence);
+  parser.GetParam("max_evidence", &max_evidence);
+  parser.GetParam("occupied_evidence", &occupied_evidence);
+}
+
+
+// Modulo that's always in [0, b), unlike the % operator.
+static int PositiveMod(int a, int b)
+{
+  const int r = a % b;
+  return (r < 0) ? (r + b) : r;
+}
+
+
+LocalCostmap::LocalCostmap(const Params& params)
+    : params_(params),
+      N_(params.size_voxels),
+      max_distance_(static_cast<float>(params.max_distance)),
+      origin_(Vector3i::Constant(-params.size_voxels / 2))
+{
+  CHECK_GT(params_.voxel_size, 0) << "LocalCostmap needs voxel_size > 0" << std::endl;
+  CHECK_GT(params_.size_voxels, 0) << "LocalCostmap needs size_voxels > 0" << std::endl;
+  CHECK_GT(params_.occupied_evidence, 0);
+  CHECK(params_.max_evidence >= params_.occupied_evidence && params_.max_evidence <= 127)
+      << "LocalCostmap needs occupied_evidence <= max_evidence <= 127" << std::endl;
+
+  const size_t num_voxels = static_cast<size_t>(N_) * N_ * N_;
+  evidence_.assign(num_voxels, 0);
+  distance_.assign(num_voxels, max_distance_);
+  obstacle_.assign(num_voxels, kNoObstacle);
+}
+
+
+LocalCostmap::VoxelIndex LocalCostmap::VoxelOf(const Vector3d& world_p) const
+{
+  const double inv_voxel = 1.0 / params_.voxel_size;
+  return VoxelIndex(static_cast<int>(std::floor(world_p.x() * inv_voxel)),
+                    static_cast<int>(std::floor(world_p.y() * inv_voxel)),
+                    static_cast<int>(std::floor(world_p.z() * inv_voxel)));
+}
+
+
+Vector3d LocalCostmap::CenterOf(const VoxelIndex& v) const
+{
+  return (v.cast<double>() + Vector3d::Constant(0.5)) * params_.voxel_size;
+}
+
+
+bool LocalCostmap::InWindow(const VoxelIndex& v) const
+{
+  return (v.array() >= origin_.array()).all() && (v.array() < (origin_.array() + N_)).all();
+}
+
+
+size_t LocalCostmap::Slot(const VoxelIndex& v) const
+{
+  const size_t x = PositiveMod(v.x(), N_);
+  const size_t y = PositiveMod(v.y(), N_);
+  const size_t z = PositiveMod(v.z(), N_);
+  return x + N_ * (y + N_ * z);
+}
+
+
+bool LocalCostmap::HasValidObstacle(size_t slot) const
+{
+  const VoxelIndex& o = obstacle_[slot];
+  return o != kNoObstacle && InWindow(o) && evidence_[Slot(o)] >= params_.occupied_evidence;
+}
+
+
+void LocalCostmap::Recenter(const Vector3d& world_t_body)
+{
+  const VoxelIndex new_origin = VoxelOf(world_t_body) - Vector3i::Constant(N_ / 2);
+  for (int axis = 0; axis < 3; ++axis) {
+    ShiftAxis(axis, new_origin[axis]);
+  }
+  UpdateDistanceField();
+}
+
+
+void LocalCostmap::ShiftAxis(int axis, int new_origin)
+{
+  const int shift = new_origin - origin_[axis];
+  if (shift == 0) {
+    return;
+  }
+
+  // Moved further than the window is wide, so everything is forgotten.
+  if (std::abs(shift) >= N_) {
+    std::fill(evidence_.begin(), evidence_.end(), 0);
+    std::fill(distance_.begin(), distance_.end(), max_distance_);
+    std::fill(obstacle_.begin(), obstacle_.end(), kNoObstacle);
+    num_occupied_ = 0;
+    raise_.clear();
+    lower_.clear();
+    origin_[axis] = new_origin;
+    return;
+  }
+
+  // The slab [lo, hi) along this axis leaves the window. Its slots are reused for the slab that
+  // comes in on the other side, so they have to be cleared.
+  const int lo = (shift > 0) ? origin_[axis] : (new_origin + N_);
+  const int hi = (shift > 0) ? new_origin : (origin_[axis] + N_);
+  const int a1 = (axis + 1) % 3;
+  const int a2 = (axis + 2) % 3;
+
+  VoxelIndex v;
+  for (int i = lo; i < hi; ++i) {
+    for (int j = origin_[a1]; j < origin_[a1] + N_; ++j) {
+      for (int k = origin_[a2]; k < origin_[a2] + N_; ++k) {
+        v[axis] = i;
+        v[a1] = j;
+        v[a2] = k;
+        ClearVoxel(v);
+      }
+    }
+  }
+
+  origin_[axis] = new_origin;
+
+  // Any voxel whose nearest obstacle just left got it through the layer next to the old slab, so
+  // the raise wave starts there.
+  const int boundary = (shift > 0) ? new_origin : (new_origin + N_ - 1);
+  for (int j = origin_[a1]; j < origin_[a1] + N_; ++j) {
+    for (int k = origin_[a2]; k < origin_[a2] + N_; ++k) {
+      v[axis] = boundary;
+      v[a1] = j;
+      v[a2] = k;
+      const size_t s = Slot(v);
+      if (obstacle_[s] != kNoObstacle && !HasValidObstacle(s)) {
+        distance_[s] = max_distance_;
+        obstacle_[s] = kNoObstacle;
+        raise_.emplace_back(v);
+      }
+    }
+  }
+}
+
+
+void LocalCostmap::ClearVoxel(const VoxelIndex& v)
+{
+  const size_t s = Slot(v);
+  if (evidence_[s] >= params_.occupied_evidence) {
+    --num_occupied_;
+  }
+  evidence_[s] = 0;
+  distance_[s] = max_distance_;
+  obstacle_[s] = kNoObstacle;
+}
+
+
+void LocalCostmap::AddEvidence(const VoxelIndex& v, int evidence)
+{
+  if (!InWindow(v)) {
+    return;
+  }
+
+  const size_t s = Slot(v);
+  const bool was_occupied = evidence_[s] >= params_.occupied_evidence;
+  const int updated = std::max(-params_.max_evidence,
+                               std::min(params_.max_evidence, evidence_[s] + evidence));
+  evidence_[s] = static_cast<int8_t>(updated);
+  const bool is_occupied = evidence_[s] >= params_.occupied_evidence;
+
+  if (is_occupied && !was_occupied) {
+    ++num_occupied_;
+    distance_[s] = 0;
+    obstacle_[s] = v;
+    lower_.emplace_back(v);
+  } else if (was_occupied && !is_occupied) {
+    --num_occupied_;
+    distance_[s] = max_distance_;
+    obstacle_[s] = kNoObstacle;
+    raise_.emplace_back(v);
+  }
+}
+
+
+void LocalCostmap::ClearRay(const Vector3d& world_origin, const Vector3d& world_p)
+{
+  const Vector3d ray = world_p - world_origin;
+  const double length = std::min(ray.norm(), params_.max_ray_length);
+  if (length <= 0) {
+    return;
+  }
+
+  // March in half voxel steps, stopping a voxel short of the hit so that it isn't cleared.
+  const Vector3d dir = ray.normalized();
+  const double step = 0.5 * params_.voxel_size;
+  VoxelIndex prev = kNoObstacle;
+  for (double t = 0; t < (length - params_.voxel_size); t += step) {
+    const VoxelIndex v = VoxelOf(world_origin + t * dir);
+    if (v != prev) {
+      AddEvidence(v, -params_.miss_evidence);
+      prev = v;
+    }
+  }
+}
+
+
+void LocalCostmap::AddHit(const Vector3d& world_p)
+{
+  AddEvidence(VoxelOf(world_p), params_.hit_evidence);
+}
+
+
+void LocalCostmap::IntegrateMesh(const TriangleMesh& mesh, const Matrix4d& world_T_cam)
+{
+  const Matrix3d world_R_cam = world_T_cam.block<3, 3>(0, 0);
+  const Vector3d world_t_cam = world_T_cam.block<3, 1>(0, 3);
+
+  std::vector<Vector3d> world_vertices(mesh.vertices.size());
+  for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+    world_vertices.at(i) = world_R_cam * mesh.vertices.at(i) + world_t_cam;
+  }
+
+  // Clear free space first, so that the hits from this mesh always win.
+  for (const Vector3d& p : world_vertices) {
+    ClearRay(world_t_cam, p);
+  }
+
+  const double step = params_.voxel_size;
+  for (const Vector3i& tri : mesh.triangles) {
+    const Vector3d& a = world_vertices.at(tri(0));
+    const Vector3d& b = world_vertices.at(tri(1));
+    const Vector3d& c = world_vertices.at(tri(2));
+
+    const double closest = std::min((a - world_t_cam).norm(),
+                                    std::min((b - world_t_cam).norm(), (c - world_t_cam).norm()));
+    if (closest > params_.max_ray_length) {
+      continue;
+    }
+
+    // NOTE(milo): Samples are at most one voxel apart (same as SurfelMap), and adding the same
+    // voxel twice just adds more evidence.
+    const double longest = std::max((b - a).norm(), std::max((c - b).norm(), (a - c).norm()));
+    const int n = std::max(1, static_cast<int>(std::ceil(longest / step)));
+    VoxelIndex prev = kNoObstacle;
+    for (int i = 0; i <= n; ++i) {
+      for (int j = 0; j <= n - i; ++j) {
+        const double u = static_cast<double>(i) / n;
+        const double v = static_cast<double>(j) / n;
+        const VoxelIndex voxel = VoxelOf(a + u * (b - a) + v * (c - a));
+        if (voxel != prev) {
+          AddEvidence(voxel, params_.hit_evidence);
+          prev = voxel;
+        }
+      }
+    }
+  }
+
+  UpdateDistanceField();
+}
+
+
+void LocalCostmap::IntegratePoints(const std::vector<Vector3d>& points_cam, const Matrix4d& world_T_cam)
+{
+  const Matrix3d world_R_cam = world_T_cam.block<3, 3>(0, 0);
+  const Vector3d world_t_cam = world_T_cam.block<3, 1>(0, 3);
+
+  std::vector<Vector3d> world_points;
+  world_points.reserve(points_cam.size());
+  for (const Vector3d& p_cam : points_cam) {
+    world_points.emplace_back(world_R_cam * p_cam + world_t_cam);
+  }
+
+  for (const Vector3d& p : world_points) {
+    ClearRay(world_t_cam, p);
+  }
+
+  for (const Vector3d& p : world_points) {
+    if ((p - world_t_cam).norm() <= params_.max_ray_length) {
+      AddHit(p);
+    }
+  }
+
+  UpdateDistanceField();
+}
+
+
+void LocalCostmap::IntegrateDisparity(const DisparityMap& map,
+                                      const StereoCamera& stereo_rig,
+                                      const Matrix4d& world_T_cam,
+                                      int stride)
+{
+  CHECK_GE(map.downsample, 1);
+  CHECK_GE(stride, 1);
+  CHECK(map.disp.size() == map.valid.size());
+
+  const double scale = static_cast<double>(map.downsample);
+
+  // Gather the valid pixels first, so that they can be backprojected in one batch.
+  const Eigen::Index max_points = ((map.disp.rows + stride - 1) / stride) * ((map.disp.cols + stride - 1) / stride);
+  ArrayXd u(max_points), v(max_points), disp(max_points);
+  Eigen::Index n = 0;
+  for (int y = 0; y < map.disp.rows; y += stride) {
+    for (int x = 0; x < map.disp.cols; x += stride) {
+      if (map.valid(y, x) == 0 || map.disp(y, x) <= 0) {
+        continue;
+      }
+      // NOTE(milo): Pixel centers line up the way cv::resize() does it (same as QueryDisparity).
+      u(n) = (x + 0.5) * scale - 0.5;
+      v(n) = (y + 0.5) * scale - 0.5;
+      disp(n) = scale * map.disp(y, x);
+      ++n;
+    }
+  }
+  u.conservativeResize(n);
+  v.conservativeResize(n);
+  disp.conservativeResize(n);
+
+  ArrayXd depth, x_cam, y_cam, z_cam;
+  stereo_rig.DispToDepth(disp, depth);
+  stereo_rig.LeftCamera().Backproject(u, v, depth, x_cam, y_cam, z_cam);
+
+  std::vector<Vector3d> points_cam(static_cast<size_t>(n));
+  for (Eigen::Index i = 0; i < n; ++i) {
+    points_cam.at(i) = Vector3d(x_cam(i), y_cam(i), z_cam(i));
+  }
+
+  IntegratePoints(points_cam, world_T_cam);
+}
+
+
+void LocalCostmap::UpdateDistanceField()
+{
+  // Raise: reset every voxel whose nearest obstacle is gone. Its neighbors that still have an
+  // obstacle will lower it again below.
+  for (size_t i = 0; i < raise_.size(); ++i) {
+    const VoxelIndex v = raise_[i];
+    for (int dz = -1; dz <= 1; ++dz) {
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+          const VoxelIndex n = v + Vector3i(dx, dy, dz);
+          if (!InWindow(n)) {
+            continue;
+          }
+          const size_t s = Slot(n);
+          if (obstacle_[s] == kNoObstacle) {
+            continue;
+          }
+          if (HasValidObstacle(s)) {
+            lower_.emplace_back(n);
+          } else {
+            distance_[s] = max_distance_;
+            obstacle_[s] = kNoObstacle;
+            raise_.emplace_back(n);
+          }
+        }
+      }
+    }
+  }
+  raise_.clear();
+
+  // Lower: spread each obstacle to its neighbors, wherever it's closer than what they have. A voxel
+  // is queued again whenever it gets closer, so this settles on the nearest obstacle.
+  const double voxel_size = params_.voxel_size;
+  for (size_t i = 0; i < lower_.size(); ++i) {
+    const VoxelIndex v = lower_[i];
+    if (!InWindow(v)) {
+      continue;
+    }
+    const size_t sv = Slot(v);
+    if (!HasValidObstacle(sv)) {
+      continue;
+    }
+    const VoxelIndex o = obstacle_[sv];
+
+    for (int dz = -1; dz <= 1; ++dz) {
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+          const VoxelIndex n = v + Vector3i(dx, dy, dz);
+          if (!InWindow(n)) {
+            continue;
+          }
+          const float d = static_cast<float>((n - o).cast<double>().norm() * voxel_size);
+          const size_t s = Slot(n);
+          if (d < distance_[s] && d <= max_distance_) {
+            distance_[s] = d;
+            obstacle_[s] = o;
+            lower_.emplace_back(n);
+          }
+        }
+      }
+    }
+  }
+  lower_.clear();
+}
+
+
+double LocalCostmap::Distance(const Vector3d& world_p) const
+{
+  const VoxelIndex v = VoxelOf(world_p);
+  return InWindow(v) ? distance_[Slot(v)] : params_.max_distance;
+}
+
+
+bool LocalCostmap::IsOccupied(const Vector3d& world_p) const
+{
+  const VoxelIndex v = VoxelOf(world_p);
+  return InWindow(v) && evidence_[Slot(v)] >= params_.occupied_evidence;
+}
+
+
+bool LocalCostmap::IsSegmentFree(const Vector3d& a, const Vector3d& b, double clearance) const
+{
+  const Vector3d ab = b - a;
+  const double length = ab.norm();
+  const Vector3d dir = (length > 0) ? Vector3d(ab / length) : Vector3d::Zero();
+  const double min_step = 0.5 * params_.voxel_size;
+
+  // NOTE(milo): Nothing is closer than Distance(), so it's safe to skip ahead by the distance minus
+  // the clearance (distances are capped at max_distance, which only makes the steps shorter).
+  double t = 0;
+  while (t < length) {
+    const double d = Distance(a + t * dir);
+    if (d < clearance) {
+      return false;
+    }
+    t += std::max(min_step, d - clearance);
+  }
+
+  return Distance(b) >= clearance;
+}
+
+
+}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "mesher/triangle_mesh.hpp"
+#include "vision_core/disparity_map.hpp"
+#include "vision_core/stereo_camera.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+
+// A rolling occupancy grid and Euclidean distance field (ESDF) around the vehicle, for fast
+// collision queries from the planner (or reactive avoidance).
+//
+// The grid is a cube of size_voxels^3 voxels that moves with the vehicle (see Recenter()). Voxels
+// are stored in a ring buffer (indexed by their world voxel coordinates modulo size_voxels), so
+// moving the window only clears the slabs that leave it, and memory never changes.
+//
+// Each voxel keeps some evidence of being occupied: hits (mesh samples, stereo points) add to it,
+// and misses (the rays from the camera to the hits) subtract from it. When a voxel becomes occupied
+// or free, the distance field is updated incrementally (Lau et al., "Efficient grid-based spatial
+// representations for robot navigation in dynamic environments"): each voxel remembers its nearest
+// obstacle, a "raise" wave resets the voxels whose obstacle went away, and a "lower" wave spreads
+// the new obstacles out to max_distance. Distance lookups are then a single array access.
+//
+// NOTE(milo): Voxels that haven't been observed are free. Not threadsafe.
+class LocalCostmap final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double voxel_size = 0.2;          // m
+    int size_voxels = 128;            // Along each side of the window (memory is ~17 bytes/voxel).
+    double max_distance = 2.0;        // Distances are only computed out to here (m).
+    double max_ray_length = 10.0;     // Don't clear free space (or add hits) further than this (m).
+    int hit_evidence = 4;
+    int miss_evidence = 1;
+    int max_evidence = 20;
+    int occupied_evidence = 4;        // Occupied once a voxel has at least this much evidence.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(LocalCostmap);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(LocalCostmap);
+
+  explicit LocalCostmap(const Params& params);
+
+  // Move the window so that it's centered on world_t_body. Anything that leaves it is forgotten.
+  void Recenter(const Vector3d& world_t_body);
+
+  // Adds a mesh (in the camera frame) as hits, and clears the space between the camera and each of
+  // its vertices.
+  void IntegrateMesh(const TriangleMesh& mesh, const Matrix4d& world_T_cam);
+
+  // Same as above, for points in the camera frame (e.g from dense stereo).
+  void IntegratePoints(const std::vector<Vector3d>& points_cam, const Matrix4d& world_T_cam);
+
+  // Backprojects every stride'th valid pixel of a dense disparity map (see DisparityMap), and adds
+  // those points.
+  void IntegrateDisparity(const DisparityMap& map,
+                          const StereoCamera& stereo_rig,
+                          const Matrix4d& world_T_cam,
+                          int stride = 4);
+
+  // Distance from a point (in the world frame) to the nearest occupied voxel, up to max_distance.
+  // Points outside of the window are max_distance away.
+  double Distance(const Vector3d& world_p) const;
+
+  bool IsOccupied(const Vector3d& world_p) const;
+
+  // Is every point on the segment at least "clearance" from the nearest obstacle? Marches along the
+  // segment in steps of (distance - clearance), so free space is crossed quickly.
+  bool IsSegmentFree(const Vector3d& a, const Vector3d& b, double clearance) const;
+
+  bool InWindow(const Vector3d& world_p) const { return InWindow(VoxelOf(world_p)); }
+
+  size_t NumOccupied() const { return num_occupied_; }
+  Vector3d WindowMin() const { return origin_.cast<double>() * params_.voxel_size; }
+  Vector3d WindowMax() const { return (origin_.array() + N_).cast<double>().matrix() * params_.voxel_size; }
+
+  const Params& GetParams() const { return params_; }
+
+ private:
+  typedef Vector3i VoxelIndex;    // World voxel coordinates.
+
+  VoxelIndex VoxelOf(const Vector3d& world_p) const;
+  Vector3d CenterOf(const VoxelIndex& v) const;
+  bool InWindow(const VoxelIndex& v) const;
+  size_t Slot(const VoxelIndex& v) const;
+
+  // Adds evidence to a voxel, and queues a distance field update if it changes state.
+  void AddEvidence(const VoxelIndex& v, int evidence);
+  void ClearRay(const Vector3d& world_origin, const Vector3d& world_p);
+  void AddHit(const Vector3d& world_p);
+
+  // Forget a voxel (e.g because it left the window).
+  void ClearVoxel(const VoxelIndex& v);
+
+  // Shift the window along one axis, clearing the voxels that leave it.
+  void ShiftAxis(int axis, int new_origin);
+
+  bool HasValidObstacle(size_t slot) const;
+  void UpdateDistanceField();
+
+  Params params_;
+  int N_;
+  float max_distance_;
+
+  VoxelIndex origin_;                   // Voxel coordinates of the window's minimum corner.
+  std::vector<int8_t> evidence_;
+  std::vector<float> distance_;
+  std::vector<VoxelIndex> obstacle_;    // Nearest obstacle of each voxel (kNoObstacle if none).
+  size_t num_occupied_ = 0;
+
+  std::vector<VoxelIndex> raise_;       // Voxels that became free.
+  std::vector<VoxelIndex> lower_;       // Voxels that became occupied.
+};
+
+
+}
+}
@@ -15,6 +15,12 @@ void PopulateGrid(const std::vector<Vector2i>& grid_cells, GridLookup<uid_t>& gr
 }
 
 
+void PopulateGrid(const std::vector<Vector2i>& grid_cells, PackedGridLookup<uid_t>& grid)
+{
+  grid.BuildIndices(grid_cells);
+}
+
+
 std::vector<Vector2i> MapToGridCells(const std::vector<cv::Point2f>& keypoints,
                                      int image_rows, int image_cols,
                                      int grid_rows, int grid_cols)
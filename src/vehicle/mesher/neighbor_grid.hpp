@@ -18,6 +18,10 @@ using namespace core;
 void PopulateGrid(const std::vector<Vector2i>& grid_cells, GridLookup<uid_t>& grid);
 
 
+// Same as above, but replaces everything in the grid at once (see PackedGridLookup::Build()).
+void PopulateGrid(const std::vector<Vector2i>& grid_cells, PackedGridLookup<uid_t>& grid);
+
+
 // Returns a list of grid cell coordinates for each point in keypoints.
 std::vector<Vector2i> MapToGridCells(const std::vector<cv::Point2f>& keypoints,
                                      int image_rows, int image_cols,
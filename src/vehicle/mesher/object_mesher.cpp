@@ -1,10 +1,12 @@
+#include <algorithm>
+
 #include <glog/logging.h>
 
 #include <opencv2/imgproc.hpp>
-#include <opencv2/highgui.hpp>
 
 #include "core/math_util.hpp"
 #include "core/timer.hpp"
+#include "core/trace.hpp"
 #include "feature_tracking/visualization_2d.hpp"
 #include "mesher/neighbor_grid.hpp"
 #include "mesher/object_mesher.hpp"
@@ -18,218 +20,392 @@ namespace mesher {
 void ObjectMesher::Params::LoadParams(const YamlParser& parser)
 {
   // Each sub-module has a subtree in the params.yaml.
-  tracker_params = StereoTracker::Params(parser.GetNode("StereoTracker"));
+  parser.GetParam("use_own_tracker", &use_own_tracker);
+  if (use_own_tracker) {
+    tracker_params = StereoTracker::Params(parser.GetNode("StereoTracker"));
+  }
+
+  parser.GetParam("dense", &dense);
+  if (dense) {
+    patchmatch_params = pm::PatchmatchGpu::Params(parser.Subtree("PatchmatchGpu"));
+    dense_params = pm::DepthMeshGpu::Params(parser.Subtree("DepthMeshGpu"));
+  }
 
   parser.GetParam("foreground_ksize", &foreground_ksize);
   parser.GetParam("foreground_min_gradient", &foreground_min_gradient);
+  parser.GetParam("foreground_mask_gpu", &foreground_mask_gpu);
   parser.GetParam("edge_min_foreground_percent", &edge_min_foreground_percent);
   parser.GetParam("edge_max_depth_change", &edge_max_depth_change);
   parser.GetParam("vertex_min_obs", &vertex_min_obs);
   parser.GetParam("min_obs_connect_edge", &min_obs_connect_edge);
   parser.GetParam("min_obs_disconnect_edge", &min_obs_disconnect_edge);
+  parser.GetParam("trigger_min_change", &trigger_min_change);
+  parser.GetParam("trigger_move_px", &trigger_move_px);
+  parser.GetParam("trigger_min_hz", &trigger_min_hz);
 
   YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_cam_left, body_T_cam_right);
 }
 
 
-void EstimateForegroundMask(const Image1b& gray,
-                            Image1b& mask,
-                            int ksize,
-                            double min_grad,
-                            int downsize)
+void DrawDelaunay(DrawList& list,
+                  const std::vector<LmkTriangle>& triangles,
+                  const LmkPoints& lmk_points,
+                  const LmkDisps& lmk_disps,
+                  double min_disp,
+                  double max_disp)
 {
-  CHECK(downsize >= 1 && downsize <= 8) << "Use a downsize argument (int) between 1 and 8" << std::endl;
-  const int scaled_ksize = ksize / downsize;
-  CHECK_GT(scaled_ksize, 1) << "ksize too small for downsize" << std::endl;
-  const int kwidth = 2*scaled_ksize + 1;
-
-  const cv::Mat kernel = cv::getStructuringElement(
-      cv::MORPH_RECT,
-      cv::Size(kwidth, kwidth),
-      cv::Point(scaled_ksize, scaled_ksize));
-
-  // Do image processing at a downsampled size (faster).
-  if (downsize > 1) {
-    Image1b gray_small;
-    cv::resize(gray, gray_small, gray.size() / downsize, 0, 0, cv::INTER_LINEAR);
-    cv::Mat gradient;
-    cv::morphologyEx(gray_small, gradient, cv::MORPH_GRADIENT, kernel, cv::Point(-1, -1), 1);
-    cv::resize(gradient > min_grad, mask, gray.size(), 0, 0, cv::INTER_LINEAR);
-
-  // Do processing at original resolution.
-  } else {
-    cv::Mat gradient;
-    cv::morphologyEx(gray, gradient, cv::MORPH_GRADIENT, kernel, cv::Point(-1, -1), 1);
-    mask = gradient > min_grad;
+  std::vector<cv::Point2f> pt(3);
+  const ColormapLut& lut = GetColormapLut(cv::COLORMAP_PARULA);
+
+  for (const LmkTriangle& t : triangles) {
+    for (size_t j = 0; j < 3; ++j) {
+      pt[j] = lmk_points.at(t[j]);
+    }
+
+    const double disps[3] = {
+      0.5*lmk_disps.at(t[0]) + 0.5*lmk_disps.at(t[1]),
+      0.5*lmk_disps.at(t[1]) + 0.5*lmk_disps.at(t[2]),
+      0.5*lmk_disps.at(t[2]) + 0.5*lmk_disps.at(t[0])
+    };
+
+    cv::Vec3b colors[3];
+    lut.Map(disps, 3, min_disp, max_disp, colors);
+    list.lines.push_back({ pt[0], pt[1], colors[0], false });
+    list.lines.push_back({ pt[1], pt[2], colors[1], false });
+    list.lines.push_back({ pt[2], pt[0], colors[2], false });
   }
 }
 
 
-void DrawDelaunay(int k,
-                  Image3b& img,
-                  cv::Subdiv2D& subdiv,
-                  const CoordinateMap<int>& vertex_lookup,
-                  const CoordinateMap<double>& vertex_disps,
-                  double min_disp = 0.5,
-                  double max_disp = 32.0)
+static void BuildTriangleMesh(TriangleMesh& mesh,
+                              const std::vector<LmkTriangle>& triangles,
+                              const LmkPoints& lmk_points,
+                              const LmkDisps& lmk_disps,
+                              const StereoCamera& stereo_rig,
+                              double scale_factor)
 {
-  std::vector<cv::Vec6f> triangle_list;
-  subdiv.getTriangleList(triangle_list);
-  std::vector<cv::Point> pt(3);
-
-  const cv::Size size = img.size();
-  cv::Rect rect(0,0, size.width, size.height);
-
-  // const double disp_range = max_disp - min_disp;
-
-  for (size_t i = 0; i < triangle_list.size(); ++i) {
-    const cv::Vec6f& t = triangle_list.at(i);
-    pt[0] = cv::Point(t[0], t[1]);
-    pt[1] = cv::Point(t[2], t[3]);
-    pt[2] = cv::Point(t[4], t[5]);
-
-    if (rect.contains(pt[0]) && rect.contains(pt[1]) && rect.contains(pt[2])) {
-      const int v0 = vertex_lookup.At((int)pt[0].x, (int)pt[0].y);
-      const int v1 = vertex_lookup.At((int)pt[1].x, (int)pt[1].y);
-      const int v2 = vertex_lookup.At((int)pt[2].x, (int)pt[2].y);
-
-      const std::vector<double> disps = {
-        0.5*vertex_disps.At(k, v0) + 0.5*vertex_disps.At(k, v1),
-        0.5*vertex_disps.At(k, v1) + 0.5*vertex_disps.At(k, v2),
-        0.5*vertex_disps.At(k, v2) + 0.5*vertex_disps.At(k, v0)
-      };
-
-      const std::vector<cv::Vec3b> colors = ColormapVector(
-          disps, min_disp, max_disp, cv::COLORMAP_PARULA);
-      cv::line(img, pt[0], pt[1], colors.at(0), 1, CV_AA, 0);
-	    cv::line(img, pt[1], pt[2], colors.at(1), 1, CV_AA, 0);
-	    cv::line(img, pt[2], pt[0], colors.at(2), 1, CV_AA, 0);
+  // Triangles share the vertex of each landmark, so that it has one (stable) id in the mesh.
+  std::unordered_map<uid_t, int> lmk_to_vertex;
+
+  for (const LmkTriangle& t : triangles) {
+    Vector3i tri;
+
+    for (size_t j = 0; j < 3; ++j) {
+      const auto it = lmk_to_vertex.find(t[j]);
+      if (it != lmk_to_vertex.end()) {
+        tri(j) = it->second;
+        continue;
+      }
+
+      const cv::Point2f& pt = lmk_points.at(t[j]);
+      const double disp = lmk_disps.at(t[j]);
+
+      // NOTE(milo): Backproject pixels at the ORIGINAL image resolution, which requires us to
+      // scale pixel locations and disparity.
+      const Vector3d vert = stereo_rig.LeftCamera().Backproject(
+        Vector2d(pt.x, pt.y) / scale_factor,
+        stereo_rig.DispToDepth(disp / scale_factor));
+
+      tri(j) = static_cast<int>(mesh.vertices.size());
+      lmk_to_vertex.emplace(t[j], tri(j));
+      mesh.vertices.emplace_back(vert);
+      mesh.vertex_ids.emplace_back(t[j]);
     }
+
+    mesh.triangles.emplace_back(tri);
   }
 }
 
 
-static void BuildTriangleMesh(TriangleMesh& mesh,
-                              int k,
-                              cv::Subdiv2D& subdiv,
-                              const CoordinateMap<int>& vertex_lookup,
-                              const CoordinateMap<double>& vertex_disps,
-                              const StereoCamera& stereo_rig,
-                              double scale_factor)
+// Returns true if at least min_percent of the pixels on the line from a to b are foreground in mask.
+// Stops walking the line as soon as the result is known either way.
+static bool IsForegroundEdge(const cv::Point2f& a,
+                             const cv::Point2f& b,
+                             const Image1b& mask,
+                             float min_percent)
 {
-  const size_t vertices_offset = mesh.vertices.size();
+  cv::LineIterator it(mask, a, b, 8, false);
+  const int length = it.count;
+  const float flength = static_cast<float>(length);
+
+  int foreground = 0;
+  int background = 0;
 
-  std::vector<cv::Vec6f> triangle_list;
-  subdiv.getTriangleList(triangle_list);
+  for (int i = 0; i < length; ++i, ++it) {
+    if (**it > 0) {
+      ++foreground;
+      if (static_cast<float>(foreground) / flength >= min_percent) {
+        return true;
+      }
+    } else {
+      ++background;
+      if (static_cast<float>(length - background) / flength < min_percent) {
+        return false;
+      }
+    }
+  }
 
-  cv::Rect rect(0,0, scale_factor * (double)stereo_rig.Width(), scale_factor * (double)stereo_rig.Height());
+  // NOTE(milo): Only reached for a zero length edge (or min_percent > 1).
+  return !(static_cast<float>(foreground) / flength < min_percent);
+}
 
-  size_t num_triangles_added = 0;
 
-  for (size_t i = 0; i < triangle_list.size(); ++i) {
-    const cv::Vec6f& t = triangle_list.at(i);
+void ObjectMesher::UpdateTriangulations(const LmkClusters& clusters,
+                                        const LmkPoints& lmk_points,
+                                        const LmkDisps& lmk_disps,
+                                        const cv::Rect& rect,
+                                        double scale_factor)
+{
+  // Which triangulation each landmark was in.
+  std::unordered_map<uid_t, size_t> lmk_to_prev;
+  std::vector<uid_t> lmk_ids;
+  for (size_t k = 0; k < triangulations_.size(); ++k) {
+    lmk_ids.clear();
+    triangulations_.at(k)->GetLandmarkIds(lmk_ids);
+    for (const uid_t lmk_id : lmk_ids) {
+      lmk_to_prev.emplace(lmk_id, k);
+    }
+  }
 
-    std::vector<cv::Point> pt(3);
-    pt[0] = cv::Point(t[0], t[1]);
-    pt[1] = cv::Point(t[2], t[3]);
-    pt[2] = cv::Point(t[4], t[5]);
+  std::vector<bool> reused(triangulations_.size(), false);
+  std::vector<int> votes(triangulations_.size());
+  std::vector<Delaunay2D::Ptr> next;
+  std::vector<const LmkSet*> next_clusters;
 
-    if (!rect.contains(pt[0]) || !rect.contains(pt[1]) || !rect.contains(pt[2])) {
+  // Pick a triangulation for each cluster (serially, since clusters compete for them).
+  for (const LmkSet& cluster : clusters) {
+    if (cluster.size() < 3) {
       continue;
     }
 
-    // Add all 3 vertices.
-    for (size_t j = 0; j < 3; ++j) {
-      const int vidx = vertex_lookup.At((int)t[2*j], (int)t[2*j+1]);
-      const double disp = vertex_disps.At(k, vidx);
+    std::fill(votes.begin(), votes.end(), 0);
+    for (const uid_t lmk_id : cluster) {
+      const auto it = lmk_to_prev.find(lmk_id);
+      if (it != lmk_to_prev.end() && !reused.at(it->second)) {
+        ++votes.at(it->second);
+      }
+    }
 
-      // NOTE(milo): Backproject pixels at the ORIGINAL image resolution, which requires us to
-      // scale pixel locations and disparity.
-      const Vector3d vert = stereo_rig.LeftCamera().Backproject(
-        Vector2d(t[2*j], t[2*j+1]) / scale_factor,
-        stereo_rig.DispToDepth(disp / scale_factor));
-      mesh.vertices.emplace_back(vert);
+    const auto best = std::max_element(votes.begin(), votes.end());
+    const size_t k = best - votes.begin();
+
+    if (best != votes.end() && *best > 0 && triangulations_.at(k)->Rect() == rect) {
+      next.emplace_back(triangulations_.at(k));
+      reused.at(k) = true;
+    } else {
+      next.emplace_back(std::make_shared<Delaunay2D>(rect));
+    }
+    next_clusters.emplace_back(&cluster);
+  }
+
+  triangulations_ = std::move(next);
+
+  const int num_clusters = static_cast<int>(triangulations_.size());
+  cluster_triangles_.resize(num_clusters);
+  cluster_meshes_.resize(num_clusters);
+  cluster_ms_triangulate_.assign(num_clusters, 0.0);
+  cluster_ms_build_mesh_.assign(num_clusters, 0.0);
+
+  cv::parallel_for_(cv::Range(0, num_clusters), [&](const cv::Range& range)
+  {
+    std::vector<uid_t> tri_lmk_ids;
+
+    for (int c = range.start; c < range.end; ++c) {
+      Timer timer(true);
+      Delaunay2D& tri = *triangulations_.at(c);
+      const LmkSet& cluster = *next_clusters.at(c);
+
+      // Remove landmarks that left the cluster, or that weren't observed in this frame.
+      tri_lmk_ids.clear();
+      tri.GetLandmarkIds(tri_lmk_ids);
+      for (const uid_t lmk_id : tri_lmk_ids) {
+        if (cluster.count(lmk_id) == 0 || lmk_points.count(lmk_id) == 0) {
+          tri.Remove(lmk_id);
+        }
+      }
+
+      for (const uid_t lmk_id : cluster) {
+        // There may be landmarks in the graph that we didn't observe in the current frame. In this
+        // case, skip them.
+        const auto it = lmk_points.find(lmk_id);
+        if (it == lmk_points.end()) {
+          continue;
+        }
+
+        if (tri.Contains(lmk_id)) {
+          tri.Move(lmk_id, it->second);
+        } else {
+          tri.Insert(lmk_id, it->second);
+        }
+      }
+
+      cluster_triangles_.at(c) = tri.GetTriangles();
+      cluster_ms_triangulate_.at(c) = timer.Tock().milliseconds();
+
+      TriangleMesh& mesh = cluster_meshes_.at(c);
+      mesh.vertices.clear();
+      mesh.triangles.clear();
+      mesh.vertex_ids.clear();
+      BuildTriangleMesh(mesh, cluster_triangles_.at(c), lmk_points, lmk_disps, params_.stereo_rig, scale_factor);
+      cluster_ms_build_mesh_.at(c) = timer.Tock().milliseconds();
     }
+  });
+}
 
-    // Create a new triangle in the mesh.
-    mesh.triangles.emplace_back(Vector3i(
-        vertices_offset + 3*num_triangles_added + 0,
-        vertices_offset + 3*num_triangles_added + 1,
-        vertices_offset + 3*num_triangles_added + 2));
 
-    ++num_triangles_added;
+void ObjectMesher::MergeClusterMeshes(TriangleMesh& mesh) const
+{
+  const size_t num_clusters = cluster_meshes_.size();
+
+  // Exclusive prefix sums, so that each cluster knows where its vertices and triangles go.
+  std::vector<size_t> vertex_offsets(num_clusters + 1, 0);
+  std::vector<size_t> triangle_offsets(num_clusters + 1, 0);
+  for (size_t c = 0; c < num_clusters; ++c) {
+    vertex_offsets.at(c + 1) = vertex_offsets.at(c) + cluster_meshes_.at(c).vertices.size();
+    triangle_offsets.at(c + 1) = triangle_offsets.at(c) + cluster_meshes_.at(c).triangles.size();
   }
+
+  mesh.vertices.resize(vertex_offsets.back());
+  mesh.vertex_ids.resize(vertex_offsets.back());
+  mesh.triangles.resize(triangle_offsets.back());
+
+  cv::parallel_for_(cv::Range(0, static_cast<int>(num_clusters)), [&](const cv::Range& range)
+  {
+    for (int c = range.start; c < range.end; ++c) {
+      const TriangleMesh& cm = cluster_meshes_.at(c);
+      const size_t v0 = vertex_offsets.at(c);
+      const size_t t0 = triangle_offsets.at(c);
+      const Vector3i offset = Vector3i::Constant(static_cast<int>(v0));
+
+      std::copy(cm.vertices.begin(), cm.vertices.end(), mesh.vertices.begin() + v0);
+      std::copy(cm.vertex_ids.begin(), cm.vertex_ids.end(), mesh.vertex_ids.begin() + v0);
+      for (size_t i = 0; i < cm.triangles.size(); ++i) {
+        mesh.triangles.at(t0 + i) = cm.triangles.at(i) + offset;
+      }
+    }
+  });
 }
 
 
-static void CountEdgePixels(const cv::Point2f& a,
-                            const cv::Point2f& b,
-                            const Image1b& mask,
-                            int& edge_sum,
-                            int& edge_length)
+TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair)
 {
-  edge_sum = 0;
+  BM_TRACE_SCOPE("ObjectMesher::ProcessStereo");
 
-  cv::LineIterator it(mask, a, b, 8, false);
-  edge_length = it.count;
+  if (params_.dense) {
+    return ProcessDense(stereo_pair);
+  }
+
+  CHECK(tracker_) << "ProcessStereo() needs use_own_tracker, use ProcessTracks() instead" << std::endl;
+
+  tracker_->TrackAndTriangulate(stereo_pair, false);
 
-  for (int i = 0; i < it.count; ++i, ++it) {
-    const uint8_t v = mask.at<uint8_t>(it.pos());
-    edge_sum += v > 0 ? 1 : 0;
+  if (viz_tap_ && viz_tap_->HasListeners()) {
+    DrawList list;
+    list.window = "Visual Navigation (Feature Tracking)";
+    list.timestamp = stereo_pair.timestamp;
+    tracker_->GetFeatureTracksDrawList(list);
+    viz_tap_->Publish(std::move(list));
   }
+
+  return ProcessTracks(stereo_pair, tracker_->GetLiveTracks(), params_.tracker_params.retrack_frames_k,
+                       &tracker_->ExpiredLandmarks());
 }
 
 
-TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool visualize)
+TriangleMesh ObjectMesher::ProcessDense(const StereoImage1b& stereo_pair)
 {
-  const Image1b& iml = stereo_pair.left_image;
-  const int img_height = iml.rows;
+  BM_TRACE_SCOPE("ObjectMesher::ProcessDense");
+  mesh_updated_ = true;
 
-  const double scale_factor = static_cast<double>(img_height) / static_cast<double>(params_.stereo_rig.Height());
+  const Image1b& iml = stereo_pair.left_image;
 
-  Timer timer(true);
-  tracker_.TrackAndTriangulate(stereo_pair, false);
-  // LOG(INFO) << "TrackAndTriangulate: " << timer.Tock().milliseconds() << std::endl;
+  Image1f disp, dispr;
+  patchmatch_->Match(iml, stereo_pair.right_image, disp, dispr);
 
-  if (visualize) {
-    const Image3b& viz_tracks = tracker_.VisualizeFeatureTracks();
-    cv::imshow("Visual Navigation (Feature Tracking)", viz_tracks);
+  // NOTE(milo): The disparity is at the input resolution, so the camera has to be rescaled to match.
+  if (!depth_mesher_ || depth_mesher_size_ != iml.size()) {
+    const StereoCamera stereo_rig(params_.stereo_rig.LeftCamera().Rescale(iml.rows, iml.cols),
+                                  params_.stereo_rig.Baseline());
+    depth_mesher_.reset(new pm::DepthMeshGpu(params_.dense_params, stereo_rig));
+    depth_mesher_size_ = iml.size();
   }
 
-  Image1b foreground_mask;
-  EstimateForegroundMask(iml, foreground_mask, params_.foreground_ksize, params_.foreground_min_gradient, 4);
+  TriangleMesh mesh;
+  depth_mesher_->Compute(disp, mesh);
+
+  if (viz_tap_ && viz_tap_->HasListeners()) {
+    DrawList list;
+    list.window = "Obstacle Avoidance (Dense Disparity)";
+    list.timestamp = stereo_pair.timestamp;
+    disp.convertTo(list.background, CV_8UC1, 255.0 / params_.patchmatch_params.matcher_params.max_disp);
+    viz_tap_->Publish(std::move(list));
+  }
 
-  if (visualize) cv::imshow("Foreground Mask", foreground_mask);
+  return mesh;
+}
 
-  // Build a keypoint graph.
-  std::vector<uid_t> lmk_ids;
-  std::vector<cv::Point2f> lmk_points_list;
 
-  std::unordered_map<uid_t, cv::Point2f> lmk_points;
-  std::unordered_map<uid_t, double> lmk_disps;
+WarmUpReport ObjectMesher::WarmUp(const cv::Size& size, int num_frames)
+{
+  WarmUpReport report;
+  if (!params_.dense || num_frames <= 0) {
+    return report;
+  }
 
-  const FeatureTracks& live_tracks = tracker_.GetLiveTracks();
+  Image1b noise(size.height, size.width + num_frames + 8);
+  cv::RNG rng(123);
+  rng.fill(noise, cv::RNG::UNIFORM, 0, 255);
 
-  // Delete any dead landmarks from the graph.
-  const LmkSet graph_lmk_ids = graph_.GetLandmarkIds();
-  for (uid_t lmk_id : graph_lmk_ids) {
-    if (live_tracks.count(lmk_id) == 0) {
-      graph_.RemoveLandmark(lmk_id);
-    }
+  Timer timer(true);
+  for (int k = 0; k < num_frames; ++k) {
+    const StereoImage1b stereo_pair(k, k, noise(cv::Rect(k, 0, size.width, size.height)).clone(),
+                                    noise(cv::Rect(k + 8, 0, size.width, size.height)).clone());
+    ProcessDense(stereo_pair);
+    report.Add(k == 0 ? "dense_first" : "dense", timer.Tock().milliseconds());
   }
 
-  for (auto it = live_tracks.begin(); it != live_tracks.end(); ++it) {
-    const uid_t lmk_id = it->first;
-    const LandmarkObservation& lmk_obs = it->second.back();
+  // NOTE(milo): Otherwise the first real frame would start from the noise disparity.
+  patchmatch_->ResetTemporal();
+
+  LOG(INFO) << "ObjectMesher warmed up: " << report.ToString() << std::endl;
+  return report;
+}
+
+
+TriangleMesh ObjectMesher::ProcessTracks(const StereoImage1b& stereo_pair,
+                                         const FeatureTracks& live_tracks,
+                                         int retrack_frames_k,
+                                         const std::vector<uid_t>* expired_lmk_ids)
+{
+  BM_TRACE_SCOPE("ObjectMesher::ProcessTracks");
+
+  const Image1b& iml = stereo_pair.left_image;
+  const int img_height = iml.rows;
+
+  const double scale_factor = static_cast<double>(img_height) / static_cast<double>(params_.stereo_rig.Height());
+
+  stage_times_ = MesherStageTimes();
+  Timer timer(true);
+
+  // The landmarks that can be vertices in this frame.
+  std::vector<uid_t> lmk_ids;
+  std::vector<cv::Point2f> lmk_points_list;
+
+  LmkPoints lmk_points;
+  LmkDisps lmk_disps;
+
+  for (const FeatureTracks::Slot s : live_tracks.LiveSlots()) {
+    const uid_t lmk_id = live_tracks.LandmarkId(s);
+    const LandmarkObservation lmk_obs = live_tracks.Observation(s, 0);
 
     // Skip observations from previous frames.
-    if (lmk_obs.camera_id < (stereo_pair.camera_id - params_.tracker_params.retrack_frames_k)) {
+    if (lmk_obs.camera_id < (stereo_pair.camera_id - retrack_frames_k)) {
       continue;
     }
 
     // Only add vertex if it's been tracked for >= vertex_min_obs frames.
     // The initial detection counts as 1 observation.
-    if ((int)it->second.size() < params_.vertex_min_obs) {
+    if ((int)live_tracks.NumObservations(s) < params_.vertex_min_obs) {
       continue;
     }
 
@@ -239,109 +415,178 @@ TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool
     lmk_ids.emplace_back(lmk_id);
   }
 
+  mesh_updated_ = ShouldMesh(stereo_pair.timestamp, lmk_points);
+  if (!mesh_updated_) {
+    if (expired_lmk_ids) {
+      skipped_expired_lmk_ids_.insert(skipped_expired_lmk_ids_.end(), expired_lmk_ids->begin(), expired_lmk_ids->end());
+    }
+    stage_times_.num_landmarks = graph_.GraphSize();
+    return last_mesh_;
+  }
+  timer.Reset();
+
+  // NOTE(milo): The mask comes from the frame's cache, so anything else that asks for it (with the
+  // same arguments) gets it for free. It's shared, so don't draw on it.
+  const Image1b foreground_mask = stereo_pair.cache->left.ForegroundMask(
+      iml, params_.foreground_ksize, params_.foreground_min_gradient, 4, params_.foreground_mask_gpu);
+
+  stage_times_.ms_foreground = timer.Tock().milliseconds();
+
+  const bool visualize = viz_tap_ && viz_tap_->HasListeners();
+
+  if (visualize) {
+    DrawList list;
+    list.window = "Foreground Mask";
+    list.timestamp = stereo_pair.timestamp;
+    list.background = foreground_mask;
+    viz_tap_->Publish(std::move(list));
+    timer.Reset();
+  }
+
+  // Delete any dead landmarks from the graph (including the ones from frames that weren't meshed).
+  if (expired_lmk_ids) {
+    for (const std::vector<uid_t>* expired : { &skipped_expired_lmk_ids_, expired_lmk_ids }) {
+      for (const uid_t lmk_id : *expired) {
+        if (graph_.HasLandmark(lmk_id)) {
+          graph_.RemoveLandmark(lmk_id);
+        }
+      }
+    }
+    skipped_expired_lmk_ids_.clear();
+  } else {
+    const LmkSet graph_lmk_ids = graph_.GetLandmarkIds();
+    for (uid_t lmk_id : graph_lmk_ids) {
+      if (!live_tracks.Contains(lmk_id)) {
+        graph_.RemoveLandmark(lmk_id);
+      }
+    }
+  }
+
   // Map all of the features into the coarse grid so that we can find NNs.
-  lmk_grid_.Clear();
   const std::vector<Vector2i> lmk_cells = MapToGridCells(
       lmk_points_list,
       iml.rows, iml.cols,
       lmk_grid_.Rows(), lmk_grid_.Cols());
 
-  timer.Reset();
   PopulateGrid(lmk_cells, lmk_grid_);
 
+  // Depth of each landmark (at the original image resolution), by its index in lmk_ids.
+  std::vector<double> lmk_depths(lmk_ids.size());
+  for (size_t i = 0; i < lmk_ids.size(); ++i) {
+    lmk_depths.at(i) = params_.stereo_rig.DispToDepth(lmk_disps.at(lmk_ids.at(i)) / scale_factor);
+  }
+
+  // If we keep observing an edge, its observations will saturate at max_weight.
+  // If an edge is observed min_obs_connect_edge times in a row, then it's added to the subgraph.
+  // Then, if we don't observe for min_obs_disconnect_edge, the edge is deleted from the subgraph.
+  const float min_weight = 0.0f;
+  const float max_weight = params_.min_obs_connect_edge + params_.min_obs_disconnect_edge;
+
+  std::vector<uid_t> roi_indices;
   for (size_t i = 0; i < lmk_ids.size(); ++i) {
     const uid_t lmk_i = lmk_ids.at(i);
     const Vector2i lmk_cell = lmk_cells.at(i);
     const core::Box2i roi(lmk_cell - Vector2i(1, 1), lmk_cell + Vector2i(1, 1));
-    const std::list<uid_t>& roi_indices = lmk_grid_.GetRoi(roi);
+    lmk_grid_.GetRoi(roi, roi_indices);
 
     // Add a graph edge to all other landmarks nearby.
     for (uid_t j : roi_indices) {
-      if (i == j) { continue; }
-
-      bool add_edge_ij = true;
+      // NOTE(milo): The roi is symmetric (i is in the roi of j), so each pair is only tested once,
+      // and the result is applied in both directions.
+      if (j <= i) { continue; }
 
       const uid_t lmk_j = lmk_ids.at(j);
 
-      // Only add edge if the vertices are within some 3D distance from each other.
-      const double depth_i = params_.stereo_rig.DispToDepth(lmk_disps.at(lmk_i) / scale_factor);
-      const double depth_j = params_.stereo_rig.DispToDepth(lmk_disps.at(lmk_j) / scale_factor);
-      if (std::fabs(depth_i - depth_j) > params_.edge_max_depth_change) {
-        add_edge_ij = false;
-      }
+      // Only add edge if the vertices are within some 3D distance from each other, and if it has
+      // texture (an object) underneath it. The depth check is cheaper, so it goes first.
+      const bool add_edge_ij =
+          std::fabs(lmk_depths.at(i) - lmk_depths.at(j)) <= params_.edge_max_depth_change &&
+          IsForegroundEdge(lmk_points_list.at(i), lmk_points_list.at(j), foreground_mask,
+                           params_.edge_min_foreground_percent);
 
-      // Only add an edge to the graph if it has texture (an object) underneath it.
-      int edge_length = 0;
-      int edge_sum = 0;
-      CountEdgePixels(lmk_points.at(lmk_i), lmk_points.at(lmk_j), foreground_mask, edge_sum, edge_length);
-      const float fgd_percent = static_cast<float>(edge_sum) / static_cast<float>(edge_length);
-      if (fgd_percent < params_.edge_min_foreground_percent) {
-        add_edge_ij = false;
-      }
-      // If we keep observing an edge, its observations will saturate at max_weight.
-      // If an edge is observed min_obs_connect_edge times in a row, then it's added to the subgraph.
-      // Then, if we don't observe for min_obs_disconnect_edge, the edge is deleted from the subgraph.
-      const float min_weight = 0.0f;
-      const float max_weight = params_.min_obs_connect_edge + params_.min_obs_disconnect_edge;
-      const float min_subgraph_weight = params_.min_obs_connect_edge;
-      graph_.UpdateEdge(lmk_i, lmk_j, add_edge_ij ? 1.0f : -1.0f, min_weight, max_weight);
+      const float increment = add_edge_ij ? 1.0f : -1.0f;
+      graph_.UpdateEdge(lmk_i, lmk_j, increment, min_weight, max_weight);
+      graph_.UpdateEdge(lmk_j, lmk_i, increment, min_weight, max_weight);
     }
   }
 
+  stage_times_.ms_graph = timer.Tock().milliseconds();
+  stage_times_.num_landmarks = graph_.GraphSize();
+
   TriangleMesh mesh;
 
   if (graph_.GraphSize() > 0) {
     const LmkClusters clusters = graph_.GetClusters(params_.min_obs_connect_edge);
+    stage_times_.ms_clusters = timer.Tock().milliseconds();
 
-    std::vector<cv::Subdiv2D> subdivs;
+    UpdateTriangulations(clusters, lmk_points, lmk_disps, cv::Rect(0, 0, iml.cols, iml.rows), scale_factor);
+    timer.Reset();
+    MergeClusterMeshes(mesh);
+    stage_times_.ms_merge = timer.Tock().milliseconds();
 
-    CoordinateMap<uid_t> vertex_id_to_lmk_id;
-    CoordinateMap<double> vertex_disps;
-    MultiCoordinateMap vertex_lookup;
+    for (size_t c = 0; c < cluster_meshes_.size(); ++c) {
+      stage_times_.ms_triangulate += cluster_ms_triangulate_.at(c);
+      stage_times_.ms_build_mesh += cluster_ms_build_mesh_.at(c);
+    }
+    stage_times_.num_clusters = cluster_meshes_.size();
+    stage_times_.num_triangles = mesh.triangles.size();
 
-    size_t c = 0;
-    for (const LmkSet& cluster : clusters) {
-      if (cluster.size() < 3) {
-        continue;
+    // Draw the output triangles.
+    if (visualize) {
+      DrawList viz_triangles;
+      for (const std::vector<LmkTriangle>& triangles : cluster_triangles_) {
+        DrawDelaunay(viz_triangles, triangles, lmk_points, lmk_disps);
       }
+      viz_triangles.window = "Obstacle Avoidance (Object Meshing)";
+      viz_triangles.timestamp = stereo_pair.timestamp;
+      viz_triangles.background = iml;
+      viz_tap_->Publish(std::move(viz_triangles));
+    }
+  } else {
+    triangulations_.clear();
+    cluster_triangles_.clear();
+    cluster_meshes_.clear();
+  }
 
-      subdivs.emplace_back(cv::Rect(0, 0, iml.cols, iml.rows));
-
-      for (const uid_t lmk_id : cluster) {
-        // There may be landmarks in the graph that we didn't observe in the current frame. In this
-        // case, skip them.
-        if (lmk_points.count(lmk_id) == 0) {
-          continue;
-        }
-
-        const cv::Point2f lmk_pt = lmk_points.at(lmk_id);
-        const int vertex_id = subdivs.back().insert(lmk_pt);
-        vertex_lookup[(int)c].Insert((int)lmk_pt.x, (int)lmk_pt.y, vertex_id);
-        vertex_id_to_lmk_id.Insert(c, vertex_id, lmk_id);
-        vertex_disps.Insert(c, vertex_id, lmk_disps.at(lmk_id));
-      }
+  has_mesh_ = true;
+  last_mesh_timestamp_ = stereo_pair.timestamp;
+  meshed_points_ = std::move(lmk_points);
+  last_mesh_ = mesh;
 
-      ++c;
-    }
+  return mesh;
+}
 
-    // Draw the output triangles.
-    cv::Mat3b viz_triangles;
 
-    if (visualize) cv::cvtColor(iml, viz_triangles, cv::COLOR_GRAY2BGR);
+bool ObjectMesher::ShouldMesh(timestamp_t timestamp, const LmkPoints& lmk_points) const
+{
+  if (params_.trigger_min_change <= 0 || !has_mesh_) {
+    return true;
+  }
+  if (params_.trigger_min_hz > 0 &&
+      ConvertToSeconds(timestamp - last_mesh_timestamp_) >= (1.0 / params_.trigger_min_hz)) {
+    return true;
+  }
 
-    for (size_t k = 0; k < subdivs.size(); ++k) {
-      if (visualize) DrawDelaunay(k, viz_triangles, subdivs.at(k), vertex_lookup.at(k), vertex_disps);
-      BuildTriangleMesh(mesh, k, subdivs.at(k), vertex_lookup.at(k), vertex_disps, params_.stereo_rig, scale_factor);
+  // Landmarks that were added or moved since the last mesh, and then the ones that were removed.
+  const double move_sq = params_.trigger_move_px * params_.trigger_move_px;
+  size_t num_changed = 0;
+  size_t num_kept = 0;
+  for (const auto& it : lmk_points) {
+    const auto prev = meshed_points_.find(it.first);
+    if (prev == meshed_points_.end()) {
+      ++num_changed;
+      continue;
     }
-
-    if (visualize) {
-      cv::imshow("Obstacle Avoidance (Object Meshing)", viz_triangles);
+    ++num_kept;
+    const cv::Point2f d = it.second - prev->second;
+    if ((d.x * d.x + d.y * d.y) > move_sq) {
+      ++num_changed;
     }
   }
+  num_changed += meshed_points_.size() - num_kept;
 
-  if (visualize) cv::waitKey(1);
-
-  return mesh;
+  const size_t num_total = std::max(lmk_points.size(), meshed_points_.size());
+  return num_changed > 0 && static_cast<double>(num_changed) >= params_.trigger_min_change * num_total;
 }
 
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <unordered_map>
 
 #include <opencv2/imgproc.hpp>
@@ -12,10 +13,15 @@
 #include "vision_core/stereo_camera.hpp"
 #include "core/sliding_buffer.hpp"
 #include "core/grid_lookup.hpp"
+#include "core/warm_up.hpp"
 #include "vision_core/landmark_observation.hpp"
+#include "vision_core/viz_tap.hpp"
 #include "feature_tracking/stereo_tracker.hpp"
+#include "mesher/delaunay.hpp"
 #include "mesher/triangle_mesh.hpp"
 #include "mesher/landmark_graph.hpp"
+#include "patchmatch_gpu/depth_mesh_gpu.h"
+#include "patchmatch_gpu/patchmatch_gpu.h"
 
 namespace bm {
 namespace mesher {
@@ -24,39 +30,8 @@ using namespace core;
 using namespace ft;
 
 
-template <typename Data>
-class CoordinateMap final {
- public:
-  typedef std::unordered_map<int, std::unordered_map<int, Data>> MapType;
-
-  void Insert(int x, int y, const Data& data)
-  {
-    if (map_.count(x) == 0) {
-      map_.emplace(x, std::unordered_map<int, Data>());
-    }
-    map_.at(x).emplace(y, data);
-  }
-
-  void Insert(const Vector2i coord, const Data& data)
-  {
-    Insert(coord.x, coord.y, data);
-  }
-
-  Data At(int x, int y) const
-  {
-    return map_.at(x).at(y);
-  }
-
-  Data At(const Vector2i& coord) const
-  {
-    return At(coord.x, coord.y);
-  }
-
- private:
-  MapType map_;
-};
-
-typedef std::unordered_map<int, CoordinateMap<int>> MultiCoordinateMap;
+typedef std::unordered_map<uid_t, cv::Point2f> LmkPoints;
+typedef std::unordered_map<uid_t, double> LmkDisps;
 
 
 // Persist any data about tracked vertices here.
@@ -71,15 +46,32 @@ struct VertexData final
 };
 
 
-// Returns a binary mask where "1" indicates foreground and "0" indicates background.
-void EstimateForegroundMask(const Image1b& gray,
-                            Image1b& mask,
-                            int ksize = 7,
-                            double min_grad = 35.0,
-                            int downsize = 2);
+// Adds the edges of all triangles in a triangulation to a DrawList, colored by the disparity along
+// each edge.
+void DrawDelaunay(DrawList& list,
+                  const std::vector<LmkTriangle>& triangles,
+                  const LmkPoints& lmk_points,
+                  const LmkDisps& lmk_disps,
+                  double min_disp = 0.5,
+                  double max_disp = 32.0);
 
-// Draw all triangles in the subdivision.
-void DrawDelaunay(Image3b& img, cv::Subdiv2D& subdiv, cv::Scalar color);
+
+// Time spent in each stage of the last ObjectMesher::ProcessTracks() (ms), and the size of its
+// output. The triangulate and build_mesh stages run in parallel over clusters, so their times are
+// summed over clusters (i.e CPU time, which can be more than the wall time of the frame).
+struct MesherStageTimes final
+{
+  double ms_foreground = 0;   // Foreground mask.
+  double ms_graph = 0;        // Removing dead landmarks, the grid, and the edge updates.
+  double ms_clusters = 0;     // LandmarkGraph::GetClusters().
+  double ms_triangulate = 0;  // Delaunay2D updates and GetTriangles().
+  double ms_build_mesh = 0;   // BuildTriangleMesh() for each cluster.
+  double ms_merge = 0;        // MergeClusterMeshes().
+
+  size_t num_landmarks = 0;   // In the graph.
+  size_t num_clusters = 0;    // Of 3+ landmarks, that were triangulated.
+  size_t num_triangles = 0;
+};
 
 
 class ObjectMesher final {
@@ -89,10 +81,20 @@ class ObjectMesher final {
   {
     MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
 
+    // If false, the mesher doesn't track features itself, and ProcessTracks() has to be called with
+    // the tracks from another StereoTracker (e.g the one in the VIO frontend).
+    bool use_own_tracker = true;
     StereoTracker::Params tracker_params;
 
+    // If true, ProcessStereo() meshes the dense disparity from PatchmatchGpu with DepthMeshGpu,
+    // instead of the tracked landmarks (the landmark params below are unused).
+    bool dense = false;
+    pm::PatchmatchGpu::Params patchmatch_params;
+    pm::DepthMeshGpu::Params dense_params;
+
     int foreground_ksize = 12;
     float foreground_min_gradient = 25.0;
+    bool foreground_mask_gpu = false;   // Compute the foreground mask with the CUDA filters.
 
     int lmk_grid_rows = 16;
     int lmk_grid_cols = 20;
@@ -103,6 +105,14 @@ class ObjectMesher final {
     float min_obs_disconnect_edge = 3.0;
     int vertex_min_obs = 1;
 
+    // Tracking runs on every frame, but the rest of meshing (the foreground mask, graph and
+    // triangulations) only runs once trigger_min_change of the landmarks have been added, removed or
+    // moved more than trigger_move_px since the last mesh, or at trigger_min_hz otherwise. So edges
+    // are observed once per mesh, not once per frame. 0 meshes every frame. Not used in dense mode.
+    double trigger_min_change = 0;
+    double trigger_move_px = 2.0;
+    double trigger_min_hz = 1.0;
+
     StereoCamera stereo_rig;
     Matrix4d body_T_cam_left = Matrix4d::Identity();
     Matrix4d body_T_cam_right = Matrix4d::Identity();
@@ -115,20 +125,112 @@ class ObjectMesher final {
 
   ObjectMesher(const Params& params)
       : params_(params),
-        tracker_(params.tracker_params, params.stereo_rig),
-        lmk_grid_(params_.lmk_grid_rows, params_.lmk_grid_cols) {}
+        lmk_grid_(params_.lmk_grid_rows, params_.lmk_grid_cols),
+        graph_(params_.min_obs_connect_edge)
+  {
+    if (params_.dense) {
+      patchmatch_.reset(new pm::PatchmatchGpu(params_.patchmatch_params));
+    } else if (params_.use_own_tracker) {
+      tracker_.reset(new StereoTracker(params_.tracker_params, params_.stereo_rig));
+    }
+  }
 
-  TriangleMesh ProcessStereo(const StereoImage1b& stereo_pair, bool visualize = true);
+  // Tracks features in a stereo pair, and then builds a mesh from them (see ProcessTracks()). Needs
+  // Params::use_own_tracker. In dense mode, meshes the disparity map instead (see ProcessDense()).
+  TriangleMesh ProcessStereo(const StereoImage1b& stereo_pair);
+
+  // Builds a mesh from the live tracks of a StereoTracker that just processed stereo_pair, which
+  // lets the mesher share tracks instead of re-tracking the same images. Observations from more
+  // than retrack_frames_k frames ago are skipped (should match the tracker's param). If the caller
+  // passes the tracker's ExpiredLandmarks() for EVERY frame, only those are removed from the graph.
+  // Otherwise, the graph is diffed against live_tracks to find the dead landmarks.
+  TriangleMesh ProcessTracks(const StereoImage1b& stereo_pair,
+                             const FeatureTracks& live_tracks,
+                             int retrack_frames_k,
+                             const std::vector<uid_t>* expired_lmk_ids = nullptr);
+
+  // In dense mode, runs num_frames noise images of this size through the GPU matcher and depth
+  // mesher, so that the CUDA context, kernels and buffers (including the zero copy pool) are ready
+  // before the first real frame. Temporal state is reset afterwards. Does nothing otherwise.
+  WarmUpReport WarmUp(const cv::Size& size, int num_frames);
+
+  // Publish the feature tracks, foreground mask and triangles to a tap (see VizTap). Nothing is
+  // drawn unless the tap has a listener, and the mesher never waits on it.
+  void SetVizTap(const VizTap::Ptr& tap) { viz_tap_ = tap; }
+
+  // Stage times of the last call to ProcessTracks() (and ProcessStereo(), if not dense).
+  const MesherStageTimes& LastStageTimes() const { return stage_times_; }
+
+  // False if the last ProcessStereo() or ProcessTracks() didn't trigger meshing (and just returned the
+  // last mesh again), so callers can skip publishing it.
+  bool LastMeshUpdated() const { return mesh_updated_; }
+
+  // In dense mode, change the number of Patchmatch iterations from the next frame on (see
+  // PatchmatchGpu::SetIters). Call this between calls to ProcessStereo(). Does nothing otherwise.
+  void SetPatchmatchIters(int patchmatch_iters)
+  {
+    if (patchmatch_) {
+      patchmatch_->SetIters(patchmatch_iters);
+    }
+  }
 
  private:
+  // Runs PatchmatchGpu on the stereo pair, and meshes its left disparity on the GPU. There's no
+  // landmark graph, so every frame is meshed from scratch and the mesh has no vertex_ids.
+  TriangleMesh ProcessDense(const StereoImage1b& stereo_pair);
+
+  // Updates the triangulations from the last frame to match the clusters (of 3+ landmarks) in this
+  // frame. Each cluster reuses the triangulation that has the most of its landmarks, so that only
+  // landmarks that were added, removed or moved are updated. Then, each cluster is triangulated
+  // and meshed in parallel into cluster_triangles_ and cluster_meshes_ (clusters don't share any
+  // landmarks, so they're independent).
+  void UpdateTriangulations(const LmkClusters& clusters,
+                            const LmkPoints& lmk_points,
+                            const LmkDisps& lmk_disps,
+                            const cv::Rect& rect,
+                            double scale_factor);
+
+  // Concatenates cluster_meshes_ into one mesh (in parallel, at offsets from a prefix sum).
+  void MergeClusterMeshes(TriangleMesh& mesh) const;
+
+  // Whether the landmarks changed enough since the last mesh to mesh again (see trigger_min_change).
+  bool ShouldMesh(timestamp_t timestamp, const LmkPoints& lmk_points) const;
+
   Params params_;
-  StereoTracker tracker_;
-  GridLookup<uid_t> lmk_grid_;
+  std::unique_ptr<StereoTracker> tracker_;   // Only if Params::use_own_tracker.
+
+  // Only if Params::dense. The depth mesher is made for the first image size that it sees.
+  std::unique_ptr<pm::PatchmatchGpu> patchmatch_;
+  std::unique_ptr<pm::DepthMeshGpu> depth_mesher_;
+  cv::Size depth_mesher_size_;
+  VizTap::Ptr viz_tap_;
+  PackedGridLookup<uid_t> lmk_grid_;
 
   // Maps each landmark id to some data about it.
   std::unordered_map<uid_t, VertexData> vertex_data_;
 
   LandmarkGraph graph_;
+
+  // One triangulation per cluster, kept across frames.
+  std::vector<Delaunay2D::Ptr> triangulations_;
+
+  // The triangles and mesh of each triangulation in this frame (reused to avoid allocating).
+  std::vector<std::vector<LmkTriangle>> cluster_triangles_;
+  std::vector<TriangleMesh> cluster_meshes_;
+
+  // Per-cluster times from UpdateTriangulations() (ms), summed into stage_times_.
+  std::vector<double> cluster_ms_triangulate_;
+  std::vector<double> cluster_ms_build_mesh_;
+  MesherStageTimes stage_times_;
+
+  // The last mesh, and where its landmarks were, for frames that don't trigger meshing. Landmarks
+  // that expire in those frames are removed from the graph on the next mesh.
+  bool mesh_updated_ = false;
+  bool has_mesh_ = false;
+  timestamp_t last_mesh_timestamp_ = 0;
+  TriangleMesh last_mesh_;
+  LmkPoints meshed_points_;
+  std::vector<uid_t> skipped_expired_lmk_ids_;
 };
 
 
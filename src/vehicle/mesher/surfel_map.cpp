@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "mesher/surfel_map.hpp"
+
+namespace bm {
+namespace mesher {
+
+
+void SurfelMap::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("voxel_size", &voxel_size);
+  parser.GetParam("block_voxels", &block_voxels);
+  parser.GetParam("max_blocks", &max_blocks);
+  parser.GetParam("max_block_age_sec", &max_block_age_sec);
+  parser.GetParam("max_block_distance", &max_block_distance);
+  parser.GetParam("max_weight", &max_weight);
+  parser.GetParam("max_samples_per_edge", &max_samples_per_edge);
+}
+
+
+// Rounds toward negative infinity (unlike integer division).
+static int FloorDiv(int a, int b)
+{
+  return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+}
+
+
+SurfelMap::SurfelMap(const Params& params) : params_(params)
+{
+  CHECK_GT(params_.voxel_size, 0) << "SurfelMap needs voxel_size > 0" << std::endl;
+  CHECK_GT(params_.block_voxels, 0) << "SurfelMap needs block_voxels > 0" << std::endl;
+}
+
+
+void SurfelMap::Integrate(timestamp_t t, const TriangleMesh& mesh, const Matrix4d& world_T_cam)
+{
+  const Matrix3d world_R_cam = world_T_cam.block<3, 3>(0, 0);
+  const Vector3d world_t_cam = world_T_cam.block<3, 1>(0, 3);
+
+  const double step = params_.voxel_size;
+
+  for (const Vector3i& tri : mesh.triangles) {
+    const Vector3d a = world_R_cam * mesh.vertices.at(tri.x()) + world_t_cam;
+    const Vector3d b = world_R_cam * mesh.vertices.at(tri.y()) + world_t_cam;
+    const Vector3d c = world_R_cam * mesh.vertices.at(tri.z()) + world_t_cam;
+
+    Vector3d normal = (b - a).cross(c - a);
+    const double area2 = normal.norm();
+    if (area2 < 1e-12) {
+      continue;
+    }
+    normal /= area2;
+
+    // Make the normals face the camera, so that samples from either winding average together.
+    if (normal.dot(world_t_cam - a) < 0) {
+      normal = -normal;
+    }
+
+    // Sample on a barycentric grid, so that samples are at most one voxel apart along each edge.
+    const double longest = std::max((b - a).norm(), std::max((c - b).norm(), (a - c).norm()));
+    const int n = std::max(1, std::min(params_.max_samples_per_edge,
+                                       static_cast<int>(std::ceil(longest / step))));
+
+    for (int i = 0; i <= n; ++i) {
+      for (int j = 0; j <= n - i; ++j) {
+        const double u = static_cast<double>(i) / n;
+        const double v = static_cast<double>(j) / n;
+        const Vector3d p = a + u * (b - a) + v * (c - a);
+        IntegrateSample(t, p.cast<float>(), normal.cast<float>());
+      }
+    }
+  }
+
+  Evict(t, world_t_cam);
+}
+
+
+void SurfelMap::IntegrateSample(timestamp_t t, const Vector3f& p, const Vector3f& normal)
+{
+  const int bv = params_.block_voxels;
+  const float inv_voxel = static_cast<float>(1.0 / params_.voxel_size);
+
+  const Vector3i voxel(static_cast<int>(std::floor(p.x() * inv_voxel)),
+                       static_cast<int>(std::floor(p.y() * inv_voxel)),
+                       static_cast<int>(std::floor(p.z() * inv_voxel)));
+  const BlockIndex index(FloorDiv(voxel.x(), bv), FloorDiv(voxel.y(), bv), FloorDiv(voxel.z(), bv));
+  const Vector3i local = voxel - bv * index;
+
+  SurfelBlock& block = blocks_[index];
+  if (block.surfels.empty()) {
+    block.surfels.resize(bv * bv * bv);
+  }
+  block.last_updated = t;
+  updated_.insert(index);
+  evicted_.erase(index);
+
+  Surfel& s = block.surfels.at(local.x() + bv * (local.y() + bv * local.z()));
+  if (s.weight == 0) {
+    ++block.num_occupied;
+    s.position = p;
+    s.normal = normal;
+    s.weight = 1.0f;
+    return;
+  }
+
+  // Running average, which turns into an exponential moving average at max_weight.
+  const float w = s.weight;
+  s.position = (w * s.position + p) / (w + 1.0f);
+  s.normal = (w * s.normal + normal).normalized();
+  s.weight = std::min(params_.max_weight, w + 1.0f);
+}
+
+
+void SurfelMap::Evict(timestamp_t t, const Vector3d& cam_position)
+{
+  const double block_size = params_.voxel_size * params_.block_voxels;
+  const timestamp_t max_age = ConvertToNanoseconds(params_.max_block_age_sec);
+
+  std::vector<BlockIndex> to_evict;
+  for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+    const Vector3d center = (it->first.cast<double>() + Vector3d::Constant(0.5)) * block_size;
+    const bool too_old = t > it->second.last_updated && (t - it->second.last_updated) > max_age;
+    const bool too_far = (center - cam_position).norm() > params_.max_block_distance;
+    if (too_old || too_far) {
+      to_evict.emplace_back(it->first);
+    }
+  }
+
+  for (const BlockIndex& index : to_evict) {
+    EvictBlock(index);
+  }
+
+  // Then drop the least recently updated blocks until the map fits.
+  const size_t max_blocks = static_cast<size_t>(std::max(0, params_.max_blocks));
+  if (blocks_.size() <= max_blocks) {
+    return;
+  }
+
+  std::vector<std::pair<timestamp_t, BlockIndex>> by_age;
+  by_age.reserve(blocks_.size());
+  for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+    by_age.emplace_back(it->second.last_updated, it->first);
+  }
+
+  const size_t num_extra = blocks_.size() - max_blocks;
+  std::nth_element(by_age.begin(), by_age.begin() + num_extra, by_age.end(),
+      [](const std::pair<timestamp_t, BlockIndex>& lhs, const std::pair<timestamp_t, BlockIndex>& rhs)
+  {
+    return lhs.first < rhs.first;
+  });
+
+  for (size_t i = 0; i < num_extra; ++i) {
+    EvictBlock(by_age.at(i).second);
+  }
+}
+
+
+void SurfelMap::EvictBlock(const BlockIndex& index)
+{
+  blocks_.erase(index);
+
+  // NOTE(milo): A block that was added and evicted between two PopChanges() calls was never
+  // published, so it doesn't need to be removed either.
+  if (updated_.erase(index) == 0) {
+    evicted_.insert(index);
+  }
+}
+
+
+void SurfelMap::PopChanges(BlockSet& updated, BlockSet& evicted)
+{
+  updated.clear();
+  evicted.clear();
+  std::swap(updated, updated_);
+  std::swap(evicted, evicted_);
+}
+
+
+const SurfelBlock* SurfelMap::GetBlock(const BlockIndex& index) const
+{
+  const auto it = blocks_.find(index);
+  return (it == blocks_.end()) ? nullptr : &it->second;
+}
+
+
+void SurfelMap::GetSurfels(const BlockIndex& index, std::vector<Surfel>& surfels) const
+{
+  const SurfelBlock* block = GetBlock(index);
+  if (block == nullptr) {
+    return;
+  }
+
+  for (const Surfel& s : block->surfels) {
+    if (s.weight > 0) {
+      surfels.emplace_back(s);
+    }
+  }
+}
+
+
+size_t SurfelMap::NumSurfels() const
+{
+  size_t n = 0;
+  for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+    n += it->second.num_occupied;
+  }
+  return n;
+}
+
+
+}
+}
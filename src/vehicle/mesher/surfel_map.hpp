@@ -0,0 +1,113 @@
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "params/params_base.hpp"
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace mesher {
+
+using namespace core;
+
+
+// A surface element: the fused position and normal of the mesh samples in one voxel.
+struct Surfel final {
+  Vector3f position = Vector3f::Zero();
+  Vector3f normal = Vector3f::Zero();
+  float weight = 0;   // Zero if the voxel hasn't been observed.
+};
+
+
+// A cube of block_voxels^3 voxels (x fastest, then y, then z). Blocks are what the map allocates,
+// evicts and publishes.
+struct SurfelBlock final {
+  std::vector<Surfel> surfels;
+  timestamp_t last_updated = 0;
+  int num_occupied = 0;
+};
+
+
+typedef Vector3i BlockIndex;
+
+struct BlockIndexHash final {
+  size_t operator()(const BlockIndex& b) const
+  {
+    // NOTE(milo): Large primes from "Optimized Spatial Hashing for Collision Detection of Deformable
+    // Objects" (Teschner et al.), which is also what voxel hashing uses.
+    return (static_cast<size_t>(b.x()) * 73856093u) ^
+           (static_cast<size_t>(b.y()) * 19349669u) ^
+           (static_cast<size_t>(b.z()) * 83492791u);
+  }
+};
+
+typedef std::unordered_set<BlockIndex, BlockIndexHash> BlockSet;
+
+
+// Fuses camera-frame triangle meshes into a world-frame map of surfels, stored in voxel-hashed
+// blocks. Each triangle is sampled at about the voxel size, and each sample is averaged into the
+// surfel of its voxel (capped at max_weight, so that the map can follow changes). Memory is bounded
+// by evicting blocks that haven't been updated in a while, that are far from the camera, or the
+// oldest ones once there are more than max_blocks. The blocks that changed (or were evicted) since
+// the last call to PopChanges() are kept track of, so that only those need to be published.
+class SurfelMap final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double voxel_size = 0.1;            // m
+    int block_voxels = 8;               // Voxels along each side of a block.
+    int max_blocks = 4096;
+    double max_block_age_sec = 60.0;    // Evict blocks that haven't been updated in this long.
+    double max_block_distance = 30.0;   // Evict blocks this far from the camera (m).
+    float max_weight = 20.0f;
+    int max_samples_per_edge = 64;      // Caps the samples for very large triangles.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(SurfelMap);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SurfelMap);
+
+  explicit SurfelMap(const Params& params);
+
+  // Fuses a mesh (in the camera frame) observed at time t, and then evicts old or far blocks.
+  void Integrate(timestamp_t t, const TriangleMesh& mesh, const Matrix4d& world_T_cam);
+
+  // Returns the blocks that were updated, and the ones that were evicted, since the last call.
+  void PopChanges(BlockSet& updated, BlockSet& evicted);
+
+  // Returns nullptr if the block isn't in the map.
+  const SurfelBlock* GetBlock(const BlockIndex& index) const;
+
+  // Appends the occupied surfels in a block to surfels.
+  void GetSurfels(const BlockIndex& index, std::vector<Surfel>& surfels) const;
+
+  size_t NumBlocks() const { return blocks_.size(); }
+  size_t NumSurfels() const;
+
+  const Params& GetParams() const { return params_; }
+
+ private:
+  void IntegrateSample(timestamp_t t, const Vector3f& p, const Vector3f& normal);
+
+  void Evict(timestamp_t t, const Vector3d& cam_position);
+
+  void EvictBlock(const BlockIndex& index);
+
+  Params params_;
+
+  std::unordered_map<BlockIndex, SurfelBlock, BlockIndexHash> blocks_;
+  BlockSet updated_;
+  BlockSet evicted_;
+};
+
+}
+}
@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "core/eigen_types.hpp"
+#include "core/uid.hpp"
 
 namespace bm {
 namespace mesher {
@@ -21,6 +22,10 @@ struct TriangleMesh
 
   std::vector<Vector3d> vertices;
   std::vector<Vector3i> triangles;
+
+  // The landmark id of each vertex, which is stable across frames (empty if the mesh isn't made
+  // from landmarks).
+  std::vector<uid_t> vertex_ids;
 };
 
 
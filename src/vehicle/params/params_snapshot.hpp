@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <glog/logging.h>
+
+#include "core/file_utils.hpp"
+#include "core/macros.hpp"
+#include "core/timer.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Holds the current params for a node (any ParamsBase struct), parsed once into an immutable
+// snapshot. Components read the snapshot instead of going back to the YAML, and the whole thing
+// can be re-parsed while the node runs (hot reload) without anyone taking a lock to read it.
+//
+// A reload parses into a brand new struct and swaps it in through an atomic shared_ptr, so readers
+// either see the old params or the new ones (never a mix), and a snapshot that a reader is holding
+// stays alive until it lets go. Hot loops should hold a Reader, which only touches the shared_ptr
+// when the version number has changed (one relaxed atomic load otherwise).
+//
+// NOTE(milo): LoadParams() CHECKs every field, so a reload with a broken YAML file still aborts
+// the node, just like at startup. Only reload files that have been validated.
+template <typename ParamsT>
+class ParamsSnapshot final {
+ public:
+  typedef std::shared_ptr<ParamsSnapshot<ParamsT>> Ptr;
+  typedef std::shared_ptr<const ParamsT> ConstParamsPtr;
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(ParamsSnapshot)
+
+  // Parses the params right away, and logs how long that took.
+  ParamsSnapshot(const std::string& filepath, const std::string& shared_filepath = "")
+      : filepath_(filepath),
+        shared_filepath_(shared_filepath)
+  {
+    Reload();
+    LOG(INFO) << "Loaded params from " << filepath_ << " in " << load_ms_.load() << " ms" << std::endl;
+  }
+
+  // Starts from params that are already parsed (Reload() will still read filepath).
+  ParamsSnapshot(const ParamsT& params, const std::string& filepath = "", const std::string& shared_filepath = "")
+      : filepath_(filepath),
+        shared_filepath_(shared_filepath)
+  {
+    Publish(params);
+  }
+
+  // The current snapshot. Cheap, but not free (atomic shared_ptr loads take a spinlock in
+  // libstdc++), so use a Reader in hot loops.
+  ConstParamsPtr Get() const { return std::atomic_load(&current_); }
+
+  // Incremented every time a new snapshot is published.
+  uint64_t Version() const { return version_.load(std::memory_order_acquire); }
+
+  // How long the last parse took (wall time, milliseconds).
+  double LoadMs() const { return load_ms_.load(); }
+
+  // Replace the current snapshot (e.g with params that were changed programmatically).
+  void Publish(const ParamsT& params)
+  {
+    std::atomic_store(&current_, ConstParamsPtr(std::make_shared<const ParamsT>(params)));
+    version_.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  // Parse the YAML file(s) again, and publish the result.
+  void Reload()
+  {
+    std::lock_guard<std::mutex> lock(reload_lock_);
+    file_mtime_ = LastWriteTime(filepath_);
+    shared_mtime_ = shared_filepath_.empty() ? 0 : LastWriteTime(shared_filepath_);
+
+    Timer timer(true);
+    const ParamsT params(filepath_, shared_filepath_);
+    load_ms_ = timer.Elapsed().milliseconds();
+
+    Publish(params);
+  }
+
+  // Reload only if either YAML file was modified since the last load. Returns whether it did. This
+  // parses on the calling thread, so call it from a background thread (not a hot loop).
+  bool ReloadIfModified()
+  {
+    {
+      std::lock_guard<std::mutex> lock(reload_lock_);
+      const bool modified = LastWriteTime(filepath_) != file_mtime_ ||
+          (!shared_filepath_.empty() && LastWriteTime(shared_filepath_) != shared_mtime_);
+      if (filepath_.empty() || !modified) {
+        return false;
+      }
+    }
+    Reload();
+    LOG(INFO) << "Reloaded params from " << filepath_ << " in " << load_ms_.load() << " ms" << std::endl;
+    return true;
+  }
+
+  // A reader's own copy of the snapshot. Refresh() is what picks up a reload, so readers decide when
+  // params are allowed to change (e.g once at the top of each loop iteration).
+  class Reader final {
+   public:
+    explicit Reader(const ParamsSnapshot<ParamsT>& snapshot)
+        : snapshot_(snapshot),
+          version_(snapshot.Version()),
+          params_(snapshot.Get()) {}
+
+    // Returns true if there was a new snapshot.
+    bool Refresh()
+    {
+      const uint64_t version = snapshot_.version_.load(std::memory_order_relaxed);
+      if (version == version_) {
+        return false;
+      }
+      version_ = snapshot_.Version();
+      params_ = snapshot_.Get();
+      return true;
+    }
+
+    const ParamsT& operator*() const { return *params_; }
+    const ParamsT* operator->() const { return params_.get(); }
+
+   private:
+    const ParamsSnapshot<ParamsT>& snapshot_;
+    uint64_t version_;
+    ConstParamsPtr params_;
+  };
+
+ private:
+  std::string filepath_;
+  std::string shared_filepath_;
+
+  ConstParamsPtr current_;                // Only accessed with std::atomic_load/atomic_store.
+  std::atomic<uint64_t> version_{0};
+  std::atomic<double> load_ms_{0};
+
+  std::mutex reload_lock_;                // Only one reload at a time (never taken by readers).
+  std::time_t file_mtime_ = 0;
+  std::time_t shared_mtime_ = 0;
+};
+
+
+}
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "params/yaml_parser.hpp"
 
 namespace bm {
@@ -121,7 +123,28 @@ std::string YamlToString(const cv::FileNode& node)
 }
 
 
+std::vector<std::string> YamlToStringList(const cv::FileNode& node)
+{
+  CHECK(node.isSeq()) << "Expected a list of strings" << std::endl;
+  std::vector<std::string> out;
+  for (size_t i = 0; i < node.size(); ++i) {
+    out.emplace_back(YamlToString(node[static_cast<int>(i)]));
+  }
+  return out;
+}
+
+
 void YamlToCameraModel(const cv::FileNode& node, PinholeCamera& cam)
+{
+  std::vector<double> distortion;
+  YamlToCameraModel(node, cam, distortion);
+
+  LOG_IF(WARNING, std::any_of(distortion.begin(), distortion.end(), [](double d) { return d != 0; }))
+      << "WARNING: distortion_coefficients are nonzero, use an UndistortMap on the raw images" << std::endl;
+}
+
+
+void YamlToCameraModel(const cv::FileNode& node, PinholeCamera& cam, std::vector<double>& distortion)
 {
   const cv::FileNode& h_node = node["image_height"];
   const cv::FileNode& w_node = node["image_width"];
@@ -150,7 +173,10 @@ void YamlToCameraModel(const cv::FileNode& node, PinholeCamera& cam)
   CHECK(distort_node.isSeq() && distort_node.size() > 0)
       << "Expected distortion coefficients" << std::endl;
 
-  LOG_IF(WARNING, (double)distort_node[0] > 0) << "WARNING: distortion_coefficients are nonzero, but we don't handle undistortion yet" << std::endl;
+  distortion.resize(distort_node.size());
+  for (size_t i = 0; i < distort_node.size(); ++i) {
+    distortion.at(i) = distort_node[static_cast<int>(i)];
+  }
 
   cam = PinholeCamera(fx, fy, cx, cy, h, w);
 }
@@ -192,5 +218,20 @@ Matrix4d YamlToTransform(const cv::FileNode& node)
 }
 
 
+void YamlToThreadConfig(const cv::FileNode& node, ThreadConfig& config)
+{
+  CHECK(node.type() != cv::FileNode::NONE) << "YamlToThreadConfig: missing node" << std::endl;
+
+  const cv::FileNode& cpus_node = node["cpus"];
+  CHECK(cpus_node.isSeq()) << "YamlToThreadConfig: 'cpus' must be a sequence" << std::endl;
+  config.cpus.clear();
+  for (size_t i = 0; i < cpus_node.size(); ++i) {
+    config.cpus.emplace_back((int)cpus_node[i]);
+  }
+
+  node["realtime_priority"] >> config.realtime_priority;
+  node["nice"] >> config.nice;
+}
+
 }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <glog/logging.h>
 
@@ -9,6 +10,7 @@
 #include <opencv2/core/persistence.hpp>
 
 #include "core/eigen_types.hpp"
+#include "core/thread_util.hpp"
 #include "vision_core/pinhole_camera.hpp"
 #include "vision_core/stereo_camera.hpp"
 
@@ -163,6 +165,10 @@ Matrix4d YamlToTransform(const cv::FileNode& node);
 std::string YamlToString(const cv::FileNode& node);
 
 
+// Parse and return a list of strings (e.g [stereo_forward, stereo_downward]).
+std::vector<std::string> YamlToStringList(const cv::FileNode& node);
+
+
 // Parse and return an enum (cast from an int to enum type).
 template <typename EnumT>
 inline EnumT YamlToEnum(const cv::FileNode& node)
@@ -178,11 +184,19 @@ inline EnumT YamlToEnum(const cv::FileNode& node)
 void YamlToCameraModel(const cv::FileNode& node, PinholeCamera& cam);
 
 
+// Same as above, but also returns the distortion coefficients (e.g to build an UndistortMap).
+void YamlToCameraModel(const cv::FileNode& node, PinholeCamera& cam, std::vector<double>& distortion);
+
+
 // Parse and return a StereoCamera as an output param.
 void YamlToStereoRig(const cv::FileNode& node,
                     StereoCamera& stereo_rig,
                     Matrix4d& body_T_left,
                     Matrix4d& body_T_right);
 
+
+// Parse a ThreadConfig with the fields "cpus" (list of ints), "realtime_priority" and "nice".
+void YamlToThreadConfig(const cv::FileNode& node, ThreadConfig& config);
+
 }
 }
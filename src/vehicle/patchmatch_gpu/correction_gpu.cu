@@ -0,0 +1,67 @@
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda/common.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#include "patchmatch_gpu/correction_gpu.h"
+
+namespace bm {
+namespace pm {
+
+
+template <typename T>
+__global__
+void CorrectImageKernel(const cu::PtrStepSz<T> bgr,
+                        const cu::PtrStep<float> range,
+                        cu::PtrStep<uchar3> out,
+                        float input_scale,
+                        imaging::CorrectionModel model)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= bgr.cols || y >= bgr.rows) {
+    return;
+  }
+
+  const T c = bgr(y, x);
+  float b = input_scale * static_cast<float>(c.x);
+  float g = input_scale * static_cast<float>(c.y);
+  float r = input_scale * static_cast<float>(c.z);
+
+  imaging::CorrectPixel(model, range(y, x), b, g, r);
+
+  out(y, x) = make_uchar3(imaging::GammaEncode8(b, model.gamma_power),
+                          imaging::GammaEncode8(g, model.gamma_power),
+                          imaging::GammaEncode8(r, model.gamma_power));
+}
+
+
+void CorrectImageFused(const cu::GpuMat& bgr,
+                       const cu::GpuMat& range,
+                       const imaging::CorrectionModel& model,
+                       cu::GpuMat& out,
+                       cu::Stream& stream)
+{
+  CHECK(bgr.type() == CV_8UC3 || bgr.type() == CV_32FC3);
+  CHECK_EQ(CV_32FC1, range.type());
+  CHECK(bgr.size() == range.size());
+  CHECK_GT(model.vmax, model.vmin);
+
+  out.create(bgr.size(), CV_8UC3);
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(bgr.cols, block.x), cu::device::divUp(bgr.rows, block.y));
+  const cudaStream_t s = cu::StreamAccessor::getStream(stream);
+
+  if (bgr.type() == CV_8UC3) {
+    CorrectImageKernel<uchar3><<<grid, block, 0, s>>>(bgr, range, out, 1.0f / 255.0f, model);
+  } else {
+    CorrectImageKernel<float3><<<grid, block, 0, s>>>(bgr, range, out, 1.0f, model);
+  }
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+
+#include "imaging/fused_correction.hpp"
+
+namespace bm {
+namespace pm {
+
+namespace cu = cv::cuda;
+
+
+// One thread per pixel version of imaging::CorrectImageFused(). T is uchar3 (scale = 1 / 255) or
+// float3 (scale = 1).
+template <typename T>
+__global__
+void CorrectImageKernel(const cu::PtrStepSz<T> bgr,
+                        const cu::PtrStep<float> range,
+                        cu::PtrStep<uchar3> out,
+                        float input_scale,
+                        imaging::CorrectionModel model);
+
+
+// See imaging::CorrectImageFused(). bgr is CV_8UC3 or CV_32FC3 (in [0, 1]), range is CV_32FC1
+// (e.g from PointCloudGpu), and out is CV_8UC3. Everything is enqueued on stream, so the frame can
+// go from the camera to the corrected 8-bit image with one upload and one download.
+void CorrectImageFused(const cu::GpuMat& bgr,
+                       const cu::GpuMat& range,
+                       const imaging::CorrectionModel& model,
+                       cu::GpuMat& out,
+                       cu::Stream& stream = cu::Stream::Null());
+
+
+}
+}
@@ -0,0 +1,372 @@
+#include <math_constants.h>
+
+#include <vector>
+
+#include <glog/logging.h>
+
+#include <thrust/device_ptr.h>
+#include <thrust/execution_policy.h>
+#include <thrust/scan.h>
+
+#include <opencv2/core/cuda/common.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#include "patchmatch_gpu/depth_mesh_gpu.h"
+#include "patchmatch_gpu/point_cloud_gpu.h"
+
+namespace bm {
+namespace pm {
+
+
+// Thresholds for the meshing kernels, passed by value.
+struct GridMeshing final {
+  int cell_px;            // Pixels between grid vertices.
+  int block_cells;        // Cells along each side of a decimation block.
+  float max_disp_ratio;   // Edges with max(d) > max_disp_ratio * min(d) are depth discontinuities.
+  float max_error_px;     // Max disparity error of the vertices inside a decimated block.
+};
+
+
+void DepthMeshGpu::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("cell_px", &cell_px);
+  parser.GetParam("block_cells", &block_cells);
+  parser.GetParam("max_depth_change", &max_depth_change);
+  parser.GetParam("max_error_px", &max_error_px);
+  parser.GetParam("min_disp", &min_disp);
+  parser.GetParam("max_range", &max_range);
+}
+
+
+// Both disparities are valid, and the depth doesn't jump between them. Depth is inversely
+// proportional to disparity, so the relative depth change is max(d) / min(d) - 1.
+__device__ __forceinline__
+bool Continuous(float d0, float d1, float max_disp_ratio)
+{
+  return d0 > 0 && d1 > 0 && fmaxf(d0, d1) <= max_disp_ratio * fminf(d0, d1);
+}
+
+
+// Samples disp every cell_px pixels into a grid of vertices. vdisp is the disparity (0 where
+// invalid) and vxyz is the point in the left camera frame (NaN where invalid).
+__global__
+void GridVertices(const cu::PtrStepSz<float> disp,
+                  cu::PtrStepSz<float> vdisp,
+                  cu::PtrStep<float3> vxyz,
+                  Backprojection bp,
+                  int cell_px)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= vdisp.cols || y >= vdisp.rows) {
+    return;
+  }
+
+  const int u = x * cell_px;
+  const int v = y * cell_px;
+  const float d = disp(v, u);
+  const float nan = CUDART_NAN_F;
+
+  // NOTE(milo): NaN fails every comparison, so check for valid disparities rather than invalid ones.
+  if (d >= bp.min_disp) {
+    const float z = bp.fx_baseline / d;
+    const float3 p = make_float3((__int2float_rn(u) - bp.cx) * z / bp.fx,
+                                 (__int2float_rn(v) - bp.cy) * z / bp.fy,
+                                 z);
+    if (norm3df(p.x, p.y, p.z) <= bp.max_range) {
+      vdisp(y, x) = d;
+      vxyz(y, x) = p;
+      return;
+    }
+  }
+
+  vdisp(y, x) = 0;
+  vxyz(y, x) = make_float3(nan, nan, nan);
+}
+
+
+// Which of the two triangles of each grid cell are valid (bit 0 for the upper-left one, bit 1 for
+// the lower-right one), i.e have three valid vertices and no depth discontinuity along any edge.
+// The cell's diagonal goes from its top-right to its bottom-left vertex.
+__global__
+void CellTriangles(const cu::PtrStepSz<float> vdisp,
+                   cu::PtrStep<uchar> cell_mask,
+                   GridMeshing gm)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= (vdisp.cols - 1) || y >= (vdisp.rows - 1)) {
+    return;
+  }
+
+  const float a = vdisp(y, x);
+  const float b = vdisp(y, x + 1);
+  const float c = vdisp(y + 1, x);
+  const float d = vdisp(y + 1, x + 1);
+  const float r = gm.max_disp_ratio;
+
+  const bool diagonal = Continuous(b, c, r);
+  const bool upper = diagonal && Continuous(a, b, r) && Continuous(a, c, r);
+  const bool lower = diagonal && Continuous(b, d, r) && Continuous(c, d, r);
+
+  cell_mask(y, x) = (upper ? 1 : 0) | (lower ? 2 : 0);
+}
+
+
+// The cells [x0, x1) x [y0, y1) of block i (the last blocks in each row and column can be cut off).
+__device__ __forceinline__
+void BlockCells(int i, int grid_cols, int grid_rows, int block_cells, int& x0, int& y0, int& x1, int& y1)
+{
+  const int cell_cols = grid_cols - 1;
+  const int cell_rows = grid_rows - 1;
+  const int blocks_per_row = (cell_cols + block_cells - 1) / block_cells;
+  x0 = (i % blocks_per_row) * block_cells;
+  y0 = (i / blocks_per_row) * block_cells;
+  x1 = min(x0 + block_cells, cell_cols);
+  y1 = min(y0 + block_cells, cell_rows);
+}
+
+
+// One thread per decimation block: the block is replaced by two triangles if all of its cells are
+// complete and every vertex inside is within max_error_px of the plane through the corners.
+// Otherwise, it keeps its valid cell triangles. Writes the number of triangles of each block (the
+// blocks are flattened in row-major order).
+__global__
+void DecimateBlocks(const cu::PtrStepSz<float> vdisp,
+                    const cu::PtrStep<uchar> cell_mask,
+                    int num_blocks,
+                    int* block_tris,
+                    uchar* block_coarse,
+                    GridMeshing gm)
+{
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num_blocks) {
+    return;
+  }
+
+  int x0, y0, x1, y1;
+  BlockCells(i, vdisp.cols, vdisp.rows, gm.block_cells, x0, y0, x1, y1);
+
+  int fine = 0;
+  bool complete = true;
+  for (int y = y0; y < y1; ++y) {
+    for (int x = x0; x < x1; ++x) {
+      const uchar m = cell_mask(y, x);
+      fine += __popc(m);
+      complete &= (m == 3);
+    }
+  }
+
+  // A single cell is already two triangles.
+  bool coarse = complete && ((x1 - x0) > 1 || (y1 - y0) > 1);
+
+  // The block is split along the same diagonal as its cells, and a plane in 3D is a plane in (u, v,
+  // disparity), so interpolate the disparity over whichever triangle each vertex falls in.
+  if (coarse) {
+    const float da = vdisp(y0, x0);
+    const float db = vdisp(y0, x1);
+    const float dc = vdisp(y1, x0);
+    const float dd = vdisp(y1, x1);
+    const float w = __int2float_rn(x1 - x0);
+    const float h = __int2float_rn(y1 - y0);
+
+    for (int y = y0; y <= y1 && coarse; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        const float s = __int2float_rn(x - x0) / w;
+        const float t = __int2float_rn(y - y0) / h;
+        const float plane = (s + t <= 1.0f) ?
+            da + s * (db - da) + t * (dc - da) :
+            dd + (1.0f - s) * (dc - dd) + (1.0f - t) * (db - dd);
+
+        if (fabsf(vdisp(y, x) - plane) > gm.max_error_px) {
+          coarse = false;
+          break;
+        }
+      }
+    }
+  }
+
+  block_coarse[i] = coarse ? 1 : 0;
+  block_tris[i] = coarse ? 2 : fine;
+}
+
+
+// Writes the triangles of each block (as indices into the flattened vertex grid), starting at its
+// offset from an exclusive scan over block_tris. Triangles are wound the same way in every cell.
+__global__
+void EmitTriangles(const cu::PtrStepSz<float> vdisp,
+                   const cu::PtrStep<uchar> cell_mask,
+                   int num_blocks,
+                   const int* block_offsets,
+                   const uchar* block_coarse,
+                   int3* triangles,
+                   GridMeshing gm)
+{
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num_blocks) {
+    return;
+  }
+
+  int x0, y0, x1, y1;
+  BlockCells(i, vdisp.cols, vdisp.rows, gm.block_cells, x0, y0, x1, y1);
+
+  const int cols = vdisp.cols;
+  int next = block_offsets[i];
+
+  if (block_coarse[i]) {
+    const int a = y0 * cols + x0;
+    const int b = y0 * cols + x1;
+    const int c = y1 * cols + x0;
+    const int d = y1 * cols + x1;
+    triangles[next] = make_int3(a, c, b);
+    triangles[next + 1] = make_int3(b, c, d);
+    return;
+  }
+
+  for (int y = y0; y < y1; ++y) {
+    for (int x = x0; x < x1; ++x) {
+      const uchar m = cell_mask(y, x);
+      const int a = y * cols + x;
+      const int b = a + 1;
+      const int c = a + cols;
+      const int d = c + 1;
+      if (m & 1) {
+        triangles[next++] = make_int3(a, c, b);
+      }
+      if (m & 2) {
+        triangles[next++] = make_int3(b, c, d);
+      }
+    }
+  }
+}
+
+
+DepthMeshGpu::DepthMeshGpu(const Params& params, const StereoCamera& stereo_rig)
+    : params_(params),
+      stereo_rig_(stereo_rig)
+{
+  CHECK_GT(params_.cell_px, 0);
+  CHECK_GT(params_.block_cells, 0);
+  CHECK_GE(params_.max_depth_change, 0);
+  CHECK_GT(params_.min_disp, 0);
+  CHECK_GT(params_.max_range, 0);
+}
+
+
+void DepthMeshGpu::Compute(const cu::GpuMat& disp,
+                           mesher::TriangleMesh& mesh,
+                           cu::Stream& stream)
+{
+  CHECK_EQ(CV_32FC1, disp.type());
+
+  mesh.vertices.clear();
+  mesh.triangles.clear();
+  mesh.vertex_ids.clear();
+
+  Backprojection bp;
+  bp.fx = stereo_rig_.fx();
+  bp.fy = stereo_rig_.fy();
+  bp.cx = stereo_rig_.cx();
+  bp.cy = stereo_rig_.cy();
+  bp.fx_baseline = stereo_rig_.fx() * stereo_rig_.Baseline();
+  bp.min_disp = params_.min_disp;
+  bp.max_range = params_.max_range;
+
+  GridMeshing gm;
+  gm.cell_px = params_.cell_px;
+  gm.block_cells = params_.block_cells;
+  gm.max_disp_ratio = 1.0f + params_.max_depth_change;
+  gm.max_error_px = params_.max_error_px;
+
+  const int grid_rows = (disp.rows - 1) / params_.cell_px + 1;
+  const int grid_cols = (disp.cols - 1) / params_.cell_px + 1;
+  if (grid_rows < 2 || grid_cols < 2) {
+    return;
+  }
+
+  const int blocks_per_row = cu::device::divUp(grid_cols - 1, params_.block_cells);
+  const int blocks_per_col = cu::device::divUp(grid_rows - 1, params_.block_cells);
+  const int num_blocks = blocks_per_row * blocks_per_col;
+
+  vdisp_.create(grid_rows, grid_cols, CV_32FC1);
+  vxyz_.create(grid_rows, grid_cols, CV_32FC3);
+  cell_mask_.create(grid_rows - 1, grid_cols - 1, CV_8UC1);
+
+  // NOTE(milo): The per-block arrays are single rows, so that thrust can scan them as flat arrays.
+  block_tris_.create(1, num_blocks, CV_32SC1);
+  block_offsets_.create(1, num_blocks, CV_32SC1);
+  block_coarse_.create(1, num_blocks, CV_8UC1);
+
+  cudaStream_t s = cu::StreamAccessor::getStream(stream);
+
+  const dim3 block(16, 16);
+  const dim3 vgrid(cu::device::divUp(grid_cols, block.x), cu::device::divUp(grid_rows, block.y));
+  GridVertices<<<vgrid, block, 0, s>>>(disp, vdisp_, vxyz_, bp, params_.cell_px);
+  cudaSafeCall(cudaGetLastError());
+
+  const dim3 cgrid(cu::device::divUp(grid_cols - 1, block.x), cu::device::divUp(grid_rows - 1, block.y));
+  CellTriangles<<<cgrid, block, 0, s>>>(vdisp_, cell_mask_, gm);
+  cudaSafeCall(cudaGetLastError());
+
+  int* block_tris = block_tris_.ptr<int>();
+  int* block_offsets = block_offsets_.ptr<int>();
+  uchar* block_coarse = block_coarse_.ptr<uchar>();
+
+  DecimateBlocks<<<cu::device::divUp(num_blocks, 128), 128, 0, s>>>(
+      vdisp_, cell_mask_, num_blocks, block_tris, block_coarse, gm);
+  cudaSafeCall(cudaGetLastError());
+
+  const thrust::device_ptr<int> tris_begin = thrust::device_pointer_cast(block_tris);
+  const thrust::device_ptr<int> offsets_begin = thrust::device_pointer_cast(block_offsets);
+  thrust::exclusive_scan(thrust::cuda::par.on(s), tris_begin, tris_begin + num_blocks, offsets_begin);
+
+  // The total is the offset of the last block plus its own count.
+  int last[2];
+  cudaSafeCall(cudaMemcpyAsync(&last[0], block_offsets + num_blocks - 1, sizeof(int), cudaMemcpyDeviceToHost, s));
+  cudaSafeCall(cudaMemcpyAsync(&last[1], block_tris + num_blocks - 1, sizeof(int), cudaMemcpyDeviceToHost, s));
+  stream.waitForCompletion();
+
+  const int num_triangles = last[0] + last[1];
+  if (num_triangles == 0) {
+    return;
+  }
+
+  triangles_.create(1, num_triangles, CV_32SC3);
+  EmitTriangles<<<cu::device::divUp(num_blocks, 128), 128, 0, s>>>(
+      vdisp_, cell_mask_, num_blocks, block_offsets, block_coarse, triangles_.ptr<int3>(), gm);
+  cudaSafeCall(cudaGetLastError());
+
+  vxyz_.download(vxyz_host_, stream);
+  triangles_.download(triangles_host_, stream);
+  stream.waitForCompletion();
+
+  // Keep only the vertices that some triangle uses.
+  std::vector<int> grid_to_vertex(grid_rows * grid_cols, -1);
+  mesh.triangles.resize(num_triangles);
+
+  for (int i = 0; i < num_triangles; ++i) {
+    const cv::Vec3i& t = triangles_host_.at<cv::Vec3i>(0, i);
+    for (int j = 0; j < 3; ++j) {
+      int& v = grid_to_vertex.at(t[j]);
+      if (v < 0) {
+        const cv::Vec3f& p = vxyz_host_(t[j] / grid_cols, t[j] % grid_cols);
+        v = static_cast<int>(mesh.vertices.size());
+        mesh.vertices.emplace_back(p[0], p[1], p[2]);
+      }
+      mesh.triangles.at(i)(j) = v;
+    }
+  }
+}
+
+
+void DepthMeshGpu::Compute(const Image1f& disp, mesher::TriangleMesh& mesh)
+{
+  disp_gpu_.upload(disp);
+  Compute(disp_gpu_, mesh);
+}
+
+
+}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace pm {
+
+namespace cu = cv::cuda;
+using namespace core;
+
+
+// Builds an obstacle mesh straight from a dense disparity map (e.g from PatchmatchGpu), instead of
+// from sparse landmarks. The disparity is sampled on a regular grid, triangles that cross a depth
+// discontinuity are dropped, and blocks of the grid that are planar (in disparity, which is affine
+// in the image for a 3D plane) are collapsed into two triangles. The error bound is in disparity
+// pixels, so it's a screen-space error: decimation is aggressive far away and careful up close.
+//
+// All of the meshing runs on the GPU. Only the triangle count, the vertex grid and the triangles
+// are downloaded, and the CPU just drops the unused vertices.
+//
+// NOTE(milo): Decimated blocks next to full resolution ones leave T-junctions. The vertices along
+// the shared edge are on the coarse plane to within max_error_px, so the cracks are at most that.
+// The kernels live in the .cu, so that this header can be included by C++ code (e.g the
+// ObjectMesher).
+class DepthMeshGpu final {
+ public:
+  struct Params final : public ParamsBase {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int cell_px = 4;
+    int block_cells = 8;
+    float max_depth_change = 0.1;   // Relative: |z0 - z1| / min(z0, z1)
+    float max_error_px = 0.5;       // Disparity pixels
+    float min_disp = 0.5;
+    float max_range = 30.0;         // m
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(DepthMeshGpu);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(DepthMeshGpu);
+
+  // stereo_rig must have the same resolution as the disparity maps (see PointCloudGpu).
+  DepthMeshGpu(const Params& params, const StereoCamera& stereo_rig);
+
+  // disp is CV_32FC1. The mesh is in the left camera frame, and has no vertex_ids. Synchronizes
+  // stream, since the number of triangles isn't known until the blocks are counted.
+  void Compute(const cu::GpuMat& disp,
+               mesher::TriangleMesh& mesh,
+               cu::Stream& stream = cu::Stream::Null());
+
+  // Uploads disp, then calls the above.
+  void Compute(const Image1f& disp, mesher::TriangleMesh& mesh);
+
+ private:
+  Params params_;
+  StereoCamera stereo_rig_;
+
+  // Pre-allocate these GpuMats to save on allocation time.
+  cu::GpuMat disp_gpu_, vdisp_, vxyz_, cell_mask_, block_tris_, block_offsets_, block_coarse_;
+  cu::GpuMat triangles_;
+  Image3f vxyz_host_;
+  cv::Mat triangles_host_;
+};
+
+
+}
+}
@@ -0,0 +1,339 @@
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda/common.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#include "patchmatch_gpu/guided_filter_gpu.h"
+
+namespace bm {
+namespace pm {
+
+
+// Reflect-101 border (cv::BORDER_DEFAULT): ... 2 1 | 0 1 2 ... n-1 | n-2 n-3 ...
+__device__ __forceinline__
+int Reflect101(int i, int n)
+{
+  if (n == 1) {
+    return 0;
+  }
+  const int period = 2 * n - 2;
+  i = abs(i) % period;
+  return (i < n) ? i : (period - i);
+}
+
+
+// One thread per column, with a running sum of the ksize rows around each pixel.
+__global__
+void BoxFilterCols(const cu::PtrStepSz<float> src, cu::PtrStep<float> dst, int ksize)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  if (x >= src.cols) {
+    return;
+  }
+
+  const int R = ksize / 2;
+  const float norm = 1.0f / static_cast<float>(ksize);
+
+  float sum = 0;
+  for (int k = -R; k <= R; ++k) {
+    sum += src(Reflect101(k, src.rows), x);
+  }
+  dst(0, x) = sum * norm;
+
+  for (int y = 1; y < src.rows; ++y) {
+    sum += src(Reflect101(y + R, src.rows), x) - src(Reflect101(y - 1 - R, src.rows), x);
+    dst(y, x) = sum * norm;
+  }
+}
+
+
+// One thread per row. The images here are downsampled by s, so there are few enough rows.
+__global__
+void BoxFilterRows(const cu::PtrStepSz<float> src, cu::PtrStep<float> dst, int ksize)
+{
+  const int y = blockIdx.x * blockDim.x + threadIdx.x;
+  if (y >= src.rows) {
+    return;
+  }
+
+  const int R = ksize / 2;
+  const float norm = 1.0f / static_cast<float>(ksize);
+
+  float sum = 0;
+  for (int k = -R; k <= R; ++k) {
+    sum += src(y, Reflect101(k, src.cols));
+  }
+  dst(y, 0) = sum * norm;
+
+  for (int x = 1; x < src.cols; ++x) {
+    sum += src(y, Reflect101(x + R, src.cols)) - src(y, Reflect101(x - 1 - R, src.cols));
+    dst(y, x) = sum * norm;
+  }
+}
+
+
+// Nearest neighbor downsampling, like cv::resize() with INTER_NEAREST. Also writes I^2.
+__global__
+void DownsampleGuide(const cu::PtrStepSz<float> I,
+                     float scale_x, float scale_y,
+                     cu::PtrStepSz<float> I_low,
+                     cu::PtrStep<float> II_low)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= I_low.cols || y >= I_low.rows) {
+    return;
+  }
+
+  const int sx = min(__float2int_rd(x * scale_x), I.cols - 1);
+  const int sy = min(__float2int_rd(y * scale_y), I.rows - 1);
+  const float v = I(sy, sx);
+
+  I_low(y, x) = v;
+  II_low(y, x) = v * v;
+}
+
+
+// In place: var_I = mean(I^2) - mean(I)^2.
+__global__
+void GuideVariance(const cu::PtrStepSz<float> mean_I, cu::PtrStep<float> var_I)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= mean_I.cols || y >= mean_I.rows) {
+    return;
+  }
+
+  const float m = mean_I(y, x);
+  var_I(y, x) = var_I(y, x) - m * m;
+}
+
+
+// Downsamples channel c of p (interleaved, with "channels" channels), and writes I * p.
+__global__
+void DownsampleInput(const cu::PtrStep<float> p,
+                     int p_rows, int p_cols,
+                     int channels, int c,
+                     const cu::PtrStepSz<float> I_low,
+                     float scale_x, float scale_y,
+                     cu::PtrStep<float> p_low,
+                     cu::PtrStep<float> Ip_low)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= I_low.cols || y >= I_low.rows) {
+    return;
+  }
+
+  const int sx = min(__float2int_rd(x * scale_x), p_cols - 1);
+  const int sy = min(__float2int_rd(y * scale_y), p_rows - 1);
+  const float v = p(sy, channels * sx + c);
+
+  p_low(y, x) = v;
+  Ip_low(y, x) = I_low(y, x) * v;
+}
+
+
+// The linear coefficients (q = a * I + b) of each window.
+__global__
+void GuidedCoefficients(const cu::PtrStepSz<float> mean_I,
+                        const cu::PtrStep<float> var_I,
+                        const cu::PtrStep<float> mean_p,
+                        const cu::PtrStep<float> mean_Ip,
+                        float eps,
+                        cu::PtrStep<float> a,
+                        cu::PtrStep<float> b)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= mean_I.cols || y >= mean_I.rows) {
+    return;
+  }
+
+  const float cov_Ip = mean_Ip(y, x) - mean_I(y, x) * mean_p(y, x);
+  const float ay = cov_Ip / (var_I(y, x) + eps);
+
+  a(y, x) = ay;
+  b(y, x) = mean_p(y, x) - ay * mean_I(y, x);
+}
+
+
+// Source coordinate and weight of cv::resize() with INTER_LINEAR (for float images).
+__device__ __forceinline__
+void LinearSample(int x, float scale, int src_size, int& x0, int& x1, float& w)
+{
+  const float fx = (x + 0.5f) * scale - 0.5f;
+  x0 = __float2int_rd(fx);
+  w = fx - x0;
+
+  if (x0 < 0) {
+    x0 = 0;
+    w = 0;
+  }
+  if (x0 >= src_size - 1) {
+    x0 = src_size - 1;
+    w = 0;
+  }
+  x1 = min(x0 + 1, src_size - 1);
+}
+
+
+// Upsamples mean_a and mean_b to full resolution and writes channel c of q = scale * (a * I + b).
+__global__
+void GuidedCombine(const cu::PtrStepSz<float> mean_a,
+                   const cu::PtrStep<float> mean_b,
+                   const cu::PtrStepSz<float> I,
+                   float scale_x, float scale_y,
+                   float scale,
+                   int channels, int c,
+                   cu::PtrStep<float> q)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= I.cols || y >= I.rows) {
+    return;
+  }
+
+  int x0, x1, y0, y1;
+  float wx, wy;
+  LinearSample(x, scale_x, mean_a.cols, x0, x1, wx);
+  LinearSample(y, scale_y, mean_a.rows, y0, y1, wy);
+
+  const float a = (1 - wy) * ((1 - wx) * mean_a(y0, x0) + wx * mean_a(y0, x1)) +
+                  wy * ((1 - wx) * mean_a(y1, x0) + wx * mean_a(y1, x1));
+  const float b = (1 - wy) * ((1 - wx) * mean_b(y0, x0) + wx * mean_b(y0, x1)) +
+                  wy * ((1 - wx) * mean_b(y1, x0) + wx * mean_b(y1, x1));
+
+  q(y, channels * x + c) = scale * (a * I(y, x) + b);
+}
+
+
+void BoxFilter(const cu::GpuMat& src,
+               cu::GpuMat& tmp,
+               cu::GpuMat& dst,
+               int ksize,
+               cu::Stream& stream)
+{
+  CHECK_EQ(CV_32FC1, src.type());
+  CHECK_EQ(1, ksize % 2) << "ksize must be odd" << std::endl;
+
+  tmp.create(src.size(), CV_32FC1);
+  dst.create(src.size(), CV_32FC1);
+
+  const cudaStream_t s = cu::StreamAccessor::getStream(stream);
+  const int threads = 128;
+
+  BoxFilterCols<<<cu::device::divUp(src.cols, threads), threads, 0, s>>>(src, tmp, ksize);
+  BoxFilterRows<<<cu::device::divUp(src.rows, threads), threads, 0, s>>>(tmp, dst, ksize);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+GuidedFilterGpu::GuidedFilterGpu(int r, double eps, int s)
+    : ksize_(2 * (r / s) + 1),
+      eps_(static_cast<float>(eps)),
+      s_(s)
+{
+  CHECK_GT(s, 0);
+  CHECK_GE(r, 0);
+}
+
+
+void GuidedFilterGpu::SetGuide(const cu::GpuMat& I, cu::Stream& stream)
+{
+  CHECK_EQ(CV_32FC1, I.type());
+  CHECK_GE(I.cols, s_);
+  CHECK_GE(I.rows, s_);
+
+  I.copyTo(I_, stream);
+
+  const cv::Size low_size(I.cols / s_, I.rows / s_);
+  I_low_.create(low_size, CV_32FC1);
+  Ip_low_.create(low_size, CV_32FC1);
+
+  const float scale_x = static_cast<float>(static_cast<double>(I.cols) / low_size.width);
+  const float scale_y = static_cast<float>(static_cast<double>(I.rows) / low_size.height);
+
+  const cudaStream_t s = cu::StreamAccessor::getStream(stream);
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(low_size.width, block.x),
+                  cu::device::divUp(low_size.height, block.y));
+
+  // NOTE(milo): Ip_low_ holds I^2 here, it isn't needed until filter().
+  DownsampleGuide<<<grid, block, 0, s>>>(I_, scale_x, scale_y, I_low_, Ip_low_);
+  BoxFilter(I_low_, tmp_, mean_I_, ksize_, stream);
+  BoxFilter(Ip_low_, tmp_, var_I_, ksize_, stream);
+  GuideVariance<<<grid, block, 0, s>>>(mean_I_, var_I_);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void GuidedFilterGpu::SetGuide(const Image1f& I)
+{
+  I_gpu_.upload(I);
+  SetGuide(I_gpu_);
+}
+
+
+void GuidedFilterGpu::filter(const cu::GpuMat& p,
+                             cu::GpuMat& q,
+                             cu::Stream& stream,
+                             float scale)
+{
+  CHECK(!I_.empty()) << "SetGuide() must be called first" << std::endl;
+  CHECK(p.type() == CV_32FC1 || p.type() == CV_32FC3);
+  CHECK(p.size() == I_.size());
+
+  const int channels = p.channels();
+  q.create(p.size(), p.type());
+
+  const cv::Size low_size = I_low_.size();
+  p_low_.create(low_size, CV_32FC1);
+  a_.create(low_size, CV_32FC1);
+  b_.create(low_size, CV_32FC1);
+
+  const float down_x = static_cast<float>(static_cast<double>(I_.cols) / low_size.width);
+  const float down_y = static_cast<float>(static_cast<double>(I_.rows) / low_size.height);
+  const float up_x = static_cast<float>(static_cast<double>(low_size.width) / I_.cols);
+  const float up_y = static_cast<float>(static_cast<double>(low_size.height) / I_.rows);
+
+  const cudaStream_t s = cu::StreamAccessor::getStream(stream);
+  const dim3 block(16, 16);
+  const dim3 grid_low(cu::device::divUp(low_size.width, block.x),
+                      cu::device::divUp(low_size.height, block.y));
+  const dim3 grid(cu::device::divUp(I_.cols, block.x), cu::device::divUp(I_.rows, block.y));
+
+  for (int c = 0; c < channels; ++c) {
+    DownsampleInput<<<grid_low, block, 0, s>>>(
+        p, p.rows, p.cols, channels, c, I_low_, down_x, down_y, p_low_, Ip_low_);
+    BoxFilter(p_low_, tmp_, mean_p_, ksize_, stream);
+    BoxFilter(Ip_low_, tmp_, mean_Ip_, ksize_, stream);
+
+    GuidedCoefficients<<<grid_low, block, 0, s>>>(mean_I_, var_I_, mean_p_, mean_Ip_, eps_, a_, b_);
+    BoxFilter(a_, tmp_, mean_a_, ksize_, stream);
+    BoxFilter(b_, tmp_, mean_b_, ksize_, stream);
+
+    GuidedCombine<<<grid, block, 0, s>>>(mean_a_, mean_b_, I_, up_x, up_y, scale, channels, c, q);
+  }
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+cv::Mat GuidedFilterGpu::filter(const cv::Mat& p)
+{
+  p_gpu_.upload(p);
+  filter(p_gpu_, q_gpu_);
+
+  cv::Mat q;
+  q_gpu_.download(q);
+  return q;
+}
+
+
+}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace pm {
+
+namespace cu = cv::cuda;
+using namespace core;
+
+
+// Box filter (mean over a ksize x ksize window) of a CV_32FC1 image, with the same reflect-101
+// border as cv::blur(). Separable, with a running sum down each column and then along each row,
+// so the cost doesn't depend on ksize.
+void BoxFilter(const cu::GpuMat& src,
+               cu::GpuMat& tmp,
+               cu::GpuMat& dst,
+               int ksize,
+               cu::Stream& stream = cu::Stream::Null());
+
+
+// CUDA version of imaging::FastGuidedFilter with a single channel guide (e.g the range image in
+// imaging::EstimateIlluminantRangeGuided()). The results match the CPU version up to float
+// rounding.
+//
+// All of the intermediate images are members, so after the first frame (at a given resolution)
+// nothing is allocated. The guide only has to be set again when it changes, and then the input
+// can be filtered any number of times.
+class GuidedFilterGpu final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(GuidedFilterGpu);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(GuidedFilterGpu);
+
+  // Same args as imaging::FastGuidedFilter(), without the guide.
+  GuidedFilterGpu(int r, double eps, int s);
+
+  // I is CV_32FC1. Computes the guide-dependent terms (local mean and variance of I).
+  void SetGuide(const cu::GpuMat& I, cu::Stream& stream = cu::Stream::Null());
+
+  // Uploads I first.
+  void SetGuide(const Image1f& I);
+
+  // p is CV_32FC1 or CV_32FC3 (filtered per channel), and q has the same size and type. The output
+  // is multiplied by scale (e.g 2 for the illuminant map in EstimateIlluminantRangeGuided()).
+  void filter(const cu::GpuMat& p,
+              cu::GpuMat& q,
+              cu::Stream& stream = cu::Stream::Null(),
+              float scale = 1.0f);
+
+  // Uploads p (CV_32FC1 or CV_32FC3), and downloads the result.
+  cv::Mat filter(const cv::Mat& p);
+
+ private:
+  int ksize_;       // Box filter size at the downsampled resolution.
+  float eps_;
+  int s_;
+
+  // Full resolution guide, and the downsampled guide terms.
+  cu::GpuMat I_, I_low_, mean_I_, var_I_;
+
+  // Pre-allocate these GpuMats to save on allocation time.
+  cu::GpuMat p_low_, Ip_low_, mean_p_, mean_Ip_, a_, b_, mean_a_, mean_b_, tmp_;
+  cu::GpuMat I_gpu_, p_gpu_, q_gpu_;
+};
+
+
+}
+}
@@ -1,7 +1,11 @@
 #include <opencv2/cudafilters.hpp>
 #include <opencv2/cudaimgproc.hpp>
 #include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudawarping.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
 
+#include "core/philox.hpp"
+#include "vision_core/gpu_context.hpp"
 #include "patchmatch_gpu/patchmatch_gpu.h"
 
 namespace bm {
@@ -113,6 +117,24 @@ static float L1GradientCost3x3(const cu::PtrStepSz<float> Il,
   return cost;
 }
 
+// Column in the target image that reference pixel x matches at disparity d. With match_dir = -1
+// the reference is the left image (matches are to the left), and with match_dir = 1 it's the right
+// image (matches are to the right). Clamped so that the patch stays inside the target image.
+__device__ __forceinline__
+static float MatchCol(float x, float d, int match_dir, int patch_radius, int cols)
+{
+  return (match_dir < 0) ? fmaxf(x - d, patch_radius) : fminf(x + d, cols - patch_radius - 1);
+}
+
+
+// Largest disparity at reference pixel x whose match is still inside the target image.
+__device__ __forceinline__
+static float MaxDisp(float x, int match_dir, int patch_radius, int cols)
+{
+  return (match_dir < 0) ? (x - patch_radius) : (cols - patch_radius - 1 - x);
+}
+
+
 __global__
 void PropagateRow(const cu::PtrStepSz<float> iml,
                   const cu::PtrStepSz<float> imr,
@@ -120,11 +142,13 @@ void PropagateRow(const cu::PtrStepSz<float> iml,
                   const cu::PtrStepSz<float> Gr,
                   cu::PtrStepSz<float> disp,
                   int direction,
+                  int match_dir,
                   int patch_size,
                   float alpha)
 {
   assert(patch_size % 2 != 0);
   assert(direction == -1 || direction == 1);
+  assert(match_dir == -1 || match_dir == 1);
 
   const int patch_radius = patch_size / 2;
 
@@ -159,14 +183,14 @@ void PropagateRow(const cu::PtrStepSz<float> iml,
     const float d1 = disp(tRow, col - direction);
 
     const float cost0 = L1GradientCost3x3(
-        iml, imr, Gl, Gr, tRow, col, y, fmaxf(x - d0, patch_radius), alpha);
+        iml, imr, Gl, Gr, tRow, col, y, MatchCol(x, d0, match_dir, patch_radius, iml.cols), alpha);
 
     const float cost1 = L1GradientCost3x3(
-        iml, imr, Gl, Gr, tRow, col, y, fmaxf(x - d1, patch_radius), alpha);
+        iml, imr, Gl, Gr, tRow, col, y, MatchCol(x, d1, match_dir, patch_radius, iml.cols), alpha);
 
     // If using the neighboring disp improves cost, use it (and clip to valid range).
     if (cost1 < cost0) {
-      disp(tRow, col) = fminf(d1, x - patch_radius);
+      disp(tRow, col) = fminf(d1, MaxDisp(x, match_dir, patch_radius, iml.cols));
     }
   }
 }
@@ -179,11 +203,13 @@ void PropagateCol(const cu::PtrStepSz<float> iml,
                   const cu::PtrStepSz<float> Gr,
                   cu::PtrStepSz<float> disp,
                   int direction,
+                  int match_dir,
                   int patch_size,
                   float alpha)
 {
   assert(patch_size % 2 != 0);
   assert(direction == -1 || direction == 1);
+  assert(match_dir == -1 || match_dir == 1);
 
   const int patch_radius = patch_size / 2;
   const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
@@ -210,6 +236,7 @@ void PropagateCol(const cu::PtrStepSz<float> iml,
   const int end = (direction > 0) ? maxRow : minRow;
 
   const float x = __int2float_rd(tCol);
+  const float d_max = MaxDisp(x, match_dir, patch_radius, iml.cols);
 
   for (int row = start; direction > 0 ? row < end : row > end; row += direction) {
     const float y = __int2float_rd(row);
@@ -217,14 +244,411 @@ void PropagateCol(const cu::PtrStepSz<float> iml,
     const float d1 = disp(row - direction, tCol);
 
     const float cost0 = L1GradientCost3x3(
-        iml, imr, Gl, Gr, row, tCol, y, fmaxf(x - d0, patch_radius), alpha);
+        iml, imr, Gl, Gr, row, tCol, y, MatchCol(x, d0, match_dir, patch_radius, iml.cols), alpha);
 
     const float cost1 = L1GradientCost3x3(
-        iml, imr, Gl, Gr, row, tCol, y, fmaxf(x - d1, patch_radius), alpha);
+        iml, imr, Gl, Gr, row, tCol, y, MatchCol(x, d1, match_dir, patch_radius, iml.cols), alpha);
+
+    // If using the neighboring disp improves cost, use it (and clip to valid range).
+    if (cost1 < cost0) {
+      disp(row, tCol) = fminf(d1, d_max);
+    }
+  }
+}
+
+
+TextureObject::~TextureObject()
+{
+  if (tex_ != 0) {
+    cudaDestroyTextureObject(tex_);
+  }
+}
+
+
+void TextureObject::Update(const cu::GpuMat& im)
+{
+  CV_Assert(im.type() == CV_32FC1 || im.type() == CV_16UC2);
+
+  if (tex_ != 0 && im.data == data_ && im.size() == size_ && im.step == step_) {
+    return;
+  }
+
+  if (tex_ != 0) {
+    cudaDestroyTextureObject(tex_);
+  }
+
+  cudaResourceDesc res;
+  memset(&res, 0, sizeof(res));
+  res.resType = cudaResourceTypePitch2D;
+  res.res.pitch2D.devPtr = const_cast<uchar*>(im.data);
+  res.res.pitch2D.desc = (im.type() == CV_16UC2) ? cudaCreateChannelDescHalf2() : cudaCreateChannelDesc<float>();
+  res.res.pitch2D.width = im.cols;
+  res.res.pitch2D.height = im.rows;
+  res.res.pitch2D.pitchInBytes = im.step;
+
+  cudaTextureDesc tex;
+  memset(&tex, 0, sizeof(tex));
+  tex.addressMode[0] = cudaAddressModeClamp;
+  tex.addressMode[1] = cudaAddressModeClamp;
+  tex.filterMode = cudaFilterModeLinear;
+  tex.readMode = cudaReadModeElementType;
+  tex.normalizedCoords = 0;
+
+  cudaSafeCall(cudaCreateTextureObject(&tex_, &res, &tex, nullptr));
+
+  data_ = im.data;
+  size_ = im.size();
+  step_ = im.step;
+}
+
+
+// Sample at pixel coordinates (row, col), same convention as GetSubpixel().
+__device__ __forceinline__
+static float TexSubpixel(cudaTextureObject_t tex, float row, float col)
+{
+  return tex2D<float>(tex, col + 0.5f, row + 0.5f);
+}
+
+
+// Same sample pattern as L1GradientCost3x3(), but the reference patch is read from a shared memory
+// tile (sIl, sGl with row stride "pitch", centered at (ly, lx) in tile coordinates).
+__device__ __forceinline__
+static float L1GradientCost3x3Tiled(const float* sIl,
+                                    const float* sGl,
+                                    int pitch,
+                                    int ly, int lx,
+                                    cudaTextureObject_t Ir,
+                                    cudaTextureObject_t Gr,
+                                    float yr, float xr,
+                                    float alpha)
+{
+  // Corners and center of the patch.
+  const int kDy[5] = { -1, -1, 0, 1, 1 };
+  const int kDx[5] = { -1, 1, 0, -1, 1 };
+
+  float cost = 0;
+
+  #pragma unroll
+  for (int k = 0; k < 5; ++k) {
+    const int dy = kDy[k];
+    const int dx = kDx[k];
+    const int i = (ly + dy) * pitch + (lx + dx);
+    cost += alpha       * fabsf(sIl[i] - TexSubpixel(Ir, yr + dy, xr + dx)) +
+            (1 - alpha) * fabsf(sGl[i] - TexSubpixel(Gr, yr + dy, xr + dx));
+  }
+
+  return cost;
+}
+
+
+__global__
+void PropagateRowTiled(const cu::PtrStepSz<float> iml,
+                       cudaTextureObject_t imr,
+                       const cu::PtrStepSz<float> Gl,
+                       cudaTextureObject_t Gr,
+                       cu::PtrStepSz<float> disp,
+                       int direction,
+                       int match_dir,
+                       float alpha)
+{
+  assert(direction == -1 || direction == 1);
+  assert(match_dir == -1 || match_dir == 1);
+
+  extern __shared__ float smem[];
+  const int patch_radius = 1;
+  const int pitch = iml.cols;
+  const int tile_rows = blockDim.y + 2 * patch_radius;
+  float* sIl = smem;
+  float* sGl = smem + tile_rows * pitch;
+
+  // Cooperatively load rows [y0, y0 + tile_rows) of Il and Gl (clamped to the image).
+  const int y0 = blockIdx.y * blockDim.y - patch_radius;
+  const int tid = threadIdx.y * blockDim.x + threadIdx.x;
+  for (int i = tid; i < tile_rows * pitch; i += blockDim.x * blockDim.y) {
+    const int row = min(max(y0 + i / pitch, 0), iml.rows - 1);
+    const int col = i % pitch;
+    sIl[i] = iml(row, col);
+    sGl[i] = Gl(row, col);
+  }
+  __syncthreads();
+
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  // Skip rows where there is insufficient padding for patch.
+  if (tRow < patch_radius || tRow > (iml.rows - patch_radius - 1)) {
+    return;
+  }
+
+  // Each thread gets a "chunk" of a row (with some overlap, like PropagateRow).
+  const int chunkSize = iml.cols / blockDim.x;
+  const int minCol = max((int)threadIdx.x * chunkSize - 5, patch_radius);
+  const int maxCol = min(((int)threadIdx.x + 1)*chunkSize + 5, iml.cols - patch_radius - 1);
+
+  const int start = (direction > 0) ? minCol : maxCol;
+  const int end = (direction > 0) ? maxCol : minCol;
+
+  const int ly = tRow - y0;
+  const float y = __int2float_rd(tRow);
+
+  for (int col = start; direction > 0 ? col < end : col > end; col += direction) {
+    const float x = __int2float_rd(col);
+    const float d0 = disp(tRow, col);
+    const float d1 = disp(tRow, col - direction);
+
+    const float cost0 = L1GradientCost3x3Tiled(
+        sIl, sGl, pitch, ly, col, imr, Gr, y, MatchCol(x, d0, match_dir, patch_radius, iml.cols), alpha);
+
+    const float cost1 = L1GradientCost3x3Tiled(
+        sIl, sGl, pitch, ly, col, imr, Gr, y, MatchCol(x, d1, match_dir, patch_radius, iml.cols), alpha);
 
     // If using the neighboring disp improves cost, use it (and clip to valid range).
     if (cost1 < cost0) {
-      disp(row, tCol) = fminf(d1, x - patch_radius);
+      disp(tRow, col) = fminf(d1, MaxDisp(x, match_dir, patch_radius, iml.cols));
+    }
+  }
+}
+
+
+__global__
+void PropagateColTiled(const cu::PtrStepSz<float> iml,
+                       cudaTextureObject_t imr,
+                       const cu::PtrStepSz<float> Gl,
+                       cudaTextureObject_t Gr,
+                       cu::PtrStepSz<float> disp,
+                       int direction,
+                       int match_dir,
+                       float alpha)
+{
+  assert(direction == -1 || direction == 1);
+  assert(match_dir == -1 || match_dir == 1);
+
+  extern __shared__ float smem[];
+  const int patch_radius = 1;
+  const int pitch = blockDim.x + 2 * patch_radius;
+  float* sIl = smem;
+  float* sGl = smem + iml.rows * pitch;
+
+  // Cooperatively load columns [x0, x0 + pitch) of Il and Gl (clamped to the image).
+  const int x0 = blockIdx.x * blockDim.x - patch_radius;
+  const int tid = threadIdx.y * blockDim.x + threadIdx.x;
+  for (int i = tid; i < iml.rows * pitch; i += blockDim.x * blockDim.y) {
+    const int row = i / pitch;
+    const int col = min(max(x0 + i % pitch, 0), iml.cols - 1);
+    sIl[i] = iml(row, col);
+    sGl[i] = Gl(row, col);
+  }
+  __syncthreads();
+
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+
+  // Skip cols where there is insufficient padding for patch.
+  if (tCol < patch_radius || tCol > (iml.cols - patch_radius - 1)) {
+    return;
+  }
+
+  // Each thread gets a "chunk" of a column (with some overlap, like PropagateCol).
+  const int chunkSize = iml.rows / blockDim.y;
+  const int minRow = max((int)threadIdx.y * chunkSize - 5, patch_radius);
+  const int maxRow = min(((int)threadIdx.y + 1)*chunkSize + 5, iml.rows - patch_radius - 1);
+
+  const int start = (direction > 0) ? minRow : maxRow;
+  const int end = (direction > 0) ? maxRow : minRow;
+
+  const int lx = tCol - x0;
+  const float x = __int2float_rd(tCol);
+  const float d_max = MaxDisp(x, match_dir, patch_radius, iml.cols);
+
+  for (int row = start; direction > 0 ? row < end : row > end; row += direction) {
+    const float y = __int2float_rd(row);
+    const float d0 = disp(row, tCol);
+    const float d1 = disp(row - direction, tCol);
+
+    const float cost0 = L1GradientCost3x3Tiled(
+        sIl, sGl, pitch, row, lx, imr, Gr, y, MatchCol(x, d0, match_dir, patch_radius, iml.cols), alpha);
+
+    const float cost1 = L1GradientCost3x3Tiled(
+        sIl, sGl, pitch, row, lx, imr, Gr, y, MatchCol(x, d1, match_dir, patch_radius, iml.cols), alpha);
+
+    // If using the neighboring disp improves cost, use it (and clip to valid range).
+    if (cost1 < cost0) {
+      disp(row, tCol) = fminf(d1, d_max);
+    }
+  }
+}
+
+
+// Packed |a - b| of both halves (clears the sign bits).
+__device__ __forceinline__
+static __half2 AbsDiff2(__half2 a, __half2 b)
+{
+  __half2 d = __hsub2(a, b);
+  unsigned int bits = *reinterpret_cast<unsigned int*>(&d) & 0x7fff7fffu;
+  return *reinterpret_cast<__half2*>(&bits);
+}
+
+
+// Same as TexSubpixel(), for a half2 texture (which the texture unit filters in float).
+__device__ __forceinline__
+static __half2 TexSubpixel2(cudaTextureObject_t tex, float row, float col)
+{
+  return __float22half2_rn(tex2D<float2>(tex, col + 0.5f, row + 0.5f));
+}
+
+
+// Same taps as L1GradientCost3x3Tiled(), on packed (intensity, gradient) pixels. The reference is
+// any row-major array (a shared memory tile, or a whole image), with "pitch" pixels per row. The
+// weights are (alpha, 1 - alpha), and only the final sum is converted to float.
+__device__ __forceinline__
+static float L1GradientCost3x3Half(const __half2* ref,
+                                   int pitch,
+                                   int ly, int lx,
+                                   cudaTextureObject_t target,
+                                   float yr, float xr,
+                                   __half2 weights)
+{
+  const int kDy[5] = { -1, -1, 0, 1, 1 };
+  const int kDx[5] = { -1, 1, 0, -1, 1 };
+
+  __half2 cost = __float2half2_rn(0.0f);
+
+  #pragma unroll
+  for (int k = 0; k < 5; ++k) {
+    const int dy = kDy[k];
+    const int dx = kDx[k];
+    const __half2 r = ref[(ly + dy) * pitch + (lx + dx)];
+    cost = __hfma2(weights, AbsDiff2(r, TexSubpixel2(target, yr + dy, xr + dx)), cost);
+  }
+
+  return __low2float(cost) + __high2float(cost);
+}
+
+
+// Pixels per row of a packed image in global memory (GpuMat rows are padded).
+__device__ __forceinline__
+static int PixelPitch(const cu::PtrStepSz<__half2>& im)
+{
+  return static_cast<int>(im.step / sizeof(__half2));
+}
+
+
+__global__
+void PropagateRowTiledHalf(const cu::PtrStepSz<__half2> ilg,
+                           cudaTextureObject_t irg,
+                           cu::PtrStepSz<float> disp,
+                           int direction,
+                           int match_dir,
+                           float alpha)
+{
+  assert(direction == -1 || direction == 1);
+  assert(match_dir == -1 || match_dir == 1);
+
+  // NOTE(milo): __half2 has a constructor, so the dynamic shared memory is declared as raw words.
+  extern __shared__ unsigned int smem_packed[];
+  const int patch_radius = 1;
+  const int pitch = ilg.cols;
+  const int tile_rows = blockDim.y + 2 * patch_radius;
+  __half2* sIlg = reinterpret_cast<__half2*>(smem_packed);
+
+  // Cooperatively load rows [y0, y0 + tile_rows) of Ilg (clamped to the image).
+  const int y0 = blockIdx.y * blockDim.y - patch_radius;
+  const int tid = threadIdx.y * blockDim.x + threadIdx.x;
+  for (int i = tid; i < tile_rows * pitch; i += blockDim.x * blockDim.y) {
+    const int row = min(max(y0 + i / pitch, 0), ilg.rows - 1);
+    sIlg[i] = ilg(row, i % pitch);
+  }
+  __syncthreads();
+
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (tRow < patch_radius || tRow > (ilg.rows - patch_radius - 1)) {
+    return;
+  }
+
+  const int chunkSize = ilg.cols / blockDim.x;
+  const int minCol = max((int)threadIdx.x * chunkSize - 5, patch_radius);
+  const int maxCol = min(((int)threadIdx.x + 1)*chunkSize + 5, ilg.cols - patch_radius - 1);
+
+  const int start = (direction > 0) ? minCol : maxCol;
+  const int end = (direction > 0) ? maxCol : minCol;
+
+  const int ly = tRow - y0;
+  const float y = __int2float_rd(tRow);
+  const __half2 weights = __floats2half2_rn(alpha, 1.0f - alpha);
+
+  for (int col = start; direction > 0 ? col < end : col > end; col += direction) {
+    const float x = __int2float_rd(col);
+    const float d0 = disp(tRow, col);
+    const float d1 = disp(tRow, col - direction);
+
+    const float cost0 = L1GradientCost3x3Half(
+        sIlg, pitch, ly, col, irg, y, MatchCol(x, d0, match_dir, patch_radius, ilg.cols), weights);
+
+    const float cost1 = L1GradientCost3x3Half(
+        sIlg, pitch, ly, col, irg, y, MatchCol(x, d1, match_dir, patch_radius, ilg.cols), weights);
+
+    if (cost1 < cost0) {
+      disp(tRow, col) = fminf(d1, MaxDisp(x, match_dir, patch_radius, ilg.cols));
+    }
+  }
+}
+
+
+__global__
+void PropagateColTiledHalf(const cu::PtrStepSz<__half2> ilg,
+                           cudaTextureObject_t irg,
+                           cu::PtrStepSz<float> disp,
+                           int direction,
+                           int match_dir,
+                           float alpha)
+{
+  assert(direction == -1 || direction == 1);
+  assert(match_dir == -1 || match_dir == 1);
+
+  extern __shared__ unsigned int smem_packed[];
+  const int patch_radius = 1;
+  const int pitch = blockDim.x + 2 * patch_radius;
+  __half2* sIlg = reinterpret_cast<__half2*>(smem_packed);
+
+  // Cooperatively load columns [x0, x0 + pitch) of Ilg (clamped to the image).
+  const int x0 = blockIdx.x * blockDim.x - patch_radius;
+  const int tid = threadIdx.y * blockDim.x + threadIdx.x;
+  for (int i = tid; i < ilg.rows * pitch; i += blockDim.x * blockDim.y) {
+    const int col = min(max(x0 + i % pitch, 0), ilg.cols - 1);
+    sIlg[i] = ilg(i / pitch, col);
+  }
+  __syncthreads();
+
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+
+  if (tCol < patch_radius || tCol > (ilg.cols - patch_radius - 1)) {
+    return;
+  }
+
+  const int chunkSize = ilg.rows / blockDim.y;
+  const int minRow = max((int)threadIdx.y * chunkSize - 5, patch_radius);
+  const int maxRow = min(((int)threadIdx.y + 1)*chunkSize + 5, ilg.rows - patch_radius - 1);
+
+  const int start = (direction > 0) ? minRow : maxRow;
+  const int end = (direction > 0) ? maxRow : minRow;
+
+  const int lx = tCol - x0;
+  const float x = __int2float_rd(tCol);
+  const float d_max = MaxDisp(x, match_dir, patch_radius, ilg.cols);
+  const __half2 weights = __floats2half2_rn(alpha, 1.0f - alpha);
+
+  for (int row = start; direction > 0 ? row < end : row > end; row += direction) {
+    const float y = __int2float_rd(row);
+    const float d0 = disp(row, tCol);
+    const float d1 = disp(row - direction, tCol);
+
+    const float cost0 = L1GradientCost3x3Half(
+        sIlg, pitch, row, lx, irg, y, MatchCol(x, d0, match_dir, patch_radius, ilg.cols), weights);
+
+    const float cost1 = L1GradientCost3x3Half(
+        sIlg, pitch, row, lx, irg, y, MatchCol(x, d1, match_dir, patch_radius, ilg.cols), weights);
+
+    if (cost1 < cost0) {
+      disp(row, tCol) = fminf(d1, d_max);
     }
   }
 }
@@ -236,6 +660,7 @@ void MaskBackground(const cu::PtrStepSz<float> iml,
                     const cu::PtrStepSz<float> Gl,
                     const cu::PtrStepSz<float> Gr,
                     cu::PtrStepSz<float> disp,
+                    int match_dir,
                     int patch_size,
                     float alpha,
                     float improve_factor)
@@ -261,7 +686,7 @@ void MaskBackground(const cu::PtrStepSz<float> iml,
       iml, imr, Gl, Gr, tRow, tCol, y, x, alpha);
 
   const float cost1 = L1GradientCost3x3(
-      iml, imr, Gl, Gr, tRow, tCol, y, fmaxf(x - d1, patch_radius), alpha);
+      iml, imr, Gl, Gr, tRow, tCol, y, MatchCol(x, d1, match_dir, patch_radius, iml.cols), alpha);
 
   // If the estimated disparity does not improve cost by more than improve_factor, mark as background.
   if (!(cost1 < improve_factor*cost0)) {
@@ -295,27 +720,360 @@ void MaskOcclusions(cu::PtrStepSz<float> displ,
 }
 
 
-void AddForegroundNoise(cu::GpuMat& disp, const cu::GpuMat& unit_noise, float scale, cu::GpuMat& mask)
+__global__
+void LeftRightCheck(const cu::PtrStepSz<float> iml,
+                    const cu::PtrStepSz<float> imr,
+                    const cu::PtrStepSz<float> Gl,
+                    const cu::PtrStepSz<float> Gr,
+                    cu::PtrStepSz<float> displ,
+                    const cu::PtrStepSz<float> dispr,
+                    cu::PtrStepSz<float> cost,
+                    cu::PtrStepSz<uchar> valid,
+                    float alpha)
+{
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (tRow > (displ.rows - 1) || tCol > (displ.cols - 1)) {
+    return;
+  }
+
+  const float y = __int2float_rd(tRow);
+  const float x = __int2float_rd(tCol);
+  const float dl = displ(tRow, tCol);
+  const float dr = dispr(tRow, fmaxf(x - dl, 0));
+
+  // Same test as MaskOcclusions().
+  const bool occluded = (dr > 1.4*dl || dr < 0.7*dl);
+  if (occluded) {
+    displ(tRow, tCol) = 0;
+  }
+
+  // The 3x3 cost needs a 1 pixel border.
+  const bool inside = tRow >= 1 && tRow <= (iml.rows - 2) && tCol >= 1 && tCol <= (iml.cols - 2);
+  const bool is_valid = inside && !occluded && dl > 0;
+
+  // NOTE(milo): L1GradientCost3x3() samples 5 of the 9 pixels, so this is the mean cost per tap.
+  cost(tRow, tCol) = is_valid ?
+      0.2f * L1GradientCost3x3(iml, imr, Gl, Gr, tRow, tCol, y, MatchCol(x, dl, -1, 1, iml.cols), alpha) : 0;
+  valid(tRow, tCol) = is_valid ? 255 : 0;
+}
+
+
+__global__
+void MaskBackgroundHalf(const cu::PtrStepSz<__half2> ilg,
+                        cudaTextureObject_t irg,
+                        cu::PtrStepSz<float> disp,
+                        int match_dir,
+                        float alpha,
+                        float improve_factor)
+{
+  const int patch_radius = 1;
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (tRow < (patch_radius) || tRow > (ilg.rows - patch_radius - 1) ||
+      tCol < (patch_radius) || tCol > (ilg.cols - patch_radius - 1)) {
+    return;
+  }
+
+  const float y = __int2float_rd(tRow);
+  const float x = __int2float_rd(tCol);
+  const float d1 = disp(tRow, tCol);
+  const __half2 weights = __floats2half2_rn(alpha, 1.0f - alpha);
+  const int pitch = PixelPitch(ilg);
+
+  const float cost0 = L1GradientCost3x3Half(ilg.data, pitch, tRow, tCol, irg, y, x, weights);
+  const float cost1 = L1GradientCost3x3Half(
+      ilg.data, pitch, tRow, tCol, irg, y, MatchCol(x, d1, match_dir, patch_radius, ilg.cols), weights);
+
+  if (!(cost1 < improve_factor*cost0)) {
+    disp(tRow, tCol) = 0;
+  }
+}
+
+
+__global__
+void LeftRightCheckHalf(const cu::PtrStepSz<__half2> ilg,
+                        cudaTextureObject_t irg,
+                        cu::PtrStepSz<float> displ,
+                        const cu::PtrStepSz<float> dispr,
+                        cu::PtrStepSz<float> cost,
+                        cu::PtrStepSz<uchar> valid,
+                        float alpha)
 {
-  cu::threshold(disp, mask, 0.0, 1.0, CV_THRESH_BINARY);
-  cu::scaleAdd(unit_noise, scale, disp, disp);
-  cu::multiply(disp, mask, disp);
-  cu::max(disp, 0, disp);
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (tRow > (displ.rows - 1) || tCol > (displ.cols - 1)) {
+    return;
+  }
+
+  const float y = __int2float_rd(tRow);
+  const float x = __int2float_rd(tCol);
+  const float dl = displ(tRow, tCol);
+  const float dr = dispr(tRow, fmaxf(x - dl, 0));
+
+  const bool occluded = (dr > 1.4*dl || dr < 0.7*dl);
+  if (occluded) {
+    displ(tRow, tCol) = 0;
+  }
+
+  const bool inside = tRow >= 1 && tRow <= (ilg.rows - 2) && tCol >= 1 && tCol <= (ilg.cols - 2);
+  const bool is_valid = inside && !occluded && dl > 0;
+  const __half2 weights = __floats2half2_rn(alpha, 1.0f - alpha);
+
+  cost(tRow, tCol) = is_valid ?
+      0.2f * L1GradientCost3x3Half(ilg.data, PixelPitch(ilg), tRow, tCol, irg, y, MatchCol(x, dl, -1, 1, ilg.cols), weights) : 0;
+  valid(tRow, tCol) = is_valid ? 255 : 0;
+}
+
+
+DisparityWarp MakeDisparityWarp(const PinholeCamera& cam,
+                                double baseline,
+                                const Matrix4d& prev_T_cur)
+{
+  const Matrix4d cur_T_prev = prev_T_cur.inverse();
+
+  DisparityWarp warp;
+  warp.fx = cam.fx();
+  warp.fy = cam.fy();
+  warp.cx = cam.cx();
+  warp.cy = cam.cy();
+  warp.fx_baseline = cam.fx() * baseline;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      warp.R[3*i + j] = cur_T_prev(i, j);
+    }
+    warp.t[i] = cur_T_prev(i, 3);
+  }
+
+  return warp;
+}
+
+
+__global__
+void WarpDisparity(const cu::PtrStepSz<float> disp0,
+                   cu::PtrStepSz<float> disp1,
+                   DisparityWarp warp)
+{
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (tRow >= disp0.rows || tCol >= disp0.cols) {
+    return;
+  }
+
+  const float d0 = disp0(tRow, tCol);
+  if (d0 <= 0) {
+    return;
+  }
+
+  // Backproject into the previous camera frame, then move into the current one.
+  const float z0 = warp.fx_baseline / d0;
+  const float x0 = (__int2float_rn(tCol) - warp.cx) * z0 / warp.fx;
+  const float y0 = (__int2float_rn(tRow) - warp.cy) * z0 / warp.fy;
+
+  const float* R = warp.R;
+  const float x1 = R[0]*x0 + R[1]*y0 + R[2]*z0 + warp.t[0];
+  const float y1 = R[3]*x0 + R[4]*y0 + R[5]*z0 + warp.t[1];
+  const float z1 = R[6]*x0 + R[7]*y0 + R[8]*z0 + warp.t[2];
+
+  if (z1 <= 0) {
+    return;
+  }
+
+  const int u = __float2int_rn(warp.fx * x1 / z1 + warp.cx);
+  const int v = __float2int_rn(warp.fy * y1 / z1 + warp.cy);
+
+  if (u < 0 || u >= disp1.cols || v < 0 || v >= disp1.rows) {
+    return;
+  }
+
+  // NOTE(milo): Positive floats have the same order as their bits do as ints, so atomicMax works
+  // as a z-buffer.
+  const float d1 = warp.fx_baseline / z1;
+  atomicMax(reinterpret_cast<int*>(disp1.ptr(v) + u), __float_as_int(d1));
+}
+
+
+// NOTE(milo): Same seed as the CPU Patchmatch::AddNoise().
+__global__
+void DownsampleSeeds(const cu::PtrStepSz<float> fine,
+                     cu::PtrStepSz<float> coarse)
+{
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (tRow >= coarse.rows || tCol >= coarse.cols) {
+    return;
+  }
+
+  float d = 0;
+  for (int row = 2*tRow; row < min(2*tRow + 2, fine.rows); ++row) {
+    for (int col = 2*tCol; col < min(2*tCol + 2, fine.cols); ++col) {
+      d = fmaxf(d, fine(row, col));
+    }
+  }
+
+  coarse(tRow, tCol) = 0.5f * d;
+}
+
+
+__global__
+void DilateSeeds(const cu::PtrStepSz<float> seeds,
+                 cu::PtrStepSz<float> disp)
+{
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (tRow >= seeds.rows || tCol >= seeds.cols) {
+    return;
+  }
+
+  float d = 0;
+  for (int row = max(0, tRow - 1); row <= min(seeds.rows - 1, tRow + 1); ++row) {
+    for (int col = max(0, tCol - 1); col <= min(seeds.cols - 1, tCol + 1); ++col) {
+      d = fmaxf(d, seeds(row, col));
+    }
+  }
+
+  disp(tRow, tCol) = d;
+}
+
+
+__global__
+void UpsampleDisparity(const cu::PtrStepSz<float> coarse,
+                       const cu::PtrStepSz<float> seeds,
+                       cu::PtrStepSz<float> fine)
+{
+  const int tCol = blockIdx.x * blockDim.x + threadIdx.x;
+  const int tRow = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (tRow >= fine.rows || tCol >= fine.cols) {
+    return;
+  }
+
+  // Disparity doubles along with the image width.
+  const float seed = seeds(tRow, tCol);
+  fine(tRow, tCol) = (seed > 0) ? seed : 2.0f * coarse(min(tRow / 2, coarse.rows - 1), min(tCol / 2, coarse.cols - 1));
+}
+
+
+static const uint32_t kNoiseSeed = 123;
+
+
+// Each thread does 4 pixels in a row, which is one Philox block.
+__global__
+void ForegroundNoise(cu::PtrStepSz<float> disp, float scale, uint32_t noise_stream, uint32_t iter)
+{
+  const int x0 = 4 * (blockIdx.x * blockDim.x + threadIdx.x);
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x0 >= disp.cols || y >= disp.rows) {
+    return;
+  }
+
+  const core::Philox4x32 block(x0 / 4, y, iter, 0, kNoiseSeed, noise_stream);
+  float* row = disp.ptr(y);
+
+  for (int j = 0; j < 4 && (x0 + j) < disp.cols; ++j) {
+    const float d = row[x0 + j];
+    if (d > 0) {
+      const float noise = 2.0f * core::UintToUnitFloat(block.v[j]) - 1.0f;
+      row[x0 + j] = fmaxf(0.0f, d + scale * noise);
+    }
+  }
+}
+
+
+void AddForegroundNoise(cu::GpuMat& disp,
+                        float scale,
+                        uint32_t noise_stream,
+                        uint32_t iter,
+                        cu::Stream& stream)
+{
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(cu::device::divUp(disp.cols, 4), block.x), cu::device::divUp(disp.rows, block.y));
+  ForegroundNoise<<<grid, block, 0, cu::StreamAccessor::getStream(stream)>>>(disp, scale, noise_stream, iter);
 }
 
 
 void GradientMagnitude(const cu::GpuMat& im,
                        cu::GpuMat& Gx,
                        cu::GpuMat& Gy,
-                       cu::GpuMat& Gmag)
+                       cu::GpuMat& Gmag,
+                       cu::Stream& stream)
 {
   // Compute the image gradient.
   cv::Ptr<cu::Filter> sobel_x = cu::createSobelFilter(CV_32FC1, CV_32FC1, 1, 0, 3);
   cv::Ptr<cu::Filter> sobel_y = cu::createSobelFilter(CV_32FC1, CV_32FC1, 0, 1, 3);
 
-  sobel_x->apply(im, Gx);
-  sobel_y->apply(im, Gy);
-  cu::magnitude(Gx, Gy, Gmag);
+  sobel_x->apply(im, Gx, stream);
+  sobel_y->apply(im, Gy, stream);
+  cu::magnitude(Gx, Gy, Gmag, stream);
+}
+
+
+// Same border as the OpenCV filters (BORDER_REFLECT_101).
+__device__ __forceinline__
+static int Reflect101(int i, int n)
+{
+  return (i < 0) ? -i : ((i >= n) ? 2 * n - i - 2 : i);
+}
+
+
+__global__
+void IntensityGradient(const cu::PtrStepSz<uchar> im, cu::PtrStepSz<__half2> out)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= im.cols || y >= im.rows) {
+    return;
+  }
+
+  const int r[3] = { Reflect101(y - 1, im.rows), y, Reflect101(y + 1, im.rows) };
+  const int c[3] = { Reflect101(x - 1, im.cols), x, Reflect101(x + 1, im.cols) };
+
+  float p[3][3];
+  #pragma unroll
+  for (int i = 0; i < 3; ++i) {
+    #pragma unroll
+    for (int j = 0; j < 3; ++j) {
+      p[i][j] = im(r[i], c[j]);
+    }
+  }
+
+  const float gx = (p[0][2] + 2.0f*p[1][2] + p[2][2]) - (p[0][0] + 2.0f*p[1][0] + p[2][0]);
+  const float gy = (p[2][0] + 2.0f*p[2][1] + p[2][2]) - (p[0][0] + 2.0f*p[0][1] + p[0][2]);
+  out(y, x) = __floats2half2_rn(p[1][1], sqrtf(gx*gx + gy*gy));
+}
+
+
+void PackIntensityGradient(const cu::GpuMat& im,
+                           cu::GpuMat& out,
+                           cu::Stream& stream)
+{
+  CV_Assert(im.type() == CV_8UC1);
+  out.create(im.size(), CV_16UC2);
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(im.cols, block.x), cu::device::divUp(im.rows, block.y));
+  IntensityGradient<<<grid, block, 0, cu::StreamAccessor::getStream(stream)>>>(im, out);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+// Copy an image into page-locked memory (so that it can be uploaded asynchronously).
+template <typename ImageT>
+static void CopyToHostMem(const ImageT& im, cu::HostMem& hmem)
+{
+  if (hmem.size() != im.size() || hmem.type() != im.type()) {
+    hmem = cu::HostMem(im.size(), im.type(), cu::HostMem::PAGE_LOCKED);
+  }
+  cv::Mat header = hmem.createMatHeader();
+  im.copyTo(header);
 }
 
 
@@ -324,7 +1082,18 @@ PatchmatchGpu::PatchmatchGpu(const Params& params)
       detector_(params.detector_params),
       matcher_(params.matcher_params)
 {
+  zero_copy_ = params_.zero_copy && GpuContext::Global().ZeroCopy();
 
+  // Below the VIO frontend, so that dense stereo never delays tracking.
+  for (Slot& s : slots_) {
+    s.stream = GpuContext::Global().NewStream(GpuPriority::DENSE_STEREO);
+  }
+}
+
+
+PatchmatchGpu::~PatchmatchGpu()
+{
+  Flush();
 }
 
 
@@ -333,46 +1102,390 @@ void PatchmatchGpu::Match(const Image1b& iml,
                           Image1f& disp,
                           Image1f& dispr)
 {
-  disp = SparseInit(iml, imr, params_.init_dilate_factor);
+  MatchAsync(iml, imr, [&](const DisparityMap& out, const Image1f& outr)
+  {
+    disp = out.disp;
+    dispr = outr;
+  });
+  Flush();
+}
+
+
+void PatchmatchGpu::Match(const Image1b& iml,
+                          const Image1b& imr,
+                          DisparityMap& left,
+                          Image1f& dispr)
+{
+  MatchAsync(iml, imr, [&](const DisparityMap& out, const Image1f& outr)
+  {
+    left = out;
+    dispr = outr;
+  });
+  Flush();
+}
 
-  // Only allocate the noise image once.
-  if (unit_noise_gpu_.empty()) {
-    Image1f tmp(iml.size(), 0);
-    cv::RNG rng(123);
-    rng.fill(tmp, cv::RNG::UNIFORM, -1, 1, true);
-    unit_noise_gpu_.upload(tmp);
-  }
 
-  tmp_.upload(iml);
-  tmp_.convertTo(iml_gpu_, CV_32FC1);
-  tmp_.upload(imr);
-  tmp_.convertTo(imr_gpu_, CV_32FC1);
+void PatchmatchGpu::MatchAsync(const Image1b& iml,
+                               const Image1b& imr,
+                               const Callback& callback)
+{
+  Enqueue(iml, imr, nullptr, Matrix4d::Identity(), callback);
+}
 
-  GradientMagnitude(iml_gpu_, Gx_, Gy_, Gl_);
-  GradientMagnitude(imr_gpu_, Gx_, Gy_, Gr_);
 
-  disp_gpu_.upload(disp);
-  Match(iml_gpu_, imr_gpu_, Gl_, Gr_, disp_gpu_);
+void PatchmatchGpu::MatchAsync(const Image1b& iml,
+                               const Image1b& imr,
+                               const StereoCamera& stereo_rig,
+                               const Matrix4d& prev_T_cur,
+                               const Callback& callback)
+{
+  CHECK(params_.temporal) << "Only temporal mode uses the camera motion" << std::endl;
+  CHECK_EQ(iml.rows, stereo_rig.Height());
+  CHECK_EQ(iml.cols, stereo_rig.Width());
+  Enqueue(iml, imr, &stereo_rig, prev_T_cur, callback);
+}
 
-  cu::flip(iml_gpu_, iml_gpu_flip_, 1);
-  cu::flip(imr_gpu_, imr_gpu_flip_, 1);
-  cu::flip(Gl_, Gl_flip_, 1);
-  cu::flip(Gr_, Gr_flip_, 1);
 
-  Image1b iml_flip, imr_flip;
-  cv::flip(iml, iml_flip, 1);
-  cv::flip(imr, imr_flip, 1);
-  disp = SparseInit(imr_flip, iml_flip, params_.init_dilate_factor);
-  disp_gpu_r_.upload(disp);
-  Match(imr_gpu_flip_, iml_gpu_flip_, Gr_flip_, Gl_flip_, disp_gpu_r_);
-  cu::flip(disp_gpu_r_, disp_gpu_r_, 1);
+void PatchmatchGpu::Enqueue(const Image1b& iml,
+                            const Image1b& imr,
+                            const StereoCamera* stereo_rig,
+                            const Matrix4d& prev_T_cur,
+                            const Callback& callback)
+{
+  Slot& prev = slots_[(next_slot_ + kNumSlots - 1) % kNumSlots];
+  Slot& s = slots_[next_slot_];
+  next_slot_ = (next_slot_ + 1) % kNumSlots;
+  Finish(s);
+
+  // NOTE(milo): In zero copy mode, the CPU writes straight into the memory that the GPU is using,
+  // which the streams don't order. The previous frame might still be reading this slot's disparity
+  // (temporal mode), so wait for it before the outputs are swapped out.
+  if (zero_copy_) {
+    if (params_.temporal && prev.busy) {
+      prev.computed.waitForCompletion();
+    }
+    MapOutputs(s, iml.size());
+  }
+
+  const bool has_history = params_.temporal && has_history_ && prev.disp.size() == iml.size();
+  const bool warm_start = has_history &&
+      (params_.temporal_reinit <= 0 || warm_frames_ < params_.temporal_reinit);
+  warm_frames_ = warm_start ? (warm_frames_ + 1) : 0;
+
+  // In pyramid mode, the seeds are dilated at the coarsest level instead (see MatchPyramid).
+  const bool pyramid = !warm_start && params_.pyramid_levels > 0;
+  const auto sparse_init = [&](const Image1b& il, const Image1b& ir)
+  {
+    return pyramid ? SparseSeeds(il, ir) : SparseInit(il, ir, params_.init_dilate_factor);
+  };
+
+  // NOTE(milo): The CPU init for this frame overlaps with the GPU work for the previous one. The
+  // sparse matcher only searches to the left, so the right init is done on flipped images (on the
+  // CPU), then flipped back. Nothing is flipped on the GPU.
+  if (!warm_start) {
+    Image1b iml_flip, imr_flip;
+    Image1f dispr_init;
+    cv::flip(iml, iml_flip, 1);
+    cv::flip(imr, imr_flip, 1);
+    cv::flip(sparse_init(imr_flip, iml_flip), dispr_init, 1);
+    const Image1f disp_init = sparse_init(iml, imr);
+    if (zero_copy_) {
+      disp_init.copyTo(s.m_disp);
+      dispr_init.copyTo(s.m_dispr);
+    } else {
+      CopyToHostMem(disp_init, s.h_disp);
+      CopyToHostMem(dispr_init, s.h_dispr);
+    }
+  }
+
+  // In half precision, each image and its gradient are packed straight from 8-bit (none of the float
+  // images are allocated). The coarse levels of the pyramid are always float.
+  const bool half = params_.half_precision && TilesFit(iml.rows, iml.cols, true);
+  const auto to_gpu = [&](const cu::GpuMat& im8, cu::GpuMat& im, cu::GpuMat& packed, bool left)
+  {
+    if (half) {
+      PackIntensityGradient(im8, packed, s.stream);
+    } else {
+      im8.convertTo(im, CV_32FC1, s.stream);
+    }
+    if (pyramid) {
+      DownsampleImage(s, im8, left);
+    }
+  };
+
+  if (zero_copy_) {
+    cu::GpuMat iml_mapped, imr_mapped;
+    MapInput(iml, s.m_iml, iml_mapped);
+    MapInput(imr, s.m_imr, imr_mapped);
+    to_gpu(iml_mapped, s.iml, s.ilg, true);
+    to_gpu(imr_mapped, s.imr, s.irg, false);
+  } else {
+    CopyToHostMem(iml, s.h_iml);
+    CopyToHostMem(imr, s.h_imr);
+    s.tmp.upload(s.h_iml, s.stream);
+    to_gpu(s.tmp, s.iml, s.ilg, true);
+    s.tmp.upload(s.h_imr, s.stream);
+    to_gpu(s.tmp, s.imr, s.irg, false);
+  }
+
+  // The slot is idle, so it's safe to (re)create its textures. This only happens if the GpuMats
+  // above were reallocated.
+  if (half) {
+    s.ilg_tex.Update(s.ilg);
+    s.irg_tex.Update(s.irg);
+  } else {
+    GradientMagnitude(s.iml, s.Gx, s.Gy, s.Gl, s.stream);
+    GradientMagnitude(s.imr, s.Gx, s.Gy, s.Gr, s.stream);
+    s.iml_tex.Update(s.iml);
+    s.imr_tex.Update(s.imr);
+    s.Gl_tex.Update(s.Gl);
+    s.Gr_tex.Update(s.Gr);
+  }
+
+  // NOTE(milo): In temporal mode, the previous frame might read this slot's disparity (from two
+  // frames ago) and this frame reads the previous slot's, so wait for the previous frame before
+  // either one is touched. The uploads and gradients above still overlap with it.
+  if (params_.temporal && prev.busy) {
+    s.stream.waitEvent(prev.computed);
+  }
 
   const dim3 block(16, 16);
   const dim3 grid(cu::device::divUp(iml.cols, block.x), cu::device::divUp(iml.rows, block.y));
-  MaskOcclusions<<<grid, block>>>(disp_gpu_, disp_gpu_r_);
+  cudaStream_t stream = cu::StreamAccessor::getStream(s.stream);
+
+  if (warm_start && stereo_rig != nullptr) {
+    // The right camera moved by the same amount, seen from its own frame.
+    const Matrix4d T_left_right = stereo_rig->Extrinsics().matrix();
+    const Matrix4d prevr_T_curr = T_left_right.inverse() * prev_T_cur * T_left_right;
+
+    s.disp.create(iml.size(), CV_32FC1);
+    s.dispr.create(iml.size(), CV_32FC1);
+    s.disp.setTo(0, s.stream);
+    s.dispr.setTo(0, s.stream);
+    WarpDisparity<<<grid, block, 0, stream>>>(prev.disp, s.disp,
+        MakeDisparityWarp(stereo_rig->LeftCamera(), stereo_rig->Baseline(), prev_T_cur));
+    WarpDisparity<<<grid, block, 0, stream>>>(prev.dispr, s.dispr,
+        MakeDisparityWarp(stereo_rig->RightCamera(), stereo_rig->Baseline(), prevr_T_curr));
+    cudaSafeCall(cudaGetLastError());
+  } else if (warm_start) {
+    prev.disp.copyTo(s.disp, s.stream);
+    prev.dispr.copyTo(s.dispr, s.stream);
+  } else if (!zero_copy_) {
+    s.disp.upload(s.h_disp, s.stream);
+    s.dispr.upload(s.h_dispr, s.stream);
+  }
+
+  if (pyramid) {
+    MatchPyramid(s);
+  }
+
+  // Pyramid mode only refines the upsampled disparity (see Params::pyramid_levels).
+  const int iters = pyramid ? 1 : (warm_start ? params_.temporal_iters : params_.patchmatch_iters);
+  const float noise = pyramid ? 0.0f : (warm_start ? params_.temporal_noise : 32.0f);
+  s.cost.create(iml.size(), CV_32FC1);
+  s.valid.create(iml.size(), CV_8UC1);
+
+  // The second pass is the same thing with the right image as the reference.
+  if (half) {
+    MatchHalf(s.ilg, s.irg_tex, s.disp, -1, iters, noise, 0, s.stream);
+    MatchHalf(s.irg, s.ilg_tex, s.dispr, 1, iters, noise, 1, s.stream);
+    LeftRightCheckHalf<<<grid, block, 0, stream>>>(s.ilg, s.irg_tex.get(), s.disp, s.dispr, s.cost, s.valid, params_.cost_alpha);
+  } else {
+    Match(s.iml, s.imr, s.Gl, s.Gr, s.imr_tex, s.Gr_tex, s.disp, -1, iters, noise, 0, s.stream);
+    Match(s.imr, s.iml, s.Gr, s.Gl, s.iml_tex, s.Gl_tex, s.dispr, 1, iters, noise, 1, s.stream);
+    LeftRightCheck<<<grid, block, 0, stream>>>(s.iml, s.imr, s.Gl, s.Gr, s.disp, s.dispr, s.cost, s.valid, params_.cost_alpha);
+  }
+  cudaSafeCall(cudaGetLastError());
 
-  disp_gpu_.download(disp);
-  disp_gpu_r_.download(dispr);
+  s.computed.record(s.stream);
+  has_history_ = params_.temporal;
+
+  // NOTE(milo): The inputs were already copied out of the host buffers, so they can be reused.
+  if (!zero_copy_) {
+    s.disp.download(s.h_disp, s.stream);
+    s.dispr.download(s.h_dispr, s.stream);
+    s.cost.download(s.h_cost, s.stream);
+    s.valid.download(s.h_valid, s.stream);
+  }
+
+  s.busy = true;
+  s.callback = callback;
+}
+
+
+void PatchmatchGpu::DownsampleImage(Slot& s, const cu::GpuMat& im8, bool left)
+{
+  while ((int)s.pyramid.size() < params_.pyramid_levels) {
+    s.pyramid.emplace_back(new PyramidLevel());
+  }
+
+  // The slot is idle, so its textures can be (re)created (same as in Enqueue).
+  for (int i = 0; i < params_.pyramid_levels; ++i) {
+    PyramidLevel& l = *s.pyramid.at(i);
+    const cu::GpuMat& finer = (i == 0) ? im8 : (left ? s.pyramid.at(i - 1)->im8l : s.pyramid.at(i - 1)->im8r);
+    cu::GpuMat& level8 = left ? l.im8l : l.im8r;
+    cu::GpuMat& im = left ? l.iml : l.imr;
+    cu::GpuMat& G = left ? l.Gl : l.Gr;
+
+    cu::pyrDown(finer, level8, s.stream);
+    level8.convertTo(im, CV_32FC1, s.stream);
+    GradientMagnitude(im, l.Gx, l.Gy, G, s.stream);
+    (left ? l.iml_tex : l.imr_tex).Update(im);
+    (left ? l.Gl_tex : l.Gr_tex).Update(G);
+  }
+}
+
+
+void PatchmatchGpu::MatchPyramid(Slot& s)
+{
+  const int levels = params_.pyramid_levels;
+  cudaStream_t stream = cu::StreamAccessor::getStream(s.stream);
+  const dim3 block(16, 16);
+  const auto grid = [&](const cu::GpuMat& im)
+  {
+    return dim3(cu::device::divUp(im.cols, block.x), cu::device::divUp(im.rows, block.y));
+  };
+
+  // Seeds for every level, finest first.
+  for (int i = 0; i < levels; ++i) {
+    PyramidLevel& l = *s.pyramid.at(i);
+    const cu::GpuMat& fine = (i == 0) ? s.disp : s.pyramid.at(i - 1)->seeds;
+    const cu::GpuMat& finer = (i == 0) ? s.dispr : s.pyramid.at(i - 1)->seedsr;
+    l.seeds.create(l.iml.size(), CV_32FC1);
+    l.seedsr.create(l.iml.size(), CV_32FC1);
+    DownsampleSeeds<<<grid(l.seeds), block, 0, stream>>>(fine, l.seeds);
+    DownsampleSeeds<<<grid(l.seedsr), block, 0, stream>>>(finer, l.seedsr);
+  }
+
+  // Each level starts from the one above it, and the coarsest one from the dilated seeds.
+  for (int i = levels - 1; i >= 0; --i) {
+    PyramidLevel& l = *s.pyramid.at(i);
+    l.disp.create(l.iml.size(), CV_32FC1);
+    l.dispr.create(l.iml.size(), CV_32FC1);
+
+    if (i == levels - 1) {
+      DilateSeeds<<<grid(l.disp), block, 0, stream>>>(l.seeds, l.disp);
+      DilateSeeds<<<grid(l.dispr), block, 0, stream>>>(l.seedsr, l.dispr);
+    } else {
+      const PyramidLevel& coarse = *s.pyramid.at(i + 1);
+      UpsampleDisparity<<<grid(l.disp), block, 0, stream>>>(coarse.disp, l.seeds, l.disp);
+      UpsampleDisparity<<<grid(l.dispr), block, 0, stream>>>(coarse.dispr, l.seedsr, l.dispr);
+    }
+
+    // NOTE(milo): Noise streams 0 and 1 are for full resolution.
+    const int iters = params_.pyramid_iters;
+    const float noise = params_.pyramid_noise;
+    Match(l.iml, l.imr, l.Gl, l.Gr, l.imr_tex, l.Gr_tex, l.disp, -1, iters, noise, 2 + 2*i, s.stream);
+    Match(l.imr, l.iml, l.Gr, l.Gl, l.iml_tex, l.Gl_tex, l.dispr, 1, iters, noise, 3 + 2*i, s.stream);
+  }
+
+  // The full resolution seeds are overwritten in place.
+  UpsampleDisparity<<<grid(s.disp), block, 0, stream>>>(s.pyramid.at(0)->disp, s.disp, s.disp);
+  UpsampleDisparity<<<grid(s.dispr), block, 0, stream>>>(s.pyramid.at(0)->dispr, s.dispr, s.dispr);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void PatchmatchGpu::Flush()
+{
+  for (int i = 0; i < kNumSlots; ++i) {
+    Finish(slots_[(next_slot_ + i) % kNumSlots]);
+  }
+}
+
+
+void PatchmatchGpu::Finish(Slot& s)
+{
+  if (!s.busy) {
+    return;
+  }
+  s.stream.waitForCompletion();
+  s.busy = false;
+
+  // The GPU is done with the inputs.
+  s.m_iml.release();
+  s.m_imr.release();
+
+  // Zero copy outputs are already on the host, and the slot gets new ones for its next frame (see
+  // MapOutputs), so the callback can keep these.
+  if (s.callback && zero_copy_) {
+    DisparityMap left;
+    left.disp = s.m_disp;
+    left.cost = s.m_cost;
+    left.valid = s.m_valid;
+    s.callback(left, Image1f(s.m_dispr));
+    return;
+  }
+
+  // The host buffers are reused by the next frame in this slot, so give the callback copies.
+  if (s.callback) {
+    DisparityMap left;
+    left.disp = s.h_disp.createMatHeader().clone();
+    left.cost = s.h_cost.createMatHeader().clone();
+    left.valid = s.h_valid.createMatHeader().clone();
+    s.callback(left, s.h_dispr.createMatHeader().clone());
+  }
+}
+
+
+void PatchmatchGpu::MapOutputs(Slot& s, const cv::Size& size)
+{
+  // NOTE(milo): Released first, so that the pool hands back the same images unless the last
+  // callback (or someone else) is still holding onto them.
+  const std::vector<std::pair<cv::Mat*, cu::GpuMat*>> outputs = {
+    { &s.m_disp, &s.disp }, { &s.m_dispr, &s.dispr }, { &s.m_cost, &s.cost }, { &s.m_valid, &s.valid }
+  };
+  for (const auto& out : outputs) {
+    const int type = (out.first == &s.m_valid) ? CV_8UC1 : CV_32FC1;
+    out.first->release();
+    *out.first = GpuContext::Global().GetMapped(size.height, size.width, type);
+    CHECK(GpuContext::WrapMapped(*out.first, *out.second)) << "GetMapped() didn't return host-mapped memory" << std::endl;
+  }
+}
+
+
+void PatchmatchGpu::MapInput(const Image1b& im, cv::Mat& mapped, cu::GpuMat& header)
+{
+  mapped = im;
+  if (!GpuContext::WrapMapped(mapped, header)) {
+    mapped = GpuContext::Global().GetMapped(im.rows, im.cols, im.type());
+    im.copyTo(mapped);
+    CHECK(GpuContext::WrapMapped(mapped, header)) << "GetMapped() didn't return host-mapped memory" << std::endl;
+  }
+}
+
+
+void PatchmatchGpu::Match(const cu::GpuMat& iml,
+                          const cu::GpuMat& imr,
+                          const cu::GpuMat& Gl,
+                          const cu::GpuMat& Gr,
+                          cu::GpuMat& disp,
+                          cu::Stream& stream)
+{
+  imr_tex_.Update(imr);
+  Gr_tex_.Update(Gr);
+  Match(iml, imr, Gl, Gr, imr_tex_, Gr_tex_, disp, -1, params_.patchmatch_iters, 32.0f, 0, stream);
+}
+
+
+void PatchmatchGpu::MatchHalf(const cu::GpuMat& ilg,
+                              const cu::GpuMat& irg,
+                              cu::GpuMat& disp,
+                              cu::Stream& stream)
+{
+  CHECK(TilesFit(ilg.rows, ilg.cols, true)) << "The half precision tiles don't fit" << std::endl;
+  irg_tex_.Update(irg);
+  MatchHalf(ilg, irg_tex_, disp, -1, params_.patchmatch_iters, 32.0f, 0, stream);
+}
+
+
+bool PatchmatchGpu::TilesFit(int rows, int cols, bool half_precision)
+{
+  const size_t pixel_bytes = half_precision ? sizeof(__half2) : 2 * sizeof(float);
+  const size_t row_smem = (kTiledRowsPerBlock + 2) * cols * pixel_bytes;
+  const size_t col_smem = rows * (kTiledColsPerBlock + 2) * pixel_bytes;
+  const size_t max_smem = static_cast<size_t>(kMaxSharedMemBytes);
+  return row_smem <= max_smem && col_smem <= max_smem;
 }
 
 
@@ -380,40 +1493,124 @@ void PatchmatchGpu::Match(const cu::GpuMat& iml,
                           const cu::GpuMat& imr,
                           const cu::GpuMat& Gl,
                           const cu::GpuMat& Gr,
-                          cu::GpuMat& disp)
-{
-  const int column_stripes = 16;
-  const int row_stripes = 16;
-  const dim3 row_block(column_stripes, 16);
-  const dim3 row_grid(cu::device::divUp(column_stripes, row_block.x),
-                      cu::device::divUp(iml.rows, row_block.y));
-  const dim3 col_block(16, row_stripes);
-  const dim3 col_grid(cu::device::divUp(iml.cols, row_block.x),
-                      cu::device::divUp(row_stripes, row_block.y));
-
-  for (int iter = 0; iter < params_.patchmatch_iters; ++iter) {
-    AddForegroundNoise(disp, unit_noise_gpu_, 32.0 / std::pow(2.0, (float)iter), mask_gpu_);
-    cudaDeviceSynchronize();
-    PropagateRow<<<row_grid, row_block>>>(iml, imr, Gl, Gr, disp, 1, 3, params_.cost_alpha);
-    cudaDeviceSynchronize();
-    PropagateCol<<<col_grid, col_block>>>(iml, imr, Gl, Gr, disp, 1, 3, params_.cost_alpha);
-    cudaDeviceSynchronize();
-    PropagateRow<<<row_grid, row_block>>>(iml, imr, Gl, Gr, disp, -1, 3, params_.cost_alpha);
-    cudaDeviceSynchronize();
-    PropagateCol<<<col_grid, col_block>>>(iml, imr, Gl, Gr, disp, -1, 3, params_.cost_alpha);
+                          const TextureObject& imr_tex,
+                          const TextureObject& Gr_tex,
+                          cu::GpuMat& disp,
+                          int match_dir,
+                          int iters,
+                          float noise_scale,
+                          uint32_t noise_stream,
+                          cu::Stream& stream)
+{
+  // Kernels on the same stream run in order, so there's no need to synchronize between passes.
+  cudaStream_t s = cu::StreamAccessor::getStream(stream);
+  const float alpha = params_.cost_alpha;
+
+  // NOTE(milo): Rows are swept away from the side that matches come from first. For match_dir = 1,
+  // that's the same as sweeping a flipped pair left to right.
+  const int row_dir = -match_dir;
+
+  if (params_.tiled_kernels && TilesFit(iml.rows, iml.cols)) {
+    const size_t row_smem = 2 * (kTiledRowsPerBlock + 2) * iml.cols * sizeof(float);
+    const size_t col_smem = 2 * iml.rows * (kTiledColsPerBlock + 2) * sizeof(float);
+    const dim3 row_block(kTiledRowChunks, kTiledRowsPerBlock);
+    const dim3 row_grid(1, cu::device::divUp(iml.rows, row_block.y));
+    const dim3 col_block(kTiledColsPerBlock, kTiledColChunks);
+    const dim3 col_grid(cu::device::divUp(iml.cols, col_block.x), 1);
+
+    for (int iter = 0; iter < iters; ++iter) {
+      if (noise_scale > 0) {
+        AddForegroundNoise(disp, noise_scale / std::pow(2.0, (float)iter), noise_stream, iter, stream);
+      }
+      PropagateRowTiled<<<row_grid, row_block, row_smem, s>>>(iml, imr_tex.get(), Gl, Gr_tex.get(), disp, row_dir, match_dir, alpha);
+      PropagateColTiled<<<col_grid, col_block, col_smem, s>>>(iml, imr_tex.get(), Gl, Gr_tex.get(), disp, 1, match_dir, alpha);
+      PropagateRowTiled<<<row_grid, row_block, row_smem, s>>>(iml, imr_tex.get(), Gl, Gr_tex.get(), disp, -row_dir, match_dir, alpha);
+      PropagateColTiled<<<col_grid, col_block, col_smem, s>>>(iml, imr_tex.get(), Gl, Gr_tex.get(), disp, -1, match_dir, alpha);
+    }
+  } else {
+    const int column_stripes = 16;
+    const int row_stripes = 16;
+    const dim3 row_block(column_stripes, 16);
+    const dim3 row_grid(cu::device::divUp(column_stripes, row_block.x),
+                        cu::device::divUp(iml.rows, row_block.y));
+    const dim3 col_block(16, row_stripes);
+    const dim3 col_grid(cu::device::divUp(iml.cols, row_block.x),
+                        cu::device::divUp(row_stripes, row_block.y));
+
+    for (int iter = 0; iter < iters; ++iter) {
+      if (noise_scale > 0) {
+        AddForegroundNoise(disp, noise_scale / std::pow(2.0, (float)iter), noise_stream, iter, stream);
+      }
+      PropagateRow<<<row_grid, row_block, 0, s>>>(iml, imr, Gl, Gr, disp, row_dir, match_dir, 3, alpha);
+      PropagateCol<<<col_grid, col_block, 0, s>>>(iml, imr, Gl, Gr, disp, 1, match_dir, 3, alpha);
+      PropagateRow<<<row_grid, row_block, 0, s>>>(iml, imr, Gl, Gr, disp, -row_dir, match_dir, 3, alpha);
+      PropagateCol<<<col_grid, col_block, 0, s>>>(iml, imr, Gl, Gr, disp, -1, match_dir, 3, alpha);
+    }
   }
 
   const dim3 block(16, 16);
   const dim3 grid(cu::device::divUp(iml.cols, block.x), cu::device::divUp(iml.rows, block.y));
-  MaskBackground<<<grid, block>>>(iml, imr, Gl, Gr, disp, 3, params_.cost_alpha, params_.cost_improve_factor);
+  MaskBackground<<<grid, block, 0, s>>>(iml, imr, Gl, Gr, disp, match_dir, 3, alpha, params_.cost_improve_factor);
 
-  cudaDeviceSynchronize();
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void PatchmatchGpu::MatchHalf(const cu::GpuMat& ref,
+                              const TextureObject& target_tex,
+                              cu::GpuMat& disp,
+                              int match_dir,
+                              int iters,
+                              float noise_scale,
+                              uint32_t noise_stream,
+                              cu::Stream& stream)
+{
+  cudaStream_t s = cu::StreamAccessor::getStream(stream);
+  const float alpha = params_.cost_alpha;
+  const int row_dir = -match_dir;
+
+  const size_t row_smem = (kTiledRowsPerBlock + 2) * ref.cols * sizeof(__half2);
+  const size_t col_smem = ref.rows * (kTiledColsPerBlock + 2) * sizeof(__half2);
+  const dim3 row_block(kTiledRowChunks, kTiledRowsPerBlock);
+  const dim3 row_grid(1, cu::device::divUp(ref.rows, row_block.y));
+  const dim3 col_block(kTiledColsPerBlock, kTiledColChunks);
+  const dim3 col_grid(cu::device::divUp(ref.cols, col_block.x), 1);
+  const cudaTextureObject_t tex = target_tex.get();
+
+  for (int iter = 0; iter < iters; ++iter) {
+    if (noise_scale > 0) {
+      AddForegroundNoise(disp, noise_scale / std::pow(2.0, (float)iter), noise_stream, iter, stream);
+    }
+    PropagateRowTiledHalf<<<row_grid, row_block, row_smem, s>>>(ref, tex, disp, row_dir, match_dir, alpha);
+    PropagateColTiledHalf<<<col_grid, col_block, col_smem, s>>>(ref, tex, disp, 1, match_dir, alpha);
+    PropagateRowTiledHalf<<<row_grid, row_block, row_smem, s>>>(ref, tex, disp, -row_dir, match_dir, alpha);
+    PropagateColTiledHalf<<<col_grid, col_block, col_smem, s>>>(ref, tex, disp, -1, match_dir, alpha);
+  }
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(ref.cols, block.x), cu::device::divUp(ref.rows, block.y));
+  MaskBackgroundHalf<<<grid, block, 0, s>>>(ref, tex, disp, match_dir, alpha, params_.cost_improve_factor);
+
+  cudaSafeCall(cudaGetLastError());
 }
 
 
 Image1f PatchmatchGpu::SparseInit(const Image1b& iml,
                                   const Image1b& imr,
                                   int dilate_factor)
+{
+  Image1f disps = SparseSeeds(iml, imr);
+
+  const int dilate_size = (int)std::pow(2, dilate_factor) + 1;
+  cv::Mat element = cv::getStructuringElement(
+      cv::MORPH_RECT, cv::Size(2*dilate_size+1, 2*dilate_size+1), cv::Point(dilate_size, dilate_size));
+  cv::dilate(disps, disps, element);
+
+  return disps;
+}
+
+
+Image1f PatchmatchGpu::SparseSeeds(const Image1b& iml, const Image1b& imr)
 {
   VecPoint2f left_kp;
   detector_.Detect(iml, VecPoint2f(), left_kp);
@@ -433,11 +1630,6 @@ Image1f PatchmatchGpu::SparseInit(const Image1b& iml,
     }
   }
 
-  const int dilate_size = (int)std::pow(2, dilate_factor) + 1;
-  cv::Mat element = cv::getStructuringElement(
-      cv::MORPH_RECT, cv::Size(2*dilate_size+1, 2*dilate_size+1), cv::Point(dilate_size, dilate_size));
-  cv::dilate(disps, disps, element);
-
   return disps;
 }
 
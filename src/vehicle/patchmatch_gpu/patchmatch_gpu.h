@@ -1,12 +1,19 @@
 #pragma once
 
 // #include <cuda_runtime.h>
+#include <cuda_fp16.h>
+#include <functional>
+#include <memory>
+#include <vector>
 
 #include <opencv2/core/cuda.hpp>
 #include <opencv2/core/cuda/common.hpp>
 
 #include "core/macros.hpp"
+#include "core/eigen_types.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/disparity_map.hpp"
+#include "vision_core/stereo_camera.hpp"
 #include "params/params_base.hpp"
 #include "params/yaml_parser.hpp"
 #include "feature_tracking/feature_detector.hpp"
@@ -24,6 +31,32 @@ __device__ __forceinline__
 T GetSubpixel(const cu::PtrStepSz<T> im, float row, float col);
 
 
+// A float texture over a CV_32FC1 GpuMat, with hardware bilinear filtering and clamped borders. A
+// CV_16UC2 GpuMat is taken as half2 pixels (see PackIntensityGradient), and is read as float2.
+class TextureObject final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(TextureObject);
+
+  TextureObject() = default;
+  ~TextureObject();
+
+  // (Re)creates the texture, unless it was already made for this image. The texture must not be in
+  // use by a kernel when that happens.
+  void Update(const cu::GpuMat& im);
+
+  cudaTextureObject_t get() const { return tex_; }
+
+ private:
+  cudaTextureObject_t tex_ = 0;
+  const uchar* data_ = nullptr;
+  cv::Size size_;
+  size_t step_ = 0;
+};
+
+
+// Row and column propagation passes. iml/Gl are the reference image, and disparities are matched
+// in imr/Gr. With match_dir = -1 the reference is the left image (matches are at x - d), and with
+// match_dir = 1 it's the right image (matches are at x + d), so neither image needs to be flipped.
 __global__
 void PropagateRow(const cu::PtrStepSz<float> iml,
                   const cu::PtrStepSz<float> imr,
@@ -31,6 +64,7 @@ void PropagateRow(const cu::PtrStepSz<float> iml,
                   const cu::PtrStepSz<float> Gr,
                   cu::PtrStepSz<float> disp,
                   int direction,
+                  int match_dir,
                   int patch_size,
                   float alpha);
 
@@ -42,16 +76,74 @@ void PropagateCol(const cu::PtrStepSz<float> iml,
                   const cu::PtrStepSz<float> Gr,
                   cu::PtrStepSz<float> disp,
                   int direction,
+                  int match_dir,
                   int patch_size,
                   float alpha);
 
 
+// Same as PropagateRow() with a 3x3 patch, but each block first copies the rows of iml/Gl that it
+// reads (plus a 1 pixel apron) into shared memory, and imr/Gr are sampled through textures (the
+// bilinear interpolation is done by the texture unit).
+// Launch with blockDim = (kTiledRowChunks, kTiledRowsPerBlock), one block per kTiledRowsPerBlock
+// rows, and 2 * (kTiledRowsPerBlock + 2) * iml.cols floats of shared memory.
+//
+// NOTE(milo): Texture filtering uses 8-bit fixed point weights, so costs differ from GetSubpixel()
+// by a tiny amount. That can flip near-ties, but doesn't change the result otherwise.
+__global__
+void PropagateRowTiled(const cu::PtrStepSz<float> iml,
+                       cudaTextureObject_t imr,
+                       const cu::PtrStepSz<float> Gl,
+                       cudaTextureObject_t Gr,
+                       cu::PtrStepSz<float> disp,
+                       int direction,
+                       int match_dir,
+                       float alpha);
+
+
+// Same as PropagateCol(), tiled like PropagateRowTiled(). Launch with blockDim = (kTiledColsPerBlock,
+// kTiledColChunks), one block per kTiledColsPerBlock columns, and 2 * iml.rows *
+// (kTiledColsPerBlock + 2) floats of shared memory.
+__global__
+void PropagateColTiled(const cu::PtrStepSz<float> iml,
+                       cudaTextureObject_t imr,
+                       const cu::PtrStepSz<float> Gl,
+                       cudaTextureObject_t Gr,
+                       cu::PtrStepSz<float> disp,
+                       int direction,
+                       int match_dir,
+                       float alpha);
+
+
+// Half precision versions of PropagateRowTiled() and PropagateColTiled() (see
+// Params::half_precision). The reference image is one packed (intensity, gradient) half2 image
+// from PackIntensityGradient(), and the target is a texture over the other one, so each tap is one
+// shared memory read and one texture fetch, and the cost is summed with packed half2 math. Launch
+// like the float kernels, with half the shared memory (one half2 instead of two floats per pixel).
+__global__
+void PropagateRowTiledHalf(const cu::PtrStepSz<__half2> ilg,
+                           cudaTextureObject_t irg,
+                           cu::PtrStepSz<float> disp,
+                           int direction,
+                           int match_dir,
+                           float alpha);
+
+
+__global__
+void PropagateColTiledHalf(const cu::PtrStepSz<__half2> ilg,
+                           cudaTextureObject_t irg,
+                           cu::PtrStepSz<float> disp,
+                           int direction,
+                           int match_dir,
+                           float alpha);
+
+
 __global__
 void MaskBackground(const cu::PtrStepSz<float> iml,
                     const cu::PtrStepSz<float> imr,
                     const cu::PtrStepSz<float> Gl,
                     const cu::PtrStepSz<float> Gr,
                     cu::PtrStepSz<float> disp,
+                    int match_dir,
                     int patch_size,
                     float alpha,
                     float improve_factor);
@@ -62,16 +154,110 @@ void MaskOcclusions(cu::PtrStepSz<float> displ,
                     cu::PtrStepSz<float> dispr);
 
 
+// Fuses MaskOcclusions() with the outputs of a DisparityMap: in one pass over the left image, it
+// zeros occluded pixels in displ, writes the (per tap) matching cost at the final disparity, and
+// sets valid to 255 where displ is foreground and passed the left-right check.
+__global__
+void LeftRightCheck(const cu::PtrStepSz<float> iml,
+                    const cu::PtrStepSz<float> imr,
+                    const cu::PtrStepSz<float> Gl,
+                    const cu::PtrStepSz<float> Gr,
+                    cu::PtrStepSz<float> displ,
+                    const cu::PtrStepSz<float> dispr,
+                    cu::PtrStepSz<float> cost,
+                    cu::PtrStepSz<uchar> valid,
+                    float alpha);
+
+
+// Same as MaskBackground() with a 3x3 patch, and LeftRightCheck(), on packed half2 images.
+__global__
+void MaskBackgroundHalf(const cu::PtrStepSz<__half2> ilg,
+                        cudaTextureObject_t irg,
+                        cu::PtrStepSz<float> disp,
+                        int match_dir,
+                        float alpha,
+                        float improve_factor);
+
+
+__global__
+void LeftRightCheckHalf(const cu::PtrStepSz<__half2> ilg,
+                        cudaTextureObject_t irg,
+                        cu::PtrStepSz<float> displ,
+                        const cu::PtrStepSz<float> dispr,
+                        cu::PtrStepSz<float> cost,
+                        cu::PtrStepSz<uchar> valid,
+                        float alpha);
+
+
+// Reprojects disparities from a previous frame into the current one, for a rectified camera that
+// moved by prev_T_cur. Passed to WarpDisparity() by value.
+struct DisparityWarp final {
+  float fx, fy, cx, cy;
+  float fx_baseline;    // depth = fx_baseline / disp
+  float R[9];           // Row-major rotation of cur_T_prev.
+  float t[3];           // Translation of cur_T_prev.
+};
+
+
+DisparityWarp MakeDisparityWarp(const PinholeCamera& cam,
+                                double baseline,
+                                const Matrix4d& prev_T_cur);
+
+
+// Forward-warps disp0 into disp1, which must be zeroed first. Where several pixels land on the same
+// location, the largest (closest) disparity wins. Pixels with zero disparity are skipped.
+__global__
+void WarpDisparity(const cu::PtrStepSz<float> disp0,
+                   cu::PtrStepSz<float> disp1,
+                   DisparityWarp warp);
+
+
+// Pyramid mode (see PatchmatchGpu::Params::pyramid_levels). Halves the resolution of sparse
+// disparities: each pixel gets the largest disparity in its 2x2 block of fine (halved), so that no
+// seed is dropped. coarse is the size that cv::cuda::pyrDown() makes.
+__global__
+void DownsampleSeeds(const cu::PtrStepSz<float> fine,
+                     cu::PtrStepSz<float> coarse);
+
+
+// Spreads the seeds at the coarsest level over a 3x3 neighborhood (the largest disparity wins).
+__global__
+void DilateSeeds(const cu::PtrStepSz<float> seeds,
+                 cu::PtrStepSz<float> disp);
+
+
+// Upsamples a coarse disparity to the next level (doubling it), and keeps the seeds wherever there
+// are any. seeds and fine can be the same image.
+__global__
+void UpsampleDisparity(const cu::PtrStepSz<float> coarse,
+                       const cu::PtrStepSz<float> seeds,
+                       cu::PtrStepSz<float> fine);
+
+
+// Adds uniform noise in [-scale, scale) to every pixel with a positive disparity (and clamps it at
+// zero). The noise is drawn inside the kernel from Philox (core/philox.hpp), keyed by noise_stream
+// and counted by (pixel, iter), so every pass gets fresh noise without keeping an image of it, and
+// the result is reproducible.
 void AddForegroundNoise(cu::GpuMat& disp,
-                        const cu::GpuMat& unit_noise,
                         float scale,
-                        cu::GpuMat& mask);
+                        uint32_t noise_stream,
+                        uint32_t iter,
+                        cu::Stream& stream = cu::Stream::Null());
 
 
 void GradientMagnitude(const cu::GpuMat& im,
                        cu::GpuMat& Gx,
                        cu::GpuMat& Gy,
-                       cu::GpuMat& Gmag);
+                       cu::GpuMat& Gmag,
+                       cu::Stream& stream = cu::Stream::Null());
+
+
+// Packs an 8-bit image and its gradient magnitude (3x3 Sobel, same as GradientMagnitude()) into
+// one half2 per pixel, stored in a CV_16UC2 GpuMat (OpenCV 3 has no half type). This replaces the
+// float image, Gx, Gy and magnitude buffers at a quarter of the memory.
+void PackIntensityGradient(const cu::GpuMat& im,
+                           cu::GpuMat& out,
+                           cu::Stream& stream = cu::Stream::Null());
 
 
 class PatchmatchGpu final {
@@ -87,40 +273,242 @@ class PatchmatchGpu final {
     int init_dilate_factor = 4;
     float cost_improve_factor = 0.8;
 
+    // Use the shared memory / texture kernels when the tiles fit (see TilesFit()).
+    bool tiled_kernels = true;
+
+    // Temporal mode: start each frame from the previous frame's disparity (see MatchAsync()) instead
+    // of SparseInit(), and run temporal_iters iterations with temporal_noise (instead of 32 px).
+    bool temporal = false;
+    int temporal_iters = 1;
+    float temporal_noise = 4.0;
+    int temporal_reinit = 30;     // Re-seed from SparseInit() every this many frames (0 = never).
+
+    // Pyramid mode: frames that start from the sparse matches (i.e not temporal warm starts) first
+    // run pyramid_iters iterations at each of pyramid_levels coarse levels (e.g 2 means 1/4, then 1/2
+    // resolution), and upsample the disparity to the next level. Only one iteration (without noise)
+    // runs at full resolution. The sparse matches are re-applied at every level, so they act as
+    // anchors. 0 turns this off.
+    int pyramid_levels = 0;
+    int pyramid_iters = 2;
+    float pyramid_noise = 2.0;    // Noise (in pixels of disparity) at the coarse levels.
+
+    // On a GPU that shares memory with the CPU (see GpuContext::ZeroCopy()), read the images and
+    // write the outputs in host-mapped memory instead of uploading and downloading them. This is
+    // ignored on a discrete GPU, where the copies are faster.
+    bool zero_copy = true;
+
+    // Store the images and gradients as half2 (see PackIntensityGradient), and sum matching costs in
+    // half2 instead of float. This halves the memory that the propagation passes read, and the
+    // disparities only change where costs were within half precision of a tie. Disparities are
+    // still float. Only the tiled kernels have a half version, so images that the tiles don't fit
+    // use the float path.
+    bool half_precision = false;
+
    private:
     void LoadParams(const YamlParser& p) override;
   };
 
+  // Receives the left disparity (with its cost and left-right check) and the right disparity for a
+  // frame passed to MatchAsync(). The map's downsample is always 1.
+  typedef std::function<void(const DisparityMap& left, const Image1f& dispr)> Callback;
+
+  // Number of frames that can be in flight at once (see MatchAsync()).
+  static const int kNumSlots = 2;
+
+  // Launch shape of the tiled kernels.
+  static const int kTiledRowChunks = 16;      // Threads along each row in PropagateRowTiled.
+  static const int kTiledRowsPerBlock = 4;    // Rows per block in PropagateRowTiled.
+  static const int kTiledColsPerBlock = 8;    // Columns per block in PropagateColTiled.
+  static const int kTiledColChunks = 16;      // Threads along each column in PropagateColTiled.
+  static const int kMaxSharedMemBytes = 48 * 1024;
+
   MACRO_DELETE_COPY_CONSTRUCTORS(PatchmatchGpu);
 
   PatchmatchGpu(const Params& params);
 
+  // Finishes any frames that are still in flight (and runs their callbacks).
+  ~PatchmatchGpu();
+
  public:
+  // Blocking version of MatchAsync().
   void Match(const Image1b& iml,
              const Image1b& imr,
              Image1f& disp,
              Image1f& dispr);
 
+  // Same as above, but also returns the cost and left-right check for the left disparity.
+  void Match(const Image1b& iml,
+             const Image1b& imr,
+             DisparityMap& left,
+             Image1f& dispr);
+
+  // Runs the sparse init on the calling thread, then enqueues the rest of the frame (upload,
+  // propagation, occlusion masking and download) on one of kNumSlots streams and returns. Each slot
+  // has its own page-locked host buffers and GpuMats, so the upload of frame N+1 overlaps the
+  // compute of frame N and the download of frame N-1.
+  //
+  // In zero copy mode, nothing is uploaded or downloaded. Images from GpuContext::GetMapped() (e.g
+  // from an ImageSubscriber that decodes into them) are read in place, and must not be written to
+  // until the frame's callback has run. The callback gets the outputs in place too.
+  //
+  // This only blocks if the slot is still busy with the frame from kNumSlots calls ago. That frame's
+  // callback is run (on the calling thread) before the slot is reused. Call Flush() to finish all of
+  // the frames that are still in flight.
+  //
+  // In temporal mode, the disparity from the previous call is reused as the initialization (it stays
+  // on the GPU, so the sparse init is skipped), which assumes that the camera barely moved.
+  void MatchAsync(const Image1b& iml,
+                  const Image1b& imr,
+                  const Callback& callback);
+
+  // Temporal mode only. Same as above, but the previous disparity is first reprojected by the camera
+  // motion since the last call (e.g from the frontend). stereo_rig must have the same resolution as
+  // iml, i.e be rescaled if the images were downsampled.
+  void MatchAsync(const Image1b& iml,
+                  const Image1b& imr,
+                  const StereoCamera& stereo_rig,
+                  const Matrix4d& prev_T_cur,
+                  const Callback& callback);
+
+  // Forgets the previous disparity, so that the next frame starts from SparseInit() (e.g after the
+  // tracking was lost).
+  void ResetTemporal() { has_history_ = false; }
+
+  // Change the number of iterations for frames that start from SparseInit() (e.g when switching
+  // performance profiles). Call this from the thread that calls MatchAsync(), between frames.
+  void SetIters(int patchmatch_iters) { params_.patchmatch_iters = patchmatch_iters; }
+
+  // Waits for all in-flight frames (oldest first) and runs their callbacks.
+  void Flush();
+
+  // Enqueues the Patchmatch iterations for disp (the left image disparity) on stream. Nothing is
+  // synchronized, so disp is only ready once the stream is.
   void Match(const cu::GpuMat& iml,
              const cu::GpuMat& imr,
              const cu::GpuMat& Gl,
              const cu::GpuMat& Gr,
-             cu::GpuMat& disp);
+             cu::GpuMat& disp,
+             cu::Stream& stream = cu::Stream::Null());
 
+  // Same as above, on images from PackIntensityGradient() (see Params::half_precision). The tiles
+  // must fit (see TilesFit).
+  void MatchHalf(const cu::GpuMat& ilg,
+                 const cu::GpuMat& irg,
+                 cu::GpuMat& disp,
+                 cu::Stream& stream = cu::Stream::Null());
+
+  // Sparse stereo matches (see SparseSeeds), dilated by 2^dilate_factor + 1 pixels.
   Image1f SparseInit(const Image1b& iml,
                      const Image1b& imr,
                      int dilate_factor);
 
+  // Disparities of the keypoints in iml that matched into imr, and zero everywhere else.
+  Image1f SparseSeeds(const Image1b& iml, const Image1b& imr);
+
+  // Whether the tiled kernels' shared memory fits for an image this size. The tiles hold whole rows
+  // (or columns), so this is true for the downsampled images that Patchmatch is usually run on. The
+  // half precision tiles are half the size, so they fit images twice as large.
+  static bool TilesFit(int rows, int cols, bool half_precision = false);
+
+ private:
+  // One coarse level of the pyramid mode in a slot. Level i is at 1/2^(i+1) resolution.
+  struct PyramidLevel final {
+    cu::GpuMat im8l, im8r, iml, imr, Gx, Gy, Gl, Gr, seeds, seedsr, disp, dispr;
+    TextureObject iml_tex, imr_tex, Gl_tex, Gr_tex;
+  };
+
+  // Everything that one in-flight frame needs.
+  struct Slot final {
+    cu::Stream stream;
+    cu::HostMem h_iml, h_imr, h_disp, h_dispr, h_cost, h_valid;
+    cu::GpuMat tmp, iml, imr, Gx, Gy, Gl, Gr, disp, dispr, cost, valid;
+
+    // Half precision only: packed (intensity, gradient) images, instead of iml, imr, Gl and Gr.
+    cu::GpuMat ilg, irg;
+    TextureObject ilg_tex, irg_tex;
+
+    // Zero copy only: the host-mapped outputs (disp, dispr, cost and valid are headers over them),
+    // and the inputs, which are kept around until the GPU is done reading them.
+    cv::Mat m_disp, m_dispr, m_cost, m_valid;
+    cv::Mat m_iml, m_imr;
+    TextureObject iml_tex, imr_tex, Gl_tex, Gr_tex;
+
+    // Pyramid mode only, finest level first.
+    std::vector<std::unique_ptr<PyramidLevel>> pyramid;
+
+    // Recorded once disp and dispr are final, so that the next frame can warm-start from them.
+    cu::Event computed;
+
+    bool busy = false;
+    Callback callback;
+  };
+
+  // Shared by both MatchAsync(). stereo_rig is null if the previous disparity shouldn't be warped.
+  void Enqueue(const Image1b& iml,
+               const Image1b& imr,
+               const StereoCamera* stereo_rig,
+               const Matrix4d& prev_T_cur,
+               const Callback& callback);
+
+  // See PropagateRow() for match_dir. imr_tex and Gr_tex must be textures over imr and Gr. The noise
+  // added before each of the iters iterations starts at noise_scale and halves every time, and is
+  // drawn from noise_stream (see AddForegroundNoise).
+  void Match(const cu::GpuMat& iml,
+             const cu::GpuMat& imr,
+             const cu::GpuMat& Gl,
+             const cu::GpuMat& Gr,
+             const TextureObject& imr_tex,
+             const TextureObject& Gr_tex,
+             cu::GpuMat& disp,
+             int match_dir,
+             int iters,
+             float noise_scale,
+             uint32_t noise_stream,
+             cu::Stream& stream);
+
+  // Half precision version of the Match() above. ref is the packed reference image, and target_tex
+  // a texture over the other one.
+  void MatchHalf(const cu::GpuMat& ref,
+                 const TextureObject& target_tex,
+                 cu::GpuMat& disp,
+                 int match_dir,
+                 int iters,
+                 float noise_scale,
+                 uint32_t noise_stream,
+                 cu::Stream& stream);
+
+  // Pyramid mode: builds the slot's coarse levels for one image (the left one if left is true) from
+  // the full resolution 8-bit image.
+  void DownsampleImage(Slot& s, const cu::GpuMat& im8, bool left);
+
+  // Pyramid mode: s.disp and s.dispr hold the full resolution seeds (see SparseSeeds). Runs the
+  // coarse levels, coarsest first, and leaves the upsampled disparities in s.disp and s.dispr.
+  void MatchPyramid(Slot& s);
+
+  void Finish(Slot& slot);
+
+  // Zero copy only: point the slot's outputs at host-mapped images of this size.
+  void MapOutputs(Slot& s, const cv::Size& size);
+
+  // Zero copy only: a GpuMat header over im, copying im into host-mapped memory if it isn't already.
+  static void MapInput(const Image1b& im, cv::Mat& mapped, cu::GpuMat& header);
+
  private:
   Params params_;
+  bool zero_copy_ = false;    // params_.zero_copy, and the GPU supports it.
 
   ft::FeatureDetector detector_;
   ft::StereoMatcher matcher_;
 
-  // Pre-allocate these GpuMats to save on allocation time.
-  cu::GpuMat mask_gpu_, unit_noise_gpu_;
-  cu::GpuMat iml_gpu_, imr_gpu_, Gx_, Gy_, Gl_, Gr_, disp_gpu_, tmp_;
-  cu::GpuMat iml_gpu_flip_, imr_gpu_flip_, Gl_flip_, Gr_flip_, disp_gpu_r_;
+  // NOTE(milo): Used by the public GpuMat Match(), so calls with different images shouldn't overlap.
+  TextureObject imr_tex_, Gr_tex_, irg_tex_;
+
+  Slot slots_[kNumSlots];
+  int next_slot_ = 0;
+
+  // Whether the last slot has a disparity to warm-start from, and how many frames in a row have.
+  bool has_history_ = false;
+  int warm_frames_ = 0;
 };
 
 }
@@ -0,0 +1,241 @@
+#include <math_constants.h>
+
+#include <glog/logging.h>
+
+#include <thrust/binary_search.h>
+#include <thrust/device_ptr.h>
+#include <thrust/execution_policy.h>
+#include <thrust/functional.h>
+#include <thrust/reduce.h>
+#include <thrust/sort.h>
+
+#include <opencv2/core/cuda/common.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#include "patchmatch_gpu/point_cloud_gpu.h"
+
+namespace bm {
+namespace pm {
+
+
+// Voxel coordinates are packed into 21 bits each, centered on the camera.
+static const int kVoxelBits = 21;
+static const long long kVoxelOffset = 1LL << (kVoxelBits - 1);
+static const unsigned long long kInvalidKey = ~0ULL;
+
+
+void PointCloudGpu::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("min_disp", &min_disp);
+  parser.GetParam("max_range", &max_range);
+  parser.GetParam("voxel_size", &voxel_size);
+}
+
+
+__global__
+void DisparityToPointCloud(const cu::PtrStepSz<float> disp,
+                           cu::PtrStep<float> range,
+                           cu::PtrStep<float3> xyz,
+                           Backprojection bp)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= disp.cols || y >= disp.rows) {
+    return;
+  }
+
+  const float d = disp(y, x);
+  const float nan = CUDART_NAN_F;
+
+  if (!(d >= bp.min_disp)) {
+    range(y, x) = 0;
+    xyz(y, x) = make_float3(nan, nan, nan);
+    return;
+  }
+
+  const float z = bp.fx_baseline / d;
+  const float3 p = make_float3((__int2float_rn(x) - bp.cx) * z / bp.fx,
+                               (__int2float_rn(y) - bp.cy) * z / bp.fy,
+                               z);
+  const float r = norm3df(p.x, p.y, p.z);
+
+  if (r > bp.max_range) {
+    range(y, x) = 0;
+    xyz(y, x) = make_float3(nan, nan, nan);
+    return;
+  }
+
+  range(y, x) = r;
+  xyz(y, x) = p;
+}
+
+
+// Voxel key and (x, y, z, 1) of each pixel, flattened in row-major order. Invalid points get
+// kInvalidKey, so they sort to the end.
+__global__
+void VoxelKeys(const cu::PtrStepSz<float3> xyz,
+               float voxel_size,
+               unsigned long long* keys,
+               float4* values)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= xyz.cols || y >= xyz.rows) {
+    return;
+  }
+
+  const int i = y * xyz.cols + x;
+  const float3 p = xyz(y, x);
+
+  const long long vx = __float2ll_rd(p.x / voxel_size) + kVoxelOffset;
+  const long long vy = __float2ll_rd(p.y / voxel_size) + kVoxelOffset;
+  const long long vz = __float2ll_rd(p.z / voxel_size) + kVoxelOffset;
+  const long long vmax = 1LL << kVoxelBits;
+
+  // NOTE(milo): NaN fails every comparison, so check for valid points rather than invalid ones.
+  const bool valid = (p.z > 0) &&
+                     vx >= 0 && vx < vmax && vy >= 0 && vy < vmax && vz >= 0 && vz < vmax;
+
+  if (!valid) {
+    keys[i] = kInvalidKey;
+    values[i] = make_float4(0, 0, 0, 0);
+    return;
+  }
+
+  keys[i] = (static_cast<unsigned long long>(vx) << (2 * kVoxelBits)) |
+            (static_cast<unsigned long long>(vy) << kVoxelBits) |
+            static_cast<unsigned long long>(vz);
+  values[i] = make_float4(p.x, p.y, p.z, 1);
+}
+
+
+struct Float4Sum final {
+  __host__ __device__
+  float4 operator()(const float4& a, const float4& b) const
+  {
+    return make_float4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w);
+  }
+};
+
+
+__global__
+void VoxelCentroids(const float4* sums, int num_voxels, cu::PtrStep<float3> points)
+{
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num_voxels) {
+    return;
+  }
+
+  const float4 s = sums[i];
+  points(0, i) = make_float3(s.x / s.w, s.y / s.w, s.z / s.w);
+}
+
+
+PointCloudGpu::PointCloudGpu(const Params& params, const StereoCamera& stereo_rig)
+    : params_(params)
+{
+  CHECK_GT(params_.min_disp, 0);
+  CHECK_GT(params_.max_range, 0);
+
+  bp_.fx = stereo_rig.fx();
+  bp_.fy = stereo_rig.fy();
+  bp_.cx = stereo_rig.cx();
+  bp_.cy = stereo_rig.cy();
+  bp_.fx_baseline = stereo_rig.fx() * stereo_rig.Baseline();
+  bp_.min_disp = params_.min_disp;
+  bp_.max_range = params_.max_range;
+}
+
+
+void PointCloudGpu::Compute(const cu::GpuMat& disp,
+                            cu::GpuMat& range,
+                            cu::GpuMat& xyz,
+                            cu::Stream& stream)
+{
+  CHECK_EQ(CV_32FC1, disp.type());
+
+  range.create(disp.size(), CV_32FC1);
+  xyz.create(disp.size(), CV_32FC3);
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(disp.cols, block.x), cu::device::divUp(disp.rows, block.y));
+  DisparityToPointCloud<<<grid, block, 0, cu::StreamAccessor::getStream(stream)>>>(disp, range, xyz, bp_);
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+void PointCloudGpu::VoxelDownsample(const cu::GpuMat& xyz,
+                                    cu::GpuMat& points,
+                                    cu::Stream& stream)
+{
+  CHECK_EQ(CV_32FC3, xyz.type());
+  CHECK_GT(params_.voxel_size, 0);
+
+  // NOTE(milo): thrust works on flat arrays, so the keys (uint64) and sums (float4) are stored in
+  // single row GpuMats of the same element size.
+  const int N = xyz.rows * xyz.cols;
+  keys_.create(1, N, CV_32SC2);
+  sums_.create(1, N, CV_32FC4);
+  voxel_keys_.create(1, N, CV_32SC2);
+  voxel_sums_.create(1, N, CV_32FC4);
+
+  unsigned long long* keys = keys_.ptr<unsigned long long>();
+  float4* sums = sums_.ptr<float4>();
+  cudaStream_t s = cu::StreamAccessor::getStream(stream);
+
+  const dim3 block(16, 16);
+  const dim3 grid(cu::device::divUp(xyz.cols, block.x), cu::device::divUp(xyz.rows, block.y));
+  VoxelKeys<<<grid, block, 0, s>>>(xyz, params_.voxel_size, keys, sums);
+  cudaSafeCall(cudaGetLastError());
+
+  const thrust::device_ptr<unsigned long long> keys_begin = thrust::device_pointer_cast(keys);
+  const thrust::device_ptr<float4> sums_begin = thrust::device_pointer_cast(sums);
+  thrust::sort_by_key(thrust::cuda::par.on(s), keys_begin, keys_begin + N, sums_begin);
+
+  // Invalid points are at the end, so only reduce up to the first one.
+  const thrust::device_ptr<unsigned long long> keys_end =
+      thrust::lower_bound(thrust::cuda::par.on(s), keys_begin, keys_begin + N, kInvalidKey);
+
+  const thrust::device_ptr<unsigned long long> voxel_keys_begin =
+      thrust::device_pointer_cast(voxel_keys_.ptr<unsigned long long>());
+  const thrust::device_ptr<float4> voxel_sums_begin =
+      thrust::device_pointer_cast(voxel_sums_.ptr<float4>());
+
+  const auto voxels_end = thrust::reduce_by_key(
+      thrust::cuda::par.on(s), keys_begin, keys_end, sums_begin, voxel_keys_begin, voxel_sums_begin,
+      thrust::equal_to<unsigned long long>(), Float4Sum());
+  const int num_voxels = static_cast<int>(voxels_end.first - voxel_keys_begin);
+
+  if (num_voxels == 0) {
+    points.release();
+    return;
+  }
+
+  points.create(1, num_voxels, CV_32FC3);
+  VoxelCentroids<<<cu::device::divUp(num_voxels, 128), 128, 0, s>>>(
+      voxel_sums_.ptr<float4>(), num_voxels, points);
+  cudaSafeCall(cudaGetLastError());
+  stream.waitForCompletion();
+}
+
+
+void PointCloudGpu::Compute(const Image1f& disp, Image1f& range, Image3f& xyz, Image3f& points)
+{
+  disp_gpu_.upload(disp);
+  Compute(disp_gpu_, range_gpu_, xyz_gpu_);
+  VoxelDownsample(xyz_gpu_, points_gpu_);
+
+  range_gpu_.download(range);
+  xyz_gpu_.download(xyz);
+  if (points_gpu_.empty()) {
+    points.release();
+  } else {
+    points_gpu_.download(points);
+  }
+}
+
+
+}
+}
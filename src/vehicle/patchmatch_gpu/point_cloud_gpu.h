@@ -0,0 +1,88 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+namespace bm {
+namespace pm {
+
+namespace cu = cv::cuda;
+using namespace core;
+
+
+// Backprojects disparities through a rectified stereo rig. Passed to the kernels by value.
+struct Backprojection final {
+  float fx, fy, cx, cy;
+  float fx_baseline;    // depth = fx_baseline / disp
+  float min_disp;
+  float max_range;
+};
+
+
+// Writes the range (distance along the ray, 0 where invalid) and organized XYZ point (NaN where
+// invalid) of every pixel in disp, in the left camera frame. Disparities below min_disp and ranges
+// beyond max_range are invalid.
+__global__
+void DisparityToPointCloud(const cu::PtrStepSz<float> disp,
+                           cu::PtrStep<float> range,
+                           cu::PtrStep<float3> xyz,
+                           Backprojection bp);
+
+
+// Converts the (left) disparity from dense stereo into metric range and a point cloud, without
+// leaving the GPU. The range is in the format that the imaging pipeline expects (see
+// EnhanceUnderwater), so it can be passed along as-is, or downloaded once.
+class PointCloudGpu final {
+ public:
+  struct Params final : public ParamsBase {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    float min_disp = 0.5;     // Smaller disparities (e.g the zeroed background) are invalid.
+    float max_range = 30.0;   // m
+    float voxel_size = 0.1;   // m, see VoxelDownsample()
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PointCloudGpu);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(PointCloudGpu);
+
+  // stereo_rig must have the same resolution as the disparity maps, i.e be rescaled if the images
+  // were downsampled before matching.
+  PointCloudGpu(const Params& params, const StereoCamera& stereo_rig);
+
+  // disp is CV_32FC1 (e.g from PatchmatchGpu), range is CV_32FC1, and xyz is CV_32FC3. All of the
+  // work is enqueued on stream, so this can return before the outputs are ready.
+  void Compute(const cu::GpuMat& disp,
+               cu::GpuMat& range,
+               cu::GpuMat& xyz,
+               cu::Stream& stream = cu::Stream::Null());
+
+  // One point per occupied voxel (the centroid of the valid points inside of it), as a 1 x N
+  // CV_32FC3 GpuMat. The number of voxels isn't known until the points are sorted, so this
+  // synchronizes the stream.
+  void VoxelDownsample(const cu::GpuMat& xyz,
+                       cu::GpuMat& points,
+                       cu::Stream& stream = cu::Stream::Null());
+
+  // Uploads disp, then downloads the results of Compute() and VoxelDownsample() (points is 1 x N).
+  void Compute(const Image1f& disp, Image1f& range, Image3f& xyz, Image3f& points);
+
+ private:
+  Params params_;
+  Backprojection bp_;
+
+  // Pre-allocate these GpuMats to save on allocation time.
+  cu::GpuMat disp_gpu_, range_gpu_, xyz_gpu_, points_gpu_;
+  cu::GpuMat keys_, sums_, voxel_keys_, voxel_sums_;
+};
+
+
+}
+}
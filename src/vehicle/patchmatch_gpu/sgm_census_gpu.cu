@@ -0,0 +1,512 @@
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda/common.hpp>
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#include "patchmatch_gpu/sgm_census_gpu.h"
+
+namespace bm {
+namespace pm {
+
+
+static const int kCensusRadius = 2;
+static const int kMaxCensusCost = 24;     // Bits in a 5x5 census descriptor.
+static const int kPathsPerBlock = 4;      // Warps (one per path) in each aggregation block.
+
+// Path cost for disparities that are out of range, so that they never get picked as a neighbor.
+static const int kInfCost = 0x3FFF;
+
+
+// Pixel for this thread. Full image launches use a 2D grid of blocks, and ROI launches use one
+// block per tile (tiles is nullptr for full image launches).
+__device__ __forceinline__
+static void ThreadPixel(const int2* tiles, int& x, int& y)
+{
+  if (tiles != nullptr) {
+    const int2 tile = tiles[blockIdx.x];
+    x = tile.x + threadIdx.x;
+    y = tile.y + threadIdx.y;
+  } else {
+    x = blockIdx.x * blockDim.x + threadIdx.x;
+    y = blockIdx.y * blockDim.y + threadIdx.y;
+  }
+}
+
+
+// An empty roi (data == nullptr) means the whole image.
+__device__ __forceinline__
+static bool InRoi(const cu::PtrStep<uchar> roi, int x, int y)
+{
+  return roi.data == nullptr || roi(y, x) != 0;
+}
+
+
+__global__
+void CensusKernel(const cu::PtrStepSz<uchar> im, cu::PtrStep<int> census)
+{
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (x >= im.cols || y >= im.rows) {
+    return;
+  }
+
+  // Pixels near the border get a descriptor of 0 (same as Census5x5()).
+  if (x < kCensusRadius || x >= (im.cols - kCensusRadius) ||
+      y < kCensusRadius || y >= (im.rows - kCensusRadius)) {
+    census(y, x) = 0;
+    return;
+  }
+
+  const uchar center = im(y, x);
+  unsigned int desc = 0;
+
+  #pragma unroll
+  for (int dy = -kCensusRadius; dy <= kCensusRadius; ++dy) {
+    #pragma unroll
+    for (int dx = -kCensusRadius; dx <= kCensusRadius; ++dx) {
+      if (dy != 0 || dx != 0) {
+        desc = (desc << 1) | (im(y + dy, x + dx) < center ? 1 : 0);
+      }
+    }
+  }
+
+  census(y, x) = static_cast<int>(desc);
+}
+
+
+// Also zeros the aggregated cost, so that only the ROI pixels are touched.
+__global__
+void CostKernel(const cu::PtrStepSz<int> census_l,
+                const cu::PtrStep<int> census_r,
+                const cu::PtrStep<uchar> roi,
+                const int2* tiles,
+                int num_disp,
+                cu::PtrStep<uchar> cost,
+                cu::PtrStep<ushort> sum)
+{
+  int x, y;
+  ThreadPixel(tiles, x, y);
+
+  if (x >= census_l.cols || y >= census_l.rows || !InRoi(roi, x, y)) {
+    return;
+  }
+
+  const unsigned int cl = static_cast<unsigned int>(census_l(y, x));
+  uchar* c = cost.ptr(y * census_l.cols + x);
+  ushort* s = sum.ptr(y * census_l.cols + x);
+
+  // Disparities that fall off the left side of the right image get the max cost.
+  for (int d = 0; d < num_disp; ++d) {
+    c[d] = (d <= x) ? __popc(cl ^ static_cast<unsigned int>(census_r(y, x - d))) : kMaxCensusCost;
+    s[d] = 0;
+  }
+}
+
+
+// First pixel of a path in direction (dx, dy). Paths enter through the edges of the image that
+// the direction points away from.
+__device__ __forceinline__
+void PathStart(int path, int rows, int cols, int dx, int dy, int& x, int& y)
+{
+  const int x_entry = (dx >= 0) ? 0 : (cols - 1);
+  const int y_entry = (dy >= 0) ? 0 : (rows - 1);
+
+  // Horizontal: one path per row.
+  if (dy == 0) {
+    x = x_entry;
+    y = path;
+
+  // Vertical: one path per column.
+  } else if (dx == 0) {
+    x = path;
+    y = y_entry;
+
+  // Diagonal: one path per top/bottom pixel, then one per left/right pixel (minus the corner).
+  } else if (path < cols) {
+    x = path;
+    y = y_entry;
+  } else {
+    const int q = path - cols + 1;
+    x = x_entry;
+    y = (dy > 0) ? q : (rows - 1 - q);
+  }
+}
+
+
+// The same recursion as UpdatePath() in stereo_matching/sgm_census.cpp. Each lane holds K
+// consecutive disparities (lane * K to lane * K + K - 1) of the current path cost in registers.
+template <int K>
+__global__
+void AggregatePathKernel(const cu::PtrStep<uchar> cost,
+                         const cu::PtrStep<uchar> roi,
+                         cu::PtrStep<ushort> sum,
+                         int rows,
+                         int cols,
+                         int num_disp,
+                         int dx,
+                         int dy,
+                         int num_paths,
+                         int P1,
+                         int P2)
+{
+  // NOTE(milo): The whole warp works on one path, so it returns (or not) together, and the
+  // shuffles below always have all 32 lanes.
+  const int path = blockIdx.x * blockDim.y + threadIdx.y;
+  if (path >= num_paths) {
+    return;
+  }
+
+  const int lane = threadIdx.x;
+
+  int x, y;
+  PathStart(path, rows, cols, dx, dy, x, y);
+
+  // Starting with L = 0 (and min 0) makes the first pixel's path cost equal to its matching cost.
+  int L[K];
+  #pragma unroll
+  for (int k = 0; k < K; ++k) {
+    L[k] = (lane * K + k < num_disp) ? 0 : kInfCost;
+  }
+  int prev_min = 0;
+
+  for (; x >= 0 && x < cols && y >= 0 && y < rows; x += dx, y += dy) {
+    // Skip pixels outside of the ROI, and start the path over when it comes back in (same as
+    // SgmCensus).
+    if (!InRoi(roi, x, y)) {
+      #pragma unroll
+      for (int k = 0; k < K; ++k) {
+        L[k] = (lane * K + k < num_disp) ? 0 : kInfCost;
+      }
+      prev_min = 0;
+      continue;
+    }
+
+    const int pixel = y * cols + x;
+    const uchar* c = cost.ptr(pixel);
+    ushort* s = sum.ptr(pixel);
+
+    // The d-1 neighbor of this lane's first disparity, and the d+1 neighbor of its last one.
+    const int below = __shfl_up_sync(0xffffffff, L[K - 1], 1);
+    const int above = __shfl_down_sync(0xffffffff, L[0], 1);
+
+    const int jump = prev_min + P2;
+    int cur[K];
+    int cur_min = kInfCost;
+
+    #pragma unroll
+    for (int k = 0; k < K; ++k) {
+      const int d = lane * K + k;
+      if (d < num_disp) {
+        const int lm = (k > 0) ? L[k - 1] : ((lane > 0) ? below : kInfCost);
+        const int lp = (k < K - 1) ? L[k + 1] : ((lane < 31) ? above : kInfCost);
+        cur[k] = c[d] + min(min(L[k], min(lm, lp) + P1), jump) - prev_min;
+        s[d] += static_cast<ushort>(cur[k]);
+        cur_min = min(cur_min, cur[k]);
+      } else {
+        cur[k] = kInfCost;
+      }
+    }
+
+    // Min over all disparities (across the warp).
+    #pragma unroll
+    for (int offset = 16; offset > 0; offset /= 2) {
+      cur_min = min(cur_min, __shfl_xor_sync(0xffffffff, cur_min, offset));
+    }
+
+    #pragma unroll
+    for (int k = 0; k < K; ++k) {
+      L[k] = cur[k];
+    }
+    prev_min = cur_min;
+  }
+}
+
+
+// Best disparity for right image pixel xr, which matches left pixel xr + d at disparity d. Only
+// the left pixels in the ROI have an aggregated cost.
+__device__ __forceinline__
+static int RightDisparity(const cu::PtrStep<ushort> sum,
+                          const cu::PtrStep<uchar> roi,
+                          int y,
+                          int xr,
+                          int cols,
+                          int num_disp)
+{
+  const int dmax = min(num_disp - 1, cols - 1 - xr);
+  int best_d = 0;
+  int best = 0xFFFF + 1;
+  for (int d = 0; d <= dmax; ++d) {
+    if (!InRoi(roi, xr + d, y)) {
+      continue;
+    }
+    const int s = sum.ptr(y * cols + xr + d)[d];
+    if (s < best) {
+      best = s;
+      best_d = d;
+    }
+  }
+  return best_d;
+}
+
+
+// RightDisparity() for every pixel in the right image (only used for the full image).
+__global__
+void RightDisparityKernel(const cu::PtrStep<ushort> sum,
+                          int rows,
+                          int cols,
+                          int num_disp,
+                          cu::PtrStep<int> disp_right)
+{
+  const int xr = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+  if (xr >= cols || y >= rows) {
+    return;
+  }
+
+  disp_right(y, xr) = RightDisparity(sum, cu::PtrStep<uchar>(), y, xr, cols, num_disp);
+}
+
+
+// Same as SgmCensus::SelectDisparity(). With an ROI, the right disparities that the left-right
+// check needs are computed here instead of by RightDisparityKernel, since most of them are never
+// used.
+__global__
+void SelectDisparityKernel(const cu::PtrStep<ushort> sum,
+                           const cu::PtrStep<int> disp_right,
+                           const cu::PtrStep<uchar> roi,
+                           const int2* tiles,
+                           int rows,
+                           int cols,
+                           int num_disp,
+                           float uniqueness,
+                           int lr_max_diff,
+                           bool subpixel,
+                           cu::PtrStep<float> disp)
+{
+  int x, y;
+  ThreadPixel(tiles, x, y);
+
+  if (x >= cols || y >= rows || !InRoi(roi, x, y)) {
+    return;
+  }
+
+  disp(y, x) = -1.0f;
+
+  const ushort* s = sum.ptr(y * cols + x);
+  const int dmax = min(num_disp - 1, x);
+
+  int best_d = 0;
+  int best = s[0];
+  for (int d = 1; d <= dmax; ++d) {
+    if (s[d] < best) {
+      best = s[d];
+      best_d = d;
+    }
+  }
+
+  // Uniqueness: no other (non-adjacent) disparity should be almost as good.
+  int second = 0xFFFF;
+  for (int d = 0; d <= dmax; ++d) {
+    if (abs(d - best_d) > 1) {
+      second = min(second, (int)s[d]);
+    }
+  }
+  if ((float)best > uniqueness * (float)second) {
+    return;
+  }
+
+  if (lr_max_diff >= 0) {
+    const int dr = (roi.data != nullptr) ? RightDisparity(sum, roi, y, x - best_d, cols, num_disp) :
+                                           disp_right(y, x - best_d);
+    if (abs(dr - best_d) > lr_max_diff) {
+      return;
+    }
+  }
+
+  float d = (float)best_d;
+  if (subpixel && best_d > 0 && best_d < dmax) {
+    const float c0 = s[best_d - 1];
+    const float c1 = s[best_d];
+    const float c2 = s[best_d + 1];
+    const float denom = c0 - 2*c1 + c2;
+    if (denom > 0) {
+      d += 0.5f * (c0 - c2) / denom;
+    }
+  }
+
+  disp(y, x) = d;
+}
+
+
+template <int K>
+static void AggregatePath(const cu::GpuMat& cost,
+                          const cu::PtrStep<uchar>& roi,
+                          cu::GpuMat& sum,
+                          int rows,
+                          int cols,
+                          int num_disp,
+                          int dx,
+                          int dy,
+                          int P1,
+                          int P2,
+                          cudaStream_t stream)
+{
+  const int num_paths = (dy == 0) ? rows : ((dx == 0) ? cols : (rows + cols - 1));
+  const dim3 block(32, kPathsPerBlock);
+  const dim3 grid(cu::device::divUp(num_paths, kPathsPerBlock));
+  AggregatePathKernel<K><<<grid, block, 0, stream>>>(
+      cost, roi, sum, rows, cols, num_disp, dx, dy, num_paths, P1, P2);
+}
+
+
+SgmCensusGpu::SgmCensusGpu(const Params& params)
+    : params_(params),
+      num_disp_(params.matcher_params.max_disp + 1)
+{
+  CHECK_GE(params_.matcher_params.max_disp, 1);
+  CHECK_LE(params_.matcher_params.max_disp, kMaxDisp);
+  CHECK(params_.num_paths == 4 || params_.num_paths == 8) << "num_paths must be 4 or 8" << std::endl;
+  CHECK(params_.P1 >= 0 && params_.P2 >= params_.P1);
+  CHECK_LT(params_.num_paths * (kMaxCensusCost + params_.P2), 0xFFFF);
+}
+
+
+Image1f SgmCensusGpu::ComputeDisparity(const Image1b& iml, const Image1b& imr)
+{
+  iml_gpu_.upload(iml);
+  imr_gpu_.upload(imr);
+  ComputeDisparity(iml_gpu_, imr_gpu_, disp_gpu_);
+
+  Image1f disp;
+  disp_gpu_.download(disp);
+  return disp;
+}
+
+
+Image1f SgmCensusGpu::ComputeDisparity(const Image1b& iml,
+                                       const Image1b& imr,
+                                       const stereo::ForegroundRoi& roi)
+{
+  const std::vector<cv::Point> tiles = roi.Tiles(kRoiTileSize);
+  if (tiles.empty()) {
+    return Image1f(iml.size(), -1.0f);
+  }
+
+  iml_gpu_.upload(iml);
+  imr_gpu_.upload(imr);
+  roi_gpu_.upload(roi.Mask());
+  tiles_gpu_.upload(cv::Mat(tiles).reshape(2, 1));
+  ComputeDisparity(iml_gpu_, imr_gpu_, roi_gpu_, tiles_gpu_, disp_gpu_);
+
+  Image1f disp;
+  disp_gpu_.download(disp);
+  return disp;
+}
+
+
+void SgmCensusGpu::ComputeDisparity(const cu::GpuMat& iml,
+                                    const cu::GpuMat& imr,
+                                    cu::GpuMat& disp,
+                                    cu::Stream& stream)
+{
+  Compute(iml, imr, cu::GpuMat(), cu::GpuMat(), disp, stream);
+}
+
+
+void SgmCensusGpu::ComputeDisparity(const cu::GpuMat& iml,
+                                    const cu::GpuMat& imr,
+                                    const cu::GpuMat& roi_mask,
+                                    const cu::GpuMat& tiles,
+                                    cu::GpuMat& disp,
+                                    cu::Stream& stream)
+{
+  CHECK(roi_mask.size() == iml.size() && roi_mask.type() == CV_8UC1);
+  CHECK(tiles.empty() || (tiles.rows == 1 && tiles.type() == CV_32SC2));
+
+  // Pixels that aren't in any tile are never touched by the kernels.
+  disp.create(iml.rows, iml.cols, CV_32FC1);
+  disp.setTo(cv::Scalar(-1.0f), stream);
+
+  if (!tiles.empty()) {
+    Compute(iml, imr, roi_mask, tiles, disp, stream);
+  }
+}
+
+
+void SgmCensusGpu::Compute(const cu::GpuMat& iml,
+                           const cu::GpuMat& imr,
+                           const cu::GpuMat& roi_mask,
+                           const cu::GpuMat& tiles,
+                           cu::GpuMat& disp,
+                           cu::Stream& stream)
+{
+  CHECK(iml.size() == imr.size());
+  CHECK(iml.type() == CV_8UC1 && imr.type() == CV_8UC1);
+
+  const int rows = iml.rows;
+  const int cols = iml.cols;
+  const int D = num_disp_;
+  cudaStream_t s = cu::StreamAccessor::getStream(stream);
+
+  census_l_.create(rows, cols, CV_32SC1);
+  census_r_.create(rows, cols, CV_32SC1);
+  cost_.create(rows * cols, D, CV_8UC1);
+  sum_.create(rows * cols, D, CV_16UC1);
+  disp_right_.create(rows, cols, CV_32SC1);
+  disp.create(rows, cols, CV_32FC1);
+
+  const bool use_roi = !roi_mask.empty();
+  const cu::PtrStep<uchar> roi = use_roi ? cu::PtrStep<uchar>(roi_mask) : cu::PtrStep<uchar>();
+  const int2* tile_ptr = use_roi ? tiles.ptr<int2>() : nullptr;
+
+  const dim3 block(kRoiTileSize, kRoiTileSize);
+  const dim3 grid(cu::device::divUp(cols, block.x), cu::device::divUp(rows, block.y));
+  const dim3 roi_grid = use_roi ? dim3(tiles.cols) : grid;
+
+  // NOTE(milo): The census is cheap, and ROI pixels match right image pixels outside of the ROI,
+  // so it's done for the whole image.
+  CensusKernel<<<grid, block, 0, s>>>(iml, census_l_);
+  CensusKernel<<<grid, block, 0, s>>>(imr, census_r_);
+  CostKernel<<<roi_grid, block, 0, s>>>(census_l_, census_r_, roi, tile_ptr, D, cost_, sum_);
+
+  // Horizontal and vertical paths, plus the diagonals for 8 paths.
+  std::vector<std::pair<int, int>> directions = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+  if (params_.num_paths == 8) {
+    directions.insert(directions.end(), { {1, 1}, {-1, 1}, {1, -1}, {-1, -1} });
+  }
+
+  // NOTE(milo): The number of disparities per lane is a template parameter so that the path costs
+  // stay in registers.
+  const int K = cu::device::divUp(D, 32);
+  for (const std::pair<int, int>& dir : directions) {
+    const int dx = dir.first;
+    const int dy = dir.second;
+    switch (K) {
+      case 1: AggregatePath<1>(cost_, roi, sum_, rows, cols, D, dx, dy, params_.P1, params_.P2, s); break;
+      case 2: AggregatePath<2>(cost_, roi, sum_, rows, cols, D, dx, dy, params_.P1, params_.P2, s); break;
+      case 3: AggregatePath<3>(cost_, roi, sum_, rows, cols, D, dx, dy, params_.P1, params_.P2, s); break;
+      case 4: AggregatePath<4>(cost_, roi, sum_, rows, cols, D, dx, dy, params_.P1, params_.P2, s); break;
+      case 5: AggregatePath<5>(cost_, roi, sum_, rows, cols, D, dx, dy, params_.P1, params_.P2, s); break;
+      case 6: AggregatePath<6>(cost_, roi, sum_, rows, cols, D, dx, dy, params_.P1, params_.P2, s); break;
+      case 7: AggregatePath<7>(cost_, roi, sum_, rows, cols, D, dx, dy, params_.P1, params_.P2, s); break;
+      default: AggregatePath<kMaxDispPerLane>(cost_, roi, sum_, rows, cols, D, dx, dy, params_.P1, params_.P2, s); break;
+    }
+  }
+
+  if (params_.lr_max_diff >= 0 && !use_roi) {
+    RightDisparityKernel<<<grid, block, 0, s>>>(sum_, rows, cols, D, disp_right_);
+  }
+  SelectDisparityKernel<<<roi_grid, block, 0, s>>>(
+      sum_, disp_right_, roi, tile_ptr, rows, cols, D, params_.uniqueness, params_.lr_max_diff, params_.subpixel, disp);
+
+  cudaSafeCall(cudaGetLastError());
+}
+
+
+}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "stereo_matching/dense_stereo.hpp"
+#include "stereo_matching/sgm_census.hpp"
+
+namespace bm {
+namespace pm {
+
+namespace cu = cv::cuda;
+using namespace core;
+
+
+// CUDA version of stereo::SgmCensus (same params, cost and aggregation, so the results should
+// only differ by float rounding in the subpixel step).
+//
+// Each path is aggregated by one warp, with the disparities split across the 32 lanes: the d-1 and
+// d+1 neighbors come from warp shuffles, and the min over disparity is a warp reduction. For a
+// given direction every pixel is on exactly one path, so the paths are independent and run in
+// parallel (rows for horizontal, columns for vertical, and rows + cols - 1 for diagonal paths).
+class SgmCensusGpu final : public stereo::DenseStereo {
+ public:
+  typedef stereo::SgmCensus::Params Params;
+
+  // Disparities per warp lane are kept in registers, which bounds max_disp.
+  static constexpr int kMaxDispPerLane = 8;
+  static constexpr int kMaxDisp = 32 * kMaxDispPerLane - 1;
+
+  // ROI launches use one block of kRoiTileSize x kRoiTileSize threads per ForegroundRoi tile.
+  static constexpr int kRoiTileSize = 16;
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(SgmCensusGpu);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SgmCensusGpu);
+
+  explicit SgmCensusGpu(const Params& params);
+
+  // See DenseStereo. Invalid pixels have a disparity of -1.
+  Image1f ComputeDisparity(const Image1b& iml, const Image1b& imr) override;
+
+  // Same as above, for images that are already on the GPU (CV_8UC1). disp is CV_32FC1. All of the
+  // work is enqueued on stream, so this can return before disp is ready.
+  void ComputeDisparity(const cu::GpuMat& iml,
+                        const cu::GpuMat& imr,
+                        cu::GpuMat& disp,
+                        cu::Stream& stream = cu::Stream::Null());
+
+  // See stereo::SgmCensus. The cost, right disparity and disparity selection are only launched on
+  // the ROI tiles, and the paths skip (and start over after) pixels outside of the ROI.
+  Image1f ComputeDisparity(const Image1b& iml,
+                           const Image1b& imr,
+                           const stereo::ForegroundRoi& roi) override;
+
+  // Same as above, for images that are already on the GPU. roi_mask is CV_8UC1 (nonzero inside of
+  // the ROI), and tiles is a 1 x N CV_32SC2 list of tile corners from ForegroundRoi::Tiles().
+  void ComputeDisparity(const cu::GpuMat& iml,
+                        const cu::GpuMat& imr,
+                        const cu::GpuMat& roi_mask,
+                        const cu::GpuMat& tiles,
+                        cu::GpuMat& disp,
+                        cu::Stream& stream = cu::Stream::Null());
+
+ private:
+  // Shared by both GPU versions above. An empty roi_mask means the whole image (and tiles is
+  // ignored).
+  void Compute(const cu::GpuMat& iml,
+               const cu::GpuMat& imr,
+               const cu::GpuMat& roi_mask,
+               const cu::GpuMat& tiles,
+               cu::GpuMat& disp,
+               cu::Stream& stream);
+
+ private:
+  Params params_;
+  int num_disp_;
+
+  // Pre-allocate these GpuMats to save on allocation time.
+  cu::GpuMat iml_gpu_, imr_gpu_, disp_gpu_;
+  cu::GpuMat census_l_, census_r_;    // CV_32SC1
+  cu::GpuMat cost_;                   // (rows * cols) x num_disp, CV_8UC1
+  cu::GpuMat sum_;                    // (rows * cols) x num_disp, CV_16UC1
+  cu::GpuMat disp_right_;             // CV_32SC1
+  cu::GpuMat roi_gpu_, tiles_gpu_;
+};
+
+
+}
+}
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <deque>
+
+#include <glog/logging.h>
+
+#include "core/random.hpp"
+#include "core/timer.hpp"
+#include "rrt/anytime_planner.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+AnytimePlanner::AnytimePlanner(const Params& params,
+                               const PointSampler& sampler,
+                               const BatchCollisionChecker& collision_checker)
+    : params_(params),
+      sampler_(sampler),
+      collision_checker_(collision_checker),
+      tree_(params.search_radius)
+{
+  CHECK_GT(params_.search_radius, 0) << "search_radius must be positive" << std::endl;
+  CHECK_GE(params_.goal_radius, 0) << "goal_radius can't be negative" << std::endl;
+}
+
+
+AnytimePlanner::AnytimePlanner(const Params& params,
+                               const Vector3d& pmin,
+                               const Vector3d& pmax,
+                               const BatchCollisionChecker& collision_checker)
+    : AnytimePlanner(params, PointSampler(), collision_checker)
+{
+  // NOTE(milo): Step() does the goal biasing, so the sampler doesn't need to.
+  InformedSampler::Params sampler_params;
+  sampler_params.goal_bias = 0;
+  informed_sampler_.reset(new InformedSampler(sampler_params, pmin, pmax, Vector3d::Zero(), Vector3d::Zero()));
+  sampler_ = informed_sampler_->AsPointSampler();
+}
+
+
+void AnytimePlanner::Reset(const Vector3d& start)
+{
+  tree_ = Tree(params_.search_radius);
+  tree_.AddNode(Node(start, -1, 0));
+  UpdateBestGoalNode();
+}
+
+
+void AnytimePlanner::SetGoal(const Vector3d& goal)
+{
+  has_goal_ = true;
+  goal_ = goal;
+  UpdateBestGoalNode();
+}
+
+
+int AnytimePlanner::Step(double time_budget_sec)
+{
+  CHECK_GT(tree_.Size(), 0ul) << "Call Reset() with a start before Step()" << std::endl;
+
+  Timer timer(true);
+  int num_added = 0;
+
+  // NOTE(milo): Always do at least one iteration, so that a tiny budget still makes progress.
+  do {
+    if (tree_.Size() >= params_.max_nodes) {
+      break;
+    }
+
+    const bool sample_goal = has_goal_ && RandomUniformd(0, 1) < params_.goal_bias;
+    const Vector3d x_sample = sample_goal ? goal_ : sampler_();
+
+    Tree::index_t z_new;
+    if (ExtendTree(tree_, x_sample, collision_checker_, params_.search_radius, z_new)) {
+      MaybeAddGoalNode(z_new);
+      ++num_added;
+    }
+  } while (timer.Elapsed().seconds() < time_budget_sec);
+
+  // Rewiring might have made a different goal node the cheapest.
+  if (!goal_nodes_.empty()) {
+    UpdateBestGoalNode();
+  }
+
+  return num_added;
+}
+
+
+double AnytimePlanner::BestCost() const
+{
+  if (!HasPath()) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return tree_.Cost(best_goal_node_);
+}
+
+
+bool AnytimePlanner::BestPath(VecVector3d& path) const
+{
+  path.clear();
+  if (!HasPath()) {
+    return false;
+  }
+
+  PathToNode(tree_, best_goal_node_, path);
+  return true;
+}
+
+
+bool AnytimePlanner::MoveStart(const Vector3d& new_start)
+{
+  CHECK_GT(tree_.Size(), 0ul) << "Call Reset() with a start before MoveStart()" << std::endl;
+
+  const Tree::index_t z_nearest = tree_.Nearest(new_start);
+
+  std::vector<uint8_t> is_free;
+  collision_checker_(new_start, VecVector3d{tree_.GetPoint(z_nearest)}, is_free);
+  if (!is_free.at(0)) {
+    LOG(WARNING) << "Could not connect the new start to the tree, starting over" << std::endl;
+    Reset(new_start);
+    return false;
+  }
+
+  // Walk the tree outwards from the nearest node, treating edges as undirected. Edges on the path
+  // from the old root to the nearest node are reversed, and every other edge keeps its direction.
+  std::vector<PointAndParent> nodes;
+  nodes.reserve(tree_.Size() + 1);
+  nodes.emplace_back(new_start, -1);
+
+  std::vector<uint8_t> visited(tree_.Size(), false);
+  std::deque<std::pair<Tree::index_t, int>> queue;   // Old index, new index of parent.
+  queue.emplace_back(z_nearest, 0);
+  visited.at(z_nearest) = true;
+
+  while (!queue.empty()) {
+    const Tree::index_t i = queue.front().first;
+    const int new_parent = queue.front().second;
+    queue.pop_front();
+
+    const int new_i = static_cast<int>(nodes.size());
+    nodes.emplace_back(tree_.GetPoint(i), new_parent);
+
+    const int old_parent = tree_.Parent(i);
+    if (old_parent >= 0 && !visited.at(old_parent)) {
+      visited.at(old_parent) = true;
+      queue.emplace_back(old_parent, new_i);
+    }
+    for (const Tree::index_t c : tree_.Children(i)) {
+      if (!visited.at(c)) {
+        visited.at(c) = true;
+        queue.emplace_back(c, new_i);
+      }
+    }
+  }
+
+  Rebuild(nodes);
+  return true;
+}
+
+
+size_t AnytimePlanner::PruneInCollision()
+{
+  CHECK_GT(tree_.Size(), 0ul) << "Call Reset() with a start before PruneInCollision()" << std::endl;
+
+  std::vector<PointAndParent> nodes;
+  nodes.reserve(tree_.Size());
+  nodes.emplace_back(tree_.GetPoint(0), -1);
+
+  // Check all of the edges to a node's children in one batch, and only keep going down the ones
+  // that are still free. Anything below a colliding edge is dropped with it.
+  std::deque<std::pair<Tree::index_t, int>> queue;    // Old index, new index.
+  queue.emplace_back(0, 0);
+
+  VecVector3d children_points;
+  std::vector<uint8_t> is_free;
+
+  while (!queue.empty()) {
+    const Tree::index_t i = queue.front().first;
+    const int new_i = queue.front().second;
+    queue.pop_front();
+
+    const std::vector<Tree::index_t>& children = tree_.Children(i);
+    if (children.empty()) {
+      continue;
+    }
+
+    children_points.clear();
+    for (const Tree::index_t c : children) {
+      children_points.emplace_back(tree_.GetPoint(c));
+    }
+    collision_checker_(tree_.GetPoint(i), children_points, is_free);
+
+    for (size_t k = 0; k < children.size(); ++k) {
+      if (is_free.at(k)) {
+        queue.emplace_back(children.at(k), static_cast<int>(nodes.size()));
+        nodes.emplace_back(children_points.at(k), new_i);
+      }
+    }
+  }
+
+  const size_t num_removed = tree_.Size() - nodes.size();
+  if (num_removed > 0) {
+    Rebuild(nodes);
+  }
+
+  return num_removed;
+}
+
+
+void AnytimePlanner::Rebuild(const std::vector<PointAndParent>& nodes)
+{
+  tree_ = Tree(params_.search_radius);
+
+  for (const PointAndParent& node : nodes) {
+    const int parent = node.second;
+    const double cost = (parent < 0) ? 0 :
+        tree_.Cost(parent) + (node.first - tree_.GetPoint(parent)).norm();
+    tree_.AddNode(Node(node.first, parent, cost));
+  }
+
+  UpdateBestGoalNode();
+}
+
+
+void AnytimePlanner::MaybeAddGoalNode(Tree::index_t index)
+{
+  if (!has_goal_ || (tree_.GetPoint(index) - goal_).norm() > params_.goal_radius) {
+    return;
+  }
+
+  goal_nodes_.emplace_back(index);
+  if (best_goal_node_ < 0 || tree_.Cost(index) < BestCost()) {
+    best_goal_node_ = static_cast<int>(index);
+    UpdateInformedSampler();
+  }
+}
+
+
+void AnytimePlanner::UpdateBestGoalNode()
+{
+  goal_nodes_.clear();
+  best_goal_node_ = -1;
+
+  if (!has_goal_ || tree_.Size() == 0) {
+    UpdateInformedSampler();
+    return;
+  }
+
+  tree_.Nearby(goal_, params_.goal_radius, goal_nodes_);
+
+  double best_cost = std::numeric_limits<double>::infinity();
+  for (const Tree::index_t i : goal_nodes_) {
+    const double cost = tree_.Cost(i);
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_goal_node_ = static_cast<int>(i);
+    }
+  }
+
+  UpdateInformedSampler();
+}
+
+
+void AnytimePlanner::UpdateInformedSampler()
+{
+  if (!informed_sampler_) {
+    return;
+  }
+
+  // Costs are from the root, so the informed set is only valid with the root as the start. A better
+  // path could end anywhere within goal_radius of the goal, so the set is grown by that much.
+  if (has_goal_ && tree_.Size() > 0) {
+    informed_sampler_->SetStartAndGoal(tree_.GetPoint(0), goal_);
+    informed_sampler_->SetBestCost(BestCost() + params_.goal_radius);
+  } else {
+    informed_sampler_->SetBestCost(std::numeric_limits<double>::infinity());
+  }
+}
+
+
+}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "rrt/informed_sampler.hpp"
+#include "rrt/rrt.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+// Runs RRT* a little at a time (e.g once per control tick, within a fixed time budget) and keeps
+// the tree between calls, so the path keeps getting better for as long as the planner runs.
+//
+// When the vehicle moves, MoveStart() re-roots the tree at the new start, instead of throwing it
+// away. When the obstacles change (e.g a new mesh was added to the collision checker), call
+// PruneInCollision() to drop the branches that now collide.
+//
+// NOTE(milo): Not threadsafe. Call everything from the planning thread.
+class AnytimePlanner final {
+ public:
+  struct Params final
+  {
+    double search_radius = 5.0;     // For choosing parents and rewiring.
+    double goal_radius = 1.0;       // A node this close to the goal reaches it.
+    double goal_bias = 0.05;        // Fraction of samples that are the goal itself.
+    size_t max_nodes = 50000;       // Stop growing the tree once it's this big.
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(AnytimePlanner)
+
+  AnytimePlanner(const Params& params,
+                 const PointSampler& sampler,
+                 const BatchCollisionChecker& collision_checker);
+
+  // Samples the box between pmin and pmax with an InformedSampler, which is kept up to date with
+  // the start, goal and best cost as the planner runs.
+  AnytimePlanner(const Params& params,
+                 const Vector3d& pmin,
+                 const Vector3d& pmax,
+                 const BatchCollisionChecker& collision_checker);
+
+  // Start over with a tree that only has the start.
+  void Reset(const Vector3d& start);
+
+  // Change the goal, but keep the tree.
+  void SetGoal(const Vector3d& goal);
+
+  // Grow the tree for up to time_budget_sec. Returns the number of nodes added.
+  int Step(double time_budget_sec);
+
+  bool HasPath() const { return best_goal_node_ >= 0; }
+
+  // Cost of the best path so far (infinite if there isn't one).
+  double BestCost() const;
+
+  // Points along the best path, from the start to the node that reached the goal.
+  bool BestPath(VecVector3d& path) const;
+
+  // Re-root the tree at a new start, connecting it to the nearest node, and reusing every other
+  // node. If the new start can't be connected, the tree is Reset(). Returns whether it was reused.
+  bool MoveStart(const Vector3d& new_start);
+
+  // Re-check every edge in the tree, and remove the branches below any that collide now. Returns
+  // the number of nodes removed.
+  size_t PruneInCollision();
+
+  const Tree& GetTree() const { return tree_; }
+
+ private:
+  // A node to add to a rebuilt tree, with the index of its parent in the same list.
+  typedef std::pair<Vector3d, int> PointAndParent;
+
+  // Replace the tree with one made of these nodes (listed so that parents come before children).
+  void Rebuild(const std::vector<PointAndParent>& nodes);
+
+  // Update the best goal node after the tree changes.
+  void MaybeAddGoalNode(Tree::index_t index);
+  void UpdateBestGoalNode();
+  void UpdateInformedSampler();
+
+  Params params_;
+  PointSampler sampler_;
+  std::unique_ptr<InformedSampler> informed_sampler_;   // Only if sampling informed.
+  BatchCollisionChecker collision_checker_;
+
+  Tree tree_;
+  bool has_goal_ = false;
+  Vector3d goal_ = Vector3d::Zero();
+  std::vector<Tree::index_t> goal_nodes_;     // Within goal_radius of the goal.
+  int best_goal_node_ = -1;
+};
+
+
+}
+}
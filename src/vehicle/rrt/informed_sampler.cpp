@@ -0,0 +1,136 @@
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "core/random.hpp"
+#include "rrt/informed_sampler.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+Vector3d SampleUnitBall()
+{
+  return RandomUnit3d() * std::cbrt(RandomUniformd(0, 1));
+}
+
+
+Matrix3d RotationAlongLine(const Vector3d& start, const Vector3d& goal)
+{
+  const Vector3d x_axis = (goal - start).normalized();
+
+  // Any vector that isn't parallel to the x-axis gives the other two axes.
+  const Vector3d other = (std::fabs(x_axis.z()) < 0.9) ? Vector3d::UnitZ() : Vector3d::UnitX();
+  const Vector3d y_axis = other.cross(x_axis).normalized();
+  const Vector3d z_axis = x_axis.cross(y_axis);
+
+  Matrix3d world_R_ellipsoid;
+  world_R_ellipsoid.col(0) = x_axis;
+  world_R_ellipsoid.col(1) = y_axis;
+  world_R_ellipsoid.col(2) = z_axis;
+  return world_R_ellipsoid;
+}
+
+
+InformedSampler::InformedSampler(const Params& params,
+                                 const Vector3d& pmin,
+                                 const Vector3d& pmax,
+                                 const Vector3d& start,
+                                 const Vector3d& goal)
+    : params_(params), pmin_(pmin), pmax_(pmax)
+{
+  CHECK((pmax_ - pmin_).minCoeff() >= 0) << "pmax must be >= pmin" << std::endl;
+  CHECK(params_.goal_bias >= 0 && params_.goal_bias <= 1) << "goal_bias must be in [0, 1]" << std::endl;
+  SetStartAndGoal(start, goal);
+}
+
+
+void InformedSampler::SetStartAndGoal(const Vector3d& start, const Vector3d& goal)
+{
+  start_ = start;
+  goal_ = goal;
+  c_min_ = (goal - start).norm();
+  center_ = 0.5 * (start + goal);
+  world_R_ellipsoid_ = (c_min_ > 0) ? RotationAlongLine(start, goal) : Matrix3d::Identity();
+
+  // The old best cost might not mean anything for the new start and goal.
+  SetBestCost(std::numeric_limits<double>::infinity());
+}
+
+
+void InformedSampler::SetBestCost(double c_best)
+{
+  c_best_ = std::fmax(c_best, c_min_);
+
+  if (HasSolution()) {
+    const double r_transverse = 0.5 * c_best_;
+    const double r_conjugate = 0.5 * std::sqrt(c_best_*c_best_ - c_min_*c_min_);
+    scales_ = Vector3d(r_transverse, r_conjugate, r_conjugate);
+  }
+}
+
+
+bool InformedSampler::InBox(const Vector3d& x) const
+{
+  return (x - pmin_).minCoeff() >= 0 && (pmax_ - x).minCoeff() >= 0;
+}
+
+
+bool InformedSampler::InInformedSet(const Vector3d& x) const
+{
+  return !HasSolution() || ((x - start_).norm() + (x - goal_).norm()) <= c_best_;
+}
+
+
+double InformedSampler::InformedVolume() const
+{
+  if (!HasSolution()) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 4.0 / 3.0 * M_PI * scales_.prod();
+}
+
+
+Vector3d InformedSampler::SampleSpheroid() const
+{
+  return world_R_ellipsoid_ * scales_.cwiseProduct(SampleUnitBall()) + center_;
+}
+
+
+Vector3d InformedSampler::Sample()
+{
+  if (params_.goal_bias > 0 && RandomUniformd(0, 1) < params_.goal_bias) {
+    return goal_;
+  }
+
+  if (!HasSolution()) {
+    return SampleBoxPoint(pmin_, pmax_);
+  }
+
+  // Sample from the smaller set, and reject what's outside of the other one.
+  const bool sample_spheroid = InformedVolume() < (pmax_ - pmin_).prod();
+
+  for (int i = 0; i < params_.max_rejections; ++i) {
+    const Vector3d x = sample_spheroid ? SampleSpheroid() : SampleBoxPoint(pmin_, pmax_);
+    if (sample_spheroid ? InBox(x) : InInformedSet(x)) {
+      return x;
+    }
+  }
+
+  // NOTE(milo): The informed set barely overlaps the box (e.g the goal is outside of it). Sampling
+  // the box is still correct, just not informed.
+  return SampleBoxPoint(pmin_, pmax_);
+}
+
+
+void InformedSampler::SampleBatch(size_t n, VecVector3d& out)
+{
+  out.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = Sample();
+  }
+}
+
+
+}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <limits>
+
+#include "core/eigen_types.hpp"
+#include "rrt/rrt.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+// Samples points for informed RRT* (Gammell et al., 2014). Until there's a path, points are sampled
+// uniformly from the box (like SampleBoxPoint). Once there's a path of cost c_best, only points that
+// could be on a shorter one are sampled: they're inside the prolate spheroid with foci at the start
+// and goal where |x - start| + |x - goal| <= c_best. That set shrinks as the path gets better, so
+// far fewer samples are wasted in a big box (e.g an open-water transit).
+//
+// Whichever of the spheroid and the box is smaller is sampled, and the points outside the other
+// are rejected. A fraction of the samples (goal_bias) are the goal itself.
+class InformedSampler final {
+ public:
+  struct Params final
+  {
+    double goal_bias = 0.05;        // Fraction of samples that are the goal.
+    int max_rejections = 100;       // Give up on the informed set after this many tries.
+  };
+
+  InformedSampler(const Params& params,
+                  const Vector3d& pmin,
+                  const Vector3d& pmax,
+                  const Vector3d& start,
+                  const Vector3d& goal);
+
+  void SetStartAndGoal(const Vector3d& start, const Vector3d& goal);
+
+  // Only sample points that could be on a path cheaper than c_best (infinite = no path yet).
+  void SetBestCost(double c_best);
+
+  Vector3d Sample();
+  void SampleBatch(size_t n, VecVector3d& out);
+
+  bool HasSolution() const { return c_best_ < std::numeric_limits<double>::infinity(); }
+
+  // Could x be on a path cheaper than the best one?
+  bool InInformedSet(const Vector3d& x) const;
+
+  // Volume of the informed set (infinite if there's no solution yet).
+  double InformedVolume() const;
+
+  PointSampler AsPointSampler() { return [this]() { return Sample(); }; }
+  BatchPointSampler AsBatchPointSampler()
+  {
+    return [this](size_t n, VecVector3d& out) { SampleBatch(n, out); };
+  }
+
+ private:
+  bool InBox(const Vector3d& x) const;
+  Vector3d SampleSpheroid() const;
+
+  Params params_;
+  Vector3d pmin_, pmax_;
+  Vector3d start_, goal_;
+  double c_min_;                  // Straight line distance from the start to the goal.
+  double c_best_ = std::numeric_limits<double>::infinity();
+
+  // Maps the unit ball onto the informed set: x = world_R_ellipsoid * diag(scales) * ball + center.
+  Matrix3d world_R_ellipsoid_;
+  Vector3d scales_ = Vector3d::Zero();
+  Vector3d center_;
+};
+
+
+// Returns a point uniformly distributed inside the unit ball.
+Vector3d SampleUnitBall();
+
+
+// Returns a rotation whose x-axis points from start to goal (see vio::EllipsoidRotationInWorld).
+Matrix3d RotationAlongLine(const Vector3d& start, const Vector3d& goal);
+
+
+}
+}
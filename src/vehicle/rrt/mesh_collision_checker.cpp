@@ -0,0 +1,193 @@
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "rrt/mesh_collision_checker.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+// From Real-Time Collision Detection (Ericson), section 5.1.5.
+Vector3d ClosestPointOnTriangle(const Vector3d& p, const Vector3d& a, const Vector3d& b, const Vector3d& c)
+{
+  const Vector3d ab = b - a;
+  const Vector3d ac = c - a;
+  const Vector3d ap = p - a;
+  const double d1 = ab.dot(ap);
+  const double d2 = ac.dot(ap);
+  if (d1 <= 0 && d2 <= 0) { return a; }
+
+  const Vector3d bp = p - b;
+  const double d3 = ab.dot(bp);
+  const double d4 = ac.dot(bp);
+  if (d3 >= 0 && d4 <= d3) { return b; }
+
+  const double vc = d1*d4 - d3*d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    return a + (d1 / (d1 - d3)) * ab;
+  }
+
+  const Vector3d cp = p - c;
+  const double d5 = ab.dot(cp);
+  const double d6 = ac.dot(cp);
+  if (d6 >= 0 && d5 <= d6) { return c; }
+
+  const double vb = d5*d2 - d1*d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    return a + (d2 / (d2 - d6)) * ac;
+  }
+
+  const double va = d3*d6 - d5*d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {
+    return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+  }
+
+  // Inside the face. Also handles degenerate triangles, since the denominator is then zero.
+  const double denom = va + vb + vc;
+  if (std::fabs(denom) < std::numeric_limits<double>::epsilon()) {
+    return a;
+  }
+  const double v = vb / denom;
+  const double w = vc / denom;
+  return a + v*ab + w*ac;
+}
+
+
+MeshCollisionChecker::MeshCollisionChecker(const Params& params)
+    : params_(params)
+{
+  CHECK_GT(params_.voxel_size, 0) << "Voxel size must be positive" << std::endl;
+  CHECK_GE(params_.clearance, 0) << "Clearance can't be negative" << std::endl;
+}
+
+
+void MeshCollisionChecker::AddMesh(const mesher::TriangleMesh& mesh)
+{
+  for (const Vector3i& t : mesh.triangles) {
+    AddTriangle(mesh.vertices.at(t(0)), mesh.vertices.at(t(1)), mesh.vertices.at(t(2)));
+  }
+}
+
+
+void MeshCollisionChecker::AddTriangle(const Vector3d& a, const Vector3d& b, const Vector3d& c)
+{
+  const double vs = params_.voxel_size;
+
+  // Any point in a voxel is within half a diagonal of its center.
+  const double half_diagonal = 0.5 * std::sqrt(3.0) * vs;
+  const double max_center_dist = params_.clearance + half_diagonal;
+  const double max_center_dist2 = max_center_dist * max_center_dist;
+
+  const Vector3d pmin = a.cwiseMin(b).cwiseMin(c).array() - params_.clearance;
+  const Vector3d pmax = a.cwiseMax(b).cwiseMax(c).array() + params_.clearance;
+
+  for (int ix = VoxelCoord(pmin.x(), vs); ix <= VoxelCoord(pmax.x(), vs); ++ix) {
+    for (int iy = VoxelCoord(pmin.y(), vs); iy <= VoxelCoord(pmax.y(), vs); ++iy) {
+      for (int iz = VoxelCoord(pmin.z(), vs); iz <= VoxelCoord(pmax.z(), vs); ++iz) {
+        const VoxelKey key = PackVoxelKey(ix, iy, iz);
+        if (occupied_.count(key)) {
+          continue;
+        }
+        const Vector3d center = vs * (Vector3d(ix, iy, iz).array() + 0.5);
+        if ((ClosestPointOnTriangle(center, a, b, c) - center).squaredNorm() <= max_center_dist2) {
+          occupied_.insert(key);
+        }
+      }
+    }
+  }
+}
+
+
+bool MeshCollisionChecker::IsFree(const Vector3d& p) const
+{
+  const double vs = params_.voxel_size;
+  return !IsOccupied(VoxelCoord(p.x(), vs), VoxelCoord(p.y(), vs), VoxelCoord(p.z(), vs));
+}
+
+
+// Amanatides and Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing".
+bool MeshCollisionChecker::IsSegmentFree(const Vector3d& a, const Vector3d& b) const
+{
+  if (occupied_.empty()) {
+    return true;
+  }
+
+  const double vs = params_.voxel_size;
+  int v[3] = { VoxelCoord(a.x(), vs), VoxelCoord(a.y(), vs), VoxelCoord(a.z(), vs) };
+  const int v_end[3] = { VoxelCoord(b.x(), vs), VoxelCoord(b.y(), vs), VoxelCoord(b.z(), vs) };
+
+  const Vector3d d = b - a;
+  int step[3];
+  double t_max[3], t_delta[3];
+  for (int i = 0; i < 3; ++i) {
+    if (d(i) > 0) {
+      step[i] = 1;
+      t_max[i] = ((v[i] + 1) * vs - a(i)) / d(i);
+      t_delta[i] = vs / d(i);
+    } else if (d(i) < 0) {
+      step[i] = -1;
+      t_max[i] = (v[i] * vs - a(i)) / d(i);
+      t_delta[i] = -vs / d(i);
+    } else {
+      step[i] = 0;
+      t_max[i] = std::numeric_limits<double>::max();
+      t_delta[i] = std::numeric_limits<double>::max();
+    }
+  }
+
+  // The segment passes through at most this many voxels (guards against rounding at the end).
+  const int max_steps = std::abs(v_end[0] - v[0]) + std::abs(v_end[1] - v[1]) + std::abs(v_end[2] - v[2]);
+
+  for (int n = 0; ; ++n) {
+    if (IsOccupied(v[0], v[1], v[2])) {
+      return false;
+    }
+    if (n >= max_steps) {
+      break;
+    }
+
+    // Step along whichever axis reaches its next voxel boundary first.
+    const int i = (t_max[0] < t_max[1]) ? ((t_max[0] < t_max[2]) ? 0 : 2) : ((t_max[1] < t_max[2]) ? 1 : 2);
+    if (t_max[i] > 1.0) {
+      break;
+    }
+    v[i] += step[i];
+    t_max[i] += t_delta[i];
+  }
+
+  return true;
+}
+
+
+void MeshCollisionChecker::AreSegmentsFree(const Vector3d& from, const VecVector3d& to, std::vector<uint8_t>& is_free) const
+{
+  const bool from_free = IsFree(from);
+  is_free.assign(to.size(), 0);
+  if (!from_free) {
+    return;
+  }
+  for (size_t i = 0; i < to.size(); ++i) {
+    is_free.at(i) = IsSegmentFree(from, to.at(i)) ? 1 : 0;
+  }
+}
+
+
+CollisionChecker MeshCollisionChecker::AsCollisionChecker() const
+{
+  return [this](const Vector3d& a, const Vector3d& b) { return IsSegmentFree(a, b); };
+}
+
+
+BatchCollisionChecker MeshCollisionChecker::AsBatchCollisionChecker() const
+{
+  return [this](const Vector3d& from, const VecVector3d& to, std::vector<uint8_t>& is_free)
+  {
+    AreSegmentsFree(from, to, is_free);
+  };
+}
+
+
+}
+}
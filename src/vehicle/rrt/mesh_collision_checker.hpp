@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "mesher/triangle_mesh.hpp"
+#include "rrt/rrt.hpp"
+#include "rrt/voxel_key.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+// Returns the point on triangle (a, b, c) that's closest to p.
+Vector3d ClosestPointOnTriangle(const Vector3d& p, const Vector3d& a, const Vector3d& b, const Vector3d& c);
+
+
+// Checks RRT edges against the meshes that the ObjectMesher publishes, instead of looping over every
+// triangle for every edge. Triangles are voxelized when they're added: every voxel that could have a
+// point within "clearance" of a triangle is marked as occupied (conservatively, so a free voxel is
+// always free). A segment is free if none of the voxels it passes through are occupied. Segments
+// are walked voxel by voxel (3D DDA), and stop at the first occupied one.
+//
+// Adding meshes is incremental (they're unioned with what's already there), so each new mesh only
+// costs as much as its own triangles. Call Clear() to start over (e.g if the map was re-optimized).
+//
+// NOTE(milo): Not threadsafe. Don't add meshes while the planner is querying.
+class MeshCollisionChecker final {
+ public:
+  struct Params final
+  {
+    double voxel_size = 0.25;   // Smaller is less conservative, but uses more memory.
+    double clearance = 0.5;     // Minimum distance to keep from any triangle (meters).
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(MeshCollisionChecker)
+
+  explicit MeshCollisionChecker(const Params& params);
+
+  // Add the triangles of a mesh (in the same frame as the planner).
+  void AddMesh(const mesher::TriangleMesh& mesh);
+  void AddTriangle(const Vector3d& a, const Vector3d& b, const Vector3d& c);
+
+  void Clear() { occupied_.clear(); }
+
+  bool IsFree(const Vector3d& p) const;
+
+  // Is the straight line from a to b collision-free?
+  bool IsSegmentFree(const Vector3d& a, const Vector3d& b) const;
+
+  // Check the segments from one point to each of several (e.g x_new and its nearby nodes in RRT*).
+  // If "from" isn't free, none of them are, so nothing else is checked.
+  void AreSegmentsFree(const Vector3d& from, const VecVector3d& to, std::vector<uint8_t>& is_free) const;
+
+  size_t NumOccupied() const { return occupied_.size(); }
+
+  // For BuildTree(). These refer to this checker, so it has to outlive them.
+  CollisionChecker AsCollisionChecker() const;
+  BatchCollisionChecker AsBatchCollisionChecker() const;
+
+ private:
+  bool IsOccupied(int ix, int iy, int iz) const { return occupied_.count(PackVoxelKey(ix, iy, iz)) > 0; }
+
+  Params params_;
+  std::unordered_set<VoxelKey> occupied_;
+};
+
+
+}
+}
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "core/eigen_types.hpp"
+#include "rrt/point_array.hpp"
 
 namespace bm {
 namespace rrt {
@@ -88,5 +89,51 @@ struct KDTreeVectorOfVectorsAdaptor
 
 }; // end of KDTreeVectorOfVectorsAdaptor
 
+
+// Same as above, but for the x, y, z arrays of a PointArray (e.g the points of a Tree), so that the
+// kd-tree reads them in place.
+template <typename Distance = nanoflann::metric_L2, typename IndexType = size_t>
+struct KDTreePointArrayAdaptor
+{
+	typedef KDTreePointArrayAdaptor<Distance, IndexType> self_t;
+	typedef typename Distance::template traits<double, self_t>::distance_t metric_t;
+	typedef nanoflann::KDTreeSingleIndexAdaptor<metric_t, self_t, 3, IndexType> index_t;
+
+	index_t* index;
+
+	KDTreePointArrayAdaptor(const PointArray& points, const int leaf_max_size = 10) : m_data(points)
+	{
+		index = new index_t(3, *this, nanoflann::KDTreeSingleIndexAdaptorParams(leaf_max_size));
+		index->buildIndex();
+	}
+
+	~KDTreePointArrayAdaptor() {
+		delete index;
+	}
+
+	const PointArray& m_data;
+
+	const self_t & derived() const {
+		return *this;
+	}
+	self_t & derived()       {
+		return *this;
+	}
+
+	inline size_t kdtree_get_point_count() const {
+		return m_data.Size();
+	}
+
+	inline double kdtree_get_pt(const size_t idx, const size_t dim) const {
+		return (dim == 0) ? m_data.X(idx) : ((dim == 1) ? m_data.Y(idx) : m_data.Z(idx));
+	}
+
+	template <class BBOX>
+	bool kdtree_get_bbox(BBOX & /*bb*/) const {
+		return false;
+	}
+};
+
+
 }
 }
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "rrt/path_smoother.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+CubicSpline3d::CubicSpline3d(const VecVector3d& waypoints)
+    : points_(waypoints)
+{
+  const size_t n = waypoints.size();
+  CHECK_GE(n, 2ul) << "A spline needs at least two waypoints" << std::endl;
+
+  knots_.resize(n, 0.0);
+  for (size_t i = 1; i < n; ++i) {
+    const double h = (waypoints.at(i) - waypoints.at(i - 1)).norm();
+    CHECK_GT(h, 0) << "Spline waypoints " << (i - 1) << " and " << i << " are the same" << std::endl;
+    knots_.at(i) = knots_.at(i - 1) + h;
+  }
+
+  // Solve the tridiagonal system for the second derivatives at the interior knots (the Thomas
+  // algorithm), for all three axes at once. The ends are zero, which makes the spline "natural".
+  second_derivs_.assign(n, Vector3d::Zero());
+  if (n == 2) {
+    return;
+  }
+
+  const size_t m = n - 2;
+  std::vector<double> upper(m, 0.0);
+  VecVector3d rhs(m, Vector3d::Zero());
+
+  for (size_t k = 0; k < m; ++k) {
+    const size_t i = k + 1;
+    const double h0 = knots_.at(i) - knots_.at(i - 1);
+    const double h1 = knots_.at(i + 1) - knots_.at(i);
+    const Vector3d d = 6.0 * ((points_.at(i + 1) - points_.at(i)) / h1 - (points_.at(i) - points_.at(i - 1)) / h0);
+    double diag = 2.0 * (h0 + h1);
+
+    // Forward elimination (h0 is the sub-diagonal, and h1 is the super-diagonal).
+    if (k > 0) {
+      diag -= h0 * upper.at(k - 1);
+      rhs.at(k) = d - h0 * rhs.at(k - 1);
+    } else {
+      rhs.at(k) = d;
+    }
+    upper.at(k) = h1 / diag;
+    rhs.at(k) /= diag;
+  }
+
+  // Back substitution.
+  second_derivs_.at(m) = rhs.at(m - 1);
+  for (size_t k = m - 1; k > 0; --k) {
+    second_derivs_.at(k) = rhs.at(k - 1) - upper.at(k - 1) * second_derivs_.at(k + 1);
+  }
+}
+
+
+size_t CubicSpline3d::Segment(double s) const
+{
+  CHECK_GE(knots_.size(), 2ul) << "Evaluating an empty spline" << std::endl;
+  const auto it = std::upper_bound(knots_.begin(), knots_.end(), s);
+  const size_t i = (it == knots_.begin()) ? 0 : static_cast<size_t>(std::distance(knots_.begin(), it) - 1);
+  return std::min(i, knots_.size() - 2);
+}
+
+
+Vector3d CubicSpline3d::Position(double s) const
+{
+  const size_t i = Segment(s);
+  const double h = knots_.at(i + 1) - knots_.at(i);
+  const double t = s - knots_.at(i);
+  const double u = knots_.at(i + 1) - s;
+  const Vector3d& M0 = second_derivs_.at(i);
+  const Vector3d& M1 = second_derivs_.at(i + 1);
+
+  return (M0 * u * u * u + M1 * t * t * t) / (6.0 * h)
+       + (points_.at(i) / h - M0 * h / 6.0) * u
+       + (points_.at(i + 1) / h - M1 * h / 6.0) * t;
+}
+
+
+Vector3d CubicSpline3d::Derivative(double s) const
+{
+  const size_t i = Segment(s);
+  const double h = knots_.at(i + 1) - knots_.at(i);
+  const double t = s - knots_.at(i);
+  const double u = knots_.at(i + 1) - s;
+  const Vector3d& M0 = second_derivs_.at(i);
+  const Vector3d& M1 = second_derivs_.at(i + 1);
+
+  return (M1 * t * t - M0 * u * u) / (2.0 * h)
+       + (points_.at(i + 1) - points_.at(i)) / h
+       - (M1 - M0) * h / 6.0;
+}
+
+
+Vector3d CubicSpline3d::SecondDerivative(double s) const
+{
+  const size_t i = Segment(s);
+  const double h = knots_.at(i + 1) - knots_.at(i);
+  const double t = s - knots_.at(i);
+  const double u = knots_.at(i + 1) - s;
+  return (second_derivs_.at(i) * u + second_derivs_.at(i + 1) * t) / h;
+}
+
+
+PathSmoother::PathSmoother(const Params& params, const BatchCollisionChecker& collision_checker)
+    : params_(params),
+      collision_checker_(collision_checker)
+{
+  CHECK_GT(params_.max_velocity, 0) << "max_velocity must be positive" << std::endl;
+  CHECK_GT(params_.max_acceleration, 0) << "max_acceleration must be positive" << std::endl;
+  CHECK_GT(params_.max_lateral_acceleration, 0) << "max_lateral_acceleration must be positive" << std::endl;
+  CHECK_GT(params_.sample_spacing, 0) << "sample_spacing must be positive" << std::endl;
+}
+
+
+bool PathSmoother::Smooth(const VecVector3d& path, Trajectory& trajectory) const
+{
+  trajectory.clear();
+  if (path.size() < 2) {
+    return false;
+  }
+
+  VecVector3d waypoints;
+  Shortcut(path, waypoints);
+  if (waypoints.size() < 2) {
+    return false;   // The path doesn't go anywhere.
+  }
+
+  CubicSpline3d spline;
+  if (!FitSpline(waypoints, spline)) {
+    return false;
+  }
+
+  TimeParameterize(spline, trajectory);
+  return true;
+}
+
+
+void PathSmoother::Shortcut(const VecVector3d& path, VecVector3d& shortcut) const
+{
+  shortcut.clear();
+
+  // NOTE(milo): Repeated points would make a spline segment with zero length.
+  VecVector3d unique;
+  unique.reserve(path.size());
+  for (const Vector3d& p : path) {
+    if (unique.empty() || (p - unique.back()).squaredNorm() > 1e-12) {
+      unique.emplace_back(p);
+    }
+  }
+  if (unique.empty()) {
+    return;
+  }
+
+  shortcut.emplace_back(unique.front());
+
+  VecVector3d to;
+  std::vector<uint8_t> is_free;
+  size_t i = 0;
+  while (i + 1 < unique.size()) {
+    to.assign(unique.begin() + i + 1, unique.end());
+    collision_checker_(unique.at(i), to, is_free);
+
+    // Go straight to the furthest waypoint that's visible. If none are, keep the original edge.
+    size_t next = i + 1;
+    for (size_t k = to.size(); k > 0; --k) {
+      if (is_free.at(k - 1)) {
+        next = i + k;
+        break;
+      }
+    }
+
+    shortcut.emplace_back(unique.at(next));
+    i = next;
+  }
+}
+
+
+void PathSmoother::CheckSpline(const CubicSpline3d& spline, std::vector<uint8_t>& is_free) const
+{
+  is_free.assign(spline.NumSegments(), 1);
+
+  VecVector3d to(1);
+  std::vector<uint8_t> chord_free;
+
+  for (size_t i = 0; i < spline.NumSegments(); ++i) {
+    const double s0 = spline.Knot(i);
+    const double s1 = spline.Knot(i + 1);
+    const int n = std::max(1, static_cast<int>(std::ceil((s1 - s0) / params_.sample_spacing)));
+
+    // Check the chords between consecutive samples.
+    Vector3d prev = spline.Position(s0);
+    for (int k = 1; k <= n; ++k) {
+      to.at(0) = spline.Position(s0 + (s1 - s0) * k / n);
+      collision_checker_(prev, to, chord_free);
+      if (!chord_free.at(0)) {
+        is_free.at(i) = 0;
+        break;
+      }
+      prev = to.at(0);
+    }
+  }
+}
+
+
+bool PathSmoother::FitSpline(const VecVector3d& waypoints, CubicSpline3d& spline) const
+{
+  CHECK_GE(waypoints.size(), 2ul);
+
+  VecVector3d current = waypoints;
+  std::vector<uint8_t> is_free;
+
+  for (int iter = 0; iter <= params_.max_refinements; ++iter) {
+    spline = CubicSpline3d(current);
+    CheckSpline(spline, is_free);
+
+    if (std::all_of(is_free.begin(), is_free.end(), [](uint8_t f) { return f != 0; })) {
+      return true;
+    }
+
+    // Pull the spline towards the polyline wherever it collides.
+    VecVector3d refined;
+    refined.reserve(2 * current.size());
+    for (size_t i = 0; i + 1 < current.size(); ++i) {
+      refined.emplace_back(current.at(i));
+      if (!is_free.at(i)) {
+        refined.emplace_back(0.5 * (current.at(i) + current.at(i + 1)));
+      }
+    }
+    refined.emplace_back(current.back());
+    current = refined;
+  }
+
+  return false;
+}
+
+
+void PathSmoother::TimeParameterize(const CubicSpline3d& spline, Trajectory& trajectory) const
+{
+  trajectory.clear();
+
+  const double length = spline.Length();
+  const size_t n = std::max<size_t>(2, static_cast<size_t>(std::ceil(length / params_.sample_spacing)) + 1);
+
+  VecVector3d position(n), tangent(n);
+  std::vector<double> ds(n, 0.0), vmax(n, params_.max_velocity);
+
+  for (size_t i = 0; i < n; ++i) {
+    const double s = length * static_cast<double>(i) / static_cast<double>(n - 1);
+    position.at(i) = spline.Position(s);
+    const Vector3d d1 = spline.Derivative(s);
+    const Vector3d d2 = spline.SecondDerivative(s);
+
+    const double speed = d1.norm();
+    tangent.at(i) = (speed > 1e-9) ? Vector3d(d1 / speed) : Vector3d::Zero();
+
+    // Slow down enough to turn (v^2 * curvature <= max_lateral_acceleration).
+    const double curvature = (speed > 1e-9) ? (d1.cross(d2).norm() / (speed * speed * speed)) : 0.0;
+    if (curvature > 1e-9) {
+      vmax.at(i) = std::min(vmax.at(i), std::sqrt(params_.max_lateral_acceleration / curvature));
+    }
+
+    if (i > 0) {
+      ds.at(i) = (position.at(i) - position.at(i - 1)).norm();
+    }
+  }
+
+  // Start and end at rest, and limit the acceleration by going forwards (speeding up) and then
+  // backwards (slowing down) along the path.
+  std::vector<double> v(vmax);
+  v.front() = 0;
+  v.back() = 0;
+  const double a = params_.max_acceleration;
+  for (size_t i = 1; i < n; ++i) {
+    v.at(i) = std::min(v.at(i), std::sqrt(v.at(i - 1) * v.at(i - 1) + 2.0 * a * ds.at(i)));
+  }
+  for (size_t i = n - 1; i > 0; --i) {
+    v.at(i - 1) = std::min(v.at(i - 1), std::sqrt(v.at(i) * v.at(i) + 2.0 * a * ds.at(i)));
+  }
+
+  // With a constant acceleration between samples, each one takes distance / average speed.
+  trajectory.reserve(n);
+  double t = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (i > 0) {
+      const double avg = 0.5 * (v.at(i - 1) + v.at(i));
+      t += (avg > 0) ? (ds.at(i) / avg) : 0.0;
+    }
+    trajectory.emplace_back(t, position.at(i), v.at(i) * tangent.at(i));
+  }
+}
+
+
+}
+}
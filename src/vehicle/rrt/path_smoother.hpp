@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "rrt/rrt.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+// A point along a time-parameterized trajectory.
+struct TrajectoryPoint final
+{
+  TrajectoryPoint() = default;
+
+  TrajectoryPoint(double t, const Vector3d& position, const Vector3d& velocity)
+      : t(t), position(position), velocity(velocity) {}
+
+  double t = 0;               // Seconds since the start of the trajectory.
+  Vector3d position = Vector3d::Zero();
+  Vector3d velocity = Vector3d::Zero();
+};
+
+typedef std::vector<TrajectoryPoint> Trajectory;
+
+
+// A natural cubic spline through a list of waypoints, parameterized by the distance between them
+// (chord length). This is the interpolating curve with the least squared acceleration, and fitting
+// it only takes one tridiagonal solve (linear in the number of waypoints).
+class CubicSpline3d final {
+ public:
+  CubicSpline3d() = default;
+
+  // NOTE(milo): Expects at least two waypoints, none of them repeated.
+  explicit CubicSpline3d(const VecVector3d& waypoints);
+
+  // The spline parameter goes from 0 to Length() (roughly, the distance along the curve).
+  double Length() const { return knots_.empty() ? 0.0 : knots_.back(); }
+  size_t NumSegments() const { return knots_.empty() ? 0 : (knots_.size() - 1); }
+  double Knot(size_t i) const { return knots_.at(i); }
+
+  Vector3d Position(double s) const;
+  Vector3d Derivative(double s) const;
+  Vector3d SecondDerivative(double s) const;
+
+ private:
+  // Index of the segment that contains s (clamped to the ends).
+  size_t Segment(double s) const;
+
+  VecVector3d points_;
+  VecVector3d second_derivs_;   // At each knot (zero at the ends).
+  std::vector<double> knots_;
+};
+
+
+// Turns an RRT path (a polyline) into a trajectory that a controller can follow, in three stages:
+//  1. Shortcutting, which removes every waypoint that the path can go straight past. The segments
+//     from a waypoint to all of the later ones are checked in one batch.
+//  2. Fitting a CubicSpline3d through what's left. Wherever the spline collides (it can cut or
+//     overshoot corners), the midpoint of that segment of the polyline is added, and it's fit again.
+//  3. Time parameterization: the fastest speed along the spline that respects the velocity,
+//     acceleration and turning limits, starting and ending at rest.
+//
+// NOTE(milo): The collision checker should be the same one that the planner used, so that the
+// shortcut polyline is collision-free, and refining the spline always converges towards it.
+class PathSmoother final {
+ public:
+  struct Params final
+  {
+    double max_velocity = 1.0;              // m/s
+    double max_acceleration = 0.5;          // m/s^2, along the path.
+    double max_lateral_acceleration = 0.5;  // m/s^2, while turning.
+    double sample_spacing = 0.1;            // m, for collision checks and the output trajectory.
+    int max_refinements = 10;               // Give up if the spline still collides after this.
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PathSmoother)
+
+  PathSmoother(const Params& params, const BatchCollisionChecker& collision_checker);
+
+  // Runs all three stages. Returns false if the path has fewer than two points, or the spline
+  // couldn't be made collision-free.
+  bool Smooth(const VecVector3d& path, Trajectory& trajectory) const;
+
+  // Stage 1: keeps the first and last points, and only the waypoints in between that are needed.
+  void Shortcut(const VecVector3d& path, VecVector3d& shortcut) const;
+
+  // Stage 2: fits a spline through the waypoints, adding more until it's collision-free. Returns
+  // false if it still collides after max_refinements.
+  bool FitSpline(const VecVector3d& waypoints, CubicSpline3d& spline) const;
+
+  // Stage 3: samples the spline every sample_spacing, and assigns each sample a time.
+  void TimeParameterize(const CubicSpline3d& spline, Trajectory& trajectory) const;
+
+  const Params& GetParams() const { return params_; }
+
+ private:
+  // Checks the spline every sample_spacing, and sets is_free[i] to whether segment i is free.
+  void CheckSpline(const CubicSpline3d& spline, std::vector<uint8_t>& is_free) const;
+
+  Params params_;
+  BatchCollisionChecker collision_checker_;
+};
+
+
+}
+}
@@ -0,0 +1,57 @@
+#include "rrt/point_array.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+void PointArray::Reserve(size_t n)
+{
+  x_.reserve(n);
+  y_.reserve(n);
+  z_.reserve(n);
+}
+
+
+void PointArray::PushBack(const Vector3d& point)
+{
+  x_.emplace_back(point.x());
+  y_.emplace_back(point.y());
+  z_.emplace_back(point.z());
+}
+
+
+void PointArray::Clear()
+{
+  x_.clear();
+  y_.clear();
+  z_.clear();
+}
+
+
+void PointArray::Distances(const Vector3d& query_point,
+                           const std::vector<size_t>& indices,
+                           std::vector<double>& distances) const
+{
+  const size_t n = indices.size();
+  distances.resize(n);
+  double* out = distances.data();
+
+  // NOTE(milo): Gather the squared distances first, then take all of the square roots at once. The
+  // gathers don't vectorize (the indices are arbitrary), but Eigen's packet sqrt does, and that's
+  // most of the cost. A plain std::sqrt loop doesn't, since it has to set errno.
+  const size_t* idx = indices.data();
+  const double qx = query_point.x(), qy = query_point.y(), qz = query_point.z();
+  for (size_t k = 0; k < n; ++k) {
+    const double dx = x_[idx[k]] - qx;
+    const double dy = y_[idx[k]] - qy;
+    const double dz = z_[idx[k]] - qz;
+    out[k] = dx*dx + dy*dy + dz*dz;
+  }
+
+  Eigen::Map<Eigen::ArrayXd> out_array(out, static_cast<Eigen::Index>(n));
+  out_array = out_array.sqrt();
+}
+
+
+}
+}
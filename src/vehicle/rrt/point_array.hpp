@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace rrt {
+
+using namespace core;
+
+
+// 3D points stored as separate x, y and z arrays (structure-of-arrays), instead of a vector of
+// Vector3d. Loops over many points (e.g the distances to all of a node's neighbors) then read each
+// coordinate contiguously, and -O3 can vectorize them.
+class PointArray final {
+ public:
+  PointArray() = default;
+
+  void Reserve(size_t n);
+  void PushBack(const Vector3d& point);
+  void Clear();
+
+  size_t Size() const { return x_.size(); }
+
+  Vector3d Get(size_t i) const { return Vector3d(x_[i], y_[i], z_[i]); }
+
+  double X(size_t i) const { return x_[i]; }
+  double Y(size_t i) const { return y_[i]; }
+  double Z(size_t i) const { return z_[i]; }
+
+  double SquaredDistance(size_t i, const Vector3d& query_point) const
+  {
+    const double dx = x_[i] - query_point.x();
+    const double dy = y_[i] - query_point.y();
+    const double dz = z_[i] - query_point.z();
+    return dx*dx + dy*dy + dz*dz;
+  }
+
+  // Set distances[k] to the distance from query_point to the point at indices[k].
+  void Distances(const Vector3d& query_point,
+                 const std::vector<size_t>& indices,
+                 std::vector<double>& distances) const;
+
+ private:
+  std::vector<double> x_, y_, z_;
+};
+
+
+}
+}
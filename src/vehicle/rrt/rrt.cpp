@@ -1,22 +1,41 @@
+#include <algorithm>
 #include <utility>
 #include <glog/logging.h>
 
 #include "rrt/rrt.hpp"
 #include "core/random.hpp"
+#include "core/thread_pool.hpp"
 
 namespace bm {
 namespace rrt {
 
-static const int kDimension = 3;
 static const double kMinObstacleDist = 0.5;
 static const double kMaxLineDist = 5.0;
 
 
 kdtree_t Tree::BuildKdTree() const
 {
-  kdtree_t kdtree(kDimension, points_, 10);
-	kdtree.index->buildIndex();
-  return kdtree;
+  return kdtree_t(points_, 10);
+}
+
+
+size_t Tree::Nearby(const Vector3d& query_point,
+                    double radius,
+                    std::vector<index_t>& indices) const
+{
+  return index_.Nearby(points_, query_point, radius, indices);
+}
+
+
+Tree::index_t Tree::Nearest(const Vector3d& query_point) const
+{
+  return index_.Nearest(points_, query_point);
+}
+
+
+void Tree::SetIndexVoxelSize(double voxel_size)
+{
+  index_.Rebuild(voxel_size, points_);
 }
 
 
@@ -42,7 +61,7 @@ size_t Tree::Nearby(const kdtree_t& kdtree,
 Tree::index_t Tree::Nearest(const kdtree_t& kdtree,
                             const Vector3d& query_point) const
 {
-  CHECK_GE(kdtree.m_data.size(), 1) << "Must have at least 1 point in the KDTree" << std::endl;
+  CHECK_GE(kdtree.kdtree_get_point_count(), 1) << "Must have at least 1 point in the KDTree" << std::endl;
 
 	nf::KNNResultSet<double> result_set(1);
   std::vector<size_t> indices(1);
@@ -56,16 +75,60 @@ Tree::index_t Tree::Nearest(const kdtree_t& kdtree,
 
 size_t Tree::AddNode(const Node& node)
 {
-  points_.emplace_back(node.point);
-  nodes_.emplace_back(node);
-  return (points_.size() - 1);
+  const index_t index = Size();
+  points_.PushBack(node.point);
+  parents_.emplace_back(node.parent);
+  costs_.emplace_back(node.cost_so_far);
+  children_.emplace_back();
+  if (node.parent >= 0) {
+    children_.at(node.parent).emplace_back(index);
+  }
+  index_.Insert(index, node.point);
+  return index;
+}
+
+
+void Tree::CostsThrough(const Vector3d& query_point,
+                        const std::vector<index_t>& indices,
+                        std::vector<double>& distances,
+                        std::vector<double>& costs) const
+{
+  points_.Distances(query_point, indices, distances);
+
+  const size_t n = indices.size();
+  costs.resize(n);
+  for (size_t k = 0; k < n; ++k) {
+    costs[k] = costs_[indices[k]] + distances[k];
+  }
 }
 
 
 void Tree::Rewire(size_t index, int new_parent, double new_cost_so_far)
 {
-  nodes_.at(index).parent = new_parent;
-  nodes_.at(index).cost_so_far = new_cost_so_far;
+  int& parent = parents_.at(index);
+
+  if (parent != new_parent) {
+    if (parent >= 0) {
+      std::vector<index_t>& siblings = children_.at(parent);
+      siblings.erase(std::remove(siblings.begin(), siblings.end(), index), siblings.end());
+    }
+    if (new_parent >= 0) {
+      children_.at(new_parent).emplace_back(index);
+    }
+    parent = new_parent;
+  }
+
+  const double delta = new_cost_so_far - costs_.at(index);
+  costs_.at(index) = new_cost_so_far;
+
+  // Every path through this node changed by the same amount.
+  std::vector<index_t> stack(children_.at(index));
+  while (!stack.empty()) {
+    const index_t i = stack.back();
+    stack.pop_back();
+    costs_[i] += delta;
+    stack.insert(stack.end(), children_.at(i).begin(), children_.at(i).end());
+  }
 }
 
 
@@ -92,57 +155,85 @@ bool ClipCollisionFree(const Vector3d& x0,
 }
 
 
-static std::pair<size_t, double> ChooseParent(const Tree& tree,
-                                              const CollisionChecker& collision_checker,
-                                              const std::vector<Tree::index_t>& Z_near,
-                                              const Tree::index_t& z_nearest,
-                                              const Vector3d& x_new)
+// Returns false if x_new can't be reached from any of the candidate parents.
+static bool ChooseParent(const Tree& tree,
+                         const BatchCollisionChecker& collision_checker,
+                         const std::vector<Tree::index_t>& Z_near,
+                         const Tree::index_t& z_nearest,
+                         const Vector3d& x_new,
+                         std::pair<size_t, double>& z_min)
 {
-  const Node n_nearest = tree.GetNode(z_nearest);
-
-  Tree::index_t z_min = z_nearest;
-  double c_min = n_nearest.cost_so_far + (n_nearest.point - x_new).norm();
+  const double c_nearest = tree.Cost(z_nearest) + (tree.GetPoint(z_nearest) - x_new).norm();
+
+  std::vector<double> dists, costs;
+  tree.CostsThrough(x_new, Z_near, dists, costs);
+
+  // The nearest node, and then only the edges that would be cheaper than going through it.
+  std::vector<Tree::index_t> candidates = { z_nearest };
+  std::vector<double> candidate_costs = { c_nearest };
+  VecVector3d points = { tree.GetPoint(z_nearest) };
+  for (size_t k = 0; k < Z_near.size(); ++k) {
+    if (Z_near[k] != z_nearest && costs[k] < c_nearest) {
+      candidates.emplace_back(Z_near[k]);
+      candidate_costs.emplace_back(costs[k]);
+      points.emplace_back(tree.GetPoint(Z_near[k]));
+    }
+  }
 
-  for (const Tree::index_t& z_near : Z_near) {
-    const Node n_near = tree.GetNode(z_near);
-    const double c = n_near.cost_so_far + (n_near.point - x_new).norm();
-    const bool is_collision_free = collision_checker(n_near.point, x_new);
+  std::vector<uint8_t> is_collision_free;
+  collision_checker(x_new, points, is_collision_free);
 
-    if (is_collision_free && c < c_min) {
-      c_min = c;
-      z_min = z_near;
+  bool found = false;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (is_collision_free.at(i) && (!found || candidate_costs.at(i) < z_min.second)) {
+      z_min = std::pair<size_t, double>(candidates.at(i), candidate_costs.at(i));
+      found = true;
     }
   }
 
-  return std::pair<size_t, double>(z_min, c_min);
+  return found;
 }
 
 
 static void Rewire(Tree& tree,
-                   const CollisionChecker& collision_checker,
+                   const BatchCollisionChecker& collision_checker,
                    const std::vector<Tree::index_t>& Z_near,
                    Tree::index_t z_min,
                    const Node& n_new,
                    Tree::index_t z_new)
 {
-  for (const Tree::index_t& z_near : Z_near) {
-    // The parent of n_new can't be rewired through it.
-    if (z_near == z_min) {
-      continue;
-    }
-
-    const Node& n_near = tree.GetNode(z_near);
-    const bool is_collision_free = collision_checker(n_new.point, n_near.point);
+  std::vector<double> dists, costs_if_rewired;
+  tree.Points().Distances(n_new.point, Z_near, dists);
+  costs_if_rewired.resize(dists.size());
+  for (size_t k = 0; k < dists.size(); ++k) {
+    costs_if_rewired[k] = n_new.cost_so_far + dists[k];
+  }
 
-    if (!is_collision_free) {
-      continue;
+  // Only check the edges that would reduce the cost to reach a nearby node. The parent of n_new
+  // can't be rewired through it.
+  std::vector<Tree::index_t> candidates;
+  std::vector<double> costs;
+  VecVector3d points;
+  for (size_t k = 0; k < Z_near.size(); ++k) {
+    if (Z_near[k] != z_min && costs_if_rewired[k] < tree.Cost(Z_near[k])) {
+      candidates.emplace_back(Z_near[k]);
+      costs.emplace_back(costs_if_rewired[k]);
+      points.emplace_back(tree.GetPoint(Z_near[k]));
     }
+  }
+
+  if (candidates.empty()) {
+    return;
+  }
 
-    const double cost_if_rewired = n_new.cost_so_far + (n_new.point - n_near.point).norm();
+  std::vector<uint8_t> is_collision_free;
+  collision_checker(n_new.point, points, is_collision_free);
 
-    // If rewiring reduces the cost to reach n_near, update its parent.
-    if (cost_if_rewired < n_near.cost_so_far) {
-      tree.Rewire(z_near, z_new, cost_if_rewired);
+  // If rewiring reduces the cost to reach n_near, update its parent. Check again, since an earlier
+  // rewire might have lowered the cost already (if n_near is its descendant).
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (is_collision_free.at(i) && costs.at(i) < tree.Cost(candidates.at(i))) {
+      tree.Rewire(candidates.at(i), z_new, costs.at(i));
     }
   }
 }
@@ -156,35 +247,368 @@ void BuildTree(Tree& tree,
                double search_radius,
                int maxiters)
 {
+  // NOTE(milo): Assumes that the collision checker is symmetric (a -> b is free iff b -> a is).
+  const BatchCollisionChecker batch_checker = [&collision_checker](
+      const Vector3d& from, const VecVector3d& to, std::vector<uint8_t>& is_free)
+  {
+    is_free.resize(to.size());
+    for (size_t i = 0; i < to.size(); ++i) {
+      is_free.at(i) = collision_checker(from, to.at(i)) ? 1 : 0;
+    }
+  };
+
+  BuildTree(tree, start, goal, sampler, batch_checker, search_radius, maxiters);
+}
+
+
+void BuildTree(Tree& tree,
+               const Vector3d& start,
+               const Vector3d& goal,
+               const PointSampler& sampler,
+               const BatchCollisionChecker& collision_checker,
+               double search_radius,
+               int maxiters)
+{
+  // NOTE(milo): Nodes are indexed incrementally as they're added, so nothing is rebuilt per iteration.
+  // With voxels as big as the search radius, Nearby() only has to look at 27 of them.
+  tree.SetIndexVoxelSize(search_radius);
   tree.AddNode(Node(start, -1, 0));
 
+  Tree::index_t z_new;
   for (int iter = 0; iter < maxiters; ++iter) {
-    const kdtree_t kdtree = tree.BuildKdTree();
+    ExtendTree(tree, sampler(), collision_checker, search_radius, z_new);
+  }
+}
+
+
+// ExtendTree() with any nearest-neighbor index.
+template <typename NearestFunction, typename NearbyFunction>
+static bool ExtendTreeWith(Tree& tree,
+                           const NearestFunction& nearest,
+                           const NearbyFunction& nearby,
+                           const Vector3d& x_sample,
+                           const BatchCollisionChecker& collision_checker,
+                           double search_radius,
+                           Tree::index_t& z_new)
+{
+  // Get the node that is nearest to x_sample.
+  Tree::index_t z_nearest = nearest(x_sample);
 
-    // Get the node that is nearest to x_sample.
-    const Vector3d x_sample = sampler();
-    Tree::index_t z_nearest = tree.Nearest(kdtree, x_sample);
+  // Try to find an x_new such that travelling from NN to x_new is collision-free.
+  Vector3d x_new;
+  const bool valid = ClipCollisionFree(
+      tree.GetPoint(z_nearest), x_sample, kMinObstacleDist, kMaxLineDist, x_new);
 
-    // Try to find an x_new such that travelling from NN to x_new is collision-free.
-    Vector3d x_new;
-    const bool valid = ClipCollisionFree(
-        tree.GetPoint(z_nearest), x_sample, kMinObstacleDist, kMaxLineDist, x_new);
+  if (!valid) {
+    return false;
+  }
+
+  // Get nodes that are nearby x_new.
+  std::vector<Tree::index_t> Z_near;
+  nearby(x_new, search_radius, Z_near);
+
+  std::pair<size_t, double> z_min;
+  if (!ChooseParent(tree, collision_checker, Z_near, z_nearest, x_new, z_min)) {
+    return false;
+  }
+
+  // Insert the new node.
+  const Node n_new(x_new, z_min.first, z_min.second);
+  z_new = tree.AddNode(n_new);
+
+  Rewire(tree, collision_checker, Z_near, z_min.first, n_new, z_new);
+  return true;
+}
 
-    if (!valid) {
+
+bool ExtendTree(Tree& tree,
+                const Vector3d& x_sample,
+                const BatchCollisionChecker& collision_checker,
+                double search_radius,
+                Tree::index_t& z_new)
+{
+  return ExtendTreeWith(tree,
+      [&tree](const Vector3d& q) { return tree.Nearest(q); },
+      [&tree](const Vector3d& q, double r, std::vector<Tree::index_t>& out) { tree.Nearby(q, r, out); },
+      x_sample, collision_checker, search_radius, z_new);
+}
+
+
+bool ExtendTree(Tree& tree,
+                const kdtree_t& kdtree,
+                const Vector3d& x_sample,
+                const BatchCollisionChecker& collision_checker,
+                double search_radius,
+                Tree::index_t& z_new)
+{
+  return ExtendTreeWith(tree,
+      [&tree, &kdtree](const Vector3d& q) { return tree.Nearest(kdtree, q); },
+      [&tree, &kdtree](const Vector3d& q, double r, std::vector<Tree::index_t>& out) { tree.Nearby(kdtree, q, r, out); },
+      x_sample, collision_checker, search_radius, z_new);
+}
+
+
+
+void PathToNode(const Tree& tree, Tree::index_t index, VecVector3d& path)
+{
+  path.clear();
+  for (int i = static_cast<int>(index); i >= 0; i = tree.Parent(i)) {
+    path.emplace_back(tree.GetPoint(i));
+  }
+  std::reverse(path.begin(), path.end());
+}
+
+
+bool QueryGoal(const Tree& tree,
+               const Vector3d& goal,
+               const BatchCollisionChecker& collision_checker,
+               double goal_radius,
+               GoalPath& result)
+{
+  result = GoalPath();
+
+  std::vector<Tree::index_t> Z_near;
+  if (tree.Nearby(goal, goal_radius, Z_near) == 0) {
+    return false;
+  }
+
+  std::vector<double> dists, costs;
+  tree.CostsThrough(goal, Z_near, dists, costs);
+
+  VecVector3d to(Z_near.size());
+  for (size_t k = 0; k < Z_near.size(); ++k) {
+    to[k] = tree.GetPoint(Z_near[k]);
+  }
+
+  // NOTE(milo): Assumes that the collision checker is symmetric (a -> b is free iff b -> a is).
+  std::vector<uint8_t> is_free;
+  collision_checker(goal, to, is_free);
+
+  for (size_t k = 0; k < Z_near.size(); ++k) {
+    if (is_free[k] && costs[k] < result.cost) {
+      result.reached = true;
+      result.node = static_cast<int>(Z_near[k]);
+      result.cost = costs[k];
+    }
+  }
+
+  if (!result.reached) {
+    return false;
+  }
+
+  PathToNode(tree, result.node, result.path);
+  result.path.emplace_back(goal);
+  return true;
+}
+
+
+void BuildTreeMultiGoal(Tree& tree,
+                        const Vector3d& start,
+                        const VecVector3d& goals,
+                        const PointSampler& sampler,
+                        const BatchCollisionChecker& collision_checker,
+                        double search_radius,
+                        double goal_radius,
+                        double goal_bias,
+                        int maxiters,
+                        std::vector<GoalPath>& results)
+{
+  tree.SetIndexVoxelSize(search_radius);
+  tree.AddNode(Node(start, -1, 0));
+
+  // Goals that no node is within goal_radius of yet. Biased samples take turns between these, and
+  // once they've all been reached, between all of the goals (to keep improving their paths).
+  std::vector<size_t> unreached(goals.size());
+  for (size_t i = 0; i < goals.size(); ++i) {
+    unreached[i] = i;
+  }
+  size_t next_goal = 0;
+
+  const double goal_radius_sq = goal_radius * goal_radius;
+
+  Tree::index_t z_new;
+  for (int iter = 0; iter < maxiters; ++iter) {
+    Vector3d x_sample;
+    if (!goals.empty() && RandomUniformd(0, 1) < goal_bias) {
+      const size_t n = unreached.empty() ? goals.size() : unreached.size();
+      const size_t i = next_goal++ % n;
+      x_sample = goals.at(unreached.empty() ? i : unreached.at(i));
+    } else {
+      x_sample = sampler();
+    }
+
+    if (!ExtendTree(tree, x_sample, collision_checker, search_radius, z_new)) {
       continue;
     }
 
-    // Get nodes that are nearby x_new.
-    std::vector<Tree::index_t> Z_near;
-    tree.Nearby(kdtree, x_new, search_radius, Z_near);
+    const Vector3d x_new = tree.GetPoint(z_new);
+    unreached.erase(std::remove_if(unreached.begin(), unreached.end(), [&](size_t i)
+    {
+      return (goals.at(i) - x_new).squaredNorm() <= goal_radius_sq;
+    }), unreached.end());
+  }
+
+  results.resize(goals.size());
+  for (size_t i = 0; i < goals.size(); ++i) {
+    QueryGoal(tree, goals.at(i), collision_checker, goal_radius, results.at(i));
+  }
+}
 
-    const std::pair<size_t, double>& z_min = ChooseParent(tree, collision_checker, Z_near, z_nearest, x_new);
+namespace {
 
-    // Insert the new node.
-    const Node n_new(x_new, z_min.first, z_min.second);
-    const size_t z_new = tree.AddNode(n_new);
+// One sample of a parallel batch, and the edges that were checked for it.
+struct BatchSample final
+{
+  Vector3d x_new;
+  bool valid = false;
+  std::vector<Tree::index_t> edges;      // Nodes that might connect to x_new...
+  std::vector<uint8_t> is_free;          // ... and whether they can.
+};
 
-    Rewire(tree, collision_checker, Z_near, z_min.first, n_new, z_new);
+}
+
+
+void BuildTreeParallel(Tree& tree,
+                       const Vector3d& start,
+                       const Vector3d& goal,
+                       const PointSampler& sampler,
+                       const CollisionChecker& collision_checker,
+                       double search_radius,
+                       int maxiters,
+                       const ParallelBuildParams& params)
+{
+  const BatchPointSampler batch_sampler = [&sampler](size_t n, VecVector3d& out)
+  {
+    out.resize(n);
+    for (Vector3d& x : out) {
+      x = sampler();
+    }
+  };
+
+  BuildTreeParallel(tree, start, goal, batch_sampler, collision_checker, search_radius, maxiters, params);
+}
+
+
+void BuildTreeParallel(Tree& tree,
+                       const Vector3d& start,
+                       const Vector3d&,
+                       const BatchPointSampler& sampler,
+                       const CollisionChecker& collision_checker,
+                       double search_radius,
+                       int maxiters,
+                       const ParallelBuildParams& params)
+{
+  CHECK_GE(params.num_threads, 1) << "Need at least one thread" << std::endl;
+  CHECK_GE(params.batch_size, 1) << "Need at least one sample per batch" << std::endl;
+
+  tree.SetIndexVoxelSize(search_radius);
+  tree.AddNode(Node(start, -1, 0));
+
+  ThreadPool pool(params.num_threads - 1);
+  std::vector<BatchSample> batch;
+  std::vector<std::pair<size_t, size_t>> flat_edges;    // (sample, edge) of every edge to check.
+  std::vector<double> dists, costs;
+
+  for (int iter = 0; iter < maxiters; iter += params.batch_size) {
+    const size_t batch_size = static_cast<size_t>(std::min(params.batch_size, maxiters - iter));
+
+    // The sampler might not be threadsafe (e.g a shared random generator).
+    VecVector3d x_samples;
+    sampler(batch_size, x_samples);
+    CHECK_EQ(batch_size, x_samples.size()) << "BatchPointSampler returned the wrong number of samples" << std::endl;
+
+    // Extend towards each sample, and find the edges that could improve the tree. An edge is worth
+    // checking if it might be x_new's best parent, or if x_new could be a better parent for it.
+    batch.resize(batch_size);
+    pool.ParallelFor(batch_size, [&](size_t begin, size_t end)
+    {
+      std::vector<Tree::index_t> Z_near;
+      std::vector<double> dists, costs;
+      for (size_t i = begin; i < end; ++i) {
+        BatchSample& b = batch.at(i);
+        b.edges.clear();
+
+        const Tree::index_t z_nearest = tree.Nearest(x_samples.at(i));
+        b.valid = ClipCollisionFree(tree.GetPoint(z_nearest), x_samples.at(i), kMinObstacleDist, kMaxLineDist, b.x_new);
+        if (!b.valid) {
+          continue;
+        }
+
+        tree.Nearby(b.x_new, search_radius, Z_near);
+        tree.CostsThrough(b.x_new, Z_near, dists, costs);
+
+        const double c_nearest = tree.Cost(z_nearest) + (tree.GetPoint(z_nearest) - b.x_new).norm();
+        double c_lower_bound = c_nearest;
+        for (size_t k = 0; k < costs.size(); ++k) {
+          c_lower_bound = std::min(c_lower_bound, costs[k]);
+        }
+
+        b.edges.emplace_back(z_nearest);
+        for (size_t k = 0; k < Z_near.size(); ++k) {
+          const Tree::index_t z = Z_near[k];
+          const bool maybe_parent = costs[k] < c_nearest;
+          const bool maybe_rewire = (c_lower_bound + dists[k]) < tree.Cost(z);
+          if (z != z_nearest && (maybe_parent || maybe_rewire)) {
+            b.edges.emplace_back(z);
+          }
+        }
+      }
+    });
+
+    // Check all of the edges at once, so that the work is balanced across threads even if some
+    // samples have many more neighbors than others.
+    flat_edges.clear();
+    for (size_t i = 0; i < batch_size; ++i) {
+      batch.at(i).is_free.assign(batch.at(i).edges.size(), 0);
+      for (size_t k = 0; k < batch.at(i).edges.size(); ++k) {
+        flat_edges.emplace_back(i, k);
+      }
+    }
+
+    pool.ParallelFor(flat_edges.size(), [&](size_t begin, size_t end)
+    {
+      for (size_t e = begin; e < end; ++e) {
+        BatchSample& b = batch.at(flat_edges.at(e).first);
+        const size_t k = flat_edges.at(e).second;
+        b.is_free.at(k) = collision_checker(tree.GetPoint(b.edges.at(k)), b.x_new) ? 1 : 0;
+      }
+    }, 16);
+
+    // Insert and rewire serially, with the costs as they are now (earlier samples in the batch might
+    // have rewired some of the nodes). Edges that weren't checked are never used.
+    for (BatchSample& b : batch) {
+      if (!b.valid) {
+        continue;
+      }
+
+      tree.CostsThrough(b.x_new, b.edges, dists, costs);
+
+      bool found = false;
+      std::pair<size_t, double> z_min;
+      for (size_t k = 0; k < b.edges.size(); ++k) {
+        if (b.is_free.at(k) && (!found || costs[k] < z_min.second)) {
+          z_min = std::pair<size_t, double>(b.edges.at(k), costs[k]);
+          found = true;
+        }
+      }
+      if (!found) {
+        continue;
+      }
+
+      const Node n_new(b.x_new, z_min.first, z_min.second);
+      const size_t z_new = tree.AddNode(n_new);
+
+      for (size_t k = 0; k < b.edges.size(); ++k) {
+        const Tree::index_t z = b.edges.at(k);
+        if (z == z_min.first || !b.is_free.at(k)) {
+          continue;
+        }
+        const double cost_if_rewired = n_new.cost_so_far + dists[k];
+        if (cost_if_rewired < tree.Cost(z)) {
+          tree.Rewire(z, z_new, cost_if_rewired);
+        }
+      }
+    }
   }
 }
 
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <limits>
 #include <vector>
 #include <nanoflann.hpp>
 
 #include "core/eigen_types.hpp"
 #include "rrt/nanoflann_adaptor.hpp"
+#include "rrt/voxel_index.hpp"
 
 namespace bm {
 namespace rrt {
@@ -13,12 +15,17 @@ namespace nf = nanoflann;
 using namespace core;
 
 typedef std::vector<core::Vector3d> VecVector3d;
-typedef KDTreeVectorOfVectorsAdaptor<VecVector3d, double> kdtree_t;
+typedef KDTreePointArrayAdaptor<> kdtree_t;
 typedef nf::KDTreeSingleIndexAdaptorParams kdtree_params_t;
 typedef std::pair<size_t, double> IndexAndDist;
 typedef std::function<Vector3d()> PointSampler;
+typedef std::function<void(size_t n, VecVector3d& out)> BatchPointSampler;   // Draws n samples at once.
 typedef std::function<bool(const Vector3d&, const Vector3d&)> CollisionChecker;
 
+// Checks the segments from one point to each of several others at once, setting is_free[i] to
+// whether from -> to[i] is collision-free (e.g MeshCollisionChecker::AreSegmentsFree).
+typedef std::function<void(const Vector3d& from, const VecVector3d& to, std::vector<uint8_t>& is_free)> BatchCollisionChecker;
+
 struct Node
 {
 	Node() = default;
@@ -32,12 +39,30 @@ struct Node
 };
 
 
+// NOTE(milo): Nodes are stored as a structure-of-arrays (see PointArray), so that the costs and
+// distances for a whole set of neighbors can be computed in one (vectorizable) pass. The VoxelIndex
+// and kd-tree read the same point arrays, so nothing is duplicated.
 class Tree {
  public:
 	typedef size_t index_t;
 
+	// Nodes are indexed by a VoxelIndex as they're added. Voxels about as big as the search radius
+	// used with Nearby() make queries fastest.
+	explicit Tree(double index_voxel_size = 1.0) : index_(index_voxel_size) {}
+
 	// Returns nearby neighbors within a spherical search radius. Note that returned
 	// neighbors are sorted by *increasing* distance, so the nearest neighbor is first.
+	size_t Nearby(const Vector3d& query_point,
+								double radius,
+								std::vector<index_t>& indices) const;
+
+	// Find the nearest node to query_point.
+	index_t Nearest(const Vector3d& query_point) const;
+
+	// Re-index all of the nodes with a new voxel size (e.g the search radius).
+	void SetIndexVoxelSize(double voxel_size);
+
+	// Same as above, but query a kd-tree (see BuildKdTree) instead of the VoxelIndex.
 	size_t Nearby(const kdtree_t& kdtree,
 								const Vector3d& query_point,
 								double radius,
@@ -50,18 +75,42 @@ class Tree {
 	// Add a node to the tree and return its index.
 	index_t AddNode(const Node& node);
 
-	Node GetNode(index_t index) const { return nodes_.at(index); }
+	// NOTE(milo): Builds a Node from the arrays. In loops, prefer GetPoint/Parent/Cost (or the batch
+	// versions below) to only read what's needed.
+	Node GetNode(index_t index) const { return Node(points_.Get(index), parents_.at(index), costs_.at(index)); }
+
+	int Parent(index_t index) const { return parents_[index]; }
+	double Cost(index_t index) const { return costs_[index]; }
+
+	// Give a node a new parent (and cost). The change in cost is propagated to all of its
+	// descendants, so cost_so_far stays the cost of the path from the root for every node.
+	// NOTE(milo): The new parent can't be a descendant of the node.
 	void Rewire(index_t index, int new_parent, double new_cost_so_far);
 
-	Vector3d GetPoint(index_t index) const { return points_.at(index); }
+	const std::vector<index_t>& Children(index_t index) const { return children_.at(index); }
+
+	Vector3d GetPoint(index_t index) const { return points_.Get(index); }
+	const PointArray& Points() const { return points_; }
+
+	// For each of the nodes at indices, set distances[k] to its distance from query_point, and
+	// costs[k] to the cost of reaching query_point through it.
+	void CostsThrough(const Vector3d& query_point,
+										const std::vector<index_t>& indices,
+										std::vector<double>& distances,
+										std::vector<double>& costs) const;
 
 	// Rebuild a kd-tree data structure using the current points_. Note that this has to be
-	// recomputed every time we add or remove a node.
+	// recomputed every time we add or remove a node, so BuildTree() uses the VoxelIndex instead.
 	kdtree_t BuildKdTree() const;
 
+	size_t Size() const { return costs_.size(); }
+
  private:
-	VecVector3d points_;
-  std::vector<Node> nodes_;
+	PointArray points_;
+	std::vector<int> parents_;
+	std::vector<double> costs_;
+	std::vector<std::vector<index_t>> children_;
+	VoxelIndex index_;
 };
 
 
@@ -77,6 +126,24 @@ bool ClipCollisionFree(const Vector3d& x0,
 											 Vector3d& x_new);
 
 
+// One iteration of RRT*: extend the tree towards x_sample, choose the cheapest collision-free parent
+// for the new node, and rewire its neighbors through it. Returns false if no node was added.
+bool ExtendTree(Tree& tree,
+								const Vector3d& x_sample,
+								const BatchCollisionChecker& collision_checker,
+								double search_radius,
+								Tree::index_t& z_new);
+
+// Same as above, but find neighbors with a kd-tree of the tree (see Tree::BuildKdTree). Nodes added
+// since the kd-tree was built aren't found.
+bool ExtendTree(Tree& tree,
+								const kdtree_t& kdtree,
+								const Vector3d& x_sample,
+								const BatchCollisionChecker& collision_checker,
+								double search_radius,
+								Tree::index_t& z_new);
+
+
 // Runs the RRT* algorithm.
 void BuildTree(Tree& tree,
 							 const Vector3d& start,
@@ -86,6 +153,85 @@ void BuildTree(Tree& tree,
 							 double search_radius,
 							 int maxiters);
 
+// Same as above, but each iteration checks all of its candidate parents (and rewires) in one batch.
+// Edges that couldn't improve the tree's cost aren't checked at all.
+void BuildTree(Tree& tree,
+							 const Vector3d& start,
+							 const Vector3d& goal,
+							 const PointSampler& sampler,
+							 const BatchCollisionChecker& collision_checker,
+							 double search_radius,
+							 int maxiters);
+
+
+// The best path that a tree has to one goal (see QueryGoal).
+struct GoalPath final
+{
+	bool reached = false;
+	int node = -1;					// The tree node that connects to the goal.
+	double cost = std::numeric_limits<double>::infinity();	// Including the last edge to the goal.
+	VecVector3d path;				// From the root to the goal.
+};
+
+// Points along the tree from the root to a node (inclusive).
+void PathToNode(const Tree& tree, Tree::index_t index, VecVector3d& path);
+
+// Connects a goal to the tree through the cheapest node within goal_radius that has a
+// collision-free edge to it (all of the candidate edges are checked in one batch). This only reads
+// the tree, so any number of goals can be queried after growing it once.
+bool QueryGoal(const Tree& tree,
+							 const Vector3d& goal,
+							 const BatchCollisionChecker& collision_checker,
+							 double goal_radius,
+							 GoalPath& result);
+
+// Grows one RRT* tree for several goals (e.g inspection waypoints), and then answers a QueryGoal()
+// for each of them. A goal_bias fraction of the samples are goals that the tree hasn't reached yet
+// (one at a time, taking turns), so K goals cost a bit more than one goal, instead of K trees.
+void BuildTreeMultiGoal(Tree& tree,
+												const Vector3d& start,
+												const VecVector3d& goals,
+												const PointSampler& sampler,
+												const BatchCollisionChecker& collision_checker,
+												double search_radius,
+												double goal_radius,
+												double goal_bias,
+												int maxiters,
+												std::vector<GoalPath>& results);
+
+struct ParallelBuildParams final
+{
+	int num_threads = 4;		// Including the calling thread.
+	int batch_size = 64;		// Samples per batch.
+};
+
+// Runs RRT* in batches. The samples of a batch are drawn serially (so the sampler doesn't need to be
+// threadsafe), then their nearest neighbors and all of their candidate edges (for both ChooseParent
+// and Rewire) are checked across a thread pool, and finally the new nodes are inserted and rewired
+// serially. Each edge is checked at most once per batch.
+//
+// NOTE(milo): The collision checker is called from several threads at once, so it must be
+// threadsafe (e.g a MeshCollisionChecker that isn't being added to). The samples in a batch only see
+// the tree from before the batch, so they can't connect to each other.
+void BuildTreeParallel(Tree& tree,
+											 const Vector3d& start,
+											 const Vector3d& goal,
+											 const PointSampler& sampler,
+											 const CollisionChecker& collision_checker,
+											 double search_radius,
+											 int maxiters,
+											 const ParallelBuildParams& params);
+
+// Same as above, but each batch of samples is drawn with one call (e.g InformedSampler::SampleBatch).
+void BuildTreeParallel(Tree& tree,
+											 const Vector3d& start,
+											 const Vector3d& goal,
+											 const BatchPointSampler& sampler,
+											 const CollisionChecker& collision_checker,
+											 double search_radius,
+											 int maxiters,
+											 const ParallelBuildParams& params);
+
 
 }
 }
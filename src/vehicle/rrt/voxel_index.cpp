@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "rrt/voxel_index.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+static double SquaredDistance(const std::vector<Vector3d>& points, size_t i, const Vector3d& query_point)
+{
+  return (points[i] - query_point).squaredNorm();
+}
+
+
+static double SquaredDistance(const PointArray& points, size_t i, const Vector3d& query_point)
+{
+  return points.SquaredDistance(i, query_point);
+}
+
+
+VoxelIndex::VoxelIndex(double voxel_size)
+    : voxel_size_(voxel_size)
+{
+  CHECK_GT(voxel_size, 0) << "Voxel size must be positive" << std::endl;
+}
+
+
+void VoxelIndex::Insert(index_t index, const Vector3d& point)
+{
+  voxels_[Key(VoxelCoord(point.x()), VoxelCoord(point.y()), VoxelCoord(point.z()))].emplace_back(index);
+  ++size_;
+}
+
+
+void VoxelIndex::Rebuild(double voxel_size, const std::vector<Vector3d>& points)
+{
+  CHECK_GT(voxel_size, 0) << "Voxel size must be positive" << std::endl;
+  voxel_size_ = voxel_size;
+  voxels_.clear();
+  size_ = 0;
+  for (index_t i = 0; i < points.size(); ++i) {
+    Insert(i, points.at(i));
+  }
+}
+
+
+void VoxelIndex::Rebuild(double voxel_size, const PointArray& points)
+{
+  CHECK_GT(voxel_size, 0) << "Voxel size must be positive" << std::endl;
+  voxel_size_ = voxel_size;
+  voxels_.clear();
+  size_ = 0;
+  for (index_t i = 0; i < points.Size(); ++i) {
+    Insert(i, points.Get(i));
+  }
+}
+
+
+size_t VoxelIndex::Nearby(const std::vector<Vector3d>& points,
+                          const Vector3d& query_point,
+                          double radius,
+                          std::vector<index_t>& indices) const
+{
+  return NearbyImpl(points, query_point, radius, indices);
+}
+
+
+size_t VoxelIndex::Nearby(const PointArray& points,
+                          const Vector3d& query_point,
+                          double radius,
+                          std::vector<index_t>& indices) const
+{
+  return NearbyImpl(points, query_point, radius, indices);
+}
+
+
+VoxelIndex::index_t VoxelIndex::Nearest(const std::vector<Vector3d>& points, const Vector3d& query_point) const
+{
+  return NearestImpl(points, query_point);
+}
+
+
+VoxelIndex::index_t VoxelIndex::Nearest(const PointArray& points, const Vector3d& query_point) const
+{
+  return NearestImpl(points, query_point);
+}
+
+
+template <typename Points>
+size_t VoxelIndex::NearbyImpl(const Points& points,
+                              const Vector3d& query_point,
+                              double radius,
+                              std::vector<index_t>& indices) const
+{
+  std::vector<std::pair<double, index_t>> found;
+  const double radius2 = radius * radius;
+
+  const int x0 = VoxelCoord(query_point.x() - radius), x1 = VoxelCoord(query_point.x() + radius);
+  const int y0 = VoxelCoord(query_point.y() - radius), y1 = VoxelCoord(query_point.y() + radius);
+  const int z0 = VoxelCoord(query_point.z() - radius), z1 = VoxelCoord(query_point.z() + radius);
+
+  for (int ix = x0; ix <= x1; ++ix) {
+    for (int iy = y0; iy <= y1; ++iy) {
+      for (int iz = z0; iz <= z1; ++iz) {
+        const auto it = voxels_.find(Key(ix, iy, iz));
+        if (it == voxels_.end()) {
+          continue;
+        }
+        for (const index_t i : it->second) {
+          const double d2 = SquaredDistance(points, i, query_point);
+          if (d2 <= radius2) {
+            found.emplace_back(d2, i);
+          }
+        }
+      }
+    }
+  }
+
+  std::sort(found.begin(), found.end());
+
+  indices.resize(found.size());
+  for (size_t i = 0; i < found.size(); ++i) {
+    indices.at(i) = found.at(i).second;
+  }
+
+  return indices.size();
+}
+
+
+template <typename Points>
+VoxelIndex::index_t VoxelIndex::NearestImpl(const Points& points, const Vector3d& query_point) const
+{
+  CHECK_GE(size_, 1ul) << "Must have at least 1 point in the VoxelIndex" << std::endl;
+
+  double best_d2 = std::numeric_limits<double>::max();
+  index_t best = 0;
+
+  const auto check_voxel = [&](const std::vector<index_t>& voxel)
+  {
+    for (const index_t i : voxel) {
+      const double d2 = SquaredDistance(points, i, query_point);
+      if (d2 < best_d2) {
+        best_d2 = d2;
+        best = i;
+      }
+    }
+  };
+
+  const int cx = VoxelCoord(query_point.x());
+  const int cy = VoxelCoord(query_point.y());
+  const int cz = VoxelCoord(query_point.z());
+
+  // Voxels in shell r are all at least (r - 1) voxels away from the query point.
+  size_t num_visited = 0;
+  for (int r = 0; ; ++r) {
+    if (best_d2 < std::numeric_limits<double>::max()) {
+      const double min_unvisited = r > 0 ? (r - 1) * voxel_size_ : 0;
+      if (best_d2 <= min_unvisited * min_unvisited) {
+        return best;
+      }
+    }
+
+    // Searching another shell would look at more voxels than there are occupied ones.
+    const size_t shell_size = (r == 0) ? 1 : static_cast<size_t>((2*r + 1)*(2*r + 1)*(2*r + 1) - (2*r - 1)*(2*r - 1)*(2*r - 1));
+    if (num_visited + shell_size > voxels_.size()) {
+      break;
+    }
+    num_visited += shell_size;
+
+    for (int ix = cx - r; ix <= cx + r; ++ix) {
+      for (int iy = cy - r; iy <= cy + r; ++iy) {
+        // Only the faces of the shell (the inside was searched already).
+        const bool on_face = std::abs(ix - cx) == r || std::abs(iy - cy) == r;
+        const int step = on_face ? 1 : 2 * r;
+        for (int iz = cz - r; iz <= cz + r; iz += std::max(1, step)) {
+          const auto it = voxels_.find(Key(ix, iy, iz));
+          if (it != voxels_.end()) {
+            check_voxel(it->second);
+          }
+        }
+      }
+    }
+  }
+
+  // Brute force over the occupied voxels.
+  for (const auto& it : voxels_) {
+    check_voxel(it.second);
+  }
+
+  return best;
+}
+
+
+}
+}
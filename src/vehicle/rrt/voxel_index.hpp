@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "rrt/point_array.hpp"
+#include "rrt/voxel_key.hpp"
+
+namespace bm {
+namespace rrt {
+
+using namespace core;
+
+
+// An incremental nearest-neighbor index for the points in a Tree. Points are hashed into cubic
+// voxels, so Insert() is O(1), and a radius search only looks at the voxels that overlap the search
+// sphere. With voxels about as big as the RRT* search radius, that's 27 voxels per query, no matter
+// how many points there are (unlike a kd-tree, which would have to be rebuilt after each insert).
+//
+// Nearest() searches outwards in shells of voxels until no closer point can be left. If the points
+// are sparse compared to the shells (e.g a small tree in a big workspace), it just checks every
+// occupied voxel instead, so a query never costs more than a brute force search.
+class VoxelIndex final {
+ public:
+  typedef size_t index_t;
+
+  explicit VoxelIndex(double voxel_size = 1.0);
+
+  // Index a point. The index should be the point's position in "points" (see Nearest/Nearby).
+  void Insert(index_t index, const Vector3d& point);
+
+  // Forget all points, and re-index them with a new voxel size.
+  void Rebuild(double voxel_size, const std::vector<Vector3d>& points);
+  void Rebuild(double voxel_size, const PointArray& points);
+
+  // Indices of the points within radius of query_point, sorted by increasing distance.
+  size_t Nearby(const std::vector<Vector3d>& points,
+                const Vector3d& query_point,
+                double radius,
+                std::vector<index_t>& indices) const;
+  size_t Nearby(const PointArray& points,
+                const Vector3d& query_point,
+                double radius,
+                std::vector<index_t>& indices) const;
+
+  // The point nearest to query_point. There must be at least one point.
+  index_t Nearest(const std::vector<Vector3d>& points, const Vector3d& query_point) const;
+  index_t Nearest(const PointArray& points, const Vector3d& query_point) const;
+
+  size_t Size() const { return size_; }
+  double VoxelSize() const { return voxel_size_; }
+
+ private:
+  int VoxelCoord(double x) const { return rrt::VoxelCoord(x, voxel_size_); }
+  static VoxelKey Key(int ix, int iy, int iz) { return PackVoxelKey(ix, iy, iz); }
+
+  // Shared by both point layouts.
+  template <typename Points>
+  size_t NearbyImpl(const Points& points, const Vector3d& query_point, double radius, std::vector<index_t>& indices) const;
+
+  template <typename Points>
+  index_t NearestImpl(const Points& points, const Vector3d& query_point) const;
+
+  double voxel_size_;
+  size_t size_ = 0;
+  std::unordered_map<VoxelKey, std::vector<index_t>> voxels_;
+};
+
+
+}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace bm {
+namespace rrt {
+
+
+typedef uint64_t VoxelKey;
+
+// NOTE(milo): Each voxel coordinate gets 21 bits, so a key covers about +/- 1 million voxels on
+// each axis. That's plenty for any workspace we'd plan in.
+static const int kVoxelCoordBits = 21;
+static const int kVoxelCoordOffset = 1 << (kVoxelCoordBits - 1);
+static const uint64_t kVoxelCoordMask = (1ul << kVoxelCoordBits) - 1;
+
+
+inline int VoxelCoord(double x, double voxel_size)
+{
+  return static_cast<int>(std::floor(x / voxel_size));
+}
+
+
+inline VoxelKey PackVoxelKey(int ix, int iy, int iz)
+{
+  const uint64_t x = static_cast<uint64_t>(ix + kVoxelCoordOffset) & kVoxelCoordMask;
+  const uint64_t y = static_cast<uint64_t>(iy + kVoxelCoordOffset) & kVoxelCoordMask;
+  const uint64_t z = static_cast<uint64_t>(iz + kVoxelCoordOffset) & kVoxelCoordMask;
+  return (x << (2 * kVoxelCoordBits)) | (y << kVoxelCoordBits) | z;
+}
+
+
+}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "vision_core/cv_types.hpp"
+#include "stereo_matching/foreground_roi.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// Common interface for the dense stereo backends, so that callers can choose one from params (see
+// CreateDenseStereo()) instead of depending on a particular matcher.
+class DenseStereo {
+ public:
+  virtual ~DenseStereo() = default;
+
+  // Disparity (in pixels) of each pixel in the (rectified) left image. Negative where invalid.
+  virtual Image1f ComputeDisparity(const Image1b& iml, const Image1b& imr) = 0;
+
+  // Same as above, but the disparity is only needed inside of roi (and is invalid everywhere else).
+  // Backends that can skip the pixels outside of roi override this. By default, the full disparity
+  // is computed and then masked.
+  virtual Image1f ComputeDisparity(const Image1b& iml, const Image1b& imr, const ForegroundRoi& roi)
+  {
+    Image1f disp = ComputeDisparity(iml, imr);
+    disp.setTo(-1.0f, roi.Mask() == 0);
+    return disp;
+  }
+};
+
+
+}
+}
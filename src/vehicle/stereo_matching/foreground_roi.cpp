@@ -0,0 +1,103 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <opencv2/imgproc.hpp>
+
+#include "stereo_matching/foreground_roi.hpp"
+#include "stereo_matching/patchmatch.hpp"
+
+namespace bm {
+namespace stereo {
+
+
+ForegroundRoi::ForegroundRoi(int rows, int cols)
+    : mask_(rows, cols, (uint8_t)255)
+{
+  BuildSpans();
+}
+
+
+ForegroundRoi::ForegroundRoi(const Image1b& mask, int dilate)
+{
+  CHECK_GE(dilate, 0);
+  mask_ = (mask > 0);
+
+  if (dilate > 0) {
+    const cv::Mat kernel = cv::getStructuringElement(
+        cv::MORPH_RECT, cv::Size(2*dilate + 1, 2*dilate + 1), cv::Point(dilate, dilate));
+    cv::dilate(mask_, mask_, kernel);
+  }
+
+  BuildSpans();
+}
+
+
+void ForegroundRoi::BuildSpans()
+{
+  spans_.assign(mask_.rows, std::vector<RowSpan>());
+  area_ = 0;
+
+  for (int y = 0; y < mask_.rows; ++y) {
+    const uint8_t* row = mask_.ptr<uint8_t>(y);
+    int x = 0;
+    while (x < mask_.cols) {
+      // Skip to the start of the next span, then to its end.
+      while (x < mask_.cols && row[x] == 0) {
+        ++x;
+      }
+      const int x0 = x;
+      while (x < mask_.cols && row[x] != 0) {
+        ++x;
+      }
+
+      if (x > x0) {
+        spans_.at(y).emplace_back(x0, x);
+        area_ += (x - x0);
+      }
+    }
+  }
+}
+
+
+std::vector<cv::Point> ForegroundRoi::Tiles(int tile_size) const
+{
+  CHECK_GT(tile_size, 0);
+
+  const int tile_rows = (mask_.rows + tile_size - 1) / tile_size;
+  const int tile_cols = (mask_.cols + tile_size - 1) / tile_size;
+  std::vector<uint8_t> occupied(tile_rows * tile_cols, 0);
+
+  for (int y = 0; y < mask_.rows; ++y) {
+    uint8_t* tile_row = occupied.data() + (y / tile_size) * tile_cols;
+    for (const RowSpan& span : spans_.at(y)) {
+      std::fill(tile_row + span.x0 / tile_size, tile_row + (span.x1 - 1) / tile_size + 1, 1);
+    }
+  }
+
+  std::vector<cv::Point> tiles;
+  for (int ty = 0; ty < tile_rows; ++ty) {
+    for (int tx = 0; tx < tile_cols; ++tx) {
+      if (occupied.at(ty * tile_cols + tx)) {
+        tiles.emplace_back(tx * tile_size, ty * tile_size);
+      }
+    }
+  }
+
+  return tiles;
+}
+
+
+ForegroundRoi EstimateForegroundRoi(const Image1b& gray,
+                                    int dilate,
+                                    int ksize,
+                                    double min_grad,
+                                    int downsize)
+{
+  Image1b mask;
+  ForegroundTextureMask(gray, mask, ksize, min_grad, downsize);
+  return ForegroundRoi(mask, dilate);
+}
+
+
+}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// A horizontal run of pixels [x0, x1) in one row.
+struct RowSpan final
+{
+  RowSpan(int x0, int x1) : x0(x0), x1(x1) {}
+
+  int x0;
+  int x1;
+};
+
+
+// The pixels where dense stereo is worth computing, e.g the textured foreground from
+// ForegroundTextureMask(). In open water most of the image is featureless, and the disparity there
+// gets thrown away anyways (see Patchmatch::RemoveBackground), so backends can skip it.
+//
+// The ROI is stored as a mask, and as a skip-list of spans for each row, so that the CPU backends
+// can jump over the background without testing every pixel. The GPU backends launch one block per
+// tile that has any ROI pixels instead (see Tiles()).
+class ForegroundRoi final {
+ public:
+  // Every pixel of a rows x cols image.
+  ForegroundRoi(int rows, int cols);
+
+  // The nonzero pixels of mask, dilated by "dilate" pixels so that the patches (and disparity
+  // edges) at the boundary of the foreground are kept.
+  ForegroundRoi(const Image1b& mask, int dilate);
+
+  int Rows() const { return mask_.rows; }
+  int Cols() const { return mask_.cols; }
+
+  // 255 inside of the ROI, 0 outside.
+  const Image1b& Mask() const { return mask_; }
+
+  // Spans of ROI pixels in a row, in order of x.
+  const std::vector<RowSpan>& Spans(int row) const { return spans_.at(row); }
+
+  // Number of pixels inside of the ROI.
+  int Area() const { return area_; }
+
+  // Top left corners of the tile_size x tile_size tiles (on a grid starting at (0, 0)) that have
+  // any ROI pixels. Tiles on the right and bottom edges can stick out of the image.
+  std::vector<cv::Point> Tiles(int tile_size) const;
+
+ private:
+  void BuildSpans();
+
+ private:
+  Image1b mask_;
+  std::vector<std::vector<RowSpan>> spans_;
+  int area_ = 0;
+};
+
+
+// The ROI for the left image of a stereo pair: ForegroundTextureMask(), dilated by "dilate" pixels.
+ForegroundRoi EstimateForegroundRoi(const Image1b& gray,
+                                    int dilate,
+                                    int ksize = 7,
+                                    double min_grad = 35.0,
+                                    int downsize = 2);
+
+
+}
+}
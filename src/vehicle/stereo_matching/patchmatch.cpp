@@ -2,6 +2,7 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "core/random.hpp"
 #include "stereo_matching/patchmatch.hpp"
 
 namespace bm {
@@ -12,40 +13,24 @@ void Patchmatch::Params::LoadParams(const YamlParser& p)
 {
   detector_params = ft::FeatureDetector::Params(p.Subtree("FeatureDetector"));
   matcher_params = ft::StereoMatcher::Params(p.Subtree("StereoMatcher"));
+
+  p.GetParam("pyramid_levels", &pyramid_levels);
+  p.GetParam("pyramid_iters", &pyramid_iters);
+  p.GetParam("pyramid_patch_size", &pyramid_patch_size);
+  p.GetParam("pyramid_noise", &pyramid_noise);
+  CHECK_GE(pyramid_levels, 0);
+  CHECK(pyramid_patch_size % 2 != 0);
 }
 
 
-// Returns a binary mask where "1" indicates foreground and "0" indicates background.
-void ForegroundTextureMask(const Image1b& gray,
-                          Image1b& mask,
-                          int ksize,
-                          double min_grad,
-                          int downsize)
+void Patchmatch::SparseMatches(const Image1b& iml,
+                               const Image1b& imr,
+                               VecPoint2f& left_kp,
+                               std::vector<double>& left_kp_disps)
 {
-  CHECK(downsize >= 1 && downsize <= 8) << "Use a downsize argument (int) between 1 and 8" << std::endl;
-  const int scaled_ksize = ksize / downsize;
-  CHECK_GT(scaled_ksize, 1) << "ksize too small for downsize" << std::endl;
-  const int kwidth = 2*scaled_ksize + 1;
-
-  const cv::Mat kernel = cv::getStructuringElement(
-      cv::MORPH_RECT,
-      cv::Size(kwidth, kwidth),
-      cv::Point(scaled_ksize, scaled_ksize));
-
-  // Do image processing at a downsampled size (faster).
-  if (downsize > 1) {
-    Image1b gray_small;
-    cv::resize(gray, gray_small, gray.size() / downsize, 0, 0, cv::INTER_LINEAR);
-    cv::Mat gradient;
-    cv::morphologyEx(gray_small, gradient, cv::MORPH_GRADIENT, kernel, cv::Point(-1, -1), 1);
-    cv::resize(gradient > min_grad, mask, gray.size(), 0, 0, cv::INTER_LINEAR);
-
-  // Do processing at original resolution.
-  } else {
-    cv::Mat gradient;
-    cv::morphologyEx(gray, gradient, cv::MORPH_GRADIENT, kernel, cv::Point(-1, -1), 1);
-    mask = gradient > min_grad;
-  }
+  left_kp.clear();
+  detector_.Detect(iml, VecPoint2f(), left_kp);
+  left_kp_disps = matcher_.MatchRectified(iml, imr, left_kp);
 }
 
 
@@ -54,8 +39,8 @@ Image1f Patchmatch::Initialize(const Image1b& iml,
                                int downsample_factor)
 {
   VecPoint2f left_kp;
-  detector_.Detect(iml, VecPoint2f(), left_kp);
-  const std::vector<double>& left_kp_disps = matcher_.MatchRectified(iml, imr, left_kp);
+  std::vector<double> left_kp_disps;
+  SparseMatches(iml, imr, left_kp, left_kp_disps);
 
   // Default to zero disparity (background).
   Image1f disps(iml.size(), 0.0f);
@@ -140,11 +125,150 @@ static Image3b VisualizeDisp(const Image1f& disp, int max_disp, int pm_downsampl
 }
 
 
+// Sparse disparities (scaled to an image of the given size), with zero everywhere else.
+static Image1f SparseDisparity(const VecPoint2f& left_kp,
+                               const std::vector<double>& left_kp_disps,
+                               const cv::Size& size,
+                               float scale)
+{
+  Image1f disps(size, 0.0f);
+
+  for (size_t i = 0; i < left_kp_disps.size(); ++i) {
+    // Skip negative disparity (invalid).
+    if (left_kp_disps.at(i) < 0) {
+      continue;
+    }
+    const int x = std::min(size.width - 1, (int)std::round(scale * left_kp.at(i).x));
+    const int y = std::min(size.height - 1, (int)std::round(scale * left_kp.at(i).y));
+    disps.at<float>(y, x) = scale * (float)left_kp_disps.at(i);
+  }
+
+  return disps;
+}
+
+
+static void GradientMagnitude(const Image1b& im, Image1f& gmag)
+{
+  Image1f Dx, Dy;
+  cv::Sobel(im, Dx, CV_32F, 1, 0, 3);
+  cv::Sobel(im, Dy, CV_32F, 0, 1, 3);
+  cv::magnitude(Dx, Dy, gmag);
+}
+
+
+Image1f Patchmatch::EstimateDisparityPyramid(const Image1b& iml,
+                                             const Image1b& imr,
+                                             const CostFunctor2& f,
+                                             const ft::ImagePyramid& left_pyr)
+{
+  const int levels = params_.pyramid_levels;
+
+  // Match keypoints at full resolution, since that's where the detector and matcher are tuned.
+  VecPoint2f left_kp;
+  std::vector<double> left_kp_disps;
+  SparseMatches(iml, imr, left_kp, left_kp_disps);
+
+  // Level 0 is full resolution. The left levels come from left_pyr when it has them, which was
+  // built with cv::pyrDown too.
+  std::vector<Image1b> pyr_l(levels + 1), pyr_r(levels + 1);
+  pyr_l.at(0) = iml;
+  pyr_r.at(0) = imr;
+  for (int level = 1; level <= levels; ++level) {
+    const cv::Mat shared = left_pyr.MaxLevel() >= level ? left_pyr.LevelImage(level) : cv::Mat();
+    if (!shared.empty() && shared.type() == CV_8UC1) {
+      pyr_l.at(level) = shared;
+    } else {
+      cv::pyrDown(pyr_l.at(level - 1), pyr_l.at(level));
+    }
+    cv::pyrDown(pyr_r.at(level - 1), pyr_r.at(level));
+  }
+
+  std::vector<Image1f> grad_l(levels + 1), grad_r(levels + 1);
+  for (int level = 0; level <= levels; ++level) {
+    GradientMagnitude(pyr_l.at(level), grad_l.at(level));
+    GradientMagnitude(pyr_r.at(level), grad_r.at(level));
+  }
+
+  return CoarseToFine(pyr_l, pyr_r, grad_l, grad_r, left_kp, left_kp_disps, f);
+}
+
+
+Image1f Patchmatch::EstimateDisparityPyramid(const StereoImage1b& stereo_pair, const CostFunctor2& f)
+{
+  const int levels = params_.pyramid_levels;
+  const Image1b& iml = stereo_pair.left_image;
+  const Image1b& imr = stereo_pair.right_image;
+
+  VecPoint2f left_kp;
+  std::vector<double> left_kp_disps;
+  SparseMatches(iml, imr, left_kp, left_kp_disps);
+
+  ImageCache& cache_l = stereo_pair.cache->left;
+  ImageCache& cache_r = stereo_pair.cache->right;
+
+  return CoarseToFine(cache_l.Pyramid(iml, levels + 1),
+                      cache_r.Pyramid(imr, levels + 1),
+                      cache_l.GradientPyramid(iml, levels + 1),
+                      cache_r.GradientPyramid(imr, levels + 1),
+                      left_kp, left_kp_disps, f);
+}
+
+
+Image1f Patchmatch::CoarseToFine(const std::vector<Image1b>& pyr_l,
+                                 const std::vector<Image1b>& pyr_r,
+                                 const std::vector<Image1f>& grad_l,
+                                 const std::vector<Image1f>& grad_r,
+                                 const VecPoint2f& left_kp,
+                                 const std::vector<double>& left_kp_disps,
+                                 const CostFunctor2& f)
+{
+  const int levels = static_cast<int>(pyr_l.size()) - 1;
+  const int patch_size = params_.pyramid_patch_size;
+
+  Image1f disp;
+
+  for (int level = levels; level >= 0; --level) {
+    const Image1b& il = pyr_l.at(level);
+    const Image1b& ir = pyr_r.at(level);
+    const Image1f& Gl = grad_l.at(level);
+    const Image1f& Gr = grad_r.at(level);
+
+    const float scale = 1.0f / (float)(1 << level);
+    const Image1f anchors = SparseDisparity(left_kp, left_kp_disps, il.size(), scale);
+
+    // Coarsest level: spread the sparse matches a little, like Initialize() does.
+    if (disp.empty()) {
+      const cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
+      cv::dilate(anchors, disp, element);
+
+    // Disparity doubles along with the image width.
+    } else {
+      cv::resize(disp, disp, il.size(), 0, 0, cv::INTER_NEAREST);
+      disp *= 2.0f;
+    }
+
+    anchors.copyTo(disp, anchors > 0);
+
+    if (level > 0) {
+      for (int iter = 0; iter < params_.pyramid_iters; ++iter) {
+        AddNoise(disp, params_.pyramid_noise, disp > 0);
+        Propagate(il, ir, Gl, Gr, disp, f, patch_size, patch_size);
+      }
+    } else {
+      Propagate(il, ir, Gl, Gr, disp, f, patch_size, patch_size);
+    }
+  }
+
+  return disp;
+}
+
+
 void Patchmatch::AddNoise(Image1f& disp, float amount, const Image1b& mask)
 {
-  Image1f disp_noise(disp.size(), 0);
-  cv::RNG rng(123);
-  rng.fill(disp_noise, cv::RNG::UNIFORM, -amount, amount, false);
+  // NOTE(milo): A new Mat is always continuous, so it can be filled as one array.
+  Image1f disp_noise(disp.size());
+  RandomStream rng(123);
+  rng.FillUniform(disp_noise.ptr<float>(), disp_noise.total(), -amount, amount);
 
   if (!mask.empty()) {
     cv::add(disp, disp_noise, disp, mask);
@@ -4,8 +4,11 @@
 #include "params/params_base.hpp"
 #include "params/yaml_parser.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/foreground_mask.hpp"
+#include "vision_core/stereo_image.hpp"
 
 #include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/image_pyramid.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
 
 namespace bm {
@@ -18,14 +21,6 @@ typedef std::function<float(const Image1b&, const Image1b&)> CostFunctor;
 typedef std::function<float(const Image1b&, const Image1b&, const Image1f&, const Image1f&)> CostFunctor2;
 
 
-// Returns a binary mask where "1" indicates foreground and "0" indicates background.
-void ForegroundTextureMask(const Image1b& gray,
-                          Image1b& mask,
-                          int ksize = 7,
-                          double min_grad = 35.0,
-                          int downsize = 2);
-
-
 class Patchmatch final {
  public:
   struct Params final : public ParamsBase {
@@ -34,6 +29,12 @@ class Patchmatch final {
     ft::FeatureDetector::Params detector_params;
     ft::StereoMatcher::Params matcher_params;
 
+    // Coarse-to-fine mode (see EstimateDisparityPyramid()).
+    int pyramid_levels = 2;       // Number of coarse levels (e.g 2 means 1/4 and 1/2 resolution).
+    int pyramid_iters = 2;        // Propagation iterations at each coarse level.
+    int pyramid_patch_size = 5;
+    float pyramid_noise = 2.0f;   // Noise (in pixels of disparity) added before each coarse iteration.
+
    private:
     void LoadParams(const YamlParser& p) override;
   };
@@ -52,6 +53,20 @@ class Patchmatch final {
                      const Image1b& imr,
                      int downsample_factor);
 
+  // Coarse-to-fine disparity for the full resolution images. Starts from the sparse stereo matches
+  // at the coarsest level, runs pyramid_iters propagation iterations at each coarse level, and
+  // upsamples the result to the next one. Only one Propagate() is done at full resolution. The
+  // sparse matches are re-applied at every level, so that they act as anchors.
+  // If left_pyr has the needed levels (e.g the frontend's KLT pyramid for this image), they're
+  // reused instead of downsampling iml again.
+  Image1f EstimateDisparityPyramid(const Image1b& iml,
+                                   const Image1b& imr,
+                                   const CostFunctor2& f,
+                                   const ft::ImagePyramid& left_pyr = ft::ImagePyramid());
+
+  // Same as above, but the pyramids and gradients come from (and are left in) the frame's cache.
+  Image1f EstimateDisparityPyramid(const StereoImage1b& stereo_pair, const CostFunctor2& f);
+
   void AddNoise(Image1f& disp, float amount, const Image1b& mask);
 
   void Propagate(const Image1b& iml,
@@ -73,6 +88,22 @@ class Patchmatch final {
                         int patch_width,
                         float win_by_factor = 2.0);
 
+ private:
+  // Detect keypoints in iml and match them into imr (disparities are negative if not matched).
+  void SparseMatches(const Image1b& iml,
+                     const Image1b& imr,
+                     VecPoint2f& left_kp,
+                     std::vector<double>& left_kp_disps);
+
+  // The coarse-to-fine loop of EstimateDisparityPyramid(), where level 0 is full resolution.
+  Image1f CoarseToFine(const std::vector<Image1b>& pyr_l,
+                       const std::vector<Image1b>& pyr_r,
+                       const std::vector<Image1f>& grad_l,
+                       const std::vector<Image1f>& grad_r,
+                       const VecPoint2f& left_kp,
+                       const std::vector<double>& left_kp_disps,
+                       const CostFunctor2& f);
+
  private:
   Params params_;
 
@@ -0,0 +1,51 @@
+#include "stereo_matching/patchmatch_cpu.hpp"
+
+namespace bm {
+namespace stereo {
+namespace internal {
+
+
+void SamplePatch(const Image1b& im, float cx, int y, int pw, int ph, uint8_t* out)
+{
+  const SubpixColumns s(cx - (pw - 1) * 0.5f);
+  int j0, j1;
+  InteriorRange(s.ix, pw, im.cols, j0, j1);
+
+  const int y0 = y - (ph - 1) / 2;
+  for (int i = 0; i < ph; ++i, out += pw) {
+    const uint8_t* row = im.ptr<uint8_t>(y0 + i);
+    const uint8_t* src = row + s.ix;
+    for (int j = 0; j < j0; ++j) { out[j] = row[0]; }
+    for (int j = j0; j < j1; ++j) {
+      out[j] = static_cast<uint8_t>((src[j]*s.w0_fixed + src[j + 1]*s.w1_fixed + (1 << 15)) >> 16);
+    }
+    for (int j = j1; j < pw; ++j) { out[j] = row[im.cols - 1]; }
+  }
+}
+
+
+void SamplePatch(const Image1f& im, float cx, int y, int pw, int ph, float* out)
+{
+  const SubpixColumns s(cx - (pw - 1) * 0.5f);
+  int j0, j1;
+  InteriorRange(s.ix, pw, im.cols, j0, j1);
+
+  const float w0 = 1.0f - s.a;
+  const float w1 = s.a;
+
+  const int y0 = y - (ph - 1) / 2;
+  for (int i = 0; i < ph; ++i, out += pw) {
+    const float* row = im.ptr<float>(y0 + i);
+    const float* src = row + s.ix;
+    for (int j = 0; j < j0; ++j) { out[j] = row[0]; }
+    for (int j = j0; j < j1; ++j) {
+      out[j] = src[j]*w0 + src[j + 1]*w1;
+    }
+    for (int j = j1; j < pw; ++j) { out[j] = row[im.cols - 1]; }
+  }
+}
+
+
+}
+}
+}
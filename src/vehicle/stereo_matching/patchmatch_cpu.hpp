@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <glog/logging.h>
+#include <opencv2/core.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// Largest patch (in either dimension) that PatchmatchCpu supports. Patches are sampled into fixed
+// size buffers on the stack, so that propagation never allocates.
+static const int kPatchmatchCpuMaxPatch = 15;
+
+
+// Same cost as L1GradientCostFunction in test/stereo_matching/patchmatch_test.cpp, but on patches
+// that have already been sampled into contiguous buffers (n pixels each). The loops are flat and
+// branch-free so that they vectorize.
+// NOTE(milo): Sums are computed the same way as cv::mean (exact integer sum for 8-bit, double for
+// float), so that this gives the same result as the cv::Mat version.
+struct L1GradientCost final
+{
+  float alpha = 0.7f;
+  float tau_color = 50.0f;
+  float tau_grad = 20.0f;
+
+  inline float operator()(const uint8_t* ref,
+                          const uint8_t* cand,
+                          const float* gref,
+                          const float* gcand,
+                          int n) const
+  {
+    int sum_color = 0;
+    for (int i = 0; i < n; ++i) {
+      sum_color += std::abs(static_cast<int>(ref[i]) - static_cast<int>(cand[i]));
+    }
+
+    double sum_grad = 0;
+    for (int i = 0; i < n; ++i) {
+      sum_grad += std::fabs(gref[i] - gcand[i]);
+    }
+
+    const double scale = 1.0 / n;
+    const float error_color = std::fmin(static_cast<float>(sum_color * scale), tau_color);
+    const float error_grad = std::fmin(static_cast<float>(sum_grad * scale), tau_grad);
+
+    return alpha * error_color + (1 - alpha) * error_grad;
+  }
+};
+
+
+namespace internal {
+
+// Bilinear sampling weights for a patch whose left edge is at the (fractional) column "left".
+// Matches cv::getRectSubPix, which uses 16-bit fixed point weights for 8-bit images.
+struct SubpixColumns final
+{
+  explicit SubpixColumns(float left)
+      : ix(static_cast<int>(std::floor(left))),
+        a(left - static_cast<float>(ix)),
+        w0_fixed(static_cast<int>(std::lrint((1.0f - a) * (1 << 16)))),
+        w1_fixed(static_cast<int>(std::lrint(a * (1 << 16)))) {}
+
+  int ix;           // First column of the patch (rounded down).
+  float a;          // Weight on the column to the right.
+  int w0_fixed;
+  int w1_fixed;
+};
+
+
+// Columns [j0, j1) of a pw-wide patch at ix have both of their interpolation neighbors inside an
+// image with "cols" columns. Outside of that, cv::getRectSubPix replicates the border pixel.
+inline void InteriorRange(int ix, int pw, int cols, int& j0, int& j1)
+{
+  j0 = std::min(pw, std::max(0, -ix));
+  j1 = std::max(j0, std::min(pw, cols - 1 - ix));
+}
+
+
+// Sample the ph x pw patch centered at (cx, y) into "out" (row-major). Same result as
+// cv::getRectSubPix, but only the column can be fractional.
+// NOTE(milo): These are in patchmatch_cpu.cpp, which is compiled without floating point
+// contraction (FMA), so that the interpolation rounds exactly like OpenCV does.
+void SamplePatch(const Image1b& im, float cx, int y, int pw, int ph, uint8_t* out);
+void SamplePatch(const Image1f& im, float cx, int y, int pw, int ph, float* out);
+
+
+// Copy the patch centered at the integer pixel (x, y), which must be inside the image.
+template <typename T>
+inline void CopyPatch(const cv::Mat_<T>& im, int x, int y, int pw, int ph, T* out)
+{
+  const int x0 = x - (pw - 1) / 2;
+  const int y0 = y - (ph - 1) / 2;
+  for (int i = 0; i < ph; ++i, out += pw) {
+    std::memcpy(out, im.template ptr<T>(y0 + i) + x0, pw * sizeof(T));
+  }
+}
+
+}
+
+
+// A CPU implementation of Patchmatch::Propagate(). It gives the same disparity output, but:
+// - the cost is a template parameter (e.g L1GradientCost) instead of a std::function, so that it
+//   can be inlined, and it works on contiguous patch buffers instead of cv::Mat patches
+// - patches are sampled with row pointers into stack buffers, rather than cv::getRectSubPix()
+// - each pass runs in parallel (cv::parallel_for_) across the rows or columns that don't depend on
+//   each other
+//
+// The Cost must have: float operator()(const uint8_t* ref, const uint8_t* cand,
+//                                      const float* gref, const float* gcand, int n) const
+template <typename Cost>
+class PatchmatchCpu final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(PatchmatchCpu);
+
+  explicit PatchmatchCpu(const Cost& cost = Cost()) : cost_(cost) {}
+
+  // See Patchmatch::Propagate(). Does four passes over disp: left-to-right, top-to-bottom,
+  // right-to-left and bottom-to-top. Each pixel takes its neighbor's disparity (from earlier in the
+  // pass) if that has a lower cost.
+  void Propagate(const Image1b& iml,
+                 const Image1b& imr,
+                 const Image1f& Gl,
+                 const Image1f& Gr,
+                 Image1f& disp,
+                 int patch_height,
+                 int patch_width) const
+  {
+    CHECK(patch_height % 2 != 0);
+    CHECK(patch_width % 2 != 0);
+    CHECK_LE(patch_height, kPatchmatchCpuMaxPatch);
+    CHECK_LE(patch_width, kPatchmatchCpuMaxPatch);
+    CHECK(iml.size() == imr.size() && iml.size() == Gl.size() &&
+          iml.size() == Gr.size() && iml.size() == disp.size());
+
+    const int w = iml.cols;
+    const int h = iml.rows;
+
+    // Pixels within patch dimensions of the border are skipped (same as Patchmatch::Propagate).
+    const int ymin = patch_height / 2;
+    const int ymax = h - patch_height / 2 - 1;
+    const int xmin = patch_width / 2;
+    const int xmax = w - patch_width / 2 - 1;
+
+    // NOTE(milo): The forward passes start at 1 and the backward passes at (size - 2), so that the
+    // neighbor is always inside the image.
+    const int fy0 = std::max(1, ymin);
+    const int fx0 = std::max(1, xmin);
+    const int by1 = std::min(h - 2, ymax);
+    const int bx1 = std::min(w - 2, xmax);
+
+    const Images im{iml, imr, Gl, Gr, patch_width, patch_height};
+
+    // Horizontal passes: each pixel depends on the one beside it, so rows are independent.
+    ForEachRowInParallel(fy0, ymax, [&](int y) {
+      for (int x = fx0; x <= xmax; ++x) { UpdatePixel(im, x, y, -1, 0, disp); }
+    });
+
+    // Vertical passes: each pixel depends on the one above/below it, so columns are independent.
+    ForEachColumnStripeInParallel(fx0, xmax, [&](int x0, int x1) {
+      for (int y = fy0; y <= ymax; ++y) {
+        for (int x = x0; x < x1; ++x) { UpdatePixel(im, x, y, 0, -1, disp); }
+      }
+    });
+
+    ForEachRowInParallel(ymin, by1, [&](int y) {
+      for (int x = bx1; x >= xmin; --x) { UpdatePixel(im, x, y, 1, 0, disp); }
+    });
+
+    ForEachColumnStripeInParallel(xmin, bx1, [&](int x0, int x1) {
+      for (int y = by1; y >= ymin; --y) {
+        for (int x = x0; x < x1; ++x) { UpdatePixel(im, x, y, 0, 1, disp); }
+      }
+    });
+  }
+
+ private:
+  static const int kMaxPatchPixels = kPatchmatchCpuMaxPatch * kPatchmatchCpuMaxPatch;
+  static const int kStripeWidth = 32;   // Columns per task in the vertical passes.
+
+  struct Images final
+  {
+    const Image1b& iml;
+    const Image1b& imr;
+    const Image1f& Gl;
+    const Image1f& Gr;
+    int pw;
+    int ph;
+  };
+
+  // Same as PropagateNeighbors() in patchmatch.cpp, for the neighbor at (x + dx, y + dy).
+  void UpdatePixel(const Images& im, int x, int y, int dx, int dy, Image1f& disp) const
+  {
+    const int n = im.pw * im.ph;
+    std::array<uint8_t, kMaxPatchPixels> ref, cand;
+    std::array<float, kMaxPatchPixels> gref, gcand;
+
+    internal::CopyPatch(im.iml, x, y, im.pw, im.ph, ref.data());
+    internal::CopyPatch(im.Gl, x, y, im.pw, im.ph, gref.data());
+
+    const float fx = static_cast<float>(x);
+    const float min_x = static_cast<float>(im.pw / 2);
+
+    float* drow = disp.ptr<float>(y);
+    const float d0 = std::fmin(std::fmax(drow[x], 0.0f), fx - min_x);
+    const float dn = disp.ptr<float>(y + dy)[x + dx];
+
+    internal::SamplePatch(im.imr, fx - d0, y, im.pw, im.ph, cand.data());
+    internal::SamplePatch(im.Gr, fx - d0, y, im.pw, im.ph, gcand.data());
+    const float cost_current = cost_(ref.data(), cand.data(), gref.data(), gcand.data(), n);
+
+    float best = d0;
+    if ((fx - dn) >= min_x) {
+      internal::SamplePatch(im.imr, fx - dn, y, im.pw, im.ph, cand.data());
+      internal::SamplePatch(im.Gr, fx - dn, y, im.pw, im.ph, gcand.data());
+      const float cost_neighbor = cost_(ref.data(), cand.data(), gref.data(), gcand.data(), n);
+      if (cost_neighbor < cost_current) {
+        best = dn;
+      }
+    }
+
+    drow[x] = best;
+  }
+
+  // Calls f(y) for each y in [y0, y1], split across threads.
+  template <typename Function>
+  static void ForEachRowInParallel(int y0, int y1, const Function& f)
+  {
+    if (y1 < y0) {
+      return;
+    }
+    cv::parallel_for_(cv::Range(y0, y1 + 1), [&](const cv::Range& range) {
+      for (int y = range.start; y < range.end; ++y) { f(y); }
+    });
+  }
+
+  // Calls f(x0, x1) for stripes of columns [x0, x1) that cover [xmin, xmax], split across threads.
+  template <typename Function>
+  static void ForEachColumnStripeInParallel(int xmin, int xmax, const Function& f)
+  {
+    if (xmax < xmin) {
+      return;
+    }
+    const int num_stripes = (xmax - xmin + kStripeWidth) / kStripeWidth;
+    cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range& range) {
+      for (int i = range.start; i < range.end; ++i) {
+        const int x0 = xmin + i * kStripeWidth;
+        f(x0, std::min(xmax + 1, x0 + kStripeWidth));
+      }
+    });
+  }
+
+ private:
+  Cost cost_;
+};
+
+
+}
+}
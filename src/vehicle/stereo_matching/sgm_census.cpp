@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "stereo_matching/sgm_census.hpp"
+
+namespace bm {
+namespace stereo {
+
+
+static const int kCensusRadius = 2;
+static const uint8_t kMaxCensusCost = 24;   // Bits in a 5x5 census descriptor.
+
+
+void SgmCensus::Params::LoadParams(const YamlParser& parser)
+{
+  matcher_params = ft::StereoMatcher::Params(parser.Subtree("StereoMatcher"));
+  parser.GetParam("num_paths", &num_paths);
+  parser.GetParam("P1", &P1);
+  parser.GetParam("P2", &P2);
+  parser.GetParam("uniqueness", &uniqueness);
+  parser.GetParam("lr_max_diff", &lr_max_diff);
+  parser.GetParam("subpixel", &subpixel);
+}
+
+
+void Census5x5(const Image1b& im, uint32_t* out)
+{
+  const int rows = im.rows;
+  const int cols = im.cols;
+  std::fill(out, out + rows * cols, 0);
+
+  cv::parallel_for_(cv::Range(kCensusRadius, std::max(kCensusRadius, rows - kCensusRadius)),
+      [&](const cv::Range& range)
+  {
+    for (int y = range.start; y < range.end; ++y) {
+      const uint8_t* center_row = im.ptr<uint8_t>(y);
+      uint32_t* out_row = out + y * cols;
+
+      for (int x = kCensusRadius; x < cols - kCensusRadius; ++x) {
+        const uint8_t center = center_row[x];
+        uint32_t desc = 0;
+        for (int dy = -kCensusRadius; dy <= kCensusRadius; ++dy) {
+          const uint8_t* row = im.ptr<uint8_t>(y + dy);
+          for (int dx = -kCensusRadius; dx <= kCensusRadius; ++dx) {
+            if (dy != 0 || dx != 0) {
+              desc = (desc << 1) | (row[x + dx] < center ? 1 : 0);
+            }
+          }
+        }
+        out_row[x] = desc;
+      }
+    }
+  });
+}
+
+
+// One step along a path, for all disparities of pixel p:
+//    Lr(p, d) = C(p, d) + min(Lr(q, d), Lr(q, d-1) + P1, Lr(q, d+1) + P1, min_k Lr(q, k) + P2)
+//               - min_k Lr(q, k)
+// where q is the previous pixel on the path. If there is no previous pixel, Lr(p, d) = C(p, d).
+// Adds Lr(p) into sum, and returns min_d Lr(p, d).
+// NOTE(milo): Subtracting min_k Lr(q, k) keeps Lr <= max(C) + P2, so 16 bits are plenty.
+static inline uint16_t UpdatePath(const uint8_t* cost,
+                                  const uint16_t* prev,
+                                  uint16_t prev_min,
+                                  int num_disp,
+                                  uint16_t P1,
+                                  uint16_t P2,
+                                  uint16_t* cur,
+                                  uint16_t* sum)
+{
+  uint16_t cur_min = std::numeric_limits<uint16_t>::max();
+
+  if (prev == nullptr) {
+    for (int d = 0; d < num_disp; ++d) {
+      cur[d] = cost[d];
+      sum[d] += cur[d];
+      cur_min = std::min(cur_min, cur[d]);
+    }
+    return cur_min;
+  }
+
+  const uint16_t jump = prev_min + P2;
+
+  // The first and last disparities only have one neighbor, so that the loop in between has no
+  // branches (and vectorizes).
+  const int last = num_disp - 1;
+  cur[0] = cost[0] + std::min(std::min(prev[0], static_cast<uint16_t>(prev[1] + P1)), jump) - prev_min;
+  cur[last] = cost[last] + std::min(std::min(prev[last], static_cast<uint16_t>(prev[last - 1] + P1)), jump) - prev_min;
+
+  for (int d = 1; d < last; ++d) {
+    const uint16_t neighbor = std::min(prev[d - 1], prev[d + 1]) + P1;
+    cur[d] = cost[d] + std::min(std::min(prev[d], neighbor), jump) - prev_min;
+  }
+
+  for (int d = 0; d < num_disp; ++d) {
+    sum[d] += cur[d];
+    cur_min = std::min(cur_min, cur[d]);
+  }
+
+  return cur_min;
+}
+
+
+SgmCensus::SgmCensus(const Params& params)
+    : params_(params),
+      num_disp_(params.matcher_params.max_disp + 1)
+{
+  CHECK_GE(params_.matcher_params.max_disp, 1);
+  CHECK(params_.num_paths == 4 || params_.num_paths == 8) << "num_paths must be 4 or 8" << std::endl;
+  CHECK(params_.P1 >= 0 && params_.P2 >= params_.P1);
+
+  // The aggregated cost is stored in 16 bits.
+  CHECK_LT(params_.num_paths * (kMaxCensusCost + params_.P2), std::numeric_limits<uint16_t>::max());
+}
+
+
+Image1f SgmCensus::ComputeDisparity(const Image1b& iml, const Image1b& imr)
+{
+  return ComputeDisparity(iml, imr, ForegroundRoi(iml.rows, iml.cols));
+}
+
+
+Image1f SgmCensus::ComputeDisparity(const Image1b& iml, const Image1b& imr, const ForegroundRoi& roi)
+{
+  CHECK(iml.size() == imr.size());
+  CHECK(roi.Mask().size() == iml.size());
+
+  rows_ = iml.rows;
+  cols_ = iml.cols;
+
+  // NOTE(milo): Nothing is zeroed here, since ComputeCost() only initializes the ROI pixels.
+  const size_t volume = static_cast<size_t>(rows_) * cols_ * num_disp_;
+  census_l_.resize(rows_ * cols_);
+  census_r_.resize(rows_ * cols_);
+  cost_.resize(volume);
+  sum_.resize(volume);
+
+  for (int i = 0; i < 3; ++i) {
+    path_prev_[i].resize(cols_ * num_disp_);
+    path_cur_[i].resize(cols_ * num_disp_);
+    path_min_prev_[i].resize(cols_);
+    path_min_cur_[i].resize(cols_);
+  }
+
+  ComputeCost(iml, imr, roi);
+
+  AggregateHorizontal(roi);
+  AggregateVertical(1, roi);
+  AggregateVertical(-1, roi);
+
+  Image1f disp(rows_, cols_, -1.0f);
+  SelectDisparity(roi, disp);
+
+  return disp;
+}
+
+
+void SgmCensus::ComputeCost(const Image1b& iml, const Image1b& imr, const ForegroundRoi& roi)
+{
+  // NOTE(milo): The census is cheap compared to the cost volume, and ROI pixels match right image
+  // pixels outside of the ROI, so it's done for the whole image.
+  Census5x5(iml, census_l_.data());
+  Census5x5(imr, census_r_.data());
+
+  const int D = num_disp_;
+
+  cv::parallel_for_(cv::Range(0, rows_), [&](const cv::Range& range)
+  {
+    for (int y = range.start; y < range.end; ++y) {
+      const uint32_t* cl = census_l_.data() + y * cols_;
+      const uint32_t* cr = census_r_.data() + y * cols_;
+
+      for (const RowSpan& span : roi.Spans(y)) {
+        for (int x = span.x0; x < span.x1; ++x) {
+          const size_t offset = (static_cast<size_t>(y) * cols_ + x) * D;
+          uint8_t* c = cost_.data() + offset;
+
+          // Disparities that fall off the left side of the right image get the max cost.
+          const int dmax = std::min(D - 1, x);
+          for (int d = 0; d <= dmax; ++d) {
+            c[d] = static_cast<uint8_t>(__builtin_popcount(cl[x] ^ cr[x - d]));
+          }
+          std::fill(c + dmax + 1, c + D, kMaxCensusCost);
+          std::fill(sum_.data() + offset, sum_.data() + offset + D, 0);
+        }
+      }
+    }
+  });
+}
+
+
+void SgmCensus::AggregateHorizontal(const ForegroundRoi& roi)
+{
+  const int D = num_disp_;
+  const uint16_t P1 = static_cast<uint16_t>(params_.P1);
+  const uint16_t P2 = static_cast<uint16_t>(params_.P2);
+
+  // Each row only depends on itself, so rows run in parallel.
+  cv::parallel_for_(cv::Range(0, rows_), [&](const cv::Range& range)
+  {
+    std::vector<uint16_t> path_a(D), path_b(D);
+
+    for (int y = range.start; y < range.end; ++y) {
+      const size_t row_offset = static_cast<size_t>(y) * cols_ * D;
+
+      // Each span is a separate path. Left to right, then right to left.
+      for (const RowSpan& span : roi.Spans(y)) {
+        for (int direction : { 1, -1 }) {
+          uint16_t* prev = nullptr;
+          uint16_t* cur = path_a.data();
+          uint16_t prev_min = 0;
+
+          for (int i = span.x0; i < span.x1; ++i) {
+            const int x = (direction > 0) ? i : (span.x1 - 1 - (i - span.x0));
+            const size_t offset = row_offset + static_cast<size_t>(x) * D;
+            prev_min = UpdatePath(cost_.data() + offset, prev, prev_min, D, P1, P2, cur, sum_.data() + offset);
+            prev = cur;
+            cur = (cur == path_a.data()) ? path_b.data() : path_a.data();
+          }
+        }
+      }
+    }
+  });
+}
+
+
+void SgmCensus::AggregateVertical(int dy, const ForegroundRoi& roi)
+{
+  const int D = num_disp_;
+  const uint16_t P1 = static_cast<uint16_t>(params_.P1);
+  const uint16_t P2 = static_cast<uint16_t>(params_.P2);
+
+  // The horizontal step along each path (0 is vertical, the others are diagonals).
+  const std::vector<int> path_dx = (params_.num_paths == 8) ? std::vector<int>{ 0, -1, 1 } :
+                                                              std::vector<int>{ 0 };
+
+  // Rows are done in order, but every pixel in a row only depends on the previous row, so each
+  // row is split across threads.
+  for (int i = 0; i < rows_; ++i) {
+    const int y = (dy > 0) ? i : (rows_ - 1 - i);
+    const size_t row_offset = static_cast<size_t>(y) * cols_ * D;
+
+    // A path only continues from the previous pixel if it was in the ROI (and so it was updated).
+    const uint8_t* prev_mask = (i > 0) ? roi.Mask().ptr<uint8_t>(y - dy) : nullptr;
+    const std::vector<RowSpan>& spans = roi.Spans(y);
+
+    cv::parallel_for_(cv::Range(0, cols_), [&](const cv::Range& range)
+    {
+      for (size_t k = 0; k < path_dx.size(); ++k) {
+        const int dx = path_dx.at(k);
+
+        for (const RowSpan& span : spans) {
+          const int x0 = std::max(span.x0, range.start);
+          const int x1 = std::min(span.x1, range.end);
+
+          for (int x = x0; x < x1; ++x) {
+            const int xq = x - dx;
+            const bool has_prev = (prev_mask != nullptr) && xq >= 0 && xq < cols_ && prev_mask[xq] != 0;
+            const uint16_t* prev = has_prev ? (path_prev_[k].data() + xq * D) : nullptr;
+            const uint16_t prev_min = has_prev ? path_min_prev_[k][xq] : 0;
+
+            const size_t offset = row_offset + static_cast<size_t>(x) * D;
+            path_min_cur_[k][x] = UpdatePath(cost_.data() + offset, prev, prev_min, D, P1, P2,
+                                             path_cur_[k].data() + x * D, sum_.data() + offset);
+          }
+        }
+      }
+    });
+
+    for (size_t k = 0; k < path_dx.size(); ++k) {
+      std::swap(path_prev_[k], path_cur_[k]);
+      std::swap(path_min_prev_[k], path_min_cur_[k]);
+    }
+  }
+}
+
+
+void SgmCensus::SelectDisparity(const ForegroundRoi& roi, Image1f& disp) const
+{
+  const int D = num_disp_;
+
+  cv::parallel_for_(cv::Range(0, rows_), [&](const cv::Range& range)
+  {
+    std::vector<int> disp_right(cols_);
+
+    for (int y = range.start; y < range.end; ++y) {
+      const uint16_t* row_sum = sum_.data() + static_cast<size_t>(y) * cols_ * D;
+      const uint8_t* row_mask = roi.Mask().ptr<uint8_t>(y);
+
+      // Best disparity for right image pixel xr, which matches left pixel xr + d at disparity d.
+      // Only the left pixels in the ROI have an aggregated cost. These are computed when a left
+      // pixel needs them for the left-right check (-1 means not computed yet).
+      std::fill(disp_right.begin(), disp_right.end(), -1);
+      const auto right_disparity = [&](int xr) -> int
+      {
+        if (disp_right[xr] < 0) {
+          const int dmax = std::min(D - 1, cols_ - 1 - xr);
+          int best_d = 0;
+          uint16_t best = std::numeric_limits<uint16_t>::max();
+          for (int d = 0; d <= dmax; ++d) {
+            if (row_mask[xr + d] == 0) {
+              continue;
+            }
+            const uint16_t s = row_sum[(xr + d) * D + d];
+            if (s < best) {
+              best = s;
+              best_d = d;
+            }
+          }
+          disp_right[xr] = best_d;
+        }
+        return disp_right[xr];
+      };
+
+      float* disp_row = disp.ptr<float>(y);
+
+      for (const RowSpan& span : roi.Spans(y)) {
+        for (int x = span.x0; x < span.x1; ++x) {
+          const uint16_t* s = row_sum + static_cast<size_t>(x) * D;
+          const int dmax = std::min(D - 1, x);
+
+          const int best_d = static_cast<int>(std::min_element(s, s + dmax + 1) - s);
+          const uint16_t best = s[best_d];
+
+          // Uniqueness: no other (non-adjacent) disparity should be almost as good.
+          uint16_t second = std::numeric_limits<uint16_t>::max();
+          for (int d = 0; d <= dmax; ++d) {
+            if (std::abs(d - best_d) > 1) {
+              second = std::min(second, s[d]);
+            }
+          }
+          if (static_cast<float>(best) > params_.uniqueness * static_cast<float>(second)) {
+            continue;
+          }
+
+          if (params_.lr_max_diff >= 0 && std::abs(right_disparity(x - best_d) - best_d) > params_.lr_max_diff) {
+            continue;
+          }
+
+          float d = static_cast<float>(best_d);
+          if (params_.subpixel && best_d > 0 && best_d < dmax) {
+            const float c0 = s[best_d - 1];
+            const float c1 = s[best_d];
+            const float c2 = s[best_d + 1];
+            const float denom = c0 - 2*c1 + c2;
+            if (denom > 0) {
+              d += 0.5f * (c0 - c2) / denom;
+            }
+          }
+
+          disp_row[x] = d;
+        }
+      }
+    }
+  });
+}
+
+
+}
+}
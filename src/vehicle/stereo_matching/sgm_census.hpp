@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vision_core/cv_types.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+#include "stereo_matching/dense_stereo.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// Semi-global matching (Hirschmuller 2008) with a 5x5 census transform and Hamming distance cost.
+// Disparities go from 0 to matcher_params.max_disp (the same range that the sparse StereoMatcher
+// searches), and there's one cost (and aggregated cost) per pixel per disparity.
+//
+// The aggregation along each path is a loop over the contiguous disparities of a pixel, written so
+// that the compiler can vectorize it (16-bit costs, 8 or 16 per SSE/AVX register). Rows are
+// independent for the horizontal paths, and columns for each row of the vertical/diagonal paths,
+// so those run in parallel.
+// NOTE(milo): Buffers are kept between calls, so only the first image (or a size change) allocates.
+class SgmCensus final : public DenseStereo {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    ft::StereoMatcher::Params matcher_params;   // Only max_disp is used.
+
+    int num_paths = 8;              // 4 (horizontal and vertical) or 8 (also diagonal).
+    int P1 = 4;                     // Penalty for a disparity change of 1 pixel.
+    int P2 = 40;                    // Penalty for larger disparity changes.
+    float uniqueness = 0.95;        // Best cost must be < uniqueness * (best non-adjacent cost).
+    int lr_max_diff = 1;            // Max left-right disparity difference (negative to disable).
+    bool subpixel = true;           // Fit a parabola around the best disparity.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(SgmCensus);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SgmCensus);
+
+  explicit SgmCensus(const Params& params);
+
+  // See DenseStereo. Invalid pixels have a disparity of -1.
+  Image1f ComputeDisparity(const Image1b& iml, const Image1b& imr) override;
+
+  // Only the cost volume inside of roi is computed and aggregated. Paths start over wherever they
+  // enter the ROI, so pixels near its boundary can differ from the full image result.
+  Image1f ComputeDisparity(const Image1b& iml, const Image1b& imr, const ForegroundRoi& roi) override;
+
+ private:
+  // Computes cost_ (Hamming distance between census descriptors) for every pixel in roi and every
+  // disparity, and zeros sum_ for those pixels.
+  void ComputeCost(const Image1b& iml, const Image1b& imr, const ForegroundRoi& roi);
+
+  // Adds the path costs in each direction into sum_.
+  void AggregateHorizontal(const ForegroundRoi& roi);
+  void AggregateVertical(int dy, const ForegroundRoi& roi);
+
+  // Chooses the disparity with the lowest aggregated cost (with uniqueness and left-right checks).
+  void SelectDisparity(const ForegroundRoi& roi, Image1f& disp) const;
+
+ private:
+  Params params_;
+  int num_disp_;    // Disparities 0 to max_disp.
+
+  int rows_ = 0;
+  int cols_ = 0;
+
+  std::vector<uint32_t> census_l_, census_r_;
+  // NOTE(milo): Only the entries for ROI pixels are valid (the rest are left over from other calls).
+  std::vector<uint8_t> cost_;     // (rows x cols x num_disp) matching cost.
+  std::vector<uint16_t> sum_;     // (rows x cols x num_disp) aggregated cost over all paths.
+
+  // Path costs for the previous and current row (cols x num_disp, one set per direction), and the
+  // min over disparity for each pixel.
+  std::vector<uint16_t> path_prev_[3], path_cur_[3];
+  std::vector<uint16_t> path_min_prev_[3], path_min_cur_[3];
+};
+
+
+// Census transform with a 5x5 window (24 bits). Pixels within 2 of the border get a descriptor of 0.
+void Census5x5(const Image1b& im, uint32_t* out);
+
+
+}
+}
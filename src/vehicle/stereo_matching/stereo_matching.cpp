@@ -1,3 +1,5 @@
+#include <glog/logging.h>
+
 #include "stereo_matching/stereo_matching.hpp"
 
 namespace bm {
@@ -40,5 +42,33 @@ Image1f EstimateDisparity(const Image1b& il,
   return dispf;
 }
 
+
+Image1f OpenCvSgbmStereo::ComputeDisparity(const Image1b& iml, const Image1b& imr)
+{
+  return EstimateDisparity(iml, imr, num_disp_, block_size_);
+}
+
+
+void DenseStereoParams::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("method", &method);
+  parser.GetParam("sgbm_block_size", &sgbm_block_size);
+  sgm_params = SgmCensus::Params(parser.Subtree("SgmCensus"));
+}
+
+
+std::unique_ptr<DenseStereo> CreateDenseStereo(const DenseStereoParams& params)
+{
+  if (params.method == "sgm_census") {
+    return std::unique_ptr<DenseStereo>(new SgmCensus(params.sgm_params));
+  } else if (params.method == "opencv_sgbm") {
+    return std::unique_ptr<DenseStereo>(new OpenCvSgbmStereo(
+        params.sgm_params.matcher_params.max_disp, params.sgbm_block_size));
+  }
+
+  LOG(FATAL) << "Unknown dense stereo method: " << params.method << std::endl;
+  return nullptr;
+}
+
 }
 }
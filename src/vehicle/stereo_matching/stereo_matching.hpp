@@ -1,8 +1,16 @@
 #pragma once
 
+#include <memory>
+#include <string>
+
 #include <opencv2/calib3d.hpp>
 
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
 #include "vision_core/cv_types.hpp"
+#include "stereo_matching/dense_stereo.hpp"
+#include "stereo_matching/sgm_census.hpp"
 
 namespace bm {
 namespace stereo {
@@ -14,5 +22,42 @@ Image1f EstimateDisparity(const Image1b& il,
                           int num_disp = 64,
                           int block_size = 3);
 
+
+// Wraps EstimateDisparity() (OpenCV StereoSGBM) as a DenseStereo backend.
+class OpenCvSgbmStereo final : public DenseStereo {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(OpenCvSgbmStereo);
+
+  // NOTE(milo): StereoSGBM needs num_disp to be divisible by 16, so it's rounded up.
+  OpenCvSgbmStereo(int max_disp, int block_size)
+      : num_disp_(16 * ((max_disp + 16) / 16)), block_size_(block_size) {}
+
+  using DenseStereo::ComputeDisparity;
+  Image1f ComputeDisparity(const Image1b& iml, const Image1b& imr) override;
+
+ private:
+  int num_disp_;
+  int block_size_;
+};
+
+
+struct DenseStereoParams final : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(DenseStereoParams);
+
+  std::string method = "sgm_census";    // "sgm_census" or "opencv_sgbm".
+  int sgbm_block_size = 3;              // Only used by "opencv_sgbm".
+
+  // Also gives the disparity range (matcher_params.max_disp) for "opencv_sgbm".
+  SgmCensus::Params sgm_params;
+
+ private:
+  void LoadParams(const YamlParser& parser) override;
+};
+
+
+// Make the dense stereo backend chosen by params.method.
+std::unique_ptr<DenseStereo> CreateDenseStereo(const DenseStereoParams& params);
+
 }
 }
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/linear/linearExceptions.h>
+#include <gtsam/navigation/ImuBias.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+
+#include "core/trace.hpp"
+#include "vio/batch_smoother.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void BatchSmoother::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("enabled", &enabled);
+  parser.GetParam("interval_sec", &interval_sec);
+  parser.GetParam("max_iters", &max_iters);
+  parser.GetParam("relative_error_tol", &relative_error_tol);
+  anchor_pose_noise_model = IsoModel::Sigma(6, parser.GetParam<double>("anchor_pose_sigma"));
+  anchor_velocity_noise_model = IsoModel::Sigma(3, parser.GetParam<double>("anchor_velocity_sigma"));
+  anchor_bias_noise_model = IsoModel::Sigma(6, parser.GetParam<double>("anchor_bias_sigma"));
+  CHECK_GT(interval_sec, 0);
+  CHECK_GT(max_iters, 0);
+}
+
+
+BatchResult BatchSmoother::Solve(const gtsam::NonlinearFactorGraph& factors,
+                                 const gtsam::Values& initial) const
+{
+  BM_TRACE_SCOPE("BatchSmoother::Solve");
+
+  BatchResult result;
+
+  gtsam::NonlinearFactorGraph graph;
+  for (const gtsam::NonlinearFactor::shared_ptr& factor : factors) {
+    if (!factor) {
+      continue;
+    }
+    bool has_all_keys = true;
+    for (const gtsam::Key key : factor->keys()) {
+      has_all_keys &= initial.exists(key);
+    }
+    if (has_all_keys) {
+      graph.push_back(factor);
+    }
+  }
+
+  // Only optimize variables that are still constrained by some factor.
+  gtsam::Values values;
+  const uid_t kNoKeypose = std::numeric_limits<uid_t>::max();
+  uid_t oldest_id = kNoKeypose;
+  for (const gtsam::Key key : graph.keys()) {
+    values.insert(key, initial.at(key));
+    const gtsam::Symbol sym(key);
+    if (sym.chr() == 'X') {
+      oldest_id = std::min(oldest_id, static_cast<uid_t>(sym.index()));
+    }
+  }
+
+  if (oldest_id == kNoKeypose) {
+    return result;
+  }
+
+  const gtsam::Symbol anchor_pose('X', oldest_id);
+  const gtsam::Symbol anchor_vel('V', oldest_id);
+  const gtsam::Symbol anchor_bias('B', oldest_id);
+  graph.addPrior(anchor_pose, values.at<gtsam::Pose3>(anchor_pose), params_.anchor_pose_noise_model);
+  if (values.exists(anchor_vel)) {
+    graph.addPrior(anchor_vel, values.at<gtsam::Vector3>(anchor_vel), params_.anchor_velocity_noise_model);
+  }
+  if (values.exists(anchor_bias)) {
+    graph.addPrior(anchor_bias, values.at<gtsam::imuBias::ConstantBias>(anchor_bias), params_.anchor_bias_noise_model);
+  }
+
+  // NOTE(milo): Elimination is multithreaded if GTSAM was built with TBB.
+  gtsam::LevenbergMarquardtParams lm_params;
+  lm_params.maxIterations = params_.max_iters;
+  lm_params.relativeErrorTol = params_.relative_error_tol;
+
+  try {
+    gtsam::LevenbergMarquardtOptimizer optimizer(graph, values, lm_params);
+    result.initial_error = graph.error(values);
+    result.estimate = optimizer.optimize();
+    result.iterations = static_cast<int>(optimizer.iterations());
+    result.final_error = optimizer.error();
+  } catch (const gtsam::IndeterminantLinearSystemException& e) {
+    LOG(WARNING) << "Batch re-optimization failed: " << e.what() << std::endl;
+    return result;
+  }
+
+  for (const gtsam::Key key : result.estimate.keys()) {
+    const gtsam::Symbol sym(key);
+    if (sym.chr() == 'X') {
+      result.world_P_body.emplace(static_cast<uid_t>(sym.index()), result.estimate.at<gtsam::Pose3>(key));
+    }
+  }
+
+  result.success = true;
+  return result;
+}
+
+
+}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <functional>
+#include <map>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "vio/noise_model.hpp"
+
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Result of a batch re-optimization over the FixedLagSmoother's history.
+struct BatchResult final
+{
+  typedef std::function<void(const BatchResult&)> Callback;
+
+  bool success = false;
+  int iterations = 0;
+  double initial_error = 0;
+  double final_error = 0;
+
+  std::map<uid_t, gtsam::Pose3> world_P_body;   // Corrected pose of each keypose (by keypose_id).
+  gtsam::Values estimate;                       // All of the optimized variables.
+};
+
+
+// Re-optimizes a longer window of factors than the FixedLagSmoother can afford to keep in iSAM2,
+// from scratch (Levenberg-Marquardt), so that old keyposes don't carry marginalization error. This
+// is slow, and is meant to be run every few seconds on a low priority thread.
+class BatchSmoother final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    bool enabled = false;
+    double interval_sec = 5.0;          // Re-optimize this often.
+    int max_iters = 20;
+    double relative_error_tol = 1e-5;
+
+    // The oldest keypose in the window is anchored at its current estimate, since the factors that
+    // connected it to older keyposes were thrown away.
+    IsoModel::shared_ptr anchor_pose_noise_model = IsoModel::Sigma(6, 1e-3);
+    IsoModel::shared_ptr anchor_velocity_noise_model = IsoModel::Sigma(3, 0.1);
+    IsoModel::shared_ptr anchor_bias_noise_model = IsoModel::Sigma(6, 1e-3);
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(BatchSmoother)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(BatchSmoother)
+
+  explicit BatchSmoother(const Params& params) : params_(params) {}
+
+  // Optimizes the factors, starting from "initial". Factors that involve a variable missing from
+  // "initial" (e.g one that was trimmed from the history) are skipped.
+  BatchResult Solve(const gtsam::NonlinearFactorGraph& factors, const gtsam::Values& initial) const;
+
+ private:
+  Params params_;
+};
+
+}
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/geometry/StereoCamera.h>
+#include <gtsam/nonlinear/Values.h>
+#include <gtsam_unstable/slam/SmartStereoProjectionPoseFactor.h>
+
+namespace gtsam {
+
+
+/**
+ * A SmartStereoProjectionPoseFactor that can pick up where the factor it replaces left off.
+ *
+ * The FixedLagSmoother replaces a landmark's factor every time the landmark gets a new observation,
+ * and a new smart factor triangulates from scratch (SVD over every observation, then a nonlinear
+ * refinement). This one keeps the point and each observation's contribution to the point's normal
+ * equations (J^T J and J^T r, which is the point block that the Schur complement eliminates). When it's
+ * seeded from the old factor, adding an observation is a rank-3 update and one Gauss-Newton step from
+ * the old point.
+ *
+ * It only falls back to a full triangulation if one of the old cameras moved more than
+ * pose_threshold, the point moved more than point_threshold (then the cached terms are relinearized
+ * first), or the update comes out degenerate, behind a camera or with an outlier.
+ *
+ * NOTE(milo): Triangulate() fills in the same cache (result_ and cameraPosesTriangulation_) that
+ * the base class checks before triangulating, so linearize() reuses the point as long as iSAM2
+ * linearizes at the same values.
+ */
+class CachedSmartStereoFactor : public SmartStereoProjectionPoseFactor {
+ public:
+  typedef CachedSmartStereoFactor This;
+  typedef SmartStereoProjectionPoseFactor Base;
+  typedef boost::shared_ptr<This> shared_ptr;
+
+  CachedSmartStereoFactor(const SharedNoiseModel& noise_model,
+                          const SmartStereoProjectionParams& params,
+                          const boost::optional<Pose3>& body_P_sensor)
+      : Base(noise_model, params, body_P_sensor) {}
+
+  // Take over the point and the per-observation terms of the factor that this one replaces.
+  void Seed(const CachedSmartStereoFactor& previous)
+  {
+    if (previous.result_.valid() && !previous.terms_.empty()) {
+      lin_point_ = previous.lin_point_;
+      terms_ = previous.terms_;
+    }
+  }
+
+  // Triangulates at these values, incrementally if possible (see above). Returns the point, which is
+  // also what point() returns afterwards.
+  TriangulationResult Triangulate(const Values& values, double pose_threshold, double point_threshold) const
+  {
+    const Cameras cameras = this->cameras(values);
+    if (!terms_.empty() && TryIncremental(cameras, pose_threshold, point_threshold)) {
+      ++num_incremental_;
+      return result_;
+    }
+
+    ++num_full_;
+    const TriangulationResult result = Base::point(values);
+    terms_.clear();
+    if (result.valid()) {
+      lin_point_ = *result;
+      for (size_t i = 0; i < cameras.size(); ++i) {
+        terms_.emplace_back(MakeTerm(cameras[i], this->measured_[i], this->keys_[i], lin_point_));
+      }
+    }
+    return result;
+  }
+
+  // How many of the Triangulate() calls were incremental (for profiling).
+  size_t NumIncremental() const { return num_incremental_; }
+  size_t NumFull() const { return num_full_; }
+
+ private:
+  // One observation's terms in the point's normal equations, at lin_point_.
+  struct Term final
+  {
+    Key key;
+    Pose3 pose;         // The camera pose that the term was computed at.
+    Matrix3 JtJ;
+    Vector3 Jtr;
+  };
+
+  static Term MakeTerm(const StereoCamera& camera, const StereoPoint2& measured, Key key, const Point3& point)
+  {
+    Matrix3 J;
+    const StereoPoint2 predicted = camera.project2(point, boost::none, J);
+    const Vector3 r = (measured - predicted).vector();
+    return Term{ key, camera.pose(), J.transpose() * J, J.transpose() * r };
+  }
+
+  bool TryIncremental(const Cameras& cameras, double pose_threshold, double point_threshold) const
+  {
+    std::vector<Term> terms;
+    terms.reserve(cameras.size());
+
+    // Reuse the term for every observation that the old factor had (if its camera stayed put), and
+    // make new ones for the rest.
+    for (size_t i = 0; i < cameras.size(); ++i) {
+      if (cameras[i].pose().transformTo(lin_point_).z() <= 0) {
+        return false;
+      }
+
+      const Term* cached = nullptr;
+      for (const Term& t : terms_) {
+        if (t.key == this->keys_[i]) {
+          cached = &t;
+          break;
+        }
+      }
+
+      if (!cached) {
+        terms.emplace_back(MakeTerm(cameras[i], this->measured_[i], this->keys_[i], lin_point_));
+      } else if (cached->pose.equals(cameras[i].pose(), pose_threshold)) {
+        terms.emplace_back(*cached);
+      } else {
+        return false;
+      }
+    }
+
+    Matrix3 JtJ = Matrix3::Zero();
+    Vector3 Jtr = Vector3::Zero();
+    for (const Term& t : terms) {
+      JtJ += t.JtJ;
+      Jtr += t.Jtr;
+    }
+
+    // Same as the rank tolerance of the full triangulation.
+    const Eigen::LDLT<Matrix3> ldlt(JtJ);
+    if (ldlt.info() != Eigen::Success || !ldlt.isPositive() ||
+        ldlt.vectorD().minCoeff() <= params_.triangulation.rankTolerance * ldlt.vectorD().maxCoeff()) {
+      return false;
+    }
+
+    const Point3 point = lin_point_ + ldlt.solve(Jtr);
+
+    // The full triangulation applies these too.
+    const double max_distance = params_.triangulation.landmarkDistanceThreshold;
+    const double max_error = params_.triangulation.dynamicOutlierRejectionThreshold;
+    for (size_t i = 0; i < cameras.size(); ++i) {
+      const Point3 cam_point = cameras[i].pose().transformTo(point);
+      if (cam_point.z() <= 0 || (max_distance > 0 && cam_point.norm() > max_distance)) {
+        return false;
+      }
+      if (max_error > 0) {
+        const Vector3 r = (this->measured_[i] - cameras[i].project2(point)).vector();
+        if (r.norm() > max_error) {
+          return false;
+        }
+      }
+    }
+
+    // Far from where the terms were computed, they aren't accurate anymore.
+    if ((point - lin_point_).norm() > point_threshold) {
+      for (size_t i = 0; i < cameras.size(); ++i) {
+        terms.at(i) = MakeTerm(cameras[i], this->measured_[i], this->keys_[i], point);
+      }
+      lin_point_ = point;
+    }
+
+    terms_ = std::move(terms);
+    result_ = TriangulationResult(point);
+    cameraPosesTriangulation_.clear();
+    for (size_t i = 0; i < cameras.size(); ++i) {
+      cameraPosesTriangulation_.emplace_back(cameras[i].pose());
+    }
+    return true;
+  }
+
+ private:
+  mutable Point3 lin_point_ = Point3::Zero();
+  mutable std::vector<Term> terms_;     // One per observation, in the order of keys_.
+  mutable size_t num_incremental_ = 0;
+  mutable size_t num_full_ = 0;
+};
+
+
+}
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "core/trace.hpp"
+#include "core/transform_util.hpp"
+#include "vio/direct_odometry.hpp"
+
+namespace bm {
+namespace vio {
+
+
+// Pixel offsets of the patch around each point (the 8 pixel pattern from DSO). It's spread out
+// enough to constrain the pose on an edge, but small enough to stay on one surface.
+static const int kPatternSize = 8;
+static const int kPattern[kPatternSize][2] = {
+  { 0, -2 }, { -1, -1 }, { 1, -1 }, { -2, 0 }, { 0, 0 }, { 2, 0 }, { -1, 1 }, { 0, 2 }
+};
+
+// Pattern pixels (and the half template for stereo) have to be this far from the border.
+static const int kBorder = 8;
+
+
+void DirectOdometry::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("pyramid_levels", &pyramid_levels);
+  parser.GetParam("cell_size", &cell_size);
+  parser.GetParam("min_gradient", &min_gradient);
+  parser.GetParam("max_iters", &max_iters);
+  parser.GetParam("huber_delta", &huber_delta);
+  parser.GetParam("max_point_error", &max_point_error);
+  parser.GetParam("max_avg_error", &max_avg_error);
+  parser.GetParam("min_points", &min_points);
+  matcher_params = StereoMatcher::Params(parser.GetNode("StereoMatcher"));
+
+  CHECK_GE(pyramid_levels, 1);
+  CHECK_GE(cell_size, 2);
+  CHECK_GT(huber_delta, 0);
+}
+
+
+// Bilinear interpolation of an 8-bit image. (x, y) must be in [0, cols - 1) x [0, rows - 1).
+inline static float Bilinear(const Image1b& image, float x, float y)
+{
+  const int x0 = static_cast<int>(x);
+  const int y0 = static_cast<int>(y);
+  const float ax = x - x0;
+  const float ay = y - y0;
+  const uchar* r0 = image.ptr<uchar>(y0) + x0;
+  const uchar* r1 = r0 + image.step;
+  return (1.0f - ay) * ((1.0f - ax) * r0[0] + ax * r0[1]) + ay * ((1.0f - ax) * r1[0] + ax * r1[1]);
+}
+
+
+DirectOdometry::DirectOdometry(const Params& params, const StereoCamera& stereo_rig)
+    : params_(params),
+      stereo_rig_(stereo_rig),
+      matcher_(params.matcher_params) {}
+
+
+size_t DirectOdometry::SetKeyframe(const StereoImage1b& stereo_pair)
+{
+  BM_TRACE_SCOPE("DirectOdometry::SetKeyframe");
+
+  const Image1b& iml = stereo_pair.left_image;
+  const std::vector<Image1b> pyramid = stereo_pair.cache->left.Pyramid(iml, params_.pyramid_levels);
+  const Image1f gradient = stereo_pair.cache->left.GradientPyramid(iml, 1).at(0);
+
+  // The strongest gradient in each cell (if it's strong enough).
+  VecPoint2f pixels;
+  const int cell = params_.cell_size;
+  for (int y0 = kBorder; y0 < iml.rows - kBorder; y0 += cell) {
+    for (int x0 = kBorder; x0 < iml.cols - kBorder; x0 += cell) {
+      float best = static_cast<float>(params_.min_gradient);
+      cv::Point2f best_pixel(-1, -1);
+      for (int y = y0; y < std::min(y0 + cell, iml.rows - kBorder); ++y) {
+        const float* row = gradient.ptr<float>(y);
+        for (int x = x0; x < std::min(x0 + cell, iml.cols - kBorder); ++x) {
+          if (row[x] > best) {
+            best = row[x];
+            best_pixel = cv::Point2f(x, y);
+          }
+        }
+      }
+      if (best_pixel.x >= 0) {
+        pixels.emplace_back(best_pixel);
+      }
+    }
+  }
+
+  const std::vector<double> disps = matcher_.MatchRectified(iml, stereo_pair.right_image, pixels);
+
+  points_.clear();
+  observations_.clear();
+  levels_.assign(pyramid.size(), Level());
+  for (size_t l = 0; l < pyramid.size(); ++l) {
+    levels_.at(l).cam = stereo_rig_.LeftCamera().Rescale(pyramid.at(l).rows, pyramid.at(l).cols);
+  }
+
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    if (disps.at(i) <= 0) {
+      continue;
+    }
+    const double depth = stereo_rig_.DispToDepth(disps.at(i));
+
+    const Point point = { next_lmk_id_++, depth };
+    points_.emplace_back(point);
+    observations_.emplace_back(point.lmk_id, stereo_pair.camera_id, pixels.at(i), disps.at(i), 0.0, 0.0);
+
+    // NOTE(milo): Every pattern pixel gets the depth of the point, and is backprojected with the
+    // intrinsics of each level. Near the border of the coarse levels, the pattern can fall outside
+    // of the image, so its reference intensity is clamped (it will be skipped in Track() anyway).
+    for (size_t l = 0; l < pyramid.size(); ++l) {
+      Level& level = levels_.at(l);
+      const Image1b& image = pyramid.at(l);
+      const double scale = static_cast<double>(image.cols) / static_cast<double>(iml.cols);
+      for (int k = 0; k < kPatternSize; ++k) {
+        const float u = static_cast<float>(pixels.at(i).x * scale + kPattern[k][0]);
+        const float v = static_cast<float>(pixels.at(i).y * scale + kPattern[k][1]);
+        level.P_kf.emplace_back(level.cam.Backproject(Vector2d(u, v), depth));
+        level.ref.emplace_back(Bilinear(image,
+            std::min(std::max(u, 0.0f), image.cols - 1.001f),
+            std::min(std::max(v, 0.0f), image.rows - 1.001f)));
+      }
+    }
+  }
+
+  return points_.size();
+}
+
+
+int DirectOdometry::Linearize(const Level& level,
+                              const Image1b& image,
+                              const Matrix4d& cur_T_kf,
+                              double& cost,
+                              Matrix6d* H,
+                              Vector6d* g) const
+{
+  const Matrix3d R = cur_T_kf.block<3, 3>(0, 0);
+  const Vector3d t = cur_T_kf.block<3, 1>(0, 3);
+  const double fx = level.cam.fx();
+  const double fy = level.cam.fy();
+  const double cx = level.cam.cx();
+  const double cy = level.cam.cy();
+  const float max_u = static_cast<float>(image.cols - 2);
+  const float max_v = static_cast<float>(image.rows - 2);
+  const double delta = params_.huber_delta;
+
+  if (H) { H->setZero(); }
+  if (g) { g->setZero(); }
+  cost = 0;
+  int num_valid = 0;
+
+  for (size_t i = 0; i < level.P_kf.size(); ++i) {
+    const Vector3d P = R * level.P_kf[i] + t;
+    if (P.z() < 1e-3) {
+      continue;
+    }
+
+    const double z_inv = 1.0 / P.z();
+    const float u = static_cast<float>(fx * P.x() * z_inv + cx);
+    const float v = static_cast<float>(fy * P.y() * z_inv + cy);
+    if (u < 1.0f || v < 1.0f || u >= max_u || v >= max_v) {
+      continue;
+    }
+
+    const double r = Bilinear(image, u, v) - level.ref[i];
+    const double abs_r = std::fabs(r);
+    const double w = (abs_r <= delta) ? 1.0 : delta / abs_r;
+    cost += (abs_r <= delta) ? 0.5 * r * r : delta * (abs_r - 0.5 * delta);
+    ++num_valid;
+
+    if (H == nullptr) {
+      continue;
+    }
+
+    // Image gradient at the warped pixel (central differences), times the Jacobian of the
+    // projection w.r.t a left increment of cur_T_kf (translation first, like ExpSE3()).
+    const double gu = 0.5 * (Bilinear(image, u + 1.0f, v) - Bilinear(image, u - 1.0f, v));
+    const double gv = 0.5 * (Bilinear(image, u, v + 1.0f) - Bilinear(image, u, v - 1.0f));
+    const double x = P.x() * z_inv;
+    const double y = P.y() * z_inv;
+    const double dx = gu * fx;
+    const double dy = gv * fy;
+
+    Vector6d J;
+    J << dx * z_inv,
+         dy * z_inv,
+         -(dx * x + dy * y) * z_inv,
+         -dx * x * y - dy * (1.0 + y * y),
+         dx * (1.0 + x * x) + dy * x * y,
+         -dx * y + dy * x;
+
+    H->noalias() += w * J * J.transpose();
+    g->noalias() -= w * r * J;
+  }
+
+  return num_valid;
+}
+
+
+void DirectOdometry::FindInliers(const Image1b& image, const Matrix4d& cur_T_kf, uid_t camera_id, double& avg_error)
+{
+  const Level& level = levels_.at(0);
+  const Matrix3d R = cur_T_kf.block<3, 3>(0, 0);
+  const Vector3d t = cur_T_kf.block<3, 1>(0, 3);
+  const float max_u = static_cast<float>(image.cols - 2);
+  const float max_v = static_cast<float>(image.rows - 2);
+
+  observations_.clear();
+  double sum_error = 0;
+  int num_pixels = 0;
+
+  for (size_t p = 0; p < points_.size(); ++p) {
+    double point_error = 0;
+    int num_in_image = 0;
+    cv::Point2f center(-1, -1);
+    double center_depth = 0;
+
+    for (int k = 0; k < kPatternSize; ++k) {
+      const size_t i = p * kPatternSize + k;
+      const Vector3d P = R * level.P_kf[i] + t;
+      if (P.z() < 1e-3) {
+        continue;
+      }
+      const Vector2d uv = level.cam.Project(P);
+      const float u = static_cast<float>(uv.x());
+      const float v = static_cast<float>(uv.y());
+      if (u < 1.0f || v < 1.0f || u >= max_u || v >= max_v) {
+        continue;
+      }
+      point_error += std::fabs(Bilinear(image, u, v) - level.ref[i]);
+      ++num_in_image;
+      if (kPattern[k][0] == 0 && kPattern[k][1] == 0) {
+        center = cv::Point2f(u, v);
+        center_depth = P.z();
+      }
+    }
+
+    // Only points that are entirely in the image, and that match well, are inliers.
+    if (num_in_image < kPatternSize || point_error > params_.max_point_error * kPatternSize) {
+      continue;
+    }
+
+    sum_error += point_error;
+    num_pixels += num_in_image;
+    observations_.emplace_back(points_.at(p).lmk_id, camera_id, center,
+                               stereo_rig_.DepthToDisp(center_depth), point_error / kPatternSize, 0.0);
+  }
+
+  avg_error = (num_pixels > 0) ? (sum_error / num_pixels) : -1.0;
+}
+
+
+int DirectOdometry::Track(const StereoImage1b& stereo_pair, Matrix4d& cur_T_kf, double& avg_error)
+{
+  BM_TRACE_SCOPE("DirectOdometry::Track");
+
+  observations_.clear();
+  avg_error = -1.0;
+  if (points_.empty()) {
+    return -1;
+  }
+
+  const Image1b& iml = stereo_pair.left_image;
+  const std::vector<Image1b> pyramid = stereo_pair.cache->left.Pyramid(iml, static_cast<int>(levels_.size()));
+
+  Matrix6d H;
+  Vector6d g;
+  int total_iters = 0;
+
+  // Coarse to fine. Each level starts from the result of the one above it.
+  for (int l = static_cast<int>(levels_.size()) - 1; l >= 0; --l) {
+    const Level& level = levels_.at(l);
+    const Image1b& image = pyramid.at(l);
+
+    double cost = 0;
+    int num_valid = Linearize(level, image, cur_T_kf, cost, &H, &g);
+    if (num_valid < 6) {
+      continue;
+    }
+
+    // https://arxiv.org/pdf/1201.5885.pdf (same damping as OptimizeOdometryLM).
+    double lambda = 1e-2;
+
+    for (int iter = 0; iter < params_.max_iters; ++iter, ++total_iters) {
+      Matrix6d H_lm = H;
+      H_lm.diagonal() *= (1.0 + lambda);
+      const Vector6d xi = H_lm.ldlt().solve(g);
+
+      const Matrix4d T_test = (ExpSE3<double>(xi) * Rigid3d(cur_T_kf)).Matrix();
+      double cost_test = 0;
+      const int num_valid_test = Linearize(level, image, T_test, cost_test, nullptr, nullptr);
+
+      // NOTE(milo): Compare the avg. cost, since points can move in or out of the image.
+      if (num_valid_test >= 6 && (cost_test / num_valid_test) < (cost / num_valid)) {
+        cur_T_kf = T_test;
+        lambda /= 3.0;
+        num_valid = Linearize(level, image, cur_T_kf, cost, &H, &g);
+      } else {
+        lambda *= 2.0;
+      }
+
+      if (xi.norm() < 1e-6) {
+        break;
+      }
+    }
+  }
+
+  FindInliers(iml, cur_T_kf, stereo_pair.camera_id, avg_error);
+
+  if (static_cast<int>(observations_.size()) < params_.min_points || avg_error > params_.max_avg_error) {
+    return -1;
+  }
+
+  return total_iters;
+}
+
+
+}
+}
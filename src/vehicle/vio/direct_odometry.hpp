@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "params/params_base.hpp"
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/landmark_observation.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_image.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+using namespace ft;
+
+
+// Direct sparse odometry: estimates the pose of a new frame relative to a keyframe by aligning
+// small patches around high-gradient pixels of the keyframe (with known stereo depth) to the new
+// left image, and minimizing their photometric error over the 6-DOF pose. There's no optical flow
+// or stereo matching per frame. The only per-point work is at keyframes, where the points are
+// selected and matched against the right image once.
+//
+// The pose is solved coarse-to-fine (Levenberg-Marquardt at each level of the image pyramid), so
+// the initial guess only has to be within a few pixels at the coarsest level. The pyramids come
+// from the StereoImage's cache, so they're shared with anything else that uses them.
+//
+// Works on edges as well as corners, so it keeps tracking in low-texture water where there are too
+// few corners for KLT. It assumes brightness constancy between the keyframe and the frame, though,
+// so keyframes should be frequent when the lighting changes.
+class DirectOdometry final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int pyramid_levels = 4;
+    int cell_size = 12;                 // Choose at most one point per cell (pixels).
+    double min_gradient = 40.0;         // Sobel gradient magnitude of a point.
+    int max_iters = 10;                 // Per pyramid level.
+    double huber_delta = 9.0;           // Intensity residuals above this have a linear cost.
+    double max_point_error = 20.0;      // Points with a larger avg. residual are outliers.
+    double max_avg_error = 12.0;        // The solve failed if the inliers' avg. residual is larger.
+    int min_points = 20;                // The solve failed if fewer inliers than this.
+
+    StereoMatcher::Params matcher_params;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(DirectOdometry);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(DirectOdometry);
+
+  DirectOdometry(const Params& params, const StereoCamera& stereo_rig);
+
+  // Selects points in the left image (the strongest gradient in each cell) and finds their depth
+  // by template matching with the right image, then makes this the keyframe that Track() aligns
+  // to. Returns the number of points with a valid depth. Each point gets a new landmark id.
+  size_t SetKeyframe(const StereoImage1b& stereo_pair);
+
+  // Aligns the keyframe's points to the left image of stereo_pair. cur_T_kf is the initial guess,
+  // and the result (the pose of the keyframe in the current camera). Returns the total number of
+  // iterations, or -1 if there were too few inliers or their error was too large (cur_T_kf is
+  // updated either way). avg_error is the avg. absolute photometric residual of the inliers.
+  int Track(const StereoImage1b& stereo_pair, Matrix4d& cur_T_kf, double& avg_error);
+
+  // The inliers of the last Track() (or all points after SetKeyframe()), as observations in that
+  // frame. Their disparity comes from the depth in the frame, so that they can go to the smoother
+  // the same way as tracked landmarks.
+  const std::vector<LandmarkObservation>& Observations() const { return observations_; }
+
+  size_t NumPoints() const { return points_.size(); }
+
+  // Don't assign landmark ids below next_lmk_id (e.g ids from a previous session).
+  void ReserveLandmarkIds(uid_t next_lmk_id) { next_lmk_id_ = std::max(next_lmk_id_, next_lmk_id); }
+
+ private:
+  // A keyframe point (its pattern pixels are in each Level).
+  struct Point final
+  {
+    uid_t lmk_id;
+    double depth;
+  };
+
+  // All of the pattern pixels at one pyramid level (structure of arrays). Pixel i belongs to point
+  // i / kPatternSize.
+  struct Level final
+  {
+    std::vector<Vector3d> P_kf;   // In the keyframe (using this level's intrinsics).
+    std::vector<float> ref;       // Intensity in the keyframe.
+    PinholeCamera cam;
+  };
+
+  // Robust cost (and the Gauss-Newton system, if H and g aren't null) of a level at cur_T_kf.
+  // Returns the number of pattern pixels that landed inside the image.
+  int Linearize(const Level& level,
+                const Image1b& image,
+                const Matrix4d& cur_T_kf,
+                double& cost,
+                Matrix6d* H,
+                Vector6d* g) const;
+
+  // Finds the inliers at level 0, and makes the observations for them.
+  void FindInliers(const Image1b& image, const Matrix4d& cur_T_kf, uid_t camera_id, double& avg_error);
+
+  Params params_;
+  StereoCamera stereo_rig_;
+  StereoMatcher matcher_;
+
+  uid_t next_lmk_id_ = 0;
+  std::vector<Point> points_;
+  std::vector<Level> levels_;
+  std::vector<LandmarkObservation> observations_;
+};
+
+
+}
+}
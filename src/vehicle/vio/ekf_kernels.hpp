@@ -0,0 +1,130 @@
+#pragma once
+
+#include <Eigen/Cholesky>
+
+#include "core/eigen_types.hpp"
+
+namespace bm {
+namespace vio {
+
+// Fixed-size kernels for the StateEkf covariance math. These are templated on the scalar type so
+// that they can also run in float (see bench/vio_bench.cpp), and never allocate on the heap.
+
+static const int kEkfDim = 15;
+
+// Row indices for variables in the 15x15 jacobian matrix F.
+static const size_t t_row = 0;
+static const size_t v_row = 3;
+static const size_t a_row = 6;
+static const size_t uq_row = 9;
+static const size_t w_row = 12;
+
+template <typename Scalar>
+using EkfCovariance = Eigen::Matrix<Scalar, kEkfDim, kEkfDim>;
+
+// D is the measurement dimension. For a variable number of measurements, use D = Eigen::Dynamic
+// with an upper bound MaxD, which keeps the storage on the stack.
+template <typename Scalar, int D, int MaxD = D>
+using EkfJacobian = Eigen::Matrix<Scalar, D, kEkfDim, (D == 1) ? Eigen::RowMajor : Eigen::ColMajor, MaxD, kEkfDim>;
+
+template <typename Scalar, int D, int MaxD = D>
+using EkfGain = Eigen::Matrix<Scalar, kEkfDim, D, Eigen::ColMajor, kEkfDim, MaxD>;
+
+template <typename Scalar, int D, int MaxD = D>
+using EkfInnovation = Eigen::Matrix<Scalar, D, 1, Eigen::ColMajor, MaxD, 1>;
+
+template <typename Scalar, int D, int MaxD = D>
+using EkfNoise = Eigen::Matrix<Scalar, D, D, Eigen::ColMajor, MaxD, MaxD>;
+
+
+// Computes P1 = F * P0 * F' + dt * Q for the constant acceleration / angular velocity model, where
+// F is the identity except for:
+//   F(t, v) = dt*I, F(t, a) = 0.5*dt^2*I, F(v, a) = dt*I, F(uq, uq) = R_dq, F(uq, w) = G
+// Only these blocks are touched, instead of doing two dense 15x15 products.
+template <typename Scalar>
+void PropagateCovariance(const EkfCovariance<Scalar>& P0,
+                         Scalar dt,
+                         const Eigen::Matrix<Scalar, 3, 3>& R_dq,
+                         const Eigen::Matrix<Scalar, 3, 3>& G,
+                         const EkfCovariance<Scalar>& Q,
+                         EkfCovariance<Scalar>& P1)
+{
+  const Scalar half_dt2 = Scalar(0.5) * dt * dt;
+
+  // FP = F * P0 (row operations).
+  EkfCovariance<Scalar> FP = P0;
+  FP.template middleRows<3>(t_row) += dt * P0.template middleRows<3>(v_row) +
+                                      half_dt2 * P0.template middleRows<3>(a_row);
+  FP.template middleRows<3>(v_row) += dt * P0.template middleRows<3>(a_row);
+  FP.template middleRows<3>(uq_row).noalias() = R_dq * P0.template middleRows<3>(uq_row);
+  FP.template middleRows<3>(uq_row).noalias() += G * P0.template middleRows<3>(w_row);
+
+  // P1 = FP * F' (column operations).
+  P1 = FP;
+  P1.template middleCols<3>(t_row) += dt * FP.template middleCols<3>(v_row) +
+                                      half_dt2 * FP.template middleCols<3>(a_row);
+  P1.template middleCols<3>(v_row) += dt * FP.template middleCols<3>(a_row);
+  P1.template middleCols<3>(uq_row).noalias() = FP.template middleCols<3>(uq_row) * R_dq.transpose();
+  P1.template middleCols<3>(uq_row).noalias() += FP.template middleCols<3>(w_row) * G.transpose();
+
+  P1 += dt * Q;
+}
+
+
+// Joseph-form Kalman update for a D-dimensional measurement:
+//   K = P H' (H P H' + R)^-1
+//   P1 = (I - K H) P (I - K H)' + K R K'
+// The Joseph form stays symmetric and PSD even with roundoff, unlike P1 = (I - K H) P.
+// Writes the gain into K and the updated covariance into P1 (which must not alias P0).
+template <typename Scalar, int D, int MaxD = D>
+void JosephUpdate(const EkfCovariance<Scalar>& P0,
+                  const EkfJacobian<Scalar, D, MaxD>& H,
+                  const EkfNoise<Scalar, D, MaxD>& R,
+                  EkfGain<Scalar, D, MaxD>& K,
+                  EkfCovariance<Scalar>& P1)
+{
+  EkfGain<Scalar, D, MaxD> PHt(kEkfDim, H.rows());
+  PHt.noalias() = P0 * H.transpose();
+
+  EkfNoise<Scalar, D, MaxD> S = R;
+  S.noalias() += H * PHt;
+
+  // K = PHt * S^-1, solved with S = S' instead of inverting.
+  K.resize(kEkfDim, H.rows());
+  K.transpose() = S.ldlt().solve(PHt.transpose());
+
+  // A * P0 = P0 - K * (H * P0) = P0 - K * PHt'
+  EkfCovariance<Scalar> AP = P0;
+  AP.noalias() -= K * PHt.transpose();
+
+  // A * P0 * A' = AP - (AP * H') * K'
+  EkfGain<Scalar, D, MaxD> APHt(kEkfDim, H.rows());
+  APHt.noalias() = AP * H.transpose();
+  P1 = AP;
+  P1.noalias() -= APHt * K.transpose();
+
+  EkfGain<Scalar, D, MaxD> KR(kEkfDim, H.rows());
+  KR.noalias() = K * R;
+  P1.noalias() += KR * K.transpose();
+}
+
+
+// Squared Mahalanobis distance of each scalar measurement's innovation y(i), using only its own
+// variance (H_i P H_i' + R_ii). Used to gate outliers before a stacked update.
+template <typename Scalar, int D, int MaxD = D>
+void InnovationMahalanobis2(const EkfCovariance<Scalar>& P,
+                            const EkfJacobian<Scalar, D, MaxD>& H,
+                            const EkfInnovation<Scalar, D, MaxD>& y,
+                            const EkfNoise<Scalar, D, MaxD>& R,
+                            EkfInnovation<Scalar, D, MaxD>& d2)
+{
+  d2.resize(H.rows());
+  for (int i = 0; i < H.rows(); ++i) {
+    const Scalar var = H.row(i) * P * H.row(i).transpose() + R(i, i);
+    d2(i) = y(i) * y(i) / var;
+  }
+}
+
+
+}
+}
@@ -0,0 +1,70 @@
+#include <glog/logging.h>
+
+#include "vio/estimator_fleet.hpp"
+
+namespace bm {
+namespace vio {
+
+
+EstimatorFleet::EstimatorFleet(int num_workers, const ThreadConfig& worker_config)
+    : scheduler_(new TaskScheduler(num_workers, worker_config)) {}
+
+
+EstimatorFleet::~EstimatorFleet()
+{
+  Shutdown();
+}
+
+
+StateEstimator& EstimatorFleet::Add(const StateEstimator::Params& params)
+{
+  CHECK(!shutdown_) << "Can't add an estimator to a fleet that was shut down" << std::endl;
+
+  EstimatorResources resources;
+  resources.scheduler = scheduler_.get();
+  if (params.use_relocalization) {
+    resources.vocabulary = Vocabulary(params.relocalizer_params.vocabulary_path);
+  }
+
+  estimators_.emplace_back(new StateEstimator(params, resources));
+  LOG(INFO) << "Added StateEstimator " << estimators_.size() - 1 << " to the fleet" << std::endl;
+  return *estimators_.back();
+}
+
+
+void EstimatorFleet::Shutdown()
+{
+  if (shutdown_) {
+    return;
+  }
+  shutdown_ = true;
+
+  for (const std::unique_ptr<StateEstimator>& estimator : estimators_) {
+    estimator->Shutdown();
+  }
+}
+
+
+BowVocabulary::ConstPtr EstimatorFleet::Vocabulary(const std::string& path)
+{
+  if (path.empty()) {
+    return nullptr;
+  }
+
+  const auto it = vocabularies_.find(path);
+  if (it != vocabularies_.end()) {
+    return it->second;
+  }
+
+  // NOTE(milo): Failures aren't cached, since an estimator that trains its own vocabulary saves it to
+  // the same path, and the next one can load it from there.
+  BowVocabulary::ConstPtr vocabulary = BowVocabulary::LoadShared(path);
+  if (vocabulary) {
+    vocabularies_.emplace(path, vocabulary);
+  }
+  return vocabulary;
+}
+
+
+}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/task_scheduler.hpp"
+#include "core/thread_util.hpp"
+#include "vio/state_estimator.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Hosts several StateEstimators in one process (e.g one per simulated vehicle). The estimators share
+// one TaskScheduler for their parallel work, so that N of them don't each size their kernels for the
+// whole machine, and any Relocalizer vocabulary is loaded once (by path) and shared read-only.
+//
+// NOTE(milo): Each estimator still has its own loop threads, since they block on their queues (see
+// TaskScheduler), but those mostly sleep. The GpuContext is process-wide too, so GPU frontends share
+// its pools and streams.
+class EstimatorFleet final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(EstimatorFleet)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(EstimatorFleet)
+
+  // The shared scheduler gets num_workers workers, configured with worker_config.
+  explicit EstimatorFleet(int num_workers, const ThreadConfig& worker_config = ThreadConfig());
+
+  // Calls Shutdown().
+  ~EstimatorFleet();
+
+  // Construct another estimator. The reference stays valid for the life of the fleet.
+  StateEstimator& Add(const StateEstimator::Params& params);
+
+  size_t Size() const { return estimators_.size(); }
+  StateEstimator& At(size_t i) { return *estimators_.at(i); }
+
+  TaskScheduler& Scheduler() { return *scheduler_; }
+
+  // Shuts down every estimator. Nothing can be added after this.
+  void Shutdown();
+
+ private:
+  // Returns nullptr if the path is empty, or the vocabulary can't be loaded (then the Relocalizer
+  // falls back to its own).
+  BowVocabulary::ConstPtr Vocabulary(const std::string& path);
+
+  // NOTE(milo): Declared first, so that it outlives the estimators that use it.
+  std::unique_ptr<TaskScheduler> scheduler_;
+  std::map<std::string, BowVocabulary::ConstPtr> vocabularies_;
+  std::vector<std::unique_ptr<StateEstimator>> estimators_;
+  bool shutdown_ = false;
+};
+
+
+}
+}
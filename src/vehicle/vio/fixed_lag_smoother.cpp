@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
 #include <gtsam/navigation/NavState.h>
 #include <gtsam/navigation/AttitudeFactor.h>
 #include <gtsam/inference/Symbol.h>
@@ -6,16 +10,26 @@
 #include <gtsam_unstable/slam/MagPoseFactor.h>
 #include <gtsam_unstable/slam/PartialPosePriorFactor.h>
 
+#include "core/async_log.hpp"
+#include "core/task_scheduler.hpp"
+#include "core/timer.hpp"
 #include "core/transform_util.hpp"
+#include "core/trace.hpp"
 #include "vio/fixed_lag_smoother.hpp"
+#include "vio/landmark_budget.hpp"
 #include "vio/vo_result.hpp"
 // #include "vio/single_axis_factor.hpp"
 
+#if defined(BM_ENABLE_TBB) && !defined(GTSAM_USE_TBB)
+#warning "BM_ENABLE_TBB is on, but GTSAM was built without TBB, so iSAM2 updates are still single-threaded"
+#endif
+
 namespace bm {
 namespace vio {
 
 static const double kSetSkewToZero = 0.0;
 static const int kTranslationStartIndex = 3;
+static const int kMinObsPerSmartFactor = 2;
 
 typedef gtsam::RangeFactorWithTransform<gtsam::Pose3, gtsam::Point3> RangeFactor;
 typedef gtsam::MagPoseFactor<gtsam::Pose3> MagFactor;
@@ -33,6 +47,31 @@ void FixedLagSmoother::Params::LoadParams(const YamlParser& p)
   p.GetParam("extra_smoothing_iters", &extra_smoothing_iters);
   p.GetParam("use_smart_stereo_factors", &use_smart_stereo_factors);
   p.GetParam("smoother_lag_sec", &smoother_lag_sec);
+  lag_controller_params = LagController::Params(p.Subtree("LagController"));
+  p.GetParam("async_update", &async_update);
+  p.GetParam("relinearize_threshold", &relinearize_threshold);
+  p.GetParam("relinearize_skip", &relinearize_skip);
+  p.GetParam("enable_partial_relinearization_check", &enable_partial_relinearization_check);
+  p.GetParam("constrain_newest_keypose_last", &constrain_newest_keypose_last);
+  p.GetParam("history_sec", &history_sec);
+  p.GetParam("covariance_interval", &covariance_interval);
+  CHECK_GE(covariance_interval, 1);
+  CHECK_GE(relinearize_threshold, 0);
+  CHECK_GE(relinearize_skip, 1);
+  p.GetParam("max_smart_factors", &max_smart_factors);
+  p.GetParam("max_obs_per_smart_factor", &max_obs_per_smart_factor);
+  p.GetParam("smart_factor_parallax_px", &smart_factor_parallax_px);
+  p.GetParam("smart_factor_grid_rows", &smart_factor_grid_rows);
+  p.GetParam("smart_factor_grid_cols", &smart_factor_grid_cols);
+  CHECK_GT(max_obs_per_smart_factor, 1) << "Smart factors need at least 2 observations" << std::endl;
+  p.GetParam("parallel_triangulation", &parallel_triangulation);
+  p.GetParam("incremental_triangulation", &incremental_triangulation);
+  p.GetParam("retriangulate_pose_threshold", &retriangulate_pose_threshold);
+  p.GetParam("retriangulate_point_threshold", &retriangulate_point_threshold);
+  CHECK_GE(retriangulate_pose_threshold, 0);
+  CHECK_GE(retriangulate_point_threshold, 0);
+  p.GetParam("tbb_threads", &tbb_threads);
+  CHECK_GE(tbb_threads, 0);
 
   pose_prior_noise_model = DiagModel::Sigmas(YamlToVector<gtsam::Vector6>(p.GetNode("pose_prior_noise_model")));
   frontend_vo_noise_model = DiagModel::Sigmas(YamlToVector<gtsam::Vector6>(p.GetNode("frontend_vo_noise_model")));
@@ -63,9 +102,18 @@ void FixedLagSmoother::Params::LoadParams(const YamlParser& p)
   body_P_mag = gtsam::Pose3(YamlToTransform(p.GetNode("/shared/mag0/body_T_sensor")));
   body_P_receiver = gtsam::Pose3(YamlToTransform(p.GetNode("/shared/aps0/body_T_receiver")));
 
-  Matrix4d body_T_left, body_T_right;
-  YamlToStereoRig(p.GetNode("/shared/stereo_forward"), stereo_rig, body_T_left, body_T_right);
-  body_P_cam = gtsam::Pose3(body_T_left);
+  p.GetParam("allowed_misalignment_rig", &allowed_misalignment_rig);
+
+  body_P_cams.clear();
+  stereo_rigs.clear();
+  for (const std::string& name : YamlToStringList(p.GetNode("/shared/stereo_rigs"))) {
+    Matrix4d body_T_left, body_T_right;
+    StereoCamera stereo_rig;
+    YamlToStereoRig(p.GetNode("/shared/" + name), stereo_rig, body_T_left, body_T_right);
+    body_P_cams.emplace_back(body_T_left);
+    stereo_rigs.emplace_back(stereo_rig);
+  }
+  CHECK(!stereo_rigs.empty()) << "Need at least one stereo rig" << std::endl;
 
   YamlToVector<Vector3d>(p.GetNode("/shared/n_gravity"), n_gravity);
 }
@@ -73,26 +121,52 @@ void FixedLagSmoother::Params::LoadParams(const YamlParser& p)
 
 FixedLagSmoother::FixedLagSmoother(const Params& params)
     : params_(params),
-      stereo_rig_(params.stereo_rig)
+      lag_controller_(params.lag_controller_params, params.smoother_lag_sec),
+      lag_sec_(lag_controller_.Lag())
 {
-  ResetSmoother();
+  CHECK(!params_.stereo_rigs.empty()) << "Need at least one stereo rig" << std::endl;
+  CHECK_EQ(params_.stereo_rigs.size(), params_.body_P_cams.size());
 
-  cal3_stereo_ = gtsam::Cal3_S2Stereo::shared_ptr(
-      new gtsam::Cal3_S2Stereo(
-          stereo_rig_.fx(),
-          stereo_rig_.fy(),
-          kSetSkewToZero,
-          stereo_rig_.cx(),
-          stereo_rig_.cy(),
-          stereo_rig_.Baseline()));
+  ResetSmoother();
+  rig_vo_keys_.resize(params_.stereo_rigs.size(), 0);
+
+  for (const StereoCamera& stereo_rig : params_.stereo_rigs) {
+    cal3_stereo_.emplace_back(new gtsam::Cal3_S2Stereo(
+        stereo_rig.fx(),
+        stereo_rig.fy(),
+        kSetSkewToZero,
+        stereo_rig.cx(),
+        stereo_rig.cy(),
+        stereo_rig.Baseline()));
+  }
 
   // https://bitbucket.org/gtborg/gtsam/issues/420/problem-with-isam2-stereo-smart-factors-no
   lmk_stereo_factor_params_ = gtsam::SmartStereoProjectionParams(gtsam::JACOBIAN_SVD, gtsam::ZERO_ON_DEGENERACY);
 
+  // NOTE(milo): iSAM2 might linearize a factor at slightly different poses than it was triangulated
+  // at (see TriangulateSmartFactors), which would throw away the incremental point otherwise.
+  if (params_.incremental_triangulation) {
+    lmk_stereo_factor_params_.setRetriangulationThreshold(params_.retriangulate_pose_threshold);
+  }
+
   Vector3d n_gravity_unit;
   depth_axis_ = GetGravityAxis(params_.n_gravity, n_gravity_unit);
   depth_sign_ = n_gravity_unit(depth_axis_) >= 0 ? 1.0 : -1.0;
   LOG(INFO) << "Unit GRAVITY/DEPTH axis: " << n_gravity_unit.transpose() << std::endl;
+
+  if (params_.async_update) {
+    optimizer_thread_ = std::thread(&FixedLagSmoother::OptimizerLoop, this);
+  }
+}
+
+
+FixedLagSmoother::~FixedLagSmoother()
+{
+  is_shutdown_.store(true);
+  optimizer_notifier_.Notify();
+  if (optimizer_thread_.joinable()) {
+    optimizer_thread_.join();
+  }
 }
 
 
@@ -100,13 +174,14 @@ void FixedLagSmoother::ResetSmoother()
 {
   // If relinearizeThreshold is zero, the graph is always relinearized on update().
   gtsam::ISAM2Params smoother_params;
-  smoother_params.relinearizeThreshold = 0.0;
-  smoother_params.relinearizeSkip = 1;
+  smoother_params.relinearizeThreshold = params_.relinearize_threshold;
+  smoother_params.relinearizeSkip = params_.relinearize_skip;
+  smoother_params.enablePartialRelinearizationCheck = params_.enable_partial_relinearization_check;
 
   // NOTE(milo): This is needed for using smart factors!!!
   // See: https://github.com/borglab/gtsam/blob/d6b24294712db197096cd3ea75fbed3157aea096/gtsam_unstable/slam/tests/testSmartStereoFactor_iSAM2.cpp
   smoother_params.cacheLinearizedFactors = false;
-  smoother_ = gtsam::IncrementalFixedLagSmoother(params_.smoother_lag_sec, smoother_params);
+  smoother_ = OrderedFixedLagSmoother(lag_sec_.load(), smoother_params, params_.constrain_newest_keypose_last);
 }
 
 
@@ -116,12 +191,8 @@ void FixedLagSmoother::Initialize(seconds_t timestamp,
                                   const ImuBias& imu_bias,
                                   bool imu_available)
 {
+  ClearState();
   ResetKeyposeId();
-  ResetSmoother();
-
-  // Clear out any members that store state.
-  lmk_to_factor_map_.clear();;
-  stereo_factors_.clear();
 
   const uid_t id0 = GetNextKeyposeId();
   const gtsam::Symbol P0_sym('X', id0);
@@ -134,10 +205,12 @@ void FixedLagSmoother::Initialize(seconds_t timestamp,
 
   new_timestamps[P0_sym] = timestamp;
 
-  result_ = SmootherResult(id0, timestamp, world_P_body, imu_available, world_v_body, imu_bias,
+  last_keypose_ = SmootherResult(id0, timestamp, world_P_body, imu_available, world_v_body, imu_bias,
       params_.pose_prior_noise_model->covariance(),
       params_.velocity_noise_model->covariance(),
       params_.bias_prior_noise_model->covariance());
+  result_.Store(last_keypose_);
+  recent_keyposes_.emplace_back(timestamp, P0_sym);
 
   // Prior and initial value for the first pose.
   new_factors.addPrior<gtsam::Pose3>(P0_sym, world_P_body, params_.pose_prior_noise_model);
@@ -154,6 +227,69 @@ void FixedLagSmoother::Initialize(seconds_t timestamp,
   }
 
   smoother_.update(new_factors, new_values, new_timestamps);
+  PublishPoses();
+}
+
+
+void FixedLagSmoother::Initialize(seconds_t timestamp, const SmootherResult& prior)
+{
+  ClearState();
+
+  // Keep counting keyposes from the previous run, so that keypose ids are never reused.
+  next_kf_id_ = prior.keypose_id + 1;
+  const uid_t id0 = GetNextKeyposeId();
+  const gtsam::Symbol P0_sym('X', id0);
+  const gtsam::Symbol V0_sym('V', id0);
+  const gtsam::Symbol B0_sym('B', id0);
+
+  gtsam::NonlinearFactorGraph new_factors;
+  gtsam::Values new_values;
+  KeyTimestampMap new_timestamps;
+
+  new_timestamps[P0_sym] = timestamp;
+
+  last_keypose_ = SmootherResult(id0, timestamp, prior.world_P_body, prior.has_imu_state, prior.world_v_body,
+      prior.imu_bias, prior.cov_pose, prior.cov_vel, prior.cov_bias);
+  result_.Store(last_keypose_);
+  recent_keyposes_.emplace_back(timestamp, P0_sym);
+
+  // NOTE(milo): The marginals are in the same (tangent space) coordinates as the prior factors.
+  new_factors.addPrior<gtsam::Pose3>(P0_sym, prior.world_P_body, GaussianModel::Covariance(prior.cov_pose));
+  new_values.insert(P0_sym, prior.world_P_body);
+
+  if (prior.has_imu_state) {
+    new_values.insert(V0_sym, prior.world_v_body);
+    new_values.insert(B0_sym, prior.imu_bias);
+    new_factors.addPrior(V0_sym, prior.world_v_body, GaussianModel::Covariance(prior.cov_vel));
+    new_factors.addPrior(B0_sym, prior.imu_bias, GaussianModel::Covariance(prior.cov_bias));
+    new_timestamps[V0_sym] = timestamp;
+    new_timestamps[B0_sym] = timestamp;
+  }
+
+  smoother_.update(new_factors, new_values, new_timestamps);
+  PublishPoses();
+}
+
+
+void FixedLagSmoother::ClearState()
+{
+  // NOTE(milo): The optimizer thread only touches smoother_ while it has a batch.
+  WaitUntilIdle();
+
+  ResetSmoother();
+
+  // Clear out any members that store state.
+  lmk_to_factor_map_.clear();
+  stereo_factors_.clear();
+  lmk_tracks_.clear();
+  recent_keyposes_.clear();
+  pending_rig_vo_.clear();
+  std::fill(rig_vo_keys_.begin(), rig_vo_keys_.end(), 0);
+  history_lock_.lock();
+  history_.clear();
+  history_values_.clear();
+  history_lock_.unlock();
+  unsaved_history_.clear();
 }
 
 
@@ -234,18 +370,29 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
                                         DepthMeasurement::ConstPtr maybe_depth_ptr,
                                         AttitudeMeasurement::ConstPtr maybe_attitude_ptr,
                                         const MultiRange& maybe_ranges,
-                                        MagMeasurement::ConstPtr maybe_mag_ptr)
+                                        MagMeasurement::ConstPtr maybe_mag_ptr,
+                                        PoseMeasurement::ConstPtr maybe_pose_ptr)
 {
+  BM_TRACE_SCOPE("FixedLagSmoother::Update");
+
   CHECK(maybe_vo_ptr || maybe_pim_ptr) << "Must have either IMU or VO available" << std::endl;
 
+  // If the optimizer has caught up, build on its estimate instead of our initial guess.
+  if (params_.async_update) {
+    const SmootherResult optimized = GetResult();
+    if (optimized.keypose_id == last_keypose_.keypose_id) {
+      last_keypose_ = optimized;
+    }
+  }
+
   gtsam::NonlinearFactorGraph new_factors;
   gtsam::Values new_values;
   KeyTimestampMap new_timestamps;
 
   const uid_t keypose_id = GetNextKeyposeId();
   const seconds_t keypose_time = maybe_vo_ptr ? ConvertToSeconds(maybe_vo_ptr->timestamp) : maybe_pim_ptr->to_time;
-  const uid_t last_keypose_id = result_.keypose_id;
-  const seconds_t last_keypose_time = result_.timestamp;
+  const uid_t last_keypose_id = last_keypose_.keypose_id;
+  const seconds_t last_keypose_time = last_keypose_.timestamp;
 
   const gtsam::Symbol keypose_sym('X', keypose_id);
   const gtsam::Symbol vel_sym('V', keypose_id);
@@ -260,12 +407,6 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
 
   new_timestamps[keypose_sym] = keypose_time;
 
-  // Needed for using ISAM2 with smart factors.
-  // gtsam::FastMap<gtsam::FactorIndex, gtsam::KeySet> factorNewAffectedKeys;
-
-  // Map: ISAM2 internal FactorIndex => lmk_id.
-  // std::map<gtsam::FactorIndex, uid_t> map_new_factor_to_lmk_id;
-
   //====================================== VISUAL ODOMETRY =========================================
   if (maybe_vo_ptr) {
     const VoResult& odom_result = *maybe_vo_ptr;
@@ -279,8 +420,9 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
     // If VO is valid, we can use it to create a between factor and guess the latest pose.
     if (odom_aligned) {
       // NOTE(milo): Must convert VO into BODY frame odometry!
-      const gtsam::Pose3& body_P_odom = params_.body_P_cam * gtsam::Pose3(odom_result.lkf_T_cam) * params_.body_P_cam.inverse();
-      const gtsam::Pose3 world_P_body = result_.world_P_body * body_P_odom;
+      const gtsam::Pose3& body_P_cam = params_.body_P_cams.front();
+      const gtsam::Pose3 body_P_odom = body_P_cam * gtsam::Pose3(odom_result.lkf_T_cam) * body_P_cam.inverse();
+      const gtsam::Pose3 world_P_body = last_keypose_.world_P_body * body_P_odom;
       new_values.insert(keypose_sym, world_P_body);
 
       // Use a robust noise model to reduce the effect of bad VO estimates.
@@ -296,48 +438,27 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
 
   //===================================== STEREO SMART FACTORS ======================================
   // Even if visual odometry didn't line up with the previous keypose, we still want to add stereo
-  // landmarks, since they could be observed in future keyframes.
-  // if (params_.use_smart_stereo_factors) {
-  //   for (const LandmarkObservation& lmk_obs : odom_result.lmk_obs) {
-  //     if (lmk_obs.disparity < 0) {
-  //       LOG(WARNING) << "Skipped zero-disparity observation!" << std::endl;
-  //       continue;
-  //     }
-
-  //     const uid_t lmk_id = lmk_obs.landmark_id;
-
-  //     // NEW SMART FACTOR: Creating smart stereo factor for the first time.
-  //     // NOTE(milo): Unfortunately, smart factors do not support robust error functions yet.
-  //     // https://groups.google.com/g/gtsam-users/c/qHXl9RLRxRs/m/6zWoA0wJBAAJ
-  //     if (stereo_factors_.count(lmk_id) == 0) {
-  //       stereo_factors_.emplace(lmk_id, new SmartStereoFactor(
-  //           params_.lmk_stereo_factor_noise_model, lmk_stereo_factor_params_, params_.body_P_cam));
-
-  //       // Indicate that the newest factor refers to lmk_id.
-  //       // NOTE(milo): Add the new factor to the graph. Order matters here!
-  //       map_new_factor_to_lmk_id[new_factors.size()] = lmk_id;
-  //       new_factors.push_back(stereo_factors_.at(lmk_id));
-
-  //     // UPDATE SMART FACTOR: An existing ISAM2 factor now affects the camera pose with the current key.
-  //     } else {
-  //       factorNewAffectedKeys[lmk_to_factor_map_.at(lmk_id)].insert(keypose_sym);
-  //     }
-
-  //     SmartStereoFactor::shared_ptr sfptr = stereo_factors_.at(lmk_id);
-  //     const gtsam::StereoPoint2 stereo_point2(
-  //         lmk_obs.pixel_location.x,                      // X-coord in left image
-  //         lmk_obs.pixel_location.x - lmk_obs.disparity,  // x-coord in right image
-  //         lmk_obs.pixel_location.y);                     // y-coord in both images (rectified)
-  //     sfptr->add(stereo_point2, keypose_sym, cal3_stereo_);
-  //   }
-  // }
+  // landmarks, since they could be observed in future keyframes. The factors themselves are made
+  // right before optimizing (see UpdateSmartStereoFactors).
+  std::vector<KeyposeLandmarks> new_lmk_obs;
+  if (params_.use_smart_stereo_factors && maybe_vo_ptr) {
+    new_lmk_obs.emplace_back(keypose_sym, keypose_time, maybe_vo_ptr);
+  }
+
+  // The other rigs' keyframes go on whichever keypose is closest in time (this one or an older one).
+  recent_keyposes_.emplace_back(keypose_time, keypose_sym);
+  const double lag_sec = lag_sec_.load();
+  while (!recent_keyposes_.empty() && (keypose_time - recent_keyposes_.front().first) > lag_sec) {
+    recent_keyposes_.pop_front();
+  }
+  MatchRigVo(new_lmk_obs);
 
   //=================================== IMU PREINTEGRATION FACTOR ==================================
   if (maybe_pim_ptr) {
     const PimResult& pim_result = *maybe_pim_ptr;
     CHECK(pim_result.timestamps_aligned) << "Preintegrated IMU to/from timestamps not aligned" << std::endl;
 
-    AddImuFactors(keypose_id, pim_result, result_, true, new_values, new_factors, new_timestamps, params_);
+    AddImuFactors(keypose_id, pim_result, last_keypose_, true, new_values, new_factors, new_timestamps, params_);
 
     new_timestamps[vel_sym] = keypose_time;
     new_timestamps[bias_sym] = keypose_time;
@@ -410,12 +531,20 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
       params_.body_P_mag));
   }
 
+  //====================================== POSE PRIOR FACTOR =======================================
+  if (maybe_pose_ptr) {
+    // Use a robust noise model, since a tag detection can be wrong (e.g a misread id).
+    const RobustModel::shared_ptr model = RobustModel::Create(
+      mCauchy::Create(1.0), DiagModel::Sigmas(maybe_pose_ptr->sigmas));
+    new_factors.addPrior(keypose_sym, gtsam::Pose3(maybe_pose_ptr->world_T_body), model);
+  }
+
   //================================= FACTOR GRAPH SAFETY CHECK ====================================
   if (!graph_has_vo_btw_factor && !graph_has_imu_btw_factor) {
-    LOG(WARNING) << "Graph doesn't have a between factor from VO or IMU, so it is under-constrained!" << std::endl;
-    LOG(WARNING) << "Assuming NO MOTION from previous keypose!" << std::endl;
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "Graph doesn't have a between factor from VO or IMU, so it is under-constrained!"
+                                   << " Assuming NO MOTION from previous keypose!";
     const gtsam::Pose3 body_P_odom = gtsam::Pose3::identity();
-    const gtsam::Pose3 world_P_body = result_.world_P_body * body_P_odom;
+    const gtsam::Pose3 world_P_body = last_keypose_.world_P_body * body_P_odom;
     new_values.insert(keypose_sym, world_P_body);
 
     // Use a robust noise model so that this no-motion prior can be "switched off" later.
@@ -428,52 +557,554 @@ SmootherResult FixedLagSmoother::Update(VoResult::ConstPtr maybe_vo_ptr,
   }
 
   //==================================== UPDATE FACTOR GRAPH =======================================
-  // gtsam::ISAM2UpdateParams update_params;
-  // update_params.newAffectedKeys = std::move(factorNewAffectedKeys);
-  // const gtsam::ISAM2Result& isam_result = smoother_.update(new_factors, new_values, update_params);
+  if (!params_.async_update) {
+    PendingUpdate update;
+    update.factors = std::move(new_factors);
+    update.values = std::move(new_values);
+    update.timestamps = std::move(new_timestamps);
+    update.lmk_obs = std::move(new_lmk_obs);
+    update.keypose_id = keypose_id;
+    update.keypose_time = keypose_time;
+    update.num_keyposes = 1;
+    last_keypose_ = Optimize(update);
+    return last_keypose_;
+  }
 
-  // // Housekeeping: figure out what factor index has been assigned to each new factor.
-  // for (const auto &fct_to_lmk : map_new_factor_to_lmk_id) {
-  //   lmk_to_factor_map_[fct_to_lmk.second] = isam_result.newFactorsIndices.at(fct_to_lmk.first);
-  // }
+  // ASYNC: The next keypose will be built on top of the initial guess for this one.
+  SmootherResult guess = last_keypose_;
+  guess.keypose_id = keypose_id;
+  guess.timestamp = keypose_time;
+  guess.world_P_body = new_values.at<gtsam::Pose3>(keypose_sym);
+  if (new_values.exists(vel_sym)) {
+    guess.has_imu_state = true;
+    guess.world_v_body = new_values.at<gtsam::Vector3>(vel_sym);
+  }
 
-  smoother_.update(new_factors, new_values, new_timestamps);
+  // Merge into the batch that's waiting for the optimizer (if there is one).
+  pending_lock_.lock();
+  pending_.factors.push_back(new_factors);
+  pending_.values.insert(new_values);
+  for (const auto& it : new_timestamps) {
+    pending_.timestamps[it.first] = it.second;
+  }
+  pending_.lmk_obs.insert(pending_.lmk_obs.end(), new_lmk_obs.begin(), new_lmk_obs.end());
+  pending_.keypose_id = keypose_id;
+  pending_.keypose_time = keypose_time;
+  ++pending_.num_keyposes;
+  has_pending_.store(true);
+  pending_lock_.unlock();
+  optimizer_notifier_.Notify();
+
+  last_keypose_ = guess;
+  return guess;
+}
+
+
+void FixedLagSmoother::AddRigVo(VoResult::ConstPtr rig_vo)
+{
+  CHECK(rig_vo->rig > 0 && rig_vo->rig < params_.stereo_rigs.size()) << "Invalid rig: " << rig_vo->rig << std::endl;
+  if (params_.use_smart_stereo_factors) {
+    pending_rig_vo_.emplace_back(rig_vo);
+  }
+}
+
+
+void FixedLagSmoother::MatchRigVo(std::vector<KeyposeLandmarks>& new_lmk_obs)
+{
+  if (recent_keyposes_.empty()) {
+    return;
+  }
+
+  const seconds_t newest_time = recent_keyposes_.back().first;
+  for (auto it = pending_rig_vo_.begin(); it != pending_rig_vo_.end();) {
+    const VoResult& rig_vo = **it;
+    const seconds_t t = ConvertToSeconds(rig_vo.timestamp);
+
+    // A keypose closer to this one might still come along.
+    if ((t - newest_time) > params_.allowed_misalignment_rig) {
+      ++it;
+      continue;
+    }
+
+    // NOTE(milo): Only a few keyposes are within the lag, so a linear search is fine.
+    const std::pair<seconds_t, gtsam::Key>* nearest = &recent_keyposes_.front();
+    for (const auto& keypose : recent_keyposes_) {
+      if (std::fabs(keypose.first - t) < std::fabs(nearest->first - t)) {
+        nearest = &keypose;
+      }
+    }
+
+    // NOTE(milo): A smart factor can only have one observation per keypose, so if a rig has more
+    // than one keyframe near the same keypose, the first one wins.
+    gtsam::Key& last_key = rig_vo_keys_.at(rig_vo.rig);
+    if (std::fabs(nearest->first - t) <= params_.allowed_misalignment_rig && nearest->second != last_key) {
+      new_lmk_obs.emplace_back(nearest->second, nearest->first, *it);
+      last_key = nearest->second;
+    }
+    it = pending_rig_vo_.erase(it);
+  }
+}
+
+
+SmootherResult FixedLagSmoother::Optimize(const PendingUpdate& update)
+{
+  BM_TRACE_SCOPE("FixedLagSmoother::Optimize");
+
+  const gtsam::Symbol keypose_sym('X', update.keypose_id);
+  const gtsam::Symbol vel_sym('V', update.keypose_id);
+  const gtsam::Symbol bias_sym('B', update.keypose_id);
+
+  // NOTE(milo): Smart factors are appended after the other new factors, so that we can look up the
+  // FactorIndex that iSAM2 gives each one.
+  gtsam::NonlinearFactorGraph new_factors = update.factors;
+  gtsam::FactorIndices factors_to_remove;
+  std::vector<uid_t> new_smart_factor_lmk_ids;
+  const size_t first_smart_factor = new_factors.size();
+
+  if (params_.use_smart_stereo_factors && !update.lmk_obs.empty()) {
+    UpdateSmartStereoFactors(update, new_factors, factors_to_remove, new_smart_factor_lmk_ids);
+  }
+
+  if ((params_.parallel_triangulation || params_.incremental_triangulation) && !stereo_factors_.empty()) {
+    TriangulateSmartFactors(update);
+  }
+
+  Timer update_timer(true);
+  RunInArena([&]() { smoother_.update(new_factors, update.values, update.timestamps, factors_to_remove); });
+
+  const gtsam::FactorIndices& new_factor_indices = smoother_.getISAM2Result().newFactorsIndices;
+  for (size_t i = 0; i < new_smart_factor_lmk_ids.size(); ++i) {
+    lmk_to_factor_map_[new_smart_factor_lmk_ids.at(i)] = new_factor_indices.at(first_smart_factor + i);
+  }
 
   // (Optional) run the smoother a few more times to reduce error.
   for (int i = 0; i < params_.extra_smoothing_iters; ++i) {
-    smoother_.update();
+    RunInArena([&]() { smoother_.update(); });
   }
 
-  //================================ RETRIEVE VARIABLE ESTIMATES ===================================
-  const gtsam::Values& estimate = smoother_.calculateEstimate();
+  // NOTE(milo): A new lag takes effect at the next update. Keyposes that were already marginalized
+  // stay gone, so a longer lag only keeps the ones that come after.
+  if (lag_controller_.Update(update_timer.Elapsed().milliseconds())) {
+    smoother_.smootherLag() = lag_controller_.Lag();
+    lag_sec_.store(lag_controller_.Lag());
+  }
 
-  const Matrix6d cov_pose = smoother_.marginalCovariance(keypose_sym).matrix();
-  const Matrix3d cov_vel = smoother_.marginalCovariance(vel_sym).matrix();
-  const Matrix6d cov_bias = smoother_.marginalCovariance(bias_sym).matrix();
+  //================================ RETRIEVE VARIABLE ESTIMATES ===================================
+  // NOTE(milo): Only the history needs the whole estimate. Otherwise, just back-substitute for the
+  // newest keypose's variables.
+  if (params_.history_sec > 0) {
+    AddToHistory(update, smoother_.calculateEstimate());
+  }
 
-  result_lock_.lock();
-  result_ = SmootherResult(
-      keypose_id,
-      keypose_time,
-      estimate.at<gtsam::Pose3>(keypose_sym),
+  // NOTE(milo): Only the optimizing thread stores results, so this is the last one it made.
+  const SmootherResult last_result = result_.Load();
+  SmootherResult result(
+      update.keypose_id,
+      update.keypose_time,
+      smoother_.calculateEstimate<gtsam::Pose3>(keypose_sym),
       true,
-      estimate.at<gtsam::Vector3>(vel_sym),
-      estimate.at<ImuBias>(bias_sym),
-      cov_pose,
-      cov_vel,
-      cov_bias);
-  result_lock_.unlock();
-
-  return result_;
+      smoother_.calculateEstimate<gtsam::Vector3>(vel_sym),
+      smoother_.calculateEstimate<ImuBias>(bias_sym),
+      last_result.cov_pose,
+      last_result.cov_vel,
+      last_result.cov_bias);
+
+  keyposes_since_covariance_ += update.num_keyposes;
+  const bool requested = covariance_requested_.exchange(false);
+  result.has_covariance = requested || keyposes_since_covariance_ >= params_.covariance_interval;
+
+  if (result.has_covariance) {
+    BM_TRACE_SCOPE("FixedLagSmoother::MarginalCovariance");
+    keyposes_since_covariance_ = 0;
+    std::vector<gtsam::Matrix> marginals;
+    if (smoother_.RootCliqueMarginals({ keypose_sym, vel_sym, bias_sym }, marginals)) {
+      result.cov_pose = marginals.at(0);
+      result.cov_vel = marginals.at(1);
+      result.cov_bias = marginals.at(2);
+    } else {
+      result.cov_pose = smoother_.marginalCovariance(keypose_sym).matrix();
+      result.cov_vel = smoother_.marginalCovariance(vel_sym).matrix();
+      result.cov_bias = smoother_.marginalCovariance(bias_sym).matrix();
+    }
+  }
+
+  result_.Store(result);
+  PublishPoses();
+
+  return result;
+}
+
+
+void FixedLagSmoother::UpdateSmartStereoFactors(const PendingUpdate& update,
+                                                gtsam::NonlinearFactorGraph& new_factors,
+                                                gtsam::FactorIndices& factors_to_remove,
+                                                std::vector<uid_t>& new_factor_lmk_ids)
+{
+  BM_TRACE_SCOPE("FixedLagSmoother::UpdateSmartStereoFactors");
+
+  const gtsam::NonlinearFactorGraph& graph = smoother_.getFactors();
+  const gtsam::Values& linearization_point = smoother_.getLinearizationPoint();
+  const auto key_exists = [&](gtsam::Key key)
+  {
+    return update.values.exists(key) || linearization_point.exists(key);
+  };
+
+  // NOTE(milo): The smoother removes a factor on its own when one of its keyposes gets marginalized,
+  // so forget about any factors that aren't in the graph anymore (and never try to remove them).
+  for (auto it = lmk_to_factor_map_.begin(); it != lmk_to_factor_map_.end();) {
+    if (it->second >= graph.size() || !graph.at(it->second)) {
+      stereo_factors_.erase(it->first);
+      it = lmk_to_factor_map_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // Add the new observations to each landmark's track, keeping only the newest few.
+  std::vector<uid_t> touched_lmk_ids;
+  std::unordered_set<uid_t> touched;
+  for (const KeyposeLandmarks& keypose_obs : update.lmk_obs) {
+    for (const LandmarkObservation& lmk_obs : keypose_obs.vo->lmk_obs) {
+      if (lmk_obs.disparity <= 0) {
+        continue;
+      }
+      // NOTE(milo): Each rig's frontend has its own range of landmark ids, so they never collide.
+      LandmarkTrack& track = lmk_tracks_[lmk_obs.landmark_id];
+      track.rig = keypose_obs.vo->rig;
+      track.obs.emplace_back(keypose_obs.key, gtsam::StereoPoint2(
+          lmk_obs.pixel_location.x,                      // X-coord in left image
+          lmk_obs.pixel_location.x - lmk_obs.disparity,  // x-coord in right image
+          lmk_obs.pixel_location.y));                    // y-coord in both images (rectified)
+      while ((int)track.obs.size() > params_.max_obs_per_smart_factor) {
+        track.obs.pop_front();
+      }
+      track.last_seen = std::max(track.last_seen, keypose_obs.keypose_time);
+      if (touched.insert(lmk_obs.landmark_id).second) {
+        touched_lmk_ids.emplace_back(lmk_obs.landmark_id);
+      }
+    }
+  }
+
+  // Forget about landmarks that haven't been seen within the lag window.
+  const seconds_t newest_time = update.keypose_time;
+  const double lag_sec = lag_sec_.load();
+  for (auto it = lmk_tracks_.begin(); it != lmk_tracks_.end();) {
+    const bool expired = (newest_time - it->second.last_seen) > lag_sec;
+    if (expired && stereo_factors_.count(it->first) == 0) {
+      it = lmk_tracks_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // Candidates are the landmarks with new observations, and the ones that already have a factor.
+  std::vector<uid_t> candidate_ids = touched_lmk_ids;
+  for (const auto& it : stereo_factors_) {
+    if (touched.count(it.first) == 0) {
+      candidate_ids.emplace_back(it.first);
+    }
+  }
+
+  std::vector<LandmarkCandidate> candidates;
+  std::vector<size_t> candidate_rigs;
+  for (const uid_t lmk_id : candidate_ids) {
+    LandmarkTrack& track = lmk_tracks_.at(lmk_id);
+
+    // Observations from keyposes that were marginalized can't go into a new factor.
+    while (!track.obs.empty() && !key_exists(track.obs.front().first)) {
+      track.obs.pop_front();
+    }
+
+    const bool has_factor = stereo_factors_.count(lmk_id) != 0;
+    if (track.obs.empty() || ((int)track.obs.size() < kMinObsPerSmartFactor && !has_factor)) {
+      continue;
+    }
+
+    const gtsam::StereoPoint2& oldest = track.obs.front().second;
+    const gtsam::StereoPoint2& newest = track.obs.back().second;
+    const Vector2d newest_px(newest.uL(), newest.v());
+    const double parallax_px = (Vector2d(oldest.uL(), oldest.v()) - newest_px).norm();
+    candidates.emplace_back(lmk_id, (int)track.obs.size(), parallax_px, newest_px);
+    candidate_rigs.emplace_back(track.rig);
+  }
+
+  // Each rig gets its own budget, since the grid coverage is over its own image.
+  std::vector<bool> selected(candidates.size(), false);
+  for (size_t rig = 0; rig < params_.stereo_rigs.size(); ++rig) {
+    std::vector<LandmarkCandidate> rig_candidates;
+    std::vector<size_t> rig_index;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      if (candidate_rigs.at(i) == rig) {
+        rig_candidates.emplace_back(candidates.at(i));
+        rig_index.emplace_back(i);
+      }
+    }
+    if (rig_candidates.empty()) {
+      continue;
+    }
+
+    const StereoCamera& stereo_rig = params_.stereo_rigs.at(rig);
+    const std::vector<bool> rig_selected = SelectLandmarks(
+        rig_candidates,
+        params_.max_smart_factors,
+        params_.max_obs_per_smart_factor,
+        params_.smart_factor_parallax_px,
+        params_.smart_factor_grid_rows,
+        params_.smart_factor_grid_cols,
+        stereo_rig.Width(),
+        stereo_rig.Height());
+    for (size_t j = 0; j < rig_selected.size(); ++j) {
+      selected.at(rig_index.at(j)) = rig_selected.at(j);
+    }
+  }
+
+  // Replace all of the factors that changed at once, so that iSAM2 only does one update.
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const uid_t lmk_id = candidates.at(i).lmk_id;
+    const bool has_factor = stereo_factors_.count(lmk_id) != 0;
+
+    // EVICTED: Over budget, so this landmark loses its factor.
+    if (!selected.at(i)) {
+      if (has_factor) {
+        factors_to_remove.emplace_back(lmk_to_factor_map_.at(lmk_id));
+        stereo_factors_.erase(lmk_id);
+        lmk_to_factor_map_.erase(lmk_id);
+      }
+      continue;
+    }
+
+    // KEPT: Nothing new, so leave the existing factor alone.
+    if (touched.count(lmk_id) == 0) {
+      continue;
+    }
+
+    // NEW OR UPDATED: Make a fresh factor with the newest observations, replacing the old one.
+    // NOTE(milo): Unfortunately, smart factors do not support robust error functions yet.
+    // https://groups.google.com/g/gtsam-users/c/qHXl9RLRxRs/m/6zWoA0wJBAAJ
+    if (has_factor) {
+      factors_to_remove.emplace_back(lmk_to_factor_map_.at(lmk_id));
+      lmk_to_factor_map_.erase(lmk_id);
+    }
+
+    const LandmarkTrack& track = lmk_tracks_.at(lmk_id);
+    gtsam::CachedSmartStereoFactor::shared_ptr factor(new gtsam::CachedSmartStereoFactor(
+        params_.lmk_stereo_factor_noise_model, lmk_stereo_factor_params_, params_.body_P_cams.at(track.rig)));
+    for (const auto& obs : track.obs) {
+      factor->add(obs.second, obs.first, cal3_stereo_.at(track.rig));
+    }
+    if (has_factor && params_.incremental_triangulation) {
+      factor->Seed(*stereo_factors_.at(lmk_id));
+    }
+
+    stereo_factors_[lmk_id] = factor;
+    new_factors.push_back(factor);
+    new_factor_lmk_ids.emplace_back(lmk_id);
+  }
+}
+
+
+void FixedLagSmoother::TriangulateSmartFactors(const PendingUpdate& update)
+{
+  BM_TRACE_SCOPE("FixedLagSmoother::TriangulateSmartFactors");
+
+  // NOTE(milo): If every variable is relinearized on this update, iSAM2 linearizes at the current
+  // estimate. Otherwise, it's the linearization point (except for the few variables that moved past
+  // the threshold). A factor whose cameras moved since it was triangulated here just triangulates
+  // again inside iSAM2, so a wrong guess only wastes time.
+  const bool relinearize_all = params_.relinearize_threshold <= 0 && params_.relinearize_skip == 1;
+  gtsam::Values values = relinearize_all ? smoother_.calculateEstimate() : smoother_.getLinearizationPoint();
+  values.insert(update.values);
+
+  std::vector<gtsam::CachedSmartStereoFactor*> factors;
+  factors.reserve(stereo_factors_.size());
+  for (const auto& it : stereo_factors_) {
+    const gtsam::KeyVector& keys = it.second->keys();
+    const bool has_values = std::all_of(keys.begin(), keys.end(),
+        [&values](gtsam::Key key) { return values.exists(key); });
+    if (has_values) {
+      factors.emplace_back(it.second.get());
+    }
+  }
+
+  const auto triangulate = [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i) {
+      if (params_.incremental_triangulation) {
+        factors.at(i)->Triangulate(values, params_.retriangulate_pose_threshold, params_.retriangulate_point_threshold);
+      } else {
+        factors.at(i)->point(values);
+      }
+    }
+  };
+
+  // Each factor only caches its own landmark, so they can triangulate at the same time.
+  if (params_.parallel_triangulation) {
+    TaskScheduler::Current().ParallelFor(factors.size(), triangulate, 8);
+  } else {
+    triangulate(0, factors.size());
+  }
+}
+
+
+void FixedLagSmoother::RunInArena(const std::function<void()>& f)
+{
+#ifdef BM_ENABLE_TBB
+  if (!tbb_arena_) {
+    tbb_arena_.reset(new tbb::task_arena(params_.tbb_threads > 0 ? params_.tbb_threads : tbb::task_arena::automatic));
+  }
+  tbb_arena_->execute(f);
+#else
+  f();
+#endif
+}
+
+
+void FixedLagSmoother::AddToHistory(const PendingUpdate& update, const gtsam::Values& estimate)
+{
+  HistoryChunk chunk;
+  chunk.factors = update.factors;
+  chunk.keys = update.values.keys();
+  chunk.keypose_time = update.keypose_time;
+  unsaved_history_.emplace_back(std::move(chunk), update.values);
+
+  // NOTE(milo): Never wait here! If a batch solve is copying the history, try again next time.
+  if (!history_lock_.try_lock()) {
+    return;
+  }
+
+  for (auto& it : unsaved_history_) {
+    history_values_.insert(it.second);
+    history_.emplace_back(std::move(it.first));
+  }
+  unsaved_history_.clear();
+
+  // Variables inside of the lag window have a better estimate now.
+  for (const gtsam::Values::ConstKeyValuePair& kv : estimate) {
+    if (history_values_.exists(kv.key)) {
+      history_values_.update(kv.key, kv.value);
+    }
+  }
+
+  while (!history_.empty() && (update.keypose_time - history_.front().keypose_time) > params_.history_sec) {
+    for (const gtsam::Key key : history_.front().keys) {
+      history_values_.erase(key);
+    }
+    history_.pop_front();
+  }
+
+  history_lock_.unlock();
+}
+
+
+bool FixedLagSmoother::GetHistory(gtsam::NonlinearFactorGraph& factors, gtsam::Values& values)
+{
+  std::lock_guard<std::mutex> lock(history_lock_);
+  if (history_.empty()) {
+    return false;
+  }
+
+  factors = gtsam::NonlinearFactorGraph();
+  for (const HistoryChunk& chunk : history_) {
+    factors.push_back(chunk.factors);
+  }
+  values = history_values_;
+  return true;
+}
+
+
+void FixedLagSmoother::UpdateHistory(const gtsam::Values& values)
+{
+  std::lock_guard<std::mutex> lock(history_lock_);
+  for (const gtsam::Values::ConstKeyValuePair& kv : values) {
+    if (history_values_.exists(kv.key)) {
+      history_values_.update(kv.key, kv.value);
+    }
+  }
+}
+
+
+void FixedLagSmoother::OptimizerLoop()
+{
+  BM_TRACE_THREAD_NAME("FixedLagSmoother");
+
+  while (!is_shutdown_) {
+    optimizer_notifier_.Wait([this]() { return has_pending_.load() || is_shutdown_.load(); });
+    if (is_shutdown_) {
+      break;
+    }
+
+    // Take everything that has queued up since the last update, so that it goes into iSAM2 at once.
+    PendingUpdate batch;
+    pending_lock_.lock();
+    std::swap(batch, pending_);
+    optimizer_busy_.store(true);
+    has_pending_.store(false);
+    pending_lock_.unlock();
+
+    if (batch.num_keyposes > 1) {
+      BM_LOG_EVERY_SEC(INFO, 1.0) << "Optimizer was busy, batched " << batch.num_keyposes << " keyposes";
+    }
+
+    latest_result_.Write(Optimize(batch));
+
+    optimizer_busy_.store(false);
+    idle_notifier_.Notify();
+  }
+}
+
+
+bool FixedLagSmoother::WaitForResult(SmootherResult& result, double timeout_sec)
+{
+  CHECK(params_.async_update) << "WaitForResult() is only used with async_update" << std::endl;
+  return latest_result_.WaitAndRead(result, timeout_sec);
+}
+
+
+void FixedLagSmoother::PublishPoses()
+{
+  if (!pose_history_) {
+    return;
+  }
+
+  BM_TRACE_SCOPE("FixedLagSmoother::PublishPoses");
+
+  seconds_t oldest = 0;
+  seconds_t newest = 0;
+  const bool has_poses = pose_history_->Ring(PoseHistory::Source::SMOOTHER).TimeRange(oldest, newest);
+
+  // NOTE(milo): Keys are ordered by keypose id, so these are in time order too. Keyposes that are
+  // already in the history are revised, and the rest (one or more new ones) are added after them.
+  std::vector<PoseStamped> revised;
+  for (const auto& it : smoother_.timestamps()) {
+    const gtsam::Symbol sym(it.first);
+    if (sym.chr() != 'X') {
+      continue;
+    }
+    const gtsam::Pose3 world_P_body = smoother_.calculateEstimate<gtsam::Pose3>(it.first);
+    const PoseStamped pose(it.second, world_P_body.rotation().toQuaternion(), world_P_body.translation());
+    if (has_poses && it.second <= newest) {
+      revised.emplace_back(pose);
+    } else {
+      pose_history_->AddSmoother(pose);
+    }
+  }
+
+  pose_history_->ReviseSmoother(revised);
+}
+
+
+void FixedLagSmoother::WaitUntilIdle()
+{
+  if (!params_.async_update) {
+    return;
+  }
+  idle_notifier_.Wait([this]() { return !has_pending_.load() && !optimizer_busy_.load(); });
 }
 
 
 SmootherResult FixedLagSmoother::GetResult()
 {
-  result_lock_.lock();
-  const SmootherResult out = result_;
-  result_lock_.unlock();
-  return out;
+  return result_.Load();
 }
 
 
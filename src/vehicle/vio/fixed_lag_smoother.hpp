@@ -1,14 +1,25 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "core/axis3.hpp"
 #include "core/depth_measurement.hpp"
 #include "core/eigen_types.hpp"
 #include "core/imu_measurement.hpp"
 #include "core/macros.hpp"
+#include "core/latest_value.hpp"
 #include "core/mag_measurement.hpp"
+#include "core/pose_measurement.hpp"
+#include "core/notifier.hpp"
 #include "core/range_measurement.hpp"
+#include "core/seq_lock.hpp"
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "params/params_base.hpp"
@@ -25,6 +36,15 @@
 #include <gtsam_unstable/slam/SmartStereoProjectionPoseFactor.h>
 #include <gtsam_unstable/nonlinear/IncrementalFixedLagSmoother.h>
 
+#include "vio/lag_controller.hpp"
+#include "vio/ordered_fixed_lag_smoother.hpp"
+#include "vio/pose_history.hpp"
+#include "vio/cached_stereo_factor.hpp"
+
+#ifdef BM_ENABLE_TBB
+#include <tbb/task_arena.h>
+#endif
+
 namespace bm {
 namespace vio {
 
@@ -37,6 +57,7 @@ typedef gtsam::SmartProjectionPoseFactor<gtsam::Cal3_S2> SmartMonoFactor;
 // Convenient map types.
 typedef std::unordered_map<uid_t, SmartMonoFactor::shared_ptr> SmartMonoFactorMap;
 typedef std::unordered_map<uid_t, SmartStereoFactor::shared_ptr> SmartStereoFactorMap;
+typedef std::unordered_map<uid_t, gtsam::CachedSmartStereoFactor::shared_ptr> CachedStereoFactorMap;
 typedef std::map<uid_t, gtsam::FactorIndex> LmkToFactorMap;
 
 
@@ -48,8 +69,61 @@ class FixedLagSmoother final {
 
     int extra_smoothing_iters = 2;    // More smoothing iters --> better accuracy.
     double smoother_lag_sec = 10.0;   // Time window for optimization over the factor graph.
+
+    // Adjusts the lag at runtime to hold a p95 update time (see LagController). smoother_lag_sec is
+    // only the starting point then.
+    LagController::Params lag_controller_params;
     bool use_smart_stereo_factors = true;
 
+    // iSAM2 relinearization. A variable is relinearized when its update exceeds the threshold, and
+    // relinearization is only checked every relinearize_skip updates. A threshold of zero always
+    // relinearizes (most accurate, but the update time grows with the size of the window).
+    double relinearize_threshold = 0.0;
+    int relinearize_skip = 1;
+    bool enable_partial_relinearization_check = false;  // Only check the part of the tree that changed.
+
+    // Eliminate the newest keypose last (at the root of the Bayes tree), see OrderedFixedLagSmoother.
+    bool constrain_newest_keypose_last = false;
+
+    // Compute the marginal covariances of the newest keypose every covariance_interval keyposes (and
+    // whenever RequestCovariance() was called). In between, results reuse the last covariances, with
+    // has_covariance = false. 1 computes them on every keypose.
+    int covariance_interval = 1;
+
+    // Keep the (non-smart) factors from the last history_sec seconds, which can be longer than the
+    // lag, so that they can be re-optimized in a batch (see BatchSmoother). Zero turns this off.
+    double history_sec = 0;
+
+    // If true, iSAM2 runs on its own thread. Update() only builds the new factors, and keyposes that
+    // arrive while the optimizer is busy are batched into a single iSAM2 update.
+    bool async_update = false;
+
+    // Landmark budget for smart stereo factors. Only the best max_smart_factors landmarks (by track
+    // length, parallax, and coverage of a grid over the image) get a factor, and each factor uses
+    // the newest max_obs_per_smart_factor observations, so the cost of an update stays bounded.
+    int max_smart_factors = 150;
+    int max_obs_per_smart_factor = 8;
+    double smart_factor_parallax_px = 20.0;   // Parallax (px) at which a landmark gets the full score.
+    int smart_factor_grid_rows = 4;
+    int smart_factor_grid_cols = 6;
+
+    // Triangulate the smart factors on the TaskScheduler (in parallel) before each iSAM2 update, so
+    // that iSAM2 only linearizes them (each factor caches its landmark).
+    bool parallel_triangulation = false;
+
+    // A landmark's new factor (with one more observation) starts from the old factor's point, and
+    // only adds the new observation's terms (see CachedSmartStereoFactor), instead of triangulating
+    // from scratch. It retriangulates if a camera moved more than retriangulate_pose_threshold (the
+    // same units as Pose3::equals), and relinearizes the cached terms if the point moved more than
+    // retriangulate_point_threshold (m).
+    bool incremental_triangulation = false;
+    double retriangulate_pose_threshold = 1e-3;
+    double retriangulate_point_threshold = 0.05;
+
+    // iSAM2 updates run in a TBB arena with this many threads (0 is one per core), which GTSAM uses to
+    // linearize and eliminate in parallel. Only if built with BM_ENABLE_TBB (otherwise ignored).
+    int tbb_threads = 0;
+
     DiagModel::shared_ptr pose_prior_noise_model = DiagModel::Sigmas(
         (gtsam::Vector(6) << 0.1, 0.1, 0.1, 0.3, 0.3, 0.3).finished());
 
@@ -74,13 +148,19 @@ class FixedLagSmoother final {
     Vector3d mag_sensor_bias = Vector3d::Zero();    // Additive bias of the magnetometer.
     IsoModel::shared_ptr mag_noise_model = IsoModel::Sigma(3, 1.0);
 
+    // Observations from the other stereo rigs (see AddRigVo) go on the nearest keypose within this
+    // many seconds.
+    double allowed_misalignment_rig = 0.05;
+
     gtsam::Pose3 body_P_imu = gtsam::Pose3::identity();
-    gtsam::Pose3 body_P_cam = gtsam::Pose3::identity();
     gtsam::Pose3 body_P_receiver = gtsam::Pose3::identity();
     gtsam::Pose3 body_P_mag = gtsam::Pose3::identity();
     Vector3d n_gravity = Vector3d(0, 9.81, 0);
 
-    StereoCamera stereo_rig;
+    // One for each rig in /shared/stereo_rigs, primary rig first. VO between factors only come from
+    // the primary rig, but every rig gets its own smart factors (and max_smart_factors budget).
+    std::vector<gtsam::Pose3> body_P_cams;
+    std::vector<StereoCamera> stereo_rigs;
 
    private:
     void LoadParams(const YamlParser& parser) override;
@@ -92,6 +172,9 @@ class FixedLagSmoother final {
   MACRO_DELETE_COPY_CONSTRUCTORS(FixedLagSmoother)
   MACRO_DELETE_DEFAULT_CONSTRUCTOR(FixedLagSmoother)
 
+  // Stops the optimizer thread (if async_update), dropping any batched keyposes.
+  ~FixedLagSmoother();
+
   /**
    * Initialize the smoother by providing the first timestamp and corresponding state.
    * This can be used to initialize the smoother for the first time, or to "reset" it through some
@@ -103,29 +186,76 @@ class FixedLagSmoother final {
                   const ImuBias& imu_bias,
                   bool imu_available);
 
+  // Initialize from a result of an earlier run (e.g a checkpoint), with priors from its marginal
+  // covariances instead of the default prior noise models. The first keypose is at "timestamp", and
+  // its id comes right after prior.keypose_id.
+  void Initialize(seconds_t timestamp, const SmootherResult& prior);
+
   /**
    * Update the graph with a variety of measurements. A new keypose is added and constrained based
    * on the available sensor data. If VO is unavailable, a preintegrated IMU measurement is expected
    * to fully constrain the 6-DOF pose.
    *
-   * @param maybe_vo_ptr Visual landmarks tracks from the last keypose to now.
+   * @param maybe_vo_ptr Visual landmarks tracks from the last keypose to now. The smoother holds
+   *        onto it (instead of copying the observations) until its landmarks are added.
    * @param pim_result Preintegrated IMU measurement, timestamp alignment should be handled by user.
    * @param maybe_depth_ptr Barometer depth measurement.
    * @param maybe_attitude_ptr Measurement of the gravity vector in the body frame.
    * @param maybe_ranges A flexible number of range measurements, depending on the number of beacons.
    * @param maybe_mag_ptr Magnetometer measurement.
-   * @return Smoothed state estimate at the newly added keypose.
+   * @param maybe_pose_ptr Absolute pose measurement (e.g from a fiducial tag), added as a prior.
+   * @return Smoothed state estimate at the newly added keypose. If async_update, this is only the
+   *         initial guess for the new keypose, and the smoothed result comes from WaitForResult().
    */
   SmootherResult Update(VoResult::ConstPtr maybe_vo_ptr,
                         PimResult::ConstPtr pim_result,
                         DepthMeasurement::ConstPtr maybe_depth_ptr = nullptr,
                         AttitudeMeasurement::ConstPtr maybe_attitude_ptr = nullptr,
                         const MultiRange& maybe_ranges = MultiRange(),
-                        MagMeasurement::ConstPtr maybe_mag_ptr = nullptr);
+                        MagMeasurement::ConstPtr maybe_mag_ptr = nullptr,
+                        PoseMeasurement::ConstPtr maybe_pose_ptr = nullptr);
+
+  // Keyframe VO from one of the other stereo rigs (rig > 0). Its landmarks are added as smart factors
+  // on the nearest keypose (within allowed_misalignment_rig). If that keypose doesn't exist yet, it's
+  // held until a later Update(). NOTE(milo): Only call this from the thread that calls Update().
+  void AddRigVo(VoResult::ConstPtr rig_vo);
 
-  // Threadsafe access to the latest result.
+  // Threadsafe access to the latest result. Lock-free, so it never holds up the optimizer.
   SmootherResult GetResult();
 
+  // After each optimization, write the newest keypose(s) to history, and revise the keyposes that
+  // are still inside the lag window. Set this before Initialize(). The history must outlive the
+  // smoother, and nothing else should write its smoother ring.
+  void SetPoseHistory(PoseHistory* history) { pose_history_ = history; }
+
+  // If async_update, blocks until the optimizer publishes a result that hasn't been read yet (or
+  // timeout_sec elapses). Returns false on timeout. Intermediate results are skipped if the caller
+  // falls behind. NOTE(milo): Only one thread should call this.
+  bool WaitForResult(SmootherResult& result, double timeout_sec);
+
+  // Blocks until all batched keyposes have been optimized. Returns immediately if not async_update.
+  void WaitUntilIdle();
+
+  // The current lag window (seconds), which the LagController may have moved from smoother_lag_sec.
+  double Lag() const { return lag_sec_.load(); }
+
+  // Make the next optimized keypose compute fresh covariances (e.g the filter needs to reset).
+  void RequestCovariance() { covariance_requested_.store(true); }
+
+  // The current estimate of every variable inside the lag window (e.g to read back a whole window
+  // that was replayed offline, see OfflineBundleAdjuster). NOTE(milo): Only call this from the thread
+  // that calls Update(), and only if not async_update.
+  gtsam::Values CalculateEstimate() { return smoother_.calculateEstimate(); }
+
+  // Copies the factors from the last history_sec seconds, and the latest estimate of each variable.
+  // Returns false if there is no history. NOTE(milo): This can wait for the history lock, but the
+  // optimizer never waits for it, so this is safe to call from a low priority thread.
+  bool GetHistory(gtsam::NonlinearFactorGraph& factors, gtsam::Values& values);
+
+  // Overwrites the history's estimate of any variables that it still has (e.g with a batch solution,
+  // so that the next batch starts from there).
+  void UpdateHistory(const gtsam::Values& values);
+
  private:
   // A central place to allocate new "keypose" ids. They are called "keyposes" because they could
   // come from vision OR other data sources (e.g acoustic localization).
@@ -136,21 +266,131 @@ class FixedLagSmoother final {
   // Reinitialize the smoother, which clears any stored graph structure / factors.
   void ResetSmoother();
 
+  // Waits for the optimizer, then resets the smoother and throws away all landmarks and history.
+  void ClearState();
+
+  // Landmarks that one stereo rig observed at a keypose.
+  struct KeyposeLandmarks final
+  {
+    KeyposeLandmarks(gtsam::Key key, seconds_t keypose_time, VoResult::ConstPtr vo)
+        : key(key), keypose_time(keypose_time), vo(std::move(vo)) {}
+
+    gtsam::Key key;
+    seconds_t keypose_time;
+    VoResult::ConstPtr vo;    // Shared (not copied), since these can wait for a few updates.
+  };
+
+  // Moves rig VO from pending_rig_vo_ onto the nearest recent keypose, and drops any that are too old
+  // to match one.
+  void MatchRigVo(std::vector<KeyposeLandmarks>& new_lmk_obs);
+
+  // New factors (for one or more keyposes) that haven't been given to iSAM2 yet.
+  struct PendingUpdate final
+  {
+    gtsam::NonlinearFactorGraph factors;
+    gtsam::Values values;
+    gtsam::IncrementalFixedLagSmoother::KeyTimestampMap timestamps;
+    std::vector<KeyposeLandmarks> lmk_obs;
+    uid_t keypose_id = 0;       // The newest keypose in this update.
+    seconds_t keypose_time = 0;
+    int num_keyposes = 0;
+  };
+
+  // Runs iSAM2 on the new factors, and updates result_ with the estimate at the newest keypose.
+  SmootherResult Optimize(const PendingUpdate& update);
+
+  // Adds the new landmark observations, selects which landmarks are within the budget, and fills in
+  // the smart factors to add and remove from the graph in this update.
+  void UpdateSmartStereoFactors(const PendingUpdate& update,
+                                gtsam::NonlinearFactorGraph& new_factors,
+                                gtsam::FactorIndices& factors_to_remove,
+                                std::vector<uid_t>& new_factor_lmk_ids);
+
+  // Triangulates every smart factor at the estimate that iSAM2 will linearize it at, in parallel
+  // (parallel_triangulation) and/or incrementally (incremental_triangulation).
+  void TriangulateSmartFactors(const PendingUpdate& update);
+
+  // Runs f in the TBB arena (if BM_ENABLE_TBB), or just calls it.
+  void RunInArena(const std::function<void()>& f);
+
+  // Saves the new factors and latest estimates for GetHistory(), and throws out anything older than
+  // history_sec. If the history is locked, this is deferred until the next update.
+  void AddToHistory(const PendingUpdate& update, const gtsam::Values& estimate);
+
+  // Optimizes batches of new factors as they arrive (if async_update).
+  void OptimizerLoop();
+
+  // Writes the estimate of every keypose in the window to pose_history_ (if there is one).
+  void PublishPoses();
+
  private:
   Params params_;
-  StereoCamera stereo_rig_;
 
   uid_t next_kf_id_ = 0;
 
-  std::mutex result_lock_;
-  SmootherResult result_;
-  gtsam::IncrementalFixedLagSmoother smoother_;
+  SeqLock<SmootherResult> result_;            // Written by whichever thread is optimizing.
+  PoseHistory* pose_history_ = nullptr;       // Also written by whichever thread is optimizing.
+  OrderedFixedLagSmoother smoother_;
+
+#ifdef BM_ENABLE_TBB
+  std::unique_ptr<tbb::task_arena> tbb_arena_;
+#endif
+
+  // The newest keypose given to Update(). New factors are built relative to this, so if async_update
+  // it can be ahead of result_ (with an unoptimized guess of the state).
+  SmootherResult last_keypose_;
+
+  std::mutex pending_lock_;
+  PendingUpdate pending_;
+  std::atomic_bool has_pending_{false};
+  std::atomic_bool optimizer_busy_{false};
+  std::atomic_bool is_shutdown_{false};
+  Notifier optimizer_notifier_;               // Wakes up the optimizer when there's a new batch.
+  Notifier idle_notifier_;                    // Wakes up WaitUntilIdle() when a batch finishes.
+  LatestValue<SmootherResult> latest_result_; // Written by the optimizer, read by WaitForResult().
+  std::thread optimizer_thread_;
+
+  std::atomic_bool covariance_requested_{false};
+  int keyposes_since_covariance_ = 0;         // Only touched by whichever thread is optimizing.
+
+  LagController lag_controller_;              // Only touched by whichever thread is optimizing.
+  std::atomic<double> lag_sec_;               // The controller's lag, for the thread that calls Update().
+
+  // The newest observations of each landmark (seen within the lag window).
+  struct LandmarkTrack final
+  {
+    std::deque<std::pair<gtsam::Key, gtsam::StereoPoint2>> obs;  // Newest at the back.
+    seconds_t last_seen = 0;
+    size_t rig = 0;
+  };
+
+  // NOTE(milo): These are only touched by the thread that calls Update().
+  std::deque<std::pair<seconds_t, gtsam::Key>> recent_keyposes_;   // Within the lag, oldest first.
+  std::deque<VoResult::ConstPtr> pending_rig_vo_;                   // Newer than any keypose so far.
+  std::vector<gtsam::Key> rig_vo_keys_;                             // Last keypose matched for each rig.
+
+  // The factors added by one update.
+  struct HistoryChunk final
+  {
+    gtsam::NonlinearFactorGraph factors;
+    gtsam::KeyVector keys;        // Variables that were added in this update.
+    seconds_t keypose_time = 0;
+  };
+
+  std::mutex history_lock_;
+  std::deque<HistoryChunk> history_;
+  gtsam::Values history_values_;
+
+  // Updates that happened while the history was locked (only touched by the optimizing thread).
+  std::vector<std::pair<HistoryChunk, gtsam::Values>> unsaved_history_;
 
-  LmkToFactorMap lmk_to_factor_map_;
-  SmartStereoFactorMap stereo_factors_;
+  // NOTE(milo): These are only touched by whichever thread is optimizing.
+  std::unordered_map<uid_t, LandmarkTrack> lmk_tracks_;
+  LmkToFactorMap lmk_to_factor_map_;      // Landmarks that have a factor in the graph.
+  CachedStereoFactorMap stereo_factors_;
 
   gtsam::SmartProjectionParams lmk_stereo_factor_params_;
-  gtsam::Cal3_S2Stereo::shared_ptr cal3_stereo_;
+  std::vector<gtsam::Cal3_S2Stereo::shared_ptr> cal3_stereo_;   // One for each rig.
 
   Axis3 depth_axis_ = Axis3::Y;
   double depth_sign_ = 1.0;
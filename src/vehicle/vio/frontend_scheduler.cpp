@@ -0,0 +1,95 @@
+#include <glog/logging.h>
+
+#include "vio/frontend_scheduler.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void FrontendScheduler::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("enabled", &enabled);
+  parser.GetParam("frame_budget_ms", &frame_budget_ms);
+  parser.GetParam("overload_ratio", &overload_ratio);
+  parser.GetParam("underload_ratio", &underload_ratio);
+  parser.GetParam("max_queue_depth", &max_queue_depth);
+  parser.GetParam("window", &window);
+  parser.GetParam("reduced_max_features_per_frame", &reduced_max_features_per_frame);
+  parser.GetParam("reduced_klt_max_level", &reduced_klt_max_level);
+
+  CHECK_GT(frame_budget_ms, 0);
+  CHECK_LT(underload_ratio, overload_ratio);
+  CHECK_GE(max_queue_depth, 1);
+  CHECK_GE(window, 1);
+  CHECK_GT(reduced_max_features_per_frame, 0);
+  CHECK_GE(reduced_klt_max_level, 0);
+}
+
+
+FrontendScheduler::FrontendScheduler(const Params& params)
+    : params_(params),
+      track_ms_(params.window) {}
+
+
+bool FrontendScheduler::Update(double track_ms, size_t queue_depth)
+{
+  if (!params_.enabled) {
+    return false;
+  }
+
+  track_ms_.Add(static_cast<float>(track_ms));
+  ++samples_since_change_;
+
+  // Wait for a full window of samples at the current level before deciding anything.
+  if (samples_since_change_ < params_.window) {
+    return false;
+  }
+
+  int N;
+  float min_ms, max_ms, mean_ms;
+  track_ms_.MinMaxMean(N, min_ms, max_ms, mean_ms);
+
+  const bool overloaded = (mean_ms > params_.overload_ratio * params_.frame_budget_ms) ||
+                          ((int)queue_depth > params_.max_queue_depth);
+  const bool underloaded = (mean_ms < params_.underload_ratio * params_.frame_budget_ms) &&
+                           (queue_depth <= 1);
+
+  const LoadLevel prev_level = level_;
+  if (overloaded && level_ != LoadLevel::NEWEST_ONLY) {
+    level_ = static_cast<LoadLevel>(static_cast<int>(level_) + 1);
+  } else if (underloaded && level_ != LoadLevel::NOMINAL) {
+    level_ = static_cast<LoadLevel>(static_cast<int>(level_) - 1);
+  }
+
+  if (level_ == prev_level) {
+    return false;
+  }
+
+  LOG(INFO) << "FrontendScheduler: load level " << static_cast<int>(prev_level) << " => "
+            << static_cast<int>(level_) << " (mean_ms=" << mean_ms << " queue_depth=" << queue_depth << ")" << std::endl;
+  samples_since_change_ = 0;
+  skip_next_ = false;
+  return true;
+}
+
+
+size_t FrontendScheduler::NumToSkip(size_t queue_depth)
+{
+  if (queue_depth == 0) {
+    return 0;
+  }
+
+  switch (level_) {
+    case LoadLevel::SKIP_ALTERNATE:
+      skip_next_ = !skip_next_;
+      return skip_next_ ? 1 : 0;
+    case LoadLevel::NEWEST_ONLY:
+      return queue_depth - 1;
+    default:
+      return 0;
+  }
+}
+
+
+}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+
+#include "core/macros.hpp"
+#include "core/stats_tracker.hpp"
+#include "params/params_base.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Decides how much work the stereo frontend should do, based on how long it has been taking to
+// process recent frames (and how backed up its input queue is). When the frontend can't keep up,
+// it's better to skip frames than to let VO latency grow until the queue starts dropping them.
+//
+// The load level goes up one step at a time when the average frame time is over budget (or the
+// queue is backing up), and down one step when it's comfortably under budget. After each change,
+// the scheduler waits for a full window of new samples before changing again (hysteresis).
+class FrontendScheduler final {
+ public:
+  enum class LoadLevel
+  {
+    NOMINAL = 0,          // Process every frame with the full feature budget.
+    REDUCED_EFFORT = 1,   // Process every frame, but with fewer features and KLT pyramid levels.
+    SKIP_ALTERNATE = 2,   // (Reduced effort) and skip every other frame.
+    NEWEST_ONLY = 3       // (Reduced effort) and drop everything in the queue except the newest frame.
+  };
+
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    bool enabled = false;                 // If false, always stay at NOMINAL.
+    double frame_budget_ms = 50.0;        // Time between frames (e.g 50ms for a 20Hz camera).
+    double overload_ratio = 0.9;          // Go up a level if the average time > ratio * budget.
+    double underload_ratio = 0.5;         // Go down a level if the average time < ratio * budget.
+    int max_queue_depth = 3;              // Go up a level if more frames than this are waiting.
+    int window = 10;                      // Average the frame time over this many frames.
+
+    int reduced_max_features_per_frame = 100;
+    int reduced_klt_max_level = 2;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(FrontendScheduler)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(FrontendScheduler)
+
+  explicit FrontendScheduler(const Params& params);
+
+  // Record how long the last frame took to process, and how many frames were still waiting. Returns
+  // true if the load level changed.
+  bool Update(double track_ms, size_t queue_depth);
+
+  // Returns how many of the oldest queued frames to discard before processing the next one.
+  size_t NumToSkip(size_t queue_depth);
+
+  LoadLevel Level() const { return level_; }
+
+  // Whether the frontend should run with the reduced feature budget and pyramid levels.
+  bool ReducedEffort() const { return level_ >= LoadLevel::REDUCED_EFFORT; }
+
+ private:
+  Params params_;
+  LoadLevel level_ = LoadLevel::NOMINAL;
+  StatsBuffer<float> track_ms_;
+  int samples_since_change_ = 0;
+  bool skip_next_ = false;
+};
+
+
+}
+}
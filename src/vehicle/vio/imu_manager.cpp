@@ -1,3 +1,4 @@
+#include "core/async_log.hpp"
 #include "vio/imu_manager.hpp"
 
 namespace bm {
@@ -9,6 +10,7 @@ void ImuManager::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("max_queue_size", &max_queue_size);
   parser.GetParam("integration_error_sigma", &integration_error_sigma);
   parser.GetParam("use_2nd_order_coriolis", &use_2nd_order_coriolis);
+  parser.GetParam("incremental", &incremental);
 
   parser.GetParam("/shared/imu0/noise_model/accel_noise_sigma", &accel_noise_sigma);
   parser.GetParam("/shared/imu0/noise_model/gyro_noise_sigma", &gyro_noise_sigma);
@@ -25,8 +27,10 @@ void ImuManager::Params::LoadParams(const YamlParser& parser)
 
 
 ImuManager::ImuManager(const Params& params, const std::string& queue_name)
-    : DataManager<ImuMeasurement>(params.max_queue_size, true, queue_name),
-      params_(params)
+    : ImuDataManager(params.max_queue_size, true, queue_name),
+      params_(params),
+      bias_(kZeroImuBias),
+      checkpoints_(params.incremental ? static_cast<size_t>(params.max_queue_size) : 1ul)
 {
   // https://github.com/haidai/gtsam/blob/master/examples/ImuFactorsExample.cpp
   const gtsam::Matrix3 measured_acc_cov = gtsam::I_3x3 * std::pow(params_.accel_noise_sigma, 2);
@@ -50,6 +54,7 @@ ImuManager::ImuManager(const Params& params, const std::string& queue_name)
   // pim_params_.print();
 
   pim_ = PimC(boost::make_shared<PimC::Params>(pim_params_)); // Initialize with zero bias.
+  running_pim_ = pim_;
 }
 
 
@@ -57,23 +62,52 @@ PimResult ImuManager::Preintegrate(seconds_t from_time,
                                    seconds_t to_time,
                                    seconds_t allowed_misalignment_sec)
 {
+  if (params_.incremental) {
+    std::lock_guard<std::mutex> lock(running_lock_);
+
+    // Usually, the running preintegration already starts at from_time.
+    if (running_started_ && from_time == running_from_ && to_time != kMaxSeconds) {
+      const PimResult result = SplitRunning(to_time, allowed_misalignment_sec);
+      if (result.timestamps_aligned) {
+        DiscardUpTo(to_time);
+        RestartRunning(to_time);
+        return result;
+      }
+    }
+
+    // Otherwise, integrate from scratch below, and start over at to_time.
+    pim_.resetIntegration();
+    const PimResult result = IntegrateQueued(from_time, to_time, allowed_misalignment_sec);
+    if (result.timestamps_aligned && to_time != kMaxSeconds) {
+      RestartRunning(to_time);
+    }
+    return result;
+  }
+
   pim_.resetIntegration();
+  return IntegrateQueued(from_time, to_time, allowed_misalignment_sec);
+}
+
 
+PimResult ImuManager::IntegrateQueued(seconds_t from_time,
+                                      seconds_t to_time,
+                                      seconds_t allowed_misalignment_sec)
+{
   // If no measurements, return failure.
   if (Empty()) {
-    LOG(WARNING) << "PimResult invalid: queue is empty" << std::endl;
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "PimResult invalid: queue is empty";
     return std::move(PimResult(false, kMinSeconds, kMaxSeconds));
   }
 
   // Requesting a from_time that is too far before our earliest measurement.
   if (Oldest() > (from_time + allowed_misalignment_sec) && (from_time != kMinSeconds)) {
-    LOG(WARNING) << "PimResult invalid: Oldest() measurement way past from_time" << std::endl;
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "PimResult invalid: Oldest() measurement way past from_time";
     return PimResult(false, kMinSeconds, kMaxSeconds);
   }
 
   // Requesting a to_time that is too far after our newest measurement.
   if (Newest() < (to_time - allowed_misalignment_sec) && (to_time != kMaxSeconds)) {
-    LOG(WARNING) << "PimResult invalid: Newest() measurement way before to_time" << std::endl;
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "PimResult invalid: Newest() measurement way before to_time";
     return PimResult(false, kMinSeconds, kMaxSeconds);
   }
 
@@ -82,49 +116,71 @@ PimResult ImuManager::Preintegrate(seconds_t from_time,
     DiscardBefore(from_time);
   }
 
-  ImuMeasurement imu = Pop();
-  const seconds_t earliest_imu_sec = ConvertToSeconds(imu.timestamp);
+  // NOTE(milo): Integrate directly from a view of the buffered measurements, rather than popping
+  // (and moving) them one at a time. All measurements <= to_time are discarded afterwards, but only
+  // if the preintegration worked, so that a failed call can be retried.
+  PimResult result(false, kMinSeconds, kMaxSeconds);
+  {
+    const View imu_range = GetRange(kMinSeconds, to_time);
+    if (imu_range.Empty()) {
+      BM_LOG_EVERY_SEC(WARNING, 1.0) << "PimResult invalid: no measurements between from_time and to_time";
+    } else {
+      result = IntegrateRange(imu_range, from_time, to_time, allowed_misalignment_sec);
+    }
+  }
+  if (result.timestamps_aligned) {
+    DiscardUpTo(to_time);
+  }
+
+  return result;
+}
+
+
+PimResult ImuManager::IntegrateRange(const View& imu_range,
+                                     seconds_t from_time,
+                                     seconds_t to_time,
+                                     seconds_t allowed_misalignment_sec)
+{
+  const ImuMeasurement& from_imu = imu_range.front();
+  const seconds_t earliest_imu_sec = ConvertToSeconds(from_imu.timestamp);
 
   // FAIL: No measurement close to (specified) from_time.
   const seconds_t offset_from_sec = (from_time != kMinSeconds) ? std::fabs(earliest_imu_sec - from_time) : 0.0;
   if (offset_from_sec > allowed_misalignment_sec) {
-    LOG(WARNING) << "PimResult invalid: no measurements near from_time" << std::endl;
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "PimResult invalid: no measurements near from_time";
     return PimResult(false, kMinSeconds, kMaxSeconds);
   }
 
-  const ImuMeasurement from_imu = imu;  // Copy.
-
   // Assume CONSTANT acceleration between from_time and nearest IMU measurement.
   // https://github.com/borglab/gtsam/blob/develop/gtsam/navigation/CombinedImuFactor.cpp
   // NOTE(milo): There is a divide by dt in the source code.
   if (offset_from_sec > 0) {
-    pim_.integrateMeasurement(imu.a, imu.w, offset_from_sec);
+    pim_.integrateMeasurement(from_imu.a, from_imu.w, offset_from_sec);
   }
 
   // Integrate all measurements <= to_time.
   seconds_t prev_imu_time_sec = earliest_imu_sec;
-  while (!Empty() && Oldest() <= to_time) {
-    imu = Pop();
+  for (size_t i = 1; i < imu_range.Size(); ++i) {
+    const ImuMeasurement& imu = imu_range.at(i);
     const seconds_t dt = ConvertToSeconds(imu.timestamp) - prev_imu_time_sec;
     CHECK(dt >= 0);
     if (dt > 0) { pim_.integrateMeasurement(imu.a, imu.w, dt); }
     prev_imu_time_sec = ConvertToSeconds(imu.timestamp);
   }
 
-  const seconds_t latest_imu_sec = ConvertToSeconds(imu.timestamp);
+  const ImuMeasurement& to_imu = imu_range.back();
+  const seconds_t latest_imu_sec = ConvertToSeconds(to_imu.timestamp);
 
   // FAIL: No measurement close to (specified) to_time.
   const seconds_t offset_to_sec = (to_time != kMaxSeconds) ? std::fabs(to_time - latest_imu_sec) : 0.0;
   if (offset_to_sec > allowed_misalignment_sec) {
-    LOG(WARNING) << "PimResult invalid: no measurements near to_time" << std::endl;
+    BM_LOG_EVERY_SEC(WARNING, 1.0) << "PimResult invalid: no measurements near to_time";
     return PimResult(false, kMinSeconds, kMaxSeconds);
   }
 
-  const ImuMeasurement to_imu = imu;
-
   // Assume CONSTANT acceleration between to_time and nearest IMU measurement.
   if (offset_to_sec > 0) {
-    pim_.integrateMeasurement(imu.a, imu.w, offset_to_sec);
+    pim_.integrateMeasurement(to_imu.a, to_imu.w, offset_to_sec);
   }
 
   return PimResult(true, from_time, to_time, pim_, from_imu, to_imu);
@@ -134,6 +190,110 @@ PimResult ImuManager::Preintegrate(seconds_t from_time,
 void ImuManager::ResetAndUpdateBias(const ImuBias& bias)
 {
   pim_.resetIntegrationAndSetBias(bias);
+
+  if (!params_.incremental) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(running_lock_);
+  bias_ = bias;
+
+  // Re-integrate with the new bias (usually only a few measurements since the last keypose).
+  if (running_started_) {
+    RestartRunning(running_from_);
+  }
+}
+
+
+void ImuManager::Advance()
+{
+  if (!params_.incremental) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(running_lock_, std::try_to_lock);
+  if (lock.owns_lock()) {
+    AdvanceLocked();
+  }
+}
+
+
+void ImuManager::AdvanceLocked()
+{
+  if (!running_started_) {
+    return;
+  }
+
+  const View imu_range = GetRange(running_newest_, kMaxSeconds);
+
+  for (size_t i = 0; i < imu_range.Size(); ++i) {
+    const ImuMeasurement& imu = imu_range.at(i);
+    const seconds_t t = ConvertToSeconds(imu.timestamp);
+
+    // The measurement at running_newest_ was already integrated (unless nothing has been yet).
+    if (t < running_from_ || (t <= running_newest_ && !checkpoints_.Empty())) {
+      continue;
+    }
+
+    // NOTE(milo): Same as IntegrateRange(). The first measurement is held constant back to
+    // from_time, and each one after that is held constant since the previous measurement.
+    if (checkpoints_.Empty()) {
+      running_from_imu_ = imu;
+    }
+    const seconds_t dt = t - running_newest_;
+    if (dt > 0) { running_pim_.integrateMeasurement(imu.a, imu.w, dt); }
+    running_newest_ = t;
+
+    Checkpoint checkpoint;
+    checkpoint.pim = running_pim_;
+    checkpoint.imu = imu;
+    checkpoints_.Update(t, checkpoint);
+  }
+}
+
+
+void ImuManager::RestartRunning(seconds_t from_time)
+{
+  running_started_ = true;
+  running_from_ = from_time;
+  running_newest_ = from_time;
+  running_pim_.resetIntegrationAndSetBias(bias_);
+  checkpoints_.Clear();
+  AdvanceLocked();
+}
+
+
+PimResult ImuManager::SplitRunning(seconds_t to_time, seconds_t allowed_misalignment_sec)
+{
+  AdvanceLocked();
+
+  // Find the last integrated measurement <= to_time.
+  size_t i = checkpoints_.LowerBound(to_time);
+  if (i == checkpoints_.Size() || checkpoints_.KeyAt(i) > to_time) {
+    if (i == 0) {
+      return PimResult(false, kMinSeconds, kMaxSeconds);
+    }
+    --i;
+  }
+
+  // Same alignment checks as IntegrateRange().
+  const seconds_t earliest_imu_sec = checkpoints_.KeyAt(0);
+  const seconds_t offset_from_sec = (running_from_ != kMinSeconds) ? std::fabs(earliest_imu_sec - running_from_) : 0.0;
+  const seconds_t latest_imu_sec = checkpoints_.KeyAt(i);
+  const seconds_t offset_to_sec = (to_time != kMaxSeconds) ? std::fabs(to_time - latest_imu_sec) : 0.0;
+  if (offset_from_sec > allowed_misalignment_sec || offset_to_sec > allowed_misalignment_sec) {
+    return PimResult(false, kMinSeconds, kMaxSeconds);
+  }
+
+  const Checkpoint& checkpoint = checkpoints_.ItemAt(i);
+  PimC pim = checkpoint.pim;
+
+  // Assume CONSTANT acceleration between to_time and nearest IMU measurement.
+  if (offset_to_sec > 0) {
+    pim.integrateMeasurement(checkpoint.imu.a, checkpoint.imu.w, offset_to_sec);
+  }
+
+  return PimResult(true, running_from_, to_time, pim, running_from_imu_, checkpoint.imu);
 }
 
 
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <mutex>
+
 #include "params/params_base.hpp"
 #include "core/macros.hpp"
 #include "core/imu_measurement.hpp"
 #include "core/uid.hpp"
 #include "core/data_manager.hpp"
 #include "vio/noise_model.hpp"
+#include "vio/ring_history.hpp"
 
 #include <gtsam/navigation/ImuFactor.h>
 #include <gtsam/navigation/CombinedImuFactor.h>
@@ -53,7 +56,11 @@ struct PimResult final
 };
 
 
-class ImuManager final : public DataManager<ImuMeasurement> {
+// Several ImuManagers (e.g the smoother's and the filter's) can share one copy of the IMU stream.
+typedef DataManager<ImuMeasurement, BroadcastQueue<ImuMeasurement>> ImuDataManager;
+
+
+class ImuManager final : public ImuDataManager {
  public:
   struct Params final : public ParamsBase
   {
@@ -70,6 +77,10 @@ class ImuManager final : public DataManager<ImuMeasurement> {
     double integration_error_sigma = 1e-4;
     bool use_2nd_order_coriolis = false;
 
+    // Preintegrate measurements while waiting for the next keypose (see Advance()), so that
+    // Preintegrate() only has to split off the already integrated part at to_time.
+    bool incremental = false;
+
     // Direction of the gravity vector in the world frame.
     // NOTE(milo): Right now, we use a RDF frame for the IMU, so gravity is +y.
     gtsam::Vector3 n_gravity = gtsam::Vector3(0, 9.81, 0); // m/s^2
@@ -90,7 +101,8 @@ class ImuManager final : public DataManager<ImuMeasurement> {
   // If not time range is given, all available result are integrated. Integration is reset inside
   // of this function once all IMU measurements are incorporated. Internally, GTSAM converts raw
   // IMU measurements into body frame measurements using body_P_sensor.
-  // NOTE(milo): All measurements up to the to_time are removed from the queue!
+  // NOTE(milo): If preintegration succeeds, all measurements up to the to_time are removed from the
+  // queue! If it fails, the measurements from from_time on are kept, so that the call can be retried.
   PimResult Preintegrate(seconds_t from_time = kMinSeconds,
                          seconds_t to_time = kMaxSeconds,
                          seconds_t allowed_misalignment_sec = 0.1);
@@ -99,10 +111,50 @@ class ImuManager final : public DataManager<ImuMeasurement> {
   // Call this after getting a new bias estimate from the smoother update.
   void ResetAndUpdateBias(const ImuBias& bias);
 
+  // If incremental, integrates any measurements that arrived since the last call. Integration starts
+  // from the to_time of the last successful Preintegrate().
+  // NOTE(milo): This reads the queue, so call it from the consumer thread (the one that calls
+  // Preintegrate), not from the one that pushes.
+  void Advance();
+
  private:
+  // A snapshot of the running preintegration, right after integrating "imu".
+  struct Checkpoint final
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    PimC pim;
+    ImuMeasurement imu;
+  };
+
+  // These all need the running_lock_.
+  void AdvanceLocked();
+  void RestartRunning(seconds_t from_time);
+  PimResult SplitRunning(seconds_t to_time, seconds_t allowed_misalignment_sec);
+
+  // Preintegrate from scratch, using the buffered measurements between from_time and to_time.
+  PimResult IntegrateQueued(seconds_t from_time,
+                            seconds_t to_time,
+                            seconds_t allowed_misalignment_sec);
+
+  // Preintegrate a (nonempty) range of measurements, all of which are >= from_time.
+  PimResult IntegrateRange(const View& imu_range,
+                           seconds_t from_time,
+                           seconds_t to_time,
+                           seconds_t allowed_misalignment_sec);
+
   Params params_;
   PimC::Params pim_params_;
   PimC pim_;
+  ImuBias bias_;
+
+  // State of the incremental preintegration (only if params_.incremental).
+  std::mutex running_lock_;
+  bool running_started_ = false;
+  seconds_t running_from_ = kMinSeconds;
+  seconds_t running_newest_ = kMinSeconds;    // Timestamp of the last integrated measurement.
+  ImuMeasurement running_from_imu_;
+  PimC running_pim_;
+  RingHistory<seconds_t, Checkpoint> checkpoints_;
 };
 
 
@@ -0,0 +1,108 @@
+#include "core/trace.hpp"
+#include "vio/imu_propagator.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void ImuPropagator::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("enabled", &enabled);
+  parser.GetParam("max_age_sec", &max_age_sec);
+  parser.GetParam("max_stored_imu", &max_stored_imu);
+  CHECK_GT(max_stored_imu, 0);
+
+  YamlToVector<Vector3d>(parser.GetNode("/shared/n_gravity"), n_gravity);
+  YamlToMatrix<Matrix4d>(parser.GetNode("/shared/imu0/body_T_imu"), body_T_imu);
+}
+
+
+ImuPropagator::ImuPropagator(const Params& params)
+    : params_(params),
+      imu_bias_(kZeroImuBias),
+      imu_history_(static_cast<size_t>(params.max_stored_imu))
+{
+  q_body_imu_ = Quaterniond(params_.body_T_imu.block<3, 3>(0, 0)).normalized();
+}
+
+
+void ImuPropagator::Reset(const StateStamped& filter_state)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+
+  has_state_ = true;
+  filter_timestamp_ = filter_state.timestamp;
+  state_.timestamp = filter_state.timestamp;
+  state_.t = filter_state.state.t;
+  state_.v = filter_state.state.v;
+  state_.q = filter_state.state.q;
+  state_.w = filter_state.state.w;
+
+  for (size_t i = imu_history_.LowerBound(filter_state.timestamp); i < imu_history_.Size(); ++i) {
+    if (imu_history_.KeyAt(i) > state_.timestamp) {
+      Step(imu_history_.ItemAt(i));
+    }
+  }
+}
+
+
+void ImuPropagator::SetBias(const ImuBias& imu_bias)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  imu_bias_ = imu_bias;
+}
+
+
+bool ImuPropagator::Propagate(const ImuMeasurement& imu, PropagatedState& out)
+{
+  BM_TRACE_SCOPE("ImuPropagator::Propagate");
+
+  const seconds_t t = ConvertToSeconds(imu.timestamp);
+
+  std::lock_guard<std::mutex> lock(lock_);
+
+  if (imu_history_.Empty() || t > imu_history_.NewestKey()) {
+    imu_history_.Update(t, imu);
+  }
+
+  if (!has_state_ || t <= state_.timestamp) {
+    return false;
+  }
+
+  Step(imu);
+
+  if (state_.age > params_.max_age_sec) {
+    return false;
+  }
+
+  out = state_;
+  return true;
+}
+
+
+void ImuPropagator::Step(const ImuMeasurement& imu)
+{
+  const seconds_t t = ConvertToSeconds(imu.timestamp);
+  const double dt = t - state_.timestamp;
+
+  // NOTE(milo): Same conventions as StateEkf (see RotateAndRemoveGravity()). The IMU "feels" an
+  // acceleration opposite to gravity, so they cancel out when at rest.
+  const Quaterniond q_world_imu = state_.q * q_body_imu_;
+  const Vector3d a_world = q_world_imu * imu_bias_.correctAccelerometer(imu.a) + params_.n_gravity;
+  const Vector3d w_world = q_world_imu * imu_bias_.correctGyroscope(imu.w);
+
+  state_.t += dt*state_.v + 0.5*dt*dt*a_world;
+  state_.v += dt*a_world;
+
+  // q1 = dq * q0 where dq = exp(dt * w).
+  const Vector3d drot = dt * w_world;
+  state_.q = (Quaterniond(AngleAxisd(drot.norm(), drot.normalized())) * state_.q).normalized();
+  state_.w = w_world;
+
+  state_.timestamp = t;
+  state_.age = t - filter_timestamp_;
+}
+
+
+}
+}
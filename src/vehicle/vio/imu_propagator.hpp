@@ -0,0 +1,95 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+
+#include "core/macros.hpp"
+#include "core/eigen_types.hpp"
+#include "core/timestamp.hpp"
+#include "core/imu_measurement.hpp"
+#include "params/params_base.hpp"
+#include "vio/imu_manager.hpp"
+#include "vio/ring_history.hpp"
+#include "vio/state_ekf.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Pose and velocity at an IMU timestamp, propagated forward from the latest filter state.
+struct PropagatedState final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef std::function<void(const PropagatedState&)> Callback;
+
+  seconds_t timestamp = 0;
+  seconds_t age = 0;            // Time since the filter state that this was propagated from.
+
+  Vector3d t = Vector3d::Zero();  // Position of body in world.
+  Vector3d v = Vector3d::Zero();  // Velocity of body in world.
+  Quaterniond q = Quaterniond::Identity();  // Orientation of body in world.
+  Vector3d w = Vector3d::Zero();  // Angular velocity (same convention as State).
+};
+
+
+// Integrates each new IMU measurement on top of the latest StateEkf state (strapdown, no
+// covariance), so that consumers like the controller can get a pose at the IMU rate instead of
+// waiting for the filter. Reset() is called with each filter state, and Propagate() with each IMU
+// measurement (e.g on the thread that receives them).
+// NOTE(milo): This keeps its own copy of the filter state, so it never takes the StateEkf lock.
+class ImuPropagator final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    bool enabled = false;
+    double max_age_sec = 0.5;     // Stop outputting if the filter hasn't produced a state in this long.
+    int max_stored_imu = 100;     // Replayed on top of a filter state that lags behind the IMU.
+
+    // Shared params.
+    Vector3d n_gravity = Vector3d(0, 9.81, 0);
+    Matrix4d body_T_imu = Matrix4d::Identity();
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(ImuPropagator)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ImuPropagator)
+
+  explicit ImuPropagator(const Params& params);
+
+  // Start propagating from a new filter state. Any stored IMU measurements after its timestamp
+  // (that the filter hasn't processed yet) are re-applied.
+  void Reset(const StateStamped& filter_state);
+
+  // Use this bias for all measurements from now on (e.g when the filter gets a new one).
+  void SetBias(const ImuBias& imu_bias);
+
+  // Integrate one IMU measurement. Returns false if there is no (recent enough) filter state, or if
+  // the measurement isn't newer than the current propagated state.
+  bool Propagate(const ImuMeasurement& imu, PropagatedState& out);
+
+ private:
+  // Integrate one measurement into state_ (needs the lock).
+  void Step(const ImuMeasurement& imu);
+
+ private:
+  Params params_;
+  Quaterniond q_body_imu_;
+
+  std::mutex lock_;
+  bool has_state_ = false;
+  seconds_t filter_timestamp_ = 0;
+  PropagatedState state_;
+  ImuBias imu_bias_;
+  RingHistory<seconds_t, ImuMeasurement> imu_history_;
+};
+
+
+}
+}
@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "vio/keyframe_database.hpp"
+
+namespace bm {
+namespace vio {
+
+
+static const char kVocabularyMagic[8] = { 'B', 'M', 'V', 'O', 'C', 'A', 'B', 0 };
+static const uint32_t kVocabularyVersion = 1;
+
+// Each level only needs a rough clustering, since the next level refines it.
+static const int kMaxKMajorityIters = 10;
+
+
+struct VocabularyHeader final {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_nodes;
+  uint32_t num_words;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(VocabularyHeader) == 24, "Unexpected VocabularyHeader padding");
+
+
+// xorshift32, so that training is the same on every platform for a given seed.
+static uint32_t NextRandom(uint32_t& state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+
+// Index of the center that's closest to d.
+static size_t NearestCenter(const VecDescriptor256& centers, const Descriptor256& d)
+{
+  size_t best = 0;
+  int best_dist = std::numeric_limits<int>::max();
+  for (size_t c = 0; c < centers.size(); ++c) {
+    const int dist = HammingDistance(centers[c], d);
+    if (dist < best_dist) {
+      best_dist = dist;
+      best = c;
+    }
+  }
+  return best;
+}
+
+
+// Each bit of the center is set if it's set in most of the descriptors.
+static Descriptor256 MajorityCenter(const VecDescriptor256& descriptors, const std::vector<uint32_t>& members)
+{
+  int counts[256] = { 0 };
+  for (const uint32_t i : members) {
+    const Descriptor256& d = descriptors[i];
+    for (int b = 0; b < 256; ++b) {
+      counts[b] += (d[b / 64] >> (b % 64)) & 1;
+    }
+  }
+
+  Descriptor256 center = {{ 0, 0, 0, 0 }};
+  for (int b = 0; b < 256; ++b) {
+    if (2 * counts[b] > static_cast<int>(members.size())) {
+      center[b / 64] |= (1ull << (b % 64));
+    }
+  }
+  return center;
+}
+
+
+void BowVocabulary::Train(const std::vector<VecDescriptor256>& images, int branching, int depth, uint32_t seed)
+{
+  CHECK_GE(branching, 2);
+  CHECK_GE(depth, 1);
+
+  VecDescriptor256 all;
+  for (const VecDescriptor256& image : images) {
+    all.insert(all.end(), image.begin(), image.end());
+  }
+  CHECK(!all.empty()) << "Can't train a BowVocabulary without descriptors" << std::endl;
+
+  std::vector<uint32_t> indices(all.size());
+  for (size_t i = 0; i < all.size(); ++i) {
+    indices[i] = static_cast<uint32_t>(i);
+  }
+
+  nodes_.clear();
+  idf_.clear();
+  nodes_.emplace_back();
+
+  uint32_t rng = (seed == 0) ? 0x9e3779b9u : seed;
+  Split(all, indices, 0, branching, depth, rng);
+
+  // idf = log(N / n_w), where n_w is the number of training images that contain word w.
+  std::vector<int> num_images_with_word(idf_.size(), 0);
+  std::vector<bool> seen(idf_.size(), false);
+  for (const VecDescriptor256& image : images) {
+    std::fill(seen.begin(), seen.end(), false);
+    for (const Descriptor256& d : image) {
+      const uint32_t w = Word(d);
+      if (!seen[w]) {
+        seen[w] = true;
+        ++num_images_with_word[w];
+      }
+    }
+  }
+
+  const double num_images = static_cast<double>(images.size());
+  for (size_t w = 0; w < idf_.size(); ++w) {
+    idf_[w] = static_cast<float>(std::log(num_images / std::max(1, num_images_with_word[w])));
+  }
+
+  LOG(INFO) << "Trained BowVocabulary with " << idf_.size() << " words from " << all.size()
+            << " descriptors (" << images.size() << " images)" << std::endl;
+}
+
+
+void BowVocabulary::Split(const VecDescriptor256& descriptors,
+                          const std::vector<uint32_t>& indices,
+                          uint32_t parent,
+                          int branching,
+                          int depth,
+                          uint32_t& rng)
+{
+  const auto make_leaf = [&]()
+  {
+    nodes_[parent].word_id = static_cast<uint32_t>(idf_.size());
+    idf_.push_back(0);
+  };
+
+  if (depth == 0 || indices.size() <= static_cast<size_t>(branching)) {
+    make_leaf();
+    return;
+  }
+
+  // Seed the centers with k-means++, so that they start out spread apart.
+  VecDescriptor256 centers;
+  centers.push_back(descriptors[indices[NextRandom(rng) % indices.size()]]);
+  std::vector<int> nearest_dist(indices.size(), std::numeric_limits<int>::max());
+
+  while (centers.size() < static_cast<size_t>(branching)) {
+    double total = 0;
+    for (size_t i = 0; i < indices.size(); ++i) {
+      nearest_dist[i] = std::min(nearest_dist[i], HammingDistance(centers.back(), descriptors[indices[i]]));
+      total += static_cast<double>(nearest_dist[i]) * nearest_dist[i];
+    }
+    if (total == 0) {
+      break;  // Every descriptor is on a center already.
+    }
+
+    double target = total * (NextRandom(rng) / static_cast<double>(std::numeric_limits<uint32_t>::max()));
+    size_t next = indices.size() - 1;
+    for (size_t i = 0; i < indices.size(); ++i) {
+      target -= static_cast<double>(nearest_dist[i]) * nearest_dist[i];
+      if (target <= 0) {
+        next = i;
+        break;
+      }
+    }
+    centers.push_back(descriptors[indices[next]]);
+  }
+
+  std::vector<size_t> assignment(indices.size(), 0);
+  std::vector<std::vector<uint32_t>> clusters;
+
+  for (int iter = 0; iter < kMaxKMajorityIters; ++iter) {
+    bool changed = (iter == 0);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      const size_t c = NearestCenter(centers, descriptors[indices[i]]);
+      changed |= (c != assignment[i]);
+      assignment[i] = c;
+    }
+
+    clusters.assign(centers.size(), std::vector<uint32_t>());
+    for (size_t i = 0; i < indices.size(); ++i) {
+      clusters[assignment[i]].push_back(indices[i]);
+    }
+
+    if (!changed) {
+      break;
+    }
+    for (size_t c = 0; c < centers.size(); ++c) {
+      if (!clusters[c].empty()) {
+        centers[c] = MajorityCenter(descriptors, clusters[c]);
+      }
+    }
+  }
+
+  // NOTE(milo): Drop empty clusters, and stop splitting if everything ended up in one.
+  std::vector<size_t> nonempty;
+  for (size_t c = 0; c < clusters.size(); ++c) {
+    if (!clusters[c].empty()) {
+      nonempty.push_back(c);
+    }
+  }
+  if (nonempty.size() < 2) {
+    make_leaf();
+    return;
+  }
+
+  // Children are added before recursing, so that they're contiguous.
+  const uint32_t first_child = static_cast<uint32_t>(nodes_.size());
+  nodes_[parent].first_child = first_child;
+  nodes_[parent].num_children = static_cast<uint32_t>(nonempty.size());
+  for (const size_t c : nonempty) {
+    nodes_.emplace_back();
+    nodes_.back().center = centers[c];
+  }
+
+  for (size_t k = 0; k < nonempty.size(); ++k) {
+    Split(descriptors, clusters[nonempty[k]], first_child + static_cast<uint32_t>(k), branching, depth - 1, rng);
+  }
+}
+
+
+uint32_t BowVocabulary::Word(const Descriptor256& d) const
+{
+  CHECK(!Empty()) << "BowVocabulary hasn't been trained or loaded" << std::endl;
+
+  uint32_t node = 0;
+  while (nodes_[node].num_children > 0) {
+    const Node& n = nodes_[node];
+    uint32_t best = n.first_child;
+    int best_dist = std::numeric_limits<int>::max();
+    for (uint32_t c = n.first_child; c < n.first_child + n.num_children; ++c) {
+      const int dist = HammingDistance(nodes_[c].center, d);
+      if (dist < best_dist) {
+        best_dist = dist;
+        best = c;
+      }
+    }
+    node = best;
+  }
+  return nodes_[node].word_id;
+}
+
+
+BowVector BowVocabulary::Transform(const VecDescriptor256& descriptors, std::vector<uint32_t>* words) const
+{
+  std::vector<uint32_t> sorted(descriptors.size());
+  for (size_t i = 0; i < descriptors.size(); ++i) {
+    sorted[i] = Word(descriptors[i]);
+  }
+  if (words) {
+    *words = sorted;
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  BowVector bow;
+  float total = 0;
+  for (size_t i = 0; i < sorted.size();) {
+    size_t j = i;
+    while (j < sorted.size() && sorted[j] == sorted[i]) { ++j; }
+
+    // NOTE(milo): Words that are in every training image have zero weight, so they're left out.
+    const float weight = static_cast<float>(j - i) * idf_[sorted[i]];
+    if (weight > 0) {
+      bow.emplace_back(sorted[i], weight);
+      total += weight;
+    }
+    i = j;
+  }
+
+  for (std::pair<uint32_t, float>& entry : bow) {
+    entry.second /= total;
+  }
+  return bow;
+}
+
+
+bool BowVocabulary::Save(const std::string& path) const
+{
+  static_assert(sizeof(Node) == 48, "Unexpected BowVocabulary::Node padding");
+
+  VocabularyHeader header;
+  std::memcpy(header.magic, kVocabularyMagic, sizeof(kVocabularyMagic));
+  header.version = kVocabularyVersion;
+  header.num_nodes = static_cast<uint32_t>(nodes_.size());
+  header.num_words = static_cast<uint32_t>(idf_.size());
+  header.reserved = 0;
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(nodes_.data()), nodes_.size() * sizeof(Node));
+  out.write(reinterpret_cast<const char*>(idf_.data()), idf_.size() * sizeof(float));
+  return out.good();
+}
+
+
+bool BowVocabulary::Load(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in.good()) {
+    return false;
+  }
+
+  VocabularyHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!in.good() || std::memcmp(header.magic, kVocabularyMagic, sizeof(kVocabularyMagic)) != 0 ||
+      header.version != kVocabularyVersion) {
+    LOG(WARNING) << "Not a BowVocabulary (or a different version): " << path << std::endl;
+    return false;
+  }
+
+  std::vector<Node> nodes(header.num_nodes);
+  std::vector<float> idf(header.num_words);
+  in.read(reinterpret_cast<char*>(nodes.data()), nodes.size() * sizeof(Node));
+  in.read(reinterpret_cast<char*>(idf.data()), idf.size() * sizeof(float));
+  if (!in.good() || nodes.empty()) {
+    LOG(WARNING) << "BowVocabulary is truncated: " << path << std::endl;
+    return false;
+  }
+
+  nodes_ = std::move(nodes);
+  idf_ = std::move(idf);
+  return true;
+}
+
+
+BowVocabulary::ConstPtr BowVocabulary::LoadShared(const std::string& path)
+{
+  Ptr vocabulary = std::make_shared<BowVocabulary>();
+  return vocabulary->Load(path) ? vocabulary : nullptr;
+}
+
+
+void KeyframeDatabase::Add(uid_t keyframe_id, const BowVector& bow)
+{
+  const uint32_t index = static_cast<uint32_t>(keyframe_ids_.size());
+  keyframe_ids_.emplace_back(keyframe_id);
+
+  for (const std::pair<uint32_t, float>& entry : bow) {
+    CHECK_LT(entry.first, inverted_index_.size()) << "Word id is outside of the vocabulary" << std::endl;
+    inverted_index_[entry.first].emplace_back(index, entry.second);
+  }
+}
+
+
+std::vector<KeyframeDatabase::Match> KeyframeDatabase::Query(const BowVector& bow, size_t max_results, float min_score) const
+{
+  // For L1-normalized vectors, 1 - |v - w|/2 only depends on the words that they share:
+  // sum(|v_i| + |w_i| - |v_i - w_i|) / 2.
+  std::vector<float> scores(keyframe_ids_.size(), 0.0f);
+  for (const std::pair<uint32_t, float>& entry : bow) {
+    if (entry.first >= inverted_index_.size()) {
+      continue;
+    }
+    const float v = entry.second;
+    for (const std::pair<uint32_t, float>& posting : inverted_index_[entry.first]) {
+      const float w = posting.second;
+      scores[posting.first] += v + w - std::fabs(v - w);
+    }
+  }
+
+  std::vector<Match> matches;
+  for (size_t i = 0; i < scores.size(); ++i) {
+    const float score = 0.5f * scores[i];
+    if (score > 0 && score >= min_score) {
+      matches.push_back(Match{ keyframe_ids_[i], score });
+    }
+  }
+
+  const size_t n = std::min(max_results, matches.size());
+  std::partial_sort(matches.begin(), matches.begin() + n, matches.end(),
+      [](const Match& a, const Match& b) { return a.score > b.score; });
+  matches.resize(n);
+  return matches;
+}
+
+
+}
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// A 256-bit binary descriptor (e.g ORB), packed so that a distance is four popcounts.
+typedef std::array<uint64_t, 4> Descriptor256;
+typedef std::vector<Descriptor256> VecDescriptor256;
+
+inline int HammingDistance(const Descriptor256& a, const Descriptor256& b)
+{
+  return __builtin_popcountll(a[0] ^ b[0]) + __builtin_popcountll(a[1] ^ b[1]) +
+         __builtin_popcountll(a[2] ^ b[2]) + __builtin_popcountll(a[3] ^ b[3]);
+}
+
+
+// Sparse bag-of-words vector of (word id, weight), sorted by word id, with weights that sum to 1.
+typedef std::vector<std::pair<uint32_t, float>> BowVector;
+
+
+// A vocabulary tree (Nister and Stewenius, 2006) for binary descriptors: each level splits the
+// descriptors into "branching" clusters with k-majority (k-means in Hamming space), and the leaves
+// are the words. Looking up a word is depth * branching distances, no matter how many words.
+class BowVocabulary final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(BowVocabulary)
+
+  BowVocabulary() = default;
+
+  // Clusters the descriptors from a set of training images (one VecDescriptor256 each) into at most
+  // branching^depth words. Each word is weighted by its inverse document frequency in the images.
+  void Train(const std::vector<VecDescriptor256>& images, int branching, int depth, uint32_t seed = 0);
+
+  // Binary file (host byte order). Load() returns false if it's missing, truncated or not a
+  // vocabulary.
+  bool Save(const std::string& path) const;
+  bool Load(const std::string& path);
+
+  // Loads a vocabulary that can be shared (read-only) between threads and estimators. Returns
+  // nullptr if Load() fails.
+  static ConstPtr LoadShared(const std::string& path);
+
+  bool Empty() const { return nodes_.empty(); }
+  size_t NumWords() const { return idf_.size(); }
+
+  // Id of the word (leaf) that this descriptor belongs to.
+  uint32_t Word(const Descriptor256& d) const;
+
+  // Term frequency times idf for each word in the image, L1-normalized. If "words" is given, it's
+  // filled with the word of each descriptor.
+  BowVector Transform(const VecDescriptor256& descriptors, std::vector<uint32_t>* words = nullptr) const;
+
+ private:
+  // Clusters descriptors[indices] under node "parent", and recurses until "depth" levels are left.
+  void Split(const VecDescriptor256& descriptors,
+             const std::vector<uint32_t>& indices,
+             uint32_t parent,
+             int branching,
+             int depth,
+             uint32_t& rng);
+
+ private:
+  struct Node final
+  {
+    Descriptor256 center = {{ 0, 0, 0, 0 }};
+    uint32_t first_child = 0;
+    uint32_t num_children = 0;  // Zero for the leaves (words).
+    uint32_t word_id = 0;       // Only for leaves.
+  };
+
+  std::vector<Node> nodes_;     // nodes_[0] is the root, and the children of a node are contiguous.
+  std::vector<float> idf_;      // One per word.
+};
+
+
+// An inverted index from each word to the keyframes that contain it, so that a query only touches
+// the keyframes that share words with it (instead of all of them).
+class KeyframeDatabase final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(KeyframeDatabase)
+
+  struct Match final
+  {
+    uid_t keyframe_id;
+    float score;                // In [0, 1], where 1 is an identical BowVector.
+  };
+
+  explicit KeyframeDatabase(size_t num_words) : inverted_index_(num_words) {}
+
+  void Add(uid_t keyframe_id, const BowVector& bow);
+
+  // Up to max_results keyframes with an L1 score of at least min_score, best first.
+  std::vector<Match> Query(const BowVector& bow, size_t max_results, float min_score) const;
+
+  size_t Size() const { return keyframe_ids_.size(); }
+
+ private:
+  // (keyframe index, weight) for each word.
+  std::vector<std::vector<std::pair<uint32_t, float>>> inverted_index_;
+  std::vector<uid_t> keyframe_ids_;
+};
+
+
+}
+}
@@ -0,0 +1,70 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "vio/lag_controller.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void LagController::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("enabled", &enabled);
+  parser.GetParam("target_p95_ms", &target_p95_ms);
+  parser.GetParam("min_lag_sec", &min_lag_sec);
+  parser.GetParam("max_lag_sec", &max_lag_sec);
+  parser.GetParam("window", &window);
+  parser.GetParam("deadband", &deadband);
+  parser.GetParam("grow_factor", &grow_factor);
+  parser.GetParam("max_shrink", &max_shrink);
+
+  CHECK_GT(target_p95_ms, 0);
+  CHECK(min_lag_sec > 0 && min_lag_sec <= max_lag_sec);
+  CHECK_GE(window, 1);
+  CHECK(deadband >= 0 && deadband < 1);
+  CHECK_GE(grow_factor, 1.0);
+  CHECK(max_shrink > 0 && max_shrink <= 1);
+}
+
+
+LagController::LagController(const Params& params, double initial_lag_sec)
+    : params_(params),
+      lag_sec_(params.enabled ? std::min(params.max_lag_sec, std::max(params.min_lag_sec, initial_lag_sec)) : initial_lag_sec) {}
+
+
+bool LagController::Update(double update_ms)
+{
+  if (!params_.enabled) {
+    return false;
+  }
+
+  update_ms_.Record(update_ms);
+  if (++samples_ < params_.window) {
+    return false;
+  }
+
+  last_p95_ms_ = update_ms_.Percentile(0.95);
+  update_ms_.Reset();
+  samples_ = 0;
+
+  const double prev_lag_sec = lag_sec_;
+  if (last_p95_ms_ > (1.0 + params_.deadband) * params_.target_p95_ms) {
+    lag_sec_ *= std::max(params_.max_shrink, params_.target_p95_ms / last_p95_ms_);
+  } else if (last_p95_ms_ < (1.0 - params_.deadband) * params_.target_p95_ms) {
+    lag_sec_ *= params_.grow_factor;
+  }
+  lag_sec_ = std::min(params_.max_lag_sec, std::max(params_.min_lag_sec, lag_sec_));
+
+  if (lag_sec_ == prev_lag_sec) {
+    return false;
+  }
+
+  LOG(INFO) << "LagController: smoother lag " << prev_lag_sec << " => " << lag_sec_
+            << " sec (p95=" << last_p95_ms_ << "ms, target=" << params_.target_p95_ms << "ms)" << std::endl;
+  return true;
+}
+
+
+}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "core/macros.hpp"
+#include "core/latency_histogram.hpp"
+#include "params/params_base.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Sizes the fixed-lag smoother's window to a CPU time budget. The p95 of the last "window" update
+// times is compared to target_p95_ms: if it's over budget, the lag is shortened in proportion (so
+// that older keyposes are marginalized sooner), and if it's comfortably under budget, the lag grows
+// a little (keeping keyposes around longer). The update time grows with the number of variables in
+// the window, so shrinking by target / p95 gets close in one step, while growing slowly avoids
+// overshooting when the scene gets busier again.
+class LagController final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    bool enabled = false;           // If false, the lag stays at its initial value.
+    double target_p95_ms = 100.0;   // Budget for the p95 smoother update time.
+    double min_lag_sec = 2.0;
+    double max_lag_sec = 30.0;
+    int window = 20;                // Take the p95 over this many updates before each change.
+    double deadband = 0.2;          // Don't change the lag while p95 is within (1 +/- deadband) * target.
+    double grow_factor = 1.1;       // Lengthen the lag by this much at a time when under budget.
+    double max_shrink = 0.5;        // Never shorten the lag by more than this factor at a time.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(LagController)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(LagController)
+
+  // The lag starts at initial_lag_sec (clamped to [min_lag_sec, max_lag_sec] if enabled).
+  LagController(const Params& params, double initial_lag_sec);
+
+  // Record how long one smoother update took. Returns true if Lag() changed.
+  bool Update(double update_ms);
+
+  double Lag() const { return lag_sec_; }
+
+  // The p95 update time from the last full window (zero before the first one).
+  double LastP95() const { return last_p95_ms_; }
+
+ private:
+  Params params_;
+  double lag_sec_;
+  LatencyHistogram update_ms_;
+  int samples_ = 0;
+  double last_p95_ms_ = 0;
+};
+
+
+}
+}
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <numeric>
+
+#include <glog/logging.h>
+
+#include "vio/landmark_budget.hpp"
+
+namespace bm {
+namespace vio {
+
+
+double LandmarkScore(const LandmarkCandidate& c, int max_obs, double parallax_scale_px)
+{
+  const double length_term = std::min(1.0, static_cast<double>(c.num_obs) / static_cast<double>(max_obs));
+  const double parallax_term = std::min(1.0, c.parallax_px / parallax_scale_px);
+  return 0.5 * length_term + 0.5 * parallax_term;
+}
+
+
+std::vector<bool> SelectLandmarks(const std::vector<LandmarkCandidate>& candidates,
+                                  int max_landmarks,
+                                  int max_obs,
+                                  double parallax_scale_px,
+                                  int grid_rows,
+                                  int grid_cols,
+                                  int image_width,
+                                  int image_height)
+{
+  CHECK_GT(max_obs, 0);
+  CHECK_GT(parallax_scale_px, 0);
+  CHECK(grid_rows > 0 && grid_cols > 0) << "Grid must have at least one cell" << std::endl;
+  CHECK(image_width > 0 && image_height > 0);
+
+  std::vector<bool> selected(candidates.size(), false);
+  if (candidates.empty() || max_landmarks <= 0) {
+    return selected;
+  }
+
+  std::vector<double> scores(candidates.size());
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    scores[i] = LandmarkScore(candidates[i], max_obs, parallax_scale_px);
+  }
+
+  // Best candidates first. Ties are broken by lmk_id so that the selection is deterministic.
+  std::vector<size_t> order(candidates.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+  {
+    return (scores[a] != scores[b]) ? (scores[a] > scores[b]) : (candidates[a].lmk_id < candidates[b].lmk_id);
+  });
+
+  const int num_cells = grid_rows * grid_cols;
+  const int per_cell = std::max(1, (max_landmarks + num_cells - 1) / num_cells);
+  std::vector<int> cell_count(num_cells, 0);
+
+  int num_selected = 0;
+
+  // PASS 1: Fill each cell up to its share of the budget.
+  for (size_t i : order) {
+    if (num_selected >= max_landmarks) {
+      break;
+    }
+    const Vector2d& px = candidates[i].newest_px;
+    const int row = std::max(0, std::min(grid_rows - 1, static_cast<int>(px.y() * grid_rows / image_height)));
+    const int col = std::max(0, std::min(grid_cols - 1, static_cast<int>(px.x() * grid_cols / image_width)));
+    int& count = cell_count[row * grid_cols + col];
+    if (count < per_cell) {
+      selected[i] = true;
+      ++count;
+      ++num_selected;
+    }
+  }
+
+  // PASS 2: If some cells didn't have enough landmarks, use the leftover budget on the best of the rest.
+  for (size_t i : order) {
+    if (num_selected >= max_landmarks) {
+      break;
+    }
+    if (!selected[i]) {
+      selected[i] = true;
+      ++num_selected;
+    }
+  }
+
+  return selected;
+}
+
+
+}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Summary of a landmark track, used to decide which landmarks get a (smart) factor in the graph.
+struct LandmarkCandidate final
+{
+  LandmarkCandidate() = default;
+
+  explicit LandmarkCandidate(uid_t lmk_id, int num_obs, double parallax_px, const Vector2d& newest_px)
+      : lmk_id(lmk_id), num_obs(num_obs), parallax_px(parallax_px), newest_px(newest_px) {}
+
+  uid_t lmk_id = 0;
+  int num_obs = 0;                          // Number of keyposes that observed this landmark.
+  double parallax_px = 0;                   // Pixel distance btw the oldest and newest observation.
+  Vector2d newest_px = Vector2d::Zero();    // Most recent pixel location (left image).
+};
+
+
+// Score in [0, 1] that prefers long tracks with a lot of parallax (well-constrained landmarks).
+// Both terms saturate: at max_obs observations and at parallax_scale_px of parallax.
+double LandmarkScore(const LandmarkCandidate& c, int max_obs, double parallax_scale_px);
+
+
+// Chooses at most max_landmarks candidates to keep. The image is split into a grid_rows x grid_cols
+// grid, and each cell gets an equal share of the budget (filled in order of score), so that the
+// selected landmarks cover the image. Any budget left over goes to the best remaining candidates.
+// Returns a flag for each candidate.
+std::vector<bool> SelectLandmarks(const std::vector<LandmarkCandidate>& candidates,
+                                  int max_landmarks,
+                                  int max_obs,
+                                  double parallax_scale_px,
+                                  int grid_rows,
+                                  int grid_cols,
+                                  int image_width,
+                                  int image_height);
+
+}
+}
@@ -0,0 +1,270 @@
+#include <cstring>
+#include <memory>
+
+#include <glog/logging.h>
+
+#include "vio/mission_log.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace mission_log;
+
+
+template <typename MatrixT>
+static void CopyTo(const MatrixT& m, double* out)
+{
+  Eigen::Map<MatrixT>(out) = m;
+}
+
+
+template <typename MatrixT>
+static MatrixT CopyFrom(const double* in)
+{
+  return Eigen::Map<const MatrixT>(in);
+}
+
+
+template <typename RecordT>
+static void WriteRecord(std::ofstream& out, const RecordT& record)
+{
+  out.write(reinterpret_cast<const char*>(&record), sizeof(RecordT));
+}
+
+
+template <typename RecordT>
+static bool ReadRecord(std::ifstream& in, RecordT& record)
+{
+  in.read(reinterpret_cast<char*>(&record), sizeof(RecordT));
+  return in.good();
+}
+
+
+MissionLogWriter::MissionLogWriter(const std::string& path)
+    : out_(path, std::ios::binary | std::ios::trunc)
+{
+  FileHeader header;
+  std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = kVersion;
+  header.reserved = 0;
+  WriteRecord(out_, header);
+
+  if (!out_.good()) {
+    LOG(WARNING) << "Couldn't open mission log for writing: " << path << std::endl;
+  }
+}
+
+
+void MissionLogWriter::WriteImu(const ImuMeasurement& imu)
+{
+  if (imu.timestamp <= newest_imu_) {
+    return;
+  }
+  newest_imu_ = imu.timestamp;
+
+  RecordHeader header;
+  header.type = RecordType::IMU;
+  header.reserved = 0;
+
+  ImuRecord record;
+  record.timestamp = imu.timestamp;
+  CopyTo<Vector3d>(imu.w, record.w);
+  CopyTo<Vector3d>(imu.a, record.a);
+
+  WriteRecord(out_, header);
+  WriteRecord(out_, record);
+}
+
+
+void MissionLogWriter::WriteKeypose(const MissionKeypose& keypose)
+{
+  RecordHeader header;
+  header.type = RecordType::KEYPOSE;
+  header.reserved = 0;
+
+  KeyposeRecord record;
+  std::memset(&record, 0, sizeof(record));
+  record.timestamp = keypose.timestamp;
+  record.flags = (keypose.vo ? kHasVo : 0) |
+                 (keypose.depth ? kHasDepth : 0) |
+                 (keypose.attitude ? kHasAttitude : 0) |
+                 (keypose.reset ? kReset : 0) |
+                 (keypose.online.has_imu_state ? kHasImuState : 0);
+  record.num_landmarks = keypose.vo ? static_cast<uint32_t>(keypose.vo->lmk_obs.size()) : 0;
+  record.num_ranges = static_cast<uint32_t>(keypose.ranges.size());
+
+  if (keypose.vo) {
+    const VoResult& vo = *keypose.vo;
+    record.rig = static_cast<uint32_t>(vo.rig);
+    record.vo_timestamp = vo.timestamp;
+    record.vo_timestamp_lkf = vo.timestamp_lkf;
+    record.camera_id = vo.camera_id;
+    record.camera_id_lkf = vo.camera_id_lkf;
+    CopyTo<Matrix4d>(vo.lkf_T_cam, record.lkf_T_cam);
+  }
+  if (keypose.depth) {
+    record.depth_timestamp = keypose.depth->timestamp;
+    record.depth = keypose.depth->depth;
+  }
+  if (keypose.attitude) {
+    record.attitude_timestamp = keypose.attitude->timestamp;
+    CopyTo<Vector3d>(keypose.attitude->body_nG, record.body_nG);
+  }
+
+  const SmootherResult& r = keypose.online;
+  const Quaterniond q = r.world_P_body.rotation().toQuaternion();
+  record.keypose_id = r.keypose_id;
+  CopyTo<Vector3d>(r.world_P_body.translation(), record.world_t_body);
+  record.world_q_body[0] = q.w();
+  record.world_q_body[1] = q.x();
+  record.world_q_body[2] = q.y();
+  record.world_q_body[3] = q.z();
+  CopyTo<Vector3d>(r.world_v_body, record.world_v_body);
+  CopyTo<Vector3d>(r.imu_bias.accelerometer(), record.bias_acc);
+  CopyTo<Vector3d>(r.imu_bias.gyroscope(), record.bias_gyro);
+
+  WriteRecord(out_, header);
+  WriteRecord(out_, record);
+
+  for (uint32_t i = 0; i < record.num_landmarks; ++i) {
+    const LandmarkObservation& obs = keypose.vo->lmk_obs.at(i);
+    ObservationRecord lmk;
+    lmk.landmark_id = obs.landmark_id;
+    lmk.camera_id = obs.camera_id;
+    lmk.pixel[0] = obs.pixel_location.x;
+    lmk.pixel[1] = obs.pixel_location.y;
+    lmk.disparity = obs.disparity;
+    WriteRecord(out_, lmk);
+  }
+
+  for (const RangeMeasurement& range : keypose.ranges) {
+    RangeRecord rr;
+    rr.timestamp = range.timestamp;
+    rr.range = range.range;
+    CopyTo<Vector3d>(range.point, rr.point);
+    WriteRecord(out_, rr);
+  }
+
+  ++num_keyposes_;
+}
+
+
+// Reads the rest of a keypose record (after its header). Returns false if the file ends first.
+static bool ReadKeypose(std::ifstream& in, MissionKeypose& keypose)
+{
+  KeyposeRecord record;
+  if (!ReadRecord(in, record)) {
+    return false;
+  }
+
+  keypose.timestamp = record.timestamp;
+  keypose.reset = (record.flags & kReset) != 0;
+
+  if (record.flags & kHasVo) {
+    VoResult::Ptr vo = std::make_shared<VoResult>(
+        record.vo_timestamp, record.vo_timestamp_lkf, record.camera_id, record.camera_id_lkf);
+    vo->is_keyframe = true;
+    vo->rig = record.rig;
+    vo->lkf_T_cam = CopyFrom<Matrix4d>(record.lkf_T_cam);
+    vo->lmk_obs.reserve(record.num_landmarks);
+    for (uint32_t i = 0; i < record.num_landmarks; ++i) {
+      ObservationRecord lmk;
+      if (!ReadRecord(in, lmk)) {
+        return false;
+      }
+      vo->lmk_obs.emplace_back(lmk.landmark_id, lmk.camera_id,
+          cv::Point2f(lmk.pixel[0], lmk.pixel[1]), lmk.disparity, 0.0, 0.0);
+    }
+    keypose.vo = vo;
+  }
+
+  if (record.flags & kHasDepth) {
+    keypose.depth = std::make_shared<DepthMeasurement>(record.depth_timestamp, record.depth);
+  }
+  if (record.flags & kHasAttitude) {
+    keypose.attitude = std::make_shared<AttitudeMeasurement>(
+        record.attitude_timestamp, CopyFrom<Vector3d>(record.body_nG));
+  }
+
+  keypose.ranges.clear();
+  for (uint32_t i = 0; i < record.num_ranges; ++i) {
+    RangeRecord rr;
+    if (!ReadRecord(in, rr)) {
+      return false;
+    }
+    keypose.ranges.emplace_back(rr.timestamp, rr.range, CopyFrom<Vector3d>(rr.point));
+  }
+
+  const double* q = record.world_q_body;
+  keypose.online = SmootherResult();
+  keypose.online.keypose_id = record.keypose_id;
+  keypose.online.timestamp = record.timestamp;
+  keypose.online.world_P_body = gtsam::Pose3(
+      gtsam::Rot3::Quaternion(q[0], q[1], q[2], q[3]), CopyFrom<Vector3d>(record.world_t_body));
+  keypose.online.has_imu_state = (record.flags & kHasImuState) != 0;
+  keypose.online.world_v_body = CopyFrom<Vector3d>(record.world_v_body);
+  keypose.online.imu_bias = ImuBias(CopyFrom<Vector3d>(record.bias_acc), CopyFrom<Vector3d>(record.bias_gyro));
+  keypose.online.has_covariance = false;
+
+  return true;
+}
+
+
+bool ReadMissionLog(const std::string& path, MissionLog& log)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in.good()) {
+    return false;
+  }
+
+  FileHeader header;
+  if (!ReadRecord(in, header) || std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 ||
+      header.version != kVersion) {
+    LOG(WARNING) << "Not a mission log (or a different version): " << path << std::endl;
+    return false;
+  }
+
+  log.imu.clear();
+  log.keyposes.clear();
+
+  // NOTE(milo): A clean end of the file is right before a RecordHeader.
+  bool truncated = false;
+  RecordHeader record;
+  while (true) {
+    if (!ReadRecord(in, record)) {
+      truncated = in.gcount() > 0;
+      break;
+    }
+
+    if (record.type == RecordType::IMU) {
+      ImuRecord imu;
+      if (!ReadRecord(in, imu)) {
+        truncated = true;
+        break;
+      }
+      log.imu.emplace_back(imu.timestamp, CopyFrom<Vector3d>(imu.w), CopyFrom<Vector3d>(imu.a));
+
+    } else if (record.type == RecordType::KEYPOSE) {
+      MissionKeypose keypose;
+      if (!ReadKeypose(in, keypose)) {
+        truncated = true;
+        break;
+      }
+      log.keyposes.emplace_back(std::move(keypose));
+
+    } else {
+      LOG(WARNING) << "Unknown record type " << record.type << " in mission log, stopping there: " << path << std::endl;
+      break;
+    }
+  }
+
+  if (truncated) {
+    LOG(WARNING) << "Mission log is truncated, read up to the last complete record: " << path << std::endl;
+  }
+
+  return true;
+}
+
+
+}
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/depth_measurement.hpp"
+#include "core/imu_measurement.hpp"
+#include "core/range_measurement.hpp"
+#include "core/timestamp.hpp"
+#include "vio/attitude_measurement.hpp"
+#include "vio/smoother_result.hpp"
+#include "vio/vo_result.hpp"
+
+namespace bm {
+namespace vio {
+
+
+// The inputs to one FixedLagSmoother::Update() during a run, and the estimate that came out of it,
+// so that the update can be made again offline (see OfflineBundleAdjuster).
+struct MissionKeypose final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  seconds_t timestamp = 0;
+  bool reset = false;                   // The smoother was (re)initialized at this keypose.
+
+  VoResult::ConstPtr vo;                // Primary rig keyframe (null if this keypose had no vision).
+  DepthMeasurement::ConstPtr depth;
+  AttitudeMeasurement::ConstPtr attitude;
+  MultiRange ranges;
+
+  SmootherResult online;                // What the online smoother returned (no covariances).
+};
+
+
+// Everything that a run gave to the smoother: keyposes in order, and the IMU measurements around
+// them (which are preintegrated again offline, since a PimResult can't be serialized).
+struct MissionLog final
+{
+  std::vector<ImuMeasurement> imu;
+  std::vector<MissionKeypose, Eigen::aligned_allocator<MissionKeypose>> keyposes;
+};
+
+
+// The on-disk layout (in host byte order): FileHeader, and then records until the end of the file.
+// Each record is a RecordHeader, followed by an ImuRecord, or by a KeyposeRecord with
+// num_landmarks x ObservationRecord and num_ranges x RangeRecord.
+namespace mission_log {
+
+static const char kFileMagic[8] = { 'B', 'M', 'M', 'L', 'O', 'G', 0, 0 };
+static const uint32_t kVersion = 1;
+
+enum RecordType : uint32_t { IMU = 1, KEYPOSE = 2 };
+
+// KeyposeRecord::flags
+static const uint32_t kHasVo = 1 << 0;
+static const uint32_t kHasDepth = 1 << 1;
+static const uint32_t kHasAttitude = 1 << 2;
+static const uint32_t kReset = 1 << 3;
+static const uint32_t kHasImuState = 1 << 4;
+
+struct FileHeader final {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct RecordHeader final {
+  uint32_t type;
+  uint32_t reserved;
+};
+
+struct ImuRecord final {
+  uint64_t timestamp;
+  double w[3];
+  double a[3];
+};
+
+struct KeyposeRecord final {
+  double timestamp;
+  uint32_t flags;
+  uint32_t num_landmarks;
+  uint32_t num_ranges;
+  uint32_t rig;
+
+  // VoResult
+  uint64_t vo_timestamp;
+  uint64_t vo_timestamp_lkf;
+  uint64_t camera_id;
+  uint64_t camera_id_lkf;
+  double lkf_T_cam[16];     // Column-major, like Eigen.
+
+  uint64_t depth_timestamp;
+  double depth;
+  double attitude_timestamp;
+  double body_nG[3];
+
+  // Online estimate.
+  uint64_t keypose_id;
+  double world_t_body[3];
+  double world_q_body[4];   // w, x, y, z
+  double world_v_body[3];
+  double bias_acc[3];
+  double bias_gyro[3];
+};
+
+struct ObservationRecord final {
+  uint64_t landmark_id;
+  uint64_t camera_id;
+  float pixel[2];
+  double disparity;
+};
+
+struct RangeRecord final {
+  uint64_t timestamp;
+  double range;
+  double point[3];
+};
+
+static_assert(sizeof(FileHeader) == 16, "Unexpected FileHeader padding");
+static_assert(sizeof(RecordHeader) == 8, "Unexpected RecordHeader padding");
+static_assert(sizeof(ImuRecord) == 56, "Unexpected ImuRecord padding");
+static_assert(sizeof(KeyposeRecord) == 368, "Unexpected KeyposeRecord padding");
+static_assert(sizeof(ObservationRecord) == 32, "Unexpected ObservationRecord padding");
+static_assert(sizeof(RangeRecord) == 40, "Unexpected RangeRecord padding");
+
+}
+
+
+// Reads a whole mission log. A log that ends in the middle of a record (e.g the run crashed) is
+// read up to the last complete one. Returns false if the file is missing or not a mission log (of
+// this version).
+bool ReadMissionLog(const std::string& path, MissionLog& log);
+
+
+// Appends smoother inputs to a mission log as a run goes (see StateEstimator::Params::mission_log_path).
+// Writes are buffered by the stream, and are small (a keyframe is a few kB), so this is cheap
+// enough to call from the smoother thread.
+//
+// NOTE(milo): Not thread-safe, only call it from one thread.
+class MissionLogWriter final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(MissionLogWriter)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MissionLogWriter)
+
+  // Truncates any existing file at "path". Check Good() to see if it could be opened.
+  explicit MissionLogWriter(const std::string& path);
+
+  bool Good() const { return out_.good(); }
+
+  // Measurements that aren't newer than the last one written are skipped, so overlapping ranges of
+  // the IMU queue can be written without duplicates.
+  void WriteImu(const ImuMeasurement& imu);
+
+  void WriteKeypose(const MissionKeypose& keypose);
+
+  void Flush() { out_.flush(); }
+
+  size_t NumKeyposes() const { return num_keyposes_; }
+
+ private:
+  std::ofstream out_;
+  timestamp_t newest_imu_ = kMinTimestamp;
+  size_t num_keyposes_ = 0;
+};
+
+
+}
+}
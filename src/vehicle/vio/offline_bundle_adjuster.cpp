@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <limits>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <gtsam/inference/Symbol.h>
+
+#include "core/thread_pool.hpp"
+#include "core/timer.hpp"
+#include "core/trace.hpp"
+#include "vio/offline_bundle_adjuster.hpp"
+
+namespace bm {
+namespace vio {
+
+
+typedef std::vector<SmootherResult, Eigen::aligned_allocator<SmootherResult>> SmootherResults;
+
+
+void OfflineBundleAdjuster::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("window_sec", &window_sec);
+  parser.GetParam("overlap_sec", &overlap_sec);
+  parser.GetParam("num_threads", &num_threads);
+  parser.GetParam("extra_smoothing_iters", &extra_smoothing_iters);
+  parser.GetParam("max_smart_factors", &max_smart_factors);
+  parser.GetParam("allowed_misalignment_imu", &allowed_misalignment_imu);
+
+  CHECK_GT(window_sec, 0);
+  CHECK(overlap_sec >= 0 && overlap_sec < window_sec) << "overlap_sec must be in [0, window_sec)" << std::endl;
+  CHECK_GE(num_threads, 0);
+  CHECK_GE(extra_smoothing_iters, 0);
+  CHECK_GT(max_smart_factors, 0);
+}
+
+
+OfflineBundleAdjuster::OfflineBundleAdjuster(const Params& params,
+                                             const FixedLagSmoother::Params& smoother_params,
+                                             const ImuManager::Params& imu_params)
+    : params_(params),
+      smoother_params_(smoother_params),
+      imu_params_(imu_params)
+{
+  // NOTE(milo): Each window has its own smoother, and they all run at once, so they shouldn't also
+  // try to use every core (or the shared TaskScheduler).
+  smoother_params_.async_update = false;
+  smoother_params_.parallel_triangulation = false;
+  smoother_params_.tbb_threads = 1;
+  smoother_params_.lag_controller_params.enabled = false;
+  smoother_params_.history_sec = 0;
+  smoother_params_.covariance_interval = std::numeric_limits<int>::max();
+  smoother_params_.extra_smoothing_iters = params_.extra_smoothing_iters;
+  smoother_params_.max_smart_factors = params_.max_smart_factors;
+
+  // All of a window's IMU is queued up front, so there's nothing to integrate as it arrives.
+  imu_params_.incremental = false;
+}
+
+
+std::vector<OfflineBundleAdjuster::Window> OfflineBundleAdjuster::Segment(const MissionLog& log) const
+{
+  std::vector<Window> windows;
+  const auto& kps = log.keyposes;
+  const size_t N = kps.size();
+
+  size_t segment_begin = 0;
+  while (segment_begin < N) {
+    // A segment goes up to the next reset.
+    size_t segment_end = segment_begin + 1;
+    while (segment_end < N && !kps.at(segment_end).reset) {
+      ++segment_end;
+    }
+
+    size_t begin = segment_begin;
+    while (true) {
+      size_t end = begin + 1;
+      while (end < segment_end && (kps.at(end).timestamp - kps.at(begin).timestamp) <= params_.window_sec) {
+        ++end;
+      }
+
+      Window window;
+      window.begin = begin;
+      window.end = end;
+      windows.emplace_back(window);
+
+      if (end == segment_end) {
+        break;
+      }
+
+      // The next window starts at the first keypose within overlap_sec of this one's last keypose
+      // (but always moves forward by at least one).
+      size_t next = end;
+      while (next > begin + 1 && (kps.at(end - 1).timestamp - kps.at(next - 1).timestamp) < params_.overlap_sec) {
+        --next;
+      }
+      begin = next;
+    }
+
+    segment_begin = segment_end;
+  }
+
+  return windows;
+}
+
+
+bool OfflineBundleAdjuster::SolveWindow(const MissionLog& log,
+                                        const Window& window,
+                                        SmootherResults& keyposes,
+                                        std::vector<bool>& refined) const
+{
+  BM_TRACE_SCOPE("OfflineBundleAdjuster::SolveWindow");
+
+  const MissionKeypose& first = log.keyposes.at(window.begin);
+  const MissionKeypose& last = log.keyposes.at(window.end - 1);
+  const size_t N = window.end - window.begin;
+
+  keyposes.resize(N);
+  refined.assign(N, false);
+  for (size_t i = 0; i < N; ++i) {
+    keyposes.at(i) = log.keyposes.at(window.begin + i).online;
+  }
+
+  // NOTE(milo): The lag covers the whole window, so nothing is ever marginalized.
+  FixedLagSmoother::Params smoother_params = smoother_params_;
+  smoother_params.smoother_lag_sec = (last.timestamp - first.timestamp) + 1.0;
+
+  // Only the IMU measurements around this window.
+  const auto imu_begin = std::lower_bound(log.imu.begin(), log.imu.end(),
+      first.timestamp - params_.allowed_misalignment_imu,
+      [](const ImuMeasurement& imu, seconds_t t) { return ConvertToSeconds(imu.timestamp) < t; });
+  const auto imu_end = std::upper_bound(imu_begin, log.imu.end(),
+      last.timestamp + params_.allowed_misalignment_imu,
+      [](seconds_t t, const ImuMeasurement& imu) { return t < ConvertToSeconds(imu.timestamp); });
+
+  ImuManager::Params imu_params = imu_params_;
+  imu_params.max_queue_size = std::max(imu_params.max_queue_size, static_cast<int>(imu_end - imu_begin) + 1);
+  ImuManager imu_manager(imu_params, "offline_ba_imu");
+  for (auto it = imu_begin; it != imu_end; ++it) {
+    imu_manager.Push(*it);
+  }
+
+  try {
+    FixedLagSmoother smoother(smoother_params);
+    smoother.Initialize(first.timestamp,
+                        first.online.world_P_body,
+                        first.online.world_v_body,
+                        first.online.imu_bias,
+                        first.online.has_imu_state);
+    imu_manager.ResetAndUpdateBias(first.online.imu_bias);
+
+    // Keypose ids in this smoother => index in the window.
+    std::map<uid_t, size_t> id_to_index;
+    id_to_index.emplace(smoother.GetResult().keypose_id, 0);
+
+    seconds_t from_time = first.timestamp;
+    for (size_t i = 1; i < N; ++i) {
+      const MissionKeypose& kp = log.keyposes.at(window.begin + i);
+
+      const PimResult pim = imu_manager.Preintegrate(from_time, kp.timestamp, params_.allowed_misalignment_imu);
+      const PimResult::ConstPtr maybe_pim_ptr = pim.timestamps_aligned ? std::make_shared<PimResult>(pim) : nullptr;
+
+      // Like online, a keypose without vision needs IMU to constrain it.
+      if (!kp.vo && !maybe_pim_ptr) {
+        continue;
+      }
+
+      const SmootherResult result = smoother.Update(kp.vo, maybe_pim_ptr, kp.depth, kp.attitude, kp.ranges);
+      id_to_index.emplace(result.keypose_id, i);
+      imu_manager.ResetAndUpdateBias(result.imu_bias);
+      from_time = kp.timestamp;
+    }
+
+    const gtsam::Values estimate = smoother.CalculateEstimate();
+    for (const auto& it : id_to_index) {
+      const gtsam::Symbol pose_sym('X', it.first);
+      const gtsam::Symbol vel_sym('V', it.first);
+      const gtsam::Symbol bias_sym('B', it.first);
+      if (!estimate.exists(pose_sym)) {
+        continue;
+      }
+      SmootherResult& out = keyposes.at(it.second);
+      out.world_P_body = estimate.at<gtsam::Pose3>(pose_sym);
+      out.has_imu_state = estimate.exists(vel_sym) && estimate.exists(bias_sym);
+      if (out.has_imu_state) {
+        out.world_v_body = estimate.at<gtsam::Vector3>(vel_sym);
+        out.imu_bias = estimate.at<ImuBias>(bias_sym);
+      }
+      refined.at(it.second) = true;
+    }
+  } catch (const std::exception& e) {
+    LOG(WARNING) << "Window [" << first.timestamp << ", " << last.timestamp << "] failed: " << e.what() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+OfflineBaResult OfflineBundleAdjuster::Solve(const MissionLog& log) const
+{
+  Timer timer(true);
+
+  OfflineBaResult result;
+  const size_t N = log.keyposes.size();
+  result.keyposes.resize(N);
+  result.refined.assign(N, false);
+  for (size_t i = 0; i < N; ++i) {
+    result.keyposes.at(i) = log.keyposes.at(i).online;
+  }
+  if (N == 0) {
+    return result;
+  }
+  result.mission_sec = log.keyposes.back().timestamp - log.keyposes.front().timestamp;
+
+  const std::vector<Window> windows = Segment(log);
+  result.num_windows = static_cast<int>(windows.size());
+
+  std::vector<SmootherResults> window_keyposes(windows.size());
+  std::vector<std::vector<bool>> window_refined(windows.size());
+  std::vector<int> window_ok(windows.size(), 0);
+
+  // NOTE(milo): ThreadPool(n) has n workers, plus the calling thread.
+  const int num_threads = (params_.num_threads > 0) ? params_.num_threads :
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  ThreadPool pool(num_threads - 1);
+  pool.ParallelFor(windows.size(), [&](size_t begin, size_t end)
+  {
+    for (size_t w = begin; w < end; ++w) {
+      window_ok.at(w) = SolveWindow(log, windows.at(w), window_keyposes.at(w), window_refined.at(w));
+    }
+  });
+
+  //===================================== STITCH THE WINDOWS =======================================
+  for (size_t w = 0; w < windows.size(); ++w) {
+    if (!window_ok.at(w)) {
+      ++result.num_failed_windows;
+      continue;
+    }
+
+    const Window& window = windows.at(w);
+    const SmootherResults& local = window_keyposes.at(w);
+    const std::vector<bool>& local_refined = window_refined.at(w);
+
+    // Find the keypose in the middle of the overlap with the last window (refined in both).
+    size_t switch_index = window.begin;
+    bool aligned = false;
+    if (w > 0 && window_ok.at(w - 1) && windows.at(w - 1).end > window.begin) {
+      const size_t overlap_end = windows.at(w - 1).end;
+      const seconds_t t_mid = 0.5 * (log.keyposes.at(window.begin).timestamp + log.keyposes.at(overlap_end - 1).timestamp);
+      double best_dt = std::numeric_limits<double>::max();
+      for (size_t i = window.begin; i < overlap_end; ++i) {
+        const double dt = std::fabs(log.keyposes.at(i).timestamp - t_mid);
+        if (result.refined.at(i) && local_refined.at(i - window.begin) && dt < best_dt) {
+          best_dt = dt;
+          switch_index = i;
+          aligned = true;
+        }
+      }
+    }
+
+    // Move the window rigidly onto the stitched trajectory at the switch keypose. The first window of
+    // each segment stays where its anchor put it.
+    const gtsam::Pose3 T_stitched_local = aligned ?
+        result.keyposes.at(switch_index).world_P_body * local.at(switch_index - window.begin).world_P_body.inverse() :
+        gtsam::Pose3::identity();
+
+    for (size_t i = (aligned ? switch_index : window.begin); i < window.end; ++i) {
+      if (!local_refined.at(i - window.begin)) {
+        continue;
+      }
+      SmootherResult& out = result.keyposes.at(i);
+      const SmootherResult& in = local.at(i - window.begin);
+      out.world_P_body = T_stitched_local * in.world_P_body;
+      out.has_imu_state = in.has_imu_state;
+      out.world_v_body = T_stitched_local.rotation() * in.world_v_body;
+      out.imu_bias = in.imu_bias;
+      result.refined.at(i) = true;
+    }
+  }
+
+  result.solve_sec = timer.Elapsed().seconds();
+  LOG(INFO) << "Solved " << result.num_windows << " windows (" << result.num_failed_windows << " failed) over "
+            << result.mission_sec << " sec of mission in " << result.solve_sec << " sec" << std::endl;
+
+  return result;
+}
+
+
+}
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "vio/fixed_lag_smoother.hpp"
+#include "vio/imu_manager.hpp"
+#include "vio/mission_log.hpp"
+#include "vio/smoother_result.hpp"
+
+namespace bm {
+namespace vio {
+
+
+// The refined trajectory of a whole mission: one keypose for each keypose in the MissionLog.
+struct OfflineBaResult final
+{
+  std::vector<SmootherResult, Eigen::aligned_allocator<SmootherResult>> keyposes;
+  std::vector<bool> refined;        // False if a keypose kept its online estimate (e.g no window solved it).
+
+  int num_windows = 0;
+  int num_failed_windows = 0;
+  double solve_sec = 0;             // Wall time of Solve().
+  double mission_sec = 0;           // From the first to the last keypose.
+};
+
+
+// Re-optimizes a recorded mission (see MissionLog) with the same factors as the online smoother.
+// The mission is cut into windows of window_sec that overlap by overlap_sec, and each window is
+// replayed through its own FixedLagSmoother, with a lag that covers the whole window, so that
+// nothing gets marginalized and the result is a full bundle adjustment of that window (smart stereo,
+// VO, IMU, depth, attitude and range factors). The windows are independent, so they're solved in
+// parallel, one per core.
+//
+// Each window is anchored at the online estimate of its first keypose. Windows are stitched in
+// order: each one is moved rigidly onto the one before it at the middle of their overlap, and
+// keyposes in the overlap come from the earlier window up to there, and from the later one after.
+//
+// NOTE(milo): Windows never span a keypose where the online smoother was reset (e.g after dead
+// reckoning), since there's no IMU or VO across the reset to connect them.
+class OfflineBundleAdjuster final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    double window_sec = 60.0;
+    double overlap_sec = 10.0;
+    int num_threads = 0;                  // Windows solved at once (0 is one per core).
+
+    // Replaces the smoother's extra_smoothing_iters, since there's no real-time budget offline.
+    int extra_smoothing_iters = 5;
+
+    // Replaces the smoother's landmark budget (see FixedLagSmoother::Params::max_smart_factors).
+    int max_smart_factors = 300;
+
+    double allowed_misalignment_imu = 0.05;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  // A range of keyposes [begin, end) from a MissionLog.
+  struct Window final
+  {
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(OfflineBundleAdjuster)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(OfflineBundleAdjuster)
+
+  // The smoother and IMU params should be the ones that the mission was recorded with.
+  OfflineBundleAdjuster(const Params& params,
+                        const FixedLagSmoother::Params& smoother_params,
+                        const ImuManager::Params& imu_params);
+
+  // Splits the keyposes into overlapping windows, in order.
+  std::vector<Window> Segment(const MissionLog& log) const;
+
+  OfflineBaResult Solve(const MissionLog& log) const;
+
+ private:
+  // Replays one window through a FixedLagSmoother. Fills in one result per keypose in the window
+  // (refined is false for keyposes that couldn't be added). Returns false if the window failed.
+  bool SolveWindow(const MissionLog& log,
+                   const Window& window,
+                   std::vector<SmootherResult, Eigen::aligned_allocator<SmootherResult>>& keyposes,
+                   std::vector<bool>& refined) const;
+
+ private:
+  Params params_;
+  FixedLagSmoother::Params smoother_params_;
+  ImuManager::Params imu_params_;
+};
+
+
+}
+}
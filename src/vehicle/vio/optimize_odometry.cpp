@@ -1,5 +1,8 @@
+#include <random>
+
 #include <eigen3/Eigen/QR>
 
+#include "core/frame_arena.hpp"
 #include "core/math_util.hpp"
 #include "core/transform_util.hpp"
 #include "vio/optimize_odometry.hpp"
@@ -8,125 +11,105 @@ namespace bm {
 namespace vio {
 
 
-int OptimizeOdometryIterative(const std::vector<Vector3d>& P0_list,
-                              const std::vector<Vector2d>& p1_obs_list,
-                              const std::vector<double>& p1_sigma_list,
-                              const StereoCamera& stereo_cam,
-                              Matrix4d& T_10,
-                              Matrix6d& C_10,
-                              double& error,
-                              std::vector<int>& inlier_indices,
-                              std::vector<int>& outlier_indices,
-                              int max_iters,
-                              double min_error,
-                              double min_error_delta,
-                              double max_error_stdevs)
+// Left-multiplies T by the exponential of the se3 increment T_eps.
+template <typename Scalar>
+static Matrix4T<Scalar> ApplyIncrement(const Vector6T<Scalar>& T_eps, const Matrix4T<Scalar>& T)
 {
-  // Do the initial pose optimization.
-  OptimizeOdometryLM(
-      P0_list, p1_obs_list, p1_sigma_list, stereo_cam,  // Inputs.
-      T_10, C_10, error,                                // Outputs.
-      max_iters, min_error, min_error_delta);           // Params.
-
-  RemovePointOutliers(T_10, P0_list, p1_obs_list, p1_sigma_list, stereo_cam, max_error_stdevs,
-                      inlier_indices, outlier_indices);
-
-  if (inlier_indices.size() < 6) {
-    T_10 = Matrix4d::Identity();
-    C_10 = Matrix6d::Identity();
-    return -1;
-  }
-
-  const std::vector<Vector3d>& P0_list_refined = Subset<Vector3d>(P0_list, inlier_indices);
-  const std::vector<Vector2d>& p1_obs_list_refined = Subset<Vector2d>(p1_obs_list, inlier_indices);
-  const std::vector<double>& p1_sigma_list_refined = Subset<double>(p1_sigma_list, inlier_indices);
-
-  const int N2 = OptimizeOdometryLM(
-      P0_list_refined, p1_obs_list_refined,
-      p1_sigma_list_refined, stereo_cam,                // Inputs.
-      T_10, C_10, error,                                // Outputs.
-      max_iters, min_error, min_error_delta);           // Params.
-
-  return N2;
+  return (ExpSE3<Scalar>(T_eps) * RigidT<Scalar>(T)).Matrix();
 }
 
 
-static double ComputeProjectionError(const std::vector<Vector3d>& P0_list,
-                                    const std::vector<Vector2d>& p1_obs_list,
-                                    const std::vector<double>& p1_sigma_list,
-                                    const StereoCamera& stereo_cam,
-                                    const Matrix4d& T_10)
+// NOTE(milo): The implementations are templated on the containers, so that they can run on lists
+// in a FrameArena (or std::vectors).
+template <typename Scalar, typename List3d, typename List2d, typename ListSigma>
+static Scalar ComputeProjectionError(const List3d& P0_list,
+                                     const List2d& p1_obs_list,
+                                     const ListSigma& p1_sigma_list,
+                                     const StereoCameraT<Scalar>& stereo_cam,
+                                     const Matrix4T<Scalar>& T_10)
 {
   assert(P0_list.size() == p1_obs_list.size());
   assert(p1_obs_list.size() == p1_sigma_list.size());
 
   const int M = P0_list.size();
 
-  double error = 0.0;
+  Scalar error = 0.0;
 
-  const PinholeCamera& cam = stereo_cam.LeftCamera();
+  const PinholeCameraT<Scalar>& cam = stereo_cam.LeftCamera();
 
   // Add up projection errors from all associated points.
   for (size_t i = 0; i < P0_list.size(); ++i) {
-    const Vector3d P1 = T_10.block<3, 3>(0, 0)*P0_list.at(i) + T_10.col(3).head(3);
+    const Vector3T<Scalar> P1 = T_10.template block<3, 3>(0, 0)*P0_list.at(i) + T_10.col(3).head(3);
 
     // Project P1 to a pixel location in Camera_1.
-    const Vector2d p = cam.Project(P1);
-    const Vector2d p_hat = p1_obs_list.at(i);
-    const double rx = p_hat.x() - p.x();
-    const double ry = p_hat.y() - p.y();
-    const double r2 = rx*rx + ry*ry;
-    const double r = std::sqrt(r2);
-    const double sigma = p1_sigma_list.at(i);
-    const double r_sigma = r / sigma;
+    const Vector2T<Scalar> p = cam.Project(P1);
+    const Vector2T<Scalar> p_hat = p1_obs_list.at(i);
+    const Scalar rx = p_hat.x() - p.x();
+    const Scalar ry = p_hat.y() - p.y();
+    const Scalar r2 = rx*rx + ry*ry;
+    const Scalar r = std::sqrt(r2);
+    const Scalar sigma = p1_sigma_list.at(i);
+    const Scalar r_sigma = r / sigma;
 
     error += r_sigma;
   }
 
-  return error / static_cast<double>(M);
+  return error / static_cast<Scalar>(M);
 }
 
 
-int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
-                                  const std::vector<Vector2d>& p1_obs_list,
-                                  const std::vector<double>& p1_sigma_list,
-                                  const StereoCamera& stereo_cam,
-                                  Matrix4d& T_10,
-                                  Matrix6d& C_10,
-                                  double& error,
+template <typename Scalar, typename List3d, typename List2d, typename ListSigma>
+static void LinearizeProjectionImpl(const List3d& P0_list,
+                                    const List2d& p1_obs_list,
+                                    const ListSigma& p1_sigma_list,
+                                    const StereoCameraT<Scalar>& stereo_cam,
+                                    const Matrix4T<Scalar>& T_10,
+                                    Matrix6T<Scalar>& H,
+                                    Vector6T<Scalar>& g,
+                                    Scalar& error);
+
+
+template <typename Scalar, typename List3d, typename List2d, typename ListSigma>
+static int OptimizeOdometryLMImpl(const List3d& P0_list,
+                                  const List2d& p1_obs_list,
+                                  const ListSigma& p1_sigma_list,
+                                  const StereoCameraT<Scalar>& stereo_cam,
+                                  Matrix4T<Scalar>& T_10,
+                                  Matrix6T<Scalar>& C_10,
+                                  Scalar& error,
                                   int max_iters,
                                   double min_error,
                                   double min_error_delta)
 {
   // Set the initial guess (if not already set).
   if (T_10(3, 3) != 1.0) {
-    T_10 = Matrix4d::Identity();
+    T_10 = Matrix4T<Scalar>::Identity();
   }
 
-  Matrix6d H;       // Current estimated Hessian of error w.r.t T_eps.
-  Vector6d g;       // Current estimated gradient of error w.r.t T_eps.
-  Vector6d T_eps;   // An incremental update to T_10.
-  double err_prev = 123;
-  double err = 123;
+  Matrix6T<Scalar> H;       // Current estimated Hessian of error w.r.t T_eps.
+  Vector6T<Scalar> g;       // Current estimated gradient of error w.r.t T_eps.
+  Vector6T<Scalar> T_eps;   // An incremental update to T_10.
+  Scalar err_prev = 123;
+  Scalar err = 123;
 
-  const double lambda_k_increase = 2.0;
-  const double lambda_k_decrease = 3.0;
+  const Scalar lambda_k_increase = 2.0;
+  const Scalar lambda_k_decrease = 3.0;
 
-  LinearizeProjection(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, H, g, err);
+  LinearizeProjectionImpl(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, H, g, err);
   err_prev = err + 1;
 
   // https://arxiv.org/pdf/1201.5885.pdf
-  double lambda = 8e-2;
+  Scalar lambda = 8e-2;
 
   int iters;
   for (iters = 0; iters < max_iters; ++iters) {
-    Matrix6d H_lm = H;
+    Matrix6T<Scalar> H_lm = H;
     H_lm.diagonal() += lambda*H.diagonal();
-    Eigen::ColPivHouseholderQR<Matrix6d> solver(H_lm);
+    Eigen::ColPivHouseholderQR<Matrix6T<Scalar>> solver(H_lm);
     T_eps = solver.solve(g);
 
     // Check if applying T_eps would improve error.
-    const Matrix4d T_10_test = expmap_se3(T_eps) * T_10;
+    const Matrix4T<Scalar> T_10_test = ApplyIncrement(T_eps, T_10);
     err = ComputeProjectionError(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10_test);
 
     if (err < min_error) {
@@ -149,7 +132,7 @@ int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
       T_10 = T_10_test;
 
       // Need to re-linearize because we updated T_10.
-      LinearizeProjection(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, H, g, err);
+      LinearizeProjectionImpl(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, H, g, err);
     }
   }
 
@@ -160,83 +143,336 @@ int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
 }
 
 
-void LinearizeProjection(const std::vector<Vector3d>& P0_list,
-                          const std::vector<Vector2d>& p1_obs_list,
-                          const std::vector<double>& p1_sigma_list,
-                          const StereoCamera& stereo_cam,
-                          const Matrix4d& T_10,
-                          Matrix6d& H,
-                          Vector6d& g,
-                          double& error)
+template <typename Scalar, typename List3d, typename List2d, typename ListSigma>
+static void LinearizeProjectionImpl(const List3d& P0_list,
+                                    const List2d& p1_obs_list,
+                                    const ListSigma& p1_sigma_list,
+                                    const StereoCameraT<Scalar>& stereo_cam,
+                                    const Matrix4T<Scalar>& T_10,
+                                    Matrix6T<Scalar>& H,
+                                    Vector6T<Scalar>& g,
+                                    Scalar& error)
 {
   assert(P0_list.size() == p1_obs_list.size());
   assert(p1_obs_list.size() == p1_sigma_list.size());
 
   const int M = P0_list.size();
 
-  // Initialize Jacobian w/ zeros.
-  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(M, 6);
-
-  // Initialize residual error vector R.
-  Eigen::VectorXd R = Eigen::VectorXd::Zero(M);
+  // NOTE(milo): Accumulate the normal equations H = J^T * J and g = -J^T * R one row at a time,
+  // so that nothing is allocated for the (M x 6) Jacobian.
+  H.setZero();
+  g.setZero();
 
   error = 0.0;             // Line projection error.
 
-  const PinholeCamera& cam = stereo_cam.LeftCamera();
+  const PinholeCameraT<Scalar>& cam = stereo_cam.LeftCamera();
+  const Scalar kEps = 1e-5;
 
   // Add up projection errors from all associated points.
   for (size_t i = 0; i < P0_list.size(); ++i) {
-    const Vector3d P1 = T_10.block<3, 3>(0, 0)*P0_list.at(i) + T_10.col(3).head(3);
+    const Vector3T<Scalar> P1 = T_10.template block<3, 3>(0, 0)*P0_list.at(i) + T_10.col(3).head(3);
 
     // TODO: filter out points that project behind the camera...
 
     // Project P1 to a pixel location in Camera_1.
-    const Vector2d p = cam.Project(P1);
-    const Vector2d p_hat = p1_obs_list.at(i);
-    const double rx = p_hat.x() - p.x();
-    const double ry = p_hat.y() - p.y();
-    const double r2 = rx*rx + ry*ry;
-    const double r = std::sqrt(r2);
-    const double sigma = p1_sigma_list.at(i);
-    const double r_sigma = r / sigma;
-    const double weight = RobustWeightCauchy(r_sigma);
-
-    const double chain_rule_terms = -weight / std::max(1e-5, sigma*r);
+    const Vector2T<Scalar> p = cam.Project(P1);
+    const Vector2T<Scalar> p_hat = p1_obs_list.at(i);
+    const Scalar rx = p_hat.x() - p.x();
+    const Scalar ry = p_hat.y() - p.y();
+    const Scalar r2 = rx*rx + ry*ry;
+    const Scalar r = std::sqrt(r2);
+    const Scalar sigma = p1_sigma_list.at(i);
+    const Scalar r_sigma = r / sigma;
+    const Scalar weight = RobustWeightCauchy(r_sigma);
+
+    const Scalar chain_rule_terms = -weight / std::max(kEps, sigma*r);
 
     // NOTE(milo): See page 54 for derivation of the Jacobian below.
     // https://jinyongjeong.github.io/Download/SE3/jlblanco2010geometry3d_techrep.pdf
-    const double gx = P1.x();
-    const double gy = P1.y();
-    const double gz = std::max(1e-5, P1.z());
-    const double gz2 = gz*gz;
-    const double fx = stereo_cam.fx();
-    const double fy = stereo_cam.fy();
-
-    Vector6d Ji;
+    const Scalar gx = P1.x();
+    const Scalar gy = P1.y();
+    const Scalar gz = std::max(kEps, P1.z());
+    const Scalar gz2 = gz*gz;
+    const Scalar fx = stereo_cam.fx();
+    const Scalar fy = stereo_cam.fy();
+
+    Vector6T<Scalar> Ji;
     Ji << + rx*fx / gz,
           + ry*fy / gz,
           - (rx*fx*gx + ry*fy*gy) / gz2,
-          - rx*fx*gx*gy/gz2 - ry*fy*(1.0 + gy*gy/gz2),
-          + rx*fx*(1.0 + gx*gx/gz2) + ry*fy*gx*gy/gz2,
+          - rx*fx*gx*gy/gz2 - ry*fy*(Scalar(1) + gy*gy/gz2),
+          + rx*fx*(Scalar(1) + gx*gx/gz2) + ry*fy*gx*gy/gz2,
           - rx*fx*gy/gz + ry*fy*gx/gz;
 
-    J.row(i) = chain_rule_terms * Ji;
-    R(i) = weight * r_sigma;
+    const Vector6T<Scalar> Ji_weighted = chain_rule_terms * Ji;
+    H.noalias() += Ji_weighted * Ji_weighted.transpose();
+    g.noalias() -= Ji_weighted * (weight * r_sigma);
     error += r_sigma;
   }
 
-  H = J.transpose() * J;
-  g = -J.transpose() * R;
-
   // Compute the AVERAGE error across all points.
-  error /= static_cast<double>(M);
+  error /= static_cast<Scalar>(M);
+}
+
+
+// Grabs the items from v at the given indices, in the arena (or on the heap if there's no arena).
+template <typename T>
+static ArenaVector<T> ArenaSubset(FrameArena* arena, const std::vector<T>& v, const std::vector<int>& indices)
+{
+  ArenaVector<T> out(arena ? ArenaAllocator<T>(*arena) : ArenaAllocator<T>());
+  out.reserve(indices.size());
+  for (int i : indices) {
+    out.emplace_back(v.at(i));
+  }
+  return out;
+}
+
+
+template <typename Scalar>
+int OptimizeOdometryIterative(const std::vector<Vector3T<Scalar>>& P0_list,
+                              const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                              const std::vector<Scalar>& p1_sigma_list,
+                              const StereoCameraT<Scalar>& stereo_cam,
+                              Matrix4T<Scalar>& T_10,
+                              Matrix6T<Scalar>& C_10,
+                              Scalar& error,
+                              std::vector<int>& inlier_indices,
+                              std::vector<int>& outlier_indices,
+                              int max_iters,
+                              double min_error,
+                              double min_error_delta,
+                              double max_error_stdevs,
+                              int ransac_hypotheses,
+                              FrameArena* arena)
+{
+  typedef Vector3T<Scalar> Vector3;
+  typedef Vector2T<Scalar> Vector2;
+
+  if (ransac_hypotheses > 0) {
+    RansacOdometry(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, max_error_stdevs,
+                   ransac_hypotheses, inlier_indices, outlier_indices);
+
+    if (inlier_indices.size() < 6) {
+      T_10 = Matrix4T<Scalar>::Identity();
+      C_10 = Matrix6T<Scalar>::Identity();
+      return -1;
+    }
+
+    // Refine once on the inliers, starting from the best hypothesis.
+    const ArenaVector<Vector3> P0_list_inliers = ArenaSubset<Vector3>(arena, P0_list, inlier_indices);
+    const ArenaVector<Vector2> p1_obs_list_inliers = ArenaSubset<Vector2>(arena, p1_obs_list, inlier_indices);
+    const ArenaVector<Scalar> p1_sigma_list_inliers = ArenaSubset<Scalar>(arena, p1_sigma_list, inlier_indices);
+
+    const int N = OptimizeOdometryLMImpl(
+        P0_list_inliers, p1_obs_list_inliers,
+        p1_sigma_list_inliers, stereo_cam,              // Inputs.
+        T_10, C_10, error,                              // Outputs.
+        max_iters, min_error, min_error_delta);         // Params.
+
+    // Re-classify with the refined pose (no second optimization).
+    RemovePointOutliers(T_10, P0_list, p1_obs_list, p1_sigma_list, stereo_cam, max_error_stdevs,
+                        inlier_indices, outlier_indices);
+    return N;
+  }
+
+  // Do the initial pose optimization.
+  OptimizeOdometryLMImpl(
+      P0_list, p1_obs_list, p1_sigma_list, stereo_cam,  // Inputs.
+      T_10, C_10, error,                                // Outputs.
+      max_iters, min_error, min_error_delta);           // Params.
+
+  RemovePointOutliers(T_10, P0_list, p1_obs_list, p1_sigma_list, stereo_cam, max_error_stdevs,
+                      inlier_indices, outlier_indices);
+
+  if (inlier_indices.size() < 6) {
+    T_10 = Matrix4T<Scalar>::Identity();
+    C_10 = Matrix6T<Scalar>::Identity();
+    return -1;
+  }
+
+  const ArenaVector<Vector3> P0_list_refined = ArenaSubset<Vector3>(arena, P0_list, inlier_indices);
+  const ArenaVector<Vector2> p1_obs_list_refined = ArenaSubset<Vector2>(arena, p1_obs_list, inlier_indices);
+  const ArenaVector<Scalar> p1_sigma_list_refined = ArenaSubset<Scalar>(arena, p1_sigma_list, inlier_indices);
+
+  const int N2 = OptimizeOdometryLMImpl(
+      P0_list_refined, p1_obs_list_refined,
+      p1_sigma_list_refined, stereo_cam,                // Inputs.
+      T_10, C_10, error,                                // Outputs.
+      max_iters, min_error, min_error_delta);           // Params.
+
+  return N2;
+}
+
+
+template <typename Scalar>
+int OptimizeOdometryLM(const std::vector<Vector3T<Scalar>>& P0_list,
+                       const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                       const std::vector<Scalar>& p1_sigma_list,
+                       const StereoCameraT<Scalar>& stereo_cam,
+                       Matrix4T<Scalar>& T_10,
+                       Matrix6T<Scalar>& C_10,
+                       Scalar& error,
+                       int max_iters,
+                       double min_error,
+                       double min_error_delta)
+{
+  return OptimizeOdometryLMImpl(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, C_10, error,
+                                max_iters, min_error, min_error_delta);
+}
+
+
+template <typename Scalar>
+void LinearizeProjection(const std::vector<Vector3T<Scalar>>& P0_list,
+                         const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                         const std::vector<Scalar>& p1_sigma_list,
+                         const StereoCameraT<Scalar>& stereo_cam,
+                         const Matrix4T<Scalar>& T_10,
+                         Matrix6T<Scalar>& H,
+                         Vector6T<Scalar>& g,
+                         Scalar& error)
+{
+  LinearizeProjectionImpl(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, H, g, error);
+}
+
+
+// Count (and optionally collect) the points with reprojection error < sigma * max_err_stdevs.
+template <typename Scalar>
+static int CountInliers(const std::vector<Vector3T<Scalar>>& P0_list,
+                        const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                        const std::vector<Scalar>& p1_sigma_list,
+                        const PinholeCameraT<Scalar>& cam,
+                        const Matrix4T<Scalar>& T_10,
+                        double max_err_stdevs)
+{
+  const Matrix3T<Scalar> R_10 = T_10.template block<3, 3>(0, 0);
+  const Vector3T<Scalar> t_10 = T_10.template block<3, 1>(0, 3);
+
+  int count = 0;
+  for (size_t i = 0; i < P0_list.size(); ++i) {
+    const Vector3T<Scalar> P1 = R_10 * P0_list[i] + t_10;
+    if (P1.z() <= 0) {
+      continue;
+    }
+    const Scalar thresh = p1_sigma_list[i] * max_err_stdevs;
+    if ((cam.Project(P1) - p1_obs_list[i]).squaredNorm() < (thresh * thresh)) {
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+
+// Fit T_10 to a minimal sample of 3 points with a few Gauss-Newton steps on the (2 x 6) projection
+// Jacobians. With 3 points, the 6x6 normal equations are exactly determined.
+template <typename Scalar>
+static bool FitMinimalSample(const std::vector<Vector3T<Scalar>>& P0_list,
+                             const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                             const PinholeCameraT<Scalar>& cam,
+                             const int sample[3],
+                             Matrix4T<Scalar>& T_10)
+{
+  static const int kGaussNewtonIters = 4;
+
+  const Scalar fx = cam.fx();
+  const Scalar fy = cam.fy();
+
+  for (int iter = 0; iter < kGaussNewtonIters; ++iter) {
+    Matrix6T<Scalar> H = Matrix6T<Scalar>::Zero();
+    Vector6T<Scalar> g = Vector6T<Scalar>::Zero();
+
+    for (int j = 0; j < 3; ++j) {
+      const Vector3T<Scalar> P1 = T_10.template block<3, 3>(0, 0)*P0_list[sample[j]] + T_10.col(3).head(3);
+      if (P1.z() <= 1e-3) {
+        return false;
+      }
+
+      const Vector2T<Scalar> r = p1_obs_list[sample[j]] - cam.Project(P1);
+
+      // Derivative of the projection w.r.t a (left) se3 perturbation [t, w].
+      const Scalar gx = P1.x();
+      const Scalar gy = P1.y();
+      const Scalar gz = P1.z();
+      const Scalar gz2 = gz*gz;
+
+      Eigen::Matrix<Scalar, 2, 6> Jp;
+      Jp << fx / gz, 0, -fx*gx / gz2, -fx*gx*gy / gz2, fx*(Scalar(1) + gx*gx / gz2), -fx*gy / gz,
+            0, fy / gz, -fy*gy / gz2, -fy*(Scalar(1) + gy*gy / gz2), fy*gx*gy / gz2, fy*gx / gz;
+
+      H.noalias() += Jp.transpose() * Jp;
+      g.noalias() += Jp.transpose() * r;
+    }
+
+    Eigen::ColPivHouseholderQR<Matrix6T<Scalar>> solver(H);
+    if (solver.rank() < 6) {
+      return false;
+    }
+
+    T_10 = ApplyIncrement<Scalar>(solver.solve(g), T_10);
+  }
+
+  return T_10.allFinite();
 }
 
-int RemovePointOutliers(const Matrix4d& T_10,
-                        const std::vector<Vector3d>& P0_list,
-                        const std::vector<Vector2d>& p1_obs_list,
-                        const std::vector<double>& p1_sigma_list,
-                        const StereoCamera& stereo_cam,
+
+template <typename Scalar>
+int RansacOdometry(const std::vector<Vector3T<Scalar>>& P0_list,
+                   const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                   const std::vector<Scalar>& p1_sigma_list,
+                   const StereoCameraT<Scalar>& stereo_cam,
+                   Matrix4T<Scalar>& T_10,
+                   double max_err_stdevs,
+                   int num_hypotheses,
+                   std::vector<int>& inlier_indices,
+                   std::vector<int>& outlier_indices)
+{
+  assert(P0_list.size() == p1_obs_list.size());
+  assert(p1_obs_list.size() == p1_sigma_list.size());
+
+  const PinholeCameraT<Scalar>& cam = stereo_cam.LeftCamera();
+  const int M = static_cast<int>(P0_list.size());
+
+  // Set the initial guess (if not already set).
+  if (T_10(3, 3) != 1.0) {
+    T_10 = Matrix4T<Scalar>::Identity();
+  }
+
+  const Matrix4T<Scalar> T_10_prior = T_10;
+  int best_count = CountInliers(P0_list, p1_obs_list, p1_sigma_list, cam, T_10, max_err_stdevs);
+
+  // NOTE(milo): Fixed seed so that results are repeatable.
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> dist(0, std::max(0, M - 1));
+
+  for (int h = 0; M >= 3 && h < num_hypotheses; ++h) {
+    int sample[3];
+    sample[0] = dist(rng);
+    do { sample[1] = dist(rng); } while (sample[1] == sample[0]);
+    do { sample[2] = dist(rng); } while (sample[2] == sample[0] || sample[2] == sample[1]);
+
+    Matrix4T<Scalar> T_10_hyp = T_10_prior;
+    if (!FitMinimalSample(P0_list, p1_obs_list, cam, sample, T_10_hyp)) {
+      continue;
+    }
+
+    const int count = CountInliers(P0_list, p1_obs_list, p1_sigma_list, cam, T_10_hyp, max_err_stdevs);
+    if (count > best_count) {
+      best_count = count;
+      T_10 = T_10_hyp;
+    }
+  }
+
+  return RemovePointOutliers(T_10, P0_list, p1_obs_list, p1_sigma_list, stereo_cam, max_err_stdevs,
+                             inlier_indices, outlier_indices);
+}
+
+
+template <typename Scalar>
+int RemovePointOutliers(const Matrix4T<Scalar>& T_10,
+                        const std::vector<Vector3T<Scalar>>& P0_list,
+                        const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                        const std::vector<Scalar>& p1_sigma_list,
+                        const StereoCameraT<Scalar>& stereo_cam,
                         double max_err_stdevs,
                         std::vector<int>& inlier_indices,
                         std::vector<int>& outlier_indices)
@@ -247,15 +483,15 @@ int RemovePointOutliers(const Matrix4d& T_10,
   inlier_indices.clear();
   outlier_indices.clear();
 
-  const PinholeCamera& cam = stereo_cam.LeftCamera();
+  const PinholeCameraT<Scalar>& cam = stereo_cam.LeftCamera();
 
   for (size_t i = 0; i < P0_list.size(); ++i) {
-    const Vector3d P1 = T_10.block<3, 3>(0, 0) * P0_list.at(i) + T_10.col(3).head(3);
-    const Vector2d p1 = cam.Project(P1);
+    const Vector3T<Scalar> P1 = T_10.template block<3, 3>(0, 0) * P0_list.at(i) + T_10.col(3).head(3);
+    const Vector2T<Scalar> p1 = cam.Project(P1);
 
     // Euclidean reprojection error.
-    const double e = (p1 - p1_obs_list.at(i)).norm();
-    const double sigma = p1_sigma_list.at(i);
+    const Scalar e = (p1 - p1_obs_list.at(i)).norm();
+    const Scalar sigma = p1_sigma_list.at(i);
     if (e < (sigma * max_err_stdevs)) {
       inlier_indices.emplace_back(i);
     } else {
@@ -267,5 +503,34 @@ int RemovePointOutliers(const Matrix4d& T_10,
 }
 
 
+#define INSTANTIATE_OPTIMIZE_ODOMETRY(Scalar) \
+  template int OptimizeOdometryIterative<Scalar>( \
+      const std::vector<Vector3T<Scalar>>&, const std::vector<Vector2T<Scalar>>&, \
+      const std::vector<Scalar>&, const StereoCameraT<Scalar>&, Matrix4T<Scalar>&, \
+      Matrix6T<Scalar>&, Scalar&, std::vector<int>&, std::vector<int>&, \
+      int, double, double, double, int, FrameArena*); \
+  template int OptimizeOdometryLM<Scalar>( \
+      const std::vector<Vector3T<Scalar>>&, const std::vector<Vector2T<Scalar>>&, \
+      const std::vector<Scalar>&, const StereoCameraT<Scalar>&, Matrix4T<Scalar>&, \
+      Matrix6T<Scalar>&, Scalar&, int, double, double); \
+  template void LinearizeProjection<Scalar>( \
+      const std::vector<Vector3T<Scalar>>&, const std::vector<Vector2T<Scalar>>&, \
+      const std::vector<Scalar>&, const StereoCameraT<Scalar>&, const Matrix4T<Scalar>&, \
+      Matrix6T<Scalar>&, Vector6T<Scalar>&, Scalar&); \
+  template int RansacOdometry<Scalar>( \
+      const std::vector<Vector3T<Scalar>>&, const std::vector<Vector2T<Scalar>>&, \
+      const std::vector<Scalar>&, const StereoCameraT<Scalar>&, Matrix4T<Scalar>&, \
+      double, int, std::vector<int>&, std::vector<int>&); \
+  template int RemovePointOutliers<Scalar>( \
+      const Matrix4T<Scalar>&, const std::vector<Vector3T<Scalar>>&, \
+      const std::vector<Vector2T<Scalar>>&, const std::vector<Scalar>&, \
+      const StereoCameraT<Scalar>&, double, std::vector<int>&, std::vector<int>&);
+
+INSTANTIATE_OPTIMIZE_ODOMETRY(double)
+INSTANTIATE_OPTIMIZE_ODOMETRY(float)
+
+#undef INSTANTIATE_OPTIMIZE_ODOMETRY
+
+
 }
 }
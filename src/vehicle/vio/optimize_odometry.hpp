@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "core/eigen_types.hpp"
+#include "core/frame_arena.hpp"
 #include "vision_core/stereo_camera.hpp"
 
 namespace bm {
@@ -12,40 +13,54 @@ using namespace core;
 
 
 // See: https://arxiv.org/pdf/1701.03077.pdf
-inline double RobustWeightCauchy(double residual)
+template <typename Scalar>
+inline Scalar RobustWeightCauchy(Scalar residual)
 {
-  return 1.0 / (1.0 + residual*residual);
+  return Scalar(1) / (Scalar(1) + residual*residual);
 }
 
 
+// NOTE(milo): Everything below is templated on the scalar type, and explicitly instantiated for
+// float and double in optimize_odometry.cpp. The frontend can run in float (twice the SIMD lanes),
+// and the result is cast back to double for the smoother (see StereoFrontend::Params).
+
 /**
  * Optimize the relative pose between two cameras using matched features. This pose is optimized
  * once, and then outlier features are removed before a refinement stage.
  *
+ * If ransac_hypotheses > 0, outliers are removed up front by RansacOdometry() instead, and the
+ * LM optimization only runs once (on the inliers). T_10 is used as the initial guess either way.
+ *
+ * If an arena is given, the inlier subsets are allocated from it (e.g the frontend's FrameArena).
+ *
  * @param[out] inlier_indices : The indices of inlier features in P0_list and p1_obs_list.
  */
-int OptimizeOdometryIterative(const std::vector<Vector3d>& P0_list,
-                              const std::vector<Vector2d>& p1_obs_list,
-                              const std::vector<double>& p1_sigma_list,
-                              const StereoCamera& stereo_cam,
-                              Matrix4d& T_10,
-                              Matrix6d& C_10,
-                              double& error,
+template <typename Scalar>
+int OptimizeOdometryIterative(const std::vector<Vector3T<Scalar>>& P0_list,
+                              const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                              const std::vector<Scalar>& p1_sigma_list,
+                              const StereoCameraT<Scalar>& stereo_cam,
+                              Matrix4T<Scalar>& T_10,
+                              Matrix6T<Scalar>& C_10,
+                              Scalar& error,
                               std::vector<int>& inlier_indices,
                               std::vector<int>& outlier_indices,
                               int max_iters,
                               double min_error,
                               double min_error_delta,
-                              double max_error_stdevs);
+                              double max_error_stdevs,
+                              int ransac_hypotheses = 0,
+                              FrameArena* arena = nullptr);
 
 
-int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
-                      const std::vector<Vector2d>& p1_obs_list,
-                      const std::vector<double>& p1_sigma_list,
-                      const StereoCamera& stereo_cam,
-                      Matrix4d& T_10,
-                      Matrix6d& C_10,
-                      double& error,
+template <typename Scalar>
+int OptimizeOdometryLM(const std::vector<Vector3T<Scalar>>& P0_list,
+                      const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                      const std::vector<Scalar>& p1_sigma_list,
+                      const StereoCameraT<Scalar>& stereo_cam,
+                      Matrix4T<Scalar>& T_10,
+                      Matrix6T<Scalar>& C_10,
+                      Scalar& error,
                       int max_iters,
                       double min_error,
                       double min_error_delta);
@@ -67,21 +82,47 @@ int OptimizeOdometryLM(const std::vector<Vector3d>& P0_list,
  * @param g (output) : The gradient at this linearization point.
  * @param error (output) : The (weighted) sum of squared projection error.
  */
-void LinearizeProjection(const std::vector<Vector3d>& P0_list,
-                        const std::vector<Vector2d>& p1_obs_list,
-                        const std::vector<double>& p1_sigma_list,
-                        const StereoCamera& stereo_cam,
-                        const Matrix4d& T_10,
-                        Matrix6d& H,
-                        Vector6d& g,
-                        double& error);
-
-
-int RemovePointOutliers(const Matrix4d& T_10,
-                        const std::vector<Vector3d>& P0_list,
-                        const std::vector<Vector2d>& p1_obs_list,
-                        const std::vector<double>& p1_sigma_list,
-                        const StereoCamera& stereo_cam,
+template <typename Scalar>
+void LinearizeProjection(const std::vector<Vector3T<Scalar>>& P0_list,
+                        const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                        const std::vector<Scalar>& p1_sigma_list,
+                        const StereoCameraT<Scalar>& stereo_cam,
+                        const Matrix4T<Scalar>& T_10,
+                        Matrix6T<Scalar>& H,
+                        Vector6T<Scalar>& g,
+                        Scalar& error);
+
+
+/**
+ * Preemptive outlier rejection with a fixed budget of hypotheses, so that the cost doesn't depend
+ * on the outlier ratio. Each hypothesis is fit to a minimal sample of 3 points (6 residuals) with
+ * a few Gauss-Newton steps, starting from the initial guess in T_10. The initial guess is also
+ * scored as a hypothesis, so a good prior is never made worse. The hypothesis with the most inliers
+ * (reprojection error < sigma * max_err_stdevs) is returned in T_10.
+ *
+ * NOTE(milo): Starting from the prior (rather than a closed-form P3P solution) is fine for
+ * frame-to-keyframe odometry, where the motion is small.
+ *
+ * @return The number of inliers for the best hypothesis.
+ */
+template <typename Scalar>
+int RansacOdometry(const std::vector<Vector3T<Scalar>>& P0_list,
+                   const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                   const std::vector<Scalar>& p1_sigma_list,
+                   const StereoCameraT<Scalar>& stereo_cam,
+                   Matrix4T<Scalar>& T_10,
+                   double max_err_stdevs,
+                   int num_hypotheses,
+                   std::vector<int>& inlier_indices,
+                   std::vector<int>& outlier_indices);
+
+
+template <typename Scalar>
+int RemovePointOutliers(const Matrix4T<Scalar>& T_10,
+                        const std::vector<Vector3T<Scalar>>& P0_list,
+                        const std::vector<Vector2T<Scalar>>& p1_obs_list,
+                        const std::vector<Scalar>& p1_sigma_list,
+                        const StereoCameraT<Scalar>& stereo_cam,
                         double max_err_stdevs,
                         std::vector<int>& inlier_indices,
                         std::vector<int>& outlier_indices);
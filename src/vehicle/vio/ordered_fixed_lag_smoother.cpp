@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <set>
+
+#include <glog/logging.h>
+
+#include "vio/ordered_fixed_lag_smoother.hpp"
+
+namespace bm {
+namespace vio {
+
+
+// Marks the frontal keys of every clique below "clique" that has "key" in its separator. These get
+// re-eliminated so that "key" can be marginalized as a leaf (same as IncrementalFixedLagSmoother).
+static void MarkAffectedKeys(gtsam::Key key,
+                             const gtsam::ISAM2Clique::shared_ptr& clique,
+                             std::set<gtsam::Key>& additional_keys)
+{
+  const auto& conditional = clique->conditional();
+  if (std::find(conditional->beginParents(), conditional->endParents(), key) == conditional->endParents()) {
+    return;
+  }
+  for (const gtsam::Key frontal : conditional->frontals()) {
+    additional_keys.insert(frontal);
+  }
+  for (const gtsam::ISAM2Clique::shared_ptr& child : clique->children) {
+    MarkAffectedKeys(key, child, additional_keys);
+  }
+}
+
+
+OrderedFixedLagSmoother::Result OrderedFixedLagSmoother::update(
+    const gtsam::NonlinearFactorGraph& newFactors,
+    const gtsam::Values& newTheta,
+    const KeyTimestampMap& timestamps,
+    const gtsam::FactorIndices& factorsToRemove)
+{
+  if (!newest_keys_last_) {
+    return gtsam::IncrementalFixedLagSmoother::update(newFactors, newTheta, timestamps, factorsToRemove);
+  }
+
+  updateKeyTimestampMap(timestamps);
+
+  const double current_timestamp = getCurrentTimestamp();
+  const gtsam::KeyVector marginalizable_keys = findKeysBefore(current_timestamp - smootherLag_);
+  const gtsam::KeyVector newest_keys = findKeysAfter(current_timestamp);
+
+  // Ordering groups: about to be marginalized (0), everything else (1), newest keypose (2).
+  gtsam::FastMap<gtsam::Key, int> constrained_keys;
+  for (const auto& it : keyTimestampMap_) {
+    constrained_keys[it.first] = 1;
+  }
+  for (const gtsam::Key key : marginalizable_keys) {
+    constrained_keys[key] = 0;
+  }
+  for (const gtsam::Key key : newest_keys) {
+    constrained_keys[key] = 2;
+  }
+
+  std::set<gtsam::Key> additional_keys;
+  for (const gtsam::Key key : marginalizable_keys) {
+    for (const gtsam::ISAM2Clique::shared_ptr& child : isam_[key]->children) {
+      MarkAffectedKeys(key, child, additional_keys);
+    }
+  }
+
+  gtsam::ISAM2UpdateParams update_params;
+  update_params.removeFactorIndices = factorsToRemove;
+  update_params.constrainedKeys = constrained_keys;
+  update_params.extraReelimKeys = gtsam::FastList<gtsam::Key>(additional_keys.begin(), additional_keys.end());
+  isamResult_ = isam_.update(newFactors, newTheta, update_params);
+
+  if (!marginalizable_keys.empty()) {
+    const gtsam::FastList<gtsam::Key> leaf_keys(marginalizable_keys.begin(), marginalizable_keys.end());
+    isam_.marginalizeLeaves(leaf_keys);
+  }
+  eraseKeyTimestampMap(marginalizable_keys);
+
+  Result result;
+  result.iterations = 1;
+  return result;
+}
+
+
+bool OrderedFixedLagSmoother::RootCliqueMarginals(const gtsam::KeyVector& keys,
+                                                  std::vector<gtsam::Matrix>& marginals) const
+{
+  CHECK(!keys.empty());
+  const auto it = isam_.nodes().find(keys.front());
+  if (it == isam_.nodes().end() || !it->second || it->second->parent()) {
+    return false;
+  }
+
+  const gtsam::GaussianConditional::shared_ptr& conditional = it->second->conditional();
+  if (conditional->nrParents() > 0 || (conditional->get_model() && !conditional->get_model()->isUnit())) {
+    return false;
+  }
+
+  std::vector<int> offsets;
+  std::vector<int> dims;
+  for (const gtsam::Key key : keys) {
+    int offset = 0;
+    gtsam::GaussianConditional::const_iterator frontal = conditional->beginFrontals();
+    for (; frontal != conditional->endFrontals() && *frontal != key; ++frontal) {
+      offset += static_cast<int>(conditional->getDim(frontal));
+    }
+    if (frontal == conditional->endFrontals()) {
+      return false;
+    }
+    offsets.emplace_back(offset);
+    dims.emplace_back(static_cast<int>(conditional->getDim(frontal)));
+  }
+
+  // Sigma = (R^T R)^-1 = R^-1 R^-T
+  const gtsam::Matrix R = conditional->R();
+  const gtsam::Matrix R_inv = R.triangularView<Eigen::Upper>().solve(gtsam::Matrix::Identity(R.rows(), R.cols()));
+  const gtsam::Matrix Sigma = R_inv * R_inv.transpose();
+
+  marginals.clear();
+  for (size_t i = 0; i < keys.size(); ++i) {
+    marginals.emplace_back(Sigma.block(offsets.at(i), offsets.at(i), dims.at(i), dims.at(i)));
+  }
+
+  return true;
+}
+
+
+}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <gtsam_unstable/nonlinear/IncrementalFixedLagSmoother.h>
+
+namespace bm {
+namespace vio {
+
+
+// Same as gtsam::IncrementalFixedLagSmoother, but can also force the variables at the newest
+// timestamp (i.e the newest keypose) to be eliminated LAST. The base class only constrains the
+// variables that are about to be marginalized (eliminated first), and leaves the rest of the
+// ordering to CCOLAMD, which can put the newest keypose deep in the Bayes tree. Keeping it at the
+// root means that the next keypose only has to re-eliminate a small part of the tree.
+class OrderedFixedLagSmoother final : public gtsam::IncrementalFixedLagSmoother {
+ public:
+  explicit OrderedFixedLagSmoother(double smoother_lag = 0.0,
+                                   const gtsam::ISAM2Params& params = gtsam::ISAM2Params(),
+                                   bool newest_keys_last = false)
+      : gtsam::IncrementalFixedLagSmoother(smoother_lag, params),
+        newest_keys_last_(newest_keys_last) {}
+
+  Result update(const gtsam::NonlinearFactorGraph& newFactors = gtsam::NonlinearFactorGraph(),
+                const gtsam::Values& newTheta = gtsam::Values(),
+                const KeyTimestampMap& timestamps = KeyTimestampMap(),
+                const gtsam::FactorIndices& factorsToRemove = gtsam::FactorIndices()) override;
+
+  // If all of the keys are frontal variables of a root clique (e.g the newest keypose, when it's
+  // eliminated last), their joint marginal is just that clique's conditional. This gets all of their
+  // marginal covariances with one small dense inverse, instead of a Bayes tree marginalization for
+  // each key. Returns false if the keys aren't all in the same root clique.
+  bool RootCliqueMarginals(const gtsam::KeyVector& keys, std::vector<gtsam::Matrix>& marginals) const;
+
+ private:
+  bool newest_keys_last_ = false;
+};
+
+
+}
+}
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "vio/pose_history.hpp"
+
+namespace bm {
+namespace vio {
+
+
+// Revised keyposes have the same timestamp as when they were added.
+static const seconds_t kSameTimestampSec = 1e-6;
+
+
+Matrix4d PoseStamped::world_T_body() const
+{
+  Matrix4d T = Matrix4d::Identity();
+  T.block<3, 3>(0, 0) = world_q_body.toRotationMatrix();
+  T.block<3, 1>(0, 3) = world_t_body;
+  return T;
+}
+
+
+PoseStamped InterpolatePose(const PoseStamped& a, const PoseStamped& b, seconds_t timestamp)
+{
+  const double dt = b.timestamp - a.timestamp;
+  const double alpha = (dt > 0) ? std::min(1.0, std::max(0.0, (timestamp - a.timestamp) / dt)) : 0.0;
+  return PoseStamped(timestamp,
+                     a.world_q_body.slerp(alpha, b.world_q_body),
+                     (1.0 - alpha) * a.world_t_body + alpha * b.world_t_body);
+}
+
+
+PoseRing::PoseRing(size_t capacity) : buffer_(capacity)
+{
+  CHECK_GT(capacity, 0ul) << "PoseRing needs a capacity > 0" << std::endl;
+}
+
+
+void PoseRing::BeginWrite()
+{
+  seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+
+void PoseRing::EndWrite()
+{
+  seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+uint64_t PoseRing::BeginRead() const
+{
+  uint64_t seq = seq_.load(std::memory_order_acquire);
+  while (seq & 1) {
+    seq = seq_.load(std::memory_order_acquire);
+  }
+  return seq;
+}
+
+
+bool PoseRing::EndRead(uint64_t seq) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return seq_.load(std::memory_order_relaxed) == seq;
+}
+
+
+PoseStamped PoseRing::CopyAt(size_t physical) const
+{
+  PoseStamped pose;
+  std::memcpy(static_cast<void*>(&pose), &buffer_[physical % buffer_.size()], sizeof(PoseStamped));
+  return pose;
+}
+
+
+size_t PoseRing::LowerBound(seconds_t t, size_t head, size_t size) const
+{
+  size_t lo = 0;
+  size_t hi = size;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (CopyAt(head + mid).timestamp < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+void PoseRing::Add(const PoseStamped& pose)
+{
+  const size_t capacity = buffer_.size();
+  size_t head = head_.load(std::memory_order_relaxed);
+  size_t size = size_.load(std::memory_order_relaxed);
+
+  BeginWrite();
+
+  if (size > 0 && pose.timestamp <= buffer_[(head + size - 1) % capacity].timestamp) {
+    size = LowerBound(pose.timestamp, head, size);
+  }
+  if (size == capacity) {
+    head = (head + 1) % capacity;
+    --size;
+  }
+  buffer_[(head + size) % capacity] = pose;
+  head_.store(head, std::memory_order_relaxed);
+  size_.store(size + 1, std::memory_order_relaxed);
+
+  EndWrite();
+}
+
+
+size_t PoseRing::Revise(const std::vector<PoseStamped>& poses)
+{
+  const size_t capacity = buffer_.size();
+  const size_t head = head_.load(std::memory_order_relaxed);
+  const size_t size = size_.load(std::memory_order_relaxed);
+
+  size_t num_revised = 0;
+
+  BeginWrite();
+  for (const PoseStamped& pose : poses) {
+    const size_t i = LowerBound(pose.timestamp - kSameTimestampSec, head, size);
+    if (i < size && std::fabs(buffer_[(head + i) % capacity].timestamp - pose.timestamp) <= kSameTimestampSec) {
+      buffer_[(head + i) % capacity] = pose;
+      ++num_revised;
+    }
+  }
+  EndWrite();
+
+  return num_revised;
+}
+
+
+void PoseRing::Clear()
+{
+  BeginWrite();
+  size_.store(0, std::memory_order_relaxed);
+  EndWrite();
+}
+
+
+bool PoseRing::Lookup(seconds_t timestamp, PoseStamped& pose) const
+{
+  const size_t capacity = buffer_.size();
+  PoseStamped out;
+  bool found = false;
+  uint64_t seq = 0;
+
+  do {
+    seq = BeginRead();
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t size = std::min(size_.load(std::memory_order_relaxed), capacity);
+
+    found = false;
+    const size_t i = LowerBound(timestamp, head, size);
+    if (i < size) {
+      const PoseStamped after = CopyAt(head + i);
+      if (after.timestamp == timestamp) {
+        out = after;
+        found = true;
+      } else if (i > 0) {
+        out = InterpolatePose(CopyAt(head + i - 1), after, timestamp);
+        found = true;
+      }
+    }
+  } while (!EndRead(seq));
+
+  if (found) {
+    pose = out;
+  }
+  return found;
+}
+
+
+bool PoseRing::TimeRange(seconds_t& oldest, seconds_t& newest) const
+{
+  const size_t capacity = buffer_.size();
+  size_t size = 0;
+  uint64_t seq = 0;
+
+  do {
+    seq = BeginRead();
+    const size_t head = head_.load(std::memory_order_relaxed);
+    size = std::min(size_.load(std::memory_order_relaxed), capacity);
+    if (size > 0) {
+      oldest = CopyAt(head).timestamp;
+      newest = CopyAt(head + size - 1).timestamp;
+    }
+  } while (!EndRead(seq));
+
+  return size > 0;
+}
+
+
+bool PoseHistory::Lookup(seconds_t timestamp, PoseStamped& pose, Source* source) const
+{
+  if (smoother_.Lookup(timestamp, pose)) {
+    if (source) { *source = Source::SMOOTHER; }
+    return true;
+  }
+  if (filter_.Lookup(timestamp, pose)) {
+    if (source) { *source = Source::FILTER; }
+    return true;
+  }
+  return false;
+}
+
+
+}
+}
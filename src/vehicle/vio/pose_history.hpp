@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// A pose of the body in the world at some time.
+struct PoseStamped final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  PoseStamped() = default;
+
+  PoseStamped(seconds_t timestamp, const Quaterniond& world_q_body, const Vector3d& world_t_body)
+      : timestamp(timestamp), world_q_body(world_q_body), world_t_body(world_t_body) {}
+
+  seconds_t timestamp = 0;
+  Quaterniond world_q_body = Quaterniond::Identity();
+  Vector3d world_t_body = Vector3d::Zero();
+
+  Matrix4d world_T_body() const;
+};
+
+
+// Interpolates between two poses (slerp for the rotation, linear for the translation). The
+// timestamp must be within [a.timestamp, b.timestamp].
+PoseStamped InterpolatePose(const PoseStamped& a, const PoseStamped& b, seconds_t timestamp);
+
+
+// A time-sorted ring of poses with a fixed capacity, for ONE writer thread and ANY number of reader
+// threads. Like SeqLock, a writer never waits for readers: each write bumps a sequence number, and
+// a reader that overlapped one just searches again. Lookups are a binary search + interpolation.
+//
+// NOTE(milo): Writes are small (one pose, or a few revised keyposes), so readers only ever spin for
+// about as long as a copy of those takes.
+class PoseRing final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(PoseRing)
+
+  explicit PoseRing(size_t capacity);
+
+  // Writer only. Adds a pose to the end. Poses with a timestamp >= this one are replaced (e.g after
+  // the smoother is reset). If the ring is full, the oldest pose is dropped.
+  void Add(const PoseStamped& pose);
+
+  // Writer only. Overwrites poses with the same timestamps (within 1us) in place, and ignores any that
+  // aren't in the ring. Returns the number that were revised.
+  size_t Revise(const std::vector<PoseStamped>& poses);
+
+  // Writer only.
+  void Clear();
+
+  // Any thread. Interpolates the pose at timestamp from the two poses around it. Returns false if
+  // timestamp is outside of the ring (no extrapolation).
+  bool Lookup(seconds_t timestamp, PoseStamped& pose) const;
+
+  // Any thread. Returns false if the ring is empty.
+  bool TimeRange(seconds_t& oldest, seconds_t& newest) const;
+
+  // Any thread. The number of writes so far (e.g to tell whether anything changed since a lookup).
+  uint64_t Version() const { return seq_.load(std::memory_order_acquire) / 2; }
+
+  size_t Size() const { return size_.load(std::memory_order_acquire); }
+  size_t Capacity() const { return buffer_.size(); }
+
+ private:
+  // Index (0 is the oldest) of the first pose with a timestamp >= t, or size if there isn't one.
+  size_t LowerBound(seconds_t t, size_t head, size_t size) const;
+
+  // Reads of shared state are only valid if the sequence didn't change (see Lookup()).
+  uint64_t BeginRead() const;
+  bool EndRead(uint64_t seq) const;
+
+  void BeginWrite();
+  void EndWrite();
+
+  // NOTE(milo): A reader can see a pose that is being overwritten, so it copies each one before
+  // using it, and throws away the result if the sequence changed.
+  PoseStamped CopyAt(size_t physical) const;
+
+  std::vector<PoseStamped, Eigen::aligned_allocator<PoseStamped>> buffer_;
+  std::atomic<size_t> head_{0};     // Physical index of the oldest pose.
+  std::atomic<size_t> size_{0};
+  std::atomic<uint64_t> seq_{0};    // Odd while a write is in progress.
+};
+
+
+// The history of poses from the smoother (keyposes, revised as the smoother updates them) and the
+// filter (every filter state), so that any module can ask for "the pose at time t" without buffering
+// callbacks itself (e.g the mesher, image enhancement, evaluation and relocalization).
+//
+// The smoother and filter each write their own ring (from their own thread). Lookup() uses the
+// smoother's keyposes wherever they cover the timestamp, since they're better estimates, and falls
+// back to the filter (e.g for the time since the newest keypose).
+class PoseHistory final {
+ public:
+  enum class Source { SMOOTHER, FILTER };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PoseHistory)
+
+  PoseHistory(size_t smoother_capacity, size_t filter_capacity)
+      : smoother_(smoother_capacity), filter_(filter_capacity) {}
+
+  // Only call these from one thread at a time (per source).
+  PoseRing& Ring(Source source) { return (source == Source::SMOOTHER) ? smoother_ : filter_; }
+  void AddSmoother(const PoseStamped& pose) { smoother_.Add(pose); }
+  size_t ReviseSmoother(const std::vector<PoseStamped>& poses) { return smoother_.Revise(poses); }
+  void AddFilter(const PoseStamped& pose) { filter_.Add(pose); }
+
+  // Lock-free, from any thread. If source isn't null, it's set to whichever ring had the pose.
+  bool Lookup(seconds_t timestamp, PoseStamped& pose, Source* source = nullptr) const;
+
+  const PoseRing& Ring(Source source) const { return (source == Source::SMOOTHER) ? smoother_ : filter_; }
+
+ private:
+  PoseRing smoother_;
+  PoseRing filter_;
+};
+
+
+}
+}
@@ -0,0 +1,279 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include <opencv2/calib3d.hpp>
+
+#include "vio/relocalizer.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void Relocalizer::Params::LoadParams(const YamlParser& parser)
+{
+  vocabulary_path = YamlToString(parser.GetNode("vocabulary_path"));
+  parser.GetParam("vocabulary_branching", &vocabulary_branching);
+  parser.GetParam("vocabulary_depth", &vocabulary_depth);
+  parser.GetParam("train_keyframes", &train_keyframes);
+  parser.GetParam("max_features", &max_features);
+  parser.GetParam("min_sec_btw_keyframes", &min_sec_btw_keyframes);
+  parser.GetParam("max_candidates", &max_candidates);
+  parser.GetParam("min_score", &min_score);
+  parser.GetParam("max_match_distance", &max_match_distance);
+  parser.GetParam("match_ratio", &match_ratio);
+  parser.GetParam("max_stereo_dy", &max_stereo_dy);
+  parser.GetParam("min_disparity", &min_disparity);
+  parser.GetParam("min_inliers", &min_inliers);
+  parser.GetParam("ransac_reproj_err", &ransac_reproj_err);
+  parser.GetParam("ransac_iters", &ransac_iters);
+  parser.GetParam("sigma_rotation", &sigma_rotation);
+  parser.GetParam("sigma_translation", &sigma_translation);
+
+  YamlToMatrix<Matrix4d>(parser.GetNode("/shared/stereo_forward/camera_left/body_T_cam"), body_T_cam);
+
+  CHECK_GE(vocabulary_branching, 2);
+  CHECK_GE(vocabulary_depth, 1);
+  CHECK_GE(train_keyframes, 1);
+  CHECK_GE(min_inliers, 4) << "PnP needs at least 4 points" << std::endl;
+  CHECK_GT(sigma_rotation, 0);
+  CHECK_GT(sigma_translation, 0);
+}
+
+
+// Index of the descriptor closest to d, if it passes the distance and ratio tests (otherwise -1).
+static int FindMatch(const Descriptor256& d,
+                     const VecDescriptor256& candidates,
+                     int max_distance,
+                     double ratio)
+{
+  int best = -1;
+  int best_dist = std::numeric_limits<int>::max();
+  int second_dist = std::numeric_limits<int>::max();
+  for (size_t j = 0; j < candidates.size(); ++j) {
+    const int dist = HammingDistance(d, candidates[j]);
+    if (dist < best_dist) {
+      second_dist = best_dist;
+      best_dist = dist;
+      best = static_cast<int>(j);
+    } else if (dist < second_dist) {
+      second_dist = dist;
+    }
+  }
+
+  const bool passes_ratio = second_dist == std::numeric_limits<int>::max() || best_dist < ratio * second_dist;
+  return (best_dist <= max_distance && passes_ratio) ? best : -1;
+}
+
+
+Relocalizer::Relocalizer(const Params& params,
+                         const StereoCamera& stereo_rig,
+                         BowVocabulary::ConstPtr vocabulary)
+    : params_(params),
+      stereo_rig_(stereo_rig),
+      orb_(cv::ORB::create(params_.max_features)),
+      vocabulary_(vocabulary)
+{
+  if (!vocabulary_ && !params_.vocabulary_path.empty()) {
+    vocabulary_ = BowVocabulary::LoadShared(params_.vocabulary_path);
+    LOG_IF(INFO, vocabulary_) << "Loaded BowVocabulary with " << vocabulary_->NumWords()
+                              << " words from " << params_.vocabulary_path << std::endl;
+  }
+
+  if (vocabulary_ && !vocabulary_->Empty()) {
+    MaybeBuildDatabase();
+  } else {
+    vocabulary_ = nullptr;
+  }
+}
+
+
+void Relocalizer::Detect(const Image1b& image, std::vector<cv::KeyPoint>& keypoints, VecDescriptor256& descriptors)
+{
+  cv::Mat desc;
+  orb_->detectAndCompute(image, cv::noArray(), keypoints, desc);
+  CHECK(desc.empty() || desc.cols == sizeof(Descriptor256)) << "Expected 256-bit ORB descriptors" << std::endl;
+
+  descriptors.resize(keypoints.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    std::memcpy(descriptors[i].data(), desc.ptr<uint8_t>(static_cast<int>(i)), sizeof(Descriptor256));
+  }
+}
+
+
+bool Relocalizer::AddKeyframe(const StereoImage1b& stereo_pair, const Matrix4d& world_T_body)
+{
+  if (!keyframes_.empty() &&
+      ConvertToSeconds(stereo_pair.timestamp - last_keyframe_time_) < params_.min_sec_btw_keyframes) {
+    return false;
+  }
+
+  std::vector<cv::KeyPoint> left_kp, right_kp;
+  VecDescriptor256 left_desc, right_desc;
+  Detect(stereo_pair.left_image, left_kp, left_desc);
+  Detect(stereo_pair.right_image, right_kp, right_desc);
+
+  Keyframe kf;
+  kf.id = keyframes_.size();
+  kf.world_T_cam = world_T_body * params_.body_T_cam;
+
+  // Match along the epipolar line (the same row in rectified images), and keep the keypoints that
+  // have a 3D point.
+  // NOTE(milo): Brute force is fine here, since this only runs once per keyframe.
+  VecDescriptor256 row_desc;
+  std::vector<int> row_index;
+  for (size_t i = 0; i < left_kp.size(); ++i) {
+    const cv::Point2f& pl = left_kp[i].pt;
+    row_desc.clear();
+    row_index.clear();
+    for (size_t j = 0; j < right_kp.size(); ++j) {
+      const cv::Point2f& pr = right_kp[j].pt;
+      if (std::fabs(pl.y - pr.y) <= params_.max_stereo_dy && (pl.x - pr.x) >= params_.min_disparity) {
+        row_desc.emplace_back(right_desc[j]);
+        row_index.emplace_back(static_cast<int>(j));
+      }
+    }
+
+    const int m = FindMatch(left_desc[i], row_desc, params_.max_match_distance, params_.match_ratio);
+    if (m < 0) {
+      continue;
+    }
+
+    const double disp = pl.x - right_kp[row_index[m]].pt.x;
+    kf.descriptors.emplace_back(left_desc[i]);
+    kf.cam_points.emplace_back(stereo_rig_.LeftCamera().Backproject(Vector2d(pl.x, pl.y), stereo_rig_.DispToDepth(disp)));
+  }
+
+  if (static_cast<int>(kf.descriptors.size()) < params_.min_inliers) {
+    return false;
+  }
+
+  last_keyframe_time_ = stereo_pair.timestamp;
+  keyframes_.emplace_back(std::move(kf));
+
+  if (database_) {
+    database_->Add(keyframes_.back().id, vocabulary_->Transform(keyframes_.back().descriptors));
+  } else {
+    MaybeBuildDatabase();
+  }
+
+  return true;
+}
+
+
+void Relocalizer::MaybeBuildDatabase()
+{
+  if (!vocabulary_) {
+    if (static_cast<int>(keyframes_.size()) < params_.train_keyframes) {
+      return;
+    }
+
+    std::vector<VecDescriptor256> images;
+    for (const Keyframe& kf : keyframes_) {
+      images.emplace_back(kf.descriptors);
+    }
+    BowVocabulary::Ptr trained = std::make_shared<BowVocabulary>();
+    trained->Train(images, params_.vocabulary_branching, params_.vocabulary_depth);
+    vocabulary_ = trained;
+
+    if (!params_.vocabulary_path.empty() && !vocabulary_->Save(params_.vocabulary_path)) {
+      LOG(WARNING) << "Failed to save BowVocabulary to " << params_.vocabulary_path << std::endl;
+    }
+  }
+
+  database_.reset(new KeyframeDatabase(vocabulary_->NumWords()));
+  for (const Keyframe& kf : keyframes_) {
+    database_->Add(kf.id, vocabulary_->Transform(kf.descriptors));
+  }
+}
+
+
+bool Relocalizer::Verify(const Keyframe& kf,
+                         const std::vector<cv::KeyPoint>& keypoints,
+                         const VecDescriptor256& descriptors,
+                         Matrix4d& query_T_kf,
+                         int& num_inliers)
+{
+  std::vector<cv::Point3f> object_points;
+  std::vector<cv::Point2f> image_points;
+  for (size_t i = 0; i < descriptors.size(); ++i) {
+    const int m = FindMatch(descriptors[i], kf.descriptors, params_.max_match_distance, params_.match_ratio);
+    if (m >= 0) {
+      const Vector3d& p = kf.cam_points[m];
+      object_points.emplace_back(p.x(), p.y(), p.z());
+      image_points.emplace_back(keypoints[i].pt);
+    }
+  }
+
+  num_inliers = 0;
+  if (static_cast<int>(object_points.size()) < params_.min_inliers) {
+    return false;
+  }
+
+  const cv::Matx33d K(stereo_rig_.fx(), 0, stereo_rig_.cx(),
+                      0, stereo_rig_.fy(), stereo_rig_.cy(),
+                      0, 0, 1);
+  cv::Mat rvec, tvec, inliers;
+  const bool ok = cv::solvePnPRansac(object_points, image_points, K, cv::noArray(), rvec, tvec, false,
+                                     params_.ransac_iters, params_.ransac_reproj_err, 0.99, inliers);
+  num_inliers = inliers.rows;
+  if (!ok || num_inliers < params_.min_inliers) {
+    return false;
+  }
+
+  cv::Mat R;
+  cv::Rodrigues(rvec, R);
+  query_T_kf = Matrix4d::Identity();
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      query_T_kf(r, c) = R.at<double>(r, c);
+    }
+    query_T_kf(r, 3) = tvec.at<double>(r);
+  }
+  return true;
+}
+
+
+std::vector<PoseMeasurement> Relocalizer::Localize(timestamp_t timestamp, const Image1b& left_image)
+{
+  std::vector<PoseMeasurement> out;
+  if (!database_) {
+    return out;
+  }
+
+  std::vector<cv::KeyPoint> keypoints;
+  VecDescriptor256 descriptors;
+  Detect(left_image, keypoints, descriptors);
+
+  const std::vector<KeyframeDatabase::Match> candidates = database_->Query(
+      vocabulary_->Transform(descriptors), params_.max_candidates, params_.min_score);
+
+  for (const KeyframeDatabase::Match& candidate : candidates) {
+    const Keyframe& kf = keyframes_.at(candidate.keyframe_id);
+
+    Matrix4d query_T_kf;
+    int num_inliers = 0;
+    if (!Verify(kf, keypoints, descriptors, query_T_kf, num_inliers)) {
+      continue;
+    }
+
+    const Matrix4d world_T_body = kf.world_T_cam * query_T_kf.inverse() * params_.body_T_cam.inverse();
+
+    Vector6d sigmas;
+    sigmas.head<3>().setConstant(params_.sigma_rotation);
+    sigmas.tail<3>().setConstant(params_.sigma_translation);
+    out.emplace_back(timestamp, world_T_body, sigmas);
+
+    LOG(INFO) << "Relocalized against keyframe " << kf.id << " (score=" << candidate.score
+              << ", inliers=" << num_inliers << ")" << std::endl;
+    break;
+  }
+
+  return out;
+}
+
+
+}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/StdVector>
+
+#include <opencv2/features2d.hpp>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/pose_measurement.hpp"
+#include "core/timestamp.hpp"
+#include "core/uid.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_image.hpp"
+#include "vio/keyframe_database.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Recognizes places that were seen before, so that the estimate can snap back after vision drops
+// out (and the frontend loses its tracks). Each keyframe is stored with ORB descriptors, their 3D
+// points (from stereo) and the body pose from the smoother, and indexed in a KeyframeDatabase. A
+// query image is matched against the best candidates, and the first one that passes PnP gives a
+// PoseMeasurement of the body (for StateEstimator::ReceivePose()).
+class Relocalizer final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    // A vocabulary trained offline (see BowVocabulary::Save). If the file is missing, a vocabulary
+    // is trained from the first train_keyframes keyframes instead, and saved here (if the path
+    // isn't empty) for next time.
+    std::string vocabulary_path = "";
+    int vocabulary_branching = 10;
+    int vocabulary_depth = 4;
+    int train_keyframes = 50;
+
+    int max_features = 500;             // ORB keypoints per image.
+    double min_sec_btw_keyframes = 1.0; // Don't store keyframes more often than this.
+
+    int max_candidates = 3;             // Check this many of the best matches from the database.
+    double min_score = 0.02;            // Database score (see KeyframeDatabase::Query).
+
+    int max_match_distance = 64;        // Hamming distance (out of 256).
+    double match_ratio = 0.8;           // Nearest neighbor ratio test.
+    double max_stereo_dy = 2.0;         // px, between rectified left and right keypoints.
+    double min_disparity = 1.0;         // px
+
+    int min_inliers = 25;
+    double ransac_reproj_err = 2.0;     // px
+    int ransac_iters = 100;
+
+    double sigma_rotation = 0.05;       // rad
+    double sigma_translation = 0.1;     // m
+
+    Matrix4d body_T_cam = Matrix4d::Identity();
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(Relocalizer)
+
+  // NOTE(milo): Images should be rectified, so that stereo matches are on the same row. A vocabulary
+  // can be passed in so that several relocalizers share one (it's never modified), instead of each
+  // loading its own copy from vocabulary_path.
+  Relocalizer(const Params& params,
+              const StereoCamera& stereo_rig,
+              BowVocabulary::ConstPtr vocabulary = nullptr);
+
+  // Store a keyframe with the body pose the smoother estimated for it. Returns false if it was
+  // skipped (too soon after the last one, or not enough stereo points).
+  bool AddKeyframe(const StereoImage1b& stereo_pair, const Matrix4d& world_T_body);
+
+  // Look for a stored keyframe in the left image. If one is found and verified, returns a
+  // measurement of the body pose at the image time (otherwise nothing).
+  std::vector<PoseMeasurement> Localize(timestamp_t timestamp, const Image1b& left_image);
+
+  size_t NumKeyframes() const { return keyframes_.size(); }
+  bool HasVocabulary() const { return database_ != nullptr; }
+
+ private:
+  struct Keyframe final
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    uid_t id;
+    Matrix4d world_T_cam;
+    VecDescriptor256 descriptors;
+    std::vector<Vector3d> cam_points;   // One for each descriptor.
+  };
+
+  void Detect(const Image1b& image, std::vector<cv::KeyPoint>& keypoints, VecDescriptor256& descriptors);
+
+  // Trains (or loads) the vocabulary once there are enough keyframes, and indexes them.
+  void MaybeBuildDatabase();
+
+  // Returns the pose of the keyframe camera in the query camera, if PnP finds enough inliers.
+  bool Verify(const Keyframe& kf,
+              const std::vector<cv::KeyPoint>& keypoints,
+              const VecDescriptor256& descriptors,
+              Matrix4d& query_T_kf,
+              int& num_inliers);
+
+ private:
+  Params params_;
+  StereoCamera stereo_rig_;
+  cv::Ptr<cv::ORB> orb_;
+
+  BowVocabulary::ConstPtr vocabulary_;         // Null until loaded or trained.
+  std::unique_ptr<KeyframeDatabase> database_;  // Only once the vocabulary is ready.
+
+  std::vector<Keyframe, Eigen::aligned_allocator<Keyframe>> keyframes_;   // Indexed by keyframe id.
+  timestamp_t last_keyframe_time_ = 0;
+};
+
+
+}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <Eigen/Core>
+
+namespace bm {
+namespace vio {
+
+
+// A time-ordered "history" of items, like ItemHistory, but stored in a contiguous circular buffer
+// with a fixed capacity (no allocation after construction). Keys must be added in non-decreasing
+// order. Adding a key that is older than the newest one truncates everything at or after it, which
+// makes "rewind and replay" cheap: rewind to an old item, then overwrite the rest in place.
+// If the buffer is full, the oldest item is dropped.
+template <typename Key, typename Item>
+class RingHistory final {
+ public:
+  typedef std::pair<Key, Item> Entry;
+
+  explicit RingHistory(size_t capacity) : buffer_(capacity)
+  {
+    CHECK_GT(capacity, 0ul) << "RingHistory needs a capacity > 0" << std::endl;
+  }
+
+  size_t Size() const { return size_; }
+  size_t Capacity() const { return buffer_.size(); }
+  bool Empty() const { return size_ == 0; }
+  void Clear() { size_ = 0; }
+
+  // Access the i-th oldest item (0 is the oldest).
+  const Entry& At(size_t i) const
+  {
+    DCHECK_LT(i, size_);
+    return buffer_[Physical(i)];
+  }
+
+  Key KeyAt(size_t i) const { return At(i).first; }
+  const Item& ItemAt(size_t i) const { return At(i).second; }
+
+  Key NewestKey() const
+  {
+    CHECK(!Empty()) << "Cannot get NewestKey() for empty history" << std::endl;
+    return KeyAt(size_ - 1);
+  }
+
+  Key OldestKey() const
+  {
+    CHECK(!Empty()) << "Cannot get OldestKey() for empty history" << std::endl;
+    return KeyAt(0);
+  }
+
+  // Index of the first item with a key >= k (binary search). Returns Size() if there isn't one.
+  size_t LowerBound(Key k) const
+  {
+    size_t lo = 0;
+    size_t hi = size_;
+    while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (KeyAt(mid) < k) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  // Add an item at key k. Any items with keys >= k are replaced.
+  void Update(Key k, const Item& item)
+  {
+    if (!Empty() && k <= NewestKey()) {
+      TruncateFrom(LowerBound(k));
+    }
+    if (size_ == buffer_.size()) {
+      head_ = (head_ + 1) % buffer_.size();
+      --size_;
+    }
+    Entry& entry = buffer_[Physical(size_)];
+    entry.first = k;
+    entry.second = item;
+    ++size_;
+  }
+
+  // Discard all items *before* (but not equal to) the key k.
+  void DiscardBefore(Key k)
+  {
+    const size_t n = LowerBound(k);
+    head_ = (head_ + n) % buffer_.size();
+    size_ -= n;
+  }
+
+  // Discard the i-th oldest item and everything newer than it.
+  void TruncateFrom(size_t i)
+  {
+    size_ = std::min(size_, i);
+  }
+
+ private:
+  size_t Physical(size_t i) const { return (head_ + i) % buffer_.size(); }
+
+ private:
+  std::vector<Entry, Eigen::aligned_allocator<Entry>> buffer_;
+  size_t head_ = 0;   // Physical index of the oldest item.
+  size_t size_ = 0;
+};
+
+
+}
+}
@@ -53,6 +53,9 @@ struct SmootherResult final
   Matrix6d cov_pose;
   Matrix3d cov_vel;
   Matrix6d cov_bias;
+
+  // If false, the covariances weren't recomputed for this keypose, and are from an earlier one.
+  bool has_covariance = true;
 };
 
 
@@ -0,0 +1,206 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/timer.hpp"
+#include "vio/state_checkpoint.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace checkpoint;
+
+
+template <typename MatrixT>
+static void CopyTo(const MatrixT& m, double* out)
+{
+  Eigen::Map<MatrixT>(out) = m;
+}
+
+
+template <typename MatrixT>
+static MatrixT CopyFrom(const double* in)
+{
+  return Eigen::Map<const MatrixT>(in);
+}
+
+
+static void CopyQuaternion(const Quaterniond& q, double* out)
+{
+  out[0] = q.w();
+  out[1] = q.x();
+  out[2] = q.y();
+  out[3] = q.z();
+}
+
+
+bool WriteCheckpoint(const std::string& path, const StateCheckpoint& checkpoint)
+{
+  FileHeader header;
+  std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = kVersion;
+  header.num_landmarks = static_cast<uint32_t>(checkpoint.landmarks.size());
+
+  const SmootherResult& r = checkpoint.smoother;
+  SmootherRecord smoother;
+  smoother.keypose_id = r.keypose_id;
+  smoother.timestamp = r.timestamp;
+  CopyTo<Vector3d>(r.world_P_body.translation(), smoother.world_t_body);
+  CopyQuaternion(r.world_P_body.rotation().toQuaternion(), smoother.world_q_body);
+  CopyTo<Vector3d>(r.world_v_body, smoother.world_v_body);
+  CopyTo<Vector3d>(r.imu_bias.accelerometer(), smoother.bias_acc);
+  CopyTo<Vector3d>(r.imu_bias.gyroscope(), smoother.bias_gyro);
+  CopyTo<Matrix6d>(r.cov_pose, smoother.cov_pose);
+  CopyTo<Matrix3d>(r.cov_vel, smoother.cov_vel);
+  CopyTo<Matrix6d>(r.cov_bias, smoother.cov_bias);
+  smoother.has_imu_state = r.has_imu_state;
+  smoother.has_covariance = r.has_covariance;
+
+  const State& s = checkpoint.filter_state.state;
+  FilterRecord filter;
+  filter.timestamp = checkpoint.filter_state.timestamp;
+  CopyTo<Vector3d>(s.t, filter.t);
+  CopyTo<Vector3d>(s.v, filter.v);
+  CopyTo<Vector3d>(s.a, filter.a);
+  CopyQuaternion(s.q, filter.q);
+  CopyTo<Vector3d>(s.w, filter.w);
+  CopyTo<Matrix15d>(s.S, filter.S);
+  filter.valid = checkpoint.has_filter_state;
+  filter.reserved = 0;
+
+  std::vector<LandmarkRecord> landmarks(checkpoint.landmarks.size());
+  for (size_t i = 0; i < landmarks.size(); ++i) {
+    const LandmarkObservation& obs = checkpoint.landmarks.at(i);
+    landmarks[i].landmark_id = obs.landmark_id;
+    landmarks[i].camera_id = obs.camera_id;
+    landmarks[i].pixel[0] = obs.pixel_location.x;
+    landmarks[i].pixel[1] = obs.pixel_location.y;
+    landmarks[i].disparity = obs.disparity;
+  }
+
+  // NOTE(milo): Rename is atomic, so readers see either the old checkpoint or the new one.
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(&smoother), sizeof(smoother));
+    out.write(reinterpret_cast<const char*>(&filter), sizeof(filter));
+    out.write(reinterpret_cast<const char*>(landmarks.data()), landmarks.size() * sizeof(LandmarkRecord));
+    if (!out.good()) {
+      return false;
+    }
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+
+bool ReadCheckpoint(const std::string& path, StateCheckpoint& checkpoint)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in.good()) {
+    return false;
+  }
+
+  FileHeader header;
+  SmootherRecord smoother;
+  FilterRecord filter;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!in.good() || std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 || header.version != kVersion) {
+    LOG(WARNING) << "Not a checkpoint (or a different version): " << path << std::endl;
+    return false;
+  }
+  in.read(reinterpret_cast<char*>(&smoother), sizeof(smoother));
+  in.read(reinterpret_cast<char*>(&filter), sizeof(filter));
+  std::vector<LandmarkRecord> landmarks(header.num_landmarks);
+  in.read(reinterpret_cast<char*>(landmarks.data()), landmarks.size() * sizeof(LandmarkRecord));
+  if (!in.good()) {
+    LOG(WARNING) << "Checkpoint is truncated: " << path << std::endl;
+    return false;
+  }
+
+  const double* q = smoother.world_q_body;
+  checkpoint.smoother = SmootherResult(
+      smoother.keypose_id,
+      smoother.timestamp,
+      gtsam::Pose3(gtsam::Rot3::Quaternion(q[0], q[1], q[2], q[3]), CopyFrom<Vector3d>(smoother.world_t_body)),
+      smoother.has_imu_state != 0,
+      CopyFrom<Vector3d>(smoother.world_v_body),
+      ImuBias(CopyFrom<Vector3d>(smoother.bias_acc), CopyFrom<Vector3d>(smoother.bias_gyro)),
+      CopyFrom<Matrix6d>(smoother.cov_pose),
+      CopyFrom<Matrix3d>(smoother.cov_vel),
+      CopyFrom<Matrix6d>(smoother.cov_bias));
+  checkpoint.smoother.has_covariance = smoother.has_covariance != 0;
+
+  checkpoint.has_filter_state = filter.valid != 0;
+  checkpoint.filter_state = StateStamped(filter.timestamp, State(
+      CopyFrom<Vector3d>(filter.t),
+      CopyFrom<Vector3d>(filter.v),
+      CopyFrom<Vector3d>(filter.a),
+      Quaterniond(filter.q[0], filter.q[1], filter.q[2], filter.q[3]),
+      CopyFrom<Vector3d>(filter.w),
+      CopyFrom<Matrix15d>(filter.S)));
+
+  checkpoint.landmarks.clear();
+  checkpoint.landmarks.reserve(landmarks.size());
+  for (const LandmarkRecord& lmk : landmarks) {
+    checkpoint.landmarks.emplace_back(lmk.landmark_id, lmk.camera_id,
+        cv::Point2f(lmk.pixel[0], lmk.pixel[1]), lmk.disparity, 0.0, 0.0);
+  }
+
+  return true;
+}
+
+
+CheckpointWriter::CheckpointWriter(const std::string& path, double interval_sec)
+    : path_(path),
+      interval_sec_(interval_sec)
+{
+  CHECK(!path_.empty()) << "CheckpointWriter needs a path" << std::endl;
+  thread_ = std::thread(&CheckpointWriter::WriterLoop, this);
+}
+
+
+CheckpointWriter::~CheckpointWriter()
+{
+  is_shutdown_.store(true);
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  // NOTE(milo): The writer thread is gone, so it's safe to read from here.
+  StateCheckpoint checkpoint;
+  if (latest_.Read(checkpoint) && WriteCheckpoint(path_, checkpoint)) {
+    ++num_written_;
+  }
+}
+
+
+void CheckpointWriter::WriterLoop()
+{
+  StateCheckpoint checkpoint;
+
+  while (!is_shutdown_) {
+    if (!latest_.WaitAndRead(checkpoint, 0.1)) {
+      continue;
+    }
+
+    if (WriteCheckpoint(path_, checkpoint)) {
+      ++num_written_;
+    } else {
+      LOG(WARNING) << "Failed to write checkpoint: " << path_ << std::endl;
+    }
+
+    // Anything submitted in the meantime waits in latest_ (only the newest is kept).
+    Timer timer(true);
+    while (!is_shutdown_ && timer.Elapsed().seconds() < interval_sec_) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+}
+
+
+}
+}
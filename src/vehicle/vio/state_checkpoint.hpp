@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "core/macros.hpp"
+#include "core/latest_value.hpp"
+#include "vision_core/landmark_observation.hpp"
+#include "vio/smoother_result.hpp"
+#include "vio/state_ekf.hpp"
+
+namespace bm {
+namespace vio {
+
+
+// Everything that StateEstimator needs to resume after a restart, without waiting for vision or
+// re-converging the IMU bias: the newest smoother keypose with its marginal covariances (which is
+// restored as a linearized prior on the first keypose), the filter state, and the landmark
+// observations of the newest keyframe (so that new landmark ids don't collide with old ones).
+struct StateCheckpoint final
+{
+  SmootherResult smoother;
+
+  bool has_filter_state = false;
+  StateStamped filter_state;
+
+  VecLandmarkObservation landmarks;
+};
+
+
+// The on-disk layout (in host byte order): FileHeader, SmootherRecord, FilterRecord, and then
+// num_landmarks x LandmarkRecord.
+namespace checkpoint {
+
+static const char kFileMagic[8] = { 'B', 'M', 'C', 'K', 'P', 'T', 0, 0 };
+static const uint32_t kVersion = 1;
+
+struct FileHeader final {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_landmarks;
+};
+
+struct SmootherRecord final {
+  uint64_t keypose_id;
+  double timestamp;
+  double world_t_body[3];
+  double world_q_body[4];   // w, x, y, z
+  double world_v_body[3];
+  double bias_acc[3];
+  double bias_gyro[3];
+  double cov_pose[36];      // Column-major, like Eigen.
+  double cov_vel[9];
+  double cov_bias[36];
+  uint32_t has_imu_state;
+  uint32_t has_covariance;
+};
+
+struct FilterRecord final {
+  double timestamp;
+  double t[3];
+  double v[3];
+  double a[3];
+  double q[4];              // w, x, y, z
+  double w[3];
+  double S[225];
+  uint32_t valid;
+  uint32_t reserved;
+};
+
+struct LandmarkRecord final {
+  uint64_t landmark_id;
+  uint64_t camera_id;
+  float pixel[2];
+  double disparity;
+};
+
+static_assert(sizeof(FileHeader) == 16, "Unexpected FileHeader padding");
+static_assert(sizeof(SmootherRecord) == 800, "Unexpected SmootherRecord padding");
+static_assert(sizeof(FilterRecord) == 1944, "Unexpected FilterRecord padding");
+static_assert(sizeof(LandmarkRecord) == 32, "Unexpected LandmarkRecord padding");
+
+}
+
+
+// Writes to a temporary file and renames it over "path", so a crash in the middle of a write never
+// leaves a partial checkpoint behind. Returns false if the file couldn't be written.
+bool WriteCheckpoint(const std::string& path, const StateCheckpoint& checkpoint);
+
+// Returns false if the file is missing, truncated, or not a checkpoint (of this version).
+bool ReadCheckpoint(const std::string& path, StateCheckpoint& checkpoint);
+
+
+// Writes checkpoints on its own thread, so that Submit() never blocks on the disk. At most one
+// checkpoint is written every interval_sec, and if several are submitted in the meantime, only
+// the newest one is written.
+//
+// NOTE(milo): Submit() must only be called from one thread at a time (see LatestValue).
+class CheckpointWriter final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(CheckpointWriter)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(CheckpointWriter)
+
+  CheckpointWriter(const std::string& path, double interval_sec);
+
+  // Writes the newest checkpoint (if it hasn't been written yet), then stops the thread.
+  ~CheckpointWriter();
+
+  void Submit(const StateCheckpoint& checkpoint) { latest_.Write(checkpoint); }
+
+  int NumWritten() const { return num_written_.load(); }
+
+ private:
+  void WriterLoop();
+
+  std::string path_;
+  double interval_sec_;
+
+  LatestValue<StateCheckpoint> latest_;
+  std::atomic_bool is_shutdown_{false};
+  std::atomic<int> num_written_{0};
+  std::thread thread_;
+};
+
+
+}
+}
@@ -1,4 +1,5 @@
 #include "vio/state_ekf.hpp"
+#include "core/trace.hpp"
 
 #include <gtsam/geometry/Pose3.h>
 
@@ -8,7 +9,9 @@ namespace vio {
 typedef Eigen::Matrix<double, 1, 1> Vector1d;
 
 
-static bool DiagonalNonnegative(const Eigen::MatrixXd& m)
+// NOTE(milo): Templated so that fixed-size matrices don't get copied into a (heap) MatrixXd.
+template <typename Derived>
+static bool DiagonalNonnegative(const Eigen::MatrixBase<Derived>& m)
 {
   for (int i = 0; i < m.rows(); ++i) {
     CHECK_GT(m(i, i), 0.0f) << "entry: " << i << " value: " << m(i, i) << "\n" << m << std::endl;
@@ -49,6 +52,7 @@ void StateEkf::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("sigma_R_imu_w", &sigma_R_imu_w);
 
   parser.GetParam("sigma_R_depth", &sigma_R_depth);
+  parser.GetParam("mahalanobis_gate_chi2", &mahalanobis_gate_chi2);
 
   YamlToVector<Vector3d>(parser.GetNode("/shared/n_gravity"), n_gravity);
   YamlToMatrix<Matrix4d>(parser.GetNode("/shared/imu0/body_T_imu"), body_T_imu);
@@ -59,12 +63,10 @@ void StateEkf::Params::LoadParams(const YamlParser& parser)
 
 StateEkf::StateEkf(const Params& params)
     : params_(params),
-      state_(0, State())
+      state_(0, State()),
+      imu_history_(static_cast<size_t>(params.stored_imu_max_queue_size)),
+      state_history_(static_cast<size_t>(std::ceil(params.stored_state_lag_sec * params.max_update_rate_hz)) + 1)
 {
-  ImuManager::Params imu_manager_params;
-  imu_manager_params.max_queue_size = params_.stored_imu_max_queue_size;
-  imu_history_ = std::shared_ptr<ImuManager>(new ImuManager(imu_manager_params, "filter_imu_history"));
-
   // IMU measurement noise: [ wx wy wz ax ay az ]
   R_imu_.block<3, 3>(0, 0) =  Matrix3d::Identity() * std::pow(params_.sigma_R_imu_w, 2.0);
   R_imu_.block<3, 3>(3, 3) =  Matrix3d::Identity() * std::pow(params_.sigma_R_imu_a, 2.0);
@@ -93,26 +95,22 @@ void StateEkf::Rewind(seconds_t timestamp, seconds_t allowed_dt)
                             << "timestamp=" << timestamp << " oldest=" << state_history_.OldestKey() << std::endl;
 
     // Use the estimate of velocity, acceleration, and angular velocity from the filter.
-    const seconds_t nearest_timestamp = state_history_.OldestKey();
-
-    state_lock_.lock();
-
     // NOTE(milo): Need to reset to timestamp to handle the case where nearest_timestamp > timestamp.
-    // In that case, we might end up with a dt < 0 when reapplying measurements.
-    state_ = StateStamped(timestamp, state_history_.at(nearest_timestamp));
-    state_lock_.unlock();
+    // In that case, we might end up with a dt < 0 when reapplying measurements. This also throws
+    // out the newer states, which get recomputed by ReapplyImu().
+    const State nearest_state = state_history_.ItemAt(0);
+    ThreadsafeSetState(timestamp, nearest_state);
   }
 }
 
 
 void StateEkf::ReapplyImu()
 {
-  imu_history_->DiscardBefore(state_.timestamp);
+  imu_history_.DiscardBefore(state_.timestamp);
 
-  while (!imu_history_->Empty()) {
+  for (size_t i = 0; i < imu_history_.Size(); ++i) {
     // NOTE(milo): Don't store these measurements in PredictAndUpdate()! Endless loop!
-    const ImuMeasurement imu = imu_history_->Pop();
-    PredictAndUpdate(imu, false);
+    PredictAndUpdate(imu_history_.ItemAt(i), false);
   }
 }
 
@@ -138,12 +136,10 @@ static State Predict(const State& x0,
   const Quaterniond dq = Quaterniond(AngleAxisd(angle, axis));
   const Quaterniond q1 = dq * x0.q;
 
-  // Update the covariance with 1st-order propagation and additive process noise.
-  Matrix15d F = Matrix15d::Identity();
-  F.block<3, 3>(t_row, v_row) = dt * Matrix3d::Identity();
-  F.block<3, 3>(t_row, a_row) = 0.5*dt*dt * Matrix3d::Identity();
-  F.block<3, 3>(v_row, a_row) = dt * Matrix3d::Identity();
-  F.block<3, 3>(uq_row, uq_row) = dq.toRotationMatrix();
+  // Update the covariance with 1st-order propagation and additive process noise. F is the identity
+  // plus a few 3x3 blocks (see PropagateCovariance()).
+  const Matrix3d R_dq = dq.toRotationMatrix();
+  Matrix3d G = Matrix3d::Zero();
 
   // Compute d(uq)/dw (see (21) in [1]). If angle is zero, then the derivative is zero.
   if (angle > 1e-7) {
@@ -158,19 +154,18 @@ static State Predict(const State& x0,
     const double n2 = n.y();
     const double n3 = n.z();
 
-    Matrix3d G = Matrix3d::Zero();  // Eq(21)
+    // Eq(21)
     G << cm*n1*n1 + c,    cm*n1*n2 - s*n3,  cm*n1*n3 + s*n2,
          cm*n1*n2 + s*n3, cm*n2*n2 + c,     cm*n2*n3 - s*n1,
          cm*n1*n3 - s*n2, cm*n2*n3 + s*n1,  cm*n3*n3 + c;
-
-    F.block<3, 3>(uq_row, w_row) = G;
   }
 
   // Multiply dt*Q to account for different step sizes (uncertainty grows with time).
-  Matrix15d S1 = F*x0.S*F.transpose() + dt*Q;
-  Symmetrize(S1);
+  State x1(t1, v1, a1, q1, w1, x0.S);
+  PropagateCovariance<double>(x0.S, dt, R_dq, G, Q, x1.S);
+  Symmetrize(x1.S);
 
-  return State(t1, v1, a1, q1, w1, S1);
+  return x1;
 }
 
 
@@ -187,32 +182,27 @@ static ImuMeasurement RotateAndRemoveGravity(const Quaterniond& q_world_imu,
 }
 
 
+// NOTE(milo): D is a template parameter so that all of the intermediate matrices are fixed-size.
+// If the number of rows isn't known at compile time, use D = Eigen::Dynamic with a bound MaxD.
+template <int D, int MaxD = D>
 static State GenericKalmanUpdate(const State& x,
-                                 const Eigen::MatrixXd& H,
-                                 const Eigen::VectorXd& y,
-                                 const Eigen::MatrixXd& R,
-                                 const Vector15d& mask)
+                                 const EkfJacobian<double, D, MaxD>& H,
+                                 const EkfInnovation<double, D, MaxD>& y,
+                                 const EkfNoise<double, D, MaxD>& R)
 {
-  const size_t d = H.rows();
-  CHECK_EQ(15, H.cols()) << "H must have 15 cols" << std::endl;
-  CHECK_EQ(d, y.rows()) << "H and y must be of the same dimension" << std::endl;
-  CHECK_EQ(d, R.rows()) << "R must have d rows" << std::endl;
-  CHECK_EQ(d, R.cols()) << "R must have d cols" << std::endl;
   CHECK(DiagonalNonnegative(R)) << "Bad measurement noise R:\n" << R << std::endl;
 
   // Follows conventions from: https://en.wikipedia.org/wiki/Extended_Kalman_filter
-  const Matrix15d P = x.S;
-  const Eigen::MatrixXd S = H*P*H.transpose() + R;
-  const Eigen::MatrixXd K = P*H.transpose() * S.inverse();
-
   // https://stats.stackexchange.com/questions/50487/possible-causes-for-the-state-noise-variance-to-become-negative-in-a-kalman-filt
-  const Matrix15d A = (Matrix15d::Identity() - K*H);
-  const Matrix15d S_new = A*P*A.transpose() + K*R*K.transpose();
+  EkfGain<double, D, MaxD> K;
+  Matrix15d S_new;
+  JosephUpdate<double, D, MaxD>(x.S, H, R, K, S_new);
 
   CHECK(DiagonalNonnegative(S_new)) << "New covariance matrix is not PSD!\n" << S_new << std::endl;
 
-  // return State(x.ToVector() + (K*y).cwiseProduct(mask), S_new);
-  return State(x.ToVector() + K*y, S_new);
+  Vector15d x_new = x.ToVector();
+  x_new.noalias() += K*y;
+  return State(x_new, S_new);
 }
 
 
@@ -232,13 +222,13 @@ static State UpdatePose(const State& x,
   H.block<3, 3>(0, uq_row) = Matrix3d::Identity();
   H.block<3, 3>(3, t_row) = Matrix3d::Identity();
 
-  Matrix15d P = x.S;
-
-  const Matrix6d S = H*P*H.transpose() + R_pose;
-  const Matrix15x6 K = P*H.transpose()*S.inverse();
+  State xu = x;
+  Matrix15x6 K;
+  JosephUpdate<double, 6>(x.S, H, R_pose, K, xu.S);
 
   // Get the update increment to apply to the state vector.
-  const Vector15d dx = K*error_tangent;
+  Vector15d dx;
+  dx.noalias() = K*error_tangent;
   Vector6d dx_tangent;
   dx_tangent.head(3) = dx.middleRows<3>(uq_row);
   dx_tangent.tail(3) = dx.middleRows<3>(t_row);
@@ -247,7 +237,6 @@ static State UpdatePose(const State& x,
   // The pose increment is applied on the manifold.
   const gtsam::Pose3 world_P_body_new = world_P_body * dx_manifold;
 
-  State xu = x;
   xu.t = world_P_body_new.translation();
   xu.q = world_P_body_new.rotation().toQuaternion().normalized();
 
@@ -257,11 +246,6 @@ static State UpdatePose(const State& x,
   xu.a += dx.middleRows<3>(a_row);
   xu.w += dx.middleRows<3>(w_row);
 
-  // https://stats.stackexchange.com/questions/50487/possible-causes-for-the-state-noise-variance-to-become-negative-in-a-kalman-filt
-  const Matrix15d A = (Matrix15d::Identity() - K*H);
-
-  xu.S = A*P*A.transpose() + K*R_pose*K.transpose();
-
   Symmetrize(xu.S);
   CHECK(DiagonalNonnegative(xu.S)) << "New covariance matrix is not PSD!\n" << xu.S << std::endl;
 
@@ -276,13 +260,15 @@ void StateEkf::Initialize(const StateStamped& state, const ImuBias& imu_bias)
   is_initialized_ = true;
   imu_bias_ = imu_bias;
 
-  imu_history_->DiscardBefore(state.timestamp);
+  imu_history_.DiscardBefore(state.timestamp);
   state_history_.DiscardBefore(state.timestamp);
 }
 
 
 StateStamped StateEkf::PredictAndUpdate(const ImuMeasurement& imu, bool store)
 {
+  BM_TRACE_SCOPE("StateEkf::PredictAndUpdate");
+
   // PREDICT STEP: Simulate the system forward to the current timestep.
   const seconds_t t_new = ConvertToSeconds(imu.timestamp);
   const State& x = PredictIfTimeElapsed(t_new);
@@ -307,14 +293,11 @@ StateStamped StateEkf::PredictAndUpdate(const ImuMeasurement& imu, bool store)
 
   // y = z - h(x)
   const Vector6d y = z_imu - x_imu;
-  Vector15d mask = Vector15d::Zero();
-  mask.block<3, 1>(a_row, 0) = Vector3d::Ones();
-  mask.block<3, 1>(w_row, 0) = Vector3d::Ones();
-  const State xu = GenericKalmanUpdate(x, H, y, R_imu_, mask);
+  const State xu = GenericKalmanUpdate(x, H, y, R_imu_);
 
   // Store IMU measurements so that we can rewind the filter and re-apply them during re-init.
   if (store && params_.reapply_measurements_after_init) {
-    imu_history_->Push(imu);
+    imu_history_.Update(t_new, imu);
   }
 
   return ThreadsafeSetState(t_new, xu);
@@ -325,6 +308,8 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
                                         const Vector3d& world_v_body,
                                         const Matrix3d& R_velocity)
 {
+  BM_TRACE_SCOPE("StateEkf::PredictAndUpdate");
+
   // PREDICT STEP: Simulate the system forward to the current timestep.
   const State& x = PredictIfTimeElapsed(timestamp);
 
@@ -335,12 +320,9 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
   // y = z - h(x)
   const Vector3d y = world_v_body - x.v;
 
-  Vector15d mask = Vector15d::Zero();
-  mask.block<3, 1>(v_row, 0) = Vector3d::Ones();
-
   Matrix3d R_velocity_safe = R_velocity;
   Symmetrize(R_velocity_safe);
-  const State xu = GenericKalmanUpdate(x, H, y, R_velocity_safe, mask);
+  const State xu = GenericKalmanUpdate(x, H, y, R_velocity_safe);
 
   return ThreadsafeSetState(timestamp, xu);
 }
@@ -351,6 +333,8 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
                                         const Vector3d& world_T_body,
                                         const Matrix6d& R_pose)
 {
+  BM_TRACE_SCOPE("StateEkf::PredictAndUpdate");
+
   // PREDICT STEP: Simulate the system forward to the current timestep.
   const State& xp = PredictIfTimeElapsed(timestamp);
 
@@ -368,6 +352,8 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
                                         double meas_world_T_body,
                                         double R_axis_sigma)
 {
+  BM_TRACE_SCOPE("StateEkf::PredictAndUpdate");
+
   // PREDICT STEP: Simulate the system forward to the current timestep.
   const State& x = PredictIfTimeElapsed(timestamp);
 
@@ -381,11 +367,8 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
   const double pred_world_T_body = x.t(axis);
   const Vector1d y = (Vector1d() << meas_world_T_body - pred_world_T_body).finished();
 
-  Vector15d mask = Vector15d::Zero();
-  mask(t_row + axis, 0) = 1.0;
-
   const Matrix1d R = Matrix1d::Identity() * R_axis_sigma * R_axis_sigma;
-  const State xu = GenericKalmanUpdate(x, H, y, R, mask);
+  const State xu = GenericKalmanUpdate(x, H, y, R);
 
   return ThreadsafeSetState(timestamp, xu);
 }
@@ -396,6 +379,8 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
                                         const Vector3d point,
                                         double sigma_R_range)
 {
+  BM_TRACE_SCOPE("StateEkf::PredictAndUpdate");
+
   // PREDICT STEP: Simulate the system forward to the current timestep.
   const State& x = PredictIfTimeElapsed(timestamp);
 
@@ -422,15 +407,85 @@ StateStamped StateEkf::PredictAndUpdate(seconds_t timestamp,
   // y = z - h(x)
   const Vector1d y = (Vector1d() << range - h_range).finished();
   const Matrix1d R = Matrix1d::Identity() * sigma_R_range*sigma_R_range;
-  Vector15d mask = Vector15d::Zero();
-  mask.block<3, 1>(t_row, 0) = Vector3d::Ones();
-  const State xu = GenericKalmanUpdate(x, H, y, R, mask);
+  const State xu = GenericKalmanUpdate(x, H, y, R);
 
   return ThreadsafeSetState(timestamp, xu);
 }
 
 
 
+StateStamped StateEkf::PredictAndUpdate(const MeasurementBatch& batch, int* num_rejected)
+{
+  BM_TRACE_SCOPE("StateEkf::PredictAndUpdate");
+
+  static const int kMax = MeasurementBatch::kMaxSize;
+  typedef EkfJacobian<double, Eigen::Dynamic, kMax> BatchJacobian;
+  typedef EkfInnovation<double, Eigen::Dynamic, kMax> BatchInnovation;
+  typedef EkfNoise<double, Eigen::Dynamic, kMax> BatchNoise;
+
+  // PREDICT STEP: Simulate the system forward to the current timestep (once for all measurements).
+  const State& x = PredictIfTimeElapsed(batch.timestamp);
+
+  // UPDATE STEP: Stack the residuals and jacobians of every measurement.
+  const int N = batch.size;
+  BatchJacobian H = BatchJacobian::Zero(N, 15);
+  BatchInnovation y(N);
+  BatchNoise R = BatchNoise::Zero(N, N);
+
+  // Need to account for the location of the range receiver on the robot.
+  const Vector3d world_t_receiver = x.t + x.q.normalized() * params_.body_T_receiver.block<3, 1>(0, 3);
+
+  for (int i = 0; i < N; ++i) {
+    const MeasurementBatch::Item& item = batch.items.at(i);
+
+    if (item.type == MeasurementBatch::Type::RANGE) {
+      // Gradient is the unit vector from the point to the robot (direction of increasing range).
+      const Vector3d point_to_receiver = world_t_receiver - item.point;
+      H.block<1, 3>(i, t_row) = point_to_receiver.normalized().transpose();
+      y(i) = item.value - point_to_receiver.norm();
+    } else {
+      H(i, t_row + item.axis) = 1.0;
+      y(i) = item.value - x.t(item.axis);
+    }
+
+    R(i, i) = item.sigma * item.sigma;
+  }
+
+  // Gate each measurement on its own innovation, and only keep the ones that pass.
+  int num_accepted = N;
+  if (params_.mahalanobis_gate_chi2 > 0) {
+    BatchInnovation d2;
+    InnovationMahalanobis2<double, Eigen::Dynamic, kMax>(x.S, H, y, R, d2);
+
+    num_accepted = 0;
+    for (int i = 0; i < N; ++i) {
+      if (d2(i) > params_.mahalanobis_gate_chi2) {
+        continue;
+      }
+      H.row(num_accepted) = H.row(i);
+      y(num_accepted) = y(i);
+      R(num_accepted, num_accepted) = R(i, i);
+      ++num_accepted;
+    }
+  }
+
+  if (num_rejected) {
+    *num_rejected = N - num_accepted;
+  }
+
+  if (num_accepted == 0) {
+    return ThreadsafeSetState(batch.timestamp, x);
+  }
+
+  H.conservativeResize(num_accepted, Eigen::NoChange);
+  y.conservativeResize(num_accepted);
+  R.conservativeResize(num_accepted, num_accepted);
+  const State xu = GenericKalmanUpdate<Eigen::Dynamic, kMax>(x, H, y, R);
+
+  return ThreadsafeSetState(batch.timestamp, xu);
+}
+
+
 State StateEkf::PredictIfTimeElapsed(seconds_t timestamp)
 {
   CHECK(is_initialized_) << "Must call Initialize() before Predict()" << std::endl;
@@ -445,11 +500,10 @@ State StateEkf::PredictIfTimeElapsed(seconds_t timestamp)
 
 StateStamped StateEkf::ThreadsafeSetState(seconds_t timestamp, const State& state)
 {
-  state_lock_.lock();
   state_.timestamp = timestamp;
   state_.state = state;
   Symmetrize(state_.state.S);
-  state_lock_.unlock();
+  published_state_.Store(state_);
 
   state_history_.Update(timestamp, state);
 
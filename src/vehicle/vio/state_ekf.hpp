@@ -1,17 +1,19 @@
 #pragma once
 
-#include <mutex>
+#include <array>
 
 #include "core/macros.hpp"
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "core/eigen_types.hpp"
 #include "core/axis3.hpp"
+#include "core/seq_lock.hpp"
 #include "params/params_base.hpp"
 #include "core/thread_safe_queue.hpp"
 
+#include "vio/ekf_kernels.hpp"
 #include "vio/imu_manager.hpp"
-#include "vio/item_history.hpp"
+#include "vio/ring_history.hpp"
 
 namespace bm {
 namespace vio {
@@ -22,13 +24,6 @@ using namespace core;
 typedef Vector16d StateVector;
 typedef Matrix15d StateCovariance;
 
-// Row indices for variables in the 15x15 jacobian matrix F.
-static const size_t t_row = 0;
-static const size_t v_row = 3;
-static const size_t a_row = 6;
-static const size_t uq_row = 9;
-static const size_t w_row = 12;
-
 typedef Eigen::Matrix<double, 6, 15> Matrix6x15;
 typedef Eigen::Matrix<double, 15, 6> Matrix15x6;
 
@@ -122,6 +117,60 @@ struct StateStamped final
 };
 
 
+// Scalar measurements that share a timestamp (e.g ranges from several beacons, and depth). These
+// are fused with a single predict step and one stacked update (see StateEkf::PredictAndUpdate).
+struct MeasurementBatch final
+{
+  static const int kMaxSize = 8;
+
+  enum class Type { RANGE, AXIS };
+
+  struct Item final
+  {
+    Type type = Type::RANGE;
+    double value = 0;
+    double sigma = 0;
+    Vector3d point = Vector3d::Zero();   // RANGE only: known point that the range is from.
+    Axis3 axis = Axis3::X;              // AXIS only: which translation axis is measured.
+  };
+
+  explicit MeasurementBatch(seconds_t timestamp) : timestamp(timestamp) {}
+
+  // Add a range from a known point (e.g APS).
+  void AddRange(double range, const Vector3d& point, double sigma_R_range)
+  {
+    Item& item = Add(Type::RANGE, range, sigma_R_range);
+    item.point = point;
+  }
+
+  // Add an estimate of ONE translation axis (e.g from barometer).
+  void AddAxis(Axis3 axis, double meas_world_T_body, double sigma_R_axis)
+  {
+    Item& item = Add(Type::AXIS, meas_world_T_body, sigma_R_axis);
+    item.axis = axis;
+  }
+
+  bool Empty() const { return size == 0; }
+  bool Full() const { return size == kMaxSize; }
+
+  seconds_t timestamp;
+  int size = 0;
+  std::array<Item, kMaxSize> items;
+
+ private:
+  Item& Add(Type type, double value, double sigma)
+  {
+    CHECK(!Full()) << "MeasurementBatch can only hold " << kMaxSize << " measurements" << std::endl;
+    CHECK_GT(sigma, 0) << "Measurement sigma (stdev) must be > 0" << std::endl;
+    Item& item = items[size++];
+    item.type = type;
+    item.value = value;
+    item.sigma = sigma;
+    return item;
+  }
+};
+
+
 class StateEkf final {
  public:
   struct Params : ParamsBase
@@ -131,6 +180,7 @@ class StateEkf final {
     bool reapply_measurements_after_init = true;
     int stored_imu_max_queue_size = 2000;
     double stored_state_lag_sec = 10;                // delete stored states once they're this old
+    double max_update_rate_hz = 400;                 // IMU + other sensors, sizes the state history
 
     // Process noise standard deviations.
     double sigma_Q_t = 1e-2;   // translation
@@ -146,6 +196,10 @@ class StateEkf final {
     double sigma_R_depth = 0.5; // m
     double sigma_R_range = 0.1;  // m
 
+    // Measurements in a MeasurementBatch are rejected if their squared Mahalanobis distance is
+    // greater than this (chi-squared with 1 DOF, e.g 9 is 3 sigma). Zero turns off gating.
+    double mahalanobis_gate_chi2 = 9.0;
+
     // Shared params.
     Vector3d n_gravity = Vector3d(0, 9.81, 0);
     Matrix4d body_T_imu = Matrix4d::Identity();
@@ -163,7 +217,8 @@ class StateEkf final {
   // If no previous state exists within allowed_dt, it will complain but no exception is thrown.
   void Rewind(seconds_t timestamp, seconds_t allowed_dt = 0.1);
 
-  // Re-apply all stored imu measurements on top of the current state.
+  // Re-apply all stored imu measurements on top of the current state. They stay stored, so that
+  // they can be re-applied again after the next Rewind().
   void UpdateImuBias(const ImuBias& imu_bias) { imu_bias_ = imu_bias; }
   void ReapplyImu();
 
@@ -198,14 +253,13 @@ class StateEkf final {
                                 const Vector3d point,
                                 double R_range);
 
-  // Retrieve the current state.
-  StateStamped GetState()
-  {
-    state_lock_.lock();
-    const StateStamped out = state_;
-    state_lock_.unlock();
-    return out;
-  }
+  // Update with several measurements that share a timestamp, using a single predict step and one
+  // stacked update. Measurements that fail the Mahalanobis gate are skipped. If num_rejected is
+  // given, it is set to the number that were.
+  StateStamped PredictAndUpdate(const MeasurementBatch& batch, int* num_rejected = nullptr);
+
+  // Retrieve the current state. Lock-free, so any thread can call this without holding up the filter.
+  StateStamped GetState() const { return published_state_.Load(); }
 
   // Retrieve the timestamp of the current state.
   seconds_t GetTimestamp() const
@@ -221,14 +275,14 @@ class StateEkf final {
   // no forward simulation happens.
   State PredictIfTimeElapsed(seconds_t timestamp);
 
-  // Call this to update the filter's state.
+  // Call this to update the filter's state (and publish it for GetState()).
   StateStamped ThreadsafeSetState(seconds_t timestamp, const State& state);
 
  private:
   Params params_;
 
-  std::mutex state_lock_;
-  StateStamped state_;
+  StateStamped state_;                        // Only touched by the thread that runs the filter.
+  SeqLock<StateStamped> published_state_;     // A copy of state_ for other threads.
   ImuBias imu_bias_;
   bool is_initialized_ = false;
 
@@ -240,9 +294,10 @@ class StateEkf final {
 
   Quaterniond q_body_imu_;
 
-  std::shared_ptr<ImuManager> imu_history_ = nullptr;
-
-  ItemHistory<seconds_t, State> state_history_;
+  // NOTE(milo): Both of these are contiguous ring buffers, so rewinding is a binary search and
+  // replaying overwrites states in place.
+  RingHistory<seconds_t, ImuMeasurement> imu_history_;
+  RingHistory<seconds_t, State> state_history_;
 };
 
 }
@@ -1,14 +1,94 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
 #include <glog/logging.h>
 
-#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <gtsam/linear/linearExceptions.h>
 
+#include "core/async_log.hpp"
+#include "core/queue_telemetry.hpp"
+#include "core/realtime_memory.hpp"
 #include "core/timer.hpp"
+#include "core/trace.hpp"
 #include "core/transform_util.hpp"
+#include "vision_core/gpu_context.hpp"
 #include "vio/state_estimator.hpp"
 
 namespace bm {
 namespace vio {
 
+// Rig i's landmark ids start at i * kLandmarkIdsPerRig (no frontend will ever get near 2^40 ids).
+static const uid_t kLandmarkIdsPerRig = 1ull << 40;
+
+
+// The rig at the frontend resolution (see Params::frontend_height), keeping the aspect ratio.
+static StereoCamera FrontendRig(const StereoCamera& rig, int frontend_height)
+{
+  if (frontend_height <= 0 || frontend_height == rig.Height()) {
+    return rig;
+  }
+  const int width = static_cast<int>(std::lround(rig.Width() * frontend_height / static_cast<double>(rig.Height())));
+  return rig.Rescale(frontend_height, width);
+}
+
+
+// The StereoFrontend params for one of the rigs at the frontend resolution.
+static StereoFrontend::Params FrontendParams(const StateEstimator::Params& params, size_t rig)
+{
+  const StereoCamera& input_rig = params.stereo_rigs.at(rig);
+  StereoFrontend::Params out = params.stereo_frontend_params;
+  out.stereo_rig = FrontendRig(input_rig, params.frontend_height);
+
+  const double scale = out.stereo_rig.Height() / static_cast<double>(input_rig.Height());
+  StereoMatcher::Params& matcher_params = out.tracker_params.matcher_params;
+  matcher_params = matcher_params.Rescaled(scale);
+  return out;
+}
+
+
+// The filter's ImuManager has the same noise model as the smoother's, but its own queue size.
+static ImuManager::Params FilterImuParams(const StateEstimator::Params& params)
+{
+  ImuManager::Params out = params.imu_manager_params;
+  out.max_queue_size = params.max_size_filter_imu_queue;
+  return out;
+}
+
+
+// Downsamples a stereo pair to the size of the frontend's rig (does nothing if it's already there).
+static void ResizeForFrontend(StereoImage1b& stereo_pair, const StereoCamera& rig)
+{
+  const cv::Size size(rig.Width(), rig.Height());
+  if (stereo_pair.left_image.size() == size) {
+    return;
+  }
+  Image1b left, right;
+  cv::resize(stereo_pair.left_image, left, size, 0, 0, cv::INTER_AREA);
+  cv::resize(stereo_pair.right_image, right, size, 0, 0, cv::INTER_AREA);
+  stereo_pair.left_image = std::move(left);
+  stereo_pair.right_image = std::move(right);
+
+  // NOTE(milo): Other copies of this pair still have the full size images, so give the resized
+  // ones a cache of their own instead of thrashing the shared one.
+  stereo_pair.cache = std::make_shared<StereoImageCache>();
+}
+
+
+// Frame k of a synthetic scene for warming up: a blurred noise texture (lots of corners) at a
+// constant disparity, panning a couple of pixels per frame so that features can be tracked.
+static StereoImage1b WarmUpStereoPair(const Image1b& texture, const StereoCamera& rig, int k)
+{
+  const int disp = std::max(1, rig.Width() / 64);
+  const int offset = 2 * k;
+  const timestamp_t timestamp = 1e9 + k * 1e8;
+  const Image1b left = texture(cv::Rect(offset, 0, rig.Width(), rig.Height())).clone();
+  const Image1b right = texture(cv::Rect(offset + disp, 0, rig.Width(), rig.Height())).clone();
+  return StereoImage1b(timestamp, k, left, right);
+}
+
 
 void StateEstimator::Params::LoadParams(const YamlParser& parser)
 {
@@ -16,6 +96,12 @@ void StateEstimator::Params::LoadParams(const YamlParser& parser)
   imu_manager_params = ImuManager::Params(parser.Subtree("ImuManager"));
   smoother_params = FixedLagSmoother::Params(parser.Subtree("FixedLagSmoother"));
   filter_params = StateEkf::Params(parser.Subtree("StateEkf"));
+  scheduler_params = FrontendScheduler::Params(parser.Subtree("FrontendScheduler"));
+  batch_params = BatchSmoother::Params(parser.Subtree("BatchSmoother"));
+  propagator_params = ImuPropagator::Params(parser.Subtree("ImuPropagator"));
+  tag_localizer_params = TagLocalizer::Params(parser.Subtree("TagLocalizer"));
+  relocalizer_params = Relocalizer::Params(parser.Subtree("Relocalizer"));
+  vi_init_params = ViInitializer::Params(parser.Subtree("ViInitializer"));
 
   parser.GetParam("max_size_raw_stereo_queue", &max_size_raw_stereo_queue);
   parser.GetParam("max_size_smoother_vo_queue", &max_size_smoother_vo_queue);
@@ -23,62 +109,240 @@ void StateEstimator::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("max_size_smoother_depth_queue", &max_size_smoother_depth_queue);
   parser.GetParam("max_size_smoother_range_queue", &max_size_smoother_range_queue);
   parser.GetParam("max_size_smoother_mag_queue", &max_size_smoother_mag_queue);
+  parser.GetParam("max_size_smoother_pose_queue", &max_size_smoother_pose_queue);
   parser.GetParam("max_size_filter_vo_queue", &max_size_filter_vo_queue);
   parser.GetParam("max_size_filter_imu_queue", &max_size_filter_imu_queue);
   parser.GetParam("max_size_filter_depth_queue", &max_size_filter_depth_queue);
-  parser.GetParam("max_size_filter_range_queue", &max_size_smoother_range_queue);
+  parser.GetParam("max_size_filter_range_queue", &max_size_filter_range_queue);
+  parser.GetParam("pose_history_keyposes", &pose_history_keyposes);
+  parser.GetParam("pose_history_filter_states", &pose_history_filter_states);
   parser.GetParam("reliable_vision_min_lmks", &reliable_vision_min_lmks);
+  parser.GetParam("keyframe_info_gain", &keyframe_info_gain);
   parser.GetParam("max_sec_btw_keyposes", &max_sec_btw_keyposes);
   parser.GetParam("min_sec_btw_keyposes", &min_sec_btw_keyposes);
+  parser.GetParam("max_merged_vo", &max_merged_vo);
   parser.GetParam("smoother_init_wait_vision_sec", &smoother_init_wait_vision_sec);
+  parser.GetParam("dead_reckoning_after_sec", &dead_reckoning_after_sec);
   parser.GetParam("allowed_misalignment_depth", &allowed_misalignment_depth);
   parser.GetParam("allowed_misalignment_imu", &allowed_misalignment_imu);
   parser.GetParam("allowed_misalignment_range", &allowed_misalignment_range);
   parser.GetParam("allowed_misalignment_mag", &allowed_misalignment_mag);
+  parser.GetParam("allowed_misalignment_pose", &allowed_misalignment_pose);
   parser.GetParam("max_filter_divergence_position", &max_filter_divergence_position);
   parser.GetParam("max_filter_divergence_rotation", &max_filter_divergence_rotation);
   parser.GetParam("show_feature_tracks", &show_feature_tracks);
   parser.GetParam("body_nG_tol", &body_nG_tol);
   parser.GetParam("filter_use_depth", &filter_use_depth);
   parser.GetParam("filter_use_range", &filter_use_range);
+  parser.GetParam("use_tags", &use_tags);
+  parser.GetParam("use_relocalization", &use_relocalization);
+  parser.GetParam("reloc_after_dropout_sec", &reloc_after_dropout_sec);
+  parser.GetParam("reloc_max_sec", &reloc_max_sec);
+  parser.GetParam("filter_batch_window_sec", &filter_batch_window_sec);
+  parser.GetParam("reorder_window_imu", &reorder_window_imu);
+  parser.GetParam("reorder_window_depth", &reorder_window_depth);
+  parser.GetParam("reorder_window_range", &reorder_window_range);
+  parser.GetParam("reorder_window_mag", &reorder_window_mag);
+  parser.GetParam("lockstep", &lockstep);
+  parser.GetParam("resource_sample_interval_sec", &resource_sample_interval_sec);
+  checkpoint_path = YamlToString(parser.GetNode("checkpoint_path"));
+  parser.GetParam("checkpoint_interval_sec", &checkpoint_interval_sec);
+  parser.GetParam("checkpoint_max_age_sec", &checkpoint_max_age_sec);
+  parser.GetParam("checkpoint_sigma_t_per_sec", &checkpoint_sigma_t_per_sec);
+  parser.GetParam("checkpoint_sigma_r_per_sec", &checkpoint_sigma_r_per_sec);
+  mission_log_path = YamlToString(parser.GetNode("mission_log_path"));
+  parser.GetParam("realtime_memory", &realtime_memory);
+  parser.GetParam("realtime_warmup_updates", &realtime_warmup_updates);
+  parser.GetParam("realtime_stack_kb", &realtime_stack_kb);
+  parser.GetParam("frontend_height", &frontend_height);
+
+  YamlToThreadConfig(parser.GetNode("frontend_thread"), frontend_thread);
+  YamlToThreadConfig(parser.GetNode("rig_frontend_thread"), rig_frontend_thread);
+  YamlToThreadConfig(parser.GetNode("smoother_thread"), smoother_thread);
+  YamlToThreadConfig(parser.GetNode("filter_thread"), filter_thread);
+  YamlToThreadConfig(parser.GetNode("batch_thread"), batch_thread);
+
+  if (batch_params.enabled) {
+    CHECK_GT(smoother_params.history_sec, 0) << "BatchSmoother needs FixedLagSmoother history_sec > 0" << std::endl;
+  }
 
   YamlToVector<Vector3d>(parser.GetNode("/shared/n_gravity"), n_gravity);
-  Matrix4d body_T_left, body_T_right;
-  YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_left, body_T_right);
-
   body_P_imu = gtsam::Pose3(YamlToTransform(parser.GetNode("/shared/imu0/body_T_imu")));
-  body_P_cam = gtsam::Pose3(body_T_left);
+
+  body_P_cams.clear();
+  stereo_rigs.clear();
+  for (const std::string& name : YamlToStringList(parser.GetNode("/shared/stereo_rigs"))) {
+    Matrix4d body_T_left, body_T_right;
+    StereoCamera rig;
+    YamlToStereoRig(parser.GetNode("/shared/" + name), rig, body_T_left, body_T_right);
+    body_P_cams.emplace_back(body_T_left);
+    stereo_rigs.emplace_back(rig);
+  }
+  CHECK(!stereo_rigs.empty()) << "Need at least one stereo rig in /shared/stereo_rigs" << std::endl;
+
+  // NOTE(milo): The submodules only know about one camera, so point them all at the primary rig.
+  stereo_rig = stereo_rigs.front();
+  body_P_cam = body_P_cams.front();
+  stereo_frontend_params.stereo_rig = stereo_rig;
+
+  // The smoother gets observations from the frontends, so its calibration has to be at their
+  // resolution too.
+  CHECK_GE(frontend_height, 0);
+  smoother_params.stereo_rigs.clear();
+  for (const StereoCamera& rig : stereo_rigs) {
+    smoother_params.stereo_rigs.emplace_back(FrontendRig(rig, frontend_height));
+  }
+  filter_params.body_T_cam = body_P_cam.matrix();
+  tag_localizer_params.body_T_cam = body_P_cam.matrix();
+  relocalizer_params.body_T_cam = body_P_cam.matrix();
+}
+
+
+// The full effort tracker settings, packed into one word (features in the high half).
+static uint64_t PackEffort(int max_features_per_frame, int klt_max_level)
+{
+  return (static_cast<uint64_t>(static_cast<uint32_t>(max_features_per_frame)) << 32) |
+          static_cast<uint32_t>(klt_max_level);
 }
 
 
-StateEstimator::StateEstimator(const Params& params)
+static void UnpackEffort(uint64_t effort, int& max_features_per_frame, int& klt_max_level)
+{
+  max_features_per_frame = static_cast<int>(effort >> 32);
+  klt_max_level = static_cast<int>(effort & 0xffffffffu);
+}
+
+
+StateEstimator::StateEstimator(const Params& params, const EstimatorResources& resources)
     : params_(params),
+      resources_(resources),
       stereo_rig_(params.stereo_rig),
       is_shutdown_(false),
-      stereo_frontend_(params_.stereo_frontend_params),
+      stereo_frontend_(FrontendParams(params_, 0)),
+      scheduler_(params_.scheduler_params),
+      full_effort_(PackEffort(params_.stereo_frontend_params.tracker_params.detector_params.max_features_per_frame,
+                              params_.stereo_frontend_params.tracker_params.tracker_params.klt_max_level)),
       raw_stereo_queue_(params_.max_size_raw_stereo_queue, true, "raw_stereo_queue"),
       smoother_imu_manager_(params_.imu_manager_params, "smoother_imu_manager"),
       smoother_vo_queue_(params_.max_size_smoother_vo_queue, true, "smoother_vo_queue"),
       smoother_depth_manager_(params_.max_size_smoother_depth_queue, true, "smoother_depth_manager"),
       smoother_range_manager_(params_.max_size_smoother_range_queue, true, "smoother_range_manager"),
       smoother_mag_manager_(params_.max_size_smoother_mag_queue, true, "smoother_mag_manager"),
-      filter_imu_manager_(params.imu_manager_params, "filter_imu_manager"),
+      smoother_pose_manager_(params_.max_size_smoother_pose_queue, true, "smoother_pose_manager"),
+      filter_imu_manager_(FilterImuParams(params_), "filter_imu_manager"),
       filter_depth_manager_(params_.max_size_filter_depth_queue, true, "filter_depth_manager"),
       filter_range_manager_(params_.max_size_filter_range_queue, true, "filter_range_manager"),
-      stats_("StateEstimator", params_.stats_tracker_k)
+      pose_history_(params_.pose_history_keyposes, params_.pose_history_filter_states),
+      imu_propagator_(params_.propagator_params),
+      stats_("StateEstimator", params_.stats_tracker_k),
+      resource_sampler_(params_.resource_sample_interval_sec),
+      viz_tap_(std::make_shared<VizTap>())
 {
   LOG(INFO) << "Constructed StateEstimator!" << std::endl;
 
+  // NOTE(milo): The GpuContext pools are shared with any other GPU modules in the process (e.g the
+  // dense mesher), so they're counted here too.
+  resource_sampler_.AddMemorySource("gpu_pool_device", []() {
+    return static_cast<double>(GpuContext::Global().MemoryUsage().device_bytes);
+  });
+  resource_sampler_.AddMemorySource("gpu_pool_host", []() {
+    return static_cast<double>(GpuContext::Global().MemoryUsage().host_bytes);
+  });
+
+  if (params_.show_feature_tracks) {
+    viz_viewer_.reset(new VizTapViewer(viz_tap_));
+  }
+
+  if (params_.use_tags) {
+    tag_localizer_.reset(new TagLocalizer(params_.tag_localizer_params, stereo_rig_.LeftCamera()));
+  }
+
+  if (params_.use_relocalization) {
+    relocalizer_.reset(new Relocalizer(params_.relocalizer_params, stereo_rig_, resources_.vocabulary));
+  }
+
+  // NOTE(milo): Each rig's landmark ids start from their own offset, so that they never collide in
+  // the smoother (or anything downstream).
+  for (size_t rig = 1; rig < params_.stereo_rigs.size(); ++rig) {
+    rig_frontends_.emplace_back(new RigFrontend(FrontendParams(params_, rig), params_.max_size_raw_stereo_queue,
+                                                params_.max_size_smoother_vo_queue));
+    rig_frontends_.back()->frontend.ReserveLandmarkIds(rig * kLandmarkIdsPerRig);
+  }
+
+  if (!params_.checkpoint_path.empty()) {
+    checkpoint_writer_.reset(new CheckpointWriter(params_.checkpoint_path, params_.checkpoint_interval_sec));
+  }
+
+  if (!params_.mission_log_path.empty()) {
+    mission_log_.reset(new MissionLogWriter(params_.mission_log_path));
+  }
+
   Vector3d n_gravity_unit;
   depth_axis_ = GetGravityAxis(params_.n_gravity, n_gravity_unit);
   depth_sign_ = n_gravity_unit(depth_axis_) >= 0 ? 1.0 : -1.0;
   LOG(INFO) << "Unit GRAVITY/DEPTH axis: " << n_gravity_unit.transpose() << std::endl;
+
+  // The filter reads the same stored measurements as the smoother (with its own read cursor), so
+  // Receive*() only has to push each measurement once.
+  filter_imu_manager_.ShareWith(smoother_imu_manager_);
+  if (params_.filter_use_depth) {
+    filter_depth_manager_.ShareWith(smoother_depth_manager_);
+  }
+  if (params_.filter_use_range) {
+    filter_range_manager_.ShareWith(smoother_range_manager_);
+  }
+
+  if ((params_.use_tags || params_.use_relocalization) && params_.lockstep) {
+    LOG(WARNING) << "Lockstep mode doesn't wait for the LocalizerLoop, so tag and relocalization priors aren't deterministic" << std::endl;
+  }
+
+  // NOTE(milo): Only the smoother managers are pushed to, so they do the reordering for both.
+  smoother_imu_manager_.SetReorderWindow(params_.reorder_window_imu);
+  smoother_depth_manager_.SetReorderWindow(params_.reorder_window_depth);
+  smoother_range_manager_.SetReorderWindow(params_.reorder_window_range);
+  smoother_mag_manager_.SetReorderWindow(params_.reorder_window_mag);
+
+  if (params_.lockstep) {
+    LOG(INFO) << "Lockstep mode: async_update, batch smoother and frontend scheduler are off" << std::endl;
+    params_.smoother_params.async_update = false;
+    params_.batch_params.enabled = false;
+  }
 }
 
 
-void StateEstimator::ReceiveStereo(const StereoImage1b& stereo_pair)
+void StateEstimator::ReceiveStereo(const StereoImage1b& stereo_pair, size_t rig)
 {
+  if (rig > 0) {
+    ReceiveStereo(StereoImage1b(stereo_pair), rig);
+    return;
+  }
+  if (tag_localizer_ || relocalizer_) {
+    localizer_image_.Write(std::make_shared<const StereoImage1b>(stereo_pair));
+  }
   raw_stereo_queue_.Push(stereo_pair);
+
+  if (params_.lockstep) {
+    LockstepReceive(stereo_pair.timestamp, false, false);
+  }
+}
+
+
+void StateEstimator::ReceiveStereo(StereoImage1b&& stereo_pair, size_t rig)
+{
+  CHECK_LT(rig, params_.stereo_rigs.size()) << "Invalid stereo rig: " << rig << std::endl;
+  const timestamp_t timestamp = stereo_pair.timestamp;
+  if (rig > 0) {
+    rig_frontends_.at(rig - 1)->raw_stereo_queue.Push(std::move(stereo_pair));
+  } else {
+    if (tag_localizer_ || relocalizer_) {
+      localizer_image_.Write(std::make_shared<const StereoImage1b>(stereo_pair));
+    }
+    raw_stereo_queue_.Push(std::move(stereo_pair));
+  }
+
+  if (params_.lockstep) {
+    LockstepReceive(timestamp, false, false);
+  }
 }
 
 
@@ -87,27 +351,75 @@ void StateEstimator::ReceiveImu(const ImuMeasurement& imu_data)
   // NOTE(milo): This raw imu_data is expressed in the IMU frame. Internally, the GTSAM IMU
   // preintegration will account for body_P_sensor and convert measurements to the body frame.
   // Also, the StateEKf will account for body_T_imu. So no need to "pre-rotate" these measurements.
+  // NOTE(milo): The filter_imu_manager_ shares storage with the smoother_imu_manager_.
   smoother_imu_manager_.Push(imu_data);
-  filter_imu_manager_.Push(imu_data);
+  filter_notifier_.Notify();
+
+  if (params_.propagator_params.enabled) {
+    PropagatedState propagated;
+    if (imu_propagator_.Propagate(imu_data, propagated)) {
+      for (const PropagatedState::Callback& cb : propagated_state_callbacks_) {
+        cb(propagated);
+      }
+    }
+  }
+
+  if (params_.lockstep) {
+    LockstepReceive(imu_data.timestamp, true, true);
+  }
+}
+
+
+void StateEstimator::ReceiveImuBatch(const ImuMeasurement* imu_data, size_t n)
+{
+  if (n == 0) {
+    return;
+  }
+
+  smoother_imu_manager_.PushBatch(imu_data, n);
+  filter_notifier_.Notify();
+
+  if (params_.propagator_params.enabled) {
+    for (size_t i = 0; i < n; ++i) {
+      PropagatedState propagated;
+      if (imu_propagator_.Propagate(imu_data[i], propagated)) {
+        for (const PropagatedState::Callback& cb : propagated_state_callbacks_) {
+          cb(propagated);
+        }
+      }
+    }
+  }
+
+  if (params_.lockstep) {
+    LockstepReceive(imu_data[n - 1].timestamp, true, true);
+  }
 }
 
 
 void StateEstimator::ReceiveDepth(const DepthMeasurement& depth_data)
 {
+  // NOTE(milo): If filter_use_depth, the filter_depth_manager_ shares this storage.
   smoother_depth_manager_.Push(depth_data);
   if (params_.filter_use_depth) {
-    filter_depth_manager_.Push(depth_data);
+    filter_notifier_.Notify();
+  }
+
+  if (params_.lockstep) {
+    LockstepReceive(depth_data.timestamp, true, params_.filter_use_depth);
   }
 }
 
 
 void StateEstimator::ReceiveRange(const RangeMeasurement& range_data)
 {
+  // NOTE(milo): If filter_use_range, the filter_range_manager_ shares this storage.
   smoother_range_manager_.Push(range_data);
-
-  // NOTE(milo): Don't send range data to the filter for now. Results in jumpy state estimates.
   if (params_.filter_use_range) {
-    filter_range_manager_.Push(range_data);
+    filter_notifier_.Notify();
+  }
+
+  if (params_.lockstep) {
+    LockstepReceive(range_data.timestamp, true, params_.filter_use_range);
   }
 }
 
@@ -115,6 +427,185 @@ void StateEstimator::ReceiveRange(const RangeMeasurement& range_data)
 void StateEstimator::ReceiveMag(const MagMeasurement& mag_data)
 {
   smoother_mag_manager_.Push(mag_data);
+
+  if (params_.lockstep) {
+    LockstepReceive(mag_data.timestamp, true, false);
+  }
+}
+
+
+void StateEstimator::ReceivePose(const PoseMeasurement& pose_data)
+{
+  smoother_pose_manager_.Push(pose_data);
+
+  if (params_.lockstep) {
+    LockstepReceive(pose_data.timestamp, true, false);
+  }
+}
+
+
+void StateEstimator::LockstepReceive(timestamp_t timestamp, bool to_smoother, bool to_filter)
+{
+  data_clock_.store(std::max(data_clock_.load(), ConvertToSeconds(timestamp)));
+
+  if (to_smoother) {
+    ++smoother_ticks_;
+    smoother_notifier_.Notify();
+  }
+  if (to_filter) {
+    ++filter_ticks_;
+    filter_notifier_.Notify();
+  }
+
+  WaitUntilIdle();
+}
+
+
+void StateEstimator::SetLockstepBusy(std::atomic_bool& busy, bool value)
+{
+  if (params_.lockstep) {
+    busy.store(value);
+    if (!value) {
+      idle_notifier_.Notify();
+    }
+  }
+}
+
+
+bool StateEstimator::IsIdle()
+{
+  // NOTE(milo): Every thread marks itself busy before it takes work off of its inputs, and only
+  // idle after it's passed results downstream. Checking in pipeline order (frontend, smoother,
+  // filter) means that a measurement can't slip between two of these checks unseen.
+  // NOTE(milo): The other rigs' VO only gets read at the next keypose, so just wait for their
+  // frontends to be done with it.
+  for (const auto& rig : rig_frontends_) {
+    if (!rig->raw_stereo_queue.Empty() || rig->busy) {
+      return false;
+    }
+  }
+  return raw_stereo_queue_.Empty() && !frontend_busy_ &&
+         smoother_vo_queue_.Empty() && smoother_ticks_ == 0 && !smoother_busy_ &&
+         !smoother_update_flag_ && filter_ticks_ == 0 && !filter_busy_;
+}
+
+
+void StateEstimator::WaitUntilIdle()
+{
+  CHECK(params_.lockstep) << "WaitUntilIdle() is only for lockstep mode" << std::endl;
+  idle_notifier_.Wait([this]() { return is_shutdown_ || IsIdle(); });
+}
+
+
+bool StateEstimator::LockstepWaitForVo(seconds_t since, double wait_sec)
+{
+  while (true) {
+    SetLockstepBusy(smoother_busy_, false);
+    smoother_notifier_.Wait([this]() {
+      return is_shutdown_ || !smoother_vo_queue_.Empty() || smoother_ticks_ > 0;
+    });
+    SetLockstepBusy(smoother_busy_, true);
+    smoother_ticks_ = 0;
+
+    if (is_shutdown_) {
+      return true;
+    }
+
+    // Woken up by new data, which might be IMU (see WaitForVo()).
+    smoother_imu_manager_.Advance();
+
+    if (!smoother_vo_queue_.Empty()) {
+      return false;
+    }
+    if ((data_clock_.load() - since) > wait_sec) {
+      return true;
+    }
+  }
+}
+
+
+bool StateEstimator::WaitForVo(double wait_sec)
+{
+  if (!params_.imu_manager_params.incremental) {
+    return WaitForResultOrTimeout<SpscQueue<VoResult>>(smoother_vo_queue_, wait_sec);
+  }
+
+  Timer timer(true);
+  while (true) {
+    smoother_imu_manager_.Advance();
+    const double remaining_sec = wait_sec - timer.Elapsed().seconds();
+    if (remaining_sec <= 0) {
+      return smoother_vo_queue_.Empty();
+    }
+    const double step_sec = std::min(remaining_sec, 0.01);
+    if (!WaitForResultOrTimeout<SpscQueue<VoResult>>(smoother_vo_queue_, step_sec) || is_shutdown_) {
+      return smoother_vo_queue_.Empty();
+    }
+  }
+}
+
+
+void StateEstimator::SetMaxFeaturesPerFrame(int max_features_per_frame)
+{
+  int unused, klt_max_level;
+  UnpackEffort(full_effort_.load(std::memory_order_relaxed), unused, klt_max_level);
+  SetTrackerEffort(max_features_per_frame, klt_max_level);
+}
+
+
+void StateEstimator::SetTrackerEffort(int max_features_per_frame, int klt_max_level)
+{
+  CHECK_GT(max_features_per_frame, 0) << "max_features_per_frame must be positive" << std::endl;
+  CHECK_GE(klt_max_level, 0) << "klt_max_level can't be negative" << std::endl;
+  full_effort_.store(PackEffort(max_features_per_frame, klt_max_level), std::memory_order_relaxed);
+}
+
+
+void StateEstimator::ExportQueueStats()
+{
+  ExportQueueTelemetry(stats_, "raw_stereo", raw_stereo_queue_);
+  for (size_t i = 0; i < rig_frontends_.size(); ++i) {
+    const std::string rig = "rig" + std::to_string(i + 1);
+    ExportQueueTelemetry(stats_, rig + "_raw_stereo", rig_frontends_.at(i)->raw_stereo_queue);
+    ExportQueueTelemetry(stats_, rig + "_vo", rig_frontends_.at(i)->vo_queue);
+  }
+  ExportQueueTelemetry(stats_, "smoother_vo", smoother_vo_queue_);
+  ExportQueueTelemetry(stats_, "smoother_imu", smoother_imu_manager_);
+  ExportQueueTelemetry(stats_, "smoother_depth", smoother_depth_manager_);
+  ExportQueueTelemetry(stats_, "smoother_range", smoother_range_manager_);
+  ExportQueueTelemetry(stats_, "smoother_mag", smoother_mag_manager_);
+  ExportQueueTelemetry(stats_, "smoother_pose", smoother_pose_manager_);
+  ExportQueueTelemetry(stats_, "filter_imu", filter_imu_manager_);
+  ExportQueueTelemetry(stats_, "filter_depth", filter_depth_manager_);
+  ExportQueueTelemetry(stats_, "filter_range", filter_range_manager_);
+}
+
+
+StatsSnapshot StateEstimator::GetStats()
+{
+  stats_.Counter("Dropped/raw_stereo") = raw_stereo_queue_.NumDropped();
+  stats_.Counter("Dropped/smoother_vo") = smoother_vo_queue_.NumDropped();
+  for (size_t i = 0; i < rig_frontends_.size(); ++i) {
+    const std::string rig = std::to_string(i + 1);
+    stats_.Counter("Dropped/rig" + rig + "_raw_stereo") = rig_frontends_.at(i)->raw_stereo_queue.NumDropped();
+    stats_.Counter("Dropped/rig" + rig + "_vo") = rig_frontends_.at(i)->vo_queue.NumDropped();
+  }
+  stats_.Counter("Dropped/smoother_imu") = smoother_imu_manager_.NumDropped();
+  stats_.Counter("Dropped/smoother_depth") = smoother_depth_manager_.NumDropped();
+  stats_.Counter("Dropped/smoother_range") = smoother_range_manager_.NumDropped();
+  stats_.Counter("Dropped/smoother_mag") = smoother_mag_manager_.NumDropped();
+  stats_.Counter("Dropped/smoother_pose") = smoother_pose_manager_.NumDropped();
+  stats_.Counter("Dropped/filter_imu") = filter_imu_manager_.NumDropped();
+  stats_.Counter("Dropped/filter_depth") = filter_depth_manager_.NumDropped();
+  stats_.Counter("Dropped/filter_range") = filter_range_manager_.NumDropped();
+  stats_.Counter("Late/imu") = smoother_imu_manager_.NumLate();
+  stats_.Counter("Late/depth") = smoother_depth_manager_.NumLate();
+  stats_.Counter("Late/range") = smoother_range_manager_.NumLate();
+  stats_.Counter("Late/mag") = smoother_mag_manager_.NumLate();
+  stats_.Counter("Late/pose") = smoother_pose_manager_.NumLate();
+  ExportQueueStats();
+  resource_sampler_.Sample(stats_);
+  return stats_.Snapshot();
 }
 
 
@@ -130,23 +621,122 @@ void StateEstimator::RegisterFilterResultCallback(const StateStamped::Callback&
 }
 
 
+void StateEstimator::RegisterBatchResultCallback(const BatchResult::Callback& cb)
+{
+  batch_result_callbacks_.emplace_back(cb);
+}
+
+
+void StateEstimator::RegisterPropagatedStateCallback(const PropagatedState::Callback& cb)
+{
+  propagated_state_callbacks_.emplace_back(cb);
+}
+
+
+void StateEstimator::RegisterFeatureTracksCallback(const FeatureTracksCallback& cb)
+{
+  feature_tracks_callbacks_.emplace_back(cb);
+}
+
+
+WarmUpReport StateEstimator::WarmUp(int num_frames)
+{
+  WarmUpReport report;
+  if (num_frames <= 0) {
+    return report;
+  }
+
+  const ScopedTaskScheduler bind_scheduler(resources_.scheduler);
+  Timer timer(true);
+  StereoFrontend frontend(FrontendParams(params_, 0));
+  const StereoCamera& rig = frontend.GetStereoRig();
+  report.Add("frontend_init", timer.Tock().milliseconds());
+
+  Image1b texture(rig.Height(), rig.Width() + rig.Width() / 64 + 2 * num_frames + 1);
+  cv::RNG rng(123);
+  rng.fill(texture, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(texture, texture, cv::Size(5, 5), 1.5);
+
+  // NOTE(milo): The first frame is the slow one, the rest show what steady state looks like.
+  VoResult::Ptr vo;
+  for (int k = 0; k < num_frames; ++k) {
+    timer.Reset();
+    vo = std::make_shared<VoResult>(frontend.Track(WarmUpStereoPair(texture, rig, k), Matrix4d::Identity()));
+    report.Add(k == 0 ? "frontend_first" : "frontend", timer.Tock().milliseconds());
+  }
+
+  // A dry run of the smoother, on the last VO (with the first keypose at its last keyframe).
+  timer.Reset();
+  FixedLagSmoother smoother(params_.smoother_params);
+  try {
+    smoother.Initialize(ConvertToSeconds(vo->timestamp_lkf), gtsam::Pose3::identity(),
+                        gtsam::Vector3::Zero(), kZeroImuBias, false);
+    smoother.Update(vo, nullptr);
+    smoother.WaitUntilIdle();
+  } catch (const gtsam::IndeterminantLinearSystemException& e) {
+    LOG(WARNING) << "Smoother warm-up update failed (this is harmless): " << e.what() << std::endl;
+  }
+  report.Add("smoother", timer.Tock().milliseconds());
+
+  LOG(INFO) << "StateEstimator warmed up: " << report.ToString() << std::endl;
+  return report;
+}
+
+
 void StateEstimator::Initialize(seconds_t t0, const gtsam::Pose3 P0_world_body)
 {
+  if (viz_viewer_) {
+    viz_viewer_->Start();
+  }
   stereo_frontend_thread_ = std::thread(&StateEstimator::StereoFrontendLoop, this);
+  for (size_t i = 0; i < rig_frontends_.size(); ++i) {
+    rig_frontends_.at(i)->thread = std::thread(&StateEstimator::RigFrontendLoop, this, i + 1);
+  }
   smoother_thread_ = std::thread(&StateEstimator::SmootherLoop, this, t0, P0_world_body);
   filter_thread_ = std::thread(&StateEstimator::FilterLoop, this, t0, P0_world_body);
+  if (tag_localizer_ || relocalizer_) {
+    localizer_thread_ = std::thread(&StateEstimator::LocalizerLoop, this);
+  }
+}
+
+
+bool StateEstimator::Initialize(const std::string& checkpoint_path)
+{
+  StateCheckpoint checkpoint;
+  if (!ReadCheckpoint(checkpoint_path, checkpoint)) {
+    LOG(WARNING) << "Couldn't read checkpoint: " << checkpoint_path << std::endl;
+    return false;
+  }
+  LOG(INFO) << "Resuming from checkpoint at t=" << checkpoint.smoother.timestamp
+            << " (keypose " << checkpoint.smoother.keypose_id << ")" << std::endl;
+
+  // NOTE(milo): The old tracks can't be continued without their images, but new landmarks must not
+  // reuse their ids (e.g in logs and the mesher).
+  uid_t next_lmk_id = 0;
+  for (const LandmarkObservation& obs : checkpoint.landmarks) {
+    next_lmk_id = std::max(next_lmk_id, obs.landmark_id + 1);
+  }
+  stereo_frontend_.ReserveLandmarkIds(next_lmk_id);
+
+  restore_.reset(new StateCheckpoint(std::move(checkpoint)));
+  Initialize(restore_->smoother.timestamp, restore_->smoother.world_P_body);
+  return true;
 }
 
 
 void StateEstimator::BlockUntilFinished()
 {
   LOG(INFO) << "BlockUntilFinished() called! StateEstimator will wait for last image to be processed" << std::endl;
-  while (!is_shutdown_) {
-    while (!smoother_vo_queue_.Empty()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  if (!is_shutdown_) {
+    if (params_.lockstep) {
+      WaitUntilIdle();
+    }
+    raw_stereo_queue_.WaitEmpty();
+    for (const auto& rig : rig_frontends_) {
+      rig->raw_stereo_queue.WaitEmpty();
     }
+    smoother_vo_queue_.WaitEmpty();
     Shutdown();
-    return;
   }
 }
 
@@ -154,45 +744,165 @@ void StateEstimator::BlockUntilFinished()
 void StateEstimator::Shutdown()
 {
   is_shutdown_.store(true);
+
+  // Wake up any threads that are blocked waiting for data.
+  raw_stereo_queue_.Close();
+  smoother_vo_queue_.Close();
+  for (const auto& rig : rig_frontends_) {
+    rig->raw_stereo_queue.Close();
+    rig->vo_queue.Close();
+  }
+  filter_notifier_.Notify();
+  smoother_notifier_.Notify();
+  idle_notifier_.Notify();
+
   if (stereo_frontend_thread_.joinable()) {
     stereo_frontend_thread_.join();
   }
+  for (const auto& rig : rig_frontends_) {
+    if (rig->thread.joinable()) {
+      rig->thread.join();
+    }
+  }
   if (smoother_thread_.joinable()) {
     smoother_thread_.join();
   }
+  if (viz_viewer_) {
+    viz_viewer_->Stop();
+  }
   if (filter_thread_.joinable()) {
     filter_thread_.join();
   }
+  if (localizer_thread_.joinable()) {
+    localizer_thread_.join();
+  }
 }
 
 
 void StateEstimator::StereoFrontendLoop()
 {
+  BM_TRACE_THREAD_NAME("StereoFrontendLoop");
+  ConfigureCurrentThread(params_.frontend_thread, "bm_frontend");
+  const ScopedTaskScheduler bind_scheduler(resources_.scheduler);
   LOG(INFO) << "Started up StereoFrontendLoop() thread" << std::endl;
 
-  if (params_.show_feature_tracks) {
-    cv::namedWindow("StereoTracking", cv::WINDOW_AUTOSIZE);
-  }
+  // Look these up once, so that recording doesn't take the stats lock.
+  LatencyHistogram& track_ms = stats_.Histogram("StereoFrontendTrack");
+  LatencyHistogram& raw_stereo_queue_depth = stats_.Histogram("QueueDepth/raw_stereo");
+  std::atomic<int64_t>& num_skipped = stats_.Counter("Dropped/scheduler_stereo");
+
+  const StereoTracker::Params& tracker_params = params_.stereo_frontend_params.tracker_params;
+  uint64_t applied_effort = full_effort_.load();
+
+  // For the gyro rotation prior (see StereoTracker::Params::klt_rotation_prior).
+  const Matrix3d body_R_cam = params_.body_P_cam.rotation().matrix();
+  Matrix3d world_R_body_prev = Matrix3d::Identity();
+  bool has_prev_rotation = false;
+
+  // For the information based keyframe trigger (see Params::keyframe_info_gain).
+  double logdet_lkf = 0;
+  bool has_logdet_lkf = false;
+
+  // Keyposes sent to the smoother (and keyframes held off for parallax) per minute, on the data clock.
+  seconds_t rate_window_start = -1;
+  size_t rate_window_keyposes = 0;
+  size_t rate_window_suppressed = stereo_frontend_.NumSuppressedKeyframes();
+  size_t num_suppressed_prev = rate_window_suppressed;
 
   while (!is_shutdown_) {
-    // If no images waiting to be processed, take a nap.
-    while (raw_stereo_queue_.Empty()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-      if (is_shutdown_) {
-        LOG(INFO) << "StereoFrontendLoop() exiting" << std::endl;
-        return;
+    // Sleep until an image arrives. Shutdown() closes the queue to wake this thread up.
+    SetLockstepBusy(frontend_busy_, false);
+    if (!raw_stereo_queue_.WaitNotEmpty() || is_shutdown_) {
+      continue;
+    }
+    SetLockstepBusy(frontend_busy_, true);
+
+    raw_stereo_queue_depth.Record(raw_stereo_queue_.Size());
+
+    // Under load, the scheduler may skip some of the oldest frames to keep VO latency bounded.
+    // NOTE(milo): StereoTracker counts processed frames (not camera ids) for retracking and
+    // keyframe triggering, so skipped frames don't break trigger_keyframe_k or retrack_frames_k.
+    const size_t num_to_skip = params_.lockstep ? 0 : scheduler_.NumToSkip(raw_stereo_queue_.ConsumerSize());
+    if (num_to_skip > 0) {
+      raw_stereo_queue_.PopFront(num_to_skip);
+      num_skipped += num_to_skip;
+    }
+    if (raw_stereo_queue_.Empty()) {
+      continue;
+    }
+
+    StereoImage1b stereo_pair = raw_stereo_queue_.Pop();
+    ResizeForFrontend(stereo_pair, stereo_frontend_.GetStereoRig());
+
+    // Predict the camera rotation since the last processed frame from the filter (gyro).
+    // NOTE(milo): The translation is left at zero on purpose. Warping a keypoint by a translation
+    // needs its depth, and the inter-frame translation is small next to the depth of the scene, so
+    // the rotation accounts for almost all of the flow. The odometry solve converges from there.
+    Matrix4d prev_T_cur_prior = Matrix4d::Identity();
+    if (tracker_params.klt_rotation_prior) {
+      Matrix3d world_R_body;
+      if (PredictWorldRotationBody(ConvertToSeconds(stereo_pair.timestamp), world_R_body)) {
+        if (has_prev_rotation) {
+          const Matrix3d prev_R_cur_body = world_R_body_prev.transpose() * world_R_body;
+          prev_T_cur_prior.block<3, 3>(0, 0) = body_R_cam.transpose() * prev_R_cur_body * body_R_cam;
+        }
+        world_R_body_prev = world_R_body;
+        has_prev_rotation = true;
       }
     }
 
+    // The expected information gain of a keyframe is how much the filter's position uncertainty
+    // has grown since the last one.
+    bool force_keyframe = false;
+    double logdet = 0;
+    StateStamped filter_ss;
+    const bool has_logdet = params_.keyframe_info_gain > 0 && filter_state_.Load(filter_ss) > 0;
+    if (has_logdet) {
+      const double det = filter_ss.state.S.block<3, 3>(t_row, t_row).determinant();
+      logdet = std::log(std::max(det, 1e-30));
+      force_keyframe = has_logdet_lkf && 0.5 * (logdet - logdet_lkf) > params_.keyframe_info_gain;
+    }
+
     // Process a stereo image pair (KLT tracking, odometry estimation, etc.)
-    // TODO(milo): Use initial odometry estimate other than identity!
-    VoResult result = stereo_frontend_.Track(
-        raw_stereo_queue_.Pop(), Matrix4d::Identity());
+    Timer timer(true);
+    VoResult result = stereo_frontend_.Track(stereo_pair, prev_T_cur_prior, force_keyframe);
+    const double elapsed_ms = timer.Elapsed().milliseconds();
+    track_ms.Record(elapsed_ms);
+    if (tracer_) {
+      tracer_->Stamp(stereo_pair.timestamp, "frontend");
+    }
+
+    const bool level_changed = !params_.lockstep && scheduler_.Update(elapsed_ms, raw_stereo_queue_.Size());
+    if (level_changed) {
+      stats_.SetGauge("Scheduler/load_level", static_cast<double>(scheduler_.Level()));
+    }
+
+    // NOTE(milo): The full effort can also change at runtime (SetTrackerEffort), which only takes
+    // effect here, between frames.
+    const uint64_t effort = full_effort_.load(std::memory_order_relaxed);
+    if (level_changed || effort != applied_effort) {
+      applied_effort = effort;
+      if (scheduler_.ReducedEffort()) {
+        stereo_frontend_.SetTrackerEffort(params_.scheduler_params.reduced_max_features_per_frame,
+                                          params_.scheduler_params.reduced_klt_max_level);
+      } else {
+        int max_features, klt_max_level;
+        UnpackEffort(effort, max_features, klt_max_level);
+        stereo_frontend_.SetTrackerEffort(max_features, klt_max_level);
+      }
+    }
 
-    if (params_.show_feature_tracks) {
-      const Image3b& viz = stereo_frontend_.VisualizeFeatureTracks();
-      cv::imshow("StereoTracking", viz);
-      cv::waitKey(1);
+    for (const FeatureTracksCallback& cb : feature_tracks_callbacks_) {
+      cb(stereo_pair, stereo_frontend_.GetLiveTracks());
+    }
+
+    // NOTE(milo): Rendering happens on the viewer's thread, so it doesn't slow down VO.
+    if (viz_tap_->HasListeners()) {
+      DrawList list;
+      list.window = "StereoTracking";
+      list.timestamp = stereo_pair.timestamp;
+      stereo_frontend_.GetFeatureTracksDrawList(list);
+      viz_tap_->Publish(std::move(list));
     }
 
     const bool tracking_failed = (result.status & StereoFrontend::Status::ODOM_ESTIMATION_FAILED) ||
@@ -205,31 +915,368 @@ void StateEstimator::StereoFrontendLoop()
     // If there are observed landmarks in this image, there must be visual texture.
     const bool vision_reliable_now = (int)result.lmk_obs.size() >= params_.reliable_vision_min_lmks;
 
+    // While hovering, keyframes are held off (see trigger_keyframe_min_parallax), which isn't the
+    // same as losing vision. The smoother waits for the next keyframe instead of adding IMU keyposes.
+    const size_t suppressed_now = stereo_frontend_.NumSuppressedKeyframes();
+    frontend_hovering_.store(suppressed_now > num_suppressed_prev && vision_reliable_now && !tracking_failed);
+    num_suppressed_prev = suppressed_now;
+
     // CASE 1: If this is a reliable keyframe, send to the smoother.
     // NOTE: This means that we will NOT send the first result to the smoother!
     if (result.is_keyframe && vision_reliable_now && !tracking_failed) {
+      if (checkpoint_writer_) {
+        checkpoint_landmarks_.Write(result.lmk_obs);
+      }
       smoother_vo_queue_.Push(std::move(result));
+      smoother_notifier_.Notify();
+
+      if (has_logdet) {
+        logdet_lkf = logdet;
+        has_logdet_lkf = true;
+      }
+      ++rate_window_keyposes;
+    }
+
+    const seconds_t now = ConvertToSeconds(stereo_pair.timestamp);
+    if (rate_window_start < 0) {
+      rate_window_start = now;
+    }
+    const double window_sec = now - rate_window_start;
+    if (window_sec >= params_.stats_print_interval_sec && window_sec > 0) {
+      const size_t suppressed = stereo_frontend_.NumSuppressedKeyframes();
+      stats_.SetGauge("Keyframes/keyposes_per_min", 60.0 * rate_window_keyposes / window_sec);
+      stats_.SetGauge("Keyframes/suppressed_per_min", 60.0 * (suppressed - rate_window_suppressed) / window_sec);
+      rate_window_start = now;
+      rate_window_keyposes = 0;
+      rate_window_suppressed = suppressed;
+    }
+  }
+
+  LOG(INFO) << "StereoFrontendLoop() exiting" << std::endl;
+}
+
+
+void StateEstimator::RigFrontendLoop(size_t rig)
+{
+  const std::string name = "RigFrontendLoop" + std::to_string(rig);
+  BM_TRACE_THREAD_NAME(name);
+  ConfigureCurrentThread(params_.rig_frontend_thread, "bm_rig" + std::to_string(rig));
+  const ScopedTaskScheduler bind_scheduler(resources_.scheduler);
+  LOG(INFO) << "Started up " << name << "() thread" << std::endl;
+
+  RigFrontend& rf = *rig_frontends_.at(rig - 1);
+  LatencyHistogram& track_ms = stats_.Histogram("RigFrontendTrack/rig" + std::to_string(rig));
+
+  const bool rotation_prior = params_.stereo_frontend_params.tracker_params.klt_rotation_prior;
+  const Matrix3d body_R_cam = params_.body_P_cams.at(rig).rotation().matrix();
+  Matrix3d world_R_body_prev = Matrix3d::Identity();
+  bool has_prev_rotation = false;
+
+  while (!is_shutdown_) {
+    SetLockstepBusy(rf.busy, false);
+    if (!rf.raw_stereo_queue.WaitNotEmpty() || is_shutdown_) {
+      continue;
+    }
+    SetLockstepBusy(rf.busy, true);
+
+    // NOTE(milo): These rigs don't make keyposes, so if this thread falls behind, skip straight to
+    // the newest frame instead of adding latency.
+    if (!params_.lockstep && rf.raw_stereo_queue.ConsumerSize() > 1) {
+      rf.raw_stereo_queue.PopFront(rf.raw_stereo_queue.ConsumerSize() - 1);
+    }
+    StereoImage1b stereo_pair = rf.raw_stereo_queue.Pop();
+    ResizeForFrontend(stereo_pair, rf.frontend.GetStereoRig());
+
+    Matrix4d prev_T_cur_prior = Matrix4d::Identity();
+    if (rotation_prior) {
+      Matrix3d world_R_body;
+      if (PredictWorldRotationBody(ConvertToSeconds(stereo_pair.timestamp), world_R_body)) {
+        if (has_prev_rotation) {
+          const Matrix3d prev_R_cur_body = world_R_body_prev.transpose() * world_R_body;
+          prev_T_cur_prior.block<3, 3>(0, 0) = body_R_cam.transpose() * prev_R_cur_body * body_R_cam;
+        }
+        world_R_body_prev = world_R_body;
+        has_prev_rotation = true;
+      }
+    }
+
+    Timer timer(true);
+    VoResult result = rf.frontend.Track(stereo_pair, prev_T_cur_prior);
+    track_ms.Record(timer.Elapsed().milliseconds());
+
+    const bool tracking_failed = (result.status & StereoFrontend::Status::ODOM_ESTIMATION_FAILED) ||
+                                 (result.status & StereoFrontend::Status::FEW_TRACKED_FEATURES);
+    const bool vision_reliable_now = (int)result.lmk_obs.size() >= params_.reliable_vision_min_lmks;
+
+    if (result.is_keyframe && vision_reliable_now && !tracking_failed) {
+      result.rig = rig;
+      rf.vo_queue.Push(std::move(result));
+    }
+  }
+
+  LOG(INFO) << name << "() exiting" << std::endl;
+}
+
+
+void StateEstimator::AddRigVo(FixedLagSmoother& smoother)
+{
+  for (const auto& rig : rig_frontends_) {
+    while (!rig->vo_queue.Empty()) {
+      smoother.AddRigVo(std::make_shared<VoResult>(rig->vo_queue.Pop()));
+    }
+  }
+}
+
+
+void StateEstimator::OnFilterState(const StateStamped& state)
+{
+  filter_state_.Store(state);
+  pose_history_.AddFilter(PoseStamped(state.timestamp, state.state.q, state.state.t));
+
+  if (params_.propagator_params.enabled) {
+    imu_propagator_.Reset(state);
+  }
+
+  // Process all callbacks with the updated state. These will block so they should be fast!
+  for (const StateStamped::Callback& cb : filter_result_callbacks_) {
+    cb(state);
+  }
+}
+
+
+bool StateEstimator::PredictWorldRotationBody(seconds_t timestamp, Matrix3d& world_R_body)
+{
+  StateStamped ss;
+  if (filter_state_.Load(ss) == 0) {
+    return false;
+  }
+
+  // Angular velocity is in the body frame, so the extra rotation goes on the right.
+  const Vector3d rotvec = ss.state.w * (timestamp - ss.timestamp);
+  const double angle = rotvec.norm();
+  world_R_body = ss.state.q.normalized().toRotationMatrix();
+  if (angle > 1e-9) {
+    world_R_body = world_R_body * AngleAxisd(angle, rotvec / angle).toRotationMatrix();
+  }
+  return true;
+}
+
+
+bool StateEstimator::FilterPrior(seconds_t timestamp, const SmootherResult& last_keypose, SmootherResult& prior)
+{
+  StateStamped ss;
+  Matrix3d world_R_body;
+  if (filter_state_.Load(ss) == 0 || !PredictWorldRotationBody(timestamp, world_R_body)) {
+    return false;
+  }
+
+  // NOTE(milo): The filter is at the newest IMU measurement, which is usually a little ahead of the
+  // keyframe (frontend latency), so dt is small and can be negative.
+  const double dt = timestamp - ss.timestamp;
+
+  prior = last_keypose;
+  prior.timestamp = timestamp;
+  prior.world_P_body = gtsam::Pose3(gtsam::Rot3(world_R_body), ss.state.t + dt * ss.state.v);
+  prior.world_v_body = ss.state.v;
+  prior.has_covariance = true;
+
+  // Same blocks as the hard reset in FilterLoop(), the other way around.
+  prior.cov_pose.setZero();
+  prior.cov_pose.block<3, 3>(0, 0) = ss.state.S.block<3, 3>(uq_row, uq_row);
+  prior.cov_pose.block<3, 3>(3, 3) = ss.state.S.block<3, 3>(t_row, t_row);
+  prior.cov_vel = ss.state.S.block<3, 3>(v_row, v_row);
+
+  return true;
+}
+
+
+bool StateEstimator::ViInitialize(seconds_t& t0, gtsam::Pose3& world_P_body, gtsam::Vector3& world_v_body, ImuBias& imu_bias)
+{
+  const ViInitializer::Params& vi_params = params_.vi_init_params;
+  ViInitializer vi_init(vi_params);
+  vi_init.Reset(t0);
+
+  const gtsam::Pose3 world_P_b0 = world_P_body;
+  gtsam::Pose3 b0_P_body = gtsam::Pose3::identity();
+  const double wait_sec = params_.max_sec_btw_keyposes + 0.1;
+
+  Timer timer(true);
+  while (!vi_init.Ready()) {
+    const bool did_timeout = params_.lockstep ?
+        LockstepWaitForVo(t0, wait_sec) :
+        WaitForResultOrTimeout<SpscQueue<VoResult>>(smoother_vo_queue_, wait_sec);
+    if (did_timeout || is_shutdown_) {
+      LOG(WARNING) << "ViInitializer: vision stopped after " << vi_init.NumKeyframes() << " keyframes" << std::endl;
+      break;
+    }
+
+    const VoResult vo = smoother_vo_queue_.Pop();
+    const seconds_t t1 = ConvertToSeconds(vo.timestamp);
+    const bool odom_aligned = std::fabs(ConvertToSeconds(vo.timestamp_lkf) - t0) < 0.01;
+
+    // NOTE(milo): Preintegration takes the IMU off of the queue, so the smoother has to start at t1
+    // from here on, whether or not the keyframe can be used.
+    const PimResult pim = smoother_imu_manager_.Preintegrate(t0, t1, params_.allowed_misalignment_imu);
+    const gtsam::Pose3 lkf_P_body = params_.body_P_cam * gtsam::Pose3(vo.lkf_T_cam) * params_.body_P_cam.inverse();
+    if (odom_aligned) {
+      b0_P_body = b0_P_body * lkf_P_body;
+    }
+    t0 = t1;
+
+    if (!odom_aligned || !pim.timestamps_aligned) {
+      LOG(WARNING) << "ViInitializer: keyframe at t=" << t1 << " isn't aligned with the last one (VO "
+                   << odom_aligned << ", IMU " << pim.timestamps_aligned << ")" << std::endl;
+      break;
+    }
+    vi_init.AddKeyframe(t1, lkf_P_body, pim.pim);
+  }
+
+  world_P_body = world_P_b0 * b0_P_body;
+  world_v_body = kZeroVelocity;
+  imu_bias = kZeroImuBias;
+
+  ViInitResult result;
+  if (!vi_init.Solve(result)) {
+    LOG(WARNING) << "ViInitializer failed, starting the smoother at t=" << t0 << " with zero velocity and bias" << std::endl;
+    return false;
+  }
+
+  const gtsam::Rot3 world_R_b0 = vi_params.align_gravity ?
+      ViInitializer::AlignGravity(world_P_b0.rotation(), result.b0_gravity, vi_params.n_gravity) :
+      world_P_b0.rotation();
+  world_P_body = gtsam::Pose3(world_R_b0, world_P_b0.translation()) * result.b0_P_body;
+  world_v_body = world_R_b0.matrix() * result.b0_v_body;
+  imu_bias = result.imu_bias;
+
+  LOG(INFO) << "ViInitializer solved with " << result.num_keyframes << " keyframes in "
+            << timer.Elapsed().milliseconds() << " ms (t=" << t0 << ")\n"
+            << "  gyro bias: " << imu_bias.gyroscope().transpose() << "\n"
+            << "  velocity: " << world_v_body.transpose() << " (rms " << result.velocity_rms << " m/s)\n"
+            << "  gravity error: " << 100.0 * result.gravity_err << "%" << std::endl;
+  return true;
+}
+
+
+void StateEstimator::LocalizerLoop()
+{
+  BM_TRACE_THREAD_NAME("LocalizerLoop");
+  const ScopedTaskScheduler bind_scheduler(resources_.scheduler);
+  LOG(INFO) << "Started up LocalizerLoop() thread" << std::endl;
+
+  // A keypose from vision has the same timestamp as its stereo pair, which might still be here by
+  // the time the keypose arrives.
+  static const size_t kMaxWaitingImages = 20;
+  std::deque<std::shared_ptr<const StereoImage1b>> waiting;
+
+  SmootherResult keypose;
+  seconds_t last_vision_keypose = -1;
+  seconds_t lost_since = -1;          // When vision dropped out (if it hasn't been relocalized yet).
+  seconds_t vision_back_since = -1;   // When vision came back after a dropout.
+
+  std::shared_ptr<const StereoImage1b> image;
+  while (!is_shutdown_) {
+    if (!localizer_image_.WaitAndRead(image, 0.1)) {
+      continue;
+    }
+
+    if (tag_localizer_) {
+      Timer timer(true);
+      const std::vector<PoseMeasurement> poses = tag_localizer_->Localize(image->timestamp, image->left_image);
+      stats_.Add("TagLocalizer", timer.Elapsed().milliseconds());
+      stats_.Print("TagLocalizer", "ms", params_.stats_print_interval_sec);
+
+      for (const PoseMeasurement& pose : poses) {
+        smoother_pose_manager_.Push(pose);
+      }
+    }
+
+    if (!relocalizer_) {
+      continue;
+    }
+
+    const seconds_t t = ConvertToSeconds(image->timestamp);
+    waiting.emplace_back(image);
+    if (waiting.size() > kMaxWaitingImages) {
+      waiting.pop_front();
+    }
+
+    if (reloc_keypose_.Read(keypose)) {
+      for (const std::shared_ptr<const StereoImage1b>& kf_image : waiting) {
+        if (std::fabs(ConvertToSeconds(kf_image->timestamp) - keypose.timestamp) > 1e-6) {
+          continue;
+        }
+        last_vision_keypose = keypose.timestamp;
+
+        // NOTE(milo): Until it's relocalized, the smoother pose has drifted, so don't store it.
+        if (lost_since < 0) {
+          Timer timer(true);
+          relocalizer_->AddKeyframe(*kf_image, keypose.world_P_body.matrix());
+          stats_.Add("RelocalizerAddKeyframe", timer.Elapsed().milliseconds());
+        } else if (vision_back_since < 0) {
+          vision_back_since = t;
+        }
+        break;
+      }
+    }
+
+    if (lost_since < 0 && last_vision_keypose >= 0 && relocalizer_->HasVocabulary() &&
+        (t - last_vision_keypose) > params_.reloc_after_dropout_sec) {
+      LOG(INFO) << "Vision dropped out, will try to relocalize" << std::endl;
+      lost_since = t;
+      vision_back_since = -1;
+    }
+
+    if (lost_since >= 0) {
+      Timer timer(true);
+      const std::vector<PoseMeasurement> poses = relocalizer_->Localize(image->timestamp, image->left_image);
+      stats_.Add("Relocalizer", timer.Elapsed().milliseconds());
+      stats_.Print("Relocalizer", "ms", params_.stats_print_interval_sec);
+
+      for (const PoseMeasurement& pose : poses) {
+        smoother_pose_manager_.Push(pose);
+      }
+
+      const bool gave_up = vision_back_since >= 0 && (t - vision_back_since) > params_.reloc_max_sec;
+      if (!poses.empty() || gave_up) {
+        LOG_IF(WARNING, poses.empty()) << "Couldn't relocalize after vision came back" << std::endl;
+        lost_since = -1;
+        last_vision_keypose = t;
+      }
     }
   }
+
+  LOG(INFO) << "LocalizerLoop() exiting" << std::endl;
 }
 
 
 void StateEstimator::OnSmootherResult(const SmootherResult& new_result)
 {
-  // Copy the result into the state estimator. Use the mutex to make sure we don't change the result
-  // while some other consumer is using it.
-  mutex_smoother_result_.lock();
-  smoother_result_ = new_result;
-  mutex_smoother_result_.unlock();
+  // Publish the result for the filter (lock-free, so the filter never waits on the smoother).
+  smoother_result_.Store(new_result);
 
-  // Use the latest bias estimate for the next IMU preintegration.
-  smoother_imu_manager_.ResetAndUpdateBias(new_result.imu_bias);
+  if (tracer_) {
+    tracer_->Stamp(ConvertToNanoseconds(new_result.timestamp), "smoother");
+  }
 
   for (const SmootherResult::Callback& cb : smoother_result_callbacks_) {
     cb(new_result);
   }
 
   smoother_update_flag_.store(true); // Tell the filter to sync with this result!
+  filter_notifier_.Notify();
+
+  if (relocalizer_) {
+    reloc_keypose_.Write(new_result);
+  }
+
+  if (checkpoint_writer_) {
+    StateCheckpoint checkpoint;
+    checkpoint.smoother = new_result;
+    checkpoint.has_filter_state = filter_state_.Load(checkpoint.filter_state) > 0;
+    checkpoint_landmarks_.Read(last_checkpoint_landmarks_);
+    checkpoint.landmarks = last_checkpoint_landmarks_;
+    checkpoint_writer_->Submit(checkpoint);
+  }
 }
 
 
@@ -242,9 +1289,11 @@ void StateEstimator::GetKeyposeAlignedMeasurements(
     AttitudeMeasurement::Ptr& maybe_attitude_ptr,
     MultiRange& maybe_ranges,
     MagMeasurement::Ptr& maybe_mag_ptr,
+    PoseMeasurement::Ptr& maybe_pose_ptr,
     seconds_t allowed_misalignment_depth,
     seconds_t allowed_misalignment_range,
     seconds_t allowed_misalignment_mag,
+    seconds_t allowed_misalignment_pose,
     seconds_t allowed_misalignment_imu)
 {
   smoother_range_manager_.DiscardBefore(to_time, true);
@@ -263,6 +1312,13 @@ void StateEstimator::GetKeyposeAlignedMeasurements(
   maybe_mag_ptr = (mag_time_offset < allowed_misalignment_mag) ?
       std::make_shared<MagMeasurement>(smoother_mag_manager_.Pop()) : nullptr;
 
+  // Check if we have a nearby absolute pose measurement.
+  smoother_pose_manager_.DiscardBefore(to_time, true);
+  const seconds_t pose_time_offset = std::fabs(smoother_pose_manager_.Oldest() - to_time);
+
+  maybe_pose_ptr = (pose_time_offset < allowed_misalignment_pose) ?
+      std::make_shared<PoseMeasurement>(smoother_pose_manager_.Pop()) : nullptr;
+
   // Check if we have a nearby depth measurement (in time).
   smoother_depth_manager_.DiscardBefore(to_time, true);
   const seconds_t depth_time_offset = std::fabs(smoother_depth_manager_.Oldest() - to_time);
@@ -293,20 +1349,69 @@ void StateEstimator::UpdateSmootherMode(SmootherMode mode)
 
 void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
 {
+  BM_TRACE_THREAD_NAME("SmootherLoop");
+  ConfigureCurrentThread(params_.smoother_thread, "bm_smoother");
+  const ScopedTaskScheduler bind_scheduler(resources_.scheduler);
   FixedLagSmoother smoother(params_.smoother_params);
+  smoother.SetPoseHistory(&pose_history_);
+
+  // Records what goes into each smoother update (see Params::mission_log_path). The IMU has to be
+  // copied out before it's preintegrated, since that takes it off of the queue.
+  const auto log_imu = [&](seconds_t from_time, seconds_t to_time)
+  {
+    if (!mission_log_) { return; }
+    const ImuManager::View imu = smoother_imu_manager_.GetRange(
+        from_time - params_.allowed_misalignment_imu, to_time + params_.allowed_misalignment_imu);
+    for (size_t i = 0; i < imu.Size(); ++i) {
+      mission_log_->WriteImu(imu.at(i));
+    }
+  };
+
+  const auto log_keypose = [&](const SmootherResult& online,
+                               bool reset,
+                               VoResult::ConstPtr vo,
+                               DepthMeasurement::ConstPtr depth,
+                               AttitudeMeasurement::ConstPtr attitude,
+                               const MultiRange& ranges)
+  {
+    if (!mission_log_) { return; }
+    MissionKeypose keypose;
+    keypose.timestamp = online.timestamp;
+    keypose.reset = reset;
+    keypose.vo = vo;
+    keypose.depth = depth;
+    keypose.attitude = attitude;
+    keypose.ranges = ranges;
+    keypose.online = online;
+    mission_log_->WriteKeypose(keypose);
+  };
+
+  // The newest keypose given to the smoother. If async_update, it may not be optimized yet.
+  SmootherResult last_keypose;
+  const bool async_update = params_.smoother_params.async_update;
 
   //====================================== INITIALIZATION ==========================================
+  // When resuming from a checkpoint, the bias doesn't need vision to converge, so only wait as long
+  // as for a normal keypose.
+  const double init_wait_sec = restore_ ? params_.max_sec_btw_keyposes : params_.smoother_init_wait_vision_sec;
+
   bool initialized = false;
   while (!initialized) {
-    LOG(INFO) << "Will wait " << params_.smoother_init_wait_vision_sec << " seconds for vision" << std::endl;
-    const bool no_vo = WaitForResultOrTimeout<ThreadsafeQueue<VoResult>>(
-        smoother_vo_queue_, params_.smoother_init_wait_vision_sec);
+    LOG(INFO) << "Will wait " << init_wait_sec << " seconds for vision" << std::endl;
+    const bool no_vo = params_.lockstep ?
+        LockstepWaitForVo(t0, init_wait_sec) :
+        WaitForResultOrTimeout<SpscQueue<VoResult>>(smoother_vo_queue_, init_wait_sec);
 
     smoother_imu_manager_.DiscardBefore(t0);
     const bool no_imu = smoother_imu_manager_.Empty();
 
+    if (is_shutdown_) {
+      LOG(INFO) << "SmootherLoop() exiting before initialization" << std::endl;
+      return;
+    }
+
     if (no_vo && no_imu) {
-      LOG(INFO) << "No VO or IMU available, waiting to initialize Smoother" << std::endl;
+      BM_LOG_EVERY_SEC(INFO, 1.0) << "No VO or IMU available, waiting to initialize Smoother";
       continue;
     }
 
@@ -320,8 +1425,34 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
     t0 = no_vo ? smoother_imu_manager_.Oldest() :
                  ConvertToSeconds(smoother_vo_queue_.Pop().timestamp);
 
-    smoother.Initialize(t0, P0_world_body, kZeroVelocity, kZeroImuBias, !no_imu);
-    OnSmootherResult(smoother.GetResult());
+    // NOTE(milo): A checkpoint without an IMU state has no velocity and bias covariances, so those
+    // start over (from the checkpoint pose).
+    const double age = restore_ ? (t0 - restore_->smoother.timestamp) : -1.0;
+    const bool can_restore = restore_ && age >= 0 && age <= params_.checkpoint_max_age_sec &&
+                             restore_->smoother.has_imu_state && !no_imu;
+
+    if (can_restore) {
+      SmootherResult prior = restore_->smoother;
+      prior.cov_pose.block<3, 3>(0, 0) += std::pow(age * params_.checkpoint_sigma_r_per_sec, 2) * Matrix3d::Identity();
+      prior.cov_pose.block<3, 3>(3, 3) += std::pow(age * params_.checkpoint_sigma_t_per_sec, 2) * Matrix3d::Identity();
+      smoother.Initialize(t0, prior);
+      LOG(INFO) << "Smoother resumed from a checkpoint that is " << age << " sec old" << std::endl;
+    } else {
+      if (restore_) {
+        LOG(WARNING) << "Checkpoint can't be resumed (age=" << age << " sec), starting over from its pose" << std::endl;
+      }
+      gtsam::Pose3 world_P_body = P0_world_body;
+      gtsam::Vector3 world_v_body = kZeroVelocity;
+      ImuBias imu_bias = kZeroImuBias;
+      if (params_.vi_init_params.enabled && !no_vo && !no_imu) {
+        ViInitialize(t0, world_P_body, world_v_body, imu_bias);
+      }
+      smoother.Initialize(t0, world_P_body, world_v_body, imu_bias, !no_imu);
+    }
+    last_keypose = smoother.GetResult();
+    smoother_imu_manager_.ResetAndUpdateBias(last_keypose.imu_bias);
+    OnSmootherResult(last_keypose);
+    log_keypose(last_keypose, true, nullptr, nullptr, nullptr, MultiRange());
 
     smoother_mode_ = no_vo ? SmootherMode::VISION_UNAVAILABLE : SmootherMode::VISION_AVAILABLE;
     initialized = true;
@@ -330,20 +1461,115 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
   }
   //================================================================================================
 
+  // Called after each Update(). If async_update, smoothed results are published from another thread
+  // instead, so that callbacks can't hold up the next keypose.
+  const auto on_keypose = [&](const SmootherResult& keypose)
+  {
+    last_keypose = keypose;
+
+    // Use the latest bias estimate for the next IMU preintegration.
+    smoother_imu_manager_.ResetAndUpdateBias(keypose.imu_bias);
+    if (!async_update) {
+      OnSmootherResult(keypose);
+    }
+  };
+
+  std::thread smoother_callback_thread;
+  if (async_update) {
+    smoother_callback_thread = std::thread([&]()
+    {
+      BM_TRACE_THREAD_NAME("SmootherCallbacks");
+      SmootherResult result;
+      while (!is_shutdown_) {
+        if (smoother.WaitForResult(result, 0.1)) {
+          OnSmootherResult(result);
+        }
+      }
+    });
+  }
+
+  std::thread batch_thread;
+  if (params_.batch_params.enabled) {
+    batch_thread = std::thread(&StateEstimator::BatchLoop, this, std::ref(smoother));
+  }
+
+  LatencyHistogram& vo_queue_depth = stats_.Histogram("QueueDepth/smoother_vo");
+  LatencyHistogram& imu_queue_depth = stats_.Histogram("QueueDepth/smoother_imu");
+
+  // Dead reckoning (see Params::dead_reckoning_after_sec): the smoother idles until vision returns.
+  seconds_t last_vision_time = last_keypose.timestamp;
+  bool dead_reckoning = false;
+
   while (!is_shutdown_) {
+    vo_queue_depth.Record(smoother_vo_queue_.Size());
+    imu_queue_depth.Record(smoother_imu_manager_.Size());
+
     // Wait for a visual odometry measurement to arrive, based on the expected time btw keyframes.
-    // If vision hasn't come in recently, don't wait as long, since it is probably unreliable.
-    const double wait_sec = (smoother_mode_ == SmootherMode::VISION_AVAILABLE) ? \
+    // If vision hasn't come in recently, don't wait as long, since it is probably unreliable. While
+    // dead reckoning there's nothing to do except wait for vision.
+    const double wait_sec = dead_reckoning ? params_.max_sec_btw_keyposes :
+        (smoother_mode_ == SmootherMode::VISION_AVAILABLE) ? \
         params_.max_sec_btw_keyposes + 0.1:       // Add a small epsilon to account for latency.
         0.005;                                    // This should be a tiny delay to process IMU ASAP.
-    const bool did_timeout = WaitForResultOrTimeout<ThreadsafeQueue<VoResult>>(smoother_vo_queue_, wait_sec);
+    // In lockstep, the wait is measured on the data clock, from the last keypose.
+    const bool did_timeout = params_.lockstep ?
+        LockstepWaitForVo(last_keypose.timestamp, wait_sec) :
+        WaitForVo(wait_sec);
+
+    // NOTE(milo): Not in lockstep, where the wait is on the data clock and wouldn't block again.
+    if (did_timeout && frontend_hovering_.load() && !params_.lockstep && !dead_reckoning && !is_shutdown_) {
+      continue;
+    }
 
     // Update the smoother mode.
     UpdateSmootherMode(did_timeout ? SmootherMode::VISION_UNAVAILABLE : SmootherMode::VISION_AVAILABLE);
 
     if (is_shutdown_) { break; }  // Timeout could have happened due to shutdown; check that here.
 
-    const seconds_t from_time = smoother_result_.timestamp;
+    // Vision is back after dead reckoning ==> restart the smoother from the filter. Like in
+    // initialization, the first keyframe only sets the time of the first keypose.
+    if (dead_reckoning) {
+      if (did_timeout) {
+        continue;
+      }
+
+      const seconds_t t1 = ConvertToSeconds(smoother_vo_queue_.Pop().timestamp);
+      SmootherResult prior;
+      if (!FilterPrior(t1, last_keypose, prior)) {
+        prior = last_keypose;
+        prior.timestamp = t1;
+      }
+
+      smoother.WaitUntilIdle();
+      smoother.Initialize(t1, prior);
+      smoother_imu_manager_.DiscardBefore(t1);
+      last_keypose = smoother.GetResult();
+      smoother_imu_manager_.ResetAndUpdateBias(last_keypose.imu_bias);
+      OnSmootherResult(last_keypose);
+      log_keypose(last_keypose, true, nullptr, nullptr, nullptr, MultiRange());
+
+      LOG(INFO) << "Vision is back after " << (t1 - last_vision_time) << " sec, smoother restarted from the filter" << std::endl;
+      last_vision_time = t1;
+      dead_reckoning = false;
+      continue;
+    }
+
+    // Vision has been gone for a while ==> let the filter dead reckon by itself.
+    // NOTE(milo): Other rigs may still see something, and their landmarks need IMU keyposes to go on.
+    if (did_timeout && params_.dead_reckoning_after_sec > 0 && !params_.lockstep && rig_frontends_.empty() &&
+        last_keypose.has_imu_state && !smoother_imu_manager_.Empty() &&
+        (smoother_imu_manager_.Newest() - last_vision_time) > params_.dead_reckoning_after_sec) {
+      LOG(INFO) << "No vision for " << params_.dead_reckoning_after_sec << " sec, dead reckoning with the filter" << std::endl;
+      dead_reckoning = true;
+      continue;
+    }
+
+    // The filter asks for fresh covariances when it has to do a hard reset (see FilterLoop()).
+    if (smoother_covariance_requested_.exchange(false)) {
+      smoother.RequestCovariance();
+    }
+
+    const seconds_t from_time = last_keypose.timestamp;
 
     // VO FAILED ==> Create a keypose with IMU/APS measurements.
     if (did_timeout) {
@@ -370,6 +1596,8 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
         AttitudeMeasurement::Ptr maybe_attitude_ptr;
         MultiRange maybe_ranges;
         MagMeasurement::Ptr maybe_mag_ptr;
+        PoseMeasurement::Ptr maybe_pose_ptr;
+        log_imu(from_time, to_time);
         GetKeyposeAlignedMeasurements(
             from_time, to_time,
             maybe_pim_ptr,
@@ -377,34 +1605,57 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
             maybe_attitude_ptr,
             maybe_ranges,
             maybe_mag_ptr,
+            maybe_pose_ptr,
             params_.allowed_misalignment_depth,
             params_.allowed_misalignment_range,
             params_.allowed_misalignment_mag,
+            params_.allowed_misalignment_pose,
             params_.allowed_misalignment_imu);
 
         CHECK(maybe_pim_ptr) << "Should have gotten a preintegrated IMU measurement, probably a timestamp offset issue" << std::endl;
 
+        AddRigVo(smoother);
         Timer timer(true);
-        OnSmootherResult(smoother.Update(
+        on_keypose(smoother.Update(
             nullptr,
             maybe_pim_ptr,
             maybe_depth_ptr,
             maybe_attitude_ptr,
             maybe_ranges,
-            maybe_mag_ptr));
+            maybe_mag_ptr,
+            maybe_pose_ptr));
         stats_.Add("SmootherUpdateNoVision", timer.Elapsed().milliseconds());
+        log_keypose(last_keypose, false, nullptr, maybe_depth_ptr, maybe_attitude_ptr, maybe_ranges);
         stats_.Print("SmootherUpdateNoVision", "ms", params_.stats_print_interval_sec);
       }
     // VO AVAILABLE ==> Add a keyframe and smooth.
     } else {
-      const VoResult frontend_result = smoother_vo_queue_.Pop();
-      const seconds_t to_time = ConvertToSeconds(frontend_result.timestamp);
+      VoResult vo = smoother_vo_queue_.Pop();
+
+      // If more keyframes came in during the last update, the smoother is behind. Merge them into
+      // one keypose at the newest, so that it catches up in a bounded number of updates.
+      int num_merged = 1;
+      while (num_merged < params_.max_merged_vo && !smoother_vo_queue_.Empty() &&
+             VoResultsChain(vo, smoother_vo_queue_.PeekFront())) {
+        MergeVoResults(vo, smoother_vo_queue_.Pop());
+        ++num_merged;
+      }
+      if (num_merged > 1) {
+        stats_.Increment("Smoother/merged_vo", num_merged - 1);
+      }
+
+      // NOTE(milo): Moved onto the heap (not copied), since the smoother can hold onto it.
+      const VoResult::ConstPtr frontend_result_ptr = std::make_shared<VoResult>(std::move(vo));
+      const seconds_t to_time = ConvertToSeconds(frontend_result_ptr->timestamp);
+      last_vision_time = to_time;
 
       PimResult::Ptr maybe_pim_ptr;
       DepthMeasurement::Ptr maybe_depth_ptr;
       AttitudeMeasurement::Ptr maybe_attitude_ptr;
       MultiRange maybe_ranges;
       MagMeasurement::Ptr maybe_mag_ptr;
+      PoseMeasurement::Ptr maybe_pose_ptr;
+      log_imu(from_time, to_time);
       GetKeyposeAlignedMeasurements(
           from_time, to_time,
           maybe_pim_ptr,
@@ -412,45 +1663,169 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
           maybe_attitude_ptr,
           maybe_ranges,
           maybe_mag_ptr,
+          maybe_pose_ptr,
           params_.allowed_misalignment_depth,
           params_.allowed_misalignment_range,
           params_.allowed_misalignment_mag,
+          params_.allowed_misalignment_pose,
           params_.allowed_misalignment_imu);
 
+      AddRigVo(smoother);
       Timer timer(true);
-      OnSmootherResult(smoother.Update(
-          VoResult::ConstPtr(&frontend_result),
+      on_keypose(smoother.Update(
+          frontend_result_ptr,
           maybe_pim_ptr,
           maybe_depth_ptr,
           maybe_attitude_ptr,
-          maybe_ranges));
+          maybe_ranges,
+          maybe_mag_ptr,
+          maybe_pose_ptr));
       stats_.Add("SmootherUpdateWithVision", timer.Elapsed().milliseconds());
+      log_keypose(last_keypose, false, frontend_result_ptr, maybe_depth_ptr, maybe_attitude_ptr, maybe_ranges);
       stats_.Print("SmootherUpdateWithVision", "ms", params_.stats_print_interval_sec);
     }
 
+    stats_.SetGauge("Smoother/lag_sec", smoother.Lag());
+    ExportQueueStats();
+    resource_sampler_.Sample(stats_);
+    stats_.Export(params_.stats_print_interval_sec);
+
   } // end while (!is_shutdown)
 
+  if (smoother_callback_thread.joinable()) {
+    smoother_callback_thread.join();
+  }
+  if (batch_thread.joinable()) {
+    batch_thread.join();
+  }
+
   LOG(INFO) << "SmootherLoop() exiting" << std::endl;
 }
 
 
+void StateEstimator::BatchLoop(FixedLagSmoother& smoother)
+{
+  BM_TRACE_THREAD_NAME("BatchLoop");
+  ConfigureCurrentThread(params_.batch_thread, "bm_batch");
+  const ScopedTaskScheduler bind_scheduler(resources_.scheduler);
+  const BatchSmoother batch_smoother(params_.batch_params);
+
+  while (!is_shutdown_) {
+    // Sleep in small steps so that shutdown isn't held up by a long interval.
+    Timer wait_timer(true);
+    while (!is_shutdown_ && wait_timer.Elapsed().seconds() < params_.batch_params.interval_sec) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (is_shutdown_) { break; }
+
+    gtsam::NonlinearFactorGraph factors;
+    gtsam::Values values;
+    if (!smoother.GetHistory(factors, values)) {
+      continue;
+    }
+
+    Timer timer(true);
+    const BatchResult result = batch_smoother.Solve(factors, values);
+    stats_.Add("BatchSolve", timer.Elapsed().milliseconds());
+    stats_.Print("BatchSolve", "ms", params_.stats_print_interval_sec);
+
+    if (!result.success) {
+      continue;
+    }
+
+    // Start the next batch from this solution.
+    smoother.UpdateHistory(result.estimate);
+
+    for (const BatchResult::Callback& cb : batch_result_callbacks_) {
+      cb(result);
+    }
+  }
+
+  LOG(INFO) << "BatchLoop() exiting" << std::endl;
+}
+
+
+size_t StateEstimator::QueueBytes(const Params& params)
+{
+  // NOTE(milo): Each stereo pair is two 8-bit images at the primary rig's resolution.
+  const size_t stereo_bytes = 2ul * params.stereo_rig.Width() * params.stereo_rig.Height() + sizeof(StereoImage1b);
+  const size_t num_rigs = std::max<size_t>(1, params.stereo_rigs.size());
+
+  return num_rigs * params.max_size_raw_stereo_queue * stereo_bytes +
+         num_rigs * params.max_size_smoother_vo_queue * sizeof(VoResult) +
+         (params.max_size_smoother_imu_queue + params.max_size_filter_imu_queue) * sizeof(ImuMeasurement) +
+         (params.max_size_smoother_depth_queue + params.max_size_filter_depth_queue) * sizeof(DepthMeasurement) +
+         (params.max_size_smoother_range_queue + params.max_size_filter_range_queue) * sizeof(RangeMeasurement) +
+         params.max_size_smoother_mag_queue * sizeof(MagMeasurement) +
+         params.max_size_smoother_pose_queue * sizeof(PoseMeasurement) +
+         (params.pose_history_keyposes + params.pose_history_filter_states) * sizeof(PoseStamped);
+}
+
+
 void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
 {
+  BM_TRACE_THREAD_NAME("FilterLoop");
+  ConfigureCurrentThread(params_.filter_thread, "bm_filter");
+  const ScopedTaskScheduler bind_scheduler(resources_.scheduler);
+
+  // NOTE(milo): The filter's histories and unread measurements are rings sized by its params (and
+  // the measurements live in the smoother managers' node pools), so everything that it keeps is
+  // allocated up front. Fault in the stack and this thread's malloc arena for the rest of the EKF.
+  if (params_.realtime_memory) {
+    PrefaultStack(1024 * static_cast<size_t>(params_.realtime_stack_kb));
+    PrefaultHeap(params_.max_size_filter_imu_queue * sizeof(ImuMeasurement) +
+                 params_.max_size_filter_depth_queue * sizeof(DepthMeasurement) +
+                 params_.max_size_filter_range_queue * sizeof(RangeMeasurement));
+  }
+
   StateEkf filter(params_.filter_params);
 
   StateCovariance S0 = 0.1*StateCovariance::Identity();
   S0.block<3, 3>(t_row, t_row) = 0.03 * Matrix3d::Identity();
 
-  filter.Initialize(StateStamped(t0, State(
-      P0_world_body.translation(),
-      Vector3d::Zero(),
-      Vector3d::Zero(),
-      P0_world_body.rotation().toQuaternion().normalized(),
-      Vector3d::Zero(),
-      S0)),
-      ImuBias());
+  // NOTE(milo): The saved acceleration and angular velocity are stale after a restart. They're
+  // measured again by the first IMU update.
+  if (restore_ && restore_->has_filter_state) {
+    StateStamped s = restore_->filter_state;
+    s.state.a.setZero();
+    s.state.w.setZero();
+    filter.Initialize(s, restore_->smoother.imu_bias);
+  } else {
+    filter.Initialize(StateStamped(t0, State(
+        P0_world_body.translation(),
+        Vector3d::Zero(),
+        Vector3d::Zero(),
+        P0_world_body.rotation().toQuaternion().normalized(),
+        Vector3d::Zero(),
+        S0)),
+        ImuBias());
+  }
+
+  std::atomic<int64_t>& num_gated = stats_.Counter("Rejected/filter_gate");
+
+  // Allocations after warmup are real-time violations (e.g for a CI benchmark to fail on).
+  std::atomic<int64_t>& num_allocations = stats_.Counter("Realtime/filter_allocations");
+  const bool count_allocations = params_.realtime_memory && AllocationCountingEnabled();
+  int num_updates = 0;
+  uint64_t allocations_after_warmup = 0;
+
+  const auto has_work = [this]() {
+    return smoother_update_flag_ ||
+           !filter_imu_manager_.Empty() ||
+           !filter_depth_manager_.Empty() ||
+           !filter_range_manager_.Empty();
+  };
 
   while (!is_shutdown_) {
+    // Sleep until there is sensor data or a smoother result to process. In lockstep, the filter is
+    // only idle once it's out of work.
+    if (!has_work()) {
+      SetLockstepBusy(filter_busy_, false);
+    }
+    filter_notifier_.Wait([&]() { return is_shutdown_ || filter_ticks_ > 0 || has_work(); });
+    SetLockstepBusy(filter_busy_, true);
+    filter_ticks_ = 0;
+
     // Clear out any sensor data before the current state.
     filter_imu_manager_.DiscardBefore(filter.GetTimestamp());
     filter_depth_manager_.DiscardBefore(filter.GetTimestamp());
@@ -469,27 +1844,29 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
       // Update the EKF using one data sample.
       if (next_timestamp == next_imu_timestamp) {
         filter.PredictAndUpdate(filter_imu_manager_.Pop());
-      } else if (next_timestamp == next_depth_timestamp) {
-        const DepthMeasurement depth_data = filter_depth_manager_.Pop();
-        filter.PredictAndUpdate(next_depth_timestamp,
-                                depth_axis_,
-                                depth_sign_ * depth_data.depth,
-                                params_.filter_params.sigma_R_depth);
-      } else if (next_timestamp == next_range_timestamp) {
-        const RangeMeasurement range_data = filter_range_manager_.Pop();
-        filter.PredictAndUpdate(next_range_timestamp,
-                                range_data.range,
-                                range_data.point,
-                                params_.filter_params.sigma_R_range);
+      } else if (next_timestamp == next_depth_timestamp || next_timestamp == next_range_timestamp) {
+        // Fuse all of the depth and range measurements at this timestamp (e.g one range per beacon)
+        // with a single predict and update.
+        MeasurementBatch batch(next_timestamp);
+        const seconds_t batch_end = next_timestamp + params_.filter_batch_window_sec;
+
+        while (!batch.Full() && !filter_depth_manager_.Empty() && filter_depth_manager_.Oldest() <= batch_end) {
+          const DepthMeasurement depth_data = filter_depth_manager_.Pop();
+          batch.AddAxis(depth_axis_, depth_sign_ * depth_data.depth, params_.filter_params.sigma_R_depth);
+        }
+        while (!batch.Full() && !filter_range_manager_.Empty() && filter_range_manager_.Oldest() <= batch_end) {
+          const RangeMeasurement range_data = filter_range_manager_.Pop();
+          batch.AddRange(range_data.range, range_data.point, params_.filter_params.sigma_R_range);
+        }
+
+        int num_rejected = 0;
+        filter.PredictAndUpdate(batch, &num_rejected);
+        num_gated += num_rejected;
       } else {
         LOG(FATAL) << "No sensor was chosen for filter update, something is wrong" << std::endl;
       }
 
-      // Process all callbacks with the updated state. These will block so they should be fast!
-      const StateStamped state = filter.GetState();
-      for (const StateStamped::Callback& cb : filter_result_callbacks_) {
-        cb(state);
-      }
+      OnFilterState(filter.GetState());
     }
 
     //================================ SYNCHRONIZE WITH SMOOTHER ===================================
@@ -497,12 +1874,11 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
 
     if (do_sync_with_smoother) {
       // Get a copy of the latest smoother state to make sure it doesn't change during the sync.
-      mutex_smoother_result_.lock();
-      const SmootherResult result = smoother_result_;
-      mutex_smoother_result_.unlock();
+      const SmootherResult result = smoother_result_.Load();
 
       filter.Rewind(result.timestamp);
       filter.UpdateImuBias(result.imu_bias);
+      imu_propagator_.SetBias(result.imu_bias);
 
       const Matrix3d world_R_body = result.world_P_body.rotation().matrix();
       const double position_err = (result.world_P_body.translation() - filter.GetState().state.t).norm();
@@ -515,6 +1891,12 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
       if (filter_has_diverged) {
         LOG(INFO) << "Filter has diverged from smoother, doing a hard reset" << std::endl;
 
+        // NOTE(milo): If the smoother skipped the covariances for this keypose (covariance_interval),
+        // reset with the last ones, and make sure the next keypose has fresh ones.
+        if (!result.has_covariance) {
+          smoother_covariance_requested_.store(true);
+        }
+
         StateCovariance S = 1.0*StateCovariance::Identity();
         S.block<3, 3>(t_row, t_row) = result.cov_pose.block<3, 3>(3, 3);
         S.block<3, 3>(uq_row, uq_row) = result.cov_pose.block<3, 3>(0, 0);
@@ -542,11 +1924,20 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
 
       filter.ReapplyImu();
 
-      const StateStamped state = filter.GetState();
-      for (const StateStamped::Callback& cb : filter_result_callbacks_) {
-        cb(state);
-      }
+      OnFilterState(filter.GetState());
     } // end if (do_sync_with_smoother)
+
+    if (count_allocations) {
+      ++num_updates;
+      if (num_updates == params_.realtime_warmup_updates) {
+        allocations_after_warmup = ThreadAllocationCount();
+      } else if (num_updates > params_.realtime_warmup_updates) {
+        const int64_t n = static_cast<int64_t>(ThreadAllocationCount() - allocations_after_warmup);
+        if (n > 0 && num_allocations.exchange(n) == 0) {
+          LOG(WARNING) << "Filter thread allocated after warmup (update " << num_updates << ")" << std::endl;
+        }
+      }
+    }
   } // end while (!is_shutdown)
 
   LOG(INFO) << "FilterLoop() exiting" << std::endl;
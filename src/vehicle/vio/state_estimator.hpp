@@ -2,6 +2,8 @@
 
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <vector>
 
 #include "params/params_base.hpp"
 #include "core/macros.hpp"
@@ -9,20 +11,41 @@
 #include "vision_core/cv_types.hpp"
 #include "core/axis3.hpp"
 #include "core/thread_safe_queue.hpp"
+#include "core/spsc_queue.hpp"
+#include "core/broadcast_queue.hpp"
+#include "core/notifier.hpp"
+#include "core/thread_util.hpp"
 #include "vision_core/stereo_image.hpp"
+#include "vision_core/viz_tap.hpp"
 #include "core/imu_measurement.hpp"
 #include "core/depth_measurement.hpp"
 #include "core/range_measurement.hpp"
 #include "core/mag_measurement.hpp"
+#include "core/pose_measurement.hpp"
 #include "core/data_manager.hpp"
 #include "core/stats_tracker.hpp"
+#include "core/latency_trace.hpp"
+#include "core/latest_value.hpp"
+#include "core/seq_lock.hpp"
+#include "core/warm_up.hpp"
+#include "core/resource_sampler.hpp"
+#include "core/task_scheduler.hpp"
 #include "vio/stereo_frontend.hpp"
+#include "vio/frontend_scheduler.hpp"
 #include "vio/imu_manager.hpp"
+#include "vio/imu_propagator.hpp"
 #include "vio/state_estimator_util.hpp"
 #include "vio/state_ekf.hpp"
 // #include "vio/smoother.hpp"
 #include "vio/smoother_result.hpp"
 #include "vio/fixed_lag_smoother.hpp"
+#include "vio/pose_history.hpp"
+#include "vio/batch_smoother.hpp"
+#include "vio/tag_localizer.hpp"
+#include "vio/relocalizer.hpp"
+#include "vio/state_checkpoint.hpp"
+#include "vio/mission_log.hpp"
+#include "vio/vi_initializer.hpp"
 
 #include <gtsam/geometry/Pose3.h>
 
@@ -30,9 +53,25 @@ namespace bm {
 namespace vio {
 
 
-typedef DataManager<DepthMeasurement> DepthManager;
-typedef DataManager<RangeMeasurement> RangeManager;
-typedef DataManager<MagMeasurement> MagManager;
+// Depth and range are read by both the smoother and the filter, so they share one copy of each
+// stream. Magnetometer and pose data only go to the smoother, so they can use the lock-free SpscQueue.
+typedef DataManager<DepthMeasurement, BroadcastQueue<DepthMeasurement>> DepthManager;
+typedef DataManager<RangeMeasurement, BroadcastQueue<RangeMeasurement>> RangeManager;
+typedef DataManager<MagMeasurement, SpscQueue<MagMeasurement>> MagManager;
+typedef DataManager<PoseMeasurement, SpscQueue<PoseMeasurement>> PoseManager;
+
+
+// Things that several StateEstimators in one process can share (see EstimatorFleet). They're only
+// ever read, so sharing them doesn't couple the estimators.
+struct EstimatorResources final
+{
+  // The parallel work from every estimator thread (tracking, linearization) goes here instead of
+  // TaskScheduler::Global(), if given. Must outlive the estimator.
+  TaskScheduler* scheduler = nullptr;
+
+  // The Relocalizer's vocabulary (otherwise each estimator loads its own from vocabulary_path).
+  BowVocabulary::ConstPtr vocabulary;
+};
 
 
 // The smoother changes its behavior depending on whether vision is available/unavailable.
@@ -62,6 +101,14 @@ class StateEstimator final {
     // Smoother::Params smoother_params;
     FixedLagSmoother::Params smoother_params;
     StateEkf::Params filter_params;
+    FrontendScheduler::Params scheduler_params;
+    BatchSmoother::Params batch_params;
+    ImuPropagator::Params propagator_params;
+    TagLocalizer::Params tag_localizer_params;
+    Relocalizer::Params relocalizer_params;
+    // If enabled, the smoother starts once the ViInitializer has solved for the gyro bias, velocity
+    // and gravity direction from the first keyframes, instead of at the first keyframe with zeros.
+    ViInitializer::Params vi_init_params;
 
     int max_size_raw_stereo_queue = 100;      // Images for the stereo frontend to process.
     int max_size_smoother_vo_queue = 100;     // Holds keyframe VO estimates for the smoother to process.
@@ -69,23 +116,47 @@ class StateEstimator final {
     int max_size_smoother_depth_queue = 1000;
     int max_size_smoother_range_queue = 100;
     int max_size_smoother_mag_queue = 100;
+    int max_size_smoother_pose_queue = 100;
     int max_size_filter_vo_queue = 100;
     int max_size_filter_imu_queue = 1000;
     int max_size_filter_depth_queue = 1000;
     int max_size_filter_range_queue = 100;
 
+    // Poses kept in the PoseHistory (see GetPoseHistory()): smoother keyposes, and filter states.
+    int pose_history_keyposes = 4096;
+    int pose_history_filter_states = 4096;
+
     int stats_tracker_k = 10;                 // Store the last k samples of each scalar.
     float stats_print_interval_sec = 5.0;     // Print out stats every 5 sec.
 
     int reliable_vision_min_lmks = 12;        // Vision is "unreliable" if not many features can be detected.
 
+    // If > 0, force a keyframe once the filter's position uncertainty has grown enough since the last
+    // keyframe that a new one is worth a smoother update: 0.5 * log(det(S) / det(S_lkf)) > this
+    // (nats). Together with StereoTracker::Params::trigger_keyframe_min_parallax, which holds off
+    // keyframes while hovering, the smoother only gets keyposes that carry information.
+    double keyframe_info_gain = 0;
+
     double max_sec_btw_keyposes = 2.0;        // If a keypose hasn't been triggered in this long, trigger it!
     double min_sec_btw_keyposes = 0.5;        // Don't trigger a keypose if it hasn't been long since the last one.
 
+    // Catch-up: if VO results pile up while the smoother is busy (e.g an update took longer than the
+    // time between keyframes), merge up to this many of the queued ones into a single keypose, with
+    // IMU preintegrated over the whole span. Otherwise every stale result is a full update, and the
+    // smoother falls further behind. 1 turns it off.
+    int max_merged_vo = 1;
+
     double smoother_init_wait_vision_sec = 3.0;   // Wait this long for VO to arrive during initialization.
+
+    // If > 0, once vision has been unavailable for this long (e.g a featureless transit), the
+    // smoother stops adding IMU-only keyposes, and the filter dead reckons alone with IMU, depth and
+    // range. When vision comes back, the smoother restarts from the filter state (see FilterPrior()).
+    // Not used in lockstep, or with more than one stereo rig.
+    double dead_reckoning_after_sec = 0;
     double allowed_misalignment_depth = 0.05;     // 50 ms for depth
     double allowed_misalignment_imu = 0.05;       // 50 ms for IMU
     double allowed_misalignment_mag = 0.05;       // 50 ms for magnetometer
+    double allowed_misalignment_pose = 0.05;      // 50 ms for absolute pose (e.g fiducial tags)
 
     // Range arrives at about 3 Hz. This means we can expect to be at most 0.15 sec away from a
     // range measurement at any given time.
@@ -101,11 +172,95 @@ class StateEstimator final {
     bool filter_use_range = true;
     bool filter_use_depth = true;
 
+    // Look for AprilTags (with known poses) in the left images, and add them to the smoother as pose
+    // priors. The detector runs on its own thread, on the newest image only.
+    bool use_tags = false;
+
+    // Store keyframes in a place recognition database (see Relocalizer), and look for them in every
+    // image after vision drops out, i.e no vision keypose for reloc_after_dropout_sec. Matches go to
+    // the smoother as pose priors. Gives up reloc_max_sec after vision comes back. Runs on the same
+    // thread as the tags.
+    bool use_relocalization = false;
+    double reloc_after_dropout_sec = 3.0;
+    double reloc_max_sec = 10.0;
+
+    // Depth and range measurements within this long after the oldest one are fused together in a
+    // single filter update (at the oldest timestamp). Zero only batches identical timestamps.
+    double filter_batch_window_sec = 0.0;
+
+    // Each sensor stream is held this long (measurement time) so that out-of-order arrivals (e.g
+    // UDP) can be sorted. Measurements later than this are dropped (see "Late/" stats).
+    double reorder_window_imu = 0.0;
+    double reorder_window_depth = 0.0;
+    double reorder_window_range = 0.0;
+    double reorder_window_mag = 0.0;
+
+    // Deterministic playback (e.g for profiling): each Receive*() blocks until every thread is done
+    // with the measurement, and the smoother's vision timeouts are measured on the data clock (the
+    // newest measurement received) instead of the wall clock. This turns off async_update, the batch
+    // smoother and the frontend scheduler, since those depend on thread timing.
+    bool lockstep = false;
+
+    // Sample the CPU time of each thread, the process RSS and the GPU pool memory at most this often,
+    // as gauges exported with the other stats (see ResourceSampler). Negative turns it off.
+    float resource_sample_interval_sec = 1.0;
+
+    // Periodically save the newest keypose (with its marginal covariances), the filter state and the
+    // newest keyframe's landmarks here, so that Initialize(checkpoint_path) can resume after a crash
+    // or restart. Empty turns checkpoints off. Written on their own thread, at most every
+    // checkpoint_interval_sec.
+    std::string checkpoint_path = "";
+    double checkpoint_interval_sec = 1.0;
+
+    // Only resume from checkpoints that are at most this old (by the first measurement after the
+    // restart). The vehicle could have moved in the meantime, so the restored pose covariance grows
+    // by these sigmas (m and rad) per second of age.
+    double checkpoint_max_age_sec = 30.0;
+    double checkpoint_sigma_t_per_sec = 0.5;
+    double checkpoint_sigma_r_per_sec = 0.05;
+
+    // Record every smoother update (primary rig VO, depth, attitude, ranges and the IMU around it)
+    // here, so that the whole mission can be bundle adjusted offline (see OfflineBundleAdjuster and
+    // tools/offline_ba). Empty turns it off.
+    std::string mission_log_path = "";
+
+    // Real-time memory: state_estimator_lcm locks the process into RAM and prefaults the queues
+    // (see QueueBytes()), and the filter thread prefaults its stack and heap. The measurements that
+    // the filter reads are preallocated anyway (see BroadcastQueue), and its queues hold at most
+    // max_size_filter_*_queue of them. After realtime_warmup_updates, every allocation on the
+    // filter thread is counted in the "Realtime/filter_allocations" stat (only if built with
+    // BM_COUNT_ALLOCATIONS).
+    bool realtime_memory = false;
+    int realtime_warmup_updates = 1000;
+    int realtime_stack_kb = 256;
+
+    // CPU pinning and priority for each worker thread. The frontends for the other stereo rigs all
+    // use rig_frontend_thread.
+    ThreadConfig frontend_thread;
+    ThreadConfig rig_frontend_thread;
+    ThreadConfig smoother_thread;
+    ThreadConfig filter_thread;
+    ThreadConfig batch_thread;
+
     gtsam::Pose3 body_P_imu = gtsam::Pose3::identity();
-    gtsam::Pose3 body_P_cam = gtsam::Pose3::identity();
+    gtsam::Pose3 body_P_cam = gtsam::Pose3::identity();     // Primary rig.
     Vector3d n_gravity = Vector3d(0, 9.81, 0);
 
-    StereoCamera stereo_rig;
+    StereoCamera stereo_rig;                                // Primary rig.
+
+    // If > 0, the frontends track on images downsampled to this height (e.g 540 for 1080p input).
+    // Each rig's intrinsics are rescaled for the frontend and the smoother's calibration, and the
+    // StereoMatcher's disparity range and templates are scaled to match. Tags and relocalization
+    // still get the input images (and stereo_rig). The other params in pixels (e.g reprojection
+    // errors) are at the frontend resolution.
+    int frontend_height = 0;
+
+    // One for each rig in /shared/stereo_rigs, primary rig first. The primary rig's VO makes the
+    // keyposes (and is the one used for tags, relocalization and checkpoints). Every other rig has
+    // its own StereoFrontend on its own thread, and its keyframes add smart factors to the nearest
+    // keypose (see FixedLagSmoother::AddRigVo).
+    std::vector<gtsam::Pose3> body_P_cams;
+    std::vector<StereoCamera> stereo_rigs;
 
    private:
     void LoadParams(const YamlParser& parser) override;
@@ -114,25 +269,101 @@ class StateEstimator final {
   MACRO_DELETE_COPY_CONSTRUCTORS(StateEstimator)
   MACRO_DELETE_DEFAULT_CONSTRUCTOR(StateEstimator)
 
-  StateEstimator(const Params& params);
+  StateEstimator(const Params& params, const EstimatorResources& resources = EstimatorResources());
+
+  // Roughly how much memory the measurement and image queues hold when they're full, for
+  // prefaulting the heap in real-time mode.
+  static size_t QueueBytes(const Params& params);
 
-  void ReceiveStereo(const StereoImage1b& stereo_pair);
+  // Images from one of the stereo rigs (an index into Params::stereo_rigs, 0 is the primary rig).
+  void ReceiveStereo(const StereoImage1b& stereo_pair, size_t rig = 0);
+  void ReceiveStereo(StereoImage1b&& stereo_pair, size_t rig = 0);
   void ReceiveImu(const ImuMeasurement& imu_data);
+
+  // Receive n IMU measurements at once (oldest first), e.g from an imu_batch_t. Same as calling
+  // ReceiveImu() on each, but the IMU queues are only locked (and the filter woken up) once.
+  void ReceiveImuBatch(const ImuMeasurement* imu_data, size_t n);
   void ReceiveDepth(const DepthMeasurement& depth_data);
   void ReceiveRange(const RangeMeasurement& range_data);
   void ReceiveMag(const MagMeasurement& mag_data);
 
+  // Absolute pose measurements (e.g from a TagLocalizer), which are added to the smoother as priors
+  // on the nearest keypose. NOTE(milo): Only call this from one thread, and not with use_tags or
+  // use_relocalization (the LocalizerLoop pushes to the same queue).
+  void ReceivePose(const PoseMeasurement& pose_data);
+
   // Add a function that gets called whenever the smoother finished an update.
-  // NOTE(milo): Callbacks will block the smoother thread, so keep them fast!
+  // NOTE(milo): Callbacks will block the smoother thread, so keep them fast! With async_update, they
+  // run on their own thread instead, and can skip intermediate results if they fall behind.
   void RegisterSmootherResultCallback(const SmootherResult::Callback& cb);
   void RegisterFilterResultCallback(const StateStamped::Callback& cb);
 
+  // Add a function that gets called after each batch re-optimization (see BatchSmoother). These run
+  // on the (low priority) batch thread.
+  void RegisterBatchResultCallback(const BatchResult::Callback& cb);
+
+  // Add a function that gets called with the latest filter state, propagated forward with each new
+  // IMU measurement (see ImuPropagator). These run on the thread that calls ReceiveImu(), so they
+  // add latency to the IMU input. Only used if propagator_params.enabled.
+  void RegisterPropagatedStateCallback(const PropagatedState::Callback& cb);
+
+  // Add a function that gets called with each stereo pair and the StereoFrontend's live tracks
+  // right after it's tracked, so that other modules (e.g the ObjectMesher) can share the tracks
+  // instead of tracking the same images again. These run on the frontend thread, and block VO!
+  typedef std::function<void(const StereoImage1b&, const FeatureTracks&)> FeatureTracksCallback;
+  void RegisterFeatureTracksCallback(const FeatureTracksCallback& cb);
+
+  // The frontend publishes its feature tracks here, but only while something is listening (e.g a
+  // VizTapViewer, which show_feature_tracks starts).
+  const VizTap::Ptr& GetVizTap() const { return viz_tap_; }
+
+  // The pose of the body at any (recent) time, from the smoother's keyposes (revised as the smoother
+  // updates them) or the filter. Lock-free, from any thread.
+  const PoseHistory& GetPoseHistory() const { return pose_history_; }
+
+  // Periodically send timing stats somewhere (CSV, JSON, LCM, etc), every stats_print_interval_sec.
+  void RegisterStatsExporter(const StatsExporter::Ptr& exporter) { stats_.RegisterExporter(exporter); }
+
+  // Stamp each stereo pair's trace (if some earlier stage opened one) once it's tracked ("frontend"),
+  // and once it's in a smoother result ("smoother"). Set this before Initialize().
+  void TraceLatency(const LatencyTracer::Ptr& tracer) { tracer_ = tracer; }
+
+  // Change the number of features that the frontend detects per frame (at full effort), e.g when
+  // params are hot-reloaded. Lock-free, and the frontend picks it up before its next frame.
+  void SetMaxFeaturesPerFrame(int max_features_per_frame);
+
+  // Same as above, but also changes the number of KLT pyramid levels (at full effort). Both are
+  // stored in one atomic, so the frontend never tracks a frame with one of them changed and not the
+  // other (e.g when switching performance profiles).
+  void SetTrackerEffort(int max_features_per_frame, int klt_max_level);
+
+  // Timing histograms, queue depths and the number of items dropped from each queue so far. Every
+  // queue also has its telemetry under "Queue/<name>/" (see ExportQueueTelemetry()), including how
+  // long items waited in it.
+  StatsSnapshot GetStats();
+
+  // Runs num_frames synthetic stereo pairs (at the frontend resolution) through a throwaway
+  // StereoFrontend, and its last VO through one update of a throwaway smoother, so that the first
+  // real frames don't pay for OpenCV and GTSAM startup costs. Call this before Initialize(), it
+  // doesn't change the estimator's state.
+  WarmUpReport WarmUp(int num_frames);
+
   // Initialize the state estimator pose from an external source of localization.
   void Initialize(seconds_t t0, const gtsam::Pose3 P0_world_body);
 
+  // Resume from a checkpoint (see Params::checkpoint_path): the smoother starts from the saved
+  // keypose and its covariances (inflated by the checkpoint's age), and the filter from the saved
+  // state, instead of waiting for vision and re-converging the IMU bias. Returns false (and starts
+  // nothing) if the checkpoint can't be read, so the caller can fall back to the other Initialize().
+  bool Initialize(const std::string& checkpoint_path);
+
   // This call blocks until all queued stereo pairs have been processed.
   void BlockUntilFinished();
 
+  // Only for lockstep: blocks until every thread is done with everything received so far. Receive*()
+  // already calls this.
+  void WaitUntilIdle();
+
   // Tells all of the threads to exit, joins them, then exits.
   void Shutdown();
 
@@ -140,6 +371,13 @@ class StateEstimator final {
   // Tracks features from stereo images, and decides what to do with the results.
   void StereoFrontendLoop();
 
+  // Tracks features from one of the other stereo rigs (rig > 0), and passes its keyframes on to the
+  // smoother.
+  void RigFrontendLoop(size_t rig);
+
+  // Gives the keyframes from the other rigs to the smoother (right before each Update()).
+  void AddRigVo(FixedLagSmoother& smoother);
+
   void GetKeyposeAlignedMeasurements(seconds_t from_time,
                                      seconds_t to_time,
                                      PimResult::Ptr& pim_result,
@@ -147,18 +385,65 @@ class StateEstimator final {
                                      AttitudeMeasurement::Ptr& maybe_attitude_ptr,
                                      MultiRange& maybe_range_ptr,
                                      MagMeasurement::Ptr& maybe_mag_ptr,
+                                     PoseMeasurement::Ptr& maybe_pose_ptr,
                                      seconds_t allowed_misalignment_depth,
                                      seconds_t allowed_misalignment_range,
                                      seconds_t allowed_misalignment_mag,
+                                     seconds_t allowed_misalignment_pose,
                                      seconds_t allowed_misalignment_imu);
 
   // Smart the backend smoother with an initial timestamp and pose.
   void SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_body);
   void FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body);
 
+  // Every batch_params.interval_sec, re-optimizes the smoother's history from scratch. This only
+  // copies the history out of the smoother, so it never holds up the SmootherLoop.
+  void BatchLoop(FixedLagSmoother& smoother);
+
+  // Localizes against AprilTags in the newest left image (see use_tags), and stores keyframes for
+  // the Relocalizer (or relocalizes after a dropout, see use_relocalization).
+  void LocalizerLoop();
+
   // Updates the smoother_result_ (threadsafe), and calls any stored smoother callbacks.
   void OnSmootherResult(const SmootherResult& result);
 
+  // Updates the filter_state_ (threadsafe), and calls any stored filter callbacks.
+  void OnFilterState(const StateStamped& state);
+
+  // Copies the telemetry of every queue into stats_ (threadsafe).
+  void ExportQueueStats();
+
+  // Orientation of the body in the world at "timestamp", extrapolated from the latest filter state
+  // with its angular velocity. Returns false if the filter hasn't produced a state yet.
+  bool PredictWorldRotationBody(seconds_t timestamp, Matrix3d& world_R_body);
+
+  // A prior for restarting the smoother at "timestamp" after dead reckoning: the latest filter state
+  // extrapolated to timestamp, with the filter's covariances. The bias (and its covariance) come from
+  // last_keypose, since the filter doesn't estimate it. Returns false if the filter has no state yet.
+  bool FilterPrior(seconds_t timestamp, const SmootherResult& last_keypose, SmootherResult& prior);
+
+  // Lockstep only (see Params::lockstep).
+  void LockstepReceive(timestamp_t timestamp, bool to_smoother, bool to_filter);
+  void SetLockstepBusy(std::atomic_bool& busy, bool value);
+  bool IsIdle();
+
+  // Start the smoother with a ViInitializer (see Params::vi_init_params). On input, t0 is the first
+  // keyframe (already popped from the VO queue) and world_P_body its pose. On output, they're the
+  // newest keyframe that was used, along with its velocity and bias. Whether or not this returns true,
+  // the keyframes that were used are gone from the VO queue, so the outputs are always usable (with
+  // zero velocity and bias if it fails).
+  bool ViInitialize(seconds_t& t0, gtsam::Pose3& world_P_body, gtsam::Vector3& world_v_body, ImuBias& imu_bias);
+
+  // Lockstep version of WaitForResultOrTimeout() for the smoother's VO queue: waits until VO arrives,
+  // or new sensor data moves the data clock more than wait_sec past "since". Returns true on timeout.
+  bool LockstepWaitForVo(seconds_t since, double wait_sec);
+
+  // Same as WaitForResultOrTimeout() on the smoother VO queue. With incremental IMU preintegration,
+  // it wakes up every 10 ms in the meantime to integrate the new IMU measurements.
+  // NOTE(milo): ImuManager::Advance() reads the queue, so it has to run on the smoother thread,
+  // which is the only consumer of smoother_imu_manager_.
+  bool WaitForVo(double wait_sec);
+
   // Central function to change the state of the smoother. If VISION_AVAILABLE, it will try create
   // new keyposes from vision. If VISION_UNAVAILABLE, it will use IMU preintegration to create new
   // keyposes.
@@ -166,6 +451,7 @@ class StateEstimator final {
 
  private:
   Params params_;
+  EstimatorResources resources_;
   StereoCamera stereo_rig_;
   std::atomic_bool is_shutdown_;  // Set this to trigger a *graceful* shutdown.
 
@@ -173,31 +459,90 @@ class StateEstimator final {
   double depth_sign_ = 1.0;
 
   StereoFrontend stereo_frontend_;
-  ThreadsafeQueue<StereoImage1b> raw_stereo_queue_;
+  FrontendScheduler scheduler_;
+  std::atomic<uint64_t> full_effort_;          // Features and KLT levels (see SetTrackerEffort).
+  SpscQueue<StereoImage1b> raw_stereo_queue_;
+
+  // The frontend for each of the other stereo rigs, with its own queues and thread.
+  struct RigFrontend final
+  {
+    RigFrontend(const StereoFrontend::Params& params, size_t max_size_raw_stereo_queue, size_t max_size_vo_queue)
+        : frontend(params),
+          raw_stereo_queue(max_size_raw_stereo_queue, true, "rig_raw_stereo_queue"),
+          vo_queue(max_size_vo_queue, true, "rig_vo_queue") {}
+
+    StereoFrontend frontend;
+    SpscQueue<StereoImage1b> raw_stereo_queue;
+    SpscQueue<VoResult> vo_queue;                 // Keyframes for the smoother.
+    std::thread thread;
+    std::atomic_bool busy{false};                 // Lockstep only.
+  };
+  std::vector<std::unique_ptr<RigFrontend>> rig_frontends_;   // rig_frontends_[i] is rig i + 1.
 
   std::thread stereo_frontend_thread_;
   std::thread smoother_thread_;
   std::thread filter_thread_;
+  std::thread localizer_thread_;
 
   //================================================================================================
-  std::mutex mutex_smoother_result_;
   SmootherMode smoother_mode_ = SmootherMode::VISION_UNAVAILABLE;
-  SmootherResult smoother_result_;
+  SeqLock<SmootherResult> smoother_result_;
   std::atomic_bool smoother_update_flag_{false};
+  std::atomic_bool smoother_covariance_requested_{false};   // Set by the filter, read by the smoother.
+  std::atomic_bool frontend_hovering_{false};   // Keyframes are held off for parallax, but vision is fine.
   ImuManager smoother_imu_manager_;
-  ThreadsafeQueue<VoResult> smoother_vo_queue_;
+  SpscQueue<VoResult> smoother_vo_queue_;
   DepthManager smoother_depth_manager_;
   RangeManager smoother_range_manager_;
   MagManager smoother_mag_manager_;
+  PoseManager smoother_pose_manager_;
   std::vector<SmootherResult::Callback> smoother_result_callbacks_;
+  std::vector<BatchResult::Callback> batch_result_callbacks_;
   //================================================================================================
   ImuManager filter_imu_manager_;
   DepthManager filter_depth_manager_;
   RangeManager filter_range_manager_;
   std::vector<StateStamped::Callback> filter_result_callbacks_;
+  SeqLock<StateStamped> filter_state_;        // Version() is zero until the filter has a state.
+  PoseHistory pose_history_;                  // Smoother ring written by the smoother, filter ring by the filter.
+  Notifier filter_notifier_;  // Wakes up the filter thread when new data or a smoother result arrives.
+  //================================================================================================
+  ImuPropagator imu_propagator_;
+  std::vector<PropagatedState::Callback> propagated_state_callbacks_;
+  //================================================================================================
+
+  std::vector<FeatureTracksCallback> feature_tracks_callbacks_;
+  //================================================================================================
+  std::unique_ptr<TagLocalizer> tag_localizer_;
+  std::unique_ptr<Relocalizer> relocalizer_;
+  LatestValue<std::shared_ptr<const StereoImage1b>> localizer_image_;
+  LatestValue<SmootherResult> reloc_keypose_;               // Newest keypose, to store keyframes.
+  //================================================================================================
+  std::unique_ptr<CheckpointWriter> checkpoint_writer_;        // Only if checkpoint_path is set.
+  LatestValue<VecLandmarkObservation> checkpoint_landmarks_;   // From the newest keyframe.
+  VecLandmarkObservation last_checkpoint_landmarks_;
+  std::unique_ptr<StateCheckpoint> restore_;                   // Set by Initialize(checkpoint_path).
+
+  std::unique_ptr<MissionLogWriter> mission_log_;              // Only if mission_log_path is set.
+
+  //================================== LOCKSTEP ====================================================
+  std::atomic<double> data_clock_{0};           // Timestamp (sec) of the newest measurement received.
+  std::atomic<int> smoother_ticks_{0};          // Measurements the smoother hasn't looked at yet.
+  std::atomic<int> filter_ticks_{0};            // Measurements the filter hasn't looked at yet.
+  std::atomic_bool frontend_busy_{false};
+  std::atomic_bool smoother_busy_{false};
+  std::atomic_bool filter_busy_{false};
+  Notifier smoother_notifier_;                  // Wakes up the smoother for new VO or data.
+  Notifier idle_notifier_;                      // Wakes up WaitUntilIdle() when a thread goes idle.
   //================================================================================================
 
   StatsTracker stats_;
+  ResourceSampler resource_sampler_;
+
+  LatencyTracer::Ptr tracer_;                  // Optional.
+
+  VizTap::Ptr viz_tap_;
+  std::unique_ptr<VizTapViewer> viz_viewer_;   // Only if show_feature_tracks.
 };
 
 }
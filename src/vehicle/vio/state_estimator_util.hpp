@@ -1,30 +1,20 @@
 #pragma once
 
-#include <chrono>
-
 #include "core/eigen_types.hpp"
 #include "vio/attitude_measurement.hpp"
+#include "vio/vo_result.hpp"
 
 namespace bm {
 namespace vio {
 
-static const size_t kWaitForDataMilliseconds = 100;
-
 using namespace core;
 
-// Waits for a queue item for timeout_sec. Returns whether an item arrived before the timeout.
+// Waits for a queue item for timeout_sec. Returns whether the queue is still empty (i.e timed out).
+// NOTE(milo): The queue wakes us up as soon as an item is pushed, so there is no polling latency.
 template <typename QueueType>
 bool WaitForResultOrTimeout(QueueType& queue, double timeout_sec)
 {
-  double elapsed = 0;
-  const size_t ms_each_wait = (timeout_sec < kWaitForDataMilliseconds) ?
-                               kWaitForDataMilliseconds / 5 : kWaitForDataMilliseconds;
-  while (queue.Empty() && elapsed < timeout_sec) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(ms_each_wait));
-    elapsed += 1e-3 * static_cast<double>(ms_each_wait);
-  }
-
-  return queue.Empty();
+  return !queue.WaitNotEmpty(timeout_sec);
 }
 
 
@@ -41,5 +31,30 @@ inline bool EstimateAttitude(const Vector3d& body_a,
   return std::fabs(body_a.norm() - g) <= atol;
 }
 
+
+// Whether newer picks up where older left off, i.e its last keyframe is older's image. The frontend
+// only sends reliable keyframes to the smoother, so the chain can have gaps.
+inline bool VoResultsChain(const VoResult& older, const VoResult& newer)
+{
+  return newer.timestamp_lkf == older.timestamp && newer.camera_id_lkf == older.camera_id &&
+         newer.rig == older.rig;
+}
+
+
+// Fold newer into older, as if the frontend had never made a keyframe at older's image: the motion
+// goes from older's last keyframe to newer's image. Only newer's landmark observations are kept,
+// since the ones in older's image were observed from a keypose that won't exist.
+inline void MergeVoResults(VoResult& older, VoResult&& newer)
+{
+  CHECK(VoResultsChain(older, newer)) << "Can only merge consecutive VO results" << std::endl;
+
+  older.timestamp = newer.timestamp;
+  older.camera_id = newer.camera_id;
+  older.status |= newer.status;
+  older.lmk_obs = std::move(newer.lmk_obs);
+  older.lkf_T_cam = older.lkf_T_cam * newer.lkf_T_cam;
+  older.avg_reprojection_err = newer.avg_reprojection_err;
+}
+
 }
 }
@@ -1,4 +1,4 @@
-#include <unordered_set>
+#include <algorithm>
 
 #include <glog/logging.h>
 
@@ -6,6 +6,7 @@
 
 #include "core/math_util.hpp"
 #include "core/timer.hpp"
+#include "core/trace.hpp"
 #include "vio/optimize_odometry.hpp"
 #include "vio/stereo_frontend.hpp"
 #include "feature_tracking/visualization_2d.hpp"
@@ -22,73 +23,74 @@ void StereoFrontend::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("sigma_tracked_point", &sigma_tracked_point);
   parser.GetParam("lm_max_iters", &lm_max_iters);
   parser.GetParam("lm_max_error_stdevs", &lm_max_error_stdevs);
+  parser.GetParam("ransac_hypotheses", &ransac_hypotheses);
   parser.GetParam("kill_nonrigid_lmks", &kill_nonrigid_lmks);
+  parser.GetParam("float_odometry", &float_odometry);
+  parser.GetParam("direct_tracking", &direct_tracking);
+  if (direct_tracking) {
+    direct_params = DirectOdometry::Params(parser.GetNode("DirectOdometry"));
+  }
 
   YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_left, body_T_right);
 
   CHECK_GE(sigma_tracked_point, 1.0);
   CHECK_GE(lm_max_iters, 5);
   CHECK_GE(lm_max_error_stdevs, 1.0);
+  CHECK_GE(ransac_hypotheses, 0);
 }
 
 
 StereoFrontend::StereoFrontend(const Params& params)
     : params_(params),
       stereo_rig_(params.stereo_rig),
+      stereo_rig_f_(params.stereo_rig.Cast<float>()),
       tracker_(params_.tracker_params, stereo_rig_)
 {
+  if (params_.direct_tracking) {
+    direct_.reset(new DirectOdometry(params_.direct_params, stereo_rig_));
+  }
   LOG(INFO) << "Constructed StereoFrontend!" << std::endl;
 }
 
 
-// Helper function to grab an observation that was observed from query_camera_id.
-// Returns whether or not the query was successful.
-static bool FindObservationFromCameraId(const VecLandmarkObservation& lmk_obs,
-                                        uid_t query_camera_id,
-                                        cv::Point2f& query_lmk_obs,
-                                        double& query_lmk_disp)
+VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
+                               const Matrix4d& prev_T_cur_prior,
+                               bool force_keyframe)
 {
-  for (const LandmarkObservation& obs : lmk_obs) {
-    if (obs.camera_id == query_camera_id) {
-      query_lmk_obs = obs.pixel_location;
-      query_lmk_disp = obs.disparity;
-      return true;
-    }
-  }
+  BM_TRACE_SCOPE("StereoFrontend::Track");
 
-  return false;
-}
+  if (direct_) {
+    return TrackDirect(stereo_pair, prev_T_cur_prior, force_keyframe);
+  }
 
+  // NOTE(milo): Everything that only lives for this frame comes from the arena. The lists that
+  // are passed to the optimizer are members, so that their capacity is reused across frames.
+  arena_.Reset();
 
-VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
-                               const Matrix4d& prev_T_cur_prior)
-{
   VoResult result(stereo_pair.timestamp, timestamp_lkf_, stereo_pair.camera_id, prev_keyframe_id_);
 
-  const bool is_keyframe = tracker_.TrackAndTriangulate(stereo_pair, false);
+  const Matrix3d prev_R_cur = prev_T_cur_prior.block<3, 3>(0, 0);
+  const bool is_keyframe = tracker_.TrackAndTriangulate(stereo_pair, force_keyframe, prev_R_cur);
+  result.is_keyframe = is_keyframe;
 
   const FeatureTracks& live_tracks = tracker_.GetLiveTracks();
 
   // Get landmarks that were tracked into the current frame.
-  std::vector<uid_t> lmk_ids;
-  std::vector<cv::Point2f> lmk_points;
-  // std::vector<double> lmk_disps;
-
-  for (auto it = live_tracks.begin(); it != live_tracks.end(); ++it) {
-    const uid_t lmk_id = it->first;
-    const LandmarkObservation& lmk_obs = it->second.back();
-
-    const size_t num_obs = it->second.size();
+  ArenaVector<uid_t> lmk_ids(arena_);
+  ArenaVector<cv::Point2f> lmk_points(arena_);
+  lmk_ids.reserve(live_tracks.Size());
+  lmk_points.reserve(live_tracks.Size());
+  result.lmk_obs.reserve(live_tracks.Size());
 
+  for (const FeatureTracks::Slot s : live_tracks.LiveSlots()) {
     // Skip observations from previous frames.
-    if (lmk_obs.camera_id != stereo_pair.camera_id) {
+    if (live_tracks.CameraId(s, 0) != stereo_pair.camera_id) {
       continue;
     }
-    lmk_points.emplace_back(lmk_obs.pixel_location);
-    // lmk_disps.emplace_back(lmk_obs.disparity);
-    lmk_ids.emplace_back(lmk_id);
+    lmk_points.emplace_back(live_tracks.Pixel(s, 0));
+    lmk_ids.emplace_back(live_tracks.LandmarkId(s));
 
-    result.lmk_obs.emplace_back(lmk_obs);
+    result.lmk_obs.emplace_back(live_tracks.Observation(s, 0));
   }
 
   if (result.lmk_obs.empty()) {
@@ -105,45 +107,86 @@ VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
 
   //==================== LEAST-SQUARES ODOMETRY OPTIMIZATION ===================
   // Get landmarks that were observed in the current frame AND the previous keyframe.
-  std::vector<Vector3d> lmk_pts_prev_kf_3d;
-  std::vector<Vector2d> lmk_pts_curr_f_2d;
-  std::vector<uid_t> lmk_ids_prev_kf;
+  lmk_pts_prev_kf_3d_.clear();
+  lmk_pts_curr_f_2d_.clear();
+  ArenaVector<uid_t> lmk_ids_prev_kf(arena_);
+  lmk_ids_prev_kf.reserve(lmk_ids.size());
 
   for (size_t i = 0; i < lmk_ids.size(); ++i) {
     const uid_t lmk_id = lmk_ids.at(i);
-    const VecLmkObs& lmk_obs = live_tracks.at(lmk_id);
     cv::Point2f pt;
     double disp;
-    if (FindObservationFromCameraId(lmk_obs, prev_keyframe_id_, pt, disp)) {
+    if (live_tracks.FindObservation(lmk_id, prev_keyframe_id_, pt, disp)) {
       CHECK_GT(disp, 0);
       const Vector3d p_lkf = stereo_rig_.LeftCamera().Backproject(Vector2d(pt.x, pt.y), stereo_rig_.DispToDepth(disp));
-      lmk_pts_prev_kf_3d.emplace_back(p_lkf);
-      lmk_pts_curr_f_2d.emplace_back(lmk_points.at(i).x, lmk_points.at(i).y);
+      lmk_pts_prev_kf_3d_.emplace_back(p_lkf);
+      lmk_pts_curr_f_2d_.emplace_back(lmk_points.at(i).x, lmk_points.at(i).y);
       lmk_ids_prev_kf.emplace_back(lmk_id);
     }
   }
 
   // Can only do LM odometry estimation if enough points in the prev keframe and cur frame.
-  if (lmk_pts_prev_kf_3d.size() > 6) {
+  if (lmk_pts_prev_kf_3d_.size() > 6) {
     Matrix6d C_cur_lkf = Matrix6d::Identity();
-    const std::vector<double> lmk_pts_sigma(lmk_pts_curr_f_2d.size(), params_.sigma_tracked_point);
-
-    std::vector<int> lm_inlier_indices, lm_outlier_indices;
-
-    const int iters = OptimizeOdometryIterative(
-        lmk_pts_prev_kf_3d,
-        lmk_pts_curr_f_2d,
-        lmk_pts_sigma,
-        stereo_rig_,
-        cur_T_lkf_,
-        C_cur_lkf,
-        result.avg_reprojection_err,
-        lm_inlier_indices,
-        lm_outlier_indices,
-        params_.lm_max_iters,
-        1e-3,
-        1e-6,
-        params_.lm_max_error_stdevs);
+    lmk_pts_sigma_.assign(lmk_pts_curr_f_2d_.size(), params_.sigma_tracked_point);
+
+    // Warm-start from the last estimate, moved forward by the prior: cur_T_lkf = cur_T_prev * prev_T_lkf.
+    cur_T_lkf_ = prev_T_cur_prior.inverse() * cur_T_lkf_;
+
+    int iters = -1;
+    if (params_.float_odometry) {
+      // NOTE(milo): Only the optimization runs in float. The lists are short (tracked landmarks),
+      // so converting them is cheap compared to the LM iterations.
+      lmk_pts_prev_kf_3d_f_.clear();
+      lmk_pts_curr_f_2d_f_.clear();
+      for (size_t i = 0; i < lmk_pts_prev_kf_3d_.size(); ++i) {
+        lmk_pts_prev_kf_3d_f_.emplace_back(lmk_pts_prev_kf_3d_.at(i).cast<float>());
+        lmk_pts_curr_f_2d_f_.emplace_back(lmk_pts_curr_f_2d_.at(i).cast<float>());
+      }
+      lmk_pts_sigma_f_.assign(lmk_pts_curr_f_2d_f_.size(), static_cast<float>(params_.sigma_tracked_point));
+
+      Matrix4f cur_T_lkf_f = cur_T_lkf_.cast<float>();
+      Matrix6f C_cur_lkf_f = Matrix6f::Identity();
+      float avg_reprojection_err_f = 0;
+
+      iters = OptimizeOdometryIterative(
+          lmk_pts_prev_kf_3d_f_,
+          lmk_pts_curr_f_2d_f_,
+          lmk_pts_sigma_f_,
+          stereo_rig_f_,
+          cur_T_lkf_f,
+          C_cur_lkf_f,
+          avg_reprojection_err_f,
+          lm_inlier_indices_,
+          lm_outlier_indices_,
+          params_.lm_max_iters,
+          1e-3,
+          1e-6,
+          params_.lm_max_error_stdevs,
+          params_.ransac_hypotheses,
+          &arena_);
+
+      cur_T_lkf_ = cur_T_lkf_f.cast<double>();
+      C_cur_lkf = C_cur_lkf_f.cast<double>();
+      result.avg_reprojection_err = avg_reprojection_err_f;
+    } else {
+      iters = OptimizeOdometryIterative(
+          lmk_pts_prev_kf_3d_,
+          lmk_pts_curr_f_2d_,
+          lmk_pts_sigma_,
+          stereo_rig_,
+          cur_T_lkf_,
+          C_cur_lkf,
+          result.avg_reprojection_err,
+          lm_inlier_indices_,
+          lm_outlier_indices_,
+          params_.lm_max_iters,
+          1e-3,
+          1e-6,
+          params_.lm_max_error_stdevs,
+          params_.ransac_hypotheses,
+          &arena_);
+    }
 
     // Returning -1 indicates an error in LM optimization.
     if (iters < 0 || result.avg_reprojection_err > params_.max_avg_reprojection_error) {
@@ -152,23 +195,23 @@ VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
     result.lkf_T_cam = cur_T_lkf_.inverse();
 
     //======================== REMOVE OUTLIER POINTS =============================
-    std::unordered_set<uid_t> inlier_lmk_ids;
-    for (const int idx : lm_inlier_indices) {
-      const uid_t lmk_id = lmk_ids_prev_kf.at(idx);
-      inlier_lmk_ids.insert(lmk_id);
-    }
-
-    VecLmkObs inlier_obs;
-    for (const LandmarkObservation& lmk_obs : result.lmk_obs) {
-      if (inlier_lmk_ids.count(lmk_obs.landmark_id) != 0) {
-        inlier_obs.emplace_back(lmk_obs);
-      }
+    ArenaVector<uid_t> inlier_lmk_ids(arena_);
+    inlier_lmk_ids.reserve(lm_inlier_indices_.size());
+    for (const int idx : lm_inlier_indices_) {
+      inlier_lmk_ids.emplace_back(lmk_ids_prev_kf.at(idx));
     }
+    std::sort(inlier_lmk_ids.begin(), inlier_lmk_ids.end());
 
-    std::swap(inlier_obs, result.lmk_obs);
+    // Filter in place, since the observations are returned (they can't live in the arena).
+    const auto is_outlier = [&inlier_lmk_ids](const LandmarkObservation& lmk_obs)
+    {
+      return !std::binary_search(inlier_lmk_ids.begin(), inlier_lmk_ids.end(), lmk_obs.landmark_id);
+    };
+    result.lmk_obs.erase(std::remove_if(result.lmk_obs.begin(), result.lmk_obs.end(), is_outlier),
+                         result.lmk_obs.end());
 
     if (params_.kill_nonrigid_lmks) {
-      for (const int idx : lm_outlier_indices) {
+      for (const int idx : lm_outlier_indices_) {
         const uid_t lmk_id = lmk_ids_prev_kf.at(idx);
         tracker_.KillLandmark(lmk_id);
       }
@@ -186,5 +229,65 @@ VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
 }
 
 
+VoResult StereoFrontend::TrackDirect(const StereoImage1b& stereo_pair,
+                                     const Matrix4d& prev_T_cur_prior,
+                                     bool force_keyframe)
+{
+  VoResult result(stereo_pair.timestamp, timestamp_lkf_, stereo_pair.camera_id, prev_keyframe_id_);
+
+  bool odom_failed = false;
+  if (direct_->NumPoints() > 0) {
+    // Warm-start from the last estimate, moved forward by the prior (same as the KLT path).
+    cur_T_lkf_ = prev_T_cur_prior.inverse() * cur_T_lkf_;
+
+    double avg_error = -1.0;
+    const int iters = direct_->Track(stereo_pair, cur_T_lkf_, avg_error);
+    odom_failed = iters < 0;
+
+    result.avg_reprojection_err = avg_error;
+    result.lkf_T_cam = cur_T_lkf_.inverse();
+    result.lmk_obs = direct_->Observations();
+
+    if (odom_failed) {
+      result.status |= StereoFrontend::Status::ODOM_ESTIMATION_FAILED;
+    }
+  } else {
+    result.status |= Status::NO_FEATURES_FROM_LAST_KF;
+  }
+
+  if (result.lmk_obs.size() < 6) {
+    result.status |= StereoFrontend::Status::FEW_TRACKED_FEATURES;
+  }
+
+  // NOTE(milo): A failed alignment also triggers a keyframe, since the next frame is even less
+  // likely to align with this keyframe.
+  ++direct_frames_since_kf_;
+  const StereoTracker::Params& tp = params_.tracker_params;
+  const bool is_keyframe = force_keyframe ||
+                           odom_failed ||
+                           direct_->NumPoints() == 0 ||
+                           direct_frames_since_kf_ >= tp.trigger_keyframe_k ||
+                           static_cast<int>(result.lmk_obs.size()) < tp.trigger_keyframe_min_lmks;
+  result.is_keyframe = is_keyframe;
+
+  if (is_keyframe) {
+    // The new keyframe's points are observed in this image too (like newly detected features).
+    const size_t num_points = direct_->SetKeyframe(stereo_pair);
+    if (num_points < 6) {
+      result.status |= Status::FEW_DETECTED_FEATURES;
+    }
+    const std::vector<LandmarkObservation>& new_obs = direct_->Observations();
+    result.lmk_obs.insert(result.lmk_obs.end(), new_obs.begin(), new_obs.end());
+
+    direct_frames_since_kf_ = 0;
+    cur_T_lkf_ = Matrix4d::Identity();
+    timestamp_lkf_ = stereo_pair.timestamp;
+    prev_keyframe_id_ = stereo_pair.camera_id;
+  }
+
+  return result;
+}
+
+
 }
 }
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <unordered_map>
 
 #include "params/params_base.hpp"
+#include "core/frame_arena.hpp"
 #include "core/macros.hpp"
 #include "vision_core/cv_types.hpp"
 #include "core/eigen_types.hpp"
@@ -15,6 +17,7 @@
 
 #include "feature_tracking/stereo_tracker.hpp"
 
+#include "vio/direct_odometry.hpp"
 #include "vio/vo_result.hpp"
 
 namespace bm {
@@ -37,7 +40,15 @@ class StereoFrontend final {
     double sigma_tracked_point = 5.0;
     int lm_max_iters = 20;
     double lm_max_error_stdevs = 3.0;
+    int ransac_hypotheses = 0;          // If > 0, reject outliers with RANSAC before the LM.
     bool kill_nonrigid_lmks = true;
+    bool float_odometry = false;        // Optimize odometry in float (the result is still double).
+
+    // Estimate odometry with DirectOdometry (photometric alignment to the last keyframe) instead of
+    // KLT tracks and reprojection error. The StereoTracker isn't run, so there are no live tracks.
+    // Keyframes are triggered by the tracker's trigger_keyframe_k and trigger_keyframe_min_lmks.
+    bool direct_tracking = false;
+    DirectOdometry::Params direct_params;
 
     StereoCamera stereo_rig;
     Matrix4d body_T_left;
@@ -62,23 +73,76 @@ class StereoFrontend final {
   // Construct with params.
   explicit StereoFrontend(const Params& params);
 
-  // Track and estimate odometry for a new stereo pair.
+  // Track and estimate odometry for a new stereo pair. If force_keyframe, this image becomes a
+  // keyframe no matter what the tracker's keyframe triggers say.
   VoResult Track(const StereoImage1b& stereo_pair,
-                 const Matrix4d& prev_T_cur_prior);
+                 const Matrix4d& prev_T_cur_prior,
+                 bool force_keyframe = false);
+
+  // The rig that stereo pairs passed to Track() should match (see StateEstimator::Params::frontend_height).
+  const StereoCamera& GetStereoRig() const { return stereo_rig_; }
+
+  // Wrapper around StereoTracker::SetEffort().
+  void SetTrackerEffort(int max_features_per_frame, int klt_max_level)
+  {
+    tracker_.SetEffort(max_features_per_frame, klt_max_level);
+  }
+
+  // Wrapper around StereoTracker::ReserveLandmarkIds().
+  void ReserveLandmarkIds(uid_t next_lmk_id)
+  {
+    tracker_.ReserveLandmarkIds(next_lmk_id);
+    if (direct_) { direct_->ReserveLandmarkIds(next_lmk_id); }
+  }
 
   // Wrapper around StereoTracker::VisualizeFeatureTracks().
   Image3b VisualizeFeatureTracks() const { return tracker_.VisualizeFeatureTracks(); }
 
+  // Wrapper around StereoTracker::GetFeatureTracksDrawList().
+  void GetFeatureTracksDrawList(DrawList& list) const { tracker_.GetFeatureTracksDrawList(list); }
+
+  // Wrapper around StereoTracker::NumSuppressedKeyframes().
+  size_t NumSuppressedKeyframes() const { return tracker_.NumSuppressedKeyframes(); }
+
+  // Wrapper around StereoTracker::GetLiveTracks().
+  const FeatureTracks& GetLiveTracks() const { return tracker_.GetLiveTracks(); }
+
+  // Per-frame temporaries (and the tracker's) come from these, e.g to check that the number of
+  // heap allocations stops growing once the frontend is warmed up.
+  const FrameArena& Arena() const { return arena_; }
+  const FrameArena& TrackerArena() const { return tracker_.Arena(); }
+
  private:
+  // Track() for params_.direct_tracking.
+  VoResult TrackDirect(const StereoImage1b& stereo_pair,
+                       const Matrix4d& prev_T_cur_prior,
+                       bool force_keyframe);
+
   Params params_;
   StereoCamera stereo_rig_;
+  StereoCameraf stereo_rig_f_;
 
   StereoTracker tracker_;
+  std::unique_ptr<DirectOdometry> direct_;    // Only if params_.direct_tracking.
+  int direct_frames_since_kf_ = 0;
 
   uid_t prev_keyframe_id_ = 0;
   timestamp_t timestamp_lkf_ = 0;
 
   Matrix4d cur_T_lkf_ = Matrix4d::Identity();
+
+  // Reset at the start of each Track().
+  FrameArena arena_;
+
+  // Inputs and outputs of the odometry optimization, reused across frames.
+  std::vector<Vector3d> lmk_pts_prev_kf_3d_;
+  std::vector<Vector2d> lmk_pts_curr_f_2d_;
+  std::vector<double> lmk_pts_sigma_;
+  std::vector<Vector3f> lmk_pts_prev_kf_3d_f_;    // Only for params_.float_odometry.
+  std::vector<Vector2f> lmk_pts_curr_f_2d_f_;
+  std::vector<float> lmk_pts_sigma_f_;
+  std::vector<int> lm_inlier_indices_;
+  std::vector<int> lm_outlier_indices_;
 };
 
 
@@ -0,0 +1,113 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "AprilTags/TagDetector.h"
+#include "AprilTags/Tag16h5.h"
+#include "AprilTags/Tag25h9.h"
+#include "AprilTags/Tag36h9.h"
+#include "AprilTags/Tag36h11.h"
+
+#include "vio/tag_localizer.hpp"
+
+namespace bm {
+namespace vio {
+
+
+static const AprilTags::TagCodes& GetTagCodes(const std::string& family)
+{
+  if (family == "16h5") {
+    return AprilTags::tagCodes16h5;
+  } else if (family == "25h9") {
+    return AprilTags::tagCodes25h9;
+  } else if (family == "36h9") {
+    return AprilTags::tagCodes36h9;
+  } else if (family == "36h11") {
+    return AprilTags::tagCodes36h11;
+  }
+  LOG(FATAL) << "Unknown AprilTag family: " << family << std::endl;
+  return AprilTags::tagCodes36h11;
+}
+
+
+void TagLocalizer::Params::LoadParams(const YamlParser& parser)
+{
+  tag_family = YamlToString(parser.GetNode("tag_family"));
+  parser.GetParam("tag_size", &tag_size);
+  parser.GetParam("decimate", &decimate);
+  parser.GetParam("num_threads", &num_threads);
+  parser.GetParam("refine_edges", &refine_edges);
+  parser.GetParam("sigma_rotation", &sigma_rotation);
+  parser.GetParam("sigma_translation", &sigma_translation);
+
+  YamlToMatrix<Matrix4d>(parser.GetNode("/shared/stereo_forward/camera_left/body_T_cam"), body_T_cam);
+
+  // NOTE(milo): YamlToTransform only accepts symmetric rotations, so the tag poses are read as
+  // plain matrices.
+  const cv::FileNode& tags_node = parser.GetNode("known_tags");
+  CHECK(tags_node.isSeq()) << "TagLocalizer: 'known_tags' must be a sequence" << std::endl;
+  world_T_tag.clear();
+  for (size_t i = 0; i < tags_node.size(); ++i) {
+    const int id = static_cast<int>(tags_node[i]["id"]);
+    Matrix4d T;
+    YamlToMatrix<Matrix4d>(tags_node[i]["world_T_tag"], T);
+    world_T_tag[id] = T;
+  }
+
+  GetTagCodes(tag_family);
+  CHECK_GT(tag_size, 0);
+  CHECK_GE(decimate, 1);
+  CHECK_GE(num_threads, 1);
+  CHECK_GT(sigma_rotation, 0);
+  CHECK_GT(sigma_translation, 0);
+}
+
+
+TagLocalizer::TagLocalizer(const Params& params, const PinholeCamera& camera)
+    : params_(params),
+      camera_(camera)
+{
+  AprilTags::TagDetector::Options options;
+  options.decimate = params_.decimate;
+  options.numThreads = params_.num_threads;
+  options.refineEdges = params_.refine_edges;
+  detector_.reset(new AprilTags::TagDetector(GetTagCodes(params_.tag_family), options));
+}
+
+
+// NOTE(milo): Defined here, where TagDetector is a complete type.
+TagLocalizer::~TagLocalizer() {}
+
+
+std::vector<PoseMeasurement> TagLocalizer::Localize(timestamp_t timestamp, const Image1b& image)
+{
+  std::vector<PoseMeasurement> out;
+
+  const std::vector<AprilTags::TagDetection> detections = detector_->extractTags(image);
+  const Matrix4d cam_T_body = params_.body_T_cam.inverse();
+
+  for (const AprilTags::TagDetection& det : detections) {
+    const auto it = params_.world_T_tag.find(det.id);
+    if (it == params_.world_T_tag.end()) {
+      continue;
+    }
+
+    // NOTE(milo): This is the pose of the tag in the camera frame (z forward, x right, y down).
+    const Matrix4d cam_T_tag = det.getRelativeTransform(
+        params_.tag_size, camera_.fx(), camera_.fy(), camera_.cx(), camera_.cy());
+    const Matrix4d world_T_body = it->second * cam_T_tag.inverse() * cam_T_body;
+
+    const double scale = std::max(1.0, cam_T_tag.block<3, 1>(0, 3).norm());
+    Vector6d sigmas;
+    sigmas.head<3>().setConstant(scale * params_.sigma_rotation);
+    sigmas.tail<3>().setConstant(scale * params_.sigma_translation);
+
+    out.emplace_back(timestamp, world_T_body, sigmas);
+  }
+
+  return out;
+}
+
+
+}
+}
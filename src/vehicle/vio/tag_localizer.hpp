@@ -0,0 +1,79 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/StdVector>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/pose_measurement.hpp"
+#include "core/timestamp.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+
+namespace AprilTags {
+class TagDetector;
+}
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// Localizes the camera against AprilTags with known poses in the world (e.g fiducials on a dock
+// or the hull of a ship). Each tag that's seen gives a PoseMeasurement of the body, which can go
+// to StateEstimator::ReceivePose() and into the smoother as a prior on the nearest keypose.
+class TagLocalizer final {
+ public:
+  typedef std::map<int, Matrix4d, std::less<int>,
+                   Eigen::aligned_allocator<std::pair<const int, Matrix4d>>> TagPoses;
+
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    std::string tag_family = "36h11";   // 16h5, 25h9, 36h9 or 36h11.
+    double tag_size = 0.2;              // m, length of an edge of the black border.
+
+    int decimate = 2;                   // Find quads on an image this much smaller (see TagDetector).
+    int num_threads = 2;                // For the detector's parallel stages.
+    bool refine_edges = true;
+
+    // Noise for a tag seen from 1m away (rotation in rad, translation in m). Both grow linearly
+    // with the distance to the tag.
+    double sigma_rotation = 0.05;
+    double sigma_translation = 0.05;
+
+    Matrix4d body_T_cam = Matrix4d::Identity();
+    TagPoses world_T_tag;               // Tags that aren't in here are ignored.
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(TagLocalizer)
+
+  // NOTE(milo): Images should be undistorted (e.g rectified), since the detector assumes a pinhole.
+  TagLocalizer(const Params& params, const PinholeCamera& camera);
+  ~TagLocalizer();
+
+  // Detects tags in an image, and returns a measurement of the body pose from each known one.
+  std::vector<PoseMeasurement> Localize(timestamp_t timestamp, const Image1b& image);
+
+  const Params& GetParams() const { return params_; }
+
+ private:
+  Params params_;
+  PinholeCamera camera_;
+  std::unique_ptr<AprilTags::TagDetector> detector_;
+};
+
+
+}
+}
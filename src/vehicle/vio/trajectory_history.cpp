@@ -0,0 +1,88 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "vio/trajectory_history.hpp"
+
+namespace bm {
+namespace vio {
+
+
+TrajectoryHistory::TrajectoryHistory(size_t full_detail, size_t max_points)
+    : full_detail_(full_detail),
+      max_points_(max_points)
+{
+  CHECK_LT(full_detail_, max_points_) << "TrajectoryHistory needs full_detail < max_points" << std::endl;
+}
+
+
+void TrajectoryHistory::Add(uid_t id, const Vector3d& position)
+{
+  index_[id] = points_.size();
+  points_.emplace_back(id, position);
+
+  if (points_.size() > max_points_) {
+    Decimate();
+  }
+}
+
+
+bool TrajectoryHistory::Update(uid_t id, const Vector3d& position)
+{
+  const auto it = index_.find(id);
+  if (it == index_.end()) {
+    return false;
+  }
+  points_.at(it->second).second = position;
+  return true;
+}
+
+
+void TrajectoryHistory::SetMaxPoints(size_t max_points)
+{
+  CHECK_LT(full_detail_, max_points) << "TrajectoryHistory needs full_detail < max_points" << std::endl;
+  max_points_ = max_points;
+  while (points_.size() > max_points_) {
+    Decimate();
+  }
+  points_.shrink_to_fit();
+}
+
+
+size_t TrajectoryHistory::MemoryBytes() const
+{
+  // NOTE(milo): An unordered_map entry is about a node (key, value, next pointer) plus a bucket.
+  const size_t index_entry = sizeof(uid_t) + sizeof(size_t) + 2 * sizeof(void*);
+  return points_.capacity() * sizeof(IdAndPosition) + index_.size() * index_entry;
+}
+
+
+void TrajectoryHistory::Decimate()
+{
+  const size_t num_old = points_.size() - std::min(points_.size(), full_detail_);
+
+  // Keep the even points of the old part (including the first one), and all of the recent part.
+  size_t out = 0;
+  for (size_t i = 0; i < points_.size(); ++i) {
+    const bool keep = (i >= num_old) || (i % 2 == 0);
+    if (keep) {
+      points_[out++] = points_[i];
+    }
+  }
+
+  // NOTE(milo): If there's only one old point, nothing was dropped, so drop the oldest instead.
+  if (out == points_.size() && !points_.empty()) {
+    points_.erase(points_.begin());
+    --out;
+  }
+  points_.resize(out);
+
+  index_.clear();
+  for (size_t i = 0; i < points_.size(); ++i) {
+    index_[points_[i].first] = i;
+  }
+}
+
+
+}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core/eigen_types.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// The positions along a trajectory (e.g keyframes), with a level of detail that drops with age, so
+// that a whole mission fits in a fixed number of points. The newest full_detail points are always
+// kept. When there are more than max_points, every other point older than those is dropped (the
+// first one is always kept). Old parts of the trajectory get coarser each time that happens, and
+// the memory stays bounded no matter how long the mission is.
+class TrajectoryHistory final {
+ public:
+  typedef std::pair<uid_t, Vector3d> IdAndPosition;
+
+  // NOTE(milo): Needs full_detail < max_points, so that there's always something to decimate.
+  TrajectoryHistory(size_t full_detail, size_t max_points);
+
+  // Add a point to the end of the trajectory.
+  void Add(uid_t id, const Vector3d& position);
+
+  // Move a point (e.g after the smoother updates a keyframe). Returns false if it was decimated.
+  bool Update(uid_t id, const Vector3d& position);
+
+  // Change the budget (e.g to free up memory). The trajectory is decimated to fit right away.
+  void SetMaxPoints(size_t max_points);
+
+  size_t Size() const { return points_.size(); }
+  size_t MaxPoints() const { return max_points_; }
+  const std::vector<IdAndPosition>& Points() const { return points_; }
+
+  // Roughly how much memory this takes up (the points and the index).
+  size_t MemoryBytes() const;
+
+ private:
+  void Decimate();
+
+  size_t full_detail_;
+  size_t max_points_;
+  std::vector<IdAndPosition> points_;         // Oldest first.
+  std::unordered_map<uid_t, size_t> index_;   // Into points_.
+};
+
+
+}
+}
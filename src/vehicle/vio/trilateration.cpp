@@ -1,6 +1,11 @@
-#include <glog/logging.h>
+#include <algorithm>
 #include <iostream>
 
+#include <glog/logging.h>
+
+#include <Eigen/Eigenvalues>
+
+#include "core/thread_pool.hpp"
 #include "vio/trilateration.hpp"
 
 namespace bm {
@@ -155,5 +160,248 @@ double TrilateratePosition(const MultiRange& ranges,
 }
 
 
+bool TrilaterateLinear(const MultiRange& ranges,
+                       const std::vector<double>& sigmas,
+                       Vector3d& world_t_body)
+{
+  CHECK_GE(ranges.size(), 3ul) << "Need at least 3 range measurements for trilateration" << std::endl;
+  CHECK_EQ(ranges.size(), sigmas.size()) << "Must pass in a measurement noise for each range" << std::endl;
+
+  const size_t M = ranges.size();
+  const Vector3d& p0 = ranges[0].point;
+  const double r0 = ranges[0].range;
+
+  // |x - p_i|^2 - |x - p_0|^2 = r_i^2 - r_0^2  ==>  2(p_i - p_0)^T x = r_0^2 - r_i^2 + |p_i|^2 - |p_0|^2
+  // NOTE(milo): The squared equations scale the range noise by about 2r, which is ignored here.
+  Matrix3d N = Matrix3d::Zero();
+  Vector3d g = Vector3d::Zero();
+  for (size_t i = 1; i < M; ++i) {
+    const Vector3d& pi = ranges[i].point;
+    const double ri = ranges[i].range;
+    const Vector3d a = 2.0 * (pi - p0);
+    const double b = r0*r0 - ri*ri + pi.squaredNorm() - p0.squaredNorm();
+    const double w = 1.0 / (sigmas[0]*sigmas[0] + sigmas[i]*sigmas[i]);
+    N.noalias() += w * a * a.transpose();
+    g += w * b * a;
+  }
+
+  // Eigenvalues are in increasing order.
+  const Eigen::SelfAdjointEigenSolver<Matrix3d> eig(N);
+  const Vector3d& lambda = eig.eigenvalues();
+  const Matrix3d& V = eig.eigenvectors();
+
+  const double kRankTol = 1e-9;
+  if (lambda(2) <= 0 || lambda(1) < kRankTol * lambda(2)) {
+    return false;
+  }
+
+  if (lambda(0) >= kRankTol * lambda(2)) {
+    world_t_body = V * (V.transpose() * g).cwiseQuotient(lambda);
+    return true;
+  }
+
+  // Coplanar beacons: the linear system only fixes the position within the plane (normal n). The
+  // offset along n comes from the ranges: r_i^2 = |in-plane distance to p_i|^2 + h^2.
+  const Vector3d n = V.col(0);
+  const Vector3d x_plane = V.col(1) * V.col(1).dot(g) / lambda(1) + V.col(2) * V.col(2).dot(g) / lambda(2);
+  const double plane_offset = n.dot(p0);
+
+  double h2 = 0;
+  double w_sum = 0;
+  for (size_t i = 0; i < M; ++i) {
+    const Vector3d d = x_plane - ranges[i].point;
+    const Vector3d d_in_plane = d - n.dot(d) * n;
+    const double w = 1.0 / (sigmas[i]*sigmas[i]);
+    h2 += w * (ranges[i].range * ranges[i].range - d_in_plane.squaredNorm());
+    w_sum += w;
+  }
+  const double h = std::sqrt(std::max(0.0, h2 / w_sum));
+
+  // Pick the side of the plane that world_t_body (the guess) is on.
+  const double side = (n.dot(world_t_body) >= plane_offset) ? 1.0 : -1.0;
+  world_t_body = x_plane + (plane_offset + side * h) * n;
+
+  return true;
+}
+
+
+// Huber loss on a normalized residual u, and its IRLS weight.
+static double HuberLoss(double u, double k)
+{
+  const double abs_u = std::fabs(u);
+  return (abs_u <= k) ? 0.5*u*u : k*(abs_u - 0.5*k);
+}
+
+
+static double HuberWeight(double u, double k)
+{
+  const double abs_u = std::fabs(u);
+  return (abs_u <= k) ? 1.0 : k / abs_u;
+}
+
+
+// Accumulates the (robustly weighted) normal equations H dx = -g at world_t_body, and returns the
+// robust cost.
+static double LinearizeRobust(const MultiRange& ranges,
+                              const std::vector<double>& sigmas,
+                              const Vector3d& world_t_body,
+                              double huber_threshold,
+                              Matrix3d& H,
+                              Vector3d& g)
+{
+  H.setZero();
+  g.setZero();
+  double cost = 0;
+
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    const Vector3d d = world_t_body - ranges[i].point;
+    const double r_pred = d.norm();
+    const double e = r_pred - ranges[i].range;
+    const double u = e / sigmas[i];
+
+    const double w = HuberWeight(u, huber_threshold) / (sigmas[i]*sigmas[i]);
+    const Vector3d J = (r_pred > 1e-9) ? Vector3d(d / r_pred) : Vector3d::Zero();
+    H.noalias() += w * J * J.transpose();
+    g += w * e * J;
+    cost += HuberLoss(u, huber_threshold);
+  }
+
+  return cost;
+}
+
+
+static double RobustCost(const MultiRange& ranges,
+                         const std::vector<double>& sigmas,
+                         const Vector3d& world_t_body,
+                         double huber_threshold)
+{
+  double cost = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    const double e = (world_t_body - ranges[i].point).norm() - ranges[i].range;
+    cost += HuberLoss(e / sigmas[i], huber_threshold);
+  }
+  return cost;
+}
+
+
+TrilaterationResult TrilaterationSolver::Refine(const MultiRange& ranges,
+                                                const std::vector<double>& sigmas,
+                                                const Vector3d& world_t_body) const
+{
+  CHECK_GE(ranges.size(), 3ul) << "Need at least 3 range measurements for trilateration" << std::endl;
+  CHECK_EQ(ranges.size(), sigmas.size()) << "Must pass in a measurement noise for each range" << std::endl;
+
+  TrilaterationResult result;
+  result.world_t_body = world_t_body;
+
+  Matrix3d H;
+  Vector3d g;
+  double cost = LinearizeRobust(ranges, sigmas, result.world_t_body, params_.huber_threshold, H, g);
+  double lambda = 1e-3 * MaxDiagonal(H);
+
+  const double lambda_k_increase = 2.0;
+  const double lambda_k_decrease = 3.0;
+
+  for (result.iters = 0; result.iters < params_.max_iters; ++result.iters) {
+    // NOTE(milo): The small constant keeps H invertible when the body is in the plane of 3 beacons.
+    Matrix3d H_damped = H;
+    H_damped.diagonal() += lambda * H.diagonal() + Vector3d::Constant(1e-9);
+    const Vector3d dX = -H_damped.ldlt().solve(g);
+
+    const Vector3d world_t_body_test = result.world_t_body + dX;
+    const double cost_test = RobustCost(ranges, sigmas, world_t_body_test, params_.huber_threshold);
+
+    if (cost_test < cost) {
+      lambda /= lambda_k_decrease;
+      result.world_t_body = world_t_body_test;
+      cost = LinearizeRobust(ranges, sigmas, result.world_t_body, params_.huber_threshold, H, g);
+      if (dX.norm() < params_.min_step) {
+        ++result.iters;
+        break;
+      }
+    } else {
+      lambda = std::max(lambda, 1e-9) * lambda_k_increase;
+      if (dX.norm() < params_.min_step) {
+        break;
+      }
+    }
+  }
+
+  // Unweighted covariance at the solution, like TrilateratePosition().
+  Matrix3d JtWJ = Matrix3d::Zero();
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    const Vector3d d = result.world_t_body - ranges[i].point;
+    const double r_pred = d.norm();
+    if (r_pred > 1e-9) {
+      const Vector3d J = d / r_pred;
+      JtWJ.noalias() += J * J.transpose() / (sigmas[i]*sigmas[i]);
+    }
+  }
+
+  bool invertible = false;
+  JtWJ.computeInverseWithCheck(result.solution_cov, invertible, 1e-12);
+  result.error = ComputeRangeError(ranges, sigmas, result.world_t_body);
+  result.valid = invertible && result.world_t_body.allFinite();
+
+  return result;
+}
+
+
+TrilaterationResult TrilaterationSolver::Solve(const MultiRange& ranges,
+                                               const std::vector<double>& sigmas,
+                                               const Vector3d& world_t_body_guess)
+{
+  TrilaterationResult result;
+
+  if (has_solution_) {
+    result = Refine(ranges, sigmas, last_world_t_body_);
+  }
+
+  if (!result.valid || result.error > params_.max_warm_start_error) {
+    Vector3d world_t_body_init = has_solution_ ? last_world_t_body_ : world_t_body_guess;
+    TrilaterateLinear(ranges, sigmas, world_t_body_init);
+
+    const TrilaterationResult cold = Refine(ranges, sigmas, world_t_body_init);
+    if (cold.valid && (!result.valid || cold.error < result.error)) {
+      result = cold;
+    }
+  }
+
+  if (result.valid) {
+    has_solution_ = true;
+    last_world_t_body_ = result.world_t_body;
+  }
+
+  return result;
+}
+
+
+std::vector<TrilaterationResult> TrilateratePositions(const std::vector<MultiRange>& range_sets,
+                                                      const std::vector<std::vector<double>>& sigmas,
+                                                      const TrilaterationSolver::Params& params,
+                                                      int num_threads,
+                                                      const Vector3d& world_t_body_guess)
+{
+  CHECK_EQ(range_sets.size(), sigmas.size()) << "Must pass in measurement noise for each range set" << std::endl;
+
+  std::vector<TrilaterationResult> results(range_sets.size());
+
+  // A few chunks per thread, so that the threads stay busy, but most sets are still warm-started.
+  const size_t T = static_cast<size_t>(std::max(1, num_threads));
+  const size_t grain = std::max(static_cast<size_t>(1), range_sets.size() / (4 * T));
+
+  ThreadPool pool(static_cast<int>(T) - 1);
+  pool.ParallelFor(range_sets.size(), [&](size_t begin, size_t end)
+  {
+    TrilaterationSolver solver(params);
+    for (size_t i = begin; i < end; ++i) {
+      results[i] = solver.Solve(range_sets[i], sigmas[i], world_t_body_guess);
+    }
+  }, grain);
+
+  return results;
+}
+
+
 }
 }
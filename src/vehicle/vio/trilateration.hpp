@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "core/eigen_types.hpp"
 #include "core/range_measurement.hpp"
 
@@ -19,5 +21,86 @@ double TrilateratePosition(const MultiRange& ranges,
                           int max_iters,
                           double min_error = 1e-3);
 
+
+// Closed-form initial guess for trilateration. Subtracting the first range equation from the others
+// gives a linear system in world_t_body, which is solved by weighted least squares. If the beacons
+// are coplanar (e.g all on the water surface), the position along the plane normal is recovered from
+// the ranges, and there are two mirror-image solutions: the one closest to world_t_body is kept.
+// Returns false if the beacons are (nearly) collinear, leaving world_t_body untouched.
+bool TrilaterateLinear(const MultiRange& ranges,
+                       const std::vector<double>& sigmas,
+                       Vector3d& world_t_body);
+
+
+struct TrilaterationResult final
+{
+  bool valid = false;
+  Vector3d world_t_body = Vector3d::Zero();
+  Matrix3d solution_cov = Matrix3d::Identity();
+  double error = 0;                       // Mean of 1/2 (e / sigma)^2, like TrilateratePosition().
+  int iters = 0;
+};
+
+
+// Trilateration for a stream of range sets (e.g acoustic beacons reporting at a few Hz). Each solve
+// is warm-started from the last solution, so it usually converges in one or two Gauss-Newton steps.
+// The normal equations are accumulated directly into fixed-size 3x3 matrices (no allocation), and
+// the ranges are re-weighted each iteration with a Huber kernel, so that a multipath range
+// doesn't drag the whole solution.
+//
+// If there isn't a previous solution (or the warm-started solution doesn't explain the ranges),
+// the solver starts from TrilaterateLinear().
+class TrilaterationSolver final {
+ public:
+  struct Params final
+  {
+    int max_iters = 10;
+    double min_step = 1e-3;               // m. Stop when the step is smaller than this.
+    double huber_threshold = 2.0;         // sigmas. Larger residuals are down-weighted.
+
+    // If the warm-started solution has a larger (mean) error than this, start over from the
+    // closed-form guess, and keep whichever solution is better.
+    double max_warm_start_error = 4.0;
+  };
+
+  TrilaterationSolver() = default;
+  explicit TrilaterationSolver(const Params& params) : params_(params) {}
+
+  // Solve for the position, warm-starting from the last solution if there is one. If world_t_body
+  // is passed in, it's used to pick between mirror-image solutions when the beacons are coplanar
+  // (until there's a previous solution).
+  TrilaterationResult Solve(const MultiRange& ranges,
+                            const std::vector<double>& sigmas,
+                            const Vector3d& world_t_body_guess = Vector3d::Zero());
+
+  // Forget the last solution (e.g after a long gap in the ranges).
+  void Reset() { has_solution_ = false; }
+
+  bool HasSolution() const { return has_solution_; }
+  const Vector3d& LastSolution() const { return last_world_t_body_; }
+
+  // Robust Gauss-Newton (Levenberg-Marquardt) starting at world_t_body.
+  TrilaterationResult Refine(const MultiRange& ranges,
+                             const std::vector<double>& sigmas,
+                             const Vector3d& world_t_body) const;
+
+ private:
+  Params params_;
+
+  bool has_solution_ = false;
+  Vector3d last_world_t_body_ = Vector3d::Zero();
+};
+
+
+// Solve many range sets (e.g from an offline replay). The sets are split into contiguous chunks,
+// which are solved in parallel (num_threads <= 1 runs serially). Within a chunk, each set is
+// warm-started from the one before it, so consecutive sets should come from nearby positions. The
+// first set in each chunk uses world_t_body_guess to pick a side of the beacon plane (if it's flat).
+std::vector<TrilaterationResult> TrilateratePositions(const std::vector<MultiRange>& range_sets,
+                                                      const std::vector<std::vector<double>>& sigmas,
+                                                      const TrilaterationSolver::Params& params,
+                                                      int num_threads = 1,
+                                                      const Vector3d& world_t_body_guess = Vector3d::Zero());
+
 }
 }
@@ -0,0 +1,193 @@
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "vio/vi_initializer.hpp"
+
+namespace bm {
+namespace vio {
+
+
+void ViInitializer::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("enabled", &enabled);
+  parser.GetParam("window_sec", &window_sec);
+  parser.GetParam("min_keyframes", &min_keyframes);
+  parser.GetParam("gyro_bias_iters", &gyro_bias_iters);
+  parser.GetParam("max_gyro_bias", &max_gyro_bias);
+  parser.GetParam("max_gravity_err", &max_gravity_err);
+  parser.GetParam("align_gravity", &align_gravity);
+
+  YamlToVector<Vector3d>(parser.GetNode("/shared/n_gravity"), n_gravity);
+
+  CHECK_GE(min_keyframes, 3) << "ViInitializer needs at least 3 keyframes" << std::endl;
+}
+
+
+ViInitializer::ViInitializer(const Params& params)
+    : params_(params)
+{
+  CHECK_GE(params_.min_keyframes, 3);
+}
+
+
+void ViInitializer::Reset(seconds_t timestamp)
+{
+  started_ = true;
+  first_timestamp_ = timestamp;
+  keyframes_.clear();
+}
+
+
+void ViInitializer::AddKeyframe(seconds_t timestamp, const gtsam::Pose3& lkf_P_body, const PimC& pim)
+{
+  CHECK(started_) << "Call Reset() with the first keyframe before AddKeyframe()" << std::endl;
+  keyframes_.emplace_back(Keyframe{timestamp, lkf_P_body, pim});
+}
+
+
+bool ViInitializer::Ready() const
+{
+  return started_ && NumKeyframes() >= params_.min_keyframes &&
+         (keyframes_.back().timestamp - first_timestamp_) >= params_.window_sec;
+}
+
+
+// Gauss-Newton on the gyro bias: the residual of each keyframe pair is the rotation between the
+// (bias-corrected) preintegrated rotation and the VO rotation.
+static Vector3d SolveGyroBias(const std::vector<gtsam::Rot3>& lkf_R_body,
+                              const std::vector<const PimC*>& pims,
+                              int iters)
+{
+  Vector3d bg = Vector3d::Zero();
+
+  for (int iter = 0; iter < iters; ++iter) {
+    Matrix3d AtA = Matrix3d::Zero();
+    Vector3d Atb = Vector3d::Zero();
+
+    for (size_t k = 0; k < pims.size(); ++k) {
+      Eigen::Matrix<double, 9, 6> H;
+      const gtsam::Vector9 delta = pims.at(k)->biasCorrectedDelta(ImuBias(Vector3d::Zero(), bg), H);
+      const Vector3d theta = delta.head<3>();
+
+      // NOTE(milo): The bias is ordered (accel, gyro), and the delta (rotation, position, velocity).
+      const Vector3d e = gtsam::Rot3::Logmap(gtsam::Rot3::Expmap(theta).between(lkf_R_body.at(k)));
+      const Matrix3d A = gtsam::Rot3::ExpmapDerivative(theta) * H.block<3, 3>(0, 3);
+      AtA += A.transpose() * A;
+      Atb += A.transpose() * e;
+    }
+
+    bg += AtA.ldlt().solve(Atb);
+  }
+
+  return bg;
+}
+
+
+bool ViInitializer::Solve(ViInitResult& result) const
+{
+  if (!Ready()) {
+    return false;
+  }
+
+  const size_t P = keyframes_.size();     // Keyframe pairs.
+  const size_t N = P + 1;                 // Keyframes.
+
+  std::vector<gtsam::Rot3> lkf_R_body(P);
+  std::vector<const PimC*> pims(P);
+  for (size_t k = 0; k < P; ++k) {
+    lkf_R_body.at(k) = keyframes_.at(k).lkf_P_body.rotation();
+    pims.at(k) = &keyframes_.at(k).pim;
+  }
+
+  //===================================== (1) GYRO BIAS ============================================
+  const Vector3d bg = SolveGyroBias(lkf_R_body, pims, params_.gyro_bias_iters);
+  if (bg.norm() > params_.max_gyro_bias) {
+    LOG(WARNING) << "ViInitializer: gyro bias too large (" << bg.transpose() << ")" << std::endl;
+    return false;
+  }
+  const ImuBias bias(Vector3d::Zero(), bg);
+
+  //============================== (2) VELOCITIES AND GRAVITY ======================================
+  // Poses of each keyframe in the first one's frame.
+  std::vector<gtsam::Pose3> b0_P_body(N);
+  b0_P_body.at(0) = gtsam::Pose3::identity();
+  for (size_t k = 0; k < P; ++k) {
+    b0_P_body.at(k + 1) = b0_P_body.at(k) * keyframes_.at(k).lkf_P_body;
+  }
+
+  // Unknowns: [v_0, ..., v_N-1, g], all in b0. For each pair i -> j, with dt and the deltas (in the
+  // body frame of i) from preintegration (see NavState::predict()):
+  //    p_j = p_i + v_i * dt + 0.5 * g * dt^2 + R_i * dp
+  //    v_j = v_i + g * dt + R_i * dv
+  // The position rows are divided by dt, so that both are in m/s.
+  const Eigen::Index num_vars = static_cast<Eigen::Index>(3 * N + 3);
+  Eigen::MatrixXd A = Eigen::MatrixXd::Zero(static_cast<Eigen::Index>(6 * P), num_vars);
+  Eigen::VectorXd b = Eigen::VectorXd::Zero(static_cast<Eigen::Index>(6 * P));
+
+  for (size_t k = 0; k < P; ++k) {
+    const PimC& pim = *pims.at(k);
+    const double dt = pim.deltaTij();
+    CHECK_GT(dt, 0) << "ViInitializer: keyframes need IMU between them" << std::endl;
+
+    const gtsam::Vector9 delta = pim.biasCorrectedDelta(bias);
+    const Matrix3d R_i = b0_P_body.at(k).rotation().matrix();
+    const Vector3d p_i = b0_P_body.at(k).translation();
+    const Vector3d p_j = b0_P_body.at(k + 1).translation();
+
+    const Eigen::Index row = static_cast<Eigen::Index>(6 * k);
+    const Eigen::Index vi = static_cast<Eigen::Index>(3 * k);
+    const Eigen::Index vj = vi + 3;
+    const Eigen::Index g = num_vars - 3;
+
+    A.block<3, 3>(row, vi) = Matrix3d::Identity();
+    A.block<3, 3>(row, g) = 0.5 * dt * Matrix3d::Identity();
+    b.segment<3>(row) = (p_j - p_i - R_i * delta.segment<3>(3)) / dt;
+
+    A.block<3, 3>(row + 3, vi) = -Matrix3d::Identity();
+    A.block<3, 3>(row + 3, vj) = Matrix3d::Identity();
+    A.block<3, 3>(row + 3, g) = -dt * Matrix3d::Identity();
+    b.segment<3>(row + 3) = R_i * delta.segment<3>(6);
+  }
+
+  const Eigen::VectorXd x = A.colPivHouseholderQr().solve(b);
+  const Vector3d g_free = x.tail<3>();
+
+  const double g_norm = params_.n_gravity.norm();
+  const double gravity_err = std::fabs(g_free.norm() - g_norm) / g_norm;
+  if (gravity_err > params_.max_gravity_err) {
+    LOG(WARNING) << "ViInitializer: gravity magnitude is off by " << 100.0 * gravity_err << "%" << std::endl;
+    return false;
+  }
+
+  // Fix the magnitude of gravity, and solve for the velocities again.
+  const Vector3d g_fixed = g_norm * g_free.normalized();
+  const Eigen::MatrixXd A_v = A.leftCols(num_vars - 3);
+  const Eigen::VectorXd b_v = b - A.rightCols<3>() * g_fixed;
+  const Eigen::VectorXd v = A_v.colPivHouseholderQr().solve(b_v);
+
+  result.timestamp = keyframes_.back().timestamp;
+  result.b0_P_body = b0_P_body.back();
+  result.b0_v_body = v.tail<3>();
+  result.b0_gravity = g_fixed;
+  result.imu_bias = bias;
+  result.num_keyframes = static_cast<int>(N);
+  result.gravity_err = gravity_err;
+  result.velocity_rms = std::sqrt((A_v * v - b_v).squaredNorm() / static_cast<double>(b_v.size()));
+
+  return true;
+}
+
+
+gtsam::Rot3 ViInitializer::AlignGravity(const gtsam::Rot3& world_R_b0,
+                                        const Vector3d& b0_gravity,
+                                        const Vector3d& n_gravity)
+{
+  const Vector3d world_gravity = world_R_b0.matrix() * b0_gravity;
+  const Quaterniond correction = Quaterniond::FromTwoVectors(world_gravity, n_gravity);
+  return gtsam::Rot3(correction.toRotationMatrix() * world_R_b0.matrix());
+}
+
+
+}
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+
+#include <gtsam/geometry/Pose3.h>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "params/params_base.hpp"
+#include "vio/imu_manager.hpp"
+
+namespace bm {
+namespace vio {
+
+using namespace core;
+
+
+// The state at the newest keyframe of a ViInitializer window, in the body frame of the first
+// keyframe ("b0"). Only roll and pitch are observable from gravity, so it's up to the caller to put
+// this in the world frame (see ViInitializer::AlignGravity()).
+struct ViInitResult final
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  seconds_t timestamp = 0;                              // Newest keyframe.
+  gtsam::Pose3 b0_P_body = gtsam::Pose3::identity();    // Chained VO from the first keyframe.
+  Vector3d b0_v_body = Vector3d::Zero();
+  Vector3d b0_gravity = Vector3d::Zero();               // Has the magnitude of n_gravity.
+  ImuBias imu_bias = kZeroImuBias;                      // Only the gyro bias is estimated.
+
+  int num_keyframes = 0;
+  double gravity_err = 0;           // Relative error of the gravity magnitude before it was fixed.
+  double velocity_rms = 0;          // m/s, residual of the velocity solve.
+};
+
+
+// Closed-form visual-inertial initialization from the first keyframes (about window_sec of them),
+// like the linear alignment in VINS-Mono. Stereo VO is already metric, so there's no scale to solve
+// for, which leaves:
+//
+//  (1) Gyro bias, from the rotation between keyframes (VO) vs. the preintegrated rotation, with a few
+//      Gauss-Newton steps on the bias Jacobian of the preintegration.
+//  (2) Gravity (in the first keyframe's frame) and every keyframe's velocity, from one linear least
+//      squares problem on the preintegrated position and velocity deltas. The gravity magnitude is
+//      known, so it's only used to check the solution, and the velocities are solved again with it
+//      fixed.
+//
+// The smoother can then start at the newest keyframe with a velocity, a bias and gravity-aligned
+// attitude, instead of zeros that take many keyposes to converge.
+// NOTE(milo): The accelerometer bias isn't observable from a second of data (it's mostly absorbed
+// into the gravity direction), so it stays zero.
+class ViInitializer final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    bool enabled = false;
+    double window_sec = 1.0;        // Collect keyframes for at least this long.
+    int min_keyframes = 3;          // Two keyframe pairs fully determine the velocities and gravity.
+    int gyro_bias_iters = 3;
+    double max_gyro_bias = 0.05;    // rad/s, reject anything bigger.
+    double max_gravity_err = 0.1;   // Reject if the gravity magnitude is off by more than this fraction.
+
+    // Rotate the initial pose so that the estimated gravity lines up with n_gravity (the smallest
+    // rotation that does, which leaves yaw alone). Otherwise, the external initial pose is trusted.
+    bool align_gravity = true;
+
+    // Shared params.
+    Vector3d n_gravity = Vector3d(0, 9.81, 0);
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(ViInitializer)
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ViInitializer)
+
+  explicit ViInitializer(const Params& params);
+
+  // Start (or start over) with the first keyframe.
+  void Reset(seconds_t timestamp);
+
+  // Add the next keyframe: the motion of the body since the previous keyframe (from VO), and the IMU
+  // preintegrated between them (with zero bias).
+  void AddKeyframe(seconds_t timestamp, const gtsam::Pose3& lkf_P_body, const PimC& pim);
+
+  int NumKeyframes() const { return static_cast<int>(keyframes_.size()) + (started_ ? 1 : 0); }
+
+  // True once the window is long enough to Solve().
+  bool Ready() const;
+
+  // Returns false if the solution doesn't pass the checks (bias or gravity magnitude).
+  bool Solve(ViInitResult& result) const;
+
+  // The rotation closest to world_R_b0 that maps b0_gravity onto n_gravity.
+  static gtsam::Rot3 AlignGravity(const gtsam::Rot3& world_R_b0,
+                                  const Vector3d& b0_gravity,
+                                  const Vector3d& n_gravity);
+
+ private:
+  struct Keyframe final
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    seconds_t timestamp;
+    gtsam::Pose3 lkf_P_body;
+    PimC pim;
+  };
+
+  Params params_;
+
+  bool started_ = false;
+  seconds_t first_timestamp_ = 0;
+  std::vector<Keyframe, Eigen::aligned_allocator<Keyframe>> keyframes_;
+};
+
+
+}
+}
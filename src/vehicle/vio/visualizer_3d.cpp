@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 
 #include <glog/logging.h>
@@ -12,6 +13,8 @@ namespace vio {
 
 
 static const std::string kWidgetNameRealtime = "CAM_REALTIME_WIDGET";
+static const std::string kWidgetNameLandmarkCloud = "LANDMARK_CLOUD_WIDGET";
+static const std::string kWidgetNameTrajectory = "TRAJECTORY_WIDGET";
 static const double kLandmarkSphereRadius = 0.01;
 
 
@@ -45,12 +48,26 @@ static cv::Affine3d EigenMatrix4dToCvAffine3d(const Matrix4d& world_T_cam)
 }
 
 
+static cv::Matx33d CameraMatrix(const StereoCamera& stereo_rig)
+{
+  return cv::Matx33d(stereo_rig.fx(), 0.0,             stereo_rig.cx(),
+                     0.0,             stereo_rig.fy(), stereo_rig.cy(),
+                     0.0,             0.0,             1.0);
+}
+
+
 void Visualizer3D::Params::LoadParams(const YamlParser& parser)
 {
   parser.GetParam("show_uncertainty", &show_uncertainty);
   parser.GetParam("show_frustums", &show_frustums);
   parser.GetParam("max_stored_poses", &max_stored_poses);
   parser.GetParam("max_stored_landmarks", &max_stored_landmarks);
+  parser.GetParam("batched", &batched);
+  parser.GetParam("batched_redraw_hz", &batched_redraw_hz);
+  parser.GetParam("max_trajectory_points", &max_trajectory_points);
+  parser.GetParam("max_stored_images", &max_stored_images);
+  parser.GetParam("landmark_max_age_keyframes", &landmark_max_age_keyframes);
+  parser.GetParam("max_memory_mb", &max_memory_mb);
 
   YamlToStereoRig(parser.GetNode("/shared/stereo_forward"), stereo_rig, body_T_left, body_T_right);
 }
@@ -62,16 +79,29 @@ void Visualizer3D::AddCameraPose(uid_t cam_id,
                                  bool is_keyframe,
                                  const Cov3Ptr& position_cov)
 {
+  if (params_.batched) {
+    std::lock_guard<std::mutex> lock(batch_lock_);
+    if (is_keyframe) {
+      pending_.add_keyframes.emplace_back(cam_id, world_T_cam.block<3, 1>(0, 3));
+    }
+    pending_.has_camera = true;
+    pending_.world_T_cam = world_T_cam;
+    pending_.is_keyframe = is_keyframe;
+    if (position_cov) {
+      pending_.position_cov = position_cov;
+    }
+    return;
+  }
+
   add_camera_pose_queue_.Push(std::move(CameraPoseData(cam_id, left_image, world_T_cam, is_keyframe, position_cov)));
 }
 
 
 void Visualizer3D::AddCameraPose(const CameraPoseData& data)
 {
-  const cv::Matx33d K = { stereo_rig_.fx(), 0.0,              stereo_rig_.cx(),
-                          0.0,              stereo_rig_.fy(), stereo_rig_.cy(),
-                          0.0,              0.0,              1.0  };
+  const cv::Matx33d K = CameraMatrix(stereo_rig_);
   const cv::Affine3d world_T_cam_cv = EigenMatrix4dToCvAffine3d(data.world_T_cam);
+  const cv::viz::Color color = data.is_keyframe ? cv::viz::Color::blue() : cv::viz::Color::red();
 
   viz_lock_.lock();
 
@@ -79,51 +109,116 @@ void Visualizer3D::AddCameraPose(const CameraPoseData& data)
   CHECK(widget_names_.count(widget_name) == 0) << "Trying to add existing cam_id: " << widget_name << std::endl;
   cv::viz::WCameraPosition widget_keyframe(1.0);
 
-  if (params_.show_frustums) {
-    widget_keyframe = cv::viz::WCameraPosition(K, 1.0, data.is_keyframe ? cv::viz::Color::blue() : cv::viz::Color::red());
+  // NOTE(milo): VTK keeps its own copy of each image, so only the newest max_stored_images are shown.
+  const bool show_image = params_.show_frustums && !data.left_image.empty() && params_.max_stored_images > 0;
+  if (show_image) {
+    widget_keyframe = cv::viz::WCameraPosition(K, data.left_image, 1.0, color);
+    const size_t bytes = data.left_image.total() * data.left_image.elemSize();
+    queue_image_cam_ids_.emplace_back(data.cam_id);
+    image_bytes_[data.cam_id] = bytes;
+    total_image_bytes_ += bytes;
+  } else if (params_.show_frustums) {
+    widget_keyframe = cv::viz::WCameraPosition(K, 1.0, color);
   }
 
   viz_.showWidget(widget_name, widget_keyframe, world_T_cam_cv);
   widget_names_.insert(widget_name);
+  queue_live_cam_ids_.push(data.cam_id);
+  live_cam_poses_[data.cam_id] = world_T_cam_cv;
+  RemoveOldCameraPoses();
+
+  while ((int)queue_image_cam_ids_.size() > params_.max_stored_images) {
+    RemoveOldestImage();
+  }
+
+  if (data.is_keyframe) {
+    trajectory_.Add(data.cam_id, data.world_T_cam.block<3, 1>(0, 3));
+    trajectory_changed_ = true;
+    ++num_keyframes_;
+    RemoveOldLandmarks();
+  }
 
-  // Show the position covariance as a 3D ellipsoid.
   if (params_.show_uncertainty && data.position_cov) {
-    if (widget_names_.count("position_cov") != 0) {
-      viz_.removeWidget("position_cov");
-    }
+    ShowPositionCovariance(*data.position_cov, data.world_T_cam.block<3, 1>(0, 3));
+  }
 
-    const EllipsoidParameters ellipsoid_params = ComputeCovarianceEllipsoid(*data.position_cov, 1.0);
-    const CvPoints3 ellipsoid_points = ToCvPoints3d(GetEllipsoidPoints(ellipsoid_params.scales, sphere_points_));
+  EnforceMemoryCap();
 
-    const Matrix3d world_R_ellipsoid = EllipsoidRotationInWorld(ellipsoid_params);
-    const cv::viz::WCloud ellipsoid_widget(ellipsoid_points, cv::viz::Color::yellow());
+  viz_lock_.unlock();
+}
 
-    Matrix4d world_T_ellipsoid = Matrix4d::Identity();
-    world_T_ellipsoid.block<3, 3>(0, 0) = world_R_ellipsoid;
-    world_T_ellipsoid.block<3, 1>(0, 3) = data.world_T_cam.block<3, 1>(0, 3);
-    const cv::Affine3d world_T_ellipsoid_cv = EigenMatrix4dToCvAffine3d(world_T_ellipsoid);
-    viz_.showWidget("position_cov", ellipsoid_widget, world_T_ellipsoid_cv);
+
+void Visualizer3D::RemoveOldestImage()
+{
+  if (queue_image_cam_ids_.empty()) {
+    return;
   }
 
-  viz_lock_.unlock();
+  const uid_t cam_id = queue_image_cam_ids_.front();
+  queue_image_cam_ids_.pop_front();
+
+  const auto it = image_bytes_.find(cam_id);
+  if (it != image_bytes_.end()) {
+    total_image_bytes_ -= it->second;
+    image_bytes_.erase(it);
+  }
+
+  // The camera itself might be gone already (see RemoveOldCameraPoses()).
+  const auto pose = live_cam_poses_.find(cam_id);
+  if (pose != live_cam_poses_.end()) {
+    const cv::viz::WCameraPosition widget(CameraMatrix(stereo_rig_), 1.0, cv::viz::Color::blue());
+    viz_.showWidget(GetCameraPoseWidgetName(cam_id), widget, pose->second);
+  }
+}
+
+
+// Show the position covariance as a 3D ellipsoid (replacing the last one).
+// NOTE(milo): Call with viz_lock_ held.
+void Visualizer3D::ShowPositionCovariance(const Matrix3d& position_cov, const Vector3d& world_t_cam)
+{
+  if (widget_names_.count("position_cov") != 0) {
+    viz_.removeWidget("position_cov");
+  }
+
+  const EllipsoidParameters ellipsoid_params = ComputeCovarianceEllipsoid(position_cov, 1.0);
+  const CvPoints3 ellipsoid_points = ToCvPoints3d(GetEllipsoidPoints(ellipsoid_params.scales, sphere_points_));
+
+  const Matrix3d world_R_ellipsoid = EllipsoidRotationInWorld(ellipsoid_params);
+  const cv::viz::WCloud ellipsoid_widget(ellipsoid_points, cv::viz::Color::yellow());
+
+  Matrix4d world_T_ellipsoid = Matrix4d::Identity();
+  world_T_ellipsoid.block<3, 3>(0, 0) = world_R_ellipsoid;
+  world_T_ellipsoid.block<3, 1>(0, 3) = world_t_cam;
+  const cv::Affine3d world_T_ellipsoid_cv = EigenMatrix4dToCvAffine3d(world_T_ellipsoid);
+  viz_.showWidget("position_cov", ellipsoid_widget, world_T_ellipsoid_cv);
 }
 
 
 void Visualizer3D::UpdateCameraPose(uid_t cam_id, const Matrix4d& world_T_cam)
 {
+  if (params_.batched) {
+    std::lock_guard<std::mutex> lock(batch_lock_);
+    pending_.update_keyframes.emplace_back(cam_id, world_T_cam.block<3, 1>(0, 3));
+    return;
+  }
+
   update_camera_pose_queue_.Push(CameraPoseData(cam_id, Image1b(), world_T_cam, false, nullptr));
 }
 
 
 void Visualizer3D::UpdateCameraPose(const CameraPoseData& data)
 {
+  // NOTE(milo): The pose may have been removed already (see RemoveOldCameraPoses()), or its add
+  // may have been dropped from the bounded queue.
   const std::string widget_name = GetCameraPoseWidgetName(data.cam_id);
-  CHECK(widget_names_.count(widget_name) != 0) << "Tried to update camera pose that doesn't exist yet: " << data.cam_id << std::endl;
-
   const cv::Affine3d world_T_cam_cv = EigenMatrix4dToCvAffine3d(data.world_T_cam);
 
   viz_lock_.lock();
-  viz_.setWidgetPose(widget_name, world_T_cam_cv);
+  trajectory_changed_ |= trajectory_.Update(data.cam_id, data.world_T_cam.block<3, 1>(0, 3));
+  if (widget_names_.count(widget_name) != 0) {
+    viz_.setWidgetPose(widget_name, world_T_cam_cv);
+    live_cam_poses_[data.cam_id] = world_T_cam_cv;
+  }
   viz_lock_.unlock();
 }
 
@@ -152,6 +247,14 @@ void Visualizer3D::UpdateBodyPose(const BodyPoseData& data)
 
 void Visualizer3D::AddOrUpdateLandmark(const std::vector<uid_t>& lmk_ids, const std::vector<Vector3d>& t_world_lmks)
 {
+  if (params_.batched) {
+    std::lock_guard<std::mutex> lock(batch_lock_);
+    for (size_t i = 0; i < lmk_ids.size(); ++i) {
+      pending_.landmarks.emplace_back(lmk_ids.at(i), t_world_lmks.at(i));
+    }
+    return;
+  }
+
   viz_lock_.lock();
 
   for (size_t i = 0; i < lmk_ids.size(); ++i) {
@@ -163,17 +266,16 @@ void Visualizer3D::AddOrUpdateLandmark(const std::vector<uid_t>& lmk_ids, const
     world_T_lmk.block<3, 1>(0, 3) = t_world_lmk;
     const cv::Affine3d world_T_lmk_cv = EigenMatrix4dToCvAffine3d(world_T_lmk);
 
-    if (set_live_lmk_ids_.count(lmk_id) == 0) {
+    if (UpdateLandmark(lmk_id, t_world_lmk)) {
       const cv::viz::WSphere widget_lmk(cv::Point3d(0, 0, 0), kLandmarkSphereRadius, 5, cv::viz::Color::white());
       viz_.showWidget(widget_name, widget_lmk, world_T_lmk_cv);
-      set_live_lmk_ids_.insert(lmk_id);
-      queue_live_lmk_ids_.push(lmk_id);
     } else {
       viz_.setWidgetPose(widget_name, world_T_lmk_cv);
     }
   }
 
   RemoveOldLandmarks();
+  EnforceMemoryCap();
 
   viz_lock_.unlock();
 }
@@ -217,29 +319,230 @@ void Visualizer3D::SetViewerPose(const Matrix4d& world_T_body)
 }
 
 
+bool Visualizer3D::UpdateLandmark(uid_t lmk_id, const Vector3d& t_world_lmk)
+{
+  const auto it = lmk_positions_.find(lmk_id);
+  if (it != lmk_positions_.end()) {
+    it->second.t_world_lmk = t_world_lmk;
+    it->second.last_keyframe = num_keyframes_;
+    return false;
+  }
+
+  lmk_positions_.emplace(lmk_id, LandmarkState{t_world_lmk, num_keyframes_});
+  lmk_order_.emplace_back(lmk_id);
+  return true;
+}
+
+
+void Visualizer3D::RemoveLandmark(uid_t lmk_id)
+{
+  if (lmk_positions_.erase(lmk_id) > 0 && !params_.batched) {
+    viz_.removeWidget(GetLandmarkWidgetName(lmk_id));
+  }
+}
+
+
 void Visualizer3D::RemoveOldLandmarks()
 {
   // If too many landmarks, remove the oldest ones.
-  if ((int)set_live_lmk_ids_.size() > params_.max_stored_landmarks) {
-    const int num_to_erase = set_live_lmk_ids_.size() - params_.max_stored_landmarks;
-
-    for (int i = 0; i < num_to_erase; ++i) {
-      const uid_t lmk_id_to_erase = queue_live_lmk_ids_.front();
-      viz_.removeWidget(GetLandmarkWidgetName(lmk_id_to_erase));
-      queue_live_lmk_ids_.pop();
-      set_live_lmk_ids_.erase(lmk_id_to_erase);
+  while ((int)lmk_positions_.size() > params_.max_stored_landmarks && !lmk_order_.empty()) {
+    RemoveLandmark(lmk_order_.front());
+    lmk_order_.pop_front();
+  }
+
+  // Landmarks that the smoother stopped updating (e.g they were marginalized out) are dead.
+  if (params_.landmark_max_age_keyframes > 0 && num_keyframes_ > (size_t)params_.landmark_max_age_keyframes) {
+    const size_t oldest_alive = num_keyframes_ - params_.landmark_max_age_keyframes;
+    for (auto it = lmk_positions_.begin(); it != lmk_positions_.end();) {
+      if (it->second.last_keyframe < oldest_alive) {
+        if (!params_.batched) {
+          viz_.removeWidget(GetLandmarkWidgetName(it->first));
+        }
+        it = lmk_positions_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // NOTE(milo): Removed landmarks stay in lmk_order_ until they reach the front, so compact it once
+  // it's mostly stale.
+  if (lmk_order_.size() > 2 * lmk_positions_.size() + 64) {
+    std::deque<uid_t> alive;
+    for (const uid_t lmk_id : lmk_order_) {
+      if (lmk_positions_.count(lmk_id) != 0) {
+        alive.emplace_back(lmk_id);
+      }
+    }
+    lmk_order_.swap(alive);
+  }
+}
+
+
+size_t Visualizer3D::HistoryMemoryBytes()
+{
+  std::lock_guard<std::mutex> lock(viz_lock_);
+  return HistoryMemoryBytesLocked();
+}
+
+
+size_t Visualizer3D::HistoryMemoryBytesLocked() const
+{
+  // NOTE(milo): A hash map entry is about a node (key, value, next pointer) plus a bucket pointer, and
+  // VTK keeps a copy of each landmark (a sphere) or cloud point.
+  const size_t lmk_bytes = sizeof(uid_t) + sizeof(LandmarkState) + 2 * sizeof(void*) + sizeof(uid_t) + 3 * sizeof(float);
+  return total_image_bytes_ + trajectory_.MemoryBytes() + lmk_positions_.size() * lmk_bytes;
+}
+
+
+void Visualizer3D::EnforceMemoryCap()
+{
+  const size_t max_bytes = static_cast<size_t>(params_.max_memory_mb * 1e6);
+
+  while (HistoryMemoryBytesLocked() > max_bytes && !queue_image_cam_ids_.empty()) {
+    RemoveOldestImage();
+  }
+
+  // Then make the old parts of the trajectory coarser, down to twice the full detail part.
+  const size_t min_trajectory_points = 2 * std::max<size_t>(1, params_.max_stored_poses);
+  while (HistoryMemoryBytesLocked() > max_bytes && trajectory_.MaxPoints() / 2 >= min_trajectory_points) {
+    trajectory_.SetMaxPoints(trajectory_.MaxPoints() / 2);
+    trajectory_changed_ = true;
+    LOG(WARNING) << "Visualizer3D is over max_memory_mb, keeping "
+                 << trajectory_.MaxPoints() << " trajectory points" << std::endl;
+  }
+
+  while (HistoryMemoryBytesLocked() > max_bytes && !lmk_order_.empty()) {
+    RemoveLandmark(lmk_order_.front());
+    lmk_order_.pop_front();
+  }
+}
+
+
+void Visualizer3D::DrawTrajectory()
+{
+  if (!trajectory_changed_ || trajectory_.Size() < 2) {
+    return;
+  }
+
+  CvPoints3 line;
+  line.reserve(trajectory_.Size());
+  for (const TrajectoryHistory::IdAndPosition& kf : trajectory_.Points()) {
+    line.emplace_back(kf.second.x(), kf.second.y(), kf.second.z());
+  }
+  viz_.showWidget(kWidgetNameTrajectory, cv::viz::WPolyLine(line, cv::viz::Color::blue()));
+  trajectory_changed_ = false;
+}
+
+
+void Visualizer3D::RemoveOldCameraPoses()
+{
+  // If too many camera poses, remove the oldest ones.
+  while ((int)queue_live_cam_ids_.size() > params_.max_stored_poses) {
+    const std::string widget_name = GetCameraPoseWidgetName(queue_live_cam_ids_.front());
+    viz_.removeWidget(widget_name);
+    widget_names_.erase(widget_name);
+    live_cam_poses_.erase(queue_live_cam_ids_.front());
+    queue_live_cam_ids_.pop();
+  }
+}
+
+
+void Visualizer3D::DrawBatched()
+{
+  {
+    std::lock_guard<std::mutex> lock(batch_lock_);
+    std::swap(pending_, drawing_);
+  }
+
+  viz_lock_.lock();
+
+  // Keyframes: appended to the trajectory, and moved when the smoother updates them.
+  for (const IdAndPosition& kf : drawing_.add_keyframes) {
+    trajectory_.Add(kf.first, kf.second);
+    trajectory_changed_ = true;
+    ++num_keyframes_;
+  }
+  for (const IdAndPosition& kf : drawing_.update_keyframes) {
+    trajectory_changed_ |= trajectory_.Update(kf.first, kf.second);
+  }
+
+  // Landmarks: the newest position of each, removing the oldest (and dead) ones.
+  const size_t num_landmarks_before = lmk_positions_.size();
+  for (const IdAndPosition& lmk : drawing_.landmarks) {
+    UpdateLandmark(lmk.first, lmk.second);
+  }
+  RemoveOldLandmarks();
+  EnforceMemoryCap();
+  const bool landmarks_changed = !drawing_.landmarks.empty() || lmk_positions_.size() != num_landmarks_before;
+
+  if (landmarks_changed) {
+    if (lmk_positions_.empty()) {
+      if (widget_names_.erase(kWidgetNameLandmarkCloud) > 0) {
+        viz_.removeWidget(kWidgetNameLandmarkCloud);
+      }
+    } else {
+      CvPoints3 cloud;
+      cloud.reserve(lmk_positions_.size());
+      for (const auto& it : lmk_positions_) {
+        const Vector3d& t = it.second.t_world_lmk;
+        cloud.emplace_back(t.x(), t.y(), t.z());
+      }
+      viz_.showWidget(kWidgetNameLandmarkCloud, cv::viz::WCloud(cloud, cv::viz::Color::white()));
+      widget_names_.insert(kWidgetNameLandmarkCloud);
+    }
+  }
+
+  DrawTrajectory();
+
+  if (drawing_.has_camera) {
+    const cv::Affine3d world_T_cam_cv = EigenMatrix4dToCvAffine3d(drawing_.world_T_cam);
+    if (widget_names_.count(kWidgetNameRealtime) == 0) {
+      if (params_.show_frustums) {
+        viz_.showWidget(kWidgetNameRealtime, cv::viz::WCameraPosition(CameraMatrix(stereo_rig_), 1.0, cv::viz::Color::red()), world_T_cam_cv);
+      } else {
+        viz_.showWidget(kWidgetNameRealtime, cv::viz::WCameraPosition(1.0), world_T_cam_cv);
+      }
+      widget_names_.insert(kWidgetNameRealtime);
+    } else {
+      viz_.setWidgetPose(kWidgetNameRealtime, world_T_cam_cv);
+    }
+
+    if (params_.show_uncertainty && drawing_.position_cov) {
+      ShowPositionCovariance(*drawing_.position_cov, drawing_.world_T_cam.block<3, 1>(0, 3));
+      widget_names_.insert("position_cov");
     }
   }
+
+  viz_lock_.unlock();
+
+  drawing_.Clear();
 }
 
 
 void Visualizer3D::RedrawThread()
 {
+  const auto draw_period = std::chrono::duration<double>(1.0 / std::max(1e-3, params_.batched_redraw_hz));
+  auto last_draw = std::chrono::steady_clock::now() - std::chrono::hours(1);
+
   while (!viz_.wasStopped()) {
     viz_lock_.lock();
     viz_.spinOnce(1, false);
     viz_lock_.unlock();
 
+    // NOTE(milo): Rebuilding the cloud and trajectory is linear in their size, so it's rate limited.
+    const auto now = std::chrono::steady_clock::now();
+    if ((now - last_draw) >= draw_period) {
+      if (params_.batched) {
+        DrawBatched();
+      } else {
+        viz_lock_.lock();
+        DrawTrajectory();
+        viz_lock_.unlock();
+      }
+      last_draw = now;
+    }
+
     while (!add_camera_pose_queue_.Empty()) {
       AddCameraPose(add_camera_pose_queue_.Pop());
     }
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 #include <thread>
 #include <mutex>
@@ -18,6 +22,7 @@
 #include "core/thread_safe_queue.hpp"
 #include "vision_core/landmark_observation.hpp"
 #include "vio/ellipsoid.hpp"
+#include "vio/trajectory_history.hpp"
 
 namespace bm {
 namespace vio {
@@ -75,9 +80,21 @@ class Visualizer3D final {
 
     bool show_uncertainty = true;
     bool show_frustums = false;       // Show camera frustums instead of pose axes.
-    int max_stored_poses = 100;
+    int max_stored_poses = 100;       // Oldest camera poses (and their images) are removed first.
     int max_stored_landmarks = 1000;
 
+    // Draw every landmark in one cloud, and the keyframes as one trajectory line (redrawn at most
+    // batched_redraw_hz), instead of a widget for each of them.
+    bool batched = true;
+    double batched_redraw_hz = 5.0;
+
+    // Level of detail for long missions. Every keyframe goes into the trajectory line, which keeps
+    // the last max_stored_poses at full detail, and decimates older ones to fit.
+    int max_trajectory_points = 10000;
+    int max_stored_images = 10;           // Keyframe images shown in frustums (not batched).
+    int landmark_max_age_keyframes = 50;  // Landmarks not updated in this many keyframes are dead.
+    double max_memory_mb = 256.0;         // Hard cap on all of the above (images go first).
+
     StereoCamera stereo_rig;
     Matrix4d body_T_left = Matrix4d::Identity();
     Matrix4d body_T_right = Matrix4d::Identity();
@@ -92,19 +109,28 @@ class Visualizer3D final {
 
   explicit Visualizer3D(const Params& params)
       : params_(params),
-        stereo_rig_(params.stereo_rig) {}
+        stereo_rig_(params.stereo_rig),
+        add_camera_pose_queue_(params.max_stored_poses, true, "add_camera_pose_queue"),
+        update_camera_pose_queue_(params.max_stored_poses, true, "update_camera_pose_queue"),
+        trajectory_(params.max_stored_poses, params.max_trajectory_points) {}
 
   ~Visualizer3D();
 
   // Adds a new camera frustrum at the given pose. If left_image is not empty, it is shown inside
-  // of the camera frustum. Only keyframe cameras are stored (and can be updated later).
+  // of the camera frustum. Only keyframe cameras are stored (and can be updated later). At most
+  // max_stored_poses are kept, so the image is only held onto until its pose is removed.
+  //
+  // NOTE(milo): If batched, only the latest camera is drawn (without an image), and keyframes are
+  // added to the trajectory line instead. Landmarks and poses from any thread just get appended to
+  // a buffer, which the redraw thread swaps out and draws.
   void AddCameraPose(uid_t cam_id,
                      const Image1b& left_image,
                      const Matrix4d& world_T_cam,
                      bool is_keyframe,
                      const Cov3Ptr& position_cov = nullptr);
 
-  // Update the pose associated with a cam_id (must correspond to a keyframe).
+  // Update the pose associated with a cam_id (must correspond to a keyframe). Does nothing if the
+  // camera pose was already removed to stay under max_stored_poses.
   void UpdateCameraPose(uid_t cam_id, const Matrix4d& world_T_cam);
 
   void UpdateBodyPose(const std::string& name, const Matrix4d& world_T_body);
@@ -124,14 +150,57 @@ class Visualizer3D final {
 
   void BlockUntilKeypress();
 
+  // Roughly how much memory the stored history takes up (see max_memory_mb).
+  size_t HistoryMemoryBytes();
+
  private:
   // Internal functions that take items off of queues and add to the visualizer.
   void AddCameraPose(const CameraPoseData& data);
   void UpdateCameraPose(const CameraPoseData& data);
   void UpdateBodyPose(const BodyPoseData& data);
 
-  void RemoveOldLandmarks();  // Ensures that max number of landmarks isn't exceeded.
+  void ShowPositionCovariance(const Matrix3d& position_cov, const Vector3d& world_t_cam);
+
+  // Adds or moves a landmark in lmk_positions_. Returns whether it's new.
+  bool UpdateLandmark(uid_t lmk_id, const Vector3d& t_world_lmk);
+
+  void RemoveOldLandmarks();  // Ensures that max number of landmarks isn't exceeded, and removes dead ones.
+  void RemoveLandmark(uid_t lmk_id);
+  void RemoveOldCameraPoses(); // Ensures that max number of camera poses isn't exceeded.
+  void RemoveOldestImage();    // Shows the oldest camera with an image as a plain frustum.
+
+  // Drops images, then trajectory detail, then the oldest landmarks until under max_memory_mb.
+  // NOTE(milo): Call these with viz_lock_ held.
+  size_t HistoryMemoryBytesLocked() const;
+  void EnforceMemoryCap();
+  void DrawTrajectory();
   void RedrawThread();        // Main thread that handles the Viz3D window.
+  void DrawBatched();         // Swaps out the pending batch, and redraws whatever it changed.
+
+  typedef std::pair<uid_t, Vector3d> IdAndPosition;
+
+  // Everything that was added or updated (in batched mode) since the last redraw.
+  struct PendingBatch final
+  {
+    std::vector<IdAndPosition> landmarks;
+    std::vector<IdAndPosition> add_keyframes;
+    std::vector<IdAndPosition> update_keyframes;
+    bool has_camera = false;
+    Matrix4d world_T_cam = Matrix4d::Identity();    // The latest camera.
+    bool is_keyframe = false;
+    Cov3Ptr position_cov;
+
+    // NOTE(milo): Keeps the capacity of the vectors, so swapping two batches back and forth stops
+    // allocating after a while.
+    void Clear()
+    {
+      landmarks.clear();
+      add_keyframes.clear();
+      update_keyframes.clear();
+      has_camera = false;
+      position_cov.reset();
+    }
+  };
 
  private:
   Params params_;
@@ -142,18 +211,39 @@ class Visualizer3D final {
   bool viz_needs_redraw_;
   std::thread redraw_thread_;
 
-  // NOTE(milo): These queues are allowed to grow unbounded!
-  ThreadsafeQueue<CameraPoseData> add_camera_pose_queue_{0, true};
-  ThreadsafeQueue<CameraPoseData> update_camera_pose_queue_{0, true};
+  // NOTE(milo): Camera poses can hold onto images, so these queues are bounded to max_stored_poses
+  // (dropping the oldest). Anything older than that would be removed right away anyways.
+  ThreadsafeQueue<CameraPoseData> add_camera_pose_queue_;
+  ThreadsafeQueue<CameraPoseData> update_camera_pose_queue_;
   ThreadsafeQueue<BodyPoseData> update_body_pose_queue_{0, true};
 
   std::unordered_set<std::string> widget_names_;
-
-  // TODO(milo): Make a more elegant solution for landmark bookkeeping.
-  std::queue<uid_t> queue_live_lmk_ids_;
-  std::unordered_set<uid_t> set_live_lmk_ids_;
+  std::queue<uid_t> queue_live_cam_ids_;
+  std::unordered_map<uid_t, cv::Affine3d> live_cam_poses_;
+  std::deque<uid_t> queue_image_cam_ids_;     // Cameras that are showing an image, oldest first.
+  std::unordered_map<uid_t, size_t> image_bytes_;
+  size_t total_image_bytes_ = 0;
 
   PrecomputedSpherePoints sphere_points_{40, 16};
+
+  // Batched mode: the callers fill pending_, and the redraw thread swaps it with drawing_.
+  std::mutex batch_lock_;
+  PendingBatch pending_;
+  PendingBatch drawing_;
+
+  // NOTE(milo): Landmarks and the trajectory are only changed with viz_lock_ held (or from the
+  // redraw thread, if batched).
+  struct LandmarkState final
+  {
+    Vector3d t_world_lmk;
+    size_t last_keyframe;     // The value of num_keyframes_ when it was last updated.
+  };
+
+  std::atomic<size_t> num_keyframes_{0};
+  std::unordered_map<uid_t, LandmarkState> lmk_positions_;
+  std::deque<uid_t> lmk_order_;         // Oldest first. Might have ids that were already removed.
+  TrajectoryHistory trajectory_;
+  bool trajectory_changed_ = false;
 };
 
 }
@@ -40,6 +40,7 @@ struct VoResult final
   timestamp_t timestamp_lkf;
   uid_t camera_id;
   uid_t camera_id_lkf;
+  size_t rig = 0;                                   // Index of the stereo rig (0 is the primary rig).
   std::vector<LandmarkObservation> lmk_obs;         // List of landmarks observed in this image.
   Matrix4d lkf_T_cam = Matrix4d::Identity();        // Pose of the camera in the last kf frame.
   double avg_reprojection_err = -1.0;               // Avg. error after LM pose optimization.
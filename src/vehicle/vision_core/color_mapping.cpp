@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <glog/logging.h>
 #include <opencv2/imgproc.hpp>
 
 #include "vision_core/color_mapping.hpp"
@@ -5,25 +11,75 @@
 namespace bm {
 namespace core {
 
+// Values are colored in chunks, so that the indices fit in a buffer on the stack.
+static const size_t kChunkSize = 256;
 
-std::vector<cv::Vec3b> ColormapVector(const std::vector<double>& values,
-                                      double vmin, double vmax,
-                                      int cv_colormap)
+
+ColormapLut::ColormapLut(int cv_colormap)
+{
+  cv::Mat1b ramp(1, 256);
+  for (int i = 0; i < 256; ++i) {
+    ramp(0, i) = static_cast<uint8_t>(i);
+  }
+  cv::Mat3b colors;
+  cv::applyColorMap(ramp, colors, cv_colormap);
+
+  for (int i = 0; i < 256; ++i) {
+    lut_[i] = colors(0, i);
+  }
+}
+
+
+cv::Vec3b ColormapLut::Map(double value, double vmin, double vmax) const
 {
-  assert(vmax > vmin);
+  cv::Vec3b out;
+  Map(&value, 1, vmin, vmax, &out);
+  return out;
+}
 
-  const double vrange = vmax - vmin;
-  cv::Mat1b values_1b;
-  cv::Mat3b values_3b;
-  cv::Mat1d(values).reshape(0, values.size()).convertTo(
-      values_1b, CV_8UC1, 255.0 / vrange, vmin);
-  cv::applyColorMap(values_1b, values_3b, cv_colormap);
 
-  std::vector<cv::Vec3b> out(values.size());
-  for (size_t i = 0; i < values.size(); ++i) {
-    out.at(i) = values_3b.at<cv::Vec3b>(i);
+void ColormapLut::Map(const double* values, size_t n, double vmin, double vmax, cv::Vec3b* out) const
+{
+  CHECK_GT(vmax, vmin) << "Colormap range is empty" << std::endl;
+
+  const double scale = 255.0 / (vmax - vmin);
+  const double offset = 0.5 - vmin * scale;   // Rounds to the nearest entry.
+
+  uint8_t index[kChunkSize];
+  for (size_t begin = 0; begin < n; begin += kChunkSize) {
+    const size_t count = std::min(kChunkSize, n - begin);
+
+    for (size_t i = 0; i < count; ++i) {
+      const double t = values[begin + i] * scale + offset;
+      index[i] = static_cast<uint8_t>(std::min(255.0, std::max(0.0, t)));
+    }
+    for (size_t i = 0; i < count; ++i) {
+      out[begin + i] = lut_[index[i]];
+    }
+  }
+}
+
+
+const ColormapLut& GetColormapLut(int cv_colormap)
+{
+  static std::mutex mutex;
+  static std::map<int, std::unique_ptr<ColormapLut>> luts;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<ColormapLut>& lut = luts[cv_colormap];
+  if (!lut) {
+    lut.reset(new ColormapLut(cv_colormap));
   }
+  return *lut;
+}
 
+
+std::vector<cv::Vec3b> ColormapVector(const std::vector<double>& values,
+                                      double vmin, double vmax,
+                                      int cv_colormap)
+{
+  std::vector<cv::Vec3b> out(values.size());
+  GetColormapLut(cv_colormap).Map(values.data(), values.size(), vmin, vmax, out.data());
   return out;
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <opencv2/core/core.hpp>
 
@@ -7,6 +8,30 @@ namespace bm {
 namespace core {
 
 
+// An OpenCV colormap as a 256 entry lookup table, so that coloring a value is a multiply-add, a
+// clamp and a table lookup (instead of building and colormapping an image). The index computation
+// is a plain loop over the values, which the compiler vectorizes.
+class ColormapLut final {
+ public:
+  explicit ColormapLut(int cv_colormap);
+
+  // Color of a value, where [vmin, vmax] maps onto the colormap (values outside are clamped).
+  cv::Vec3b Map(double value, double vmin, double vmax) const;
+
+  // Colors n values at once.
+  void Map(const double* values, size_t n, double vmin, double vmax, cv::Vec3b* out) const;
+
+  const cv::Vec3b& operator[](uint8_t i) const { return lut_[i]; }
+
+ private:
+  std::array<cv::Vec3b, 256> lut_;
+};
+
+
+// The lookup table for an OpenCV colormap, built the first time that it's needed (thread-safe).
+const ColormapLut& GetColormapLut(int cv_colormap);
+
+
 std::vector<cv::Vec3b> ColormapVector(const std::vector<double>& values,
                                       double vmin, double vmax,
                                       int cv_colormap);
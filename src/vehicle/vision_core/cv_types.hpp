@@ -8,6 +8,10 @@ namespace core {
 typedef cv::Mat1b Image1b;
 typedef cv::Mat3b Image3b;
 
+// 16-bit unsigned images (e.g linear camera frames)
+typedef cv::Mat1w Image1w;
+typedef cv::Mat3w Image3w;
+
 // 32-bit floating point images
 typedef cv::Mat1f Image1f;
 typedef cv::Mat3f Image3f;
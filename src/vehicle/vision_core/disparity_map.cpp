@@ -0,0 +1,42 @@
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "vision_core/disparity_map.hpp"
+
+namespace bm {
+namespace core {
+
+
+std::vector<double> QueryDisparity(const DisparityMap& map,
+                                   const VecPoint2f& kps,
+                                   double max_cost)
+{
+  CHECK_GE(map.downsample, 1);
+  CHECK(map.disp.size() == map.valid.size());
+  CHECK(map.disp.size() == map.cost.size());
+
+  const double scale = static_cast<double>(map.downsample);
+  std::vector<double> disps(kps.size(), -1.0);
+
+  for (size_t i = 0; i < kps.size(); ++i) {
+    // NOTE(milo): Pixel centers line up the way cv::resize() does it.
+    const int x = static_cast<int>(std::round((kps.at(i).x + 0.5) / scale - 0.5));
+    const int y = static_cast<int>(std::round((kps.at(i).y + 0.5) / scale - 0.5));
+
+    if (x < 0 || x >= map.disp.cols || y < 0 || y >= map.disp.rows) {
+      continue;
+    }
+    if (map.valid(y, x) == 0 || map.disp(y, x) <= 0 || map.cost(y, x) > max_cost) {
+      continue;
+    }
+
+    disps.at(i) = scale * map.disp(y, x);
+  }
+
+  return disps;
+}
+
+
+}
+}
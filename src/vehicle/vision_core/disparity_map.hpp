@@ -0,0 +1,33 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A dense disparity map for the left image of a stereo pair (e.g from PatchmatchGpu), along with the
+// matching cost and the result of a left-right check for each pixel. Dense stereo usually runs on
+// downsampled images, so the maps can be smaller than the images that keypoints come from.
+struct DisparityMap final
+{
+  Image1f disp;         // Disparity in map pixels (zero for background).
+  Image1f cost;         // Matching cost per pixel, only meaningful where valid.
+  Image1b valid;        // 255 where disp is foreground and passed the left-right check.
+  int downsample = 1;   // The images were downsampled by this factor before matching.
+};
+
+
+// Looks up the disparity at each keypoint (in full resolution pixels), so that a dense map can be
+// used instead of StereoMatcher::MatchRectified(). The disparities are in full resolution pixels,
+// and are -1 where the map is invalid or the cost is above max_cost.
+std::vector<double> QueryDisparity(const DisparityMap& map,
+                                   const VecPoint2f& kps,
+                                   double max_cost = std::numeric_limits<double>::max());
+
+
+}
+}
@@ -0,0 +1,80 @@
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/cudaarithm.hpp>
+#include <opencv2/cudafilters.hpp>
+#include <opencv2/cudawarping.hpp>
+
+#include "vision_core/foreground_mask.hpp"
+
+namespace bm {
+namespace core {
+
+
+static cv::Mat GradientKernel(int ksize, int downsize)
+{
+  CHECK(downsize >= 1 && downsize <= 8) << "Use a downsize argument (int) between 1 and 8" << std::endl;
+  const int scaled_ksize = ksize / downsize;
+  CHECK_GT(scaled_ksize, 1) << "ksize too small for downsize" << std::endl;
+  const int kwidth = 2*scaled_ksize + 1;
+
+  return cv::getStructuringElement(
+      cv::MORPH_RECT,
+      cv::Size(kwidth, kwidth),
+      cv::Point(scaled_ksize, scaled_ksize));
+}
+
+
+void ForegroundTextureMask(const Image1b& gray,
+                           Image1b& mask,
+                           int ksize,
+                           double min_grad,
+                           int downsize)
+{
+  const cv::Mat kernel = GradientKernel(ksize, downsize);
+
+  // Do image processing at a downsampled size (faster).
+  if (downsize > 1) {
+    Image1b gray_small;
+    cv::resize(gray, gray_small, gray.size() / downsize, 0, 0, cv::INTER_LINEAR);
+    cv::Mat gradient;
+    cv::morphologyEx(gray_small, gradient, cv::MORPH_GRADIENT, kernel, cv::Point(-1, -1), 1);
+    cv::resize(gradient > min_grad, mask, gray.size(), 0, 0, cv::INTER_LINEAR);
+
+  // Do processing at original resolution.
+  } else {
+    cv::Mat gradient;
+    cv::morphologyEx(gray, gradient, cv::MORPH_GRADIENT, kernel, cv::Point(-1, -1), 1);
+    mask = gradient > min_grad;
+  }
+}
+
+
+void ForegroundTextureMaskGpu(const cu::GpuMat& gray,
+                              cu::GpuMat& mask,
+                              int ksize,
+                              double min_grad,
+                              int downsize,
+                              cu::Stream& stream)
+{
+  CHECK_EQ(CV_8UC1, gray.type());
+  const cv::Ptr<cu::Filter> gradient_filter = cu::createMorphologyFilter(
+      cv::MORPH_GRADIENT, CV_8UC1, GradientKernel(ksize, downsize));
+
+  // NOTE(milo): threshold() gives 255 where gradient > min_grad, same as the CPU comparison.
+  cu::GpuMat gradient, foreground;
+  if (downsize > 1) {
+    cu::GpuMat gray_small;
+    cu::resize(gray, gray_small, gray.size() / downsize, 0, 0, cv::INTER_LINEAR, stream);
+    gradient_filter->apply(gray_small, gradient, stream);
+    cu::threshold(gradient, foreground, min_grad, 255, cv::THRESH_BINARY, stream);
+    cu::resize(foreground, mask, gray.size(), 0, 0, cv::INTER_LINEAR, stream);
+  } else {
+    gradient_filter->apply(gray, gradient, stream);
+    cu::threshold(gradient, mask, min_grad, 255, cv::THRESH_BINARY, stream);
+  }
+}
+
+
+}
+}
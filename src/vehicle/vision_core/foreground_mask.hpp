@@ -0,0 +1,34 @@
+#pragma once
+
+#include <opencv2/core/cuda.hpp>
+
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+namespace cu = cv::cuda;
+
+
+// Returns a binary mask where "1" indicates foreground and "0" indicates background. A pixel is
+// foreground if the morphological gradient (max - min) in a ksize window around it is more than
+// min_grad. The gradient is computed on an image that's downsize times smaller (between 1 and 8).
+void ForegroundTextureMask(const Image1b& gray,
+                           Image1b& mask,
+                           int ksize = 7,
+                           double min_grad = 35.0,
+                           int downsize = 2);
+
+
+// Same as ForegroundTextureMask(), with the CUDA filters. Nothing is synchronized, so the mask is
+// only ready once the stream is.
+void ForegroundTextureMaskGpu(const cu::GpuMat& gray,
+                              cu::GpuMat& mask,
+                              int ksize = 7,
+                              double min_grad = 35.0,
+                              int downsize = 2,
+                              cu::Stream& stream = cu::Stream::Null());
+
+
+}
+}
@@ -0,0 +1,285 @@
+#include <algorithm>
+
+#include <cuda_runtime.h>
+
+#include <glog/logging.h>
+
+#include <opencv2/core/cuda_stream_accessor.hpp>
+
+#include "vision_core/gpu_context.hpp"
+
+namespace bm {
+namespace core {
+
+
+static const int kNumPriorities = 3;
+
+
+// Copy an image into a (reused) page-locked buffer, so that the upload can be async.
+static void CopyToHostMem(const Image1b& img, cu::HostMem& hmem)
+{
+  if (hmem.size() != img.size() || hmem.type() != img.type()) {
+    hmem = cu::HostMem(img.size(), img.type(), cu::HostMem::PAGE_LOCKED);
+  }
+  cv::Mat header = hmem.createMatHeader();
+  img.copyTo(header);
+}
+
+
+// A pooled buffer is idle when the pool holds the only reference to it.
+template <typename BufferT>
+static bool IsIdle(const BufferT& buf)
+{
+  return buf.refcount != nullptr && *buf.refcount == 1;
+}
+
+
+static bool IsIdleMat(const cv::Mat& buf)
+{
+  return buf.u != nullptr && buf.u->refcount == 1;
+}
+
+
+GpuContext::GpuContext() {}
+
+
+GpuContext::~GpuContext()
+{
+  // NOTE(milo): The streams were wrapped, so OpenCV doesn't destroy them.
+  for (std::vector<cu::Stream>* streams : { &streams_, &owned_streams_ }) {
+    for (cu::Stream& s : *streams) {
+      s.waitForCompletion();
+      cudaStreamDestroy(cu::StreamAccessor::getStream(s));
+    }
+  }
+}
+
+
+GpuContext& GpuContext::Global()
+{
+  static GpuContext context;
+  return context;
+}
+
+
+cu::Stream GpuContext::CreateStream(GpuPriority priority)
+{
+  // Lower numbers are higher priorities. Usually there are only a few levels (two on the Jetson),
+  // so DENSE_STEREO might share one with another priority.
+  int least = 0, greatest = 0;
+  cudaDeviceGetStreamPriorityRange(&least, &greatest);
+
+  int value = least;
+  switch (priority) {
+    case GpuPriority::VIO_FRONTEND: value = greatest; break;
+    case GpuPriority::DENSE_STEREO: value = (least + greatest) / 2; break;
+    case GpuPriority::ENHANCEMENT: value = least; break;
+  }
+
+  cudaStream_t stream;
+  const cudaError_t err = cudaStreamCreateWithPriority(&stream, cudaStreamNonBlocking, value);
+  CHECK_EQ(cudaSuccess, err) << "Failed to create a CUDA stream: " << cudaGetErrorString(err) << std::endl;
+
+  return cu::StreamAccessor::wrapStream(stream);
+}
+
+
+cu::Stream& GpuContext::Stream(GpuPriority priority)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!has_streams_) {
+    for (int p = 0; p < kNumPriorities; ++p) {
+      streams_.emplace_back(CreateStream(static_cast<GpuPriority>(p)));
+    }
+    has_streams_ = true;
+  }
+  return streams_.at(static_cast<int>(priority));
+}
+
+
+cu::Stream GpuContext::NewStream(GpuPriority priority)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  owned_streams_.emplace_back(CreateStream(priority));
+  return owned_streams_.back();
+}
+
+
+cu::GpuMat GpuContext::GetBuffer(int rows, int cols, int type)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetBufferLocked(rows, cols, type);
+}
+
+
+cu::GpuMat GpuContext::GetBufferLocked(int rows, int cols, int type)
+{
+  for (const cu::GpuMat& buf : device_pool_) {
+    if (IsIdle(buf) && buf.rows == rows && buf.cols == cols && buf.type() == type) {
+      return buf;
+    }
+  }
+  device_pool_.emplace_back(rows, cols, type);
+  return device_pool_.back();
+}
+
+
+cu::HostMem GpuContext::GetPinned(int rows, int cols, int type)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const cu::HostMem& buf : host_pool_) {
+    if (IsIdle(buf) && buf.rows == rows && buf.cols == cols && buf.type() == type) {
+      return buf;
+    }
+  }
+  host_pool_.emplace_back(rows, cols, type, cu::HostMem::PAGE_LOCKED);
+  return host_pool_.back();
+}
+
+
+bool GpuContext::ZeroCopy()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (zero_copy_ < 0) {
+    int device = 0;
+    cudaDeviceProp prop;
+    zero_copy_ = cudaGetDevice(&device) == cudaSuccess &&
+                 cudaGetDeviceProperties(&prop, device) == cudaSuccess &&
+                 prop.integrated && prop.canMapHostMemory;
+    LOG(INFO) << "GPU " << (zero_copy_ ? "shares memory with the CPU, using zero copy buffers" :
+                                         "has its own memory, using explicit copies") << std::endl;
+  }
+  return zero_copy_ == 1;
+}
+
+
+cv::Mat GpuContext::GetMapped(int rows, int cols, int type)
+{
+  // NOTE(milo): Outside of the lock, since ZeroCopy() takes it.
+  const cu::HostMem::AllocType alloc = ZeroCopy() ? cu::HostMem::SHARED : cu::HostMem::PAGE_LOCKED;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const cv::Mat& buf : mapped_pool_) {
+    if (IsIdleMat(buf) && buf.rows == rows && buf.cols == cols && buf.type() == type) {
+      return buf;
+    }
+  }
+
+  cv::Mat buf;
+  buf.allocator = cu::HostMem::getAllocator(alloc);
+  buf.create(rows, cols, type);
+  mapped_pool_.emplace_back(buf);
+  return buf;
+}
+
+
+bool GpuContext::WrapMapped(const cv::Mat& im, cu::GpuMat& out)
+{
+  void* device_ptr = nullptr;
+  if (im.empty() || cudaHostGetDevicePointer(&device_ptr, im.data, 0) != cudaSuccess) {
+    cudaGetLastError();   // Clear the error, so that it isn't picked up by the next kernel launch.
+    return false;
+  }
+  out = cu::GpuMat(im.rows, im.cols, im.type(), device_ptr, im.step);
+  return true;
+}
+
+
+void GpuContext::Trim()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  device_pool_.erase(std::remove_if(device_pool_.begin(), device_pool_.end(), IsIdle<cu::GpuMat>), device_pool_.end());
+  host_pool_.erase(std::remove_if(host_pool_.begin(), host_pool_.end(), IsIdle<cu::HostMem>), host_pool_.end());
+  mapped_pool_.erase(std::remove_if(mapped_pool_.begin(), mapped_pool_.end(), IsIdleMat), mapped_pool_.end());
+}
+
+
+size_t GpuContext::NumBuffers() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return device_pool_.size() + host_pool_.size() + mapped_pool_.size();
+}
+
+
+size_t GpuContext::NumBuffersInUse() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t count = 0;
+  for (const cu::GpuMat& buf : device_pool_) { count += IsIdle(buf) ? 0 : 1; }
+  for (const cu::HostMem& buf : host_pool_) { count += IsIdle(buf) ? 0 : 1; }
+  for (const cv::Mat& buf : mapped_pool_) { count += IsIdleMat(buf) ? 0 : 1; }
+  return count;
+}
+
+
+GpuMemoryUsage GpuContext::MemoryUsage() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  GpuMemoryUsage usage;
+  for (const cu::GpuMat& buf : device_pool_) {
+    const size_t bytes = buf.step * buf.rows;
+    usage.device_bytes += bytes;
+    usage.device_bytes_in_use += IsIdle(buf) ? 0 : bytes;
+  }
+  for (const cu::HostMem& buf : host_pool_) {
+    const size_t bytes = buf.step * buf.rows;
+    usage.host_bytes += bytes;
+    usage.host_bytes_in_use += IsIdle(buf) ? 0 : bytes;
+  }
+  for (const cv::Mat& buf : mapped_pool_) {
+    const size_t bytes = buf.step[0] * buf.rows;
+    usage.host_bytes += bytes;
+    usage.host_bytes_in_use += IsIdleMat(buf) ? 0 : bytes;
+  }
+  return usage;
+}
+
+
+GpuStereoFrame::ConstPtr GpuContext::UploadStereo(uid_t camera_id,
+                                                  const Image1b& left,
+                                                  const Image1b& right,
+                                                  GpuPriority priority)
+{
+  cu::Stream& stream = Stream(priority);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (last_frame_ && last_frame_->camera_id == camera_id) {
+    return last_frame_;
+  }
+
+  // NOTE(milo): The previous upload could still be reading the page-locked buffers.
+  if (last_frame_) {
+    last_frame_->ready.waitForCompletion();
+  }
+  CopyToHostMem(left, h_left_);
+  CopyToHostMem(right, h_right_);
+
+  GpuStereoFrame::Ptr frame = std::make_shared<GpuStereoFrame>();
+  frame->camera_id = camera_id;
+  frame->left = GetBufferLocked(left.rows, left.cols, left.type());
+  frame->right = GetBufferLocked(right.rows, right.cols, right.type());
+  frame->left.upload(h_left_, stream);
+  frame->right.upload(h_right_, stream);
+  frame->ready.record(stream);
+
+  last_frame_ = frame;
+  return frame;
+}
+
+
+void GpuContext::WaitFor(cu::Stream& stream, const cu::Event& event)
+{
+  stream.waitEvent(event);
+}
+
+
+cu::Event GpuContext::Record(cu::Stream& stream)
+{
+  cu::Event event(cu::Event::DISABLE_TIMING);
+  event.record(stream);
+  return event;
+}
+
+
+}
+}
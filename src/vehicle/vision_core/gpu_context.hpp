@@ -0,0 +1,144 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/cuda.hpp>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+namespace cu = cv::cuda;
+
+
+// Stream priorities, from highest to lowest. The GPU runs queued work from higher priority streams
+// first, so dense stereo and enhancement kernels don't hold up the VIO frontend.
+enum class GpuPriority { VIO_FRONTEND = 0, DENSE_STEREO = 1, ENHANCEMENT = 2 };
+
+
+// Bytes held by the GpuContext pools. "host" counts both page-locked and host-mapped buffers.
+struct GpuMemoryUsage final
+{
+  size_t device_bytes = 0;
+  size_t device_bytes_in_use = 0;
+  size_t host_bytes = 0;
+  size_t host_bytes_in_use = 0;
+};
+
+
+// A stereo pair that was uploaded once, for all of the GPU modules that need it. "ready" is recorded
+// on the upload stream, so other streams have to wait on it (see GpuContext::WaitFor) before they
+// read the images.
+struct GpuStereoFrame final
+{
+  MACRO_SHARED_POINTER_TYPEDEFS(GpuStereoFrame);
+
+  uid_t camera_id = 0;
+  cu::GpuMat left;
+  cu::GpuMat right;
+  cu::Event ready;
+};
+
+
+// Process-wide GPU resources, shared by all of the CUDA modules (GpuFrontend, PatchmatchGpu, the
+// correction kernels):
+//  - One stream per priority (and more on request), created with a real CUDA stream priority.
+//  - A device memory pool: GetBuffer() hands out a GpuMat that's idle in the pool (or allocates
+//    one). It goes back to the pool as soon as the last copy of it is released.
+//  - The same for page-locked host memory, so async uploads don't allocate either.
+//  - On GPUs that share DRAM with the CPU (e.g Jetson), host-mapped images that kernels can read
+//    and write in place, so frames don't get copied from one part of DRAM to another.
+//  - The last uploaded stereo frame, so modules that get the same camera_id share one copy.
+//
+// NOTE(milo): Thread-safe. Only touches the device once a module asks for something, so CPU-only
+// runs never need a GPU.
+class GpuContext final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(GpuContext);
+
+  GpuContext();
+  ~GpuContext();
+
+  static GpuContext& Global();
+
+  // The shared stream for a priority. Modules that need several streams (e.g one per in-flight
+  // frame) should use NewStream() instead.
+  cu::Stream& Stream(GpuPriority priority);
+
+  // A new stream with this priority, which is owned by the context.
+  cu::Stream NewStream(GpuPriority priority);
+
+  // A device (or page-locked host) buffer of this size and type from the pool. The contents are
+  // whatever the last user left there.
+  // NOTE(milo): The pool doesn't know about streams, so don't release a buffer while some stream
+  // could still be using it (e.g keep it on the module until the stream is synchronized).
+  cu::GpuMat GetBuffer(int rows, int cols, int type);
+  cu::HostMem GetPinned(int rows, int cols, int type);
+
+  // True if the GPU is integrated with the CPU (shares its memory) and can map host memory, i.e
+  // host-mapped buffers are as fast for it as device memory. False if there is no GPU.
+  bool ZeroCopy();
+
+  // A pooled image (which owns its pixels, so it can go anywhere a cv::Mat can) in memory that the
+  // GPU can use directly: host-mapped if ZeroCopy(), page-locked otherwise (so that an upload from
+  // it is async). It goes back to the pool once the last copy of it is released.
+  cv::Mat GetMapped(int rows, int cols, int type);
+
+  // A GpuMat header over an image from GetMapped() (or any host-mapped memory), without copying it.
+  // Returns false if im isn't host-mapped. Only use it if ZeroCopy(): on a discrete GPU, every read
+  // of the header goes over PCIe.
+  static bool WrapMapped(const cv::Mat& im, cu::GpuMat& out);
+
+  // Frees the pooled buffers that nobody is using.
+  void Trim();
+
+  // Number of buffers in the pools (used or not), and how many of them are in use.
+  size_t NumBuffers() const;
+  size_t NumBuffersInUse() const;
+
+  // How much memory the pools hold (used or not), and how much of it is in use.
+  GpuMemoryUsage MemoryUsage() const;
+
+  // Uploads a stereo pair on the stream with this priority, unless the last uploaded frame already
+  // has this camera_id (then that one is returned, and nothing is uploaded).
+  GpuStereoFrame::ConstPtr UploadStereo(uid_t camera_id,
+                                        const Image1b& left,
+                                        const Image1b& right,
+                                        GpuPriority priority);
+
+  // Makes "stream" wait until "event" has happened on some other stream (without blocking the CPU).
+  void WaitFor(cu::Stream& stream, const cu::Event& event);
+
+  // Record an event on a stream, which other streams can WaitFor().
+  cu::Event Record(cu::Stream& stream);
+
+ private:
+  cu::Stream CreateStream(GpuPriority priority);
+  cu::GpuMat GetBufferLocked(int rows, int cols, int type);
+
+ private:
+  mutable std::mutex mutex_;
+
+  bool has_streams_ = false;
+  std::vector<cu::Stream> streams_;             // One per GpuPriority.
+  std::vector<cu::Stream> owned_streams_;       // From NewStream().
+
+  std::vector<cu::GpuMat> device_pool_;
+  std::vector<cu::HostMem> host_pool_;
+  std::vector<cv::Mat> mapped_pool_;
+
+  int zero_copy_ = -1;    // Not checked yet.
+
+  // A page-locked copy of the last stereo pair, and the frame that was uploaded from it.
+  cu::HostMem h_left_, h_right_;
+  GpuStereoFrame::Ptr last_frame_;
+};
+
+
+}
+}
@@ -0,0 +1,148 @@
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/foreground_mask.hpp"
+#include "vision_core/image_cache.hpp"
+
+namespace bm {
+namespace core {
+
+
+void ImageCache::CheckSource(const Image1b& gray)
+{
+  if (gray.data == source_data_ && gray.size() == source_size_) {
+    return;
+  }
+
+  source_data_ = gray.data;
+  source_size_ = gray.size();
+  mask_args_ = MaskArgs();
+  mask_.release();
+  mask_gpu_args_ = MaskArgs();
+  mask_gpu_.release();
+  gray_gpu_.release();
+  pyramid_.clear();
+  gradient_pyramid_.clear();
+}
+
+
+Image1b ImageCache::ForegroundMask(const Image1b& gray,
+                                   int ksize,
+                                   double min_grad,
+                                   int downsize,
+                                   bool use_gpu)
+{
+  if (use_gpu) {
+    const cu::GpuMat mask_gpu = ForegroundMaskGpu(gray, ksize, min_grad, downsize);
+    std::lock_guard<std::mutex> lock(mutex_);
+    MaskArgs args;
+    args.ksize = ksize;
+    args.min_grad = min_grad;
+    args.downsize = downsize;
+    if (mask_.empty() || !(args == mask_args_)) {
+      mask_gpu.download(mask_);
+      mask_args_ = args;
+    }
+    return mask_;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  CheckSource(gray);
+
+  MaskArgs args;
+  args.ksize = ksize;
+  args.min_grad = min_grad;
+  args.downsize = downsize;
+
+  if (mask_.empty() || !(args == mask_args_)) {
+    ForegroundTextureMask(gray, mask_, ksize, min_grad, downsize);
+    mask_args_ = args;
+  }
+
+  return mask_;
+}
+
+
+cu::GpuMat ImageCache::ForegroundMaskGpu(const Image1b& gray, int ksize, double min_grad, int downsize)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  CheckSource(gray);
+
+  MaskArgs args;
+  args.ksize = ksize;
+  args.min_grad = min_grad;
+  args.downsize = downsize;
+
+  if (mask_gpu_.empty() || !(args == mask_gpu_args_)) {
+    cu::Stream stream;
+    if (gray_gpu_.empty()) {
+      gray_gpu_.upload(gray, stream);
+    }
+    ForegroundTextureMaskGpu(gray_gpu_, mask_gpu_, ksize, min_grad, downsize, stream);
+    stream.waitForCompletion();
+    mask_gpu_args_ = args;
+  }
+
+  return mask_gpu_;
+}
+
+
+cu::GpuMat ImageCache::Gpu(const Image1b& gray)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  CheckSource(gray);
+
+  if (gray_gpu_.empty()) {
+    gray_gpu_.upload(gray);
+  }
+
+  return gray_gpu_;
+}
+
+
+std::vector<Image1b> ImageCache::Pyramid(const Image1b& gray, int levels)
+{
+  CHECK_GT(levels, 0);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  CheckSource(gray);
+
+  if (pyramid_.empty()) {
+    pyramid_.emplace_back(gray);
+  }
+
+  // NOTE(milo): Deeper levels are only added on demand, so asking for fewer levels is free.
+  while (static_cast<int>(pyramid_.size()) < levels) {
+    Image1b down;
+    cv::pyrDown(pyramid_.back(), down);
+    pyramid_.emplace_back(down);
+  }
+
+  return std::vector<Image1b>(pyramid_.begin(), pyramid_.begin() + levels);
+}
+
+
+std::vector<Image1f> ImageCache::GradientPyramid(const Image1b& gray, int levels)
+{
+  const std::vector<Image1b> pyramid = Pyramid(gray, levels);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  CheckSource(gray);
+
+  while (static_cast<int>(gradient_pyramid_.size()) < levels) {
+    const Image1b& level = pyramid.at(gradient_pyramid_.size());
+    cv::Mat dx, dy;
+    cv::Sobel(level, dx, CV_32F, 1, 0);
+    cv::Sobel(level, dy, CV_32F, 0, 1);
+    Image1f magnitude;
+    cv::magnitude(dx, dy, magnitude);
+    gradient_pyramid_.emplace_back(magnitude);
+  }
+
+  return std::vector<Image1f>(gradient_pyramid_.begin(), gradient_pyramid_.begin() + levels);
+}
+
+
+}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/cuda.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+namespace cu = cv::cuda;
+
+
+// Images derived from one grayscale image (foreground mask, pyramids, a GPU copy), computed the
+// first time something asks for them and then shared by everything else that processes the same
+// frame (e.g the mesher and patchmatch both want the foreground mask).
+//
+// NOTE(milo): Everything is keyed on the source image's pixel pointer and size. If a different
+// image is passed in (e.g the frame was resized after the cache was made), the cache is cleared
+// instead of handing back stale results. The returned cv::Mat headers share pixels with the cache,
+// so treat them as read only.
+class ImageCache final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ImageCache)
+
+  ImageCache() = default;
+
+  // See ForegroundTextureMask(). The mask is recomputed if the arguments change. If use_gpu, the
+  // mask is computed with ForegroundTextureMaskGpu() and downloaded.
+  Image1b ForegroundMask(const Image1b& gray,
+                         int ksize,
+                         double min_grad,
+                         int downsize,
+                         bool use_gpu = false);
+
+  // The foreground mask, left on the GPU (for the CUDA path). Waits on its own stream.
+  cu::GpuMat ForegroundMaskGpu(const Image1b& gray, int ksize, double min_grad, int downsize);
+
+  // The source image uploaded to the GPU.
+  cu::GpuMat Gpu(const Image1b& gray);
+
+  // Gaussian (pyrDown) pyramid, where level 0 is the source image. Returned by value (headers only)
+  // so that they stay valid if another thread clears the cache.
+  std::vector<Image1b> Pyramid(const Image1b& gray, int levels);
+
+  // Sobel gradient magnitude (CV_32FC1) of each level of Pyramid().
+  std::vector<Image1f> GradientPyramid(const Image1b& gray, int levels);
+
+ private:
+  // Clears everything if gray isn't the image the cache was made for. Call with mutex_ held.
+  void CheckSource(const Image1b& gray);
+
+  std::mutex mutex_;
+  const uchar* source_data_ = nullptr;
+  cv::Size source_size_;
+
+  struct MaskArgs final
+  {
+    bool operator==(const MaskArgs& other) const
+    {
+      return ksize == other.ksize && min_grad == other.min_grad && downsize == other.downsize;
+    }
+    int ksize = 0;
+    double min_grad = 0;
+    int downsize = 0;
+  };
+
+  MaskArgs mask_args_;
+  Image1b mask_;
+  MaskArgs mask_gpu_args_;
+  cu::GpuMat mask_gpu_;
+  cu::GpuMat gray_gpu_;
+  std::vector<Image1b> pyramid_;
+  std::vector<Image1f> gradient_pyramid_;
+};
+
+
+// One ImageCache per image of a stereo pair (see StereoImage::cache).
+struct StereoImageCache final
+{
+  MACRO_SHARED_POINTER_TYPEDEFS(StereoImageCache)
+
+  ImageCache left;
+  ImageCache right;
+};
+
+
+}
+}
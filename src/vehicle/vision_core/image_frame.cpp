@@ -0,0 +1,103 @@
+#include <glog/logging.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/image_frame.hpp"
+
+namespace bm {
+namespace core {
+
+static const float kUint8ToFloat = 1.0 / 255.0;
+
+
+ImageFrame::ImageFrame(const cv::Mat& decoded)
+    : decoded_(decoded)
+{
+  CHECK(decoded_.type() == CV_8UC1 || decoded_.type() == CV_8UC3)
+      << "ImageFrame expects an 8-bit gray or BGR image" << std::endl;
+}
+
+
+const Image1b& ImageFrame::Gray() const
+{
+  std::call_once(gray_once_, [this]()
+  {
+    if (IsColor()) {
+      cv::cvtColor(decoded_, gray_, cv::COLOR_BGR2GRAY);
+    } else {
+      gray_ = decoded_;
+    }
+  });
+  return gray_;
+}
+
+
+const Image3b& ImageFrame::Color() const
+{
+  std::call_once(color_once_, [this]()
+  {
+    if (IsColor()) {
+      color_ = decoded_;
+    } else {
+      cv::cvtColor(decoded_, color_, cv::COLOR_GRAY2BGR);
+    }
+  });
+  return color_;
+}
+
+
+const Image3f& ImageFrame::ColorFloat() const
+{
+  std::call_once(color_float_once_, [this]()
+  {
+    Color().convertTo(color_float_, CV_32FC3, kUint8ToFloat);
+  });
+  return color_float_;
+}
+
+
+const Image1f& ImageFrame::Intensity() const
+{
+  std::call_once(intensity_once_, [this]()
+  {
+    if (!IsColor()) {
+      decoded_.convertTo(intensity_, CV_32FC1, kUint8ToFloat);
+      return;
+    }
+
+    // NOTE(milo): Same weights as cv::cvtColor (BGR2GRAY), with the cast to float folded in, so
+    // that no float color image has to be allocated.
+    const float wb = 0.114f * kUint8ToFloat;
+    const float wg = 0.587f * kUint8ToFloat;
+    const float wr = 0.299f * kUint8ToFloat;
+
+    intensity_.create(decoded_.rows, decoded_.cols);
+    for (int v = 0; v < decoded_.rows; ++v) {
+      const uint8_t* bgr = decoded_.ptr<uint8_t>(v);
+      float* out = intensity_.ptr<float>(v);
+      for (int u = 0; u < decoded_.cols; ++u) {
+        out[u] = wb * bgr[3*u] + wg * bgr[3*u + 1] + wr * bgr[3*u + 2];
+      }
+    }
+  });
+  return intensity_;
+}
+
+
+StereoImage1b GrayView(const StereoFrame& pair)
+{
+  // NOTE(milo): Gray() is the same buffer every time, so all gray views of a frame share one cache.
+  StereoImage1b gray(pair.timestamp, pair.camera_id, pair.left_image->Gray(), pair.right_image->Gray());
+  gray.cache = pair.cache;
+  return gray;
+}
+
+
+StereoImage3b ColorView(const StereoFrame& pair)
+{
+  return StereoImage3b(pair.timestamp, pair.camera_id, pair.left_image->Color(), pair.right_image->Color());
+}
+
+
+}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_image.hpp"
+
+namespace bm {
+namespace core {
+
+
+// One decoded 8-bit image (gray or BGR), with the other views of it that consumers need computed
+// on demand and cached on the frame. A consumer that only needs gray never pays for a color
+// conversion (or the other way around), and each view is computed at most once per frame, no
+// matter how many consumers ask for it.
+//
+// NOTE(milo): The views are computed under a std::call_once, so a frame can be shared across
+// threads (e.g through a ConstPtr). The returned references stay valid for the life of the frame.
+class ImageFrame final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(ImageFrame);
+  MACRO_DELETE_COPY_CONSTRUCTORS(ImageFrame);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ImageFrame);
+
+  // Takes a (ref-counted) handle to the decoded image, which must be CV_8UC1 or CV_8UC3.
+  explicit ImageFrame(const cv::Mat& decoded);
+
+  bool IsColor() const { return decoded_.channels() == 3; }
+  cv::Size Size() const { return decoded_.size(); }
+  const cv::Mat& Decoded() const { return decoded_; }
+
+  // 8-bit grayscale. If the decoded image is gray, this is the same buffer (no copy).
+  const Image1b& Gray() const;
+
+  // 8-bit BGR. If the decoded image is color, this is the same buffer (no copy).
+  const Image3b& Color() const;
+
+  // BGR in [0, 1] (see CastImage3bTo3f).
+  const Image3f& ColorFloat() const;
+
+  // Intensity in [0, 1] (see ComputeIntensity). This is computed straight from the decoded image in
+  // one pass, without going through ColorFloat().
+  const Image1f& Intensity() const;
+
+ private:
+  cv::Mat decoded_;
+
+  mutable std::once_flag gray_once_, color_once_, color_float_once_, intensity_once_;
+  mutable Image1b gray_;
+  mutable Image3b color_;
+  mutable Image3f color_float_;
+  mutable Image1f intensity_;
+};
+
+
+// A stereo pair of frames, which can hand out gray or color stereo images.
+typedef StereoImage<ImageFrame::ConstPtr> StereoFrame;
+
+
+// Views of both frames in a stereo pair (computed on demand, see ImageFrame).
+StereoImage1b GrayView(const StereoFrame& pair);
+StereoImage3b ColorView(const StereoFrame& pair);
+
+
+}
+}
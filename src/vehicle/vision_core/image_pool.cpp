@@ -0,0 +1,105 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "vision_core/image_pool.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A pooled buffer is idle when the pool holds the only reference to it.
+static bool IsIdle(const cv::Mat& buf)
+{
+  return buf.u != nullptr && buf.u->refcount == 1;
+}
+
+
+static bool SameShape(const cv::Mat& buf, int rows, int cols, int type)
+{
+  return buf.rows == rows && buf.cols == cols && buf.type() == type;
+}
+
+
+ImagePool::ImagePool(size_t max_per_shape)
+    : max_per_shape_(max_per_shape)
+{
+  CHECK_GT(max_per_shape_, 0ul) << "ImagePool needs max_per_shape > 0" << std::endl;
+}
+
+
+cv::Mat ImagePool::Get(int rows, int cols, int type)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  size_t num_shape = 0;
+  for (const cv::Mat& buf : pool_) {
+    if (SameShape(buf, rows, cols, type)) {
+      if (IsIdle(buf)) {
+        return buf;
+      }
+      ++num_shape;
+    }
+  }
+
+  ++num_allocations_;
+  if (num_shape >= max_per_shape_) {
+    ++num_unpooled_;
+    LOG_EVERY_N(WARNING, 100) << "ImagePool is out of " << cols << "x" << rows << " buffers ("
+                              << max_per_shape_ << " in use), allocating" << std::endl;
+    return cv::Mat(rows, cols, type);
+  }
+
+  pool_.emplace_back(rows, cols, type);
+  return pool_.back();
+}
+
+
+void ImagePool::Trim()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  pool_.erase(std::remove_if(pool_.begin(), pool_.end(), IsIdle), pool_.end());
+}
+
+
+size_t ImagePool::NumBuffers() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pool_.size();
+}
+
+
+size_t ImagePool::NumBuffersInUse() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::count_if(pool_.begin(), pool_.end(), [](const cv::Mat& buf) { return !IsIdle(buf); });
+}
+
+
+size_t ImagePool::Bytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t bytes = 0;
+  for (const cv::Mat& buf : pool_) {
+    bytes += buf.total() * buf.elemSize();
+  }
+  return bytes;
+}
+
+
+size_t ImagePool::NumAllocations() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_allocations_;
+}
+
+
+size_t ImagePool::NumUnpooled() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_unpooled_;
+}
+
+
+}
+}
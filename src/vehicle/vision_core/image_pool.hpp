@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A fixed-size pool of image buffers for each resolution and type, so that decoders can write each
+// frame into a buffer that a previous frame already paged in, instead of allocating (and faulting
+// in) a few more megabytes at 20-30Hz.
+//
+// Get() returns an image that owns its pixels like any cv::Mat (so it can go into a StereoImage or
+// ImageFrame), and it goes back to the pool once the last copy of it is released. Like the
+// GpuContext pools, a buffer is idle when the pool holds the only reference to it.
+//
+// If all max_per_shape buffers of a shape are in use (e.g consumers are holding onto more frames
+// than expected), Get() falls back to a regular allocation that isn't pooled, so the pool never
+// grows past its size.
+//
+// NOTE(milo): Thread-safe. The contents of a recycled image are whatever the last user left there,
+// so only use Get() for outputs that get overwritten completely.
+class ImagePool final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(ImagePool);
+
+  explicit ImagePool(size_t max_per_shape = 8);
+
+  cv::Mat Get(int rows, int cols, int type);
+
+  // Frees the pooled buffers that nobody is using.
+  void Trim();
+
+  size_t NumBuffers() const;
+  size_t NumBuffersInUse() const;
+  size_t Bytes() const;
+
+  // Number of Get() calls that allocated a new buffer: pooled ones while the pool fills up, and
+  // unpooled ones when it's full.
+  size_t NumAllocations() const;
+  size_t NumUnpooled() const;
+
+ private:
+  size_t max_per_shape_;
+
+  mutable std::mutex mutex_;
+  std::vector<cv::Mat> pool_;
+  size_t num_allocations_ = 0;
+  size_t num_unpooled_ = 0;
+};
+
+
+}
+}
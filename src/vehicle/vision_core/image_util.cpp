@@ -61,6 +61,17 @@ Image1b MaybeConvertToGray(const cv::Mat& im)
 }
 
 
+Image1b MaybeConvertToGray(const cv::Mat& im, ImagePool& pool)
+{
+  if (im.channels() == 1) {
+    return im;
+  }
+  Image1b im_gray = pool.Get(im.rows, im.cols, CV_8UC1);
+  cv::cvtColor(im, im_gray, cv::COLOR_BGR2GRAY);
+  return im_gray;
+}
+
+
 StereoImage1b ConvertToGray(const StereoImage3b& pair)
 {
   return StereoImage1b(pair.timestamp, pair.camera_id,
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "vision_core/cv_types.hpp"
+#include "vision_core/image_pool.hpp"
 #include "vision_core/stereo_image.hpp"
 
 namespace bm {
@@ -24,6 +25,10 @@ Image1b ReadAndConvertToGrayScale(const std::string& img_path);
 Image1b MaybeConvertToGray(const cv::Mat& im);
 
 
+// Same as above, but a color image is converted into a buffer from the pool.
+Image1b MaybeConvertToGray(const cv::Mat& im, ImagePool& pool);
+
+
 StereoImage1b ConvertToGray(const StereoImage3b& pair);
 
 
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+
+#include "core/uid.hpp"
+#include "vision_core/line_feature.hpp"
+
+namespace bm {
+namespace core {
+
+
+// An observation of a line landmark in a (rectified) stereo pair. The endpoints are where the
+// line was detected in the left image, and the disparities are along the epipolar lines through
+// them, so that the smoother can use the 2D line for reprojection error (see LineFeature2D::cross)
+// and the 3D endpoints to initialize the landmark.
+struct LineObservation final
+{
+  LineObservation() = delete;
+
+  explicit LineObservation(uid_t line_id,
+                           uid_t camera_id,
+                           const LineFeature2D& left_line,
+                           double disp_start,
+                           double disp_end,
+                           const LineFeature3D& camera_line,
+                           double stereo_match_score)
+      : line_id(line_id),
+        camera_id(camera_id),
+        left_line(left_line),
+        disp_start(disp_start),
+        disp_end(disp_end),
+        camera_line(camera_line),
+        stereo_match_score(stereo_match_score) {}
+
+  // Member fields.
+  uid_t line_id;
+  uid_t camera_id;
+  LineFeature2D left_line;
+  double disp_start;
+  double disp_end;
+  LineFeature3D camera_line;    // Endpoints in the left camera frame.
+  double stereo_match_score;    // Hamming distance between the LBD descriptors (lower is better).
+};
+
+
+typedef std::vector<LineObservation> VecLineObservation;
+
+
+}
+}
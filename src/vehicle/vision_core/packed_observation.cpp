@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "vision_core/packed_observation.hpp"
+
+namespace bm {
+namespace core {
+
+
+constexpr double PackedObservation::kDisparityScale;
+
+
+void PackObservations(const VecLandmarkObservation& obs, uid_t camera_id, PackedObservations& packed)
+{
+  packed.camera_id = camera_id;
+  packed.base_landmark_id = obs.empty() ? 0 : obs.front().landmark_id;
+  for (const LandmarkObservation& o : obs) {
+    packed.base_landmark_id = std::min(packed.base_landmark_id, o.landmark_id);
+  }
+
+  packed.obs.resize(obs.size());
+
+  const double max_disp = std::numeric_limits<int16_t>::max();
+
+  for (size_t i = 0; i < obs.size(); ++i) {
+    const LandmarkObservation& o = obs[i];
+    PackedObservation& p = packed.obs[i];
+
+    const uid_t landmark_offset = o.landmark_id - packed.base_landmark_id;
+    CHECK_LE(landmark_offset, std::numeric_limits<uint32_t>::max())
+        << "Landmark ids in one list must be within 2^32 of each other" << std::endl;
+    CHECK_LE(o.camera_id, camera_id) << "Can't pack an observation from a newer camera" << std::endl;
+    CHECK_LE(camera_id - o.camera_id, std::numeric_limits<uint16_t>::max());
+
+    p.u = o.pixel_location.x;
+    p.v = o.pixel_location.y;
+    p.landmark_offset = static_cast<uint32_t>(landmark_offset);
+    p.camera_delta = static_cast<uint16_t>(camera_id - o.camera_id);
+
+    // NOTE(milo): A tiny positive disparity must not round to zero, since the smoother skips
+    // observations with disparity <= 0.
+    p.disparity = (o.disparity > 0) ?
+        static_cast<int16_t>(std::max(1.0, std::min(max_disp, std::round(o.disparity * PackedObservation::kDisparityScale)))) :
+        static_cast<int16_t>(-1);
+  }
+}
+
+
+void UnpackObservations(const PackedObservations& packed, VecLandmarkObservation& obs)
+{
+  obs.reserve(obs.size() + packed.obs.size());
+
+  for (const PackedObservation& p : packed.obs) {
+    const double disp = (p.disparity > 0) ? (p.disparity / PackedObservation::kDisparityScale) : -1.0;
+    obs.emplace_back(packed.base_landmark_id + p.landmark_offset,
+                     packed.camera_id - p.camera_delta,
+                     cv::Point2f(p.u, p.v),
+                     disp, 0.0, 0.0);
+  }
+}
+
+
+}
+}
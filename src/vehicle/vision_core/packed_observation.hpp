@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/uid.hpp"
+#include "vision_core/landmark_observation.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A LandmarkObservation in 16 bytes instead of 48, for sending observations between processes (or
+// keeping a lot of them around). The pixel is a float (like cv::Point2f), the disparity is
+// quantized to 1/kDisparityScale px, and the ids are relative to a PackedObservations list.
+// The track and match scores aren't kept, since nothing downstream of the frontend uses them.
+struct PackedObservation final
+{
+  static constexpr double kDisparityScale = 128.0;    // So disparities up to 255.99 px fit.
+
+  float u;
+  float v;
+  uint32_t landmark_offset;   // landmark_id - PackedObservations::base_landmark_id
+  int16_t disparity;          // Quantized, and negative if the observation didn't have one.
+  uint16_t camera_delta;      // PackedObservations::camera_id - camera_id
+};
+
+static_assert(sizeof(PackedObservation) == 16, "PackedObservation should be 16 bytes");
+
+
+// Observations that are delta-encoded against the same base ids. The camera_id is usually the image
+// that they were observed in (e.g VoResult::camera_id), so every camera_delta is zero.
+//
+// NOTE(milo): Landmark ids don't fit in 32 bits (each rig's ids start at a large offset), but the
+// ids in one list come from the same frontend, so they're within 2^32 of the smallest one.
+struct PackedObservations final
+{
+  uid_t camera_id = 0;
+  uid_t base_landmark_id = 0;
+  std::vector<PackedObservation> obs;
+};
+
+
+// Packs obs against camera_id (and the smallest landmark id in obs).
+void PackObservations(const VecLandmarkObservation& obs, uid_t camera_id, PackedObservations& packed);
+
+// Appends the observations in packed to obs. Disparities come back within 1/256 px (or as -1 if they
+// were <= 0), and the scores are zero.
+void UnpackObservations(const PackedObservations& packed, VecLandmarkObservation& obs);
+
+
+}
+}
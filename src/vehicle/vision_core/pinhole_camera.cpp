@@ -1,10 +1,13 @@
+#include <glog/logging.h>
+
 #include "vision_core/pinhole_camera.hpp"
 
 namespace bm {
 namespace core {
 
 
-PinholeCamera::PinholeCamera(double fx, double fy, double cx, double cy, double h, double w)
+template <typename Scalar>
+PinholeCameraT<Scalar>::PinholeCameraT(Scalar fx, Scalar fy, Scalar cx, Scalar cy, double h, double w)
     : fx_(fx), fy_(fy), cx_(cx), cy_(cy), height_(h), width_(w)
 {
   // Set up intrinsics matrices for later.
@@ -16,11 +19,12 @@ PinholeCamera::PinholeCamera(double fx, double fy, double cx, double cy, double
 // Returns a PinholeCamera with intrinsics scaled based on a new image resolution.
 // NOTE(milo): This only applies when an image is resized! Cropping will not change the focal
 // length, but resizing will.
-PinholeCamera PinholeCamera::Rescale(int new_height, int new_width) const
+template <typename Scalar>
+PinholeCameraT<Scalar> PinholeCameraT<Scalar>::Rescale(int new_height, int new_width) const
 {
-  const double height_sf = new_height / static_cast<double>(height_);
-  const double width_sf = new_width / static_cast<double>(width_);
-  return PinholeCamera(fx_ * width_sf,
+  const Scalar height_sf = new_height / static_cast<Scalar>(height_);
+  const Scalar width_sf = new_width / static_cast<Scalar>(width_);
+  return PinholeCameraT(fx_ * width_sf,
                         fy_ * height_sf,
                         cx_ * width_sf,
                         cy_ * height_sf,
@@ -30,20 +34,47 @@ PinholeCamera PinholeCamera::Rescale(int new_height, int new_width) const
 
 
 // Project 3D point in the camera's RDF frame.
-Vector2d PinholeCamera::Project(const Vector3d& p_cam) const
+template <typename Scalar>
+typename PinholeCameraT<Scalar>::Vector2 PinholeCameraT<Scalar>::Project(const Vector3& p_cam) const
 {
-  const Vector3d xy_h = K_ * p_cam;
-  return xy_h.head<2>() / xy_h(2);
+  const Vector3 xy_h = K_ * p_cam;
+  return xy_h.template head<2>() / xy_h(2);
 }
 
 
 // Backproject a pixel location to a 3D point in the camera's RDF frame.
-Vector3d PinholeCamera::Backproject(const Vector2d& xy, double depth) const
+template <typename Scalar>
+typename PinholeCameraT<Scalar>::Vector3 PinholeCameraT<Scalar>::Backproject(const Vector2& xy, Scalar depth) const
 {
-  const Vector3d xy_h(xy.x(), xy.y(), 1);
+  const Vector3 xy_h(xy.x(), xy.y(), 1);
   return depth * K_inv_ * xy_h;
 }
 
 
+template <typename Scalar>
+void PinholeCameraT<Scalar>::Project(const ArrayX& x, const ArrayX& y, const ArrayX& z, ArrayX& u, ArrayX& v) const
+{
+  CHECK(x.size() == y.size() && x.size() == z.size()) << "Project: arrays must be the same size" << std::endl;
+  const ArrayX z_inv = z.inverse();
+  u = fx_ * x * z_inv + cx_;
+  v = fy_ * y * z_inv + cy_;
+}
+
+
+template <typename Scalar>
+void PinholeCameraT<Scalar>::Backproject(const ArrayX& u, const ArrayX& v, const ArrayX& depth,
+                                         ArrayX& x, ArrayX& y, ArrayX& z) const
+{
+  CHECK(u.size() == v.size() && u.size() == depth.size()) << "Backproject: arrays must be the same size" << std::endl;
+  x = (u - cx_) * (depth / fx_);
+  y = (v - cy_) * (depth / fy_);
+  z = depth;
+}
+
+
+template class PinholeCameraT<double>;
+template class PinholeCameraT<float>;
+
+
 }
 }
@@ -6,40 +6,71 @@ namespace bm {
 namespace core {
 
 
-class PinholeCamera final {
+// NOTE(milo): Templated on the scalar type, so that the frontend can do its geometry in float
+// (twice as many SIMD lanes) while the smoother stays in double. Explicitly instantiated for float
+// and double in pinhole_camera.cpp.
+template <typename Scalar>
+class PinholeCameraT final {
  public:
-  PinholeCamera() = default;
-  PinholeCamera(double fx, double fy, double cx, double cy, double h, double w);
+  typedef Eigen::Matrix<Scalar, 2, 1> Vector2;
+  typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+  typedef Eigen::Matrix<Scalar, 3, 3> Matrix3;
+  typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> ArrayX;
+
+  PinholeCameraT() = default;
+  PinholeCameraT(Scalar fx, Scalar fy, Scalar cx, Scalar cy, double h, double w);
 
   // Returns a PinholeCamera with intrinsics scaled based on a new image resolution.
   // NOTE(milo): This only applies when an image is resized! Cropping will not change the focal
   // length, but resizing will.
-  PinholeCamera Rescale(int new_height, int new_width) const;
+  PinholeCameraT Rescale(int new_height, int new_width) const;
+
+  // Returns the same camera with a different scalar type (e.g PinholeCamera => PinholeCameraf).
+  template <typename Other>
+  PinholeCameraT<Other> Cast() const
+  {
+    return PinholeCameraT<Other>(static_cast<Other>(fx_), static_cast<Other>(fy_),
+                                 static_cast<Other>(cx_), static_cast<Other>(cy_), height_, width_);
+  }
 
-  double fx() const { return fx_; }
-  double fy() const { return fy_; }
-  double cx() const { return cx_; }
-  double cy() const { return cy_; }
+  Scalar fx() const { return fx_; }
+  Scalar fy() const { return fy_; }
+  Scalar cx() const { return cx_; }
+  Scalar cy() const { return cy_; }
   double Width() const { return width_; }
   double Height() const { return height_; }
-  Matrix3d K() const { return K_; }
-  Matrix3d Kinv() const { return K_inv_; }
+  const Matrix3& K() const { return K_; }
+  const Matrix3& Kinv() const { return K_inv_; }
 
   // Project 3D point in the camera's RDF frame.
-  Vector2d Project(const Vector3d& p_cam) const;
+  Vector2 Project(const Vector3& p_cam) const;
 
   // Backproject a pixel location to a 3D point in the camera's RDF frame.
-  Vector3d Backproject(const Vector2d& xy, double depth) const;
+  Vector3 Backproject(const Vector2& xy, Scalar depth) const;
+
+  // Batch versions of Project() and Backproject() for N points, stored as structure-of-arrays (one
+  // array per coordinate). These are Eigen array expressions, so they compile to SIMD instructions
+  // and don't do a 3x3 matrix multiply for each point.
+  void Project(const ArrayX& x, const ArrayX& y, const ArrayX& z, ArrayX& u, ArrayX& v) const;
+  void Backproject(const ArrayX& u, const ArrayX& v, const ArrayX& depth,
+                   ArrayX& x, ArrayX& y, ArrayX& z) const;
 
  private:
-  double fx_, fy_, cx_, cy_;
+  Scalar fx_, fy_, cx_, cy_;
 
   // Nominal width and height for an image captured by this camera.
   int height_, width_;
 
-  Matrix3d K_ = Matrix3d::Identity();
-  Matrix3d K_inv_ = Matrix3d::Identity();
+  Matrix3 K_ = Matrix3::Identity();
+  Matrix3 K_inv_ = Matrix3::Identity();
 };
 
+
+typedef PinholeCameraT<double> PinholeCamera;
+typedef PinholeCameraT<float> PinholeCameraf;
+
+extern template class PinholeCameraT<double>;
+extern template class PinholeCameraT<float>;
+
 }
 }
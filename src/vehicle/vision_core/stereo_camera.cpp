@@ -6,9 +6,10 @@ namespace bm {
 namespace core {
 
 
-StereoCamera::StereoCamera(const PinholeCamera& cam_left,
-                          const PinholeCamera& cam_right,
-                          const Transform3d& T_right_left)
+template <typename Scalar>
+StereoCameraT<Scalar>::StereoCameraT(const PinholeCameraT<Scalar>& cam_left,
+                                     const PinholeCameraT<Scalar>& cam_right,
+                                     const Transform3& T_right_left)
     : cam_left_(cam_left),
       cam_right_(cam_right),
       T_left_right_(T_right_left)
@@ -19,46 +20,79 @@ StereoCamera::StereoCamera(const PinholeCamera& cam_left,
 }
 
 
-StereoCamera::StereoCamera(const PinholeCamera& cam_left,
-                          const PinholeCamera& cam_right,
-                          double baseline)
+template <typename Scalar>
+StereoCameraT<Scalar>::StereoCameraT(const PinholeCameraT<Scalar>& cam_left,
+                                     const PinholeCameraT<Scalar>& cam_right,
+                                     Scalar baseline)
     : cam_left_(cam_left),
       cam_right_(cam_right),
       baseline_(baseline)
 {
-  T_left_right_ = Transform3d::Identity();
-  T_left_right_.translation() = Vector3d(baseline_, 0, 0);
+  T_left_right_ = Transform3::Identity();
+  T_left_right_.translation() = Vector3(baseline_, 0, 0);
   assert(cam_left_.Height() == cam_right_.Height() &&
           cam_left_.Width() == cam_right_.Width());
 }
 
 
-StereoCamera::StereoCamera(const PinholeCamera& cam_leftright,
-                           double baseline)
+template <typename Scalar>
+StereoCameraT<Scalar>::StereoCameraT(const PinholeCameraT<Scalar>& cam_leftright,
+                                     Scalar baseline)
     : cam_left_(cam_leftright),
       cam_right_(cam_leftright),
       baseline_(baseline)
 {
-  T_left_right_ = Transform3d::Identity();
-  T_left_right_.translation() = Vector3d(baseline_, 0, 0);
+  T_left_right_ = Transform3::Identity();
+  T_left_right_.translation() = Vector3(baseline_, 0, 0);
   assert(cam_left_.Height() == cam_right_.Height() &&
           cam_left_.Width() == cam_right_.Width());
 }
 
 
-double StereoCamera::DispToDepth(double disp) const
+template <typename Scalar>
+StereoCameraT<Scalar> StereoCameraT<Scalar>::Rescale(int new_height, int new_width) const
+{
+  return StereoCameraT(cam_left_.Rescale(new_height, new_width),
+                       cam_right_.Rescale(new_height, new_width),
+                       T_left_right_);
+}
+
+
+template <typename Scalar>
+Scalar StereoCameraT<Scalar>::DispToDepth(Scalar disp) const
 {
   CHECK_GT(disp, 0) << "Cannot convert zero disparity to depth (inf)!" << std::endl;
   return fx() * Baseline() / disp;
 }
 
 
-double StereoCamera::DepthToDisp(double depth) const
+template <typename Scalar>
+Scalar StereoCameraT<Scalar>::DepthToDisp(Scalar depth) const
 {
   CHECK_GT(depth, 0) << "Cannot convert zero depth to disp (inf)!" << std::endl;
   return fx() * Baseline() / depth;
 }
 
 
+template <typename Scalar>
+void StereoCameraT<Scalar>::DispToDepth(const ArrayX& disp, ArrayX& depth) const
+{
+  CHECK((disp > 0).all()) << "Cannot convert zero disparity to depth (inf)!" << std::endl;
+  depth = (fx() * Baseline()) * disp.inverse();
+}
+
+
+template <typename Scalar>
+void StereoCameraT<Scalar>::DepthToDisp(const ArrayX& depth, ArrayX& disp) const
+{
+  CHECK((depth > 0).all()) << "Cannot convert zero depth to disp (inf)!" << std::endl;
+  disp = (fx() * Baseline()) * depth.inverse();
+}
+
+
+template class StereoCameraT<double>;
+template class StereoCameraT<float>;
+
+
 }
 }
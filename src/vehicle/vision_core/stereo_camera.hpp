@@ -7,41 +7,72 @@ namespace bm {
 namespace core {
 
 
-class StereoCamera final {
+// NOTE(milo): See PinholeCameraT for the scalar type. Explicitly instantiated for float and double
+// in stereo_camera.cpp.
+template <typename Scalar>
+class StereoCameraT final {
  public:
-  StereoCamera() = default;
+  typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+  typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> ArrayX;
+  typedef Eigen::Transform<Scalar, 3, Eigen::AffineCompact> Transform3;
 
-  StereoCamera(const PinholeCamera& cam_left,
-               const PinholeCamera& cam_right,
-               const Transform3d& T_right_left);
+  StereoCameraT() = default;
 
-  StereoCamera(const PinholeCamera& cam_left,
-               const PinholeCamera& cam_right,
-               double baseline);
+  StereoCameraT(const PinholeCameraT<Scalar>& cam_left,
+                const PinholeCameraT<Scalar>& cam_right,
+                const Transform3& T_right_left);
 
-  StereoCamera(const PinholeCamera& cam_leftright,
-               double baseline);
+  StereoCameraT(const PinholeCameraT<Scalar>& cam_left,
+                const PinholeCameraT<Scalar>& cam_right,
+                Scalar baseline);
 
-  const PinholeCamera& LeftCamera() const { return cam_left_; }
-  const PinholeCamera& RightCamera() const { return cam_right_; }
+  StereoCameraT(const PinholeCameraT<Scalar>& cam_leftright,
+                Scalar baseline);
+
+  // Returns the same stereo rig with a different scalar type (e.g StereoCamera => StereoCameraf).
+  template <typename Other>
+  StereoCameraT<Other> Cast() const
+  {
+    return StereoCameraT<Other>(cam_left_.template Cast<Other>(),
+                                cam_right_.template Cast<Other>(),
+                                T_left_right_.template cast<Other>());
+  }
+
+  // The same rig for images resized to new_height x new_width (see PinholeCameraT::Rescale). The
+  // baseline is metric, so it doesn't change.
+  StereoCameraT Rescale(int new_height, int new_width) const;
+
+  const PinholeCameraT<Scalar>& LeftCamera() const { return cam_left_; }
+  const PinholeCameraT<Scalar>& RightCamera() const { return cam_right_; }
   int Height() const { return cam_left_.Height(); }
   int Width() const { return cam_left_.Width(); }
-  double Baseline() const { return baseline_; }
-  double fx() const { return cam_left_.fx(); }
-  double fy() const { return cam_left_.fy(); }
-  double cx() const { return cam_left_.cx(); }
-  double cy() const { return cam_left_.cy(); }
-  Transform3d Extrinsics() const { return T_left_right_; }
+  Scalar Baseline() const { return baseline_; }
+  Scalar fx() const { return cam_left_.fx(); }
+  Scalar fy() const { return cam_left_.fy(); }
+  Scalar cx() const { return cam_left_.cx(); }
+  Scalar cy() const { return cam_left_.cy(); }
+  Transform3 Extrinsics() const { return T_left_right_; }
+
+  Scalar DispToDepth(Scalar disp) const;
+  Scalar DepthToDisp(Scalar depth) const;
 
-  double DispToDepth(double disp) const;
-  double DepthToDisp(double depth) const;
+  // Batch versions of the above (vectorized). All of the inputs must be positive.
+  void DispToDepth(const ArrayX& disp, ArrayX& depth) const;
+  void DepthToDisp(const ArrayX& depth, ArrayX& disp) const;
 
  private:
-  PinholeCamera cam_left_;
-  PinholeCamera cam_right_;
-  double baseline_;              // Baseline in meters.
-  Transform3d T_left_right_;     // Transform of the right camera in the left frame.
+  PinholeCameraT<Scalar> cam_left_;
+  PinholeCameraT<Scalar> cam_right_;
+  Scalar baseline_;              // Baseline in meters.
+  Transform3 T_left_right_;      // Transform of the right camera in the left frame.
 };
 
+
+typedef StereoCameraT<double> StereoCamera;
+typedef StereoCameraT<float> StereoCameraf;
+
+extern template class StereoCameraT<double>;
+extern template class StereoCameraT<float>;
+
 }
 }
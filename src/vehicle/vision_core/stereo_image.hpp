@@ -1,14 +1,25 @@
 #pragma once
 
+#include <memory>
+#include <utility>
+
 #include "core/macros.hpp"
 #include "core/timestamp.hpp"
 #include "core/uid.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/image_cache.hpp"
 
 namespace bm {
 namespace core {
 
 
+// NOTE(milo): The images are cv::Mat headers, so a StereoImage is a ref-counted handle to pixel
+// data. Copying one only bumps the ref count (and never copies pixels). The pixels are freed once
+// the last handle goes away, so anything that holds onto a StereoImage (queues, sliding buffers,
+// the visualizer) should be bounded. Move handles whenever possible to avoid the atomic ref count.
+//
+// Copies also share the cache of derived images (foreground mask, pyramids), so each of those is
+// computed once per frame no matter how many modules look at it.
 template <typename ImageT>
 struct StereoImage final
 {
@@ -16,17 +27,19 @@ struct StereoImage final
 
   explicit StereoImage(timestamp_t timestamp,
                        uid_t camera_id,
-                       const ImageT& l,
-                       const ImageT& r)
+                       ImageT l,
+                       ImageT r)
     : timestamp(timestamp),
       camera_id(camera_id),
-      left_image(l),
-      right_image(r) {}
+      left_image(std::move(l)),
+      right_image(std::move(r)),
+      cache(std::make_shared<StereoImageCache>()) {}
 
   timestamp_t timestamp;
   uid_t camera_id;
   ImageT left_image;
   ImageT right_image;
+  StereoImageCache::Ptr cache;
 };
 
 typedef StereoImage<Image1b> StereoImage1b;
@@ -0,0 +1,88 @@
+#include <glog/logging.h>
+
+#include <opencv2/calib3d.hpp>
+
+#include "vision_core/undistort_map.hpp"
+
+namespace bm {
+namespace core {
+
+
+static cv::Mat EigenToCvMat(const Matrix3d& m)
+{
+  cv::Mat out(3, 3, CV_64FC1);
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      out.at<double>(i, j) = m(i, j);
+    }
+  }
+  return out;
+}
+
+
+UndistortMap::UndistortMap(const PinholeCamera& cam, const std::vector<double>& distortion)
+    : UndistortMap(cam, distortion, Matrix3d::Identity(), cam) {}
+
+
+UndistortMap::UndistortMap(const PinholeCamera& cam,
+                           const std::vector<double>& distortion,
+                           const Matrix3d& R_rect_cam,
+                           const PinholeCamera& cam_rect)
+    : cam_out_(cam_rect)
+{
+  CHECK(distortion.size() == 4 || distortion.size() == 5)
+      << "Expected (4) or (5) distortion coefficients: k1, k2, p1, p2[, k3]" << std::endl;
+  CHECK(cam.Height() == cam_rect.Height() && cam.Width() == cam_rect.Width())
+      << "UndistortMap doesn't resize images" << std::endl;
+
+  bool has_distortion = false;
+  D_ = cv::Mat(1, static_cast<int>(distortion.size()), CV_64FC1);
+  for (size_t i = 0; i < distortion.size(); ++i) {
+    D_.at<double>(0, static_cast<int>(i)) = distortion.at(i);
+    has_distortion |= (distortion.at(i) != 0);
+  }
+
+  identity_ = !has_distortion &&
+              R_rect_cam.isIdentity() &&
+              cam.K().isApprox(cam_rect.K());
+
+  K_ = EigenToCvMat(cam.K());
+  R_ = EigenToCvMat(R_rect_cam);
+  P_ = EigenToCvMat(cam_rect.K());
+
+  // NOTE(milo): Skip the tables if there's nothing to do, since most of our datasets come in
+  // already undistorted and rectified.
+  if (identity_) {
+    return;
+  }
+
+  const cv::Size size(static_cast<int>(cam.Width()), static_cast<int>(cam.Height()));
+  cv::initUndistortRectifyMap(K_, D_, R_, P_, size, CV_16SC2, map1_, map2_);
+}
+
+
+void UndistortMap::Apply(const cv::Mat& raw, cv::Mat& out, int interpolation) const
+{
+  if (identity_) {
+    raw.copyTo(out);
+    return;
+  }
+
+  CHECK(raw.rows == map1_.rows && raw.cols == map1_.cols)
+      << "Image size doesn't match the UndistortMap" << std::endl;
+  cv::remap(raw, out, map1_, map2_, interpolation, cv::BORDER_CONSTANT);
+}
+
+
+void UndistortMap::UndistortPoints(const VecPoint2f& raw, VecPoint2f& out) const
+{
+  if (identity_ || raw.empty()) {
+    out = raw;
+    return;
+  }
+  cv::undistortPoints(raw, out, K_, D_, R_, P_);
+}
+
+
+}
+}
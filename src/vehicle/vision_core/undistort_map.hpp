@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/imgproc.hpp>
+
+#include "core/eigen_types.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Lookup tables that undistort (and optionally rectify) raw images from a camera with a single
+// cv::remap() per frame. cv::undistort() rebuilds the same tables on every call, which costs more
+// than the remap itself, so these are built once when the camera is loaded. The tables are stored
+// in OpenCV's fixed-point format (CV_16SC2 + CV_16UC1), which is the fastest one to remap with.
+//
+// The distortion coefficients are the radial-tangential (k1, k2, p1, p2[, k3]) ones from the
+// "distortion_coefficients" field in the camera yaml (see YamlToCameraModel).
+class UndistortMap final {
+ public:
+  UndistortMap() = default;
+
+  // Undistorts images from cam, keeping the same intrinsics.
+  UndistortMap(const PinholeCamera& cam, const std::vector<double>& distortion);
+
+  // Undistorts and rectifies images from cam, where R_rect_cam rotates the raw camera frame into the
+  // rectified one, and cam_rect is the camera model for the rectified images.
+  UndistortMap(const PinholeCamera& cam,
+               const std::vector<double>& distortion,
+               const Matrix3d& R_rect_cam,
+               const PinholeCamera& cam_rect);
+
+  // True if there's nothing to correct (no distortion and no rectification), so Apply() just copies.
+  bool IsIdentity() const { return identity_; }
+
+  // The camera model for the output of Apply() and UndistortPoints().
+  const PinholeCamera& OutputCamera() const { return cam_out_; }
+
+  // Dense path: remaps a whole raw image (any type that cv::remap supports).
+  void Apply(const cv::Mat& raw, cv::Mat& out, int interpolation = cv::INTER_LINEAR) const;
+
+  // Sparse path: undistorts pixel locations from the raw image (e.g keypoints), without touching
+  // the image. The outputs are pixels in OutputCamera().
+  void UndistortPoints(const VecPoint2f& raw, VecPoint2f& out) const;
+
+ private:
+  bool identity_ = true;
+  PinholeCamera cam_out_;
+
+  cv::Mat K_, D_, R_, P_;   // Kept around for UndistortPoints().
+  cv::Mat map1_, map2_;     // Fixed-point remap tables.
+};
+
+
+}
+}
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/highgui.hpp>
+
+#include "vision_core/viz_tap.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Offsets of the pixels on a circle outline (midpoint circle algorithm), which get stamped at
+// every point with that radius.
+static std::vector<cv::Point> CircleStencil(int radius)
+{
+  std::vector<cv::Point> stencil;
+  int x = radius, y = 0, err = 1 - radius;
+  while (x >= y) {
+    const cv::Point octant[8] = { {x, y}, {y, x}, {-y, x}, {-x, y}, {-x, -y}, {-y, -x}, {y, -x}, {x, -y} };
+    stencil.insert(stencil.end(), octant, octant + 8);
+    ++y;
+    if (err < 0) {
+      err += 2*y + 1;
+    } else {
+      --x;
+      err += 2*(y - x) + 1;
+    }
+  }
+
+  // Points on the diagonals and axes show up twice.
+  std::sort(stencil.begin(), stencil.end(), [](const cv::Point& a, const cv::Point& b)
+  {
+    return (a.y < b.y) || (a.y == b.y && a.x < b.x);
+  });
+  stencil.erase(std::unique(stencil.begin(), stencil.end()), stencil.end());
+  return stencil;
+}
+
+
+static inline void Plot(Image3b& img, int x, int y, const cv::Vec3b& color)
+{
+  if ((unsigned)x < (unsigned)img.cols && (unsigned)y < (unsigned)img.rows) {
+    img(y, x) = color;
+  }
+}
+
+
+// An 8-connected (Bresenham) line, clipped to the image.
+static void PlotLine(Image3b& img, cv::Point a, cv::Point b, const cv::Vec3b& color)
+{
+  if (!cv::clipLine(img.size(), a, b)) {
+    return;
+  }
+
+  const int dx = std::abs(b.x - a.x), sx = (a.x < b.x) ? 1 : -1;
+  const int dy = -std::abs(b.y - a.y), sy = (a.y < b.y) ? 1 : -1;
+  int err = dx + dy;
+
+  while (true) {
+    img(a.y, a.x) = color;
+    if (a == b) {
+      break;
+    }
+    const int e2 = 2 * err;
+    if (e2 >= dy) { err += dy; a.x += sx; }
+    if (e2 <= dx) { err += dx; a.y += sy; }
+  }
+}
+
+
+// Skips NaNs, and points so far away that rounding them would overflow.
+static bool IsDrawable(const cv::Point2f& p)
+{
+  return std::fabs(p.x) < 1e6f && std::fabs(p.y) < 1e6f;
+}
+
+
+void RenderDrawList(const DrawList& list, Image3b& out)
+{
+  // NOTE(milo): cvtColor reuses the output buffer if it's already the right size, so a caller that
+  // keeps "out" around (e.g VizTapViewer) doesn't allocate for every frame.
+  if (list.background.empty()) {
+    out = Image3b::zeros(1, 1);
+  } else {
+    cv::cvtColor(list.background, out, cv::COLOR_GRAY2BGR);
+  }
+
+  // Everything is drawn straight into the buffer in one pass over the primitives, instead of a
+  // cv::circle() or cv::line() call (with its own setup and clipping) for each one.
+  std::vector<std::vector<cv::Point>> stencils;
+  for (const DrawPoint& p : list.points) {
+    if (p.radius < 0 || !IsDrawable(p.pt)) {
+      continue;
+    }
+    if ((size_t)p.radius >= stencils.size()) {
+      stencils.resize(p.radius + 1);
+    }
+    std::vector<cv::Point>& stencil = stencils.at(p.radius);
+    if (stencil.empty()) {
+      stencil = CircleStencil(p.radius);
+    }
+
+    const cv::Point c(cvRound(p.pt.x), cvRound(p.pt.y));
+    for (const cv::Point& o : stencil) {
+      Plot(out, c.x + o.x, c.y + o.y, p.color);
+    }
+  }
+
+  for (const DrawLine& l : list.lines) {
+    if (!IsDrawable(l.a) || !IsDrawable(l.b)) {
+      continue;
+    }
+    const cv::Point a(cvRound(l.a.x), cvRound(l.a.y));
+    const cv::Point b(cvRound(l.b.x), cvRound(l.b.y));
+    PlotLine(out, a, b, l.color);
+
+    // Same arrow head as cv::arrowedLine (10% of the length, at +/- 45 degrees).
+    if (l.arrow) {
+      const double angle = std::atan2(l.a.y - l.b.y, l.a.x - l.b.x);
+      const double length = 0.1 * cv::norm(l.b - l.a);
+      for (const double side : { 1.0, -1.0 }) {
+        const double t = angle + side * CV_PI / 4;
+        const cv::Point tip(cvRound(l.b.x + length * std::cos(t)), cvRound(l.b.y + length * std::sin(t)));
+        PlotLine(out, tip, b, l.color);
+      }
+    }
+  }
+}
+
+
+VizTapViewer::VizTapViewer(const VizTap::Ptr& tap, double max_hz)
+    : tap_(tap), max_hz_(max_hz)
+{
+  CHECK_GT(max_hz_, 0) << "VizTapViewer needs max_hz > 0" << std::endl;
+}
+
+
+VizTapViewer::~VizTapViewer()
+{
+  Stop();
+}
+
+
+void VizTapViewer::Start()
+{
+  if (thread_.joinable()) {
+    return;
+  }
+  is_shutdown_ = false;
+  thread_ = std::thread(&VizTapViewer::Loop, this);
+}
+
+
+void VizTapViewer::Stop()
+{
+  is_shutdown_ = true;
+  tap_->GetBuffer().Notify();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+
+void VizTapViewer::Loop()
+{
+  const auto period = std::chrono::duration<double>(1.0 / max_hz_);
+
+  uint64_t cursor = tap_->AddListener();
+  std::map<std::string, VizTap::Buffer::ItemPtr> latest;
+  Image3b rendered;
+
+  while (!is_shutdown_) {
+    const auto t0 = std::chrono::steady_clock::now();
+
+    tap_->GetBuffer().Wait(cursor, is_shutdown_, 0.1);
+
+    // Only the latest list of each window gets rendered.
+    tap_->GetBuffer().Fetch(cursor, [&latest](const VizTap::Buffer::ItemPtr& list, int64_t) {
+      latest[list->window] = list;
+    });
+
+    for (auto it = latest.begin(); it != latest.end(); ++it) {
+      RenderDrawList(*it->second, rendered);
+      cv::imshow(it->first, rendered);
+    }
+    if (!latest.empty()) {
+      cv::waitKey(1);
+    }
+    latest.clear();
+
+    std::this_thread::sleep_until(t0 + period);
+  }
+
+  tap_->RemoveListener();
+}
+
+
+}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "core/macros.hpp"
+#include "core/timestamp.hpp"
+#include "core/broadcast_queue.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+
+struct DrawPoint final {
+  cv::Point2f pt;
+  cv::Vec3b color;
+  int radius;
+};
+
+
+struct DrawLine final {
+  cv::Point2f a;
+  cv::Point2f b;
+  cv::Vec3b color;
+  bool arrow;   // Draw an arrow head at b.
+};
+
+
+// Lightweight draw primitives for one window, which are cheap to build in the hot path. The
+// background shares its pixels with the source image (cv::Mat is reference counted), so it isn't
+// copied either. RenderDrawList() does the actual drawing.
+struct DrawList final {
+  std::string window;
+  timestamp_t timestamp = 0;
+  Image1b background;
+
+  std::vector<DrawPoint> points;
+  std::vector<DrawLine> lines;
+};
+
+
+// Draws the primitives on top of the (grayscale) background.
+void RenderDrawList(const DrawList& list, Image3b& out);
+
+
+// An out-of-band visualization tap: the pipeline publishes DrawLists, and a VizTapViewer renders
+// them on its own thread at its own rate. Publishing only stores a shared_ptr in a ring buffer,
+// and callers should check HasListeners() before building a DrawList at all, so visualization
+// costs (almost) nothing when nobody is watching.
+class VizTap final {
+ public:
+  MACRO_SHARED_POINTER_TYPEDEFS(VizTap);
+  MACRO_DELETE_COPY_CONSTRUCTORS(VizTap);
+
+  typedef BroadcastBuffer<DrawList> Buffer;
+
+  explicit VizTap(size_t capacity = 8) : buffer_(capacity, "VizTap") {}
+
+  bool HasListeners() const { return num_listeners_.load(std::memory_order_relaxed) > 0; }
+
+  // Drops the list if nobody is listening.
+  void Publish(DrawList list)
+  {
+    if (HasListeners()) {
+      buffer_.Publish(std::move(list));
+    }
+  }
+
+  // Returns the cursor to read from (see BroadcastBuffer::Fetch()).
+  uint64_t AddListener()
+  {
+    ++num_listeners_;
+    return buffer_.Sequence();
+  }
+
+  void RemoveListener() { --num_listeners_; }
+
+  Buffer& GetBuffer() { return buffer_; }
+
+ private:
+  Buffer buffer_;
+  std::atomic<int> num_listeners_{0};
+};
+
+
+// Renders the latest DrawList of each window in a VizTap with cv::imshow(), at most max_hz times
+// per second. Lists that arrive faster than that are skipped.
+class VizTapViewer final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(VizTapViewer);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(VizTapViewer);
+
+  VizTapViewer(const VizTap::Ptr& tap, double max_hz = 20.0);
+  ~VizTapViewer();
+
+  void Start();
+  void Stop();
+
+ private:
+  void Loop();
+
+  VizTap::Ptr tap_;
+  double max_hz_;
+
+  std::atomic_bool is_shutdown_{false};
+  std::thread thread_;
+};
+
+
+}
+}
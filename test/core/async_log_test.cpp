@@ -0,0 +1,76 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/async_log.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(AsyncLogTest, TestRateLimit)
+{
+  LogSite site(__FILE__, __LINE__);
+
+  uint64_t suppressed = 0;
+  EXPECT_TRUE(site.ShouldLog(60.0, suppressed));
+  EXPECT_EQ(0ul, suppressed);
+
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_FALSE(site.ShouldLog(60.0, suppressed));
+  }
+  EXPECT_EQ(6ul, site.NumCalls());
+  EXPECT_EQ(5ul, site.NumSuppressed());
+
+  // Once the period is up, the next call gets through and reports the suppressed ones.
+  LogSite fast(__FILE__, __LINE__);
+  EXPECT_TRUE(fast.ShouldLog(0.05, suppressed));
+  EXPECT_FALSE(fast.ShouldLog(0.05, suppressed));
+  EXPECT_FALSE(fast.ShouldLog(0.05, suppressed));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_TRUE(fast.ShouldLog(0.05, suppressed));
+  EXPECT_EQ(2ul, suppressed);
+}
+
+
+TEST(AsyncLogTest, TestManyProducers)
+{
+  AsyncLogSink sink;
+  const int kThreads = 4;
+  const int kPerThread = 500;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&sink, t]() {
+      for (int i = 0; i < kPerThread; ++i) {
+        const std::string text = "thread " + std::to_string(t) + " message " + std::to_string(i);
+        sink.Push(google::GLOG_INFO, __FILE__, __LINE__, text.data(), text.size());
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  sink.Flush();
+
+  // Nothing is lost without being counted (the ring can overflow, but never blocks).
+  EXPECT_EQ(static_cast<uint64_t>(kThreads * kPerThread), sink.NumWritten() + sink.NumDropped());
+  EXPECT_GT(sink.NumWritten(), 0ul);
+}
+
+
+TEST(AsyncLogTest, TestMacro)
+{
+  AsyncLogSink& sink = AsyncLogSink::Instance();
+  sink.Flush();
+  const uint64_t written = sink.NumWritten();
+
+  for (int i = 0; i < 1000; ++i) {
+    BM_LOG_EVERY_SEC(WARNING, 60.0) << "Only the first of these is written: " << i;
+  }
+  sink.Flush();
+
+  EXPECT_EQ(written + 1, sink.NumWritten());
+}
@@ -0,0 +1,176 @@
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/depth_measurement.hpp"
+#include "core/data_manager.hpp"
+#include "core/broadcast_queue.hpp"
+#include "core/realtime_memory.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(BroadcastQueueTest, TestPrivate)
+{
+  // Without sharing, a BroadcastQueue acts like a normal drop-oldest queue.
+  BroadcastQueue<int> q(2, true);
+  EXPECT_TRUE(q.Empty());
+  q.Push(1);
+  q.Push(2);
+  q.Push(3);
+  EXPECT_EQ(2ul, q.Size());
+  EXPECT_EQ(2, q.PeekFront());
+  EXPECT_EQ(3, q.PeekBack());
+  EXPECT_EQ(2, q.Pop());
+  EXPECT_EQ(3, q.Pop());
+  EXPECT_TRUE(q.Empty());
+}
+
+
+TEST(BroadcastQueueTest, TestShared)
+{
+  BroadcastQueue<int> a(10, true, "a");
+  BroadcastQueue<int> b(10, true, "b");
+  b.ShareWith(a);
+
+  // Every consumer sees every item, and each one has its own cursor.
+  a.Push(1);
+  b.Push(2);
+  EXPECT_EQ(2ul, a.Size());
+  EXPECT_EQ(2ul, b.Size());
+  EXPECT_EQ(1, a.Pop());
+  EXPECT_EQ(1ul, a.Size());
+  EXPECT_EQ(2ul, b.Size());
+  EXPECT_EQ(1, b.Pop());
+  EXPECT_EQ(2, b.Pop());
+  EXPECT_EQ(2, a.Pop());
+  EXPECT_TRUE(a.Empty());
+  EXPECT_TRUE(b.Empty());
+}
+
+
+TEST(BroadcastQueueTest, TestSlowConsumer)
+{
+  BroadcastQueue<int> fast(4, true, "fast");
+  BroadcastQueue<int> slow(2, true, "slow");
+  slow.ShareWith(fast);
+
+  // The slow consumer only keeps its own newest 2 items, without affecting the fast one.
+  for (int i = 0; i < 4; ++i) {
+    fast.Push(i);
+    EXPECT_EQ(i, fast.Pop());
+  }
+  EXPECT_EQ(2ul, slow.Size());
+  EXPECT_EQ(2, slow.Pop());
+  EXPECT_EQ(3, slow.Pop());
+}
+
+
+TEST(BroadcastQueueTest, TestDataManager)
+{
+  typedef DataManager<DepthMeasurement, BroadcastQueue<DepthMeasurement>> SharedDepthManager;
+  SharedDepthManager smoother(10, true, "smoother");
+  SharedDepthManager filter(10, true, "filter");
+  filter.ShareWith(smoother);
+
+  smoother.Push(DepthMeasurement(10, 0.1));
+  smoother.Push(DepthMeasurement(20, 0.2));
+  smoother.Push(DepthMeasurement(30, 0.3));
+
+  smoother.DiscardBefore(ConvertToSeconds(25));
+  EXPECT_EQ(1ul, smoother.Size());
+  EXPECT_EQ(3ul, filter.Size());
+  EXPECT_EQ(ConvertToSeconds(10), filter.Oldest());
+  EXPECT_EQ(ConvertToSeconds(30), filter.Newest());
+
+  // A batch pushed to one shows up in both.
+  const std::vector<DepthMeasurement> batch = { DepthMeasurement(40, 0.4), DepthMeasurement(50, 0.5) };
+  filter.PushBatch(batch.data(), batch.size());
+  EXPECT_EQ(3ul, smoother.Size());
+  EXPECT_EQ(5ul, filter.Size());
+  EXPECT_EQ(ConvertToSeconds(50), smoother.Newest());
+}
+
+
+TEST(BroadcastQueueTest, TestBlocking)
+{
+  BroadcastQueue<int> a(4, true);
+  BroadcastQueue<int> b(4, true);
+  b.ShareWith(a);
+
+  int item = 0;
+  EXPECT_FALSE(b.PopBlocking(item, 0.01));
+
+  std::thread producer([&a]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    a.Push(5);
+  });
+  EXPECT_TRUE(b.PopBlocking(item));
+  EXPECT_EQ(5, item);
+  producer.join();
+
+  b.Close();
+  EXPECT_FALSE(b.WaitNotEmpty());
+}
+
+
+TEST(BroadcastQueueTest, TestPool)
+{
+  BroadcastQueue<int> fast(4, true, "fast");
+  BroadcastQueue<int> slow(2, false, "slow");
+  slow.ShareWith(fast);
+
+  // Room for the ring, one item being published, and the unread items of both consumers.
+  EXPECT_EQ(4ul + 1ul + 4ul + 2ul, fast.GetBuffer().PoolSize());
+
+  // The slow consumer keeps its oldest items long after they were overwritten in the ring, while
+  // the nodes of everything else get reused.
+  fast.Push(0);
+  fast.Push(1);
+  EXPECT_EQ(2ul, slow.ConsumerSize());
+  for (int i = 2; i < 100; ++i) {
+    fast.Push(i);
+    EXPECT_EQ(i - 2, fast.Pop());
+    EXPECT_EQ(0, slow.PeekFront());
+  }
+  EXPECT_EQ(0, slow.Pop());
+  EXPECT_EQ(1, slow.Pop());
+  EXPECT_EQ(0ul, fast.GetBuffer().NumPoolGrowths());
+
+  // Everything that was published while it was full got dropped.
+  EXPECT_TRUE(slow.Empty());
+  EXPECT_EQ(98ul, slow.NumDropped());
+  fast.Push(100);
+  EXPECT_EQ(100, slow.Pop());
+  EXPECT_EQ(0ul, fast.GetBuffer().NumPoolGrowths());
+}
+
+
+TEST(BroadcastQueueTest, TestNoAllocations)
+{
+  // Same pattern as the StateEstimator FilterLoop: the smoother manager is pushed to, and the filter
+  // manager discards, peeks and pops.
+  typedef DataManager<DepthMeasurement, BroadcastQueue<DepthMeasurement>> SharedDepthManager;
+  SharedDepthManager smoother(100, true, "smoother");
+  SharedDepthManager filter(10, true, "filter");
+  filter.ShareWith(smoother);
+
+  uint64_t allocations_after_warmup = 0;
+  for (int i = 0; i < 1000; ++i) {
+    if (i == 100) {
+      allocations_after_warmup = ThreadAllocationCount();
+    }
+    smoother.Push(DepthMeasurement(10 * i, 0.1));
+    filter.DiscardBefore(ConvertToSeconds(10 * i));
+    ASSERT_FALSE(filter.Empty());
+    EXPECT_EQ(ConvertToSeconds(10 * i), filter.Oldest());
+    filter.Pop();
+    smoother.DiscardBefore(ConvertToSeconds(10 * i));
+  }
+
+  // NOTE(milo): Only counts if built with BM_COUNT_ALLOCATIONS.
+  EXPECT_EQ(0ul, ThreadAllocationCount() - allocations_after_warmup);
+  EXPECT_EQ(0ul, smoother.NumDropped());
+  EXPECT_EQ(0ul, filter.NumDropped());
+}
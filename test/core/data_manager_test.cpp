@@ -87,3 +87,137 @@ TEST(DataManagerTest, TestAll)
   EXPECT_EQ(15ul, out.at(1).timestamp);
   EXPECT_EQ(15ul, out.at(2).timestamp);
 }
+
+
+TEST(DataManagerTest, TestLookups)
+{
+  DataManager<DepthMeasurement> m(10, true);
+  for (timestamp_t t = 10; t <= 50; t += 10) {
+    m.Push(DepthMeasurement(t, 0.1 * static_cast<double>(t)));
+  }
+
+  // Nearest measurement in time.
+  DepthMeasurement nearest(0, 0);
+  EXPECT_TRUE(m.Nearest(ConvertToSeconds(24), nearest));
+  EXPECT_EQ(20ul, nearest.timestamp);
+  EXPECT_TRUE(m.Nearest(ConvertToSeconds(26), nearest));
+  EXPECT_EQ(30ul, nearest.timestamp);
+  EXPECT_TRUE(m.Nearest(ConvertToSeconds(100), nearest));
+  EXPECT_EQ(50ul, nearest.timestamp);
+
+  // Range queries are inclusive on both ends, and don't remove anything.
+  {
+    const DataManager<DepthMeasurement>::View view = m.GetRange(ConvertToSeconds(20), ConvertToSeconds(40));
+    ASSERT_EQ(3ul, view.Size());
+    EXPECT_EQ(20ul, view.front().timestamp);
+    EXPECT_EQ(30ul, view.at(1).timestamp);
+    EXPECT_EQ(40ul, view.back().timestamp);
+  }
+  EXPECT_EQ(5ul, m.Size());
+  EXPECT_TRUE(m.GetRange(ConvertToSeconds(41), ConvertToSeconds(49)).Empty());
+
+  // Interpolate between bracketing measurements.
+  DepthMeasurement interp(0, 0);
+  EXPECT_TRUE(m.Interpolate(ConvertToSeconds(25), interp));
+  EXPECT_NEAR(2.5, interp.depth, 1e-6);
+  EXPECT_TRUE(m.Interpolate(ConvertToSeconds(50), interp));
+  EXPECT_NEAR(5.0, interp.depth, 1e-6);
+  EXPECT_FALSE(m.Interpolate(ConvertToSeconds(51), interp));
+  EXPECT_FALSE(m.Interpolate(ConvertToSeconds(9), interp));
+
+  m.DiscardUpTo(ConvertToSeconds(30));
+  EXPECT_EQ(2ul, m.Size());
+  EXPECT_EQ(ConvertToSeconds(40), m.Oldest());
+}
+
+
+TEST(DataManagerTest, TestReorder)
+{
+  DataManager<DepthMeasurement> m(100, true);
+
+  // Without a reorder window, late measurements are dropped (and counted).
+  m.Push(DepthMeasurement(ConvertToNanoseconds(1.0), 0.1));
+  m.Push(DepthMeasurement(ConvertToNanoseconds(0.9), 0.2));
+  EXPECT_EQ(1ul, m.Size());
+  EXPECT_EQ(1ul, m.NumLate());
+  m.DiscardBefore(kMaxSeconds);
+
+  // With a 0.1 sec window, anything up to 0.1 sec late gets sorted into place.
+  DataManager<DepthMeasurement> r(100, true);
+  r.SetReorderWindow(0.1);
+
+  r.Push(DepthMeasurement(ConvertToNanoseconds(1.00), 0.0));
+  r.Push(DepthMeasurement(ConvertToNanoseconds(1.04), 0.0));
+  r.Push(DepthMeasurement(ConvertToNanoseconds(1.02), 0.0));
+  EXPECT_TRUE(r.Empty());
+
+  // 1.00 and 1.02 are now more than 0.1 sec older than the newest arrival.
+  r.Push(DepthMeasurement(ConvertToNanoseconds(1.13), 0.0));
+  EXPECT_EQ(2ul, r.Size());
+  EXPECT_EQ(1.00, r.Oldest());
+  EXPECT_EQ(1.02, r.Newest());
+
+  // Too late: 1.01 is older than what was already released.
+  r.Push(DepthMeasurement(ConvertToNanoseconds(1.01), 0.0));
+  EXPECT_EQ(1ul, r.NumLate());
+
+  r.Push(DepthMeasurement(ConvertToNanoseconds(1.08), 0.0));
+  r.FlushReorderBuffer();
+
+  std::vector<DepthMeasurement> out;
+  r.PopUntil(kMaxSeconds, out);
+  ASSERT_EQ(5ul, out.size());
+  for (size_t i = 1; i < out.size(); ++i) {
+    EXPECT_LT(out.at(i - 1).timestamp, out.at(i).timestamp);
+  }
+  EXPECT_EQ(ConvertToNanoseconds(1.08), out.at(3).timestamp);
+  EXPECT_EQ(1ul, r.NumLate());
+}
+
+
+TEST(DataManagerTest, TestPushBatch)
+{
+  // A batch is queued in order, and late measurements inside it are dropped like with Push().
+  DataManager<DepthMeasurement> m(10, true);
+  m.Push(DepthMeasurement(20, 0.0));
+  const std::vector<DepthMeasurement> batch = {
+    DepthMeasurement(10, 0.0),   // Late.
+    DepthMeasurement(30, 0.0),
+    DepthMeasurement(40, 0.0),
+    DepthMeasurement(35, 0.0),   // Late.
+    DepthMeasurement(50, 0.0)
+  };
+  m.PushBatch(batch.data(), batch.size());
+  EXPECT_EQ(4ul, m.Size());
+  EXPECT_EQ(2ul, m.NumLate());
+  EXPECT_EQ(ConvertToSeconds(20), m.Oldest());
+  EXPECT_EQ(ConvertToSeconds(50), m.Newest());
+
+  // If the queue doesn't drop old items, only the start of the batch fits.
+  DataManager<DepthMeasurement> full(2, false);
+  full.PushBatch(batch.data() + 1, 4);
+  EXPECT_EQ(2ul, full.Size());
+  EXPECT_EQ(1ul, full.NumDropped());
+  EXPECT_EQ(ConvertToSeconds(40), full.Newest());
+
+  // The next batch is compared against the newest measurement that was actually queued.
+  full.DiscardBefore(kMaxSeconds);
+  const DepthMeasurement next(45, 0.0);
+  full.PushBatch(&next, 1);
+  EXPECT_EQ(1ul, full.Size());
+  EXPECT_EQ(1ul, full.NumLate());
+
+  // With a reorder window, the whole batch is sorted before anything is released.
+  DataManager<DepthMeasurement> r(100, true);
+  r.SetReorderWindow(0.1);
+  const std::vector<DepthMeasurement> unsorted = {
+    DepthMeasurement(ConvertToNanoseconds(1.02), 0.0),
+    DepthMeasurement(ConvertToNanoseconds(1.00), 0.0),
+    DepthMeasurement(ConvertToNanoseconds(1.13), 0.0)
+  };
+  r.PushBatch(unsorted.data(), unsorted.size());
+  EXPECT_EQ(2ul, r.Size());
+  EXPECT_EQ(1.00, r.Oldest());
+  EXPECT_EQ(1.02, r.Newest());
+  EXPECT_EQ(0ul, r.NumLate());
+}
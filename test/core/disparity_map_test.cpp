@@ -0,0 +1,38 @@
+#include "gtest/gtest.h"
+
+#include "vision_core/disparity_map.hpp"
+
+using namespace bm::core;
+
+
+TEST(DisparityMapTest, TestQuery)
+{
+  DisparityMap map;
+  map.disp = Image1f(20, 30, 4.0f);
+  map.cost = Image1f(20, 30, 0.1f);
+  map.valid = Image1b(20, 30, (uint8_t)255);
+  map.downsample = 2;
+
+  map.valid(5, 10) = 0;
+  map.disp(6, 10) = 0;
+  map.cost(7, 10) = 0.5f;
+
+  const VecPoint2f kps = {
+    cv::Point2f(20.5, 8.5),   // Map pixel (10, 4).
+    cv::Point2f(20.5, 10.5),  // Failed the left-right check.
+    cv::Point2f(20.5, 12.5),  // Background.
+    cv::Point2f(20.5, 14.5),  // Cost is too high.
+    cv::Point2f(60.5, 8.5),   // Outside of the map.
+  };
+
+  const std::vector<double> disps = QueryDisparity(map, kps, 0.2);
+  ASSERT_EQ(kps.size(), disps.size());
+  EXPECT_EQ(8.0, disps.at(0));
+  EXPECT_EQ(-1.0, disps.at(1));
+  EXPECT_EQ(-1.0, disps.at(2));
+  EXPECT_EQ(-1.0, disps.at(3));
+  EXPECT_EQ(-1.0, disps.at(4));
+
+  // Without a max cost, only the cost check passes.
+  EXPECT_EQ(8.0, QueryDisparity(map, kps).at(3));
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/expiration_wheel.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static std::vector<int> Sorted(std::vector<int> v)
+{
+  std::sort(v.begin(), v.end());
+  return v;
+}
+
+
+TEST(ExpirationWheelTest, TestExpire)
+{
+  ExpirationWheel<int> wheel(2);
+  std::vector<int> expired;
+
+  wheel.Advance(0, expired);
+  wheel.Touch(1);
+  wheel.Touch(2);
+  wheel.Touch(3);
+  EXPECT_EQ(3ul, wheel.Size());
+
+  // Keys last touched at tick 0 live through tick 2.
+  wheel.Advance(1, expired);
+  wheel.Touch(2);
+  wheel.Advance(2, expired);
+  wheel.Touch(3);
+  EXPECT_TRUE(expired.empty());
+
+  wheel.Advance(3, expired);
+  EXPECT_EQ(std::vector<int>({ 1 }), expired);
+  EXPECT_FALSE(wheel.Contains(1));
+
+  expired.clear();
+  wheel.Advance(4, expired);
+  EXPECT_EQ(std::vector<int>({ 2 }), expired);
+
+  expired.clear();
+  wheel.Advance(5, expired);
+  EXPECT_EQ(std::vector<int>({ 3 }), expired);
+  EXPECT_TRUE(wheel.Empty());
+}
+
+
+TEST(ExpirationWheelTest, TestTouchAndRemove)
+{
+  ExpirationWheel<int> wheel(1);
+  std::vector<int> expired;
+
+  for (int k = 0; k < 10; ++k) {
+    wheel.Touch(k);
+  }
+  wheel.Remove(3);
+  wheel.Remove(42);
+
+  // Touching a key again moves it out of the old bucket (keys get swapped around inside of it).
+  wheel.Advance(1, expired);
+  wheel.Touch(0);
+  wheel.Touch(5);
+  wheel.Touch(9);
+  wheel.Touch(9);
+
+  wheel.Advance(2, expired);
+  EXPECT_EQ(std::vector<int>({ 1, 2, 4, 6, 7, 8 }), Sorted(expired));
+  EXPECT_EQ(3ul, wheel.Size());
+  EXPECT_TRUE(wheel.Contains(0) && wheel.Contains(5) && wheel.Contains(9));
+}
+
+
+TEST(ExpirationWheelTest, TestSkipTicks)
+{
+  ExpirationWheel<int> wheel(3);
+  std::vector<int> expired;
+
+  wheel.Touch(1);
+  wheel.Advance(2, expired);
+  wheel.Touch(2);
+
+  // Jumping past the whole wheel expires everything.
+  wheel.Advance(100, expired);
+  EXPECT_EQ(std::vector<int>({ 1, 2 }), Sorted(expired));
+  EXPECT_TRUE(wheel.Empty());
+  EXPECT_EQ(100ul, wheel.Now());
+}
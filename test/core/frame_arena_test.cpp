@@ -0,0 +1,80 @@
+#include <cstdint>
+
+#include <gtest/gtest.h>
+
+#include "core/eigen_types.hpp"
+#include "core/frame_arena.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(FrameArenaTest, TestAlignment)
+{
+  FrameArena arena(256);
+
+  for (const size_t alignment : { 1ul, 2ul, 8ul, 16ul, 64ul }) {
+    arena.Allocate(3, 1);
+    const void* p = arena.Allocate(10, alignment);
+    EXPECT_EQ(0ul, reinterpret_cast<uintptr_t>(p) % alignment);
+  }
+
+  // Allocations bigger than a block still work.
+  const void* big = arena.Allocate(10000, 32);
+  EXPECT_EQ(0ul, reinterpret_cast<uintptr_t>(big) % 32);
+  EXPECT_GE(arena.BytesUsed(), 10000ul);
+}
+
+
+TEST(FrameArenaTest, TestSteadyState)
+{
+  FrameArena arena(128);
+
+  // A "frame" that needs more than the initial block.
+  const auto frame = [&arena]()
+  {
+    ArenaVector<int> ids(arena);
+    ArenaVector<Vector2d> points(arena);
+    for (int i = 0; i < 500; ++i) {
+      ids.emplace_back(i);
+      points.emplace_back(i, 2*i);
+    }
+    for (int i = 0; i < 500; ++i) {
+      EXPECT_EQ(i, ids.at(i));
+      EXPECT_EQ(2*i, points.at(i).y());
+    }
+    EXPECT_EQ(0ul, reinterpret_cast<uintptr_t>(points.data()) % alignof(Vector2d));
+  };
+
+  frame();
+  EXPECT_GT(arena.NumAllocations(), 0ul);
+  EXPECT_GT(arena.NumHeapAllocations(), 1ul);
+  arena.Reset();
+  EXPECT_EQ(0ul, arena.NumAllocations());
+  EXPECT_EQ(0ul, arena.BytesUsed());
+
+  // After the blocks are merged, the same frame doesn't touch the heap anymore.
+  const size_t num_heap = arena.NumHeapAllocations();
+  for (int i = 0; i < 10; ++i) {
+    frame();
+    arena.Reset();
+  }
+  EXPECT_EQ(num_heap, arena.NumHeapAllocations());
+}
+
+
+TEST(FrameArenaTest, TestHeapFallback)
+{
+  // Default-constructed allocators use the heap, so these work like normal vectors.
+  ArenaVector<double> v;
+  for (int i = 0; i < 100; ++i) {
+    v.emplace_back(i);
+  }
+  EXPECT_EQ(100ul, v.size());
+  EXPECT_EQ(99, v.back());
+
+  FrameArena arena;
+  ArenaVector<double> a(arena);
+  EXPECT_TRUE(a.get_allocator() != v.get_allocator());
+  EXPECT_TRUE(a.get_allocator() == ArenaAllocator<int>(arena));
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "gtest/gtest.h"
 
 #include "core/grid_lookup.hpp"
@@ -29,3 +31,55 @@ TEST(GridLookupTest, TestIndexLookupGrid)
   const auto idx3 = grid.GetRoi(roi_empty);
   ASSERT_EQ(0ul, idx3.size());
 }
+
+
+TEST(GridLookupTest, TestPackedGridLookup)
+{
+  PackedGridLookup<int> grid(4, 5);
+  ASSERT_EQ(0ul, grid.GetCell(2, 3).size());
+
+  // Cells are (col, row), like MapToGridCells().
+  const std::vector<Vector2i> cells = {
+    Vector2i(3, 2), Vector2i(0, 0), Vector2i(3, 2), Vector2i(4, 3), Vector2i(2, 1)
+  };
+  grid.BuildIndices(cells);
+  ASSERT_EQ(5ul, grid.Size());
+
+  // Items keep their order within a cell.
+  const GridSpan<int> cell = grid.GetCell(2, 3);
+  ASSERT_EQ(2ul, cell.size());
+  EXPECT_EQ(0, *cell.begin());
+  EXPECT_EQ(2, *(cell.begin() + 1));
+
+  // Should match GridLookup for any roi.
+  GridLookup<int> expected(4, 5);
+  for (size_t i = 0; i < cells.size(); ++i) {
+    expected.GetCellMutable(cells.at(i).y(), cells.at(i).x()).emplace_back(i);
+  }
+
+  std::vector<int> roi_items;
+  for (int x0 = -1; x0 < 6; ++x0) {
+    for (int y0 = -1; y0 < 5; ++y0) {
+      const Box2i roi(Vector2i(x0, y0), Vector2i(x0 + 2, y0 + 1));
+      std::list<int> l = expected.GetRoi(roi);
+      std::vector<int> e(l.begin(), l.end());
+      grid.GetRoi(roi, roi_items);
+      std::sort(e.begin(), e.end());
+      std::sort(roi_items.begin(), roi_items.end());
+      EXPECT_EQ(e, roi_items);
+
+      size_t visited = 0;
+      grid.ForEachInRoi(roi, [&visited](int) { ++visited; });
+      EXPECT_EQ(e.size(), visited);
+    }
+  }
+
+  // Building again replaces the old items.
+  grid.Build({ Vector2i(1, 1) }, { 42 });
+  EXPECT_EQ(1ul, grid.Size());
+  EXPECT_EQ(0ul, grid.GetCell(2, 3).size());
+  EXPECT_EQ(42, *grid.GetCell(1, 1).begin());
+
+  grid.Clear();
+  EXPECT_EQ(0ul, grid.GetCell(1, 1).size());
+}
@@ -0,0 +1,61 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/inproc_bus.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(InprocBusTest, TestFanOut)
+{
+  InprocBus bus;
+
+  std::vector<std::shared_ptr<const int>> a, b;
+  bus.Subscribe<int>("ints", [&a](const std::shared_ptr<const int>& msg) { a.emplace_back(msg); });
+  bus.Subscribe<int>("ints", [&b](const std::shared_ptr<const int>& msg) { b.emplace_back(msg); });
+  EXPECT_EQ(2ul, bus.NumSubscribers("ints"));
+  EXPECT_EQ(0ul, bus.NumSubscribers("other"));
+
+  // Nobody is listening on this topic.
+  bus.Publish<int>("other", std::make_shared<const int>(0));
+
+  bus.Publish<int>("ints", std::make_shared<const int>(1));
+  bus.Publish<int>("ints", std::make_shared<const int>(2));
+
+  ASSERT_EQ(2ul, a.size());
+  ASSERT_EQ(2ul, b.size());
+  EXPECT_EQ(2, *a.at(1));
+
+  // Both subscribers got the same message (not a copy).
+  EXPECT_EQ(a.at(0).get(), b.at(0).get());
+}
+
+
+TEST(InprocBusTest, TestQueued)
+{
+  InprocBus bus;
+
+  std::atomic<int> sum{0};
+  std::atomic<bool> other_thread{false};
+  const std::thread::id publisher = std::this_thread::get_id();
+
+  bus.Subscribe<int>("ints", [&](const std::shared_ptr<const int>& msg)
+  {
+    other_thread = (std::this_thread::get_id() != publisher);
+    sum += *msg;
+  }, 10);
+
+  for (int i = 1; i <= 4; ++i) {
+    bus.Publish<int>("ints", std::make_shared<const int>(i));
+  }
+
+  for (int i = 0; i < 100 && sum < 10; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(10, sum);
+  EXPECT_TRUE(other_thread);
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/landmark_map.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(LandmarkMapTest, TestMerge)
+{
+  LandmarkMap::Params params;
+  params.max_landmarks = 10;
+  params.voxel_size = 1.0;
+  params.merge_radius = 0.1;
+  LandmarkMap map(params);
+
+  EXPECT_EQ(1ul, map.Update(1, Vector3d(0.98, 0, 0), 0));
+  EXPECT_EQ(2ul, map.Update(2, Vector3d(5, 0, 0), 0));
+
+  // Close to landmark 1 (but in the next voxel), so it's merged into it.
+  EXPECT_EQ(1ul, map.Update(3, Vector3d(1.02, 0, 0), 1));
+  EXPECT_EQ(2ul, map.Size());
+  EXPECT_EQ(1ul, map.NumMerged());
+
+  Vector3d t;
+  ASSERT_TRUE(map.Get(3, t));
+  EXPECT_NEAR(1.0, t.x(), 1e-9);
+
+  // The alias keeps working, even if the landmark moves away from where it was merged.
+  EXPECT_EQ(1ul, map.Update(3, Vector3d(1.5, 0, 0), 2));
+  EXPECT_FALSE(map.Get(4, t));
+}
+
+
+TEST(LandmarkMapTest, TestRadiusQuery)
+{
+  LandmarkMap::Params params;
+  params.max_landmarks = 1000;
+  params.voxel_size = 0.5;
+  params.merge_radius = 0;
+  LandmarkMap map(params);
+
+  std::vector<Vector3d> points;
+  for (int ix = -5; ix <= 5; ++ix) {
+    for (int iy = -5; iy <= 5; ++iy) {
+      points.emplace_back(0.3 * ix, 0.3 * iy, 1.0);
+      map.Update(points.size(), points.back(), 0);
+    }
+  }
+
+  const Vector3d center(0.2, -0.1, 1.1);
+  for (const double radius : { 0.05, 0.4, 1.0, 100.0 }) {
+    std::vector<core::uid_t> ids;
+    std::vector<Vector3d> t_world_lmks;
+    const size_t n = map.RadiusQuery(center, radius, &ids, &t_world_lmks);
+
+    std::vector<core::uid_t> expected;
+    for (size_t i = 0; i < points.size(); ++i) {
+      if ((points[i] - center).norm() <= radius) {
+        expected.emplace_back(i + 1);
+      }
+    }
+    std::sort(ids.begin(), ids.end());
+    EXPECT_EQ(expected.size(), n);
+    EXPECT_EQ(expected, ids);
+    EXPECT_EQ(n, t_world_lmks.size());
+  }
+}
+
+
+TEST(LandmarkMapTest, TestEvict)
+{
+  LandmarkMap::Params params;
+  params.max_landmarks = 100;
+  params.voxel_size = 1.0;
+  params.merge_radius = 0.01;
+  params.evict_fraction = 0.1;
+  LandmarkMap map(params);
+
+  // Drive along x, leaving a landmark every 0.1m.
+  for (int i = 0; i < 1000; ++i) {
+    const Vector3d t_world_body(0.1 * i, 0, 0);
+    map.SetVehiclePosition(t_world_body);
+    map.Update(i, t_world_body + Vector3d(0, 1, 0), 0.1 * i);
+    EXPECT_LE(map.Size(), 100ul);
+  }
+  EXPECT_GT(map.NumEvicted(), 800ul);
+
+  // The landmarks around the vehicle are still there, and the old ones are gone.
+  Vector3d t;
+  EXPECT_TRUE(map.Get(999, t));
+  EXPECT_TRUE(map.Get(950, t));
+  EXPECT_FALSE(map.Get(0, t));
+  EXPECT_EQ(0ul, map.RadiusQuery(Vector3d(10, 1, 0), 5.0, nullptr, nullptr));
+
+  // Memory doesn't grow once the map is full.
+  const size_t bytes = map.MemoryBytes();
+  for (int i = 1000; i < 5000; ++i) {
+    map.SetVehiclePosition(Vector3d(0.1 * i, 0, 0));
+    map.Update(i, Vector3d(0.1 * i, 1, 0), 0.1 * i);
+  }
+  EXPECT_LE(map.MemoryBytes(), 2 * bytes);
+
+  map.Clear();
+  EXPECT_EQ(0ul, map.Size());
+  EXPECT_FALSE(map.Get(4999, t));
+}
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include "core/latency_trace.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(LatencyTraceTest, TestStages)
+{
+  LatencyTracer tracer(4, 1000);
+
+  tracer.Begin(1000000, 7, "receive", 10);
+  EXPECT_TRUE(tracer.Stamp(1000000, "decode", 20));
+
+  // Timestamps that went through seconds_t might be off by a little bit.
+  EXPECT_TRUE(tracer.Stamp(1000000 + 300, "frontend", 35));
+  EXPECT_FALSE(tracer.Stamp(1000000 + 5000, "frontend", 35));
+
+  LatencyTrace trace;
+  EXPECT_TRUE(tracer.Finish(999900, "publish", trace, 50));
+  EXPECT_EQ(0ul, tracer.NumOpen());
+
+  EXPECT_EQ(1000000ul, trace.timestamp);
+  EXPECT_EQ(7ul, trace.seq);
+  ASSERT_EQ(4ul, trace.stages.size());
+  EXPECT_EQ("receive", trace.stages.at(0).first);
+  EXPECT_EQ("decode", trace.stages.at(1).first);
+  EXPECT_EQ("frontend", trace.stages.at(2).first);
+  EXPECT_EQ("publish", trace.stages.at(3).first);
+  EXPECT_EQ(50, trace.stages.at(3).second);
+
+  // Already finished.
+  EXPECT_FALSE(tracer.Finish(1000000, "publish", trace, 60));
+}
+
+
+TEST(LatencyTraceTest, TestDropOldest)
+{
+  LatencyTracer tracer(2, 0);
+  tracer.Begin(1, 0, "receive", 0);
+  tracer.Begin(2, 1, "receive", 0);
+  tracer.Begin(3, 2, "receive", 0);
+  EXPECT_EQ(2ul, tracer.NumOpen());
+
+  // The oldest frame (e.g one that never became a keyframe) was dropped.
+  EXPECT_FALSE(tracer.Stamp(1, "decode"));
+  EXPECT_TRUE(tracer.Stamp(2, "decode"));
+  EXPECT_TRUE(tracer.Stamp(3, "decode"));
+}
@@ -0,0 +1,68 @@
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/latest_value.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(LatestValueTest, TestOverwrite)
+{
+  LatestValue<int> v;
+  int out = -1;
+  EXPECT_FALSE(v.HasNew());
+  EXPECT_FALSE(v.Read(out));
+
+  v.Write(1);
+  v.Write(2);
+  v.Write(3);
+  EXPECT_TRUE(v.HasNew());
+
+  // Only the newest value should be seen, and only once.
+  EXPECT_TRUE(v.Read(out));
+  EXPECT_EQ(3, out);
+  EXPECT_FALSE(v.Read(out));
+  EXPECT_EQ(3, out);
+
+  v.Write(4);
+  EXPECT_TRUE(v.Read(out));
+  EXPECT_EQ(4, out);
+}
+
+
+TEST(LatestValueTest, TestWaitTimeout)
+{
+  LatestValue<int> v;
+  int out = -1;
+  EXPECT_FALSE(v.WaitAndRead(out, 0.01));
+  EXPECT_EQ(-1, out);
+}
+
+
+TEST(LatestValueTest, TestProducerConsumer)
+{
+  LatestValue<std::pair<int, int>> v;
+  const int N = 100000;
+
+  std::thread producer([&]() {
+    for (int i = 1; i <= N; ++i) {
+      v.Write(std::make_pair(i, -i));
+    }
+  });
+
+  // Values should never be torn, and should never go backwards.
+  int last = 0;
+  std::pair<int, int> out;
+  while (last < N) {
+    if (v.WaitAndRead(out, 0.1)) {
+      EXPECT_EQ(out.first, -out.second);
+      EXPECT_GT(out.first, last);
+      last = out.first;
+    }
+  }
+
+  producer.join();
+  EXPECT_EQ(N, last);
+}
@@ -0,0 +1,104 @@
+#include <fstream>
+
+#include <utime.h>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/params_snapshot.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+struct TunableParams final : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(TunableParams);
+
+  int max_features_per_frame = 0;
+  float filter_publish_hz = 0;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    parser.GetParam("max_features_per_frame", &max_features_per_frame);
+    parser.GetParam("filter_publish_hz", &filter_publish_hz);
+  }
+};
+
+
+static void WriteParams(const std::string& filepath, int max_features_per_frame, float filter_publish_hz)
+{
+  std::ofstream out(filepath);
+  out << "%YAML:1.0\n\n";
+  out << "max_features_per_frame: " << max_features_per_frame << "\n";
+  out << "filter_publish_hz: " << filter_publish_hz << "\n";
+}
+
+
+TEST(ParamsSnapshotTest, TestReload)
+{
+  const std::string filepath = "/tmp/params_snapshot_test.yaml";
+  WriteParams(filepath, 200, 50.0);
+
+  ParamsSnapshot<TunableParams> snapshot(filepath);
+  EXPECT_EQ(1ul, snapshot.Version());
+  EXPECT_GE(snapshot.LoadMs(), 0);
+
+  ParamsSnapshot<TunableParams>::Reader reader(snapshot);
+  EXPECT_EQ(200, reader->max_features_per_frame);
+  EXPECT_EQ(50.0, reader->filter_publish_hz);
+  EXPECT_FALSE(reader.Refresh());
+
+  // Readers keep their snapshot until they refresh.
+  const auto old = snapshot.Get();
+  WriteParams(filepath, 100, 10.0);
+  snapshot.Reload();
+  EXPECT_EQ(2ul, snapshot.Version());
+  EXPECT_EQ(200, reader->max_features_per_frame);
+  EXPECT_EQ(200, old->max_features_per_frame);
+
+  EXPECT_TRUE(reader.Refresh());
+  EXPECT_EQ(100, reader->max_features_per_frame);
+  EXPECT_EQ(10.0, reader->filter_publish_hz);
+  EXPECT_FALSE(reader.Refresh());
+}
+
+
+TEST(ParamsSnapshotTest, TestReloadIfModified)
+{
+  const std::string filepath = "/tmp/params_snapshot_modified_test.yaml";
+  WriteParams(filepath, 200, 50.0);
+
+  ParamsSnapshot<TunableParams> snapshot(filepath);
+  EXPECT_FALSE(snapshot.ReloadIfModified());
+
+  // NOTE(milo): Modification times only have a resolution of one second, so move it forward.
+  WriteParams(filepath, 150, 20.0);
+  struct utimbuf times;
+  times.actime = LastWriteTime(filepath) + 10;
+  times.modtime = times.actime;
+  ASSERT_EQ(0, utime(filepath.c_str(), &times));
+
+  EXPECT_TRUE(snapshot.ReloadIfModified());
+  EXPECT_EQ(150, snapshot.Get()->max_features_per_frame);
+  EXPECT_FALSE(snapshot.ReloadIfModified());
+}
+
+
+TEST(ParamsSnapshotTest, TestPublish)
+{
+  TunableParams params;
+  params.max_features_per_frame = 300;
+
+  ParamsSnapshot<TunableParams> snapshot(params);
+  ParamsSnapshot<TunableParams>::Reader reader(snapshot);
+  EXPECT_EQ(300, reader->max_features_per_frame);
+
+  params.max_features_per_frame = 50;
+  snapshot.Publish(params);
+  EXPECT_TRUE(reader.Refresh());
+  EXPECT_EQ(50, (*reader).max_features_per_frame);
+}
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include "core/publish_scheduler.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(PublishSchedulerTest, TestCoalesce)
+{
+  PublishScheduler::Params params;
+  PublishScheduler scheduler(params);
+
+  int num_sent = 0;
+  int latest = 0, sent_value = 0;
+  const PublishScheduler::ChannelId id = scheduler.AddChannel("pose", PublishPriority::CRITICAL, 10.0, 10.0,
+      [&]() { ++num_sent; sent_value = latest; return 100; });
+
+  // Nothing to publish yet.
+  EXPECT_EQ(0, scheduler.Poll(0.0));
+
+  latest = 1;
+  scheduler.MarkPending(id);
+  EXPECT_EQ(1, scheduler.Poll(0.0));
+  EXPECT_EQ(1, sent_value);
+
+  // Too soon (10Hz) for the next one, but the newest value goes out once it's due.
+  latest = 2;
+  scheduler.MarkPending(id);
+  latest = 3;
+  scheduler.MarkPending(id);
+  EXPECT_EQ(0, scheduler.Poll(0.05));
+  EXPECT_EQ(1, scheduler.Poll(0.1));
+  EXPECT_EQ(3, sent_value);
+  EXPECT_EQ(2, num_sent);
+
+  // Nothing new.
+  EXPECT_EQ(0, scheduler.Poll(0.5));
+}
+
+
+TEST(PublishSchedulerTest, TestPriority)
+{
+  PublishScheduler::Params params;
+  params.link_max_bytes_per_sec = 10000;
+  params.burst_sec = 0.1;             // 1000 byte bucket.
+  PublishScheduler scheduler(params);
+
+  std::vector<std::string> order;
+  const PublishScheduler::ChannelId viz = scheduler.AddChannel("viz", PublishPriority::VISUALIZATION, 20.0, 1.0,
+      [&]() { order.emplace_back("viz"); return 600; });
+  const PublishScheduler::ChannelId pose = scheduler.AddChannel("pose", PublishPriority::CRITICAL, 0, 0,
+      [&]() { order.emplace_back("pose"); return 600; });
+
+  // The pose goes first, even though it was added last. Both fit in the first burst, since the
+  // size of the viz message isn't known yet.
+  scheduler.MarkPending(viz);
+  scheduler.MarkPending(pose);
+  EXPECT_EQ(2, scheduler.Poll(0.0));
+  ASSERT_EQ(2ul, order.size());
+  EXPECT_EQ("pose", order.at(0));
+  EXPECT_EQ("viz", order.at(1));
+
+  // Now the bucket is empty. The pose still goes out, but the viz channel has to wait (and slows down).
+  order.clear();
+  scheduler.MarkPending(viz);
+  scheduler.MarkPending(pose);
+  EXPECT_EQ(1, scheduler.Poll(0.05));
+  ASSERT_EQ(1ul, order.size());
+  EXPECT_EQ("pose", order.at(0));
+  EXPECT_EQ(10.0, scheduler.ChannelHz(viz));
+
+  // Once the budget refills, the viz channel catches up (and speeds up again).
+  order.clear();
+  EXPECT_EQ(1, scheduler.Poll(0.3));
+  ASSERT_EQ(1ul, order.size());
+  EXPECT_EQ("viz", order.at(0));
+}
+
+
+TEST(PublishSchedulerTest, TestPublishFailed)
+{
+  PublishScheduler::Params params;
+  params.link_min_bytes_per_sec = 100;
+  PublishScheduler scheduler(params);
+  EXPECT_EQ(0, scheduler.LinkCapacity());
+
+  bool fail = true;
+  const PublishScheduler::ChannelId id = scheduler.AddChannel("mesh", PublishPriority::NORMAL, 0, 0,
+      [&]() { return fail ? -1 : 50; });
+
+  // A failure means the link is saturated, so it starts being budgeted. The value is retried.
+  scheduler.MarkPending(id);
+  EXPECT_EQ(0, scheduler.Poll(0.0));
+  EXPECT_EQ(100, scheduler.LinkCapacity());
+
+  fail = false;
+  EXPECT_EQ(1, scheduler.Poll(2.0));
+
+  // The capacity estimate grows again while publishing succeeds.
+  EXPECT_GT(scheduler.LinkCapacity(), 100);
+}
+
+
+TEST(PublishSchedulerTest, TestSetMaxHz)
+{
+  PublishScheduler::Params params;
+  PublishScheduler scheduler(params);
+
+  int num_sent = 0;
+  const PublishScheduler::ChannelId id = scheduler.AddChannel("pose", PublishPriority::CRITICAL, 10.0, 0,
+      [&]() { ++num_sent; return 100; });
+  EXPECT_EQ(10.0, scheduler.ChannelHz(id));
+
+  scheduler.MarkPending(id);
+  EXPECT_EQ(1, scheduler.Poll(0.0));
+
+  // At 2Hz, the next one isn't due for 0.5 sec.
+  scheduler.SetMaxHz(id, 2.0);
+  EXPECT_EQ(2.0, scheduler.ChannelHz(id));
+  scheduler.MarkPending(id);
+  EXPECT_EQ(0, scheduler.Poll(0.2));
+  EXPECT_EQ(1, scheduler.Poll(0.5));
+  EXPECT_EQ(2, num_sent);
+}
@@ -0,0 +1,119 @@
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/broadcast_queue.hpp"
+#include "core/queue_telemetry.hpp"
+#include "core/spsc_queue.hpp"
+#include "core/stats_tracker.hpp"
+#include "core/thread_safe_queue.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Pushes 4 items into a queue of size 3, waits, and then pops everything.
+template <typename QueueT>
+static void PushWaitPop(QueueT& q)
+{
+  for (int i = 0; i < 4; ++i) {
+    q.Push(i);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  int item;
+  while (q.PopIfNonEmpty(item)) {}
+}
+
+
+template <typename QueueT>
+static void CheckTelemetry(QueueT& q, uint64_t num_pushed)
+{
+  PushWaitPop(q);
+
+  const QueueTelemetry& t = q.Telemetry();
+  EXPECT_EQ(num_pushed, t.NumPushed());
+  EXPECT_EQ(3ul, t.NumPopped());
+  EXPECT_EQ(3ul, t.HighWater());
+  EXPECT_EQ(0ul, t.Depth());
+  EXPECT_EQ(1ul, q.NumDropped());
+
+  // Every item waited at least 20ms between its push and its pop.
+  EXPECT_EQ(3ul, t.DwellMs().Count());
+  EXPECT_GE(t.DwellMs().Min(), 0.97 * 20.0);
+  EXPECT_LT(t.DwellMs().Max(), 1000.0);
+}
+
+
+TEST(QueueTelemetryTest, TestThreadsafeQueue)
+{
+  // The oldest item is dropped to make room for the 4th.
+  ThreadsafeQueue<int> q(3, true, "test");
+  CheckTelemetry(q, 4);
+}
+
+
+TEST(QueueTelemetryTest, TestSpscQueue)
+{
+  // The consumer discards the excess item, so all 4 were pushed.
+  SpscQueue<int> q(3, true, "test");
+  CheckTelemetry(q, 4);
+}
+
+
+TEST(QueueTelemetryTest, TestBroadcastQueue)
+{
+  // The 1st item was overwritten in the buffer before this consumer fetched it.
+  BroadcastQueue<int> q(3, true, "test");
+  CheckTelemetry(q, 3);
+}
+
+
+TEST(QueueTelemetryTest, TestSharedBroadcastQueue)
+{
+  // Each consumer of a shared buffer has its own telemetry.
+  BroadcastQueue<int> a(10, true);
+  BroadcastQueue<int> b(10, true);
+  b.ShareWith(a);
+
+  a.Push(1);
+  a.Push(2);
+  EXPECT_EQ(1, a.Pop());
+  EXPECT_EQ(2ul, a.Telemetry().NumPushed());
+  EXPECT_EQ(1ul, a.Telemetry().NumPopped());
+  EXPECT_EQ(0ul, b.Telemetry().NumPushed());
+
+  EXPECT_EQ(2ul, b.ConsumerSize());
+  b.PopFront(2);
+  EXPECT_EQ(2ul, b.Telemetry().NumPushed());
+  EXPECT_EQ(2ul, b.Telemetry().NumPopped());
+  EXPECT_EQ(2ul, b.Telemetry().HighWater());
+}
+
+
+TEST(QueueTelemetryTest, TestExport)
+{
+  ThreadsafeQueue<int> q(3, true, "test");
+  PushWaitPop(q);
+  q.Push(5);
+
+  StatsTracker stats("test", 10);
+  ExportQueueTelemetry(stats, "test", q);
+  EXPECT_EQ(5, stats.Counter("Queue/test/pushed").load());
+  EXPECT_EQ(3, stats.Counter("Queue/test/popped").load());
+  EXPECT_EQ(1, stats.Counter("Queue/test/dropped").load());
+
+  const StatsSnapshot snapshot = stats.Snapshot();
+  bool found_depth = false, found_dwell = false;
+  for (const auto& gauge : snapshot.gauges) {
+    if (gauge.first == "Queue/test/depth") {
+      found_depth = true;
+      EXPECT_EQ(1.0, gauge.second);
+    } else if (gauge.first == "Queue/test/dwell_p99_ms") {
+      found_dwell = true;
+      EXPECT_GE(gauge.second, 0.97 * 20.0);
+    }
+  }
+  EXPECT_TRUE(found_depth);
+  EXPECT_TRUE(found_dwell);
+}
@@ -0,0 +1,149 @@
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/philox.hpp"
+#include "core/random.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Known answers from the Random123 distribution (kat_vectors).
+TEST(RandomTest, TestPhiloxKnownAnswers)
+{
+  const Philox4x32 zeros(0, 0, 0, 0, 0, 0);
+  EXPECT_EQ(0x6627e8d5u, zeros.v[0]);
+  EXPECT_EQ(0xe169c58du, zeros.v[1]);
+  EXPECT_EQ(0xbc57ac4cu, zeros.v[2]);
+  EXPECT_EQ(0x9b00dbd8u, zeros.v[3]);
+
+  const uint32_t f = 0xffffffffu;
+  const Philox4x32 ones(f, f, f, f, f, f);
+  EXPECT_EQ(0x408f276du, ones.v[0]);
+  EXPECT_EQ(0x41c83b0eu, ones.v[1]);
+  EXPECT_EQ(0xa20bc7c6u, ones.v[2]);
+  EXPECT_EQ(0x6d5451fdu, ones.v[3]);
+}
+
+
+TEST(RandomTest, TestStreamsReproducible)
+{
+  RandomStream a(123, 0), b(123, 0), c(123, 1), d(124, 0);
+  int num_same_stream = 0, num_same_seed = 0;
+  for (int i = 0; i < 100; ++i) {
+    const uint32_t x = a.NextUint();
+    EXPECT_EQ(x, b.NextUint());
+    num_same_stream += (x == c.NextUint()) ? 1 : 0;
+    num_same_seed += (x == d.NextUint()) ? 1 : 0;
+  }
+  EXPECT_EQ(0, num_same_stream);
+  EXPECT_EQ(0, num_same_seed);
+}
+
+
+TEST(RandomTest, TestFillUniform)
+{
+  // Sizes that aren't a multiple of the block size use part of one more block.
+  for (const size_t n : { 0ul, 3ul, 4ul, 1001ul }) {
+    std::vector<float> vf(n);
+    std::vector<double> vd(n);
+    RandomStream rng(7);
+    rng.FillUniform(vf.data(), n, -2.0f, 3.0f);
+    rng.FillUniform(vd.data(), n, -2.0, 3.0);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_GE(vf.at(i), -2.0f);
+      EXPECT_LT(vf.at(i), 3.0f);
+      EXPECT_GE(vd.at(i), -2.0);
+      EXPECT_LT(vd.at(i), 3.0);
+    }
+  }
+
+  // The same seed fills the same values.
+  std::vector<float> v1(100), v2(100);
+  RandomStream(5).FillUniform(v1.data(), v1.size(), 0.0f, 1.0f);
+  RandomStream(5).FillUniform(v2.data(), v2.size(), 0.0f, 1.0f);
+  EXPECT_EQ(v1, v2);
+
+  std::vector<double> big(100000);
+  RandomStream(9).FillUniform(big.data(), big.size(), 0.0, 1.0);
+  double mean = 0;
+  for (const double x : big) { mean += x; }
+  mean /= big.size();
+  EXPECT_NEAR(0.5, mean, 0.01);
+}
+
+
+TEST(RandomTest, TestFillNormal)
+{
+  const size_t n = 100001;
+  std::vector<float> vf(n);
+  std::vector<double> vd(n);
+  RandomStream rng(11);
+  rng.FillNormal(vf.data(), n, 1.0f, 2.0f);
+  rng.FillNormal(vd.data(), n, 1.0, 2.0);
+
+  double mean_f = 0, mean_d = 0, var_f = 0, var_d = 0;
+  for (size_t i = 0; i < n; ++i) {
+    ASSERT_TRUE(std::isfinite(vf.at(i)));
+    ASSERT_TRUE(std::isfinite(vd.at(i)));
+    mean_f += vf.at(i);
+    mean_d += vd.at(i);
+  }
+  mean_f /= n;
+  mean_d /= n;
+  for (size_t i = 0; i < n; ++i) {
+    var_f += (vf.at(i) - mean_f) * (vf.at(i) - mean_f);
+    var_d += (vd.at(i) - mean_d) * (vd.at(i) - mean_d);
+  }
+  EXPECT_NEAR(1.0, mean_f, 0.03);
+  EXPECT_NEAR(1.0, mean_d, 0.03);
+  EXPECT_NEAR(2.0, std::sqrt(var_f / n), 0.03);
+  EXPECT_NEAR(2.0, std::sqrt(var_d / n), 0.03);
+
+  // One at a time too.
+  double mean = 0;
+  for (int i = 0; i < 10000; ++i) { mean += rng.Normald(-3.0, 0.5); }
+  EXPECT_NEAR(-3.0, mean / 10000, 0.03);
+}
+
+
+TEST(RandomTest, TestSetRandomSeed)
+{
+  SetRandomSeed(42);
+  const double a = RandomUniformd(0, 1);
+  const Vector3d u = RandomUnit3d();
+  EXPECT_NEAR(1.0, u.norm(), 1e-9);
+
+  SetRandomSeed(42);
+  EXPECT_EQ(a, RandomUniformd(0, 1));
+  EXPECT_EQ(u, RandomUnit3d());
+}
+
+
+// Each thread draws from its own stream, so there's no data race (run with -fsanitize=thread), and
+// the threads don't all get the same numbers.
+TEST(RandomTest, TestThreads)
+{
+  SetRandomSeed(1);
+  const int num_threads = 4;
+  std::vector<std::vector<double>> draws(num_threads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&draws, t]()
+    {
+      for (int i = 0; i < 1000; ++i) {
+        draws.at(t).emplace_back(RandomUniformd(0, 1));
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+
+  for (int t = 1; t < num_threads; ++t) {
+    EXPECT_NE(draws.at(0), draws.at(t));
+  }
+}
@@ -0,0 +1,127 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "core/notifier.hpp"
+#include "core/resource_sampler.hpp"
+#include "core/thread_util.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static bool FindGauge(const StatsSnapshot& snapshot, const std::string& name, double& value)
+{
+  for (const auto& gauge : snapshot.gauges) {
+    if (gauge.first == name) {
+      value = gauge.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Whether the sampled thread has named itself and used at least one tick of CPU.
+static bool FoundBusyThread(const std::string& name)
+{
+  std::vector<ThreadCpuTime> threads;
+  if (!ResourceSampler::ReadThreadCpuTimes(threads)) {
+    return false;
+  }
+  for (const ThreadCpuTime& thread : threads) {
+    if (thread.name == name && thread.cpu_sec > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+TEST(ResourceSamplerTest, TestThreadCpuTimes)
+{
+  std::atomic<bool> ready(false);
+  std::atomic<bool> done(false);
+  Notifier notifier;
+
+  // NOTE(milo): The thread keeps spinning after it's ready, so that it's still alive when sampled.
+  std::thread t([&]() {
+    ConfigureCurrentThread(ThreadConfig(), "test_sampled");
+    while (!done) {
+      if (!ready && FoundBusyThread("test_sampled")) {
+        ready = true;
+        notifier.Notify();
+      }
+    }
+  });
+
+  const bool is_ready = notifier.Wait([&]() { return ready.load(); }, 10.0);
+
+  std::vector<ThreadCpuTime> threads;
+  const bool did_read = ResourceSampler::ReadThreadCpuTimes(threads);
+  done = true;
+  t.join();
+
+  ASSERT_TRUE(is_ready);
+  ASSERT_TRUE(did_read);
+
+  bool found = false;
+  for (const ThreadCpuTime& thread : threads) {
+    if (thread.name == "test_sampled") {
+      found = true;
+      EXPECT_GT(thread.cpu_sec, 0.0);
+    }
+  }
+  EXPECT_TRUE(found);
+
+  // NOTE(milo): Read the current RSS before the peak, since it can grow in between. The two come
+  // from different sources (statm in pages, getrusage in kB), so allow a few pages of slack.
+  const double rss_bytes = ResourceSampler::ReadRssBytes();
+  const double peak_rss_bytes = ResourceSampler::ReadPeakRssBytes();
+  const double page_bytes = static_cast<double>(sysconf(_SC_PAGESIZE));
+  EXPECT_GT(rss_bytes, 0.0);
+  EXPECT_GT(peak_rss_bytes, 0.0);
+  EXPECT_GE(peak_rss_bytes, rss_bytes - 16 * page_bytes);
+}
+
+
+TEST(ResourceSamplerTest, TestGauges)
+{
+  StatsTracker stats("ResourceSamplerTest", 10);
+  ResourceSampler sampler(0);
+  sampler.AddMemorySource("pool", []() { return 3.0 * 1024 * 1024; });
+
+  // The first sample has no CPU rates yet.
+  EXPECT_TRUE(sampler.Sample(stats));
+  double value = 0;
+  EXPECT_FALSE(FindGauge(stats.Snapshot(), "Cpu/process", value));
+  ASSERT_TRUE(FindGauge(stats.Snapshot(), "Memory/pool_mb", value));
+  EXPECT_EQ(3.0, value);
+  ASSERT_TRUE(FindGauge(stats.Snapshot(), "Memory/rss_mb", value));
+  EXPECT_GT(value, 0.0);
+
+  // Spin for a bit, so that this thread shows up as busy.
+  Timer timer(true);
+  while (timer.Elapsed().seconds() < 0.1) {}
+
+  EXPECT_TRUE(sampler.Sample(stats));
+  ASSERT_TRUE(FindGauge(stats.Snapshot(), "Cpu/process", value));
+  EXPECT_GT(value, 10.0);
+}
+
+
+TEST(ResourceSamplerTest, TestInterval)
+{
+  StatsTracker stats("ResourceSamplerTest", 10);
+  ResourceSampler sampler(100.0f);
+  EXPECT_TRUE(sampler.Sample(stats));
+  EXPECT_FALSE(sampler.Sample(stats));
+
+  ResourceSampler disabled(-1.0f);
+  EXPECT_FALSE(disabled.Sample(stats));
+}
@@ -0,0 +1,81 @@
+#include <array>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/seq_lock.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Big enough that a copy takes a while, so that readers overlap with the writer.
+struct Payload final
+{
+  Payload() { values.fill(0); }
+  explicit Payload(int64_t v) { values.fill(v); }
+
+  std::array<int64_t, 256> values;
+};
+
+
+TEST(SeqLockTest, TestStoreLoad)
+{
+  SeqLock<int> v(-1);
+  EXPECT_EQ(0ul, v.Version());
+  EXPECT_EQ(-1, v.Load());
+
+  v.Store(1);
+  v.Store(2);
+  EXPECT_EQ(2ul, v.Version());
+
+  int out = 0;
+  EXPECT_EQ(2ul, v.Load(out));
+  EXPECT_EQ(2, out);
+
+  // Loads don't consume the value (see LatestValue for that).
+  EXPECT_EQ(2, v.Load());
+}
+
+
+TEST(SeqLockTest, TestManyReaders)
+{
+  SeqLock<Payload> v;
+  const int64_t N = 200000;
+  std::atomic_bool done{false};
+
+  // Readers should never see a torn value, or one that goes backwards.
+  std::vector<std::thread> readers;
+  std::atomic<int> num_torn{0};
+  for (int r = 0; r < 3; ++r) {
+    readers.emplace_back([&]() {
+      int64_t last = 0;
+      Payload out;
+      while (!done) {
+        const uint64_t version = v.Load(out);
+        for (const int64_t x : out.values) {
+          if (x != out.values.front()) {
+            ++num_torn;
+            break;
+          }
+        }
+        EXPECT_GE(out.values.front(), last);
+        EXPECT_EQ(static_cast<int64_t>(version), out.values.front());
+        last = out.values.front();
+      }
+    });
+  }
+
+  for (int64_t i = 1; i <= N; ++i) {
+    v.Store(Payload(i));
+  }
+  done = true;
+
+  for (std::thread& t : readers) {
+    t.join();
+  }
+
+  EXPECT_EQ(0, num_torn.load());
+  EXPECT_EQ(N, v.Load().values.back());
+}
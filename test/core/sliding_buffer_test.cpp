@@ -1,3 +1,5 @@
+#include <string>
+
 #include <gtest/gtest.h>
 
 #include "core/math_util.hpp"
@@ -41,3 +43,56 @@ TEST(SlidingBuffer, Test01)
   EXPECT_EQ(3, sb.Get(1));
   EXPECT_EQ(2, sb.Get(2));
 }
+
+
+TEST(SlidingBuffer, FixedSize)
+{
+  // Capacity 3 is stored in an array of 4, so this also checks the masking.
+  SlidingBuffer<int, 3> sb;
+  EXPECT_EQ(3ul, sb.Size());
+  EXPECT_EQ(0ul, sb.Added());
+
+  for (int i = 1; i <= 10; ++i) {
+    sb.Add(i);
+    EXPECT_EQ(i, sb.Head());
+    if (i >= 3) {
+      EXPECT_EQ(i - 1, sb.Get(1));
+      EXPECT_EQ(i - 2, sb.Get(2));
+    }
+  }
+  EXPECT_EQ(10ul, sb.Added());
+}
+
+
+TEST(SlidingBuffer, MoveAndEmplace)
+{
+  SlidingBuffer<std::string, 2> sb;
+  std::string s = "hello";
+  sb.Add(std::move(s));
+  sb.Emplace(3, 'x');
+  EXPECT_EQ("xxx", sb.Head());
+  EXPECT_EQ("hello", sb.Get(1));
+
+  SlidingBuffer<std::string> sb_runtime(2);
+  sb_runtime.Add(std::string("world"));
+  EXPECT_EQ("world", sb_runtime.Head());
+}
+
+
+TEST(SlidingBuffer, Release)
+{
+  SlidingBuffer<std::string, 4> sb;
+  sb.Add("a");
+  sb.Add("b");
+  sb.Add("c");
+  sb.Release(2);
+  EXPECT_EQ("", sb.Get(2));
+  EXPECT_EQ("b", sb.Get(1));
+  EXPECT_EQ("c", sb.Head());
+
+  // The released slot gets overwritten normally.
+  sb.Add("d");
+  sb.Add("e");
+  EXPECT_EQ("e", sb.Head());
+  EXPECT_EQ("b", sb.Get(3));
+}
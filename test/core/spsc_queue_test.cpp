@@ -0,0 +1,157 @@
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/depth_measurement.hpp"
+#include "core/data_manager.hpp"
+#include "core/spsc_queue.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(SpscQueueTest, TestDropOldest)
+{
+  SpscQueue<int> q(3, true);
+  EXPECT_TRUE(q.Empty());
+
+  EXPECT_TRUE(q.Push(1));
+  EXPECT_TRUE(q.Push(2));
+  EXPECT_TRUE(q.Push(3));
+  EXPECT_TRUE(q.Push(4));
+
+  // The consumer should only ever see the newest 3 items.
+  EXPECT_EQ(3ul, q.Size());
+  EXPECT_EQ(4, q.PeekBack());
+  EXPECT_EQ(2, q.PeekFront());
+  EXPECT_EQ(2, q.Pop());
+  EXPECT_EQ(3, q.Pop());
+
+  int item = 0;
+  EXPECT_TRUE(q.PopIfNonEmpty(item));
+  EXPECT_EQ(4, item);
+  EXPECT_FALSE(q.PopIfNonEmpty(item));
+  EXPECT_TRUE(q.Empty());
+}
+
+
+TEST(SpscQueueTest, TestDropNewest)
+{
+  SpscQueue<int> q(2, false);
+  EXPECT_TRUE(q.Push(1));
+  EXPECT_TRUE(q.Push(2));
+  EXPECT_FALSE(q.Push(3));
+  EXPECT_EQ(2ul, q.Size());
+  EXPECT_EQ(1, q.Pop());
+  EXPECT_EQ(2, q.Pop());
+}
+
+
+TEST(SpscQueueTest, TestProducerConsumer)
+{
+  const int N = 100000;
+  SpscQueue<int> q(64, false);
+
+  std::thread producer([&q]() {
+    for (int i = 0; i < N; ++i) {
+      while (!q.Push(i)) {}
+    }
+  });
+
+  // Every item should come out exactly once, in order.
+  int expected = 0;
+  int item;
+  while (expected < N) {
+    if (q.PopIfNonEmpty(item)) {
+      ASSERT_EQ(expected, item);
+      ++expected;
+    }
+  }
+
+  producer.join();
+  EXPECT_TRUE(q.Empty());
+}
+
+
+TEST(SpscQueueTest, TestDataManager)
+{
+  DataManager<DepthMeasurement, SpscQueue<DepthMeasurement>> m(3, true);
+
+  m.Push(DepthMeasurement(123, 0.3));
+  m.Push(DepthMeasurement(124, 0.3));
+  m.Push(DepthMeasurement(125, 0.3));
+  m.Push(DepthMeasurement(126, 0.3));
+
+  EXPECT_EQ(3ul, m.Size());
+  EXPECT_EQ(ConvertToSeconds(126), m.Newest());
+  EXPECT_EQ(ConvertToSeconds(124), m.Oldest());
+
+  std::vector<DepthMeasurement> out;
+  m.PopUntil(ConvertToSeconds(125), out);
+  EXPECT_EQ(2ul, out.size());
+  EXPECT_EQ(1ul, m.Size());
+
+  m.DiscardBefore(kMaxSeconds);
+  EXPECT_TRUE(m.Empty());
+
+  // Pushing after the queue has emptied out only needs to be ordered w.r.t the last push.
+  m.Push(DepthMeasurement(130, 0.3));
+  EXPECT_EQ(ConvertToSeconds(130), m.Newest());
+}
+
+
+TEST(SpscQueueTest, TestBlocking)
+{
+  SpscQueue<int> q(4, true);
+
+  // Should time out with nothing in the queue.
+  int item = 0;
+  EXPECT_FALSE(q.WaitNotEmpty(0.01));
+  EXPECT_FALSE(q.PopBlocking(item, 0.01));
+
+  // The consumer should wake up as soon as the producer pushes.
+  std::thread producer([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Push(7);
+  });
+  EXPECT_TRUE(q.PopBlocking(item));
+  EXPECT_EQ(7, item);
+  producer.join();
+
+  // Closing the queue should wake up a waiting consumer.
+  std::thread closer([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Close();
+  });
+  EXPECT_FALSE(q.WaitNotEmpty());
+  EXPECT_TRUE(q.IsClosed());
+  closer.join();
+}
+
+
+TEST(ThreadsafeQueueTest, TestBlocking)
+{
+  ThreadsafeQueue<int> q(4, true);
+
+  int item = 0;
+  EXPECT_FALSE(q.PopBlocking(item, 0.01));
+
+  std::thread producer([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Push(3);
+    q.Push(4);
+  });
+  EXPECT_TRUE(q.PopBlocking(item));
+  EXPECT_EQ(3, item);
+  producer.join();
+
+  std::thread consumer([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Pop();
+  });
+  EXPECT_TRUE(q.WaitEmpty());
+  consumer.join();
+
+  q.Close();
+  EXPECT_FALSE(q.WaitNotEmpty());
+}
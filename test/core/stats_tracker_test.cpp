@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/latency_histogram.hpp"
+#include "core/stats_tracker.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(StatsTrackerTest, TestHistogramPercentiles)
+{
+  LatencyHistogram h;
+  EXPECT_EQ(0ul, h.Count());
+  EXPECT_EQ(0, h.Percentile(0.5));
+
+  // Uniform samples from 1 to 1000 ms.
+  for (int i = 1; i <= 1000; ++i) {
+    h.Record(static_cast<double>(i));
+  }
+
+  EXPECT_EQ(1000ul, h.Count());
+  EXPECT_NEAR(1.0, h.Min(), 1e-6);
+  EXPECT_NEAR(1000.0, h.Max(), 1e-6);
+  EXPECT_NEAR(500.5, h.Mean(), 1e-3);
+
+  // Buckets have about 3% relative error.
+  EXPECT_NEAR(500.0, h.Percentile(0.5), 0.03 * 500.0);
+  EXPECT_NEAR(900.0, h.Percentile(0.9), 0.03 * 900.0);
+  EXPECT_NEAR(990.0, h.Percentile(0.99), 0.03 * 990.0);
+  EXPECT_NEAR(999.0, h.Percentile(0.999), 0.03 * 999.0);
+
+  h.Reset();
+  EXPECT_EQ(0ul, h.Count());
+}
+
+
+TEST(StatsTrackerTest, TestConcurrentRecord)
+{
+  LatencyHistogram h;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&h]() {
+      for (int i = 0; i < 10000; ++i) { h.Record(1.0); }
+    });
+  }
+  for (std::thread& t : threads) { t.join(); }
+  EXPECT_EQ(40000ul, h.Count());
+}
+
+
+TEST(StatsTrackerTest, TestSnapshot)
+{
+  StatsTracker stats("test", 10);
+
+  for (int i = 0; i < 100; ++i) {
+    stats.Add("latency", 5.0f);
+  }
+  stats.Increment("dropped_frames");
+  stats.Increment("dropped_frames", 2);
+  stats.SetGauge("queue_depth", 3.0);
+  stats.SetGauge("queue_depth", 4.0);
+
+  const StatsSnapshot s = stats.Snapshot();
+  EXPECT_EQ("test", s.tracker_name);
+
+  ASSERT_EQ(1ul, s.histograms.size());
+  EXPECT_EQ("latency", s.histograms.at(0).name);
+  EXPECT_EQ(100ul, s.histograms.at(0).count);
+  EXPECT_NEAR(5.0, s.histograms.at(0).p99, 0.03 * 5.0);
+
+  ASSERT_EQ(1ul, s.counters.size());
+  EXPECT_EQ(3, s.counters.at(0).second);
+
+  ASSERT_EQ(1ul, s.gauges.size());
+  EXPECT_EQ(4.0, s.gauges.at(0).second);
+}
+
+
+class CountingExporter : public StatsExporter {
+ public:
+  void Export(const StatsSnapshot&) override { ++num_exports; }
+  int num_exports = 0;
+};
+
+
+TEST(StatsTrackerTest, TestExport)
+{
+  StatsTracker stats("test", 10);
+  std::shared_ptr<CountingExporter> exporter = std::make_shared<CountingExporter>();
+  stats.RegisterExporter(exporter);
+
+  stats.Add("latency", 1.0f);
+  stats.Export();
+  EXPECT_EQ(1, exporter->num_exports);
+
+  // Shouldn't export again until the interval has elapsed.
+  stats.Export(100.0f);
+  EXPECT_EQ(1, exporter->num_exports);
+}
+
+
+TEST(StatsTrackerTest, StatsBufferMinMaxMean)
+{
+  StatsBuffer<float> buf(4);
+  const std::vector<float> values = { 5, 1, 7, 3, 2, 9, 9, 0, 4, 6, 8, 1 };
+
+  for (size_t i = 0; i < values.size(); ++i) {
+    buf.Add(values[i]);
+
+    // Brute force over the last (up to) 4 values.
+    const size_t first = (i >= 3) ? (i - 3) : 0;
+    float min = values[first], max = values[first], sum = 0;
+    for (size_t j = first; j <= i; ++j) {
+      min = std::min(min, values[j]);
+      max = std::max(max, values[j]);
+      sum += values[j];
+    }
+
+    int N;
+    float bmin, bmax, bmean;
+    buf.MinMaxMean(N, bmin, bmax, bmean);
+    EXPECT_EQ(static_cast<int>(i - first + 1), N);
+    EXPECT_EQ(min, bmin);
+    EXPECT_EQ(max, bmax);
+    EXPECT_NEAR(sum / N, bmean, 1e-5);
+  }
+}
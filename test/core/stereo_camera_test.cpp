@@ -39,3 +39,54 @@ TEST(StereoCamera, TestProject)
   const Vector2d pr = stereo_cam.RightCamera().Project(Vector3d(-3, 4, 10));
   ASSERT_EQ(Pr, stereo_cam.RightCamera().Backproject(pr, 10));
 }
+
+TEST(StereoCamera, TestBatch)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 376.0, 240.0, 480, 752);
+  StereoCamera stereo_cam(cam, cam, 0.2);
+
+  ArrayXd x(3), y(3), z(3);
+  x << 0, 1, -3;
+  y << 0, 2, 4;
+  z << 10, 3, 10;
+
+  ArrayXd u, v;
+  cam.Project(x, y, z, u, v);
+  ASSERT_EQ(3, u.size());
+  for (int i = 0; i < 3; ++i) {
+    const Vector2d uv = cam.Project(Vector3d(x(i), y(i), z(i)));
+    EXPECT_NEAR(uv.x(), u(i), 1e-9);
+    EXPECT_NEAR(uv.y(), v(i), 1e-9);
+  }
+
+  ArrayXd disp, depth;
+  stereo_cam.DepthToDisp(z, disp);
+  stereo_cam.DispToDepth(disp, depth);
+  EXPECT_NEAR(stereo_cam.DepthToDisp(3), disp(1), 1e-9);
+
+  ArrayXd xb, yb, zb;
+  cam.Backproject(u, v, depth, xb, yb, zb);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_NEAR(x(i), xb(i), 1e-9);
+    EXPECT_NEAR(y(i), yb(i), 1e-9);
+    EXPECT_NEAR(z(i), zb(i), 1e-9);
+  }
+}
+
+TEST(StereoCamera, TestRescale)
+{
+  const PinholeCamera cam(1400.0, 1400.0, 960.0, 540.0, 1080, 1920);
+  const StereoCamera stereo_cam(cam, cam, 0.12);
+  const StereoCamera half = stereo_cam.Rescale(540, 960);
+
+  EXPECT_EQ(540, half.Height());
+  EXPECT_EQ(960, half.Width());
+  EXPECT_EQ(700.0, half.fx());
+  EXPECT_EQ(270.0, half.cy());
+  EXPECT_EQ(0.12, half.Baseline());
+
+  // Points land at half of the pixel coordinates, with half the disparity.
+  const Vector3d p(0.3, -0.2, 4.0);
+  EXPECT_TRUE((0.5 * stereo_cam.LeftCamera().Project(p)).isApprox(half.LeftCamera().Project(p)));
+  EXPECT_NEAR(0.5 * stereo_cam.DepthToDisp(4.0), half.DepthToDisp(4.0), 1e-9);
+}
@@ -0,0 +1,141 @@
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/task_scheduler.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(TaskSchedulerTest, TestSubmitAndWait)
+{
+  TaskScheduler scheduler(3);
+  EXPECT_EQ(4, scheduler.NumThreads());
+
+  std::atomic<int> sum{0};
+  TaskGroup group;
+  for (int i = 0; i < 1000; ++i) {
+    scheduler.Submit([&sum, i]() { sum += i; }, &group, (i % 2) ? TaskPriority::LOW : TaskPriority::HIGH);
+  }
+  scheduler.Wait(group);
+  EXPECT_EQ(0, group.NumPending());
+  EXPECT_EQ(499500, sum.load());
+}
+
+
+TEST(TaskSchedulerTest, TestParallelFor)
+{
+  TaskScheduler scheduler(3);
+
+  for (const size_t n : { 1ul, 5ul, 100ul, 999ul }) {
+    std::vector<std::atomic<int>> visits(n);
+    for (std::atomic<int>& v : visits) { v = 0; }
+
+    scheduler.ParallelFor(visits.size(), [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i) {
+        ++visits.at(i);
+      }
+    }, 7);
+
+    for (const std::atomic<int>& v : visits) {
+      ASSERT_EQ(1, v.load());
+    }
+  }
+
+  scheduler.ParallelFor(0, [](size_t, size_t) { FAIL(); });
+}
+
+
+TEST(TaskSchedulerTest, TestNested)
+{
+  // More nested loops than workers, which would deadlock if waiting didn't run tasks.
+  TaskScheduler scheduler(2);
+
+  std::atomic<int> count{0};
+  scheduler.ParallelFor(16, [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i) {
+      scheduler.ParallelFor(100, [&](size_t b, size_t e) { count += static_cast<int>(e - b); }, 10);
+    }
+  });
+  EXPECT_EQ(1600, count.load());
+}
+
+
+TEST(TaskSchedulerTest, TestPinned)
+{
+  TaskScheduler scheduler(3);
+
+  std::vector<int> ran_on(30, -2);
+  TaskGroup group;
+  for (size_t i = 0; i < ran_on.size(); ++i) {
+    const int worker = static_cast<int>(i % 3);
+    scheduler.Submit([&scheduler, &ran_on, i]() { ran_on.at(i) = scheduler.CurrentWorker(); }, &group, TaskPriority::NORMAL, worker);
+  }
+  scheduler.Wait(group);
+
+  for (size_t i = 0; i < ran_on.size(); ++i) {
+    EXPECT_EQ(static_cast<int>(i % 3), ran_on.at(i));
+  }
+  EXPECT_EQ(-1, scheduler.CurrentWorker());
+}
+
+
+TEST(TaskSchedulerTest, TestSerial)
+{
+  // Without workers, everything runs on the calling thread.
+  TaskScheduler scheduler(0);
+  int sum = 0;
+  TaskGroup group;
+  scheduler.Submit([&sum]() { sum += 1; }, &group);
+  EXPECT_EQ(1, sum);
+  scheduler.ParallelFor(100, [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i) {
+      sum += static_cast<int>(i);
+    }
+  });
+  scheduler.Wait(group);
+  EXPECT_EQ(4951, sum);
+}
+
+
+TEST(TaskSchedulerTest, TestGlobal)
+{
+  TaskScheduler& global = TaskScheduler::Global();
+  EXPECT_EQ(&global, &TaskScheduler::Global());
+  EXPECT_FALSE(TaskScheduler::ConfigureGlobal(1));
+}
+
+
+TEST(TaskSchedulerTest, TestCurrent)
+{
+  EXPECT_EQ(&TaskScheduler::Global(), &TaskScheduler::Current());
+
+  TaskScheduler a(2), b(1);
+  {
+    const ScopedTaskScheduler bind_a(&a);
+    EXPECT_EQ(&a, &TaskScheduler::Current());
+    {
+      const ScopedTaskScheduler bind_b(&b);
+      EXPECT_EQ(&b, &TaskScheduler::Current());
+      const ScopedTaskScheduler bind_none(nullptr);
+      EXPECT_EQ(&b, &TaskScheduler::Current());
+    }
+    EXPECT_EQ(&a, &TaskScheduler::Current());
+
+    // Workers always see their own scheduler, whatever the submitting thread has bound.
+    std::atomic<int> num_wrong{0};
+    b.ParallelFor(8, [&](size_t, size_t)
+    {
+      if (b.CurrentWorker() >= 0 && &TaskScheduler::Current() != &b) {
+        ++num_wrong;
+      }
+    });
+    EXPECT_EQ(0, num_wrong.load());
+  }
+  EXPECT_EQ(&TaskScheduler::Global(), &TaskScheduler::Current());
+}
@@ -0,0 +1,50 @@
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/thread_pool.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ThreadPoolTest, TestParallelFor)
+{
+  ThreadPool pool(3);
+  EXPECT_EQ(4, pool.NumThreads());
+
+  // Each item is visited exactly once, in every loop.
+  for (int loop = 0; loop < 50; ++loop) {
+    std::vector<std::atomic<int>> visits(1000);
+    for (std::atomic<int>& v : visits) { v = 0; }
+
+    pool.ParallelFor(visits.size(), [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i) {
+        ++visits.at(i);
+      }
+    }, 7);
+
+    for (const std::atomic<int>& v : visits) {
+      ASSERT_EQ(1, v.load());
+    }
+  }
+
+  // Empty loops are fine too.
+  pool.ParallelFor(0, [](size_t, size_t) { FAIL(); });
+}
+
+
+TEST(ThreadPoolTest, TestSerial)
+{
+  ThreadPool pool(0);
+  size_t sum = 0;
+  pool.ParallelFor(100, [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i) {
+      sum += i;
+    }
+  });
+  EXPECT_EQ(4950ul, sum);
+}
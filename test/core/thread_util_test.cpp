@@ -0,0 +1,36 @@
+#include <sched.h>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/thread_util.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ThreadUtilTest, TestDefaultConfig)
+{
+  // The default config shouldn't change anything, so it can't fail.
+  std::thread t([]() { EXPECT_TRUE(ConfigureCurrentThread(ThreadConfig(), "test_default")); });
+  t.join();
+}
+
+
+TEST(ThreadUtilTest, TestPinToCpu)
+{
+  std::thread t([]() {
+    ThreadConfig config;
+    config.cpus = { 0 };
+    config.nice = 5;  // Lowering priority doesn't need any permissions.
+    EXPECT_TRUE(ConfigureCurrentThread(config, "test_pinned"));
+    EXPECT_EQ(0, sched_getcpu());
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    ASSERT_EQ(0, pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset));
+    EXPECT_EQ(1, CPU_COUNT(&cpuset));
+    EXPECT_TRUE(CPU_ISSET(0, &cpuset));
+  });
+  t.join();
+}
@@ -0,0 +1,70 @@
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "core/trace.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(TraceTest, TestScopedTrace)
+{
+  Tracer& tracer = Tracer::Instance();
+  TraceBuffer& buffer = tracer.ThreadBuffer();
+  const size_t size0 = buffer.Size();
+
+  // Nothing should be recorded until the tracer is started.
+  { ScopedTrace trace("disabled"); }
+  EXPECT_EQ(size0, buffer.Size());
+
+  tracer.Start();
+  {
+    ScopedTrace trace("outer");
+    { ScopedTrace inner("inner"); }
+  }
+
+  // Inner scope finishes first.
+  ASSERT_EQ(size0 + 2, buffer.Size());
+  EXPECT_STREQ("inner", buffer.At(size0).name);
+  EXPECT_STREQ("outer", buffer.At(size0 + 1).name);
+  EXPECT_LE(buffer.At(size0 + 1).start_ns, buffer.At(size0).start_ns);
+  EXPECT_GE(buffer.At(size0 + 1).duration_ns, buffer.At(size0).duration_ns);
+
+  // Each thread should get its own buffer.
+  std::thread worker([&tracer, &buffer]() {
+    tracer.SetThreadName("worker");
+    ScopedTrace trace("worker_scope");
+    EXPECT_NE(&buffer, &tracer.ThreadBuffer());
+  });
+  worker.join();
+  tracer.Stop();
+
+  const std::string filepath = "/tmp/trace_test.json";
+  ASSERT_TRUE(tracer.WriteChromeTrace(filepath));
+
+  std::ifstream in(filepath);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  const std::string json = ss.str();
+  EXPECT_NE(std::string::npos, json.find("\"traceEvents\""));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"outer\""));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"worker_scope\""));
+  EXPECT_NE(std::string::npos, json.find("\"args\":{\"name\":\"worker\"}"));
+  EXPECT_EQ(0ul, tracer.NumDropped());
+}
+
+
+TEST(TraceTest, TestBufferFull)
+{
+  TraceBuffer buffer(2, 0);
+  TraceEvent event;
+  event.name = "e";
+  buffer.Add(event);
+  buffer.Add(event);
+  buffer.Add(event);
+  EXPECT_EQ(2ul, buffer.Size());
+  EXPECT_EQ(1ul, buffer.NumDropped());
+}
@@ -0,0 +1,87 @@
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "core/transform_util.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static std::vector<Vector6d> MakeTwists()
+{
+  std::vector<Vector6d> xi;
+  Vector6d x;
+  x << 0.1, -0.2, 0.3, 0.4, -0.5, 0.6;
+  xi.emplace_back(x);
+  x << 1.0, 2.0, -3.0, 1e-6, -2e-6, 3e-7;
+  xi.emplace_back(x);
+  x << 0.0, 0.0, 0.0, 0.0, 0.0, 0.0;
+  xi.emplace_back(x);
+  x << -0.5, 0.1, 0.2, 0.0, 0.0, 3.1;
+  xi.emplace_back(x);
+  return xi;
+}
+
+
+TEST(TransformUtilTest, TestExpSE3MatchesLegacy)
+{
+  for (const Vector6d& xi : MakeTwists()) {
+    const Matrix4d T_legacy = expmap_se3(xi);
+    const Rigid3d T = ExpSE3<double>(xi);
+    EXPECT_TRUE(T.Matrix().isApprox(T_legacy, 1e-9)) << xi.transpose();
+  }
+}
+
+
+TEST(TransformUtilTest, TestLogSE3RoundTrip)
+{
+  for (const Vector6d& xi : MakeTwists()) {
+    const Vector6d xi_hat = LogSE3<double>(ExpSE3<double>(xi));
+    EXPECT_LT((xi_hat - xi).norm(), 1e-9) << xi.transpose();
+  }
+
+  // Floats should round trip to single precision.
+  for (const Vector6d& xi : MakeTwists()) {
+    const Vector6f xf = xi.cast<float>();
+    const Vector6f xf_hat = LogSE3<float>(ExpSE3<float>(xf));
+    EXPECT_LT((xf_hat - xf).norm(), 1e-3) << xi.transpose();
+  }
+}
+
+
+TEST(TransformUtilTest, TestBatched)
+{
+  const std::vector<Vector6d> xi = MakeTwists();
+  std::vector<Rigid3d> T(xi.size());
+  std::vector<Vector6d> xi_hat(xi.size());
+
+  ExpSE3<double>(xi.data(), T.data(), xi.size());
+  LogSE3<double>(T.data(), xi_hat.data(), T.size());
+
+  for (size_t i = 0; i < xi.size(); ++i) {
+    EXPECT_TRUE(T.at(i).Matrix().isApprox(ExpSE3<double>(xi.at(i)).Matrix()));
+    EXPECT_LT((xi_hat.at(i) - xi.at(i)).norm(), 1e-9);
+  }
+}
+
+
+TEST(TransformUtilTest, TestRigidCompose)
+{
+  const std::vector<Vector6d> xi = MakeTwists();
+  const Rigid3d T_ab = ExpSE3<double>(xi.at(0));
+  const Rigid3d T_bc = ExpSE3<double>(xi.at(3));
+
+  EXPECT_TRUE((T_ab * T_bc).Matrix().isApprox(T_ab.Matrix() * T_bc.Matrix()));
+  EXPECT_TRUE(T_ab.Inverse().Matrix().isApprox(inverse_se3(T_ab.Matrix())));
+  EXPECT_TRUE((T_ab * T_ab.Inverse()).Matrix().isApprox(Matrix4d::Identity()));
+  EXPECT_TRUE(Rigid3d(T_ab.Matrix()).Matrix().isApprox(T_ab.Matrix()));
+
+  Rigid3d::Points P(3, 5);
+  P.setRandom();
+  Rigid3d::Points P_out(3, 5);
+  T_ab.TransformPoints(P, P_out);
+  for (int i = 0; i < P.cols(); ++i) {
+    EXPECT_TRUE(P_out.col(i).isApprox(T_ab * Vector3d(P.col(i))));
+  }
+}
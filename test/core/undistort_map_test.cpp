@@ -0,0 +1,55 @@
+#include "gtest/gtest.h"
+
+#include "core/eigen_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/undistort_map.hpp"
+
+using namespace bm::core;
+
+
+TEST(UndistortMapTest, TestIdentity)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 376.0, 240.0, 480, 752);
+  const UndistortMap map(cam, { 0, 0, 0, 0 });
+  ASSERT_TRUE(map.IsIdentity());
+
+  Image1b raw(480, 752, 127);
+  raw(100, 200) = 255;
+
+  cv::Mat out;
+  map.Apply(raw, out);
+  ASSERT_EQ(0, cv::countNonZero(out != raw));
+
+  const VecPoint2f kps = { cv::Point2f(10, 20), cv::Point2f(700, 400) };
+  VecPoint2f kps_out;
+  map.UndistortPoints(kps, kps_out);
+  ASSERT_EQ(kps, kps_out);
+}
+
+
+TEST(UndistortMapTest, TestRadial)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 376.0, 240.0, 480, 752);
+  const UndistortMap map(cam, { 0.15, 0.7, 0, 0 });
+  ASSERT_FALSE(map.IsIdentity());
+
+  // Radial distortion doesn't move the principal point, but moves pixels near the edge.
+  const VecPoint2f kps = { cv::Point2f(376, 240), cv::Point2f(700, 400) };
+  VecPoint2f kps_out;
+  map.UndistortPoints(kps, kps_out);
+  ASSERT_EQ(2ul, kps_out.size());
+  EXPECT_NEAR(376, kps_out.at(0).x, 1e-3);
+  EXPECT_NEAR(240, kps_out.at(0).y, 1e-3);
+  EXPECT_GT(cv::norm(kps_out.at(1) - kps.at(1)), 1.0);
+
+  // The dense and sparse paths should agree: a bright spot in the raw image ends up where
+  // UndistortPoints() says it does.
+  Image1b raw(480, 752, static_cast<uint8_t>(0));
+  cv::circle(raw, cv::Point(700, 400), 3, cv::Scalar(255), -1);
+
+  Image1b out;
+  map.Apply(raw, out);
+  ASSERT_EQ(480, out.rows);
+  ASSERT_EQ(752, out.cols);
+  EXPECT_GT(out(static_cast<int>(kps_out.at(1).y + 0.5), static_cast<int>(kps_out.at(1).x + 0.5)), 0);
+}
@@ -0,0 +1,208 @@
+#include <cstdio>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/binary_log.hpp"
+#include "dataset/binary_log_dataset.hpp"
+#include "dataset/stereo_prefetcher.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static const std::string kLogPath = "/tmp/binary_log_test.bmlog";
+
+
+static Image1b MakeImage1b(int rows, int cols, uint8_t seed)
+{
+  Image1b im(rows, cols);
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      im(r, c) = static_cast<uint8_t>(seed + r * cols + c);
+    }
+  }
+  return im;
+}
+
+
+// Writes 100 IMU, 10 depth, 10 range, 10 mag, 10 groundtruth and 10 stereo records.
+static void WriteLog(size_t chunk_bytes)
+{
+  BinaryLogWriter writer(kLogPath, binary_log::ImageEncoding::RAW, 95, chunk_bytes);
+
+  for (int i = 0; i < 100; ++i) {
+    const timestamp_t t = 1000 + 10 * i;
+    writer.WriteImu(ImuMeasurement(t, Vector3d(0.01 * i, 0, 0), Vector3d(0, 0, 9.81)));
+
+    if (i % 10 == 0) {
+      writer.WriteDepth(DepthMeasurement(t, 0.1 * i));
+      writer.WriteRange(RangeMeasurement(t, 0.5 * i, Vector3d(1, 2, 3)));
+      writer.WriteMag(MagMeasurement(t, Vector3d(0.3, 0.0, -0.5)));
+
+      Matrix4d world_T_body = Matrix4d::Identity();
+      world_T_body(0, 3) = i;
+      world_T_body(2, 1) = 0.5;
+      writer.WriteGroundtruth(GroundtruthItem(t, world_T_body));
+
+      const uint8_t seed = static_cast<uint8_t>(i);
+      writer.WriteStereo(StereoImage1b(t, i, MakeImage1b(6, 8, seed), MakeImage1b(6, 8, seed + 1)));
+    }
+  }
+}
+
+
+TEST(BinaryLogTest, TestRoundTrip)
+{
+  WriteLog(256);
+
+  BinaryLogReader reader(kLogPath);
+  EXPECT_TRUE(reader.HasIndex());
+  EXPECT_GT(reader.Chunks().size(), 1ul);
+
+  size_t num_imu = 0, num_stereo = 0, num_mag = 0;
+  reader.ForEachRecord([&](const RecordView& r)
+  {
+    if (r.type == binary_log::RecordType::IMU) {
+      const ImuMeasurement imu = ParseImuRecord(r);
+      EXPECT_EQ(1000 + 10 * num_imu, imu.timestamp);
+      EXPECT_EQ(0.01 * num_imu, imu.w.x());
+      EXPECT_EQ(9.81, imu.a.z());
+      ++num_imu;
+    } else if (r.type == binary_log::RecordType::MAG) {
+      EXPECT_EQ(-0.5, ParseMagRecord(r).field.z());
+      ++num_mag;
+    } else if (r.type == binary_log::RecordType::STEREO) {
+      // RAW images are views into the mapping.
+      cv::Mat left, right;
+      EXPECT_EQ(binary_log::ImageEncoding::RAW, ParseStereoRecord(r, left, right));
+      EXPECT_EQ(6, left.rows);
+      EXPECT_EQ(8, left.cols);
+      EXPECT_EQ(CV_8UC1, left.type());
+      EXPECT_GE(left.data, r.data);
+      EXPECT_LT(right.data, r.data + r.size);
+      ++num_stereo;
+    }
+  });
+
+  EXPECT_EQ(100ul, num_imu);
+  EXPECT_EQ(10ul, num_stereo);
+  EXPECT_EQ(10ul, num_mag);
+
+  EXPECT_EQ(0ul, reader.FindChunk(0));
+  EXPECT_EQ(reader.Chunks().size(), reader.FindChunk(kMaxTimestamp));
+  const size_t k = reader.FindChunk(1500);
+  EXPECT_GE(reader.Chunks().at(k).t_last, 1500ul);
+  if (k > 0) {
+    EXPECT_LT(reader.Chunks().at(k - 1).t_last, 1500ul);
+  }
+}
+
+
+TEST(BinaryLogTest, TestDataset)
+{
+  WriteLog(4096);
+
+  BinaryLogDataset dataset(kLogPath);
+  EXPECT_EQ(10ul, dataset.StereoItems().size());
+  EXPECT_EQ(10ul, dataset.GroundtruthPoses().size());
+  EXPECT_EQ(10ul, dataset.MagData().size());
+  EXPECT_EQ(1000ul, dataset.FirstTimestamp());
+
+  const Matrix4d& T = dataset.GroundtruthPoses().at(3).world_T_body;
+  EXPECT_EQ(30.0, T(0, 3));
+  EXPECT_EQ(0.5, T(2, 1));
+  EXPECT_EQ(0.0, T(1, 2));
+
+  size_t num_stereo = 0, num_imu = 0, num_depth = 0, num_range = 0;
+  dataset.RegisterStereoCallback([&](const StereoImage1b& pair)
+  {
+    const uint8_t seed = static_cast<uint8_t>(10 * num_stereo);
+    EXPECT_EQ(num_stereo, pair.camera_id);
+    EXPECT_EQ(seed, pair.left_image(0, 0));
+    EXPECT_EQ(static_cast<uint8_t>(seed + 1 + 47), pair.right_image(5, 7));
+    ++num_stereo;
+  });
+  dataset.RegisterImuCallback([&](const ImuMeasurement&) { ++num_imu; });
+  dataset.RegisterDepthCallback([&](const DepthMeasurement&) { ++num_depth; });
+  dataset.RegisterRangeCallback([&](const RangeMeasurement&) { ++num_range; });
+
+  // Same thing through the prefetcher.
+  for (size_t lookahead : { 0ul, 3ul }) {
+    num_stereo = num_imu = num_depth = num_range = 0;
+    dataset.SetStereoPrefetch(lookahead, 2);
+    dataset.Reset();
+    while (dataset.Step()) {}
+    EXPECT_EQ(10ul, num_stereo);
+    EXPECT_EQ(100ul, num_imu);
+    EXPECT_EQ(10ul, num_depth);
+    EXPECT_EQ(10ul, num_range);
+  }
+}
+
+
+TEST(BinaryLogTest, TestNotClosed)
+{
+  WriteLog(256);
+
+  size_t total_records = 0;
+  {
+    BinaryLogReader reader(kLogPath);
+    for (const binary_log::ChunkIndexEntry& chunk : reader.Chunks()) {
+      total_records += chunk.num_records;
+    }
+  }
+
+  // Chop off the index and footer, as if the recorder was killed right after writing a chunk.
+  FILE* f = std::fopen(kLogPath.c_str(), "rb");
+  ASSERT_TRUE(f != nullptr);
+  std::fseek(f, -static_cast<long>(sizeof(binary_log::Footer)), SEEK_END);
+  binary_log::Footer footer;
+  ASSERT_EQ(1ul, std::fread(&footer, sizeof(footer), 1, f));
+  std::fclose(f);
+  ASSERT_EQ(0, truncate(kLogPath.c_str(), footer.index_offset));
+
+  BinaryLogReader reader(kLogPath);
+  EXPECT_FALSE(reader.HasIndex());
+
+  size_t num_records = 0;
+  reader.ForEachRecord([&](const RecordView&) { ++num_records; });
+  EXPECT_EQ(total_records, num_records);
+
+  EXPECT_THROW(BinaryLogReader("/nonexistent/log.bmlog"), std::runtime_error);
+}
+
+
+TEST(BinaryLogTest, TestJpeg)
+{
+  {
+    BinaryLogWriter writer(kLogPath, binary_log::ImageEncoding::JPEG, 90);
+    for (int i = 0; i < 3; ++i) {
+      const Image3b im(48, 64, cv::Vec3b(10, 100, 200));
+      writer.WriteStereo(StereoImage3b(1000 + i, i, im, im));
+    }
+  }
+
+  BinaryLogDataset dataset(kLogPath);
+
+  // JPEG is lossy, so only check the sizes.
+  size_t num_color = 0, num_gray = 0;
+  dataset.RegisterStereoCallback([&](const StereoImage3b& pair)
+  {
+    EXPECT_EQ(48, pair.left_image.rows);
+    EXPECT_EQ(64, pair.right_image.cols);
+    ++num_color;
+  });
+  dataset.RegisterStereoCallback([&](const StereoImage1b& pair)
+  {
+    EXPECT_EQ(48, pair.left_image.rows);
+    EXPECT_EQ(64, pair.right_image.cols);
+    ++num_gray;
+  });
+
+  while (dataset.Step()) {}
+  EXPECT_EQ(3ul, num_color);
+  EXPECT_EQ(3ul, num_gray);
+}
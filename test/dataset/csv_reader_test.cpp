@@ -0,0 +1,155 @@
+#include <fstream>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/csv_reader.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static std::string WriteFile(const std::string& name, const std::string& contents)
+{
+  const std::string path = "/tmp/" + name;
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << contents;
+  return path;
+}
+
+
+struct Row final {
+  Row(timestamp_t t, double a, double b) : t(t), a(a), b(b) {}
+  timestamp_t t;
+  double a;
+  double b;
+};
+
+
+static bool ParseRow(CsvLine& line, std::vector<Row>& out)
+{
+  timestamp_t t = 0;
+  double a = 0, b = 0;
+  if (!(line.Next(t) && line.Next(a) && line.Next(b))) {
+    return false;
+  }
+  out.emplace_back(t, a, b);
+  return true;
+}
+
+
+TEST(CsvReaderTest, TestLines)
+{
+  // A header, CRLF line endings, an empty line, spaces, and no newline at the end.
+  const std::string path = WriteFile("csv_reader_test.csv",
+      "#timestamp [ns],a,b\r\n"
+      "1403636579763555584,-0.099134701513277898, 9.81\r\n"
+      "\n"
+      "1403636579768555520 , 1e-3,-2\r\n"
+      "1403636579773555456,0.5,0.25");
+
+  const CsvReader csv(path);
+  EXPECT_EQ(5ul, csv.NumLines());
+
+  std::vector<Row> rows;
+  csv.ParseLines(rows, ParseRow);
+
+  ASSERT_EQ(3ul, rows.size());
+  EXPECT_EQ(1403636579763555584ul, rows.at(0).t);
+  EXPECT_DOUBLE_EQ(-0.099134701513277898, rows.at(0).a);
+  EXPECT_DOUBLE_EQ(9.81, rows.at(0).b);
+  EXPECT_EQ(1403636579768555520ul, rows.at(1).t);
+  EXPECT_DOUBLE_EQ(1e-3, rows.at(1).a);
+  EXPECT_DOUBLE_EQ(-2.0, rows.at(1).b);
+  EXPECT_EQ(1403636579773555456ul, rows.at(2).t);
+  EXPECT_DOUBLE_EQ(0.25, rows.at(2).b);
+}
+
+
+TEST(CsvReaderTest, TestFields)
+{
+  const std::string text = "12,,abc,-3\n";
+  CsvLine line(text.data(), text.data() + text.size() - 1);
+
+  timestamp_t t = 0;
+  double v = 0;
+  EXPECT_TRUE(line.Next(t));
+  EXPECT_EQ(12ul, t);
+
+  // Empty fields and text don't parse as numbers, and don't move the cursor.
+  EXPECT_FALSE(line.Next(v));
+  const char* field = nullptr;
+  size_t length = 0;
+  EXPECT_TRUE(line.Next(field, length));
+  EXPECT_EQ(0ul, length);
+  EXPECT_FALSE(line.Next(v));
+  EXPECT_TRUE(line.Next(field, length));
+  EXPECT_EQ("abc", std::string(field, length));
+
+  // Negative timestamps aren't allowed.
+  EXPECT_FALSE(line.Next(t));
+  EXPECT_TRUE(line.Next(v));
+  EXPECT_EQ(-3.0, v);
+  EXPECT_TRUE(line.AtEnd());
+  EXPECT_FALSE(line.Next(v));
+}
+
+
+TEST(CsvReaderTest, TestParallel)
+{
+  // Big enough to be split across threads.
+  const size_t N = 400000;
+  std::string contents = "t,a,b\n";
+  for (size_t i = 0; i < N; ++i) {
+    contents += std::to_string(1000 + i) + "," + std::to_string(i) + ",0.5\n";
+  }
+  const std::string path = WriteFile("csv_reader_parallel_test.csv", contents);
+
+  const CsvReader csv(path);
+
+  std::vector<Row> serial, parallel;
+  csv.ParseLines(serial, ParseRow, 1, 1);
+  csv.ParseLines(parallel, ParseRow, 1, 4);
+
+  ASSERT_EQ(N, serial.size());
+  ASSERT_EQ(N, parallel.size());
+  for (size_t i = 0; i < N; ++i) {
+    EXPECT_EQ(1000 + i, parallel.at(i).t);
+    EXPECT_EQ(static_cast<double>(i), parallel.at(i).a);
+  }
+}
+
+
+TEST(CsvReaderTest, TestChunks)
+{
+  // 10 rows after the header, and no newline at the end.
+  std::string contents = "t,a,b\n";
+  for (int i = 0; i < 10; ++i) {
+    contents += std::to_string(1000 + i) + "," + std::to_string(i) + ",0.5";
+    contents += (i < 9) ? "\n" : "";
+  }
+  const std::string path = WriteFile("csv_reader_chunks_test.csv", contents);
+
+  const CsvReader csv(path);
+  const std::vector<size_t> offsets = csv.ChunkOffsets(4);
+  ASSERT_EQ(4ul, offsets.size());
+  EXPECT_EQ(contents.size(), offsets.back());
+
+  std::vector<Row> all;
+  for (size_t i = 0; (i + 1) < offsets.size(); ++i) {
+    std::vector<Row> chunk;
+    csv.ParseChunk(chunk, ParseRow, offsets.at(i), offsets.at(i + 1));
+    EXPECT_EQ((i < 2) ? 4ul : 2ul, chunk.size());
+    all.insert(all.end(), chunk.begin(), chunk.end());
+  }
+
+  ASSERT_EQ(10ul, all.size());
+  for (size_t i = 0; i < all.size(); ++i) {
+    EXPECT_EQ(1000 + i, all.at(i).t);
+  }
+
+  // A header with nothing after it has no chunks.
+  const CsvReader header_only(WriteFile("csv_reader_empty_test.csv", "t,a,b"));
+  EXPECT_EQ(1ul, header_only.ChunkOffsets(4).size());
+}
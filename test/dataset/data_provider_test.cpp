@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/data_provider.hpp"
+#include "dataset/stereo_prefetcher.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+// IMU at t=0,10,...,990, depth and groundtruth at t=0,50,...,950 and stereo at t=5,105,...,905.
+// Each stereo pair is a 2x2 image filled with its index.
+class SteppedDataset : public DataProvider {
+ public:
+  SteppedDataset()
+  {
+    for (int i = 0; i < 100; ++i) {
+      const timestamp_t t = 10 * i;
+      imu_data.emplace_back(ImuMeasurement(t, Vector3d(0.01 * i, 0, 0), Vector3d(0, 0, 9.81)));
+
+      if (i % 5 == 0) {
+        depth_data.emplace_back(DepthMeasurement(t, 0.1 * i));
+        Matrix4d world_T_body = Matrix4d::Identity();
+        world_T_body(0, 3) = i;
+        pose_data.emplace_back(GroundtruthItem(t, world_T_body));
+      }
+      if (i % 10 == 0) {
+        stereo_data.emplace_back(t + 5, "", "");
+      }
+    }
+
+    stereo_decoder = [](size_t idx, bool, DecodedStereo& out)
+    {
+      out.has_color = false;
+      out.left = std::make_shared<ImageFrame>(Image1b(2, 2, static_cast<uint8_t>(idx)));
+      out.right = std::make_shared<ImageFrame>(Image1b(2, 2, static_cast<uint8_t>(idx)));
+    };
+  }
+};
+
+
+// Plays back everything that's left, and records the timestamps and stereo pixel values.
+static void PlayRest(DataProvider& dataset, std::vector<timestamp_t>& imu, std::vector<int>& stereo)
+{
+  imu.clear();
+  stereo.clear();
+  dataset.RegisterImuCallback([&](const ImuMeasurement& data) { imu.emplace_back(data.timestamp); });
+  dataset.RegisterStereoCallback([&](const StereoImage1b& pair) { stereo.emplace_back(pair.left_image(0, 0)); });
+  while (dataset.Step()) {}
+}
+
+
+TEST(DataProviderTest, TestSeekTo)
+{
+  for (size_t lookahead : { 0ul, 2ul }) {
+    SteppedDataset dataset;
+    dataset.SetStereoPrefetch(lookahead, 2);
+
+    size_t num_imu = 0, num_depth = 0;
+    timestamp_t first_imu = kMaxTimestamp, first_depth = kMaxTimestamp;
+    std::vector<int> stereo;
+    dataset.RegisterImuCallback([&](const ImuMeasurement& data)
+    {
+      first_imu = std::min(first_imu, data.timestamp);
+      ++num_imu;
+    });
+    dataset.RegisterDepthCallback([&](const DepthMeasurement& data)
+    {
+      first_depth = std::min(first_depth, data.timestamp);
+      ++num_depth;
+    });
+    dataset.RegisterStereoCallback([&](const StereoImage1b& pair) { stereo.emplace_back(pair.left_image(0, 0)); });
+
+    // Play some of the dataset, then skip ahead (into the middle of the stereo lookahead).
+    for (int i = 0; i < 30; ++i) {
+      dataset.Step();
+    }
+    num_imu = num_depth = 0;
+    first_imu = first_depth = kMaxTimestamp;
+    stereo.clear();
+
+    dataset.SeekTo(501);
+    while (dataset.Step()) {}
+    EXPECT_EQ(510ul, first_imu);
+    EXPECT_EQ(49ul, num_imu);
+    EXPECT_EQ(550ul, first_depth);
+    EXPECT_EQ(9ul, num_depth);
+    EXPECT_EQ(std::vector<int>({ 5, 6, 7, 8, 9 }), stereo);
+
+    // And back.
+    stereo.clear();
+    dataset.SeekTo(0);
+    while (dataset.Step()) {}
+    EXPECT_EQ(10ul, stereo.size());
+    EXPECT_EQ(0, stereo.front());
+
+    // Past the end.
+    dataset.SeekTo(kMaxTimestamp);
+    EXPECT_FALSE(dataset.Step());
+  }
+}
+
+
+TEST(DataProviderTest, TestSlice)
+{
+  SteppedDataset dataset;
+  EXPECT_EQ(0ul, dataset.FirstTimestamp());
+  EXPECT_EQ(990ul, dataset.LastTimestamp());
+
+  const DataProvider slice = dataset.Slice(300, 600);
+  EXPECT_EQ(300ul, slice.FirstTimestamp());
+  EXPECT_EQ(590ul, slice.LastTimestamp());
+  EXPECT_EQ(3ul, slice.StereoItems().size());
+  EXPECT_EQ(6ul, slice.GroundtruthPoses().size());
+  EXPECT_EQ(30.0, slice.InitialPose()(0, 3));
+
+  // Slices play back independently of each other, and the stereo pairs refer to the whole dataset.
+  DataProvider a = slice;
+  DataProvider b = dataset.Slice(600, 1000);
+  b.SetStereoPrefetch(2, 2);
+
+  std::vector<timestamp_t> imu_a, imu_b;
+  std::vector<int> stereo_a, stereo_b;
+  PlayRest(a, imu_a, stereo_a);
+  PlayRest(b, imu_b, stereo_b);
+
+  EXPECT_EQ(30ul, imu_a.size());
+  EXPECT_EQ(300ul, imu_a.front());
+  EXPECT_EQ(590ul, imu_a.back());
+  EXPECT_EQ(std::vector<int>({ 3, 4, 5 }), stereo_a);
+
+  EXPECT_EQ(40ul, imu_b.size());
+  EXPECT_EQ(600ul, imu_b.front());
+  EXPECT_EQ(std::vector<int>({ 6, 7, 8, 9 }), stereo_b);
+
+  // Empty slices are fine too.
+  DataProvider empty = dataset.Slice(2000, 3000);
+  EXPECT_TRUE(empty.StereoItems().empty());
+  EXPECT_FALSE(empty.Step());
+}
+
+
+TEST(DataProviderTest, TestStereoFrameCallback)
+{
+  for (size_t lookahead : { 0ul, 2ul }) {
+    SteppedDataset dataset;
+    dataset.SetStereoPrefetch(lookahead, 2);
+
+    std::vector<const uint8_t*> frame_data, gray_data;
+    std::vector<int> stereo;
+    dataset.RegisterStereoFrameCallback([&](const StereoFrame& frame)
+    {
+      EXPECT_FALSE(frame.left_image->IsColor());
+      frame_data.emplace_back(frame.left_image->Gray().data);
+    });
+    dataset.RegisterStereoCallback([&](const StereoImage1b& pair)
+    {
+      gray_data.emplace_back(pair.left_image.data);
+      stereo.emplace_back(pair.left_image(0, 0));
+    });
+    while (dataset.Step()) {}
+
+    // Both callbacks see the same gray buffer.
+    EXPECT_EQ(std::vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }), stereo);
+    EXPECT_EQ(frame_data, gray_data);
+  }
+}
@@ -0,0 +1,114 @@
+#include <cmath>
+#include <cstdio>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/dataset_analyzer.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static const std::string kReportPath = "/tmp/dataset_analyzer_test.csv";
+
+
+// 200 Hz IMU (long enough to be split across threads), with:
+// - a 100 ms gap after #1000
+// - a repeated timestamp at #2000
+// - a timestamp that goes backwards at #3000
+// - the x acceleration pinned at its max for 5 samples
+static std::vector<ImuMeasurement> MakeImu(size_t n)
+{
+  std::vector<ImuMeasurement> imu;
+  timestamp_t t = 0;
+  for (size_t i = 0; i < n; ++i) {
+    t += (i == 1001) ? 100000000 : 5000000;
+    timestamp_t ti = t;
+    if (i == 2000) { ti = imu.back().timestamp; }
+    if (i == 3000) { ti = imu.back().timestamp - 1; }
+
+    const double ax = (i % 50000 == 7) ? 40.0 : 0.1 * std::sin(0.01 * i);
+    imu.emplace_back(ImuMeasurement(ti, Vector3d(0.01, 0, 0), Vector3d(ax, 0, 9.81)));
+  }
+  return imu;
+}
+
+
+TEST(DatasetAnalyzerTest, TestImu)
+{
+  const std::vector<ImuMeasurement> imu = MakeImu(250000);
+
+  for (int max_threads : { 1, 4 }) {
+    const DatasetReport report = AnalyzeDataset({}, imu, {}, {}, {}, max_threads);
+    ASSERT_EQ(5ul, report.streams.size());
+
+    const StreamReport* s = report.Find("IMU");
+    ASSERT_TRUE(s != nullptr);
+    EXPECT_EQ(250000ul, s->count);
+    EXPECT_EQ(1ul, s->num_gaps);
+    EXPECT_EQ(1ul, s->num_duplicates);
+    EXPECT_EQ(1ul, s->num_out_of_order);
+    EXPECT_EQ(5ul, s->num_saturated);
+    EXPECT_EQ(0ul, s->num_invalid);
+    EXPECT_NEAR(200.0, s->rate_hz, 0.1);
+    EXPECT_NEAR(5.0, s->dt_p50_ms, 0.2);
+    EXPECT_NEAR(100.0, s->dt_max_ms, 3.0);
+    EXPECT_GT(s->jitter_ms, 0.0);
+
+    EXPECT_EQ(0ul, report.Find("STEREO")->count);
+    EXPECT_TRUE(report.Find("MAG") == nullptr);
+  }
+}
+
+
+TEST(DatasetAnalyzerTest, TestInvalid)
+{
+  std::vector<DepthMeasurement> depth;
+  for (int i = 0; i < 10; ++i) {
+    depth.emplace_back(DepthMeasurement(1000 * (i + 1), (i == 6) ? -1.0 : 0.5 * i));
+  }
+
+  const DatasetReport report = AnalyzeDataset({}, {}, depth, {}, {});
+  EXPECT_EQ(1ul, report.Find("DEPTH")->num_invalid);
+  EXPECT_EQ(6ul, report.Find("DEPTH")->first_invalid);
+}
+
+
+TEST(DatasetAnalyzerTest, TestCache)
+{
+  std::remove(kReportPath.c_str());
+
+  std::vector<ImuMeasurement> imu = MakeImu(5000);
+  std::vector<GroundtruthItem> poses;
+  poses.emplace_back(GroundtruthItem(123, Matrix4d::Identity()));
+
+  const DatasetReport report = AnalyzeDataset({}, imu, {}, {}, poses);
+  EXPECT_TRUE(ReportMatchesData(report, {}, imu, {}, {}, poses));
+
+  DatasetReport loaded;
+  EXPECT_FALSE(LoadReport(kReportPath, loaded));
+  ASSERT_TRUE(SaveReport(kReportPath, report));
+  ASSERT_TRUE(LoadReport(kReportPath, loaded));
+  ASSERT_EQ(report.streams.size(), loaded.streams.size());
+
+  for (size_t i = 0; i < report.streams.size(); ++i) {
+    const StreamReport& a = report.streams.at(i);
+    const StreamReport& b = loaded.streams.at(i);
+    EXPECT_EQ(a.name, b.name);
+    EXPECT_EQ(a.count, b.count);
+    EXPECT_EQ(a.t_first, b.t_first);
+    EXPECT_EQ(a.t_last, b.t_last);
+    EXPECT_FLOAT_EQ(a.rate_hz, b.rate_hz);
+    EXPECT_FLOAT_EQ(a.dt_p99_ms, b.dt_p99_ms);
+    EXPECT_EQ(a.num_gaps, b.num_gaps);
+    EXPECT_EQ(a.num_saturated, b.num_saturated);
+  }
+  EXPECT_TRUE(ReportMatchesData(loaded, {}, imu, {}, {}, poses));
+
+  // Any change to the ends of a stream invalidates the report.
+  imu.pop_back();
+  EXPECT_FALSE(ReportMatchesData(loaded, {}, imu, {}, {}, poses));
+  EXPECT_FALSE(ReportMatchesData(loaded, {}, MakeImu(5000), {}, {}, {}));
+}
@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/file_utils.hpp"
+#include "dataset/async_euroc_data_writer.hpp"
+#include "dataset/csv_reader.hpp"
+#include "dataset/dataset_analyzer.hpp"
+#include "dataset/euroc_data_writer.hpp"
+#include "dataset/euroc_dataset.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static const std::string kFolder = "/tmp/euroc_data_writer_test";
+
+
+static int64_t FindCounter(const StatsSnapshot& s, const std::string& name)
+{
+  for (const auto& c : s.counters) {
+    if (c.first == name) { return c.second; }
+  }
+  return -1;
+}
+
+
+TEST(EurocDataWriterTest, TestAsync)
+{
+  const Image3b im(12, 16, cv::Vec3b(10, 100, 200));
+
+  StatsSnapshot stats;
+  {
+    // A tiny queue, so that the writer has to block on the encoders.
+    AsyncEurocDataWriter writer(kFolder, ".jpg", 90, 3, 1, false, 0.01);
+    for (int i = 0; i < 200; ++i) {
+      const timestamp_t t = 1000 + 10 * i;
+      writer.WriteImu(ImuMeasurement(t, Vector3d(0.01 * i, 0, 0), Vector3d(0, 0, 9.81)));
+      if (i % 10 == 0) {
+        writer.WriteDepth(DepthMeasurement(t, 0.1 * i));
+        writer.WriteRange(RangeMeasurement(t, 0.5 * i, Vector3d(1, 2, 3)));
+        writer.WriteStereo(StereoImage3b(t, i, im, im));
+      }
+    }
+    writer.Close();
+    stats = writer.GetStats();
+  }
+
+  EXPECT_EQ(0, FindCounter(stats, "Backpressure/stereo_dropped"));
+  EXPECT_EQ(0, FindCounter(stats, "Encode/stereo_failed"));
+  EXPECT_GE(FindCounter(stats, "Backpressure/stereo_blocked"), 0);
+
+  // Every CSV starts with a header.
+  EXPECT_EQ(201ul, CsvReader(Join(kFolder, "mav0/imu0/data.csv")).NumLines());
+  EXPECT_EQ(21ul, CsvReader(Join(kFolder, "mav0/depth0/data.csv")).NumLines());
+  EXPECT_EQ(21ul, CsvReader(Join(kFolder, "mav0/aps0/data.csv")).NumLines());
+
+  // The stereo rows are in order (even though the pairs were encoded on several threads), and
+  // point at the JPEG files.
+  EurocDataset dataset(kFolder);
+  const std::vector<StereoDatasetItem>& items = dataset.StereoItems();
+  ASSERT_EQ(20ul, items.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    const timestamp_t t = 1000 + 100 * i;
+    EXPECT_EQ(t, items.at(i).timestamp);
+    EXPECT_EQ(Join(kFolder, "mav0/cam0/data/" + std::to_string(t) + ".jpg"), items.at(i).path_left);
+    EXPECT_TRUE(Exists(items.at(i).path_right));
+  }
+}
+
+
+TEST(EurocDataWriterTest, TestDropIfFull)
+{
+  const Image3b im(12, 16, cv::Vec3b(10, 100, 200));
+
+  AsyncEurocDataWriter writer(kFolder, ".png", 1, 1, 2, true);
+  for (int i = 0; i < 50; ++i) {
+    writer.WriteImu(ImuMeasurement(1000 + i, Vector3d::Zero(), Vector3d(0, 0, 9.81)));
+    writer.WriteStereo(StereoImage3b(1000 + i, i, im, im));
+  }
+  writer.Close();
+
+  // Whatever wasn't dropped made it into the CSV.
+  const StatsSnapshot stats = writer.GetStats();
+  const int64_t num_dropped = FindCounter(stats, "Backpressure/stereo_dropped");
+  EXPECT_EQ(0, FindCounter(stats, "Backpressure/stereo_blocked"));
+  EXPECT_EQ(static_cast<size_t>(50 - num_dropped), EurocDataset(kFolder).StereoItems().size());
+}
+
+
+TEST(EurocDataWriterTest, TestLazyRead)
+{
+  const std::string folder = "/tmp/euroc_data_writer_lazy_test";
+  const Image3b im(12, 16, cv::Vec3b(10, 100, 200));
+  {
+    EurocDataWriter writer(folder);
+    for (int i = 0; i < 100; ++i) {
+      const timestamp_t t = 1000 + 10 * i;
+      writer.WriteImu(ImuMeasurement(t, Vector3d(0.01 * i, 0, 0), Vector3d(0, 0, 9.81)));
+      if (i % 10 == 0) {
+        writer.WriteDepth(DepthMeasurement(t + 5, 0.1 * i));
+      }
+      if (i % 25 == 0) {
+        writer.WriteStereo(StereoImage3b(t, i, im, im));
+      }
+    }
+  }
+
+  // Only the streams with callbacks are read (and played back).
+  EurocDataset lazy(folder, true, 7);
+  std::vector<timestamp_t> imu;
+  lazy.RegisterImuCallback([&](const ImuMeasurement& data) { imu.emplace_back(data.timestamp); });
+  EXPECT_EQ(1000ul, lazy.FirstTimestamp());
+  EXPECT_EQ(1990ul, lazy.LastTimestamp());
+
+  while (lazy.Step()) {}
+  ASSERT_EQ(100ul, imu.size());
+  for (size_t i = 0; i < imu.size(); ++i) {
+    EXPECT_EQ(1000 + 10 * i, imu.at(i));
+  }
+
+  // Seeking (and starting over) reads the right chunk back in.
+  imu.clear();
+  lazy.SeekTo(1505);
+  lazy.StepUntil(DataSource::IMU);
+  ASSERT_EQ(1ul, imu.size());
+  EXPECT_EQ(1510ul, imu.front());
+  lazy.Reset();
+  lazy.StepUntil(DataSource::IMU);
+  EXPECT_EQ(1000ul, imu.back());
+
+  // Everything else still loads on demand, and matches reading the whole dataset up front.
+  EurocDataset eager(folder);
+  EXPECT_EQ(eager.Analyze().ToString(), lazy.Analyze().ToString());
+  EXPECT_EQ(eager.LastTimestamp(), lazy.Slice(1000, 3000).LastTimestamp());
+}
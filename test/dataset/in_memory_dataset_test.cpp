@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <thread>
+#include <vector>
+
+#include "dataset/in_memory_dataset.hpp"
+#include "dataset/stereo_prefetcher.hpp"
+#include "dataset/synthetic_dataset.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static SyntheticDataset::Params SmallParams()
+{
+  SyntheticDataset::Params params;
+  params.duration_sec = 2.0;
+  params.image_width = 64;
+  params.image_height = 48;
+  params.fx = 32.0;
+  return params;
+}
+
+
+TEST(InMemoryDatasetTest, TestMatchesSource)
+{
+  const SyntheticDataset source(SmallParams());
+  const InMemoryDataset dataset(source, false, 3);
+
+  ASSERT_EQ(source.StereoItems().size(), dataset.StereoItems().size());
+  EXPECT_EQ(source.FirstTimestamp(), dataset.FirstTimestamp());
+  EXPECT_EQ(source.LastTimestamp(), dataset.LastTimestamp());
+  EXPECT_EQ(source.GroundtruthPoses().size(), dataset.GroundtruthPoses().size());
+  EXPECT_EQ(21ul * 2 * 64 * 48, dataset.NumBytes());
+
+  for (size_t i = 0; i < dataset.StereoItems().size(); ++i) {
+    DecodedStereo expected, pair;
+    source.DecodeStereo(i, false, expected);
+    dataset.DecodeStereo(i, false, pair);
+    ASSERT_TRUE(pair.error.empty());
+    EXPECT_FALSE(pair.has_color);
+    EXPECT_EQ(0, cv::norm(expected.left->Gray(), pair.left->Gray(), cv::NORM_L1));
+    EXPECT_EQ(0, cv::norm(expected.right->Gray(), pair.right->Gray(), cv::NORM_L1));
+  }
+}
+
+
+TEST(InMemoryDatasetTest, TestSharedFrames)
+{
+  SyntheticDataset::Params params = SmallParams();
+  params.color = true;
+  const InMemoryDataset dataset(SyntheticDataset(params), true, 2);
+
+  // Copies and slices hand out the same frames (no decoding, and no copies of the images).
+  const DataProvider copy = dataset;
+  const DataProvider slice = dataset.Slice(dataset.StereoItems().at(5).timestamp, dataset.LastTimestamp() + 1);
+
+  DecodedStereo a, b, c;
+  dataset.DecodeStereo(5, true, a);
+  copy.DecodeStereo(5, true, b);
+  slice.DecodeStereo(0, false, c);
+  EXPECT_TRUE(a.has_color);
+  EXPECT_FALSE(c.has_color);
+  EXPECT_EQ(a.left.get(), b.left.get());
+  EXPECT_EQ(a.right.get(), c.right.get());
+
+  // Several copies can play back at once, and all of them see every measurement.
+  std::vector<DataProvider> players(4, dataset);
+  std::vector<size_t> num_stereo(players.size(), 0), num_imu(players.size(), 0);
+  for (size_t i = 0; i < players.size(); ++i) {
+    players.at(i).RegisterStereoCallback([&num_stereo, i](const StereoImage1b& stereo_pair)
+    {
+      EXPECT_EQ(cv::Size(64, 48), stereo_pair.left_image.size());
+      ++num_stereo.at(i);
+    });
+    players.at(i).RegisterImuCallback([&num_imu, i](const ImuMeasurement&) { ++num_imu.at(i); });
+  }
+
+  std::vector<std::thread> threads;
+  for (DataProvider& player : players) {
+    threads.emplace_back([&player]() { player.Playback(-1.0f); });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+
+  for (size_t i = 0; i < players.size(); ++i) {
+    EXPECT_EQ(21ul, num_stereo.at(i));
+    EXPECT_EQ(201ul, num_imu.at(i));
+  }
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/stereo_prefetcher.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+// NOTE(milo): None of the paths exist, so each pair decodes to an error that names its file. That
+// makes it easy to check which pair came back without any images on disk.
+static std::vector<StereoDatasetItem> MakeItems(size_t n)
+{
+  std::vector<StereoDatasetItem> items;
+  for (size_t i = 0; i < n; ++i) {
+    items.emplace_back(i, "/nonexistent/left_" + std::to_string(i) + ".png",
+                          "/nonexistent/right_" + std::to_string(i) + ".png");
+  }
+  return items;
+}
+
+
+static StereoDecoder MakeDecoder(const std::vector<StereoDatasetItem>& items)
+{
+  return [items](size_t idx, bool decode_color, DecodedStereo& out)
+  {
+    DecodeStereoItem(items.at(idx), decode_color, out);
+  };
+}
+
+
+static bool IsFor(const DecodedStereo& decoded, size_t i)
+{
+  return decoded.error.find("left_" + std::to_string(i) + ".png") != std::string::npos;
+}
+
+
+TEST(StereoPrefetcherTest, TestInOrder)
+{
+  const std::vector<StereoDatasetItem> items = MakeItems(20);
+  StereoPrefetcher prefetcher(items.size(), MakeDecoder(items), 4, 3, false);
+
+  DecodedStereo decoded;
+  for (size_t i = 0; i < items.size(); ++i) {
+    prefetcher.Get(i, decoded);
+    EXPECT_TRUE(IsFor(decoded, i)) << decoded.error;
+    EXPECT_FALSE(decoded.has_color);
+  }
+}
+
+
+TEST(StereoPrefetcherTest, TestSeek)
+{
+  const std::vector<StereoDatasetItem> items = MakeItems(20);
+  StereoPrefetcher prefetcher(items.size(), MakeDecoder(items), 3, 2, false);
+
+  DecodedStereo decoded;
+  for (size_t i = 0; i < 5; ++i) {
+    prefetcher.Get(i, decoded);
+    EXPECT_TRUE(IsFor(decoded, i));
+  }
+
+  // Back to the start (like DataProvider::Reset()), then skip past the lookahead window.
+  prefetcher.Get(0, decoded);
+  EXPECT_TRUE(IsFor(decoded, 0));
+  prefetcher.Get(1, decoded);
+  EXPECT_TRUE(IsFor(decoded, 1));
+  prefetcher.Get(15, decoded);
+  EXPECT_TRUE(IsFor(decoded, 15));
+  prefetcher.Get(17, decoded);
+  EXPECT_TRUE(IsFor(decoded, 17));
+  prefetcher.Get(19, decoded);
+  EXPECT_TRUE(IsFor(decoded, 19));
+}
+
+
+class FakeDataset : public DataProvider {
+ public:
+  explicit FakeDataset(const std::vector<StereoDatasetItem>& items) { stereo_data = items; }
+};
+
+
+TEST(StereoPrefetcherTest, TestDataProvider)
+{
+  // Missing files are reported the same way with and without prefetching.
+  for (size_t lookahead : { 0ul, 4ul }) {
+    FakeDataset dataset(MakeItems(5));
+    dataset.SetStereoPrefetch(lookahead, 2);
+    dataset.RegisterStereoCallback([](const StereoImage1b&) {});
+    EXPECT_THROW(dataset.Step(), std::runtime_error);
+
+    dataset.Reset();
+    EXPECT_THROW(dataset.Step(), std::runtime_error);
+  }
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/stereo_prefetcher.hpp"
+#include "dataset/synthetic_dataset.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static SyntheticDataset::Params SmallParams()
+{
+  SyntheticDataset::Params params;
+  params.duration_sec = 2.0;
+  params.image_width = 64;
+  params.image_height = 48;
+  params.fx = 32.0;
+  return params;
+}
+
+
+TEST(SyntheticDatasetTest, TestParams)
+{
+  const SyntheticDataset::Params params("./resources/config/SyntheticDataset.yaml");
+  EXPECT_EQ(672, params.image_width);
+  EXPECT_EQ(2, params.num_beacons);
+  EXPECT_FALSE(params.color);
+  EXPECT_TRUE(params.texture_path.empty());
+  EXPECT_DOUBLE_EQ(17.0, params.period_sec.y());
+}
+
+
+TEST(SyntheticDatasetTest, TestStreams)
+{
+  SyntheticDataset::Params params = SmallParams();
+  params.imu_hz = 200.0;
+  params.num_beacons = 3;
+  SyntheticDataset dataset(params);
+
+  // Every stream includes both ends of the duration.
+  EXPECT_EQ(21ul, dataset.StereoItems().size());
+  EXPECT_EQ(ConvertToNanoseconds(1.0), dataset.FirstTimestamp());
+  EXPECT_EQ(ConvertToNanoseconds(3.0), dataset.LastTimestamp());
+  EXPECT_EQ(201ul, dataset.GroundtruthPoses().size());
+
+  size_t num_imu = 0, num_depth = 0, num_range = 0;
+  dataset.RegisterImuCallback([&](const ImuMeasurement&) { ++num_imu; });
+  dataset.RegisterDepthCallback([&](const DepthMeasurement&) { ++num_depth; });
+  dataset.RegisterRangeCallback([&](const RangeMeasurement& range)
+  {
+    EXPECT_GT(range.range, 0);
+    ++num_range;
+  });
+  while (dataset.Step()) {}
+
+  EXPECT_EQ(401ul, num_imu);
+  EXPECT_EQ(101ul, num_depth);
+  EXPECT_EQ(9ul, num_range);
+
+  // A rate of zero leaves the stream out.
+  params.range_hz = 0;
+  SyntheticDataset no_range(params);
+  num_range = 0;
+  no_range.RegisterRangeCallback([&](const RangeMeasurement&) { ++num_range; });
+  while (no_range.Step()) {}
+  EXPECT_EQ(0ul, num_range);
+}
+
+
+TEST(SyntheticDatasetTest, TestImuMatchesTrajectory)
+{
+  const SyntheticDataset::Params params = SmallParams();
+
+  // At rest, the accelerometer only sees gravity (pointing up in the RDF body frame).
+  SyntheticDataset::Params still = params;
+  still.amplitude.setZero();
+  still.ypr_amplitude.setZero();
+  const ImuMeasurement rest = SyntheticDataset::ExactImu(still, 0.5);
+  EXPECT_NEAR(0, (rest.a - Vector3d(0, -9.81, 0)).norm(), 1e-9);
+  EXPECT_NEAR(0, rest.w.norm(), 1e-9);
+
+  // Otherwise, the IMU should agree with finite differences of the groundtruth.
+  const double t = 0.7;
+  const double h = 1e-3;
+  const Matrix4d T0 = SyntheticDataset::WorldTBody(params, t - h);
+  const Matrix4d T1 = SyntheticDataset::WorldTBody(params, t);
+  const Matrix4d T2 = SyntheticDataset::WorldTBody(params, t + h);
+
+  const Vector3d world_a = (T2.block<3, 1>(0, 3) - 2 * T1.block<3, 1>(0, 3) + T0.block<3, 1>(0, 3)) / (h * h);
+  const Vector3d expected_a = T1.block<3, 3>(0, 0).transpose() * (world_a - Vector3d(0, 9.81, 0));
+
+  const Eigen::AngleAxisd delta(Matrix3d(T1.block<3, 3>(0, 0).transpose() * T2.block<3, 3>(0, 0)));
+  const Vector3d expected_w = delta.axis() * delta.angle() / h;
+
+  const ImuMeasurement imu = SyntheticDataset::ExactImu(params, t);
+  EXPECT_NEAR(0, (imu.a - expected_a).norm(), 1e-4);
+  EXPECT_NEAR(0, (imu.w - expected_w).norm(), 1e-3);
+}
+
+
+TEST(SyntheticDatasetTest, TestRangesAndDepth)
+{
+  SyntheticDataset::Params params = SmallParams();
+  params.depth_noise_sigma = 0;
+  params.range_noise_sigma = 0;
+  SyntheticDataset dataset(params);
+
+  dataset.RegisterDepthCallback([&](const DepthMeasurement& depth)
+  {
+    const double t = ConvertToSeconds(depth.timestamp) - params.start_sec;
+    EXPECT_NEAR(SyntheticDataset::WorldTBody(params, t)(1, 3), depth.depth, 1e-6);
+  });
+  dataset.RegisterRangeCallback([&](const RangeMeasurement& range)
+  {
+    const double t = ConvertToSeconds(range.timestamp) - params.start_sec;
+    const Vector3d world_t_body = SyntheticDataset::WorldTBody(params, t).block<3, 1>(0, 3);
+    EXPECT_NEAR((world_t_body - range.point).norm(), range.range, 1e-6);
+  });
+  while (dataset.Step()) {}
+}
+
+
+TEST(SyntheticDatasetTest, TestDeterministicImages)
+{
+  SyntheticDataset::Params params = SmallParams();
+  params.color = true;
+  const SyntheticDataset a(params);
+  const SyntheticDataset b(params);
+
+  DecodedStereo pair_a, pair_b;
+  a.DecodeStereo(5, true, pair_a);
+  b.DecodeStereo(5, true, pair_b);
+  ASSERT_TRUE(pair_a.error.empty());
+  EXPECT_TRUE(pair_a.has_color);
+  EXPECT_EQ(cv::Size(64, 48), pair_a.left->Size());
+
+  // The same seed renders the same images, no matter which dataset (or thread) decodes them.
+  EXPECT_EQ(0, cv::norm(pair_a.left->Color(), pair_b.left->Color(), cv::NORM_L1));
+  EXPECT_EQ(0, cv::norm(pair_a.right->Color(), pair_b.right->Color(), cv::NORM_L1));
+
+  // The right camera is somewhere else, so it sees something different.
+  EXPECT_GT(cv::norm(pair_a.left->Gray(), pair_a.right->Gray(), cv::NORM_L1), 0);
+
+  // And the scene is textured (not the black background).
+  cv::Scalar mean, stddev;
+  cv::meanStdDev(pair_a.left->Gray(), mean, stddev);
+  EXPECT_GT(stddev[0], 5.0);
+
+  params.seed = 1;
+  DecodedStereo pair_c;
+  SyntheticDataset(params).DecodeStereo(5, false, pair_c);
+  EXPECT_FALSE(pair_c.has_color);
+  EXPECT_GT(cv::norm(pair_a.left->Gray(), pair_c.left->Gray(), cv::NORM_L1), 0);
+}
@@ -0,0 +1,103 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/trajectory_evaluator.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+// Groundtruth at 10 Hz, driving along +x at 1 m/s.
+static std::vector<GroundtruthItem> MakeGroundtruth(size_t n)
+{
+  std::vector<GroundtruthItem> poses;
+  for (size_t i = 0; i < n; ++i) {
+    Matrix4d T = Matrix4d::Identity();
+    T(0, 3) = 0.1 * i;
+    poses.emplace_back(GroundtruthItem(100000000ul * i, T));
+  }
+  return poses;
+}
+
+
+TEST(TrajectoryEvaluatorTest, TestNearest)
+{
+  const std::vector<GroundtruthItem> poses = MakeGroundtruth(10);
+
+  EXPECT_EQ(&poses.at(3), TrajectoryEvaluator::NearestGroundtruth(poses, 0.31, 0.05));
+  EXPECT_EQ(&poses.at(4), TrajectoryEvaluator::NearestGroundtruth(poses, 0.37, 0.05));
+  EXPECT_EQ(&poses.at(0), TrajectoryEvaluator::NearestGroundtruth(poses, -0.01, 0.05));
+  EXPECT_TRUE(TrajectoryEvaluator::NearestGroundtruth(poses, 0.35, 0.01) == nullptr);
+  EXPECT_TRUE(TrajectoryEvaluator::NearestGroundtruth(poses, 5.0, 0.05) == nullptr);
+}
+
+
+TEST(TrajectoryEvaluatorTest, TestPerfect)
+{
+  const std::vector<GroundtruthItem> poses = MakeGroundtruth(100);
+  TrajectoryEvaluator evaluator(poses, 0.01, 1.0);
+
+  for (const GroundtruthItem& gt : poses) {
+    EXPECT_TRUE(evaluator.AddPose(ConvertToSeconds(gt.timestamp), gt.world_T_body));
+  }
+  EXPECT_FALSE(evaluator.AddPose(20.0, Matrix4d::Identity()));
+
+  const TrajectoryError e = evaluator.Error();
+  EXPECT_EQ(100ul, e.num_matched);
+  EXPECT_EQ(1ul, e.num_unmatched);
+  EXPECT_NEAR(0, e.ate_rmse_m, 1e-9);
+  EXPECT_NEAR(0, e.ate_rot_rmse_deg, 1e-6);
+  EXPECT_EQ(9ul, e.num_rpe);
+  EXPECT_NEAR(0, e.rpe_trans_rmse_m, 1e-9);
+}
+
+
+TEST(TrajectoryEvaluatorTest, TestDrift)
+{
+  const std::vector<GroundtruthItem> poses = MakeGroundtruth(101);
+  TrajectoryEvaluator evaluator(poses, 0.01, 1.0);
+
+  // The estimate overshoots by 10%, so it's 0.1 m off after every 1 sec segment, and 1 m off at the end.
+  for (const GroundtruthItem& gt : poses) {
+    Matrix4d T = gt.world_T_body;
+    T(0, 3) *= 1.1;
+    evaluator.AddPose(ConvertToSeconds(gt.timestamp), T);
+  }
+
+  const TrajectoryError e = evaluator.Error();
+  EXPECT_EQ(101ul, e.num_matched);
+  EXPECT_EQ(10ul, e.num_rpe);
+  EXPECT_NEAR(0.1, e.rpe_trans_rmse_m, 1e-6);
+  EXPECT_NEAR(1.0, e.ate_max_m, 1e-6);
+  EXPECT_NEAR(1.0, e.ate_final_m, 1e-6);
+  EXPECT_NEAR(0.5, e.ate_p50_m, 0.03);
+
+  // RMSE of 0.01 * i for i = 0..100.
+  double sum_sq = 0;
+  for (int i = 0; i <= 100; ++i) { sum_sq += 1e-4 * i * i; }
+  EXPECT_NEAR(std::sqrt(sum_sq / 101), e.ate_rmse_m, 1e-6);
+}
+
+
+TEST(TrajectoryEvaluatorTest, TestRotation)
+{
+  const std::vector<GroundtruthItem> poses = MakeGroundtruth(11);
+  TrajectoryEvaluator evaluator(poses, 0.01, 0.5);
+
+  // A constant 2 deg yaw error shows up in ATE, but not RPE (the relative motion is still right).
+  const Matrix3d R = AngleAxisd(2.0 * M_PI / 180.0, Vector3d::UnitZ()).toRotationMatrix();
+  for (const GroundtruthItem& gt : poses) {
+    Matrix4d T = gt.world_T_body;
+    T.block<3, 3>(0, 0) = R;
+    evaluator.AddPose(ConvertToSeconds(gt.timestamp), T);
+  }
+
+  const TrajectoryError e = evaluator.Error();
+  EXPECT_NEAR(2.0, e.ate_rot_rmse_deg, 1e-6);
+  EXPECT_NEAR(0, e.ate_rmse_m, 1e-9);
+  EXPECT_EQ(2ul, e.num_rpe);
+  EXPECT_NEAR(0, e.rpe_rot_rmse_deg, 1e-4);
+}
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "dataset/stereo_prefetcher.hpp"
+#include "dataset/video_log.hpp"
+#include "dataset/video_log_dataset.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static const std::string kVideoLogPath = "/tmp/video_log_test";
+static const int kNumFrames = 30;
+
+
+static Image3b MakeImage3b(int rows, int cols, uint8_t seed)
+{
+  Image3b im(rows, cols);
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      im(r, c) = cv::Vec3b(static_cast<uint8_t>(seed + r), static_cast<uint8_t>(seed + c), seed);
+    }
+  }
+  return im;
+}
+
+
+// Lossless, so that the decoded pixels can be checked exactly. Also 100 IMU and 10 depth samples.
+static void WriteVideoLog()
+{
+  VideoLogWriter writer(kVideoLogPath, video_log::VideoCodec::FFV1, 30.0, 8000, 30, false);
+
+  for (int i = 0; i < 100; ++i) {
+    const timestamp_t t = 1000 + 10 * i;
+    writer.WriteImu(ImuMeasurement(t, Vector3d(0.01 * i, 0, 0), Vector3d(0, 0, 9.81)));
+    if (i % 10 == 0) {
+      writer.WriteDepth(DepthMeasurement(t, 0.1 * i));
+    }
+  }
+
+  for (int i = 0; i < kNumFrames; ++i) {
+    const uint8_t seed = static_cast<uint8_t>(3 * i);
+    writer.WriteStereo(StereoImage3b(1000 + 33 * i, i, MakeImage3b(48, 64, seed), MakeImage3b(48, 64, seed + 1)));
+  }
+}
+
+
+TEST(VideoLogTest, TestIndex)
+{
+  WriteVideoLog();
+
+  const VideoLogIndex index = VideoLogIndex::Read(kVideoLogPath + "/index.csv");
+  EXPECT_EQ(video_log::VideoCodec::FFV1, index.codec);
+  ASSERT_EQ(static_cast<size_t>(kNumFrames), index.frames.size());
+  EXPECT_EQ(1000ul + 33 * 29, index.frames.at(29).timestamp);
+
+  // FFV1 always has a keyframe every 12 frames.
+  EXPECT_TRUE(index.frames.at(0).keyframe);
+  EXPECT_TRUE(index.frames.at(12).keyframe);
+  EXPECT_FALSE(index.frames.at(13).keyframe);
+  EXPECT_EQ(0ul, index.KeyframeBefore(11));
+  EXPECT_EQ(12ul, index.KeyframeBefore(12));
+  EXPECT_EQ(24ul, index.KeyframeBefore(29));
+
+  EXPECT_THROW(VideoLogIndex::Read("/tmp/does_not_exist.csv"), std::runtime_error);
+  EXPECT_THROW(video_log::CodecFromString("mjpeg"), std::runtime_error);
+}
+
+
+TEST(VideoLogTest, TestRandomAccess)
+{
+  WriteVideoLog();
+
+  VideoLogReader reader(kVideoLogPath, false);
+
+  // Reading in order never seeks. Jumping back (or past a keyframe) seeks, but reading a little
+  // ahead decodes forward.
+  DecodedStereo out;
+  for (size_t idx : { 0, 1, 2, 5, 20, 3, 3, 29, 14 }) {
+    reader.Decode(idx, true, out);
+    ASSERT_TRUE(out.error.empty()) << out.error;
+    ASSERT_TRUE(out.has_color);
+
+    const uint8_t seed = static_cast<uint8_t>(3 * idx);
+    EXPECT_EQ(cv::Vec3b(seed + 5, seed + 7, seed), out.left->Color()(5, 7));
+    EXPECT_EQ(cv::Vec3b(seed + 48, seed + 64, seed + 1), out.right->Color()(47, 63));
+  }
+
+  // Both streams seek for 20, 3, 29 and 14 (5 decodes forward from 2, and the second 3 is cached).
+  EXPECT_EQ(8ul, reader.NumSeeks());
+
+  reader.Decode(kNumFrames, false, out);
+  EXPECT_FALSE(out.error.empty());
+}
+
+
+TEST(VideoLogTest, TestDataset)
+{
+  WriteVideoLog();
+
+  VideoLogDataset dataset(kVideoLogPath, false);
+  EXPECT_EQ(static_cast<size_t>(kNumFrames), dataset.StereoItems().size());
+  EXPECT_EQ(1000ul, dataset.FirstTimestamp());
+
+  size_t num_stereo = 0, num_imu = 0, num_depth = 0;
+  dataset.RegisterStereoCallback([&](const StereoImage1b& pair)
+  {
+    EXPECT_EQ(1000ul + 33 * num_stereo, pair.timestamp);
+    EXPECT_EQ(48, pair.left_image.rows);
+    ++num_stereo;
+  });
+  dataset.RegisterImuCallback([&](const ImuMeasurement&) { ++num_imu; });
+  dataset.RegisterDepthCallback([&](const DepthMeasurement&) { ++num_depth; });
+
+  dataset.SeekTo(1000 + 33 * 15);
+  while (dataset.Step()) {}
+
+  EXPECT_EQ(static_cast<size_t>(kNumFrames - 15), num_stereo);
+  EXPECT_GT(num_imu, 0ul);
+  EXPECT_GT(num_depth, 0ul);
+}
@@ -74,3 +74,139 @@ TEST(DetectorTest, TestDetectSequence)
   dataset.Playback(5.0f, false);
   LOG(INFO) << "DONE" << std::endl;
 }
+
+
+TEST(DetectorTest, TestDetectTiled)
+{
+  const Image1b iml = cv::imread("./resources/caddy_32_left.jpg", cv::IMREAD_GRAYSCALE);
+
+  FeatureDetector::Params params;
+  params.tile_rows = 4;
+  params.tile_cols = 4;
+  FeatureDetector detector(params);
+
+  VecPoint2f tracked_kp, new_kp;
+  detector.Detect(iml, tracked_kp, new_kp);
+
+  EXPECT_GT(new_kp.size(), 0u);
+  EXPECT_LE((int)new_kp.size(), params.max_features_per_frame);
+
+  for (const cv::Point2f& pt : new_kp) {
+    EXPECT_TRUE(pt.x >= 0 && pt.x < iml.cols && pt.y >= 0 && pt.y < iml.rows);
+  }
+
+  // Tracked keypoints count against the budget.
+  VecPoint2f new_kp2;
+  detector.Detect(iml, new_kp, new_kp2);
+  EXPECT_LE((int)(new_kp.size() + new_kp2.size()), params.max_features_per_frame);
+}
+
+
+TEST(DetectorTest, TestIncrementalTileBudgets)
+{
+  FeatureDetector::Params params;
+  params.max_features_per_frame = 40;
+  params.tile_rows = 2;
+  params.tile_cols = 2;
+  params.incremental = true;
+  params.incremental_fill_ratio = 0.5;
+  params.incremental_skip_coverage = 1.0;
+  FeatureDetector detector(params);
+
+  // 10 features per tile. The top left tile is full, the top right one is half full, the bottom
+  // left one has a few, and the bottom right one is empty.
+  const cv::Size size(100, 100);
+  VecPoint2f tracked_kp;
+  for (int i = 0; i < 10; ++i) { tracked_kp.emplace_back(10, 10); }
+  for (int i = 0; i < 5; ++i) { tracked_kp.emplace_back(60, 10); }
+  for (int i = 0; i < 2; ++i) { tracked_kp.emplace_back(10, 60); }
+
+  EXPECT_EQ(std::vector<int>({ 0, 0, 8, 10 }), detector.TileBudgets(size, tracked_kp));
+
+  // Only the emptiest tile fits in the per-frame budget.
+  params.incremental_max_tiles = 1;
+  FeatureDetector detector_budget(params);
+  EXPECT_EQ(std::vector<int>({ 0, 0, 0, 10 }), detector_budget.TileBudgets(size, tracked_kp));
+
+  // Half of the tiles are filled, which is enough coverage to skip detection.
+  params.incremental_skip_coverage = 0.5;
+  FeatureDetector detector_skip(params);
+  EXPECT_EQ(std::vector<int>({ 0, 0, 0, 0 }), detector_skip.TileBudgets(size, tracked_kp));
+
+  // Without incremental mode, every tile with room left is detected in.
+  params.incremental = false;
+  FeatureDetector detector_full(params);
+  EXPECT_EQ(std::vector<int>({ 0, 5, 8, 10 }), detector_full.TileBudgets(size, tracked_kp));
+}
+
+
+TEST(DetectorTest, TestDetectFastAnms)
+{
+  const Image1b iml = cv::imread("./resources/caddy_32_left.jpg", cv::IMREAD_GRAYSCALE);
+
+  for (const AnmsAlgorithm anms : { AnmsAlgorithm::NONE, AnmsAlgorithm::RANGE_TREE, AnmsAlgorithm::SSC }) {
+    FeatureDetector::Params params;
+    params.algorithm = FeatureAlgorithm::FAST;
+    params.anms_algorithm = anms;
+    FeatureDetector detector(params);
+
+    VecPoint2f tracked_kp, new_kp;
+    Timer timer(true);
+    detector.Detect(iml, tracked_kp, new_kp);
+    LOG(INFO) << "ANMS " << anms << ": detected " << new_kp.size() << " keypoints in "
+              << timer.Elapsed().milliseconds() << " ms" << std::endl;
+
+    EXPECT_GT(new_kp.size(), 0u);
+    EXPECT_LE((int)new_kp.size(), params.max_features_per_frame);
+
+    for (const cv::Point2f& pt : new_kp) {
+      EXPECT_TRUE(pt.x >= 0 && pt.x < iml.cols && pt.y >= 0 && pt.y < iml.rows);
+    }
+  }
+}
+
+
+TEST(DetectorTest, TestSelectKeypoints)
+{
+  // A dense cluster of strong corners in one corner of the image, and weaker ones everywhere.
+  std::vector<cv::KeyPoint> keypoints;
+  for (int i = 0; i < 20; ++i) {
+    for (int j = 0; j < 20; ++j) {
+      keypoints.emplace_back(cv::Point2f(2 * j, 2 * i), 1.0f, -1.0f, 100.0f + i + j);
+    }
+  }
+  for (int i = 0; i < 10; ++i) {
+    for (int j = 0; j < 10; ++j) {
+      keypoints.emplace_back(cv::Point2f(20 + 60 * j, 20 + 40 * i), 1.0f, -1.0f, 1.0f + 0.1f * (i + j));
+    }
+  }
+
+  FeatureDetector::Params params;
+  params.anms_algorithm = AnmsAlgorithm::NONE;
+  FeatureDetector detector_none(params);
+
+  // Without ANMS, only the cluster survives.
+  std::vector<cv::KeyPoint> kp_none = keypoints;
+  detector_none.SelectKeypoints(50, 640, 480, kp_none);
+  ASSERT_EQ(50ul, kp_none.size());
+  for (const cv::KeyPoint& kp : kp_none) {
+    EXPECT_GE(kp.response, 100.0f);
+  }
+
+  for (const AnmsAlgorithm anms : { AnmsAlgorithm::RANGE_TREE, AnmsAlgorithm::SSC }) {
+    params.anms_algorithm = anms;
+    FeatureDetector detector(params);
+
+    std::vector<cv::KeyPoint> kp = keypoints;
+    detector.SelectKeypoints(50, 640, 480, kp);
+    EXPECT_LE(kp.size(), 50ul);
+    EXPECT_GT(kp.size(), 40ul);
+
+    // With ANMS, most of the points should be outside of the cluster.
+    int num_spread = 0;
+    for (const cv::KeyPoint& k : kp) {
+      num_spread += (k.pt.x >= 40 || k.pt.y >= 40) ? 1 : 0;
+    }
+    EXPECT_GT(num_spread, 25);
+  }
+}
@@ -1,3 +1,5 @@
+#include <cmath>
+
 #include <gtest/gtest.h>
 #include <glog/logging.h>
 
@@ -38,3 +40,59 @@ TEST(TrackerTest, TestTrackLR)
   cv::imshow("Tracker", viz);
   cv::waitKey(0);
 }
+
+
+TEST(TrackerTest, TestWarpByRotation)
+{
+  const PinholeCamera cam(400, 400, 320, 240, 480, 640);
+  const VecPoint2f px_ref = { cv::Point2f(320, 240), cv::Point2f(100, 50), cv::Point2f(600, 400) };
+  VecPoint2f px_cur;
+
+  // No rotation, no motion.
+  WarpByRotation(cam, Matrix3d::Identity(), px_ref, px_cur);
+  ASSERT_EQ(px_ref.size(), px_cur.size());
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    EXPECT_NEAR(px_ref.at(i).x, px_cur.at(i).x, 1e-3);
+    EXPECT_NEAR(px_ref.at(i).y, px_cur.at(i).y, 1e-3);
+  }
+
+  // Rolling about the optical axis rotates pixels about the principal point.
+  const Matrix3d R_roll = Eigen::AngleAxisd(M_PI / 2, Vector3d::UnitZ()).toRotationMatrix();
+  WarpByRotation(cam, R_roll, { cv::Point2f(420, 240) }, px_cur);
+  ASSERT_EQ(1ul, px_cur.size());
+  EXPECT_NEAR(320, px_cur.at(0).x, 1e-3);
+  EXPECT_NEAR(340, px_cur.at(0).y, 1e-3);
+
+  // Panning moves the principal point by fx * tan(angle).
+  const double angle = 0.1;
+  const Matrix3d R_pan = Eigen::AngleAxisd(angle, Vector3d::UnitY()).toRotationMatrix();
+  WarpByRotation(cam, R_pan, { cv::Point2f(320, 240) }, px_cur);
+  EXPECT_NEAR(320 + 400 * std::tan(angle), px_cur.at(0).x, 1e-3);
+  EXPECT_NEAR(240, px_cur.at(0).y, 1e-3);
+
+  // Should match projecting the (rotated) 3D point, no matter its depth.
+  const Matrix3d cur_R_ref = (Eigen::AngleAxisd(0.05, Vector3d::UnitX()) *
+                              Eigen::AngleAxisd(-0.08, Vector3d::UnitY()) *
+                              Eigen::AngleAxisd(0.2, Vector3d::UnitZ())).toRotationMatrix();
+  WarpByRotation(cam, cur_R_ref, px_ref, px_cur);
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    const Vector3d p_ref = cam.Backproject(Vector2d(px_ref.at(i).x, px_ref.at(i).y), 3.0 + i);
+    const Vector2d expected = cam.Project(cur_R_ref * p_ref);
+    EXPECT_NEAR(expected.x(), px_cur.at(i).x, 1e-2);
+    EXPECT_NEAR(expected.y(), px_cur.at(i).y, 1e-2);
+  }
+
+  // Warping back by the inverse rotation recovers the reference pixels.
+  VecPoint2f px_back;
+  WarpByRotation(cam, cur_R_ref.transpose(), px_cur, px_back);
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    EXPECT_NEAR(px_ref.at(i).x, px_back.at(i).x, 1e-2);
+    EXPECT_NEAR(px_ref.at(i).y, px_back.at(i).y, 1e-2);
+  }
+
+  // Turning all the way around puts the point behind the camera, so it keeps its location.
+  const Matrix3d R_back = Eigen::AngleAxisd(M_PI, Vector3d::UnitY()).toRotationMatrix();
+  WarpByRotation(cam, R_back, { cv::Point2f(100, 50) }, px_cur);
+  EXPECT_EQ(100, px_cur.at(0).x);
+  EXPECT_EQ(50, px_cur.at(0).y);
+}
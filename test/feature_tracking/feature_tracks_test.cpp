@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include "feature_tracking/feature_tracks.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+TEST(FeatureTracksTest, TestAddRemove)
+{
+  FeatureTracks tracks;
+  EXPECT_TRUE(tracks.Empty());
+
+  tracks.AddObservation(7, 0, cv::Point2f(1, 2), 3.0);
+  tracks.AddObservation(7, 1, cv::Point2f(4, 5), 6.0);
+  tracks.AddObservation(9, 1, cv::Point2f(7, 8), 9.0);
+  EXPECT_EQ(2ul, tracks.Size());
+  EXPECT_TRUE(tracks.Contains(7));
+  EXPECT_TRUE(tracks.Contains(9));
+
+  const FeatureTracks::Slot s7 = tracks.GetSlot(7);
+  EXPECT_EQ(7ul, tracks.LandmarkId(s7));
+  EXPECT_EQ(2ul, tracks.NumObservations(s7));
+  EXPECT_EQ(1ul, tracks.CameraId(s7, 0));
+  EXPECT_EQ(4.0f, tracks.Pixel(s7, 0).x);
+  EXPECT_EQ(3.0, tracks.Disparity(s7, 1));
+
+  cv::Point2f px;
+  double disp;
+  EXPECT_TRUE(tracks.FindObservation(7, 0, px, disp));
+  EXPECT_EQ(2.0f, px.y);
+  EXPECT_EQ(3.0, disp);
+  EXPECT_FALSE(tracks.FindObservation(7, 5, px, disp));
+  EXPECT_FALSE(tracks.FindObservation(8, 0, px, disp));
+
+  // Removing a track frees its slot for the next new track, and keeps the other ids.
+  tracks.Remove(7);
+  EXPECT_FALSE(tracks.Contains(7));
+  EXPECT_EQ(1ul, tracks.Size());
+  tracks.AddObservation(11, 2, cv::Point2f(0, 0), 1.0);
+  EXPECT_EQ(s7, tracks.GetSlot(11));
+  EXPECT_EQ(1ul, tracks.NumObservations(s7));
+  EXPECT_EQ(9ul, tracks.LandmarkId(tracks.GetSlot(9)));
+
+  tracks.Clear();
+  EXPECT_TRUE(tracks.Empty());
+}
+
+
+TEST(FeatureTracksTest, TestRingOverflow)
+{
+  FeatureTracks tracks;
+  const size_t N = FeatureTracks::kMaxObsPerTrack;
+
+  for (size_t i = 0; i < 3*N; ++i) {
+    tracks.AddObservation(1, i, cv::Point2f(i, i), static_cast<double>(i));
+  }
+
+  const FeatureTracks::Slot s = tracks.GetSlot(1);
+  EXPECT_EQ(3*N, tracks.NumObservations(s));
+  EXPECT_EQ(N, tracks.NumStored(s));
+
+  // Only the last N observations are stored.
+  for (size_t k = 0; k < N; ++k) {
+    EXPECT_EQ(3*N - 1 - k, tracks.CameraId(s, k));
+  }
+
+  cv::Point2f px;
+  double disp;
+  EXPECT_TRUE(tracks.FindObservation(1, 3*N - N, px, disp));
+  EXPECT_FALSE(tracks.FindObservation(1, 3*N - N - 1, px, disp));
+}
+
+
+TEST(FeatureTracksTest, TestLiveSlotsStayPacked)
+{
+  FeatureTracks tracks;
+  for (core::uid_t id = 0; id < 10; ++id) {
+    tracks.AddObservation(id, 0, cv::Point2f(), 1.0);
+  }
+  for (core::uid_t id = 0; id < 10; id += 2) {
+    tracks.Remove(id);
+  }
+
+  ASSERT_EQ(5ul, tracks.LiveSlots().size());
+  for (const FeatureTracks::Slot s : tracks.LiveSlots()) {
+    EXPECT_EQ(1ul, tracks.LandmarkId(s) % 2);
+  }
+}
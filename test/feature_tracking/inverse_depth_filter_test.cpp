@@ -0,0 +1,74 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include "feature_tracking/feature_tracks.hpp"
+#include "feature_tracking/inverse_depth_filter.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+TEST(InverseDepthFilterTest, TestFuse)
+{
+  InverseDepthFilter::Params params;
+  params.meas_sigma = 0.5;
+  params.process_sigma = 0.0;
+  params.max_sigma = 0.3;
+  const InverseDepthFilter filter(params);
+
+  // With no process noise, the estimate is the running average of the matches.
+  InverseDepthFilter::Estimate e = filter.Initialize(10.0);
+  EXPECT_EQ(0.25, e.var);
+  EXPECT_TRUE(filter.NeedsMatch(e));
+
+  e = filter.Update(filter.Predict(e), 11.0);
+  EXPECT_NEAR(10.5, e.disp, 1e-9);
+  EXPECT_NEAR(0.125, e.var, 1e-9);
+
+  e = filter.Update(filter.Predict(e), 10.5);
+  EXPECT_NEAR(10.5, e.disp, 1e-9);
+  EXPECT_NEAR(0.25 / 3.0, e.var, 1e-9);
+  EXPECT_FALSE(filter.NeedsMatch(e));
+}
+
+
+TEST(InverseDepthFilterTest, TestPredictAndOutlier)
+{
+  InverseDepthFilter::Params params;
+  params.meas_sigma = 0.5;
+  params.process_sigma = 0.2;
+  params.max_sigma = 0.4;
+  params.outlier_sigmas = 3.0;
+  const InverseDepthFilter filter(params);
+
+  // Uncertainty grows with every frame since the last match, until it has to be matched again.
+  const InverseDepthFilter::Estimate e{ 20.0, 0.1 };
+  EXPECT_NEAR(0.14, filter.Predict(e).var, 1e-9);
+  EXPECT_FALSE(filter.NeedsMatch(filter.Predict(e, 1)));
+  EXPECT_TRUE(filter.NeedsMatch(filter.Predict(e, 2)));
+  EXPECT_EQ(20.0, filter.Predict(e, 2).disp);
+
+  // A match way outside of the prediction starts over from it.
+  const InverseDepthFilter::Estimate restarted = filter.Update(filter.Predict(e), 25.0);
+  EXPECT_EQ(25.0, restarted.disp);
+  EXPECT_EQ(0.25, restarted.var);
+}
+
+
+TEST(InverseDepthFilterTest, TestTrackVariance)
+{
+  FeatureTracks tracks;
+  tracks.AddObservation(3, 0, cv::Point2f(1, 2), 10.0);
+  EXPECT_LT(tracks.DisparityVariance(tracks.GetSlot(3)), 0);
+
+  // Only the newest observation's variance is kept.
+  tracks.AddObservation(3, 1, cv::Point2f(1, 2), 10.5, 0.125);
+  EXPECT_EQ(0.125, tracks.DisparityVariance(tracks.GetSlot(3)));
+
+  // A reused slot doesn't keep the old track's variance.
+  tracks.Remove(3);
+  tracks.AddObservation(4, 2, cv::Point2f(1, 2), 5.0);
+  EXPECT_LT(tracks.DisparityVariance(tracks.GetSlot(4)), 0);
+}
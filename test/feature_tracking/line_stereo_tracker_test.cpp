@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "core/timer.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "feature_tracking/line_stereo_tracker.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+static ld::KeyLine MakeKeyLine(float x0, float y0, float x1, float y1)
+{
+  ld::KeyLine kl;
+  kl.startPointX = x0;
+  kl.startPointY = y0;
+  kl.endPointX = x1;
+  kl.endPointY = y1;
+  kl.lineLength = std::sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+  return kl;
+}
+
+
+TEST(LineStereoTrackerTest, TestStereoDisparity)
+{
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  LineStereoTracker::Params params;
+  LineStereoTracker tracker(params, stereo_rig);
+
+  double d0, d1;
+
+  // The right line is shorter, and shifted 20px to the left.
+  EXPECT_TRUE(tracker.StereoDisparity(MakeKeyLine(100, 50, 150, 250), MakeKeyLine(87.5, 80, 120, 210), d0, d1));
+  EXPECT_NEAR(20.0, d0, 1e-3);
+  EXPECT_NEAR(20.0, d1, 1e-3);
+
+  // Endpoints in the opposite order.
+  EXPECT_TRUE(tracker.StereoDisparity(MakeKeyLine(100, 50, 150, 250), MakeKeyLine(120, 210, 87.5, 80), d0, d1));
+  EXPECT_NEAR(20.0, d0, 1e-3);
+  EXPECT_NEAR(20.0, d1, 1e-3);
+
+  // Negative disparity.
+  EXPECT_FALSE(tracker.StereoDisparity(MakeKeyLine(100, 50, 150, 250), MakeKeyLine(120, 50, 170, 250), d0, d1));
+
+  // Near-horizontal lines are ambiguous.
+  EXPECT_FALSE(tracker.StereoDisparity(MakeKeyLine(100, 50, 300, 55), MakeKeyLine(80, 50, 280, 55), d0, d1));
+
+  // Different angles.
+  EXPECT_FALSE(tracker.StereoDisparity(MakeKeyLine(100, 50, 150, 250), MakeKeyLine(80, 50, 80, 250), d0, d1));
+
+  // Not on the same rows.
+  EXPECT_FALSE(tracker.StereoDisparity(MakeKeyLine(100, 50, 100, 150), MakeKeyLine(80, 200, 80, 300), d0, d1));
+
+  // Too close (more disparity than stereo_min_depth allows).
+  EXPECT_FALSE(tracker.StereoDisparity(MakeKeyLine(500, 50, 500, 250), MakeKeyLine(300, 50, 300, 250), d0, d1));
+}
+
+
+TEST(LineStereoTrackerTest, TestSyntheticPair)
+{
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  // A few bright, slanted bars (like pilings), and a right image that's shifted by 16px. The bars
+  // all look a bit different, so that their descriptors are distinct.
+  Image1b iml(480, 752, (uint8_t)40);
+  for (int i = 0; i < 6; ++i) {
+    const cv::Point p0(100 + 100 * i, 60 + 10 * i);
+    const cv::Point p1(120 + 110 * i, 420);
+    cv::line(iml, p0, p1, cv::Scalar(120 + 20 * i), 6 + 3 * i);
+  }
+  const int shift = 16;
+  Image1b imr(iml.size(), (uint8_t)40);
+  iml(cv::Rect(shift, 0, iml.cols - shift, iml.rows)).copyTo(imr(cv::Rect(0, 0, iml.cols - shift, iml.rows)));
+
+  LineStereoTracker::Params params;
+  LineStereoTracker tracker(params, stereo_rig);
+
+  VecLineObservation obs1, obs2;
+  tracker.TrackAndTriangulate(StereoImage1b(0, 0, iml, imr), obs1);
+  ASSERT_GT(obs1.size(), 0u);
+
+  for (const LineObservation& obs : obs1) {
+    EXPECT_NEAR(shift, obs.disp_start, 2.0);
+    EXPECT_NEAR(shift, obs.disp_end, 2.0);
+    EXPECT_GT(obs.camera_line.P_start.z(), 0);
+    EXPECT_GT(obs.camera_line.P_end.z(), 0);
+  }
+
+  // The same lines should be tracked (with the same ids) in the next frame.
+  const size_t num_tracks = tracker.NumLiveTracks();
+  tracker.TrackAndTriangulate(StereoImage1b(1, 1, iml, imr), obs2);
+  EXPECT_EQ(num_tracks, tracker.NumLiveTracks());
+  ASSERT_EQ(obs1.size(), obs2.size());
+  for (size_t i = 0; i < obs1.size(); ++i) {
+    EXPECT_EQ(obs1.at(i).line_id, obs2.at(i).line_id);
+    EXPECT_EQ(1ul, obs2.at(i).camera_id);
+  }
+}
+
+
+TEST(LineStereoTrackerTest, TestTiming)
+{
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  for (const LineAlgorithm algorithm : { LineAlgorithm::LSD, LineAlgorithm::EDLINES }) {
+    LineStereoTracker::Params params;
+    params.algorithm = algorithm;
+    LineStereoTracker tracker(params, stereo_rig);
+
+    VecLineObservation obs;
+    Timer timer(true);
+    for (int iter = 0; iter < 20; ++iter) {
+      tracker.TrackAndTriangulate(StereoImage1b(iter, iter, iml, imr), obs);
+    }
+    LOG(INFO) << "Algorithm " << algorithm << ": triangulated " << obs.size() << " lines, averaged "
+              << timer.Elapsed().milliseconds() / 20.0 << " ms per stereo pair" << std::endl;
+  }
+}
@@ -1,3 +1,5 @@
+#include <cmath>
+
 #include <gtest/gtest.h>
 #include <glog/logging.h>
 
@@ -35,6 +37,140 @@ TEST(MatcherTest, TestSingle)
 }
 
 
+// The batched matcher should give the same disparities as matching each keypoint separately.
+TEST(MatcherTest, TestBatchedMatchesSingle)
+{
+  StereoMatcher::Params opt;
+  StereoMatcher matcher(opt);
+
+  opt.parallel = true;
+  StereoMatcher matcher_parallel(opt);
+
+  FeatureDetector::Params dopt;
+  FeatureDetector detector(dopt);
+
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+
+  VecPoint2f empty_kp, left_keypoints;
+  detector.Detect(iml, empty_kp, left_keypoints);
+  ASSERT_FALSE(left_keypoints.empty());
+
+  const std::vector<double> disp = matcher.MatchRectified(iml, imr, left_keypoints);
+  const std::vector<double> disp_parallel = matcher_parallel.MatchRectified(iml, imr, left_keypoints);
+  ASSERT_EQ(left_keypoints.size(), disp.size());
+  EXPECT_EQ(disp, disp_parallel);
+
+  // NOTE(milo): cv::matchTemplate computes the cost in floating point, so a near-tie can rarely
+  // pick a different pixel. Allow a few of those.
+  size_t num_different = 0;
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    const double disp_single = matcher.MatchRectified(iml, imr, left_keypoints.at(i));
+    num_different += (std::fabs(disp_single - disp.at(i)) > 1e-3) ? 1 : 0;
+  }
+  EXPECT_LE(num_different, left_keypoints.size() / 50);
+}
+
+
+// Searching around the right disparity should find the same match as the full search, and a
+// prediction that's way off should fall back to the full search.
+TEST(MatcherTest, TestPredictedDisparity)
+{
+  StereoMatcher::Params opt;
+  StereoMatcher matcher(opt);
+
+  FeatureDetector::Params dopt;
+  FeatureDetector detector(dopt);
+
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+
+  VecPoint2f empty_kp, left_keypoints;
+  detector.Detect(iml, empty_kp, left_keypoints);
+  ASSERT_FALSE(left_keypoints.empty());
+
+  const std::vector<double> disp = matcher.MatchRectified(iml, imr, left_keypoints);
+
+  std::vector<double> predicted(disp), wrong(disp.size(), -1.0);
+  for (size_t i = 0; i < disp.size(); ++i) {
+    if (disp.at(i) >= 0) {
+      wrong.at(i) = std::fmod(disp.at(i) + 0.5 * opt.max_disp, static_cast<double>(opt.max_disp));
+    }
+  }
+
+  const std::vector<double> disp_predicted = matcher.MatchRectified(iml, imr, left_keypoints, predicted);
+  ASSERT_EQ(disp.size(), disp_predicted.size());
+
+  size_t num_different = 0;
+  for (size_t i = 0; i < disp.size(); ++i) {
+    num_different += (disp.at(i) >= 0 && std::fabs(disp_predicted.at(i) - disp.at(i)) > 1e-3) ? 1 : 0;
+  }
+  EXPECT_LE(num_different, left_keypoints.size() / 50);
+
+  // NOTE(milo): A wrong prediction can still land on a (bad) local minimum that passes the cost
+  // threshold, so only check that most of them recover.
+  const std::vector<double> disp_wrong = matcher.MatchRectified(iml, imr, left_keypoints, wrong);
+  size_t num_recovered = 0, num_valid = 0;
+  for (size_t i = 0; i < disp.size(); ++i) {
+    if (disp.at(i) >= 0) {
+      ++num_valid;
+      num_recovered += (std::fabs(disp_wrong.at(i) - disp.at(i)) <= 1e-3) ? 1 : 0;
+    }
+  }
+  EXPECT_GE(num_recovered, num_valid / 2);
+}
+
+
+TEST(MatcherTest, TestNarrowMatchWindow)
+{
+  StereoMatcher::Params opt;
+  opt.predicted_disp_window = 4;
+
+  MatchWindow window;
+  ASSERT_TRUE(ComputeMatchWindow(opt, cv::Size(640, 480), cv::Size(640, 480), cv::Point2f(320, 240), window));
+  const cv::Rect full = window.stripe_rect;
+
+  // Disparities in [16, 24] put the template center between 296 and 304 in the right image.
+  ASSERT_TRUE(NarrowMatchWindow(opt, 20.0, window));
+  EXPECT_EQ(full.y, window.stripe_rect.y);
+  EXPECT_EQ(full.height, window.stripe_rect.height);
+  EXPECT_EQ(296 - (opt.templ_cols - 1) / 2, window.stripe_rect.x);
+  EXPECT_EQ(8 + opt.templ_cols, window.stripe_rect.width);
+
+  // A prediction outside of the full stripe can't be narrowed.
+  MatchWindow outside;
+  ComputeMatchWindow(opt, cv::Size(640, 480), cv::Size(640, 480), cv::Point2f(320, 240), outside);
+  EXPECT_FALSE(NarrowMatchWindow(opt, 500.0, outside));
+}
+
+
+TEST(MatcherTest, TestRescaledParams)
+{
+  StereoMatcher::Params opt;
+  opt.templ_cols = 31;
+  opt.templ_rows = 11;
+  opt.max_disp = 128;
+  opt.predicted_disp_window = 8;
+
+  const StereoMatcher::Params half = opt.Rescaled(0.5);
+  EXPECT_EQ(17, half.templ_cols);
+  EXPECT_EQ(7, half.templ_rows);
+  EXPECT_EQ(64, half.max_disp);
+  EXPECT_EQ(4, half.predicted_disp_window);
+  EXPECT_EQ(opt.max_matching_cost, half.max_matching_cost);
+
+  // Templates stay odd, and never get smaller than 3 x 3.
+  const StereoMatcher::Params tiny = opt.Rescaled(0.05);
+  EXPECT_EQ(3, tiny.templ_cols);
+  EXPECT_EQ(3, tiny.templ_rows);
+
+  const StereoMatcher::Params same = opt.Rescaled(1.0);
+  EXPECT_EQ(opt.templ_cols, same.templ_cols);
+  EXPECT_EQ(opt.templ_rows, same.templ_rows);
+  EXPECT_EQ(opt.max_disp, same.max_disp);
+}
+
+
 TEST(MatcherTest, TestSequence)
 {
   StereoMatcher::Params opt;
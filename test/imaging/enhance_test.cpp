@@ -13,14 +13,19 @@
 #include "imaging/enhance.hpp"
 #include "imaging/attenuation.hpp"
 #include "imaging/illuminant.hpp"
+#include "imaging/fused_correction.hpp"
 
 using namespace bm;
 using namespace core;
 using namespace imaging;
 
 
+// NOTE(milo): The DISABLED_ tests need local datasets or a display. Run them with
+// --gtest_also_run_disabled_tests.
+
+
 // https://github.com/opencv/opencv/issues/7762
-TEST(EnhanceTest, TestResizeDepth)
+TEST(EnhanceTest, DISABLED_TestResizeDepth)
 {
   const std::string resources_path = "/home/milo/bluemeadow/catkin_ws/src/vehicle/test/resources/";
 
@@ -42,7 +47,54 @@ TEST(EnhanceTest, TestResizeDepth)
 }
 
 
-TEST(EnhanceTest, TestStereoAndVoEnhance)
+
+TEST(EnhanceTest, TestEnhanceUnderwaterTiled)
+{
+  const std::string dir = "/tmp/bm_enhance_tiled_test/";
+  rmdir(dir);
+  mkdir(dir);
+
+  // A synthetic scene that gets darker and bluer with range, and has some missing range.
+  const int rows = 203, cols = 96;
+  Image3b bgr(rows, cols);
+  Image1f range(rows, cols);
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      const float z = 0.5f + 0.05f * static_cast<float>(x + y);
+      const float albedo = ((x / 8 + y / 8) % 2 == 0) ? 0.2f : 0.8f;
+      bgr(y, x) = cv::Vec3b(cv::saturate_cast<uint8_t>(255 * (0.1f + albedo * std::exp(-0.1f * z))),
+                            cv::saturate_cast<uint8_t>(255 * (0.1f + albedo * std::exp(-0.2f * z))),
+                            cv::saturate_cast<uint8_t>(255 * (0.05f + albedo * std::exp(-0.4f * z))));
+      range(y, x) = (x % 17 == 0) ? 0.0f : z;
+    }
+  }
+
+  const std::string bgr_path = Join(dir, "bgr.bmimage");
+  const std::string range_path = Join(dir, "range.bmimage");
+  const std::string out_path = Join(dir, "out.bmimage");
+  ASSERT_TRUE(WriteMappedImage(bgr_path, bgr));
+  ASSERT_TRUE(WriteMappedImage(range_path, range));
+
+  Vector12f beta_D_guess;
+  beta_D_guess << 2.0, 2.0, 2.0, -0.5, -0.5, -0.5, 0, 0, 0, 0, 0, 0;
+
+  // Tiles that don't divide the image (or the overview factor).
+  const EUInfo info = EnhanceUnderwaterTiled(bgr_path, range_path, 100, 10, 100, 10, beta_D_guess,
+                                             out_path, 0.25f, 13);
+
+  const MappedImage::Ptr out = MappedImage::Open(out_path);
+  ASSERT_TRUE(out != nullptr);
+  ASSERT_EQ(CV_8UC3, out->Image().type());
+
+  // Streaming doesn't change the result: it's the same as correcting the whole image at once.
+  Image3b expected;
+  CorrectImageFused(bgr, range, MakeCorrectionModel(info, range), expected);
+  EXPECT_EQ(0, cv::norm(expected, out->Image(), cv::NORM_INF));
+
+  rmdir(dir);
+}
+
+TEST(EnhanceTest, DISABLED_TestStereoAndVoEnhance)
 {
   std::vector<std::string> img_fnames;
   const std::string dataset_folder = "./resources/test_images_enhance/images/";
@@ -81,7 +133,7 @@ TEST(EnhanceTest, TestStereoAndVoEnhance)
 }
 
 
-TEST(EnhanceTest, TestSeathruDataset)
+TEST(EnhanceTest, DISABLED_TestSeathruDataset)
 {
   std::vector<std::string> img_fnames;
   std::vector<std::string> rng_fnames;
@@ -140,6 +192,17 @@ TEST(EnhanceTest, TestSeathruDataset)
     const double ms = timer.Elapsed().milliseconds();
     printf("Took %lf ms (%lf hz) to process frame\n", ms, 1000.0 / ms);
 
+    // Same frame, with the model estimated at half resolution.
+    Image3f J_half;
+    const EUInfo info_half = EnhanceUnderwater(
+        bgr, range, 256, 10, 256, 20, good_atten_coeff, J_half, 0.5f);
+    printf("[INFO] STAGE TIMES (ms): full res / half res estimation\n");
+    printf("  FINDDARK:    %lf / %lf\n", info.ms_finddark, info_half.ms_finddark);
+    printf("  BACKSCATTER: %lf / %lf\n", info.ms_backscatter, info_half.ms_backscatter);
+    printf("  ILLUMINANT:  %lf / %lf\n", info.ms_illuminant, info_half.ms_illuminant);
+    printf("  ATTENUATION: %lf / %lf\n", info.ms_attenuation, info_half.ms_attenuation);
+    printf("  CORRECTION:  %lf / %lf\n", info.ms_correction, info_half.ms_correction);
+
     // If the last attenuation coefficients were good, use them again. Otherwise revert to defaults.
     if (info.success_attenuation) {
       good_atten_coeff = info.beta_D;
@@ -0,0 +1,69 @@
+#include "gtest/gtest.h"
+
+#include "imaging/enhancement_pipeline.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+// A gray scene with a range gradient, so that every row has some dark (far) pixels.
+static void MakeScene(int rows, int cols, Image3f& bgr, Image1f& range)
+{
+  bgr = Image3f(rows, cols);
+  range = Image1f(rows, cols);
+
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      const float r = 1.0f + 9.0f * static_cast<float>(x) / static_cast<float>(cols);
+      range(y, x) = r;
+      const float v = 0.1f + 0.5f * std::exp(-0.3f * r);
+      bgr(y, x) = cv::Vec3f(v, 0.9f * v, 0.7f * v);
+    }
+  }
+}
+
+
+TEST(EnhancementPipelineTest, TestReestimateEvery)
+{
+  EnhancementPipeline::Params params;
+  params.reestimate_every = 4;
+  params.check_drift_every = 0;
+
+  EnhancementPipeline pipeline(params);
+
+  Image3f bgr, out;
+  Image1f range;
+  MakeScene(60, 80, bgr, range);
+
+  for (int i = 0; i < 10; ++i) {
+    const bool reestimated = pipeline.Process(bgr, range, out);
+    EXPECT_EQ((i % 4) == 0, reestimated) << "frame " << i;
+    EXPECT_EQ(bgr.size(), out.size());
+  }
+
+  // After a reset, the next frame is estimated from scratch.
+  pipeline.Reset();
+  EXPECT_TRUE(pipeline.Process(bgr, range, out));
+  EXPECT_FALSE(pipeline.Process(bgr, range, out));
+}
+
+
+TEST(EnhancementPipelineTest, TestDriftCheck)
+{
+  EnhancementPipeline::Params params;
+  params.reestimate_every = 0;
+  params.check_drift_every = 1;
+
+  EnhancementPipeline pipeline(params);
+
+  Image3f bgr, out;
+  Image1f range;
+  MakeScene(60, 80, bgr, range);
+
+  EXPECT_TRUE(pipeline.Process(bgr, range, out));
+
+  // A much brighter backscatter doesn't fit the params from the first frame.
+  const Image3f murky = bgr + cv::Scalar(0.3, 0.3, 0.3);
+  EXPECT_TRUE(pipeline.Process(murky, range, out));
+}
@@ -0,0 +1,30 @@
+#include "gtest/gtest.h"
+
+#include "imaging/fast_guided_filter.hpp"
+
+using namespace bm;
+using namespace imaging;
+
+
+TEST(FastGuidedFilterTest, TestCachedGuidedFilter)
+{
+  cv::Mat1f I(60, 80), p(60, 80);
+  cv::randu(I, 0.0f, 10.0f);
+  cv::randu(p, 0.0f, 1.0f);
+
+  CachedGuidedFilter filter(16, 0.01, 4);
+
+  const cv::Mat q1 = filter.filter(I, p);
+  EXPECT_FALSE(filter.Reused());
+
+  // Same values in a different buffer still count as the same guide.
+  const cv::Mat q2 = filter.filter(I.clone(), p);
+  EXPECT_TRUE(filter.Reused());
+  EXPECT_EQ(0, cv::norm(q1, q2, cv::NORM_INF));
+  EXPECT_EQ(0, cv::norm(q1, fastGuidedFilter(I, p, 16, 0.01, 4), cv::NORM_INF));
+
+  cv::Mat1f I2 = I.clone();
+  I2(30, 40) += 1.0f;
+  filter.filter(I2, p);
+  EXPECT_FALSE(filter.Reused());
+}
@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+
+#include "imaging/backscatter.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+// Intensity (x + W * y) / (W * H), so every pixel has a distinct value.
+static void MakeRamp(int rows, int cols, Image1f& intensity, Image1f& range)
+{
+  intensity = Image1f(rows, cols);
+  range = Image1f(rows, cols);
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      intensity(y, x) = static_cast<float>(x + cols * y) / static_cast<float>(rows * cols);
+      range(y, x) = 1.0f + static_cast<float>(y);
+    }
+  }
+}
+
+
+TEST(FindDarkTest, TestPercentile)
+{
+  Image1f intensity, range;
+  MakeRamp(64, 64, intensity, range);
+
+  // The bottom half has no range, so the darkest 10% comes from the top half.
+  for (int y = 0; y < 32; ++y) {
+    for (int x = 0; x < 64; ++x) {
+      range(y, x) = 0;
+    }
+  }
+
+  Image1b mask;
+  std::vector<cv::Point> dark_px;
+  const float threshold = FindDarkFast(intensity, range, 0.1f, 1, 50, mask, dark_px);
+
+  int N_dark = 0;
+  for (int y = 0; y < mask.rows; ++y) {
+    for (int x = 0; x < mask.cols; ++x) {
+      if (mask(y, x) > 0) {
+        ++N_dark;
+        EXPECT_GT(range(y, x), 0.1f);
+        EXPECT_LE(intensity(y, x), threshold);
+      }
+    }
+  }
+
+  // Within one histogram bin (4 pixels) of the 10th percentile.
+  EXPECT_GE(N_dark, 205);
+  EXPECT_LE(N_dark, 205 + 4);
+
+  ASSERT_EQ(50u, dark_px.size());
+  for (size_t i = 0; i < dark_px.size(); ++i) {
+    EXPECT_GT(mask(dark_px.at(i).y, dark_px.at(i).x), 0);
+    if (i > 0) {
+      EXPECT_GT(dark_px.at(i).x + 64 * dark_px.at(i).y, dark_px.at(i-1).x + 64 * dark_px.at(i-1).y);
+    }
+  }
+}
+
+
+TEST(FindDarkTest, TestRangeBins)
+{
+  Image1f intensity, range;
+  MakeRamp(64, 64, intensity, range);
+
+  // Intensity increases with range, so a single bin only takes close pixels. With a bin per row,
+  // each row contributes its own darkest pixels.
+  Image1b mask;
+  std::vector<cv::Point> dark_px;
+  FindDarkFast(intensity, range, 0.1f, 64, 0, mask, dark_px);
+  EXPECT_TRUE(dark_px.empty());
+
+  for (int y = 0; y < mask.rows; ++y) {
+    int N_dark = 0;
+    for (int x = 0; x < mask.cols; ++x) {
+      N_dark += (mask(y, x) > 0) ? 1 : 0;
+    }
+    EXPECT_GE(N_dark, 1) << "row " << y;
+  }
+}
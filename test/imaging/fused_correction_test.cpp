@@ -0,0 +1,82 @@
+#include <cmath>
+
+#include "gtest/gtest.h"
+
+#include "imaging/fused_correction.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+TEST(FusedCorrectionTest, TestFastMath)
+{
+  for (float x = -20.0f; x <= 20.0f; x += 0.01f) {
+    EXPECT_NEAR(1.0f, FastExp(x) / std::exp(x), 1e-5) << x;
+  }
+
+  for (float x = 1e-4f; x <= 1.0f; x *= 1.01f) {
+    EXPECT_NEAR(std::log2(x), FastLog2(x), 1e-4) << x;
+    EXPECT_NEAR(std::pow(x, 0.4545f), FastPow(x, 0.4545f), 1e-3) << x;
+  }
+}
+
+
+// Per-pixel version of RemoveBackscatter(), CorrectAttenuation() and LinearToGamma().
+static void CorrectPixelReference(const CorrectionModel& m, float range, float c[3])
+{
+  const float z_B = (range > 1e-3f) ? range : kBackscatterBackgroundRange;
+  const float z_D = (range > 0.0f) ? range : m.max_range;
+
+  for (int i = 0; i < 3; ++i) {
+    const float D = std::max(0.0f, c[i] - m.B[i] * (1.0f - std::exp(-m.beta_B[i] * z_B)));
+    const float beta_D = m.beta_D[i] * std::exp(m.beta_D[3 + i] * z_D) +
+                         m.beta_D[6 + i] * std::exp(m.beta_D[9 + i] * z_D);
+    const float J = D * std::exp(beta_D * z_D);
+    c[i] = 255.0f * std::pow(std::min(1.0f, J), m.gamma_power);
+  }
+}
+
+
+TEST(FusedCorrectionTest, TestCorrectImageFused)
+{
+  CorrectionModel m;
+  const float B[3] = { 0.132, 0.115, 0.0559 };
+  const float beta_B[3] = { 0.358, 0.695, 1.11 };
+  const float beta_D[12] = { 0.3, 0.4, 0.6, -0.1, -0.1, -0.2, 0.1, 0.1, 0.2, -0.5, -0.5, -0.6 };
+  std::copy(B, B + 3, m.B);
+  std::copy(beta_B, beta_B + 3, m.beta_B);
+  std::copy(beta_D, beta_D + 12, m.beta_D);
+  m.max_range = 8.0f;
+
+  const int rows = 37, cols = 53;
+  Image3b bgr(rows, cols);
+  Image1f range(rows, cols);
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      uint8_t* px = bgr.ptr<uint8_t>(y) + 3*x;
+      px[0] = (7*x + y) % 256;
+      px[1] = (3*x + 5*y) % 256;
+      px[2] = (x * y) % 256;
+      range(y, x) = (x % 11 == 0) ? 0.0f : 0.15f * static_cast<float>(x + y);
+    }
+  }
+
+  Image3b out;
+  CorrectImageFused(bgr, range, m, out);
+  ASSERT_EQ(rows, out.rows);
+  ASSERT_EQ(cols, out.cols);
+
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      const uint8_t* px = bgr.ptr<uint8_t>(y) + 3*x;
+      float c[3] = { px[0] / 255.0f, px[1] / 255.0f, px[2] / 255.0f };
+      CorrectPixelReference(m, range(y, x), c);
+
+      // Within one level of 8-bit rounding.
+      for (int i = 0; i < 3; ++i) {
+        EXPECT_NEAR(c[i], out.ptr<uint8_t>(y)[3*x + i], 1.01f) << x << " " << y << " " << i;
+      }
+    }
+  }
+}
@@ -0,0 +1,126 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "core/file_utils.hpp"
+#include "imaging/io.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+static void WriteFile(const std::string& path, const std::string& contents)
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << contents;
+}
+
+
+TEST(IoTest, TestDepthCacheRoundTrip)
+{
+  const std::string dir = "/tmp/bm_io_test/";
+  rmdir(dir);
+  mkdir(dir);
+
+  // The cache only looks at the path, size and mtime of the source, so it doesn't have to be a TIFF.
+  const std::string source = Join(dir, "depth.tif");
+  WriteFile(source, "not really a tiff");
+
+  Image1f depth(7, 13);
+  for (int y = 0; y < depth.rows; ++y) {
+    for (int x = 0; x < depth.cols; ++x) {
+      depth(y, x) = 0.5f * static_cast<float>(x + 100 * y);
+    }
+  }
+
+  const std::string cache = DepthCachePath(source, dir);
+  EXPECT_EQ(cache, DepthCachePath(source, dir));
+  EXPECT_NE(cache, DepthCachePath(Join(dir, "other.tif"), dir));
+
+  ASSERT_TRUE(WriteDepthCache(cache, source, depth));
+
+  {
+    const MappedDepth::Ptr mapped = MappedDepth::Open(cache, source);
+    ASSERT_TRUE(mapped != nullptr);
+    ASSERT_EQ(depth.rows, mapped->Image().rows);
+    ASSERT_EQ(depth.cols, mapped->Image().cols);
+    for (int y = 0; y < depth.rows; ++y) {
+      for (int x = 0; x < depth.cols; ++x) {
+        EXPECT_EQ(depth(y, x), mapped->Image()(y, x));
+      }
+    }
+  }
+
+  // A different source path doesn't match the header.
+  const std::string other = Join(dir, "other.tif");
+  WriteFile(other, "not really a tiff");
+  EXPECT_TRUE(MappedDepth::Open(cache, other) == nullptr);
+
+  // The source changed since the cache was written.
+  struct utimbuf times;
+  times.actime = 1000;
+  times.modtime = 1000;
+  ASSERT_EQ(0, utime(source.c_str(), &times));
+  EXPECT_TRUE(MappedDepth::Open(cache, source) == nullptr);
+
+  // A truncated cache file is rejected instead of read past the end.
+  ASSERT_TRUE(WriteDepthCache(cache, source, depth));
+  ASSERT_EQ(0, truncate(cache.c_str(), 100));
+  EXPECT_TRUE(MappedDepth::Open(cache, source) == nullptr);
+
+  rmdir(dir);
+}
+
+
+TEST(IoTest, TestMappedImage)
+{
+  const std::string dir = "/tmp/bm_io_test/";
+  rmdir(dir);
+  mkdir(dir);
+
+  // Tall enough that Release() drops some whole pages.
+  Image3f image(500, 37);
+  for (int y = 0; y < image.rows; ++y) {
+    for (int x = 0; x < image.cols; ++x) {
+      image(y, x) = cv::Vec3f(x, y, x * y);
+    }
+  }
+
+  const std::string path = Join(dir, "image.bmimage");
+  ASSERT_TRUE(WriteMappedImage(path, image));
+
+  {
+    const MappedImage::Ptr mapped = MappedImage::Open(path);
+    ASSERT_TRUE(mapped != nullptr);
+    EXPECT_FALSE(mapped->Writable());
+    ASSERT_EQ(CV_32FC3, mapped->Image().type());
+    ASSERT_EQ(image.size(), mapped->Image().size());
+
+    // Released rows are read back from the file.
+    mapped->Release(0, 250);
+    EXPECT_EQ(0, cv::norm(image, mapped->Image(), cv::NORM_INF));
+  }
+
+  // Writes through a writable mapping end up in the file.
+  {
+    const MappedImage::Ptr mapped = MappedImage::Open(path, true);
+    ASSERT_TRUE(mapped != nullptr);
+    mapped->Image().at<cv::Vec3f>(400, 3) = cv::Vec3f(-1, -2, -3);
+    mapped->Release(300, 500);
+    EXPECT_TRUE(mapped->Flush());
+  }
+  EXPECT_EQ(cv::Vec3f(-1, -2, -3), MappedImage::Open(path)->Image().at<cv::Vec3f>(400, 3));
+
+  // Anything else is rejected.
+  const std::string other = Join(dir, "other.bmimage");
+  WriteFile(other, "not really an image");
+  EXPECT_TRUE(MappedImage::Open(other) == nullptr);
+  EXPECT_TRUE(MappedImage::Open(Join(dir, "missing.bmimage")) == nullptr);
+
+  rmdir(dir);
+}
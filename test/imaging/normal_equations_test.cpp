@@ -0,0 +1,40 @@
+#include "gtest/gtest.h"
+
+#include "imaging/normal_equations.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+TEST(NormalEquationsTest, TestMatchesExplicitJacobian)
+{
+  // Not a multiple of kSamplesPerChunk, so the last chunk is partial.
+  const int m = 3 * kSamplesPerChunk + 17;
+
+  Eigen::MatrixXf J = Eigen::MatrixXf::Random(m, 12);
+  Eigen::VectorXf R = Eigen::VectorXf::Random(m);
+  Eigen::VectorXf err = Eigen::VectorXf::Random(m).cwiseAbs();
+
+  Matrix12f H;
+  Vector12f g;
+  const float error = AccumulateNormalEquations(m, [&](int i, Vector12f& Ji, float& Ri)
+  {
+    Ji = J.row(i).transpose();
+    Ri = R(i);
+    return err(i);
+  }, H, g);
+
+  const Matrix12f H_expected = J.transpose() * J;
+  const Vector12f g_expected = -J.transpose() * R;
+
+  EXPECT_LT((H - H_expected).cwiseAbs().maxCoeff(), 1e-3);
+  EXPECT_LT((g - g_expected).cwiseAbs().maxCoeff(), 1e-3);
+  EXPECT_NEAR(err.mean(), error, 1e-5);
+
+  EXPECT_NEAR(err.mean(), MeanErrorParallel(m, [&](int i) { return err(i); }), 1e-5);
+
+  // No samples.
+  EXPECT_EQ(0.0f, AccumulateNormalEquations(0, [&](int, Vector12f&, float&) { return 1.0f; }, H, g));
+  EXPECT_EQ(0.0f, H.cwiseAbs().maxCoeff());
+}
@@ -0,0 +1,96 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+
+#include <opencv2/imgproc.hpp>
+
+#include "imaging/normalization.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+static Image3b MakeRandomImage(int rows, int cols)
+{
+  Image3b bgr(rows, cols);
+  cv::randu(bgr, cv::Scalar(0, 0, 0), cv::Scalar(256, 256, 256));
+  return bgr;
+}
+
+
+TEST(NormalizationTest, TestGammaLut8)
+{
+  const Image3b bgr = MakeRandomImage(48, 64);
+
+  Image3b out;
+  LinearToGamma(bgr, out, 0.4545f);
+
+  for (int y = 0; y < bgr.rows; ++y) {
+    for (int x = 0; x < bgr.cols; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        const float expected = 255.0f * std::pow(bgr(y, x)[c] / 255.0f, 0.4545f);
+        EXPECT_NEAR(expected, out(y, x)[c], 0.5f);
+      }
+    }
+  }
+
+  // In-place.
+  Image3b inplace = bgr.clone();
+  LinearToGamma(inplace, inplace, 0.4545f);
+  EXPECT_EQ(0, cv::norm(inplace, out, cv::NORM_INF));
+}
+
+
+TEST(NormalizationTest, TestGammaLut16)
+{
+  Image3w bgr(16, 16);
+  cv::randu(bgr, cv::Scalar(0, 0, 0), cv::Scalar(65536, 65536, 65536));
+
+  const GammaLut lut(0.4545f);
+  Image3b out;
+  lut.Apply(bgr, out);
+
+  for (int y = 0; y < bgr.rows; ++y) {
+    for (int x = 0; x < bgr.cols; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        const float expected = 255.0f * std::pow(bgr(y, x)[c] / 65535.0f, 0.4545f);
+        EXPECT_NEAR(expected, out(y, x)[c], 0.5f);
+      }
+    }
+  }
+}
+
+
+TEST(NormalizationTest, TestNormalize8MatchesFloat)
+{
+  // A dim image, so that the stretch does something.
+  Image3b bgr = MakeRandomImage(64, 96);
+  bgr = bgr / 2 + cv::Scalar(20, 20, 20);
+
+  Image3b out;
+  Normalize(bgr, out);
+
+  Image3f bgrf;
+  bgr.convertTo(bgrf, CV_32FC3, 1.0 / 255.0);
+  Image3b expected;
+  Normalize(bgrf).convertTo(expected, CV_8UC3, 255.0);
+
+  // vmin/vmax are found slightly differently, so allow a few levels.
+  EXPECT_LE(cv::norm(expected, out, cv::NORM_INF), 4);
+}
+
+
+TEST(NormalizationTest, TestCorrectColorRatio8)
+{
+  Image3b bgr(32, 32, cv::Vec3b(100, 50, 25));
+
+  Image3b out;
+  CorrectColorRatio(bgr, out);
+
+  // Every channel is scaled to the mean of green.
+  const cv::Scalar mean = cv::mean(out);
+  EXPECT_NEAR(50, mean(0), 0.5);
+  EXPECT_NEAR(50, mean(1), 0.5);
+  EXPECT_NEAR(50, mean(2), 0.5);
+}
@@ -0,0 +1,142 @@
+#include "gtest/gtest.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include "imaging/attenuation.hpp"
+#include "imaging/backscatter.hpp"
+#include "imaging/normalization.hpp"
+#include "imaging/op_graph.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace imaging;
+
+
+static Image3f MakeRandomImage(int rows, int cols)
+{
+  Image3f bgr(rows, cols);
+  cv::randu(bgr, cv::Scalar(0.05, 0.05, 0.05), cv::Scalar(0.6, 0.7, 0.8));
+  return bgr;
+}
+
+
+static Image1f MakeRange(int rows, int cols)
+{
+  Image1f range(rows, cols);
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      range(y, x) = (x % 11 == 0) ? 0.0f : 0.05f * static_cast<float>(x + y);
+    }
+  }
+  return range;
+}
+
+
+static const Vector3f kB(0.132, 0.115, 0.0559);
+static const Vector3f kBetaB(0.358, 0.695, 1.11);
+
+
+static Vector12f BetaD()
+{
+  Vector12f beta_D;
+  beta_D << 0.3, 0.4, 0.6, -0.1, -0.1, -0.2, 0.1, 0.1, 0.2, -0.5, -0.5, -0.6;
+  return beta_D;
+}
+
+
+TEST(OpGraphTest, TestPlan)
+{
+  OpGraph graph;
+  EXPECT_EQ(0, graph.NumPasses());
+
+  // Per-pixel ops are fused into the pass before them, and barriers start a new one (unless
+  // they're first).
+  graph.RemoveBackscatter(kB, kBetaB).CorrectAttenuation(BetaD()).Normalize().LinearToGamma();
+  EXPECT_EQ(4, graph.NumOps());
+  EXPECT_EQ(2, graph.NumPasses());
+  EXPECT_EQ("[RemoveBackscatter CorrectAttenuation] [Normalize LinearToGamma]", graph.Plan());
+
+  OpGraph barrier_first;
+  barrier_first.WhiteBalanceSimple().LinearToGamma().CorrectColorRatio();
+  EXPECT_EQ("[WhiteBalanceSimple LinearToGamma] [CorrectColorRatio]", barrier_first.Plan());
+}
+
+
+TEST(OpGraphTest, TestFusedMatchesSteps)
+{
+  const Image3f bgr = MakeRandomImage(61, 83);
+  const Image1f range = MakeRange(61, 83);
+
+  OpGraph graph(7);
+  graph.RemoveBackscatter(kB, kBetaB)
+       .CorrectAttenuation(BetaD())
+       .WhiteBalanceSimple()
+       .CorrectColorRatio()
+       .Normalize()
+       .Sharpen()
+       .LinearToGamma(0.5f);
+  EXPECT_EQ(5, graph.NumPasses());
+
+  // The same thing, one step (and image) at a time.
+  const Image3f normalized = Normalize(CorrectColorRatio(WhiteBalanceSimple(
+      CorrectAttenuation(RemoveBackscatter(bgr, range, kB, kBetaB), range, BetaD()))));
+  Image3f sharpened;
+  OpGraph().Sharpen().Run(normalized, sharpened);
+  const Image3f steps = LinearToGamma(sharpened, 0.5f);
+
+  Image3f fused;
+  graph.Run(bgr, range, fused);
+  EXPECT_LT(cv::norm(steps, fused, cv::NORM_INF), 1e-5);
+
+  // The buffers are reused, and out can be the input.
+  Image3f inplace = bgr.clone();
+  graph.Run(inplace, range, inplace);
+  EXPECT_EQ(0, cv::norm(fused, inplace, cv::NORM_INF));
+}
+
+
+TEST(OpGraphTest, TestMatchesOpenCv)
+{
+  const Image3f bgr = MakeRandomImage(64, 96);
+  const Image1f range = MakeRange(64, 96);
+
+  // Normalize() stretches the value in HSV.
+  Image3f hsv;
+  cv::cvtColor(bgr, hsv, CV_BGR2HSV);
+  Image1f channels[3];
+  cv::split(hsv, channels);
+  Image1f smoothed_value;
+  cv::resize(channels[2], smoothed_value, hsv.size() / 8);
+  double vmin, vmax;
+  cv::minMaxLoc(smoothed_value, &vmin, &vmax);
+  channels[2] = (channels[2] - vmin) / (vmax - vmin);
+  cv::merge(channels, 3, hsv);
+  Image3f expected;
+  cv::cvtColor(hsv, expected, CV_HSV2BGR);
+  EXPECT_LT(cv::norm(expected, Normalize(bgr), cv::NORM_INF), 1e-3);
+
+  // RemoveBackscatter() treats a range <= 1e-3 as 20m.
+  Image1f range_default;
+  cv::threshold(range, range_default, 1e-3, 20.0f, CV_THRESH_BINARY_INV);
+  const Image1f z = range + range_default;
+  Image1f Ic[3];
+  cv::split(bgr, Ic);
+  for (int c = 0; c < 3; ++c) {
+    Image1f e;
+    cv::exp(-kBetaB(c) * z, e);
+    Ic[c] = Ic[c] - kB(c) * (1.0f - e);
+  }
+  cv::merge(Ic, 3, expected);
+  expected = cv::max(expected, 0.0f);
+  EXPECT_LT(cv::norm(expected, RemoveBackscatter(bgr, range, kB, kBetaB), cv::NORM_INF), 1e-5);
+
+  // Sharpen() is an unsharp mask that leaves low contrast pixels alone.
+  Image1f gray;
+  cv::cvtColor(bgr, gray, CV_BGR2GRAY);
+  Image1f blurred;
+  cv::GaussianBlur(gray, blurred, cv::Size(3, 3), 1.0, 1.0);
+  const Image1b low_contrast_mask = cv::abs(gray - blurred) < 0.01;
+  Image1f sharpened = gray*1.5 - blurred*0.5;
+  gray.copyTo(sharpened, low_contrast_mask);
+  EXPECT_LT(cv::norm(sharpened, Sharpen(gray), cv::NORM_INF), 1e-5);
+}
@@ -0,0 +1,151 @@
+#include <cstdio>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include <lcm/lcm-cpp.hpp>
+
+#include "dataset/stereo_prefetcher.hpp"
+#include "lcm_util/lcm_log_dataset.hpp"
+#include "lcm_util/util_vector3_t.hpp"
+
+#include "vehicle/depth_measurement_t.hpp"
+#include "vehicle/imu_measurement_t.hpp"
+#include "vehicle/stereo_image_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace dataset;
+
+
+static const std::string kLogPath = "/tmp/lcm_log_dataset_test.lcmlog";
+
+
+template <typename Msg>
+static void WriteEvent(lcm::LogFile& log, const std::string& channel, const Msg& msg, int64_t eventnum)
+{
+  std::vector<uint8_t> buf(msg.getEncodedSize());
+  msg.encode(buf.data(), 0, buf.size());
+
+  lcm::LogEvent event;
+  event.eventnum = eventnum;
+  event.timestamp = eventnum;
+  event.channel = channel;
+  event.datalen = buf.size();
+  event.data = buf.data();
+  ASSERT_EQ(0, log.writeEvent(&event));
+}
+
+
+static vehicle::image_t MakeRawImage(int rows, int cols, uint8_t seed)
+{
+  vehicle::image_t msg;
+  msg.width = cols;
+  msg.height = rows;
+  msg.channels = 1;
+  msg.format = "mono8";
+  msg.encoding = "raw";
+  msg.size = rows * cols;
+  msg.data.resize(msg.size);
+  for (int i = 0; i < msg.size; ++i) {
+    msg.data[i] = static_cast<uint8_t>(seed + i);
+  }
+  return msg;
+}
+
+
+// Writes 100 IMU, 10 depth and 10 stereo messages, and some on a channel that isn't played back.
+static void WriteLog(const LcmLogChannels& channels)
+{
+  std::remove(kLogPath.c_str());
+  std::remove(LcmLogDataset::IndexPath(kLogPath).c_str());
+  std::remove((kLogPath + ".report.csv").c_str());
+
+  lcm::LogFile log(kLogPath, "w");
+  ASSERT_TRUE(log.good());
+
+  int64_t eventnum = 0;
+  for (int i = 0; i < 100; ++i) {
+    const int64_t t = 1000 + 10 * i;
+
+    vehicle::imu_measurement_t imu;
+    imu.header.timestamp = t;
+    pack_vector3_t(Vector3d(0, 0, 9.81), imu.linear_acc);
+    pack_vector3_t(Vector3d(0.01 * i, 0, 0), imu.angular_vel);
+    WriteEvent(log, channels.imu, imu, eventnum++);
+
+    if (i % 10 == 0) {
+      vehicle::depth_measurement_t depth;
+      depth.header.timestamp = t;
+      depth.depth = 0.1 * i;
+      WriteEvent(log, channels.depth, depth, eventnum++);
+      WriteEvent(log, "some/other/channel", depth, eventnum++);
+
+      vehicle::stereo_image_t stereo;
+      stereo.header.timestamp = t;
+      stereo.img_left = MakeRawImage(6, 8, static_cast<uint8_t>(i));
+      stereo.img_right = MakeRawImage(6, 8, static_cast<uint8_t>(i + 1));
+      WriteEvent(log, channels.stereo, stereo, eventnum++);
+    }
+  }
+}
+
+
+TEST(LcmLogDatasetTest, TestIndexAndPlayback)
+{
+  const LcmLogChannels channels;
+  WriteLog(channels);
+
+  LcmLogDataset dataset(kLogPath, channels);
+  EXPECT_FALSE(dataset.UsedCachedIndex());
+  EXPECT_EQ(10ul, dataset.StereoItems().size());
+  EXPECT_EQ(1000ul, dataset.FirstTimestamp());
+  EXPECT_EQ(1990ul, dataset.LastTimestamp());
+
+  // Stereo pairs are decoded out of the log, by index.
+  DecodedStereo pair;
+  dataset.DecodeStereo(3, false, pair);
+  ASSERT_TRUE(pair.error.empty()) << pair.error;
+  const Image1b& left = pair.left->Gray();
+  EXPECT_EQ(6, left.rows);
+  EXPECT_EQ(8, left.cols);
+  EXPECT_EQ(30, left(0, 0));
+  EXPECT_EQ(31, pair.right->Gray()(0, 0));
+
+  size_t num_imu = 0, num_depth = 0, num_stereo = 0;
+  dataset.RegisterImuCallback([&](const ImuMeasurement& imu)
+  {
+    EXPECT_EQ(1000 + 10 * num_imu, imu.timestamp);
+    EXPECT_NEAR(0.01 * num_imu, imu.w.x(), 1e-9);
+    ++num_imu;
+  });
+  dataset.RegisterDepthCallback([&](const DepthMeasurement&) { ++num_depth; });
+  dataset.RegisterStereoCallback([&](const StereoImage1b& stereo)
+  {
+    EXPECT_EQ(1000 + 100 * num_stereo, stereo.timestamp);
+    EXPECT_EQ(static_cast<uint8_t>(10 * num_stereo), stereo.left_image(0, 0));
+    ++num_stereo;
+  });
+  while (dataset.Step()) {}
+
+  EXPECT_EQ(100ul, num_imu);
+  EXPECT_EQ(10ul, num_depth);
+  EXPECT_EQ(10ul, num_stereo);
+
+  // Opening the log again reads the cached index.
+  const LcmLogDataset again(kLogPath, channels);
+  EXPECT_TRUE(again.UsedCachedIndex());
+  EXPECT_EQ(10ul, again.StereoItems().size());
+
+  // A different set of channels needs a different index.
+  LcmLogChannels no_stereo = channels;
+  no_stereo.stereo = "";
+  const LcmLogDataset without_stereo(kLogPath, no_stereo);
+  EXPECT_FALSE(without_stereo.UsedCachedIndex());
+  EXPECT_EQ(0ul, without_stereo.StereoItems().size());
+}
+
+
+TEST(LcmLogDatasetTest, TestMissingLog)
+{
+  EXPECT_THROW(LcmLogDataset("/tmp/does_not_exist.lcmlog"), std::runtime_error);
+}
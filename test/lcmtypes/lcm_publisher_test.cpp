@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "lcm_util/lcm_publisher.hpp"
+#include "lcm_util/util_imu_measurement_t.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Keeps the last IMU batch received.
+class ImuBatchHandler final {
+ public:
+  void Handle(const lcm::ReceiveBuffer*, const std::string&, const vehicle::imu_batch_t* msg)
+  {
+    decode_imu_batch_t(*msg, received);
+    ++num_received;
+  }
+
+  std::vector<ImuMeasurement> received;
+  int num_received = 0;
+};
+
+
+TEST(LcmPublisherTest, TestImuBatch)
+{
+  // NOTE(milo): The memq provider delivers messages within this process, without a network.
+  lcm::LCM lcm("memq://");
+  ASSERT_TRUE(lcm.good());
+
+  ImuBatchHandler handler;
+  lcm.subscribe("imu_batch", &ImuBatchHandler::Handle, &handler);
+
+  std::vector<ImuMeasurement> batch;
+  for (int i = 0; i < 4; ++i) {
+    batch.emplace_back(100 + i, Vector3d(0.1 * i, 0, 0), Vector3d(0, 0, 9.81 + i));
+  }
+
+  LcmPublisher<vehicle::imu_batch_t> pub(lcm, "imu_batch");
+  pack_imu_batch_t(batch.data(), batch.size(), pub.Msg());
+  EXPECT_EQ(0, pub.Publish());
+  EXPECT_GT(lcm.handleTimeout(100), 0);
+
+  ASSERT_EQ(1, handler.num_received);
+  ASSERT_EQ(batch.size(), handler.received.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    EXPECT_EQ(batch.at(i).timestamp, handler.received.at(i).timestamp);
+    EXPECT_EQ(batch.at(i).w, handler.received.at(i).w);
+    EXPECT_EQ(batch.at(i).a, handler.received.at(i).a);
+  }
+  EXPECT_EQ(103, pub.Msg().header.timestamp);
+
+  // A smaller message reuses the same buffer, and a bigger one grows it.
+  pack_imu_batch_t(batch.data(), 1, pub.Msg());
+  EXPECT_EQ(0, pub.Publish());
+  EXPECT_GT(lcm.handleTimeout(100), 0);
+  ASSERT_EQ(2, handler.num_received);
+  EXPECT_EQ(1ul, handler.received.size());
+
+  const std::vector<ImuMeasurement> first_half = batch;
+  batch.insert(batch.end(), first_half.begin(), first_half.end());
+  pack_imu_batch_t(batch.data(), batch.size(), pub.Msg());
+  EXPECT_EQ(0, pub.Publish());
+  EXPECT_GT(lcm.handleTimeout(100), 0);
+  ASSERT_EQ(3, handler.num_received);
+  EXPECT_EQ(8ul, handler.received.size());
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include "lcm_util/util_mesh_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// A grid of vertices (with ids) and two triangles per cell.
+static TriangleMesh MakeGrid(int n, double z = 1.0)
+{
+  TriangleMesh mesh;
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      mesh.vertices.emplace_back(0.1 * j, 0.1 * i, z);
+      mesh.vertex_ids.emplace_back(static_cast<core::uid_t>(100 + i*n + j));
+    }
+  }
+  for (int i = 0; i + 1 < n; ++i) {
+    for (int j = 0; j + 1 < n; ++j) {
+      const int v = i*n + j;
+      mesh.triangles.emplace_back(v, v + 1, v + n + 1);
+      mesh.triangles.emplace_back(v, v + n + 1, v + n);
+    }
+  }
+  return mesh;
+}
+
+
+// Compares meshes by vertex id, since the decoder can put the vertices in any order.
+static void ExpectSameMesh(const TriangleMesh& expected, const TriangleMesh& actual, double tol)
+{
+  ASSERT_EQ(expected.vertices.size(), actual.vertices.size());
+  ASSERT_EQ(expected.triangles.size(), actual.triangles.size());
+
+  std::unordered_map<core::uid_t, Vector3d> vertices;
+  for (size_t i = 0; i < actual.vertices.size(); ++i) {
+    vertices.emplace(actual.vertex_ids.at(i), actual.vertices.at(i));
+  }
+
+  for (size_t i = 0; i < expected.vertices.size(); ++i) {
+    ASSERT_EQ(1ul, vertices.count(expected.vertex_ids.at(i)));
+    EXPECT_LE((vertices.at(expected.vertex_ids.at(i)) - expected.vertices.at(i)).norm(), tol);
+  }
+
+  std::set<MeshTriangleIds> triangles;
+  for (const Vector3i& t : actual.triangles) {
+    triangles.insert(CanonicalTriangleIds(actual.vertex_ids.at(t.x()), actual.vertex_ids.at(t.y()), actual.vertex_ids.at(t.z())));
+  }
+  for (const Vector3i& t : expected.triangles) {
+    EXPECT_EQ(1ul, triangles.count(
+        CanonicalTriangleIds(expected.vertex_ids.at(t.x()), expected.vertex_ids.at(t.y()), expected.vertex_ids.at(t.z()))));
+  }
+}
+
+
+TEST(MeshDeltaTest, RoundTrip)
+{
+  MeshDeltaEncoder encoder(10, 0.01);
+  MeshDeltaDecoder decoder;
+  TriangleMesh decoded;
+
+  TriangleMesh mesh = MakeGrid(4);
+  vehicle::mesh_delta_t msg;
+  encoder.Encode(mesh, msg);
+  EXPECT_TRUE(msg.keyframe);
+  EXPECT_EQ(16, msg.num_added);
+  EXPECT_EQ(18, msg.num_added_triangles);
+
+  ASSERT_TRUE(decoder.Decode(msg));
+  decoder.GetMesh(decoded);
+  ExpectSameMesh(mesh, decoded, 1e-4);
+
+  // Nothing changed, so nothing is sent.
+  encoder.Encode(mesh, msg);
+  EXPECT_FALSE(msg.keyframe);
+  EXPECT_EQ(0, msg.num_added + msg.num_moved + msg.num_removed);
+  EXPECT_EQ(0, msg.num_added_triangles + msg.num_removed_triangles);
+  ASSERT_TRUE(decoder.Decode(msg));
+
+  // Move one vertex, and remove the last row (and its triangles).
+  mesh.vertices.at(5).z() += 0.5;
+  TriangleMesh smaller = MakeGrid(3);
+  smaller.vertex_ids = { 100, 101, 102, 104, 105, 106, 108, 109, 110 };
+  smaller.vertices.at(4) = mesh.vertices.at(5);
+
+  encoder.Encode(smaller, msg);
+  EXPECT_EQ(1, msg.num_moved);
+  EXPECT_EQ(7, msg.num_removed);
+  EXPECT_EQ(0, msg.num_removed_triangles);
+
+  ASSERT_TRUE(decoder.Decode(msg));
+  decoder.GetMesh(decoded);
+  ExpectSameMesh(smaller, decoded, 1e-4);
+}
+
+
+TEST(MeshDeltaTest, DroppedMessage)
+{
+  MeshDeltaEncoder encoder(3, 0.01);
+  MeshDeltaDecoder decoder;
+  vehicle::mesh_delta_t msg;
+
+  encoder.Encode(MakeGrid(3), msg);
+  ASSERT_TRUE(decoder.Decode(msg));
+
+  // The decoder misses a message, so it waits for the next keyframe.
+  encoder.Encode(MakeGrid(3, 2.0), msg);
+  encoder.Encode(MakeGrid(3, 3.0), msg);
+  EXPECT_FALSE(decoder.Decode(msg));
+
+  encoder.Encode(MakeGrid(3, 4.0), msg);
+  EXPECT_TRUE(msg.keyframe);
+  ASSERT_TRUE(decoder.Decode(msg));
+
+  TriangleMesh decoded;
+  decoder.GetMesh(decoded);
+  ExpectSameMesh(MakeGrid(3, 4.0), decoded, 1e-4);
+}
@@ -0,0 +1,33 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/path_util.hpp"
+#include "lcm_util/perf_profile.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(PerfProfileTest, TestLoadProfiles)
+{
+  const PerfProfiles profiles(config_path("auv/PerfProfiles.yaml"));
+  ASSERT_EQ(3ul, profiles.profiles.size());
+  EXPECT_TRUE(profiles.initial_profile.empty());
+
+  const PerfProfile* transit = profiles.Find("transit");
+  ASSERT_NE(nullptr, transit);
+  EXPECT_EQ("transit", transit->name);
+  EXPECT_FALSE(transit->run_mesher);
+  EXPECT_EQ(3, transit->klt_max_level);
+
+  const PerfProfile* inspection = profiles.Find("inspection");
+  ASSERT_NE(nullptr, inspection);
+  EXPECT_TRUE(inspection->run_mesher);
+  EXPECT_EQ(3, inspection->patchmatch_iters);
+
+  const PerfProfile* docking = profiles.Find("docking");
+  ASSERT_NE(nullptr, docking);
+  EXPECT_FLOAT_EQ(50.0f, docking->filter_publish_hz);
+
+  EXPECT_EQ(nullptr, profiles.Find("does_not_exist"));
+}
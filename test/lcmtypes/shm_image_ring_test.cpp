@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "lcm_util/shm_image_ring.hpp"
+#include "vision_core/cv_types.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static const std::string kRingName = "bm_shm_image_ring_test";
+
+
+TEST(ShmImageRingTest, TestWriteRead)
+{
+  ShmImageRing publisher(kRingName, 3, 8 * 6);
+  const ShmImageRing subscriber(kRingName);
+  EXPECT_EQ(3, subscriber.NumSlots());
+
+  std::vector<int> slots;
+  std::vector<int64_t> seqs;
+  for (int i = 0; i < 4; ++i) {
+    const Image1b left(6, 8, static_cast<uint8_t>(i));
+    const Image1b right(6, 8, static_cast<uint8_t>(100 + i));
+    int slot = -1;
+    int64_t seq = -1;
+    ASSERT_TRUE(publisher.Write(1000 + i, left, right, slot, seq));
+    slots.emplace_back(slot);
+    seqs.emplace_back(seq);
+  }
+
+  // Slots are reused round-robin.
+  EXPECT_EQ(0, slots.at(0));
+  EXPECT_EQ(2, slots.at(2));
+  EXPECT_EQ(0, slots.at(3));
+
+  timestamp_t timestamp = 0;
+  cv::Mat left, right;
+  ASSERT_TRUE(subscriber.Read(slots.at(2), seqs.at(2), timestamp, left, right));
+  EXPECT_EQ(1002ul, timestamp);
+  EXPECT_EQ(6, left.rows);
+  EXPECT_EQ(8, left.cols);
+  EXPECT_EQ(2, left.ptr(5)[7]);
+  EXPECT_EQ(102, right.ptr(0)[0]);
+
+  // The first pair was overwritten by the fourth.
+  EXPECT_FALSE(subscriber.Read(slots.at(0), seqs.at(0), timestamp, left, right));
+  ASSERT_TRUE(subscriber.Read(slots.at(3), seqs.at(3), timestamp, left, right));
+  EXPECT_EQ(3, left.ptr(0)[0]);
+
+  // Too big for a slot.
+  int slot = -1;
+  int64_t seq = -1;
+  const Image1b big(10, 10, static_cast<uint8_t>(0));
+  EXPECT_FALSE(publisher.Write(2000, big, big, slot, seq));
+}
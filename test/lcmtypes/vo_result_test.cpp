@@ -0,0 +1,113 @@
+#include <type_traits>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/transform_util.hpp"
+#include "lcm_util/util_vo_result_t.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static_assert(!std::is_copy_constructible<VoResult>::value, "VoResult should be move-only");
+static_assert(std::is_move_constructible<VoResult>::value, "VoResult should be move-only");
+
+
+static VoResult MakeVoResult(uid_t base_lmk_id, int num_obs)
+{
+  VoResult result(1234567, 1200000, 42, 37);
+  result.is_keyframe = true;
+  result.status = 3;
+  result.rig = 1;
+  result.avg_reprojection_err = 0.25;
+
+  Vector6d xi;
+  xi << 0.1, -0.2, 0.05, 0.02, -0.01, 0.03;
+  result.lkf_T_cam = ExpSE3<double>(xi).Matrix();
+
+  for (int i = 0; i < num_obs; ++i) {
+    const double disp = (i % 10 == 0) ? -1.0 : (0.01 + 1.37 * i);
+    result.lmk_obs.emplace_back(base_lmk_id + 3 * i, 42, cv::Point2f(10.25f + i, 300.5f - i), disp, 0.9, 12.0);
+  }
+  return result;
+}
+
+
+static void ExpectSameObservations(const VecLandmarkObservation& expected, const VecLandmarkObservation& actual)
+{
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].landmark_id, actual[i].landmark_id);
+    EXPECT_EQ(expected[i].camera_id, actual[i].camera_id);
+    EXPECT_EQ(expected[i].pixel_location.x, actual[i].pixel_location.x);
+    EXPECT_EQ(expected[i].pixel_location.y, actual[i].pixel_location.y);
+    if (expected[i].disparity > 0) {
+      EXPECT_GT(actual[i].disparity, 0);
+      EXPECT_NEAR(expected[i].disparity, actual[i].disparity, 0.5 / PackedObservation::kDisparityScale);
+    } else {
+      EXPECT_LT(actual[i].disparity, 0);
+    }
+  }
+}
+
+
+TEST(VoResultTest, TestPackObservations)
+{
+  // Ids near a rig's offset don't fit in 32 bits, but their deltas do.
+  const uid_t base_lmk_id = 3ul << 40;
+  const VoResult result = MakeVoResult(base_lmk_id, 50);
+
+  PackedObservations packed;
+  PackObservations(result.lmk_obs, result.camera_id, packed);
+  EXPECT_EQ(base_lmk_id, packed.base_landmark_id);
+  EXPECT_EQ(result.lmk_obs.size(), packed.obs.size());
+
+  VecLandmarkObservation unpacked;
+  UnpackObservations(packed, unpacked);
+  ExpectSameObservations(result.lmk_obs, unpacked);
+
+  // Tiny disparities are still valid after packing.
+  VecLandmarkObservation tiny;
+  tiny.emplace_back(7, 2, cv::Point2f(1, 2), 1e-4, 0, 0);
+  tiny.emplace_back(9, 1, cv::Point2f(1, 2), 0.0, 0, 0);
+  PackObservations(tiny, 2, packed);
+  unpacked.clear();
+  UnpackObservations(packed, unpacked);
+  ASSERT_EQ(2ul, unpacked.size());
+  EXPECT_GT(unpacked[0].disparity, 0);
+  EXPECT_LT(unpacked[1].disparity, 0);
+  EXPECT_EQ(1ul, unpacked[1].camera_id);
+}
+
+
+TEST(VoResultTest, TestRoundTrip)
+{
+  const VoResult result = MakeVoResult(1000, 200);
+
+  vehicle::vo_result_t msg;
+  pack_vo_result_t(result, msg);
+
+  std::vector<uint8_t> buf(msg.getEncodedSize());
+  ASSERT_EQ(static_cast<int>(buf.size()), msg.encode(buf.data(), 0, buf.size()));
+
+  // Each observation is 16 bytes (plus the fixed size fields).
+  EXPECT_LT(buf.size(), 200 * 16 + 256);
+
+  vehicle::vo_result_t decoded_msg;
+  ASSERT_EQ(static_cast<int>(buf.size()), decoded_msg.decode(buf.data(), 0, buf.size()));
+
+  const VoResult decoded = decode_vo_result_t(decoded_msg);
+  EXPECT_EQ(result.timestamp, decoded.timestamp);
+  EXPECT_EQ(result.timestamp_lkf, decoded.timestamp_lkf);
+  EXPECT_EQ(result.camera_id, decoded.camera_id);
+  EXPECT_EQ(result.camera_id_lkf, decoded.camera_id_lkf);
+  EXPECT_EQ(result.rig, decoded.rig);
+  EXPECT_EQ(result.is_keyframe, decoded.is_keyframe);
+  EXPECT_EQ(result.status, decoded.status);
+  EXPECT_NEAR(result.avg_reprojection_err, decoded.avg_reprojection_err, 1e-6);
+  EXPECT_LT((result.lkf_T_cam - decoded.lkf_T_cam).norm(), 1e-9);
+
+  ExpectSameObservations(result.lmk_obs, decoded.lmk_obs);
+}
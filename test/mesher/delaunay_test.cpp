@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include "mesher/delaunay.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// Rotate each triangle so that it starts at its smallest id, so that two triangulations can be
+// compared as sets.
+static std::set<LmkTriangle> Canonical(const std::vector<LmkTriangle>& triangles)
+{
+  std::set<LmkTriangle> out;
+  for (const LmkTriangle& t : triangles) {
+    const size_t i = std::min_element(t.begin(), t.end()) - t.begin();
+    out.insert({ t[i], t[(i + 1) % 3], t[(i + 2) % 3] });
+  }
+  return out;
+}
+
+
+static cv::Point2f RandomPoint()
+{
+  return cv::Point2f(static_cast<float>(std::rand() % 64000) / 100.0f,
+                     static_cast<float>(std::rand() % 48000) / 100.0f);
+}
+
+
+TEST(Delaunay2D, Square)
+{
+  Delaunay2D d(cv::Rect(0, 0, 100, 100));
+  EXPECT_TRUE(d.Insert(1, cv::Point2f(10, 10)));
+  EXPECT_TRUE(d.Insert(2, cv::Point2f(60, 12)));
+  EXPECT_TRUE(d.Insert(3, cv::Point2f(58, 70)));
+  EXPECT_TRUE(d.Insert(4, cv::Point2f(11, 65)));
+
+  // Duplicates, and points outside of the rect, aren't added.
+  EXPECT_FALSE(d.Insert(1, cv::Point2f(20, 20)));
+  EXPECT_FALSE(d.Insert(5, cv::Point2f(60, 12)));
+  EXPECT_FALSE(d.Insert(6, cv::Point2f(100, 50)));
+  EXPECT_EQ(4ul, d.Size());
+  EXPECT_EQ(2ul, d.GetTriangles().size());
+
+  EXPECT_TRUE(d.Remove(3));
+  EXPECT_FALSE(d.Remove(3));
+  EXPECT_EQ(1ul, d.GetTriangles().size());
+
+  // Moving a vertex past the others still gives a valid triangulation.
+  EXPECT_TRUE(d.Move(1, cv::Point2f(90, 90)));
+  EXPECT_EQ(1ul, d.GetTriangles().size());
+}
+
+
+// Random inserts, removes and moves should give the same triangles as inserting the final points
+// into a new triangulation (points in general position have only one Delaunay triangulation).
+TEST(Delaunay2D, MatchesRebuild)
+{
+  std::srand(0);
+  const cv::Rect rect(0, 0, 640, 480);
+  Delaunay2D d(rect);
+  std::map<core::uid_t, cv::Point2f> points;
+
+  for (int iter = 0; iter < 2000; ++iter) {
+    const core::uid_t lmk_id = std::rand() % 200;
+    const int op = std::rand() % 4;
+
+    if (points.count(lmk_id) == 0) {
+      const cv::Point2f pt = RandomPoint();
+      if (d.Insert(lmk_id, pt)) {
+        points[lmk_id] = pt;
+      }
+    } else if (op == 0) {
+      EXPECT_TRUE(d.Remove(lmk_id));
+      points.erase(lmk_id);
+    } else {
+      // Mostly small moves (like a tracked landmark), and sometimes a jump across the image.
+      cv::Point2f pt = points.at(lmk_id);
+      if (op == 1) {
+        pt = RandomPoint();
+      } else {
+        pt.x = std::min(639.0f, std::max(0.0f, pt.x + static_cast<float>(std::rand() % 600 - 300) / 100.0f));
+        pt.y = std::min(479.0f, std::max(0.0f, pt.y + static_cast<float>(std::rand() % 600 - 300) / 100.0f));
+      }
+      if (d.Move(lmk_id, pt)) {
+        points[lmk_id] = pt;
+      } else {
+        points.erase(lmk_id);
+      }
+    }
+
+    ASSERT_EQ(points.size(), d.Size());
+
+    if (iter % 100 == 99) {
+      Delaunay2D expected(rect);
+      for (auto it = points.begin(); it != points.end(); ++it) {
+        ASSERT_TRUE(expected.Insert(it->first, it->second));
+      }
+      EXPECT_EQ(Canonical(expected.GetTriangles()), Canonical(d.GetTriangles()));
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#include <cstdlib>
+#include <unordered_map>
+
+#include <gtest/gtest.h>
+
+#include "mesher/edge_map.hpp"
+
+using namespace bm;
+using namespace mesher;
+
+
+TEST(EdgeMap, InsertFindErase)
+{
+  EdgeMap m;
+  EXPECT_EQ(EdgeMap::Key(3, 7), EdgeMap::Key(7, 3));
+
+  bool inserted;
+  *m.Insert(EdgeMap::Key(3, 7), 1.0f, inserted) += 2.0f;
+  EXPECT_TRUE(inserted);
+  EXPECT_EQ(3.0f, *m.Insert(EdgeMap::Key(7, 3), 0.0f, inserted));
+  EXPECT_FALSE(inserted);
+  EXPECT_EQ(1ul, m.Size());
+
+  EXPECT_EQ(nullptr, m.Find(EdgeMap::Key(3, 8)));
+  EXPECT_TRUE(m.Erase(EdgeMap::Key(7, 3)));
+  EXPECT_FALSE(m.Erase(EdgeMap::Key(7, 3)));
+  EXPECT_EQ(nullptr, m.Find(EdgeMap::Key(3, 7)));
+  EXPECT_EQ(0ul, m.Size());
+}
+
+
+// Random inserts and erases (enough to grow the map a few times) should match std::unordered_map.
+TEST(EdgeMap, MatchesUnorderedMap)
+{
+  std::srand(0);
+  EdgeMap m(16);
+  std::unordered_map<uint64_t, float> expected;
+
+  for (int i = 0; i < 20000; ++i) {
+    const uint64_t key = EdgeMap::Key(std::rand() % 64, std::rand() % 64);
+    if (std::rand() % 3 == 0) {
+      EXPECT_EQ(expected.erase(key) > 0, m.Erase(key));
+    } else {
+      bool inserted;
+      *m.Insert(key, 0.0f, inserted) += 1.0f;
+      EXPECT_EQ(expected.count(key) == 0, inserted);
+      expected[key] += 1.0f;
+    }
+  }
+
+  ASSERT_EQ(expected.size(), m.Size());
+  for (auto it = expected.begin(); it != expected.end(); ++it) {
+    const float* w = m.Find(it->first);
+    ASSERT_NE(nullptr, w);
+    EXPECT_EQ(it->second, *w);
+  }
+}
@@ -1,3 +1,7 @@
+#include <cstdlib>
+#include <map>
+#include <set>
+
 #include <gtest/gtest.h>
 
 #include "core/uid.hpp"
@@ -50,3 +54,138 @@ TEST(LandmarkGraph, All)
   EXPECT_EQ(1ul, clusters3.at(0).count(123));
   EXPECT_EQ(1ul, clusters3.at(0).count(456));
 }
+
+
+TEST(LandmarkGraph, SplitChain)
+{
+  LandmarkGraph g(2.0f);
+
+  // 0 - 1 - 2 - 3 - 4, all above the min weight.
+  for (core::uid_t i = 0; i < 4; ++i) {
+    g.UpdateEdge(i, i + 1, 2.0f, -2.0f, 2.0f);
+  }
+  EXPECT_EQ(1ul, g.GetClusters(2.0f).size());
+
+  // Dropping the middle edge splits the chain in two.
+  g.UpdateEdge(2, 1, -1.0f, -2.0f, 2.0f);
+  const LmkClusters clusters = g.GetClusters(2.0f);
+  ASSERT_EQ(2ul, clusters.size());
+  for (const LmkSet& c : clusters) {
+    EXPECT_TRUE(c.count(0) ? (c.size() == 2 && c.count(1)) : (c.size() == 3 && c.count(4)));
+  }
+
+  // A second path keeps the landmarks connected when an edge drops.
+  g.UpdateEdge(0, 4, 2.0f, -2.0f, 2.0f);
+  g.UpdateEdge(3, 4, -1.0f, -2.0f, 2.0f);
+  const LmkClusters clusters2 = g.GetClusters(2.0f);
+  ASSERT_EQ(2ul, clusters2.size());
+  for (const LmkSet& c : clusters2) {
+    EXPECT_TRUE(c.count(0) ? (c.size() == 3 && c.count(4)) : (c.size() == 2 && c.count(3)));
+  }
+}
+
+
+TEST(LandmarkGraph, RemoveSplits)
+{
+  LandmarkGraph g(1.0f);
+  g.UpdateEdge(10, 11, 1.0f, -5.0f, 5.0f);
+  g.UpdateEdge(11, 12, 1.0f, -5.0f, 5.0f);
+  EXPECT_EQ(1ul, g.GetClusters(1.0f).size());
+
+  // Removing the landmark in the middle leaves the other two on their own.
+  g.RemoveLandmark(11);
+  const LmkClusters clusters = g.GetClusters(1.0f);
+  EXPECT_EQ(2ul, clusters.size());
+  for (const LmkSet& c : clusters) {
+    EXPECT_EQ(1ul, c.size());
+    EXPECT_EQ(0ul, c.count(11));
+  }
+
+  // Adding it back reconnects them.
+  g.UpdateEdge(10, 11, 1.0f, -5.0f, 5.0f);
+  g.UpdateEdge(12, 11, 1.0f, -5.0f, 5.0f);
+  EXPECT_EQ(1ul, g.GetClusters(1.0f).size());
+}
+
+
+TEST(LandmarkGraph, ChangeMinWeight)
+{
+  LandmarkGraph g(1.0f);
+  g.UpdateEdge(1, 2, 1.0f, -5.0f, 5.0f);
+  g.UpdateEdge(2, 3, 3.0f, -5.0f, 5.0f);
+  EXPECT_EQ(1ul, g.GetClusters(1.0f).size());
+
+  // Only the 2-3 edge is above the new min weight.
+  const LmkClusters clusters = g.GetClusters(2.0f);
+  ASSERT_EQ(2ul, clusters.size());
+  for (const LmkSet& c : clusters) {
+    EXPECT_TRUE(c.count(1) ? c.size() == 1 : (c.size() == 2 && c.count(2) && c.count(3)));
+  }
+
+  // Then the components are kept up to date for the new min weight.
+  g.UpdateEdge(1, 2, 1.0f, -5.0f, 5.0f);
+  EXPECT_EQ(1ul, g.GetClusters(2.0f).size());
+}
+
+
+// Compares GetClusters() against a search over the whole graph after random updates and removals.
+TEST(LandmarkGraph, MatchesFullSearch)
+{
+  std::srand(0);
+  LandmarkGraph g(1.0f);
+  std::map<std::pair<core::uid_t, core::uid_t>, float> weights;
+  std::set<core::uid_t> lmks;
+
+  for (int iter = 0; iter < 300; ++iter) {
+    for (int i = 0; i < 20; ++i) {
+      core::uid_t a = std::rand() % 40, b = std::rand() % 40;
+      if (a == b) { continue; }
+      if (a > b) { std::swap(a, b); }
+      const float inc = (std::rand() % 2) ? 1.0f : -1.0f;
+      g.UpdateEdge(a, b, inc, -2.0f, 2.0f);
+      float& w = weights[std::make_pair(a, b)];
+      w = std::min(2.0f, std::max(-2.0f, w + inc));
+      lmks.insert(a);
+      lmks.insert(b);
+    }
+
+    if (!lmks.empty() && std::rand() % 2) {
+      const core::uid_t r = std::rand() % 40;
+      if (lmks.erase(r) > 0) {
+        g.RemoveLandmark(r);
+        for (auto it = weights.begin(); it != weights.end();) {
+          it = (it->first.first == r || it->first.second == r) ? weights.erase(it) : std::next(it);
+        }
+      }
+    }
+
+    // Label each landmark with the smallest id in its component.
+    std::map<core::uid_t, core::uid_t> label;
+    for (const core::uid_t lmk_id : lmks) { label[lmk_id] = lmk_id; }
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (auto it = weights.begin(); it != weights.end(); ++it) {
+        if (it->second < 1.0f) { continue; }
+        core::uid_t& la = label.at(it->first.first);
+        core::uid_t& lb = label.at(it->first.second);
+        if (la != lb) { la = lb = std::min(la, lb); changed = true; }
+      }
+    }
+
+    const LmkClusters clusters = g.GetClusters(1.0f);
+    size_t total = 0;
+    for (const LmkSet& c : clusters) {
+      ASSERT_FALSE(c.empty());
+      total += c.size();
+      const core::uid_t l = label.at(*c.begin());
+      for (const core::uid_t lmk_id : c) {
+        EXPECT_EQ(l, label.at(lmk_id));
+      }
+    }
+    EXPECT_EQ(lmks.size(), total);
+    EXPECT_EQ(lmks.size(), g.GraphSize());
+    std::set<core::uid_t> labels;
+    for (auto it = label.begin(); it != label.end(); ++it) { labels.insert(it->second); }
+    EXPECT_EQ(labels.size(), clusters.size());
+  }
+}
@@ -0,0 +1,127 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include "mesher/local_costmap.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+static LocalCostmap::Params SmallParams()
+{
+  LocalCostmap::Params params;
+  params.voxel_size = 0.1;
+  params.size_voxels = 40;
+  params.max_distance = 1.0;
+  params.max_ray_length = 5.0;
+  params.hit_evidence = 4;
+  params.miss_evidence = 1;
+  params.max_evidence = 8;
+  params.occupied_evidence = 4;
+  return params;
+}
+
+
+// A square in the z = z0 plane (in front of the camera), made of two triangles.
+static TriangleMesh MakeSquare(double size, double z0)
+{
+  const double h = 0.5 * size;
+  const std::vector<Vector3d> vertices = {
+    Vector3d(-h, -h, z0), Vector3d(h, -h, z0), Vector3d(h, h, z0), Vector3d(-h, h, z0)
+  };
+  const std::vector<Vector3i> triangles = { Vector3i(0, 1, 2), Vector3i(0, 2, 3) };
+  return TriangleMesh(vertices, triangles);
+}
+
+
+TEST(LocalCostmap, SinglePoint)
+{
+  LocalCostmap map(SmallParams());
+  EXPECT_EQ(0ul, map.NumOccupied());
+  EXPECT_NEAR(1.0, map.Distance(Vector3d::Zero()), 1e-6);
+
+  map.IntegratePoints({ Vector3d(0.05, 0.05, 1.05) }, Matrix4d::Identity());
+  EXPECT_EQ(1ul, map.NumOccupied());
+  EXPECT_TRUE(map.IsOccupied(Vector3d(0.05, 0.05, 1.05)));
+
+  EXPECT_NEAR(0.0, map.Distance(Vector3d(0.05, 0.05, 1.05)), 1e-6);
+  EXPECT_NEAR(0.3, map.Distance(Vector3d(0.05, 0.05, 0.75)), 1e-5);
+  EXPECT_NEAR(0.3 * std::sqrt(2.0), map.Distance(Vector3d(0.35, 0.05, 0.75)), 1e-5);
+
+  // Capped at max_distance.
+  EXPECT_NEAR(1.0, map.Distance(Vector3d(0.05, 0.05, -0.55)), 1e-6);
+
+  // Outside of the window.
+  EXPECT_FALSE(map.InWindow(Vector3d(10, 0, 0)));
+  EXPECT_NEAR(1.0, map.Distance(Vector3d(10, 0, 0)), 1e-6);
+}
+
+
+TEST(LocalCostmap, MissesClearObstacles)
+{
+  LocalCostmap map(SmallParams());
+
+  // An obstacle at 1m, which is then seen through (something further away is visible behind it).
+  map.IntegratePoints({ Vector3d(0.05, 0.05, 1.05) }, Matrix4d::Identity());
+  ASSERT_EQ(1ul, map.NumOccupied());
+
+  for (int i = 0; i < 8; ++i) {
+    map.IntegratePoints({ Vector3d(0.05, 0.05, 1.85) }, Matrix4d::Identity());
+  }
+
+  EXPECT_FALSE(map.IsOccupied(Vector3d(0.05, 0.05, 1.05)));
+  EXPECT_TRUE(map.IsOccupied(Vector3d(0.05, 0.05, 1.85)));
+  EXPECT_EQ(1ul, map.NumOccupied());
+
+  // The distance field forgot about the old obstacle.
+  EXPECT_NEAR(0.8, map.Distance(Vector3d(0.05, 0.05, 1.05)), 1e-5);
+  EXPECT_NEAR(1.0, map.Distance(Vector3d(0.05, 0.05, 0.55)), 1e-5);
+}
+
+
+TEST(LocalCostmap, MeshAndSegments)
+{
+  LocalCostmap map(SmallParams());
+  map.IntegrateMesh(MakeSquare(1.0, 1.05), Matrix4d::Identity());
+
+  EXPECT_GT(map.NumOccupied(), 80ul);
+  EXPECT_TRUE(map.IsOccupied(Vector3d(0.05, 0.05, 1.05)));
+
+  // Passes through the wall.
+  EXPECT_FALSE(map.IsSegmentFree(Vector3d(0.05, 0.05, 0.25), Vector3d(0.05, 0.05, 1.45), 0.1));
+
+  // In front of the wall, parallel to it.
+  EXPECT_TRUE(map.IsSegmentFree(Vector3d(-0.5, 0, 0.35), Vector3d(0.5, 0, 0.35), 0.3));
+  EXPECT_FALSE(map.IsSegmentFree(Vector3d(-0.5, 0, 0.35), Vector3d(0.5, 0, 0.35), 0.9));
+}
+
+
+TEST(LocalCostmap, Recenter)
+{
+  LocalCostmap map(SmallParams());
+  map.IntegratePoints({ Vector3d(0.05, 0.05, 1.05) }, Matrix4d::Identity());
+  ASSERT_EQ(1ul, map.NumOccupied());
+
+  // A short move keeps the obstacle (and its distance field).
+  map.Recenter(Vector3d(0.5, 0.0, 0.0));
+  EXPECT_EQ(1ul, map.NumOccupied());
+  EXPECT_NEAR(0.3, map.Distance(Vector3d(0.05, 0.05, 0.75)), 1e-5);
+
+  // Point in the new part of the window.
+  map.IntegratePoints({ Vector3d(2.05, 0.05, 0.05) }, Matrix4d::Identity());
+  EXPECT_EQ(2ul, map.NumOccupied());
+
+  // Moving so that the first obstacle leaves the window forgets it, and the voxels around it.
+  map.Recenter(Vector3d(2.6, 0.0, 0.0));
+  EXPECT_FALSE(map.InWindow(Vector3d(0.05, 0.05, 1.05)));
+  EXPECT_EQ(1ul, map.NumOccupied());
+  EXPECT_NEAR(1.0, map.Distance(Vector3d(0.75, 0.05, 1.05)), 1e-5);
+  EXPECT_NEAR(0.0, map.Distance(Vector3d(2.05, 0.05, 0.05)), 1e-6);
+
+  // Moving away completely clears the window.
+  map.Recenter(Vector3d(100.0, 0.0, 0.0));
+  EXPECT_EQ(0ul, map.NumOccupied());
+  EXPECT_NEAR(1.0, map.Distance(Vector3d(100.05, 0.05, 0.05)), 1e-6);
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include "mesher/surfel_map.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace mesher;
+
+
+// A square in the z = 1 plane (in front of the camera), made of two triangles.
+static TriangleMesh MakeSquare(double size, double x0 = 0.0)
+{
+  const std::vector<Vector3d> vertices = {
+    Vector3d(x0, 0, 1), Vector3d(x0 + size, 0, 1), Vector3d(x0 + size, size, 1), Vector3d(x0, size, 1)
+  };
+  const std::vector<Vector3i> triangles = { Vector3i(0, 1, 2), Vector3i(0, 2, 3) };
+  return TriangleMesh(vertices, triangles);
+}
+
+
+TEST(SurfelMap, FlatSquare)
+{
+  SurfelMap::Params params;
+  params.voxel_size = 0.1;
+  params.block_voxels = 4;
+  SurfelMap map(params);
+
+  // Offset by half a voxel so that the samples don't land on voxel boundaries.
+  TriangleMesh mesh = MakeSquare(0.8);
+  for (Vector3d& v : mesh.vertices) {
+    v += Vector3d(0.05, 0.05, 0.05);
+  }
+  map.Integrate(ConvertToNanoseconds(1.0), mesh, Matrix4d::Identity());
+
+  // 9x9 samples at the voxel size cover 9x9 voxels, in 3x3 blocks.
+  EXPECT_EQ(81ul, map.NumSurfels());
+  EXPECT_EQ(9ul, map.NumBlocks());
+
+  std::vector<Surfel> surfels;
+  map.GetSurfels(BlockIndex(0, 0, 2), surfels);
+  ASSERT_EQ(16ul, surfels.size());
+
+  for (const Surfel& s : surfels) {
+    EXPECT_NEAR(1.05, s.position.z(), 1e-5);
+    EXPECT_NEAR(-1.0, s.normal.z(), 1e-5);   // Faces the camera at the origin.
+    EXPECT_GE(s.weight, 1.0f);
+  }
+
+  EXPECT_EQ(nullptr, map.GetBlock(BlockIndex(5, 5, 5)));
+}
+
+
+TEST(SurfelMap, PopChanges)
+{
+  SurfelMap::Params params;
+  params.block_voxels = 4;
+  SurfelMap map(params);
+
+  map.Integrate(ConvertToNanoseconds(1.0), MakeSquare(0.2), Matrix4d::Identity());
+
+  BlockSet updated, evicted;
+  map.PopChanges(updated, evicted);
+  EXPECT_EQ(map.NumBlocks(), updated.size());
+  EXPECT_TRUE(evicted.empty());
+
+  // Nothing changed since the last call.
+  map.PopChanges(updated, evicted);
+  EXPECT_TRUE(updated.empty());
+  EXPECT_TRUE(evicted.empty());
+}
+
+
+TEST(SurfelMap, Eviction)
+{
+  SurfelMap::Params params;
+  params.block_voxels = 4;
+  params.max_block_age_sec = 10.0;
+  params.max_blocks = 2;
+  SurfelMap map(params);
+
+  BlockSet updated, evicted;
+
+  map.Integrate(ConvertToNanoseconds(1.0), MakeSquare(0.2), Matrix4d::Identity());
+  map.PopChanges(updated, evicted);
+  const BlockSet first = updated;
+  ASSERT_EQ(1ul, first.size());
+
+  // The first block is too old by now.
+  map.Integrate(ConvertToNanoseconds(20.0), MakeSquare(0.2, 2.0), Matrix4d::Identity());
+  map.PopChanges(updated, evicted);
+  EXPECT_EQ(first, evicted);
+  EXPECT_EQ(1ul, map.NumBlocks());
+
+  // Three more blocks: the oldest ones are evicted to stay under max_blocks.
+  map.Integrate(ConvertToNanoseconds(21.0), MakeSquare(0.2, 4.0), Matrix4d::Identity());
+  map.Integrate(ConvertToNanoseconds(22.0), MakeSquare(0.2, 6.0), Matrix4d::Identity());
+  map.PopChanges(updated, evicted);
+  EXPECT_EQ(2ul, map.NumBlocks());
+  EXPECT_EQ(1ul, evicted.size());
+  EXPECT_EQ(2ul, updated.size());
+  EXPECT_EQ(nullptr, map.GetBlock(*evicted.begin()));
+}
+
+
+TEST(SurfelMap, WorldFrame)
+{
+  SurfelMap::Params params;
+  SurfelMap map(params);
+
+  Matrix4d world_T_cam = Matrix4d::Identity();
+  world_T_cam.block<3, 1>(0, 3) = Vector3d(5.0, 0, 0);
+
+  map.Integrate(ConvertToNanoseconds(1.0), MakeSquare(0.05), world_T_cam);
+  ASSERT_EQ(1ul, map.NumBlocks());
+
+  std::vector<Surfel> surfels;
+  map.GetSurfels(BlockIndex(6, 0, 1), surfels);
+  ASSERT_EQ(1ul, surfels.size());
+  EXPECT_NEAR(5.0 + 0.05 / 3.0, surfels.front().position.x(), 0.02);
+}
@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+
+#include "rrt/anytime_planner.hpp"
+#include "rrt/mesh_collision_checker.hpp"
+#include "rrt/test_meshes.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+// Checks that every node's cost is its parent's cost plus the length of the edge.
+static void ExpectConsistentCosts(const Tree& tree)
+{
+  ASSERT_GT(tree.Size(), 0ul);
+  EXPECT_EQ(-1, tree.GetNode(0).parent);
+  EXPECT_EQ(0, tree.GetNode(0).cost_so_far);
+
+  for (Tree::index_t i = 1; i < tree.Size(); ++i) {
+    const Node node = tree.GetNode(i);
+    ASSERT_GE(node.parent, 0);
+    const double expected = tree.GetNode(node.parent).cost_so_far + (node.point - tree.GetPoint(node.parent)).norm();
+    EXPECT_NEAR(expected, node.cost_so_far, 1e-9);
+  }
+}
+
+
+static AnytimePlanner::Params MakeParams()
+{
+  AnytimePlanner::Params params;
+  params.search_radius = 3.0;
+  params.goal_radius = 1.0;
+  params.goal_bias = 0.1;
+  return params;
+}
+
+
+TEST(AnytimePlannerTest, TestImprovesPath)
+{
+  MeshCollisionChecker checker(MeshCollisionChecker::Params{});
+  checker.AddMesh(MakeWall());
+
+  const Vector3d pmin(-2, -10, -10), pmax(12, 10, 10);
+  AnytimePlanner planner(MakeParams(), [&]() { return SampleBoxPoint(pmin, pmax); }, checker.AsBatchCollisionChecker());
+  planner.Reset(Vector3d(0, 0, 0));
+  planner.SetGoal(Vector3d(10, 0, 0));
+  EXPECT_FALSE(planner.HasPath());
+
+  double cost = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_GT(planner.Step(0.01), 0);
+    EXPECT_LE(planner.BestCost(), cost);
+    cost = planner.BestCost();
+  }
+
+  ASSERT_TRUE(planner.HasPath());
+  ExpectConsistentCosts(planner.GetTree());
+
+  VecVector3d path;
+  ASSERT_TRUE(planner.BestPath(path));
+  EXPECT_TRUE(path.front().isApprox(Vector3d(0, 0, 0)));
+  EXPECT_LE((path.back() - Vector3d(10, 0, 0)).norm(), 1.0);
+
+  // Has to go around the wall, and every edge has to be free.
+  EXPECT_GT(planner.BestCost(), 10.0);
+  for (size_t i = 1; i < path.size(); ++i) {
+    EXPECT_TRUE(checker.IsSegmentFree(path.at(i - 1), path.at(i)));
+  }
+}
+
+
+TEST(AnytimePlannerTest, TestMoveStart)
+{
+  MeshCollisionChecker checker(MeshCollisionChecker::Params{});
+
+  const Vector3d pmin(-10, -10, -10), pmax(10, 10, 10);
+  AnytimePlanner planner(MakeParams(), [&]() { return SampleBoxPoint(pmin, pmax); }, checker.AsBatchCollisionChecker());
+  planner.Reset(Vector3d(0, 0, 0));
+  planner.SetGoal(Vector3d(8, 8, 0));
+  planner.Step(0.05);
+  ASSERT_TRUE(planner.HasPath());
+
+  const size_t size_before = planner.GetTree().Size();
+  EXPECT_TRUE(planner.MoveStart(Vector3d(1, 1, 0)));
+
+  // All of the old nodes are reused, and the new start is the root.
+  EXPECT_EQ(size_before + 1, planner.GetTree().Size());
+  EXPECT_TRUE(planner.GetTree().GetPoint(0).isApprox(Vector3d(1, 1, 0)));
+  ExpectConsistentCosts(planner.GetTree());
+  EXPECT_TRUE(planner.HasPath());
+
+  VecVector3d path;
+  ASSERT_TRUE(planner.BestPath(path));
+  EXPECT_TRUE(path.front().isApprox(Vector3d(1, 1, 0)));
+}
+
+
+TEST(AnytimePlannerTest, TestPruneInCollision)
+{
+  MeshCollisionChecker checker(MeshCollisionChecker::Params{});
+
+  const Vector3d pmin(-2, -10, -10), pmax(12, 10, 10);
+  AnytimePlanner planner(MakeParams(), [&]() { return SampleBoxPoint(pmin, pmax); }, checker.AsBatchCollisionChecker());
+  planner.Reset(Vector3d(0, 0, 0));
+  planner.SetGoal(Vector3d(10, 0, 0));
+  planner.Step(0.05);
+  ASSERT_TRUE(planner.HasPath());
+  EXPECT_NEAR(10.0, planner.BestCost(), 1.5);
+
+  // A wall shows up between the start and the goal.
+  checker.AddMesh(MakeWall());
+  const size_t size_before = planner.GetTree().Size();
+  const size_t num_removed = planner.PruneInCollision();
+  EXPECT_GT(num_removed, 0ul);
+  EXPECT_EQ(size_before - num_removed, planner.GetTree().Size());
+  ExpectConsistentCosts(planner.GetTree());
+
+  // Whatever is left is collision-free.
+  const Tree& tree = planner.GetTree();
+  for (Tree::index_t i = 1; i < tree.Size(); ++i) {
+    EXPECT_TRUE(checker.IsSegmentFree(tree.GetPoint(tree.GetNode(i).parent), tree.GetPoint(i)));
+  }
+  EXPECT_EQ(0ul, planner.PruneInCollision());
+
+  // Keep planning, and find a way around.
+  for (int i = 0; i < 20 && !planner.HasPath(); ++i) {
+    planner.Step(0.05);
+  }
+  ASSERT_TRUE(planner.HasPath());
+  EXPECT_GT(planner.BestCost(), 10.0);
+}
+
+
+TEST(AnytimePlannerTest, TestInformedSampling)
+{
+  MeshCollisionChecker checker(MeshCollisionChecker::Params{});
+
+  // A long transit in a big, empty box.
+  const Vector3d pmin(-100, -100, -20), pmax(100, 100, 20);
+  AnytimePlanner::Params params = MakeParams();
+  params.search_radius = 10.0;
+  params.goal_radius = 2.0;
+
+  AnytimePlanner planner(params, pmin, pmax, checker.AsBatchCollisionChecker());
+  planner.Reset(Vector3d(-80, 0, 0));
+  planner.SetGoal(Vector3d(80, 0, 0));
+
+  for (int i = 0; i < 50 && !planner.HasPath(); ++i) {
+    planner.Step(0.02);
+  }
+  ASSERT_TRUE(planner.HasPath());
+  const double first_cost = planner.BestCost();
+
+  // Once there's a path, new nodes only go where they could make it shorter.
+  const size_t size_before = planner.GetTree().Size();
+  for (int i = 0; i < 20; ++i) {
+    planner.Step(0.01);
+  }
+  EXPECT_LE(planner.BestCost(), first_cost);
+  EXPECT_GE(planner.BestCost(), 160 - params.goal_radius);
+  ExpectConsistentCosts(planner.GetTree());
+
+  // NOTE(milo): A new node is between its sample and the nearest node, which could be an older node
+  // from outside of the informed set, so only most of them have to be inside.
+  const Tree& tree = planner.GetTree();
+  const Vector3d start(-80, 0, 0), goal(80, 0, 0);
+  ASSERT_GT(tree.Size(), size_before);
+  size_t num_inside = 0;
+  for (Tree::index_t i = size_before; i < tree.Size(); ++i) {
+    const Vector3d p = tree.GetPoint(i);
+    num_inside += ((p - start).norm() + (p - goal).norm()) <= (first_cost + params.goal_radius + 1e-6);
+  }
+  EXPECT_GE(num_inside, 9 * (tree.Size() - size_before) / 10);
+}
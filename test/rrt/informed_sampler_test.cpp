@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include "rrt/informed_sampler.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+static bool InBox(const Vector3d& x, const Vector3d& pmin, const Vector3d& pmax)
+{
+  return (x - pmin).minCoeff() >= 0 && (pmax - x).minCoeff() >= 0;
+}
+
+
+TEST(InformedSamplerTest, TestRotationAlongLine)
+{
+  const Vector3d start(1, 2, 3), goal(-4, 0, 8);
+  const Matrix3d R = RotationAlongLine(start, goal);
+  EXPECT_TRUE(R.col(0).isApprox((goal - start).normalized()));
+  EXPECT_TRUE((R.transpose() * R).isApprox(Matrix3d::Identity()));
+  EXPECT_NEAR(1.0, R.determinant(), 1e-9);
+
+  // Straight up (parallel to the fallback axis).
+  EXPECT_TRUE(RotationAlongLine(Vector3d::Zero(), Vector3d(0, 0, 5)).col(0).isApprox(Vector3d::UnitZ()));
+}
+
+
+TEST(InformedSamplerTest, TestUnitBall)
+{
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_LE(SampleUnitBall().norm(), 1.0);
+  }
+}
+
+
+TEST(InformedSamplerTest, TestInformedSet)
+{
+  const Vector3d pmin(-100, -100, -20), pmax(100, 100, 20);
+  const Vector3d start(-50, 0, 0), goal(50, 0, 0);
+
+  InformedSampler::Params params;
+  params.goal_bias = 0;
+  InformedSampler sampler(params, pmin, pmax, start, goal);
+
+  // No solution, so the whole box.
+  EXPECT_FALSE(sampler.HasSolution());
+  VecVector3d samples;
+  sampler.SampleBatch(1000, samples);
+  ASSERT_EQ(1000ul, samples.size());
+  bool any_far = false;
+  for (const Vector3d& x : samples) {
+    EXPECT_TRUE(InBox(x, pmin, pmax));
+    any_far |= std::fabs(x.y()) > 50;
+  }
+  EXPECT_TRUE(any_far);
+
+  // Only points that could be on a path cheaper than 110.
+  sampler.SetBestCost(110);
+  EXPECT_TRUE(sampler.HasSolution());
+  EXPECT_LT(sampler.InformedVolume(), (pmax - pmin).prod());
+  sampler.SampleBatch(1000, samples);
+  for (const Vector3d& x : samples) {
+    EXPECT_TRUE(InBox(x, pmin, pmax));
+    EXPECT_TRUE(sampler.InInformedSet(x));
+    EXPECT_LE((x - start).norm() + (x - goal).norm(), 110 + 1e-6);
+  }
+
+  // Better paths shrink the informed set, down to the line between the start and goal.
+  const double volume = sampler.InformedVolume();
+  sampler.SetBestCost(101);
+  EXPECT_LT(sampler.InformedVolume(), volume);
+  sampler.SetBestCost(50);
+  EXPECT_NEAR(0, sampler.InformedVolume(), 1e-9);
+  EXPECT_NEAR(0, (sampler.Sample() - Vector3d(0, 0, 0)).tail<2>().norm(), 1e-6);
+}
+
+
+TEST(InformedSamplerTest, TestGoalBias)
+{
+  const Vector3d goal(5, 5, 5);
+  InformedSampler::Params params;
+  params.goal_bias = 0.25;
+  InformedSampler sampler(params, Vector3d(-10, -10, -10), Vector3d(10, 10, 10), Vector3d::Zero(), goal);
+
+  int num_goal = 0;
+  const int N = 4000;
+  for (int i = 0; i < N; ++i) {
+    num_goal += (sampler.Sample() == goal) ? 1 : 0;
+  }
+  EXPECT_NEAR(0.25, static_cast<double>(num_goal) / N, 0.03);
+}
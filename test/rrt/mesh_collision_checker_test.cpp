@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include "rrt/mesh_collision_checker.hpp"
+#include "rrt/test_meshes.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+TEST(MeshCollisionCheckerTest, TestClosestPointOnTriangle)
+{
+  const Vector3d a(0, 0, 0), b(1, 0, 0), c(0, 1, 0);
+  EXPECT_TRUE(ClosestPointOnTriangle(Vector3d(0.2, 0.2, 3), a, b, c).isApprox(Vector3d(0.2, 0.2, 0)));
+  EXPECT_TRUE(ClosestPointOnTriangle(Vector3d(-1, -1, 0), a, b, c).isApprox(a));
+  EXPECT_TRUE(ClosestPointOnTriangle(Vector3d(0.5, -2, 0), a, b, c).isApprox(Vector3d(0.5, 0, 0)));
+  EXPECT_TRUE(ClosestPointOnTriangle(Vector3d(1, 1, 0), a, b, c).isApprox(Vector3d(0.5, 0.5, 0)));
+}
+
+
+TEST(MeshCollisionCheckerTest, TestSegments)
+{
+  MeshCollisionChecker::Params params;
+  params.voxel_size = 0.25;
+  params.clearance = 0.5;
+  MeshCollisionChecker checker(params);
+
+  EXPECT_TRUE(checker.IsSegmentFree(Vector3d(0, 0, 0), Vector3d(10, 0, 0)));
+
+  checker.AddMesh(MakeWall());
+  EXPECT_GT(checker.NumOccupied(), 0ul);
+
+  // Through the wall, and too close to it.
+  EXPECT_FALSE(checker.IsSegmentFree(Vector3d(0, 0, 0), Vector3d(10, 0, 0)));
+  EXPECT_FALSE(checker.IsSegmentFree(Vector3d(10, 1, 1), Vector3d(0, -1, 2)));
+  EXPECT_FALSE(checker.IsSegmentFree(Vector3d(4.7, -3, 0), Vector3d(4.7, 3, 0)));
+  EXPECT_FALSE(checker.IsFree(Vector3d(5.3, 0, 0)));
+
+  // Parallel to the wall with enough clearance, or around it.
+  EXPECT_TRUE(checker.IsSegmentFree(Vector3d(3.5, -3, 0), Vector3d(3.5, 3, 0)));
+  EXPECT_TRUE(checker.IsSegmentFree(Vector3d(0, 0, 0), Vector3d(10, 0, 14)));
+  EXPECT_TRUE(checker.IsSegmentFree(Vector3d(0, 0, 0), Vector3d(0, 0, 0)));
+
+  std::vector<uint8_t> is_free;
+  checker.AreSegmentsFree(Vector3d(0, 0, 0), { Vector3d(10, 0, 0), Vector3d(3, 3, 3), Vector3d(-5, 0, 0) }, is_free);
+  ASSERT_EQ(3ul, is_free.size());
+  EXPECT_EQ(0, is_free.at(0));
+  EXPECT_EQ(1, is_free.at(1));
+  EXPECT_EQ(1, is_free.at(2));
+
+  // Everything collides if the start does.
+  checker.AreSegmentsFree(Vector3d(5, 0, 0), { Vector3d(-5, 0, 0), Vector3d(3, 3, 3) }, is_free);
+  EXPECT_EQ(0, is_free.at(0));
+  EXPECT_EQ(0, is_free.at(1));
+
+  checker.Clear();
+  EXPECT_TRUE(checker.IsSegmentFree(Vector3d(0, 0, 0), Vector3d(10, 0, 0)));
+}
+
+
+TEST(MeshCollisionCheckerTest, TestBuildTree)
+{
+  MeshCollisionChecker::Params params;
+  MeshCollisionChecker checker(params);
+  checker.AddMesh(MakeWall());
+
+  Tree tree;
+  const Vector3d pmin(-10, -10, -10), pmax(10, 10, 10);
+  BuildTree(tree, Vector3d::Zero(), Vector3d(10, 0, 0), [&]() { return SampleBoxPoint(pmin, pmax); },
+            checker.AsBatchCollisionChecker(), 3.0, 1000);
+
+  // No edge in the tree goes through the wall.
+  for (Tree::index_t i = 1; i < tree.Size(); ++i) {
+    const Node n = tree.GetNode(i);
+    EXPECT_TRUE(checker.IsSegmentFree(tree.GetPoint(n.parent), n.point));
+  }
+}
+
+
+TEST(MeshCollisionCheckerTest, TestBuildTreeParallel)
+{
+  MeshCollisionChecker::Params params;
+  MeshCollisionChecker checker(params);
+  checker.AddMesh(MakeWall());
+
+  Tree tree;
+  const Vector3d pmin(-10, -10, -10), pmax(10, 10, 10);
+  ParallelBuildParams parallel_params;
+  parallel_params.num_threads = 4;
+  parallel_params.batch_size = 32;
+  BuildTreeParallel(tree, Vector3d::Zero(), Vector3d(10, 0, 0), [&]() { return SampleBoxPoint(pmin, pmax); },
+                    checker.AsCollisionChecker(), 3.0, 1000, parallel_params);
+  EXPECT_GT(tree.Size(), 500ul);
+
+  // No edge goes through the wall, and costs are consistent with the parents (at insert time, a
+  // node's cost is its parent's plus the edge, and rewiring only ever lowers costs).
+  for (Tree::index_t i = 1; i < tree.Size(); ++i) {
+    const Node n = tree.GetNode(i);
+    EXPECT_TRUE(checker.IsSegmentFree(tree.GetPoint(n.parent), n.point));
+    EXPECT_GE(n.cost_so_far + 1e-6, n.point.norm());
+  }
+}
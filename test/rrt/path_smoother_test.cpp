@@ -0,0 +1,141 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/timer.hpp"
+#include "rrt/mesh_collision_checker.hpp"
+#include "rrt/path_smoother.hpp"
+#include "rrt/test_meshes.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+// Goes around the top of the wall, wiggling along the way (like an RRT path would).
+static VecVector3d MakeWigglyPath(int n)
+{
+  const Vector3d start(0, 0, 0), corner(5, 7, 0), goal(10, 0, 0);
+  VecVector3d path;
+  for (int i = 0; i <= n; ++i) {
+    const double u = static_cast<double>(i) / n;
+    const Vector3d p = (u < 0.5) ? (start + 2 * u * (corner - start)) : (corner + (2 * u - 1) * (goal - corner));
+    const double wiggle = (i % 2 == 0 || i == n) ? 0.0 : 0.1;
+    path.emplace_back(p + Vector3d(0, 0, wiggle));
+  }
+  return path;
+}
+
+
+TEST(CubicSpline3dTest, TestInterpolates)
+{
+  const VecVector3d waypoints = { Vector3d(0, 0, 0), Vector3d(1, 1, 0), Vector3d(2, 0, 1), Vector3d(4, 0, 0) };
+  const CubicSpline3d spline(waypoints);
+  ASSERT_EQ(3ul, spline.NumSegments());
+
+  for (size_t i = 0; i < waypoints.size(); ++i) {
+    EXPECT_NEAR(0, (waypoints.at(i) - spline.Position(spline.Knot(i))).norm(), 1e-9);
+  }
+
+  // Natural: no curvature at the ends.
+  EXPECT_NEAR(0, spline.SecondDerivative(0).norm(), 1e-9);
+  EXPECT_NEAR(0, spline.SecondDerivative(spline.Length()).norm(), 1e-9);
+
+  // Continuous first and second derivatives at the interior knots.
+  for (size_t i = 1; i + 1 < waypoints.size(); ++i) {
+    const double s = spline.Knot(i);
+    EXPECT_NEAR(0, (spline.Derivative(s - 1e-7) - spline.Derivative(s + 1e-7)).norm(), 1e-5);
+    EXPECT_NEAR(0, (spline.SecondDerivative(s - 1e-7) - spline.SecondDerivative(s + 1e-7)).norm(), 1e-5);
+  }
+
+  // Derivative matches a finite difference.
+  const double s = 2.2;
+  const Vector3d fd = (spline.Position(s + 1e-6) - spline.Position(s - 1e-6)) / 2e-6;
+  EXPECT_NEAR(0, (fd - spline.Derivative(s)).norm(), 1e-5);
+}
+
+
+TEST(CubicSpline3dTest, TestStraightLine)
+{
+  const CubicSpline3d spline({ Vector3d(0, 0, 0), Vector3d(1, 0, 0), Vector3d(3, 0, 0) });
+  EXPECT_NEAR(3.0, spline.Length(), 1e-9);
+  EXPECT_NEAR(0, (Vector3d(1.7, 0, 0) - spline.Position(1.7)).norm(), 1e-9);
+  EXPECT_NEAR(0, spline.SecondDerivative(1.7).norm(), 1e-9);
+}
+
+
+TEST(PathSmootherTest, TestShortcut)
+{
+  MeshCollisionChecker checker(MeshCollisionChecker::Params{});
+  PathSmoother smoother(PathSmoother::Params(), checker.AsBatchCollisionChecker());
+
+  // With nothing in the way, the path becomes a straight line.
+  VecVector3d shortcut;
+  smoother.Shortcut(MakeWigglyPath(20), shortcut);
+  ASSERT_EQ(2ul, shortcut.size());
+  EXPECT_EQ(Vector3d(0, 0, 0), shortcut.front());
+  EXPECT_EQ(Vector3d(10, 0, 0), shortcut.back());
+
+  // With the wall, it has to go around the corner.
+  checker.AddMesh(MakeWall());
+  smoother.Shortcut(MakeWigglyPath(20), shortcut);
+  ASSERT_GE(shortcut.size(), 3ul);
+  EXPECT_LE(shortcut.size(), 5ul);
+  EXPECT_EQ(Vector3d(0, 0, 0), shortcut.front());
+  EXPECT_EQ(Vector3d(10, 0, 0), shortcut.back());
+}
+
+
+TEST(PathSmootherTest, TestSmooth)
+{
+  MeshCollisionChecker checker(MeshCollisionChecker::Params{});
+  checker.AddMesh(MakeWall());
+
+  PathSmoother::Params params;
+  params.max_velocity = 1.0;
+  params.max_acceleration = 0.5;
+  params.max_lateral_acceleration = 0.5;
+  params.sample_spacing = 0.1;
+  PathSmoother smoother(params, checker.AsBatchCollisionChecker());
+
+  const VecVector3d path = MakeWigglyPath(300);
+
+  Timer timer(true);
+  Trajectory trajectory;
+  ASSERT_TRUE(smoother.Smooth(path, trajectory));
+  LOG(INFO) << "Smoothed " << path.size() << " waypoints in " << timer.Elapsed().milliseconds() << " ms" << std::endl;
+
+  ASSERT_GE(trajectory.size(), 2ul);
+  EXPECT_NEAR(0, (trajectory.front().position - path.front()).norm(), 1e-9);
+  EXPECT_NEAR(0, (trajectory.back().position - path.back()).norm(), 1e-9);
+  EXPECT_NEAR(0, trajectory.front().velocity.norm(), 1e-9);
+  EXPECT_NEAR(0, trajectory.back().velocity.norm(), 1e-9);
+
+  for (size_t i = 1; i < trajectory.size(); ++i) {
+    const TrajectoryPoint& a = trajectory.at(i - 1);
+    const TrajectoryPoint& b = trajectory.at(i);
+    ASSERT_GT(b.t, a.t);
+    EXPECT_LE(b.velocity.norm(), params.max_velocity + 1e-9);
+    EXPECT_TRUE(checker.IsSegmentFree(a.position, b.position));
+
+    // Speed changes no faster than max_acceleration.
+    const double accel = std::fabs(b.velocity.norm() - a.velocity.norm()) / (b.t - a.t);
+    EXPECT_LE(accel, params.max_acceleration + 1e-6);
+  }
+
+  // Can't be faster than going around the corner at top speed.
+  EXPECT_GT(trajectory.back().t, 2 * std::sqrt(74.0) / params.max_velocity);
+}
+
+
+TEST(PathSmootherTest, TestTooShort)
+{
+  MeshCollisionChecker checker(MeshCollisionChecker::Params{});
+  PathSmoother smoother(PathSmoother::Params(), checker.AsBatchCollisionChecker());
+
+  Trajectory trajectory;
+  EXPECT_FALSE(smoother.Smooth({ Vector3d(1, 2, 3) }, trajectory));
+  EXPECT_FALSE(smoother.Smooth({ Vector3d(1, 2, 3), Vector3d(1, 2, 3) }, trajectory));
+  EXPECT_TRUE(trajectory.empty());
+}
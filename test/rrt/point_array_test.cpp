@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include "core/random.hpp"
+#include "rrt/rrt.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+TEST(PointArrayTest, TestDistances)
+{
+  PointArray points;
+  VecVector3d expected;
+  for (int i = 0; i < 100; ++i) {
+    const Vector3d p = SampleBoxPoint(Vector3d(-10, -10, -10), Vector3d(10, 10, 10));
+    points.PushBack(p);
+    expected.emplace_back(p);
+  }
+  ASSERT_EQ(100ul, points.Size());
+
+  const Vector3d q(1, 2, 3);
+  const std::vector<size_t> indices = { 5, 0, 99, 5, 42 };
+  std::vector<double> dists;
+  points.Distances(q, indices, dists);
+
+  ASSERT_EQ(indices.size(), dists.size());
+  for (size_t k = 0; k < indices.size(); ++k) {
+    EXPECT_TRUE(points.Get(indices.at(k)).isApprox(expected.at(indices.at(k))));
+    EXPECT_NEAR((expected.at(indices.at(k)) - q).norm(), dists.at(k), 1e-12);
+    EXPECT_NEAR((expected.at(indices.at(k)) - q).squaredNorm(), points.SquaredDistance(indices.at(k), q), 1e-9);
+  }
+
+  points.Distances(q, {}, dists);
+  EXPECT_TRUE(dists.empty());
+}
+
+
+TEST(PointArrayTest, TestTreeCostsThrough)
+{
+  Tree tree;
+  tree.AddNode(Node(Vector3d(0, 0, 0), -1, 0));
+  tree.AddNode(Node(Vector3d(3, 0, 0), 0, 3));
+  tree.AddNode(Node(Vector3d(3, 4, 0), 1, 7));
+
+  std::vector<double> dists, costs;
+  tree.CostsThrough(Vector3d(0, 4, 0), { 0, 1, 2 }, dists, costs);
+  ASSERT_EQ(3ul, costs.size());
+  EXPECT_NEAR(4, dists.at(0), 1e-12);
+  EXPECT_NEAR(5, dists.at(1), 1e-12);
+  EXPECT_NEAR(3, dists.at(2), 1e-12);
+  EXPECT_NEAR(4, costs.at(0), 1e-12);
+  EXPECT_NEAR(8, costs.at(1), 1e-12);
+  EXPECT_NEAR(10, costs.at(2), 1e-12);
+
+  // The VoxelIndex and kd-tree both read the same point arrays.
+  EXPECT_EQ(2ul, tree.Nearest(Vector3d(3, 5, 0)));
+  const kdtree_t kd = tree.BuildKdTree();
+  EXPECT_EQ(2ul, tree.Nearest(kd, Vector3d(3, 5, 0)));
+}
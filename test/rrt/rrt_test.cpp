@@ -94,3 +94,116 @@ TEST(TreeTest, Nearby)
   tree.Nearby(kd, Vector3d(0, 0, 0), r + 0.01, out);
   EXPECT_EQ(3ul, out.size());
 }
+
+
+TEST(TreeTest, NearestAndNearbyIndexed)
+{
+  Tree tree(0.5);
+
+  tree.AddNode(Node(Vector3d(1, 2, 3), -1, 100));
+  EXPECT_EQ(0ul, tree.Nearest(Vector3d(0, 0, 0)));
+
+  tree.AddNode(Node(Vector3d(-2, 4, 8), 0, 101));
+  tree.AddNode(Node(Vector3d(0, 0, 0), 0, 101));
+  EXPECT_EQ(1ul, tree.Nearest(Vector3d(-2, 4, 7)));
+
+  // Changing the voxel size doesn't change the results.
+  tree.SetIndexVoxelSize(3.0);
+  std::vector<Tree::index_t> out;
+  tree.Nearby(Vector3d(0, 0, 0), Vector3d(1, 2, 3).norm() + 0.01, out);
+  ASSERT_EQ(2ul, out.size());
+  EXPECT_EQ(2ul, out.at(0));
+  EXPECT_EQ(0ul, out.at(1));
+}
+
+
+TEST(TreeTest, BuildTree)
+{
+  Tree tree;
+  const Vector3d pmin(-50, -50, -10);
+  const Vector3d pmax(50, 50, 10);
+  const PointSampler sampler = [&]() { return SampleBoxPoint(pmin, pmax); };
+  const CollisionChecker always_free = [](const Vector3d&, const Vector3d&) { return true; };
+
+  BuildTree(tree, Vector3d::Zero(), Vector3d(40, 40, 0), sampler, always_free, 5.0, 2000);
+  EXPECT_EQ(2001ul, tree.Size());
+
+  // Every node's cost is at least the straight line distance from the start.
+  for (Tree::index_t i = 0; i < tree.Size(); ++i) {
+    EXPECT_GE(tree.GetNode(i).cost_so_far + 1e-6, tree.GetPoint(i).norm());
+  }
+}
+
+
+TEST(TreeTest, RewirePropagatesCost)
+{
+  // 0 -> 1 -> 2 -> 3, and 0 -> 4.
+  Tree tree;
+  tree.AddNode(Node(Vector3d(0, 0, 0), -1, 0));
+  tree.AddNode(Node(Vector3d(0, 5, 0), 0, 5));
+  tree.AddNode(Node(Vector3d(1, 5, 0), 1, 6));
+  tree.AddNode(Node(Vector3d(2, 5, 0), 2, 7));
+  tree.AddNode(Node(Vector3d(1, 0, 0), 0, 1));
+
+  // Give node 2 a shorter path through node 4.
+  tree.Rewire(2, 4, 1 + 5);
+  EXPECT_EQ(4, tree.GetNode(2).parent);
+  EXPECT_EQ(6, tree.GetNode(2).cost_so_far);
+  EXPECT_EQ(7, tree.GetNode(3).cost_so_far);
+
+  tree.Rewire(1, 0, 4);
+  EXPECT_EQ(4, tree.GetNode(1).cost_so_far);
+  EXPECT_EQ(6, tree.GetNode(2).cost_so_far);
+
+  EXPECT_TRUE(tree.Children(1).empty());
+  ASSERT_EQ(1ul, tree.Children(4).size());
+  EXPECT_EQ(2ul, tree.Children(4).at(0));
+}
+
+
+TEST(TreeTest, BuildTreeMultiGoal)
+{
+  Tree tree;
+  const Vector3d pmin(-50, -50, -10);
+  const Vector3d pmax(50, 50, 10);
+  const PointSampler sampler = [&]() { return SampleBoxPoint(pmin, pmax); };
+
+  // Nothing can get near the last goal.
+  const Vector3d blocked(0, 40, 0);
+  const BatchCollisionChecker checker = [&](const Vector3d& from, const VecVector3d& to, std::vector<uint8_t>& is_free)
+  {
+    is_free.resize(to.size());
+    for (size_t i = 0; i < to.size(); ++i) {
+      is_free[i] = (from - blocked).norm() > 3.0 && (to[i] - blocked).norm() > 3.0;
+    }
+  };
+
+  const VecVector3d goals = { Vector3d(40, 40, 0), Vector3d(-40, 10, 5), Vector3d(20, -30, -5), blocked };
+  std::vector<GoalPath> results;
+  BuildTreeMultiGoal(tree, Vector3d::Zero(), goals, sampler, checker, 5.0, 2.0, 0.1, 3000, results);
+  ASSERT_EQ(goals.size(), results.size());
+
+  for (size_t i = 0; i + 1 < goals.size(); ++i) {
+    const GoalPath& r = results.at(i);
+    ASSERT_TRUE(r.reached) << "Goal " << i << " wasn't reached";
+    ASSERT_GE(r.path.size(), 2ul);
+    EXPECT_EQ(Vector3d::Zero(), r.path.front());
+    EXPECT_EQ(goals.at(i), r.path.back());
+
+    // The cost is the length of the path, which is at least the straight line distance.
+    double length = 0;
+    for (size_t k = 1; k < r.path.size(); ++k) {
+      length += (r.path.at(k) - r.path.at(k - 1)).norm();
+    }
+    EXPECT_NEAR(length, r.cost, 1e-6);
+    EXPECT_GE(r.cost + 1e-6, goals.at(i).norm());
+  }
+
+  EXPECT_FALSE(results.back().reached);
+  EXPECT_TRUE(results.back().path.empty());
+
+  // Querying again later gives the same answer.
+  GoalPath again;
+  ASSERT_TRUE(QueryGoal(tree, goals.at(0), checker, 2.0, again));
+  EXPECT_EQ(results.at(0).node, again.node);
+}
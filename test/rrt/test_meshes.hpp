@@ -0,0 +1,21 @@
+#pragma once
+
+#include "core/eigen_types.hpp"
+#include "mesher/triangle_mesh.hpp"
+
+namespace bm {
+namespace rrt {
+
+
+// A 10x10 square wall in the plane x = 5.
+inline mesher::TriangleMesh MakeWall()
+{
+  mesher::TriangleMesh mesh;
+  mesh.vertices = { core::Vector3d(5, -5, -5), core::Vector3d(5, 5, -5), core::Vector3d(5, 5, 5), core::Vector3d(5, -5, 5) };
+  mesh.triangles = { core::Vector3i(0, 1, 2), core::Vector3i(0, 2, 3) };
+  return mesh;
+}
+
+
+}
+}
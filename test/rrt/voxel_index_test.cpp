@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include "core/random.hpp"
+#include "rrt/voxel_index.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace rrt;
+
+
+// Compare against a brute force search over random points (including ones far from the data).
+TEST(VoxelIndexTest, TestMatchesBruteForce)
+{
+  std::vector<Vector3d> points;
+  VoxelIndex index(2.0);
+
+  for (int i = 0; i < 500; ++i) {
+    points.emplace_back(RandomUniformd(-20, 20), RandomUniformd(-20, 20), RandomUniformd(-5, 5));
+    index.Insert(points.size() - 1, points.back());
+  }
+  EXPECT_EQ(500ul, index.Size());
+
+  for (int q = 0; q < 200; ++q) {
+    const double extent = (q % 2 == 0) ? 25.0 : 200.0;
+    const Vector3d query(RandomUniformd(-extent, extent), RandomUniformd(-extent, extent), RandomUniformd(-extent, extent));
+
+    size_t nearest = 0;
+    for (size_t i = 1; i < points.size(); ++i) {
+      if ((points.at(i) - query).norm() < (points.at(nearest) - query).norm()) {
+        nearest = i;
+      }
+    }
+    EXPECT_EQ(nearest, index.Nearest(points, query));
+
+    const double radius = 3.0;
+    size_t num_nearby = 0;
+    for (const Vector3d& p : points) {
+      num_nearby += ((p - query).norm() <= radius) ? 1 : 0;
+    }
+    std::vector<VoxelIndex::index_t> nearby;
+    EXPECT_EQ(num_nearby, index.Nearby(points, query, radius, nearby));
+
+    // Sorted by increasing distance.
+    for (size_t i = 1; i < nearby.size(); ++i) {
+      EXPECT_LE((points.at(nearby.at(i - 1)) - query).norm(), (points.at(nearby.at(i)) - query).norm());
+    }
+  }
+}
+
+
+TEST(VoxelIndexTest, TestRebuild)
+{
+  std::vector<Vector3d> points = { Vector3d(0, 0, 0), Vector3d(-3, 1, 2), Vector3d(0.5, 0, 0) };
+  VoxelIndex index(1.0);
+  index.Rebuild(0.25, points);
+  EXPECT_EQ(3ul, index.Size());
+  EXPECT_EQ(0.25, index.VoxelSize());
+
+  EXPECT_EQ(1ul, index.Nearest(points, Vector3d(-3, 1, 1)));
+
+  std::vector<VoxelIndex::index_t> nearby;
+  EXPECT_EQ(2ul, index.Nearby(points, Vector3d(0.4, 0, 0), 1.0, nearby));
+  EXPECT_EQ(2ul, nearby.at(0));
+  EXPECT_EQ(0ul, nearby.at(1));
+}
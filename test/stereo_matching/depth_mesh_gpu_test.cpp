@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "patchmatch_gpu/depth_mesh_gpu.h"
+
+using namespace bm;
+using namespace core;
+using namespace pm;
+
+
+// With cell_px = 4, a 61 x 81 disparity map is a 16 x 21 grid of vertices, i.e 15 x 20 cells, and
+// with block_cells = 5 that's 3 x 4 full blocks.
+static DepthMeshGpu::Params MakeParams()
+{
+  DepthMeshGpu::Params params;
+  params.cell_px = 4;
+  params.block_cells = 5;
+  params.max_depth_change = 0.1;
+  params.max_error_px = 0.25;
+  return params;
+}
+
+
+TEST(DepthMeshGpuTest, TestPlane)
+{
+  const PinholeCamera cam(100, 100, 40, 30, 61, 81);
+  const StereoCamera stereo_rig(cam, 0.2);
+  DepthMeshGpu mesher(MakeParams(), stereo_rig);
+
+  // A fronto-parallel plane 2m away collapses to two triangles per block.
+  Image1f disp(61, 81, 10.0f);
+  mesher::TriangleMesh mesh;
+  mesher.Compute(disp, mesh);
+
+  EXPECT_EQ(3ul * 4 * 2, mesh.triangles.size());
+  EXPECT_EQ(4ul * 5, mesh.vertices.size());
+  EXPECT_TRUE(mesh.vertex_ids.empty());
+  for (const Vector3d& v : mesh.vertices) {
+    EXPECT_NEAR(2.0, v.z(), 1e-5);
+  }
+
+  // Background (zero disparity) on the left half has no triangles.
+  disp(cv::Rect(0, 0, 40, 61)).setTo(0);
+  mesher.Compute(disp, mesh);
+  EXPECT_EQ(3ul * 2 * 2, mesh.triangles.size());
+}
+
+
+TEST(DepthMeshGpuTest, TestDiscontinuity)
+{
+  const PinholeCamera cam(100, 100, 40, 30, 61, 81);
+  const StereoCamera stereo_rig(cam, 0.2);
+  DepthMeshGpu mesher(MakeParams(), stereo_rig);
+
+  // Two planes (2m and 1m away) that meet between vertex columns 9 and 10.
+  Image1f disp(61, 81, 10.0f);
+  disp(cv::Rect(40, 0, 41, 61)).setTo(20.0f);
+
+  mesher::TriangleMesh mesh;
+  mesher.Compute(disp, mesh);
+
+  // The blocks on either side of the step are still decimated, but the one with the step keeps its
+  // 4 columns of complete cells at full resolution.
+  EXPECT_EQ(3ul*2 + 15*4*2 + 3*2*2, mesh.triangles.size());
+
+  // No triangle connects the two planes.
+  for (const Vector3i& t : mesh.triangles) {
+    const double z = mesh.vertices.at(t(0)).z();
+    EXPECT_NEAR(z, mesh.vertices.at(t(1)).z(), 1e-5);
+    EXPECT_NEAR(z, mesh.vertices.at(t(2)).z(), 1e-5);
+  }
+}
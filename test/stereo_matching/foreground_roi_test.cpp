@@ -0,0 +1,55 @@
+#include "gtest/gtest.h"
+
+#include <opencv2/core.hpp>
+
+#include "vision_core/cv_types.hpp"
+#include "stereo_matching/foreground_roi.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace stereo;
+
+
+TEST(ForegroundRoiTest, TestFull)
+{
+  const ForegroundRoi roi(30, 40);
+  EXPECT_EQ(30 * 40, roi.Area());
+
+  for (int y = 0; y < roi.Rows(); ++y) {
+    ASSERT_EQ(1ul, roi.Spans(y).size());
+    EXPECT_EQ(0, roi.Spans(y).at(0).x0);
+    EXPECT_EQ(40, roi.Spans(y).at(0).x1);
+  }
+
+  // 2 x 3 tiles, the last row and column stick out of the image.
+  EXPECT_EQ(6ul, roi.Tiles(16).size());
+}
+
+
+TEST(ForegroundRoiTest, TestSpansAndTiles)
+{
+  Image1b mask(32, 64, (uint8_t)0);
+
+  // Two separate blobs in row 10.
+  mask(10, 3) = 1;
+  mask(10, 40) = 1;
+
+  const ForegroundRoi roi(mask, 2);
+  EXPECT_EQ(2 * 5 * 5, roi.Area());
+  EXPECT_EQ(0ul, roi.Spans(7).size());
+  EXPECT_EQ(0ul, roi.Spans(13).size());
+
+  for (int y = 8; y <= 12; ++y) {
+    const std::vector<RowSpan>& spans = roi.Spans(y);
+    ASSERT_EQ(2ul, spans.size());
+    EXPECT_EQ(1, spans.at(0).x0);
+    EXPECT_EQ(6, spans.at(0).x1);
+    EXPECT_EQ(38, spans.at(1).x0);
+    EXPECT_EQ(43, spans.at(1).x1);
+  }
+
+  const std::vector<cv::Point> tiles = roi.Tiles(16);
+  ASSERT_EQ(2ul, tiles.size());
+  EXPECT_EQ(cv::Point(0, 0), tiles.at(0));
+  EXPECT_EQ(cv::Point(32, 0), tiles.at(1));
+}
@@ -0,0 +1,111 @@
+#include "gtest/gtest.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include "patchmatch_gpu/guided_filter_gpu.h"
+
+using namespace bm;
+using namespace core;
+using namespace pm;
+
+
+// Same steps as imaging::FastGuidedFilterMono (which isn't built with the stereo tests).
+static Image1f GuidedFilterReference(const Image1f& I, const Image1f& p, int r, double eps, int s)
+{
+  const cv::Size ksize(2 * (r / s) + 1, 2 * (r / s) + 1);
+  const cv::Size low_size(I.cols / s, I.rows / s);
+
+  Image1f Il, pl;
+  cv::resize(I, Il, low_size, 0, 0, cv::INTER_NEAREST);
+  cv::resize(p, pl, low_size, 0, 0, cv::INTER_NEAREST);
+
+  Image1f mean_I, mean_II, mean_p, mean_Ip;
+  cv::blur(Il, mean_I, ksize);
+  cv::blur(Il.mul(Il), mean_II, ksize);
+  cv::blur(pl, mean_p, ksize);
+  cv::blur(Il.mul(pl), mean_Ip, ksize);
+
+  const Image1f var_I = mean_II - mean_I.mul(mean_I);
+  const Image1f a = (mean_Ip - mean_I.mul(mean_p)) / (var_I + eps);
+  const Image1f b = mean_p - a.mul(mean_I);
+
+  Image1f mean_a, mean_b;
+  cv::blur(a, mean_a, ksize);
+  cv::blur(b, mean_b, ksize);
+  cv::resize(mean_a, mean_a, I.size(), 0, 0, cv::INTER_LINEAR);
+  cv::resize(mean_b, mean_b, I.size(), 0, 0, cv::INTER_LINEAR);
+
+  return mean_a.mul(I) + mean_b;
+}
+
+
+static void MakeImages(int rows, int cols, Image1f& I, Image3f& p)
+{
+  I = Image1f(rows, cols);
+  p = Image3f(rows, cols);
+
+  cv::RNG rng(123);
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      I(y, x) = 1.0f + 0.05f * x + ((x / 16 + y / 16) % 2);
+      p(y, x) = cv::Vec3f(rng.uniform(0.0f, 1.0f), 0.5f * I(y, x), rng.uniform(0.0f, 0.2f));
+    }
+  }
+}
+
+
+TEST(GuidedFilterGpuTest, TestBoxFilter)
+{
+  Image1f I;
+  Image3f p;
+  MakeImages(37, 53, I, p);
+
+  cu::GpuMat I_gpu, tmp, out_gpu;
+  I_gpu.upload(I);
+
+  // The last size is wider than the image, so the border is reflected more than once.
+  for (const int ksize : { 1, 5, 21, 41 }) {
+    BoxFilter(I_gpu, tmp, out_gpu, ksize);
+
+    Image1f out, expected;
+    out_gpu.download(out);
+    cv::blur(I, expected, cv::Size(ksize, ksize));
+
+    EXPECT_LT(cv::norm(out, expected, cv::NORM_INF), 1e-4) << "ksize=" << ksize;
+  }
+}
+
+
+TEST(GuidedFilterGpuTest, TestMatchesCpu)
+{
+  Image1f I;
+  Image3f p;
+  MakeImages(120, 160, I, p);
+
+  Image1f pc[3];
+  cv::split(p, pc);
+
+  for (const int s : { 1, 4 }) {
+    const int r = 16;
+    const double eps = 0.01;
+
+    GuidedFilterGpu filter(r, eps, s);
+    filter.SetGuide(I);
+
+    const Image3f q = filter.filter(p);
+    ASSERT_EQ(p.size(), q.size());
+    ASSERT_EQ(CV_32FC3, q.type());
+
+    Image1f qc[3];
+    cv::split(q, qc);
+
+    for (int c = 0; c < 3; ++c) {
+      const Image1f expected = GuidedFilterReference(I, pc[c], r, eps, s);
+      EXPECT_LT(cv::norm(qc[c], expected, cv::NORM_INF), 1e-3) << "s=" << s << " c=" << c;
+    }
+
+    // Filtering again with the same guide gives the same result.
+    const Image3f q2 = filter.filter(p);
+    EXPECT_EQ(0, cv::norm(q, q2, cv::NORM_INF));
+  }
+}
@@ -0,0 +1,85 @@
+#include "gtest/gtest.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "vision_core/cv_types.hpp"
+#include "stereo_matching/patchmatch.hpp"
+#include "stereo_matching/patchmatch_cpu.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace stereo;
+
+
+template <typename ImageT>
+static float L1CostFunction(const ImageT& pl, const ImageT& pr)
+{
+  cv::Mat diff;
+  cv::absdiff(pl, pr, diff);
+  return (float)cv::mean(diff)[0];
+}
+
+
+// The cv::Mat version of L1GradientCost.
+static float L1GradientCostFunction(const Image1b& pl,
+                                    const Image1b& pr,
+                                    const Image1f& gl,
+                                    const Image1f& gr)
+{
+  const float alpha = 0.7;
+  const float tau_color = 50.0;
+  const float tau_grad = 20.0;
+
+  const float error_color = std::fmin(L1CostFunction<Image1b>(pl, pr), tau_color);
+  const float error_grad = std::fmin(L1CostFunction<Image1f>(gl, gr), tau_grad);
+
+  return alpha * error_color + (1 - alpha) * error_grad;
+}
+
+
+static void ComputeGradient(const Image1b& im, Image1f& gmag)
+{
+  cv::Mat Dx, Dy;
+  cv::Sobel(im, Dx, CV_32F, 1, 0, 3);
+  cv::Sobel(im, Dy, CV_32F, 0, 1, 3);
+  cv::pow(Dx, 2, Dx);
+  cv::pow(Dy, 2, Dy);
+  cv::sqrt(Dx + Dy, gmag);
+}
+
+
+// PatchmatchCpu should give exactly the same disparities as Patchmatch::Propagate.
+TEST(PatchmatchCpuTest, TestSameAsPropagate)
+{
+  Image1b iml = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  Image1b imr = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(iml.empty() || imr.empty());
+  cv::resize(iml, iml, iml.size() / 4);
+  cv::resize(imr, imr, imr.size() / 4);
+
+  Image1f Gl, Gr;
+  ComputeGradient(iml, Gl);
+  ComputeGradient(imr, Gr);
+
+  // Random (nonnegative) disparities, so that lots of pixels change.
+  Image1f disp0(iml.size(), 0.0f);
+  cv::RNG rng(123);
+  rng.fill(disp0, cv::RNG::UNIFORM, 0.0f, 40.0f, false);
+
+  Patchmatch::Params params;
+  Patchmatch pm(params);
+  PatchmatchCpu<L1GradientCost> pm_cpu;
+
+  for (const int patch_size : { 3, 5 }) {
+    Image1f disp_expected = disp0.clone();
+    Image1f disp_cpu = disp0.clone();
+
+    pm.Propagate(iml, imr, Gl, Gr, disp_expected, L1GradientCostFunction, patch_size, patch_size);
+    pm_cpu.Propagate(iml, imr, Gl, Gr, disp_cpu, patch_size, patch_size);
+
+    EXPECT_GT(cv::countNonZero(disp_expected != disp0), 0);
+    EXPECT_EQ(0, cv::countNonZero(disp_expected != disp_cpu)) << "Mismatch with patch_size=" << patch_size;
+  }
+}
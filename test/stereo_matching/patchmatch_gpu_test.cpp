@@ -92,6 +92,185 @@ TEST(PatchmatchGpuTest, Test01)
 }
 
 
+TEST(PatchmatchGpuTest, TestAsync)
+{
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+
+  PatchmatchGpu pm(params);
+
+  std::vector<Image1b> left, right;
+  for (int i = 1; i <= 3; ++i) {
+    Image1b il = cv::imread("./resources/images/fsl" + std::to_string(i) + ".png", CV_LOAD_IMAGE_GRAYSCALE);
+    Image1b ir = cv::imread("./resources/images/fsr" + std::to_string(i) + ".png", CV_LOAD_IMAGE_GRAYSCALE);
+    ASSERT_FALSE(il.empty() || ir.empty());
+    cv::resize(il, il, il.size() / 2);
+    cv::resize(ir, ir, ir.size() / 2);
+    left.emplace_back(il);
+    right.emplace_back(ir);
+  }
+
+  // Callbacks should come back in the order that frames were submitted.
+  std::vector<int> finished;
+  Timer timer(true);
+  for (size_t i = 0; i < left.size(); ++i) {
+    pm.MatchAsync(left.at(i), right.at(i), [&, i](const DisparityMap& disp, const Image1f& dispr)
+    {
+      EXPECT_EQ(left.at(i).size(), disp.disp.size());
+      EXPECT_EQ(left.at(i).size(), dispr.size());
+      EXPECT_GT(cv::countNonZero(disp.disp > 0), 0);
+
+      // Everything valid is foreground (and has some cost), but not the other way around.
+      EXPECT_GT(cv::countNonZero(disp.valid), 0);
+      EXPECT_EQ(0, cv::countNonZero(disp.valid & (disp.disp <= 0)));
+      EXPECT_EQ(0, cv::countNonZero(disp.valid & (disp.cost < 0)));
+      finished.emplace_back(i);
+    });
+  }
+  pm.Flush();
+  LOG(INFO) << "Took " << timer.Elapsed().milliseconds() / left.size() << " ms per frame" << std::endl;
+
+  ASSERT_EQ(left.size(), finished.size());
+  for (size_t i = 0; i < finished.size(); ++i) {
+    EXPECT_EQ((int)i, finished.at(i));
+  }
+}
+
+
+TEST(PatchmatchGpuTest, TestTemporal)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  ASSERT_FALSE(il.empty() || ir.empty());
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+
+  Image1f disp, dispr;
+  PatchmatchGpu pm(params);
+  pm.Match(il, ir, disp, dispr);
+
+  params.temporal = true;
+  PatchmatchGpu pm_temporal(params);
+
+  // The camera doesn't move, so warming up from the previous frame (with one iteration per frame)
+  // should converge to about the same disparity as a full Match().
+  const StereoCamera stereo_rig(PinholeCamera(300, 300, il.cols / 2, il.rows / 2, il.rows, il.cols), 0.2);
+  Image1f disp_temporal;
+  Timer timer(true);
+  for (int i = 0; i < 5; ++i) {
+    pm_temporal.MatchAsync(il, ir, stereo_rig, Matrix4d::Identity(), [&](const DisparityMap& d, const Image1f&)
+    {
+      disp_temporal = d.disp;
+    });
+  }
+  pm_temporal.Flush();
+  LOG(INFO) << "Took " << timer.Elapsed().milliseconds() / 5 << " ms per frame" << std::endl;
+
+  ASSERT_EQ(disp.size(), disp_temporal.size());
+  const Image1b both = (disp > 0) & (disp_temporal > 0);
+  ASSERT_GT(cv::countNonZero(both), 0);
+
+  Image1f diff;
+  cv::absdiff(disp, disp_temporal, diff);
+  EXPECT_LT(cv::mean(diff, both)[0], 2.0);
+}
+
+
+TEST(PatchmatchGpuTest, TestHalfPrecision)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  ASSERT_FALSE(il.empty() || ir.empty());
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+  ASSERT_TRUE(PatchmatchGpu::TilesFit(il.rows, il.cols, true));
+
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+
+  DisparityMap left, left_half;
+  Image1f dispr, dispr_half;
+  PatchmatchGpu pm(params);
+  pm.Match(il, ir, left, dispr);
+
+  params.half_precision = true;
+  PatchmatchGpu pm_half(params);
+  Timer timer(true);
+  pm_half.Match(il, ir, left_half, dispr_half);
+  LOG(INFO) << "Took " << timer.Elapsed().milliseconds() << " ms (half precision)" << std::endl;
+
+  // Same seed and noise, so only near-ties in the cost should come out differently.
+  ASSERT_EQ(left.disp.size(), left_half.disp.size());
+  const Image1b both = (left.disp > 0) & (left_half.disp > 0);
+  ASSERT_GT(cv::countNonZero(both), 0);
+
+  Image1f diff;
+  cv::absdiff(left.disp, left_half.disp, diff);
+  EXPECT_LT(cv::mean(diff, both)[0], 1.0);
+  EXPECT_EQ(0, cv::countNonZero(left_half.valid & (left_half.disp <= 0)));
+}
+
+
+TEST(PatchmatchGpuTest, TestPyramid)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  ASSERT_FALSE(il.empty() || ir.empty());
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+
+  DisparityMap left, left_pyr;
+  Image1f dispr, dispr_pyr;
+  PatchmatchGpu pm(params);
+  pm.Match(il, ir, left, dispr);
+
+  params.pyramid_levels = 2;
+  PatchmatchGpu pm_pyr(params);
+  Timer timer(true);
+  pm_pyr.Match(il, ir, left_pyr, dispr_pyr);
+  LOG(INFO) << "Took " << timer.Elapsed().milliseconds() << " ms (pyramid)" << std::endl;
+
+  ASSERT_EQ(il.size(), left_pyr.disp.size());
+  ASSERT_EQ(il.size(), dispr_pyr.size());
+  EXPECT_GT(cv::countNonZero(left_pyr.valid), 0);
+  EXPECT_EQ(0, cv::countNonZero(left_pyr.valid & (left_pyr.disp <= 0)));
+
+  // Where both passed the left-right check, the pyramid should land close to the full resolution
+  // iterations.
+  const Image1b both = left.valid & left_pyr.valid;
+  ASSERT_GT(cv::countNonZero(both), 0);
+  Image1f diff;
+  cv::absdiff(left.disp, left_pyr.disp, diff);
+  EXPECT_LT(cv::mean(diff, both)[0], 2.0);
+}
+
+
 TEST(PatchmatchGpuTest, Sequence)
 {
   // const std::string folder = "/home/milo/datasets/Unity3D/farmsim/waypoints1";
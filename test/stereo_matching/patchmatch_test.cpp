@@ -186,3 +186,30 @@ TEST(PatchmatchTest, Test01)
 
   cv::waitKey(0);
 }
+
+
+TEST(PatchmatchTest, TestPyramid)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+
+  Patchmatch::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+  params.pyramid_levels = 2;
+
+  Patchmatch pm(params);
+
+  Timer timer(true);
+  const Image1f disp = pm.EstimateDisparityPyramid(il, ir, L1GradientCostFunction);
+  LOG(INFO) << "Pyramid disp took: " << timer.Elapsed().milliseconds() << " ms" << std::endl;
+
+  EXPECT_EQ(il.size(), disp.size());
+  EXPECT_GT(cv::countNonZero(disp > 0), 0);
+}
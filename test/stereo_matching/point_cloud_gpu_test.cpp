@@ -0,0 +1,53 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "patchmatch_gpu/point_cloud_gpu.h"
+
+using namespace bm;
+using namespace core;
+using namespace pm;
+
+
+TEST(PointCloudGpuTest, TestPlane)
+{
+  const PinholeCamera cam(100, 100, 40, 30, 60, 80);
+  const StereoCamera stereo_rig(cam, 0.2);
+
+  // A fronto-parallel plane 2m away, with a background (zero disparity) stripe on the left.
+  Image1f disp(60, 80, 10.0f);
+  disp(cv::Rect(0, 0, 10, 60)).setTo(0);
+
+  PointCloudGpu::Params params;
+  params.voxel_size = 0.1;
+  PointCloudGpu pc(params, stereo_rig);
+
+  Image1f range;
+  Image3f xyz, points;
+  pc.Compute(disp, range, xyz, points);
+
+  ASSERT_EQ(disp.size(), range.size());
+  ASSERT_EQ(disp.size(), xyz.size());
+
+  EXPECT_NEAR(2.0, range(30, 40), 1e-5);
+  EXPECT_NEAR(0.0, xyz(30, 40)[0], 1e-5);
+  EXPECT_NEAR(2.0, xyz(30, 40)[2], 1e-5);
+
+  const cv::Vec3f corner = xyz(59, 79);
+  const double corner_range = std::sqrt(0.78*0.78 + 0.58*0.58 + 2.0*2.0);
+  EXPECT_NEAR(0.78, corner[0], 1e-5);
+  EXPECT_NEAR(0.58, corner[1], 1e-5);
+  EXPECT_NEAR(corner_range, range(59, 79), 1e-5);
+
+  EXPECT_EQ(0, range(30, 5));
+  EXPECT_TRUE(std::isnan(xyz(30, 5)[2]));
+
+  // The plane spans [-0.6, 0.8) x [-0.6, 0.6) at z = 2, so there are 14 x 12 voxels.
+  ASSERT_EQ(1, points.rows);
+  EXPECT_EQ(14 * 12, points.cols);
+  for (int i = 0; i < points.cols; ++i) {
+    EXPECT_NEAR(2.0, points(0, i)[2], 1e-5);
+  }
+}
@@ -0,0 +1,107 @@
+#include "gtest/gtest.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "core/timer.hpp"
+#include "vision_core/cv_types.hpp"
+#include "stereo_matching/stereo_matching.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace stereo;
+
+
+// Random texture, and the same texture shifted left by "disp" pixels (as seen by the right camera).
+static void MakeShiftedPair(int rows, int cols, int disp, Image1b& iml, Image1b& imr)
+{
+  iml = Image1b(rows, cols);
+  cv::RNG rng(123);
+  rng.fill(iml, cv::RNG::UNIFORM, 0, 256);
+  cv::GaussianBlur(iml, iml, cv::Size(3, 3), 0);
+
+  imr = Image1b(rows, cols, (uint8_t)0);
+  iml(cv::Rect(disp, 0, cols - disp, rows)).copyTo(imr(cv::Rect(0, 0, cols - disp, rows)));
+}
+
+
+TEST(SgmCensusTest, TestConstantDisparity)
+{
+  const int true_disp = 12;
+  Image1b iml, imr;
+  MakeShiftedPair(120, 160, true_disp, iml, imr);
+
+  for (const int num_paths : { 4, 8 }) {
+    SgmCensus::Params params;
+    params.matcher_params.max_disp = 32;
+    params.num_paths = num_paths;
+    SgmCensus sgm(params);
+
+    const Image1f disp = sgm.ComputeDisparity(iml, imr);
+    ASSERT_EQ(iml.size(), disp.size());
+
+    // Skip the census border, and the pixels whose match is off the edge of the right image.
+    const cv::Rect interior(params.matcher_params.max_disp, 2, 160 - params.matcher_params.max_disp - 2, 116);
+    const Image1f disp_interior = disp(interior);
+    const int num_correct = cv::countNonZero(cv::abs(disp_interior - true_disp) < 0.5);
+
+    EXPECT_GT(num_correct, 0.98 * interior.area()) << "num_paths=" << num_paths;
+    EXPECT_LE(cv::countNonZero(disp > params.matcher_params.max_disp), 0);
+  }
+}
+
+
+TEST(SgmCensusTest, TestForegroundRoi)
+{
+  const int true_disp = 12;
+  Image1b iml, imr;
+  MakeShiftedPair(120, 160, true_disp, iml, imr);
+
+  SgmCensus::Params params;
+  params.matcher_params.max_disp = 32;
+  SgmCensus sgm(params);
+
+  // Only a block in the middle of the image is foreground.
+  Image1b mask(iml.size(), (uint8_t)0);
+  mask(cv::Rect(60, 40, 60, 40)).setTo(255);
+  const ForegroundRoi roi(mask, 4);
+
+  const Image1f disp_full = sgm.ComputeDisparity(iml, imr);
+  const Image1f disp = sgm.ComputeDisparity(iml, imr, roi);
+  ASSERT_EQ(iml.size(), disp.size());
+
+  // Nothing outside of the ROI.
+  EXPECT_EQ(0, cv::countNonZero((disp >= 0) & (roi.Mask() == 0)));
+
+  // Paths start over at the boundary of the ROI, but that shouldn't matter on a constant disparity.
+  const cv::Rect interior(60, 40, 60, 40);
+  const int num_correct = cv::countNonZero(cv::abs(disp(interior) - true_disp) < 0.5);
+  EXPECT_GT(num_correct, 0.98 * interior.area());
+  EXPECT_EQ(cv::countNonZero(cv::abs(disp_full(interior) - true_disp) < 0.5), num_correct);
+}
+
+
+TEST(SgmCensusTest, TestRealImages)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", cv::IMREAD_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(il.empty() || ir.empty());
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+
+  DenseStereoParams params;
+  params.sgm_params.matcher_params.max_disp = 64;
+
+  for (const std::string method : { "sgm_census", "opencv_sgbm" }) {
+    params.method = method;
+    std::unique_ptr<DenseStereo> stereo = CreateDenseStereo(params);
+
+    Timer timer(true);
+    const Image1f disp = stereo->ComputeDisparity(il, ir);
+    LOG(INFO) << method << " took " << timer.Elapsed().milliseconds() << " ms" << std::endl;
+
+    EXPECT_EQ(il.size(), disp.size());
+    EXPECT_GT(cv::countNonZero(disp > 0), 0);
+  }
+}
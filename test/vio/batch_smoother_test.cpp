@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "vio/batch_smoother.hpp"
+#include "vio/noise_model.hpp"
+
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/slam/BetweenFactor.h>
+
+using namespace bm;
+using namespace vio;
+using namespace core;
+
+
+// A chain of odometry factors, with a noisy initial guess for every keypose except the first.
+static void MakePoseChain(int n,
+                          const gtsam::Pose3& odom,
+                          gtsam::NonlinearFactorGraph& factors,
+                          gtsam::Values& initial)
+{
+  const IsoModel::shared_ptr odom_noise = IsoModel::Sigma(6, 0.05);
+  const gtsam::Pose3 drift(gtsam::Rot3::Rz(0.02), gtsam::Point3(0.05, -0.03, 0.01));
+
+  gtsam::Pose3 guess = gtsam::Pose3::identity();
+  initial.insert(gtsam::Symbol('X', 0), guess);
+
+  for (int i = 1; i < n; ++i) {
+    factors.push_back(gtsam::BetweenFactor<gtsam::Pose3>(
+        gtsam::Symbol('X', i - 1), gtsam::Symbol('X', i), odom, odom_noise));
+    guess = guess * odom * drift;
+    initial.insert(gtsam::Symbol('X', i), guess);
+  }
+}
+
+
+TEST(BatchSmootherTest, TestPoseChain)
+{
+  BatchSmoother::Params params;
+  params.max_iters = 50;
+  BatchSmoother smoother(params);
+
+  const int n = 10;
+  const gtsam::Pose3 odom(gtsam::Rot3::Rz(0.1), gtsam::Point3(1, 0, 0));
+
+  gtsam::NonlinearFactorGraph factors;
+  gtsam::Values initial;
+  MakePoseChain(n, odom, factors, initial);
+
+  const BatchResult result = smoother.Solve(factors, initial);
+  ASSERT_TRUE(result.success);
+  EXPECT_GT(result.iterations, 0);
+  EXPECT_LT(result.final_error, result.initial_error);
+  ASSERT_EQ(static_cast<size_t>(n), result.world_P_body.size());
+
+  // The oldest keypose is anchored at its initial guess, and the rest follow the odometry exactly.
+  gtsam::Pose3 expected = gtsam::Pose3::identity();
+  for (int i = 0; i < n; ++i) {
+    const gtsam::Pose3& actual = result.world_P_body.at(i);
+    EXPECT_TRUE(expected.equals(actual, 1e-4)) << "Mismatch at keypose " << i;
+    EXPECT_TRUE(actual.equals(result.estimate.at<gtsam::Pose3>(gtsam::Symbol('X', i)), 1e-9));
+    expected = expected * odom;
+  }
+}
+
+
+TEST(BatchSmootherTest, TestSkipsTrimmedKeys)
+{
+  BatchSmoother smoother((BatchSmoother::Params()));
+
+  const int n = 6;
+  const gtsam::Pose3 odom(gtsam::Rot3::Ry(-0.05), gtsam::Point3(0.5, 0.2, 0));
+
+  gtsam::NonlinearFactorGraph factors;
+  gtsam::Values initial;
+  MakePoseChain(n, odom, factors, initial);
+
+  // Pretend that the oldest keypose was trimmed from the history, so the factor that involves it
+  // is skipped, and X1 becomes the anchor.
+  const gtsam::Pose3 X1_init = initial.at<gtsam::Pose3>(gtsam::Symbol('X', 1));
+  initial.erase(gtsam::Symbol('X', 0));
+
+  // Factors on a variable that only shows up in the initial values should be skipped too.
+  factors.push_back(gtsam::BetweenFactor<gtsam::Pose3>(
+      gtsam::Symbol('X', n - 1), gtsam::Symbol('X', n), odom, IsoModel::Sigma(6, 0.05)));
+  factors.push_back(gtsam::NonlinearFactor::shared_ptr());
+
+  const BatchResult result = smoother.Solve(factors, initial);
+  ASSERT_TRUE(result.success);
+  ASSERT_EQ(static_cast<size_t>(n - 1), result.world_P_body.size());
+  EXPECT_EQ(0ul, result.world_P_body.count(0));
+  EXPECT_EQ(0ul, result.world_P_body.count(n));
+
+  gtsam::Pose3 expected = X1_init;
+  for (int i = 1; i < n; ++i) {
+    EXPECT_TRUE(expected.equals(result.world_P_body.at(i), 1e-4)) << "Mismatch at keypose " << i;
+    expected = expected * odom;
+  }
+}
+
+
+TEST(BatchSmootherTest, TestNoKeyposes)
+{
+  BatchSmoother smoother((BatchSmoother::Params()));
+
+  const BatchResult result = smoother.Solve(gtsam::NonlinearFactorGraph(), gtsam::Values());
+  EXPECT_FALSE(result.success);
+  EXPECT_TRUE(result.world_P_body.empty());
+}
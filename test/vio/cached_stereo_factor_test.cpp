@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "vio/cached_stereo_factor.hpp"
+
+#include <gtsam/geometry/Cal3_S2Stereo.h>
+#include <gtsam/geometry/StereoCamera.h>
+#include <gtsam/nonlinear/Values.h>
+
+using namespace gtsam;
+
+
+static const Point3 kLandmark(0.5, -0.3, 5.0);
+
+
+static Pose3 CameraPose(size_t i)
+{
+  return Pose3(Rot3::Ypr(0.02 * i, -0.01 * i, 0), Point3(0.3 * i, 0.05 * i, 0));
+}
+
+
+// Observations of kLandmark from cameras [0, n), with "noise" (px) added to the last one.
+static CachedSmartStereoFactor::shared_ptr MakeFactor(const Cal3_S2Stereo::shared_ptr& K, size_t n, double noise)
+{
+  CachedSmartStereoFactor::shared_ptr factor(new CachedSmartStereoFactor(
+      noiseModel::Isotropic::Sigma(3, 1.0), SmartStereoProjectionParams(JACOBIAN_SVD, ZERO_ON_DEGENERACY), Pose3()));
+  for (size_t i = 0; i < n; ++i) {
+    StereoPoint2 measured = StereoCamera(CameraPose(i), K).project(kLandmark);
+    if (i + 1 == n) {
+      measured = StereoPoint2(measured.uL() + noise, measured.uR() + noise, measured.v() - noise);
+    }
+    factor->add(measured, i, K);
+  }
+  return factor;
+}
+
+
+TEST(CachedSmartStereoFactorTest, TestIncremental)
+{
+  const Cal3_S2Stereo::shared_ptr K(new Cal3_S2Stereo(400, 400, 0, 320, 240, 0.2));
+
+  Values values;
+  for (size_t i = 0; i < 5; ++i) {
+    values.insert(i, CameraPose(i));
+  }
+
+  // The first factor has nothing to start from.
+  const CachedSmartStereoFactor::shared_ptr f3 = MakeFactor(K, 3, 0.0);
+  TriangulationResult result = f3->Triangulate(values, 1e-3, 0.05);
+  ASSERT_TRUE(result.valid());
+  EXPECT_LT((*result - kLandmark).norm(), 1e-6);
+  EXPECT_EQ(1ul, f3->NumFull());
+
+  // Adding a (noisy) observation is one step from the old point, and lands where a full
+  // triangulation would.
+  const CachedSmartStereoFactor::shared_ptr f4 = MakeFactor(K, 4, 0.5);
+  f4->Seed(*f3);
+  result = f4->Triangulate(values, 1e-3, 0.05);
+  ASSERT_TRUE(result.valid());
+  EXPECT_EQ(1ul, f4->NumIncremental());
+  EXPECT_EQ(0ul, f4->NumFull());
+
+  const CachedSmartStereoFactor::shared_ptr f4_full = MakeFactor(K, 4, 0.5);
+  const TriangulationResult expected = f4_full->Triangulate(values, 1e-3, 0.05);
+  ASSERT_TRUE(expected.valid());
+  EXPECT_LT((*result - *expected).norm(), 1e-3);
+
+  // The linearize() cache picks up the incremental point too.
+  EXPECT_LT((*f4->point(values) - *result).norm(), 1e-12);
+
+  // Once one of the old cameras moves, it triangulates from scratch.
+  values.update(0, CameraPose(0) * Pose3(Rot3(), Point3(0.1, 0, 0)));
+  const CachedSmartStereoFactor::shared_ptr f5 = MakeFactor(K, 5, 0.0);
+  f5->Seed(*f4);
+  EXPECT_TRUE(f5->Triangulate(values, 1e-3, 0.05).valid());
+  EXPECT_EQ(0ul, f5->NumIncremental());
+  EXPECT_EQ(1ul, f5->NumFull());
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <cmath>
+
+#include "core/eigen_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_image.hpp"
+#include "vio/direct_odometry.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static const double kPlaneDepth = 5.0;
+
+
+// Texture on the plane z = kPlaneDepth (in the keyframe), at world coordinates (x, y). The periods
+// are incommensurate, so that stereo matching has a unique answer.
+static double Texture(double x, double y)
+{
+  return 128.0 + 40.0 * std::sin(2.0 * M_PI * x / 0.25) + 30.0 * std::sin(2.0 * M_PI * x / 0.37 + 1.0)
+               + 40.0 * std::cos(2.0 * M_PI * y / 0.29) + 20.0 * std::sin(2.0 * M_PI * (x + y) / 0.53);
+}
+
+
+// Image of the plane from a (fronto-parallel) camera at position c in the keyframe.
+static Image1b RenderPlane(const PinholeCamera& cam, const Vector3d& c)
+{
+  Image1b image(static_cast<int>(cam.Height()), static_cast<int>(cam.Width()));
+  const double Z = kPlaneDepth - c.z();
+  for (int v = 0; v < image.rows; ++v) {
+    for (int u = 0; u < image.cols; ++u) {
+      const double x = (u - cam.cx()) / cam.fx() * Z + c.x();
+      const double y = (v - cam.cy()) / cam.fy() * Z + c.y();
+      image(v, u) = cv::saturate_cast<uchar>(Texture(x, y));
+    }
+  }
+  return image;
+}
+
+
+static StereoImage1b RenderStereo(const StereoCamera& stereo_rig, uid_t camera_id, const Vector3d& c)
+{
+  const Vector3d c_right = c + Vector3d(stereo_rig.Baseline(), 0, 0);
+  return StereoImage1b(camera_id, camera_id,
+                       RenderPlane(stereo_rig.LeftCamera(), c),
+                       RenderPlane(stereo_rig.LeftCamera(), c_right));
+}
+
+
+static DirectOdometry::Params MakeParams()
+{
+  DirectOdometry::Params params;
+  params.matcher_params.max_disp = 32;
+  params.matcher_params.subpixel_refinement = true;
+  return params;
+}
+
+
+TEST(DirectOdometryTest, TestTrackTranslation)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(cam, 0.2);
+
+  DirectOdometry odom(MakeParams(), stereo_rig);
+
+  // No keyframe yet.
+  Matrix4d cur_T_kf = Matrix4d::Identity();
+  double avg_error = 0;
+  EXPECT_EQ(-1, odom.Track(RenderStereo(stereo_rig, 0, Vector3d::Zero()), cur_T_kf, avg_error));
+
+  const size_t num_points = odom.SetKeyframe(RenderStereo(stereo_rig, 1, Vector3d::Zero()));
+  EXPECT_GT(num_points, 100ul);
+  EXPECT_EQ(num_points, odom.Observations().size());
+
+  // All of the points are on the plane.
+  for (const LandmarkObservation& obs : odom.Observations()) {
+    EXPECT_NEAR(kPlaneDepth, stereo_rig.DispToDepth(obs.disparity), 0.1);
+  }
+
+  // The camera moved a few cm (about 5px). Start from identity.
+  const Vector3d c(0.05, -0.03, 0.1);
+  EXPECT_GE(odom.Track(RenderStereo(stereo_rig, 2, c), cur_T_kf, avg_error), 0);
+  EXPECT_LT(avg_error, 3.0);
+
+  const Vector3d t_expected = -c;
+  EXPECT_LT((cur_T_kf.block<3, 1>(0, 3) - t_expected).norm(), 0.01);
+  EXPECT_LT((cur_T_kf.block<3, 3>(0, 0) - Matrix3d::Identity()).norm(), 0.01);
+
+  // The inliers keep their landmark ids, and their disparity is at the new depth.
+  EXPECT_GT(odom.Observations().size(), num_points / 2);
+  for (const LandmarkObservation& obs : odom.Observations()) {
+    EXPECT_EQ(2ul, obs.camera_id);
+    EXPECT_NEAR(kPlaneDepth - c.z(), stereo_rig.DispToDepth(obs.disparity), 0.1);
+  }
+}
+
+
+TEST(DirectOdometryTest, TestLandmarkIds)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(cam, 0.2);
+
+  DirectOdometry odom(MakeParams(), stereo_rig);
+  odom.ReserveLandmarkIds(1000);
+
+  odom.SetKeyframe(RenderStereo(stereo_rig, 0, Vector3d::Zero()));
+  const uid_t first_id = odom.Observations().front().landmark_id;
+  const uid_t last_id = odom.Observations().back().landmark_id;
+  EXPECT_EQ(1000ul, first_id);
+
+  // Every keyframe gets new landmarks.
+  odom.SetKeyframe(RenderStereo(stereo_rig, 1, Vector3d(0.02, 0, 0)));
+  EXPECT_EQ(last_id + 1, odom.Observations().front().landmark_id);
+}
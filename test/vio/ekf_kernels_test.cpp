@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+
+#include "core/eigen_types.hpp"
+#include "vio/ekf_kernels.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// A random symmetric positive definite covariance.
+template <typename Scalar>
+static EkfCovariance<Scalar> RandomCovariance()
+{
+  const EkfCovariance<Scalar> A = EkfCovariance<Scalar>::Random();
+  return A * A.transpose() + Scalar(0.1) * EkfCovariance<Scalar>::Identity();
+}
+
+
+TEST(EkfKernelsTest, PropagateCovarianceMatchesDense)
+{
+  const double dt = 0.005;
+  const Matrix15d P0 = RandomCovariance<double>();
+  const Matrix15d Q = 1e-3 * Matrix15d::Identity();
+  const Matrix3d R_dq = AngleAxisd(0.01, Vector3d(0.2, 0.3, 0.9).normalized()).toRotationMatrix();
+  const Matrix3d G = Matrix3d::Random();
+
+  Matrix15d F = Matrix15d::Identity();
+  F.block<3, 3>(t_row, v_row) = dt * Matrix3d::Identity();
+  F.block<3, 3>(t_row, a_row) = 0.5*dt*dt * Matrix3d::Identity();
+  F.block<3, 3>(v_row, a_row) = dt * Matrix3d::Identity();
+  F.block<3, 3>(uq_row, uq_row) = R_dq;
+  F.block<3, 3>(uq_row, w_row) = G;
+  const Matrix15d expected = F*P0*F.transpose() + dt*Q;
+
+  Matrix15d P1;
+  PropagateCovariance<double>(P0, dt, R_dq, G, Q, P1);
+  EXPECT_TRUE(P1.isApprox(expected, 1e-12));
+}
+
+
+TEST(EkfKernelsTest, JosephUpdateMatchesDense)
+{
+  const Matrix15d P0 = RandomCovariance<double>();
+
+  // Pose-like measurement (rotation and translation).
+  Eigen::Matrix<double, 6, 15> H = Eigen::Matrix<double, 6, 15>::Zero();
+  H.block<3, 3>(0, uq_row) = Matrix3d::Identity();
+  H.block<3, 3>(3, t_row) = Matrix3d::Identity();
+  const Matrix6d R = 0.01 * Matrix6d::Identity();
+
+  const Matrix6d S = H*P0*H.transpose() + R;
+  const Eigen::Matrix<double, 15, 6> K_expected = P0*H.transpose()*S.inverse();
+  const Matrix15d A = Matrix15d::Identity() - K_expected*H;
+  const Matrix15d P1_expected = A*P0*A.transpose() + K_expected*R*K_expected.transpose();
+
+  Eigen::Matrix<double, 15, 6> K;
+  Matrix15d P1;
+  JosephUpdate<double, 6>(P0, H, R, K, P1);
+
+  EXPECT_TRUE(K.isApprox(K_expected, 1e-9));
+  EXPECT_TRUE(P1.isApprox(P1_expected, 1e-9));
+}
+
+
+// The float kernels should agree with the double ones to float precision.
+TEST(EkfKernelsTest, FloatMatchesDouble)
+{
+  const Matrix15d P0 = RandomCovariance<double>();
+  Eigen::Matrix<double, 1, 15> H = Eigen::Matrix<double, 1, 15>::Zero();
+  H.block<1, 3>(0, t_row) = Vector3d(0.6, 0, 0.8).transpose();
+  const Matrix1d R = 0.1 * Matrix1d::Identity();
+
+  Eigen::Matrix<double, 15, 1> Kd;
+  Matrix15d P1d;
+  JosephUpdate<double, 1>(P0, H, R, Kd, P1d);
+
+  Eigen::Matrix<float, 15, 1> Kf;
+  EkfCovariance<float> P1f;
+  const EkfCovariance<float> P0f = P0.cast<float>();
+  const Eigen::Matrix<float, 1, 15> Hf = H.cast<float>();
+  const Matrix1f Rf = R.cast<float>();
+  JosephUpdate<float, 1>(P0f, Hf, Rf, Kf, P1f);
+
+  EXPECT_LT((Kf.cast<double>() - Kd).norm(), 1e-4);
+  EXPECT_LT((P1f.cast<double>() - P1d).norm() / P1d.norm(), 1e-4);
+}
+
+
+// A stacked update with a dynamic (but bounded) number of rows should match the fixed-size one.
+TEST(EkfKernelsTest, DynamicMatchesFixed)
+{
+  const Matrix15d P0 = RandomCovariance<double>();
+
+  Eigen::Matrix<double, 3, 15> H = Eigen::Matrix<double, 3, 15>::Random();
+  const Matrix3d R = 0.05 * Matrix3d::Identity();
+
+  Eigen::Matrix<double, 15, 3> K_fixed;
+  Matrix15d P1_fixed;
+  JosephUpdate<double, 3>(P0, H, R, K_fixed, P1_fixed);
+
+  const EkfJacobian<double, Eigen::Dynamic, 8> H_dyn = H;
+  const EkfNoise<double, Eigen::Dynamic, 8> R_dyn = R;
+  EkfGain<double, Eigen::Dynamic, 8> K_dyn;
+  Matrix15d P1_dyn;
+  JosephUpdate<double, Eigen::Dynamic, 8>(P0, H_dyn, R_dyn, K_dyn, P1_dyn);
+
+  ASSERT_EQ(3, K_dyn.cols());
+  EXPECT_TRUE(K_dyn.isApprox(K_fixed, 1e-12));
+  EXPECT_TRUE(P1_dyn.isApprox(P1_fixed, 1e-12));
+
+  // A huge innovation on the first row should stand out.
+  EkfInnovation<double, Eigen::Dynamic, 8> y(3);
+  y << 100.0, 0.01, -0.01;
+  EkfInnovation<double, Eigen::Dynamic, 8> d2;
+  InnovationMahalanobis2<double, Eigen::Dynamic, 8>(P0, H_dyn, y, R_dyn, d2);
+  ASSERT_EQ(3, d2.rows());
+  EXPECT_GT(d2(0), 9.0);
+  EXPECT_LT(d2(1), 9.0);
+  EXPECT_LT(d2(2), 9.0);
+}
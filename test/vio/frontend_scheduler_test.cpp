@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "vio/frontend_scheduler.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+typedef FrontendScheduler::LoadLevel LoadLevel;
+
+
+static FrontendScheduler::Params MakeParams()
+{
+  FrontendScheduler::Params params;
+  params.enabled = true;
+  params.frame_budget_ms = 50.0;
+  params.window = 4;
+  return params;
+}
+
+
+TEST(FrontendSchedulerTest, Disabled)
+{
+  FrontendScheduler::Params params = MakeParams();
+  params.enabled = false;
+  FrontendScheduler scheduler(params);
+
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_FALSE(scheduler.Update(500.0, 50));
+  }
+  EXPECT_EQ(LoadLevel::NOMINAL, scheduler.Level());
+  EXPECT_EQ(0ul, scheduler.NumToSkip(50));
+}
+
+
+TEST(FrontendSchedulerTest, EscalateAndRecover)
+{
+  FrontendScheduler scheduler(MakeParams());
+
+  // Each level change needs a full window of samples.
+  for (int level = 1; level <= 3; ++level) {
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_FALSE(scheduler.Update(80.0, 1));
+    }
+    EXPECT_TRUE(scheduler.Update(80.0, 1));
+    EXPECT_EQ(level, static_cast<int>(scheduler.Level()));
+  }
+  EXPECT_TRUE(scheduler.ReducedEffort());
+
+  // Already at the highest level.
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_FALSE(scheduler.Update(80.0, 1));
+  }
+
+  // Only process the newest frame.
+  EXPECT_EQ(4ul, scheduler.NumToSkip(5));
+  EXPECT_EQ(0ul, scheduler.NumToSkip(1));
+
+  // In between the thresholds, stay put.
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_FALSE(scheduler.Update(35.0, 1));
+  }
+  EXPECT_EQ(LoadLevel::NEWEST_ONLY, scheduler.Level());
+
+  // Recover one level at a time.
+  int num_changes = 0;
+  for (int i = 0; i < 12; ++i) {
+    const int prev_level = static_cast<int>(scheduler.Level());
+    if (scheduler.Update(10.0, 0)) {
+      EXPECT_EQ(prev_level - 1, static_cast<int>(scheduler.Level()));
+      ++num_changes;
+    }
+  }
+  EXPECT_EQ(3, num_changes);
+  EXPECT_EQ(LoadLevel::NOMINAL, scheduler.Level());
+  EXPECT_FALSE(scheduler.ReducedEffort());
+}
+
+
+TEST(FrontendSchedulerTest, QueueDepthAndSkipAlternate)
+{
+  FrontendScheduler scheduler(MakeParams());
+
+  // Fast frames, but the queue is backing up.
+  for (int i = 0; i < 8; ++i) {
+    scheduler.Update(10.0, 10);
+  }
+  EXPECT_EQ(LoadLevel::SKIP_ALTERNATE, scheduler.Level());
+
+  // Skip every other frame.
+  EXPECT_EQ(1ul, scheduler.NumToSkip(3));
+  EXPECT_EQ(0ul, scheduler.NumToSkip(2));
+  EXPECT_EQ(1ul, scheduler.NumToSkip(1));
+  EXPECT_EQ(0ul, scheduler.NumToSkip(1));
+  EXPECT_EQ(0ul, scheduler.NumToSkip(0));
+}
@@ -62,7 +62,6 @@ TEST(ImuManagerTest, TestAll)
   EXPECT_EQ(2ul, m.Size());
 
   // The newest IMU measurement is way before the to_time, so should fail.
-  // NOTE: measurements will be dropped by this operation.
   const PimResult& pim2 = m.Preintegrate(10, 12);
   EXPECT_FALSE(pim2.timestamps_aligned);
   EXPECT_EQ(2ul, m.Size());
@@ -77,3 +76,97 @@ TEST(ImuManagerTest, TestAll)
   EXPECT_TRUE(pim4.timestamps_aligned);
   EXPECT_TRUE(m.Empty());
 }
+
+
+// A failed preintegration shouldn't throw away the measurements, so that it can be retried.
+TEST(ImuManagerTest, TestKeepOnFailure)
+{
+  const std::string filepath_params = "./resources/config/ImuManager.yaml";
+  const std::string filepath_shared = config_path("shared/Farmsim.yaml");
+  ImuManager::Params params(filepath_params, filepath_shared);
+
+  for (const bool incremental : { false, true }) {
+    params.incremental = incremental;
+    ImuManager m(params);
+
+    // There's a gap in the measurements around t = 12.
+    for (const double t : { 10.0, 11.0, 13.0 }) {
+      m.Push(ImuMeasurement(ConvertToNanoseconds(t), Vector3d(0, 0, 0), Vector3d(0, -9.81, 0)));
+    }
+
+    // No measurement near the to_time, so this fails after integrating the measurements up to it.
+    const PimResult pim1 = m.Preintegrate(10.0, 12.0);
+    EXPECT_FALSE(pim1.timestamps_aligned);
+    EXPECT_EQ(3ul, m.Size());
+    EXPECT_EQ(10.0, m.Oldest());
+
+    // Retrying (with a looser tolerance) still has all of the measurements.
+    const PimResult pim2 = m.Preintegrate(10.0, 12.0, 1.5);
+    ASSERT_TRUE(pim2.timestamps_aligned);
+    EXPECT_NEAR(2.0, pim2.pim.deltaTij(), 1e-9);
+    EXPECT_EQ(ConvertToNanoseconds(10.0), pim2.from_imu.timestamp);
+    EXPECT_EQ(ConvertToNanoseconds(11.0), pim2.to_imu.timestamp);
+    EXPECT_EQ(1ul, m.Size());
+    EXPECT_EQ(13.0, m.Oldest());
+  }
+}
+
+
+// Preintegrating as measurements arrive should give the same result as preintegrating all at once.
+TEST(ImuManagerTest, TestIncremental)
+{
+  const std::string filepath_params = "./resources/config/ImuManager.yaml";
+  const std::string filepath_shared = config_path("shared/Farmsim.yaml");
+  ImuManager::Params params(filepath_params, filepath_shared);
+
+  ImuManager batch(params);
+  params.incremental = true;
+  ImuManager incremental(params);
+
+  const auto push = [&](int i) {
+    const double t = 0.01 * i;
+    const ImuMeasurement imu(ConvertToNanoseconds(t),
+                             Vector3d(0.1 * std::sin(t), 0.2, -0.1 * std::cos(t)),
+                             Vector3d(0.5 * std::cos(t), -9.81, 0.3));
+    batch.Push(imu);
+    incremental.Push(imu);
+    incremental.Advance();
+  };
+
+  for (int i = 0; i <= 100; ++i) { push(i); }
+
+  // The first preintegration has to start from scratch.
+  const PimResult b0 = batch.Preintegrate(0.0, 1.0, 0.02);
+  const PimResult i0 = incremental.Preintegrate(0.0, 1.0, 0.02);
+  ASSERT_TRUE(b0.timestamps_aligned);
+  ASSERT_TRUE(i0.timestamps_aligned);
+
+  for (int i = 101; i <= 200; ++i) { push(i); }
+
+  // Now the incremental one only has to split its running result at to_time (between measurements).
+  const PimResult b1 = batch.Preintegrate(1.0, 1.505, 0.02);
+  const PimResult i1 = incremental.Preintegrate(1.0, 1.505, 0.02);
+  ASSERT_TRUE(b1.timestamps_aligned);
+  ASSERT_TRUE(i1.timestamps_aligned);
+  EXPECT_EQ(batch.Size(), incremental.Size());
+
+  EXPECT_NEAR(b1.pim.deltaTij(), i1.pim.deltaTij(), 1e-9);
+  EXPECT_TRUE(b1.pim.deltaPij().isApprox(i1.pim.deltaPij(), 1e-9));
+  EXPECT_TRUE(b1.pim.deltaVij().isApprox(i1.pim.deltaVij(), 1e-9));
+  EXPECT_TRUE(b1.pim.deltaRij().equals(i1.pim.deltaRij(), 1e-9));
+  EXPECT_EQ(b1.from_imu.timestamp, i1.from_imu.timestamp);
+  EXPECT_EQ(b1.to_imu.timestamp, i1.to_imu.timestamp);
+
+  // A new bias should be applied to the measurements that were already integrated.
+  const ImuBias bias(gtsam::Vector3(0.01, 0, 0), gtsam::Vector3(0, 0.001, 0));
+  batch.ResetAndUpdateBias(bias);
+  incremental.ResetAndUpdateBias(bias);
+
+  const PimResult b2 = batch.Preintegrate(1.505, 2.0, 0.02);
+  const PimResult i2 = incremental.Preintegrate(1.505, 2.0, 0.02);
+  ASSERT_TRUE(b2.timestamps_aligned);
+  ASSERT_TRUE(i2.timestamps_aligned);
+  EXPECT_TRUE(b2.pim.deltaPij().isApprox(i2.pim.deltaPij(), 1e-9));
+  EXPECT_TRUE(b2.pim.deltaVij().isApprox(i2.pim.deltaVij(), 1e-9));
+  EXPECT_TRUE(b2.pim.biasHat().equals(i2.pim.biasHat(), 1e-9));
+}
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "core/eigen_types.hpp"
+#include "core/timestamp.hpp"
+#include "vio/imu_propagator.hpp"
+
+using namespace bm;
+using namespace vio;
+using namespace core;
+
+
+static ImuMeasurement MakeImu(seconds_t t, const Vector3d& a_world)
+{
+  // The IMU (at identity orientation) feels the opposite of gravity, on top of a_world.
+  return ImuMeasurement(ConvertToNanoseconds(t), Vector3d::Zero(), a_world - Vector3d(0, 9.81, 0));
+}
+
+
+static State MakeState(const Vector3d& t)
+{
+  return State(t, Vector3d::Zero(), Vector3d::Zero(), Quaterniond::Identity(), Vector3d::Zero(), Matrix15d::Identity());
+}
+
+
+TEST(ImuPropagatorTest, TestConstantAcceleration)
+{
+  ImuPropagator::Params params;
+  params.enabled = true;
+  ImuPropagator propagator(params);
+
+  const Vector3d a_world(0.2, 0, -0.1);
+  PropagatedState out;
+
+  // Nothing to propagate from yet.
+  EXPECT_FALSE(propagator.Propagate(MakeImu(0.0, a_world), out));
+
+  propagator.Reset(StateStamped(0.0, MakeState(Vector3d::Zero())));
+
+  for (int i = 1; i <= 100; ++i) {
+    const seconds_t t = 0.002 * i;
+    ASSERT_TRUE(propagator.Propagate(MakeImu(t, a_world), out));
+    EXPECT_NEAR(t, out.timestamp, 1e-9);
+    EXPECT_NEAR(t, out.age, 1e-9);
+  }
+
+  EXPECT_TRUE(out.t.isApprox(0.5 * 0.2 * 0.2 * a_world, 1e-6));
+  EXPECT_TRUE(out.v.isApprox(0.2 * a_world, 1e-6));
+  EXPECT_NEAR(0, out.q.angularDistance(Quaterniond::Identity()), 1e-9);
+
+  // Old measurements (already integrated) are skipped.
+  EXPECT_FALSE(propagator.Propagate(MakeImu(0.1, a_world), out));
+}
+
+
+TEST(ImuPropagatorTest, TestResetReplays)
+{
+  ImuPropagator::Params params;
+  params.enabled = true;
+  params.max_age_sec = 0.1;
+  ImuPropagator propagator(params);
+
+  const Vector3d a_world(0, 0, 1);
+  PropagatedState out;
+
+  propagator.Reset(StateStamped(0.0, MakeState(Vector3d::Zero())));
+  for (int i = 1; i <= 10; ++i) {
+    propagator.Propagate(MakeImu(0.01 * i, a_world), out);
+  }
+
+  // A filter state that lags behind the IMU (t=0.05). The stored measurements after it get replayed.
+  propagator.Reset(StateStamped(0.05, MakeState(Vector3d(1, 2, 3))));
+
+  ASSERT_TRUE(propagator.Propagate(MakeImu(0.11, a_world), out));
+  EXPECT_NEAR(0.06, out.age, 1e-9);
+  EXPECT_TRUE(out.t.isApprox(Vector3d(1, 2, 3) + 0.5 * 0.06 * 0.06 * a_world, 1e-6));
+
+  // Too old to be useful.
+  params.max_age_sec = 0.01;
+  ImuPropagator strict(params);
+  strict.Reset(StateStamped(0.0, MakeState(Vector3d::Zero())));
+  EXPECT_FALSE(strict.Propagate(MakeImu(0.02, a_world), out));
+}
@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <random>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/timer.hpp"
+#include "vio/keyframe_database.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static Descriptor256 RandomDescriptor(std::mt19937_64& rng)
+{
+  return Descriptor256{{ rng(), rng(), rng(), rng() }};
+}
+
+
+// Random "places", each with its own set of descriptors, drawn from a pool of "visual patterns"
+// (so that words are shared between places, like in real images).
+static std::vector<VecDescriptor256> MakePlaces(size_t num_places, size_t per_place, std::mt19937_64& rng)
+{
+  VecDescriptor256 patterns(2000);
+  for (Descriptor256& d : patterns) {
+    d = RandomDescriptor(rng);
+  }
+
+  std::vector<VecDescriptor256> places(num_places);
+  for (VecDescriptor256& place : places) {
+    for (size_t i = 0; i < per_place; ++i) {
+      place.push_back(patterns.at(rng() % patterns.size()));
+    }
+  }
+  return places;
+}
+
+
+// Flip a few bits of every descriptor, and drop some of them (a different view of the same place).
+static VecDescriptor256 Perturb(const VecDescriptor256& place, std::mt19937_64& rng)
+{
+  VecDescriptor256 out;
+  for (const Descriptor256& d : place) {
+    if (rng() % 4 == 0) {
+      continue;
+    }
+    Descriptor256 p = d;
+    for (int k = 0; k < 10; ++k) {
+      const int b = static_cast<int>(rng() % 256);
+      p[b / 64] ^= (1ull << (b % 64));
+    }
+    out.push_back(p);
+  }
+  return out;
+}
+
+
+TEST(KeyframeDatabaseTest, TestHammingDistance)
+{
+  const Descriptor256 a = {{ 0, 0, 0, 0 }};
+  const Descriptor256 b = {{ 1, 3, 0, ~0ull }};
+  EXPECT_EQ(0, HammingDistance(a, a));
+  EXPECT_EQ(67, HammingDistance(a, b));
+}
+
+
+TEST(KeyframeDatabaseTest, TestTrainAndTransform)
+{
+  std::mt19937_64 rng(123);
+  const std::vector<VecDescriptor256> places = MakePlaces(30, 200, rng);
+
+  BowVocabulary vocab;
+  EXPECT_TRUE(vocab.Empty());
+  vocab.Train(places, 8, 3);
+  EXPECT_FALSE(vocab.Empty());
+  EXPECT_LE(vocab.NumWords(), 512ul);
+  EXPECT_GT(vocab.NumWords(), 100ul);
+
+  std::vector<uint32_t> words;
+  const BowVector bow = vocab.Transform(places.at(0), &words);
+  ASSERT_EQ(places.at(0).size(), words.size());
+  EXPECT_FALSE(bow.empty());
+
+  float total = 0;
+  for (size_t i = 0; i < bow.size(); ++i) {
+    EXPECT_LT(bow.at(i).first, vocab.NumWords());
+    if (i > 0) {
+      EXPECT_LT(bow.at(i - 1).first, bow.at(i).first);
+    }
+    total += bow.at(i).second;
+  }
+  EXPECT_NEAR(1.0, total, 1e-5);
+
+  // The same descriptor always maps to the same word.
+  EXPECT_EQ(words.at(5), vocab.Word(places.at(0).at(5)));
+}
+
+
+TEST(KeyframeDatabaseTest, TestSaveLoad)
+{
+  std::mt19937_64 rng(7);
+  const std::vector<VecDescriptor256> places = MakePlaces(10, 100, rng);
+
+  BowVocabulary vocab;
+  vocab.Train(places, 6, 3);
+
+  const std::string path = "/tmp/keyframe_database_test.vocab";
+  ASSERT_TRUE(vocab.Save(path));
+
+  BowVocabulary loaded;
+  ASSERT_TRUE(loaded.Load(path));
+  EXPECT_EQ(vocab.NumWords(), loaded.NumWords());
+  EXPECT_EQ(vocab.Transform(places.at(3)), loaded.Transform(places.at(3)));
+
+  BowVocabulary missing;
+  EXPECT_FALSE(missing.Load("/tmp/keyframe_database_test_missing.vocab"));
+  EXPECT_TRUE(missing.Empty());
+
+  std::remove(path.c_str());
+}
+
+
+TEST(KeyframeDatabaseTest, TestQuery)
+{
+  std::mt19937_64 rng(42);
+  const std::vector<VecDescriptor256> places = MakePlaces(2000, 300, rng);
+
+  // Train on a subset, like a vocabulary that was trained on a different dataset.
+  BowVocabulary vocab;
+  vocab.Train(std::vector<VecDescriptor256>(places.begin(), places.begin() + 100), 10, 4);
+
+  KeyframeDatabase db(vocab.NumWords());
+  for (size_t i = 0; i < places.size(); ++i) {
+    db.Add(1000 + i, vocab.Transform(places.at(i)));
+  }
+  EXPECT_EQ(places.size(), db.Size());
+
+  // Each perturbed view should bring back its own place first.
+  Timer timer(true);
+  int num_correct = 0;
+  for (size_t i = 0; i < 50; ++i) {
+    const size_t place = (i * 37) % places.size();
+    const std::vector<KeyframeDatabase::Match> matches = db.Query(vocab.Transform(Perturb(places.at(place), rng)), 5, 0.0f);
+    ASSERT_FALSE(matches.empty());
+    EXPECT_LE(matches.size(), 5ul);
+    for (size_t k = 1; k < matches.size(); ++k) {
+      EXPECT_GE(matches.at(k - 1).score, matches.at(k).score);
+    }
+    num_correct += (matches.front().keyframe_id == 1000 + place) ? 1 : 0;
+  }
+  EXPECT_GE(num_correct, 48);
+  LOG(INFO) << "Transform + Query: " << timer.Elapsed().milliseconds() / 50 << " ms each (" << db.Size() << " keyframes)" << std::endl;
+
+  // An identical BowVector scores 1, and min_score filters out everything else.
+  const std::vector<KeyframeDatabase::Match> exact = db.Query(vocab.Transform(places.at(10)), 5, 0.99f);
+  ASSERT_EQ(1ul, exact.size());
+  EXPECT_EQ(1010ul, exact.front().keyframe_id);
+  EXPECT_NEAR(1.0, exact.front().score, 1e-4);
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "vio/lag_controller.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static LagController::Params MakeParams()
+{
+  LagController::Params params;
+  params.enabled = true;
+  params.target_p95_ms = 100.0;
+  params.min_lag_sec = 2.0;
+  params.max_lag_sec = 30.0;
+  params.window = 5;
+  params.deadband = 0.2;
+  params.grow_factor = 1.1;
+  params.max_shrink = 0.5;
+  return params;
+}
+
+
+TEST(LagControllerTest, Disabled)
+{
+  LagController::Params params = MakeParams();
+  params.enabled = false;
+  LagController controller(params, 50.0);
+
+  // When disabled, the configured lag is used as is (even outside of [min_lag_sec, max_lag_sec]).
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_FALSE(controller.Update(1000.0));
+  }
+  EXPECT_EQ(50.0, controller.Lag());
+}
+
+
+TEST(LagControllerTest, ShrinkWhenOverBudget)
+{
+  LagController controller(MakeParams(), 20.0);
+
+  // Nothing changes until a full window of updates has been seen.
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_FALSE(controller.Update(160.0));
+  }
+  EXPECT_EQ(20.0, controller.Lag());
+
+  // p95 is 1.6x the target, so the lag shrinks by about 1/1.6.
+  EXPECT_TRUE(controller.Update(160.0));
+  EXPECT_NEAR(160.0, controller.LastP95(), 10.0);
+  EXPECT_NEAR(12.5, controller.Lag(), 1.0);
+
+  // A much slower update never shrinks the lag by more than max_shrink at a time.
+  for (int i = 0; i < 5; ++i) { controller.Update(1000.0); }
+  EXPECT_NEAR(0.5 * 12.5, controller.Lag(), 0.5);
+}
+
+
+TEST(LagControllerTest, GrowWhenUnderBudget)
+{
+  LagController controller(MakeParams(), 10.0);
+
+  for (int i = 0; i < 5; ++i) { controller.Update(40.0); }
+  EXPECT_NEAR(11.0, controller.Lag(), 1e-6);
+
+  // Within the deadband, the lag stays put.
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_FALSE(controller.Update(100.0));
+  }
+  EXPECT_NEAR(11.0, controller.Lag(), 1e-6);
+}
+
+
+TEST(LagControllerTest, Clamp)
+{
+  LagController controller(MakeParams(), 100.0);
+  EXPECT_EQ(30.0, controller.Lag());
+
+  for (int i = 0; i < 100; ++i) { controller.Update(1.0); }
+  EXPECT_EQ(30.0, controller.Lag());
+
+  for (int i = 0; i < 100; ++i) { controller.Update(1000.0); }
+  EXPECT_EQ(2.0, controller.Lag());
+}
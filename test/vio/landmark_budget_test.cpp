@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "vio/landmark_budget.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+TEST(LandmarkBudgetTest, TestScore)
+{
+  const LandmarkCandidate short_track(0, 2, 2.0, Vector2d(10, 10));
+  const LandmarkCandidate long_track(1, 10, 2.0, Vector2d(10, 10));
+  const LandmarkCandidate wide_track(2, 2, 40.0, Vector2d(10, 10));
+
+  EXPECT_LT(LandmarkScore(short_track, 10, 20.0), LandmarkScore(long_track, 10, 20.0));
+  EXPECT_LT(LandmarkScore(short_track, 10, 20.0), LandmarkScore(wide_track, 10, 20.0));
+
+  // Both terms saturate at 1.
+  EXPECT_DOUBLE_EQ(1.0, LandmarkScore(LandmarkCandidate(3, 20, 100.0, Vector2d::Zero()), 10, 20.0));
+}
+
+
+TEST(LandmarkBudgetTest, TestBudget)
+{
+  std::vector<LandmarkCandidate> candidates;
+  for (int i = 0; i < 20; ++i) {
+    candidates.emplace_back(i, 2 + i % 5, 1.0 * i, Vector2d(5 * i, 5 * i));
+  }
+
+  const std::vector<bool> selected = SelectLandmarks(candidates, 8, 10, 20.0, 1, 1, 100, 100);
+  ASSERT_EQ(candidates.size(), selected.size());
+  EXPECT_EQ(8, std::count(selected.begin(), selected.end(), true));
+
+  // With a single cell, this is just the top-8 by score.
+  EXPECT_TRUE(selected.at(19));
+  EXPECT_FALSE(selected.at(0));
+
+  // Everything fits inside of a big budget.
+  const std::vector<bool> all = SelectLandmarks(candidates, 100, 10, 20.0, 1, 1, 100, 100);
+  EXPECT_EQ(20, std::count(all.begin(), all.end(), true));
+}
+
+
+TEST(LandmarkBudgetTest, TestCoverage)
+{
+  // Lots of great landmarks in the top-left corner, and a few mediocre ones everywhere else.
+  std::vector<LandmarkCandidate> candidates;
+  for (int i = 0; i < 10; ++i) {
+    candidates.emplace_back(i, 10, 50.0, Vector2d(10, 10));
+  }
+  candidates.emplace_back(10, 2, 1.0, Vector2d(90, 10));
+  candidates.emplace_back(11, 2, 1.0, Vector2d(10, 90));
+  candidates.emplace_back(12, 2, 1.0, Vector2d(90, 90));
+
+  const std::vector<bool> selected = SelectLandmarks(candidates, 8, 10, 20.0, 2, 2, 100, 100);
+  EXPECT_EQ(8, std::count(selected.begin(), selected.end(), true));
+
+  // Every cell should get at least one landmark, even though the corner has better ones.
+  EXPECT_TRUE(selected.at(10));
+  EXPECT_TRUE(selected.at(11));
+  EXPECT_TRUE(selected.at(12));
+}
@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "vio/mission_log.hpp"
+#include "vio/offline_bundle_adjuster.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static MissionKeypose MakeKeypose(seconds_t timestamp, bool with_vo, bool reset = false)
+{
+  MissionKeypose kp;
+  kp.timestamp = timestamp;
+  kp.reset = reset;
+
+  if (with_vo) {
+    VoResult::Ptr vo = std::make_shared<VoResult>(ConvertToNanoseconds(timestamp),
+                                                  ConvertToNanoseconds(timestamp - 0.5), 11, 10);
+    vo->is_keyframe = true;
+    vo->lkf_T_cam.block<3, 1>(0, 3) = Vector3d(0.1, 0.2, 0.3);
+    vo->lmk_obs.emplace_back(7, 11, cv::Point2f(10.5, 20.25), 3.5, 0.0, 0.0);
+    vo->lmk_obs.emplace_back(9, 11, cv::Point2f(100, 200), 12.0, 0.0, 0.0);
+    kp.vo = vo;
+    kp.depth = std::make_shared<DepthMeasurement>(ConvertToNanoseconds(timestamp), 4.5);
+    kp.attitude = std::make_shared<AttitudeMeasurement>(timestamp, Vector3d(0, 1, 0));
+  }
+  kp.ranges.emplace_back(ConvertToNanoseconds(timestamp), 12.0, Vector3d(1, 2, 3));
+
+  kp.online.keypose_id = 3;
+  kp.online.timestamp = timestamp;
+  kp.online.world_P_body = gtsam::Pose3(gtsam::Rot3::Rodrigues(0.1, -0.2, 0.3), gtsam::Point3(1, 2, 3));
+  kp.online.has_imu_state = true;
+  kp.online.world_v_body = Vector3d(0.5, 0, -0.1);
+  kp.online.imu_bias = ImuBias(Vector3d(0.01, 0.02, 0.03), Vector3d(-0.001, 0.002, 0.0));
+  return kp;
+}
+
+
+TEST(MissionLogTest, TestRoundtrip)
+{
+  const std::string path = "/tmp/mission_log_test.bmlog";
+  {
+    MissionLogWriter writer(path);
+    ASSERT_TRUE(writer.Good());
+    writer.WriteImu(ImuMeasurement(1000, Vector3d(0.1, 0, 0), Vector3d(0, 9.81, 0)));
+    writer.WriteImu(ImuMeasurement(1000, Vector3d::Zero(), Vector3d::Zero()));   // Duplicate, skipped.
+    writer.WriteImu(ImuMeasurement(2000, Vector3d(0.2, 0, 0), Vector3d(0, 9.81, 0)));
+    writer.WriteKeypose(MakeKeypose(1.0, false, true));
+    writer.WriteKeypose(MakeKeypose(1.5, true));
+    EXPECT_EQ(2ul, writer.NumKeyposes());
+  }
+
+  MissionLog log;
+  ASSERT_TRUE(ReadMissionLog(path, log));
+  ASSERT_EQ(2ul, log.imu.size());
+  EXPECT_EQ(2000ul, log.imu.at(1).timestamp);
+  EXPECT_EQ(Vector3d(0.2, 0, 0), log.imu.at(1).w);
+
+  ASSERT_EQ(2ul, log.keyposes.size());
+  const MissionKeypose& k0 = log.keyposes.at(0);
+  EXPECT_TRUE(k0.reset);
+  EXPECT_FALSE(k0.vo);
+  EXPECT_FALSE(k0.depth);
+
+  const MissionKeypose& k1 = log.keyposes.at(1);
+  const MissionKeypose expected = MakeKeypose(1.5, true);
+  EXPECT_FALSE(k1.reset);
+  EXPECT_EQ(1.5, k1.timestamp);
+  ASSERT_TRUE(k1.vo);
+  EXPECT_TRUE(k1.vo->is_keyframe);
+  EXPECT_EQ(expected.vo->timestamp_lkf, k1.vo->timestamp_lkf);
+  EXPECT_EQ(11ul, k1.vo->camera_id);
+  EXPECT_EQ(expected.vo->lkf_T_cam, k1.vo->lkf_T_cam);
+  ASSERT_EQ(2ul, k1.vo->lmk_obs.size());
+  EXPECT_EQ(9ul, k1.vo->lmk_obs.at(1).landmark_id);
+  EXPECT_EQ(200.0f, k1.vo->lmk_obs.at(1).pixel_location.y);
+  EXPECT_EQ(12.0, k1.vo->lmk_obs.at(1).disparity);
+  ASSERT_TRUE(k1.depth);
+  EXPECT_EQ(4.5, k1.depth->depth);
+  ASSERT_TRUE(k1.attitude);
+  EXPECT_EQ(Vector3d(0, 1, 0), k1.attitude->body_nG);
+  ASSERT_EQ(1ul, k1.ranges.size());
+  EXPECT_EQ(Vector3d(1, 2, 3), k1.ranges.at(0).point);
+
+  EXPECT_EQ(3ul, k1.online.keypose_id);
+  EXPECT_TRUE(k1.online.world_P_body.equals(expected.online.world_P_body, 1e-12));
+  EXPECT_TRUE(k1.online.has_imu_state);
+  EXPECT_EQ(expected.online.world_v_body, k1.online.world_v_body);
+  EXPECT_TRUE(k1.online.imu_bias.equals(expected.online.imu_bias, 1e-12));
+}
+
+
+TEST(MissionLogTest, TestTruncated)
+{
+  const std::string path = "/tmp/mission_log_test_truncated.bmlog";
+  {
+    MissionLogWriter writer(path);
+    writer.WriteKeypose(MakeKeypose(1.0, true, true));
+    writer.WriteKeypose(MakeKeypose(1.5, true));
+  }
+
+  // Chop off the end of the last keypose, like a run that crashed while writing it.
+  std::ifstream in(path, std::ios::binary);
+  const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size() - 10);
+
+  MissionLog log;
+  ASSERT_TRUE(ReadMissionLog(path, log));
+  EXPECT_EQ(1ul, log.keyposes.size());
+
+  EXPECT_FALSE(ReadMissionLog("/tmp/does_not_exist.bmlog", log));
+}
+
+
+TEST(MissionLogTest, TestSegment)
+{
+  OfflineBundleAdjuster::Params params;
+  params.window_sec = 10.0;
+  params.overlap_sec = 2.0;
+  const OfflineBundleAdjuster adjuster(params, FixedLagSmoother::Params(), ImuManager::Params());
+
+  // A keypose every second for 25 sec, and the smoother was reset at t=20.
+  MissionLog log;
+  for (int i = 0; i < 25; ++i) {
+    log.keyposes.emplace_back(MakeKeypose(i, false, i == 0 || i == 20));
+  }
+
+  const std::vector<OfflineBundleAdjuster::Window> windows = adjuster.Segment(log);
+  ASSERT_EQ(3ul, windows.size());
+
+  // [0, 10] sec, then [9, 19] sec (up to the reset), and then [20, 24] sec.
+  EXPECT_EQ(0ul, windows.at(0).begin);
+  EXPECT_EQ(11ul, windows.at(0).end);
+  EXPECT_EQ(9ul, windows.at(1).begin);
+  EXPECT_EQ(20ul, windows.at(1).end);
+  EXPECT_EQ(20ul, windows.at(2).begin);
+  EXPECT_EQ(25ul, windows.at(2).end);
+}
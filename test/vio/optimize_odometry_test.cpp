@@ -0,0 +1,182 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/eigen_types.hpp"
+#include "core/random.hpp"
+#include "core/transform_util.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vio/optimize_odometry.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Simulate points in front of Camera_0 and their observations in Camera_1. Every "outlier_every"
+// observation is corrupted by a large offset.
+static void SimulateObservations(const PinholeCamera& cam,
+                                 const Matrix4d& T_10,
+                                 int N,
+                                 int outlier_every,
+                                 std::vector<Vector3d>& P0_list,
+                                 std::vector<Vector2d>& p1_obs_list,
+                                 std::vector<bool>& is_outlier)
+{
+  for (int i = 0; i < N; ++i) {
+    const Vector3d P0(RandomUniformd(-3, 3), RandomUniformd(-2, 2), RandomUniformd(4, 10));
+    const Vector3d P1 = T_10.block<3, 3>(0, 0) * P0 + T_10.block<3, 1>(0, 3);
+    Vector2d p1 = cam.Project(P1);
+
+    const bool outlier = (outlier_every > 0) && (i % outlier_every == 0);
+    if (outlier) {
+      p1 += Vector2d(RandomUniformd(40, 80), RandomUniformd(-80, -40));
+    }
+
+    P0_list.emplace_back(P0);
+    p1_obs_list.emplace_back(p1);
+    is_outlier.emplace_back(outlier);
+  }
+}
+
+
+TEST(OptimizeOdometryTest, RansacRejectsOutliers)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_cam(cam, 0.2);
+
+  Vector6d xi;
+  xi << 0.1, -0.05, 0.2, 0.02, -0.03, 0.01;
+  const Matrix4d T_10_true = expmap_se3(xi);
+
+  std::vector<Vector3d> P0_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<bool> is_outlier;
+  SimulateObservations(cam, T_10_true, 60, 3, P0_list, p1_obs_list, is_outlier);
+  const std::vector<double> p1_sigma_list(P0_list.size(), 1.0);
+
+  Matrix4d T_10 = Matrix4d::Identity();
+  std::vector<int> inlier_indices, outlier_indices;
+  RansacOdometry(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, 3.0, 32,
+                 inlier_indices, outlier_indices);
+
+  for (const int i : inlier_indices) { EXPECT_FALSE(is_outlier.at(i)); }
+  for (const int i : outlier_indices) { EXPECT_TRUE(is_outlier.at(i)); }
+  EXPECT_EQ(40ul, inlier_indices.size());
+
+  // LM once on the inliers.
+  Matrix6d C_10;
+  double error = 0;
+  T_10 = Matrix4d::Identity();
+  const int iters = OptimizeOdometryIterative(
+      P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, C_10, error,
+      inlier_indices, outlier_indices, 20, 1e-3, 1e-6, 3.0, 32);
+
+  EXPECT_GE(iters, 0);
+  EXPECT_EQ(40ul, inlier_indices.size());
+  EXPECT_LT((T_10 - T_10_true).norm(), 1e-3);
+}
+
+
+// The inlier subsets can come from a FrameArena, without changing the result.
+TEST(OptimizeOdometryTest, ArenaSameResult)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_cam(cam, 0.2);
+
+  Vector6d xi;
+  xi << 0.05, 0.02, -0.1, 0.01, 0.02, -0.01;
+  const Matrix4d T_10_true = expmap_se3(xi);
+
+  std::vector<Vector3d> P0_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<bool> is_outlier;
+  SimulateObservations(cam, T_10_true, 60, 3, P0_list, p1_obs_list, is_outlier);
+  const std::vector<double> p1_sigma_list(P0_list.size(), 1.0);
+
+  Matrix4d T_10_heap = Matrix4d::Identity();
+  Matrix4d T_10_arena = Matrix4d::Identity();
+  Matrix6d C_10;
+  double error_heap = 0, error_arena = 0;
+  std::vector<int> inliers, outliers;
+
+  OptimizeOdometryIterative(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10_heap, C_10, error_heap,
+                            inliers, outliers, 20, 1e-3, 1e-6, 3.0);
+
+  FrameArena arena;
+  OptimizeOdometryIterative(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10_arena, C_10, error_arena,
+                            inliers, outliers, 20, 1e-3, 1e-6, 3.0, 0, &arena);
+
+  EXPECT_GT(arena.NumAllocations(), 0ul);
+  EXPECT_EQ(1ul, arena.NumHeapAllocations());
+  EXPECT_EQ(error_heap, error_arena);
+  EXPECT_TRUE(T_10_heap.isApprox(T_10_arena, 0));
+}
+
+
+TEST(OptimizeOdometryTest, LinearizeProjection)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_cam(cam, 0.2);
+
+  std::vector<Vector3d> P0_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<bool> is_outlier;
+  SimulateObservations(cam, Matrix4d::Identity(), 30, 0, P0_list, p1_obs_list, is_outlier);
+  const std::vector<double> p1_sigma_list(P0_list.size(), 1.0);
+
+  // At the true pose, the error and gradient are zero.
+  Matrix6d H;
+  Vector6d g;
+  double error = -1;
+  const Matrix4d T_10 = Matrix4d::Identity();
+  LinearizeProjection(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, H, g, error);
+  EXPECT_NEAR(0.0, error, 1e-9);
+  EXPECT_NEAR(0.0, g.norm(), 1e-6);
+}
+
+
+// The float instantiation (for the frontend) should agree with double to within float precision.
+TEST(OptimizeOdometryTest, FloatMatchesDouble)
+{
+  const PinholeCamera cam(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_cam(cam, 0.2);
+  const StereoCameraf stereo_cam_f = stereo_cam.Cast<float>();
+
+  Vector6d xi;
+  xi << 0.05, 0.02, -0.1, 0.01, 0.02, -0.01;
+  const Matrix4d T_10_true = expmap_se3(xi);
+
+  std::vector<Vector3d> P0_list;
+  std::vector<Vector2d> p1_obs_list;
+  std::vector<bool> is_outlier;
+  SimulateObservations(cam, T_10_true, 60, 3, P0_list, p1_obs_list, is_outlier);
+  const std::vector<double> p1_sigma_list(P0_list.size(), 1.0);
+
+  std::vector<Vector3f> P0_list_f;
+  std::vector<Vector2f> p1_obs_list_f;
+  for (size_t i = 0; i < P0_list.size(); ++i) {
+    P0_list_f.emplace_back(P0_list.at(i).cast<float>());
+    p1_obs_list_f.emplace_back(p1_obs_list.at(i).cast<float>());
+  }
+  const std::vector<float> p1_sigma_list_f(P0_list.size(), 1.0f);
+
+  Matrix4d T_10 = Matrix4d::Identity();
+  Matrix6d C_10;
+  double error = 0;
+  std::vector<int> inliers, outliers;
+  OptimizeOdometryIterative(P0_list, p1_obs_list, p1_sigma_list, stereo_cam, T_10, C_10, error,
+                            inliers, outliers, 20, 1e-3, 1e-6, 3.0);
+
+  Matrix4f T_10_f = Matrix4f::Identity();
+  Matrix6f C_10_f;
+  float error_f = 0;
+  std::vector<int> inliers_f, outliers_f;
+  OptimizeOdometryIterative(P0_list_f, p1_obs_list_f, p1_sigma_list_f, stereo_cam_f, T_10_f, C_10_f, error_f,
+                            inliers_f, outliers_f, 20, 1e-3, 1e-6, 3.0);
+
+  EXPECT_EQ(inliers, inliers_f);
+  EXPECT_LT((T_10 - T_10_true).norm(), 1e-3);
+  EXPECT_LT((T_10_f.cast<double>() - T_10).norm(), 1e-3);
+  EXPECT_NEAR(error, error_f, 1e-3);
+}
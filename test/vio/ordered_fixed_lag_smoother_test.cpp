@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/eigen_types.hpp"
+#include "vio/noise_model.hpp"
+#include "vio/ordered_fixed_lag_smoother.hpp"
+
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+
+using namespace bm;
+using namespace vio;
+using namespace core;
+
+
+// Constraining the newest keypose last should only change the elimination order, not the estimate.
+TEST(OrderedFixedLagSmootherTest, TestSameAsIncremental)
+{
+  const double lag_sec = 2.0;
+  gtsam::IncrementalFixedLagSmoother baseline(lag_sec);
+  OrderedFixedLagSmoother ordered(lag_sec, gtsam::ISAM2Params(), true);
+
+  const IsoModel::shared_ptr prior_noise = IsoModel::Sigma(6, 0.1);
+  const IsoModel::shared_ptr odom_noise = IsoModel::Sigma(6, 0.05);
+  const gtsam::Pose3 odom(gtsam::Rot3::Rz(0.1), gtsam::Point3(1, 0, 0));
+
+  gtsam::Pose3 guess = gtsam::Pose3::identity();
+
+  for (int i = 0; i < 20; ++i) {
+    const gtsam::Symbol sym('X', i);
+    const double t = 0.5 * i;
+
+    gtsam::NonlinearFactorGraph new_factors;
+    gtsam::Values new_values;
+    gtsam::IncrementalFixedLagSmoother::KeyTimestampMap new_timestamps;
+
+    if (i == 0) {
+      new_factors.addPrior(sym, gtsam::Pose3::identity(), prior_noise);
+    } else {
+      new_factors.push_back(gtsam::BetweenFactor<gtsam::Pose3>(gtsam::Symbol('X', i - 1), sym, odom, odom_noise));
+      guess = guess * odom * gtsam::Pose3(gtsam::Rot3::Rz(0.01), gtsam::Point3(0.02, 0, 0));
+    }
+    new_values.insert(sym, guess);
+    new_timestamps[sym] = t;
+
+    baseline.update(new_factors, new_values, new_timestamps);
+    ordered.update(new_factors, new_values, new_timestamps);
+
+    const gtsam::Pose3 expected = baseline.calculateEstimate<gtsam::Pose3>(sym);
+    const gtsam::Pose3 actual = ordered.calculateEstimate<gtsam::Pose3>(sym);
+    EXPECT_TRUE(expected.equals(actual, 1e-6)) << "Mismatch at keypose " << i;
+  }
+
+  // Old keyposes should have been marginalized out of both.
+  EXPECT_FALSE(ordered.calculateEstimate().exists(gtsam::Symbol('X', 0)));
+  EXPECT_EQ(baseline.calculateEstimate().size(), ordered.calculateEstimate().size());
+}
+
+
+// The joint marginal from the root clique should match iSAM2's marginal covariance for each key.
+TEST(OrderedFixedLagSmootherTest, TestRootCliqueMarginals)
+{
+  OrderedFixedLagSmoother smoother(2.0, gtsam::ISAM2Params(), true);
+
+  const IsoModel::shared_ptr prior_noise = IsoModel::Sigma(6, 0.1);
+  const IsoModel::shared_ptr odom_noise = IsoModel::Sigma(6, 0.05);
+  const IsoModel::shared_ptr offset_noise = IsoModel::Sigma(6, 0.2);
+  const gtsam::Pose3 odom(gtsam::Rot3::Rz(0.1), gtsam::Point3(1, 0, 0));
+  const gtsam::Pose3 offset(gtsam::Rot3::identity(), gtsam::Point3(0, 0.5, 0));
+
+  gtsam::Pose3 guess = gtsam::Pose3::identity();
+
+  // Two variables per keypose (e.g a body and a sensor pose), tied together by a between factor.
+  for (int i = 0; i < 10; ++i) {
+    const gtsam::Symbol X('X', i);
+    const gtsam::Symbol Y('Y', i);
+    const double t = 0.5 * i;
+
+    gtsam::NonlinearFactorGraph new_factors;
+    gtsam::Values new_values;
+    gtsam::IncrementalFixedLagSmoother::KeyTimestampMap new_timestamps;
+
+    if (i == 0) {
+      new_factors.addPrior(X, gtsam::Pose3::identity(), prior_noise);
+    } else {
+      new_factors.push_back(gtsam::BetweenFactor<gtsam::Pose3>(gtsam::Symbol('X', i - 1), X, odom, odom_noise));
+      new_factors.push_back(gtsam::BetweenFactor<gtsam::Pose3>(gtsam::Symbol('Y', i - 1), Y, odom, odom_noise));
+      guess = guess * odom;
+    }
+    new_factors.push_back(gtsam::BetweenFactor<gtsam::Pose3>(X, Y, offset, offset_noise));
+    new_values.insert(X, guess);
+    new_values.insert(Y, guess * offset);
+    new_timestamps[X] = t;
+    new_timestamps[Y] = t;
+
+    smoother.update(new_factors, new_values, new_timestamps);
+
+    std::vector<gtsam::Matrix> marginals;
+    ASSERT_TRUE(smoother.RootCliqueMarginals({ X, Y }, marginals)) << "Newest keys aren't at the root " << i;
+    ASSERT_EQ(2ul, marginals.size());
+    EXPECT_TRUE(gtsam::assert_equal(smoother.marginalCovariance(X), marginals.at(0), 1e-8));
+    EXPECT_TRUE(gtsam::assert_equal(smoother.marginalCovariance(Y), marginals.at(1), 1e-8));
+  }
+
+  // The first keypose isn't in the graph anymore.
+  std::vector<gtsam::Matrix> marginals;
+  EXPECT_FALSE(smoother.RootCliqueMarginals({ gtsam::Symbol('X', 0) }, marginals));
+}
@@ -0,0 +1,125 @@
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vio/pose_history.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Rotating about z at 0.1 rad/s, and moving along x at 1 m/s.
+static PoseStamped TruePose(seconds_t t)
+{
+  return PoseStamped(t, Quaterniond(AngleAxisd(0.1 * t, Vector3d::UnitZ())), Vector3d(t, 0, 0));
+}
+
+
+TEST(PoseHistoryTest, TestInterpolate)
+{
+  PoseRing ring(4);
+  PoseStamped pose;
+  EXPECT_FALSE(ring.Lookup(1.0, pose));
+
+  for (int i = 0; i < 6; ++i) {
+    ring.Add(TruePose(i));
+  }
+
+  // Wrapped around, so only [2, 5] are left.
+  EXPECT_EQ(4ul, ring.Size());
+  seconds_t oldest, newest;
+  ASSERT_TRUE(ring.TimeRange(oldest, newest));
+  EXPECT_EQ(2.0, oldest);
+  EXPECT_EQ(5.0, newest);
+
+  EXPECT_FALSE(ring.Lookup(1.9, pose));
+  EXPECT_FALSE(ring.Lookup(5.1, pose));
+
+  // Exact and interpolated poses.
+  ASSERT_TRUE(ring.Lookup(3.0, pose));
+  EXPECT_LT((pose.world_T_body() - TruePose(3.0).world_T_body()).norm(), 1e-9);
+  ASSERT_TRUE(ring.Lookup(4.25, pose));
+  EXPECT_EQ(4.25, pose.timestamp);
+  EXPECT_LT((pose.world_T_body() - TruePose(4.25).world_T_body()).norm(), 1e-9);
+
+  // Adding an older pose replaces everything after it.
+  ring.Add(TruePose(3.5));
+  ASSERT_TRUE(ring.TimeRange(oldest, newest));
+  EXPECT_EQ(3.5, newest);
+  EXPECT_EQ(3ul, ring.Size());
+}
+
+
+TEST(PoseHistoryTest, TestRevise)
+{
+  PoseHistory history(8, 8);
+  for (int i = 0; i < 4; ++i) {
+    history.AddSmoother(TruePose(i));
+  }
+
+  const uint64_t version = history.Ring(PoseHistory::Source::SMOOTHER).Version();
+
+  // The smoother moves two keyposes (and one of them is gone already).
+  std::vector<PoseStamped> revised;
+  revised.emplace_back(1.0, Quaterniond::Identity(), Vector3d(1, 1, 0));
+  revised.emplace_back(2.0, Quaterniond::Identity(), Vector3d(2, 1, 0));
+  revised.emplace_back(7.0, Quaterniond::Identity(), Vector3d(7, 1, 0));
+  EXPECT_EQ(2ul, history.ReviseSmoother(revised));
+  EXPECT_GT(history.Ring(PoseHistory::Source::SMOOTHER).Version(), version);
+  EXPECT_EQ(4ul, history.Ring(PoseHistory::Source::SMOOTHER).Size());
+
+  PoseStamped pose;
+  ASSERT_TRUE(history.Lookup(1.5, pose));
+  EXPECT_LT((pose.world_t_body - Vector3d(1.5, 1, 0)).norm(), 1e-9);
+
+  // After the newest keypose, the filter has the pose.
+  history.AddFilter(TruePose(3.0));
+  history.AddFilter(TruePose(4.0));
+  PoseHistory::Source source;
+  ASSERT_TRUE(history.Lookup(3.5, pose, &source));
+  EXPECT_EQ(PoseHistory::Source::FILTER, source);
+  ASSERT_TRUE(history.Lookup(2.5, pose, &source));
+  EXPECT_EQ(PoseHistory::Source::SMOOTHER, source);
+  EXPECT_FALSE(history.Lookup(4.5, pose));
+}
+
+
+TEST(PoseHistoryTest, TestConcurrentReaders)
+{
+  PoseRing ring(64);
+  ring.Add(TruePose(0));
+
+  std::atomic_bool done{false};
+  std::atomic<int> num_bad{0};
+
+  // Readers should only ever see poses on the true trajectory, even while the writer wraps around.
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 3; ++r) {
+    readers.emplace_back([&]()
+    {
+      PoseStamped pose;
+      while (!done) {
+        seconds_t oldest, newest;
+        if (!ring.TimeRange(oldest, newest)) {
+          continue;
+        }
+        const seconds_t t = 0.5 * (oldest + newest) + 0.25;
+        if (ring.Lookup(t, pose) && (pose.world_t_body - TruePose(t).world_t_body).norm() > 1e-6) {
+          ++num_bad;
+        }
+      }
+    });
+  }
+
+  for (int i = 1; i < 200000; ++i) {
+    ring.Add(TruePose(0.5 * i));
+  }
+  done = true;
+  for (std::thread& t : readers) {
+    t.join();
+  }
+  EXPECT_EQ(0, num_bad.load());
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include "vio/ring_history.hpp"
+
+using namespace bm;
+using namespace vio;
+
+
+TEST(RingHistoryTest, TestUpdateAndDiscard)
+{
+  RingHistory<double, int> h(4);
+  EXPECT_TRUE(h.Empty());
+
+  for (int i = 0; i < 3; ++i) {
+    h.Update(0.1 * i, i);
+  }
+  EXPECT_EQ(3ul, h.Size());
+  EXPECT_DOUBLE_EQ(0.0, h.OldestKey());
+  EXPECT_DOUBLE_EQ(0.2, h.NewestKey());
+
+  // Discard before (but not equal to) a key.
+  h.DiscardBefore(0.1);
+  EXPECT_EQ(2ul, h.Size());
+  EXPECT_EQ(1, h.ItemAt(0));
+
+  // Fill past the capacity and wrap around: the oldest items get dropped.
+  for (int i = 3; i < 8; ++i) {
+    h.Update(0.1 * i, i);
+  }
+  EXPECT_EQ(4ul, h.Size());
+  for (size_t i = 0; i < h.Size(); ++i) {
+    EXPECT_EQ(4 + static_cast<int>(i), h.ItemAt(i));
+  }
+}
+
+
+TEST(RingHistoryTest, TestLowerBound)
+{
+  RingHistory<double, int> h(8);
+  EXPECT_EQ(0ul, h.LowerBound(1.0));
+
+  for (int i = 0; i < 11; ++i) {
+    h.Update(static_cast<double>(i), i);
+  }
+
+  // Holds keys 3 through 10 (wrapped around).
+  EXPECT_EQ(0ul, h.LowerBound(-1.0));
+  EXPECT_EQ(0ul, h.LowerBound(3.0));
+  EXPECT_EQ(1ul, h.LowerBound(3.5));
+  EXPECT_EQ(7ul, h.LowerBound(10.0));
+  EXPECT_EQ(8ul, h.LowerBound(10.5));
+}
+
+
+// Updating at an old key replaces it and everything after it (i.e rewind and replay).
+TEST(RingHistoryTest, TestRewindOverwrite)
+{
+  RingHistory<double, int> h(8);
+  for (int i = 0; i < 6; ++i) {
+    h.Update(static_cast<double>(i), i);
+  }
+
+  h.Update(2.0, 20);
+  EXPECT_EQ(3ul, h.Size());
+  EXPECT_EQ(20, h.ItemAt(2));
+
+  h.Update(3.0, 30);
+  h.Update(4.0, 40);
+  EXPECT_EQ(5ul, h.Size());
+  EXPECT_EQ(40, h.ItemAt(4));
+
+  // Same key as the newest overwrites it.
+  h.Update(4.0, 41);
+  EXPECT_EQ(5ul, h.Size());
+  EXPECT_EQ(41, h.ItemAt(4));
+
+  h.TruncateFrom(1);
+  EXPECT_EQ(1ul, h.Size());
+  EXPECT_DOUBLE_EQ(0.0, h.NewestKey());
+}
@@ -0,0 +1,134 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include <gtest/gtest.h>
+
+#include "vio/state_checkpoint.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static StateCheckpoint MakeCheckpoint(uid_t keypose_id)
+{
+  Matrix6d cov_pose = 0.01 * Matrix6d::Identity();
+  cov_pose(4, 1) = cov_pose(1, 4) = 0.002;
+
+  StateCheckpoint c;
+  c.smoother = SmootherResult(
+      keypose_id, 12.5,
+      gtsam::Pose3(gtsam::Rot3::Rodrigues(0.1, -0.2, 0.3), gtsam::Point3(1, 2, 3)),
+      true,
+      Vector3d(0.5, 0, -0.1),
+      ImuBias(Vector3d(0.01, 0.02, 0.03), Vector3d(-0.001, 0.002, 0.0)),
+      cov_pose,
+      0.1 * Matrix3d::Identity(),
+      1e-4 * Matrix6d::Identity());
+
+  c.has_filter_state = true;
+  c.filter_state = StateStamped(12.6, State(
+      Vector3d(1, 2, 3.1), Vector3d(0.5, 0, 0), Vector3d(0, 0.1, 0),
+      Quaterniond(0.9, 0.1, 0.2, 0.3).normalized(), Vector3d(0, 0, 0.2),
+      0.2 * StateCovariance::Identity()));
+
+  c.landmarks.emplace_back(7, 40, cv::Point2f(10.5, 20.25), 3.5, 0.0, 0.0);
+  c.landmarks.emplace_back(9, 40, cv::Point2f(100, 200), 12.0, 0.0, 0.0);
+  return c;
+}
+
+
+TEST(StateCheckpointTest, TestRoundtrip)
+{
+  const std::string path = "/tmp/state_checkpoint_test.ckpt";
+  const StateCheckpoint c = MakeCheckpoint(123);
+  ASSERT_TRUE(WriteCheckpoint(path, c));
+
+  StateCheckpoint r;
+  ASSERT_TRUE(ReadCheckpoint(path, r));
+
+  EXPECT_EQ(123ul, r.smoother.keypose_id);
+  EXPECT_EQ(12.5, r.smoother.timestamp);
+  EXPECT_TRUE(r.smoother.world_P_body.equals(c.smoother.world_P_body, 1e-12));
+  EXPECT_TRUE(r.smoother.has_imu_state);
+  EXPECT_EQ(c.smoother.world_v_body, r.smoother.world_v_body);
+  EXPECT_TRUE(r.smoother.imu_bias.equals(c.smoother.imu_bias, 1e-12));
+  EXPECT_EQ(c.smoother.cov_pose, r.smoother.cov_pose);
+  EXPECT_EQ(c.smoother.cov_vel, r.smoother.cov_vel);
+  EXPECT_EQ(c.smoother.cov_bias, r.smoother.cov_bias);
+
+  ASSERT_TRUE(r.has_filter_state);
+  EXPECT_EQ(12.6, r.filter_state.timestamp);
+  EXPECT_EQ(c.filter_state.state.t, r.filter_state.state.t);
+  EXPECT_EQ(c.filter_state.state.v, r.filter_state.state.v);
+  EXPECT_NEAR(0, c.filter_state.state.q.angularDistance(r.filter_state.state.q), 1e-12);
+  EXPECT_EQ(c.filter_state.state.S, r.filter_state.state.S);
+
+  ASSERT_EQ(2ul, r.landmarks.size());
+  EXPECT_EQ(9ul, r.landmarks.at(1).landmark_id);
+  EXPECT_EQ(40ul, r.landmarks.at(1).camera_id);
+  EXPECT_EQ(cv::Point2f(10.5, 20.25), r.landmarks.at(0).pixel_location);
+  EXPECT_EQ(12.0, r.landmarks.at(1).disparity);
+
+  std::remove(path.c_str());
+}
+
+
+TEST(StateCheckpointTest, TestBadFile)
+{
+  const std::string path = "/tmp/state_checkpoint_test_bad.ckpt";
+  StateCheckpoint r;
+  std::remove(path.c_str());
+  EXPECT_FALSE(ReadCheckpoint(path, r));
+
+  // Not a checkpoint.
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << "this is not a checkpoint file at all";
+  }
+  EXPECT_FALSE(ReadCheckpoint(path, r));
+
+  // Truncated (e.g the disk filled up).
+  ASSERT_TRUE(WriteCheckpoint(path, MakeCheckpoint(1)));
+  std::string bytes;
+  {
+    std::ifstream in(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size() - 8);
+  }
+  EXPECT_FALSE(ReadCheckpoint(path, r));
+
+  std::remove(path.c_str());
+}
+
+
+TEST(StateCheckpointTest, TestWriter)
+{
+  const std::string path = "/tmp/state_checkpoint_test_writer.ckpt";
+  std::remove(path.c_str());
+
+  {
+    // A long interval, so only the first checkpoint is written until the writer is destroyed.
+    CheckpointWriter writer(path, 100.0);
+    writer.Submit(MakeCheckpoint(1));
+    for (int i = 0; i < 200 && writer.NumWritten() == 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(1, writer.NumWritten());
+
+    for (uid_t id = 2; id <= 5; ++id) {
+      writer.Submit(MakeCheckpoint(id));
+    }
+  }
+
+  // The destructor writes the newest one.
+  StateCheckpoint r;
+  ASSERT_TRUE(ReadCheckpoint(path, r));
+  EXPECT_EQ(5ul, r.smoother.keypose_id);
+
+  std::remove(path.c_str());
+}
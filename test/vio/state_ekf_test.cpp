@@ -51,6 +51,38 @@ TEST(VioTest, TestState)
 }
 
 
+// Ranges from several beacons at once, with one outlier that should be gated out.
+TEST(StateEkfTest, TestBatchRangeUpdate)
+{
+  StateEkf::Params params;
+  params.mahalanobis_gate_chi2 = 9.0;
+  StateEkf ekf(params);
+
+  const State s0(Vector3d(1, 2, 3), Vector3d::Zero(), Vector3d::Zero(),
+                 Quaterniond::Identity(), Vector3d::Zero(),
+                 0.1 * Matrix15d::Identity());
+  ekf.Initialize(StateStamped(0, s0), ImuBias());
+
+  const Vector3d t_true(1.2, 2.0, 3.1);
+  const std::vector<Vector3d> beacons = {
+    Vector3d(10, 0, 0), Vector3d(0, 10, 0), Vector3d(0, 0, 10), Vector3d(-10, -10, 0)
+  };
+
+  MeasurementBatch batch(0.1);
+  for (const Vector3d& point : beacons) {
+    batch.AddRange((t_true - point).norm(), point, 0.05);
+  }
+  batch.AddRange((t_true - beacons.front()).norm() + 50.0, beacons.front(), 0.05);
+
+  int num_rejected = 0;
+  const StateStamped s1 = ekf.PredictAndUpdate(batch, &num_rejected);
+
+  EXPECT_EQ(1, num_rejected);
+  EXPECT_DOUBLE_EQ(0.1, s1.timestamp);
+  EXPECT_LT((s1.state.t - t_true).norm(), (s0.t - t_true).norm());
+}
+
+
 // TEST(VioTest, TestEkf_01)
 // {
 //   StateEkf::Params params;
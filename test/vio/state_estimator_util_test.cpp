@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "vio/state_estimator_util.hpp"
+#include "vio/stereo_frontend.hpp"
+
+using namespace bm;
+using namespace vio;
+using namespace core;
+
+
+static Matrix4d MakeTransform(const Matrix3d& R, const Vector3d& t)
+{
+  Matrix4d T = Matrix4d::Identity();
+  T.block<3, 3>(0, 0) = R;
+  T.block<3, 1>(0, 3) = t;
+  return T;
+}
+
+
+TEST(StateEstimatorUtilTest, TestVoResultsChain)
+{
+  const VoResult older(200, 100, 2, 1);
+
+  EXPECT_TRUE(VoResultsChain(older, VoResult(300, 200, 3, 2)));
+
+  // The newer result has to start from the older result's image, on the same rig.
+  EXPECT_FALSE(VoResultsChain(older, VoResult(300, 199, 3, 2)));
+  EXPECT_FALSE(VoResultsChain(older, VoResult(300, 200, 3, 1)));
+  EXPECT_FALSE(VoResultsChain(older, VoResult(300, 100, 3, 1)));
+
+  VoResult other_rig(300, 200, 3, 2);
+  other_rig.rig = 1;
+  EXPECT_FALSE(VoResultsChain(older, other_rig));
+
+  // Order matters.
+  EXPECT_FALSE(VoResultsChain(VoResult(300, 200, 3, 2), older));
+}
+
+
+TEST(StateEstimatorUtilTest, TestMergeVoResults)
+{
+  VoResult older(200, 100, 2, 1);
+  older.status = StereoFrontend::Status::FEW_TRACKED_FEATURES;
+  older.lmk_obs.emplace_back(7, 2, cv::Point2f(10, 20), 5.0, 1.0, 1.0);
+  older.lkf_T_cam = MakeTransform(Eigen::AngleAxisd(M_PI / 2, Vector3d::UnitZ()).toRotationMatrix(),
+                                  Vector3d(1, 0, 0));
+  older.avg_reprojection_err = 0.5;
+
+  VoResult newer(300, 200, 3, 2);
+  newer.status = StereoFrontend::Status::ODOM_ESTIMATION_FAILED;
+  newer.lmk_obs.emplace_back(8, 3, cv::Point2f(30, 40), 6.0, 1.0, 1.0);
+  newer.lmk_obs.emplace_back(9, 3, cv::Point2f(50, 60), 7.0, 1.0, 1.0);
+  newer.lkf_T_cam = MakeTransform(Matrix3d::Identity(), Vector3d(2, 0, 0));
+  newer.avg_reprojection_err = 0.25;
+
+  const Matrix4d expected_T = older.lkf_T_cam * newer.lkf_T_cam;
+
+  MergeVoResults(older, std::move(newer));
+
+  // Goes from the older result's keyframe to the newer result's image.
+  EXPECT_EQ(300ul, older.timestamp);
+  EXPECT_EQ(100ul, older.timestamp_lkf);
+  EXPECT_EQ(3ul, older.camera_id);
+  EXPECT_EQ(1ul, older.camera_id_lkf);
+
+  // Moving 2m along x in the rotated frame ends up 2m along y.
+  EXPECT_TRUE(older.lkf_T_cam.isApprox(expected_T));
+  EXPECT_TRUE(older.lkf_T_cam.block<3, 1>(0, 3).isApprox(Vector3d(1, 2, 0)));
+
+  // Flags from either result are kept.
+  EXPECT_EQ(StereoFrontend::Status::FEW_TRACKED_FEATURES | StereoFrontend::Status::ODOM_ESTIMATION_FAILED,
+            older.status);
+
+  // Only the newer result's observations are kept.
+  ASSERT_EQ(2ul, older.lmk_obs.size());
+  EXPECT_EQ(8ul, older.lmk_obs.at(0).landmark_id);
+  EXPECT_EQ(9ul, older.lmk_obs.at(1).landmark_id);
+  EXPECT_EQ(0.25, older.avg_reprojection_err);
+}
+
+
+// Merging repeatedly should compose all of the motions, so that a result can chain onto the merge.
+TEST(StateEstimatorUtilTest, TestMergeChain)
+{
+  const Matrix4d step = MakeTransform(Eigen::AngleAxisd(0.1, Vector3d::UnitY()).toRotationMatrix(),
+                                      Vector3d(0.5, 0, 0.1));
+
+  VoResult merged(100, 0, 1, 0);
+  merged.lkf_T_cam = step;
+
+  Matrix4d expected_T = step;
+  for (uid_t i = 2; i < 6; ++i) {
+    VoResult next(100 * i, 100 * (i - 1), i, i - 1);
+    next.lkf_T_cam = step;
+    next.status = (i == 3) ? StereoFrontend::Status::FEW_DETECTED_FEATURES : 0;
+    ASSERT_TRUE(VoResultsChain(merged, next));
+    MergeVoResults(merged, std::move(next));
+    expected_T = expected_T * step;
+  }
+
+  EXPECT_EQ(500ul, merged.timestamp);
+  EXPECT_EQ(0ul, merged.timestamp_lkf);
+  EXPECT_EQ(StereoFrontend::Status::FEW_DETECTED_FEATURES, merged.status);
+  EXPECT_TRUE(merged.lkf_T_cam.isApprox(expected_T));
+
+  EXPECT_TRUE(VoResultsChain(merged, VoResult(600, 500, 6, 5)));
+  EXPECT_FALSE(VoResultsChain(merged, VoResult(600, 400, 6, 4)));
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "AprilTags/Tag36h11.h"
+
+#include "core/eigen_types.hpp"
+#include "vio/tag_localizer.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+// Renders a 36h11 tag facing the camera (tag_size meters wide, "depth" meters away, centered on
+// the optical axis). The tag is 8x8 cells with the black border, plus a 1 cell white border.
+static Image1b RenderTag(const PinholeCamera& cam, int id, double tag_size, double depth)
+{
+  Image1b image(cam.Height(), cam.Width(), static_cast<uchar>(100));
+  const unsigned long long code = AprilTags::tagCodes36h11.codes.at(id);
+  const double cell = tag_size / 8.0;
+
+  for (int v = 0; v < image.rows; ++v) {
+    for (int u = 0; u < image.cols; ++u) {
+      const double x = depth * (u + 0.5 - cam.cx()) / cam.fx() / cell + 5;
+      const double y = depth * (v + 0.5 - cam.cy()) / cam.fy() / cell + 5;
+      const int ix = static_cast<int>(std::floor(x));
+      const int iy = static_cast<int>(std::floor(y));
+      if (ix < 0 || ix >= 10 || iy < 0 || iy >= 10) {
+        continue;
+      }
+      uchar value = 255;
+      if (ix >= 1 && ix <= 8 && iy >= 1 && iy <= 8) {
+        if (ix == 1 || ix == 8 || iy == 1 || iy == 8) {
+          value = 0;
+        } else {
+          const int bit = 35 - ((iy - 2) * 6 + (ix - 2));
+          value = ((code >> bit) & 1) ? 255 : 0;
+        }
+      }
+      image(v, u) = value;
+    }
+  }
+
+  return image;
+}
+
+
+static TagLocalizer::Params MakeParams()
+{
+  TagLocalizer::Params params;
+  params.tag_family = "36h11";
+  params.tag_size = 0.2;
+  params.decimate = 2;
+  params.num_threads = 2;
+
+  Matrix4d world_T_tag = Matrix4d::Identity();
+  world_T_tag.block<3, 1>(0, 3) = Vector3d(1, 2, 3);
+  params.world_T_tag[7] = world_T_tag;
+  return params;
+}
+
+
+TEST(TagLocalizerTest, TestLocalize)
+{
+  const PinholeCamera cam(400, 400, 320, 240, 480, 640);
+  const TagLocalizer::Params params = MakeParams();
+  TagLocalizer localizer(params, cam);
+
+  const Image1b image = RenderTag(cam, 7, params.tag_size, 1.0);
+  const std::vector<PoseMeasurement> poses = localizer.Localize(123, image);
+  ASSERT_EQ(1ul, poses.size());
+
+  const PoseMeasurement& pose = poses.at(0);
+  EXPECT_EQ(123ul, pose.timestamp);
+
+  // The camera (which is the body here) is 1m away from the tag, along its normal.
+  const Vector3d tag_t_body = pose.world_T_body.block<3, 1>(0, 3) - Vector3d(1, 2, 3);
+  EXPECT_NEAR(1.0, tag_t_body.norm(), 0.02);
+  EXPECT_NEAR(0.0, tag_t_body.x(), 0.02);
+  EXPECT_NEAR(0.0, tag_t_body.y(), 0.02);
+
+  // Sigmas don't grow until the tag is more than 1m away.
+  EXPECT_NEAR(params.sigma_rotation, pose.sigmas(0), 0.01);
+  EXPECT_NEAR(params.sigma_translation, pose.sigmas(3), 0.01);
+}
+
+
+TEST(TagLocalizerTest, TestUnknownTag)
+{
+  const PinholeCamera cam(400, 400, 320, 240, 480, 640);
+  const TagLocalizer::Params params = MakeParams();
+  TagLocalizer localizer(params, cam);
+
+  const Image1b image = RenderTag(cam, 8, params.tag_size, 1.0);
+  EXPECT_TRUE(localizer.Localize(0, image).empty());
+}
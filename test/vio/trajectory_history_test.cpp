@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include "vio/trajectory_history.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+TEST(TrajectoryHistoryTest, TestKeepsRecentAndFirst)
+{
+  TrajectoryHistory h(10, 50);
+
+  for (core::uid_t i = 0; i < 1000; ++i) {
+    h.Add(i, Vector3d(i, 0, 0));
+    ASSERT_LE(h.Size(), 50ul);
+  }
+
+  // The first point and the last full_detail are always there, in order.
+  const std::vector<TrajectoryHistory::IdAndPosition>& points = h.Points();
+  EXPECT_EQ(0ul, points.front().first);
+  for (size_t k = 0; k < 10; ++k) {
+    EXPECT_EQ(990ul + k, points.at(points.size() - 10 + k).first);
+  }
+  for (size_t k = 1; k < points.size(); ++k) {
+    EXPECT_LT(points.at(k - 1).first, points.at(k).first);
+  }
+
+  // Older parts are sparser than newer ones.
+  EXPECT_GT(points.at(2).first - points.at(1).first, points.at(points.size() - 12).first - points.at(points.size() - 13).first);
+}
+
+
+TEST(TrajectoryHistoryTest, TestUpdate)
+{
+  TrajectoryHistory h(4, 8);
+  for (core::uid_t i = 0; i < 20; ++i) {
+    h.Add(i, Vector3d::Zero());
+  }
+
+  EXPECT_TRUE(h.Update(19, Vector3d(1, 2, 3)));
+  EXPECT_EQ(Vector3d(1, 2, 3), h.Points().back().second);
+  EXPECT_TRUE(h.Update(0, Vector3d(4, 5, 6)));
+  EXPECT_EQ(Vector3d(4, 5, 6), h.Points().front().second);
+
+  // Odd points get decimated first.
+  EXPECT_FALSE(h.Update(1, Vector3d(1, 1, 1)));
+  EXPECT_FALSE(h.Update(100, Vector3d(1, 1, 1)));
+}
+
+
+TEST(TrajectoryHistoryTest, TestShrink)
+{
+  TrajectoryHistory h(10, 1000);
+  for (core::uid_t i = 0; i < 1000; ++i) {
+    h.Add(i, Vector3d(i, 0, 0));
+  }
+  EXPECT_EQ(1000ul, h.Size());
+  const size_t bytes = h.MemoryBytes();
+
+  h.SetMaxPoints(100);
+  EXPECT_LE(h.Size(), 100ul);
+  EXPECT_EQ(0ul, h.Points().front().first);
+  EXPECT_EQ(999ul, h.Points().back().first);
+  EXPECT_LT(h.MemoryBytes(), bytes / 5);
+}
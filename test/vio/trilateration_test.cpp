@@ -66,3 +66,121 @@ TEST(Trilateration, Noisy)
   std::cout << "Optimized world_t_body: " << world_t_body.transpose() << std::endl;
   std::cout << "Solution covariance:\n" << solution_cov << std::endl;
 }
+
+
+static MultiRange SimulateRanges(const std::vector<Vector3d>& beacons,
+                                 const Vector3d& world_t_body,
+                                 const std::vector<double>& noise)
+{
+  MultiRange ranges;
+  for (size_t i = 0; i < beacons.size(); ++i) {
+    ranges.emplace_back(RangeMeasurement(0, (world_t_body - beacons[i]).norm() + noise[i], beacons[i]));
+  }
+  return ranges;
+}
+
+
+TEST(Trilateration, Linear)
+{
+  // Beacons that aren't coplanar: the closed-form solution is exact for perfect ranges.
+  const std::vector<Vector3d> beacons = { Vector3d(5, 0, 0), Vector3d(-5, 0, 0), Vector3d(0, 0, 5), Vector3d(0, -8, 1) };
+  const Vector3d world_t_body(17, -23, 4);
+  const std::vector<double> sigmas(4, 0.2);
+
+  Vector3d world_t_body_est = Vector3d::Zero();
+  EXPECT_TRUE(TrilaterateLinear(SimulateRanges(beacons, world_t_body, std::vector<double>(4, 0)), sigmas, world_t_body_est));
+  EXPECT_LT((world_t_body_est - world_t_body).norm(), 1e-6);
+
+  // Beacons on the y=0 plane: the guess picks the side of the plane.
+  const std::vector<Vector3d> surface = { Vector3d(5, 0, 0), Vector3d(-5, 0, 0), Vector3d(0, 0, 5) };
+  const MultiRange ranges = SimulateRanges(surface, world_t_body, std::vector<double>(3, 0));
+
+  world_t_body_est = Vector3d(0, -1, 0);
+  EXPECT_TRUE(TrilaterateLinear(ranges, std::vector<double>(3, 0.2), world_t_body_est));
+  EXPECT_LT((world_t_body_est - world_t_body).norm(), 1e-6);
+
+  world_t_body_est = Vector3d(0, 1, 0);
+  EXPECT_TRUE(TrilaterateLinear(ranges, std::vector<double>(3, 0.2), world_t_body_est));
+  EXPECT_LT((world_t_body_est - Vector3d(17, 23, 4)).norm(), 1e-6);
+
+  // Collinear beacons don't constrain the position.
+  const std::vector<Vector3d> line = { Vector3d(5, 0, 0), Vector3d(-5, 0, 0), Vector3d(1, 0, 0) };
+  EXPECT_FALSE(TrilaterateLinear(SimulateRanges(line, world_t_body, std::vector<double>(3, 0)), std::vector<double>(3, 0.2), world_t_body_est));
+}
+
+
+TEST(Trilateration, SolverWarmStart)
+{
+  const std::vector<Vector3d> beacons = { Vector3d(4, 0, 0), Vector3d(-4, 0, 0), Vector3d(0, 0, 4), Vector3d(0, 0, -4) };
+  const std::vector<double> sigmas(4, 0.5);
+
+  TrilaterationSolver::Params params;
+  TrilaterationSolver solver(params);
+
+  // The vehicle moves slowly below the surface. After the first solve, each one is warm-started.
+  for (int t = 0; t < 20; ++t) {
+    const Vector3d world_t_body(17 - 0.2*t, -15, 4 + 0.1*t);
+    const MultiRange ranges = SimulateRanges(beacons, world_t_body, { 0.3, -0.1, -0.2, 0.1 });
+    const TrilaterationResult result = solver.Solve(ranges, sigmas, Vector3d(0, -1, 0));
+
+    ASSERT_TRUE(result.valid);
+    EXPECT_LT((result.world_t_body - world_t_body).norm(), 3.0);
+    EXPECT_TRUE(solver.HasSolution());
+    EXPECT_NEAR(0, (solver.LastSolution() - result.world_t_body).norm(), 1e-12);
+
+    // Shouldn't take any longer than solving from scratch.
+    TrilaterationSolver cold(params);
+    EXPECT_LE(result.iters, cold.Solve(ranges, sigmas, Vector3d(0, -1, 0)).iters);
+  }
+}
+
+
+TEST(Trilateration, SolverRobust)
+{
+  const std::vector<Vector3d> beacons = { Vector3d(10, 0, 0), Vector3d(-10, 0, 0), Vector3d(0, 0, 10),
+                                          Vector3d(0, 0, -10), Vector3d(7, 0, 7) };
+  const std::vector<double> sigmas(5, 0.2);
+  const Vector3d world_t_body(3, -12, 2);
+
+  // One of the ranges is a multipath outlier (5m too long).
+  const MultiRange ranges = SimulateRanges(beacons, world_t_body, { 0, 0, 0, 0, 5.0 });
+
+  TrilaterationSolver::Params params;
+  TrilaterationSolver robust(params);
+  const TrilaterationResult r_robust = robust.Solve(ranges, sigmas, Vector3d(0, -1, 0));
+
+  params.huber_threshold = 1e6;
+  TrilaterationSolver least_squares(params);
+  const TrilaterationResult r_ls = least_squares.Solve(ranges, sigmas, Vector3d(0, -1, 0));
+
+  ASSERT_TRUE(r_robust.valid);
+  ASSERT_TRUE(r_ls.valid);
+  EXPECT_LT((r_robust.world_t_body - world_t_body).norm(), (r_ls.world_t_body - world_t_body).norm());
+}
+
+
+TEST(Trilateration, Batched)
+{
+  const std::vector<Vector3d> beacons = { Vector3d(4, 0, 0), Vector3d(-4, 0, 0), Vector3d(0, 0, 4) };
+
+  std::vector<MultiRange> range_sets;
+  std::vector<Vector3d> truth;
+  for (int t = 0; t < 200; ++t) {
+    truth.emplace_back(10 * std::cos(0.01*t), -10 - 0.01*t, 10 * std::sin(0.01*t));
+    range_sets.emplace_back(SimulateRanges(beacons, truth.back(), std::vector<double>(3, 0)));
+  }
+  const std::vector<std::vector<double>> sigmas(range_sets.size(), std::vector<double>(3, 0.2));
+
+  TrilaterationSolver::Params params;
+  const std::vector<TrilaterationResult> serial = TrilateratePositions(range_sets, sigmas, params, 1, Vector3d(0, -1, 0));
+  const std::vector<TrilaterationResult> parallel = TrilateratePositions(range_sets, sigmas, params, 4, Vector3d(0, -1, 0));
+
+  ASSERT_EQ(range_sets.size(), serial.size());
+  ASSERT_EQ(range_sets.size(), parallel.size());
+  for (size_t i = 0; i < range_sets.size(); ++i) {
+    ASSERT_TRUE(serial[i].valid);
+    ASSERT_TRUE(parallel[i].valid);
+    EXPECT_LT((serial[i].world_t_body - truth[i]).norm(), 1e-3);
+    EXPECT_LT((parallel[i].world_t_body - truth[i]).norm(), 1e-3);
+  }
+}
@@ -0,0 +1,114 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include "core/eigen_types.hpp"
+#include "core/timestamp.hpp"
+#include "vio/imu_manager.hpp"
+#include "vio/vi_initializer.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace vio;
+
+
+static const Vector3d kGravity(0, 9.81, 0);
+static const Vector3d kOmega(0.1, -0.3, 0.2);     // Body frame, constant.
+static const Matrix3d kR0 = AngleAxisd(0.3, Vector3d(1, 0, 1).normalized()).toRotationMatrix();
+
+
+// A smooth trajectory with a constant angular velocity.
+static gtsam::Pose3 PoseAt(double t)
+{
+  const Matrix3d R = kR0 * AngleAxisd(kOmega.norm() * t, kOmega.normalized()).toRotationMatrix();
+  return gtsam::Pose3(gtsam::Rot3(R), gtsam::Point3(std::sin(t), 0.2 * t * t, 0.5 * std::cos(2 * t)));
+}
+
+
+static Vector3d VelocityAt(double t)
+{
+  return Vector3d(std::cos(t), 0.4 * t, -std::sin(2 * t));
+}
+
+
+static Vector3d AccelerationAt(double t)
+{
+  return Vector3d(-std::sin(t), 0.4, -2 * std::cos(2 * t));
+}
+
+
+TEST(ViInitializerTest, TestSolve)
+{
+  const Vector3d gyro_bias(0.01, -0.005, 0.02);
+
+  ImuManager::Params imu_params;
+  imu_params.max_queue_size = 2000;
+  ImuManager imu_manager(imu_params);
+  const double imu_dt = 0.002;
+  for (int i = 0; i <= 1200; ++i) {
+    const double t = imu_dt * i;
+    const Matrix3d R = PoseAt(t).rotation().matrix();
+    const Vector3d a = R.transpose() * (AccelerationAt(t) - kGravity);
+    imu_manager.Push(ImuMeasurement(ConvertToNanoseconds(t), kOmega + gyro_bias, a));
+  }
+
+  ViInitializer::Params params;
+  params.window_sec = 1.5;
+  ViInitializer vi_init(params);
+
+  // Keyframes every 0.4 sec, with perfect VO.
+  vi_init.Reset(0.0);
+  for (int k = 1; k <= 4; ++k) {
+    EXPECT_FALSE(vi_init.Ready());
+    const double t0 = 0.4 * (k - 1);
+    const double t1 = 0.4 * k;
+    const PimResult pim = imu_manager.Preintegrate(t0, t1, 0.01);
+    ASSERT_TRUE(pim.timestamps_aligned);
+    vi_init.AddKeyframe(t1, PoseAt(t0).between(PoseAt(t1)), pim.pim);
+  }
+  ASSERT_TRUE(vi_init.Ready());
+  EXPECT_EQ(5, vi_init.NumKeyframes());
+
+  ViInitResult result;
+  ASSERT_TRUE(vi_init.Solve(result));
+  EXPECT_NEAR(1.6, result.timestamp, 1e-9);
+  EXPECT_LT((result.imu_bias.gyroscope() - gyro_bias).norm(), 1e-3);
+  EXPECT_LT(result.gravity_err, 0.01);
+
+  // Everything is in the frame of the first keyframe.
+  const gtsam::Pose3 b0_P_body = PoseAt(0).between(PoseAt(1.6));
+  EXPECT_TRUE(result.b0_P_body.equals(b0_P_body, 1e-9));
+  EXPECT_LT((result.b0_gravity - kR0.transpose() * kGravity).norm(), 0.05);
+  EXPECT_LT((result.b0_v_body - kR0.transpose() * VelocityAt(1.6)).norm(), 0.05);
+
+  // Gravity alignment fixes the roll and pitch of a bad initial attitude.
+  const gtsam::Rot3 world_R_b0 = ViInitializer::AlignGravity(gtsam::Rot3(), result.b0_gravity, kGravity);
+  EXPECT_LT((world_R_b0.matrix() * result.b0_gravity - kGravity).norm(), 1e-6);
+  EXPECT_LT((world_R_b0.matrix() * kR0.transpose() * kGravity - kGravity).norm(), 0.05);
+}
+
+
+TEST(ViInitializerTest, TestRejectBadVo)
+{
+  ImuManager imu_manager((ImuManager::Params()));
+  for (int i = 0; i <= 600; ++i) {
+    imu_manager.Push(ImuMeasurement(ConvertToNanoseconds(0.002 * i), Vector3d::Zero(), -kGravity));
+  }
+
+  ViInitializer::Params params;
+  ViInitializer vi_init(params);
+
+  // The IMU is at rest, but VO says that the vehicle moved 1m, then 2m, then 3m (every 0.4 sec). That
+  // acceleration has to come from somewhere, so gravity comes out way stronger than 9.81 m/s^2.
+  vi_init.Reset(0.0);
+  for (int k = 1; k <= 3; ++k) {
+    const PimResult pim = imu_manager.Preintegrate(0.4 * (k - 1), 0.4 * k, 0.01);
+    ASSERT_TRUE(pim.timestamps_aligned);
+    vi_init.AddKeyframe(0.4 * k, gtsam::Pose3(gtsam::Rot3(), gtsam::Point3(k, 0, 0)), pim.pim);
+  }
+  ASSERT_TRUE(vi_init.Ready());
+
+  ViInitResult result;
+  EXPECT_FALSE(vi_init.Solve(result));
+}
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/color_mapping.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ColorMappingTest, TestLutMatchesOpenCV)
+{
+  cv::Mat1b ramp(1, 256);
+  for (int i = 0; i < 256; ++i) {
+    ramp(0, i) = static_cast<uint8_t>(i);
+  }
+  cv::Mat3b expected;
+  cv::applyColorMap(ramp, expected, cv::COLORMAP_PARULA);
+
+  const ColormapLut& lut = GetColormapLut(cv::COLORMAP_PARULA);
+  for (int i = 0; i < 256; ++i) {
+    EXPECT_EQ(expected(0, i), lut[i]);
+    EXPECT_EQ(expected(0, i), lut.Map(i, 0, 255));
+  }
+
+  // The table is only built once.
+  EXPECT_EQ(&lut, &GetColormapLut(cv::COLORMAP_PARULA));
+}
+
+
+TEST(ColorMappingTest, TestRange)
+{
+  const ColormapLut& lut = GetColormapLut(cv::COLORMAP_JET);
+
+  EXPECT_EQ(lut[0], lut.Map(10.0, 10.0, 20.0));
+  EXPECT_EQ(lut[255], lut.Map(20.0, 10.0, 20.0));
+  EXPECT_EQ(lut[128], lut.Map(15.0, 10.0, 20.0));
+
+  // Clamped to the ends.
+  EXPECT_EQ(lut[0], lut.Map(-100.0, 10.0, 20.0));
+  EXPECT_EQ(lut[255], lut.Map(100.0, 10.0, 20.0));
+
+  // More values than fit in one chunk.
+  std::vector<double> values(1000);
+  for (size_t i = 0; i < values.size(); ++i) {
+    values.at(i) = 10.0 + 10.0 * i / (values.size() - 1);
+  }
+  const std::vector<cv::Vec3b> colors = ColormapVector(values, 10.0, 20.0, cv::COLORMAP_JET);
+  ASSERT_EQ(values.size(), colors.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(lut.Map(values.at(i), 10.0, 20.0), colors.at(i));
+  }
+  EXPECT_EQ(lut[0], colors.front());
+  EXPECT_EQ(lut[255], colors.back());
+}
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/foreground_mask.hpp"
+#include "vision_core/image_cache.hpp"
+#include "vision_core/image_frame.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Left half flat, right half a checkerboard (lots of texture).
+static Image1b MakeHalfTextured()
+{
+  Image1b gray(64, 80, static_cast<uchar>(128));
+  for (int v = 0; v < gray.rows; ++v) {
+    for (int u = gray.cols / 2; u < gray.cols; ++u) {
+      gray(v, u) = ((u / 4 + v / 4) % 2) ? 255 : 0;
+    }
+  }
+  return gray;
+}
+
+
+TEST(ImageCacheTest, TestForegroundMask)
+{
+  const Image1b gray = MakeHalfTextured();
+
+  Image1b expected;
+  ForegroundTextureMask(gray, expected, 7, 35.0, 2);
+  EXPECT_EQ(0, expected(32, 5));
+  EXPECT_EQ(255, expected(32, 60));
+
+  ImageCache cache;
+  const Image1b mask = cache.ForegroundMask(gray, 7, 35.0, 2);
+  EXPECT_EQ(0, cv::countNonZero(mask != expected));
+
+  // Same arguments give back the same (cached) buffer.
+  EXPECT_EQ(mask.data, cache.ForegroundMask(gray, 7, 35.0, 2).data);
+
+  // Different arguments recompute.
+  const Image1b no_downsize = cache.ForegroundMask(gray, 7, 35.0, 1);
+  ForegroundTextureMask(gray, expected, 7, 35.0, 1);
+  EXPECT_EQ(0, cv::countNonZero(no_downsize != expected));
+}
+
+
+TEST(ImageCacheTest, TestPyramid)
+{
+  const Image1b gray = MakeHalfTextured();
+  ImageCache cache;
+
+  const std::vector<Image1b> pyr = cache.Pyramid(gray, 3);
+  ASSERT_EQ(3ul, pyr.size());
+  EXPECT_EQ(gray.data, pyr.at(0).data);
+  EXPECT_EQ(cv::Size(40, 32), pyr.at(1).size());
+  EXPECT_EQ(cv::Size(20, 16), pyr.at(2).size());
+
+  // Fewer levels reuse the ones that were already computed.
+  EXPECT_EQ(pyr.at(1).data, cache.Pyramid(gray, 2).at(1).data);
+
+  const std::vector<Image1f> grad = cache.GradientPyramid(gray, 3);
+  ASSERT_EQ(3ul, grad.size());
+  EXPECT_EQ(pyr.at(2).size(), grad.at(2).size());
+  EXPECT_FLOAT_EQ(0.0f, grad.at(0)(32, 5));
+  EXPECT_GT(grad.at(0)(32, 60), 0.0f);
+}
+
+
+TEST(ImageCacheTest, TestSourceChanged)
+{
+  const Image1b gray = MakeHalfTextured();
+  ImageCache cache;
+  const Image1b mask = cache.ForegroundMask(gray, 7, 35.0, 2);
+
+  // A different image (e.g a resized frame) doesn't get the stale mask.
+  Image1b small;
+  cv::resize(gray, small, gray.size() / 2);
+  EXPECT_EQ(small.size(), cache.ForegroundMask(small, 7, 35.0, 2).size());
+  EXPECT_NE(mask.data, cache.ForegroundMask(gray, 7, 35.0, 2).data);
+}
+
+
+TEST(ImageCacheTest, TestSharedAcrossCopies)
+{
+  const Image1b gray = MakeHalfTextured();
+  const StereoImage1b pair(0, 0, gray, gray);
+  const StereoImage1b copy = pair;
+  EXPECT_EQ(pair.cache, copy.cache);
+
+  const Image1b mask = pair.cache->left.ForegroundMask(pair.left_image, 7, 35.0, 2);
+  EXPECT_EQ(mask.data, copy.cache->left.ForegroundMask(copy.left_image, 7, 35.0, 2).data);
+
+  // Gray views of the same frame share a cache too.
+  const ImageFrame::ConstPtr frame = std::make_shared<ImageFrame>(gray);
+  const StereoFrame stereo_frame(0, 0, frame, frame);
+  EXPECT_EQ(GrayView(stereo_frame).cache, GrayView(stereo_frame).cache);
+}
@@ -0,0 +1,118 @@
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "vision_core/image_frame.hpp"
+#include "vision_core/image_util.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static Image3b MakeColorImage()
+{
+  Image3b bgr(48, 64);
+  for (int v = 0; v < bgr.rows; ++v) {
+    for (int u = 0; u < bgr.cols; ++u) {
+      bgr(v, u) = cv::Vec3b(4 * u, 5 * v, (u * v) % 256);
+    }
+  }
+  return bgr;
+}
+
+
+static double MaxAbsDiff(const cv::Mat& a, const cv::Mat& b)
+{
+  cv::Mat diff;
+  cv::absdiff(a, b, diff);
+  double max_diff = 0;
+  cv::minMaxLoc(diff.reshape(1), nullptr, &max_diff);
+  return max_diff;
+}
+
+
+TEST(ImageFrameTest, TestColor)
+{
+  const Image3b bgr = MakeColorImage();
+  const ImageFrame frame(bgr);
+  EXPECT_TRUE(frame.IsColor());
+
+  // The color view is the decoded buffer itself.
+  EXPECT_EQ(bgr.data, frame.Color().data);
+
+  Image1b gray;
+  cv::cvtColor(bgr, gray, cv::COLOR_BGR2GRAY);
+  EXPECT_EQ(0, MaxAbsDiff(gray, frame.Gray()));
+
+  // Same as the separate conversions, which each make a full pass.
+  const Image3f bgr_float = CastImage3bTo3f(bgr);
+  EXPECT_LT(MaxAbsDiff(bgr_float, frame.ColorFloat()), 1e-6);
+  EXPECT_LT(MaxAbsDiff(ComputeIntensity(bgr_float), frame.Intensity()), 1e-5);
+
+  // Views are cached.
+  EXPECT_EQ(frame.Gray().data, frame.Gray().data);
+  EXPECT_EQ(frame.Intensity().data, frame.Intensity().data);
+}
+
+
+TEST(ImageFrameTest, TestGray)
+{
+  Image1b gray;
+  cv::cvtColor(MakeColorImage(), gray, cv::COLOR_BGR2GRAY);
+  const ImageFrame frame(gray);
+  EXPECT_FALSE(frame.IsColor());
+
+  // The gray view is the decoded buffer itself.
+  EXPECT_EQ(gray.data, frame.Gray().data);
+
+  Image1f intensity;
+  gray.convertTo(intensity, CV_32FC1, 1.0 / 255.0);
+  EXPECT_LT(MaxAbsDiff(intensity, frame.Intensity()), 1e-6);
+
+  EXPECT_EQ(3, frame.Color().channels());
+  EXPECT_EQ(gray.size(), frame.Color().size());
+}
+
+
+TEST(ImageFrameTest, TestConcurrentViews)
+{
+  const ImageFrame::ConstPtr frame = std::make_shared<ImageFrame>(MakeColorImage());
+
+  std::vector<const uint8_t*> gray(4), intensity(4);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&, i]()
+    {
+      gray.at(i) = frame->Gray().data;
+      intensity.at(i) = frame->Intensity().data;
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+
+  // Every thread got the same (computed once) views.
+  for (size_t i = 1; i < 4; ++i) {
+    EXPECT_EQ(gray.at(0), gray.at(i));
+    EXPECT_EQ(intensity.at(0), intensity.at(i));
+  }
+}
+
+
+TEST(ImageFrameTest, TestStereoViews)
+{
+  const Image3b bgr = MakeColorImage();
+  const StereoFrame pair(123, 7, std::make_shared<ImageFrame>(bgr), std::make_shared<ImageFrame>(bgr));
+
+  const StereoImage1b gray = GrayView(pair);
+  EXPECT_EQ(123ul, gray.timestamp);
+  EXPECT_EQ(7ul, gray.camera_id);
+  EXPECT_EQ(pair.left_image->Gray().data, gray.left_image.data);
+
+  const StereoImage3b color = ColorView(pair);
+  EXPECT_EQ(bgr.data, color.left_image.data);
+  EXPECT_EQ(bgr.data, color.right_image.data);
+}
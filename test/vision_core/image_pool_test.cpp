@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include "vision_core/image_pool.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ImagePoolTest, TestRecycle)
+{
+  ImagePool pool(2);
+
+  cv::Mat a = pool.Get(480, 640, CV_8UC1);
+  const uchar* a_data = a.data;
+  EXPECT_EQ(1ul, pool.NumBuffersInUse());
+
+  // Releasing the last copy gives the buffer back to the pool.
+  cv::Mat a_copy = a;
+  a.release();
+  EXPECT_EQ(1ul, pool.NumBuffersInUse());
+  a_copy.release();
+  EXPECT_EQ(0ul, pool.NumBuffersInUse());
+
+  cv::Mat b = pool.Get(480, 640, CV_8UC1);
+  EXPECT_EQ(a_data, b.data);
+  EXPECT_EQ(1ul, pool.NumAllocations());
+
+  // Different shapes and types get their own buffers.
+  cv::Mat c = pool.Get(480, 640, CV_8UC3);
+  cv::Mat d = pool.Get(240, 320, CV_8UC1);
+  EXPECT_NE(b.data, c.data);
+  EXPECT_EQ(3ul, pool.NumBuffers());
+  EXPECT_EQ(480ul * 640 * 4 + 240 * 320, pool.Bytes());
+}
+
+
+TEST(ImagePoolTest, TestFull)
+{
+  ImagePool pool(2);
+
+  cv::Mat a = pool.Get(10, 10, CV_8UC1);
+  cv::Mat b = pool.Get(10, 10, CV_8UC1);
+  EXPECT_EQ(0ul, pool.NumUnpooled());
+
+  // Past max_per_shape, images are still allocated, but they aren't kept.
+  cv::Mat c = pool.Get(10, 10, CV_8UC1);
+  EXPECT_EQ(1ul, pool.NumUnpooled());
+  EXPECT_EQ(2ul, pool.NumBuffers());
+  EXPECT_EQ(3ul, pool.NumAllocations());
+
+  a.release();
+  b.release();
+  pool.Trim();
+  EXPECT_EQ(0ul, pool.NumBuffers());
+}
@@ -0,0 +1,97 @@
+#include <cmath>
+#include <limits>
+
+#include <gtest/gtest.h>
+
+#include "vision_core/viz_tap.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static int CountColor(const Image3b& img, const cv::Vec3b& color)
+{
+  int count = 0;
+  for (int v = 0; v < img.rows; ++v) {
+    for (int u = 0; u < img.cols; ++u) {
+      count += (img(v, u) == color) ? 1 : 0;
+    }
+  }
+  return count;
+}
+
+
+TEST(VizTapTest, TestRenderPoint)
+{
+  const cv::Vec3b red(0, 0, 255);
+
+  DrawList list;
+  list.background = Image1b::zeros(64, 64);
+  list.points.push_back({ cv::Point2f(32, 32), red, 4 });
+
+  Image3b out;
+  RenderDrawList(list, out);
+  ASSERT_EQ(64, out.rows);
+  ASSERT_EQ(64, out.cols);
+
+  EXPECT_GT(CountColor(out, red), 16);
+  EXPECT_EQ(cv::Vec3b(0, 0, 0), out(32, 32));
+
+  // Every pixel of the outline is about 4px from the center.
+  for (int v = 0; v < out.rows; ++v) {
+    for (int u = 0; u < out.cols; ++u) {
+      if (out(v, u) == red) {
+        const double r = std::hypot(u - 32, v - 32);
+        EXPECT_NEAR(4.0, r, 0.75) << u << " " << v;
+      }
+    }
+  }
+}
+
+
+TEST(VizTapTest, TestRenderLine)
+{
+  const cv::Vec3b green(0, 255, 0);
+
+  DrawList list;
+  list.background = Image1b::zeros(64, 64);
+  list.lines.push_back({ cv::Point2f(5, 5), cv::Point2f(50, 20), green, false });
+
+  Image3b out;
+  RenderDrawList(list, out);
+
+  // An 8-connected line has one pixel per step along its major axis.
+  EXPECT_EQ(46, CountColor(out, green));
+  EXPECT_EQ(green, out(5, 5));
+  EXPECT_EQ(green, out(20, 50));
+
+  // Re-rendering into the same buffer doesn't reallocate it.
+  const uint8_t* data = out.data;
+  RenderDrawList(list, out);
+  EXPECT_EQ(data, out.data);
+}
+
+
+TEST(VizTapTest, TestRenderClipped)
+{
+  const cv::Vec3b blue(255, 0, 0);
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+
+  DrawList list;
+  list.background = Image1b::zeros(32, 32);
+  list.points.push_back({ cv::Point2f(-100, 10), blue, 4 });
+  list.points.push_back({ cv::Point2f(nan, 10), blue, 4 });
+  list.points.push_back({ cv::Point2f(1, 1), blue, 3 });
+  list.lines.push_back({ cv::Point2f(-1e9, 16), cv::Point2f(1e9, 16), blue, true });
+  list.lines.push_back({ cv::Point2f(-50, 16), cv::Point2f(100, 16), blue, true });
+  list.lines.push_back({ cv::Point2f(10, nan), cv::Point2f(20, 20), blue, false });
+
+  Image3b out;
+  RenderDrawList(list, out);
+
+  // The line across the image is clipped to it, and the point in the corner is partly drawn.
+  for (int u = 0; u < out.cols; ++u) {
+    EXPECT_EQ(blue, out(16, u));
+  }
+  EXPECT_EQ(blue, out(1, 4));
+}